@@ -5,21 +5,55 @@
 
 CommandCaller::CommandCaller( const QByteArray &command, QObject *parent )
     : QLocalSocket( parent )
+{
+    if ( !connectIpc() )
+        return;
+
+    // send command
+    QLocalSocket::write( command );
+    QLocalSocket::flush();
+    QLocalSocket::close();
+}
+
+CommandCaller::CommandCaller( QObject *parent )
+    : QLocalSocket( parent )
+{
+    connectIpc();
+}
+
+bool CommandCaller::send( const QByteArray &data )
+{
+    if ( state() != QLocalSocket::ConnectedState )
+        return false;
+
+    QLocalSocket::write( data );
+
+    // there's no event loop to write it later
+    while ( bytesToWrite() > 0 )
+    {
+        if ( !QLocalSocket::waitForBytesWritten() )
+        {
+            qDebug() << "error: failed to send command:" << QLocalSocket::errorString();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool CommandCaller::connectIpc()
 {
     // open ipc
     const QString ipc_path = Global::getIPCPath();
     QLocalSocket::connectToServer( ipc_path );
     QLocalSocket::waitForConnected();
 
-    // send command
-    if ( state() == QLocalSocket::ConnectedState )
-    {
-        QLocalSocket::write( command );
-        QLocalSocket::flush();
-        QLocalSocket::close();
-    }
-    else // abort if we didn't connect
+    // abort if we didn't connect
+    if ( state() != QLocalSocket::ConnectedState )
     {
         qDebug() << "error: failed to send command:" << QLocalSocket::errorString();
+        return false;
     }
+
+    return true;
 }
@@ -9,7 +9,13 @@ class CommandCaller : public QLocalSocket
     Q_OBJECT
 
 public:
-    explicit CommandCaller( const QByteArray &command, QObject *parent = nullptr );
+    explicit CommandCaller( const QByteArray &command, QObject *parent = nullptr ); // sends it and closes
+    explicit CommandCaller( QObject *parent = nullptr ); // stays connected for send()
+
+    bool send( const QByteArray &data ); // false if the connection is gone
+
+private:
+    bool connectIpc();
 };
 
 #endif // COMMANDCALLER_H
@@ -1,8 +1,114 @@
 #include "commandcaller.h"
+#include "../daemon/global.h"
+#include "../daemon/ipcprotocol.h"
 
 #include <QCoreApplication>
 #include <QString>
 #include <QByteArray>
+#include <QHash>
+#include <QFile>
+#include <QTextStream>
+
+#include <algorithm>
+
+static const int BULK_COMMANDS_PER_FRAME = 1000;
+
+static QHash<QString, qint32> getCommandIds()
+{
+    QHash<QString, qint32> ids;
+    for ( qint32 i = 0; i < IPC_COMMAND_COUNT; i++ )
+        ids.insert( QLatin1String( IPC_COMMAND_NAMES[ i ] ), i );
+
+    return ids;
+}
+
+static qint8 getEngineType( const QString &exchange )
+{
+    const QString name = exchange.toLower();
+    return name == "bittrex"  ? ENGINE_BITTREX :
+           name == "binance"  ? ENGINE_BINANCE :
+           name == "poloniex" ? ENGINE_POLONIEX :
+           name == "waves"    ? ENGINE_WAVES :
+                                -1;
+}
+
+// adds one command line to the frame, false if it's blank or unknown
+static bool addCommandLine( IpcFrameWriter &frame, const QHash<QString, qint32> &ids, const QString &line )
+{
+    const QStringList args = line.split( QChar( ' ' ), QString::SkipEmptyParts );
+    if ( args.isEmpty() )
+        return false;
+
+    const qint32 id = ids.value( args.first().toLower(), -1 );
+    if ( id < 0 )
+    {
+        qDebug() << "error: unknown command:" << args.first();
+        return false;
+    }
+
+    frame.addCommand( id, quint8( std::min( args.size() -1, 0xFF ) ) );
+    for ( int i = 1; i < args.size() && i <= 0xFF; i++ )
+        frame.addString( args.at( i ) );
+
+    return true;
+}
+
+// reads commands from stdin, one per line, and packs them into binary frames for the engine
+static QByteArray readBulkCommands( const quint8 engine_type )
+{
+    const QHash<QString, qint32> ids = getCommandIds();
+
+    QByteArray out( IPC_BINARY_MAGIC, IPC_BINARY_MAGIC_SIZE );
+    IpcFrameWriter frame( engine_type );
+
+    QFile in_file;
+    in_file.open( stdin, QIODevice::ReadOnly | QIODevice::Text );
+    QTextStream in( &in_file );
+
+    while ( !in.atEnd() )
+    {
+        addCommandLine( frame, ids, in.readLine() );
+
+        if ( frame.getCommandCount() >= BULK_COMMANDS_PER_FRAME )
+        {
+            out += frame.finish();
+            frame = IpcFrameWriter( engine_type );
+        }
+    }
+
+    if ( frame.getCommandCount() > 0 )
+        out += frame.finish();
+
+    return out;
+}
+
+// keeps one connection open and sends each line on stdin as it comes in, until stdin closes
+static int runSession( const quint8 engine_type )
+{
+    CommandCaller c;
+    if ( !c.send( QByteArray( IPC_BINARY_MAGIC, IPC_BINARY_MAGIC_SIZE ) ) )
+        return 1;
+
+    const QHash<QString, qint32> ids = getCommandIds();
+
+    QFile in_file;
+    in_file.open( stdin, QIODevice::ReadOnly | QIODevice::Text );
+    QTextStream in( &in_file );
+
+    QString line;
+    while ( in.readLineInto( &line ) )
+    {
+        IpcFrameWriter frame( engine_type );
+        if ( !addCommandLine( frame, ids, line ) )
+            continue;
+
+        if ( !c.send( frame.finish() ) )
+            return 1;
+    }
+
+    c.close();
+    return 0;
+}
 
 int main( int argc, char *argv[] )
 {
@@ -14,6 +120,24 @@ int main( int argc, char *argv[] )
     // strip binary name
     args.removeFirst();
 
+    // -b <exchange>: send the commands on stdin in bulk, through the binary protocol
+    // -i <exchange>: the same a line at a time over one connection, for scripts that keep trader-cli open
+    if ( args.size() == 2 && ( args.first() == "-b" || args.first() == "-i" ) )
+    {
+        const qint8 engine_type = getEngineType( args.at( 1 ) );
+        if ( engine_type < 0 )
+        {
+            qDebug() << "error: unknown exchange:" << args.at( 1 );
+            return 1;
+        }
+
+        if ( args.first() == "-i" )
+            return runSession( quint8( engine_type ) );
+
+        CommandCaller c( readBulkCommands( quint8( engine_type ) ) );
+        return 0;
+    }
+
     // form arguments for command caller
     QString joined = args.join( QChar( ' ' ) );
 
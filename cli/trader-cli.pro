@@ -13,5 +13,6 @@ SOURCES += commandcaller.cpp \
         main.cpp
 
 HEADERS += \
-    commandcaller.h
+    commandcaller.h \
+    ../daemon/ipcprotocol.h
 
@@ -2,6 +2,37 @@
 #include "position.h"
 #include "global.h"
 
+#include <QtEndian>
+
+#include <cstring>
+
+// the vwap of one side
+static Coin getAvgPrice( const AlphaData &d )
+{
+    return d.trades == 0 ? Coin() : d.vp / d.v;
+}
+
+// sell vwap / buy vwap
+static Coin getAlpha( const AlphaData &buy_data, const AlphaData &sell_data )
+{
+    const Coin sell_price = getAvgPrice( sell_data );
+    const Coin buy_price = getAvgPrice( buy_data );
+
+    if ( buy_price.isZeroOrLess() || sell_price.isZeroOrLess() )
+        return Coin();
+
+    return ( sell_price / buy_price );
+}
+
+// small side volume / big side volume
+static Coin getAlphaSignificanceFactor( const AlphaData &buy_data, const AlphaData &sell_data )
+{
+    const Coin lo = std::min( buy_data.v, sell_data.v );
+    const Coin hi = std::max( buy_data.v, sell_data.v );
+
+    return ( hi.isGreaterThanZero() ) ? lo / hi : Coin();
+}
+
 AlphaTracker::AlphaTracker()
 {
 }
@@ -10,42 +41,101 @@ void AlphaTracker::reset()
 {
     buys.clear();
     sells.clear();
+    buy_buckets.clear();
+    sell_buckets.clear();
     daily_volume_epoch_secs = 0;
     daily_volume.clear();
+    daily_volume_sums.clear();
+
+    // the journal on disk follows stats that are gone now
+    startJournal();
+    needs_snapshot = true;
 }
 
-void AlphaTracker::addAlpha( const QString &market, const quint8 side, const Coin &amount, const Coin &price )
+void AlphaTracker::addAlpha( const QString &market, const quint8 side, const Coin &amount, const Coin &price, const qint64 time_ms )
+{
+    applyAlpha( market, side, amount, price, time_ms );
+    journalRecord( ALPHA_JOURNAL_ALPHA, side, market, time_ms, amount, price );
+}
+
+void AlphaTracker::applyAlpha( const QString &market, const quint8 side, const Coin &amount, const Coin &price, const qint64 time_ms )
 {
     QMap<QString,AlphaData> &map = side == SIDE_BUY ? buys : sells;
     AlphaData &d = map[ market ];
 
     // for each trade, v += volume, and vp += volume * price
+    const Coin vp = amount * price;
     d.v += amount;
-    d.vp += amount * price;
+    d.vp += vp;
 
     d.trades++;
+
+    // the bucket for this hour, an old one in the slot starts over
+    QVector<AlphaBucket> &ring = ( side == SIDE_BUY ? buy_buckets : sell_buckets )[ market ];
+    if ( ring.isEmpty() )
+        ring.resize( ALPHA_BUCKET_COUNT );
+
+    const qint64 hour = time_ms / ALPHA_BUCKET_MS;
+    AlphaBucket &bucket = ring[ int( hour % ALPHA_BUCKET_COUNT ) ];
+
+    if ( bucket.hour != hour )
+    {
+        bucket.hour = hour;
+        bucket.data = AlphaData();
+    }
+
+    bucket.data.v += amount;
+    bucket.data.vp += vp;
+    bucket.data.trades++;
 }
 
-Coin AlphaTracker::getAlpha( const QString &market ) const
+AlphaData AlphaTracker::getWindow( const QString &market, const quint8 side, const qint32 window_hours, const qint64 current_time_ms ) const
 {
-    const Coin sell_price = getAvgPrice( market, SIDE_SELL );
-    const Coin buy_price = getAvgPrice( market, SIDE_BUY );
+    AlphaData ret;
 
-    if ( buy_price.isZeroOrLess() || sell_price.isZeroOrLess() )
-        return Coin();
+    const QMap<QString,QVector<AlphaBucket>> &rings = side == SIDE_BUY ? buy_buckets : sell_buckets;
+    const QMap<QString,QVector<AlphaBucket>>::const_iterator i = rings.find( market );
+    if ( i == rings.end() )
+        return ret;
 
-    return ( sell_price / buy_price );
+    // sum the buckets stamped with an hour inside the window, the rest are left over from earlier laps
+    const qint64 current_hour = current_time_ms / ALPHA_BUCKET_MS;
+    const qint64 first_hour = current_hour - qBound( 1, window_hours, ALPHA_BUCKET_COUNT ) +1;
+
+    const QVector<AlphaBucket> &ring = i.value();
+    for ( QVector<AlphaBucket>::const_iterator j = ring.begin(); j != ring.end(); j++ )
+    {
+        if ( j->hour < first_hour || j->hour > current_hour )
+            continue;
+
+        ret.v += j->data.v;
+        ret.vp += j->data.vp;
+        ret.trades += j->data.trades;
+    }
+
+    return ret;
 }
 
-Coin AlphaTracker::getAlphaSignificanceFactor( const QString &market ) const
+Coin AlphaTracker::getAlpha( const QString &market, const qint32 window_hours, const qint64 current_time_ms ) const
 {
-    const Coin buy_vol = getVolume( SIDE_BUY, market );
-    const Coin sell_vol = getVolume( SIDE_SELL, market );
+    return ::getAlpha( getWindow( market, SIDE_BUY, window_hours, current_time_ms ),
+                       getWindow( market, SIDE_SELL, window_hours, current_time_ms ) );
+}
 
-    const Coin lo = std::min( buy_vol, sell_vol );
-    const Coin hi = std::max( buy_vol, sell_vol );
+Coin AlphaTracker::getVolume( const QString &market, const qint32 window_hours, const qint64 current_time_ms ) const
+{
+    return getWindow( market, SIDE_BUY, window_hours, current_time_ms ).v +
+           getWindow( market, SIDE_SELL, window_hours, current_time_ms ).v;
+}
 
-    return ( hi.isGreaterThanZero() ) ? lo / hi : Coin();
+Coin AlphaTracker::getAlpha( const QString &market ) const
+{
+    return ::getAlpha( buys.value( market ), sells.value( market ) );
+}
+
+Coin AlphaTracker::getAlphaSignificanceFactor( const QString &market ) const
+{
+    return ::getAlphaSignificanceFactor( buys.value( market ), sells.value( market ) );
 }
 
 Coin AlphaTracker::getVolume( const QString &market ) const
@@ -72,14 +162,7 @@ Coin AlphaTracker::getVolumePerTrade( const QString &market ) const
 
 Coin AlphaTracker::getAvgPrice( const QString &market, quint8 side ) const
 {
-    if ( side == SIDE_BUY )
-    {
-        const AlphaData &buy_data = buys.value( market );
-        return buy_data.trades == 0 ? Coin() : buy_data.vp / buy_data.v;
-    }
-
-    const AlphaData &sell_data = sells.value( market );
-    return sell_data.trades == 0 ? Coin() : sell_data.vp / sell_data.v;
+    return ::getAvgPrice( side == SIDE_BUY ? buys.value( market ) : sells.value( market ) );
 }
 
 quint64 AlphaTracker::getTrades( const QString &market ) const
@@ -89,37 +172,117 @@ quint64 AlphaTracker::getTrades( const QString &market ) const
 
 void AlphaTracker::addDailyVolume( const qint64 epoch_time_secs, const Coin &volume )
 {
-    quint32 days_offset = 0;
+    applyDailyVolume( epoch_time_secs, volume );
+    journalRecord( ALPHA_JOURNAL_DAILY_VOLUME, 0, QString(), epoch_time_secs, volume, Coin() );
+}
+
+void AlphaTracker::applyDailyVolume( const qint64 epoch_time_secs, const Coin &volume )
+{
+    if ( daily_volume_epoch_secs == 0 ) // set the epoch secs to the day at 00:00:00, from the time given so a replayed journal lands on the same day
+        daily_volume_epoch_secs = ( epoch_time_secs / 86400 ) * 86400;
 
-    if ( daily_volume_epoch_secs == 0 ) // set the epoch secs to the current day at 00:00:00
-        daily_volume_epoch_secs = ( QDateTime::currentSecsSinceEpoch() / 86400 ) * 86400;
-    else // calculate how many days in from daily_volume_start epoch_time_secs is at
-        days_offset = ( epoch_time_secs - daily_volume_epoch_secs ) / 86400;
+    // calculate how many days in from daily_volume_start epoch_time_secs is at
+    const qint32 days_offset = std::max( getDailyVolumeDay( epoch_time_secs ), 0 );
+    resizeDailyVolume( days_offset +1 );
 
-    // add volume
+    // add volume, the sums after it move up too. fills land on the last day, so that's only the final sum
     daily_volume[ days_offset ] += volume;
+    for ( int i = days_offset +1; i < daily_volume_sums.size(); i++ )
+        daily_volume_sums[ i ] += volume;
+}
+
+void AlphaTracker::resizeDailyVolume( const qint32 days )
+{
+    if ( daily_volume.size() >= days )
+        return;
+
+    if ( daily_volume_sums.isEmpty() )
+        daily_volume_sums.append( Coin() );
+
+    // the new days are empty, so their sums are the total so far
+    const int old_days = daily_volume.size();
+    const Coin total = daily_volume_sums.last();
+    daily_volume.resize( days );
+    daily_volume_sums.resize( days +1 );
+
+    for ( int i = old_days +1; i <= days; i++ )
+        daily_volume_sums[ i ] = total;
+}
+
+qint32 AlphaTracker::getDailyVolumeDay( const qint64 epoch_time_secs ) const
+{
+    // floor, so a time before the epoch is a negative day
+    const qint64 delta = epoch_time_secs - daily_volume_epoch_secs;
+    return qint32( delta >= 0 ? delta / 86400 : ( delta - 86399 ) / 86400 );
+}
+
+Coin AlphaTracker::getDailyVolume( qint32 first_day, qint32 last_day ) const
+{
+    first_day = std::max( first_day, 0 );
+    last_day = std::min( last_day, daily_volume.size() -1 );
+
+    if ( first_day > last_day )
+        return Coin();
+
+    return daily_volume_sums.at( last_day +1 ) - daily_volume_sums.at( first_day );
+}
+
+Coin AlphaTracker::getDailyVolume( const qint32 days, const qint64 current_time_secs ) const
+{
+    const qint32 today = getDailyVolumeDay( current_time_secs );
+    return getDailyVolume( today - days +1, today );
 }
 
 void AlphaTracker::printAlpha() const
 {
-    Coin total_volume, estimated_pl;
+    printAlpha( getMarkets(), buys, sells );
+}
+
+void AlphaTracker::printAlpha( const qint32 window_hours, const qint64 current_time_ms ) const
+{
+    QMap<QString,AlphaData> buy_data, sell_data;
+    QList<QString> markets;
+
     const QList<QString> keys = getMarkets();
     for ( QList<QString>::const_iterator i = keys.begin(); i != keys.end(); i++ )
+    {
+        const AlphaData buy = getWindow( *i, SIDE_BUY, window_hours, current_time_ms );
+        const AlphaData sell = getWindow( *i, SIDE_SELL, window_hours, current_time_ms );
+
+        if ( buy.trades == 0 && sell.trades == 0 )
+            continue;
+
+        markets += *i;
+        buy_data.insert( *i, buy );
+        sell_data.insert( *i, sell );
+    }
+
+    kDebug() << "alpha for the last" << qBound( 1, window_hours, ALPHA_BUCKET_COUNT ) << "hours:";
+    printAlpha( markets, buy_data, sell_data );
+}
+
+void AlphaTracker::printAlpha( const QList<QString> &markets, const QMap<QString,AlphaData> &buy_data, const QMap<QString,AlphaData> &sell_data ) const
+{
+    Coin total_volume, estimated_pl;
+    for ( QList<QString>::const_iterator i = markets.begin(); i != markets.end(); i++ )
     {
         const QString &market = *i;
-        const Coin volume = getVolume( market );
-        const Coin significance = getAlphaSignificanceFactor( market );
-        const Coin alpha = getAlpha( market );
+        const AlphaData buy = buy_data.value( market );
+        const AlphaData sell = sell_data.value( market );
+        const Coin volume = buy.v + sell.v;
+        const quint64 trades = buy.trades + sell.trades;
+        const Coin significance = ::getAlphaSignificanceFactor( buy, sell );
+        const Coin alpha = ::getAlpha( buy, sell );
 
         kDebug() << QString( "%1 | est_alpha %2 | signif %3 | buy %4 | sell %5 | vol %6 | vol-trade %7 | trades %8" )
                     .arg( market, -MARKET_STRING_WIDTH )
                     .arg( alpha.toString( 4 ), -6 )
                     .arg( significance.toString( 3 ), -5 )
-                    .arg( getAvgPrice( market, SIDE_BUY ), -12 )
-                    .arg( getAvgPrice( market, SIDE_SELL ), -12 )
+                    .arg( ::getAvgPrice( buy ), -12 )
+                    .arg( ::getAvgPrice( sell ), -12 )
                     .arg( volume, -12 )
-                    .arg( getVolumePerTrade( market ), -12 )
-                    .arg( getTrades( market ), -7 );
+                    .arg( trades == 0 ? Coin() : volume / trades, -12 )
+                    .arg( trades, -7 );
 
         // only incorporate volume and alpha into pl if we have buy and sell prices
         if ( alpha.isGreaterThanZero() )
@@ -136,14 +299,30 @@ void AlphaTracker::printAlpha() const
 
 void AlphaTracker::printDailyVolume() const
 {
-    for ( QMap<quint32, Coin>::const_iterator i = daily_volume.begin(); i != daily_volume.end(); i++ )
+    const QDateTime epoch_date = QDateTime::fromSecsSinceEpoch( daily_volume_epoch_secs, Qt::UTC );
+
+    // each day, and the month's total after its last day
+    qint32 month_first_day = 0;
+    for ( int i = 0; i < daily_volume.size(); i++ )
     {
-        const QDateTime iterative_date = QDateTime::fromSecsSinceEpoch( daily_volume_epoch_secs, Qt::UTC ).addDays( i.key() );
+        const QDateTime iterative_date = epoch_date.addDays( i );
 
         kDebug() << QString( "%1 | %2" )
                     .arg( iterative_date.toString( "MM-dd-yyyy" ) )
-                    .arg( i.value() );
+                    .arg( daily_volume.at( i ) );
+
+        if ( i +1 < daily_volume.size() && epoch_date.addDays( i +1 ).date().month() == iterative_date.date().month() )
+            continue;
+
+        kDebug() << QString( "%1 | %2" )
+                    .arg( iterative_date.toString( "MM-yyyy   " ) )
+                    .arg( getDailyVolume( month_first_day, i ) );
+
+        month_first_day = i +1;
     }
+
+    const qint64 current_time_secs = QDateTime::currentSecsSinceEpoch();
+    kDebug() << "last 7 days:" << getDailyVolume( 7, current_time_secs ) << "last 30 days:" << getDailyVolume( 30, current_time_secs );
 }
 
 QString AlphaTracker::getSaveState() const
@@ -171,18 +350,34 @@ QString AlphaTracker::getSaveState() const
                         .arg( d.v.toSubSatoshiString() )
                         .arg( d.vp.toSubSatoshiString() )
                         .arg( d.trades );
+
+            // the hourly buckets, so the recent windows survive a restart
+            const QVector<AlphaBucket> ring = ( side == SIDE_BUY ? buy_buckets : sell_buckets ).value( market );
+            for ( QVector<AlphaBucket>::const_iterator j = ring.begin(); j != ring.end(); j++ )
+            {
+                if ( j->hour < 0 || j->data.trades == 0 )
+                    continue;
+
+                ret += QString( "w %1 %2 %3 %4 %5 %6\n" )
+                            .arg( market )
+                            .arg( side )
+                            .arg( j->hour )
+                            .arg( j->data.v.toSubSatoshiString() )
+                            .arg( j->data.vp.toSubSatoshiString() )
+                            .arg( j->data.trades );
+            }
         }
     }
 
     // save daily volume state
     QString daily_volume_data;
-    for ( QMap<quint32, Coin>::const_iterator i = daily_volume.begin(); i != daily_volume.end(); i++ )
+    for ( QVector<Coin>::const_iterator i = daily_volume.begin(); i != daily_volume.end(); i++ )
     {
         // if there's data, add a space
         if ( daily_volume_data.size() > 0 )
             daily_volume_data += QChar( ' ' );
 
-        daily_volume_data += i.value();
+        daily_volume_data += *i;
     }
 
     // pack data prepended with header and epoch
@@ -217,29 +412,170 @@ void AlphaTracker::readSaveState( const QString &state )
             d.vp = args.at( 4 );
             d.trades = args.at( 5 ).toULongLong();
         }
+        // read an hourly bucket
+        else if ( args.size() == 7 && args.value( 0 ) == "w" )
+        {
+            const QString &market = args.at( 1 );
+            const quint8 side = args.at( 2 ).toUShort();
+            const qint64 hour = args.at( 3 ).toLongLong();
+
+            QVector<AlphaBucket> &ring = ( side == SIDE_BUY ? buy_buckets : sell_buckets )[ market ];
+            if ( ring.isEmpty() )
+                ring.resize( ALPHA_BUCKET_COUNT );
+
+            AlphaBucket &bucket = ring[ int( hour % ALPHA_BUCKET_COUNT ) ];
+
+            // keep the newer one if two hours share a slot
+            if ( bucket.hour > hour )
+                continue;
+
+            bucket.hour = hour;
+            bucket.data.v = args.at( 4 );
+            bucket.data.vp = args.at( 5 );
+            bucket.data.trades = args.at( 6 ).toULongLong();
+        }
         // read daily volume data
         else if ( args.size() > 2 && args.value( 0 ) == "dv" )
         {
             // read epoch secs
             daily_volume_epoch_secs = args.at( 1 ).toLongLong();
-            qint64 epoch_secs_delta = daily_volume_epoch_secs;
 
             // read daily volume sequentially
-            qint64 j;
-            for ( j = 2; j < args.size(); j++ )
+            daily_volume.clear();
+            daily_volume_sums.clear();
+            resizeDailyVolume( args.size() -2 );
+
+            for ( int j = 2; j < args.size(); j++ )
             {
-                daily_volume.insert( j -2, args.at( j ) );
-                epoch_secs_delta += 60 * 60 * 24;
+                daily_volume[ j -2 ] = args.at( j );
+                daily_volume_sums[ j -1 ] = daily_volume_sums.at( j -2 ) + daily_volume.at( j -2 );
             }
 
-            // insert 0 volume for each day between epoch_secs_delta and today's date
-            while ( QDateTime::fromSecsSinceEpoch( epoch_secs_delta ).daysTo( QDateTime::currentDateTime() ) > 0 )
+            // 0 volume for each day up to today's date
+            resizeDailyVolume( getDailyVolumeDay( QDateTime::currentSecsSinceEpoch() ) +1 );
+        }
+    }
+}
+
+void AlphaTracker::journalRecord( const quint8 type, const quint8 side, const QString &market, const qint64 time, const Coin &amount, const Coin &price )
+{
+    // nothing more goes in until the next snapshot covers it
+    if ( needs_snapshot )
+        return;
+
+    qint64 raw_amount = 0, raw_price = 0;
+    if ( !amount.toRawInt64( raw_amount ) || !price.toRawInt64( raw_price ) )
+    {
+        kDebug() << "local warning: stats change too big to journal, the next save takes a snapshot";
+        needs_snapshot = true;
+        return;
+    }
+
+    quint16 market_id = 0;
+    if ( !market.isEmpty() )
+    {
+        market_id = journal_market_ids.value( market, 0 );
+
+        // name the market the first time it's in this file
+        if ( market_id == 0 )
+        {
+            const QByteArray name = market.toUtf8();
+            if ( journal_market_ids.size() >= 0xFFFF || name.size() > 0xFFFF )
             {
-                daily_volume.insert( ++j -2, 0 );
-                epoch_secs_delta += 60 * 60 * 24;
+                needs_snapshot = true;
+                return;
             }
+
+            market_id = quint16( journal_market_ids.size() +1 );
+            journal_market_ids.insert( market, market_id );
+
+            const int offset = journal.size();
+            journal.resize( offset + ALPHA_JOURNAL_RECORD_SIZE + name.size() );
+
+            uchar *p = reinterpret_cast<uchar*>( journal.data() + offset );
+            memset( p, 0, ALPHA_JOURNAL_RECORD_SIZE );
+            p[ 0 ] = ALPHA_JOURNAL_MARKET;
+            qToLittleEndian<quint16>( market_id, p + 2 );
+            qToLittleEndian<quint16>( quint16( name.size() ), p + 4 );
+            memcpy( p + ALPHA_JOURNAL_RECORD_SIZE, name.constData(), size_t( name.size() ) );
+        }
+    }
+
+    const int offset = journal.size();
+    journal.resize( offset + ALPHA_JOURNAL_RECORD_SIZE );
+
+    uchar *p = reinterpret_cast<uchar*>( journal.data() + offset );
+    memset( p, 0, ALPHA_JOURNAL_RECORD_SIZE );
+    p[ 0 ] = type;
+    p[ 1 ] = side;
+    qToLittleEndian<quint16>( market_id, p + 2 );
+    qToLittleEndian<qint64>( time, p + 8 );
+    qToLittleEndian<qint64>( raw_amount, p + 16 );
+    qToLittleEndian<qint64>( raw_price, p + 24 );
+}
+
+QByteArray AlphaTracker::takeJournal()
+{
+    QByteArray ret = journal;
+    journal.clear();
+    return ret;
+}
+
+void AlphaTracker::startJournal()
+{
+    journal.clear();
+    journal_market_ids.clear();
+    needs_snapshot = false;
+}
+
+qint64 AlphaTracker::readJournal( const QByteArray &data )
+{
+    const uchar *start = reinterpret_cast<const uchar*>( data.constData() );
+    const qint64 size = data.size();
+    qint64 position = 0;
+
+    QHash<quint16/*id*/, QString/*market*/> markets;
+
+    // a record cut short by a crash ends the journal
+    while ( position + ALPHA_JOURNAL_RECORD_SIZE <= size )
+    {
+        const uchar *p = start + position;
+        const quint8 type = p[ 0 ];
+        const quint8 side = p[ 1 ];
+        const quint16 market_id = qFromLittleEndian<quint16>( p + 2 );
+
+        if ( type == ALPHA_JOURNAL_MARKET )
+        {
+            const quint16 name_size = qFromLittleEndian<quint16>( p + 4 );
+            if ( position + ALPHA_JOURNAL_RECORD_SIZE + name_size > size )
+                break;
+
+            const QString market = QString::fromUtf8( reinterpret_cast<const char*>( p + ALPHA_JOURNAL_RECORD_SIZE ), name_size );
+            markets.insert( market_id, market );
+            journal_market_ids.insert( market, market_id ); // appends to the same file reuse the ids
+
+            position += ALPHA_JOURNAL_RECORD_SIZE + name_size;
+            continue;
         }
+
+        const qint64 time = qFromLittleEndian<qint64>( p + 8 );
+        const Coin amount = Coin( CoinRaw{ qFromLittleEndian<qint64>( p + 16 ) } );
+        const Coin price = Coin( CoinRaw{ qFromLittleEndian<qint64>( p + 24 ) } );
+
+        if ( type == ALPHA_JOURNAL_ALPHA && markets.contains( market_id ) )
+            applyAlpha( markets.value( market_id ), side, amount, price, time );
+        else if ( type == ALPHA_JOURNAL_DAILY_VOLUME )
+            applyDailyVolume( time, amount );
+        else
+        {
+            kDebug() << "local warning: bad stats journal record at" << position;
+            break;
+        }
+
+        position += ALPHA_JOURNAL_RECORD_SIZE;
     }
+
+    return position;
 }
 
 QList<QString> AlphaTracker::getMarkets() const
@@ -3,6 +3,9 @@
 
 #include "coinamount.h"
 #include <QMap>
+#include <QHash>
+#include <QVector>
+#include <QByteArray>
 
 class Position;
 
@@ -12,6 +15,27 @@ struct AlphaData
     quint64 trades{ 0 };
 };
 
+// the recent windows are summed from hourly buckets, the longest window is a week
+static const qint64 ALPHA_BUCKET_MS = 60 * 60000;
+static const qint32 ALPHA_BUCKET_COUNT = 24 * 7;
+
+struct AlphaBucket
+{
+    qint64 hour{ -1 }; // hours since epoch, the bucket is stale if it isn't in the window
+    AlphaData data;
+};
+
+// the stats journal, the changes since the last stats snapshot. the file starts with the magic and the qint64
+// generation of the snapshot it follows, then fixed size little endian records: quint8 type, quint8 side, quint16
+// market id, quint16 name size, 2 spare bytes, qint64 time, and the raw subsatoshi qint64s of amount and price
+static const char ALPHA_JOURNAL_MAGIC[] = "TRDSTJ01";
+static const qint32 ALPHA_JOURNAL_MAGIC_SIZE = 8;
+static const qint32 ALPHA_JOURNAL_HEADER_SIZE = 16;
+static const qint32 ALPHA_JOURNAL_RECORD_SIZE = 32;
+static const quint8 ALPHA_JOURNAL_MARKET = 1; // names the market id for the rest of the file, the name follows the record
+static const quint8 ALPHA_JOURNAL_ALPHA = 2; // addAlpha(), time in ms
+static const quint8 ALPHA_JOURNAL_DAILY_VOLUME = 3; // addDailyVolume(), time in secs, no price
+
 class AlphaTracker
 {
 public:
@@ -27,28 +51,56 @@ public:
     Coin getVolumePerTrade( const QString &market ) const;
     Coin getAvgPrice( const QString &market, quint8 side ) const;
     quint64 getTrades( const QString &market ) const;
-    void addAlpha( const QString &market, const quint8 side, const Coin &amount, const Coin &price );
+    void addAlpha( const QString &market, const quint8 side, const Coin &amount, const Coin &price, const qint64 time_ms );
+
+    // the same over the last window_hours (1 to ALPHA_BUCKET_COUNT) before current_time_ms
+    AlphaData getWindow( const QString &market, const quint8 side, const qint32 window_hours, const qint64 current_time_ms ) const;
+    Coin getAlpha( const QString &market, const qint32 window_hours, const qint64 current_time_ms ) const;
+    Coin getVolume( const QString &market, const qint32 window_hours, const qint64 current_time_ms ) const;
     //
 
     // "daily volume"
     void addDailyVolume( const qint64 epoch_time_secs, const Coin &volume );
+    qint32 getDailyVolumeDay( const qint64 epoch_time_secs ) const; // the day offset of a time, from daily_volume_epoch_secs
+    Coin getDailyVolume( qint32 first_day, qint32 last_day ) const; // the total of the days from first_day to last_day inclusive
+    Coin getDailyVolume( const qint32 days, const qint64 current_time_secs ) const; // the last days up to and including today
     //
 
     void printAlpha() const;
+    void printAlpha( const qint32 window_hours, const qint64 current_time_ms ) const;
     void printDailyVolume() const;
 
     QString getSaveState() const;
     void readSaveState( const QString &state );
 
+    // the journal records of the changes since the last take, see ALPHA_JOURNAL_MAGIC
+    QByteArray takeJournal();
+    qint64 readJournal( const QByteArray &data ); // replays whole records, returns the bytes read
+    void startJournal(); // for a new journal file, after a snapshot
+    bool needsSnapshot() const { return needs_snapshot; } // a change couldn't be journaled, or the stats were reset
+
+    QList<QString> getMarkets() const; // markets with buys or sells
+
 private:
-    QList<QString> getMarkets() const;
+    void printAlpha( const QList<QString> &markets, const QMap<QString,AlphaData> &buy_data, const QMap<QString,AlphaData> &sell_data ) const;
+    void applyAlpha( const QString &market, const quint8 side, const Coin &amount, const Coin &price, const qint64 time_ms );
+    void applyDailyVolume( const qint64 epoch_time_secs, const Coin &volume );
+    void resizeDailyVolume( const qint32 days );
+    void journalRecord( const quint8 type, const quint8 side, const QString &market, const qint64 time, const Coin &amount, const Coin &price );
 
     // "alpha" data
     QMap<QString,AlphaData> buys, sells;
+    QMap<QString,QVector<AlphaBucket>> buy_buckets, sell_buckets; // ALPHA_BUCKET_COUNT rings, by hour % ALPHA_BUCKET_COUNT
 
     // "daily volume" data
     qint64 daily_volume_epoch_secs{ 0 }; // the date we started recording volume
-    QMap<quint32 /*offset in days from epoch*/, Coin> daily_volume;
+    QVector<Coin> daily_volume; // by offset in days from daily_volume_epoch_secs, every day up to the last one with volume
+    QVector<Coin> daily_volume_sums; // the total of the days before each offset, one longer than daily_volume
+
+    // journal records not taken yet, and the market ids already named in the journal file
+    QByteArray journal;
+    QHash<QString/*market*/, quint16/*id*/> journal_market_ids;
+    bool needs_snapshot{ false };
 };
 
 #endif // ALPHATRACKER_H
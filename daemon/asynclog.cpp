@@ -0,0 +1,312 @@
+#include "asynclog.h"
+#include "threadplacement.h"
+
+#include <QDateTime>
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+static const quint64 SLOT_MASK = LogRing::SLOT_COUNT -1;
+static const qint32 BATCH_MAX = 256 * 1024; // write out before the batch gets bigger than this
+static const qint32 DRAIN_IDLE_MS = 2; // sleep between drains when the ring was empty
+
+LogRing::LogRing()
+    : ring( new Slot[ SLOT_COUNT ] )
+{
+    for ( qint32 i = 0; i < SLOT_COUNT; i++ )
+        ring[ i ].sequence.store( quint64( i ), std::memory_order_relaxed );
+}
+
+LogRing::~LogRing()
+{
+    delete[] ring;
+}
+
+qint64 LogRing::getBufferBytes()
+{
+    return qint64( SLOT_COUNT ) * qint64( sizeof( Slot ) );
+}
+
+bool LogRing::push( const QByteArray &text, const qint64 time, const char *function )
+{
+    const qint32 max_size = SLOT_DATA_SIZE * MAX_SLOTS_PER_MESSAGE;
+    const qint32 size = std::min( text.size(), max_size );
+    const quint64 count = quint64( std::max( ( size + SLOT_DATA_SIZE -1 ) / SLOT_DATA_SIZE, 1 ) );
+
+    // claim count tickets in a row. the reader frees slots in order, so if the last one is free the others are too
+    quint64 pos = head.load( std::memory_order_relaxed );
+    while ( true )
+    {
+        const quint64 last = pos + count -1;
+        const qint64 diff = qint64( ring[ last & SLOT_MASK ].sequence.load( std::memory_order_acquire ) - last );
+
+        if ( diff == 0 )
+        {
+            if ( head.compare_exchange_weak( pos, pos + count, std::memory_order_relaxed ) )
+                break;
+        }
+        else if ( diff < 0 )
+        {
+            // full, the reader hasn't gotten there yet
+            dropped.fetch_add( 1, std::memory_order_relaxed );
+            return false;
+        }
+        else
+        {
+            pos = head.load( std::memory_order_relaxed );
+        }
+    }
+
+    for ( quint64 i = 0; i < count; i++ )
+    {
+        Slot &slot = ring[ ( pos + i ) & SLOT_MASK ];
+        const qint32 offset = qint32( i ) * SLOT_DATA_SIZE;
+
+        slot.size = quint16( size - offset < SLOT_DATA_SIZE ? size - offset : SLOT_DATA_SIZE );
+        memcpy( slot.data, text.constData() + offset, slot.size );
+
+        if ( i == 0 )
+        {
+            slot.time = time;
+            slot.function = function;
+            slot.slot_count = quint16( count );
+        }
+
+        slot.sequence.store( pos + i +1, std::memory_order_release );
+    }
+
+    return true;
+}
+
+bool LogRing::pop( QByteArray &text, qint64 &time, const char *&function )
+{
+    const Slot &first = ring[ tail & SLOT_MASK ];
+    if ( first.sequence.load( std::memory_order_acquire ) != tail +1 )
+        return false;
+
+    // the rest of the message might still be on its way in
+    const quint64 count = first.slot_count;
+    for ( quint64 i = 1; i < count; i++ )
+        if ( ring[ ( tail + i ) & SLOT_MASK ].sequence.load( std::memory_order_acquire ) != tail + i +1 )
+            return false;
+
+    time = first.time;
+    function = first.function;
+    text.resize( 0 );
+
+    for ( quint64 i = 0; i < count; i++ )
+    {
+        Slot &slot = ring[ ( tail + i ) & SLOT_MASK ];
+        text.append( slot.data, slot.size );
+        slot.sequence.store( tail + i + SLOT_COUNT, std::memory_order_release );
+    }
+
+    tail += count;
+    return true;
+}
+
+AsyncLog::AsyncLog()
+    : write_lock( QMutex::Recursive ) // opening the files logs
+{
+    is_running.store( true, std::memory_order_release );
+    thread = std::thread( &AsyncLog::run, this );
+}
+
+AsyncLog::~AsyncLog()
+{
+    is_running.store( false, std::memory_order_release );
+    if ( thread.joinable() )
+        thread.join();
+}
+
+AsyncLog &AsyncLog::getInstance()
+{
+    // never deleted, we log until the very end
+    static AsyncLog *instance = new AsyncLog();
+    return *instance;
+}
+
+void AsyncLog::messageOutput( QtMsgType type, const QMessageLogContext &context, const QString &msg )
+{
+    AsyncLog &log = getInstance();
+    const qint64 time = QDateTime::currentMSecsSinceEpoch();
+
+    if ( type != QtFatalMsg && log.is_running.load( std::memory_order_acquire ) )
+    {
+        log.ring.push( msg.toUtf8(), time, context.function );
+        return;
+    }
+
+    // fatal, or the thread is gone. write it now, after what's queued
+    if ( type == QtFatalMsg )
+        stop();
+
+    QMutexLocker locker( &log.write_lock );
+    log.formatMessage( msg.toUtf8(), time, context.function );
+    log.writeBatch();
+
+    if ( type == QtFatalMsg )
+        abort();
+}
+
+void AsyncLog::stop()
+{
+    AsyncLog &log = getInstance();
+    if ( !log.is_running.exchange( false, std::memory_order_acq_rel ) )
+        return;
+
+    // the thread stops by itself after its next drain if it's the one logging
+    if ( log.thread.get_id() != std::this_thread::get_id() )
+        log.thread.join();
+}
+
+void AsyncLog::run()
+{
+    while ( is_running.load( std::memory_order_acquire ) )
+    {
+        // we're logging before the threads file is read, this is a no-op once it's applied
+        ThreadPlacement::apply( ThreadPlacement::ROLE_BATCH );
+
+        if ( !drain() )
+            std::this_thread::sleep_for( std::chrono::milliseconds( DRAIN_IDLE_MS ) );
+    }
+
+    drain();
+}
+
+bool AsyncLog::drain()
+{
+    QMutexLocker locker( &write_lock );
+
+    QByteArray text;
+    qint64 time = 0;
+    const char *function = nullptr;
+    bool got_messages = false;
+
+    while ( ring.pop( text, time, function ) )
+    {
+        got_messages = true;
+        formatMessage( text, time, function );
+
+        if ( batch_color.size() >= BATCH_MAX )
+            writeBatch();
+    }
+
+    const quint64 dropped = ring.takeDropped();
+    if ( dropped > 0 )
+    {
+        got_messages = true;
+        formatMessage( QString( "local warning: the log was full, dropped %1 messages" ).arg( dropped ).toUtf8(),
+                       QDateTime::currentMSecsSinceEpoch(), nullptr );
+    }
+
+    if ( got_messages )
+        writeBatch();
+
+    return got_messages;
+}
+
+void AsyncLog::openFiles()
+{
+    // once, what the failures log would come right back here
+    if ( is_files_opened )
+        return;
+
+    is_files_opened = true;
+
+    // open log file
+    if ( !log_file.isOpen() )
+    {
+        // make sure path exists
+        Global::ensurePath();
+
+        // move old logs to <trader_dir>/old_logs/
+        if ( !Global::moveOldLogsOut() )
+            qCritical() << "local error: failed to move old logs out, check file permissions";
+
+        log_file.setFileName( QString( Global::getTraderPath() + QDir::separator() + "log.%1.txt" )
+                              .arg( QDateTime::currentSecsSinceEpoch() ) );
+
+        if ( !log_file.open( QFile::Append | QFile::Text ) )
+            qCritical() << "local error: failed to open log file!:" << log_file.fileName();
+        else
+            kDebug() << "opened log" << log_file.fileName();
+    }
+
+    // open log_color file
+    if ( !log_color_file.isOpen() )
+    {
+        log_color_file.setFileName( QString( Global::getTraderPath() + QDir::separator() + "log.%1_color.txt" )
+                                    .arg( QDateTime::currentSecsSinceEpoch() ) );
+
+        if ( !log_color_file.open( QFile::Append | QFile::Text ) )
+            qCritical() << "local error: failed to open log_color file!:" << log_color_file.fileName();
+        else
+            kDebug() << "opened log_color" << log_color_file.fileName();
+    }
+}
+
+void AsyncLog::formatMessage( const QByteArray &text, const qint64 time, const char *function )
+{
+    const QString date = QDateTime::fromMSecsSinceEpoch( time ).toString( "MM-dd-yy HH:mm:ss" );
+
+#if defined(PRINT_LOGS_WITH_FUNCTION_NAMES)
+    QString line = QString( "%1 %2 %3  %4\n" )
+                    .arg( date )
+                    .arg( function != nullptr ? function : "" )
+                    .arg( "" )
+                    .arg( QString::fromUtf8( text ) );
+#else
+    Q_UNUSED( function )
+    QString line = QString( "%1  %2\n" )
+                    .arg( date )
+                    .arg( QString::fromUtf8( text ) );
+#endif
+
+    // form color string
+    QString line_unixcolors = line;
+    Global::fillInColors( line_unixcolors ); // replace color tags with unix color codes
+    batch_color += line_unixcolors.toUtf8();
+
+#if defined(PRINT_LOGS_TO_FILE)
+    Global::cleanseColorTags( line ); // replace color tags with nothing
+    batch += line.toUtf8();
+#endif
+}
+
+void AsyncLog::writeBatch()
+{
+    // write_lock is held
+    openFiles();
+
+    // print to console
+#if defined(PRINT_LOGS_TO_CONSOLE)
+    fwrite( batch_color.constData(), 1, size_t( batch_color.size() ), stderr );
+#endif
+
+#if defined(PRINT_LOGS_TO_FILE_COLOR)
+    // print to file_color
+    if ( log_color_file.isWritable() )
+    {
+        log_color_file.write( batch_color );
+        log_color_file.flush();
+    }
+#endif
+
+#if defined(PRINT_LOGS_TO_FILE)
+    // print to file
+    if ( log_file.isWritable() )
+    {
+        log_file.write( batch );
+        log_file.flush();
+    }
+#endif
+
+    // keep the capacity for the next batch
+    batch.resize( 0 );
+    batch_color.resize( 0 );
+}
@@ -0,0 +1,83 @@
+#ifndef ASYNCLOG_H
+#define ASYNCLOG_H
+
+#include "global.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QMutex>
+#include <QFile>
+
+#include <atomic>
+#include <thread>
+
+//
+// LogRing, a bounded lock-free queue of log messages for any number of writer threads and one reader. messages are
+// copied into preallocated slots, ones longer than a slot take consecutive slots. when it's full, push() drops the
+// message and counts it instead of waiting
+//
+class LogRing
+{
+public:
+    static const qint32 SLOT_COUNT = 16384; // power of two
+    static const qint32 SLOT_DATA_SIZE = 224; // text bytes in each slot
+    static const qint32 MAX_SLOTS_PER_MESSAGE = SLOT_COUNT / 16; // longer messages are cut
+
+    explicit LogRing();
+    ~LogRing();
+
+    bool push( const QByteArray &text, const qint64 time, const char *function );
+    bool pop( QByteArray &text, qint64 &time, const char *&function ); // the reader's, false if empty
+    quint64 takeDropped() { return dropped.exchange( 0, std::memory_order_relaxed ); }
+    static qint64 getBufferBytes(); // the preallocated slots
+
+private:
+    struct Slot
+    {
+        std::atomic<quint64> sequence{ 0 }; // ticket + 1 once written, ticket + SLOT_COUNT once read
+        qint64 time{ 0 };
+        const char *function{ nullptr }; // static strings from QMessageLogContext
+        quint16 size{ 0 }; // bytes in this slot
+        quint16 slot_count{ 0 }; // slots in the message, set on its first slot
+        char data[ SLOT_DATA_SIZE ];
+    };
+
+    Slot *ring{ nullptr };
+    alignas( 64 ) std::atomic<quint64> head{ 0 }; // next ticket for the writers
+    alignas( 64 ) quint64 tail{ 0 }; // next ticket for the reader
+    std::atomic<quint64> dropped{ 0 };
+};
+
+//
+// AsyncLog, the message handler. the calling thread only copies the message into the ring, a thread of its own adds
+// the date, fills in the colors and writes to the console and log files in batches
+//
+class AsyncLog
+{
+public:
+    static void messageOutput( QtMsgType type, const QMessageLogContext &context, const QString &msg );
+    static void stop(); // writes what's left and stops the thread, later messages are written right away
+
+private:
+    explicit AsyncLog();
+    ~AsyncLog();
+
+    static AsyncLog &getInstance();
+
+    void run();
+    bool drain(); // false if there was nothing to write
+    void openFiles();
+    void formatMessage( const QByteArray &text, const qint64 time, const char *function );
+    void writeBatch();
+
+    LogRing ring;
+    std::thread thread;
+    std::atomic<bool> is_running{ false };
+
+    QMutex write_lock; // held while writing, for messages written right away
+    QFile log_file, log_color_file;
+    bool is_files_opened{ false };
+    QByteArray batch, batch_color; // plain and colored lines waiting for writeBatch()
+};
+
+#endif // ASYNCLOG_H
@@ -0,0 +1,64 @@
+#include "asynclog_test.h"
+#include "asynclog.h"
+
+#include <QByteArray>
+
+void AsyncLogTest::test()
+{
+    LogRing *ring = new LogRing();
+
+    QByteArray text;
+    qint64 time = 0;
+    const char *function = nullptr;
+    static const char *const FUNCTION = "test";
+
+    // empty
+    assert( !ring->pop( text, time, function ) );
+
+    // one slot, empty text, and a message over several slots
+    assert( ring->push( "hello", 5, FUNCTION ) );
+    assert( ring->push( QByteArray(), 6, nullptr ) );
+    const QByteArray long_text( LogRing::SLOT_DATA_SIZE * 3 + 7, 'x' );
+    assert( ring->push( long_text, 7, FUNCTION ) );
+
+    assert( ring->pop( text, time, function ) && text == "hello" && time == 5 && function == FUNCTION );
+    assert( ring->pop( text, time, function ) && text.isEmpty() && time == 6 && function == nullptr );
+    assert( ring->pop( text, time, function ) && text == long_text && time == 7 );
+    assert( !ring->pop( text, time, function ) );
+
+    // go around a few times, with messages that straddle the end
+    for ( int i = 0; i < LogRing::SLOT_COUNT * 3; i++ )
+    {
+        const QByteArray message = QByteArray::number( i ).repeated( 1 + i % 50 );
+        assert( ring->push( message, i, nullptr ) );
+        assert( ring->pop( text, time, function ) && text == message && time == i );
+    }
+
+    // fill it, the rest is dropped and counted
+    for ( int i = 0; i < LogRing::SLOT_COUNT; i++ )
+        assert( ring->push( "fill", i, nullptr ) );
+
+    assert( !ring->push( "dropped", 0, nullptr ) );
+    assert( ring->takeDropped() == 1 );
+    assert( ring->takeDropped() == 0 );
+
+    // a two slot message needs two free slots
+    assert( ring->pop( text, time, function ) && text == "fill" && time == 0 );
+    assert( !ring->push( long_text.left( LogRing::SLOT_DATA_SIZE +1 ), 0, nullptr ) );
+    assert( ring->pop( text, time, function ) && time == 1 );
+    assert( ring->push( long_text.left( LogRing::SLOT_DATA_SIZE +1 ), 0, nullptr ) );
+    assert( ring->takeDropped() == 1 );
+
+    for ( int i = 2; i < LogRing::SLOT_COUNT; i++ )
+        assert( ring->pop( text, time, function ) && text == "fill" && time == i );
+
+    assert( ring->pop( text, time, function ) && text.size() == LogRing::SLOT_DATA_SIZE +1 );
+
+    // too long messages are cut
+    const qint32 max_size = LogRing::SLOT_DATA_SIZE * LogRing::MAX_SLOTS_PER_MESSAGE;
+    assert( ring->push( QByteArray( max_size + 100, 'y' ), 0, nullptr ) );
+    assert( ring->pop( text, time, function ) && text.size() == max_size );
+    assert( !ring->pop( text, time, function ) );
+
+    delete ring;
+}
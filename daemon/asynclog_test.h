@@ -0,0 +1,9 @@
+#ifndef ASYNCLOG_TEST_H
+#define ASYNCLOG_TEST_H
+
+struct AsyncLogTest
+{
+    void test();
+};
+
+#endif // ASYNCLOG_TEST_H
@@ -0,0 +1,121 @@
+#include "asyncsaver.h"
+#include "threadplacement.h"
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QFile>
+
+namespace
+{
+
+class AsyncSaveJob : public QRunnable
+{
+public:
+    AsyncSaveJob( AsyncSaver *_saver, const QString &_name, std::function<bool()> _job, std::function<void(bool)> _done )
+        : saver( _saver ),
+          name( _name ),
+          job( _job ),
+          done( _done )
+    {
+    }
+
+    void run()
+    {
+        ThreadPlacement::apply( ThreadPlacement::ROLE_BATCH );
+        const bool ok = job();
+
+        if ( !ok )
+            kDebug() << "local error: couldn't save" << name;
+
+        // back to the saver's thread, dropped if it's gone by then
+        AsyncSaver *const target = saver;
+        const QString saved_name = name;
+        const std::function<void(bool)> saved_done = done;
+        QMetaObject::invokeMethod( target, [target, saved_name, saved_done, ok]()
+        {
+            if ( saved_done )
+                saved_done( ok );
+
+            emit target->saved( saved_name, ok );
+        }, Qt::QueuedConnection );
+    }
+
+private:
+    AsyncSaver *saver; // waits for the pool before it goes away
+    QString name;
+    std::function<bool()> job;
+    std::function<void(bool)> done;
+};
+
+} // namespace
+
+AsyncSaver::AsyncSaver( QObject *parent )
+    : QObject( parent )
+{
+    // one thread keeps the writes in order, a snapshot and the journal after it for example
+    pool = new QThreadPool( this );
+    pool->setMaxThreadCount( 1 );
+    pool->setExpiryTimeout( -1 );
+}
+
+AsyncSaver::~AsyncSaver()
+{
+    waitForDone();
+}
+
+void AsyncSaver::save( const QString &name, std::function<bool()> job, std::function<void(bool)> done )
+{
+    pool->start( new AsyncSaveJob( this, name, job, done ) );
+}
+
+void AsyncSaver::waitForDone()
+{
+    pool->waitForDone();
+}
+
+bool AsyncSaver::writeFile( const QString &path, const QByteArray &data, const bool text )
+{
+    QSaveFile savefile( path );
+
+    if ( !savefile.open( text ? QIODevice::WriteOnly | QIODevice::Text : QIODevice::WriteOnly ) )
+    {
+        kDebug() << "local error: couldn't open" << path;
+        return false;
+    }
+
+    if ( savefile.write( data ) != data.size() || !savefile.commit() )
+    {
+        kDebug() << "local error: couldn't write" << path;
+        return false;
+    }
+
+    return true;
+}
+
+bool AsyncSaver::appendFile( const QString &path, const QByteArray &data )
+{
+    QFile savefile( path );
+
+    if ( !savefile.open( QIODevice::WriteOnly | QIODevice::Append ) || savefile.write( data ) != data.size() )
+    {
+        kDebug() << "local error: couldn't append to" << path;
+        return false;
+    }
+
+    return true;
+}
+
+bool AsyncSaver::backupFile( const QString &path, const QString &backup_path )
+{
+    if ( !QFile::exists( path ) )
+        return true;
+
+    if ( !QFile::copy( path, backup_path ) )
+    {
+        kDebug() << "local error: couldn't backup" << path << "to" << backup_path;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,44 @@
+#ifndef ASYNCSAVER_H
+#define ASYNCSAVER_H
+
+#include "global.h"
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+
+#include <functional>
+
+class QThreadPool;
+
+//
+// AsyncSaver, runs file writes on a thread of its own, one at a time and in the order they were queued, so the event
+// loop only pays for copying the state it saves. the caller snapshots what it needs on its thread and hands over a
+// job that serializes and writes it
+//
+class AsyncSaver : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AsyncSaver( QObject *parent = nullptr );
+    ~AsyncSaver(); // waits for the queued jobs
+
+    // job runs on the save thread and returns false on a failed write. done, if any, then runs on our thread,
+    // before saved() is emitted
+    void save( const QString &name, std::function<bool()> job, std::function<void(bool)> done = nullptr );
+    void waitForDone();
+
+    // for jobs. writeFile() replaces the file through a temporary and a rename, so it's never seen half written
+    static bool writeFile( const QString &path, const QByteArray &data, const bool text = false );
+    static bool appendFile( const QString &path, const QByteArray &data );
+    static bool backupFile( const QString &path, const QString &backup_path ); // true if there's nothing to copy
+
+signals:
+    void saved( const QString &name, bool ok );
+
+private:
+    QThreadPool *pool{ nullptr };
+};
+
+#endif // ASYNCSAVER_H
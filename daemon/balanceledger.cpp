@@ -0,0 +1,118 @@
+#include "balanceledger.h"
+#include "market.h"
+
+#include <QSet>
+
+static const Coin DRIFT_MIN = 0.000001_coin; // under this is dust, whatever the ratio
+
+void BalanceLedger::addHold( const QString &order_id, const Market &market, const quint8 side, const Coin &quantity, const Coin &amount )
+{
+    if ( order_id.isEmpty() || holds.contains( order_id ) )
+        return;
+
+    Hold hold;
+    hold.currency = side == SIDE_BUY ? market.getBase() : market.getQuote();
+    hold.amount = side == SIDE_BUY ? amount : quantity;
+
+    moveHeld( hold.currency, hold.amount );
+    holds.insert( order_id, hold );
+}
+
+void BalanceLedger::releaseHold( const QString &order_id )
+{
+    QHash<QString, Hold>::iterator i = holds.find( order_id );
+    if ( i == holds.end() )
+        return;
+
+    moveHeld( i->currency, -i->amount );
+    holds.erase( i );
+}
+
+void BalanceLedger::addFill( const QString &order_id, const Market &market, const quint8 side, const Coin &price, Coin quantity,
+                             Coin amount, const Coin &fee )
+{
+    // the exchanges report one or the other
+    if ( amount.isZeroOrLess() && price.isGreaterThanZero() )
+        amount = quantity * price;
+    if ( quantity.isZeroOrLess() && price.isGreaterThanZero() )
+        quantity = amount / price;
+
+    const QString &base = market.getBase();
+    const QString &quote = market.getQuote();
+
+    if ( side == SIDE_BUY )
+    {
+        totals[ base ] -= amount + fee;
+        totals[ quote ] += quantity;
+    }
+    else
+    {
+        totals[ base ] += amount - fee;
+        totals[ quote ] -= quantity;
+    }
+
+    // a partial fill frees what it used of the hold, the rest goes with the order
+    QHash<QString, Hold>::iterator i = holds.find( order_id );
+    if ( i == holds.end() )
+        return;
+
+    const Coin used = qMin( i->amount, side == SIDE_BUY ? amount : quantity );
+    i->amount -= used;
+    moveHeld( i->currency, -used );
+}
+
+qint32 BalanceLedger::reconcile( const QMap<QString, Balance> &polled, const qint64 current_time )
+{
+    QSet<QString> currencies;
+    for ( QHash<QString, Coin>::const_iterator i = totals.begin(); i != totals.end(); i++ )
+        currencies.insert( i.key() );
+    for ( QMap<QString, Balance>::const_iterator i = polled.begin(); i != polled.end(); i++ )
+        currencies.insert( i.key() );
+
+    qint32 drifted = 0;
+    for ( QSet<QString>::const_iterator i = currencies.begin(); i != currencies.end(); i++ )
+    {
+        const Balance exchange = polled.value( *i );
+        const Coin ours = totals.value( *i );
+        const Coin drift = ours - exchange.total;
+
+        // the first poll seeds us, there's nothing to compare yet
+        if ( isReconciled() && drift.abs() > qMax( exchange.total.abs().ratio( DRIFT_RATIO ), DRIFT_MIN ) )
+        {
+            kDebug() << "local warning: balance drift" << *i << "ledger" << ours << "exchange" << exchange.total
+                     << "drift" << drift << "held ledger" << held.value( *i ) << "exchange" << exchange.held;
+            drifted++;
+        }
+
+        if ( exchange.total.isZero() )
+            totals.remove( *i );
+        else
+            totals.insert( *i, exchange.total );
+    }
+
+    last_reconcile_time = current_time;
+    return drifted;
+}
+
+QStringList BalanceLedger::getCurrencies() const
+{
+    QSet<QString> currencies;
+    for ( QHash<QString, Coin>::const_iterator i = totals.begin(); i != totals.end(); i++ )
+        currencies.insert( i.key() );
+    for ( QHash<QString, Coin>::const_iterator i = held.begin(); i != held.end(); i++ )
+        currencies.insert( i.key() );
+
+    QStringList ret = currencies.toList();
+    ret.sort();
+    return ret;
+}
+
+void BalanceLedger::moveHeld( const QString &currency, const Coin &amount )
+{
+    Coin &current = held[ currency ];
+    current += amount;
+
+    // the last hold of a currency came off
+    if ( current.isZeroOrLess() )
+        held.remove( currency );
+}
@@ -0,0 +1,62 @@
+#ifndef BALANCELEDGER_H
+#define BALANCELEDGER_H
+
+#include "global.h"
+#include "coinamount.h"
+
+#include <QHash>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+
+class Market;
+
+//
+// BalanceLedger, an engine's balances kept from its own fills, fees and the holds of its open orders, so they're
+// current between the balance polls. a poll reconciles it, the exchange's totals replace ours and a currency that had
+// drifted more than DRIFT_RATIO or DRIFT_MIN is logged. before the first poll the totals are the changes since start
+//
+class BalanceLedger
+{
+public:
+    static constexpr qreal DRIFT_RATIO = 0.01; // of the exchange's total
+    static constexpr qint64 RECONCILE_INTERVAL = 10 * 60000; // ms between the polls that only reconcile
+
+    struct Balance
+    {
+        Coin total;
+        Coin held; // on orders
+    };
+
+    // buys hold the amount of the base currency, sells the quantity of the quote
+    void addHold( const QString &order_id, const Market &market, const quint8 side, const Coin &quantity, const Coin &amount );
+    void releaseHold( const QString &order_id ); // the order is gone, filled or cancelled
+    void addFill( const QString &order_id, const Market &market, const quint8 side, const Coin &price, Coin quantity,
+                  Coin amount, const Coin &fee ); // the fee is in the base currency
+
+    // the exchange's balances of every currency, the ones it left out are zero. returns how many had drifted
+    qint32 reconcile( const QMap<QString, Balance> &polled, const qint64 current_time );
+
+    bool isReconciled() const { return last_reconcile_time > 0; }
+    qint64 getLastReconcileTime() const { return last_reconcile_time; }
+    Coin getTotal( const QString &currency ) const { return totals.value( currency ); }
+    Coin getHeld( const QString &currency ) const { return held.value( currency ); }
+    Coin getAvailable( const QString &currency ) const { return getTotal( currency ) - getHeld( currency ); }
+    QStringList getCurrencies() const;
+
+private:
+    struct Hold
+    {
+        QString currency;
+        Coin amount;
+    };
+
+    void moveHeld( const QString &currency, const Coin &amount );
+
+    QHash<QString/*currency*/, Coin> totals;
+    QHash<QString/*currency*/, Coin> held;
+    QHash<QString/*order id*/, Hold> holds;
+    qint64 last_reconcile_time{ 0 };
+};
+
+#endif // BALANCELEDGER_H
@@ -0,0 +1,66 @@
+#include "balanceledger_test.h"
+#include "balanceledger.h"
+#include "market.h"
+
+#include <QMap>
+
+#include <assert.h>
+
+void BalanceLedgerTest::test()
+{
+    const Market market( "BTC", "DOGE" );
+    BalanceLedger ledger;
+
+    /// test the holds, a buy holds the base and a sell the quote
+    ledger.addHold( "buy", market, SIDE_BUY, 100_coin, 1_coin );
+    ledger.addHold( "sell", market, SIDE_SELL, 50_coin, 0.5_coin );
+    ledger.addHold( "buy", market, SIDE_BUY, 100_coin, 1_coin ); // set twice, held once
+    assert( ledger.getHeld( "BTC" ) == 1_coin );
+    assert( ledger.getHeld( "DOGE" ) == 50_coin );
+    assert( !ledger.isReconciled() );
+
+    /// test a partial fill, it frees what it used and the rest goes with the order
+    ledger.addFill( "buy", market, SIDE_BUY, 0.01_coin, 40_coin, 0.4_coin, 0.001_coin );
+    assert( ledger.getTotal( "BTC" ) == -0.401_coin );
+    assert( ledger.getTotal( "DOGE" ) == 40_coin );
+    assert( ledger.getHeld( "BTC" ) == 0.6_coin );
+
+    ledger.releaseHold( "buy" );
+    ledger.releaseHold( "buy" );
+    assert( ledger.getHeld( "BTC" ).isZero() );
+    assert( ledger.getCurrencies() == QStringList() << "BTC" << "DOGE" );
+
+    /// test that the first poll seeds the totals
+    QMap<QString, BalanceLedger::Balance> polled;
+    polled[ "BTC" ].total = 2_coin;
+    polled[ "DOGE" ].total = 100_coin;
+    polled[ "DOGE" ].held = 50_coin;
+    assert( ledger.reconcile( polled, 1000 ) == 0 );
+    assert( ledger.isReconciled() && ledger.getLastReconcileTime() == 1000 );
+    assert( ledger.getTotal( "BTC" ) == 2_coin );
+    assert( ledger.getAvailable( "DOGE" ) == 50_coin );
+
+    /// test a fill with only the quantity, the amount comes from the price
+    ledger.addFill( "sell", market, SIDE_SELL, 0.01_coin, 50_coin, Coin(), 0.001_coin );
+    ledger.releaseHold( "sell" );
+    assert( ledger.getTotal( "BTC" ) == 2.499_coin );
+    assert( ledger.getTotal( "DOGE" ) == 50_coin );
+    assert( ledger.getHeld( "DOGE" ).isZero() );
+
+    polled[ "BTC" ].total = 2.499_coin;
+    polled[ "DOGE" ].total = 50_coin;
+    polled[ "DOGE" ].held = Coin();
+    assert( ledger.reconcile( polled, 2000 ) == 0 );
+
+    /// test the drift, a currency the exchange left out is zero
+    polled.remove( "DOGE" );
+    polled[ "BTC" ].total = 2.5_coin; // under the drift ratio
+    assert( ledger.reconcile( polled, 3000 ) == 1 );
+    assert( ledger.getTotal( "BTC" ) == 2.5_coin );
+    assert( ledger.getTotal( "DOGE" ).isZero() );
+    assert( ledger.getCurrencies() == QStringList() << "BTC" );
+
+    polled[ "BTC" ].total = 2.7_coin; // over it
+    assert( ledger.reconcile( polled, 4000 ) == 1 );
+    assert( ledger.getTotal( "BTC" ) == 2.7_coin );
+}
@@ -0,0 +1,9 @@
+#ifndef BALANCELEDGER_TEST_H
+#define BALANCELEDGER_TEST_H
+
+struct BalanceLedgerTest
+{
+    void test();
+};
+
+#endif // BALANCELEDGER_TEST_H
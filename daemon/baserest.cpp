@@ -3,9 +3,27 @@
 #include "global.h"
 #include "engine.h"
 #include "positionman.h"
+#include "position.h"
+#include "ssl_policy.h"
+#include "asyncsaver.h"
+#include "memorystats.h"
+#include "replyparser.h"
+#include "taskscheduler.h"
 
 #include <QTimer>
+#include <QtMath>
 #include <QThread>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDateTime>
+#include <QLocale>
+
+static const qint64 WARM_IDLE_TIME = 20000; // reconnect if closed after this long without a request
+static const qint32 WARM_TIMER_INTERVAL = 10000;
+static const qint64 SESSION_TICKET_SAVE_INTERVAL = 60000;
+static const qint32 HTTP2_STREAMS_MAX = 100; // qt's default max concurrent streams for one http/2 connection
 
 BaseREST::BaseREST( Engine *_engine )
     : QObject( nullptr ),
@@ -13,29 +31,39 @@ BaseREST::BaseREST( Engine *_engine )
 {
     kDebug() << "[BaseREST]";
 
-    // we use this to send the requests at a predictable rate
-    send_timer = new QTimer( this );
-    send_timer->setTimerType( Qt::CoarseTimer );
+    TaskScheduler *scheduler = engine->getScheduler();
 
-    // this timer checks for nam requests that have been queued too long
-    timeout_timer = new QTimer( this );
-    connect( timeout_timer, &QTimer::timeout, engine, &Engine::onCheckTimeouts );
-    timeout_timer->setTimerType( Qt::VeryCoarseTimer );
+    // we use this to send the requests at a predictable rate, the subclass sets the callback
+    send_timer = scheduler->addTask( this, "send", nullptr, TASK_PRIORITY_SEND );
+
+    // this sends queued requests as soon as rate limit tokens are available
+    send_wake_timer = scheduler->addTask( this, "send wake", nullptr, TASK_PRIORITY_SEND, 0., TASK_PRECISE | TASK_SINGLE_SHOT );
+
+    // this checks for nam requests that have been queued too long
+    timeout_timer = scheduler->addTask( this, "timeouts", [this]() { engine->onCheckTimeouts(); }, TASK_PRIORITY_TIMEOUTS, 0.05 );
     timeout_timer->start( 30000 );
 
-    // this timer diverges/converges ping-pong orders
-    diverge_converge_timer = new QTimer( this );
-    connect( diverge_converge_timer, &QTimer::timeout, engine->getPositionMan(), &PositionMan::divergeConverge );
-    diverge_converge_timer->setTimerType( Qt::VeryCoarseTimer );
+    // this diverges/converges ping-pong orders
+    diverge_converge_timer = scheduler->addTask( this, "diverge converge", [this]() { engine->getPositionMan()->divergeConverge(); },
+                                                 TASK_PRIORITY_DC, 0.05, TASK_SKIP_IF_BUSY );
     diverge_converge_timer->start( 100000 );
 
-    // this timer reads the lo_sell and hi_buy prices for all coins
-    ticker_timer = new QTimer( this );
-    ticker_timer->setTimerType( Qt::VeryCoarseTimer );
+    // this reads the lo_sell and hi_buy prices for all coins
+    ticker_timer = scheduler->addTask( this, "ticker", nullptr, TASK_PRIORITY_TICKER, 0.05, TASK_SKIP_IF_BUSY );
+
+    // this requests the open orders, it doesn't wait for flow control because it's how fills are seen
+    orderbook_timer = scheduler->addTask( this, "orders", nullptr, TASK_PRIORITY_ORDERS, 0.05 );
+
+    // this keeps a connection to the exchange open, started by startConnectionWarming()
+    warm_timer = scheduler->addTask( this, "warm", [this]() { onWarmConnection(); }, TASK_PRIORITY_HOUSEKEEPING, 0.1 );
 
-    // this timer requests the order book
-    orderbook_timer = new QTimer( this );
-    orderbook_timer->setTimerType( Qt::VeryCoarseTimer );
+    // this moves the flow control limits toward the best reply rate, started by setFlowTuning()
+    flow_tune_timer = scheduler->addTask( this, "flow tune", [this]() { onFlowTune(); }, TASK_PRIORITY_HOUSEKEEPING );
+
+    // this polls the balances to check the ledger against the exchange
+    balance_timer = scheduler->addTask( this, "balances", [this]() { checkBalances(); }, TASK_PRIORITY_HOUSEKEEPING, 0.05 );
+
+    parser = new ReplyParser( this );
 }
 
 BaseREST::~BaseREST()
@@ -44,12 +72,15 @@ BaseREST::~BaseREST()
     keystore.clear();
     request_nonce = 0;
 
-    // stop timers
-    send_timer->stop();
-    orderbook_timer->stop();
-    timeout_timer->stop();
-    diverge_converge_timer->stop();
-    ticker_timer->stop();
+    // wait for the replies being parsed, and drop the ones that weren't applied
+    parser->waitForDone();
+    ParsedReply parsed;
+    while ( parser->take( parsed ) )
+    {
+        parsed.reply->setParent( this );
+        parsed.reply->deleteLater();
+        delete parsed.request;
+    }
 
     // clear network replies
     for ( QHash<QNetworkReply*,Request*>::const_iterator i = nam_queue_sent.begin(); i != nam_queue_sent.end(); i++ )
@@ -63,17 +94,19 @@ BaseREST::~BaseREST()
     while ( nam_queue.size() > 0 )
         delete nam_queue.takeFirst();
 
-    delete send_timer;
-    delete orderbook_timer;
-    delete timeout_timer;
-    delete diverge_converge_timer;
-    delete ticker_timer;
+    while ( free_requests.size() > 0 )
+        delete free_requests.takeLast();
 
+    // the tasks went with the engine's scheduler, or go with us
     send_timer = nullptr;
+    send_wake_timer = nullptr;
     orderbook_timer = nullptr;
     timeout_timer = nullptr;
     diverge_converge_timer = nullptr;
     ticker_timer = nullptr;
+    warm_timer = nullptr;
+    flow_tune_timer = nullptr;
+    balance_timer = nullptr;
 
     engine = nullptr;
 
@@ -83,21 +116,25 @@ BaseREST::~BaseREST()
 bool BaseREST::yieldToFlowControl() const
 {
     return ( nam_queue.size() >= limit_commands_queued ||
-             nam_queue_sent.size() >= limit_commands_sent );
+             nam_queue_sent.size() >= getSentLimit() );
 }
 
 bool BaseREST::yieldToServer( bool verbose ) const
 {
+    // send fewer commands at once while the server's tail reply time is high
+    const bool is_slow = isResponseTimeOver( 0.90, limit_response_time_tail );
+    const qint32 limit = is_slow ? getSentLimit() /2 : getSentLimit();
+
     // stop sending commands if server is unresponsive
-    if ( nam_queue_sent.size() > limit_commands_sent )
+    if ( nam_queue_sent.size() > limit )
     {
         // print something every 2 mins
-        static qint64 last_print_time = 0;
         const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
-        if ( verbose && last_print_time < current_time - 120000 )
+        if ( verbose && yield_print_time < current_time - 120000 )
         {
-            kDebug() << "local" << engine->engine_type << "info: nam_queue_sent > limit_commands_sent, waiting.";
-            last_print_time = current_time;
+            kDebug() << "local" << engine->engine_type << "info: nam_queue_sent >" << limit
+                     << ( is_slow ? "(p90 reply time is high)" : "" ) << "waiting.";
+            yield_print_time = current_time;
         }
 
         return true;
@@ -106,16 +143,269 @@ bool BaseREST::yieldToServer( bool verbose ) const
     return false;
 }
 
+qint64 BaseREST::getResponseTimePercentile( qreal percentile ) const
+{
+    static const quint64 MIN_SAMPLES = 10; // don't trust a couple of replies
+
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+    const ResponseTimeWindow &all = response_times.getAll();
+
+    if ( all.getCount( current_time ) < MIN_SAMPLES )
+        return -1;
+
+    return all.getPercentile( percentile, current_time );
+}
+
+bool BaseREST::isResponseTimeOver( qreal percentile, qint64 limit ) const
+{
+    return getResponseTimePercentile( percentile ) > limit;
+}
+
 void BaseREST::sendRequest( QString api_command, QString body, Position *pos, quint16 weight )
 {
-    Request *delayed_request = new Request();
+    Request *const request = prepareRequest( api_command, body, pos, weight );
+
+    // the reply to the query we already have covers this one
+    if ( coalesceRequest( request ) )
+    {
+        releaseRequest( request );
+        return;
+    }
+
+    // append to packet queue
+    nam_queue.append( request );
+    wakeSendQueue();
+}
+
+bool BaseREST::coalesceRequest( Request *const &request )
+{
+    // only status queries are reads that get repeated for the same order
+    if ( request->request_class != REQUEST_ORDER_STATUS )
+        return false;
+
+    Request *existing = sent_status_by_command.value( request->api_command + request->body );
+
+    if ( existing == nullptr )
+    {
+        const QList<Request*> queued = nam_queue.getByCommand( request->api_command, request->body );
+        existing = queued.isEmpty() ? nullptr : queued.first();
+    }
+
+    if ( existing == nullptr )
+        return false;
+
+    // the reply is handled for the position of the request that goes out, so it has to be the same one
+    if ( existing->pos == nullptr )
+    {
+        existing->pos = request->pos;
+        existing->pos_generation = request->pos_generation;
+    }
+    else if ( request->pos != nullptr && ( request->pos != existing->pos || request->pos_generation != existing->pos_generation ) )
+    {
+        return false;
+    }
+
+    coalesced_request_count++;
+    return true;
+}
+
+Request *BaseREST::prepareRequest( const QString &api_command, const QString &body, Position *pos, quint16 weight )
+{
+    Request *delayed_request = acquireRequest();
     delayed_request->api_command = api_command;
     delayed_request->body = body;
     delayed_request->pos = pos;
+    delayed_request->pos_generation = pos ? pos->getGeneration() : 0;
     delayed_request->weight = weight;
+    delayed_request->request_class = getRequestClass( api_command );
+    delayed_request->command_kind = getCommandKind( api_command );
 
-    // append to packet queue
-    nam_queue.append( delayed_request );
+    // cancels for crowded markets go first, then new orders by profit (new hi/lo orders aren't reactive, keep them at 0)
+    if ( pos != nullptr && delayed_request->request_class == REQUEST_CANCEL &&
+         engine->getPositionMan()->getMarketOrderTotal( pos->market ) >= market_cancel_thresh )
+        delayed_request->priority = CoinAmount::COIN;
+    else if ( pos != nullptr && delayed_request->request_class == REQUEST_NEW_ORDER && !pos->is_new_hilo_order )
+        delayed_request->priority = pos->per_trade_profit;
+
+    return delayed_request;
+}
+
+Request *BaseREST::acquireRequest()
+{
+    if ( free_requests.isEmpty() )
+        return new Request();
+
+    return free_requests.takeLast();
+}
+
+void BaseREST::releaseRequest( Request *const &request )
+{
+    static const qint32 MAX_FREE_REQUESTS = 512; // more than we ever have queued and sent
+
+    if ( free_requests.size() >= MAX_FREE_REQUESTS )
+    {
+        delete request;
+        return;
+    }
+
+    *request = Request();
+    free_requests.append( request );
+}
+
+const RequestTemplate &BaseREST::getRequestTemplate( const QString &api_command )
+{
+    const QString kind = getCommandKind( api_command );
+
+    QHash<QString, RequestTemplate>::const_iterator i = request_templates.find( kind );
+    if ( i != request_templates.end() )
+        return i.value();
+
+    RequestTemplate &t = request_templates[ kind ];
+    buildRequestTemplate( api_command, t );
+    t.nam_request.setAttribute( QNetworkRequest::Http2AllowedAttribute, is_http2_allowed );
+
+    if ( t.verb.isEmpty() )
+        kDebug() << "local error: no request template for api command" << api_command;
+
+    return t;
+}
+
+void BaseREST::prebuildRequestTemplates( const QStringList &api_commands )
+{
+    for ( QStringList::const_iterator i = api_commands.begin(); i != api_commands.end(); i++ )
+        getRequestTemplate( *i );
+}
+
+bool BaseREST::takeSendTokens()
+{
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+
+    if ( shared_send_limiter ? shared_send_limiter->tryTake( 1., current_time ) : send_limiter.tryTake( 1., current_time ) )
+        return true;
+
+    // try again when the next token is in
+    wakeSendQueue( shared_send_limiter ? shared_send_limiter->getWaitTime( 1., current_time ) :
+                                         send_limiter.getWaitTime( 1., current_time ) );
+    return false;
+}
+
+void BaseREST::wakeSendQueue( qint64 delay_ms )
+{
+    // keep an earlier wake up
+    if ( !send_wake_timer || ( send_wake_timer->isActive() && send_wake_timer->remainingTime() <= delay_ms ) )
+        return;
+
+    send_wake_timer->start( qMax( qint64( 0 ), delay_ms ) );
+}
+
+void BaseREST::setSendRate( qreal requests_per_second )
+{
+    send_limiter.setRate( requests_per_second, qFloor( requests_per_second ) );
+
+    if ( shared_send_limiter )
+        shared_send_limiter->setRate( requests_per_second, qFloor( requests_per_second ) );
+}
+
+void BaseREST::shareSendLimiter( SharedTokenBucket *limiter )
+{
+    shared_send_limiter = limiter;
+
+    if ( shared_send_limiter )
+        shared_send_limiter->setRate( send_limiter.getRate(), send_limiter.getCapacity() );
+}
+
+void BaseREST::setHttp2Allowed( bool allowed )
+{
+    if ( allowed && !is_http2_supported )
+    {
+        kDebug() << "local error:" << exchange_string << "doesn't support http/2";
+        return;
+    }
+
+    is_http2_allowed = allowed;
+
+    // the templates are copied into every request, so new requests pick this up
+    for ( QHash<QString, RequestTemplate>::iterator i = request_templates.begin(); i != request_templates.end(); i++ )
+        i.value().nam_request.setAttribute( QNetworkRequest::Http2AllowedAttribute, is_http2_allowed );
+
+    // open the new kind of connection now instead of on the next order
+    last_warm_time = 0;
+    onWarmConnection();
+}
+
+qint32 BaseREST::getSentLimit() const
+{
+    // every in-flight request is a stream on the one connection, past the server's limit they would queue inside qt
+    if ( is_http2_allowed )
+        return qMin( limit_commands_sent, HTTP2_STREAMS_MAX );
+
+    return limit_commands_sent;
+}
+
+void BaseREST::setFlowTuning( bool enabled )
+{
+    flow_tuner.setEnabled( enabled, QDateTime::currentMSecsSinceEpoch() );
+
+    if ( enabled )
+        flow_tune_timer->start( FlowTuner::INTERVAL );
+    else
+        flow_tune_timer->stop();
+}
+
+void BaseREST::onFlowTune()
+{
+    const qint32 old_sent = limit_commands_sent;
+    const qint32 old_queued = limit_commands_queued;
+    const qint64 p90 = getResponseTimePercentile( 0.90 );
+
+    if ( !flow_tuner.tune( QDateTime::currentMSecsSinceEpoch(), p90, limit_response_time_tail, limit_commands_sent, limit_commands_queued ) )
+        return;
+
+    kDebug() << "local" << engine->engine_type << "info: flow tuner set sent limit" << old_sent << "->" << limit_commands_sent
+             << "queued limit" << old_queued << "->" << limit_commands_queued
+             << QString( "(%1 ok/s, p90 %2ms, %3% failed)" )
+                .arg( flow_tuner.getGoodput(), 0, 'f', 1 )
+                .arg( p90 )
+                .arg( flow_tuner.getFailureRatio() * 100., 0, 'f', 1 );
+
+    // a higher limit has room for what's queued now
+    wakeSendQueue();
+}
+
+Request *BaseREST::getNextRequest( const QString &only_command, qint32 skip_class ) const
+{
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+
+    // go through the classes in order, the first sendable request wins
+    for ( quint8 c = 0; c < REQUEST_CLASS_COUNT; c++ )
+    {
+        const QMap<RequestKey, Request*> &requests = nam_queue.getClass( c );
+
+        if ( requests.isEmpty() || c == skip_class )
+            continue;
+
+        const qint32 limit = limit_commands_sent_by_class.value( c );
+        if ( limit > 0 && sent_by_class.at( c ) >= limit )
+            continue;
+
+        // the server keeps failing this class, leave it queued until the backoff is over
+        if ( !breakers.at( c ).isSendAllowed( current_time ) )
+            continue;
+
+        // highest priority is last
+        if ( only_command.isEmpty() )
+            return ( requests.end() -1 ).value();
+
+        // we are yielding, only a specific command may go out (usually the one that tells us the server is back)
+        for ( QMap<RequestKey, Request*>::const_iterator i = requests.end(); i != requests.begin(); )
+        {
+            i--;
+            if ( i.value()->api_command == only_command )
+                return i.value();
+        }
+    }
+
+    return nullptr;
 }
 
 bool BaseREST::isKeyOrSecretUnset() const
@@ -130,45 +420,318 @@ bool BaseREST::isKeyOrSecretUnset() const
     return false;
 }
 
-bool BaseREST::isCommandQueued( const QString &api_command_prefix ) const
+void BaseREST::removeRequest( const QString &api_command, const QString &body )
 {
-    // check for getopenorders request in nam_queue
-    for ( QQueue<Request*>::const_iterator i = nam_queue.begin(); i != nam_queue.end(); i++ )
-        if ( (*i)->api_command.startsWith( api_command_prefix ) )
-            return true;
+    const QList<Request*> removed_requests = nam_queue.getByCommand( api_command, body );
 
-    return false;
+    // remove the requests we matched
+    for ( QList<Request*>::const_iterator i = removed_requests.begin(); i != removed_requests.end(); i++ )
+    {
+        nam_queue.removeOne( *i );
+        releaseRequest( *i );
+    }
+}
+
+qint32 BaseREST::dropQueuedRequests( const quint8 request_class, const QString &market, QVector<Position*> &dropped_positions )
+{
+    if ( request_class >= REQUEST_CLASS_COUNT )
+        return 0;
+
+    // copy the class, removeOne() changes it
+    const QMap<RequestKey, Request*> queued = nam_queue.getClass( request_class );
+    qint32 dropped = 0;
+
+    for ( QMap<RequestKey, Request*>::const_iterator i = queued.constBegin(); i != queued.constEnd(); i++ )
+    {
+        Request *const &request = i.value();
+        Position *const &pos = request->pos;
+
+        // positions are recycled, only hand back the one the request was for
+        const bool is_pos_valid = pos && engine->getPositionMan()->isValid( pos, request->pos_generation );
+
+        if ( market != ALL && ( !is_pos_valid || pos->market != market ) )
+            continue;
+
+        if ( is_pos_valid )
+            dropped_positions += pos;
+
+        nam_queue.removeOne( request );
+        releaseRequest( request );
+        dropped++;
+    }
+
+    return dropped;
+}
+
+void BaseREST::trackSent( QNetworkReply *const &reply, Request *const &request )
+{
+    nam_queue_sent.insert( reply, request );
+    nam_queue.removeOne( request );
+    flow_tuner.addSent( nam_queue_sent.size() );
+
+    sent_by_kind[ request->command_kind ]++;
+    if ( request->request_class < REQUEST_CLASS_COUNT )
+    {
+        sent_by_class[ request->request_class ]++;
+        breakers[ request->request_class ].addSent( request->time_sent_ms );
+    }
+    if ( request->request_class == REQUEST_ORDER_STATUS )
+        sent_status_by_command.insert( request->api_command + request->body, request );
+}
+
+Request *BaseREST::takeSent( QNetworkReply *const &reply )
+{
+    QHash<QNetworkReply*,Request*>::iterator i = nam_queue_sent.find( reply );
+    if ( i == nam_queue_sent.end() )
+        return nullptr;
+
+    Request *request = i.value();
+    nam_queue_sent.erase( i );
+    wakeSendQueue(); // a slot opened up for the in-flight limits
+
+    // keep refilling the grid at the rate the slots free up, instead of waiting for the next timeout check
+    if ( !yieldToFlowControl() )
+        engine->scheduleRefill();
+
+    QHash<QString, qint32>::iterator k = sent_by_kind.find( request->command_kind );
+    if ( k != sent_by_kind.end() && --k.value() <= 0 )
+        sent_by_kind.erase( k );
+    if ( request->request_class < REQUEST_CLASS_COUNT )
+        sent_by_class[ request->request_class ]--;
+    if ( request->request_class == REQUEST_ORDER_STATUS )
+    {
+        QHash<QString, Request*>::iterator s = sent_status_by_command.find( request->api_command + request->body );
+        if ( s != sent_status_by_command.end() && s.value() == request )
+            sent_status_by_command.erase( s );
+    }
+
+    return request;
+}
+
+void BaseREST::recordReply( QNetworkReply *const &reply, Request *const &request, const qint64 current_time )
+{
+    if ( request->request_class >= REQUEST_CLASS_COUNT )
+        return;
+
+    CircuitBreaker &breaker = breakers[ request->request_class ];
+    const CircuitBreaker::State previous_state = breaker.getState( current_time );
+
+    // the server not answering, or answering that it can't right now, counts against the class. any other error is
+    // about the request itself, it means the server is up
+    const qint32 status = reply->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt();
+    const QNetworkReply::NetworkError error = reply->error();
+    const bool is_unreachable = status == 0 && error != QNetworkReply::NoError;
+    const bool is_failure = is_unreachable || status >= 500 || status == 429 || status == 418;
+    flow_tuner.addReply( is_failure );
+
+    if ( !is_failure )
+    {
+        breaker.addSuccess( current_time );
+
+        if ( previous_state != CircuitBreaker::CLOSED && breaker.getState( current_time ) == CircuitBreaker::CLOSED )
+            kDebug() << "local" << engine->engine_type << "info: request class" << REQUEST_CLASS_NAMES[ request->request_class ] << "is back, breaker closed";
+        return;
+    }
+
+    breaker.addFailure( current_time );
+
+    if ( breaker.getState( current_time ) == CircuitBreaker::OPEN && previous_state != CircuitBreaker::OPEN )
+    {
+        const qint64 wait_time = breaker.getWaitTime( current_time );
+        kDebug() << "local warning: request class" << REQUEST_CLASS_NAMES[ request->request_class ] << "failed" << breaker.getFailures()
+                 << "times in a row (" << request->api_command << status << error << "), pausing it for" << wait_time << "ms";
+
+        // come back for what queued up once it's half-open
+        wakeSendQueue( wait_time );
+    }
 }
 
-bool BaseREST::isCommandSent( const QString &api_command_prefix, qint32 min_times ) const
+bool BaseREST::isClassPaused( const quint8 request_class ) const
 {
-    qint32 times = 0;
+    return request_class < REQUEST_CLASS_COUNT &&
+           breakers.at( request_class ).getState( QDateTime::currentMSecsSinceEpoch() ) == CircuitBreaker::OPEN;
+}
+
+void BaseREST::readServerDate( QNetworkReply *const &reply, const qint64 sent_ms, const qint64 received_ms )
+{
+    // "Tue, 14 Oct 2026 10:00:00 GMT", always in english and gmt
+    const QByteArray date = reply->rawHeader( "Date" );
+    if ( date.isEmpty() )
+        return;
+
+    QDateTime server_time = QLocale::c().toDateTime( QString::fromLatin1( date ), "ddd, dd MMM yyyy HH:mm:ss 'GMT'" );
+    if ( !server_time.isValid() )
+        return;
+
+    server_time.setTimeSpec( Qt::UTC );
+    server_clock.addSample( sent_ms, server_time.toMSecsSinceEpoch(), received_ms );
+}
+
+qint64 BaseREST::getServerTime() const
+{
+    return server_clock.toServerTime( QDateTime::currentMSecsSinceEpoch() );
+}
+
+const QByteArray &BaseREST::readReply( QNetworkReply *const &reply )
+{
+    // the reply is finished, so the whole body is buffered
+    const qint64 size = reply->bytesAvailable();
+    reply_buffer.resize( static_cast<int>( size ) );
+
+    const qint64 read_size = reply->read( reply_buffer.data(), size );
+    reply_buffer.resize( read_size > 0 ? static_cast<int>( read_size ) : 0 );
+
+    // keep the latest session ticket for connections we open later
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+    if ( current_time > session_ticket_save_time + SESSION_TICKET_SAVE_INTERVAL )
+    {
+        const QByteArray ticket = reply->sslConfiguration().sessionTicket();
+        if ( !ticket.isEmpty() )
+        {
+            GlobalSsl::setSessionTicket( reply->url().host(), ticket );
+            session_ticket_save_time = current_time;
+        }
+    }
+
+    return reply_buffer;
+}
+
+qint64 BaseREST::getRequestBytes() const
+{
+    using MemoryStats::getBytes;
+
+    qint64 bytes = getBytes( nam_queue_sent ) + getBytes( sent_status_by_command ) + getBytes( free_requests ) + getBytes( reply_buffer );
+
+    // the queue holds each request in its class map and again by command
+    QVector<const Request*> requests;
+    for ( quint8 request_class = 0; request_class < REQUEST_CLASS_COUNT; request_class++ )
+    {
+        const QMap<RequestKey, Request*> &queued = nam_queue.getClass( request_class );
+        bytes += getBytes( queued ) * 2;
+
+        for ( QMap<RequestKey, Request*>::const_iterator i = queued.begin(); i != queued.end(); i++ )
+            requests += i.value();
+    }
 
-    // check for getopenorders request in nam_queue
     for ( QHash<QNetworkReply*,Request*>::const_iterator i = nam_queue_sent.begin(); i != nam_queue_sent.end(); i++ )
+        requests += i.value();
+    for ( QVector<Request*>::const_iterator i = free_requests.begin(); i != free_requests.end(); i++ )
+        requests += *i;
+
+    for ( QVector<const Request*>::const_iterator i = requests.begin(); i != requests.end(); i++ )
     {
-        if ( (*i)->api_command.startsWith( api_command_prefix ) )
-            times++;
+        const Request *const &request = *i;
+        if ( request )
+            bytes += qint64( sizeof( Request ) ) + getBytes( request->api_command ) + getBytes( request->body ) + getBytes( request->command_kind );
     }
 
-    return times >= min_times;
+    return bytes;
 }
 
-void BaseREST::removeRequest( const QString &api_command, const QString &body )
+void BaseREST::startConnectionWarming( const QString &url )
+{
+    warm_url = QUrl( url );
+    warm_timer->start( WARM_TIMER_INTERVAL );
+
+    // the first request shouldn't wait on dns, tcp and the handshake
+    onWarmConnection();
+}
+
+void BaseREST::onWarmConnection()
 {
-    QQueue<Request*> removed_requests;
-    for ( QQueue<Request*>::const_iterator i = nam_queue.begin(); i != nam_queue.end(); i++ )
+    QMutexLocker locker( engine->getLock() );
+
+    // a mock manager answers everything itself, there's no connection to keep
+    if ( nam == nullptr || !warm_url.isValid() || nam->inherits( "MockNetworkAccessManager" ) )
+        return;
+
+    // requests keep the connection open, otherwise the server might have closed it
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+    if ( last_warm_time > 0 && current_time - last_request_sent_ms < WARM_IDLE_TIME )
+        return;
+
+    // resume the last session if we have one, this doesn't do anything while a connection is open
+    QSslConfiguration ssl_config = QSslConfiguration::defaultConfiguration();
+    const QByteArray ticket = GlobalSsl::getSessionTicket( warm_url.host() );
+    if ( !ticket.isEmpty() )
+        ssl_config.setSessionTicket( ticket );
+
+    // offer h2 so the requests can share this connection
+    if ( is_http2_allowed )
+        ssl_config.setAllowedNextProtocols( QList<QByteArray>() << QSslConfiguration::ALPNProtocolHTTP2
+                                                                 << QSslConfiguration::NextProtocolHttp1_1 );
+
+    nam->connectToHostEncrypted( warm_url.host(), quint16( warm_url.port( 443 ) ), ssl_config );
+    last_warm_time = current_time;
+}
+
+bool BaseREST::readMetadataCache( const QString &name, const qint64 max_age_secs, QByteArray &data ) const
+{
+    const QString path = Global::getMetadataCachePath( engine->engine_type, name );
+    const QFileInfo info( path );
+
+    if ( !info.exists() || info.lastModified().secsTo( QDateTime::currentDateTime() ) > max_age_secs )
+        return false;
+
+    QFile loadfile( path );
+    if ( !loadfile.open( QIODevice::ReadOnly ) )
+        return false;
+
+    data = loadfile.readAll();
+    return true;
+}
+
+bool BaseREST::readMetadataCache( const QString &name, const qint64 max_age_secs, QJsonObject &obj ) const
+{
+    QByteArray data;
+    if ( !readMetadataCache( name, max_age_secs, data ) )
+        return false;
+
+    const QJsonDocument doc = QJsonDocument::fromJson( data );
+    if ( !doc.isObject() )
     {
-        Request *const &req = *i;
+        kDebug() << "local warning: couldn't read metadata cache" << Global::getMetadataCachePath( engine->engine_type, name );
+        return false;
+    }
 
-        if ( req->api_command == api_command &&
-             req->body == body )
-            removed_requests.append( req );
+    obj = doc.object();
+    return true;
+}
+
+void BaseREST::writeMetadataCache( const QString &name, const QByteArray &data )
+{
+    // the engines of an exchange read the same metadata, the first one keeps the cache
+    if ( engine->getEngineIndex() > 0 )
+        return;
+
+    const QString path = Global::getMetadataCachePath( engine->engine_type, name );
+    engine->getSaver()->save( path, [path, data]() { return AsyncSaver::writeFile( path, data ); } );
+}
+
+const QByteArray &BaseREST::readMessage( const QString &msg )
+{
+    const int size = msg.size();
+    reply_buffer.resize( size );
+
+    char *out = reply_buffer.data();
+    const QChar *in = msg.constData();
+
+    // wss frames are ascii json, copy the chars straight across
+    for ( int i = 0; i < size; i++ )
+    {
+        const ushort c = in[ i ].unicode();
+
+        // not ascii, take the long way
+        if ( c >= 0x80 )
+        {
+            reply_buffer = msg.toUtf8();
+            break;
+        }
+
+        out[ i ] = static_cast<char>( c );
     }
 
-    // remove the requests we matched
-    while ( removed_requests.size() > 0 )
-        nam_queue.removeOne( removed_requests.takeFirst() );
+    return reply_buffer;
 }
 
 void BaseREST::deleteReply( QNetworkReply * const &reply, Request * const &request )
@@ -180,10 +743,10 @@ void BaseREST::deleteReply( QNetworkReply * const &reply, Request * const &reque
         return;
     }
 
-    delete request;
-
     // if we took it out, it won't be in there. remove incase it's still there.
-    nam_queue_sent.remove( reply );
+    takeSent( reply );
+
+    releaseRequest( request );
 
     // send interrupt signal if we need to (if we are cleaning up replies in transit)
     if ( !reply->isFinished() )
@@ -4,12 +4,21 @@
 #include "global.h"
 #include "misctypes.h"
 #include "keystore.h"
+#include "hmacsigner.h"
+#include "latencyhistogram.h"
+#include "requestqueue.h"
+#include "tokenbucket.h"
+#include "serverclock.h"
+#include "circuitbreaker.h"
+#include "flowtuner.h"
 
 #include <QObject>
 #include <QQueue>
 #include <QHash>
 #include <QNetworkAccessManager>
+#include <QNetworkRequest>
 #include <QNetworkReply>
+#include <QUrl>
 
 class QNetworkAccessManager;
 class QNetworkReply;
@@ -18,6 +27,21 @@ class Stats;
 class Engine;
 class QTimer;
 class Position;
+class QJsonObject;
+class ReplyParser;
+class ScheduledTask;
+
+// the parts of a request that only depend on the command, built once per command kind
+struct RequestTemplate
+{
+    QNetworkRequest nam_request; // constant headers, and the url when is_fixed_url
+    QString base_url; // when !is_fixed_url, url = base_url + api_command.mid( command_offset )
+    qint32 command_offset{ 0 };
+    QByteArray verb; // GET, POST, PUT or DELETE, empty if we don't know how to send it
+    bool is_fixed_url{ true };
+    bool is_signed{ false };
+    bool is_keyed{ false }; // sends the api key without signing
+};
 
 struct BaseREST : public QObject
 {
@@ -25,26 +49,78 @@ struct BaseREST : public QObject
     ~BaseREST();
 
     virtual void init() {}
+    virtual QString getWarmUrl() const { return QString(); } // the host init() keeps a connection open to
+    virtual void checkBalances( bool print = false ) { Q_UNUSED( print ) } // poll the balances, the reply reconciles the engine's ledger
 
     bool yieldToFlowControl() const;
     bool yieldToServer( bool verbose = true ) const;
+    qint64 getResponseTimePercentile( qreal percentile ) const; // recent reply time, or -1 without enough replies
+    bool isResponseTimeOver( qreal percentile, qint64 limit ) const; // recent reply time percentile is over limit
 
     void sendRequest( QString api_command, QString body = QLatin1String(), Position *pos = nullptr, quint16 weight = 0 );
+    Request *prepareRequest( const QString &api_command, const QString &body, Position *pos, quint16 weight = 0 ); // filled in but not queued
+    bool coalesceRequest( Request *const &request ); // true if an identical status query is already queued or sent
+    virtual quint8 getRequestClass( const QString &api_command ) const { Q_UNUSED( api_command ) return REQUEST_POLL; }
+    virtual QString getCommandKind( const QString &api_command ) const { return api_command; } // what isCommandQueued/Sent() match
+    virtual void buildRequestTemplate( const QString &api_command, RequestTemplate &t ) const { Q_UNUSED( api_command ) Q_UNUSED( t ) }
+    const RequestTemplate &getRequestTemplate( const QString &api_command ); // built on first use for each command kind
+    void prebuildRequestTemplates( const QStringList &api_commands );
+
+    Request *acquireRequest(); // from free_requests if we have one
+    void releaseRequest( Request *const &request ); // reset and keep for reuse
+    Request *getNextRequest( const QString &only_command = QString(), qint32 skip_class = -1 ) const; // nullptr if none can be sent
+    bool takeSendTokens(); // false if over the send rate, sendNamQueue() is woken when it isn't
+    void wakeSendQueue( qint64 delay_ms = 0 ); // run sendNamQueue() after delay_ms instead of waiting for send_timer
+    void setSendRate( qreal requests_per_second ); // burst of up to one second of requests
+    void shareSendLimiter( SharedTokenBucket *limiter ); // the shards of an exchange send from one limiter, it keeps our rate
+    void setHttp2Allowed( bool allowed ); // multiplex requests on one connection, if is_http2_supported
+    qint32 getSentLimit() const; // limit_commands_sent, capped to the streams we can have open over http/2
+    void setFlowTuning( bool enabled ); // let flow_tuner move limit_commands_sent and limit_commands_queued
+    void onFlowTune();
 
     bool isKeyOrSecretUnset() const;
-    bool isCommandQueued( const QString &api_command_prefix ) const;
-    bool isCommandSent( const QString &api_command_prefix, qint32 min_times = 1 ) const;
+    bool isCommandQueued( const QString &command_kind ) const { return nam_queue.getKindCount( command_kind ) > 0; }
+    bool isCommandSent( const QString &command_kind, qint32 min_times = 1 ) const { return sent_by_kind.value( command_kind ) >= min_times; }
     void removeRequest( const QString &api_command, const QString &body );
+    qint32 dropQueuedRequests( const quint8 request_class, const QString &market, QVector<Position*> &dropped_positions ); // for flatten, market can be ALL
+    void trackSent( QNetworkReply *const &reply, Request *const &request ); // moves request from nam_queue to nam_queue_sent
+    Request *takeSent( QNetworkReply *const &reply ); // nullptr if we weren't tracking reply
+    void recordReply( QNetworkReply *const &reply, Request *const &request, const qint64 current_time ); // feeds the breaker of its class
+    bool isClassPaused( const quint8 request_class ) const; // its breaker is open, don't pile more of it up
     void deleteReply( QNetworkReply *const &reply, Request *const &request );
+    const QByteArray &readReply( QNetworkReply *const &reply ); // body in reply_buffer, valid until the next read
+    void readServerDate( QNetworkReply *const &reply, const qint64 sent_ms, const qint64 received_ms ); // a server_clock sample
+    qint64 getServerTime() const; // our clock corrected by server_clock, for signed timestamps
+    const QByteArray &readMessage( const QString &msg ); // utf-8 of a wss text frame in reply_buffer, same
+    qint64 getRequestBytes() const; // estimated, the queued, sent and free requests and the reply buffer, for getmemory
+
+    void startConnectionWarming( const QString &url ); // connect before the first request, and again after idle periods
+    void onWarmConnection();
+
+    // exchange metadata replies are kept on disk, so a restart can set up its markets before the first reply is back
+    bool readMetadataCache( const QString &name, const qint64 max_age_secs, QJsonObject &obj ) const; // false if missing or too old
+    bool readMetadataCache( const QString &name, const qint64 max_age_secs, QByteArray &data ) const; // same, the bytes as they were written
+    void writeMetadataCache( const QString &name, const QByteArray &data );
 
-    QQueue<Request*> nam_queue; // queue for requests so we can load balance timestamp/hmac generation
+    RequestQueue nam_queue; // queue for requests so we can load balance timestamp/hmac generation
     QHash<QNetworkReply*,Request*> nam_queue_sent; // request tracking queue
+    QHash<QString/*command kind*/, qint32> sent_by_kind; // counts for nam_queue_sent
+    QVector<qint32> sent_by_class{ QVector<qint32>( REQUEST_CLASS_COUNT, 0 ) }; // ^
+    QHash<QString/*api_command + body*/, Request*> sent_status_by_command; // sent order status queries, for coalesceRequest()
+    QHash<QString/*command kind*/, RequestTemplate> request_templates;
+    QVector<Request*> free_requests; // released requests, reused by sendRequest()
+    QByteArray reply_buffer; // reused for every reply body, keeps its capacity
+    ReplyParser *parser{ nullptr }; // parses large replies off our thread, for the subclasses that use it
 
     KeyStore keystore;
-    AvgResponseTime avg_response_time;
+    HmacSigner signer; // keyed with the keystore secret in init()
+    ResponseTimes response_times; // per api command class
     QString exchange_string;
 
     qint64 request_nonce{ 0 }; // nonce (except for trex which uses time atm)
+    qint64 coalesced_request_count{ 0 }; // duplicate status queries dropped by coalesceRequest()
+    ServerClock server_clock; // from the Date header of the replies
+    qint64 clock_rejects_avoided{ 0 }; // signed requests the server would have rejected with our own clock's timestamp
     qint64 last_request_sent_ms{ 0 }; // last nam request time
 
     qint64 orderbook_update_time{ 0 }; // most recent trade time
@@ -53,20 +129,40 @@ struct BaseREST : public QObject
     qint64 ticker_update_request_time{ 0 };
     qint32 limit_commands_queued{ 35 }; // stop checks if we are over this many commands queued
     qint32 limit_commands_queued_dc_check{ 10 }; // skip dc check if we are over this many commands queued
-    qint32 limit_commands_sent{ 60 }; // stop checks if we are over this many commands sent
+    qint32 limit_commands_sent{ 60 }; // stop checks if we are over this many commands sent (see getSentLimit())
     qint32 limit_timeout_yield{ 12 };
+    qint64 limit_response_time_tail{ 5000 }; // halve limit_commands_sent while the recent p90 reply time is over this
+    qint64 limit_response_time_lag{ 15000 }; // yield to lag while the recent p99 reply time is over this
     qint32 market_cancel_thresh{ 300 }; // limit for market order total for weighting cancels to be sent first
+    QVector<qint32> limit_commands_sent_by_class{ QVector<qint32>( REQUEST_CLASS_COUNT, 0 ) }; // in-flight limit per request class, 0 = none
+    QVector<CircuitBreaker> breakers{ QVector<CircuitBreaker>( REQUEST_CLASS_COUNT ) }; // per request class, a failing class waits while the rest go
+    FlowTuner flow_tuner; // the slo is limit_response_time_tail, setting a limit by command pins it
 
     qint64 slippage_stale_time{ 500 }; // quiet time before we allow an order to be included in slippage price calculations
     qint64 orderbook_stale_tolerance{ 10000 }; // only accept orderbooks sent within this time
     qint64 orders_stale_trip_count{ 0 };
+    QVector<OrderRecord> open_orders; // filled by parseOpenOrders(), kept to reuse its capacity
     qint64 books_stale_trip_count{ 0 };
 
-    QTimer *send_timer{ nullptr };
-    QTimer *orderbook_timer{ nullptr };
-    QTimer *ticker_timer{ nullptr };
-    QTimer *timeout_timer{ nullptr };
-    QTimer *diverge_converge_timer{ nullptr };
+    // tasks on the engine's scheduler, see TaskScheduler
+    ScheduledTask *send_timer{ nullptr }; // idle tick, wakeSendQueue() sends the rest as soon as the limiter allows
+    ScheduledTask *send_wake_timer{ nullptr };
+    TokenBucket send_limiter;
+    SharedTokenBucket *shared_send_limiter{ nullptr }; // owned by Trader, used instead of send_limiter when set
+    ScheduledTask *orderbook_timer{ nullptr };
+    ScheduledTask *ticker_timer{ nullptr };
+    ScheduledTask *timeout_timer{ nullptr };
+    ScheduledTask *diverge_converge_timer{ nullptr };
+    ScheduledTask *warm_timer{ nullptr };
+    ScheduledTask *flow_tune_timer{ nullptr };
+    ScheduledTask *balance_timer{ nullptr }; // reconciles the ledger, started by the subclass without a ticker only build
+    bool is_printing_balances{ false }; // the next balance reply is printed, for getbalances
+    QUrl warm_url; // host we keep a connection open to
+    qint64 last_warm_time{ 0 };
+    qint64 session_ticket_save_time{ 0 };
+    mutable qint64 yield_print_time{ 0 }; // last 'waiting' print of yieldToServer()
+    bool is_http2_supported{ false }; // the exchange negotiates h2, set by the subclass
+    bool is_http2_allowed{ false };
 
     QNetworkAccessManager *nam{ nullptr };
     Engine *engine{ nullptr };
@@ -0,0 +1,112 @@
+#include "bbocache.h"
+#include "virtualclock.h"
+
+void BboCache::update( const quint8 engine_type, const QString &market, const TickerInfo &ticker, const qint64 time )
+{
+    if ( !ticker.isValid() )
+        return;
+
+    QMutexLocker locker( &lock );
+
+    tickers[ market ].insert( engine_type, TickerInfo( ticker.bid, ticker.ask ) );
+
+    // a stale exchange's prices are kept for when it comes back
+    if ( !stale_exchanges.contains( engine_type ) )
+        rebuild( market, time );
+}
+
+void BboCache::setStale( const quint8 engine_type, const bool stale )
+{
+    QMutexLocker locker( &lock );
+
+    if ( stale == stale_exchanges.contains( engine_type ) )
+        return;
+
+    if ( stale )
+        stale_exchanges.insert( engine_type );
+    else
+        stale_exchanges.remove( engine_type );
+
+    // rebuild the markets the exchange has prices for
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
+    for ( QHash<QString, QMap<quint8, TickerInfo>>::const_iterator i = tickers.begin(); i != tickers.end(); i++ )
+        if ( i.value().contains( engine_type ) )
+            rebuild( i.key(), current_time );
+}
+
+bool BboCache::isStale( const quint8 engine_type ) const
+{
+    QMutexLocker locker( &lock );
+    return stale_exchanges.contains( engine_type );
+}
+
+void BboCache::remove( const QString &market )
+{
+    QMutexLocker locker( &lock );
+    tickers.remove( market );
+    quotes.remove( market );
+}
+
+BboQuote BboCache::getQuote( const QString &market ) const
+{
+    QMutexLocker locker( &lock );
+    return quotes.value( market );
+}
+
+void BboCache::rebuild( const QString &market, const qint64 time )
+{
+    const QMap<quint8, TickerInfo> &market_tickers = tickers[ market ];
+
+    BboQuote quote;
+    quote.update_time = time;
+
+    Coin bid_sum, ask_sum;
+
+    for ( QMap<quint8, TickerInfo>::const_iterator i = market_tickers.begin(); i != market_tickers.end(); i++ )
+    {
+        if ( stale_exchanges.contains( i.key() ) )
+            continue;
+
+        const TickerInfo &ticker = i.value();
+
+        if ( quote.source_count == 0 || ticker.bid > quote.best.bid )
+        {
+            quote.best.bid = ticker.bid;
+            quote.best_bid_source = i.key();
+        }
+        if ( quote.source_count == 0 || ticker.ask < quote.best.ask )
+        {
+            quote.best.ask = ticker.ask;
+            quote.best_ask_source = i.key();
+        }
+        if ( quote.source_count == 0 || ticker.bid < quote.widest.bid )
+            quote.widest.bid = ticker.bid;
+        if ( quote.source_count == 0 || ticker.ask > quote.widest.ask )
+            quote.widest.ask = ticker.ask;
+
+        bid_sum += ticker.bid;
+        ask_sum += ticker.ask;
+        quote.source_count++;
+    }
+
+    // nothing fresh
+    if ( quote.source_count == 0 )
+    {
+        quotes.remove( market );
+        return;
+    }
+
+    quote.average.bid = bid_sum;
+    quote.average.ask = ask_sum;
+
+    if ( quote.source_count > 1 )
+    {
+        quote.average.bid /= quote.source_count;
+        quote.average.ask /= quote.source_count;
+    }
+
+    quote.average_mid_price = quote.average.getMidPrice();
+    quote.widest_mid_price = quote.widest.getMidPrice();
+
+    quotes.insert( market, quote );
+}
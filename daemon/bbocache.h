@@ -0,0 +1,54 @@
+#ifndef BBOCACHE_H
+#define BBOCACHE_H
+
+#include "global.h"
+#include "coinamount.h"
+#include "misctypes.h"
+
+#include <QMutex>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+
+static const qint64 TICKER_STALE_TIME = 60000; // an exchange's tickers drop out after this long without one
+
+// the consolidated prices of one market across the exchanges with fresh tickers
+struct BboQuote
+{
+    bool isValid() const { return source_count > 0; }
+
+    TickerInfo best; // highest bid and lowest ask
+    quint8 best_bid_source{ 0 }; // engine type
+    quint8 best_ask_source{ 0 };
+    TickerInfo average; // average bid and ask
+    TickerInfo widest; // lowest bid and highest ask
+    Coin average_mid_price;
+    Coin widest_mid_price;
+    qint32 source_count{ 0 };
+    qint64 update_time{ 0 }; // when a ticker of this market last changed
+};
+
+//
+// BboCache, shared by the engines. each one pushes a ticker when it changes and flags its exchange stale when the
+// tickers stop, the quote of the market is rebuilt then so reading it is a hash lookup
+//
+class BboCache
+{
+public:
+    void update( const quint8 engine_type, const QString &market, const TickerInfo &ticker, const qint64 time );
+    void setStale( const quint8 engine_type, const bool stale ); // drops or restores the exchange's prices in every market
+    bool isStale( const quint8 engine_type ) const;
+    void remove( const QString &market );
+
+    BboQuote getQuote( const QString &market ) const; // invalid if no fresh exchange has a ticker for it
+
+private:
+    void rebuild( const QString &market, const qint64 time );
+
+    mutable QMutex lock;
+    QHash<QString/*market*/, QMap<quint8/*engine type*/, TickerInfo>> tickers;
+    QHash<QString/*market*/, BboQuote> quotes;
+    QSet<quint8/*engine type*/> stale_exchanges;
+};
+
+#endif // BBOCACHE_H
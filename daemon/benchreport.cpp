@@ -0,0 +1,129 @@
+#include "benchreport.h"
+
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<quint64> allocation_count( 0 );
+
+void *operator new( std::size_t size )
+{
+    allocation_count.fetch_add( 1, std::memory_order_relaxed );
+
+    void *p = std::malloc( size ? size : 1 );
+    if ( !p )
+        throw std::bad_alloc();
+
+    return p;
+}
+
+void operator delete( void *p ) noexcept
+{
+    std::free( p );
+}
+
+void operator delete( void *p, std::size_t ) noexcept
+{
+    std::free( p );
+}
+
+namespace
+{
+
+static QString json_path;
+static QVector<BenchReport::Result> results;
+
+// nearest rank of the sorted samples
+qreal getPercentile( const QVector<qreal> &sorted, const qreal p )
+{
+    if ( sorted.isEmpty() )
+        return 0.;
+
+    const qint32 rank = qint32( std::ceil( p * sorted.size() ) );
+    return sorted.at( qBound( 0, rank -1, sorted.size() -1 ) );
+}
+
+} // namespace
+
+bool BenchReport::init( QStringList &args )
+{
+    const qint32 i = args.indexOf( "--json" );
+    if ( i < 0 )
+        return true;
+
+    if ( i +1 >= args.size() )
+    {
+        kDebug() << "local error: --json needs a path";
+        return false;
+    }
+
+    json_path = args.at( i +1 );
+    args.removeAt( i +1 );
+    args.removeAt( i );
+    return true;
+}
+
+quint64 BenchReport::getAllocations()
+{
+    return allocation_count.load( std::memory_order_relaxed );
+}
+
+BenchReport::Result BenchReport::getResult( const QString &name, const qint64 ops, const qint64 ns, const quint64 allocations,
+                                            QVector<qreal> samples )
+{
+    std::sort( samples.begin(), samples.end() );
+
+    Result result;
+    result.name = name;
+    result.ops = ops;
+    result.ns_per_op = ops > 0 ? qreal( ns ) / ops : 0.;
+    result.p50_ns = getPercentile( samples, 0.50 );
+    result.p99_ns = getPercentile( samples, 0.99 );
+    result.allocs_per_op = ops > 0 ? qreal( allocations ) / ops : 0.;
+
+    return result;
+}
+
+void BenchReport::add( const Result &result )
+{
+    results += result;
+}
+
+bool BenchReport::finish( const QString &bench )
+{
+    if ( json_path.isEmpty() )
+        return true;
+
+    QJsonArray list;
+    for ( QVector<Result>::const_iterator i = results.begin(); i != results.end(); i++ )
+    {
+        QJsonObject obj;
+        obj[ "name" ] = i->name;
+        obj[ "ops" ] = qreal( i->ops );
+        obj[ "ns_per_op" ] = i->ns_per_op;
+        obj[ "p50_ns" ] = i->p50_ns;
+        obj[ "p99_ns" ] = i->p99_ns;
+        obj[ "allocs_per_op" ] = i->allocs_per_op;
+        list += obj;
+    }
+
+    QJsonObject doc;
+    doc[ "bench" ] = bench;
+    doc[ "results" ] = list;
+
+    QFile file( json_path );
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) ||
+         file.write( QJsonDocument( doc ).toJson( QJsonDocument::Indented ) ) < 0 )
+    {
+        kDebug() << "local error: couldn't write results to" << json_path;
+        return false;
+    }
+
+    return true;
+}
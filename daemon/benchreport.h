@@ -0,0 +1,81 @@
+#ifndef BENCHREPORT_H
+#define BENCHREPORT_H
+
+#include "global.h"
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <algorithm>
+
+//
+// BenchReport, the results a bench passes to perf_suite. each bench still prints its own lines, and with
+// '--json <path>' it also writes every result it added as one json document. linking this in replaces operator new
+// with one that counts calls, Qt's containers and strings allocate with malloc and aren't counted
+//
+namespace BenchReport
+{
+    static const qint32 SAMPLE_COUNT = 100; // slices measure() times on their own, for the percentiles
+
+    struct Result
+    {
+        QString name;
+        qint64 ops{ 0 };
+        qreal ns_per_op{ 0. };
+        qreal p50_ns{ 0. }; // of the samples, each one in ns per op
+        qreal p99_ns{ 0. };
+        qreal allocs_per_op{ 0. };
+    };
+
+    bool init( QStringList &args ); // takes '--json <path>' out of the args, false if the path is missing
+    quint64 getAllocations(); // operator new calls so far, from every thread
+
+    Result getResult( const QString &name, const qint64 ops, const qint64 ns, const quint64 allocations, QVector<qreal> samples );
+    void add( const Result &result );
+    bool finish( const QString &bench ); // writes the json if it was asked for
+
+    // runs func( i ) for each i in SAMPLE_COUNT slices after a warm up, then adds and prints the result
+    template <typename F>
+    Result measure( const QString &name, const qint32 iterations, F func )
+    {
+        for ( qint32 i = 0; i < iterations / 10 +1; i++ )
+            func( i );
+
+        const qint32 slices = std::min( iterations, SAMPLE_COUNT );
+        QVector<qreal> samples;
+        samples.reserve( slices );
+
+        const quint64 allocations_start = getAllocations();
+        QElapsedTimer t;
+        qint64 ns = 0;
+        qint32 i = 0;
+
+        for ( qint32 s = 0; s < slices; s++ )
+        {
+            const qint32 begin = i, end = qint32( qint64( iterations ) * ( s +1 ) / slices );
+
+            t.start();
+            for ( ; i < end; i++ )
+                func( i );
+
+            const qint64 slice_ns = t.nsecsElapsed();
+            ns += slice_ns;
+            samples += qreal( slice_ns ) / ( end - begin );
+        }
+
+        const Result result = getResult( name, iterations, ns, getAllocations() - allocations_start, samples );
+        add( result );
+
+        kDebug() << QString( "%1 %2 ns/op | p99 %3 ns | %4 allocs/op" )
+                    .arg( name, -40 )
+                    .arg( result.ns_per_op, 10, 'f', 1 )
+                    .arg( result.p99_ns, 10, 'f', 1 )
+                    .arg( result.allocs_per_op, 0, 'f', 1 );
+
+        return result;
+    }
+}
+
+#endif // BENCHREPORT_H
@@ -0,0 +1,312 @@
+#include "blake2bdispatch.h"
+
+#include <cstring>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#define BLAKE2B_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*CompressFunction)( uint64_t h[ 8 ], const uint8_t *block, const uint64_t t, const bool last );
+
+static const uint64_t IV[ 8 ] =
+{
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static const uint8_t SIGMA[ 12 ][ 16 ] =
+{
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+};
+
+static inline uint64_t load64( const uint8_t *p )
+{
+    uint64_t v = 0;
+    for ( int i = 7; i >= 0; i-- )
+        v = ( v << 8 ) | p[ i ];
+
+    return v;
+}
+
+static inline void store64( uint8_t *p, uint64_t v )
+{
+    for ( int i = 0; i < 8; i++, v >>= 8 )
+        p[ i ] = uint8_t( v );
+}
+
+static inline uint64_t rotr64( const uint64_t v, const int c )
+{
+    return ( v >> c ) | ( v << ( 64 - c ) );
+}
+
+static inline void loadMessage( uint64_t m[ 16 ], const uint8_t *block )
+{
+    for ( int i = 0; i < 16; i++ )
+        m[ i ] = load64( block + i * 8 );
+}
+
+static void compressScalar( uint64_t h[ 8 ], const uint8_t *block, const uint64_t t, const bool last )
+{
+    uint64_t m[ 16 ], v[ 16 ];
+    loadMessage( m, block );
+
+    for ( int i = 0; i < 8; i++ )
+    {
+        v[ i ] = h[ i ];
+        v[ i + 8 ] = IV[ i ];
+    }
+
+    v[ 12 ] ^= t;
+    if ( last )
+        v[ 14 ] = ~v[ 14 ];
+
+#define G( a, b, c, d, x, y ) \
+    v[ a ] += v[ b ] + ( x ); v[ d ] = rotr64( v[ d ] ^ v[ a ], 32 ); \
+    v[ c ] += v[ d ];         v[ b ] = rotr64( v[ b ] ^ v[ c ], 24 ); \
+    v[ a ] += v[ b ] + ( y ); v[ d ] = rotr64( v[ d ] ^ v[ a ], 16 ); \
+    v[ c ] += v[ d ];         v[ b ] = rotr64( v[ b ] ^ v[ c ], 63 );
+
+    for ( int r = 0; r < 12; r++ )
+    {
+        const uint8_t *s = SIGMA[ r ];
+        G( 0, 4,  8, 12, m[ s[  0 ] ], m[ s[  1 ] ] )
+        G( 1, 5,  9, 13, m[ s[  2 ] ], m[ s[  3 ] ] )
+        G( 2, 6, 10, 14, m[ s[  4 ] ], m[ s[  5 ] ] )
+        G( 3, 7, 11, 15, m[ s[  6 ] ], m[ s[  7 ] ] )
+        G( 0, 5, 10, 15, m[ s[  8 ] ], m[ s[  9 ] ] )
+        G( 1, 6, 11, 12, m[ s[ 10 ] ], m[ s[ 11 ] ] )
+        G( 2, 7,  8, 13, m[ s[ 12 ] ], m[ s[ 13 ] ] )
+        G( 3, 4,  9, 14, m[ s[ 14 ] ], m[ s[ 15 ] ] )
+    }
+
+#undef G
+
+    for ( int i = 0; i < 8; i++ )
+        h[ i ] ^= v[ i ] ^ v[ i + 8 ];
+}
+
+#if defined( BLAKE2B_X86 )
+
+// rows as two 128 bit halves, the messages are gathered per round
+__attribute__(( target( "sse4.1" ) ))
+static void compressSse41( uint64_t h[ 8 ], const uint8_t *block, const uint64_t t, const bool last )
+{
+    uint64_t m[ 16 ];
+    std::memcpy( m, block, sizeof( m ) ); // x86 is little endian
+
+    const __m128i r16 = _mm_setr_epi8( 2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9 );
+    const __m128i r24 = _mm_setr_epi8( 3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10 );
+
+    __m128i a0 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( h ) );
+    __m128i a1 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( h + 2 ) );
+    __m128i b0 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( h + 4 ) );
+    __m128i b1 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( h + 6 ) );
+    __m128i c0 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( IV ) );
+    __m128i c1 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( IV + 2 ) );
+    __m128i d0 = _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( IV + 4 ) ), _mm_set_epi64x( 0, int64_t( t ) ) );
+    __m128i d1 = _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( IV + 6 ) ), _mm_set_epi64x( 0, last ? -1 : 0 ) );
+    __m128i x0, x1, y0, y1, tmp;
+
+#define G_HALF( a, b, c, d, x, y ) \
+    a = _mm_add_epi64( _mm_add_epi64( a, b ), x ); d = _mm_shuffle_epi32( _mm_xor_si128( d, a ), _MM_SHUFFLE( 2, 3, 0, 1 ) ); \
+    c = _mm_add_epi64( c, d ); b = _mm_shuffle_epi8( _mm_xor_si128( b, c ), r24 ); \
+    a = _mm_add_epi64( _mm_add_epi64( a, b ), y ); d = _mm_shuffle_epi8( _mm_xor_si128( d, a ), r16 ); \
+    c = _mm_add_epi64( c, d ); b = _mm_xor_si128( b, c ); b = _mm_xor_si128( _mm_srli_epi64( b, 63 ), _mm_add_epi64( b, b ) );
+
+    for ( int r = 0; r < 12; r++ )
+    {
+        const uint8_t *s = SIGMA[ r ];
+
+        // columns
+        x0 = _mm_set_epi64x( int64_t( m[ s[ 2 ] ] ), int64_t( m[ s[ 0 ] ] ) );
+        y0 = _mm_set_epi64x( int64_t( m[ s[ 3 ] ] ), int64_t( m[ s[ 1 ] ] ) );
+        x1 = _mm_set_epi64x( int64_t( m[ s[ 6 ] ] ), int64_t( m[ s[ 4 ] ] ) );
+        y1 = _mm_set_epi64x( int64_t( m[ s[ 7 ] ] ), int64_t( m[ s[ 5 ] ] ) );
+        G_HALF( a0, b0, c0, d0, x0, y0 )
+        G_HALF( a1, b1, c1, d1, x1, y1 )
+
+        // diagonals, rotate b, c, d left by 1, 2, 3 lanes
+        tmp = _mm_alignr_epi8( b1, b0, 8 ); b1 = _mm_alignr_epi8( b0, b1, 8 ); b0 = tmp;
+        tmp = c0; c0 = c1; c1 = tmp;
+        tmp = _mm_alignr_epi8( d0, d1, 8 ); d1 = _mm_alignr_epi8( d1, d0, 8 ); d0 = tmp;
+
+        x0 = _mm_set_epi64x( int64_t( m[ s[ 10 ] ] ), int64_t( m[ s[  8 ] ] ) );
+        y0 = _mm_set_epi64x( int64_t( m[ s[ 11 ] ] ), int64_t( m[ s[  9 ] ] ) );
+        x1 = _mm_set_epi64x( int64_t( m[ s[ 14 ] ] ), int64_t( m[ s[ 12 ] ] ) );
+        y1 = _mm_set_epi64x( int64_t( m[ s[ 15 ] ] ), int64_t( m[ s[ 13 ] ] ) );
+        G_HALF( a0, b0, c0, d0, x0, y0 )
+        G_HALF( a1, b1, c1, d1, x1, y1 )
+
+        // and back
+        tmp = _mm_alignr_epi8( b0, b1, 8 ); b1 = _mm_alignr_epi8( b1, b0, 8 ); b0 = tmp;
+        tmp = c0; c0 = c1; c1 = tmp;
+        tmp = _mm_alignr_epi8( d1, d0, 8 ); d1 = _mm_alignr_epi8( d0, d1, 8 ); d0 = tmp;
+    }
+
+#undef G_HALF
+
+    a0 = _mm_xor_si128( a0, c0 );
+    a1 = _mm_xor_si128( a1, c1 );
+    b0 = _mm_xor_si128( b0, d0 );
+    b1 = _mm_xor_si128( b1, d1 );
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( h ), _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( h ) ), a0 ) );
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( h + 2 ), _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( h + 2 ) ), a1 ) );
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( h + 4 ), _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( h + 4 ) ), b0 ) );
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( h + 6 ), _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( h + 6 ) ), b1 ) );
+}
+
+// one row per 256 bit register
+__attribute__(( target( "avx2" ) ))
+static void compressAvx2( uint64_t h[ 8 ], const uint8_t *block, const uint64_t t, const bool last )
+{
+    uint64_t m[ 16 ];
+    std::memcpy( m, block, sizeof( m ) );
+
+    const __m256i r16 = _mm256_setr_epi8( 2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+                                          2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9 );
+    const __m256i r24 = _mm256_setr_epi8( 3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+                                          3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10 );
+
+    const __m256i h0 = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( h ) );
+    const __m256i h1 = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( h + 4 ) );
+    __m256i a = h0;
+    __m256i b = h1;
+    __m256i c = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( IV ) );
+    __m256i d = _mm256_xor_si256( _mm256_loadu_si256( reinterpret_cast<const __m256i*>( IV + 4 ) ),
+                                  _mm256_set_epi64x( 0, last ? -1 : 0, 0, int64_t( t ) ) );
+    __m256i x, y;
+
+#define G_ROW( x, y ) \
+    a = _mm256_add_epi64( _mm256_add_epi64( a, b ), x ); d = _mm256_shuffle_epi32( _mm256_xor_si256( d, a ), _MM_SHUFFLE( 2, 3, 0, 1 ) ); \
+    c = _mm256_add_epi64( c, d ); b = _mm256_shuffle_epi8( _mm256_xor_si256( b, c ), r24 ); \
+    a = _mm256_add_epi64( _mm256_add_epi64( a, b ), y ); d = _mm256_shuffle_epi8( _mm256_xor_si256( d, a ), r16 ); \
+    c = _mm256_add_epi64( c, d ); b = _mm256_xor_si256( b, c ); b = _mm256_xor_si256( _mm256_srli_epi64( b, 63 ), _mm256_add_epi64( b, b ) );
+
+    for ( int r = 0; r < 12; r++ )
+    {
+        const uint8_t *s = SIGMA[ r ];
+
+        // columns
+        x = _mm256_set_epi64x( int64_t( m[ s[ 6 ] ] ), int64_t( m[ s[ 4 ] ] ), int64_t( m[ s[ 2 ] ] ), int64_t( m[ s[ 0 ] ] ) );
+        y = _mm256_set_epi64x( int64_t( m[ s[ 7 ] ] ), int64_t( m[ s[ 5 ] ] ), int64_t( m[ s[ 3 ] ] ), int64_t( m[ s[ 1 ] ] ) );
+        G_ROW( x, y )
+
+        // diagonals
+        b = _mm256_permute4x64_epi64( b, _MM_SHUFFLE( 0, 3, 2, 1 ) );
+        c = _mm256_permute4x64_epi64( c, _MM_SHUFFLE( 1, 0, 3, 2 ) );
+        d = _mm256_permute4x64_epi64( d, _MM_SHUFFLE( 2, 1, 0, 3 ) );
+
+        x = _mm256_set_epi64x( int64_t( m[ s[ 14 ] ] ), int64_t( m[ s[ 12 ] ] ), int64_t( m[ s[ 10 ] ] ), int64_t( m[ s[  8 ] ] ) );
+        y = _mm256_set_epi64x( int64_t( m[ s[ 15 ] ] ), int64_t( m[ s[ 13 ] ] ), int64_t( m[ s[ 11 ] ] ), int64_t( m[ s[  9 ] ] ) );
+        G_ROW( x, y )
+
+        b = _mm256_permute4x64_epi64( b, _MM_SHUFFLE( 2, 1, 0, 3 ) );
+        c = _mm256_permute4x64_epi64( c, _MM_SHUFFLE( 1, 0, 3, 2 ) );
+        d = _mm256_permute4x64_epi64( d, _MM_SHUFFLE( 0, 3, 2, 1 ) );
+    }
+
+#undef G_ROW
+
+    _mm256_storeu_si256( reinterpret_cast<__m256i*>( h ), _mm256_xor_si256( h0, _mm256_xor_si256( a, c ) ) );
+    _mm256_storeu_si256( reinterpret_cast<__m256i*>( h + 4 ), _mm256_xor_si256( h1, _mm256_xor_si256( b, d ) ) );
+}
+
+#endif // BLAKE2B_X86
+
+static CompressFunction getCompress( const Blake2bDispatch::Backend backend )
+{
+#if defined( BLAKE2B_X86 )
+    if ( backend == Blake2bDispatch::Avx2 )
+        return compressAvx2;
+    if ( backend == Blake2bDispatch::Sse41 )
+        return compressSse41;
+#else
+    (void) backend;
+#endif
+    return compressScalar;
+}
+
+static void hashWith( const CompressFunction compress, const char *in, size_t size, uint8_t out[ 32 ] )
+{
+    // parameter block for an unkeyed 32 byte digest: digest length, key length 0, fanout 1, depth 1
+    uint64_t h[ 8 ];
+    std::memcpy( h, IV, sizeof( h ) );
+    h[ 0 ] ^= 0x01010000ULL ^ 32;
+
+    const uint8_t *p = reinterpret_cast<const uint8_t*>( in );
+    uint64_t t = 0;
+
+    // the last block is compressed with the final flag, even if it's full
+    for ( ; size > 128; size -= 128, p += 128 )
+    {
+        t += 128;
+        compress( h, p, t, false );
+    }
+
+    uint8_t tail[ 128 ] = {};
+    if ( size > 0 )
+        std::memcpy( tail, p, size );
+
+    t += size;
+    compress( h, tail, t, true );
+
+    for ( int i = 0; i < 4; i++ )
+        store64( out + i * 8, h[ i ] );
+}
+
+bool Blake2bDispatch::isSupported( const Backend backend )
+{
+    return backend <= getBackend();
+}
+
+Blake2bDispatch::Backend Blake2bDispatch::getBackend()
+{
+    static const Backend backend = []()
+    {
+#if defined( BLAKE2B_X86 )
+        // also checks that the os saves the avx registers
+        __builtin_cpu_init();
+
+        if ( __builtin_cpu_supports( "avx2" ) )
+            return Avx2;
+        if ( __builtin_cpu_supports( "sse4.1" ) )
+            return Sse41;
+#endif
+        return Scalar;
+    }();
+
+    return backend;
+}
+
+const char *Blake2bDispatch::getBackendName( const Backend backend )
+{
+    if ( backend == Avx2 )
+        return "avx2";
+    if ( backend == Sse41 )
+        return "sse4.1";
+
+    return "scalar";
+}
+
+void Blake2bDispatch::hash256( const char *in, const size_t size, uint8_t out[ 32 ] )
+{
+    static const CompressFunction compress = getCompress( getBackend() );
+    hashWith( compress, in, size, out );
+}
+
+void Blake2bDispatch::hash256( const Backend backend, const char *in, const size_t size, uint8_t out[ 32 ] )
+{
+    hashWith( getCompress( isSupported( backend ) ? backend : getBackend() ), in, size, out );
+}
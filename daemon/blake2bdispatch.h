@@ -0,0 +1,28 @@
+#ifndef BLAKE2BDISPATCH_H
+#define BLAKE2BDISPATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Blake2bDispatch, unkeyed blake2b-256 (what waves hashes with) with the compression picked from cpuid on startup,
+// so one binary uses avx2 or sse4.1 where the host has it and plain c elsewhere. hashes into the caller's buffer
+//
+namespace Blake2bDispatch
+{
+    enum Backend
+    {
+        Scalar,
+        Sse41,
+        Avx2
+    };
+
+    bool isSupported( const Backend backend );
+    Backend getBackend(); // the best supported one, used by hash256()
+    const char *getBackendName( const Backend backend );
+
+    void hash256( const char *in, const size_t size, uint8_t out[ 32 ] );
+    void hash256( const Backend backend, const char *in, const size_t size, uint8_t out[ 32 ] ); // backend must be supported
+}
+
+#endif // BLAKE2BDISPATCH_H
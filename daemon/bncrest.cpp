@@ -1,7 +1,12 @@
 #include "bncrest.h"
 #include "engine.h"
+#include "taskscheduler.h"
+#include "virtualclock.h"
+#include "tracespan.h"
 #include "position.h"
 #include "positionman.h"
+#include "jsonstreamreader.h"
+#include "replyparser.h"
 
 #include <QTimer>
 #include <QNetworkAccessManager>
@@ -14,6 +19,36 @@
 #include <QWebSocket>
 #include <QtMath>
 
+static const QString EXCHANGEINFO_CACHE_NAME = "exchangeinfo";
+static const qint64 EXCHANGEINFO_CACHE_MAX_AGE_SECS = 60 * 60 * 24; // ticksizes and filters rarely change, and it's asked for again anyway
+static const qint64 EXCHANGEINFO_FULL_INTERVAL = 60000 * 60 * 24; // every symbol, for the new ones, between these the markets we trade
+static const qint32 EXCHANGEINFO_SYMBOLS_MAX = 100; // more than this many, and asking for every one is smaller
+static const qint64 EXCHANGEINFO_MISSING_RETRY = 60000; // between asks for a market we trade that the ticker has and we have no filters for
+static const qreal RATELIMIT_RESERVE = 0.02; // of a server counted limit, left for requests the server saw before we did
+static const qint64 RATELIMIT_BACKOFF_DEFAULT = 60000; // after a 429 or 418 without a Retry-After
+static const qint64 RECV_WINDOW = 120000; // 2 minutes recvWindow because we aren't bad
+static const qint64 TIMESTAMP_AHEAD_LIMIT = 1000; // the server rejects timestamps further ahead of it than this
+
+// "1m", "10s", "1d" of a rate limit header, 0 if it isn't one
+static qint64 getHeaderIntervalMs( const QByteArray &suffix )
+{
+    if ( suffix.size() < 2 )
+        return 0;
+
+    const qint64 count = suffix.left( suffix.size() -1 ).toLongLong();
+    const char unit = suffix.at( suffix.size() -1 );
+
+    return count * ( unit == 's' ? 1000 :
+                     unit == 'm' ? 60000 :
+                     unit == 'h' ? 3600000 :
+                     unit == 'd' ? 86400000 : 0 );
+}
+
+static qint32 getRateLimitReserve( const qint32 limit )
+{
+    return qMax( 1, qCeil( limit * RATELIMIT_RESERVE ) );
+}
+
 BncREST::BncREST( Engine *_engine , QNetworkAccessManager *_nam )
   : BaseREST( _engine )
 {
@@ -21,20 +56,28 @@ BncREST::BncREST( Engine *_engine , QNetworkAccessManager *_nam )
 
     nam = _nam;
     connect( nam, &QNetworkAccessManager::finished, this, &BncREST::onNamReply );
+    connect( parser, &ReplyParser::parsed, this, &BncREST::onParsedReplies, Qt::QueuedConnection );
 
     exchange_string = BINANCE_EXCHANGE_STR;
+    is_http2_supported = true;
 }
 
 BncREST::~BncREST()
 {
-    exchangeinfo_timer->stop();
-    ratelimit_timer->stop();
+    // our tasks go with us, see TaskScheduler::addTask()
+    exchangeinfo_timer = nullptr;
+    wss_timer = nullptr;
 
-    delete exchangeinfo_timer;
-    delete ratelimit_timer;
+    // dispose of websocket
+    if ( wss )
+    {
+        // disconnect wss so we don't call wssCheckConnection()
+        disconnect( wss, &QWebSocket::disconnected, this, &BncREST::wssCheckConnection );
 
-    exchangeinfo_timer = nullptr;
-    ratelimit_timer = nullptr;
+        wss->abort();
+        delete wss;
+        wss = nullptr;
+    }
 
     kDebug() << "[BncREST] done.";
 }
@@ -47,156 +90,222 @@ void BncREST::init()
     BaseREST::limit_timeout_yield = 12;
     BaseREST::market_cancel_thresh = 300; // limit for market order total for weighting cancels to be sent first
 
-    connect( send_timer, &QTimer::timeout, this, &BncREST::sendNamQueue );
+    send_timer->setCallback( [this]() { sendNamQueue(); } );
+    send_wake_timer->setCallback( [this]() { sendNamQueue(); } );
     send_timer->start( BINANCE_TIMER_INTERVAL_NAM_SEND ); // minimum threshold 200 or so
+    setSendRate( 1000. / BINANCE_TIMER_INTERVAL_NAM_SEND ); // same average rate as the timer, in bursts
 
-    connect( ticker_timer, &QTimer::timeout, this, &BncREST::onCheckTicker );
+    // open the connection now instead of on the first request
+    startConnectionWarming( getWarmUrl() );
+
+    prebuildRequestTemplates( QStringList() << BNC_COMMAND_GETORDERS << BNC_COMMAND_BUYSELL << BNC_COMMAND_CANCEL << BNC_COMMAND_CANCEL_PAIR
+                                            << BNC_COMMAND_CANCEL_REPLACE
+                                            << BNC_COMMAND_GETORDER << BNC_COMMAND_GETTICKER
+                                            << BNC_COMMAND_GETEXCHANGEINFO << BNC_COMMAND_GETBALANCES
+                                            << BNC_COMMAND_NEWLISTENKEY << BNC_COMMAND_KEEPLISTENKEY );
+
+    ticker_timer->setCallback( [this]() { onCheckTicker(); } );
     ticker_timer->start( BINANCE_TIMER_INTERVAL_TICKER );
 
-    // this timer sets the network rate, fee, price ticksizes, and quantity ticksizes
-    exchangeinfo_timer = new QTimer( this );
-    connect( exchangeinfo_timer, &QTimer::timeout, this, &BncREST::onCheckExchangeInfo );
-    exchangeinfo_timer->setTimerType( Qt::VeryCoarseTimer );
+    // this sets the network rate, fee, price ticksizes, and quantity ticksizes
+    exchangeinfo_timer = engine->getScheduler()->addTask( this, "exchange info", [this]() { onCheckExchangeInfo(); },
+                                                          TASK_PRIORITY_HOUSEKEEPING, 0.05 );
     exchangeinfo_timer->start( 60000 ); // 1 minute (turns to 1 hour after first parse)
 
-    // this timer sets the network rate, fee, price ticksizes, and quantity ticksizes
-    ratelimit_timer = new QTimer( this );
-    connect( exchangeinfo_timer, &QTimer::timeout, this, &BncREST::onCheckRateLimit );
-    ratelimit_timer->setTimerType( Qt::VeryCoarseTimer );
-    ratelimit_timer->start( BINANCE_RATELIMIT_WINDOW ); // window is 1 minute
+    // the weight limit refills over the 1 minute window, until exchangeinfo gives us the real limits
+    setWeightLimit( ratelimit_minute );
+
+    // create websocket, the ticker streams work without keys
+    wss = new QWebSocket();
+    connect( wss, &QWebSocket::connected, this, &BncREST::wssConnected );
+    connect( wss, &QWebSocket::disconnected, this, &BncREST::wssCheckConnection );
+    connect( wss, &QWebSocket::textMessageReceived, this, &BncREST::wssTextMessageReceived );
+    connect( wss, &QWebSocket::pong, this, &BncREST::wssPong );
+
+    // check websocket frequently
+    wss_timer = engine->getScheduler()->addTask( this, "wss check", [this]() { wssCheckConnection(); }, TASK_PRIORITY_HOUSEKEEPING, 0.05 );
+    wss_timer->start( 30000 );
 
 #if !defined( BINANCE_TICKER_ONLY )
     keystore.setKeys( BINANCE_KEY, BINANCE_SECRET );
+    signer.setKey( keystore.getSecret(), HmacSigner::Sha256 );
 
-    connect( orderbook_timer, &QTimer::timeout, this, &BncREST::onCheckBotOrders );
+    orderbook_timer->setCallback( [this]() { onCheckBotOrders(); } );
     orderbook_timer->start( BINANCE_TIMER_INTERVAL_ORDERBOOK );
     onCheckBotOrders();
+
+    // this seeds the balance ledger, then checks it against the exchange
+    balance_timer->start( BalanceLedger::RECONCILE_INTERVAL );
+    checkBalances();
 #endif
 
-    onCheckExchangeInfo();
+    // set up the markets from our cache of the filters, the timer asks for them when the engine knows what it trades.
+    // without one, ask now for every symbol
+    QByteArray cached_info;
+    if ( readMetadataCache( EXCHANGEINFO_CACHE_NAME, EXCHANGEINFO_CACHE_MAX_AGE_SECS, cached_info ) &&
+         parseExchangeInfo( cached_info, true, true ) )
+        kDebug() << "[BncREST] read cached exchange info";
+    else
+        onCheckExchangeInfo();
 
     engine->loadSettings();
 }
 
 void BncREST::sendNamQueue()
 {
+    QMutexLocker locker( engine->getLock() );
+
     // check for requests
     if ( nam_queue.isEmpty() )
         return;
 
-    // stop sending commands if server is unresponsive
-    if ( yieldToServer() )
-        return;
-
-    // normalize ratelimit by our timer
-    const qint32 ratelimit_window = ratelimit_minute;
-    if ( binance_weight > ratelimit_window )
+    // the server told us to back off, anything more extends the ban
+    const qint64 start_time = QDateTime::currentMSecsSinceEpoch();
+    if ( start_time < rate_limited_until )
     {
-        kDebug() << "local warning: hit ratelimit_window" << ratelimit_window;
+        wakeSendQueue( rate_limited_until - start_time );
         return;
     }
 
-    QMultiMap<Coin/*weight*/,Request*> sorted_nam_queue;
+    const QString mdy_str = Global::getDateStringMDY();
 
-    // insert into auto sorted map sorted by weight
-    for ( QQueue<Request*>::const_iterator i = nam_queue.begin(); i != nam_queue.end(); i++ )
+    // send as many requests as the rate limits allow
+    while ( !nam_queue.isEmpty() && !yieldToServer() )
     {
-        Request *const &request = *i;
-        Position *const &pos = request->pos;
+        const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
 
-        // check for valid pos
-        if ( !pos || !engine->getPositionMan()->isValid( pos ) )
-        {
-            sorted_nam_queue.insert( Coin(), request );
-            continue;
-        }
+        // hold new orders while we are over the daily order ratelimit
+        const bool over_daily_limit = daily_orders.value( mdy_str ) >= ratelimit_day;
+        if ( over_daily_limit && nam_queue.size( REQUEST_NEW_ORDER ) > 0 )
+            kDebug() << "local warning: we are over the daily order ratelimit" << ratelimit_day;
 
-        // check for cancel
-        if ( request->api_command == BNC_COMMAND_CANCEL &&
-             engine->getPositionMan()->getMarketOrderTotal( pos->market ) >= market_cancel_thresh )
-        {
-            // expedite the cancel
-            sorted_nam_queue.insert( CoinAmount::COIN, request );
-            continue;
-        }
+        // and while the server's order count is full for this window, the cancels and polls still go
+        const qint64 order_wait_time = order_window.isKnown() ? order_window.getWaitTime( 1, getRateLimitReserve( order_window.getLimit() ), current_time ) : 0;
+        if ( order_wait_time > 0 && nam_queue.size( REQUEST_NEW_ORDER ) > 0 )
+            wakeSendQueue( order_wait_time );
 
-        if ( request->api_command == BNC_COMMAND_GETTICKER ||
-             request->api_command == BNC_COMMAND_GETORDERS )
+        // check if we received the orderbook in the timeframe of an order timeout grace period
+        // if it's stale, we can assume the server is down and we let the orders timeout, except for the open orders
+        Request *request = getNextRequest( yieldToLag() ? QString( BNC_COMMAND_GETORDERS ) : QString(),
+                                           over_daily_limit || order_wait_time > 0 ? REQUEST_NEW_ORDER : -1 );
+
+        // let the rest hang around until the orderbook is responded to
+        if ( !request )
+            return;
+
+        // wait for the weight limit (per minute) first, then the request limit (per second). once the server has told
+        // us its count, the budget is exact and we can go right up to it
+        const qint64 weight_wait_time = weight_window.isKnown() ? weight_window.getWaitTime( request->weight, getRateLimitReserve( weight_window.getLimit() ), current_time ) :
+                                                                  weight_limiter.getWaitTime( request->weight, current_time );
+        if ( weight_wait_time > 0 )
         {
-            sorted_nam_queue.insert( Coin(), request );
-            continue;
+            kLogIf( LOG_LEVEL_DEBUG, engine->getVerbosity() > 0 ) << "local warning: hit the weight limit, used" << weight_window.getUsed( current_time )
+                                                                  << "waiting" << weight_wait_time << "ms";
+            wakeSendQueue( weight_wait_time );
+            return;
         }
 
-        // new hi/lo buy or sell, we should value this at 0 because it's not a reactive order
-        if ( pos->is_new_hilo_order )
-        {
-            sorted_nam_queue.insert( Coin(), request );
-            continue;
-        }
+        if ( !takeSendTokens() )
+            return;
 
-        // check for not buy/sell command
-        if ( request->api_command != BNC_COMMAND_BUYSELL )
+        weight_limiter.tryTake( request->weight, current_time );
+        weight_window.add( request->weight, current_time );
+
+        // track orders total
+        if ( request->request_class == REQUEST_NEW_ORDER )
         {
-            sorted_nam_queue.insert( Coin(), request );
-            continue;
+            daily_orders[ mdy_str ]++;
+            order_window.add( 1, current_time );
         }
 
-        sorted_nam_queue.insert( pos->per_trade_profit, request );
+        sendNamRequest( request );
+        // the request is added to sent_nam_queue and thus not deleted until the response is met
     }
+}
+
+void BncREST::buildRequestTemplate( const QString &api_command, RequestTemplate &t ) const
+{
+    QString path = api_command;
 
-    // go through orders, ranked from highest weight to lowest
-    for ( QMultiMap<Coin,Request*>::const_iterator i = sorted_nam_queue.end() -1; i != sorted_nam_queue.begin() -1; i-- )
+    if ( path.startsWith( "sign-" ) )
     {
-        Request *const &request = i.value();
+        path.remove( 0, 5 ); // remove "sign-" string
+        t.is_signed = true;
+    }
+    else if ( path.startsWith( "key-" ) )
+    {
+        path.remove( 0, 4 ); // remove "key-" string
+        t.is_keyed = true;
+    }
 
-        // check if we received the orderbook in the timeframe of an order timeout grace period
-        // if it's stale, we can assume the server is down and we let the orders timeout
-        if ( yieldToLag() && request->api_command != BNC_COMMAND_GETORDERS )
-        {
-            // let this request hang around until the orderbook is responded to
-            continue;
-        }
+    if ( path.startsWith( "get-" ) )
+    {
+        path.remove( 0, 4 ); // remove "get-"
+        t.verb = "GET";
+    }
+    else if ( path.startsWith( "post-" ) )
+    {
+        path.remove( 0, 5 ); // remove "post-"
+        t.verb = "POST";
+    }
+    else if ( path.startsWith( "put-" ) )
+    {
+        path.remove( 0, 4 ); // remove "put-"
+        t.verb = "PUT";
+    }
+    else if ( path.startsWith( "delete-" ) )
+    {
+        path.remove( 0, 7 ); // remove "delete-"
+        t.verb = "DELETE";
+    }
+    else
+    {
+        return;
+    }
 
-        // track orders total and continue if we're over it
-        if ( request->api_command.endsWith( "post-order" ) )
-        {
-            QString mdy_str = Global::getDateStringMDY();
-            qint32 orders_today = daily_orders.value( mdy_str );
+    QString url_base = BNC_URL;
 
-            if ( orders_today >= ratelimit_day )
-            {
-                kDebug() << "local warning: we are over the daily order ratelimit" << ratelimit_day;
-                continue;
-            }
+    // option to switch from v3 to v1
+    if ( t.verb == "GET" && path.startsWith( "v1-" ) )
+    {
+        path.remove( 0, 3 );
+        url_base.replace( "v3", "v1" );
+    }
 
-            daily_orders[ mdy_str ]++;
-        }
+    t.nam_request.setUrl( QUrl( url_base + path ) );
+    t.nam_request.setRawHeader( CONTENT_TYPE, CONTENT_TYPE_ARGS ); // add content header
+}
 
-        sendNamRequest( request );
-        // the request is added to sent_nam_queue and thus not deleted until the response is met
-        return;
-    }
+quint8 BncREST::getRequestClass( const QString &api_command ) const
+{
+    if ( api_command == BNC_COMMAND_CANCEL || api_command == BNC_COMMAND_CANCEL_PAIR )
+        return REQUEST_CANCEL;
+    if ( api_command == BNC_COMMAND_BUYSELL || api_command == BNC_COMMAND_CANCEL_REPLACE )
+        return REQUEST_NEW_ORDER;
+    if ( api_command == BNC_COMMAND_GETORDER )
+        return REQUEST_ORDER_STATUS;
+
+    return REQUEST_POLL;
 }
 
 void BncREST::sendNamRequest( Request *const &request )
 {
     // check for valid pos
-    if ( request->pos != nullptr && !engine->getPositionMan()->isValid( request->pos ) )
+    if ( request->pos != nullptr && !engine->getPositionMan()->isValid( request->pos, request->pos_generation ) )
     {
         kDebug() << "local warning: caught nam request with invalid position";
         nam_queue.removeOne( request );
+        releaseRequest( request );
         return;
     }
 
-    binance_weight += request->weight;
-
     const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
 
-    QString api_command = request->api_command;
+    const QString &api_command = request->api_command;
     Position *const &pos = request->pos;
 
     // set the order request time because we are sending the request
-    if ( api_command == BNC_COMMAND_BUYSELL &&
+    if ( ( api_command == BNC_COMMAND_BUYSELL || api_command == BNC_COMMAND_CANCEL_REPLACE ) &&
          engine->getPositionMan()->isQueued( pos ) )
     {
         pos->order_request_time = current_time;
@@ -211,8 +320,8 @@ void BncREST::sendNamRequest( Request *const &request )
     // inherit the body from the input structure
     QUrlQuery query( request->body );
 
-    // calculate a new nonce and compare it against the old nonce
-    const qint64 request_nonce_new = current_time;
+    // calculate a new nonce on the server's clock and compare it against the old nonce
+    const qint64 request_nonce_new = current_time + server_clock.getOffset();
     QString request_nonce_str;
 
     // let a corrected nonce past incase we got a nonce error (allow multi-bot per key)
@@ -227,45 +336,41 @@ void BncREST::sendNamRequest( Request *const &request )
         request_nonce = request_nonce_new;
     }
 
-    // form nam request and body
-    QNetworkRequest nam_request;
-    QByteArray query_bytes;
+    const RequestTemplate &t = getRequestTemplate( api_command );
 
-    nam_request.setRawHeader( CONTENT_TYPE, CONTENT_TYPE_ARGS ); // add content header
+    // form nam request and body from the template
+    QNetworkRequest nam_request = t.nam_request;
+    QByteArray query_bytes;
 
     // add to sent queue so we can check if it timed out
     request->time_sent_ms = current_time;
 
-    if ( api_command.startsWith( "sign-" ) )
+    if ( t.is_signed )
     {
-        api_command.remove( 0, 5 ); // remove "sign-" string
-
-        query.addQueryItem( BNC_RECVWINDOW, "120000" ); // 2 minutes recvWindow because we aren't bad
+        query.addQueryItem( BNC_RECVWINDOW, QString::number( RECV_WINDOW ) );
         query.addQueryItem( BNC_TIMESTAMP, request_nonce_str );
-        query.addQueryItem( BNC_SIGNATURE, Global::getBncSignature( query.toString().toUtf8(), keystore.getSecret() ) ); // add signature header
+
+        if ( server_clock.isLocalRejected( TIMESTAMP_AHEAD_LIMIT, RECV_WINDOW ) )
+            clock_rejects_avoided++;
+        query.addQueryItem( BNC_SIGNATURE, signer.signHex( query.toString().toUtf8() ) ); // add signature header
 
         // add signature to query
         query_bytes = query.toString().toUtf8();
 
         nam_request.setRawHeader( BNC_APIKEY, keystore.getKey() ); // add key header
     }
+    else if ( t.is_keyed )
+    {
+        query_bytes = query.toString().toUtf8();
+
+        nam_request.setRawHeader( BNC_APIKEY, keystore.getKey() ); // add key header
+    }
 
     QNetworkReply *reply = nullptr;
     // GET
-    if ( api_command.startsWith( "get-" ) )
+    if ( t.verb == "GET" )
     {
-        api_command.remove( 0, 4 ); // remove "get-"
-
-        QString url_base = BNC_URL;
-
-        // option to switch from v3 to v1
-        if ( api_command.startsWith( "v1-" ) )
-        {
-            api_command.remove( 0, 3 );
-            url_base.replace( "v3", "v1" );
-        }
-
-        QUrl public_url( url_base + api_command );
+        QUrl public_url = nam_request.url();
 
         public_url.setQuery( query );
         nam_request.setUrl( public_url );
@@ -273,24 +378,14 @@ void BncREST::sendNamRequest( Request *const &request )
         reply = nam->get( nam_request );
     }
     // POST
-    else if ( api_command.startsWith( "post-" ) )
+    else if ( t.verb == "POST" )
     {
-        api_command.remove( 0, 5 ); // remove "post-"
-
-        QUrl public_url( BNC_URL + api_command );
-
-        nam_request.setUrl( public_url );
         reply = nam->post( nam_request, query_bytes );
     }
-    // DELETE
-    else if ( api_command.startsWith( "delete-" ) )
+    // PUT, DELETE
+    else if ( t.verb == "PUT" || t.verb == "DELETE" )
     {
-        api_command.remove( 0, 7 ); // remove "delete-"
-
-        QUrl public_url( BNC_URL + api_command );
-
-        nam_request.setUrl( public_url );
-        reply = nam->sendCustomRequest( nam_request, "DELETE", query_bytes );
+        reply = nam->sendCustomRequest( nam_request, t.verb, query_bytes );
     }
 
     if ( !reply )
@@ -299,19 +394,43 @@ void BncREST::sendNamRequest( Request *const &request )
         return;
     }
 
-    nam_queue_sent.insert( reply, request );
-    nam_queue.removeOne( request );
+    trackSent( reply, request );
 
     last_request_sent_ms = current_time;
 }
 
 void BncREST::sendBuySell( Position * const &pos, bool quiet )
 {
-    if ( !quiet )
-        kDebug() << QString( "queued          %1" )
-                    .arg( pos->stringifyOrderWithoutOrderID() );
+    kLogIf( LOG_LEVEL_DEBUG, !quiet && engine->getVerbosity() > 0 ) << "queued         " << pos->logOrderWithoutOrderID();
+
+    QUrlQuery query;
+    addOrderQueryItems( query, pos );
+
+    // either post a buy or sell command
+    sendRequest( BNC_COMMAND_BUYSELL, query.toString(), pos, 1 );
+}
+
+void BncREST::sendCancelReplace( Position *const &replaced_pos, Position *const &pos, bool quiet )
+{
+    kLogIf( LOG_LEVEL_DEBUG, !quiet && engine->getVerbosity() > 0 ) << "queued replace " << pos->logOrderWithoutOrderID();
+
+    const QString symbol = pos->market.toExchangeString( ENGINE_BINANCE );
 
     QUrlQuery query;
+    addOrderQueryItems( query, pos );
+
+    // don't place the new order if the old one is gone (it filled)
+    query.addQueryItem( "cancelReplaceMode", "STOP_ON_FAILURE" );
+    query.addQueryItem( "cancelOrderId", replaced_pos->order_number.toString().mid( symbol.size() ) );
+
+    sendRequest( BNC_COMMAND_CANCEL_REPLACE, query.toString(), pos, 1 );
+
+    // set the cancel time here too, the replace doesn't go through sendCancel()
+    replaced_pos->order_cancel_time = QDateTime::currentMSecsSinceEpoch();
+}
+
+void BncREST::addOrderQueryItems( QUrlQuery &query, Position *const &pos ) const
+{
     query.addQueryItem( "symbol", pos->market.toExchangeString( ENGINE_BINANCE ) );
     query.addQueryItem( "side", pos->sideStr() );
 
@@ -328,9 +447,6 @@ void BncREST::sendBuySell( Position * const &pos, bool quiet )
 
     query.addQueryItem( "price", pos->price );
     query.addQueryItem( "quantity", pos->quantity );
-
-    // either post a buy or sell command
-    sendRequest( BNC_COMMAND_BUYSELL, query.toString(), pos, 1 );
 }
 
 void BncREST::sendCancel( const QString &_order_id, Position *const &pos )
@@ -352,13 +468,21 @@ void BncREST::sendCancel( const QString &_order_id, Position *const &pos )
 
     if ( pos && engine->getPositionMan()->isActive( pos ) )
     {
-        pos->is_cancelling = true;
+        engine->getPositionMan()->setCancelling( pos );
 
         // set the cancel time once here, and once on send, to avoid double cancel timeouts
         pos->order_cancel_time = QDateTime::currentMSecsSinceEpoch();
     }
 }
 
+void BncREST::sendCancelPair( const QString &symbol )
+{
+    QUrlQuery query;
+    query.addQueryItem( "symbol", symbol );
+
+    sendRequest( BNC_COMMAND_CANCEL_PAIR, query.toString(), nullptr, 1 );
+}
+
 void BncREST::sendGetOrder( const QString &_order_id, Position * const &pos )
 {
     // extract market from orderid (binance only)
@@ -382,31 +506,95 @@ bool BncREST::yieldToLag() const
     const qint64 time = QDateTime::currentMSecsSinceEpoch();
 
     // have we seen the orderbook update recently?
-    return ( orderbook_update_time != 0 &&
-             orderbook_update_time < time - ( BINANCE_TIMER_INTERVAL_ORDERBOOK *5 ) );
+    return ( ( orderbook_update_time != 0 &&
+             orderbook_update_time < time - ( BINANCE_TIMER_INTERVAL_ORDERBOOK *5 ) ) ||
+             isResponseTimeOver( 0.99, limit_response_time_lag ) ); // or the server is lagging badly right now
 }
 
 void BncREST::onNamReply( QNetworkReply *const &reply )
 {
+    TRACE_SPAN( "onNamReply" );
+    QMutexLocker locker( engine->getLock() );
+
     // don't process a reply we aren't tracking
     if ( !nam_queue_sent.contains( reply ) )
         return;
 
-    QByteArray data = reply->readAll();
+    QByteArray data = readReply( reply ); // shares reply_buffer, only error paths write to it
 
     // reference the object we made during the request
-    Request *const &request = nam_queue_sent.take( reply );
+    Request *const &request = takeSent( reply );
     const QString &api_command = request->api_command;
-    const qint64 response_time = QDateTime::currentMSecsSinceEpoch() - request->time_sent_ms;
 
-    avg_response_time.addResponseTime( response_time );
+    // positions are recycled, forget ours if it was released and reused while the request was out
+    if ( request->pos != nullptr && request->pos->getGeneration() != request->pos_generation )
+        request->pos = nullptr;
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+    const qint64 response_time = current_time - request->time_sent_ms;
+
+    // keep the server's count of our weight and orders
+    readRateLimitHeaders( reply, request, current_time );
+    readServerDate( reply, request->time_sent_ms, current_time );
+    recordReply( reply, request, current_time );
+
+    const qint32 status = reply->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt();
+    if ( status == 429 || status == 418 )
+        onRateLimited( reply, status, current_time );
+
+    response_times.add( api_command, response_time );
+
+    // large order lists and tickers are read on the parser thread, we only apply them once they're back
+    if ( ( api_command == BNC_COMMAND_GETORDERS || api_command == BNC_COMMAND_GETTICKER ) && parser->canParse( data.size() ) )
+    {
+        parser->parse( reply, request, data, api_command == BNC_COMMAND_GETORDERS ? &BncREST::readOpenOrders : nullptr );
+        return;
+    }
+
+    // open orders are read straight from the bytes, without building a document
+    if ( api_command == BNC_COMMAND_GETORDERS && parseOpenOrders( data, request->time_sent_ms ) )
+    {
+        deleteReply( reply, request );
+        return;
+    }
+
+    // exchange info too, and only the markets we trade get their filters read. the request names the symbols unless it's a full one
+    if ( api_command == BNC_COMMAND_GETEXCHANGEINFO && parseExchangeInfo( data, request->body.isEmpty() ) )
+    {
+        deleteReply( reply, request );
+        return;
+    }
 
     //kDebug() << api_command << data;
 
     //kDebug() << "got reply for" << api_command;
 
+    handleReply( reply, request, data, QJsonDocument::fromJson( data ) );
+}
+
+void BncREST::onParsedReplies()
+{
+    QMutexLocker locker( engine->getLock() );
+
+    ParsedReply parsed;
+    while ( parser->take( parsed ) )
+    {
+        if ( parsed.type == ParsedReply::ORDER_LIST )
+        {
+            open_orders.swap( parsed.orders );
+            applyOpenOrders( parsed.request->time_sent_ms );
+            deleteReply( parsed.reply, parsed.request );
+            continue;
+        }
+
+        handleReply( parsed.reply, parsed.request, parsed.data, parsed.json );
+    }
+}
+
+void BncREST::handleReply( QNetworkReply *const &reply, Request *const &request, QByteArray &data, const QJsonDocument &body_json )
+{
+    const QString &api_command = request->api_command;
+
     // parse any possible json in the body
-    QJsonDocument body_json = QJsonDocument::fromJson( data );
     QJsonObject body_obj;
     QJsonArray body_arr;
 
@@ -471,7 +659,9 @@ void BncREST::onNamReply( QNetworkReply *const &reply )
 
     if ( api_command == BNC_COMMAND_GETORDERS )
     {
-        parseOpenOrders( body_arr, request->time_sent_ms );
+        // parseOpenOrders() couldn't read it, don't take an error reply for a blank orderbook
+        if ( !is_json_invalid )
+            kDebug() << "local warning: unexpected open orders reply:" << data;
     }
     else if ( api_command == BNC_COMMAND_GETTICKER )
     {
@@ -479,7 +669,11 @@ void BncREST::onNamReply( QNetworkReply *const &reply )
     }
     else if ( api_command == BNC_COMMAND_GETEXCHANGEINFO )
     {
-        parseExchangeInfo( body_obj );
+        // parseExchangeInfo() couldn't read it, a symbol of ours might be gone, ask for every one next time
+        if ( !is_json_invalid )
+            kDebug() << "local warning: unexpected exchange info reply:" << data;
+
+        exchangeinfo_full_time = 0;
     }
     else if ( api_command == BNC_COMMAND_BUYSELL )
     {
@@ -489,10 +683,22 @@ void BncREST::onNamReply( QNetworkReply *const &reply )
     {
         parseCancelOrder( request, body_obj );
     }
+    else if ( api_command == BNC_COMMAND_CANCEL_PAIR )
+    {
+        parseCancelPair( body_arr, body_obj );
+    }
+    else if ( api_command == BNC_COMMAND_CANCEL_REPLACE )
+    {
+        parseCancelReplace( request, body_obj );
+    }
     else if ( api_command == BNC_COMMAND_GETBALANCES )
     {
         parseReturnBalances( body_obj );
     }
+    else if ( api_command == BNC_COMMAND_NEWLISTENKEY || api_command == BNC_COMMAND_KEEPLISTENKEY )
+    {
+        parseListenKey( request, body_obj );
+    }
     else
     {
         // parse unknown command
@@ -515,13 +721,14 @@ void BncREST::checkBotOrders( bool ignore_flow_control )
 
 void BncREST::onCheckBotOrders()
 {
+    QMutexLocker locker( engine->getLock() );
+
     checkBotOrders();
 }
 
 void BncREST::onCheckTicker()
 {
-    // check if wss disconnected
-    wssCheckConnection();
+    QMutexLocker locker( engine->getLock() );
 
     if ( isCommandQueued( BNC_COMMAND_GETTICKER ) || isCommandSent( BNC_COMMAND_GETTICKER, 10 ) )
         return;
@@ -530,118 +737,566 @@ void BncREST::onCheckTicker()
 }
 
 void BncREST::onCheckExchangeInfo()
-{ // happens every hour
+{ // happens every hour, and when the ticker has a market we trade without filters
 
     if ( isCommandQueued( BNC_COMMAND_GETEXCHANGEINFO ) || isCommandSent( BNC_COMMAND_GETEXCHANGEINFO, 2 ) )
         return;
 
-    sendRequest( BNC_COMMAND_GETEXCHANGEINFO, "", nullptr, 1 );
-}
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+    exchangeinfo_request_time = current_time;
 
-void BncREST::onCheckRateLimit()
-{ // happens every minute
-    binance_weight = 0;
-}
+    // every symbol once a day or when the ticker has one we don't know, otherwise only the markets we trade
+    QStringList symbols;
+    if ( exchangeinfo_full_time > 0 && current_time - exchangeinfo_full_time < EXCHANGEINFO_FULL_INTERVAL )
+    {
+        for ( QMap<QString,QString>::const_iterator i = market_aliases.begin(); i != market_aliases.end(); i++ )
+            if ( Market::getMarketId( i.value() ) >= 0 && isWantedMarket( i.value() ) )
+                symbols += QString( "\"%1\"" ).arg( i.key() );
+    }
 
-void BncREST::wssConnected()
-{
-    wssSendSubscriptions();
-}
+    if ( symbols.isEmpty() || symbols.size() > EXCHANGEINFO_SYMBOLS_MAX )
+    {
+        sendRequest( BNC_COMMAND_GETEXCHANGEINFO, "", nullptr, 1 );
+        return;
+    }
 
-void BncREST::wssSendSubscriptions()
-{
+    sendRequest( BNC_COMMAND_GETEXCHANGEINFO, "symbols=" + QString::fromLatin1( QUrl::toPercentEncoding( "[" + symbols.join( ',' ) + "]" ) ), nullptr, 1 );
 }
 
-void BncREST::wssSendJsonObj( const QJsonObject &obj )
+void BncREST::setWeightLimit( qint32 weight_per_window )
 {
-    Q_UNUSED( obj )
+    weight_limiter.setRate( qreal( weight_per_window ) * 1000. / BINANCE_RATELIMIT_WINDOW, weight_per_window );
 }
 
-void BncREST::wssCheckConnection()
+void BncREST::readRateLimitHeaders( QNetworkReply *const &reply, Request *const &request, const qint64 current_time )
 {
+    const QList<QNetworkReply::RawHeaderPair> &headers = reply->rawHeaderPairs();
+
+    bool is_in_flight_counted = false;
+    qint32 in_flight_weight = 0, in_flight_orders = 0;
+
+    for ( QList<QNetworkReply::RawHeaderPair>::const_iterator i = headers.begin(); i != headers.end(); i++ )
+    {
+        const QByteArray name = i->first.toLower();
+
+        const bool is_weight = name.startsWith( "x-mbx-used-weight-" );
+        const bool is_orders = !is_weight && name.startsWith( "x-mbx-order-count-" );
+        if ( !is_weight && !is_orders )
+            continue;
+
+        const qint64 interval_ms = getHeaderIntervalMs( name.mid( 18 ) );
+        const qint32 count = i->second.trimmed().toInt();
+
+        // the server counted up to this request, the ones we sent after it might not be in yet
+        if ( !is_in_flight_counted )
+        {
+            for ( QHash<QNetworkReply*,Request*>::const_iterator j = nam_queue_sent.begin(); j != nam_queue_sent.end(); j++ )
+            {
+                const Request *const &sent = j.value();
+                if ( sent->time_sent_ms < request->time_sent_ms )
+                    continue;
+
+                in_flight_weight += sent->weight;
+                if ( sent->request_class == REQUEST_NEW_ORDER )
+                    in_flight_orders++;
+            }
+
+            is_in_flight_counted = true;
+        }
+
+        if ( is_weight && interval_ms == weight_window.getWindowMs() )
+            weight_window.setServerUsed( count, in_flight_weight, current_time );
+        else if ( is_orders && interval_ms == order_window.getWindowMs() )
+            order_window.setServerUsed( count, in_flight_orders, current_time );
+        else if ( is_orders && interval_ms == 86400000 )
+            daily_orders[ Global::getDateStringMDY() ] = count + in_flight_orders;
+    }
 }
 
-void BncREST::wssTextMessageReceived( const QString &msg )
+void BncREST::onRateLimited( QNetworkReply *const &reply, const qint32 status, const qint64 current_time )
 {
-    Q_UNUSED( msg )
+    // seconds to wait, a 418 is an ip ban that gets longer if we keep going
+    const qint64 retry_after_secs = reply->rawHeader( "Retry-After" ).trimmed().toLongLong();
+    const qint64 wait_time = retry_after_secs > 0 ? retry_after_secs * 1000 : RATELIMIT_BACKOFF_DEFAULT;
+
+    rate_limited_until = qMax( rate_limited_until, current_time + wait_time );
+    weight_window.setFull( current_time );
+
+    kDebug() << "local error: binance" << ( status == 418 ? "banned our ip" : "rate limited us" ) << "( http" << status
+             << "), holding requests for" << wait_time << "ms";
+
+    wakeSendQueue( rate_limited_until - current_time );
 }
 
-void BncREST::parseBuySell( Request *const &request, const QJsonObject &response )
+void BncREST::checkListenKey()
 {
-    //kDebug();
-
-    // check if we have a position recorded for this request
-    if ( !request->pos )
-    {
-        kDebug() << "local error: found response for queued position, but postion is null";
+    if ( isKeyOrSecretUnset() )
         return;
-    }
 
-    // check that the position is queued and not set
-    if ( !engine->getPositionMan()->isQueued( request->pos ) )
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+
+    // get a new listen key
+    if ( wss_listen_key.isEmpty() )
     {
-        kDebug() << "local warning: position from response not found in positions_queued";
-        return;
-    }
+        if ( isCommandQueued( BNC_COMMAND_NEWLISTENKEY ) || isCommandSent( BNC_COMMAND_NEWLISTENKEY, 1 ) )
+            return;
 
-    Position *const &pos = request->pos;
+        sendRequest( BNC_COMMAND_NEWLISTENKEY, "", nullptr, 1 );
+    }
+    // the key expires after 60 minutes without a keepalive
+    else if ( wss_listen_key_time < current_time - 60000 * 30 )
+    {
+        if ( isCommandQueued( BNC_COMMAND_KEEPLISTENKEY ) || isCommandSent( BNC_COMMAND_KEEPLISTENKEY, 1 ) )
+            return;
 
-    // if we scan-set the order, it'll have an id. skip if the id is set
-    // exiting here lets us have simultaneous scan-sets across different indices with the same prices/sizes
-    if ( pos->order_number.size() > 0 )
-        return;
+        sendRequest( BNC_COMMAND_KEEPLISTENKEY, QString( "listenKey=%1" ).arg( QString( wss_listen_key ) ), nullptr, 1 );
+        wss_listen_key_time = current_time; // don't resend until the next interval, an error reply clears the key
+    }
+}
 
-    // look for post-only error
-    if ( response[ "msg" ].toString() == "Order would immediately match and take." )
+void BncREST::parseListenKey( Request *const &request, const QJsonObject &response )
+{
+    // keepalive replies with {}, errors have a code
+    if ( request->api_command == BNC_COMMAND_KEEPLISTENKEY )
     {
-        // try a better post-only price
-        engine->findBetterPrice( pos );
+        if ( response.contains( "code" ) )
+        {
+            kDebug() << "local warning: listen key keepalive failed:" << response;
+
+            wss_listen_key.clear();
+            wss_user_state = false;
+            wss_user_resync.cancel();
+        }
 
-        // resend command
-        sendBuySell( pos );
         return;
     }
 
-    if ( !response.contains( "orderId" ) )
+    const QString listen_key = response.value( "listenKey" ).toString();
+
+    if ( listen_key.isEmpty() )
     {
-        kDebug() << "local error: tried to parse order but id was blank:" << response;
+        kDebug() << "local error: couldn't parse listen key:" << response;
         return;
     }
 
-    const QString &order_number = response[ "orderId" ].toVariant().toString(); // get the order number to track position id
+    wss_listen_key = listen_key.toLatin1();
+    wss_listen_key_time = QDateTime::currentMSecsSinceEpoch();
 
-    engine->getPositionMan()->activate( pos, order_number );
+    // subscribe with the new key
+    wss_user_state = false;
+    wss_user_subscribe_try_time = 0;
+    wssSendSubscriptions();
 }
 
-void BncREST::parseCancelOrder( Request *const &request, const QJsonObject &response )
+void BncREST::wssConnected()
 {
-    // request must be valid!
+    QMutexLocker locker( engine->getLock() );
 
-    Position *const &pos = request->pos;
+    wss_heartbeat_time = QDateTime::currentMSecsSinceEpoch();
 
-    // prevent unsafe access
-    if ( !pos || !engine->getPositionMan()->isActive( pos ) )
-    {
-        kDebug() << "successfully cancelled non-local order:" << response;
+    wssSendSubscriptions();
+}
+
+void BncREST::wssSendSubscriptions()
+{
+    QMutexLocker locker( engine->getLock() );
+
+    if ( !wss || !wss->isValid() )
         return;
-    }
 
-    const QString &msg = response.value( "msg" ).toString();
-    const bool error_unknown_order = ( msg == "Unknown order sent." );
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
 
-    // handle error on manually cancelled order
-    if ( error_unknown_order &&
-         pos->cancel_reason == CANCELLING_FOR_USER )
+    // subscribe to bookTicker for the markets we have positions in, the rest come from the rest ticker
+    QJsonArray ticker_params;
+    for ( QVector<Position*>::const_iterator i = engine->getPositionMan()->all().constBegin(); i != engine->getPositionMan()->all().constEnd(); i++ )
     {
-        engine->processCancelledOrder( pos );
-        return;
-    }
+        const QString stream = (*i)->market.toExchangeString( ENGINE_BINANCE ).toLower() + QLatin1String( "@bookTicker" );
+
+        // the server allows 1024 streams per connection
+        if ( wss_ticker_streams.contains( stream ) || wss_ticker_streams.size() >= 1000 )
+            continue;
+
+        wss_ticker_streams.insert( stream );
+        ticker_params += stream;
+    }
+
+    if ( !ticker_params.isEmpty() )
+    {
+        const QJsonObject subscribe_tickers
+        {
+            { "method", "SUBSCRIBE" },
+            { "params", ticker_params },
+            { "id", ++wss_request_id }
+        };
+
+        kDebug() << "(wss) sending bookTicker subscribe for" << ticker_params.size() << "markets";
+        wssSendJsonObj( subscribe_tickers );
+    }
+
+#if !defined( BINANCE_TICKER_ONLY )
+    // subscribe to the user data stream once we have a listen key
+    if ( !wss_user_state &&
+         !wss_listen_key.isEmpty() &&
+         wss_user_subscribe_try_time < current_time - 30000 )
+    {
+        wss_user_subscribe_id = ++wss_request_id;
+
+        const QJsonObject subscribe_user
+        {
+            { "method", "SUBSCRIBE" },
+            { "params", QJsonArray{ QString( wss_listen_key ) } },
+            { "id", wss_user_subscribe_id }
+        };
+
+        kDebug() << "(wss) sending user data subscribe";
+        wssSendJsonObj( subscribe_user );
+
+        wss_user_subscribe_try_time = current_time;
+    }
+#else
+    Q_UNUSED( current_time )
+#endif
+}
+
+void BncREST::wssSendJsonObj( const QJsonObject &obj )
+{
+    const QJsonDocument doc = QJsonDocument( obj );
+    const QString data_str = doc.toJson( QJsonDocument::Compact );
+
+    //kDebug() << "(wss) sending" << data_str;
+
+    wss->sendTextMessage( data_str );
+}
+
+void BncREST::wssCheckConnection()
+{
+    QMutexLocker locker( engine->getLock() );
+
+    if ( !wss )
+        return;
+
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+    const qint64 wss_timeout = 30000;
+
+    // check for connected
+    if ( ( !wss->isValid() ||  // socket is invalid OR
+           wss_heartbeat_time < current_time - wss_timeout ) && // we stopped receiving data
+         wss_connect_try_time < current_time - wss_timeout && // last time we tried to connect is stale
+         !yieldToLag() ) // make sure orderbook is still updating
+    {
+        kDebug() << "(wss-reconnect)";
+
+        // update the time now incase open() is blocking when another disconnected() event fires
+        wss_connect_try_time = current_time;
+        wss_user_state = false;
+        wss_user_subscribe_try_time = 0;
+        wss_ticker_streams.clear();
+        wss_user_resync.cancel();
+
+        wss->abort();
+        wss->open( QUrl( BNC_URL_WSS ) );
+    }
+    else if ( wss->isValid() )
+    {
+        // the user stream can be quiet for a long time, ping so the heartbeat stays current
+        wss->ping();
+
+        // if we are connected, make sure feeds are active
+        wssSendSubscriptions();
+
+        // the resync snapshot didn't make it, ask again
+        if ( wss_user_resync.isSnapshotLate( current_time ) )
+        {
+            wss_user_resync.setSnapshotRequested( current_time );
+            checkBotOrders( true );
+        }
+    }
+
+    // ticker feed is up to date, keep the rest ticker for the other markets at a slower interval
+    const bool wss_ticker_feed_is_up_to_date = wss_ticker_feed_update_time > current_time - wss_timeout;
+
+    if ( wss_ticker_feed_is_up_to_date &&
+         ticker_timer->interval() < 60000 )
+    {
+        ticker_timer->setInterval( 60000 );
+
+        kDebug() << "(wss) slowed down price timer";
+    }
+    // feed is old, restore interval
+    else if ( !wss_ticker_feed_is_up_to_date &&
+              ticker_timer->interval() > BINANCE_TIMER_INTERVAL_TICKER )
+    {
+        ticker_timer->setInterval( BINANCE_TIMER_INTERVAL_TICKER );
+
+        kDebug() << "(wss) sped up price timer";
+    }
+
+#if !defined( BINANCE_TICKER_ONLY )
+    // create or keep alive the listen key
+    checkListenKey();
+
+    const bool wss_account_feed_is_up_to_date = wss_user_state && wss_account_feed_update_time > current_time - wss_timeout;
+
+    // websocket feed is up to date, adjust timer interval to be slower
+    if ( wss_account_feed_is_up_to_date &&
+         orderbook_timer->interval() < 120000 )
+    {
+        orderbook_timer->setInterval( 120000 );
+
+        kDebug() << "(wss) slowed down orderbook timer";
+    }
+    // feed is old, restore interval
+    else if ( !wss_account_feed_is_up_to_date &&
+              orderbook_timer->interval() > BINANCE_TIMER_INTERVAL_ORDERBOOK )
+    {
+        orderbook_timer->setInterval( BINANCE_TIMER_INTERVAL_ORDERBOOK );
+
+        kDebug() << "(wss) sped up orderbook timer";
+    }
+#endif
+}
+
+void BncREST::wssPong( quint64 elapsed_time, const QByteArray &payload )
+{
+    QMutexLocker locker( engine->getLock() );
+
+    Q_UNUSED( elapsed_time )
+    Q_UNUSED( payload )
+
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+    wss_heartbeat_time = current_time;
+
+    if ( wss_user_state )
+        wss_account_feed_update_time = current_time;
+}
+
+void BncREST::wssTextMessageReceived( const QString &msg )
+{
+    QMutexLocker locker( engine->getLock() );
+
+    const QJsonDocument doc = QJsonDocument::fromJson( readMessage( msg ) );
+
+    //kDebug() << "wss in:" << msg;
+
+    if ( !doc.isObject() )
+        return;
+
+    // update heartbeat time for any message
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+    wss_heartbeat_time = current_time;
+
+    // update our time that controls timer intervals
+    if ( wss_user_state )
+        wss_account_feed_update_time = current_time;
+
+    const QJsonObject obj = doc.object();
+
+    // check for a subscribe reply {"result":null,"id":1}
+    if ( obj.contains( "id" ) )
+    {
+        if ( obj.contains( "error" ) )
+        {
+            kDebug() << "(wss) subscribe error:" << obj.value( "error" ).toObject();
+            return;
+        }
+
+        if ( obj.value( "id" ).toInt() == wss_user_subscribe_id )
+        {
+            kDebug() << "(wss) user data feed active";
+            wss_user_state = true;
+
+            // the fills we missed while it was down come from the snapshot
+            wssBeginResync();
+        }
+
+        return;
+    }
+
+    // combined stream {"stream":"<name>","data":{...}}
+    const QString stream = obj.value( "stream" ).toString();
+    const QJsonObject data = obj.value( "data" ).toObject();
+
+    if ( stream.endsWith( QLatin1String( "@bookTicker" ) ) )
+    {
+        wssParseBookTicker( data );
+        return;
+    }
+
+    // user data stream, named by the listen key
+    if ( !wss_listen_key.isEmpty() && stream == wss_listen_key )
+    {
+        const QString event = data.value( "e" ).toString();
+
+        if ( event == "executionReport" )
+        {
+            // hold it until the snapshot is applied
+            if ( wss_user_resync.add( current_time, msg ) )
+                return;
+
+            wssParseExecutionReport( data );
+        }
+        else if ( event == "listenKeyExpired" )
+        {
+            kDebug() << "(wss) listen key expired";
+
+            wss_listen_key.clear();
+            wss_user_state = false;
+            checkListenKey();
+        }
+        // balance events are unused
+        return;
+    }
+
+    // print unhandled message
+    kDebug() << "unhandled wss:" << msg;
+}
+
+void BncREST::wssParseBookTicker( const QJsonObject &data )
+{
+    // {"u":400900217,"s":"BNBUSDT","b":"25.35190000","B":"31.21000000","a":"25.36520000","A":"40.66000000"}
+    const QString &market = market_aliases.value( data.value( "s" ).toString() );
+    const Coin bid = Coin::fromAscii( data.value( "b" ).toString() );
+    const Coin ask = Coin::fromAscii( data.value( "a" ).toString() );
+
+    if ( market.isEmpty() ||
+         bid.isZeroOrLess() ||
+         ask.isZeroOrLess() )
+        return;
+
+    wss_ticker_feed_update_time = QDateTime::currentMSecsSinceEpoch();
+
+    // the best levels with their quantities
+    engine->getMarketInfo( market ).order_book.applyTop( OrderBookLevel( bid, Coin::fromAscii( data.value( "B" ).toString() ) ),
+                                                         OrderBookLevel( ask, Coin::fromAscii( data.value( "A" ).toString() ) ),
+                                                         wss_ticker_feed_update_time );
+
+    // no request time, the ticker feed doesn't detect fills
+    engine->processTicker( this, market, TickerInfo( bid, ask ) );
+}
+
+void BncREST::wssParseExecutionReport( const QJsonObject &data )
+{
+    // only complete fills, partial fills wait for the rest of it
+    if ( data.value( "X" ).toString() != "FILLED" )
+        return;
+
+    // our order ids are the symbol followed by the order id, like the open orders
+    const QString order_id = data.value( "s" ).toString() + data.value( "i" ).toVariant().toString();
+
+    Position *const &pos = engine->getPositionMan()->getByOrderID( order_id );
+
+    // make sure pos is valid
+    if ( !pos )
+        return;
+
+    // cancel-n-fill is handled by the cancel reply
+    if ( pos->is_cancelling )
+        return;
+
+    engine->processFilledOrders( QVector<Position*>() << pos, FILL_WSS );
+}
+
+void BncREST::wssBeginResync()
+{
+    if ( !wss_user_resync.begin( QDateTime::currentMSecsSinceEpoch() ) )
+        return;
+
+    kDebug() << "(wss) resyncing user data feed";
+
+    // the snapshot, whatever the flow control says
+    checkBotOrders( true );
+}
+
+void BncREST::wssFinishResync( const qint64 snapshot_time )
+{
+    QMutexLocker locker( engine->getLock() );
+
+    QVector<QString> replay;
+    if ( !wss_user_resync.finish( snapshot_time, replay ) )
+        return;
+
+    kDebug() << "(wss) user data feed resynced, replaying" << replay.size() << "updates";
+
+    for ( QVector<QString>::const_iterator i = replay.begin(); i != replay.end(); i++ )
+        wssTextMessageReceived( *i );
+}
+
+void BncREST::parseBuySell( Request *const &request, const QJsonObject &response )
+{
+    //kDebug();
+
+    // check if we have a position recorded for this request
+    if ( !request->pos )
+    {
+        kDebug() << "local error: found response for queued position, but postion is null";
+        return;
+    }
+
+    // check that the position is queued and not set
+    if ( !engine->getPositionMan()->isQueued( request->pos ) )
+    {
+        kDebug() << "local warning: position from response not found in positions_queued";
+        return;
+    }
+
+    Position *const &pos = request->pos;
+
+    // if we scan-set the order, it'll have an id. skip if the id is set
+    // exiting here lets us have simultaneous scan-sets across different indices with the same prices/sizes
+    if ( pos->order_number.size() > 0 )
+        return;
+
+    // look for post-only error
+    if ( response[ "msg" ].toString() == "Order would immediately match and take." )
+    {
+        // try a better post-only price
+        engine->findBetterPrice( pos );
+
+        // resend command
+        sendBuySell( pos );
+        return;
+    }
+
+    if ( !response.contains( "orderId" ) )
+    {
+        kDebug() << "local error: tried to parse order but id was blank:" << response;
+        return;
+    }
+
+    const QString &order_number = response[ "orderId" ].toVariant().toString(); // get the order number to track position id
+
+    engine->getPositionMan()->activate( pos, order_number );
+}
+
+void BncREST::parseCancelOrder( Request *const &request, const QJsonObject &response )
+{
+    // request must be valid!
+
+    Position *const &pos = request->pos;
+
+    // prevent unsafe access
+    if ( !pos || !engine->getPositionMan()->isActive( pos ) )
+    {
+        kDebug() << "successfully cancelled non-local order:" << response;
+        return;
+    }
+
+    const QString &msg = response.value( "msg" ).toString();
+    const bool error_unknown_order = ( msg == "Unknown order sent." );
+
+    // handle error on manually cancelled order
+    if ( error_unknown_order &&
+         pos->cancel_reason == CANCELLING_FOR_USER )
+    {
+        engine->processCancelledOrder( pos );
+        return;
+    }
 
     // cancel-n-fill
     if ( error_unknown_order )
     {
         // single order fill
-        sendGetOrder( pos->order_number, pos );
+        sendGetOrder( pos->order_number.toString(), pos );
         return;
     }
 
@@ -657,65 +1312,220 @@ void BncREST::parseCancelOrder( Request *const &request, const QJsonObject &resp
     engine->processCancelledOrder( pos );
 }
 
-void BncREST::parseOpenOrders( const QJsonArray &markets, qint64 request_time_sent_ms )
+void BncREST::parseCancelPair( const QJsonArray &orders, const QJsonObject &error )
 {
-    //kDebug() << "got openOrders" << markets;
+    // the orders time out and get cancelled one at a time
+    if ( !error.isEmpty() )
+    {
+        kDebug() << "local warning: pair cancel failed:" << error;
+        return;
+    }
 
-    const qint64 current_time = QDateTime::currentMSecsSinceEpoch(); // cache time
-    QVector<QString> order_numbers; // keep track of order numbers
-    QMultiHash<QString, OrderInfo> orders;
+    qint32 ct_cancelled = 0, ct_local = 0;
 
-    // is the orderbook is too old to be safe? check the stale tolerance
-    if ( request_time_sent_ms < current_time - orderbook_stale_tolerance )
+    for ( QJsonArray::const_iterator i = orders.begin(); i != orders.end(); i++ )
     {
-        orders_stale_trip_count++;
-        return;
+        const QJsonObject order = (*i).toObject();
+
+        if ( order.value( "status" ).toString() != "CANCELED" )
+            continue;
+
+        ct_cancelled++;
+
+        // our order ids are the symbol followed by the order id
+        const QString order_number = order.value( "symbol" ).toString() +
+                                     QString::number( order.value( "orderId" ).toVariant().toLongLong() );
+
+        Position *const pos = engine->getPositionMan()->getByOrderID( order_number );
+
+        if ( !pos || !engine->getPositionMan()->isActive( pos ) )
+            continue;
+
+        engine->processCancelledOrder( pos );
+        ct_local++;
     }
 
-    // don't accept responses for requests sooner than the latest response request_time_sent_ms
-    if ( request_time_sent_ms < orderbook_update_request_time )
+    kDebug() << "successfully cancelled" << ct_cancelled << "orders in pair," << ct_local << "local";
+}
+
+void BncREST::parseCancelReplace( Request *const &request, const QJsonObject &response )
+{
+    // when either half fails the results are in data, next to the error
+    const QJsonObject result = response.contains( "data" ) ? response.value( "data" ).toObject() : response;
+    const QString cancel_result = result.value( "cancelResult" ).toString();
+    const QString new_order_result = result.value( "newOrderResult" ).toString();
+
+    // find the order we replaced from the request
+    const QUrlQuery query( request->body );
+    Position *const replaced_pos = engine->getPositionMan()->getByOrderID( query.queryItemValue( "symbol" ) + query.queryItemValue( "cancelOrderId" ) );
+    const bool is_replaced_valid = replaced_pos && engine->getPositionMan()->isActive( replaced_pos );
+
+    // the new order won't be placed, drop it
+    if ( new_order_result != "SUCCESS" && new_order_result != "FAILURE" &&
+         request->pos && engine->getPositionMan()->isQueued( request->pos ) )
+        engine->getPositionMan()->remove( request->pos );
+
+    // neither half ran, cancel it by itself and put it back on the ack
+    if ( cancel_result.isEmpty() )
+    {
+        kDebug() << "local warning: cancel replace failed:" << response;
+
+        if ( is_replaced_valid )
+        {
+            replaced_pos->is_replaced = false;
+            engine->sendCancel( replaced_pos->order_number, replaced_pos );
+        }
+
         return;
+    }
 
-    // set the timestamp of orderbook update if we saw any orders
-    orderbook_update_time = current_time;
-    orderbook_update_request_time = request_time_sent_ms;
+    // the cancel half, as if it was sent by itself
+    if ( is_replaced_valid )
+    {
+        // if there's no replacement, put it back if it turns out to be cancelled
+        if ( new_order_result != "SUCCESS" && new_order_result != "FAILURE" )
+            replaced_pos->is_replaced = false;
+
+        Request cancel_request;
+        cancel_request.pos = replaced_pos;
+        parseCancelOrder( &cancel_request, result.value( "cancelResponse" ).toObject() );
+    }
+
+    // the new order half, as if it was sent by itself
+    if ( new_order_result == "SUCCESS" || new_order_result == "FAILURE" )
+        parseBuySell( request, result.value( "newOrderResponse" ).toObject() );
+}
+
+bool BncREST::parseOpenOrders( const QByteArray &data, qint64 request_time_sent_ms )
+{
+    if ( !readOpenOrders( data, open_orders ) )
+        return false;
+
+    applyOpenOrders( request_time_sent_ms );
+    return true;
+}
+
+bool BncREST::readOpenOrders( const QByteArray &data, QVector<OrderRecord> &orders )
+{
+    // read the array of orders in one pass
+    JsonStreamReader reader( data );
+    if ( reader.readNext() != JsonStreamReader::StartArray )
+        return false;
 
-    for ( QJsonArray::const_iterator i = markets.begin(); i != markets.end(); i++ )
+    orders.resize( 0 ); // keeps the capacity
+
+    while ( reader.readNext() != JsonStreamReader::EndArray )
     {
-        // the first level is arrays of orders
-        if ( !(*i).isObject() )
+        // the first level is objects of orders
+        if ( reader.tokenType() != JsonStreamReader::StartObject )
+        {
+            if ( !reader.skipCurrentValue() )
+                return false;
+
             continue;
+        }
+
+        QString market;
+        QByteArray order_id;
+        quint8 side = 0;
+        Coin price, original_quantity;
 
-        const QJsonObject &order = (*i).toObject();
-        const QString &market = order.value( "symbol" ).toString();
-        const QString &order_number = market + order.value( "orderId" ).toVariant().toString();
-        const QString &side = order.value( "side" ).toString().toLower();
-        const Coin &price = order.value( "price" ).toString();
-        const Coin &original_quantity = order.value( "origQty" ).toString();
-        const Coin &amount = price * original_quantity;
+        while ( reader.readNext() == JsonStreamReader::Name )
+        {
+            if ( reader.isText( "symbol" ) )
+            {
+                reader.readScalar();
+                market = reader.textString();
+            }
+            else if ( reader.isText( "orderId" ) )
+            {
+                reader.readScalar();
+                order_id = reader.text();
+            }
+            else if ( reader.isText( "side" ) )
+            {
+                reader.readScalar();
+                side = reader.isText( "BUY" ) || reader.isText( "buy" ) ? SIDE_BUY :
+                       reader.isText( "SELL" ) || reader.isText( "sell" ) ? SIDE_SELL : 0;
+            }
+            else if ( reader.isText( "price" ) )
+            {
+                reader.readScalar();
+                price = reader.toCoin();
+            }
+            else if ( reader.isText( "origQty" ) )
+            {
+                reader.readScalar();
+                original_quantity = reader.toCoin();
+            }
+            else if ( !reader.skipValue() )
+            {
+                return false;
+            }
+        }
 
-        //kDebug() << market << order_number << side << price << amount;
+        if ( reader.tokenType() != JsonStreamReader::EndObject )
+            return false;
 
         // check for missing information
-        if ( market.isEmpty()||
-             order_number.isEmpty() ||
-             side.isEmpty() ||
+        if ( market.isEmpty() ||
+             order_id.isEmpty() ||
+             side == 0 ||
              price.isZeroOrLess() ||
-             amount.isZeroOrLess() )
+             original_quantity.isZeroOrLess() )
             continue;
 
-        // insert into seen orders
-        order_numbers += order_number;
+        orders.append( OrderRecord() );
+        OrderRecord &order = orders.last();
+        order.order_number = market + QString::fromLatin1( order_id );
+        order.market = market;
+        order.side = side;
+        order.price = price;
+        order.amount = price * original_quantity;
+    }
+
+    // the whole reply should be the array
+    return reader.readNext() == JsonStreamReader::EndDocument;
+}
 
-        // insert (market, order)
-        orders.insert( market, OrderInfo( order_number, side == BUY ? SIDE_BUY : side == SELL ? SIDE_SELL : 0, price, amount ) );
+void BncREST::applyOpenOrders( qint64 request_time_sent_ms )
+{
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch(); // cache time
+
+    // is the orderbook is too old to be safe? check the stale tolerance
+    if ( request_time_sent_ms < current_time - orderbook_stale_tolerance )
+    {
+        orders_stale_trip_count++;
+        return;
     }
 
-    engine->processOpenOrders( order_numbers, orders, request_time_sent_ms );
+    // don't accept responses for requests sooner than the latest response request_time_sent_ms
+    if ( request_time_sent_ms < orderbook_update_request_time )
+        return;
+
+    // set the timestamp of orderbook update if we saw any orders
+    orderbook_update_time = current_time;
+    orderbook_update_request_time = request_time_sent_ms;
+
+    engine->processOpenOrders( open_orders, request_time_sent_ms );
+
+    // replay the user data feed on top of it, after the caller is done with the reply buffer
+    if ( wss_user_resync.isBuffering() )
+        QTimer::singleShot( 0, this, [this, request_time_sent_ms]() { wssFinishResync( request_time_sent_ms ); } );
+}
+
+void BncREST::checkBalances( bool print )
+{
+    is_printing_balances = is_printing_balances || print;
+    sendRequest( BNC_COMMAND_GETBALANCES, "", nullptr, 5 );
 }
 
 void BncREST::parseReturnBalances( const QJsonObject &obj )
-{ // prints exchange balances
+{ // reconciles the ledger, and prints exchange balances for getbalances
+    const bool print = is_printing_balances;
+    is_printing_balances = false;
+
+    QMap<QString, BalanceLedger::Balance> polled;
     Coin total_btc_value;
 
     //kDebug() << obj;
@@ -746,6 +1556,13 @@ void BncREST::parseReturnBalances( const QJsonObject &obj )
              onOrders.isZeroOrLess() )
             continue;
 
+        BalanceLedger::Balance &ledger_balance = polled[ currency ];
+        ledger_balance.total = total;
+        ledger_balance.held = onOrders;
+
+        if ( !print )
+            continue;
+
         Coin btcValue = total;
         if ( currency != "BTC" )
             btcValue *= engine->getPositionMan()->getHiBuy( Market( "BTC", currency ) );
@@ -762,7 +1579,10 @@ void BncREST::parseReturnBalances( const QJsonObject &obj )
         total_btc_value += btcValue;
     }
 
-    kDebug() << "total btc value:" << total_btc_value;
+    engine->getLedger().reconcile( polled, VirtualClock::currentMSecsSinceEpoch() );
+
+    if ( print )
+        kDebug() << "total btc value:" << total_btc_value;
 }
 
 void BncREST::parseTicker( const QJsonArray &info, qint64 request_time_sent_ms )
@@ -793,8 +1613,10 @@ void BncREST::parseTicker( const QJsonArray &info, qint64 request_time_sent_ms )
     ticker_update_request_time = request_time_sent_ms;
 
     // iterate through each market object
-    QMap<QString, TickerInfo> ticker_info;
+    QVector<MarketTicker> ticker_info;
+    ticker_info.reserve( info.size() );
     QVector<QString> market_aliases_not_found;
+    bool is_filter_missing = false;
 
     for ( QJsonArray::const_iterator i = info.begin(); i != info.end(); i++ )
     {
@@ -813,60 +1635,95 @@ void BncREST::parseTicker( const QJsonArray &info, qint64 request_time_sent_ms )
 
         const QString &market = market_aliases.value( market_dirty );
 
+        // skip the markets we don't trade before parsing their prices
+        const qint32 market_id = Market::getMarketId( market );
+        if ( market_id < 0 || !engine->isTrackedMarket( market_id ) )
+            continue;
+
+        // one we started trading since the last exchange info
+        if ( !symbol_filters.contains( market ) )
+            is_filter_missing = true;
+
         if ( !market_obj.contains( "askPrice" ) ||
              !market_obj.contains( "bidPrice" ) )
             continue;
 
         // the object has two arrays of arrays [[1,2],[3,4]]
-        const Coin ask_price = market_obj[ "askPrice" ].toString();
-        const Coin bid_price = market_obj[ "bidPrice" ].toString();
+        const Coin ask_price = Coin::fromAscii( market_obj[ "askPrice" ].toString() );
+        const Coin bid_price = Coin::fromAscii( market_obj[ "bidPrice" ].toString() );
 
         //kDebug() << market << bid_price << ask_price;
 
         // update our maps
-        if ( market.size() > 0 &&
-             bid_price.isGreaterThanZero() &&
+        if ( bid_price.isGreaterThanZero() &&
              ask_price.isGreaterThanZero() )
         {
-            ticker_info.insert( market, TickerInfo( bid_price, ask_price ) );
+            ticker_info += MarketTicker( market_id, bid_price, ask_price );
         }
     }
 
     if ( market_aliases_not_found.size() > 0 )
     {
         kDebug() << "local warning: couldn't find market alias for binance markets" << market_aliases_not_found;
+        exchangeinfo_full_time = 0;
         onCheckExchangeInfo(); // read markets again
     }
+    else if ( is_filter_missing && current_time - exchangeinfo_request_time >= EXCHANGEINFO_MISSING_RETRY )
+    {
+        onCheckExchangeInfo();
+    }
 
     engine->processTicker( this, ticker_info, request_time_sent_ms );
 }
 
-void BncREST::parseExchangeInfo( const QJsonObject &obj )
+bool BncREST::isWantedMarket( const QString &market )
 {
-    const QJsonArray &rate_limits = obj[ "rateLimits" ].toArray();
-    const QJsonArray &symbols = obj[ "symbols" ].toArray();
+    // a market that was never registered isn't one we trade, unless the engine doesn't know yet and takes every one
+    return engine->isTrackedMarket( Market::getMarketId( market ) );
+}
 
-    for ( QJsonArray::const_iterator i = rate_limits.begin(); i != rate_limits.end(); i++ )
-    {
-        if ( !(*i).isObject() )
-            continue;
+bool BncREST::parseExchangeInfo( const QByteArray &data, const bool is_full, const bool is_cached )
+{
+    TRACE_SPAN( "parseExchangeInfo" );
 
-        const QJsonObject &ratelimit = (*i).toObject();
+    BncExchangeInfo info;
+    if ( !readExchangeInfo( data, info, [this]( const QString &market ) { return isWantedMarket( market ); } ) )
+        return false;
 
-        //qDebug() << ratelimit;
+    if ( is_full && info.symbols.isEmpty() )
+    {
+        kDebug() << "local warning: exchange info has no markets";
+        return false;
+    }
 
-        const QString &interval = ratelimit[ "interval" ].toString();
-        const qint32 limit = ratelimit[ "limit" ].toInt();
+    if ( !info.rate_limits.isEmpty() )
+        rate_limits = info.rate_limits;
+
+    for ( QVector<BncRateLimit>::const_iterator i = info.rate_limits.begin(); i != info.rate_limits.end(); i++ )
+    {
+        const QString &type = i->type;
+        const QString &interval = i->interval;
+        const qint32 limit = i->limit;
+        const qint64 interval_ms = qMax( 1, i->interval_num ) * ( interval == "SECOND" ? 1000 :
+                                                                 interval == "MINUTE" ? 60000 :
+                                                                 interval == "DAY"    ? 86400000 : 0 );
+
+        // the exact limits, for the counts the server sends back in the headers
+        if ( type == "REQUEST_WEIGHT" && interval_ms == BINANCE_RATELIMIT_WINDOW && limit > 1 )
+            weight_window.setLimit( interval_ms, limit );
+        else if ( type == "ORDERS" && interval == "SECOND" && limit > 1 )
+            order_window.setLimit( interval_ms, limit );
 
         if ( interval == "MINUTE" && limit > 1 )
         {
             ratelimit_minute = qFloor( limit * 0.75 );
+            setWeightLimit( ratelimit_minute );
         }
         else if ( interval == "SECOND" && limit > 3 )
         {
             ratelimit_second = limit - 2; // be nice, subtract 2 from limit
-            send_timer->setInterval( 1000 / ( ratelimit_second ) );
-            //qDebug() << "send_timer interval set to" << send_timer->interval();
+            setSendRate( ratelimit_second );
+            //qDebug() << "send rate set to" << ratelimit_second;
         }
         else if ( interval == "DAY" && limit > 101 )
         {
@@ -874,74 +1731,346 @@ void BncREST::parseExchangeInfo( const QJsonObject &obj )
         }
     }
 
-    for ( QJsonArray::const_iterator i = symbols.begin(); i != symbols.end(); i++ )
+    for ( QVector<BncSymbolInfo>::const_iterator i = info.symbols.begin(); i != info.symbols.end(); i++ )
     {
-        if ( !(*i).isObject() )
-            continue;
+        const BncSymbolInfo &symbol = *i;
 
-        const QJsonObject &symbol_info = (*i).toObject();
-        const QString market = symbol_info[ "quoteAsset" ].toString() + QString( "_" ) + symbol_info[ "baseAsset" ].toString();
-        const QString market_alias = symbol_info[ "baseAsset" ].toString() + symbol_info[ "quoteAsset" ].toString();
+        if ( symbol.alias.isEmpty() || symbol.base_asset.isEmpty() || symbol.quote_asset.isEmpty() )
+            continue;
 
         // store the alias for this market later, because there's no separator
-        market_aliases.insert( market_alias, market );
+        market_aliases.insert( symbol.alias, symbol.market );
 
-        const QJsonArray &filters = symbol_info[ "filters" ].toArray();
-
-        if ( market_alias.isEmpty() || filters.isEmpty() )
+        if ( !symbol.has_filters )
             continue;
 
         // read market info
-        MarketInfo &market_info = engine->getMarketInfo( market );
+        MarketInfo &market_info = engine->getMarketInfo( symbol.market );
+
+        if ( symbol.price_ticksize.isGreaterThanZero() )
+            market_info.price_ticksize = symbol.price_ticksize;
+        else
+            kDebug() << "local error: failed to parse 'tickSize' for" << symbol.market;
 
-        for ( QJsonArray::const_iterator j = filters.begin(); j != filters.end(); j++ )
+        if ( symbol.quantity_ticksize.isGreaterThanZero() )
+            market_info.quantity_ticksize = symbol.quantity_ticksize;
+        else
+            kDebug() << "local error: failed to parse 'stepSize' for" << symbol.market;
+
+        // binance moved some markets to PERCENT_PRICE_BY_SIDE, keep the defaults for those
+        if ( symbol.price_min_mul.isGreaterThanZero() && symbol.price_max_mul.isGreaterThanZero() )
         {
-            const QJsonObject &filter = (*j).toObject();
+            market_info.price_min_mul = symbol.price_min_mul;
+            market_info.price_max_mul = symbol.price_max_mul;
+        }
+
+        market_info.min_notional = symbol.min_notional;
+        symbol_filters.insert( symbol.market, symbol );
+    }
+
+    // the cached info knows the markets already, check the ticker. the timer asks for the real one once the engine
+    // knows what it trades
+    if ( is_cached )
+    {
+        exchangeinfo_full_time = info.time;
+        onCheckTicker();
+        return true;
+    }
+
+    if ( is_full )
+        exchangeinfo_full_time = QDateTime::currentMSecsSinceEpoch();
+
+    writeMetadataCache( EXCHANGEINFO_CACHE_NAME, getExchangeInfoCache() );
 
-            const QString &filter_type = filter[ "filterType" ].toString();
+    // after we get the first response, turn our timer interval up, and check ticker
+    static const qint32 exchangeinfo_interval = 60000 * 60; // 1 hour
+    if ( exchangeinfo_timer->interval() < exchangeinfo_interval )
+    {
+        exchangeinfo_timer->setInterval( exchangeinfo_interval );
+        onCheckTicker();
+    }
 
-            if ( filter_type == "PRICE_FILTER" )
+    return true;
+}
+
+QByteArray BncREST::getExchangeInfoCache() const
+{
+    QJsonArray limits_arr;
+    for ( QVector<BncRateLimit>::const_iterator i = rate_limits.begin(); i != rate_limits.end(); i++ )
+    {
+        QJsonObject limit;
+        limit[ "rateLimitType" ] = i->type;
+        limit[ "interval" ] = i->interval;
+        limit[ "intervalNum" ] = i->interval_num;
+        limit[ "limit" ] = i->limit;
+        limits_arr += limit;
+    }
+
+    // every alias for the ticker, the filters of the markets we read them for
+    QJsonArray symbols_arr;
+    for ( QMap<QString,QString>::const_iterator i = market_aliases.begin(); i != market_aliases.end(); i++ )
+    {
+        QJsonObject symbol_obj;
+        symbol_obj[ "symbol" ] = i.key();
+        symbol_obj[ "quoteAsset" ] = i.value().section( QChar( '_' ), 0, 0 );
+        symbol_obj[ "baseAsset" ] = i.value().section( QChar( '_' ), 1, 1 );
+
+        const QMap<QString,BncSymbolInfo>::const_iterator f = symbol_filters.constFind( i.value() );
+        if ( f != symbol_filters.constEnd() )
+        {
+            QJsonObject price_filter, lot_size, percent_price, notional;
+            price_filter[ "filterType" ] = QString( "PRICE_FILTER" );
+            price_filter[ "tickSize" ] = QString( f->price_ticksize );
+            lot_size[ "filterType" ] = QString( "LOT_SIZE" );
+            lot_size[ "stepSize" ] = QString( f->quantity_ticksize );
+            percent_price[ "filterType" ] = QString( "PERCENT_PRICE" );
+            percent_price[ "multiplierDown" ] = QString( f->price_min_mul );
+            percent_price[ "multiplierUp" ] = QString( f->price_max_mul );
+            notional[ "filterType" ] = QString( "NOTIONAL" );
+            notional[ "minNotional" ] = QString( f->min_notional );
+
+            symbol_obj[ "filters" ] = QJsonArray() << price_filter << lot_size << percent_price << notional;
+        }
+
+        symbols_arr += symbol_obj;
+    }
+
+    QJsonObject obj;
+    obj[ "time" ] = QString::number( exchangeinfo_full_time );
+    obj[ "rateLimits" ] = limits_arr;
+    obj[ "symbols" ] = symbols_arr;
+
+    return QJsonDocument( obj ).toJson( QJsonDocument::Compact );
+}
+
+namespace
+{
+
+bool readRateLimits( JsonStreamReader &reader, QVector<BncRateLimit> &rate_limits )
+{
+    if ( reader.readNext() != JsonStreamReader::StartArray )
+        return false;
+
+    while ( reader.readNext() != JsonStreamReader::EndArray )
+    {
+        if ( reader.tokenType() != JsonStreamReader::StartObject )
+        {
+            if ( !reader.skipCurrentValue() )
+                return false;
+
+            continue;
+        }
+
+        BncRateLimit limit;
+        while ( reader.readNext() == JsonStreamReader::Name )
+        {
+            if ( reader.isText( "rateLimitType" ) )
+            {
+                reader.readScalar();
+                limit.type = reader.textString();
+            }
+            else if ( reader.isText( "interval" ) )
+            {
+                reader.readScalar();
+                limit.interval = reader.textString();
+            }
+            else if ( reader.isText( "intervalNum" ) )
+            {
+                reader.readScalar();
+                limit.interval_num = qint32( reader.toULongLong() );
+            }
+            else if ( reader.isText( "limit" ) )
+            {
+                reader.readScalar();
+                limit.limit = qint32( reader.toULongLong() );
+            }
+            else if ( !reader.skipValue() )
+            {
+                return false;
+            }
+        }
+
+        if ( reader.tokenType() != JsonStreamReader::EndObject )
+            return false;
+
+        rate_limits += limit;
+    }
+
+    return true;
+}
+
+bool readFilters( JsonStreamReader &reader, BncSymbolInfo &symbol )
+{
+    if ( reader.readNext() != JsonStreamReader::StartArray )
+        return false;
+
+    while ( reader.readNext() != JsonStreamReader::EndArray )
+    {
+        if ( reader.tokenType() != JsonStreamReader::StartObject )
+        {
+            if ( !reader.skipCurrentValue() )
+                return false;
+
+            continue;
+        }
+
+        // the filter type isn't always first
+        QByteArray filter_type;
+        Coin tick_size, step_size, multiplier_down, multiplier_up, min_notional;
+
+        while ( reader.readNext() == JsonStreamReader::Name )
+        {
+            if ( reader.isText( "filterType" ) )
+            {
+                reader.readScalar();
+                filter_type = reader.text();
+            }
+            else if ( reader.isText( "tickSize" ) )
             {
-                const Coin &price_tick = filter[ "tickSize" ].toString();
-                //qDebug() << "price ticksize" << price_tick;
+                reader.readScalar();
+                tick_size = reader.toCoin();
+            }
+            else if ( reader.isText( "stepSize" ) )
+            {
+                reader.readScalar();
+                step_size = reader.toCoin();
+            }
+            else if ( reader.isText( "multiplierDown" ) )
+            {
+                reader.readScalar();
+                multiplier_down = reader.toCoin();
+            }
+            else if ( reader.isText( "multiplierUp" ) )
+            {
+                reader.readScalar();
+                multiplier_up = reader.toCoin();
+            }
+            else if ( reader.isText( "minNotional" ) )
+            {
+                reader.readScalar();
+                min_notional = reader.toCoin();
+            }
+            else if ( !reader.skipValue() )
+            {
+                return false;
+            }
+        }
+
+        if ( reader.tokenType() != JsonStreamReader::EndObject )
+            return false;
+
+        if ( filter_type == "PRICE_FILTER" )
+            symbol.price_ticksize = tick_size;
+        else if ( filter_type == "LOT_SIZE" )
+            symbol.quantity_ticksize = step_size;
+        else if ( filter_type == "PERCENT_PRICE" )
+        {
+            symbol.price_min_mul = multiplier_down;
+            symbol.price_max_mul = multiplier_up;
+        }
+        else if ( filter_type == "NOTIONAL" || filter_type == "MIN_NOTIONAL" )
+            symbol.min_notional = min_notional;
+    }
+
+    symbol.has_filters = true;
+    return true;
+}
+
+bool readSymbols( JsonStreamReader &reader, QVector<BncSymbolInfo> &symbols, const std::function<bool( const QString &market )> &is_wanted )
+{
+    if ( reader.readNext() != JsonStreamReader::StartArray )
+        return false;
 
-                if ( price_tick.isGreaterThanZero() )
-                    market_info.price_ticksize = price_tick;
-                else
-                    kDebug() << "local error: failed to parse 'tickSize'" << filter;
+    while ( reader.readNext() != JsonStreamReader::EndArray )
+    {
+        if ( reader.tokenType() != JsonStreamReader::StartObject )
+        {
+            if ( !reader.skipCurrentValue() )
+                return false;
+
+            continue;
+        }
+
+        BncSymbolInfo symbol;
+        while ( reader.readNext() == JsonStreamReader::Name )
+        {
+            if ( reader.isText( "symbol" ) )
+            {
+                reader.readScalar();
+                symbol.alias = reader.textString();
+            }
+            else if ( reader.isText( "baseAsset" ) )
+            {
+                reader.readScalar();
+                symbol.base_asset = reader.textString();
             }
-            else if ( filter_type == "LOT_SIZE" )
+            else if ( reader.isText( "quoteAsset" ) )
             {
-                const Coin &quantity_tick = filter[ "stepSize" ].toString();
-                //qDebug() << "quantity ticksize" << quantity_tick;
+                reader.readScalar();
+                symbol.quote_asset = reader.textString();
+            }
+            else if ( reader.isText( "filters" ) )
+            {
+                // binance lists the assets first, if they aren't we read the filters and decide after
+                const bool is_skipped = is_wanted && !symbol.base_asset.isEmpty() && !symbol.quote_asset.isEmpty() &&
+                                        !is_wanted( symbol.quote_asset + QChar( '_' ) + symbol.base_asset );
 
-                if ( quantity_tick.isGreaterThanZero() )
-                    market_info.quantity_ticksize = quantity_tick;
-                else
-                    kDebug() << "local error: failed to parse 'stepSize'" << filter;
+                if ( is_skipped ? !reader.skipValue() : !readFilters( reader, symbol ) )
+                    return false;
             }
-            else if ( filter_type == "PERCENT_PRICE" )
+            else if ( !reader.skipValue() )
             {
-                const Coin &min = filter[ "multiplierDown" ].toString();
-                const Coin &max = filter[ "multiplierUp" ].toString();
-                //kDebug() << filter_type << market << Global::toSatoshiFormat( min ) << Global::toSatoshiFormat( max );
-
-                if ( min.isGreaterThanZero() && max.isGreaterThanZero() )
-                {
-                    market_info.price_min_mul = min;
-                    market_info.price_max_mul = max;
-                }
-                else
-                    kDebug() << "local error: failed to parse 'multiplierDown' 'multiplierUp'" << filter;
+                return false;
             }
         }
+
+        if ( reader.tokenType() != JsonStreamReader::EndObject )
+            return false;
+
+        symbol.market = symbol.quote_asset + QChar( '_' ) + symbol.base_asset;
+        if ( symbol.has_filters && is_wanted && !is_wanted( symbol.market ) )
+            symbol.has_filters = false;
+
+        symbols += symbol;
     }
 
-    // after we get the first response, turn our timer interval up, and check ticker
-    static const qint32 exchangeinfo_interval = 60000 * 60; // 1 hour
-    if ( exchangeinfo_timer->interval() < exchangeinfo_interval )
+    return true;
+}
+
+} // namespace
+
+bool BncREST::readExchangeInfo( const QByteArray &data, BncExchangeInfo &info, const std::function<bool( const QString &market )> &is_wanted )
+{
+    JsonStreamReader reader( data );
+    if ( reader.readNext() != JsonStreamReader::StartObject )
+        return false;
+
+    while ( reader.readNext() == JsonStreamReader::Name )
     {
-        exchangeinfo_timer->setInterval( exchangeinfo_interval );
-        onCheckTicker();
+        if ( reader.isText( "rateLimits" ) )
+        {
+            if ( !readRateLimits( reader, info.rate_limits ) )
+                return false;
+        }
+        else if ( reader.isText( "symbols" ) )
+        {
+            if ( !readSymbols( reader, info.symbols, is_wanted ) )
+                return false;
+        }
+        else if ( reader.isText( "time" ) )
+        {
+            reader.readScalar();
+            info.time = qint64( reader.toULongLong() );
+        }
+        else if ( !reader.skipValue() )
+        {
+            return false;
+        }
     }
+
+    // an error reply is an object too, it has neither
+    if ( reader.tokenType() != JsonStreamReader::EndObject || ( info.symbols.isEmpty() && info.rate_limits.isEmpty() ) )
+        return false;
+
+    return reader.readNext() == JsonStreamReader::EndDocument;
 }
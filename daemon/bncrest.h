@@ -5,15 +5,46 @@
 #include <QQueue>
 #include <QHash>
 #include <QMap>
+#include <QSet>
+#include <QVector>
+
+#include <functional>
 
 #include "global.h"
 #include "position.h"
 #include "keystore.h"
 #include "baserest.h"
+#include "ratewindow.h"
+#include "streamresync.h"
 
 class QNetworkReply;
+class QUrlQuery;
 class QTimer;
 class QWebSocket;
+class QJsonDocument;
+class JsonStreamReader;
+
+// what we keep of a symbol in exchangeInfo, the filters only of the markets we trade
+struct BncSymbolInfo
+{
+    QString alias, base_asset, quote_asset; // "LTCBTC", "LTC", "BTC"
+    QString market; // "BTC_LTC"
+    bool has_filters{ false };
+    Coin price_ticksize, quantity_ticksize, price_min_mul, price_max_mul, min_notional; // zero if the filter was missing
+};
+
+struct BncRateLimit
+{
+    QString type, interval;
+    qint32 interval_num{ 1 }, limit{ 0 };
+};
+
+struct BncExchangeInfo
+{
+    QVector<BncRateLimit> rate_limits;
+    QVector<BncSymbolInfo> symbols;
+    qint64 time{ 0 }; // when our cache of it was asked for, 0 from the exchange
+};
 
 class BncREST : public BaseREST
 {
@@ -26,19 +57,33 @@ public:
     ~BncREST();
 
     void init();
+    QString getWarmUrl() const { return BNC_URL; }
+    void checkBalances( bool print = false );
 
     bool yieldToLag() const;
 
     void sendNamRequest( Request *const &request );
+    void buildRequestTemplate( const QString &api_command, RequestTemplate &t ) const;
+    quint8 getRequestClass( const QString &api_command ) const;
     void sendBuySell( Position *const &pos, bool quiet = true );
     void sendCancel( const QString &_order_id, Position *const &pos = nullptr );
+    void sendCancelPair( const QString &symbol ); // every open order on the symbol, ours or not
+    void sendCancelReplace( Position *const &replaced_pos, Position *const &pos, bool quiet = true ); // cancel and place in one request
     void sendGetOrder( const QString &_order_id, Position *const &pos = nullptr );
     void parseBuySell( Request *const &request, const QJsonObject &response );
     void parseCancelOrder( Request *const &request, const QJsonObject &response );
-    void parseOpenOrders( const QJsonArray &markets, qint64 request_time_sent_ms );
+    void parseCancelPair( const QJsonArray &orders, const QJsonObject &error );
+    void parseCancelReplace( Request *const &request, const QJsonObject &response );
+    bool parseOpenOrders( const QByteArray &data, qint64 request_time_sent_ms ); // false if it isn't an orders array
+    static bool readOpenOrders( const QByteArray &data, QVector<OrderRecord> &orders ); // the parse, safe on the parser thread
+    void applyOpenOrders( qint64 request_time_sent_ms ); // hands open_orders to the engine unless it's stale
     void parseReturnBalances( const QJsonObject &obj );
     void parseTicker( const QJsonArray &info, qint64 request_time_sent_ms );
-    void parseExchangeInfo( const QJsonObject &obj );
+    bool parseExchangeInfo( const QByteArray &data, const bool is_full, const bool is_cached = false ); // false if it isn't one, or a full one had no markets
+    // the parse, in one pass over the bytes. the filters of the markets is_wanted turns down are skipped, every
+    // symbol's alias is kept for the ticker
+    static bool readExchangeInfo( const QByteArray &data, BncExchangeInfo &info, const std::function<bool( const QString &market )> &is_wanted = nullptr );
+    void parseListenKey( Request *const &request, const QJsonObject &response );
     void wssSendJsonObj( const QJsonObject &obj );
 
     void checkBotOrders( bool ignore_flow_control = false );
@@ -46,8 +91,8 @@ public:
 public Q_SLOTS:
     void sendNamQueue();
     void onNamReply( QNetworkReply *const &reply );
+    void onParsedReplies(); // from the parser thread, through the queue
 
-    void onCheckRateLimit();
     void onCheckBotOrders();
     void onCheckTicker();
     void onCheckExchangeInfo();
@@ -55,28 +100,57 @@ public Q_SLOTS:
     void wssConnected();
     void wssCheckConnection();
     void wssTextMessageReceived( const QString &msg );
+    void wssPong( quint64 elapsed_time, const QByteArray &payload );
     void wssSendSubscriptions();
 
 private:
+    void handleReply( QNetworkReply *const &reply, Request *const &request, QByteArray &data, const QJsonDocument &body_json );
+    void addOrderQueryItems( QUrlQuery &query, Position *const &pos ) const;
+    void setWeightLimit( qint32 weight_per_window );
+    void readRateLimitHeaders( QNetworkReply *const &reply, Request *const &request, const qint64 current_time );
+    void onRateLimited( QNetworkReply *const &reply, const qint32 status, const qint64 current_time ); // 429 or 418
+    void checkListenKey();
+    void wssParseBookTicker( const QJsonObject &data );
+    void wssParseExecutionReport( const QJsonObject &data );
+    void wssBeginResync(); // the user data feed is back, buffer it until an open orders snapshot is applied
+    void wssFinishResync( const qint64 snapshot_time );
+    bool isWantedMarket( const QString &market ); // its filters are read, every market until the engine knows what it trades
+    QByteArray getExchangeInfoCache() const; // the filters we have in exchangeInfo's shape, with the time of the last full one
+
     QMap<QString, QString> market_aliases;
+    QMap<QString/*market*/, BncSymbolInfo> symbol_filters; // the markets we read the filters of
+    QVector<BncRateLimit> rate_limits;
+    qint64 exchangeinfo_full_time{ 0 }, // of the last exchangeInfo with every symbol, 0 to ask for one next
+           exchangeinfo_request_time{ 0 };
     QMap<QString /*date MDY*/, qint32 /*num*/> daily_orders; // track daily orders sent
 
     qint64 wss_connect_try_time{ 0 },
            wss_heartbeat_time{ 0 },
            wss_account_feed_update_time{ 0 },
+           wss_ticker_feed_update_time{ 0 },
+           wss_user_subscribe_try_time{ 0 },
+           wss_listen_key_time{ 0 }, // last time the listen key was created or kept alive
            wss_safety_delay_time{ 2000 }; // only detect a wss filled order after this amount of time - for possible wss lag
 
-    bool wss_1000_state{ false }, // account subscription
-         wss_1002_state{ false }; // ticker subscription
+    bool wss_user_state{ false }; // user data stream subscription
+    qint32 wss_request_id{ 0 }, // id for subscribe messages, to match the replies
+           wss_user_subscribe_id{ 0 };
+    QByteArray wss_listen_key; // user data stream key from userDataStream
+    QSet<QString> wss_ticker_streams; // "<symbol>@bookTicker" we subscribed to on this connection
+    StreamResync wss_user_resync;
 
     // rate limit stuff
-    qint32 binance_weight{ 0 }, // current weight
-           ratelimit_second{ 10 }, // orders limit
+    qint32 ratelimit_second{ 10 }, // orders limit
            ratelimit_minute{ 600 }, // weight limit
            ratelimit_day{ 100000 }; // orders limit
 
-    QTimer *exchangeinfo_timer{ nullptr };
-    QTimer *ratelimit_timer{ nullptr };
+    ScheduledTask *exchangeinfo_timer{ nullptr };
+    ScheduledTask *wss_timer{ nullptr };
+    QWebSocket *wss{ nullptr };
+    TokenBucket weight_limiter; // ratelimit_minute, refilled over BINANCE_RATELIMIT_WINDOW, until the server tells us its count
+    RateWindow weight_window{ BINANCE_RATELIMIT_WINDOW, 1200 }; // from X-MBX-USED-WEIGHT-1M
+    RateWindow order_window{ 10000, 50 }; // from X-MBX-ORDER-COUNT-10S
+    qint64 rate_limited_until{ 0 }; // nothing is sent until then after a 429 or 418
 };
 
 #endif // BNCREST_H
@@ -3,7 +3,7 @@
 
 #define BUILD_VERSION "1.79y"
 
-/// select your exchanges
+/// select your exchanges. these are built in, the ones named in ~/.config/trader/exchanges (one per line) are started
 #define BITTREX_ENABLED
 #define BINANCE_ENABLED
 #define POLONIEX_ENABLED
@@ -20,10 +20,17 @@
 //#define PRINT_LOGS_TO_FILE
 #define PRINT_LOGS_TO_FILE_COLOR
 
-/// to make trades with the strategy, comment this out
+/// to match orders on a simulated exchange against live prices instead of sending them, uncomment this
 //#define PAPER_TRADE
 
+/// to answer every rest request from ~/.config/trader/mock.<exchange> (see mocknetwork.cpp) instead of the exchange, uncomment this
+//#define MOCK_NETWORK
+
+/// to serve prometheus metrics at http://127.0.0.1:<port>/metrics, uncomment this
+//#define METRICS_PORT 9464
+
 /// what to log
+#define LOG_LEVEL 1 // kLog() levels to build in: 0 = trace, 1 = debug (per order and chatty lines), 2 = info, 3 = warn
 //#define PRINT_LOGS_WITH_FUNCTION_NAMES
 #define PRINT_ENABLED_SSL_CIPHERS
 //#define PRINT_DISABLED_SSL_CIPHERS
@@ -32,7 +39,4 @@
 #define SPREAD_EXPAND_FULL // expand to trade price
 //#define SPREAD_EXPAND_HALF // expand between trade price and current ticker price
 
-/// spread contraction on aggressive spread
-#define SPREAD_CONTRACT_RATIO "0.5"
-
 #endif // BUILDCONFIG_H
@@ -0,0 +1,105 @@
+#ifndef CIRCUITBREAKER_H
+#define CIRCUITBREAKER_H
+
+#include "global.h"
+
+//
+// CircuitBreaker, stops sending a class of requests while the server keeps failing them. after FAILURE_THRESHOLD
+// failures in a row it opens and nothing is sent for a backoff that doubles every time it opens again, up to
+// BACKOFF_MAX, with a random half of it as jitter so the shards and exchanges don't all come back at once. once the
+// backoff is over it's half-open, one request goes out as a probe, and its reply closes it or opens it again
+//
+class CircuitBreaker
+{
+public:
+    enum State : quint8
+    {
+        CLOSED = 0,
+        OPEN,
+        HALF_OPEN
+    };
+
+    static const qint32 FAILURE_THRESHOLD = 5;
+    static const qint64 BACKOFF_BASE = 1000; // ms
+    static const qint64 BACKOFF_MAX = 60000; // ms, also how long we wait for a probe's reply before sending another
+
+    State getState( const qint64 current_time ) const
+    {
+        if ( state == OPEN && current_time >= open_until )
+            return HALF_OPEN;
+
+        return state;
+    }
+
+    // closed, or half-open without a probe out
+    bool isSendAllowed( const qint64 current_time ) const
+    {
+        const State s = getState( current_time );
+        if ( s == CLOSED )
+            return true;
+        if ( s == OPEN )
+            return false;
+
+        // a probe that went with its position doesn't hold the class forever
+        return probe_time == 0 || current_time - probe_time >= BACKOFF_MAX;
+    }
+
+    qint64 getWaitTime( const qint64 current_time ) const { return state == OPEN ? qMax( qint64( 0 ), open_until - current_time ) : 0; }
+
+    void addSent( const qint64 current_time )
+    {
+        if ( getState( current_time ) != HALF_OPEN )
+            return;
+
+        state = HALF_OPEN;
+        probe_time = current_time;
+    }
+
+    void addSuccess( const qint64 current_time )
+    {
+        // a late reply to something sent before it opened doesn't mean the server is back
+        if ( getState( current_time ) == OPEN )
+            return;
+
+        state = CLOSED;
+        failures = 0;
+        open_count = 0;
+        probe_time = 0;
+    }
+
+    void addFailure( const qint64 current_time )
+    {
+        // the rest of what was out when it opened, we already know
+        if ( getState( current_time ) == OPEN )
+            return;
+
+        failures++;
+
+        // a failed probe opens it again right away, otherwise wait for the threshold
+        if ( state == CLOSED && failures < FAILURE_THRESHOLD )
+            return;
+
+        // the backoff doubles each time it opens, and we wait between half and all of it
+        const qint64 backoff = qMin( BACKOFF_MAX, BACKOFF_BASE << qMin( open_count, 16 ) );
+        const qint64 jitter = Global::getSecureRandomRange32( 0, quint32( backoff / 2 ) );
+
+        state = OPEN;
+        open_until = current_time + backoff / 2 + jitter;
+        open_count++;
+        trip_count++;
+        probe_time = 0;
+    }
+
+    qint32 getFailures() const { return failures; }
+    qint64 getTripCount() const { return trip_count; }
+
+private:
+    State state{ CLOSED };
+    qint32 failures{ 0 }; // in a row
+    qint32 open_count{ 0 }; // times opened since it was last closed, the backoff exponent
+    qint64 open_until{ 0 };
+    qint64 probe_time{ 0 }; // when the half-open probe went out, 0 if none is out
+    qint64 trip_count{ 0 }; // times opened, for metrics
+};
+
+#endif // CIRCUITBREAKER_H
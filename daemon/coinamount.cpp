@@ -1,7 +1,10 @@
 #include "coinamount.h"
 #include "global.h"
 
-#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
 #include <gmp.h>
 
 #include <QString>
@@ -17,43 +20,603 @@ static inline QString qstringToSubsatoshis( QString s )
     return CoinAmount::toSatoshiFormatStr( s, CoinAmount::subsatoshi_decimals ).remove( CoinAmount::decimal_exp );
 }
 
+// raw value of 1.0 in subsatoshis (10^16)
+static const __int128 coin_raw = 10000000000000000LL;
+// 10^8, used to divide mpz values by 10^16 in two steps without needing a 64-bit unsigned long
+static const unsigned long satoshi_parts_ui = 100000000UL;
+// the largest amount of significant digits that safely fits into 126 bits
+static const int max_int128_digits = 37;
+// raw subsatoshi units for each amount of decimals, ie. pow10_for_decimals[ 8 ] is a satoshi
+static const int64_t pow10_for_decimals[ CoinAmount::subsatoshi_decimals +1 ] =
+{
+    10000000000000000LL, 1000000000000000LL, 100000000000000LL, 10000000000000LL, 1000000000000LL,
+    100000000000LL, 10000000000LL, 1000000000LL, 100000000LL, 10000000LL, 1000000LL, 100000LL, 10000LL,
+    1000LL, 100LL, 10LL, 1LL
+};
+
+// the exact value of r rounded to subsatoshis (half away from zero, like QString::number( r, 'f', 16 )) without
+// formatting it, returns false if it doesn't fit. infinity and nan are zero
+static inline bool qrealToRaw( const qreal r, __int128 &out )
+{
+    out = 0;
+    if ( !std::isfinite( r ) || r == 0. )
+        return true;
+
+    // r = mantissa * 2^exp exactly, with a 53 bit mantissa
+    int exp = 0;
+    const qint64 mantissa = static_cast<qint64>( std::ldexp( std::frexp( r, &exp ), 53 ) );
+    exp -= 53;
+
+    // 53 bits times 10^16 (54 bits) can still shift left by up to 19 bits in 126 bits
+    const unsigned __int128 n = static_cast<unsigned __int128>( mantissa < 0 ? -mantissa : mantissa ) * 10000000000000000ULL;
+    unsigned __int128 u;
+
+    if ( exp >= 0 )
+    {
+        if ( exp > 19 )
+            return false;
+
+        u = n << exp;
+    }
+    else
+    {
+        const int shift = -exp;
+        if ( shift > 120 )
+            return true; // below half a subsatoshi
+
+        const unsigned __int128 half = static_cast<unsigned __int128>( 1 ) << ( shift -1 );
+        u = ( n >> shift ) + ( ( n & ( ( half << 1 ) -1 ) ) >= half ? 1 : 0 );
+    }
+
+    out = mantissa < 0 ? -static_cast<__int128>( u ) : static_cast<__int128>( u );
+    return true;
+}
+
+static inline __int128 floorDiv( const __int128 n, const __int128 d )
+{
+    // match mpz_div() (floor) instead of c++ truncation towards zero
+    __int128 q = n / d;
+    if ( n % d != 0 && ( ( n < 0 ) != ( d < 0 ) ) )
+        q--;
+    return q;
+}
+
+// floor( a * b / 10^32 ) for a and b up to 10^32, split at 10^16 so every partial product fits in 128 bits
+static inline unsigned __int128 mulFine( const unsigned __int128 a, const unsigned __int128 b )
+{
+    const unsigned __int128 c = coin_raw;
+    const unsigned __int128 a1 = a / c, a0 = a % c, b1 = b / c, b0 = b % c;
+    return a1 * b1 + ( a1 * b0 + a0 * b1 + a0 * b0 / c ) / c;
+}
+
+static inline void int128ToMpz( mpz_t z, const __int128 v )
+{
+    const bool is_negative = v < 0;
+    const unsigned __int128 u = is_negative ? -static_cast<unsigned __int128>( v ) : static_cast<unsigned __int128>( v );
+    const uint64_t words[ 2 ] = { static_cast<uint64_t>( u ), static_cast<uint64_t>( u >> 64 ) };
+
+    mpz_import( z, 2, -1, sizeof( uint64_t ), 0, 0, words );
+    if ( is_negative )
+        mpz_neg( z, z );
+}
+
+// writes the magnitude of v into out (at least 40 bytes) without leading zeroes, returns the digit count
+static inline int int128ToDigits( const __int128 v, char *out )
+{
+    char reversed[ 40 ];
+    unsigned __int128 u = v < 0 ? -static_cast<unsigned __int128>( v ) : static_cast<unsigned __int128>( v );
+    int n = 0;
+
+    do
+    {
+        reversed[ n++ ] = static_cast<char>( '0' + static_cast<int>( u % 10 ) );
+        u /= 10;
+    }
+    while ( u > 0 );
+
+    for ( int i = 0; i < n; i++ )
+        out[ i ] = reversed[ n - i -1 ];
+
+    return n;
+}
+
+// lays out subsatoshi magnitude digits as a decimal truncated at 'decimals', returns the length or -1 if buf is too small
+static inline int formatDigits( const char *digits, const int n, const bool is_negative, char *buf, const int buf_size, int decimals )
+{
+    decimals = std::max( 0, std::min( decimals, CoinAmount::subsatoshi_decimals ) );
+
+    const int int_len = n - CoinAmount::subsatoshi_decimals;
+    const int needed = ( is_negative ? 1 : 0 ) + std::max( int_len, 1 ) +1 + decimals;
+
+    if ( needed > buf_size )
+        return -1;
+
+    int k = 0;
+    if ( is_negative )
+        buf[ k++ ] = '-';
+
+    // integer part
+    if ( int_len > 0 )
+        for ( int i = 0; i < int_len; i++ )
+            buf[ k++ ] = digits[ i ];
+    else
+        buf[ k++ ] = '0';
+
+    buf[ k++ ] = '.';
+
+    // fractional part, zero padded on the left side
+    for ( int j = 0; j < decimals; j++ )
+    {
+        const int idx = int_len + j;
+        buf[ k++ ] = idx >= 0 ? digits[ idx ] : '0';
+    }
+
+    return k;
+}
+
+static inline char asciiAt( const char *s, const size_t i )
+{
+    return s[ i ];
+}
+
+static inline char asciiAt( const QChar *s, const size_t i )
+{
+    const ushort c = s[ i ].unicode();
+    return c < 128 ? static_cast<char>( c ) : '\0';
+}
+
+static inline bool isAsciiSpace( const char c )
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static inline bool isAsciiDigit( const char c )
+{
+    return c >= '0' && c <= '9';
+}
+
+// reads a plain or scientific notation decimal string and writes the raw subsatoshi digits into out, truncating
+// anything past 16 decimals. returns the length written, -1 on bad input, or -2 if out isn't big enough.
+template <typename T>
+static int decimalToSubsatoshiDigits( const T *s, const size_t len, char *out, const int out_size )
+{
+    size_t i = 0, end = len;
+
+    // trim
+    while ( i < end && isAsciiSpace( asciiAt( s, i ) ) )
+        i++;
+    while ( end > i && isAsciiSpace( asciiAt( s, end -1 ) ) )
+        end--;
+
+    const bool is_negative = i < end && asciiAt( s, i ) == '-';
+    if ( is_negative )
+        i++;
+
+    // skip leading zeroes
+    while ( i < end && asciiAt( s, i ) == '0' )
+        i++;
+
+    // read the integer part
+    const size_t int_begin = i;
+    while ( i < end && isAsciiDigit( asciiAt( s, i ) ) )
+        i++;
+    const size_t int_end = i;
+
+    // read the fractional part
+    size_t frac_begin = i, frac_end = i;
+    if ( i < end && asciiAt( s, i ) == '.' )
+    {
+        frac_begin = ++i;
+        while ( i < end && isAsciiDigit( asciiAt( s, i ) ) )
+            i++;
+        frac_end = i;
+    }
+
+    // read exponent
+    int exponent = 0;
+    if ( i < end && ( asciiAt( s, i ) == 'e' || asciiAt( s, i ) == 'E' ) )
+    {
+        i++;
+        const bool exponent_negative = i < end && asciiAt( s, i ) == '-';
+        if ( i < end && ( asciiAt( s, i ) == '-' || asciiAt( s, i ) == '+' ) )
+            i++;
+
+        if ( i == end )
+            return -1;
+
+        for ( ; i < end && isAsciiDigit( asciiAt( s, i ) ); i++ )
+        {
+            exponent = exponent * 10 + ( asciiAt( s, i ) - '0' );
+
+            // way out of range, let the slow path deal with it
+            if ( exponent > 100000 )
+                return -2;
+        }
+
+        if ( exponent_negative )
+            exponent = -exponent;
+    }
+
+    // trap junk
+    if ( i != end )
+        return -1;
+
+    const int int_len = static_cast<int>( int_end - int_begin );
+    const int frac_len = static_cast<int>( frac_end - frac_begin );
+
+    // the amount of digits we want is the integer part, shifted by the exponent, plus 16 decimals
+    const int digits = int_len + exponent + CoinAmount::subsatoshi_decimals;
+    if ( digits <= 0 )
+    {
+        out[ 0 ] = '0';
+        return 1;
+    }
+
+    if ( digits +1 > out_size )
+        return -2;
+
+    int n = 0;
+    if ( is_negative )
+        out[ n++ ] = '-';
+
+    for ( int k = 0; k < digits; k++ )
+    {
+        if ( k < int_len )
+            out[ n++ ] = asciiAt( s, int_begin + k );
+        else if ( k - int_len < frac_len )
+            out[ n++ ] = asciiAt( s, frac_begin + k - int_len );
+        else
+            out[ n++ ] = '0';
+    }
+
+    return n;
+}
+
 Coin::Coin()
 {
-    mpz_init( b );
 }
 
 Coin::~Coin()
 {
-    mpz_clear( b );
+    if ( is_big )
+        mpz_clear( b );
 }
 
 Coin::Coin( const Coin &big )
+    : v( big.v ),
+      is_big( big.is_big )
+{
+    if ( is_big )
+        mpz_init_set( b, big.b );
+}
+
+Coin::Coin( Coin &&big ) noexcept
+    : v( big.v ),
+      is_big( big.is_big )
 {
-    mpz_init_set( b, big.b );
+    // take the limbs and leave a small zero behind
+    if ( is_big )
+    {
+        *b = *big.b;
+        big.is_big = false;
+        big.v = 0;
+    }
 }
 
 Coin::Coin( QString amount )
 {
-    mpz_init_set_str( b, qstringToSubsatoshis( amount ).toLocal8Bit().data(), CoinAmount::str_base );
+    setSubsatoshis( qstringToSubsatoshis( amount ).toLocal8Bit() );
 }
 
 Coin::Coin( qreal amount )
 {
-    mpz_init_set_str( b, qrealToSubsatoshis( amount ).toLocal8Bit().data(), CoinAmount::str_base );
+    if ( qrealToRaw( amount, v ) )
+        return;
+
+    setSubsatoshis( qrealToSubsatoshis( amount ).toLocal8Bit() );
+}
+
+void Coin::promote()
+{
+    if ( is_big )
+        return;
+
+    mpz_init( b );
+    int128ToMpz( b, v );
+    is_big = true;
+}
+
+void Coin::demote()
+{
+    // keep anything over 126 bits in gmp so small ops can't overflow the sign bit
+    if ( !is_big || mpz_sizeinbase( b, 2 ) > 126 )
+        return;
+
+    uint64_t words[ 2 ] = { 0, 0 };
+    mpz_export( words, nullptr, -1, sizeof( uint64_t ), 0, 0, b );
+
+    const __int128 u = static_cast<__int128>( ( static_cast<unsigned __int128>( words[ 1 ] ) << 64 ) | words[ 0 ] );
+    v = mpz_sgn( b ) < 0 ? -u : u;
+
+    mpz_clear( b );
+    is_big = false;
+}
+
+void Coin::getMpz( mpz_t out ) const
+{
+    if ( is_big )
+        mpz_set( out, b );
+    else
+        int128ToMpz( out, v );
+}
+
+void Coin::setSubsatoshis( const QByteArray &digits )
+{
+    setSubsatoshis( digits.constData(), digits.size() );
+}
+
+void Coin::setSubsatoshis( const char *digits, const int len )
+{
+    const char *p = digits;
+    const char *const end = p + len;
+    const bool is_negative = p < end && *p == '-';
+
+    if ( is_negative )
+        p++;
+
+    // skip zero padding
+    while ( p < end && *p == '0' )
+        p++;
+
+    // read digits into the fixed width value, or fall back to gmp for anything else
+    bool fits = end - p <= max_int128_digits;
+    __int128 r = 0;
+    for ( ; fits && p < end; p++ )
+    {
+        if ( *p < '0' || *p > '9' )
+        {
+            fits = false;
+            break;
+        }
+
+        r = r * 10 + ( *p - '0' );
+    }
+
+    if ( fits )
+    {
+        if ( is_big )
+        {
+            mpz_clear( b );
+            is_big = false;
+        }
+
+        v = is_negative ? -r : r;
+        return;
+    }
+
+    if ( !is_big )
+    {
+        mpz_init( b );
+        is_big = true;
+    }
+
+    // mpz_set_str() needs a null-terminated string
+    mpz_set_str( b, QByteArray( digits, len ).constData(), CoinAmount::str_base );
+    demote();
+}
+
+Coin Coin::fromAscii( const char *s, const size_t len )
+{
+    Coin ret;
+    char buffer[ 256 ];
+    const int n = decimalToSubsatoshiDigits( s, len, buffer, sizeof( buffer ) );
+
+    if ( n > 0 )
+        ret.setSubsatoshis( buffer, n );
+    // out of range for the stack buffer, take the long way
+    else if ( n == -2 )
+        ret = QString::fromLatin1( s, static_cast<int>( len ) );
+
+    return ret;
+}
+
+Coin Coin::fromAscii( const QByteArray &s )
+{
+    return fromAscii( s.constData(), static_cast<size_t>( s.size() ) );
+}
+
+Coin Coin::fromAscii( const QString &s )
+{
+    Coin ret;
+    char buffer[ 256 ];
+    const int n = decimalToSubsatoshiDigits( s.constData(), static_cast<size_t>( s.size() ), buffer, sizeof( buffer ) );
+
+    if ( n > 0 )
+        ret.setSubsatoshis( buffer, n );
+    else if ( n == -2 )
+        ret = s;
+
+    return ret;
+}
+
+int Coin::compare( const Coin &c ) const
+{
+    if ( !is_big && !c.is_big )
+        return v < c.v ? -1 : v > c.v ? 1 : 0;
+
+    mpz_t x, y;
+    mpz_init( x );
+    mpz_init( y );
+    getMpz( x );
+    c.getMpz( y );
+
+    const int ret = mpz_cmp( x, y );
+
+    mpz_clear( x );
+    mpz_clear( y );
+    return ret;
 }
 
 Coin &Coin::operator =( const QString &in )
 {
-    mpz_set_str( b, qstringToSubsatoshis( in ).toLocal8Bit().data(), CoinAmount::str_base );
+    setSubsatoshis( qstringToSubsatoshis( in ).toLocal8Bit() );
     return *this;
 }
 
 Coin &Coin::operator =( const Coin &c )
 {
-    mpz_set( b, c.b );
+    if ( c.is_big )
+    {
+        if ( !is_big )
+        {
+            mpz_init( b );
+            is_big = true;
+        }
+
+        mpz_set( b, c.b );
+        return *this;
+    }
+
+    if ( is_big )
+    {
+        mpz_clear( b );
+        is_big = false;
+    }
+
+    v = c.v;
     return *this;
 }
 
+Coin &Coin::operator =( Coin &&c ) noexcept
+{
+    if ( this == &c )
+        return *this;
+
+    if ( c.is_big )
+    {
+        // swap limbs, c will free our old value
+        if ( is_big )
+            mpz_swap( b, c.b );
+        else
+        {
+            *b = *c.b;
+            is_big = true;
+            c.is_big = false;
+            c.v = 0;
+        }
+
+        return *this;
+    }
+
+    if ( is_big )
+    {
+        mpz_clear( b );
+        is_big = false;
+    }
+
+    v = c.v;
+    return *this;
+}
+
+Coin &Coin::setMul( const Coin &a, const Coin &c )
+{
+    // a * c == c * a, so if c is us just multiply by a
+    if ( this == &c )
+        return operator *=( a );
+
+    operator =( a );
+    return operator *=( c );
+}
+
+Coin &Coin::setDiv( const Coin &a, const Coin &c )
+{
+    // we can't overwrite the divisor, use a temporary
+    if ( this == &c )
+    {
+        Coin r = a;
+        r /= c;
+        return operator =( std::move( r ) );
+    }
+
+    operator =( a );
+    return operator /=( c );
+}
+
+Coin Coin::mulDiv( const Coin &num, const Coin &den ) const
+{
+    if ( den.isZero() )
+    {
+        kDebug() << "[Coin] trapped div0 in" << __FUNCTION__ << toSubSatoshiString() << "*" << num.toSubSatoshiString() << "/" << den.toSubSatoshiString();
+        return Coin();
+    }
+
+    // fast path: the subsatoshi scale of num and den cancel out, so r = b * num.b / den.b
+    Coin r;
+    __int128 n;
+    if ( !is_big && !num.is_big && !den.is_big && !__builtin_mul_overflow( v, num.v, &n ) )
+    {
+        r.v = floorDiv( n, den.v );
+        return r;
+    }
+
+    mpz_t x, y;
+    mpz_init( x );
+    mpz_init( y );
+    num.getMpz( x );
+    den.getMpz( y );
+    r.promote();
+    getMpz( r.b );
+    mpz_mul( r.b, r.b, x );
+    mpz_div( r.b, r.b, y );
+    mpz_clear( x );
+    mpz_clear( y );
+    r.demote();
+    return r;
+}
+
+Coin Coin::pow( quint64 n ) const
+{
+    // -1 to 1 is raised with 16 more decimals and rounded down once. of the extra decimals, only the last
+    // couple collect the rounding of each step
+    if ( !is_big && v >= -coin_raw && v <= coin_raw )
+    {
+        unsigned __int128 fine = static_cast<unsigned __int128>( coin_raw ) * coin_raw,
+                          base = static_cast<unsigned __int128>( v < 0 ? -v : v ) * coin_raw;
+        const bool is_negative = v < 0 && ( n & 1 );
+
+        while ( n > 0 )
+        {
+            if ( n & 1 )
+                fine = mulFine( fine, base );
+
+            n >>= 1;
+            if ( n > 0 )
+                base = mulFine( base, base );
+        }
+
+        Coin ret;
+        ret.v = static_cast<__int128>( fine / coin_raw );
+        if ( is_negative )
+            ret.v = -ret.v - ( fine % coin_raw != 0 ? 1 : 0 );
+
+        return ret;
+    }
+
+    Coin ret = CoinAmount::COIN, base = *this;
+
+    while ( n > 0 )
+    {
+        if ( n & 1 )
+            ret *= base;
+
+        n >>= 1;
+        if ( n > 0 )
+            base *= base;
+    }
+
+    return ret;
+}
+
 Coin &Coin::operator /=( const QString &s )
 {
     return operator /=( Coin( s ) );
@@ -61,104 +624,223 @@ Coin &Coin::operator /=( const QString &s )
 
 Coin &Coin::operator +=( const Coin &c )
 {
-    mpz_add( b, b, c.b ); // b += c.b;
+    // fast path
+    __int128 r;
+    if ( !is_big && !c.is_big && !__builtin_add_overflow( v, c.v, &r ) )
+    {
+        v = r;
+        return *this;
+    }
+
+    mpz_t x;
+    mpz_init( x );
+    c.getMpz( x );
+    promote();
+    mpz_add( b, b, x ); // b += c.b;
+    mpz_clear( x );
+    demote();
     return *this;
 }
 
 Coin &Coin::operator -=( const Coin &c )
 {
-    mpz_sub( b, b, c.b ); // b -= c.b;
+    // fast path
+    __int128 r;
+    if ( !is_big && !c.is_big && !__builtin_sub_overflow( v, c.v, &r ) )
+    {
+        v = r;
+        return *this;
+    }
+
+    mpz_t x;
+    mpz_init( x );
+    c.getMpz( x );
+    promote();
+    mpz_sub( b, b, x ); // b -= c.b;
+    mpz_clear( x );
+    demote();
     return *this;
 }
 
 Coin &Coin::operator /=( const Coin &c )
 {
-    mpz_mul( b, b, CoinAmount::COIN.b );
-    if ( mpz_cmp_ui( c.b, 0 ) != 0 )
-        mpz_div( b, b, c.b );
-    else
+    if ( c.isZero() )
     {
         kDebug() << "[Coin] trapped div0 in" << __FUNCTION__ << toSubSatoshiString() << "/" << c.toSubSatoshiString();
-        mpz_set_ui( b, 0 );
+        *this = Coin();
+        return *this;
+    }
+
+    // fast path: b = b * COIN / c.b
+    __int128 n;
+    if ( !is_big && !c.is_big && !__builtin_mul_overflow( v, coin_raw, &n ) )
+    {
+        v = floorDiv( n, c.v );
+        return *this;
     }
+
+    mpz_t x;
+    mpz_init( x );
+    c.getMpz( x );
+    promote();
+    mpz_mul_ui( b, b, satoshi_parts_ui );
+    mpz_mul_ui( b, b, satoshi_parts_ui );
+    mpz_div( b, b, x );
+    mpz_clear( x );
+    demote();
     return *this;
 }
 
 Coin &Coin::operator *=( const Coin &c )
 {
-    mpz_mul( b, b, CoinAmount::COIN_PARTS.b );
-    mpz_mul( b, b, c.b );
-    mpz_div( b, b, CoinAmount::COIN_PARTS_DIV.b );
+    // fast path: b = b * c.b / COIN
+    __int128 n;
+    if ( !is_big && !c.is_big && !__builtin_mul_overflow( v, c.v, &n ) )
+    {
+        v = floorDiv( n, coin_raw );
+        return *this;
+    }
+
+    // note: b * COIN_PARTS * c.b / COIN_PARTS^2 reduces to b * c.b / COIN_PARTS, and nested floor divisions by
+    //       positive integers are exact, so we divide by 10^8 twice
+    mpz_t x;
+    mpz_init( x );
+    c.getMpz( x );
+    promote();
+    mpz_mul( b, b, x );
+    mpz_fdiv_q_ui( b, b, satoshi_parts_ui );
+    mpz_fdiv_q_ui( b, b, satoshi_parts_ui );
+    mpz_clear( x );
+    demote();
     return *this;
 }
 
 Coin &Coin::operator /=( const uint64_t &i )
 {
-    if ( i != 0 )
-        mpz_div_ui( b, b, i ); // b /= i;
-    else
+    if ( i == 0 )
     {
         kDebug() << "[Coin] trapped div0 in" << __FUNCTION__ << toSubSatoshiString() << "/" << i;
-        mpz_set_ui( b, 0 );
+        *this = Coin();
+        return *this;
     }
+
+    // fast path
+    if ( !is_big )
+    {
+        v = floorDiv( v, static_cast<__int128>( i ) );
+        return *this;
+    }
+
+    mpz_div_ui( b, b, i ); // b /= i;
+    demote();
     return *this;
 }
 
 Coin &Coin::operator *=( const uint64_t &i )
 {
+    // fast path
+    __int128 r;
+    if ( !is_big && !__builtin_mul_overflow( v, static_cast<__int128>( i ), &r ) )
+    {
+        v = r;
+        return *this;
+    }
+
+    promote();
     mpz_mul_ui( b, b, i ); // b *= i;
+    demote();
     return *this;
 }
 
-Coin Coin::operator *( const QString &s ) const
+Coin Coin::operator *( const QString &s ) const &
 {
     return operator *( Coin( s ) );
 }
 
-Coin Coin::operator -( const Coin &c ) const
+Coin Coin::operator *( const QString &s ) &&
+{
+    operator *=( Coin( s ) );
+    return std::move( *this );
+}
+
+Coin Coin::operator -( const Coin &c ) const &
 {
     Coin r = *this;
     r -= c;
     return r;
 }
 
-Coin Coin::operator +( const Coin &c ) const
+Coin Coin::operator +( const Coin &c ) const &
 {
     Coin r = *this;
     r += c;
     return r;
 }
 
-Coin Coin::operator *( const Coin &c ) const
+Coin Coin::operator *( const Coin &c ) const &
 {
-    Coin in = c;
-    mpz_mul( in.b, in.b, CoinAmount::COIN_PARTS.b );
-    mpz_mul( in.b, in.b, b );
-    mpz_div( in.b, in.b, CoinAmount::COIN_PARTS_DIV.b );
-    return in;
+    Coin r = *this;
+    r *= c;
+    return r;
 }
 
-Coin Coin::operator /( const Coin &c ) const
+Coin Coin::operator /( const Coin &c ) const &
 {
     Coin in = *this;
     in /= c;
     return in;
 }
 
-Coin Coin::operator *( const uint64_t &i ) const
+Coin Coin::operator -( const Coin &c ) &&
+{
+    operator -=( c );
+    return std::move( *this );
+}
+
+Coin Coin::operator +( const Coin &c ) &&
+{
+    operator +=( c );
+    return std::move( *this );
+}
+
+Coin Coin::operator *( const Coin &c ) &&
+{
+    operator *=( c );
+    return std::move( *this );
+}
+
+Coin Coin::operator /( const Coin &c ) &&
+{
+    operator /=( c );
+    return std::move( *this );
+}
+
+Coin Coin::operator *( const uint64_t &i ) const &
 {
     Coin r = *this;
     r *= i;
     return r;
 }
 
-Coin Coin::operator /( const uint64_t &i ) const
+Coin Coin::operator /( const uint64_t &i ) const &
 {
     Coin r = *this;
     r /= i;
     return r;
 }
 
+Coin Coin::operator *( const uint64_t &i ) &&
+{
+    operator *=( i );
+    return std::move( *this );
+}
+
+Coin Coin::operator /( const uint64_t &i ) &&
+{
+    operator /=( i );
+    return std::move( *this );
+}
+
 bool Coin::operator ==( const QString &s ) const
 {
     return s == toAmountString();
@@ -171,12 +853,12 @@ bool Coin::operator !=( const QString &s ) const
 
 bool Coin::operator ==( const Coin &c ) const
 {
-    return mpz_cmp( b, c.b ) == 0;
+    return compare( c ) == 0;
 }
 
 bool Coin::operator !=( const Coin &c ) const
 {
-    return mpz_cmp( b, c.b ) != 0;
+    return compare( c ) != 0;
 }
 
 bool Coin::operator <( const QString &s ) const
@@ -191,12 +873,12 @@ bool Coin::operator >( const QString &s ) const
 
 bool Coin::operator <( const Coin &c ) const
 {
-    return mpz_cmp( b, c.b ) < 0;
+    return compare( c ) < 0;
 }
 
 bool Coin::operator >( const Coin &c ) const
 {
-    return mpz_cmp( b, c.b ) > 0;
+    return compare( c ) > 0;
 }
 
 bool Coin::operator <=( const QString &s ) const
@@ -211,12 +893,12 @@ bool Coin::operator >=( const QString &s ) const
 
 bool Coin::operator <=( const Coin &c ) const
 {
-    return mpz_cmp( b, c.b ) <= 0;
+    return compare( c ) <= 0;
 }
 
 bool Coin::operator >=( const Coin &c ) const
 {
-    return mpz_cmp( b, c.b ) >= 0;
+    return compare( c ) >= 0;
 }
 
 Coin Coin::operator -() const
@@ -233,22 +915,22 @@ Coin Coin::abs() const
 
 bool Coin::isZero() const
 {
-    return mpz_cmp_ui( b, 0 ) == 0;
+    return is_big ? mpz_sgn( b ) == 0 : v == 0;
 }
 
 bool Coin::isZeroOrLess() const
 {
-    return mpz_cmp_ui( b, 0 ) <= 0;
+    return is_big ? mpz_sgn( b ) <= 0 : v <= 0;
 }
 
 bool Coin::isLessThanZero() const
 {
-    return mpz_cmp_ui( b, 0 ) < 0;
+    return is_big ? mpz_sgn( b ) < 0 : v < 0;
 }
 
 bool Coin::isGreaterThanZero() const
 {
-    return mpz_cmp_ui( b, 0 ) > 0;
+    return is_big ? mpz_sgn( b ) > 0 : v > 0;
 }
 
 Coin::operator QString() const
@@ -256,62 +938,53 @@ Coin::operator QString() const
     return toAmountString();
 }
 
-// note: these next few functions are optimized with 'static' but it'll only work with 1 thread using Coin
-QString Coin::toString( const int decimals = CoinAmount::subsatoshi_decimals ) const
+int Coin::format( char *buf, const int buf_size, const int decimals ) const
 {
-    // note: if multithread, then remove these static declarations
-    static size_t buffer_size;
-    static std::vector<char> buffer = std::vector<char>( 10 );
-
-    // resize the buffer to how many base10 bytes we'll need
-    buffer_size = mpz_sizeinbase( b, CoinAmount::str_base ) +2; // "two extra bytes for a possible minus sign, and null-terminator."
-    if ( buffer_size != buffer.size() )
-        buffer.resize( buffer_size );
+    // fast path, no allocations
+    if ( !is_big )
+    {
+        char digits[ 40 ];
+        const int n = int128ToDigits( v, digits );
+        return formatDigits( digits, n, v < 0, buf, buf_size, decimals );
+    }
 
-    // fill buffer and make a QString out of it
-    mpz_get_str( buffer.data(), CoinAmount::str_base, b );
-    QString ret( buffer.data() );
+    // "two extra bytes for a possible minus sign, and null-terminator."
+    QByteArray digits( static_cast<int>( mpz_sizeinbase( b, CoinAmount::str_base ) ) +2, '\0' );
+    mpz_get_str( digits.data(), CoinAmount::str_base, b );
 
-    // alternative method which uses malloc/free, about 2.5% slower than std::vector
-//    char *c = mpz_get_str( nullptr, 10, b );
-//    ret.insert( 0, c );
-//    free( c );
+    const bool is_negative = digits.at( 0 ) == '-';
+    const char *d = digits.constData() + ( is_negative ? 1 : 0 );
 
-    // temporarily remove the negative sign so we can properly prepend zeroes
-    bool is_negative = ret.at( 0 ) == CoinAmount::minus_exp;
-    if ( is_negative ) ret.remove( 0, 1 );
+    return formatDigits( d, static_cast<int>( qstrlen( d ) ), is_negative, buf, buf_size, decimals );
+}
 
-    int sz = ret.size();
-    // truncate at proper digit if we have less than 16 digits
-    if ( decimals < CoinAmount::subsatoshi_decimals )
+void Coin::appendTo( QByteArray &out, const int decimals ) const
+{
+    if ( !is_big )
     {
-        int diff = CoinAmount::subsatoshi_decimals - decimals;
-        ret.chop( diff );
-
-        // update sz1
-        if ( sz <= CoinAmount::satoshi_decimals )
-            sz = 0;
-        else
-            sz -= diff;
+        char buf[ FORMAT_BUFFER_SIZE ];
+        out.append( buf, format( buf, sizeof( buf ), decimals ) );
+        return;
     }
 
-    while ( sz < decimals )
+    // big values need sign, digits, decimal and up to 16 padded zeroes
+    const int buf_size = static_cast<int>( mpz_sizeinbase( b, CoinAmount::str_base ) ) + CoinAmount::subsatoshi_decimals +4;
+    const int sz = out.size();
+    out.resize( sz + buf_size );
+    out.resize( sz + format( out.data() + sz, buf_size, decimals ) );
+}
+
+QString Coin::toString( const int decimals = CoinAmount::subsatoshi_decimals ) const
+{
+    if ( !is_big )
     {
-        sz++; // add only if statement passes
-        ret.prepend( CoinAmount::zero_exp );
+        char buf[ FORMAT_BUFFER_SIZE ];
+        return QString::fromLatin1( buf, format( buf, sizeof( buf ), decimals ) );
     }
 
-    // reuse sz to calculate a new decimal index and insert decimal
-    sz -= decimals;
-    ret.insert( sz, CoinAmount::decimal_exp );
-
-    // decimal is the first character, return with prepended zero
-    if ( sz == 0 )
-        ret.prepend( CoinAmount::zero_exp );
-
-    if ( is_negative ) ret.prepend( CoinAmount::minus_exp );
-
-    return ret;
+    QByteArray ret;
+    appendTo( ret, decimals );
+    return QString::fromLatin1( ret );
 }
 
 QString Coin::toSubSatoshiString() const
@@ -324,69 +997,84 @@ QString Coin::toAmountString() const
     return toString( CoinAmount::satoshi_decimals );
 }
 
-int Coin::toInt() const
+bool Coin::getTruncated( const int decimals, qint64 &out ) const
 {
-    QString str = toString( 0 );
+    const int64_t parts = pow10_for_decimals[ decimals ];
 
-    // truncate decimal
-    str.chop( 1 );
+    // fast path, c++ division truncates towards zero like format() does
+    if ( !is_big )
+    {
+        const __int128 q = v / parts;
+        if ( q > std::numeric_limits<qint64>::max() || q < std::numeric_limits<qint64>::min() )
+            return false;
 
-    // convert to int
-    bool ok = false;
-    int ret = str.toInt( &ok );
+        out = static_cast<qint64>( q );
+        return true;
+    }
+
+    mpz_t q, d;
+    mpz_init( q );
+    mpz_init( d );
+    int128ToMpz( d, parts );
+    mpz_tdiv_q( q, b, d );
+
+    const bool ok = mpz_fits_slong_p( q ) != 0;
+    if ( ok )
+        out = mpz_get_si( q );
 
-    // check for valid int
-    if ( !ok )
+    mpz_clear( q );
+    mpz_clear( d );
+    return ok;
+}
+
+int Coin::toInt() const
+{
+    // whole coins, truncated
+    qint64 ret = 0;
+    if ( !getTruncated( 0, ret ) || ret > std::numeric_limits<int>::max() || ret < std::numeric_limits<int>::min() )
     {
-        kDebug() << "[Coin] local error: couldn't read integer out of" << str;
+        kDebug() << "[Coin] local error: couldn't read integer out of" << toString( 0 );
         return 0;
     }
 
-    return ret;
+    return static_cast<int>( ret );
 }
 
 quint32 Coin::toUInt32() const
 {
-    QString str = toString( 0 );
-
-    // truncate decimal
-    str.chop( 1 );
-
-    // convert to int
-    bool ok = false;
-    quint32 ret = str.toULong( &ok );
-
-    // check for valid int
-    if ( !ok )
+    // whole coins, truncated
+    qint64 ret = 0;
+    if ( !getTruncated( 0, ret ) || ret > std::numeric_limits<quint32>::max() || ret < 0 )
     {
-        kDebug() << "[Coin] local error: couldn't read integer out of" << str;
+        kDebug() << "[Coin] local error: couldn't read integer out of" << toString( 0 );
         return 0;
     }
 
-    return ret;
+    return static_cast<quint32>( ret );
 }
 
-qint64 Coin::toIntSatoshis()
+qint64 Coin::toIntSatoshis() const
 {
-    QString str = toString( CoinAmount::satoshi_decimals );
-
-    // remove decimal
-    str.remove( str.size() - ( CoinAmount::satoshi_decimals +1 ), 1 );
-
-    // convert to int
-    bool ok = false;
-    const qint64 ret = str.toLongLong( &ok );
-
-    // check for valid int
-    if ( !ok )
+    // whole satoshis, truncated
+    qint64 ret = 0;
+    if ( !getTruncated( CoinAmount::satoshi_decimals, ret ) )
     {
-        kDebug() << "[Coin] local error: couldn't read integer out of" << str;
+        kDebug() << "[Coin] local error: couldn't read integer out of" << toAmountString();
         return 0;
     }
 
     return ret;
 }
 
+bool Coin::toRawInt64( qint64 &out ) const
+{
+    if ( is_big || v > std::numeric_limits<qint64>::max() || v < std::numeric_limits<qint64>::min() )
+        return false;
+
+    out = static_cast<qint64>( v );
+    return true;
+}
+
 void Coin::applyRatio( qreal r )
 {
     // trap infinity as 0
@@ -394,9 +1082,8 @@ void Coin::applyRatio( qreal r )
          r == -std::numeric_limits<qreal>::infinity() )
         r = 0.;
 
-    // doesn't apply the ratio beyond Coin digits
-    operator *= ( Coin( r ) );
-    operator /= ( CoinAmount::COIN );
+    // doesn't apply the ratio beyond Coin digits, r is rounded to subsatoshis and multiplied in with a single floor
+    operator *=( Coin( r ) );
 }
 
 Coin Coin::ratio( qreal r ) const
@@ -433,6 +1120,54 @@ Coin Coin::truncatedByTicksize( QString ticksize )
     return ret;
 }
 
+void Coin::truncateByTicksize( const Coin &ticksize )
+{
+    // the string version only looks at the first 8 decimals, so stay compatible with it for anything else
+    if ( !ticksize.is_big )
+    {
+        for ( int dec = 0; dec <= CoinAmount::satoshi_decimals; dec++ )
+        {
+            if ( ticksize.v == pow10_for_decimals[ dec ] )
+            {
+                truncateByDecimals( dec );
+                return;
+            }
+        }
+    }
+
+    truncateByTicksize( ticksize.toAmountString() );
+}
+
+Coin Coin::truncatedByTicksize( const Coin &ticksize ) const
+{
+    Coin ret = *this;
+    ret.truncateByTicksize( ticksize );
+    return ret;
+}
+
+void Coin::truncateByDecimals( int decimals )
+{
+    decimals = std::max( 0, std::min( decimals, CoinAmount::subsatoshi_decimals ) );
+    const __int128 unit = pow10_for_decimals[ decimals ];
+
+    // fast path: c++ modulo truncates towards zero, like chopping off the string digits
+    if ( !is_big )
+    {
+        v -= v % unit;
+        return;
+    }
+
+    mpz_t u, r;
+    mpz_init( u );
+    mpz_init( r );
+    int128ToMpz( u, unit );
+    mpz_tdiv_r( r, b, u );
+    mpz_sub( b, b, r ); // b -= b % unit;
+    mpz_clear( r );
+    mpz_clear( u );
+    demote();
+}
+
 Coin Coin::ticksizeFromDecimals( int dec )
 {
     Coin ret = CoinAmount::SATOSHI;
@@ -446,3 +1181,209 @@ Coin Coin::ticksizeFromDecimals( int dec )
 
     return ret;
 }
+
+void CoinVector::reserve( const int size )
+{
+    if ( m_is_big )
+        m_coins.reserve( size );
+    else
+        m_raw.reserve( size );
+}
+
+void CoinVector::clear()
+{
+    m_raw.clear();
+    m_coins.clear();
+    m_is_big = false;
+}
+
+void CoinVector::append( const Coin &c )
+{
+    if ( !m_is_big && !c.is_big )
+    {
+        m_raw.append( c.v );
+        return;
+    }
+
+    promoteAll();
+    m_coins.append( c );
+}
+
+Coin CoinVector::at( const int i ) const
+{
+    if ( m_is_big )
+        return m_coins.at( i );
+
+    Coin ret;
+    ret.v = m_raw.at( i );
+    return ret;
+}
+
+void CoinVector::promoteAll()
+{
+    if ( m_is_big )
+        return;
+
+    m_coins.reserve( std::max( m_raw.capacity(), m_raw.size() +1 ) );
+    for ( QVector<__int128>::const_iterator i = m_raw.begin(); i != m_raw.end(); i++ )
+    {
+        Coin c;
+        c.v = *i;
+        m_coins.append( c );
+    }
+
+    m_raw.clear();
+    m_is_big = true;
+}
+
+Coin CoinVector::sum() const
+{
+    Coin ret;
+
+    if ( !m_is_big )
+    {
+        // fast path: accumulate without branching, check overflow once at the end
+        const __int128 *raw = m_raw.constData();
+        const int n = m_raw.size();
+        __int128 acc = 0;
+        bool overflow = false;
+
+        for ( int i = 0; i < n; i++ )
+            overflow |= __builtin_add_overflow( acc, raw[ i ], &acc );
+
+        if ( !overflow )
+        {
+            ret.v = acc;
+            return ret;
+        }
+    }
+
+    for ( int i = 0; i < size(); i++ )
+        ret += at( i );
+
+    return ret;
+}
+
+int CoinVector::indexOfMin() const
+{
+    if ( isEmpty() )
+        return -1;
+
+    int ret = 0;
+
+    if ( !m_is_big )
+    {
+        const __int128 *raw = m_raw.constData();
+        const int n = m_raw.size();
+
+        for ( int i = 1; i < n; i++ )
+            if ( raw[ i ] < raw[ ret ] )
+                ret = i;
+
+        return ret;
+    }
+
+    for ( int i = 1; i < m_coins.size(); i++ )
+        if ( m_coins.at( i ) < m_coins.at( ret ) )
+            ret = i;
+
+    return ret;
+}
+
+int CoinVector::indexOfMax() const
+{
+    if ( isEmpty() )
+        return -1;
+
+    int ret = 0;
+
+    if ( !m_is_big )
+    {
+        const __int128 *raw = m_raw.constData();
+        const int n = m_raw.size();
+
+        for ( int i = 1; i < n; i++ )
+            if ( raw[ i ] > raw[ ret ] )
+                ret = i;
+
+        return ret;
+    }
+
+    for ( int i = 1; i < m_coins.size(); i++ )
+        if ( m_coins.at( i ) > m_coins.at( ret ) )
+            ret = i;
+
+    return ret;
+}
+
+Coin CoinVector::min() const
+{
+    const int i = indexOfMin();
+    return i < 0 ? Coin() : at( i );
+}
+
+Coin CoinVector::max() const
+{
+    const int i = indexOfMax();
+    return i < 0 ? Coin() : at( i );
+}
+
+void CoinVector::scale( const Coin &c )
+{
+    if ( !m_is_big && !c.is_big )
+    {
+        // fast path: compute all products first so an overflow leaves the values untouched
+        const __int128 *raw = m_raw.constData();
+        const int n = m_raw.size();
+        QVector<__int128> scaled( n );
+        __int128 *out = scaled.data();
+        bool overflow = false;
+
+        for ( int i = 0; i < n; i++ )
+            overflow |= __builtin_mul_overflow( raw[ i ], c.v, &out[ i ] );
+
+        if ( !overflow )
+        {
+            for ( int i = 0; i < n; i++ )
+                out[ i ] = floorDiv( out[ i ], coin_raw );
+
+            m_raw = scaled;
+            return;
+        }
+    }
+
+    promoteAll();
+    for ( QVector<Coin>::iterator i = m_coins.begin(); i != m_coins.end(); i++ )
+        *i *= c;
+}
+
+Coin CoinVector::dot( const CoinVector &other ) const
+{
+    const int n = std::min( size(), other.size() );
+    Coin ret;
+
+    if ( !m_is_big && !other.m_is_big )
+    {
+        const __int128 *a = m_raw.constData();
+        const __int128 *c = other.m_raw.constData();
+        __int128 acc = 0, product;
+        bool overflow = false;
+
+        for ( int i = 0; i < n; i++ )
+        {
+            overflow |= __builtin_mul_overflow( a[ i ], c[ i ], &product );
+            overflow |= __builtin_add_overflow( acc, floorDiv( product, coin_raw ), &acc );
+        }
+
+        if ( !overflow )
+        {
+            ret.v = acc;
+            return ret;
+        }
+    }
+
+    for ( int i = 0; i < n; i++ )
+        ret += at( i ) * other.at( i );
+
+    return ret;
+}
@@ -3,18 +3,31 @@
 
 #include <gmp.h>
 #include <QString>
+#include <QByteArray>
+#include <QVector>
+
+// raw subsatoshi value produced at compile time by the _coin literal, ie. 0.001_coin
+struct CoinRaw
+{
+    __int128 raw;
+
+    constexpr CoinRaw operator -() const { return CoinRaw{ -raw }; }
+};
 
 class Coin
 {
 public:
     Coin();
+    constexpr Coin( const CoinRaw r ) : v( r.raw ), is_big( false ), b{} {}
     ~Coin();
     Coin( const Coin &big );
+    Coin( Coin &&big ) noexcept;
     Coin( QString amount );
     Coin( qreal amount );
 
     Coin& operator =( const QString &s );
     Coin& operator =( const Coin &c );
+    Coin& operator =( Coin &&c ) noexcept;
     Coin& operator /=( const QString &s );
     Coin& operator +=( const Coin &c );
     Coin& operator -=( const Coin &c );
@@ -23,13 +36,32 @@ public:
     Coin& operator /=( const uint64_t &i );
     Coin& operator *=( const uint64_t &i );
 
-    Coin operator *( const QString &s ) const;
-    Coin operator -( const Coin &c ) const;
-    Coin operator +( const Coin &c ) const;
-    Coin operator *( const Coin &c ) const;
-    Coin operator /( const Coin &c ) const;
-    Coin operator *( const uint64_t &i ) const;
-    Coin operator /( const uint64_t &i ) const;
+    Coin operator *( const QString &s ) const &;
+    Coin operator -( const Coin &c ) const &;
+    Coin operator +( const Coin &c ) const &;
+    Coin operator *( const Coin &c ) const &;
+    Coin operator /( const Coin &c ) const &;
+    Coin operator *( const uint64_t &i ) const &;
+    Coin operator /( const uint64_t &i ) const &;
+
+    // temporaries on the left side are reused in-place, ie. a * b * c only creates one Coin
+    Coin operator *( const QString &s ) &&;
+    Coin operator -( const Coin &c ) &&;
+    Coin operator +( const Coin &c ) &&;
+    Coin operator *( const Coin &c ) &&;
+    Coin operator /( const Coin &c ) &&;
+    Coin operator *( const uint64_t &i ) &&;
+    Coin operator /( const uint64_t &i ) &&;
+
+    // in-place forms of 'x = a * b' and 'x = a / b' which reuse our storage
+    Coin& setMul( const Coin &a, const Coin &c );
+    Coin& setDiv( const Coin &a, const Coin &c );
+
+    // returns this * num / den with a single rounding step (and no COIN_PARTS scaling in between)
+    Coin mulDiv( const Coin &num, const Coin &den ) const;
+    // returns this^n by squaring. from -1 to 1 it's rounded down once, like exact exponentiation would be, larger
+    // values round each multiplication like operator *()
+    Coin pow( quint64 n ) const;
 
     bool operator ==( const QString &s ) const;
     bool operator !=( const QString &s ) const;
@@ -54,6 +86,12 @@ public:
 
     operator QString() const;
 
+    // writes the value truncated at 'decimals' (0-16) into buf without allocating, and returns the length or -1 if
+    // buf_size is too small. FORMAT_BUFFER_SIZE always fits a value that hasn't been promoted to gmp.
+    static const int FORMAT_BUFFER_SIZE = 64;
+    int format( char *buf, const int buf_size, const int decimals ) const;
+    void appendTo( QByteArray &out, const int decimals ) const;
+
     QString toString( const int decimals ) const;
     QString toSubSatoshiString() const;
     QString toAmountString() const;
@@ -61,34 +99,175 @@ public:
     int toInt() const;
     quint32 toUInt32() const;
 
-    qint64 toIntSatoshis();
+    qint64 toIntSatoshis() const;
+    // raw subsatoshi value for binary storage, returns false if it doesn't fit in 64 bits. read it back with Coin( CoinRaw{ raw } )
+    bool toRawInt64( qint64 &out ) const;
 
     void applyRatio( qreal r );
     Coin ratio( qreal r ) const;
 
     void truncateByTicksize( QString ticksize );
     Coin truncatedByTicksize( QString ticksize );
+    // same as above without any string conversions when the ticksize is a power of ten from 0.00000001 to 1
+    void truncateByTicksize( const Coin &ticksize );
+    Coin truncatedByTicksize( const Coin &ticksize ) const;
+    // truncate towards zero at 'decimals' (0-16) decimal places with a single integer modulo
+    void truncateByDecimals( int decimals );
     static Coin ticksizeFromDecimals( int dec );
 
+    // parse a decimal string (with optional exponent) straight into subsatoshis without any
+    // intermediate QString. decimals past 16 are truncated, junk returns zero.
+    static Coin fromAscii( const char *s, const size_t len );
+    static Coin fromAscii( const QByteArray &s );
+    static Coin fromAscii( const QString &s );
+
 private:
+    friend class CoinVector;
+
+    // values that fit in 126 bits live in 'v', anything larger is promoted to the gmp integer 'b'
+    void promote();
+    void demote();
+    void getMpz( mpz_t out ) const;
+    bool getTruncated( const int decimals, qint64 &out ) const; // value truncated at 'decimals' as an integer, false if it doesn't fit
+    void setSubsatoshis( const QByteArray &digits );
+    void setSubsatoshis( const char *digits, const int len );
+    int compare( const Coin &c ) const;
+
+    __int128 v{ 0 };
+    bool is_big{ false };
     mpz_t b;
 };
 
+// a contiguous list of Coins with batch kernels. while every value fits the fast path the values are kept in a
+// flat int128 array and the kernels run as tight loops over it, once any value is promoted to gmp (or a kernel
+// overflows) we fall back to the regular Coin operators.
+class CoinVector
+{
+public:
+    void reserve( const int size );
+    void clear();
+    void append( const Coin &c );
+    CoinVector &operator <<( const Coin &c ) { append( c ); return *this; }
+
+    int size() const { return m_is_big ? m_coins.size() : m_raw.size(); }
+    bool isEmpty() const { return size() == 0; }
+    Coin at( const int i ) const;
+
+    // sum of all values
+    Coin sum() const;
+    // index of the first lowest/highest value, or -1 if empty
+    int indexOfMin() const;
+    int indexOfMax() const;
+    Coin min() const;
+    Coin max() const;
+    // multiplies every value by c, same rounding as Coin::operator *=()
+    void scale( const Coin &c );
+    // sum of this[i] * other[i] over the shorter of the two lists, each product rounded as Coin::operator *()
+    Coin dot( const CoinVector &other ) const;
+
+private:
+    void promoteAll();
+
+    QVector<__int128> m_raw; // values while none are big
+    QVector<Coin> m_coins; // values once some are big
+    bool m_is_big{ false };
+};
+
+namespace CoinLiteral
+{
+
+static const int decimals = 16;
+static const int max_integer_digits = 21; // 37 significant digits fit in 126 bits, minus 16 decimals
+
+static constexpr bool isDigit( const char c ) { return c >= '0' && c <= '9'; }
+
+static constexpr bool isValid( const char *s )
+{
+    int integer_digits = 0, decimal_digits = 0;
+    bool seen_decimal = false, seen_nonzero = false;
+
+    for ( ; *s != '\0'; s++ )
+    {
+        if ( *s == '\'' ) // digit separator
+            continue;
+
+        if ( *s == '.' )
+        {
+            if ( seen_decimal )
+                return false;
+            seen_decimal = true;
+        }
+        else if ( !isDigit( *s ) )
+            return false;
+        else if ( seen_decimal )
+            decimal_digits++;
+        else if ( seen_nonzero || *s != '0' )
+        {
+            seen_nonzero = true;
+            integer_digits++;
+        }
+    }
+
+    return integer_digits <= max_integer_digits && decimal_digits <= decimals;
+}
+
+static constexpr __int128 parse( const char *s )
+{
+    __int128 r = 0;
+    int decimal_digits = -1;
+
+    for ( ; *s != '\0'; s++ )
+    {
+        if ( *s == '\'' )
+            continue;
+
+        if ( *s == '.' )
+        {
+            decimal_digits = 0;
+            continue;
+        }
+
+        r = r * 10 + ( *s - '0' );
+
+        if ( decimal_digits >= 0 )
+            decimal_digits++;
+    }
+
+    // pad up to 16 decimals
+    for ( int i = decimal_digits < 0 ? 0 : decimal_digits; i < decimals; i++ )
+        r *= 10;
+
+    return r;
+}
+
+} // CoinLiteral
+
+// compile-time Coin literal, ie. 0.999_coin, 10_coin. the value is checked and parsed by the compiler, and
+// constructing a Coin from it is constant-initialized.
+template <char... chars>
+constexpr CoinRaw operator"" _coin()
+{
+    constexpr char str[] = { chars..., '\0' };
+    static_assert( CoinLiteral::isValid( str ), "invalid _coin literal (max 16 decimals and 21 integer digits)" );
+    return CoinRaw{ CoinLiteral::parse( str ) };
+}
+
 namespace CoinAmount
 {
 
 // note: there MUST NOT be any Coin::operators used here as we might recursively reference another
-// uninitialized static variable, which is undefined and will break things
-static const Coin COIN = QString( "1.0" );
-static const Coin COIN_PARTS = QString( "10000000000000000" );
-static const Coin COIN_PARTS_DIV = QString( "100000000000000000000000000000000" ); // =COIN_PARTS^2
-static const Coin SATOSHI_PARTS = QString( "100000000" );
-static const Coin SATOSHI = QString( "0.00000001" );
-static const Coin SUBSATOSHI = QString( "0.0000000000000001" );
+// uninitialized static variable, which is undefined and will break things. _coin literals are
+// constant-initialized, so they're always safe.
+static const Coin COIN = 1.0_coin;
+static const Coin COIN_PARTS = 10000000000000000_coin;
+static const Coin COIN_PARTS_DIV = QString( "100000000000000000000000000000000" ); // =COIN_PARTS^2, too big for a literal
+static const Coin SATOSHI_PARTS = 100000000_coin;
+static const Coin SATOSHI = 0.00000001_coin;
+static const Coin SUBSATOSHI = 0.0000000000000001_coin;
 static const Coin A_LOT = QString( "10000000000000000000000000000000000000000000000000000000000000000000000" );
 static const QString SATOSHI_STR = QString( "0.00000001" );
 static const qreal SATOSHI_REAL = 0.00000001;
-static const Coin ORDER_SHIM = QString( "0.000000005" );
+static const Coin ORDER_SHIM = 0.000000005_coin;
 
 static const QChar decimal_exp = QChar( '.' );
 static const QChar zero_exp = QChar( '0' );
@@ -270,4 +449,24 @@ static inline QString toSubsatoshiFormat( const qreal &r )
 
 } // CoinAmount
 
+// caches COIN / c for the last value of c, so inverse prices are only divided when the price changes
+class CoinInverse
+{
+public:
+    const Coin &of( const Coin &c ) const
+    {
+        // note: the default 0 -> 0 matches the result of the div0 trap
+        if ( c != m_source )
+        {
+            m_source = c;
+            m_inverse = CoinAmount::COIN / c;
+        }
+
+        return m_inverse;
+    }
+
+private:
+    mutable Coin m_source, m_inverse;
+};
+
 #endif // COINAMOUNT_H
@@ -0,0 +1,92 @@
+#include "global.h"
+#include "benchreport.h"
+#include "coinamount.h"
+
+#include <QCoreApplication>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <algorithm>
+
+// coinamount_bench: prints ns/op for the Coin operations that run in the spruce and ticker paths.
+// usage: ./coinamount_bench [iterations] [--json <path>]
+
+namespace
+{
+
+struct Magnitude
+{
+    const char *name;
+    QString str;
+    Coin value;
+};
+
+// keep results alive so the compiler can't drop the loops
+static Coin coin_sink;
+static quint64 bool_sink = 0;
+static qint64 int_sink = 0;
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication a( argc, argv );
+
+    QStringList args = QCoreApplication::arguments();
+    if ( !BenchReport::init( args ) )
+        return 1;
+
+    const qint32 iterations = args.size() > 1 ? std::max( args.at( 1 ).toInt(), 1 ) : 1000000;
+
+    kDebug() << "coinamount_bench:" << iterations << "iterations per test";
+
+    // realistic magnitudes, satoshi prices up to A_LOT (which is always in gmp)
+    const QVector<Magnitude> magnitudes = QVector<Magnitude>()
+        << Magnitude{ "satoshi", CoinAmount::SATOSHI_STR, CoinAmount::SATOSHI }
+        << Magnitude{ "price", QString( "0.00012345" ), Coin( "0.00012345" ) }
+        << Magnitude{ "quantity", QString( "1234.56789012" ), Coin( "1234.56789012" ) }
+        << Magnitude{ "supply", QString( "21000000.12345678" ), Coin( "21000000.12345678" ) }
+        << Magnitude{ "large", QString( "8000000000000000000000000" ), Coin( "8000000000000000000000000" ) }
+        << Magnitude{ "a_lot", CoinAmount::A_LOT.toAmountString(), CoinAmount::A_LOT };
+
+    const Coin operand = QString( "1.23456789" );
+    const QString operand_str = operand.toAmountString();
+
+    for ( QVector<Magnitude>::const_iterator i = magnitudes.begin(); i != magnitudes.end(); i++ )
+    {
+        const Magnitude &m = *i;
+        const QByteArray ascii = m.str.toLatin1();
+
+        kDebug() << QString( "--- %1 (%2)" ).arg( m.name ).arg( m.str );
+
+        BenchReport::measure( QString( "%1 Coin( QString )" ).arg( m.name ), iterations, [&]( qint32 ) { coin_sink = Coin( m.str ); } );
+        BenchReport::measure( QString( "%1 Coin::fromAscii()" ).arg( m.name ), iterations, [&]( qint32 ) { coin_sink = Coin::fromAscii( ascii ); } );
+        BenchReport::measure( QString( "%1 copy" ).arg( m.name ), iterations, [&]( qint32 ) { coin_sink = m.value; } );
+        BenchReport::measure( QString( "%1 +" ).arg( m.name ), iterations, [&]( qint32 ) { coin_sink = m.value + operand; } );
+        BenchReport::measure( QString( "%1 -" ).arg( m.name ), iterations, [&]( qint32 ) { coin_sink = m.value - operand; } );
+        BenchReport::measure( QString( "%1 *" ).arg( m.name ), iterations, [&]( qint32 ) { coin_sink = m.value * operand; } );
+        BenchReport::measure( QString( "%1 /" ).arg( m.name ), iterations, [&]( qint32 ) { coin_sink = m.value / operand; } );
+        BenchReport::measure( QString( "%1 * uint64" ).arg( m.name ), iterations, [&]( qint32 i ) { coin_sink = m.value * quint64( i +1 ); } );
+        BenchReport::measure( QString( "%1 / uint64" ).arg( m.name ), iterations, [&]( qint32 i ) { coin_sink = m.value / quint64( i +1 ); } );
+        BenchReport::measure( QString( "%1 mulDiv()" ).arg( m.name ), iterations, [&]( qint32 ) { coin_sink = m.value.mulDiv( operand, CoinAmount::SATOSHI ); } );
+        BenchReport::measure( QString( "%1 += in-place" ).arg( m.name ), iterations, [&]( qint32 ) { coin_sink += m.value; } );
+        BenchReport::measure( QString( "%1 < Coin" ).arg( m.name ), iterations, [&]( qint32 ) { bool_sink += m.value < operand; } );
+        BenchReport::measure( QString( "%1 == Coin" ).arg( m.name ), iterations, [&]( qint32 ) { bool_sink += m.value == operand; } );
+        BenchReport::measure( QString( "%1 < QString" ).arg( m.name ), iterations, [&]( qint32 ) { bool_sink += m.value < operand_str; } );
+        BenchReport::measure( QString( "%1 truncatedByTicksize()" ).arg( m.name ), iterations, [&]( qint32 ) { Coin c = m.value; coin_sink = c.truncatedByTicksize( "0.0001" ); } );
+        BenchReport::measure( QString( "%1 truncatedByTicksize( Coin )" ).arg( m.name ), iterations, [&]( qint32 ) { coin_sink = m.value.truncatedByTicksize( 0.0001_coin ); } );
+        BenchReport::measure( QString( "%1 ratio()" ).arg( m.name ), iterations, [&]( qint32 ) { coin_sink = m.value.ratio( 0.999 ); } );
+        BenchReport::measure( QString( "%1 toAmountString()" ).arg( m.name ), iterations, [&]( qint32 ) { int_sink += m.value.toAmountString().size(); } );
+        BenchReport::measure( QString( "%1 toSubSatoshiString()" ).arg( m.name ), iterations, [&]( qint32 ) { int_sink += m.value.toSubSatoshiString().size(); } );
+        BenchReport::measure( QString( "%1 format()" ).arg( m.name ), iterations, [&]( qint32 )
+        {
+            char buf[ Coin::FORMAT_BUFFER_SIZE ];
+            int_sink += m.value.format( buf, sizeof( buf ), CoinAmount::satoshi_decimals );
+        } );
+    }
+
+    kDebug() << "coinamount_bench done." << coin_sink.isZero() << bool_sink << int_sink;
+
+    return BenchReport::finish( "coinamount_bench" ) ? 0 : 1;
+}
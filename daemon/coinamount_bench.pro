@@ -0,0 +1,23 @@
+QT       = core network
+
+TARGET = coinamount_bench
+DESTDIR = ../
+
+MOC_DIR = ../build-tmp/coinamount_bench
+OBJECTS_DIR = ../build-tmp/coinamount_bench
+
+CONFIG += c++14 c++17
+CONFIG += RELEASE console
+
+LIBS += -lgmp
+
+QMAKE_CXXFLAGS_RELEASE = -Wall -O3
+
+SOURCES += coinamount_bench.cpp \
+    benchreport.cpp \
+    coinamount.cpp
+
+HEADERS += build-config.h \
+    benchreport.h \
+    global.h \
+    coinamount.h
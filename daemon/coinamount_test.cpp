@@ -404,6 +404,9 @@ void CoinAmountTest::test()
     assert( Coin("1").toInt() == int(1) );
     assert( Coin("17").toInt() == int(17) );
     assert( Coin("65535").toInt() == int(65535) );
+    assert( Coin("1.99999999").toInt() == int(1) );
+    assert( Coin("-1.99999999").toInt() == int(-1) );
+    assert( Coin("-0.5").toInt() == int(0) );
 
     // Coin::toUInt32()
     assert( Coin("1").toUInt32() == quint32(1) );
@@ -417,6 +420,15 @@ void CoinAmountTest::test()
     assert( Coin("10000").toIntSatoshis() == qint64(1000000000000) );
     assert( Coin("0.00000001").toIntSatoshis() == qint64(1) );
     assert( Coin("0.00000100").toIntSatoshis() == qint64(100) );
+    assert( Coin("0.000000019").toIntSatoshis() == qint64(1) );
+    assert( Coin("-0.000000019").toIntSatoshis() == qint64(-1) );
+
+    // Coin( qreal ) rounds to subsatoshis without formatting, big values still go through the string
+    assert( Coin( 0.1 ) == "0.1" );
+    assert( Coin( -2.5 ) == "-2.5" );
+    assert( Coin( 0.00000000000000006 ) == "0.0000000000000001" );
+    assert( Coin( 0.00000000000000004 ).isZero() );
+    assert( Coin( 1e30 ) == "1000000000000000019884624838656" );
 
     // run a test that confirms different magnitudes of strings and coin are the same value
     QString test_str = "1";
@@ -455,4 +467,165 @@ void CoinAmountTest::test()
     assert( Coin( QVariant( -0.000000011 /* -11e-7 */ ).toString() ).toSubSatoshiString() == "-0.0000000110000000" );
     assert( Coin( QVariant( -0.00000001 /* -1e-7 */ ).toString() ).toSubSatoshiString() == "-0.0000000100000000" );
     assert( Coin( QVariant( -0.00000010 /* -1e-6 */ ).toString() ) == "-0.00000010" );
+
+    // test values crossing the fixed width/gmp boundary (2^126 subsatoshis is ~8.5e21 coins)
+    const Coin below_boundary = QString( "8000000000000000000000" );
+    const Coin above_boundary = below_boundary * QString( "1000" );
+    assert( above_boundary == "8000000000000000000000000.00000000" );
+    assert( above_boundary / QString( "1000" ) == below_boundary );
+    assert( above_boundary - above_boundary + CoinAmount::SATOSHI == CoinAmount::SATOSHI );
+    assert( below_boundary + below_boundary == "16000000000000000000000.00000000" );
+    assert( -( below_boundary + below_boundary ) == "-16000000000000000000000.00000000" );
+    assert( ( below_boundary + below_boundary ) > below_boundary );
+    assert( -( below_boundary + below_boundary ) < below_boundary );
+    assert( CoinAmount::A_LOT > above_boundary );
+    assert( CoinAmount::A_LOT / CoinAmount::A_LOT == CoinAmount::COIN );
+
+    // intermediate products that overflow 128 bits should still be exact
+    assert( Coin( "100000000" ) * Coin( "100000000" ) == "10000000000000000.00000000" );
+    assert( Coin( "-100000000.00000001" ) * Coin( "100000000" ) == "-10000000000000001.00000000" );
+    assert( Coin( "100000000000000" ) / CoinAmount::SUBSATOSHI == "1000000000000000000000000000000.00000000" );
+
+    // moved-from values are left as zero, moved-to values keep their value on both sides of the boundary
+    Coin moved_big = above_boundary;
+    Coin moved_to = std::move( moved_big );
+    assert( moved_to == above_boundary && moved_big.isZero() );
+    moved_big = std::move( moved_to );
+    assert( moved_big == above_boundary && moved_to.isZero() );
+    moved_to = CoinAmount::COIN;
+    moved_to = std::move( moved_big );
+    assert( moved_to == above_boundary );
+
+    // rvalue operators and in-place forms
+    assert( Coin( "2" ) * Coin( "3" ) * Coin( "4" ) == "24.00000000" );
+    assert( Coin( "24" ) / Coin( "4" ) - Coin( "1" ) + Coin( "0.5" ) == "5.50000000" );
+    Coin in_place;
+    assert( in_place.setMul( Coin( "2" ), Coin( "0.5" ) ) == CoinAmount::COIN );
+    assert( in_place.setDiv( Coin( "3" ), in_place ) == "3.00000000" );
+    assert( in_place.setMul( Coin( "3" ), in_place ) == "9.00000000" );
+    assert( in_place.setDiv( in_place, Coin( "2" ) ) == "4.50000000" );
+
+    // test Coin::mulDiv()
+    assert( Coin( "3" ).mulDiv( Coin( "5" ), Coin( "2" ) ) == "7.50000000" );
+    assert( CoinAmount::COIN.mulDiv( CoinAmount::COIN, Coin( "3" ) ).toSubSatoshiString() == "0.3333333333333333" );
+    assert( Coin( "-1" ).mulDiv( CoinAmount::COIN, Coin( "3" ) ).toSubSatoshiString() == "-0.3333333333333334" );
+    assert( Coin( "2" ).mulDiv( CoinAmount::SATOSHI, Coin() ).isZero() );
+    assert( above_boundary.mulDiv( above_boundary, above_boundary ) == above_boundary );
+    assert( Coin( "100000000" ).mulDiv( Coin( "100000000" ), Coin( "10000" ) ) == "1000000000000.00000000" );
+
+    // a single rounding step is more accurate than a / b * c
+    assert( CoinAmount::COIN / Coin( "3" ) * Coin( "3" ) != CoinAmount::COIN );
+    assert( CoinAmount::COIN.mulDiv( Coin( "3" ), Coin( "3" ) ) == CoinAmount::COIN );
+
+    // test Coin::fromAscii()
+    assert( Coin::fromAscii( "0.00000001", 10 ) == CoinAmount::SATOSHI );
+    assert( Coin::fromAscii( QByteArray( " -12.5 " ) ) == "-12.50000000" );
+    assert( Coin::fromAscii( QString( "0001.10" ) ) == "1.10000000" );
+    assert( Coin::fromAscii( QString( ".5" ) ) == "0.50000000" );
+    assert( Coin::fromAscii( QString( "-.5" ) ) == "-0.50000000" );
+    assert( Coin::fromAscii( QString( "1e+07" ) ) == "10000000.00000000" );
+    assert( Coin::fromAscii( QString( "1E7" ) ) == "10000000.00000000" );
+    assert( Coin::fromAscii( QString( "-1.1e-08" ) ).toSubSatoshiString() == "-0.0000000110000000" );
+    assert( Coin::fromAscii( QString( "123.456e-2" ) ).toSubSatoshiString() == "1.2345600000000000" );
+    assert( Coin::fromAscii( QString( "1e-17" ) ).isZero() );
+    assert( Coin::fromAscii( QString( "0.12345678901234567" ) ).toSubSatoshiString() == "0.1234567890123456" ); // truncated
+    assert( Coin::fromAscii( QString( "100000000100000000100000000100000000100000000.00000010" ) ) == "100000000100000000100000000100000000100000000.00000010" );
+    assert( Coin::fromAscii( QString( "1e+300" ) ) == Coin( QString( "1e+300" ) ) );
+    assert( Coin::fromAscii( QString() ).isZero() );
+    assert( Coin::fromAscii( QString( "abc" ) ).isZero() );
+    assert( Coin::fromAscii( QString( "1.2.3" ) ).isZero() );
+    assert( Coin::fromAscii( QString( "1e" ) ).isZero() );
+    assert( Coin::fromAscii( QString( "--1" ) ).isZero() );
+
+    // test Coin::format() and Coin::appendTo()
+    char format_buf[ Coin::FORMAT_BUFFER_SIZE ];
+    assert( QByteArray( format_buf, Coin( "-12.5" ).format( format_buf, sizeof( format_buf ), 8 ) ) == "-12.50000000" );
+    assert( QByteArray( format_buf, CoinAmount::SUBSATOSHI.format( format_buf, sizeof( format_buf ), 16 ) ) == "0.0000000000000001" );
+    assert( QByteArray( format_buf, Coin( "123.456" ).format( format_buf, sizeof( format_buf ), 0 ) ) == "123." );
+    assert( Coin( "123.456" ).format( format_buf, 4, 8 ) == -1 );
+    QByteArray append_buf = "price=";
+    Coin( "0.00012345" ).appendTo( append_buf, 8 );
+    above_boundary.appendTo( append_buf, 2 );
+    assert( append_buf == "price=0.000123458000000000000000000000000.00" );
+
+    // shorter decimals are truncated and padded correctly
+    assert( Coin( "0.04851458" ).toString( 4 ) == "0.0485" );
+    assert( Coin( "-0.04851458" ).toString( 3 ) == "-0.048" );
+    assert( Coin( "0.00001" ).toString( 4 ) == "0.0000" );
+    assert( Coin( "0.5" ).toInt() == 0 );
+
+    // floor division for negatives, as with mpz_div()
+    assert( ( Coin( "-0.0000000000000001" ) / 2 ).toSubSatoshiString() == "-0.0000000000000001" );
+    assert( ( Coin( "-0.0000000000000003" ) * Coin( "0.5" ) ).toSubSatoshiString() == "-0.0000000000000002" );
+    assert( ( Coin( "0.0000000000000003" ) * Coin( "0.5" ) ).toSubSatoshiString() == "0.0000000000000001" );
+
+    // test _coin literals
+    static_assert( ( 0.5_coin ).raw == 5000000000000000, "0.5_coin" );
+    static_assert( ( -0.0000000000000001_coin ).raw == -1, "-0.0000000000000001_coin" );
+    assert( Coin( 1_coin ) == CoinAmount::COIN );
+    assert( Coin( 0.00000001_coin ) == CoinAmount::SATOSHI );
+    assert( Coin( -12.5_coin ) == Coin( "-12.5" ) );
+    assert( Coin( 1'000.001_coin ) == Coin( "1000.001" ) );
+    assert( Coin( 999999999999999999999.9999999999999999_coin ).toSubSatoshiString() == "999999999999999999999.9999999999999999" );
+    assert( Coin( 999999999999999999999.9999999999999999_coin ) + CoinAmount::SUBSATOSHI == Coin( "1000000000000000000000" ) );
+
+    // test CoinVector kernels, on the fast path and after promotion
+    CoinVector coins, weights;
+    coins << Coin( "1.5" ) << Coin( "-2" ) << Coin( "0.00000001" ) << Coin( "3" );
+    weights << Coin( "2" ) << Coin( "0.5" ) << Coin( "100" ) << Coin( "0.0000000000000001" );
+    assert( coins.sum() == Coin( "2.50000001" ) );
+    assert( coins.indexOfMin() == 1 && coins.indexOfMax() == 3 );
+    assert( coins.dot( weights ) == Coin( "2.0000010000000003" ) );
+    assert( CoinVector().indexOfMax() == -1 && CoinVector().sum().isZero() );
+    coins.scale( Coin( "2" ) );
+    assert( coins.at( 0 ) == Coin( "3" ) && coins.at( 1 ) == Coin( "-4" ) );
+    coins << above_boundary << above_boundary;
+    assert( coins.sum() == Coin( "5.00000002" ) + above_boundary * 2 );
+    assert( coins.indexOfMax() == 4 && coins.min() == Coin( "-4" ) );
+    assert( coins.dot( weights ) == Coin( "4.0000020000000006" ) );
+    CoinVector overflowing;
+    overflowing << below_boundary << below_boundary << below_boundary;
+    assert( overflowing.sum() == below_boundary * 3 );
+    overflowing.scale( Coin( "2" ) );
+    assert( overflowing.at( 2 ) == below_boundary * 2 && overflowing.sum() == below_boundary * 6 );
+
+    // test Coin ticksize truncation against the string version
+    const QVector<Coin> truncate_values = QVector<Coin>() << Coin( "1.23456789123" ) << Coin( "-1.23456789123" ) << Coin( "0.5" )
+                                                          << Coin( "-0.00009999" ) << above_boundary + Coin( "0.123" ) << Coin();
+    const QVector<Coin> truncate_ticksizes = QVector<Coin>() << CoinAmount::COIN << Coin( "0.01" ) << Coin( "0.0001" ) << CoinAmount::SATOSHI
+                                                             << CoinAmount::SUBSATOSHI << Coin( "0.00025" ) << Coin( "10" ) << Coin();
+    for ( QVector<Coin>::const_iterator i = truncate_values.begin(); i != truncate_values.end(); i++ )
+    {
+        for ( QVector<Coin>::const_iterator j = truncate_ticksizes.begin(); j != truncate_ticksizes.end(); j++ )
+        {
+            Coin by_string = *i, by_coin = *i;
+            by_string.truncateByTicksize( ( *j ).toAmountString() );
+            by_coin.truncateByTicksize( *j );
+            assert( by_string.toSubSatoshiString() == by_coin.toSubSatoshiString() );
+        }
+    }
+    Coin truncated = Coin( "-1.2345678912345678" );
+    truncated.truncateByDecimals( 12 );
+    assert( truncated.toSubSatoshiString() == "-1.2345678912340000" );
+    truncated.truncateByDecimals( 0 );
+    assert( truncated == Coin( "-1" ) );
+
+    // test Coin::pow()
+    assert( Coin( "2" ).pow( 0 ) == CoinAmount::COIN );
+    assert( Coin( "2" ).pow( 10 ) == Coin( "1024" ) );
+    assert( Coin( "-0.5" ).pow( 3 ) == Coin( "-0.125" ) );
+    assert( Coin( "0.9999" ).pow( 1000000 ).toAmountString() == "0.00000000" );
+    assert( Coin( "0.999999" ).pow( 1000 ).toString( 12 ) == "0.999000499333" );
+
+    // rounded once, rounding each multiplication would end 738 and 61467 subsatoshis lower
+    assert( Coin( "0.9999" ).pow( 10000 ) == Coin( "0.3678610464329299" ) );
+    assert( Coin( "0.99999999" ).pow( 123457 ) == Coin( "0.9987661917618596" ) );
+    assert( Coin( "-0.9999" ).pow( 10001 ) == Coin( "-0.3678242603282867" ) ); // down, not towards zero
+
+    // test CoinInverse
+    CoinInverse inverse;
+    assert( inverse.of( Coin() ).isZero() );
+    assert( inverse.of( Coin( "4" ) ) == Coin( "0.25" ) );
+    assert( inverse.of( Coin( "4" ) ) == Coin( "0.25" ) );
+    assert( inverse.of( Coin( "0.5" ) ) == Coin( "2" ) );
 }
@@ -1,14 +1,20 @@
 #include "commandlistener.h"
 #include "global.h"
+#include "ipcprotocol.h"
+#include "eventfeed.h"
 
 #include <QDir>
 #include <QLocalServer>
 #include <QLocalSocket>
+#include <QStringList>
+#include <QtEndian>
 
-CommandListener::CommandListener( QObject *parent )
+#include <cstring>
+
+CommandListener::CommandListener( const QString &_path, QObject *parent )
     : QLocalServer( parent )
 {
-    QString path = Global::getIPCPath();
+    const QString path = _path.isEmpty() ? Global::getIPCPath() : _path;
 
     // remove socket path if it exists
     if ( QFile::exists( path ) )
@@ -25,11 +31,14 @@ CommandListener::CommandListener( QObject *parent )
     }
 
     connect( this, &QLocalServer::newConnection, this, &CommandListener::handleNewConnection );
+    EventFeed::setListener( this );
     kDebug() << "[CommandListener] listening at" << path;
 }
 
 CommandListener::~CommandListener()
 {
+    EventFeed::setListener( nullptr );
+    EventFeed::setSubscribedMask( 0 );
     QLocalServer::close();
 
     QList<LocalClient*> list = m_users.values();
@@ -51,14 +60,159 @@ void CommandListener::handleDisconnect( LocalClient *sck )
 {
     m_users.remove( sck );
     sck->deleteLater();
+
+    if ( sck->getSubscribedMask() != 0 )
+        updateSubscribedMask();
     //kDebug() << "[CommandListener] socket disconnected";
 }
 
 void CommandListener::handleReadyRead( LocalClient *sck )
 {
-    QString data = sck->getSocketData();
-    emit gotDataChunk( data );
-    //kDebug() << "[CommandListener] " << data;
+    if ( sck->getMode() == LocalClient::MODE_TEXT )
+    {
+        QString data = sck->getSocketData();
+        handleTextChunk( sck, data );
+        //kDebug() << "[CommandListener] " << data;
+        return;
+    }
+
+    QByteArray &buffer = sck->getBuffer();
+    buffer += sck->getSocketData();
+
+    // text never starts with a zero, so the first byte picks the protocol
+    if ( sck->getMode() == LocalClient::MODE_UNKNOWN )
+    {
+        if ( buffer.isEmpty() )
+            return;
+
+        if ( buffer.at( 0 ) != '\0' )
+        {
+            sck->setMode( LocalClient::MODE_TEXT );
+            QString data = buffer;
+            buffer.clear();
+            handleTextChunk( sck, data );
+            return;
+        }
+
+        if ( buffer.size() < IPC_BINARY_MAGIC_SIZE )
+            return;
+
+        if ( memcmp( buffer.constData(), IPC_BINARY_MAGIC, IPC_BINARY_MAGIC_SIZE ) != 0 )
+        {
+            kDebug() << "[CommandListener] bad binary magic, dropping connection";
+            buffer.clear();
+            sck->abort();
+            return;
+        }
+
+        sck->setMode( LocalClient::MODE_BINARY );
+        buffer.remove( 0, IPC_BINARY_MAGIC_SIZE );
+    }
+
+    // hand over the whole frames, keep the rest for the next read
+    int position = 0;
+    while ( buffer.size() - position >= IPC_FRAME_HEADER_SIZE )
+    {
+        const quint32 size = qFromLittleEndian<quint32>( buffer.constData() + position );
+        if ( size > quint32( IPC_FRAME_MAX ) )
+        {
+            kDebug() << "[CommandListener] frame of" << size << "bytes is too big, dropping connection";
+            buffer.clear();
+            sck->abort();
+            return;
+        }
+
+        if ( quint32( buffer.size() - position - IPC_FRAME_HEADER_SIZE ) < size )
+            break;
+
+        emit gotBinaryFrame( buffer.mid( position + IPC_FRAME_HEADER_SIZE, int( size ) ) );
+        position += IPC_FRAME_HEADER_SIZE + int( size );
+    }
+
+    buffer.remove( 0, position );
+}
+
+void CommandListener::handleTextChunk( LocalClient *sck, QString &data )
+{
+    // subscriptions belong to the connection, the rest are commands for the engines
+    const QString first = data.section( QChar( ' ' ), 0, 0 ).trimmed().toLower();
+    if ( first != "subscribe" && first != "unsubscribe" )
+    {
+        emit gotDataChunk( data );
+        return;
+    }
+
+    const QStringList lines = data.split( QChar( '\n' ), QString::SkipEmptyParts );
+    for ( QStringList::const_iterator i = lines.begin(); i != lines.end(); i++ )
+        handleSubscribe( sck, i->simplified().split( QChar( ' ' ), QString::SkipEmptyParts ) );
+}
+
+void CommandListener::handleSubscribe( LocalClient *sck, const QStringList &args )
+{
+    if ( args.isEmpty() )
+        return;
+
+    const bool is_subscribe = args.first().toLower() == "subscribe";
+    if ( !is_subscribe && args.first().toLower() != "unsubscribe" )
+    {
+        kDebug() << "local warning: commands can't follow a subscribe on the same write:" << args;
+        return;
+    }
+
+    // a bare unsubscribe is all of them
+    quint32 mask = args.size() == 1 && !is_subscribe ? ~0u : 0u;
+    for ( QStringList::const_iterator i = args.begin() +1; i != args.end(); i++ )
+    {
+        const qint32 type = EventFeed::getType( *i );
+        if ( i->toLower() == "all" )
+            mask = ~0u;
+        else if ( type >= 0 )
+            mask |= 1u << type;
+        else
+            kDebug() << "local warning: unknown event type" << *i;
+    }
+
+    mask &= ( 1u << EventFeed::TYPE_COUNT ) -1;
+    sck->setSubscribedMask( is_subscribe ? sck->getSubscribedMask() | mask : sck->getSubscribedMask() & ~mask );
+
+    // say what it has now
+    QByteArray ack( "subscribed" );
+    for ( qint32 type = 0; type < EventFeed::TYPE_COUNT; type++ )
+        if ( sck->getSubscribedMask() & ( 1u << type ) )
+            ack += QByteArray( " " ) + EventFeed::getTypeName( EventFeed::Type( type ) );
+    sck->writeLine( ack + '\n' );
+
+    updateSubscribedMask();
+}
+
+void CommandListener::updateSubscribedMask()
+{
+    quint32 mask = 0;
+    for ( QSet<LocalClient*>::const_iterator i = m_users.begin(); i != m_users.end(); i++ )
+        mask |= (*i)->getSubscribedMask();
+
+    EventFeed::setSubscribedMask( mask );
+}
+
+void CommandListener::flushEvents()
+{
+    QVector<EventFeed::Event> events;
+    const quint64 dropped = EventFeed::takePending( events );
+
+    for ( QSet<LocalClient*>::const_iterator c = m_users.begin(); c != m_users.end(); c++ )
+    {
+        LocalClient *client = *c;
+        const quint32 mask = client->getSubscribedMask();
+        if ( mask == 0 )
+            continue;
+
+        // the feed's queue was full, it could have been any of theirs
+        client->addEventsDropped( dropped );
+
+        for ( QVector<EventFeed::Event>::const_iterator i = events.begin(); i != events.end(); i++ )
+            if ( mask & ( 1u << i->type ) )
+                client->writeEvent( i->line );
+    }
 }
 
 
@@ -76,6 +230,24 @@ LocalClient::~LocalClient()
     m_sck->deleteLater();
 }
 
+bool LocalClient::writeEvent( const QByteArray &line )
+{
+    if ( m_sck->bytesToWrite() + line.size() > EVENT_BUFFER_MAX )
+    {
+        m_events_dropped++;
+        return false;
+    }
+
+    if ( m_events_dropped > 0 )
+    {
+        m_sck->write( "dropped " + QByteArray::number( m_events_dropped ) + '\n' );
+        m_events_dropped = 0;
+    }
+
+    m_sck->write( line );
+    return true;
+}
+
 void LocalClient::handleDisconnected()
 {
     emit disconnected( this );
@@ -8,24 +8,33 @@
 class LocalClient;
 
 //
-// CommandListener, an IPC server to listen for commands
+// CommandListener, an IPC server to listen for commands. a text connection that sends "subscribe <type> ..." or
+// "subscribe all" gets the events of those types pushed to it as lines, see EventFeed, until "unsubscribe [type ...]".
+// each subscriber has its own bounded buffer, the events that don't fit are dropped and a "dropped <n>" line comes
+// before the next one it's sent
 //
 class CommandListener : public QLocalServer
 {
     Q_OBJECT
 public:
-    explicit CommandListener( QObject *parent = nullptr );
+    explicit CommandListener( const QString &path = QString(), QObject *parent = nullptr ); // Global::getIPCPath() without a path
     ~CommandListener();
 
 signals:
     void gotDataChunk( QString &s );
+    void gotBinaryFrame( const QByteArray &frame ); // a whole frame without the size, see ipcprotocol.h
 
 public slots:
     void handleNewConnection();
     void handleDisconnect( LocalClient *sck );
     void handleReadyRead( LocalClient *sck );
+    void flushEvents(); // woken by EventFeed::publish()
 
 private:
+    void handleTextChunk( LocalClient *sck, QString &data );
+    void handleSubscribe( LocalClient *sck, const QStringList &args );
+    void updateSubscribedMask();
+
     QSet<LocalClient*> m_users;
 };
 
@@ -39,7 +48,22 @@ public:
     explicit LocalClient( QLocalSocket *sck, QObject *parent = nullptr );\
     ~LocalClient();
 
+    // the protocol is picked by the first bytes on the connection
+    enum Mode { MODE_UNKNOWN, MODE_TEXT, MODE_BINARY };
+
     QByteArray getSocketData() const { return m_sck->readAll(); }
+    QByteArray &getBuffer() { return m_buffer; } // binary bytes short of a whole frame
+    Mode getMode() const { return m_mode; }
+    void setMode( const Mode mode ) { m_mode = mode; }
+    void abort() { m_sck->abort(); }
+
+    // event subscriptions, a bit for each EventFeed::Type
+    static const qint64 EVENT_BUFFER_MAX = 4 * 1024 * 1024; // bytes not yet written to the client
+    quint32 getSubscribedMask() const { return m_subscribed_mask; }
+    void setSubscribedMask( const quint32 mask ) { m_subscribed_mask = mask; }
+    void addEventsDropped( const quint64 n ) { m_events_dropped += n; }
+    bool writeEvent( const QByteArray &line ); // false if it didn't fit in the buffer and was dropped
+    void writeLine( const QByteArray &line ) { m_sck->write( line ); }
 
 signals:
     void disconnected( LocalClient *sck );
@@ -51,6 +75,10 @@ public slots:
 
 private:
     QLocalSocket *m_sck;
+    QByteArray m_buffer;
+    Mode m_mode{ MODE_UNKNOWN };
+    quint32 m_subscribed_mask{ 0 };
+    quint64 m_events_dropped{ 0 };
 };
 
 
@@ -1,23 +1,157 @@
 #include "commandrunner.h"
 #include "global.h"
 #include "engine.h"
+#include "taskscheduler.h"
 #include "enginesettings.h"
 #include "trexrest.h"
 #include "polorest.h"
 #include "wavesrest.h"
 #include "bncrest.h"
 #include "positionman.h"
+#include "position.h"
 #include "market.h"
 #include "alphatracker.h"
 #include "spruce.h"
 #include "spruceoverseer.h"
+#include "virtualclock.h"
+#include "ipcprotocol.h"
+#include "asyncsaver.h"
+#include "tracespan.h"
+#include "memorystats.h"
+#include "asynclog.h"
+#include "costfunctioncache.h"
 
-#include <functional>
 #include <QString>
 #include <QMap>
 #include <QVector>
 #include <QQueue>
 #include <QTimer>
+#include <QtEndian>
+
+#include <algorithm>
+
+// every command, with the arg counts runCommands() checks before it runs one (see checkArgs(), -1 = the command checks)
+const CommandRunner::CommandInfo CommandRunner::COMMANDS[] =
+{
+    { "getbalances",                    &CommandRunner::command_getbalances,                    -1, -1 },
+    { "getledger",                      &CommandRunner::command_getledger,                      -1, -1 },
+    { "getlastprices",                  &CommandRunner::command_getlastprices,                  -1, -1 },
+    { "getbuyselltotal",                &CommandRunner::command_getbuyselltotal,                -1, -1 },
+    { "cancelall",                      &CommandRunner::command_cancelall,                      -1, -1 },
+    { "cancellocal",                    &CommandRunner::command_cancellocal,                    -1, -1 },
+    { "flatten",                        &CommandRunner::command_flatten,                        -1, -1 },
+    { "cancelhighest",                  &CommandRunner::command_cancelhighest,                  -1, -1 },
+    { "cancellowest",                   &CommandRunner::command_cancellowest,                   -1, -1 },
+    { "getorders",                      &CommandRunner::command_getorders,                      -1, -1 },
+    { "getpositions",                   &CommandRunner::command_getpositions,                   -1, -1 },
+    { "getordersbyindex",               &CommandRunner::command_getordersbyindex,               -1, -1 },
+    { "setorder",                       &CommandRunner::command_setorder,                        6,  7 },
+    { "setgrid",                        &CommandRunner::command_setgrid,                         6,  8 },
+    { "setordermin",                    &CommandRunner::command_setordermin,                     2, -1 },
+    { "setordermax",                    &CommandRunner::command_setordermax,                     2, -1 },
+    { "setorderdc",                     &CommandRunner::command_setorderdc,                      2, -1 },
+    { "setorderdcnice",                 &CommandRunner::command_setorderdcnice,                  2, -1 },
+    { "setorderlandmarkthresh",         &CommandRunner::command_setorderlandmarkthresh,          2, -1 },
+    { "setorderlandmarkstart",          &CommandRunner::command_setorderlandmarkstart,           2, -1 },
+    { "long",                           &CommandRunner::command_long,                           -1, -1 },
+    { "longindex",                      &CommandRunner::command_longindex,                      -1, -1 },
+    { "short",                          &CommandRunner::command_short,                          -1, -1 },
+    { "shortindex",                     &CommandRunner::command_shortindex,                     -1, -1 },
+    { "setcancelthresh",                &CommandRunner::command_setcancelthresh,                -1, -1 },
+    { "setkeyandsecret",                &CommandRunner::command_setkeyandsecret,                -1, -1 },
+    { "getdailyvolume",                 &CommandRunner::command_getdailyvolume,                 -1, -1 },
+    { "getdailyfills",                  &CommandRunner::command_getdailyfills,                  -1, -1 },
+    { "getalpha",                       &CommandRunner::command_getalpha,                       -1, -1 },
+    { "setalphamanual",                 &CommandRunner::command_setalphamanual,                  5, -1 },
+    { "getdailymarketvolume",           &CommandRunner::command_getdailymarketvolume,           -1, -1 },
+    { "getshortlong",                   &CommandRunner::command_getshortlong,                   -1, -1 },
+    { "gethibuylosell",                 &CommandRunner::command_gethibuylosell,                 -1, -1 },
+    { "setmarketsettings",              &CommandRunner::command_setmarketsettings,               9, -1 },
+    { "setmarketoffset",                &CommandRunner::command_setmarketoffset,                 2, -1 },
+    { "setmarketsentiment",             &CommandRunner::command_setmarketsentiment,              2, -1 },
+    { "setnaminterval",                 &CommandRunner::command_setnaminterval,                  1, -1 },
+    { "setbookinterval",                &CommandRunner::command_setbookinterval,                 1, -1 },
+    { "settickerinterval",              &CommandRunner::command_settickerinterval,               1, -1 },
+    { "setwavestickerbatch",            &CommandRunner::command_setwavestickerbatch,             1,  3 },
+    { "setwavesjwt",                    &CommandRunner::command_setwavesjwt,                     1, -1 },
+    { "setwaveshistoryfills",           &CommandRunner::command_setwaveshistoryfills,            1, -1 },
+    { "setgracetimelimit",              &CommandRunner::command_setgracetimelimit,               1, -1 },
+    { "setcheckinterval",               &CommandRunner::command_setcheckinterval,                1, -1 },
+    { "setdcinterval",                  &CommandRunner::command_setdcinterval,                   1, -1 },
+    { "setclearstrayorders",            &CommandRunner::command_setclearstrayorders,             1, -1 },
+    { "setclearstrayordersall",         &CommandRunner::command_setclearstrayordersall,          1, -1 },
+    { "setslippagecalculated",          &CommandRunner::command_setslippagecalculated,           1, -1 },
+    { "setadjustbuysell",               &CommandRunner::command_setadjustbuysell,                1, -1 },
+    { "setdcslippage",                  &CommandRunner::command_setdcslippage,                   1, -1 },
+    { "setorderbookstaletolerance",     &CommandRunner::command_setorderbookstaletolerance,     -1, -1 },
+    { "setsafetydelaytime",             &CommandRunner::command_setsafetydelaytime,             -1, -1 },
+    { "settickersafetydelaytime",       &CommandRunner::command_settickersafetydelaytime,       -1, -1 },
+    { "setslippagestaletime",           &CommandRunner::command_setslippagestaletime,            1, -1 },
+    { "setqueuedcommandsmax",           &CommandRunner::command_setqueuedcommandsmax,            1, -1 },
+    { "setqueuedcommandsmaxdc",         &CommandRunner::command_setqueuedcommandsmaxdc,          1, -1 },
+    { "setsentcommandsmax",             &CommandRunner::command_setsentcommandsmax,              1, -1 },
+    { "sethttp2",                       &CommandRunner::command_sethttp2,                        1, -1 },
+    { "setflowtuning",                  &CommandRunner::command_setflowtuning,                   1, -1 },
+    { "setrecording",                   &CommandRunner::command_setrecording,                    1, -1 },
+    { "setpaperlatency",                &CommandRunner::command_setpaperlatency,                 1, -1 },
+    { "setpaperfillmodel",              &CommandRunner::command_setpaperfillmodel,               1, -1 },
+    { "settimeoutyield",                &CommandRunner::command_settimeoutyield,                 1, -1 },
+    { "setrequesttimeout",              &CommandRunner::command_setrequesttimeout,               1, -1 },
+    { "setcanceltimeout",               &CommandRunner::command_setcanceltimeout,                1, -1 },
+    { "setadaptivetimeout",             &CommandRunner::command_setadaptivetimeout,              1,  4 },
+    { "setslippagetimeout",             &CommandRunner::command_setslippagetimeout,              2, -1 },
+    { "setspruceinterval",              &CommandRunner::command_setspruceinterval,               1, -1 },
+    { "setsprucebasecurrency",          &CommandRunner::command_setsprucebasecurrency,           1, -1 },
+    { "setspruceweight",                &CommandRunner::command_setspruceweight,                 2, -1 },
+    { "setsprucestartnode",             &CommandRunner::command_setsprucestartnode,              3, -1 },
+    { "setspruceshortlongtotal",        &CommandRunner::command_setspruceshortlongtotal,         2, -1 },
+    { "setsprucebetamarket",            &CommandRunner::command_setsprucebetamarket,             1, -1 },
+    { "setspruceamplification",         &CommandRunner::command_setspruceamplification,          1, -1 },
+    { "setsprucesolver",                &CommandRunner::command_setsprucesolver,                 1, -1 },
+    { "setsprucetrigger",               &CommandRunner::command_setsprucetrigger,                1, -1 },
+    { "setsprucewarmstart",             &CommandRunner::command_setsprucewarmstart,              1, -1 },
+    { "setspruceprofile",               &CommandRunner::command_setspruceprofile,                2, -1 },
+    { "setsprucereserve",               &CommandRunner::command_setsprucereserve,                2, -1 },
+    { "setspruceordergreed",            &CommandRunner::command_setspruceordergreed,             4, -1 },
+    { "setspruceordersize",             &CommandRunner::command_setspruceordersize,              1, -1 },
+    { "setspruceordernice",             &CommandRunner::command_setspruceordernice,              6, -1 },
+    { "setspruceordernicecustom",       &CommandRunner::command_setspruceordernicecustom,        4, -1 },
+    { "setspruceordernicemarketoffset", &CommandRunner::command_setspruceordernicemarketoffset,  5, -1 },
+    { "setspruceallocation",            &CommandRunner::command_setspruceallocation,             2, -1 },
+    { "setsprucesnapback",              &CommandRunner::command_setsprucesnapback,               2, -1 },
+    { "setspruceroute",                 &CommandRunner::command_setspruceroute,                  1,  1 },
+    { "setsprucesolvedeadline",         &CommandRunner::command_setsprucesolvedeadline,          1,  1 },
+    { "setsprucecostimage",             &CommandRunner::command_setsprucecostimage,              1,  1 },
+    { "setspruceportfolio",             &CommandRunner::command_setspruceportfolio,              1,  1 },
+    { "setspruceshadow",                &CommandRunner::command_setspruceshadow,                 1,  2 },
+    { "getspruceshadows",               &CommandRunner::command_getspruceshadows,                0,  0 },
+    { "getstatus",                      &CommandRunner::command_getstatus,                      -1, -1 },
+    { "getconfig",                      &CommandRunner::command_getconfig,                      -1, -1 },
+    { "getinternal",                    &CommandRunner::command_getinternal,                    -1, -1 },
+    { "getlatency",                     &CommandRunner::command_getlatency,                      0,  2 },
+    { "savetrace",                      &CommandRunner::command_savetrace,                       0,  1 },
+    { "getmemory",                      &CommandRunner::command_getmemory,                       0, -1 },
+    { "settracing",                     &CommandRunner::command_settracing,                      1, -1 },
+    { "setmaintenancetime",             &CommandRunner::command_setmaintenancetime,             -1, -1 },
+    { "clearallstats",                  &CommandRunner::command_clearallstats,                  -1, -1 },
+    { "savemarket",                     &CommandRunner::command_savemarket,                     -1, -1 },
+    { "savesnapshot",                   &CommandRunner::command_savesnapshot,                   -1, -1 },
+    { "loadsnapshot",                   &CommandRunner::command_loadsnapshot,                    1, -1 },
+    { "savesettings",                   &CommandRunner::command_savesettings,                   -1, -1 },
+    { "savestats",                      &CommandRunner::command_savestats,                      -1, -1 },
+    { "sendcommand",                    &CommandRunner::command_sendcommand,                    -1, -1 },
+    { "setchatty",                      &CommandRunner::command_setchatty,                       1, -1 },
+    { "spruceup",                       &CommandRunner::command_spruceup,                       -1, -1 },
+    { "exit",                           &CommandRunner::command_exit,                           -1, -1 },
+    { "stop",                           &CommandRunner::command_exit,                           -1, -1 },
+    { "quit",                           &CommandRunner::command_exit,                           -1, -1 },
+};
+const qint32 CommandRunner::COMMAND_COUNT = sizeof( CommandRunner::COMMANDS ) / sizeof( CommandRunner::COMMANDS[ 0 ] );
+
+// the name hash table has this many slots, enough for a collision free seed to come up within a few tries
+static const qint32 COMMAND_SLOT_COUNT = 4096;
+static const uint COMMAND_SEED_TRIES = 1000;
+static const qint32 QUERY_CHUNK_SIZE = 200; // positions printed per event loop pass by getorders/getpositions
 
 CommandRunner::CommandRunner( const quint8 _engine_type, Engine *_e, QVector<BaseREST*> _rest_arr, QObject *parent )
     : QObject( parent ),
@@ -25,93 +159,28 @@ CommandRunner::CommandRunner( const quint8 _engine_type, Engine *_e, QVector<Bas
       engine_type( _engine_type ),
       engine( _e )
 {
-    // map strings to functions
-    using std::placeholders::_1;
-    command_map.insert( "getbalances", std::bind( &CommandRunner::command_getbalances, this, _1 ) );
-    command_map.insert( "getlastprices", std::bind( &CommandRunner::command_getlastprices, this, _1 ) );
-    command_map.insert( "getbuyselltotal", std::bind( &CommandRunner::command_getbuyselltotal, this, _1 ) );
-    command_map.insert( "cancelall", std::bind( &CommandRunner::command_cancelall, this, _1 ) );
-    command_map.insert( "cancellocal", std::bind( &CommandRunner::command_cancellocal, this, _1 ) );
-    command_map.insert( "cancelhighest", std::bind( &CommandRunner::command_cancelhighest, this, _1 ) );
-    command_map.insert( "cancellowest", std::bind( &CommandRunner::command_cancellowest, this, _1 ) );
-    command_map.insert( "getorders", std::bind( &CommandRunner::command_getorders, this, _1 ) );
-    command_map.insert( "getpositions", std::bind( &CommandRunner::command_getpositions, this, _1 ) );
-    command_map.insert( "getordersbyindex", std::bind( &CommandRunner::command_getordersbyindex, this, _1 ) );
-    command_map.insert( "setorder", std::bind( &CommandRunner::command_setorder, this, _1 ) );
-    command_map.insert( "setordermin", std::bind( &CommandRunner::command_setordermin, this, _1 ) );
-    command_map.insert( "setordermax", std::bind( &CommandRunner::command_setordermax, this, _1 ) );
-    command_map.insert( "setorderdc", std::bind( &CommandRunner::command_setorderdc, this, _1 ) );
-    command_map.insert( "setorderdcnice", std::bind( &CommandRunner::command_setorderdcnice, this, _1 ) );
-    command_map.insert( "setorderlandmarkthresh", std::bind( &CommandRunner::command_setorderlandmarkthresh, this, _1 ) );
-    command_map.insert( "setorderlandmarkstart", std::bind( &CommandRunner::command_setorderlandmarkstart, this, _1 ) );
-    command_map.insert( "long", std::bind( &CommandRunner::command_long, this, _1 ) );
-    command_map.insert( "longindex", std::bind( &CommandRunner::command_longindex, this, _1 ) );
-    command_map.insert( "short", std::bind( &CommandRunner::command_short, this, _1 ) );
-    command_map.insert( "shortindex", std::bind( &CommandRunner::command_shortindex, this, _1 ) );
-    command_map.insert( "setcancelthresh", std::bind( &CommandRunner::command_setcancelthresh, this, _1 ) );
-    command_map.insert( "setkeyandsecret", std::bind( &CommandRunner::command_setkeyandsecret, this, _1 ) );
-    command_map.insert( "getdailyvolume", std::bind( &CommandRunner::command_getdailyvolume, this, _1 ) );
-    command_map.insert( "getdailyfills", std::bind( &CommandRunner::command_getdailyfills, this, _1 ) );
-    command_map.insert( "getalpha", std::bind( &CommandRunner::command_getalpha, this, _1 ) );
-    command_map.insert( "setalphamanual", std::bind( &CommandRunner::command_setalphamanual, this, _1 ) );
-    command_map.insert( "getdailymarketvolume", std::bind( &CommandRunner::command_getdailymarketvolume, this, _1 ) );
-    command_map.insert( "getshortlong", std::bind( &CommandRunner::command_getshortlong, this, _1 ) );
-    command_map.insert( "gethibuylosell", std::bind( &CommandRunner::command_gethibuylosell, this, _1 ) );
-    command_map.insert( "setmarketsettings", std::bind( &CommandRunner::command_setmarketsettings, this, _1 ) );
-    command_map.insert( "setmarketoffset", std::bind( &CommandRunner::command_setmarketoffset, this, _1 ) );
-    command_map.insert( "setmarketsentiment", std::bind( &CommandRunner::command_setmarketsentiment, this, _1 ) );
-    command_map.insert( "setnaminterval", std::bind( &CommandRunner::command_setnaminterval, this, _1 ) );
-    command_map.insert( "setbookinterval", std::bind( &CommandRunner::command_setbookinterval, this, _1 ) );
-    command_map.insert( "settickerinterval", std::bind( &CommandRunner::command_settickerinterval, this, _1 ) );
-    command_map.insert( "setgracetimelimit", std::bind( &CommandRunner::command_setgracetimelimit, this, _1 ) );
-    command_map.insert( "setcheckinterval", std::bind( &CommandRunner::command_setcheckinterval, this, _1 ) );
-    command_map.insert( "setdcinterval", std::bind( &CommandRunner::command_setdcinterval, this, _1 ) );
-    command_map.insert( "setclearstrayorders", std::bind( &CommandRunner::command_setclearstrayorders, this, _1 ) );
-    command_map.insert( "setclearstrayordersall", std::bind( &CommandRunner::command_setclearstrayordersall, this, _1 ) );
-    command_map.insert( "setslippagecalculated", std::bind( &CommandRunner::command_setslippagecalculated, this, _1 ) );
-    command_map.insert( "setadjustbuysell", std::bind( &CommandRunner::command_setadjustbuysell, this, _1 ) );
-    command_map.insert( "setdcslippage", std::bind( &CommandRunner::command_setdcslippage, this, _1 ) );
-    command_map.insert( "setorderbookstaletolerance", std::bind( &CommandRunner::command_setorderbookstaletolerance, this, _1 ) );
-    command_map.insert( "setsafetydelaytime", std::bind( &CommandRunner::command_setsafetydelaytime, this, _1 ) );
-    command_map.insert( "settickersafetydelaytime", std::bind( &CommandRunner::command_settickersafetydelaytime, this, _1 ) );
-    command_map.insert( "setslippagestaletime", std::bind( &CommandRunner::command_setslippagestaletime, this, _1 ) );
-    command_map.insert( "setqueuedcommandsmax", std::bind( &CommandRunner::command_setqueuedcommandsmax, this, _1 ) );
-    command_map.insert( "setqueuedcommandsmaxdc", std::bind( &CommandRunner::command_setqueuedcommandsmaxdc, this, _1 ) );
-    command_map.insert( "setsentcommandsmax", std::bind( &CommandRunner::command_setsentcommandsmax, this, _1 ) );
-    command_map.insert( "settimeoutyield", std::bind( &CommandRunner::command_settimeoutyield, this, _1 ) );
-    command_map.insert( "setrequesttimeout", std::bind( &CommandRunner::command_setrequesttimeout, this, _1 ) );
-    command_map.insert( "setcanceltimeout", std::bind( &CommandRunner::command_setcanceltimeout, this, _1 ) );
-    command_map.insert( "setslippagetimeout", std::bind( &CommandRunner::command_setslippagetimeout, this, _1 ) );
-    command_map.insert( "setspruceinterval", std::bind( &CommandRunner::command_setspruceinterval, this, _1 ) );
-    command_map.insert( "setsprucebasecurrency", std::bind( &CommandRunner::command_setsprucebasecurrency, this, _1 ) );
-    command_map.insert( "setspruceweight", std::bind( &CommandRunner::command_setspruceweight, this, _1 ) );
-    command_map.insert( "setsprucestartnode", std::bind( &CommandRunner::command_setsprucestartnode, this, _1 ) );
-    command_map.insert( "setspruceshortlongtotal", std::bind( &CommandRunner::command_setspruceshortlongtotal, this, _1 ) );
-    command_map.insert( "setsprucebetamarket", std::bind( &CommandRunner::command_setsprucebetamarket, this, _1 ) );
-    command_map.insert( "setspruceamplification", std::bind( &CommandRunner::command_setspruceamplification, this, _1 ) );
-    command_map.insert( "setspruceprofile", std::bind( &CommandRunner::command_setspruceprofile, this, _1 ) );
-    command_map.insert( "setsprucereserve", std::bind( &CommandRunner::command_setsprucereserve, this, _1 ) );
-    command_map.insert( "setspruceordergreed", std::bind( &CommandRunner::command_setspruceordergreed, this, _1 ) );
-    command_map.insert( "setspruceordersize", std::bind( &CommandRunner::command_setspruceordersize, this, _1 ) );
-    command_map.insert( "setspruceordernice", std::bind( &CommandRunner::command_setspruceordernice, this, _1 ) );
-    command_map.insert( "setspruceordernicecustom", std::bind( &CommandRunner::command_setspruceordernicecustom, this, _1 ) );
-    command_map.insert( "setspruceordernicemarketoffset", std::bind( &CommandRunner::command_setspruceordernicemarketoffset, this, _1 ) );
-    command_map.insert( "setspruceallocation", std::bind( &CommandRunner::command_setspruceallocation, this, _1 ) );
-    command_map.insert( "setsprucesnapback", std::bind( &CommandRunner::command_setsprucesnapback, this, _1 ) );
-    command_map.insert( "getstatus", std::bind( &CommandRunner::command_getstatus, this, _1 ) );
-    command_map.insert( "getconfig", std::bind( &CommandRunner::command_getconfig, this, _1 ) );
-    command_map.insert( "getinternal", std::bind( &CommandRunner::command_getinternal, this, _1 ) );
-    command_map.insert( "setmaintenancetime", std::bind( &CommandRunner::command_setmaintenancetime, this, _1 ) );
-    command_map.insert( "clearallstats", std::bind( &CommandRunner::command_clearallstats, this, _1 ) );
-    command_map.insert( "savemarket", std::bind( &CommandRunner::command_savemarket, this, _1 ) );
-    command_map.insert( "savesettings", std::bind( &CommandRunner::command_savesettings, this, _1 ) );
-    command_map.insert( "savestats", std::bind( &CommandRunner::command_savestats, this, _1 ) );
-    command_map.insert( "sendcommand", std::bind( &CommandRunner::command_sendcommand, this, _1 ) );
-    command_map.insert( "setchatty", std::bind( &CommandRunner::command_setchatty, this, _1 ) );
-    command_map.insert( "spruceup", std::bind( &CommandRunner::command_spruceup, this, _1 ) );
-    command_map.insert( "exit", std::bind( &CommandRunner::command_exit, this, _1 ) );
-    command_map.insert( "stop", std::bind( &CommandRunner::command_exit, this, _1 ) );
-    command_map.insert( "quit", std::bind( &CommandRunner::command_exit, this, _1 ) );
+    // ids for the binary protocol's commands first, so a frame's ids index straight in, then the text only ones
+    for ( qint32 i = 0; i < IPC_COMMAND_COUNT; i++ )
+    {
+        for ( qint32 j = 0; j < COMMAND_COUNT; j++ )
+        {
+            if ( qstrcmp( COMMANDS[ j ].name, IPC_COMMAND_NAMES[ i ] ) != 0 )
+                continue;
+
+            command_by_id += &COMMANDS[ j ];
+            break;
+        }
+
+        if ( command_by_id.size() != i +1 )
+            command_by_id += nullptr;
+    }
+
+    for ( qint32 j = 0; j < COMMAND_COUNT; j++ )
+        if ( !command_by_id.contains( &COMMANDS[ j ] ) )
+            command_by_id += &COMMANDS[ j ];
+
+    buildCommandSlots();
+    setorder_id = getCommandId( "setorder" );
 
     kDebug() << QString( "[CommandRunner %1]" )
                 .arg( engine_type );
@@ -122,11 +191,54 @@ CommandRunner::~CommandRunner()
 
 }
 
-void CommandRunner::runCommandChunk( QString &s )
+void CommandRunner::buildCommandSlots()
 {
-    QQueue<QStringList> commands;
-    QMap<QString, qint32> times_called; // count of commands called
-    QMap<QString, qint32> positions_added; // count of positions set in each market
+    // look for a seed that gives every name its own slot, so a lookup is one hash and one compare. if none comes up
+    // the last seed is kept and lookups probe past the collisions
+    for ( command_seed = 0; command_seed < COMMAND_SEED_TRIES; command_seed++ )
+    {
+        command_slots.fill( -1, COMMAND_SLOT_COUNT );
+        bool is_perfect = true;
+
+        for ( qint32 id = 0; id < command_by_id.size(); id++ )
+        {
+            const CommandInfo *info = command_by_id.at( id );
+            if ( info == nullptr )
+                continue;
+
+            qint32 slot = qHash( QString::fromLatin1( info->name ), command_seed ) & ( COMMAND_SLOT_COUNT -1 );
+            if ( command_slots.at( slot ) >= 0 )
+                is_perfect = false;
+
+            while ( command_slots.at( slot ) >= 0 )
+                slot = ( slot +1 ) & ( COMMAND_SLOT_COUNT -1 );
+
+            command_slots[ slot ] = qint16( id );
+        }
+
+        if ( is_perfect || command_seed +1 == COMMAND_SEED_TRIES )
+            break;
+    }
+}
+
+qint32 CommandRunner::getCommandId( const QString &name ) const
+{
+    qint32 slot = qHash( name, command_seed ) & ( COMMAND_SLOT_COUNT -1 );
+
+    for ( qint16 id = command_slots.at( slot ); id >= 0; id = command_slots.at( slot ) )
+    {
+        if ( name == QLatin1String( command_by_id.at( id )->name ) )
+            return id;
+
+        slot = ( slot +1 ) & ( COMMAND_SLOT_COUNT -1 );
+    }
+
+    return -1;
+}
+
+void CommandRunner::runCommandChunk( const QString &s )
+{
+    QVector<QueuedCommand> commands;
 
     QStringList lines = s.split( "\n" );
     while ( lines.size() > 0 )
@@ -142,33 +254,152 @@ void CommandRunner::runCommandChunk( QString &s )
         if ( command.isNull() || command.isEmpty() )
             continue;
 
-        // record how many times it was called
-        times_called[ command ]++;
-        commands += args;
+        QueuedCommand queued;
+        queued.id = getCommandId( args.first() );
+        queued.args = args;
+        commands += queued;
+    }
+
+    runCommands( commands );
+}
+
+void CommandRunner::runCommandFrame( const QByteArray &frame )
+{
+    const QString prefix = QString( "[CommandRunner %1]" )
+                            .arg( engine_type );
+
+    // after the engine type, the command count, then the commands
+    const uchar *p = reinterpret_cast<const uchar*>( frame.constData() );
+    const int size = frame.size();
+    if ( size < 3 )
+    {
+        kDebug() << prefix << "local error: command frame is too short";
+        return;
+    }
+
+    const quint16 count = qFromLittleEndian<quint16>( p + 1 );
+    int position = 3;
+    bool is_bad = false;
+
+    QVector<QueuedCommand> commands;
+    commands.reserve( count );
+
+    for ( quint16 i = 0; i < count && !is_bad; i++ )
+    {
+        if ( position + 3 > size )
+        {
+            is_bad = true;
+            break;
+        }
+
+        const quint16 id = qFromLittleEndian<quint16>( p + position );
+        const quint8 arg_count = p[ position +2 ];
+        position += 3;
+
+        QueuedCommand queued;
+        queued.id = id < IPC_COMMAND_COUNT ? id : -1;
+        queued.args.reserve( arg_count +1 );
+        queued.args += id < IPC_COMMAND_COUNT ? QString( QLatin1String( IPC_COMMAND_NAMES[ id ] ) ) : QString( "#%1" ).arg( id );
+
+        // typed args go in as the text the commands parse
+        for ( quint8 j = 0; j < arg_count; j++ )
+        {
+            if ( position +1 > size )
+            {
+                is_bad = true;
+                break;
+            }
+
+            const quint8 type = p[ position++ ];
+
+            if ( type == IPC_ARG_STRING && position +2 <= size )
+            {
+                const quint16 arg_size = qFromLittleEndian<quint16>( p + position );
+                position += 2;
+
+                if ( position + arg_size > size )
+                {
+                    is_bad = true;
+                    break;
+                }
+
+                queued.args += QString::fromUtf8( frame.constData() + position, arg_size );
+                position += arg_size;
+            }
+            else if ( type == IPC_ARG_INT && position +8 <= size )
+            {
+                queued.args += QString::number( qFromLittleEndian<qint64>( p + position ) );
+                position += 8;
+            }
+            else if ( type == IPC_ARG_COIN && position +8 <= size )
+            {
+                queued.args += Coin( CoinRaw{ qFromLittleEndian<qint64>( p + position ) } ).toSubSatoshiString();
+                position += 8;
+            }
+            else
+            {
+                is_bad = true;
+                break;
+            }
+        }
+
+        commands += queued;
+    }
+
+    // a frame runs whole or not at all
+    if ( is_bad || position != size )
+    {
+        kDebug() << prefix << "local error: bad command frame at byte" << position << "of" << size;
+        return;
     }
 
+    runCommands( commands );
+}
+
+void CommandRunner::runCommands( QVector<QueuedCommand> &commands )
+{
     // early return
     if ( commands.isEmpty() )
         return;
 
+    // commands touch this engine and spruce, lock in the same order as SpruceOverseer
+    QMutexLocker locker( engine->getLock() );
+    QMutexLocker spruce_locker( &spruce_overseer->spruce_lock );
+
+    QVector<qint32> times_called( command_by_id.size(), 0 ); // count of commands called
+    QMap<QString, qint32> positions_added; // count of positions set in each market
+
+    // record how many times each was called
+    for ( QVector<QueuedCommand>::const_iterator i = commands.begin(); i != commands.end(); i++ )
+        if ( i->id >= 0 )
+            times_called[ i->id ]++;
+
     const QString prefix = QString( "[CommandRunner %1]" )
                             .arg( engine_type );
 
+    // consecutive 'setorder' lines are collected and added in one go
+    QVector<PositionSpec> setorders;
+
     // parse all commands
-    while ( !commands.isEmpty() )
+    for ( int i = 0; i < commands.size(); i++ )
     {
-        QStringList args = commands.takeFirst();
-        QString cmd = args.first();
-
-        qint32 times = times_called.value( cmd );
+        QStringList &args = commands[ i ].args;
+        const qint32 id = commands.at( i ).id;
+        const QString &cmd = args.first();
 
         // if the command is unknown, print it until suppressed
-        if ( !command_map.contains( cmd ) )
+        const CommandInfo *info = id >= 0 ? command_by_id.at( id ) : nullptr;
+        if ( info == nullptr )
         {
             kDebug() << prefix << "unknown command:" << cmd;
             continue;
         }
 
+        if ( info->args_min >= 0 && !checkArgs( args, info->args_min, info->args_max ) )
+            continue;
+
+        qint32 times = times_called.value( id );
+
         // do not leak key/secret into debug log
         if ( cmd.startsWith( "setkey" ) )
         {
@@ -177,7 +408,7 @@ void CommandRunner::runCommandChunk( QString &s )
         // be nice to the log
         else if ( times > 10 )
         {
-            times_called[ cmd ] = 0; // don't print any more lines for this command
+            times_called[ id ] = 0; // don't print any more lines for this command
             kDebug() << QString( "%1 running '%2' x%3" )
                             .arg( prefix )
                             .arg( cmd )
@@ -185,16 +416,30 @@ void CommandRunner::runCommandChunk( QString &s )
         }
         else if ( times > 0 )
         {
-            kDebug() << prefix << "running:" << args.join( QChar( ' ' ) );
+            kLog( LOG_LEVEL_DEBUG ) << prefix << "running:" << args.join( QChar( ' ' ) );
         }
 
         // if we set an order, increment positions_added
-        if ( args.size() > 1 && cmd == "setorder" )
+        if ( args.size() > 1 && id == setorder_id )
             positions_added[ args.value( 1 ) ]++;
 
+        if ( id == setorder_id )
+        {
+            PositionSpec spec;
+            parseSetOrder( args, spec );
+            setorders += spec;
+
+            // flush the batch when the run of 'setorder' lines ends
+            if ( i +1 == commands.size() || commands.at( i +1 ).id != setorder_id )
+            {
+                engine->addPositions( setorders );
+                setorders.clear();
+            }
+            continue;
+        }
+
         // run command
-        std::function<void(QStringList&)> _func = command_map.value( cmd );
-        _func( args );
+        ( this->*info->run )( args );
     }
 
     // avoid addPosition() spam by logging stuff about 'setorder' here
@@ -241,12 +486,25 @@ bool CommandRunner::checkArgs( const QStringList &args, qint32 expected_args_min
 
 void CommandRunner::command_getbalances( QStringList & )
 {
-    if ( engine_type == ENGINE_BITTREX )
-        rest_arr.at( ENGINE_BITTREX )->sendRequest( TREX_COMMAND_GET_BALANCES );
-    else if ( engine_type == ENGINE_BINANCE )
-        rest_arr.at( ENGINE_BINANCE )->sendRequest( BNC_COMMAND_GETBALANCES, "", nullptr, 5 );
-    else if ( engine_type == ENGINE_POLONIEX )
-        rest_arr.at( ENGINE_POLONIEX )->sendRequest( POLO_COMMAND_GETBALANCES );
+    rest_arr.at( engine_type )->checkBalances( true );
+}
+
+void CommandRunner::command_getledger( QStringList & )
+{
+    const BalanceLedger &ledger = engine->getLedger();
+    const QStringList currencies = ledger.getCurrencies();
+
+    for ( QStringList::const_iterator i = currencies.begin(); i != currencies.end(); i++ )
+        kDebug() << QString( "%1 TOTAL: %2 AVAIL: %3 ORDER: %4" )
+                     .arg( *i, -8 )
+                     .arg( ledger.getTotal( *i ), -20 )
+                     .arg( ledger.getAvailable( *i ), -20 )
+                     .arg( ledger.getHeld( *i ), -20 );
+
+    if ( ledger.isReconciled() )
+        kDebug() << "reconciled" << ( VirtualClock::currentMSecsSinceEpoch() - ledger.getLastReconcileTime() ) / 1000 << "seconds ago";
+    else
+        kDebug() << "not reconciled yet, the totals are the changes since start";
 }
 
 void CommandRunner::command_getlastprices( QStringList & )
@@ -263,12 +521,11 @@ void CommandRunner::command_getbuyselltotal( QStringList & )
 
     QString base_asset = spruce_overseer->spruce->getBaseCurrency();
 
-    // build indexes from active and queued positions
-    QSet<Position*>::const_iterator begin = engine->getPositionMan()->all().begin(),
-                                    end = engine->getPositionMan()->all().end();
-    for ( QSet<Position*>::const_iterator i = begin; i != end; i++ )
+    // build indexes from active and queued positions, as of a current snapshot
+    const PositionSnapshotPtr snapshot = engine->getPositionMan()->publishSnapshot( true );
+    for ( QVector<PositionSnapshotEntry>::const_iterator i = snapshot->positions.begin(); i != snapshot->positions.end(); i++ )
     {
-        Position *const &pos = *i;
+        const PositionSnapshotEntry *const pos = &*i;
 
         quint8 side_actual;
         Market market_actual;
@@ -366,6 +623,17 @@ void CommandRunner::command_cancellocal( QStringList &args )
     engine->getPositionMan()->cancelLocal( Market( args.value( 1 ) ) );
 }
 
+void CommandRunner::command_flatten( QStringList &args )
+{
+    if ( args.value( 2 ) == "stop" )
+    {
+        engine->stopFlattening( Market( args.value( 1 ) ) );
+        return;
+    }
+
+    engine->flatten( Market( args.value( 1 ) ) );
+}
+
 void CommandRunner::command_cancelhighest( QStringList &args )
 {
     engine->getPositionMan()->cancelHighest( Market( args.value( 1 ) ) );
@@ -378,42 +646,123 @@ void CommandRunner::command_cancellowest( QStringList &args )
 
 void CommandRunner::command_getorders( QStringList &args )
 {
-    Q_UNUSED( args )
-    //stats->printOrders( Market( args.value( 1 ) ), false );
+    startQuery( "getorders", args.value( 1 ), true, false );
 }
 
 void CommandRunner::command_getpositions( QStringList &args )
 {
-    Q_UNUSED( args )
-    //stats->printPositions( Market( args.value( 1 ) ) );
+    startQuery( "getpositions", args.value( 1 ), false, false );
 }
 
 void CommandRunner::command_getordersbyindex( QStringList &args )
 {
-    Q_UNUSED( args )
-    //stats->printOrders( Market( args.value( 1 ) ), true );
+    startQuery( "getordersbyindex", args.value( 1 ), true, true );
+}
+
+void CommandRunner::startQuery( const QString &name, const QString &market, const bool active_only, const bool by_index )
+{
+    if ( query_next < query_entries.size() )
+        kDebug() << "local warning:" << query_name << "didn't finish, dropped" << query_entries.size() - query_next << "positions";
+
+    const Market market_filter( market );
+
+    // the query walks a current snapshot, so the chunks print one consistent view without the engine
+    query_snapshot = engine->getPositionMan()->publishSnapshot( true );
+    query_entries.clear();
+    query_entries.reserve( active_only ? query_snapshot->active_count : query_snapshot->positions.size() );
+
+    for ( QVector<PositionSnapshotEntry>::const_iterator i = query_snapshot->positions.begin(); i != query_snapshot->positions.end(); i++ )
+    {
+        if ( active_only && !i->is_active )
+            continue;
+
+        if ( !market.isEmpty() && i->market != market_filter )
+            continue;
+
+        query_entries += &*i;
+    }
+
+    // by market and side, then by price or index
+    std::sort( query_entries.begin(), query_entries.end(), [by_index]( const PositionSnapshotEntry *a, const PositionSnapshotEntry *b )
+    {
+        if ( a->market != b->market )
+            return QString( a->market ) < QString( b->market );
+        if ( a->side != b->side )
+            return a->side < b->side;
+
+        return by_index ? a->market_index_lo < b->market_index_lo :
+                          a->price < b->price;
+    } );
+
+    query_next = 0;
+    query_name = name;
+
+    kDebug() << QString( "%1: %2 positions" )
+                .arg( name )
+                .arg( query_entries.size() );
+
+    printQueryChunk();
+}
+
+void CommandRunner::printQueryChunk()
+{
+    // the entries are in our snapshot, positions filled or cancelled since then still print as they were
+    const qint32 end = std::min( query_next + QUERY_CHUNK_SIZE, query_entries.size() );
+
+    for ( ; query_next < end; query_next++ )
+        kDebug() << query_entries.at( query_next )->stringifyOrder();
+
+    if ( query_next < query_entries.size() )
+    {
+        QTimer::singleShot( 0, this, &CommandRunner::printQueryChunk );
+        return;
+    }
+
+    query_entries.clear();
+    query_entries.squeeze();
+    query_snapshot.clear();
+    query_next = 0;
+}
+
+void CommandRunner::parseSetOrder( const QStringList &args, PositionSpec &spec )
+{
+    spec.market = Market( args.value( 1 ) );
+    spec.side = args.value( 2 ) == BUY ? SIDE_BUY :
+                args.value( 2 ) == SELL ? SIDE_SELL : 0;
+    spec.buy_price = args.value( 3 );
+    spec.sell_price = args.value( 4 );
+    spec.order_size = args.value( 5 );
+    spec.type = args.value( 6 );
+    spec.strategy_tag = args.value( 7 );
+
+    return true;
 }
 
 void CommandRunner::command_setorder( QStringList &args )
 {
-    if ( !checkArgs( args, 6, 7 ) ) return;
+    PositionSpec spec;
+    parseSetOrder( args, spec );
 
-    QString market = Market( args.value( 1 ) );
-    quint8 side = args.value( 2 ) == BUY ? SIDE_BUY :
-                  args.value( 2 ) == SELL ? SIDE_SELL : 0;
-    const QString &lo = args.value( 3 );
-    const QString &hi = args.value( 4 );
-    const QString &size = args.value( 5 );
-    const QString &type = args.value( 6 );
-    const QString &strategy = args.value( 7 );
+    engine->addPosition( spec.market, spec.side, spec.buy_price, spec.sell_price, spec.order_size, spec.type, spec.strategy_tag );
+}
+
+void CommandRunner::command_setgrid( QStringList &args )
+{
+    const QString market = Market( args.value( 1 ) );
+    const QString type = args.size() > 7 ? args.value( 7 ) : QString( ACTIVE );
+
+    const qint32 indices_set = engine->addGrid( market, Coin( args.value( 2 ) ), Coin( args.value( 3 ) ), args.value( 4 ).toInt(),
+                                                args.value( 5 ).toDouble(), Coin( args.value( 6 ) ), type, args.value( 8 ) );
 
-    engine->addPosition( market, side, lo, hi, size, type, strategy );
+    kDebug() << QString( "[%1] set %2 grid indices. total ping-pong indices: %3, active orders: %4" )
+                    .arg( market )
+                    .arg( indices_set )
+                    .arg( engine->getMarketInfo( market ).position_index.size() )
+                    .arg( engine->getPositionMan()->getMarketOrderTotal( market ) );
 }
 
 void CommandRunner::command_setordermin( QStringList &args )
 {
-    if ( !checkArgs( args, 2 ) ) return;
-
     QString market = Market( args.value( 1 ) );
     const qint32 &count = args.value( 2 ).toInt();
 
@@ -423,8 +772,6 @@ void CommandRunner::command_setordermin( QStringList &args )
 
 void CommandRunner::command_setordermax( QStringList &args )
 {
-    if ( !checkArgs( args, 2 ) ) return;
-
     QString market = Market( args.value( 1 ) );
     const qint32 &count = args.value( 2 ).toInt();
 
@@ -434,30 +781,26 @@ void CommandRunner::command_setordermax( QStringList &args )
 
 void CommandRunner::command_setorderdc( QStringList &args )
 {
-    if ( !checkArgs( args, 2 ) ) return;
-
     QString market = Market( args.value( 1 ) );
     const qint32 &count = args.value( 2 ).toInt();
 
     engine->getMarketInfo( market ).order_dc = count;
+    engine->getPositionMan()->setDCDirty( market );
     kDebug() << "market dc for" << market << "is now" << count;
 }
 
 void CommandRunner::command_setorderdcnice( QStringList &args )
 {
-    if ( !checkArgs( args, 2 ) ) return;
-
     QString market = Market( args.value( 1 ) );
     const qint32 &nice = args.value( 2 ).toInt();
 
     engine->getMarketInfo( market ).order_dc_nice = nice;
+    engine->getPositionMan()->setDCDirty( market );
     kDebug() << "market dc nice for" << market << "is now" << nice;
 }
 
 void CommandRunner::command_setorderlandmarkthresh( QStringList &args )
 {
-    if ( !checkArgs( args, 2 ) ) return;
-
     QString market = Market( args.value( 1 ) );
     const qint32 &val = args.value( 2 ).toInt();
 
@@ -467,12 +810,11 @@ void CommandRunner::command_setorderlandmarkthresh( QStringList &args )
 
 void CommandRunner::command_setorderlandmarkstart( QStringList &args )
 {
-    if ( !checkArgs( args, 2 ) ) return;
-
     QString market = Market( args.value( 1 ) );
     const qint32 &val = args.value( 2 ).toInt();
 
     engine->getMarketInfo( market ).order_landmark_start = val;
+    engine->getPositionMan()->setDCDirty( market );
     kDebug() << "market landmark start for" << market << "is now" << val;
 }
 
@@ -521,8 +863,21 @@ void CommandRunner::command_setkeyandsecret( QStringList &args )
 
 void CommandRunner::command_getdailyvolume( QStringList &args )
 {
-    Q_UNUSED( args )
-    engine->alpha->printDailyVolume();
+    if ( args.size() < 2 )
+    {
+        engine->alpha->printDailyVolume();
+        return;
+    }
+
+    // the total of the last days
+    const qint32 days = args.value( 1 ).toInt();
+    if ( days < 1 )
+    {
+        kDebug() << "local error: days must be 1 or more";
+        return;
+    }
+
+    kDebug() << "volume for the last" << days << "days:" << engine->alpha->getDailyVolume( days, VirtualClock::currentMSecsSinceEpoch() / 1000 );
 }
 
 void CommandRunner::command_getdailyfills( QStringList &args )
@@ -533,14 +888,28 @@ void CommandRunner::command_getdailyfills( QStringList &args )
 
 void CommandRunner::command_getalpha( QStringList &args )
 {
-    Q_UNUSED( args )
-    engine->alpha->printAlpha();
+    if ( args.size() < 2 )
+    {
+        engine->alpha->printAlpha();
+        return;
+    }
+
+    // 1h, 24h, 7d or a number of hours
+    const QString window = args.value( 1 ).toLower();
+    const qint32 window_hours = window.endsWith( 'd' ) ? window.chopped( 1 ).toInt() * 24 :
+                                window.endsWith( 'h' ) ? window.chopped( 1 ).toInt() :
+                                                         window.toInt();
+    if ( window_hours < 1 || window_hours > ALPHA_BUCKET_COUNT )
+    {
+        kDebug() << "local error: the alpha window must be 1h to" << ALPHA_BUCKET_COUNT / 24 << "d";
+        return;
+    }
+
+    engine->alpha->printAlpha( window_hours, VirtualClock::currentMSecsSinceEpoch() );
 }
 
 void CommandRunner::command_setalphamanual( QStringList &args )
 {
-    if ( !checkArgs( args, 5 ) ) return;
-
     const Market market = Market( args.value( 1 ) );
     const quint8 side = args.value( 2 ).toLower() == "buy" ? SIDE_BUY : SIDE_SELL;
     const Coin amt = args.value( 3 );
@@ -585,7 +954,7 @@ void CommandRunner::command_gethibuylosell( QStringList &args )
     Q_UNUSED( args )
     QMap<Coin, QString> market_spreads;
 
-    for ( QHash<QString, MarketInfo>::const_iterator i = engine->getMarketInfoStructure().begin(); i != engine->getMarketInfoStructure().end(); i++ )
+    for ( MarketInfoTable::const_iterator i = engine->getMarketInfoStructure().begin(); i != engine->getMarketInfoStructure().end(); i++ )
     {
         const Coin &hi_buy  = i.value().ticker.bid;
         const Coin &lo_sell = i.value().ticker.ask;
@@ -598,11 +967,17 @@ void CommandRunner::command_gethibuylosell( QStringList &args )
         pct_diff_str.truncate( 4 );
         pct_diff_str.append( QChar( '%' ) );
 
-        QString out = QString( "%1 %2 %3  diff %4" )
+        // volatility of the last few minutes
+        const TickerHistory &history = i.value().ticker_history;
+        const QString volatility_str = QString::number( history.getVolatility() * 100., 'f', 3 ) + QChar( '%' );
+
+        QString out = QString( "%1 %2 %3  diff %4  vol %5 over %6s" )
                             .arg( i.key(), -11 )
                             .arg( hi_buy,  15 )
                             .arg( lo_sell, 15 )
-                            .arg( pct_diff_str );
+                            .arg( pct_diff_str )
+                            .arg( volatility_str, -7 )
+                            .arg( ( history.getLastTime() - history.getFirstTime() ) / 1000 );
 
         market_spreads.insert( pct_diff, out );
     }
@@ -614,8 +989,6 @@ void CommandRunner::command_gethibuylosell( QStringList &args )
 
 void CommandRunner::command_setmarketsettings( QStringList &args )
 {
-    if ( !checkArgs( args, 9 ) ) return;
-
     QString market = Market( args.value( 1 ) );
 
     engine->setMarketSettings( market,
@@ -633,8 +1006,6 @@ void CommandRunner::command_setmarketsettings( QStringList &args )
 
 void CommandRunner::command_setmarketoffset( QStringList &args )
 {
-    if ( !checkArgs( args, 2 ) ) return;
-
     QString market = Market( args.value( 1 ) );
     qreal offset = args.value( 2 ).toDouble();
 
@@ -644,8 +1015,6 @@ void CommandRunner::command_setmarketoffset( QStringList &args )
 
 void CommandRunner::command_setmarketsentiment( QStringList &args )
 {
-    if ( !checkArgs( args, 2 ) ) return;
-
     QString market = Market( args.value( 1 ) );
     bool sentiment = args.value( 2 ) == "true" ? true : false;
 
@@ -655,89 +1024,106 @@ void CommandRunner::command_setmarketsentiment( QStringList &args )
 
 void CommandRunner::command_setnaminterval( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
-    rest_arr.at( engine_type )->send_timer->setInterval( args.value( 1 ).toInt() );
+    const qint32 interval = qMax( 1, args.value( 1 ).toInt() );
+    rest_arr.at( engine_type )->send_timer->setInterval( interval );
+    rest_arr.at( engine_type )->setSendRate( 1000. / interval );
     kDebug() << "nam interval set to" << rest_arr.at( engine_type )->send_timer->interval();
 }
 
 void CommandRunner::command_setbookinterval( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     rest_arr.at( engine_type )->orderbook_timer->setInterval( args.value( 1 ).toInt() );
     kDebug() << "nam interval set to" << rest_arr.at( engine_type )->orderbook_timer->interval();
 }
 
 void CommandRunner::command_settickerinterval( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     rest_arr.at( engine_type )->ticker_timer->setInterval( args.value( 1 ).toInt() );
     kDebug() << "nam interval set to" << rest_arr.at( engine_type )->ticker_timer->interval();
 }
 
-void CommandRunner::command_setgracetimelimit( QStringList &args )
+void CommandRunner::command_setwavestickerbatch( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
+    if ( engine_type != ENGINE_WAVES )
+    {
+        kDebug() << "local error: ticker batch mode is only for waves";
+        return;
+    }
+
+    WavesREST *const waves = static_cast<WavesREST*>( rest_arr.at( ENGINE_WAVES ) );
+    waves->setTickerBatch( args.value( 1 ) == "true" ? true : false, args.value( 2 ).toInt() );
+}
 
+void CommandRunner::command_setwaveshistoryfills( QStringList &args )
+{
+    if ( engine_type != ENGINE_WAVES )
+    {
+        kDebug() << "local error: history fills are only for waves";
+        return;
+    }
+
+    WavesREST *const waves = static_cast<WavesREST*>( rest_arr.at( ENGINE_WAVES ) );
+    waves->setHistoryFills( args.value( 1 ) == "true" ? true : false );
+}
+
+void CommandRunner::command_setwavesjwt( QStringList &args )
+{
+    if ( engine_type != ENGINE_WAVES )
+    {
+        kDebug() << "local error: the address stream token is only for waves";
+        return;
+    }
+
+    WavesREST *const waves = static_cast<WavesREST*>( rest_arr.at( ENGINE_WAVES ) );
+    waves->setJwt( args.value( 1 ).toLatin1() );
+}
+
+void CommandRunner::command_setgracetimelimit( QStringList &args )
+{
     engine->getSettings()->stray_grace_time_limit = args.value( 1 ).toLong();
     kDebug() << "stray_grace_time_limit set to" << engine->getSettings()->stray_grace_time_limit;
 }
 
 void CommandRunner::command_setcheckinterval( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     rest_arr.at( engine_type )->timeout_timer->setInterval( args.value( 1 ).toInt() );
     kDebug() << "nam interval set to" << rest_arr.at( engine_type )->timeout_timer->interval();
 }
 
 void CommandRunner::command_setdcinterval( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     rest_arr.at( engine_type )->diverge_converge_timer->setInterval( args.value( 1 ).toInt() );
     kDebug() << "nam interval set to" << rest_arr.at( engine_type )->diverge_converge_timer->interval();
 }
 
 void CommandRunner::command_setclearstrayorders( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     engine->getSettings()->should_clear_stray_orders = args.value( 1 ) == "true" ? true : false;
     kDebug() << "should_clear_stray_orders set to" << engine->getSettings()->should_clear_stray_orders;
 }
 
 void CommandRunner::command_setclearstrayordersall( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     engine->getSettings()->should_clear_stray_orders_all = args.value( 1 ) == "true" ? true : false;
     kDebug() << "should_clear_stray_orders_all set to" << engine->getSettings()->should_clear_stray_orders_all;
 }
 
 void CommandRunner::command_setslippagecalculated( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     engine->getSettings()->should_slippage_be_calculated = args.value( 1 ) == "true" ? true : false;
     kDebug() << "should_slippage_be_calculated set to" << engine->getSettings()->should_slippage_be_calculated;
 }
 
 void CommandRunner::command_setadjustbuysell( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     engine->getSettings()->should_adjust_hibuy_losell = args.value( 1 ) == "true" ? true : false;
     kDebug() << "should_adjust_hibuy_losell set to" << engine->getSettings()->should_adjust_hibuy_losell;
 }
 
 void CommandRunner::command_setdcslippage( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     engine->getSettings()->should_dc_slippage_orders = args.value( 1 ) == "true" ? true : false;
+    engine->getPositionMan()->setDCDirtyAll();
     kDebug() << "should_dc_slippage_orders set to" << engine->getSettings()->should_dc_slippage_orders;
 }
 
@@ -765,64 +1151,122 @@ void CommandRunner::command_settickersafetydelaytime( QStringList &args )
 
 void CommandRunner::command_setslippagestaletime( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     rest_arr.at( engine_type )->slippage_stale_time = args.value( 1 ).toLongLong();
     kDebug() << "slippage_stale_time set to" << rest_arr.at( engine_type )->slippage_stale_time << "ms";
 }
 
 void CommandRunner::command_setqueuedcommandsmax( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
+    BaseREST *rest = rest_arr.at( engine_type );
 
-    rest_arr.at( engine_type )->limit_commands_queued = args.value( 1 ).toInt();
-    kDebug() << "limit_commands_queued set to" << rest_arr.at( engine_type )->limit_commands_queued;
+    // a value pins it against the flow tuner, "auto" hands it back
+    rest->flow_tuner.is_queued_pinned = args.value( 1 ) != "auto";
+    if ( rest->flow_tuner.is_queued_pinned )
+        rest->limit_commands_queued = args.value( 1 ).toInt();
+
+    kDebug() << "limit_commands_queued set to" << rest->limit_commands_queued << ( rest->flow_tuner.is_queued_pinned ? "(pinned)" : "(tuned)" );
 }
 
 void CommandRunner::command_setqueuedcommandsmaxdc( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     rest_arr.at( engine_type )->limit_commands_queued_dc_check = args.value( 1 ).toInt();
     kDebug() << "limit_commands_queued_dc_check set to" << rest_arr.at( engine_type )->limit_commands_queued_dc_check;
 }
 
 void CommandRunner::command_setsentcommandsmax( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
+    BaseREST *rest = rest_arr.at( engine_type );
+
+    rest->flow_tuner.is_sent_pinned = args.value( 1 ) != "auto";
+    if ( rest->flow_tuner.is_sent_pinned )
+        rest->limit_commands_sent = args.value( 1 ).toInt();
 
-    rest_arr.at( engine_type )->limit_commands_sent = args.value( 1 ).toInt();
-    kDebug() << "sent commands max set to" << rest_arr.at( engine_type )->limit_commands_sent;
+    kDebug() << "sent commands max set to" << rest->limit_commands_sent << ( rest->flow_tuner.is_sent_pinned ? "(pinned)" : "(tuned)" );
 }
 
-void CommandRunner::command_settimeoutyield( QStringList &args )
+void CommandRunner::command_setflowtuning( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
+    BaseREST *rest = rest_arr.at( engine_type );
+    rest->setFlowTuning( args.value( 1 ) == "true" ? true : false );
+
+    kDebug() << "flow tuning set to" << rest->flow_tuner.isEnabled()
+             << "sent limit" << rest->limit_commands_sent << ( rest->flow_tuner.is_sent_pinned ? "(pinned)" : "" )
+             << "queued limit" << rest->limit_commands_queued << ( rest->flow_tuner.is_queued_pinned ? "(pinned)" : "" )
+             << "p90 slo" << rest->limit_response_time_tail << "ms";
+}
 
+void CommandRunner::command_sethttp2( QStringList &args )
+{
+    rest_arr.at( engine_type )->setHttp2Allowed( args.value( 1 ) == "true" ? true : false );
+    kDebug() << "http/2 set to" << rest_arr.at( engine_type )->is_http2_allowed
+             << "sent commands limit" << rest_arr.at( engine_type )->getSentLimit();
+}
+
+void CommandRunner::command_setrecording( QStringList &args )
+{
+    engine->setRecording( args.value( 1 ) == "true" ? true : false );
+    kDebug() << "recording set to" << engine->isRecording();
+}
+
+void CommandRunner::command_setpaperlatency( QStringList &args )
+{
+    engine->getSettings()->paper_latency = args.value( 1 ).toLongLong();
+    kDebug() << "paper_latency set to" << engine->getSettings()->paper_latency << "ms" << ( engine->isPaperTrading() ? "" : "(not a PAPER_TRADE build)" );
+}
+
+void CommandRunner::command_setpaperfillmodel( QStringList &args )
+{
+    const QString model = args.value( 1 ).toLower();
+    const quint8 fill_model = model == "ticker" ? PAPER_FILL_TICKER :
+                              model == "cross"  ? PAPER_FILL_CROSS :
+                              model == "book"   ? PAPER_FILL_BOOK :
+                                                  0;
+    if ( fill_model == 0 )
+    {
+        kDebug() << "local error: paper fill model must be ticker, cross or book";
+        return;
+    }
+
+    engine->getSettings()->paper_fill_model = fill_model;
+    kDebug() << "paper_fill_model set to" << model << ( engine->isPaperTrading() ? "" : "(not a PAPER_TRADE build)" );
+}
+
+void CommandRunner::command_settimeoutyield( QStringList &args )
+{
     rest_arr.at( engine_type )->limit_timeout_yield = args.value( 1 ).toInt();
     kDebug() << "limit_timeout_yield set to" << rest_arr.at( engine_type )->limit_timeout_yield;
 }
 
 void CommandRunner::command_setrequesttimeout( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     engine->getSettings()->order_timeout = args.value( 1 ).toLong();
     kDebug() << "order timeout is" << engine->getSettings()->order_timeout;
 }
 
 void CommandRunner::command_setcanceltimeout( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     engine->getSettings()->cancel_timeout = args.value( 1 ).toLong();
     kDebug() << "cancel timeout is" << engine->getSettings()->cancel_timeout;
 }
 
-void CommandRunner::command_setslippagetimeout( QStringList &args )
+void CommandRunner::command_setadaptivetimeout( QStringList &args )
 {
-    if ( !checkArgs( args, 2 ) ) return;
+    // setadaptivetimeout <p99 multiplier, 0 = off> [order timeout min] [cancel timeout min]
+    EngineSettings *settings = engine->getSettings();
+    settings->adaptive_timeout_multiplier = args.value( 1 ).toLong();
+
+    if ( args.size() > 2 )
+        settings->order_timeout_min = args.value( 2 ).toLong();
+    if ( args.size() > 3 )
+        settings->cancel_timeout_min = args.value( 3 ).toLong();
+
+    kDebug() << "adaptive timeout multiplier is" << settings->adaptive_timeout_multiplier
+             << "order timeout min" << settings->order_timeout_min
+             << "cancel timeout min" << settings->cancel_timeout_min;
+}
 
+void CommandRunner::command_setslippagetimeout( QStringList &args )
+{
     QString market = Market( args.value( 1 ) );
 
     engine->getMarketInfo( market ).slippage_timeout = args.value( 2 ).toInt();
@@ -831,175 +1275,296 @@ void CommandRunner::command_setslippagetimeout( QStringList &args )
 
 void CommandRunner::command_setspruceinterval( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     const long secs = args.value( 1 ).toLong();
 
-    spruce_overseer->spruce->setIntervalSecs( secs );
-    spruce_overseer->spruce_timer->setInterval( secs *1000 );
-    kDebug() << "spruce interval is now" << spruce_overseer->spruce->getIntervalSecs() << "seconds";
+    spruce_overseer->getSelectedPortfolio()->setIntervalSecs( secs );
+
+    // the other portfolios solve on primary's ticks
+    if ( spruce_overseer->getSelectedPortfolio() == spruce_overseer->spruce )
+    {
+        // the timer lives on the main thread
+        SpruceOverseer *overseer = spruce_overseer;
+        QMetaObject::invokeMethod( overseer, [overseer, secs]() { overseer->spruce_timer->setInterval( secs *1000 ); } );
+    }
+    kDebug() << "spruce interval is now" << spruce_overseer->getSelectedPortfolio()->getIntervalSecs() << "seconds";
 }
 
 void CommandRunner::command_setsprucebasecurrency( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
-    spruce_overseer->spruce->setBaseCurrency( args.value( 1 ) );
-    kDebug() << "spruce base currency is now" << spruce_overseer->spruce->getBaseCurrency();
+    spruce_overseer->getSelectedPortfolio()->setBaseCurrency( args.value( 1 ) );
+    kDebug() << "spruce base currency is now" << spruce_overseer->getSelectedPortfolio()->getBaseCurrency();
 }
 
 void CommandRunner::command_setspruceweight( QStringList &args )
 {
-    if ( !checkArgs( args, 2 ) ) return;
-
-    spruce_overseer->spruce->setCurrencyWeight( args.value( 1 ), args.value( 2 ) );
+    spruce_overseer->getSelectedPortfolio()->setCurrencyWeight( args.value( 1 ), args.value( 2 ) );
     kDebug() << "spruce currency weight for" << args.value( 1 ) << "is" << args.value( 2 );
 }
 
 void CommandRunner::command_setsprucestartnode( QStringList &args )
 {
-    if ( !checkArgs( args, 3 ) ) return;
-
-    spruce_overseer->spruce->addStartNode( args.value( 1 ), args.value( 2 ), args.value( 3 ) );
+    spruce_overseer->getSelectedPortfolio()->addStartNode( args.value( 1 ), args.value( 2 ), args.value( 3 ) );
     kDebug() << "spruce added start node for" << args.value( 1 ) << args.value( 2 ) << args.value( 3 );
 }
 
 void CommandRunner::command_setspruceshortlongtotal( QStringList &args )
 {
-    if ( !checkArgs( args, 2 ) ) return;
-
-    spruce_overseer->spruce->addToShortLonged( Market( args.value( 1 ) ), args.value( 2 ) );
+    spruce_overseer->getSelectedPortfolio()->addToShortLonged( Market( args.value( 1 ) ), args.value( 2 ) );
     kDebug() << "spruce shortlong total for" << args.value( 1 ) << "is" << args.value( 2 );
 }
 
 void CommandRunner::command_setsprucebetamarket( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     const Market m = args.value( 1 );
-    spruce_overseer->spruce->addMarketBeta( m );
+    spruce_overseer->getSelectedPortfolio()->addMarketBeta( m );
 }
 
 void CommandRunner::command_setspruceamplification( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
+    spruce_overseer->getSelectedPortfolio()->setAmplification( args.value( 1 ) );
+    kDebug() << "spruce log amplification is" << spruce_overseer->getSelectedPortfolio()->getAmplification();
+}
 
-    spruce_overseer->spruce->setAmplification( args.value( 1 ) );
-    kDebug() << "spruce log amplification is" << spruce_overseer->spruce->getAmplification();
+void CommandRunner::command_setsprucesolver( QStringList &args )
+{
+    const QString mode = args.value( 1 ).toLower();
+    if ( mode != "adaptive" && mode != "reference" )
+    {
+        kDebug() << "local error: spruce solver must be 'adaptive' or 'reference'";
+        return;
+    }
+
+    spruce_overseer->getSelectedPortfolio()->setSolverAdaptive( mode == "adaptive" );
+    kDebug() << "spruce solver is" << mode;
 }
 
-void CommandRunner::command_setspruceprofile( QStringList &args )
+void CommandRunner::command_setsprucewarmstart( QStringList &args )
 {
-    if ( !checkArgs( args, 2 ) ) return;
+    const bool warm_start = args.value( 1 ) == "true" ? true : false;
 
-    spruce_overseer->spruce->setProfileU( args.value( 1 ), args.value( 2 ) );
-    kDebug() << "spruce profile u for" << args.value( 1 ) << "is" << spruce_overseer->spruce->getProfileU( args.value( 1 ) );
+    spruce_overseer->getSelectedPortfolio()->setSolverWarmStart( warm_start );
+    kDebug() << "spruce solver warm start is" << ( warm_start ? "enabled" : "disabled" );
 }
 
-void CommandRunner::command_setsprucereserve( QStringList &args )
+void CommandRunner::command_setsprucetrigger( QStringList &args )
 {
-    if ( !checkArgs( args, 2 ) ) return;
+    const Coin ratio = args.value( 1 );
+    if ( ratio.isLessThanZero() )
+    {
+        kDebug() << "local error: spruce trigger ratio must be 0 or more";
+        return;
+    }
+
+    spruce_overseer->getSelectedPortfolio()->setTriggerRatio( ratio );
 
-    spruce_overseer->spruce->setReserve( args.value( 1 ), args.value( 2 ) );
-    kDebug() << "spruce reserve for" << args.value( 1 ) << "is" << spruce_overseer->spruce->getReserve( args.value( 1 ) );
+    if ( ratio.isZero() )
+        kDebug() << "spruce trigger is disabled, solving every" << spruce_overseer->getSelectedPortfolio()->getIntervalSecs() << "seconds";
+    else
+        kDebug() << "spruce trigger ratio is now" << ratio;
 }
 
-void CommandRunner::command_setspruceordergreed( QStringList &args )
+void CommandRunner::command_setspruceprofile( QStringList &args )
 {
-    if ( !checkArgs( args, 4 ) ) return;
+    spruce_overseer->getSelectedPortfolio()->setProfileU( args.value( 1 ), args.value( 2 ) );
+    kDebug() << "spruce profile u for" << args.value( 1 ) << "is" << spruce_overseer->getSelectedPortfolio()->getProfileU( args.value( 1 ) );
+}
 
-    spruce_overseer->spruce->setOrderGreed( args.value( 1 ) );
-    spruce_overseer->spruce->setOrderGreedMinimum( args.value( 2 ) );
-    spruce_overseer->spruce->setOrderRandomBuy( args.value( 3 ) );
-    spruce_overseer->spruce->setOrderRandomSell( args.value( 4 ) );
+void CommandRunner::command_setsprucereserve( QStringList &args )
+{
+    spruce_overseer->getSelectedPortfolio()->setReserve( args.value( 1 ), args.value( 2 ) );
+    kDebug() << "spruce reserve for" << args.value( 1 ) << "is" << spruce_overseer->getSelectedPortfolio()->getReserve( args.value( 1 ) );
+}
+
+void CommandRunner::command_setspruceordergreed( QStringList &args )
+{
+    spruce_overseer->getSelectedPortfolio()->setOrderGreed( args.value( 1 ) );
+    spruce_overseer->getSelectedPortfolio()->setOrderGreedMinimum( args.value( 2 ) );
+    spruce_overseer->getSelectedPortfolio()->setOrderRandomBuy( args.value( 3 ) );
+    spruce_overseer->getSelectedPortfolio()->setOrderRandomSell( args.value( 4 ) );
 
-    kDebug() << "spruce order greed:" << spruce_overseer->spruce->getOrderGreed()
-             << "greed minimum:" << spruce_overseer->spruce->getOrderGreedMinimum()
-             << "buy random:" << spruce_overseer->spruce->getOrderRandomBuy()
-             << "sell random:" << spruce_overseer->spruce->getOrderRandomSell();
+    kDebug() << "spruce order greed:" << spruce_overseer->getSelectedPortfolio()->getOrderGreed()
+             << "greed minimum:" << spruce_overseer->getSelectedPortfolio()->getOrderGreedMinimum()
+             << "buy random:" << spruce_overseer->getSelectedPortfolio()->getOrderRandomBuy()
+             << "sell random:" << spruce_overseer->getSelectedPortfolio()->getOrderRandomSell();
 }
 
 void CommandRunner::command_setspruceordersize( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
-    spruce_overseer->spruce->setOrderSize( args.value( 1 ) );
-    kDebug() << "spruce ordersize is" << spruce_overseer->spruce->getOrderSize();
+    spruce_overseer->getSelectedPortfolio()->setOrderSize( args.value( 1 ) );
+    kDebug() << "spruce ordersize is" << spruce_overseer->getSelectedPortfolio()->getOrderSize();
 }
 
 void CommandRunner::command_setspruceordernice( QStringList &args )
 {
-    if ( !checkArgs( args, 6 ) ) return;
-
-    spruce_overseer->spruce->setOrderNice( SIDE_BUY, args.value( 1 ), false );
-    spruce_overseer->spruce->setOrderNiceZeroBound( SIDE_BUY, args.value( 2 ), false );
-    spruce_overseer->spruce->setOrderNiceSpreadPut( SIDE_BUY, args.value( 3 ) );
+    spruce_overseer->getSelectedPortfolio()->setOrderNice( SIDE_BUY, args.value( 1 ), false );
+    spruce_overseer->getSelectedPortfolio()->setOrderNiceZeroBound( SIDE_BUY, args.value( 2 ), false );
+    spruce_overseer->getSelectedPortfolio()->setOrderNiceSpreadPut( SIDE_BUY, args.value( 3 ) );
 
-    spruce_overseer->spruce->setOrderNice( SIDE_SELL, args.value( 4 ), false );
-    spruce_overseer->spruce->setOrderNiceZeroBound( SIDE_SELL, args.value( 5 ), false );
-    spruce_overseer->spruce->setOrderNiceSpreadPut( SIDE_SELL, args.value( 6 ) );
+    spruce_overseer->getSelectedPortfolio()->setOrderNice( SIDE_SELL, args.value( 4 ), false );
+    spruce_overseer->getSelectedPortfolio()->setOrderNiceZeroBound( SIDE_SELL, args.value( 5 ), false );
+    spruce_overseer->getSelectedPortfolio()->setOrderNiceSpreadPut( SIDE_SELL, args.value( 6 ) );
 
-    kDebug()    << "buy nice:" << spruce_overseer->spruce->getOrderNice( QString(), SIDE_BUY, false )
-          << "buy zero bound:" << spruce_overseer->spruce->getOrderNiceZeroBound( QString(), SIDE_BUY, false )
-       << "buy spread reduce:" << spruce_overseer->spruce->getOrderNiceSpreadPut( SIDE_BUY )
-               << "sell nice:" << spruce_overseer->spruce->getOrderNice( QString(), SIDE_SELL, false )
-         << "sell zero bound:" << spruce_overseer->spruce->getOrderNiceZeroBound( QString(), SIDE_SELL, false )
-      << "sell spread reduce:" << spruce_overseer->spruce->getOrderNiceSpreadPut( SIDE_SELL );
+    kDebug()    << "buy nice:" << spruce_overseer->getSelectedPortfolio()->getOrderNice( QString(), SIDE_BUY, false )
+          << "buy zero bound:" << spruce_overseer->getSelectedPortfolio()->getOrderNiceZeroBound( QString(), SIDE_BUY, false )
+       << "buy spread reduce:" << spruce_overseer->getSelectedPortfolio()->getOrderNiceSpreadPut( SIDE_BUY )
+               << "sell nice:" << spruce_overseer->getSelectedPortfolio()->getOrderNice( QString(), SIDE_SELL, false )
+         << "sell zero bound:" << spruce_overseer->getSelectedPortfolio()->getOrderNiceZeroBound( QString(), SIDE_SELL, false )
+      << "sell spread reduce:" << spruce_overseer->getSelectedPortfolio()->getOrderNiceSpreadPut( SIDE_SELL );
 }
 
 void CommandRunner::command_setspruceordernicecustom( QStringList &args )
 {
-    if ( !checkArgs( args, 4 ) ) return;
-
-    spruce_overseer->spruce->setOrderNice( SIDE_BUY, args.value( 1 ), true );
-    spruce_overseer->spruce->setOrderNiceZeroBound( SIDE_BUY, args.value( 2 ), true );
+    spruce_overseer->getSelectedPortfolio()->setOrderNice( SIDE_BUY, args.value( 1 ), true );
+    spruce_overseer->getSelectedPortfolio()->setOrderNiceZeroBound( SIDE_BUY, args.value( 2 ), true );
 
-    spruce_overseer->spruce->setOrderNice( SIDE_SELL, args.value( 3 ), true );
-    spruce_overseer->spruce->setOrderNiceZeroBound( SIDE_SELL, args.value( 4 ), true );
+    spruce_overseer->getSelectedPortfolio()->setOrderNice( SIDE_SELL, args.value( 3 ), true );
+    spruce_overseer->getSelectedPortfolio()->setOrderNiceZeroBound( SIDE_SELL, args.value( 4 ), true );
 
-    kDebug() << "buy nice custom:" << spruce_overseer->spruce->getOrderNice( QString(), SIDE_BUY, true )
-       << "buy zero bound custom:" << spruce_overseer->spruce->getOrderNiceZeroBound( QString(), SIDE_BUY, true )
-            << "sell nice custom:" << spruce_overseer->spruce->getOrderNice( QString(), SIDE_SELL, true )
-      << "sell zero bound custom:" << spruce_overseer->spruce->getOrderNiceZeroBound( QString(), SIDE_SELL, true );
+    kDebug() << "buy nice custom:" << spruce_overseer->getSelectedPortfolio()->getOrderNice( QString(), SIDE_BUY, true )
+       << "buy zero bound custom:" << spruce_overseer->getSelectedPortfolio()->getOrderNiceZeroBound( QString(), SIDE_BUY, true )
+            << "sell nice custom:" << spruce_overseer->getSelectedPortfolio()->getOrderNice( QString(), SIDE_SELL, true )
+      << "sell zero bound custom:" << spruce_overseer->getSelectedPortfolio()->getOrderNiceZeroBound( QString(), SIDE_SELL, true );
 }
 
 void CommandRunner::command_setspruceordernicemarketoffset( QStringList &args )
 {
-    if ( !checkArgs( args, 5 ) ) return;
+    spruce_overseer->getSelectedPortfolio()->setOrderNiceMarketOffset( args.value( 1 ), SIDE_BUY, args.value( 2 ) );
+    spruce_overseer->getSelectedPortfolio()->setOrderNiceZeroBoundMarketOffset( args.value( 1 ), SIDE_BUY, args.value( 3 ) );
+    spruce_overseer->getSelectedPortfolio()->setOrderNiceMarketOffset( args.value( 1 ), SIDE_SELL, args.value( 4 ) );
+    spruce_overseer->getSelectedPortfolio()->setOrderNiceZeroBoundMarketOffset( args.value( 1 ), SIDE_SELL, args.value( 5 ) );
 
-    spruce_overseer->spruce->setOrderNiceMarketOffset( args.value( 1 ), SIDE_BUY, args.value( 2 ) );
-    spruce_overseer->spruce->setOrderNiceZeroBoundMarketOffset( args.value( 1 ), SIDE_BUY, args.value( 3 ) );
-    spruce_overseer->spruce->setOrderNiceMarketOffset( args.value( 1 ), SIDE_SELL, args.value( 4 ) );
-    spruce_overseer->spruce->setOrderNiceZeroBoundMarketOffset( args.value( 1 ), SIDE_SELL, args.value( 5 ) );
-
-    kDebug() << "buy nice offset:" << spruce_overseer->spruce->getOrderNiceMarketOffset( args.value( 1 ), SIDE_BUY )
-       << "buy zero bound offset:" << spruce_overseer->spruce->getOrderNiceZeroBoundMarketOffset( args.value( 1 ), SIDE_BUY )
-            << "sell nice offset:" << spruce_overseer->spruce->getOrderNiceMarketOffset( args.value( 1 ), SIDE_SELL )
-      << "sell zero bound offset:" << spruce_overseer->spruce->getOrderNiceZeroBoundMarketOffset( args.value( 1 ), SIDE_SELL );
+    kDebug() << "buy nice offset:" << spruce_overseer->getSelectedPortfolio()->getOrderNiceMarketOffset( args.value( 1 ), SIDE_BUY )
+       << "buy zero bound offset:" << spruce_overseer->getSelectedPortfolio()->getOrderNiceZeroBoundMarketOffset( args.value( 1 ), SIDE_BUY )
+            << "sell nice offset:" << spruce_overseer->getSelectedPortfolio()->getOrderNiceMarketOffset( args.value( 1 ), SIDE_SELL )
+      << "sell zero bound offset:" << spruce_overseer->getSelectedPortfolio()->getOrderNiceZeroBoundMarketOffset( args.value( 1 ), SIDE_SELL );
 }
 
 void CommandRunner::command_setspruceallocation( QStringList &args )
 {
-    if ( !checkArgs( args, 2 ) ) return;
-
-    spruce_overseer->spruce->setExchangeAllocation( args.value( 1 ),
+    spruce_overseer->getSelectedPortfolio()->setExchangeAllocation( args.value( 1 ),
                                                     Coin( args.value( 2 ) ) );
 }
 
 void CommandRunner::command_setsprucesnapback( QStringList &args )
 {
-    if ( !checkArgs( args, 2 ) ) return;
+    spruce_overseer->getSelectedPortfolio()->setSnapbackRatio( args.value( 1 ) );
+    spruce_overseer->getSelectedPortfolio()->setSnapbackExpiry( args.value( 2 ).toLongLong() );
 
-    spruce_overseer->spruce->setSnapbackRatio( args.value( 1 ) );
-    spruce_overseer->spruce->setSnapbackExpiry( args.value( 2 ).toLongLong() );
+    kDebug() << "spruce snapback ratio:" << spruce_overseer->getSelectedPortfolio()->getSnapbackRatio()
+                            << "expiry:" << spruce_overseer->getSelectedPortfolio()->getSnapbackExpiry();
+}
 
-    kDebug() << "spruce snapback ratio:" << spruce_overseer->spruce->getSnapbackRatio()
-                            << "expiry:" << spruce_overseer->spruce->getSnapbackExpiry();
+void CommandRunner::command_setspruceroute( QStringList &args )
+{
+    const Coin bound( args.value( 1 ) );
+    if ( bound.isLessThanZero() || bound >= CoinAmount::COIN )
+    {
+        kDebug() << "local error: the route bound is a ratio from 0 to under 1:" << args.value( 1 );
+        return;
+    }
+
+    spruce_overseer->getSelectedPortfolio()->setRouteBound( bound );
+    kDebug() << "spruce route bound:" << spruce_overseer->getSelectedPortfolio()->getRouteBound();
+
+    for ( QMap<qint32, SpruceRoute>::const_iterator i = spruce_overseer->m_routes.begin(); i != spruce_overseer->m_routes.end(); i++ )
+        kDebug() << "engine" << i.key() << "route weight" << i->weight << "p90" << i->p90 << "ms fill ratio" << i->fill_ratio
+                 << "queue" << i->queue_ratio;
+}
+
+void CommandRunner::command_setsprucesolvedeadline( QStringList &args )
+{
+    bool ok = false;
+    const qint64 deadline_ms = args.value( 1 ).toLongLong( &ok );
+    if ( !ok || deadline_ms < 0 )
+    {
+        kDebug() << "local error: the solve deadline is a number of ms, 0 to turn it off:" << args.value( 1 );
+        return;
+    }
+
+    spruce_overseer->getSelectedPortfolio()->setSolveDeadline( deadline_ms );
+    kDebug() << "spruce solve deadline:" << ( deadline_ms > 0 ? QString( "%1ms per phase" ).arg( deadline_ms ) : QString( "off" ) );
+}
+
+void CommandRunner::command_setsprucecostimage( QStringList &args )
+{
+    const bool use_image = args.value( 1 ) == "true" ? true : false;
+
+    spruce_overseer->getSelectedPortfolio()->setCostFunctionImage( use_image );
+    kDebug() << "spruce cost functions are" << ( use_image ? "read from images" : "evaluated" );
+}
+
+void CommandRunner::command_setspruceportfolio( QStringList &args )
+{
+    // the setspruce commands after this change the portfolio, "primary" goes back to the first one
+    if ( !spruce_overseer->selectPortfolio( args.value( 1 ) ) )
+        return;
+
+    kDebug() << "spruce portfolio is now" << args.value( 1 );
+}
+
+void CommandRunner::command_setspruceshadow( QStringList &args )
+{
+    const QString &name = args.value( 1 );
+
+    if ( args.value( 2 ) == "clear" )
+    {
+        if ( spruce_overseer->removeShadow( name ) )
+            kDebug() << "spruce shadow" << name << "cleared";
+        else
+            kDebug() << "local warning: no spruce shadow" << name;
+
+        return;
+    }
+
+    if ( args.size() > 2 )
+    {
+        kDebug() << "local warning: usage: setspruceshadow <name> [clear]";
+        return;
+    }
+
+    // the setspruce commands after this change the shadow, "setspruceportfolio primary" goes back
+    if ( !spruce_overseer->addShadow( name ) )
+        return;
+
+    kDebug() << "spruce portfolio is now shadow" << name;
+}
+
+void CommandRunner::command_getspruceshadows( QStringList & )
+{
+    if ( spruce_overseer->shadows.isEmpty() )
+    {
+        kDebug() << "no spruce shadows";
+        return;
+    }
+
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
+
+    for ( QMap<QString, SpruceShadow>::const_iterator i = spruce_overseer->shadows.begin(); i != spruce_overseer->shadows.end(); i++ )
+    {
+        const SpruceShadow &shadow = i.value();
+
+        kDebug() << QString( "%1 | pnl %2 | vol %3 | solves %4 | orders %5 | fills %6 | resting %7 | %8s" )
+                    .arg( i.key(), -12 )
+                    .arg( spruce_overseer->getShadowPnl( shadow ), 13 )
+                    .arg( shadow.volume, 13 )
+                    .arg( shadow.solves )
+                    .arg( shadow.orders_placed )
+                    .arg( shadow.fills )
+                    .arg( shadow.orders.size() )
+                    .arg( ( current_time - shadow.start_time ) / 1000 );
+
+        for ( QMap<QString,Coin>::const_iterator j = shadow.targets.begin(); j != shadow.targets.end(); j++ )
+            kDebug() << QString( "    %1 | target %2 | held %3" )
+                        .arg( j.key(), -MARKET_STRING_WIDTH )
+                        .arg( j.value(), 13 )
+                        .arg( shadow.quantity.value( j.key() ), 16 );
+    }
 }
 
 void CommandRunner::command_spruceup( QStringList & )
 {
-    spruce_overseer->onSpruceUp();
+    // run it on the main thread after this chunk releases our locks
+    QMetaObject::invokeMethod( spruce_overseer, "onSpruceUp", Qt::QueuedConnection );
 }
 
 void CommandRunner::command_getstatus( QStringList &args )
@@ -1036,7 +1601,7 @@ void CommandRunner::command_getconfig( QStringList &args )
     // print all market options
     if ( market.isEmpty() || market == ALL )
     {
-        for ( QHash<QString, MarketInfo>::iterator i = engine->getMarketInfoStructure().begin(); i != engine->getMarketInfoStructure().end(); i++ )
+        for ( MarketInfoTable::iterator i = engine->getMarketInfoStructure().begin(); i != engine->getMarketInfoStructure().end(); i++ )
         {
             kDebug() << QString( "%1 %2" )
                         .arg( i.key(), -10 )
@@ -1087,11 +1652,23 @@ void CommandRunner::command_getinternal( QStringList &args )
 
     kDebug() << "nam_queue size:" << rest->nam_queue.size();
     kDebug() << "nam_queue_sent size:" << rest->nam_queue_sent.size();
+    kDebug() << "coalesced status queries:" << rest->coalesced_request_count;
+    kDebug() << "server clock offset:" << rest->server_clock.getOffset() << "ms from" << rest->server_clock.getSampleCount() << "replies," << rest->clock_rejects_avoided << "rejects avoided";
+
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+    for ( quint8 c = 0; c < REQUEST_CLASS_COUNT; c++ )
+    {
+        const CircuitBreaker &breaker = rest->breakers.at( c );
+        static const char *const STATE_NAMES[] = { "closed", "open", "half-open" };
+
+        kDebug() << "breaker" << REQUEST_CLASS_NAMES[ c ] << STATE_NAMES[ breaker.getState( current_time ) ] << "for" << breaker.getWaitTime( current_time )
+                 << "ms," << breaker.getFailures() << "failures in a row," << breaker.getTripCount() << "trips";
+    }
     kDebug() << "orderbook_update_time:" << QDateTime::fromMSecsSinceEpoch( rest->orderbook_update_time ).toString();
     kDebug() << "orderbook_update_request_time:" << QDateTime::fromMSecsSinceEpoch( rest->orderbook_update_request_time ).toString();
     kDebug() << "ticker_update_time:" << QDateTime::fromMSecsSinceEpoch( rest->ticker_update_time ).toString();
     kDebug() << "ticker_update_request_time:" << QDateTime::fromMSecsSinceEpoch( rest->ticker_update_request_time ).toString();
-    kDebug() << "avg response time:" << rest->avg_response_time.avgResponseTime();
+    rest->response_times.print( "response time" );
     kDebug() << "orders_stale_trip_count: " << rest->orders_stale_trip_count;
     kDebug() << "books_stale_trip_count: " << rest->books_stale_trip_count;
     kDebug() << "request nonce:" << rest->request_nonce;
@@ -1100,6 +1677,81 @@ void CommandRunner::command_getinternal( QStringList &args )
     kDebug() << spruce_overseer->spruce->getMarketsBeta();
 }
 
+void CommandRunner::command_getlatency( QStringList &args )
+{
+    // getlatency [clear]
+    engine->printLatency();
+    rest_arr.value( engine_type )->response_times.print( "response time" );
+
+    if ( args.value( 1 ) == "clear" )
+    {
+        engine->getLatency().clear();
+        kDebug() << "latency histograms cleared";
+    }
+}
+
+void CommandRunner::command_getmemory( QStringList &args )
+{
+    Q_UNUSED( args )
+
+    using MemoryStats::formatBytes;
+
+    // getmemory
+    const qint64 engine_bytes = engine->printMemory();
+
+    const CostFunctionCache &cost_cache = spruce_overseer->spruce->getCostFunctionCache();
+    const qint32 cost_values = cost_cache.getRamCacheCount();
+    const qint64 cost_value_bytes = qint64( cost_values ) * qint64( sizeof( Coin ) + sizeof( CostFunctionKey ) + MemoryStats::HASH_NODE_OVERHEAD );
+    kDebug() << QString( "cost cache values: %1 in %2" ).arg( cost_values, -8 ).arg( formatBytes( cost_value_bytes ) );
+    kDebug() << QString( "cost images:       %1 in %2 mapped" ).arg( cost_cache.getImageCount(), -8 ).arg( formatBytes( cost_cache.getImageBytes() ) );
+
+    const qint64 log_bytes = LogRing::getBufferBytes();
+    const qint64 trace_bytes = qint64( TraceRing::SIZE ) * qint64( sizeof( TraceEvent ) );
+    kDebug() << QString( "log ring:          %1" ).arg( formatBytes( log_bytes ) );
+    kDebug() << QString( "trace ring:        %1" ).arg( formatBytes( trace_bytes ) );
+
+    // outside the estimates, counted as they're allocated
+    const qint64 gmp_bytes = MemoryStats::getGmpBytes() + MemoryStats::getGmpPoolBytes();
+    kDebug() << QString( "gmp limbs:         %1 peak %2, %3 allocations" ).arg( formatBytes( MemoryStats::getGmpBytes() ) )
+                                                                         .arg( formatBytes( MemoryStats::getGmpPeakBytes() ) )
+                                                                         .arg( MemoryStats::getGmpAllocations() );
+    kDebug() << QString( "gmp pools:         %1 free, %2 allocations reused" ).arg( formatBytes( MemoryStats::getGmpPoolBytes() ) )
+                                                                              .arg( MemoryStats::getGmpPoolHits() );
+
+    kDebug() << QString( "estimated total:   %1, resident %2" ).arg( formatBytes( engine_bytes + cost_value_bytes + log_bytes + trace_bytes + gmp_bytes ) )
+                                                              .arg( formatBytes( MemoryStats::getResidentBytes() ) );
+}
+
+void CommandRunner::command_savetrace( QStringList &args )
+{
+    // savetrace [clear]
+    const QByteArray trace = TraceRing::toChromeTrace();
+    const QString path = Global::getTracePath( QDateTime::currentMSecsSinceEpoch() );
+
+    engine->getSaver()->save( path, [path, trace]() { return AsyncSaver::writeFile( path, trace ); },
+                              [path]( bool ok )
+    {
+        if ( ok )
+            kDebug() << "saved trace to" << path;
+        else
+            kDebug() << "local error: couldn't save trace to" << path;
+    } );
+
+    if ( args.value( 1 ) == "clear" )
+    {
+        TraceRing::clear();
+        kDebug() << "trace spans cleared";
+    }
+}
+
+void CommandRunner::command_settracing( QStringList &args )
+{
+    const bool enabled = args.value( 1 ) == "true" ? true : false;
+
+    TraceRing::setEnabled( enabled );
+    kDebug() << "tracing set to" << enabled;
+}
+
 void CommandRunner::command_setmaintenancetime( QStringList &args )
 {
     qint64 time = args.value( 1 ).toLongLong();
@@ -1126,6 +1778,16 @@ void CommandRunner::command_savemarket( QStringList &args )
     engine->saveMarket( Market( args.value( 1 ) ), args.value( 2 ).toInt() );
 }
 
+void CommandRunner::command_savesnapshot( QStringList &args )
+{
+    engine->saveSnapshot( Market( args.value( 1 ) ) );
+}
+
+void CommandRunner::command_loadsnapshot( QStringList &args )
+{
+    engine->loadSnapshot( Market( args.value( 1 ) ) );
+}
+
 void CommandRunner::command_savesettings( QStringList &args )
 {
     Q_UNUSED( args )
@@ -1146,8 +1808,6 @@ void CommandRunner::command_sendcommand( QStringList &args )
 
 void CommandRunner::command_setchatty( QStringList &args )
 {
-    if ( !checkArgs( args, 1 ) ) return;
-
     bool chatty = args.value( 1 ) == "true" ? true : false;
 
     engine->getSettings()->is_chatty = chatty;
@@ -1,15 +1,17 @@
 #ifndef COMMANDRUNNER_H
 #define COMMANDRUNNER_H
 
-#include <functional>
-
 #include <QObject>
 #include <QString>
 #include <QStringList>
 #include <QVector>
 #include <QMap>
+#include <QByteArray>
+
+#include "positionsnapshot.h"
 
 class Engine;
+class Position;
 class Spruce;
 class SpruceOverseer;
 class BaseREST;
@@ -18,6 +20,7 @@ class BncREST;
 class PoloREST;
 class WavesREST;
 class Stats;
+struct PositionSpec;
 
 class CommandRunner : public QObject
 {
@@ -29,26 +32,55 @@ public:
     explicit CommandRunner( const quint8 _engine_type, Engine *_e, QVector<BaseREST *> _rest_arr, QObject *parent = nullptr );
     ~CommandRunner();
 
+    void setSpruceOverseer( SpruceOverseer *_spruce_overseer ) { spruce_overseer = _spruce_overseer; }
+
 signals:
     void exitSignal();
 
 public slots:
-    void runCommandChunk( QString &s );
+    void runCommandChunk( const QString &s );
+    void runCommandFrame( const QByteArray &frame ); // binary commands from the engine type on, see ipcprotocol.h
 
 private:
+    struct QueuedCommand
+    {
+        qint32 id{ -1 }; // in command_by_id, -1 if unknown
+        QStringList args; // the command name first
+    };
+
+    struct CommandInfo
+    {
+        const char *name;
+        void ( CommandRunner::*run )( QStringList &args );
+        qint8 args_min; // for checkArgs(), -1 if the command checks its own
+        qint8 args_max;
+    };
+
+    static const CommandInfo COMMANDS[];
+    static const qint32 COMMAND_COUNT;
+
+    void runCommands( QVector<QueuedCommand> &commands );
+    void buildCommandSlots();
+    qint32 getCommandId( const QString &name ) const; // -1 if unknown
     bool checkArgs( const QStringList &args, qint32 expected_args_min, qint32 expected_args_max = -1 ); // -1 sets max=min
+    void parseSetOrder( const QStringList &args, PositionSpec &spec ); // args checked by runCommands()
+    void startQuery( const QString &name, const QString &market, const bool active_only, const bool by_index );
+    void printQueryChunk(); // prints the next chunk of the query and yields to the event loop until it's done
 
     void command_getbalances( QStringList &args );
+    void command_getledger( QStringList &args );
     void command_getlastprices( QStringList &args );
     void command_getbuyselltotal( QStringList &args );
     void command_cancelall( QStringList &args );
     void command_cancellocal( QStringList &args );
+    void command_flatten( QStringList &args );
     void command_cancelhighest( QStringList &args );
     void command_cancellowest( QStringList &args );
     void command_getorders( QStringList &args );
     void command_getpositions( QStringList &args );
     void command_getordersbyindex( QStringList &args );
     void command_setorder( QStringList &args );
+    void command_setgrid( QStringList &args );
     void command_setordermin( QStringList &args );
     void command_setordermax( QStringList &args );
     void command_setorderdc( QStringList &args );
@@ -74,6 +106,9 @@ private:
     void command_setnaminterval( QStringList &args );
     void command_setbookinterval( QStringList &args );
     void command_settickerinterval( QStringList &args );
+    void command_setwavestickerbatch( QStringList &args );
+    void command_setwaveshistoryfills( QStringList &args );
+    void command_setwavesjwt( QStringList &args );
     void command_setgracetimelimit( QStringList &args );
     void command_setcheckinterval( QStringList &args );
     void command_setdcinterval( QStringList &args );
@@ -89,9 +124,15 @@ private:
     void command_setqueuedcommandsmax( QStringList &args );
     void command_setqueuedcommandsmaxdc( QStringList &args );
     void command_setsentcommandsmax( QStringList &args );
+    void command_setflowtuning( QStringList &args );
+    void command_sethttp2( QStringList &args );
+    void command_setrecording( QStringList &args );
+    void command_setpaperlatency( QStringList &args );
+    void command_setpaperfillmodel( QStringList &args );
     void command_settimeoutyield( QStringList &args );
     void command_setrequesttimeout( QStringList &args );
     void command_setcanceltimeout( QStringList &args );
+    void command_setadaptivetimeout( QStringList &args );
     void command_setslippagetimeout( QStringList &args );
     void command_setspruceinterval( QStringList &args );
     void command_setsprucebasecurrency( QStringList &args );
@@ -100,6 +141,9 @@ private:
     void command_setspruceshortlongtotal( QStringList &args );
     void command_setsprucebetamarket( QStringList &args );
     void command_setspruceamplification( QStringList &args );
+    void command_setsprucesolver( QStringList &args );
+    void command_setsprucetrigger( QStringList &args );
+    void command_setsprucewarmstart( QStringList &args );
     void command_setspruceprofile( QStringList &args );
     void command_setsprucereserve( QStringList &args );
     void command_setspruceordergreed( QStringList &args );
@@ -109,21 +153,41 @@ private:
     void command_setspruceordernicemarketoffset( QStringList &args );
     void command_setspruceallocation( QStringList &args );
     void command_setsprucesnapback( QStringList &args );
+    void command_setspruceroute( QStringList &args );
+    void command_setsprucesolvedeadline( QStringList &args );
+    void command_setsprucecostimage( QStringList &args );
+    void command_setspruceportfolio( QStringList &args );
+    void command_setspruceshadow( QStringList &args );
+    void command_getspruceshadows( QStringList &args );
     void command_spruceup( QStringList &args );
 
     void command_getstatus( QStringList &args );
     void command_getconfig( QStringList &args );
     void command_getinternal( QStringList &args );
+    void command_getlatency( QStringList &args );
+    void command_getmemory( QStringList &args );
+    void command_savetrace( QStringList &args );
+    void command_settracing( QStringList &args );
     void command_setmaintenancetime( QStringList &args );
     void command_clearallstats( QStringList &args );
     void command_savemarket( QStringList &args );
+    void command_savesnapshot( QStringList &args );
+    void command_loadsnapshot( QStringList &args );
     void command_savesettings( QStringList &args );
     void command_savestats( QStringList &args );
     void command_sendcommand( QStringList &args );
     void command_setchatty( QStringList &args );
     void command_exit( QStringList &args );
 
-    QMap<QString, std::function<void(QStringList&)>> command_map;
+    QVector<const CommandInfo*> command_by_id; // the binary protocol's ids and then the rest, nullptr for ids we don't have
+    QVector<qint16> command_slots; // ids by name hash, -1 for empty
+    uint command_seed{ 0 };
+    qint32 setorder_id{ -1 };
+
+    PositionSnapshotPtr query_snapshot; // what getorders/getpositions print from, held until they're done
+    QVector<const PositionSnapshotEntry*> query_entries; // in query_snapshot, the output still to print
+    qint32 query_next{ 0 };
+    QString query_name;
 
     QVector<BaseREST*> rest_arr;
     quint8 engine_type{ 0 };
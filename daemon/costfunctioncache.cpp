@@ -1,124 +1,406 @@
 #include "costfunctioncache.h"
 #include "coinamount.h"
 #include "global.h"
+#include "tracespan.h"
+#include "threadplacement.h"
 
 #include <QDateTime>
 #include <QByteArray>
 #include <QDir>
 #include <QFile>
-#include <QDataStream>
-#include <QCache>
+#include <QVector>
+#include <QThreadPool>
+#include <QRunnable>
+
+// fnv-1a over the y values, to catch truncated or corrupted images
+static quint64 imageChecksum( const qint64 *y, const qint64 count )
+{
+    quint64 hash = 14695981039346656037ULL;
+    for ( qint64 i = 0; i < count; i++ )
+    {
+        hash ^= static_cast<quint64>( y[ i ] );
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// validates an existing image, or regenerates it, on a pool thread
+class CostFunctionWarmUp : public QRunnable
+{
+public:
+    CostFunctionWarmUp( const CostFunctionCache *_cache, const QString &_file_path, const CostFunctionImageHeader &_header, const Coin &_profile_u, const Coin &_reserve )
+        : cache( _cache ),
+        file_path( _file_path ),
+        header( _header ),
+        profile_u( _profile_u ),
+        reserve( _reserve )
+    {
+    }
+
+    void run() override
+    {
+        ThreadPlacement::apply( ThreadPlacement::ROLE_SOLVER );
+        CostFunctionImage *image = cache->mapImage( file_path, header );
+        if ( image )
+        {
+            delete image;
+            return;
+        }
+
+        cache->regenerateImage( file_path, header, profile_u, reserve );
+    }
+
+private:
+    const CostFunctionCache *cache;
+    const QString file_path;
+    const CostFunctionImageHeader header;
+    const Coin profile_u, reserve;
+};
 
 CostFunctionCache::CostFunctionCache()
 {
-    m_ticksize = Coin( "0.0001" );
+    m_ticksize = 0.0001_coin;
     m_max_x = CoinAmount::COIN * 100;
+    m_cache.setMaxCost( MAX_RAM_CACHE );
+}
+
+CostFunctionCache::~CostFunctionCache()
+{
+    // deleting the files unmaps them
+    qDeleteAll( m_images );
+    m_images.clear();
 }
 
 Coin CostFunctionCache::getY( const Coin &profile_u, const Coin &reserve, const Coin &x )
 {
-    static const int MAX_RAM_CACHE = 20000; // how many values
-    static const int FIELD_SIZE = 10;
-    static const QString pre_path = Global::getCostFunctionCachePath() + QDir::separator() + "cf-";
-    const int projected_file_size = ( ( m_max_x / m_ticksize ).toInt() +1 ) * FIELD_SIZE; // +1 for zero
+    // index of y = x / m_tick_size;
+    CostFunctionKey key;
+    qint64 x_raw, ticksize_raw;
+    if ( !profile_u.toRawInt64( key.profile_u ) || !reserve.toRawInt64( key.reserve ) ||
+         !x.toRawInt64( x_raw ) || !m_ticksize.toRawInt64( ticksize_raw ) || x_raw < 0 )
+    {
+        kDebug() << "[Spruce] local error: x" << x << "is out of range for cost function, profile" << profile_u << "reserve" << reserve;
+        return Coin();
+    }
+    key.x_index = x_raw / ticksize_raw;
 
-    static_assert( MAX_RAM_CACHE > 1000 );
+    QMutexLocker lock( &m_mutex );
 
     /// step 1: check if it's in the cache
-    QString tag = profile_u.toAmountString() + reserve.toAmountString();
-    QString tag_with_x = tag + x;
-    if ( m_cache.contains( tag_with_x ) )
-        return m_cache.value( tag_with_x );
+    const Coin *cached = m_cache.object( key );
+    if ( cached )
+    {
+        m_cache_hits++;
+        return *cached;
+    }
 
-    /// step 2: create cache file if it doesn't exist
-    // check for existing file with wrong size
-    QString file_path = pre_path + tag;
+    m_cache_misses++;
 
-    QFile f( file_path );
-    if ( f.exists() && f.size() != projected_file_size )
+    /// step 2: read it from the image, or evaluate the closed form
+    const Coin y = m_use_image ? getYFromImage( profile_u, reserve, key ) : getYAnalytic( profile_u, reserve, key.x_index );
+
+    // insert into cache, don't remember errors (zero is only valid at the origin)
+    if ( y.isGreaterThanZero() || key.x_index == 0 )
+        m_cache.insert( key, new Coin( y ) );
+
+    return y;
+}
+
+Coin CostFunctionCache::getYFromImage( const Coin &profile_u, const Coin &reserve, const CostFunctionKey &key )
+{
+    CostFunctionImage *image = getImage( profile_u, reserve, key );
+    if ( !image )
+        return Coin();
+
+    if ( key.x_index >= image->count )
+    {
+        kDebug() << "[Spruce] local error: index" << key.x_index << "is out of range for cost function image" << image->file.fileName();
+        return Coin();
+    }
+
+    const Coin y = CoinRaw{ image->y[ key.x_index ] };
+
+    // if it's a bad value, return 0
+    if ( y.isLessThanZero() || y >= CoinAmount::COIN )
     {
-        kDebug() << "[Spruce] deleted file for wrong size" << f.size();
+        kDebug() << "[Spruce] local error: read bad y value" << y << "at index" << key.x_index << "in cache file" << image->file.fileName();
+        return Coin();
+    }
+
+    return y;
+}
+
+Coin CostFunctionCache::getYAnalytic( const Coin &profile_u, const Coin &reserve, const qint64 n ) const
+{
+    // the image recurrence y += ( 1 - reserve - y ) * profile is geometric, so the nth step is
+    // y = ( 1 - reserve ) * ( 1 - ( 1 - profile )^n ). the power is exact and the product rounds once, while the
+    // image rounds down on every step. that leaves the image up to 1 / profile subsatoshis lower, so after the
+    // truncation to satoshis the two agree or the image is a satoshi lower
+    const Coin limit = CoinAmount::COIN - reserve;
+    const Coin profile = m_ticksize * 10 / profile_u;
+    Coin y = limit * ( CoinAmount::COIN - ( CoinAmount::COIN - profile ).pow( quint64( n ) ) );
+
+    // the power rounds down to zero far out, where the image has stalled a satoshi under the limit instead
+    if ( y >= limit )
+        y = limit - CoinAmount::SATOSHI;
 
-        // delete the file
-        bool was_deleted = f.remove();
-        if ( !was_deleted )
-            kDebug() << "[Spruce] local error: failed to delete file" << file_path;
+    // match the satoshi precision of the images
+    y.truncateByDecimals( CoinAmount::satoshi_decimals );
 
+    // if it's a bad value, return 0
+    if ( y.isLessThanZero() )
+    {
+        kDebug() << "[Spruce] local error: bad y value" << y << "for profile" << profile_u << "reserve" << reserve << "at index" << n;
         return Coin();
     }
 
-    // check for non-existant cache file
-    if ( !f.exists() )
+    return y;
+}
+
+void CostFunctionCache::warmUp( const QList<QPair<Coin,Coin>> &profiles )
+{
+    qint64 t0 = QDateTime::currentMSecsSinceEpoch();
+
+    // the closed form doesn't need any images
+    if ( !m_use_image )
+        return;
+
+    QThreadPool pool;
+    QList<QPair<Coin,Coin>> queued;
+
+    // generate or validate each missing image concurrently
+    for ( QList<QPair<Coin,Coin>>::const_iterator i = profiles.begin(); i != profiles.end(); i++ )
+    {
+        const Coin &profile_u = i->first;
+        const Coin &reserve = i->second;
+        CostFunctionImageHeader header;
+
+        if ( queued.contains( *i ) || !fillHeader( header, profile_u, reserve ) ||
+             m_images.contains( QPair<qint64,qint64>( header.profile_u, header.reserve ) ) )
+            continue;
+
+        removeLegacyImage( profile_u, reserve );
+        pool.start( new CostFunctionWarmUp( this, getImagePath( profile_u, reserve ), header, profile_u, reserve ) );
+        queued += *i;
+    }
+
+    pool.waitForDone();
+
+    // map them on this thread
+    for ( QList<QPair<Coin,Coin>>::const_iterator i = queued.begin(); i != queued.end(); i++ )
     {
-        // open file
-        if ( !f.open( QIODevice::WriteOnly | QIODevice::Text ) )
+        CostFunctionImageHeader header;
+        fillHeader( header, i->first, i->second );
+
+        CostFunctionImage *image = mapImage( getImagePath( i->first, i->second ), header );
+        if ( !image )
         {
-            kDebug() << "[Spruce] local error: couldn't open savemarket file" << file_path;
-            return Coin();
+            kDebug() << "[Spruce] local error: couldn't warm up cost function image for profile" << i->first << "reserve" << i->second;
+            continue;
         }
 
-        // create byte stream to write to file
-        QTextStream f_out( &f );
+        QMutexLocker lock( &m_mutex );
+        m_images.insert( QPair<qint64,qint64>( header.profile_u, header.reserve ), image );
+    }
+
+    kDebug() << "[Spruce] warmed up" << queued.size() << "cost function images using" << pool.maxThreadCount()
+             << "threads, took" << QDateTime::currentMSecsSinceEpoch() - t0 << "ms.";
+}
+
+qint32 CostFunctionCache::getRamCacheCount() const
+{
+    QMutexLocker lock( &m_mutex );
+    return m_cache.size();
+}
+
+qint32 CostFunctionCache::getImageCount() const
+{
+    QMutexLocker lock( &m_mutex );
+    return m_images.size();
+}
+
+qint64 CostFunctionCache::getImageBytes() const
+{
+    QMutexLocker lock( &m_mutex );
+
+    qint64 bytes = 0;
+    for ( QHash<QPair<qint64,qint64>,CostFunctionImage*>::const_iterator i = m_images.begin(); i != m_images.end(); i++ )
+        if ( i.value() )
+            bytes += qint64( sizeof( CostFunctionImageHeader ) ) + i.value()->count * qint64( sizeof( qint64 ) );
+
+    return bytes;
+}
+
+QString CostFunctionCache::getImagePath( const Coin &profile_u, const Coin &reserve ) const
+{
+    return Global::getCostFunctionCachePath() + QDir::separator() + "cf-" + profile_u.toAmountString() + reserve.toAmountString() + ".bin";
+}
+
+void CostFunctionCache::removeLegacyImage( const Coin &profile_u, const Coin &reserve ) const
+{
+    // remove the old text image if it's still around
+    const QString legacy_path = Global::getCostFunctionCachePath() + QDir::separator() + "cf-" + profile_u.toAmountString() + reserve.toAmountString();
+    if ( QFile::exists( legacy_path ) )
+        QFile::remove( legacy_path );
+}
+
+CostFunctionImage *CostFunctionCache::getImage( const Coin &profile_u, const Coin &reserve, const CostFunctionKey &key )
+{
+    /// step 1: check if it's already mapped
+    const QPair<qint64,qint64> image_key( key.profile_u, key.reserve );
+    CostFunctionImage *image = m_images.value( image_key, nullptr );
+    if ( image )
+        return image;
+
+    // mapping or writing the image is the only disk access on a solve
+    TRACE_SPAN( "costFunctionImage" );
+
+    CostFunctionImageHeader header;
+    if ( !fillHeader( header, profile_u, reserve ) )
+    {
+        kDebug() << "[Spruce] local error: cost function parameters too large for image" << profile_u << reserve;
+        return nullptr;
+    }
+
+    const QString file_path = getImagePath( profile_u, reserve );
+    removeLegacyImage( profile_u, reserve );
 
-        kDebug() << "[Spruce] generating cost function image for profile" << profile_u << "...";
-        qint64 t0 = QDateTime::currentMSecsSinceEpoch();
+    /// step 2: map the existing image, or (re)generate it if it's missing or doesn't match
+    image = mapImage( file_path, header );
+    if ( !image )
+    {
+        if ( !regenerateImage( file_path, header, profile_u, reserve ) )
+            return nullptr;
 
-        // y += ( 1 - y ) * profile_u;
-        Coin y;
-        const Coin profile = m_ticksize * 10 / profile_u;
-        int bytes_written = 0;
-        QString data;
-        for ( Coin x; x <= m_max_x; x += m_ticksize /*granularity to find y*/ )
+        image = mapImage( file_path, header );
+        if ( !image )
         {
-            if ( !x.isZero() ) // don't skip zero, just set zero to zero
-                y += ( CoinAmount::COIN - reserve - y ) * profile;
+            kDebug() << "[Spruce] local error: couldn't map cost function image" << file_path;
+            return nullptr;
+        }
+    }
 
-            data = QString( "%1" )
-                    .arg( y.toAmountString(), -FIELD_SIZE );
+    m_images.insert( image_key, image );
+    return image;
+}
+
+bool CostFunctionCache::fillHeader( CostFunctionImageHeader &header, const Coin &profile_u, const Coin &reserve ) const
+{
+    header.magic = CostFunctionImageHeader::MAGIC;
+    header.version = CostFunctionImageHeader::VERSION;
+    header.checksum = 0;
+
+    if ( !profile_u.toRawInt64( header.profile_u ) ||
+         !reserve.toRawInt64( header.reserve ) ||
+         !m_ticksize.toRawInt64( header.ticksize ) ||
+         !m_max_x.toRawInt64( header.max_x ) ||
+         header.ticksize <= 0 )
+        return false;
+
+    header.count = header.max_x / header.ticksize +1; // +1 for zero
+    return true;
+}
+
+bool CostFunctionCache::regenerateImage( const QString &file_path, const CostFunctionImageHeader &header, const Coin &profile_u, const Coin &reserve ) const
+{
+    if ( QFile::exists( file_path ) && !QFile::remove( file_path ) )
+    {
+        kDebug() << "[Spruce] local error: failed to delete file" << file_path;
+        return false;
+    }
+
+    return writeImage( file_path, header, profile_u, reserve );
+}
+
+bool CostFunctionCache::writeImage( const QString &file_path, CostFunctionImageHeader header, const Coin &profile_u, const Coin &reserve ) const
+{
+    kDebug() << "[Spruce] generating cost function image for profile" << profile_u << "...";
+    qint64 t0 = QDateTime::currentMSecsSinceEpoch();
+
+    // y += ( 1 - y ) * profile_u;
+    QVector<qint64> data( header.count );
+    qint64 *out = data.data();
+    Coin y, y_stored;
+    const Coin profile = m_ticksize * 10 / profile_u;
+    qint64 idx = 0;
+    for ( Coin x; x <= m_max_x && idx < header.count; x += m_ticksize /*granularity to find y*/ )
+    {
+        if ( !x.isZero() ) // don't skip zero, just set zero to zero
+            y += ( CoinAmount::COIN - reserve - y ) * profile;
 
-            f_out << data;
-            bytes_written += data.size();
+        // store at satoshi precision, like the text images did
+        y_stored = y;
+        y_stored.truncateByDecimals( CoinAmount::satoshi_decimals );
+        if ( !y_stored.toRawInt64( out[ idx++ ] ) )
+        {
+            kDebug() << "[Spruce] local error: cost function y value out of range" << y;
+            return false;
         }
-        kDebug() << "[Spruce] done generating image," << bytes_written <<
-                    "bytes. took" << QDateTime::currentMSecsSinceEpoch() - t0 << "ms.";
+    }
 
-        f_out.flush();
-        f.close();
+    header.checksum = imageChecksum( out, header.count );
+
+    QFile f( file_path );
+    if ( !f.open( QIODevice::WriteOnly ) )
+    {
+        kDebug() << "[Spruce] local error: couldn't open cost function image" << file_path;
+        return false;
     }
 
-    /// step 3: open the cache file and cache our value into ram
-    // index of y = x / m_tick_size;
-    int y_idx = ( x / m_ticksize ).toInt();
+    const qint64 data_size = header.count * qint64( sizeof( qint64 ) );
+    const bool ok = f.write( reinterpret_cast<const char*>( &header ), sizeof( header ) ) == qint64( sizeof( header ) ) &&
+                    f.write( reinterpret_cast<const char*>( out ), data_size ) == data_size;
+    f.close();
 
-    // open file
-    if ( !f.open( QIODevice::ReadOnly ) )
+    if ( !ok )
     {
-        kDebug() << "[Spruce] local error: couldn't open savemarket file" << file_path;
-        return Coin();
+        kDebug() << "[Spruce] local error: couldn't write cost function image" << file_path;
+        f.remove();
+        return false;
     }
 
-    // read field
-    f.seek( FIELD_SIZE * y_idx );
-    QByteArray y_data = f.read( FIELD_SIZE );
+    kDebug() << "[Spruce] done generating image," << sizeof( header ) + data_size <<
+                "bytes. took" << QDateTime::currentMSecsSinceEpoch() - t0 << "ms.";
+
+    return true;
+}
 
-    Coin y = QString::fromLocal8Bit( y_data );
+CostFunctionImage *CostFunctionCache::mapImage( const QString &file_path, const CostFunctionImageHeader &header ) const
+{
+    const qint64 projected_file_size = qint64( sizeof( header ) ) + header.count * qint64( sizeof( qint64 ) );
 
-    // if it's a bad value, return 0
-    if ( y.isLessThanZero() || y >= CoinAmount::COIN )
+    CostFunctionImage *image = new CostFunctionImage;
+    image->file.setFileName( file_path );
+
+    if ( !image->file.exists() || image->file.size() != projected_file_size || !image->file.open( QIODevice::ReadOnly ) )
     {
-        kDebug() << "[Spruce] local error: read bad y value" << y << "at index" << y_idx << "in cache file" << file_path;
-        return Coin();
+        delete image;
+        return nullptr;
     }
 
-    // insert into cache
-    m_cache.insert( tag_with_x, y );
+    const uchar *mem = image->file.map( 0, projected_file_size );
+    const CostFunctionImageHeader *mapped_header = reinterpret_cast<const CostFunctionImageHeader*>( mem );
 
-    // check if cache is too full
-    if ( m_cache.size() > MAX_RAM_CACHE + 500 )
+    // make sure the image was generated with the same version and parameters
+    if ( !mem ||
+         mapped_header->magic != header.magic ||
+         mapped_header->version != header.version ||
+         mapped_header->profile_u != header.profile_u ||
+         mapped_header->reserve != header.reserve ||
+         mapped_header->ticksize != header.ticksize ||
+         mapped_header->max_x != header.max_x ||
+         mapped_header->count != header.count ||
+         mapped_header->checksum != imageChecksum( reinterpret_cast<const qint64*>( mem + sizeof( header ) ), header.count ) )
     {
-        for ( int i = 0; i < 500; i++ )
-            m_cache.remove( *m_cache.keyBegin() );
+        kDebug() << "[Spruce] cost function image" << file_path << "doesn't match, regenerating";
+        delete image;
+        return nullptr;
     }
 
-    return y;
+    image->y = reinterpret_cast<const qint64*>( mem + sizeof( header ) );
+    image->count = header.count;
+    image->file.close(); // the mapping stays valid until the QFile is destroyed
+
+    return image;
 }
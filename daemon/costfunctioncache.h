@@ -4,20 +4,102 @@
 #include "coinamount.h"
 
 #include <QString>
+#include <QHash>
 #include <QCache>
+#include <QPair>
+#include <QFile>
+#include <QList>
+#include <QVector>
+#include <QMutex>
+
+#include <atomic>
+
+// identifies a point on a cost curve by the raw subsatoshi profile_u and reserve, and the ticksize index of x
+struct CostFunctionKey
+{
+    qint64 profile_u{ 0 }, reserve{ 0 }, x_index{ 0 };
+
+    bool operator ==( const CostFunctionKey &other ) const
+    {
+        return x_index == other.x_index && profile_u == other.profile_u && reserve == other.reserve;
+    }
+};
+
+inline uint qHash( const CostFunctionKey &key, uint seed = 0 )
+{
+    return qHash( key.x_index, seed ) ^ ( qHash( key.profile_u, seed ) * 31u ) ^ ( qHash( key.reserve, seed ) * 1031u );
+}
+
+// header of a binary cost function image, followed by 'count' raw subsatoshi y values (qint64, host byte order)
+struct CostFunctionImageHeader
+{
+    static const quint32 MAGIC = 0x49464354; // "TCFI"
+    static const quint32 VERSION = 2;
+
+    quint32 magic;
+    quint32 version;
+    qint64 profile_u, reserve, ticksize, max_x; // raw subsatoshis
+    qint64 count;
+    quint64 checksum; // of the y values
+};
+
+// an image that stays mapped for the lifetime of the cache
+struct CostFunctionImage
+{
+    QFile file;
+    const qint64 *y{ nullptr };
+    qint64 count{ 0 };
+};
 
 class CostFunctionCache
 {
 public:
     explicit CostFunctionCache();
+    ~CostFunctionCache();
 
     Coin getY( const Coin &profile_u, const Coin &reserve, const Coin &x );
+    // generates or validates the images for each ( profile_u, reserve ) pair concurrently, blocking until they're mapped
+    void warmUp( const QList<QPair<Coin,Coin>> &profiles );
     const Coin &getTicksize() const { return m_ticksize; }
     const Coin &getMaxX() const { return m_max_x; }
 
+    // use the generated images instead of evaluating the curve directly
+    void setUseImage( const bool use_image ) { QMutexLocker lock( &m_mutex ); m_use_image = use_image; m_cache.clear(); }
+    bool getUseImage() const { return m_use_image; }
+
+    // lookup stats of the ram cache since construction
+    quint64 getCacheHits() const { return m_cache_hits.load( std::memory_order_relaxed ); }
+    quint64 getCacheMisses() const { return m_cache_misses.load( std::memory_order_relaxed ); }
+
+    // what's held, for getmemory. the images are mapped files, the kernel pages them in and out
+    qint32 getRamCacheCount() const;
+    qint32 getImageCount() const;
+    qint64 getImageBytes() const;
+
 private:
+    friend class CostFunctionCacheTest;
+
+    static const int MAX_RAM_CACHE = 20000; // how many values
+
+    Coin getYAnalytic( const Coin &profile_u, const Coin &reserve, const qint64 n ) const;
+    Coin getYFromImage( const Coin &profile_u, const Coin &reserve, const CostFunctionKey &key );
+    CostFunctionImage *getImage( const Coin &profile_u, const Coin &reserve, const CostFunctionKey &key );
+    QString getImagePath( const Coin &profile_u, const Coin &reserve ) const;
+    void removeLegacyImage( const Coin &profile_u, const Coin &reserve ) const;
+    bool fillHeader( CostFunctionImageHeader &header, const Coin &profile_u, const Coin &reserve ) const;
+
+    // these are called from warm up threads, and must not touch any members except the ticksize and max_x
+    friend class CostFunctionWarmUp;
+    bool regenerateImage( const QString &file_path, const CostFunctionImageHeader &header, const Coin &profile_u, const Coin &reserve ) const;
+    bool writeImage( const QString &file_path, CostFunctionImageHeader header, const Coin &profile_u, const Coin &reserve ) const;
+    CostFunctionImage *mapImage( const QString &file_path, const CostFunctionImageHeader &header ) const;
+
     Coin m_ticksize, m_max_x;
-    QHash<QString,Coin> m_cache;
+    bool m_use_image{ true };
+    QHash<QPair<qint64,qint64>,CostFunctionImage*> m_images;
+    QCache<CostFunctionKey,Coin> m_cache; // least recently used values are evicted first
+    std::atomic<quint64> m_cache_hits{ 0 }, m_cache_misses{ 0 }; // read by the metrics scrape without the mutex
+    mutable QMutex m_mutex; // guards m_cache and m_images, spruce phases share the cache while solving concurrently
 };
 
 #endif // COSTFUNCTIONCACHE_H
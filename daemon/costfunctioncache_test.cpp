@@ -0,0 +1,57 @@
+#include "costfunctioncache_test.h"
+#include "costfunctioncache.h"
+#include "coinamount.h"
+
+#include <QFile>
+#include <QList>
+
+#include <assert.h>
+
+void CostFunctionCacheTest::test()
+{
+    /// test that the closed form is within a satoshi of the image at every index, with the default reserve and with none
+    const Coin profile_u( "10" );
+    const QList<Coin> reserves = QList<Coin>() << Coin( "0.01" ) << Coin();
+
+    for ( QList<Coin>::const_iterator r = reserves.begin(); r != reserves.end(); r++ )
+    {
+        const Coin &reserve = *r;
+
+        CostFunctionCache image, analytic;
+        analytic.setUseImage( false );
+
+        const QString path = image.getImagePath( profile_u, reserve );
+        const bool is_existing = QFile::exists( path );
+
+        const Coin y_limit = CoinAmount::COIN - reserve;
+        Coin x, y_last;
+        qint64 count = 0, differ_count = 0;
+        for ( ; x <= image.getMaxX(); x += image.getTicksize() )
+        {
+            const Coin y = analytic.getY( profile_u, reserve, x );
+            const Coin y_image = image.getY( profile_u, reserve, x );
+
+            // the image rounds down on every step, so it can only be a satoshi lower
+            assert( y == y_image || y == y_image + CoinAmount::SATOSHI );
+            if ( y != y_image )
+                differ_count++;
+
+            // it only rises and never reaches 1 - reserve, or zero past the origin
+            assert( y >= y_last && y < y_limit );
+            assert( count == 0 || y.isGreaterThanZero() );
+            y_last = y;
+            count++;
+        }
+
+        // a few indices right under a satoshi, out of a million
+        assert( differ_count < count / 10000 );
+
+        // both end a satoshi under the limit
+        assert( y_last == y_limit - CoinAmount::SATOSHI );
+        assert( image.getY( profile_u, reserve, image.getMaxX() ) == y_last );
+
+        // don't leave test images around
+        if ( !is_existing )
+            QFile::remove( path );
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef COSTFUNCTIONCACHE_TEST_H
+#define COSTFUNCTIONCACHE_TEST_H
+
+struct CostFunctionCacheTest
+{
+    void test();
+};
+
+#endif // COSTFUNCTIONCACHE_TEST_H
@@ -9,8 +9,22 @@
 #include "market.h"
 #include "alphatracker.h"
 #include "spruce.h"
+#include "bbocache.h"
+#include "marketrecorder.h"
+#include "paperexchange.h"
+#include "virtualclock.h"
+#include "asyncsaver.h"
+#include "orderjournal.h"
+#include "settingsstate.h"
+#include "metrics.h"
+#include "tracespan.h"
+#include "memorystats.h"
+#include "marketevents.h"
+#include "taskscheduler.h"
+#include "eventfeed.h"
 
 #include <algorithm>
+#include <cctype>
 #include <QtMath>
 #include <QVector>
 #include <QSet>
@@ -23,6 +37,45 @@
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QTimer>
+#include <QDataStream>
+
+// binary market snapshot, see Engine::saveSnapshot()
+static const quint32 SNAPSHOT_MAGIC = 0x5053544d; // "MTSP"
+static const quint32 SNAPSHOT_VERSION = 1;
+static const quint32 SETTINGS_STATE_VERSION = 1; // of getMarketSettingsState()
+static const char *const SETTINGS_STATE_COMMANDS[] = // captured by getMarketSettingsState(), the rest is replayed
+{
+    "setmarketsettings", "setordermin", "setordermax", "setorderdc", "setorderdcnice", "setorderlandmarkthresh",
+    "setorderlandmarkstart", "setmarketoffset", "setmarketsentiment", "setslippagetimeout", nullptr
+};
+static const qint64 LATENCY_LOG_INTERVAL = 60 * 60000; // log latency percentiles every hour
+static const qint32 CANCEL_PAIR_MIN = 2; // fewer cancels than this for a market go out one at a time
+static const qint64 POLL_RECENT_TIME = 5 * 60000; // a fill or ticker change this recent makes a market active
+static const qreal POLL_NEAR_SPREAD = 0.005; // an order within this share of the price of the spread is near it
+static const qreal POLL_VOLATILE = 0.002; // ticker history volatility over this is volatile
+static const qreal POLL_WEIGHT_IDLE = 0.25; // a market without orders or ticker changes
+static const qint64 TRACKED_MARKETS_INTERVAL = 10000; // ms between rebuilds of the markets whole tickers parse
+static const qint32 GRID_LEVELS_MAX = 100000; // per setgrid, a typo in levels shouldn't eat the memory
+
+// a hash of the id and amount of every order, summed so the order of the list doesn't matter
+static quint64 getOpenOrdersFingerprint( const QVector<OrderRecord> &orders )
+{
+    quint64 fingerprint = 0;
+    for ( QVector<OrderRecord>::const_iterator i = orders.constBegin(); i != orders.constEnd(); i++ )
+    {
+        qint64 raw_amount = 0;
+        if ( !i->amount.toRawInt64( raw_amount ) )
+            raw_amount = i->amount.toIntSatoshis();
+
+        // splitmix64 of the pair
+        quint64 h = ( quint64( i->order_number.getHash() ) << 32 | quint32( i->order_number.size() ) ) ^ quint64( raw_amount ) * 0x9e3779b97f4a7c15ull;
+        h = ( h ^ ( h >> 30 ) ) * 0xbf58476d1ce4e5b9ull;
+        h = ( h ^ ( h >> 27 ) ) * 0x94d049bb133111ebull;
+        fingerprint += h ^ ( h >> 31 );
+    }
+
+    return fingerprint;
+}
 
 Engine::Engine( const quint8 _engine_type )
     : QObject( nullptr ),
@@ -35,22 +88,56 @@ Engine::Engine( const quint8 _engine_type )
 
     start_time = QDateTime::currentDateTime();
 
-    // engine maintenance timer
-    maintenance_timer = new QTimer( this );
-    connect( maintenance_timer, &QTimer::timeout, this, &Engine::onEngineMaintenance );
-    maintenance_timer->setTimerType( Qt::VeryCoarseTimer );
+    // the periodic jobs of the engine and its rest interface share one wakeup, polls wait out flow control
+    scheduler = new TaskScheduler( this );
+    scheduler->setSeed( quint32( engine_type ) +1 );
+    scheduler->setBusyCheck( [this]() { QMutexLocker locker( &engine_lock ); return yieldToFlowControl(); } );
+
+    // engine maintenance
+    maintenance_timer = scheduler->addTask( this, "maintenance", [this]() { onEngineMaintenance(); }, TASK_PRIORITY_HOUSEKEEPING, 0.05 );
     maintenance_timer->start( 60000 );
+
+    // ticker staleness, started by the first ticker
+    ticker_stale_timer = scheduler->addTask( this, "ticker stale", [this]() { onTickerStale(); }, TASK_PRIORITY_HOUSEKEEPING, 0.,
+                                             TASK_SINGLE_SHOT );
+
+    // position snapshots, for the metrics scrape and the saves
+    position_snapshot_timer = scheduler->addTask( this, "position snapshot", [this]()
+    {
+        QMutexLocker locker( &engine_lock );
+        positions->publishSnapshot();
+    }, TASK_PRIORITY_HOUSEKEEPING, 0.05 );
+    position_snapshot_timer->start( POSITION_SNAPSHOT_INTERVAL );
+
+#if defined(PAPER_TRADE)
+    paper = new PaperExchange( this );
+#endif
+
+    // market and snapshot files are written off the engine thread
+    saver = new AsyncSaver( this );
+    journal = new OrderJournal( engine_type, saver );
 }
 
 Engine::~Engine()
 {
-    maintenance_timer->stop();
-
-    delete maintenance_timer;
+    // stop every task before anything they use goes away, the rest interface's tasks go with it too
+    delete scheduler;
+    delete journal; // hands its last records to saver
+    delete recorder; // ^ its last block and index
+    delete saver; // waits for the writes
+    delete paper;
+    flattening_markets.clear(); // the positions going away aren't cancels
     delete positions;
     delete settings;
 
+    scheduler = nullptr;
     maintenance_timer = nullptr;
+    ticker_stale_timer = nullptr;
+    position_snapshot_timer = nullptr;
+    journal = nullptr;
+    saver = nullptr;
+    recorder = nullptr;
+    paper = nullptr;
     positions = nullptr;
     settings = nullptr;
 
@@ -77,7 +164,165 @@ Position *Engine::addPosition( QString market_input, quint8 side, QString buy_pr
         return nullptr;
     }
 
-    if ( !getMarketInfo( market ).is_tradeable )
+    trackMarket( market );
+
+    return addPositionToMarket( market, !getMarketInfo( market ).is_tradeable, side, buy_price, sell_price, order_size,
+                                type, strategy_tag, indices, landmark, quiet );
+}
+
+void Engine::addPositions( const QVector<PositionSpec> &specs )
+{
+    if ( specs.isEmpty() )
+        return;
+
+    // don't add a position on an exchange without a key and secret
+    if ( rest_arr.value( engine_type )->isKeyOrSecretUnset() )
+    {
+        kDebug() << "local error: tried to add" << specs.size() << "positions on exchange" << engine_type << "but key or secret is unset";
+        return;
+    }
+
+    // count the specs for each market so we only validate and reserve once
+    QMap<QString, qint32> market_counts;
+    for ( QVector<PositionSpec>::const_iterator i = specs.begin(); i != specs.end(); i++ )
+        market_counts[ i->market ]++;
+
+    QHash<QString, Market> markets; // validated markets, by input market
+    QHash<QString, bool> markets_inverted;
+    for ( QMap<QString, qint32>::const_iterator i = market_counts.begin(); i != market_counts.end(); i++ )
+    {
+        const Market market( i.key() );
+
+        if ( !market.isValid() )
+        {
+            kDebug() << "local error: incorrect market format. you used '" << i.key()
+                     << "'. please use universal market format 'base_quote' or 'base-quote'. for example 'BTC_DOGE' or 'BTC-DOGE'";
+            continue;
+        }
+
+        if ( !isInShard( market ) )
+        {
+            kDebug() << "local warning: market" << market << "isn't in shard" << shard_index << "of this exchange, skipping" << i.value() << "positions";
+            continue;
+        }
+
+        trackMarket( market );
+
+        const bool invert = !getMarketInfo( market ).is_tradeable;
+        MarketInfo &info = market_info[ invert ? market.getInverse() : market ];
+
+        // check if bid/ask price exists
+        if ( !info.ticker.isValid() )
+        {
+            kDebug() << "local error: ticker has not been read yet for" << market << "(try again), skipping" << i.value() << "positions";
+            continue;
+        }
+
+        // every spec might append a ping-pong index
+        info.position_index.reserve( info.position_index.size() + i.value() );
+
+        markets.insert( i.key(), market );
+        markets_inverted.insert( i.key(), invert );
+    }
+
+    for ( QVector<PositionSpec>::const_iterator i = specs.begin(); i != specs.end(); i++ )
+    {
+        if ( !markets.contains( i->market ) )
+            continue;
+
+        addPositionToMarket( markets.value( i->market ), markets_inverted.value( i->market ), i->side, i->buy_price, i->sell_price,
+                             i->order_size, i->type, i->strategy_tag, QVector<qint32>(), false, true );
+    }
+}
+
+qint32 Engine::addGrid( const QString &market_input, const Coin &lo, const Coin &hi, const qint32 levels, const qreal ratio,
+                        const Coin &size, const QString &type, const QString &strategy_tag )
+{
+    const Market market( market_input );
+    if ( !market.isValid() )
+    {
+        kDebug() << "local error: incorrect market format" << market_input;
+        return 0;
+    }
+
+    // the ticksizes are the tradeable market's, an inverted grid would round the wrong prices
+    const MarketInfo &info = getMarketInfo( market );
+    if ( !info.is_tradeable )
+    {
+        kDebug() << "local error: market" << market << "isn't tradeable, set the grid on" << market.getInverse();
+        return 0;
+    }
+
+    if ( lo.isZeroOrLess() || hi < lo || levels < 1 || levels > GRID_LEVELS_MAX || !( ratio > 1. ) || size.isZeroOrLess() )
+    {
+        kDebug() << "local error: bad grid, lo" << lo << "hi" << hi << "levels" << levels << "ratio" << ratio << "size" << size;
+        return 0;
+    }
+
+    // the side is picked from the spread, addPositions() checks it again
+    if ( !info.ticker.isValid() )
+    {
+        kDebug() << "local error: ticker has not been read yet for" << market << "(try again)";
+        return 0;
+    }
+
+    // each level is step times the last one, so hi is the last
+    const qreal step = levels > 1 ? qPow( QString( hi / lo ).toDouble(), 1. / ( levels -1 ) ) : 1.;
+
+    QVector<PositionSpec> specs;
+    specs.reserve( levels );
+    Coin last_buy_price;
+    qint32 skipped = 0;
+
+    for ( qint32 i = 0; i < levels; i++ )
+    {
+        const Coin buy_price = ( i == levels -1 ? hi : lo.ratio( qPow( step, i ) ) ).truncatedByTicksize( info.price_ticksize );
+
+        // at least a tick wide
+        Coin sell_price = buy_price.ratio( ratio ).truncatedByTicksize( info.price_ticksize );
+        if ( sell_price <= buy_price )
+            sell_price = buy_price + info.price_ticksize;
+
+        // a whole number of lots at the buy price
+        Coin order_size = ( size / buy_price ).truncatedByTicksize( info.quantity_ticksize ) * buy_price;
+        order_size.truncateByDecimals( CoinAmount::satoshi_decimals );
+
+        // levels closer than a tick round onto the last one
+        if ( buy_price.isZeroOrLess() || buy_price == last_buy_price || order_size.isZeroOrLess() )
+        {
+            skipped++;
+            continue;
+        }
+
+        last_buy_price = buy_price;
+
+        PositionSpec spec;
+        spec.market = market;
+        spec.side = buy_price < info.ticker.bid ? SIDE_BUY : SIDE_SELL;
+        spec.buy_price = buy_price;
+        spec.sell_price = sell_price;
+        spec.order_size = order_size;
+        spec.type = type;
+        spec.strategy_tag = strategy_tag;
+        specs += spec;
+    }
+
+    if ( skipped > 0 )
+        kDebug() << "local warning: skipped" << skipped << "grid levels of" << market << "that rounded onto another one or to nothing";
+
+    const qint32 indices_before = info.position_index.size();
+    addPositions( specs );
+
+    return getMarketInfo( market ).position_index.size() - indices_before;
+}
+
+Position *Engine::addPositionToMarket( Market market, bool invert, quint8 side, QString buy_price, QString sell_price,
+                                       QString order_size, QString type, QString strategy_tag, QVector<qint32> indices,
+                                       bool landmark, bool quiet )
+{
+    TRACE_SPAN( "addPosition" );
+
+    if ( invert )
     {
         // invert market pair
         market = market.getInverse();
@@ -102,6 +347,13 @@ Position *Engine::addPosition( QString market_input, quint8 side, QString buy_pr
 //                 << "new_size:" << new_size;
     }
 
+    // another engine has this market
+    if ( !isInShard( market ) )
+    {
+        kDebug() << "local warning: market" << market << "isn't in shard" << shard_index << "of this exchange";
+        return nullptr;
+    }
+
     MarketInfo &info = market_info[ market ];
 
     // check if bid/ask price exists
@@ -156,11 +408,16 @@ Position *Engine::addPosition( QString market_input, quint8 side, QString buy_pr
         return nullptr;
     }
 
+    // parse each value once for the checks below
+    const Coin buy_coin( buy_price );
+    const Coin sell_coin( sell_price );
+    const Coin size_coin( order_size );
+
     // check that we didn't make an erroneous buy/sell price. if it's a onetime order, do single price check
-    if ( ( !is_onetime && ( Coin( sell_price ) <= Coin( buy_price ) ||
-                            Coin( buy_price ).isZeroOrLess() || Coin( sell_price ).isZeroOrLess() ) ) ||
-         ( is_onetime && side == SIDE_BUY && Coin( buy_price ).isZeroOrLess() ) ||
-         ( is_onetime && side == SIDE_SELL && Coin( sell_price ).isZeroOrLess() ) ||
+    if ( ( !is_onetime && ( sell_coin <= buy_coin ||
+                            buy_coin.isZeroOrLess() || sell_coin.isZeroOrLess() ) ) ||
+         ( is_onetime && side == SIDE_BUY && buy_coin.isZeroOrLess() ) ||
+         ( is_onetime && side == SIDE_SELL && sell_coin.isZeroOrLess() ) ||
          ( is_onetime && alternate_size.size() > 0 && Coin( alternate_size ).isZeroOrLess() ) )
     {
         kDebug() << "local error: tried to set bad" << ( is_onetime ? "one-time" : "ping-pong" ) << "order. hi price"
@@ -168,9 +425,9 @@ Position *Engine::addPosition( QString market_input, quint8 side, QString buy_pr
         return nullptr;
     }
     // reformat strings
-    QString formatted_buy_price = Coin( buy_price );
-    QString formatted_sell_price = Coin( sell_price );
-    QString formatted_order_size = Coin( order_size );
+    QString formatted_buy_price = buy_coin;
+    QString formatted_sell_price = sell_coin;
+    QString formatted_order_size = size_coin;
 
     // anti-stupid check: did we put in price/amount decimals that didn't go into the price? abort if so
     if ( buy_price.size() > formatted_buy_price.size() ||
@@ -189,19 +446,26 @@ Position *Engine::addPosition( QString market_input, quint8 side, QString buy_pr
 
     // anti-stupid check: did we put in a taker price that's <>10% of the current bid/ask?
     if ( !is_override && is_taker &&
-        ( ( side == SIDE_SELL && info.ticker.bid.ratio( 0.9 ) > Coin( sell_price ) ) ||  // bid * 0.9 > sell_price
-          ( side == SIDE_SELL && info.ticker.bid.ratio( 1.1 ) < Coin( sell_price ) ) ||  // bid * 1.1 < sell_price
-          ( side == SIDE_BUY && info.ticker.ask.ratio( 1.1 ) < Coin( buy_price ) ) ||  // ask * 1.1 < buy_price
-          ( side == SIDE_BUY && info.ticker.ask.ratio( 0.9 ) > Coin( buy_price ) ) ) ) // ask * 0.9 > buy_price
+        ( ( side == SIDE_SELL && info.ticker.bid.ratio( 0.9 ) > sell_coin ) ||  // bid * 0.9 > sell_price
+          ( side == SIDE_SELL && info.ticker.bid.ratio( 1.1 ) < sell_coin ) ||  // bid * 1.1 < sell_price
+          ( side == SIDE_BUY && info.ticker.ask.ratio( 1.1 ) < buy_coin ) ||  // ask * 1.1 < buy_price
+          ( side == SIDE_BUY && info.ticker.ask.ratio( 0.9 ) > buy_coin ) ) ) // ask * 0.9 > buy_price
     {
         kDebug() << "local error: taker sell_price:" << sell_price << "buy_price:" << buy_price << "is >10% from spread, aborting order. add '-override' if intentional.";
         return nullptr;
     }
 
+    // the values as they were formatted above
+    Coin buy_value = buy_coin, sell_value = sell_coin, size_value = size_coin;
+    buy_value.truncateByDecimals( CoinAmount::satoshi_decimals );
+    sell_value.truncateByDecimals( CoinAmount::satoshi_decimals );
+    size_value.truncateByDecimals( CoinAmount::satoshi_decimals );
+
     // figure out the market index if we didn't supply one
     if ( !is_onetime && indices.isEmpty() )
     {
-        const PositionData posdata = PositionData( buy_price, sell_price, order_size, alternate_size );
+        const PositionData posdata = PositionData( buy_value, sell_value, size_value,
+                                                   alternate_size.isEmpty() ? Coin() : Coin( alternate_size ) );
 
         // get the next position index and append to our positions
         indices.append( info.position_index.size() );
@@ -214,18 +478,85 @@ Position *Engine::addPosition( QString market_input, quint8 side, QString buy_pr
     if ( !is_onetime && !is_active )
         return nullptr;
 
+    return addParsedPosition( info, market, side, buy_value, sell_value, size_value, type, strategy_tag, indices, landmark,
+                              is_onetime, is_taker, quiet );
+}
+
+Position *Engine::addGridPosition( const Market &market, quint8 side, const PositionData &data, const QVector<qint32> &indices,
+                                   bool landmark, bool quiet )
+{
+    // don't add a position on an exchange without a key and secret
+    if ( rest_arr.value( engine_type )->isKeyOrSecretUnset() )
+    {
+        kDebug() << "local error: tried to add a new position on exchange" << engine_type << "but key or secret is unset";
+        return nullptr;
+    }
+
+    if ( !isInShard( market ) )
+    {
+        kDebug() << "local warning: market" << market << "isn't in shard" << shard_index << "of this exchange";
+        return nullptr;
+    }
+
+    MarketInfo &info = market_info[ market ];
+
+    // an inverted market converts the prices, let addPosition() do it
+    if ( !market.isValid() || !info.is_tradeable )
+        return addPosition( market, side, data.buy_price, data.sell_price, data.order_size, ACTIVE, QLatin1String(), indices,
+                            landmark, quiet );
+
+    // check if bid/ask price exists
+    if ( !info.ticker.isValid() )
+    {
+        kDebug() << "local error: ticker has not been read yet. (try again)";
+        return nullptr;
+    }
+
+    // the grid values were validated when the index was set
+    return addParsedPosition( info, market, side, data.buy_price, data.sell_price, data.order_size, ACTIVE, QLatin1String(),
+                              indices, landmark, false, false, quiet );
+}
+
+Position *Engine::addParsedPosition( MarketInfo &info, const Market &market, quint8 side, const Coin &buy_price,
+                                     const Coin &sell_price, const Coin &order_size, const QString &type,
+                                     const QString &strategy_tag, const QVector<qint32> &indices, bool landmark,
+                                     bool is_onetime, bool is_taker, bool quiet )
+{
     // make position object
-    Position *const &pos = new Position( market, side, buy_price, sell_price, order_size, strategy_tag, indices, landmark, this );
+    Position *const &pos = positions->getPool().acquire( market, side, buy_price, sell_price, order_size, strategy_tag, indices, landmark, this );
+
+    if ( !pos )
+    {
+        kDebug() << "local warning: failed to set order for" << market << side << buy_price << sell_price << order_size << indices << landmark;
+        return nullptr;
+    }
+
+    return setParsedPosition( info, pos, type, is_onetime, is_taker, quiet );
+}
+
+Position *Engine::setParsedPosition( MarketInfo &info, Position *const &pos, const QString &type, bool is_onetime,
+                                     bool is_taker, bool quiet )
+{
+    // pos must be valid, and not held by positions!
+    const Market &market = pos->market;
+
+    // we're getting out, not putting orders in
+    if ( isFlattening( market ) )
+    {
+        kLogIf( LOG_LEVEL_DEBUG, !quiet ) << "local warning: not setting order while flattening" << market << pos->side << pos->price;
+        positions->getPool().release( pos );
+        checkFlattened();
+        return nullptr;
+    }
 
     // check for correctly loaded position data and size
-    if ( !pos ||
-         !pos->market.isValid() ||
+    if ( !pos->market.isValid() ||
           pos->price.isZeroOrLess() ||
           pos->amount.isZeroOrLess() ||
           pos->quantity.isZeroOrLess() )
     {
-        kDebug() << "local warning: failed to set order because of invalid value:" << market << pos->side << pos->buy_price << pos->sell_price << pos->amount << pos->quantity << indices << landmark;
-        if ( pos ) delete pos;
+        kDebug() << "local warning: failed to set order because of invalid value:" << market << pos->side << pos->buy_price << pos->sell_price << pos->amount << pos->quantity << pos->market_indices << pos->is_landmark;
+        positions->getPool().release( pos );
         return nullptr;
     }
 
@@ -239,12 +570,20 @@ Position *Engine::addPosition( QString market_input, quint8 side, QString buy_pr
     if ( pos->amount < minimum_order_size - CoinAmount::SATOSHI )
     {
         kDebug() << "local warning: failed to set order: size" << pos->amount << "is under the minimum size" << minimum_order_size;
+        positions->getPool().release( pos );
         return nullptr;
     }
 
-    // enforce PERCENT_PRICE on binance
+    // enforce PERCENT_PRICE and NOTIONAL on binance
     if ( engine_type == ENGINE_BINANCE )
     {
+        if ( info.min_notional.isGreaterThanZero() && pos->amount < info.min_notional )
+        {
+            kDebug() << "local warning: failed to set order: size" << pos->amount << "is under the NOTIONAL minimum" << info.min_notional << "for" << market;
+            positions->getPool().release( pos );
+            return nullptr;
+        }
+
         // respect the binance limits with a 20% padding (we don't know what the 5min avg is, so we'll just compress the range)
         Coin buy_limit = ( info.ticker.bid * info.price_min_mul.ratio( 1.2 ) ).truncatedByTicksize( "0.00000001" );
         Coin sell_limit = ( info.ticker.ask * info.price_max_mul.ratio( 0.8 ) ).truncatedByTicksize( "0.00000001" );
@@ -255,7 +594,7 @@ Position *Engine::addPosition( QString market_input, quint8 side, QString buy_pr
         {
             if ( pos->is_onetime ) // if ping-pong, don't warn
                 kDebug() << "local warning: hit PERCENT_PRICE limit for" << market << buy_limit << sell_limit << "for pos" << pos->stringifyOrderWithoutOrderID();
-            delete pos;
+            positions->getPool().release( pos );
             return nullptr;
         }
     }
@@ -271,7 +610,7 @@ Position *Engine::addPosition( QString market_input, quint8 side, QString buy_pr
         int timeout = type.mid( read_from, type.size() - read_from ).toInt( &ok );
 
         if ( ok && timeout > 0 )
-            pos->max_age_epoch = QDateTime::currentMSecsSinceEpoch() + ( timeout * 60000 );
+            pos->max_age_epoch = VirtualClock::currentMSecsSinceEpoch() + ( timeout * 60000 );
     }
 
     // TODO: if the positon is simulated in an inverted market, don't run this. otherwise, run it
@@ -305,7 +644,7 @@ Position *Engine::addPosition( QString market_input, quint8 side, QString buy_pr
 
     // position is now queued, update engine state
     positions->add( pos );
-    info.order_prices.append( pos->price );
+    info.addOrderPrice( pos->price, pos->side );
 
     // if running tests, exit early
     if ( is_testing )
@@ -326,7 +665,7 @@ void Engine::addLandmarkPositionFor( Position *const &pos )
                  pos->market_indices, true, true );
 }
 
-void Engine::fillNQ( const QString &order_id, qint8 fill_type , quint8 extra_data )
+void Engine::fillNQ( const OrderId &order_id, qint8 fill_type , quint8 extra_data, QVector<DeferredFill> *deferred )
 {
     // 1 = getorder
     // 2 = history
@@ -334,6 +673,7 @@ void Engine::fillNQ( const QString &order_id, qint8 fill_type , quint8 extra_dat
     // 4 = cancel
     // 5 = wss
     // 6 = order list
+    // 7 = paper
 
     static const QStringList fill_strings = QStringList()
             << "getorder"
@@ -341,10 +681,11 @@ void Engine::fillNQ( const QString &order_id, qint8 fill_type , quint8 extra_dat
             << "ticker"
             << "cancel"
             << "wss"
-            << "ordlist";
+            << "ordlist"
+            << "paper";
 
     // check for correct value
-    if ( fill_type < 1 || fill_type > 5 )
+    if ( fill_type < 1 || fill_type > fill_strings.size() )
     {
         kDebug() << "local error: unexpected fill type" << fill_type << "for order" << order_id;
         return;
@@ -366,7 +707,10 @@ void Engine::fillNQ( const QString &order_id, qint8 fill_type , quint8 extra_dat
         return;
     }
 
+    latency.addSince( "order set->fill", pos->order_set_time, VirtualClock::currentMSecsSinceEpoch() );
+
     MarketInfo &info = market_info[ pos->market ];
+    info.last_fill_time = VirtualClock::currentMSecsSinceEpoch();
 
     Coin new_price;
 #if defined(SPREAD_EXPAND_FULL)
@@ -393,32 +737,58 @@ void Engine::fillNQ( const QString &order_id, qint8 fill_type , quint8 extra_dat
             continue;
 
         // increment fill count and resize by alternate size if one exists
-        info.position_index[ pos->market_indices.value( i ) ].iterateFillCount();
+        info.position_index.iterateFillCount( pos->market_indices.value( i ) );
     }
 
     QString fill_str = fill_strings.value( fill_type -1, "unknown" );
     if ( extra_data > 0 ) fill_str += QChar('-') + QString::number( extra_data );
 
-    // update stats and print
+    // update stats and print, or leave it for after the batch
     // note: btc_commission is set in rest->parseOrderHistory
-    updateStatsAndPrintFill( fill_str, pos->market, pos->order_number, pos->side, pos->strategy_tag, pos->amount, Coin(), pos->price, pos->btc_commission );
-
-    // set the next position
-    flipPosition( pos );
+    if ( deferred )
+    {
+        DeferredFill fill;
+        fill.fill_type = fill_str;
+        fill.market = pos->market;
+        fill.order_id = pos->order_number;
+        fill.side = pos->side;
+        fill.strategy_tag = pos->strategy_tag;
+        fill.amount = pos->amount;
+        fill.price = pos->price;
+        fill.btc_commission = pos->btc_commission;
+        deferred->append( fill );
+    }
+    else
+    {
+        updateStatsAndPrintFill( fill_str, pos->market, pos->order_number.toString(), pos->side, pos->strategy_tag, pos->amount, Coin(), pos->price, pos->btc_commission );
+    }
 
     // on trex, remove any 'getorder's in queue related to this uuid, to prevent spam
     // if testing, don't access rest because it's null
     if ( !is_testing && engine_type == ENGINE_BITTREX )
-        rest_arr.value( ENGINE_BITTREX )->removeRequest( TREX_COMMAND_GET_ORDER, QString( "uuid=%1" ).arg( order_id ) ); // note: uses pos*
+        rest_arr.value( ENGINE_BITTREX )->removeRequest( TREX_COMMAND_GET_ORDER, QString( "uuid=%1" ).arg( order_id.toString() ) ); // note: uses pos*
 
-    // delete
-    positions->remove( pos );
+    // set the next position with the same object, or delete it
+    if ( !flipPositionInPlace( pos ) )
+        positions->remove( pos );
+}
+
+Spruce *Engine::getSpruceForTag( const QString &strategy_tag ) const
+{
+    // "spruce.<portfolio>-<B|S>-<market>", the rest are primary's
+    if ( !spruce_portfolios || !strategy_tag.startsWith( SPRUCE_PORTFOLIO_TAG_PREFIX ) )
+        return spruce;
+
+    const QString name = strategy_tag.mid( SPRUCE_PORTFOLIO_TAG_PREFIX.size() ).section( QChar( '-' ), 0, 0 );
+    return spruce_portfolios->value( name, spruce );
 }
 
 void Engine::updateStatsAndPrintFill( const QString &fill_type, Market market, const QString &order_id, quint8 side,
                                       const QString &strategy_tag, Coin amount, Coin quantity, Coin price,
-                                      const Coin &btc_commission )
+                                      const Coin &btc_commission, bool print )
 {
+    TRACE_SPAN( "updateStatsAndPrintFill" );
+
     // check for valid inputs. amount or quantity must exist, and all others must be valid
     if ( amount.isZeroOrLess() && quantity.isZeroOrLess() )
     {
@@ -431,21 +801,64 @@ void Engine::updateStatsAndPrintFill( const QString &fill_type, Market market, c
         return;
     }
 
+    Metrics::add( Metrics::getEngineCounters( engine_type ).fills );
+    fill_count++;
+
+    // journal the fill as the exchange reported it, before it's converted below
+    if ( !is_testing )
+    {
+        OrderJournalEvent event;
+        event.type = ORDER_JOURNAL_FILL;
+        event.exchange = engine_type;
+        event.side = side;
+        event.time = VirtualClock::currentMSecsSinceEpoch();
+        event.market = market;
+        event.strategy_tag = strategy_tag;
+        event.order_id = order_id;
+        event.fill_type = fill_type;
+        event.price = price;
+        event.quantity = quantity;
+        event.amount = amount;
+        event.fee = btc_commission;
+        journal->record( event );
+    }
+
+    ledger.addFill( order_id, market, side, price, quantity, amount, btc_commission );
+
+    if ( EventFeed::isSubscribed( EventFeed::TYPE_FILL ) )
+        EventFeed::publish( EventFeed::TYPE_FILL, QString( "fill %1 %2 %3 %4 %5 %6 %7 %8 %9 %10 %11\n" )
+                                                   .arg( getEngineId() )
+                                                   .arg( market )
+                                                   .arg( side == SIDE_BUY ? "buy" : "sell" )
+                                                   .arg( order_id )
+                                                   .arg( price )
+                                                   .arg( quantity )
+                                                   .arg( amount )
+                                                   .arg( btc_commission )
+                                                   .arg( fill_type )
+                                                   .arg( strategy_tag.isEmpty() ? QString( "-" ) : strategy_tag )
+                                                   .arg( VirtualClock::currentMSecsSinceEpoch() ).toUtf8() );
+
+    QMutexLocker spruce_locker( spruce_lock );
+
+    // the other portfolios convert with their own base currency
+    Spruce *portfolio = getSpruceForTag( strategy_tag );
+
     Market alpha_market_0, alpha_market_1;
     Coin market_0_quantity;
     /// found beta level trade, convert prices and volumes to base currency using an estimated conversion rate
-    if ( market.getBase() != spruce->getBaseCurrency() &&
-         market.getQuote() != spruce->getBaseCurrency() )
+    if ( market.getBase() != portfolio->getBaseCurrency() &&
+         market.getQuote() != portfolio->getBaseCurrency() )
     {
-        alpha_market_0 = Market( spruce->getBaseCurrency(), market.getBase() );
-        alpha_market_1 = Market( spruce->getBaseCurrency(), market.getQuote() );
+        alpha_market_0 = Market( portfolio->getBaseCurrency(), market.getBase() );
+        alpha_market_1 = Market( portfolio->getBaseCurrency(), market.getQuote() );
 
-        const Coin price_in_btc = getMarketInfo( Market( spruce->getBaseCurrency(), market.getBase() ) ).ticker.bid;
+        const Coin price_in_btc = getMarketInfo( Market( portfolio->getBaseCurrency(), market.getBase() ) ).ticker.bid;
 
         // check for valid price
         if ( !is_testing && !price_in_btc.isGreaterThanZero() )
         {
-            kDebug() << "engine error: ticker price is <= zero for" << Market( spruce->getBaseCurrency(), market.getBase() ) << order_id << "amount:" << amount << "qty:" << quantity << "@" << price << "ticker:" << price_in_btc;
+            kDebug() << "engine error: ticker price is <= zero for" << Market( portfolio->getBaseCurrency(), market.getBase() ) << order_id << "amount:" << amount << "qty:" << quantity << "@" << price << "ticker:" << price_in_btc;
             return;
         }
 
@@ -474,8 +887,8 @@ void Engine::updateStatsAndPrintFill( const QString &fill_type, Market market, c
             quantity = amount / price;
 
         // if base market is not btc, but the quote is, calculate btc price with inverse
-        if ( market.getBase() != spruce->getBaseCurrency() &&
-             market.getQuote() == spruce->getBaseCurrency() )
+        if ( market.getBase() != portfolio->getBaseCurrency() &&
+             market.getQuote() == portfolio->getBaseCurrency() )
         {
             // invert market to make stats show properly
             market = market.getInverse();
@@ -497,8 +910,9 @@ void Engine::updateStatsAndPrintFill( const QString &fill_type, Market market, c
     }
 
     // add stats changes to alpha tracker (note: volume before commission is used)
-    alpha->addAlpha( market, side, amount, price );
-    alpha->addDailyVolume( QDateTime::currentSecsSinceEpoch(), amount );
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
+    alpha->addAlpha( market, side, amount, price, current_time );
+    alpha->addDailyVolume( current_time / 1000, amount );
 
     if ( strategy_tag.startsWith( "spruce" ) )
     {
@@ -510,8 +924,8 @@ void Engine::updateStatsAndPrintFill( const QString &fill_type, Market market, c
             const Coin quantity_offset_1 = ( side == SIDE_BUY ) ?  quantity
                                                                 : -quantity;
 
-            spruce->addToShortLonged( alpha_market_0, quantity_offset_0 );
-            spruce->addToShortLonged( alpha_market_1, quantity_offset_1 );
+            portfolio->addToShortLonged( alpha_market_0, quantity_offset_0 );
+            portfolio->addToShortLonged( alpha_market_1, quantity_offset_1 );
         }
         // normal order, subtract the qty of the alt (base doesn't need changing)
         else
@@ -520,11 +934,11 @@ void Engine::updateStatsAndPrintFill( const QString &fill_type, Market market, c
             const Coin quantity_offset = ( side == SIDE_BUY ) ?  quantity
                                                               : -quantity;
 
-            spruce->addToShortLonged( market, quantity_offset );
+            portfolio->addToShortLonged( market, quantity_offset );
         }
     }
 
-    if ( getVerbosity() > 0 )
+    if ( print && getVerbosity() > 0 )
     {
         const bool is_buy = ( side == SIDE_BUY );
         const QString side_str = QString( "%1%2>>>none<<<" )
@@ -543,8 +957,44 @@ void Engine::updateStatsAndPrintFill( const QString &fill_type, Market market, c
     }
 }
 
+void Engine::setRecording( bool enabled )
+{
+    if ( enabled == isRecording() )
+        return;
+
+    if ( !enabled )
+    {
+        kDebug() << "stopped recording after" << recorder->getRecordCount() << "records";
+        delete recorder;
+        recorder = nullptr;
+        return;
+    }
+
+    recorder = new MarketRecorder( engine_type, saver );
+
+    // failed to open the first segment
+    if ( !recorder->isOpen() )
+    {
+        delete recorder;
+        recorder = nullptr;
+    }
+}
+
 void Engine::processFilledOrders( QVector<Position*> &to_be_filled, qint8 fill_type )
 {
+    TRACE_SPAN( "processFilledOrders" );
+
+    if ( recorder )
+    {
+        const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
+        for ( QVector<Position*>::const_iterator i = to_be_filled.begin(); i != to_be_filled.end(); i++ )
+            recorder->recordFill( (*i)->market, (*i)->side, fill_type, (*i)->price, (*i)->quantity, current_time );
+    }
+
+    // flip everything first, stats and logging wait until the new orders are queued
+    QVector<DeferredFill> deferred;
+    deferred.reserve( to_be_filled.size() );
+
     /// step 1: build markets list
     QMap<QString,QVector<Position*>> markets;
     for ( QVector<Position*>::const_iterator i = to_be_filled.begin(); i != to_be_filled.end(); i++ )
@@ -575,7 +1025,7 @@ void Engine::processFilledOrders( QVector<Position*> &to_be_filled, qint8 fill_t
                  ( pos->side == SIDE_BUY  && pos->getFlippedPrice() >  price_avg ) )  // new sell is gte avg
             {
                 to_be_filled.removeOne( pos );
-                fillNQ( pos->order_number, fill_type );
+                fillNQ( pos->order_number, fill_type, 0, &deferred );
             }
         }
     }
@@ -584,28 +1034,204 @@ void Engine::processFilledOrders( QVector<Position*> &to_be_filled, qint8 fill_t
     for ( QVector<Position*>::const_iterator i = to_be_filled.begin(); i != to_be_filled.end(); i++ )
     {
         Position *const &pos = *i;
-        fillNQ( pos->order_number, fill_type );
+        fillNQ( pos->order_number, fill_type, 0, &deferred );
+    }
+
+    /// step 4: update stats and print
+    applyDeferredFills( deferred );
+}
+
+void Engine::applyDeferredFills( const QVector<DeferredFill> &fills )
+{
+    if ( fills.isEmpty() )
+        return;
+
+    // print each fill if there's only one or we're verbose, otherwise print a summary for each market
+    const bool print_each = ( fills.size() == 1 || getVerbosity() > 1 );
+
+    QMap<QString, qint32> buy_counts, sell_counts;
+    QMap<QString, Coin> buy_amounts, sell_amounts;
+
+    for ( QVector<DeferredFill>::const_iterator i = fills.begin(); i != fills.end(); i++ )
+    {
+        updateStatsAndPrintFill( i->fill_type, i->market, i->order_id.toString(), i->side, i->strategy_tag, i->amount, Coin(), i->price, i->btc_commission, print_each );
+
+        if ( i->side == SIDE_BUY )
+        {
+            buy_counts[ i->market ]++;
+            buy_amounts[ i->market ] += i->amount;
+        }
+        else
+        {
+            sell_counts[ i->market ]++;
+            sell_amounts[ i->market ] += i->amount;
+        }
+    }
+
+    if ( print_each || getVerbosity() == 0 )
+        return;
+
+    // collect the markets from both sides
+    QMap<QString, qint32> markets = buy_counts;
+    for ( QMap<QString, qint32>::const_iterator i = sell_counts.begin(); i != sell_counts.end(); i++ )
+        markets.insert( i.key(), 0 );
+
+    for ( QMap<QString, qint32>::const_iterator i = markets.begin(); i != markets.end(); i++ )
+    {
+        const QString &market = i.key();
+
+        kDebug() << QString( "fill-%1: %2 >>>grn<<<%3 buys>>>none<<< a %4 >>>red<<<%5 sells>>>none<<< a %6" )
+                    .arg( fills.first().fill_type, -8 )
+                    .arg( market, -MARKET_STRING_WIDTH )
+                    .arg( buy_counts.value( market ) )
+                    .arg( buy_amounts.value( market ), -PRICE_WIDTH )
+                    .arg( sell_counts.value( market ) )
+                    .arg( sell_amounts.value( market ), -PRICE_WIDTH );
+    }
+}
+
+void Engine::matchOpenOrders( const QVector<OrderRecord> &orders, QVector<Position*> &seen_positions,
+                              QVector<Position*> &missing_positions ) const
+{
+    // sort the exchange's ids and ours once, then one walk over both tells which orders are ours (seen_positions, by
+    // index in orders) and which of our set orders aren't in the list (missing_positions)
+    seen_positions.fill( nullptr, orders.size() );
+    missing_positions.clear();
+
+    QVector<qint32> orders_by_id( orders.size() );
+    for ( qint32 i = 0; i < orders.size(); i++ )
+        orders_by_id[ i ] = i;
+
+    std::sort( orders_by_id.begin(), orders_by_id.end(), [&orders]( const qint32 a, const qint32 b )
+    {
+        return orders.at( a ).order_number < orders.at( b ).order_number;
+    } );
+
+    QVector<Position*> active_by_id = positions->active();
+    std::sort( active_by_id.begin(), active_by_id.end(), []( Position *const &a, Position *const &b )
+    {
+        return a->order_number < b->order_number;
+    } );
+
+    qint32 next_order = 0;
+    bool last_found = false;
+    for ( qint32 k = 0; k < active_by_id.size(); k++ )
+    {
+        Position *const &pos = active_by_id.at( k );
+
+        // same id as the last one, it goes the same way
+        if ( k > 0 && active_by_id.at( k -1 )->order_number == pos->order_number )
+        {
+            if ( !last_found )
+                missing_positions += pos;
+            continue;
+        }
+
+        // skip the orders that sort before ours, they aren't ours
+        while ( next_order < orders_by_id.size() && orders.at( orders_by_id.at( next_order ) ).order_number < pos->order_number )
+            next_order++;
+
+        // ours, and any duplicates of it
+        last_found = false;
+        while ( next_order < orders_by_id.size() && orders.at( orders_by_id.at( next_order ) ).order_number == pos->order_number )
+        {
+            seen_positions[ orders_by_id.at( next_order++ ) ] = pos;
+            last_found = true;
+        }
+
+        if ( !last_found )
+            missing_positions += pos;
     }
 }
 
-void Engine::processOpenOrders( QVector<QString> &order_numbers, QMultiHash<QString, OrderInfo> &orders, qint64 request_time_sent_ms )
+void Engine::processOpenOrders( const QVector<OrderRecord> &all_orders, qint64 request_time_sent_ms )
 {
-    const qint64 current_time = QDateTime::currentMSecsSinceEpoch(); // cache time
+    TRACE_SPAN( "processOpenOrders" );
+
+    // the other shards' orders are listed too, they aren't ours to match, clear or cancel
+    QVector<OrderRecord> shard_orders;
+    if ( shards.isSharded() )
+    {
+        shard_orders.reserve( all_orders.size() );
+        for ( QVector<OrderRecord>::const_iterator i = all_orders.constBegin(); i != all_orders.constEnd(); i++ )
+            if ( isInShard( i->market ) )
+                shard_orders += *i;
+    }
+    const QVector<OrderRecord> &orders = shards.isSharded() ? shard_orders : all_orders;
+
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch(); // cache time
     qint32 ct_cancelled = 0, ct_all = 0;
 
-    QQueue<QString> stray_orders;
+    if ( recorder )
+        recorder->recordOpenOrders( orders, current_time );
+
+    // our orders aren't on the exchange, and the ones that are aren't ours to fill or cancel
+    if ( isPaperTrading() )
+    {
+        positions->setRunningCancelAll( false );
+        return;
+    }
+
+    QQueue<OrderId> stray_orders;
     QQueue<Market> stray_orders_markets;
 
-    for ( QMultiHash<QString, OrderInfo>::const_iterator i = orders.begin(); i != orders.end(); i++ )
+    // the same orders as last time with our positions as they were reconcile the same way. only the strays and the
+    // missing orders are looked at again, for their grace and safety times
+    const quint64 fingerprint = getOpenOrdersFingerprint( orders );
+    const bool is_unchanged = !positions->isRunningCancelAll() &&
+                               orders.size() == open_orders_count &&
+                               fingerprint == open_orders_fingerprint &&
+                               positions->getChangeCount() == open_orders_position_changes;
+
+    const QVector<OrderRecord> last_strays = is_unchanged ? open_orders_strays : QVector<OrderRecord>();
+    const QVector<OrderRecord> &records = is_unchanged ? last_strays : orders;
+    QVector<Position*> seen_positions, missing_positions;
+
+    if ( is_unchanged )
     {
-        const QString &market = i.key();
-        const OrderInfo &info = i.value();
-        const quint8 &side = info.side;
-        const QString &price = info.price;
-        const QString &amount = info.amount;
-        const QString &order_number = info.order_number;
+        missing_positions = open_orders_missing;
+    }
+    else
+    {
+        // markets a pair cancel would take someone else's orders in, see sendCancels()
+        foreign_order_groups.clear();
+
+        matchOpenOrders( orders, seen_positions, missing_positions );
+
+        // remember how it came out, with our positions as they were before the loop below sets any
+        open_orders_fingerprint = fingerprint;
+        open_orders_count = orders.size();
+        open_orders_position_changes = positions->getChangeCount();
+        open_orders_strays.clear();
+        open_orders_missing = missing_positions;
+    }
+
+    for ( qint32 idx = 0; idx < records.size(); idx++ )
+    {
+        const OrderRecord &order = records.at( idx );
+        const QString &market = order.market;
+        const quint8 &side = order.side;
+        const Coin &price = order.price;
+        const Coin &amount = order.amount;
+        const OrderId &order_number = order.order_number;
+        Position *const seen_pos = is_unchanged ? nullptr : seen_positions.at( idx );
+
+        if ( !is_unchanged && !seen_pos )
+        {
+            open_orders_strays += order;
 
-        //kDebug() << "processing order" << order_number << market << side << amount << "@" << price;
+            if ( isPairCancelSupported() )
+                foreign_order_groups.insert( getCancelGroup( order_number, nullptr, market ) );
+        }
+
+        kLog( LOG_LEVEL_TRACE ) << "processing order" << order_number << market << side << amount << "@" << price;
+
+        // record the first time one of our set orders shows up in the order list
+        if ( seen_pos && seen_pos->order_seen_time == 0 )
+        {
+            seen_pos->order_seen_time = current_time;
+            latency.addSince( "order set->seen", seen_pos->order_set_time, current_time );
+        }
 
         // if we ran cancelall, try to cancel this order
         if ( positions->isRunningCancelAll() )
@@ -619,8 +1245,12 @@ void Engine::processOpenOrders( QVector<QString> &order_numbers, QMultiHash<QStr
 
             ct_cancelled++;
 
+            // everything in the market goes, let sendCancels() do it at once
+            if ( isPairCancelSupported() )
+                cancel_pair_groups.insert( getCancelGroup( order_number, nullptr, market ) );
+
             // cancel stray orders
-            if ( !positions->isValidOrderID( order_number ) )
+            if ( !seen_pos )
             {
                 kDebug() << "cancelling non-bot order" << market << side << amount << "@" << price << "id:" << order_number;
 
@@ -629,44 +1259,23 @@ void Engine::processOpenOrders( QVector<QString> &order_numbers, QMultiHash<QStr
                 continue;
             }
 
-            // if it is in our index, cancel that one
-            positions->cancel( positions->getByOrderID( order_number ), false, CANCELLING_FOR_USER );
+            // if it is in our index, cancel that one. it might be gone after this, so we're done with it
+            positions->cancel( seen_pos, false, CANCELLING_FOR_USER );
+            continue;
         }
 
         // we haven't seen this order in a buy/sell reply, we should test the order id to see if it matches a queued pos
-        if ( settings->should_clear_stray_orders && !positions->isValidOrderID( order_number ) )
+        if ( settings->should_clear_stray_orders && !seen_pos )
         {
             // if this isn't a price in any of our positions, we should ignore it
-            if ( !settings->should_clear_stray_orders_all && !market_info[ market ].order_prices.contains( price ) )
+            if ( !settings->should_clear_stray_orders_all && !market_info[ market ].hasOrderPrice( price ) )
                 continue;
 
             // we haven't seen it, add a grace time if it doesn't match an active position
             if ( !order_grace_times.contains( order_number ) )
             {
-                const Coin &amount_d = amount;
-                Position *matching_pos = nullptr;
-
-                // try and match a queued position to our json data
-                for ( QSet<Position*>::const_iterator k = positions->queued().begin(); k != positions->queued().end(); k++ )
-                {
-                    Position *const &pos = *k;
-
-                    // avoid nullptr
-                    if ( !pos )
-                        continue;
-
-                    // we found a set order before we received the reply for it
-                    if ( pos->market == market &&
-                         pos->side == side &&
-                         pos->price == price &&
-                         pos->amount == amount &&
-                         amount_d >= pos->amount.ratio( 0.999 ) &&
-                         amount_d <= pos->amount.ratio( 1.001 ) )
-                    {
-                        matching_pos = pos;
-                        break;
-                    }
-                }
+                // try and match a queued position to our json data (we found a set order before we received the reply for it)
+                Position *const matching_pos = positions->getQueuedByPrice( market, side, price, amount );
 
                 // check if the order details match a currently queued order
                 if (  matching_pos &&
@@ -674,12 +1283,12 @@ void Engine::processOpenOrders( QVector<QString> &order_numbers, QMultiHash<QStr
                       matching_pos->order_request_time < current_time - 10000 ) // request must be a little old (so we don't cross scan-set different indices so much)
                 {
                     // order is now set
-                    positions->activate( matching_pos, order_number );
+                    positions->activate( matching_pos, order_number.toString() );
                 }
                 // it doesn't match a queued order, we should still update the seen time
                 else
                 {
-                    order_grace_times.insert( order_number, current_time );
+                    setGraceTime( order_number, current_time );
                 }
             }
             // we have seen the stray order at least once before, measure the grace time
@@ -700,6 +1309,12 @@ void Engine::processOpenOrders( QVector<QString> &order_numbers, QMultiHash<QStr
     {
         kDebug() << "cancelled" << ct_cancelled << "orders," << ct_all << "orders total";
         positions->setRunningCancelAll( false ); // reset state to default
+        open_orders_count = -1; // everything is going, reconcile the next list in full
+
+        // nothing was queued, don't leave the groups for the next cancels
+        if ( pending_cancels.isEmpty() )
+            cancel_pair_groups.clear();
+
         return;
     }
 
@@ -712,19 +1327,19 @@ void Engine::processOpenOrders( QVector<QString> &order_numbers, QMultiHash<QStr
     {
         while ( stray_orders.size() > 0 )
         {
-            const QString &order_number = stray_orders.takeFirst();
+            const OrderId order_number = stray_orders.takeFirst();
             const Market &market = engine_type == ENGINE_WAVES ? stray_orders_markets.takeFirst() : Market();
 
             sendCancel( order_number, nullptr, market );
             // reset grace time incase we see this order again from the next response
-            order_grace_times.insert( order_number, current_time + settings->stray_grace_time_limit /* don't try to cancel again for 10m */ );
+            setGraceTime( order_number, current_time + settings->stray_grace_time_limit /* don't try to cancel again for 10m */ );
         }
 
     }
 
     // mitigate blank orderbook flash
     if ( settings->should_mitigate_blank_orderbook_flash &&
-         !order_numbers.size() && // the orderbook is blank
+         orders.isEmpty() && // the orderbook is blank
          positions->active().size() >= 20 ) // we have some orders, don't make it too low (if it's 2 or 3, we might fill all those orders at once, and the mitigation leads to the orders never getting filled)
     {
         kDebug() << "local warning: blank orderbook flash has been mitigated!";
@@ -737,7 +1352,7 @@ void Engine::processOpenOrders( QVector<QString> &order_numbers, QMultiHash<QStr
     {
         QVector<Position*> filled_orders;
 
-        for ( QSet<Position*>::const_iterator k = positions->active().begin(); k != positions->active().end(); k++ )
+        for ( QVector<Position*>::const_iterator k = missing_positions.constBegin(); k != missing_positions.constEnd(); k++ )
         {
             Position *const &pos = *k;
 
@@ -757,10 +1372,6 @@ void Engine::processOpenOrders( QVector<QString> &order_numbers, QMultiHash<QStr
             if ( pos->order_set_time > current_time - settings->safety_delay_time )
                 continue;
 
-            // is the order in the list of orders?
-            if ( order_numbers.contains( pos->order_number ) )
-                continue;
-
             // check that the api request timestamp was at/after our request send time
             if ( pos->order_set_time >= request_time_sent_ms )
                 continue;
@@ -783,51 +1394,333 @@ void Engine::processOpenOrders( QVector<QString> &order_numbers, QMultiHash<QStr
     }
 }
 
-void Engine::processTicker( BaseREST *base_rest_module, const QMap<QString, TickerInfo> &ticker_data, qint64 request_time_sent_ms )
+qreal Engine::getMarketPollWeight( const Market &market )
 {
-    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+    const MarketInfo &info = market_info[ market ];
+    const qint64 recent_time = VirtualClock::currentMSecsSinceEpoch() - POLL_RECENT_TIME;
+    const Position *const hi_buy = positions->getHighestBuyAll( market );
+    const Position *const lo_sell = positions->getLowestSellAll( market );
+    const bool is_ticker_changed = info.last_ticker_change_time > recent_time;
 
-    // update ticker update time
-    base_rest_module->ticker_update_time = current_time;
+    // nothing of ours here and nothing moving, check it now and then
+    if ( !hi_buy && !lo_sell && !is_ticker_changed )
+        return POLL_WEIGHT_IDLE;
 
-    // store deleted positions, because we can't delete and iterate a hash<>
+    qreal weight = 1.;
 
-    for ( QMap<QString, TickerInfo>::const_iterator i = ticker_data.begin(); i != ticker_data.end(); i++ )
+    // we just filled here, the next fill is likely to come soon
+    if ( info.last_fill_time > recent_time )
+        weight *= 4.;
+
+    // an order close to the spread is the next to fill
+    if ( info.ticker.isValid() &&
+       ( ( hi_buy && hi_buy->price >= info.ticker.bid.ratio( 1. - POLL_NEAR_SPREAD ) ) ||
+         ( lo_sell && lo_sell->price <= info.ticker.ask.ratio( 1. + POLL_NEAR_SPREAD ) ) ) )
+        weight *= 2.;
+
+    // the price is moving
+    if ( is_ticker_changed || info.ticker_history.getVolatility() > POLL_VOLATILE )
+        weight *= 2.;
+
+    return weight;
+}
+
+bool Engine::updateTicker( const MarketTicker &ticker )
+{
+    const Coin &ask = ticker.ask;
+    const Coin &bid = ticker.bid;
+
+    // check for missing information
+    if ( ask.isZeroOrLess() || bid.isZeroOrLess() || ticker.market_id < 0 )
+        return false;
+
+    const QString market = Market::getMarketString( ticker.market_id );
+
+    // update values for market
+    MarketInfo &info = market_info.getById( ticker.market_id );
+    const bool is_changed = info.ticker.bid != bid || info.ticker.ask != ask;
+
+    info.ticker.bid = bid;
+    info.ticker.ask = ask;
+    info.is_tradeable = true;
+
+    // sample it for the rolling stats
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
+    if ( is_changed )
+        info.last_ticker_change_time = current_time;
+    if ( recorder )
+        recorder->recordTicker( market, bid, ask, current_time );
+
+    if ( info.ticker_history.getLastTime() <= current_time - TICKER_HISTORY_INTERVAL )
+        info.ticker_history.add( bid, ask, current_time );
+
+    // share it with spruce, and the ipc subscribers
+    if ( is_changed )
     {
-        const Market market = i.key();
-        const TickerInfo &ticker = i.value();
-        const Coin &ask = ticker.ask;
-        const Coin &bid = ticker.bid;
+        shareTicker( market, info.ticker, current_time );
+
+        if ( EventFeed::isSubscribed( EventFeed::TYPE_TICKER ) )
+            EventFeed::publish( EventFeed::TYPE_TICKER, QString( "ticker %1 %2 %3 %4 %5\n" )
+                                                         .arg( getEngineId() )
+                                                         .arg( market )
+                                                         .arg( bid )
+                                                         .arg( ask )
+                                                         .arg( current_time ).toUtf8() );
+    }
 
-        // check for missing information
-        if ( ask.isZeroOrLess() || bid.isZeroOrLess() )
-            continue;
+    // link the inverse market once
+    if ( !info.inverse )
+    {
+        MarketInfo &linked = market_info[ Market( market ).getInverse() ];
+        info.inverse = &linked;
+        linked.inverse = &info;
+    }
 
-        // update values for market
-        MarketInfo &info = market_info[ market ];
+    // update values for inverse market, if it is not tradeable
+    MarketInfo &info_inverse = *info.inverse;
 
-        info.ticker.bid = bid;
-        info.ticker.ask = ask;
-        info.is_tradeable = true;
+    // if it doesn't have an active ticker, update it with the inverse market ticker
+    if ( !info_inverse.is_tradeable )
+    {
+        // cross prices (cached by info.ticker until the price changes)
+        info_inverse.ticker.bid = info.ticker.getAskInverse();
+        info_inverse.ticker.ask = info.ticker.getBidInverse();
 
-        // TODO: make this faster
-        // update values for inverse market, if it is not tradeable
-        Market market_inverse = market.getInverse();
-        MarketInfo &info_inverse = market_info[ market_inverse ];
+        if ( is_changed )
+            shareTicker( Market( market ).getInverse(), info_inverse.ticker, current_time );
+
+        // cross ticksizes (probably not needed)
+//        info_inverse.price_ticksize = info.quantity_ticksize;
+//        info_inverse.quantity_ticksize = info.price_ticksize;
+    }
 
-        // if it doesn't have an active ticker, update it with the inverse market ticker
-        if ( !info_inverse.is_tradeable )
+    return true;
+}
+
+bool Engine::isTrackedMarket( const qint32 market_id )
+{
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
+    if ( tracked_markets_time <= 0 || current_time - tracked_markets_time >= TRACKED_MARKETS_INTERVAL )
+        updateTrackedMarkets();
+
+    return tracked_market_ids.isEmpty() || tracked_market_ids.contains( market_id );
+}
+
+void Engine::updateTrackedMarkets()
+{
+    tracked_markets_time = VirtualClock::currentMSecsSinceEpoch();
+    tracked_market_ids = wanted_market_ids;
+
+    // markets with orders or ping-pong indices
+    for ( MarketInfoTable::const_iterator i = market_info.constBegin(); i != market_info.constEnd(); i++ )
+        if ( !i.value().position_index.isEmpty() )
+            tracked_market_ids += Market::getMarketId( i.key() );
+
+    const QVector<Position*> &all = positions->all();
+    for ( QVector<Position*>::const_iterator i = all.constBegin(); i != all.constEnd(); i++ )
+        tracked_market_ids += (*i)->market.getId();
+
+    // the markets spruce prices, for every portfolio
+    if ( spruce && spruce_lock )
+    {
+        QMutexLocker locker( spruce_lock );
+
+        QList<Spruce*> sprucez;
+        sprucez += spruce;
+        if ( spruce_portfolios )
+            sprucez += spruce_portfolios->values();
+
+        for ( QList<Spruce*>::const_iterator i = sprucez.constBegin(); i != sprucez.constEnd(); i++ )
         {
-            // cross prices
-            info_inverse.ticker.bid = CoinAmount::COIN / ask;
-            info_inverse.ticker.ask = CoinAmount::COIN / bid;
+            const QList<QString> markets_alpha = (*i)->getMarketsAlpha();
+            for ( QList<QString>::const_iterator j = markets_alpha.constBegin(); j != markets_alpha.constEnd(); j++ )
+                tracked_market_ids += Market( *j ).getId();
 
-            // cross ticksizes (probably not needed)
-//            info_inverse.price_ticksize = info.quantity_ticksize;
-//            info_inverse.quantity_ticksize = info.price_ticksize;
+            const QList<Market> &markets_beta = (*i)->getMarketsBeta();
+            for ( QList<Market>::const_iterator j = markets_beta.constBegin(); j != markets_beta.constEnd(); j++ )
+                tracked_market_ids += j->getId();
         }
     }
 
+    // the inverse is priced from the other side if it isn't tradeable
+    const QList<qint32> ids = tracked_market_ids.toList();
+    for ( QList<qint32>::const_iterator i = ids.constBegin(); i != ids.constEnd(); i++ )
+    {
+        const Market market( Market::getMarketString( *i ) );
+        if ( market.isValid() )
+            tracked_market_ids += market.getInverse().getId();
+    }
+
+    tracked_market_ids.remove( -1 );
+}
+
+void Engine::trackMarket( const Market &market )
+{
+    if ( wanted_market_ids.contains( market.getId() ) )
+        return;
+
+    // the ticker it waits for might be the next one, don't wait for the interval
+    wanted_market_ids += market.getId();
+    tracked_markets_time = 0;
+}
+
+void Engine::setTickerFresh()
+{
+    // our prices count again
+    if ( is_ticker_stale )
+    {
+        is_ticker_stale = false;
+        shareStale( false );
+    }
+
+    if ( !ticker_stale_timer->isActive() )
+        ticker_stale_timer->start( TICKER_STALE_TIME );
+}
+
+void Engine::onTickerStale()
+{
+    QMutexLocker locker( &engine_lock );
+
+    // a newer ticker came in, check again when that one would be stale
+    const qint64 time_left = rest_arr.value( engine_type )->ticker_update_time + TICKER_STALE_TIME - VirtualClock::currentMSecsSinceEpoch();
+    if ( time_left > 0 )
+    {
+        ticker_stale_timer->start( time_left );
+        return;
+    }
+
+    kDebug() << "local warning: no tickers for" << TICKER_STALE_TIME / 1000 << "seconds, leaving them out of the spread";
+    is_ticker_stale = true;
+    shareStale( true );
+}
+
+void Engine::shareTicker( const Market &market, const TickerInfo &ticker, const qint64 time )
+{
+    if ( !bbo )
+        return;
+
+    if ( !market_events )
+    {
+        bbo->update( engine_type, market, ticker, time );
+        return;
+    }
+
+    MarketEvent event;
+    event.ticker = ticker;
+    event.time = time;
+    event.market_id = market.getId();
+
+    // the first event since the overseer's last drain wakes it, the rest go along with it
+    if ( market_events->push( event ) )
+        emit gotTickerUpdate();
+}
+
+void Engine::shareStale( const bool stale )
+{
+    if ( !bbo )
+        return;
+
+    if ( !market_events )
+    {
+        bbo->setStale( engine_type, stale );
+        return;
+    }
+
+    MarketEvent event;
+    event.type = stale ? MarketEvent::STALE : MarketEvent::FRESH;
+    event.time = VirtualClock::currentMSecsSinceEpoch();
+
+    if ( market_events->push( event ) )
+        emit gotTickerUpdate();
+}
+
+void Engine::processTicker( BaseREST *base_rest_module, const QString &market, const TickerInfo &ticker )
+{
+    // update ticker update time
+    base_rest_module->ticker_update_time = VirtualClock::currentMSecsSinceEpoch();
+    setTickerFresh();
+
+    // a feed sends these a message at a time, keep the latest of each market and take them all after this turn
+    pending_tickers[ market ] = ticker;
+    pending_tickers_rest = base_rest_module;
+
+    // tests read the ticker right after
+    if ( is_testing )
+    {
+        onFlushTickers();
+        return;
+    }
+
+    if ( is_ticker_flush_scheduled )
+        return;
+
+    is_ticker_flush_scheduled = true;
+    QTimer::singleShot( 0, this, &Engine::onFlushTickers );
+}
+
+void Engine::onFlushTickers()
+{
+    QMutexLocker locker( &engine_lock );
+
+    is_ticker_flush_scheduled = false;
+
+    if ( pending_tickers.isEmpty() )
+        return;
+
+    // the feed doesn't detect fills, so no request time
+    QMap<QString, TickerInfo> tickers;
+    tickers.swap( pending_tickers );
+    processTicker( pending_tickers_rest, tickers );
+}
+
+void Engine::processTicker( BaseREST *base_rest_module, const QMap<QString, TickerInfo> &ticker_data, qint64 request_time_sent_ms )
+{
+    QVector<MarketTicker> tickers;
+    tickers.reserve( ticker_data.size() );
+    for ( QMap<QString, TickerInfo>::const_iterator i = ticker_data.begin(); i != ticker_data.end(); i++ )
+    {
+        const Market market( i.key() );
+        if ( market.isValid() )
+            tickers += MarketTicker( market.getId(), i.value().bid, i.value().ask );
+    }
+
+    processTicker( base_rest_module, tickers, request_time_sent_ms );
+}
+
+void Engine::processTicker( BaseREST *base_rest_module, const QVector<MarketTicker> &tickers, qint64 request_time_sent_ms )
+{
+    // feed tickers that came in before this go first
+    if ( !pending_tickers.isEmpty() )
+        onFlushTickers();
+
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
+
+    // update ticker update time
+    base_rest_module->ticker_update_time = current_time;
+    setTickerFresh();
+
+    bool has_update = false;
+    for ( QVector<MarketTicker>::const_iterator i = tickers.constBegin(); i != tickers.constEnd(); i++ )
+        if ( updateTicker( *i ) )
+            has_update = true;
+
+    // a standby that took over sets the primary's positions once their markets have prices
+    if ( has_update && !pending_snapshots.isEmpty() )
+        applyPendingSnapshots();
+
+    // let spruce check if prices moved enough to solve early, market_events wakes it by itself
+    if ( has_update && !market_events )
+        emit gotTickerUpdate();
+
+    // the simulated exchange fills instead of the checks below
+    if ( isPaperTrading() )
+    {
+        for ( QVector<MarketTicker>::const_iterator i = tickers.constBegin(); i != tickers.constEnd(); i++ )
+            paper->processTicker( Market::getMarketString( i->market_id ), TickerInfo( i->bid, i->ask ) );
+
+        return;
+    }
+
     // if this is a ticker feed, just process the ticker data. the fill feed will cause false fills when the ticker comes in just as new positions were set,
     // because we have no request time to compare the position set time to.
     if ( request_time_sent_ms <= 0 )
@@ -848,23 +1741,17 @@ void Engine::processTicker( BaseREST *base_rest_module, const QMap<QString, Tick
         // did we find bid == ask (we shouldn't have)
         bool found_equal_bid_ask = false;
 
-        // check for any orders that could've been filled
+        // check for any orders that could've been filled, only in the markets this ticker covers
         // (note: removed because ping-pong is deprecated, history-fill is preferred)
-        for ( QSet<Position*>::const_iterator j = positions->active().begin(); j != positions->active().end(); j++ )
+        QVector<Position*> crossed;
+        for ( QVector<MarketTicker>::const_iterator i = tickers.constBegin(); i != tickers.constEnd(); i++ )
         {
-            Position *const &pos = *j;
-
-            if ( !pos )
+            const QString market = Market::getMarketString( i->market_id );
+            if ( market.isEmpty() || !positions->hasActiveInMarket( market ) )
                 continue;
 
-            const QString &market = pos->market;
-            if ( market.isEmpty() || !ticker_data.contains( market ) )
-                continue;
-
-            const TickerInfo &ticker = ticker_data[ market ];
-
-            const Coin &ask = ticker.ask;
-            const Coin &bid = ticker.bid;
+            const Coin &ask = i->ask;
+            const Coin &bid = i->bid;
 
             // check for equal bid/ask
             if ( ask <= bid )
@@ -877,19 +1764,14 @@ void Engine::processTicker( BaseREST *base_rest_module, const QMap<QString, Tick
             if ( ask.isZeroOrLess() || bid.isZeroOrLess() )
                 continue;
 
-            // check for position price collision with ticker prices
-            quint8 fill_details = 0;
-            if      ( pos->side == SIDE_SELL && pos->sell_price <= bid ) // sell price <= hi buy
-                fill_details = 1;
-            else if ( pos->side == SIDE_BUY  && pos->buy_price >= ask ) // buy price => lo sell
-                fill_details = 2;
-            else if ( pos->side == SIDE_SELL && pos->sell_price < ask ) // sell price < lo sell
-                fill_details = 3;
-            else if ( pos->side == SIDE_BUY  && pos->buy_price > bid ) // buy price > hi buy
-                fill_details = 4;
-
-            if ( fill_details > 0 )
+            // get positions with price collisions with the ticker prices (sell price < lo sell, buy price > hi buy)
+            crossed.clear();
+            positions->getCrossedByTicker( market, bid, ask, crossed );
+
+            for ( QVector<Position*>::const_iterator j = crossed.begin(); j != crossed.end(); j++ )
             {
+                Position *const &pos = *j;
+
                 // is the order pretty new?
                 if ( pos->order_set_time > request_time_sent_ms - settings->ticker_safety_delay_time || // if the request time is supplied, check that we didn't send the ticker command before the position was set
                      pos->order_set_time > current_time - settings->ticker_safety_delay_time ) // allow for a safe period to avoid orders we just set possibly not showing up yet
@@ -920,43 +1802,145 @@ void Engine::processCancelledOrder( Position * const &pos )
 {
     // pos must be valid!
 
-    // we succeeded at cancelling a slippage position or timed out position, now put it back to the -same side- and at its original prices
-    if ( ( pos->is_slippage && pos->cancel_reason == CANCELLING_FOR_SLIPPAGE_RESET ) ||
-         ( !pos->is_onetime && pos->cancel_reason == CANCELLING_FOR_MAX_AGE ) )
-    {
-        if ( pos->strategy_tag.startsWith( "spruce" ) )
-        {
-            addPosition( pos->market, pos->side, pos->buy_price_original, pos->sell_price_original, pos->original_size, "onetime", pos->strategy_tag,
-                         QVector<qint32>(), false, true );
-        }
-        else if ( pos->is_landmark )
-        {
-            addLandmarkPositionFor( pos );
-        }
-        else
-        {
-            const PositionData &new_pos = market_info[ pos->market ].position_index.value( pos->market_indices.value( 0 ) );
+    latency.addSince( "order cancel->ack", pos->order_cancel_time, VirtualClock::currentMSecsSinceEpoch() );
+    Metrics::add( Metrics::getEngineCounters( engine_type ).orders_cancelled );
+    journalOrder( ORDER_JOURNAL_CANCEL, pos );
 
-            addPosition( pos->market, pos->side, new_pos.buy_price, new_pos.sell_price, new_pos.order_size, ACTIVE, "",
-                         pos->market_indices, false, true );
-        }
-    }
+    // we succeeded at cancelling a slippage position or timed out position, now put it back (unless that's been done already)
+    if ( !pos->is_replaced && isReplacedOnCancel( pos, pos->cancel_reason ) )
+        addReplacementFor( pos );
 
-    if ( verbosity > 0 )
-        kDebug() << QString( "%1 %2" )
-                    .arg( "cancelled", -15 )
-                    .arg( pos->stringifyOrder() );
+    kLogIf( LOG_LEVEL_DEBUG, verbosity > 0 ) << "cancelled      " << pos->logOrder();
 
     // depending on the type of cancel, we should take some action
     if ( pos->cancel_reason == CANCELLING_FOR_DC )
         cancelOrderMeatDCOrder( pos );
-    else if ( pos->cancel_reason == CANCELLING_FOR_SHORTLONG )
-        flipPosition( pos );
+    else if ( pos->cancel_reason == CANCELLING_FOR_SHORTLONG && flipPositionInPlace( pos ) )
+        return; // set again with the same object
 
     // delete position
     positions->remove( pos );
 }
 
+void Engine::journalOrder( const quint8 type, Position *const &pos )
+{
+    if ( is_testing )
+        return;
+
+    OrderJournalEvent event;
+    event.type = type;
+    event.exchange = engine_type;
+    event.side = pos->side;
+    event.time = VirtualClock::currentMSecsSinceEpoch();
+    event.market = pos->market;
+    event.strategy_tag = pos->strategy_tag;
+    event.order_id = pos->order_number.toString();
+    event.price = pos->price;
+    event.quantity = pos->quantity;
+    event.amount = pos->amount;
+
+    if ( type == ORDER_JOURNAL_CANCEL )
+    {
+        event.cancel_reason = pos->cancel_reason;
+        event.request_time = pos->order_cancel_time;
+    }
+    else
+    {
+        event.request_time = pos->order_request_time;
+    }
+
+    journal->record( event );
+
+    if ( EventFeed::isSubscribed( EventFeed::TYPE_ORDER ) )
+        EventFeed::publish( EventFeed::TYPE_ORDER, QString( "order %1 %2 %3 %4 %5 %6 %7 %8 %9 %10\n" )
+                                                    .arg( type == ORDER_JOURNAL_CANCEL ? "cancel" : "set" )
+                                                    .arg( getEngineId() )
+                                                    .arg( pos->market )
+                                                    .arg( pos->side == SIDE_BUY ? "buy" : "sell" )
+                                                    .arg( event.order_id )
+                                                    .arg( pos->price )
+                                                    .arg( pos->quantity )
+                                                    .arg( pos->amount )
+                                                    .arg( pos->strategy_tag.isEmpty() ? QString( "-" ) : pos->strategy_tag )
+                                                    .arg( event.time ).toUtf8() );
+}
+
+void Engine::addReplacementFor( Position *const &pos )
+{
+    // put it back to the -same side- and at its original prices
+    if ( pos->strategy_tag.startsWith( "spruce" ) )
+    {
+        addPosition( pos->market, pos->side, pos->buy_price_original, pos->sell_price_original, pos->original_size, "onetime", pos->strategy_tag,
+                     QVector<qint32>(), false, true );
+    }
+    else if ( pos->is_landmark )
+    {
+        addLandmarkPositionFor( pos );
+    }
+    else
+    {
+        const PositionData &new_pos = market_info[ pos->market ].position_index.value( pos->market_indices.value( 0 ) );
+
+        addGridPosition( pos->market, pos->side, new_pos, pos->market_indices );
+    }
+}
+
+bool Engine::isReplacedOnCancel( Position *const &pos, quint8 cancel_reason ) const
+{
+    return ( pos->is_slippage && cancel_reason == CANCELLING_FOR_SLIPPAGE_RESET ) ||
+           ( !pos->is_onetime && cancel_reason == CANCELLING_FOR_MAX_AGE );
+}
+
+bool Engine::replaceOrder( Position *const &pos, quint8 cancel_reason )
+{
+    // binance swaps them in one request. elsewhere both orders could fill in the gap, so only
+    // send them back to back for orders that don't hold a grid index
+    if ( is_testing ||
+         !positions->isActive( pos ) ||
+         pos->is_cancelling ||
+         !isReplacedOnCancel( pos, cancel_reason ) ||
+         ( engine_type != ENGINE_BINANCE && !pos->market_indices.isEmpty() ) )
+        return false;
+
+    // mark it cancelling, the request goes out with the replacement
+    positions->cancel( pos, false, cancel_reason, false );
+    pos->is_replaced = true;
+
+    // addPosition() ends in sendBuySell(), which picks this up
+    replacing_pos = pos;
+    addReplacementFor( pos );
+
+    // no replacement was set, cancel it by itself and put it back on the ack like before
+    if ( replacing_pos != nullptr )
+    {
+        replacing_pos = nullptr;
+        pos->is_replaced = false;
+        sendCancel( pos->order_number, pos, engine_type == ENGINE_WAVES ? pos->market : Market() );
+    }
+
+    return true;
+}
+
+void Engine::sendReplace( Position *const &replaced_pos, Position *const &pos, bool quiet )
+{
+    if ( isPaperTrading() )
+    {
+        paper->sendCancel( replaced_pos );
+        paper->sendBuySell( pos );
+        return;
+    }
+
+    if ( engine_type == ENGINE_BINANCE )
+    {
+        reinterpret_cast<BncREST*>( rest_arr.value( ENGINE_BINANCE ) )->sendCancelReplace( replaced_pos, pos, quiet );
+        return;
+    }
+
+    // no native replace, pipeline the cancel and the new order instead of waiting for the ack
+    sendCancel( replaced_pos->order_number, replaced_pos, engine_type == ENGINE_WAVES ? replaced_pos->market : Market() );
+    sendBuySell( pos, quiet );
+}
+
 void Engine::cancelOrderMeatDCOrder( Position * const &pos )
 {
     QVector<Position*> cancelling_positions;
@@ -1004,9 +1988,9 @@ void Engine::cancelOrderMeatDCOrder( Position * const &pos )
         {
             // clear from diverging_converging
             for ( int i = 0; i < new_indices.size(); i++ )
-                positions->getDCPending()[ pos->market ].removeOne( new_indices.value( i ) );
+                positions->removeDCIndex( pos->market, new_indices.value( i ) );
 
-            pos->market_indices = new_indices;
+            pos->setMarketIndices( new_indices );
             addLandmarkPositionFor( pos );
         }
         else // we diverged into multiple standard orders
@@ -1018,7 +2002,7 @@ void Engine::cancelOrderMeatDCOrder( Position * const &pos )
                 qint32 idx = new_indices.value( i );
 
                 // clear from diverging_converging
-                positions->getDCPending()[ pos->market ].removeOne( idx );
+                positions->removeDCIndex( pos->market, idx );
 
                 // check for valid index data - incase we are cancelling
                 if ( !info.position_index.size() )
@@ -1031,8 +2015,7 @@ void Engine::cancelOrderMeatDCOrder( Position * const &pos )
                 QVector<qint32> new_index_single;
                 new_index_single.append( new_indices.value( i ) );
 
-                addPosition( pos->market, pos->side, data.buy_price, data.sell_price, data.order_size, ACTIVE, "",
-                             new_index_single, false, true );
+                addGridPosition( pos->market, pos->side, data, new_index_single );
             }
         }
     }
@@ -1053,24 +2036,150 @@ void Engine::saveMarket( QString market, qint32 num_orders )
     if ( num_orders < 15 )
         num_orders = 15;
 
-    // open dump file
     QString path = Global::getTraderPath() + QDir::separator() + QString( "index-%1.txt" ).arg( market );
-    QFile savefile( path );
 
-    if ( !savefile.open( QIODevice::WriteOnly | QIODevice::Text ) )
+    // the positions come from a current snapshot, read on the save thread
+    const PositionSnapshotPtr snapshot = positions->publishSnapshot( true );
+
+    // the index lists are shared until they change, the text is built on the save thread
+    QHash<QString, QVector<PositionData>> market_lists;
+    for ( MarketInfoTable::const_iterator i = market_info.begin(); i != market_info.end(); i++ )
     {
-        kDebug() << "local error: couldn't open savemarket file" << path;
-        return;
+        // apply our market filter
+        if ( market != ALL && i.key() != market )
+            continue;
+
+        if ( i.key().isEmpty() || i.value().position_index.isEmpty() )
+            continue;
+
+        market_lists.insert( i.key(), i.value().position_index.toVector() );
     }
 
-    QTextStream out_savefile( &savefile );
+    saver->save( path, [path, market, num_orders, market_lists, snapshot]()
+    {
+        // collect the buy and sell indices of every market in one pass
+        QHash<QString, QSet<qint32>> market_buys, market_sells;
+        for ( QVector<PositionSnapshotEntry>::const_iterator j = snapshot->positions.begin(); j != snapshot->positions.end(); j++ )
+        {
+            if ( market != ALL && j->market != market )
+                continue;
+
+            QSet<qint32> &indices = ( j->side == SIDE_SELL ) ? market_sells[ j->market ] : market_buys[ j->market ];
+            for ( QVector<qint32>::const_iterator k = j->market_indices.constBegin(); k != j->market_indices.constEnd(); k++ )
+                indices.insert( *k );
+        }
+
+        QString out_savefile;
+        qint32 saved_market_count = 0;
+
+        for ( QHash<QString, QVector<PositionData>>::const_iterator i = market_lists.begin(); i != market_lists.end(); i++ )
+        {
+            const QString &current_market = i.key();
+            const QVector<PositionData> &list = i.value();
+
+            // store buy and sell indices
+            qint32 highest_sell_idx = 0, lowest_sell_idx = std::numeric_limits<qint32>::max();
+            const QSet<qint32> buys = market_buys.value( current_market ), sells = market_sells.value( current_market );
+
+            for ( QSet<qint32>::const_iterator k = sells.begin(); k != sells.end(); k++ )
+            {
+                if ( *k > highest_sell_idx ) highest_sell_idx = *k;
+                if ( *k < lowest_sell_idx ) lowest_sell_idx = *k;
+            }
+
+            // bad index check
+            if ( buys.isEmpty() && sells.isEmpty() )
+            {
+                kDebug() << "local error: couldn't buy or sell indices for market" << current_market;
+                continue;
+            }
+
+            // save each index as setorder
+            qint32 current_index = 0;
+            for ( QVector<PositionData>::const_iterator j = list.begin(); j != list.end(); j++ )
+            {
+                const PositionData &pos_data = *j;
+
+                bool is_active = ( sells.contains( current_index ) || buys.contains( current_index ) ) &&
+                                 current_index > lowest_sell_idx - num_orders &&
+                                 current_index < lowest_sell_idx + num_orders;
+
+                bool is_sell = sells.contains( current_index ) || // is active sell
+                            ( current_index > highest_sell_idx && highest_sell_idx > 0 ); // is ghost sell
+
+                // if the order has an "alternate_size", append it to preserve the state
+                QString order_size = pos_data.order_size;
+                if ( pos_data.hasAlternateSize() )
+                    order_size += QString( "/%1" ).arg( pos_data.getAlternateSizeString() );
+
+                out_savefile += QString( "setorder %1 %2 %3 %4 %5 %6\n" )
+                                .arg( current_market )
+                                .arg( is_sell ? SELL : BUY )
+                                .arg( pos_data.buy_price )
+                                .arg( pos_data.sell_price )
+                                .arg( order_size )
+                                .arg( is_active ? ACTIVE : GHOST );
+
+                current_index++;
+            }
 
-    qint32 saved_market_count = 0;
-    for ( QHash<QString, MarketInfo>::const_iterator i = market_info.begin(); i != market_info.end(); i++ )
+            // track number of saved markets
+            if ( current_index > 0 )
+                saved_market_count++;
+
+            kDebug() << "saved market" << current_market << "with" << current_index << "indices";
+        }
+
+        // if we didn't save any markets, just exit
+        if ( saved_market_count == 0 )
+        {
+            kDebug() << "no markets saved";
+            return true;
+        }
+
+        return AsyncSaver::writeFile( path, out_savefile.toUtf8(), true );
+    } );
+}
+
+void Engine::saveSnapshot( QString market )
+{
+    // the arg will always be supplied; set the default arg here instead of the function def
+    if ( market.isEmpty() )
+        market = ALL;
+
+    // each market gets its own file, so saving one market doesn't rewrite the others
+    const QMap<QString, QByteArray> snapshots = getSnapshotData( market );
+    for ( QMap<QString, QByteArray>::const_iterator i = snapshots.begin(); i != snapshots.end(); i++ )
+    {
+        const QString path = Global::getTraderPath() + QDir::separator() + QString( "snapshot-%1.bin" ).arg( i.key() );
+        const QByteArray data = i.value();
+        saver->save( path, [path, data]() { return AsyncSaver::writeFile( path, data ); } );
+
+        kDebug() << "saved snapshot" << i.key() << "with" << market_info[ i.key() ].position_index.size() << "indices," << data.size() << "bytes";
+    }
+}
+
+QMap<QString, QByteArray> Engine::getSnapshotData( const QString &market )
+{
+    // group the ping-pong positions of each market in one pass, from a current snapshot
+    const PositionSnapshotPtr snapshot = positions->publishSnapshot( true );
+    QHash<QString, QVector<const PositionSnapshotEntry*>> market_positions;
+    for ( QVector<PositionSnapshotEntry>::const_iterator i = snapshot->positions.begin(); i != snapshot->positions.end(); i++ )
+    {
+        if ( i->is_onetime || i->market_indices.isEmpty() )
+            continue;
+
+        if ( market != ALL && i->market != market )
+            continue;
+
+        market_positions[ i->market ].append( &*i );
+    }
+
+    QMap<QString, QByteArray> ret;
+    for ( MarketInfoTable::const_iterator i = market_info.begin(); i != market_info.end(); i++ )
     {
         const QString &current_market = i.key();
-        const MarketInfo &info = i.value();
-        const QVector<PositionData> &list = info.position_index;
+        const QVector<PositionData> list = i.value().position_index.toVector();
 
         // apply our market filter
         if ( market != ALL && current_market != market )
@@ -1079,107 +2188,315 @@ void Engine::saveMarket( QString market, qint32 num_orders )
         if ( current_market.isEmpty() || list.isEmpty() )
             continue;
 
-        // store buy and sell indices
-        qint32 highest_sell_idx = 0, lowest_sell_idx = std::numeric_limits<qint32>::max();
-        QVector<qint32> buys, sells;
+        QByteArray data;
+        QDataStream out( &data, QIODevice::WriteOnly );
+        out.setVersion( QDataStream::Qt_5_0 );
 
-        for ( QSet<Position*>::const_iterator j = positions->all().begin(); j != positions->all().end(); j++ )
+        out << SNAPSHOT_MAGIC << SNAPSHOT_VERSION << current_market;
+
+        // ping-pong indices, with the fill state the text format doesn't keep
+        out << qint32( list.size() );
+        for ( QVector<PositionData>::const_iterator j = list.begin(); j != list.end(); j++ )
+            out << QString( j->buy_price ) << QString( j->sell_price ) << QString( j->order_size ) << j->getAlternateSizeString()
+                << j->fill_count;
+
+        // positions and their order ids
+        const QVector<const PositionSnapshotEntry*> &market_list = market_positions[ current_market ];
+        out << qint32( market_list.size() );
+        for ( QVector<const PositionSnapshotEntry*>::const_iterator j = market_list.begin(); j != market_list.end(); j++ )
         {
-            Position *const &pos = *j;
+            const PositionSnapshotEntry *const &entry = *j;
+            out << entry->side << entry->market_indices << entry->is_landmark << entry->strategy_tag << entry->order_number.toString();
+        }
 
-            // skip other markets
-            if ( pos->market != current_market )
-                continue;
+        ret.insert( current_market, data );
+    }
 
-            bool is_sell = ( pos->side == SIDE_SELL );
+    return ret;
+}
 
-            for ( QVector<qint32>::const_iterator k = pos->market_indices.begin(); k != pos->market_indices.end(); k++ )
-            {
-                if ( is_sell )
-                {
-                    sells.append( *k );
-                    if ( *k > highest_sell_idx ) highest_sell_idx = *k;
-                    if ( *k < lowest_sell_idx ) lowest_sell_idx = *k;
-                }
-                else
-                    buys.append( *k );
-            }
-        }
+void Engine::loadSnapshot( const QString &market )
+{
+    const QString path = Global::getTraderPath() + QDir::separator() + QString( "snapshot-%1.bin" ).arg( market );
+    QFile loadfile( path );
 
-        // bad index check
-        if ( buys.isEmpty() && sells.isEmpty() )
+    if ( !loadfile.open( QIODevice::ReadOnly ) )
+    {
+        kDebug() << "local error: couldn't open snapshot file" << path;
+        return;
+    }
+
+    // read it in one go
+    const QByteArray data = loadfile.readAll();
+    loadfile.close();
+
+    readSnapshot( market, data, path );
+}
+
+bool Engine::readSnapshot( const QString &market, const QByteArray &data, const QString &source )
+{
+    QDataStream in( data );
+    in.setVersion( QDataStream::Qt_5_0 );
+
+    quint32 magic = 0, version = 0;
+    QString snapshot_market;
+    in >> magic >> version >> snapshot_market;
+
+    if ( magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION || snapshot_market != market )
+    {
+        kDebug() << "local error: snapshot" << source << "has a bad header or version" << version;
+        return false;
+    }
+
+    MarketInfo &info = market_info[ market ];
+
+    // don't mix the snapshot into indices that were already set
+    if ( !info.position_index.isEmpty() )
+    {
+        kDebug() << "local error: tried to load snapshot for" << market << "but it already has" << info.position_index.size() << "indices";
+        return false;
+    }
+
+    if ( !info.ticker.isValid() )
+    {
+        kDebug() << "local error: ticker has not been read yet. (try again)";
+        return false;
+    }
+
+    qint32 index_count = 0;
+    in >> index_count;
+
+    QVector<PositionData> list;
+    list.reserve( qMax( index_count, 0 ) );
+    for ( qint32 i = 0; i < index_count && in.status() == QDataStream::Ok; i++ )
+    {
+        QString buy_price, sell_price, order_size, alternate_size;
+        quint32 fill_count = 0;
+        in >> buy_price >> sell_price >> order_size >> alternate_size >> fill_count;
+
+        PositionData pos_data( buy_price, sell_price, order_size, alternate_size );
+        pos_data.fill_count = fill_count;
+        list.append( pos_data );
+    }
+
+    qint32 position_count = 0;
+    in >> position_count;
+
+    if ( in.status() != QDataStream::Ok || index_count <= 0 || position_count < 0 )
+    {
+        kDebug() << "local error: snapshot" << source << "is truncated";
+        return false;
+    }
+
+    info.position_index.setVector( list );
+
+    // set the saved positions again, the exchange orders were cancelled when we shut down
+    qint32 positions_set = 0, positions_replayed = 0;
+    for ( qint32 i = 0; i < position_count && in.status() == QDataStream::Ok; i++ )
+    {
+        quint8 side = 0;
+        QVector<qint32> indices;
+        bool landmark = false;
+        QString strategy_tag, order_number;
+        in >> side >> indices >> landmark >> strategy_tag >> order_number;
+
+        // skip indices that don't exist
+        bool indices_ok = !indices.isEmpty();
+        for ( QVector<qint32>::const_iterator j = indices.begin(); j != indices.end(); j++ )
+            if ( *j < 0 || *j >= list.size() )
+                indices_ok = false;
+
+        if ( in.status() != QDataStream::Ok || !indices_ok )
+            break;
+
+        // the primary's order went on after its snapshot, do what it did with it. a fill or shortlong cancel flips it,
+        // slippage and max age cancels set it again, and the rest leave it cancelled
+        const QHash<QString, QPair<quint8, quint8>>::const_iterator tail = order_number.isEmpty() ? pending_journal_tail.constEnd() :
+                                                                                                     pending_journal_tail.constFind( order_number );
+        if ( tail != pending_journal_tail.constEnd() )
         {
-            kDebug() << "local error: couldn't buy or sell indices for market" << current_market;
-            continue;
+            positions_replayed++;
+            const quint8 type = tail.value().first;
+            const quint8 cancel_reason = tail.value().second;
+
+            if ( type == ORDER_JOURNAL_FILL )
+                for ( QVector<qint32>::const_iterator j = indices.begin(); j != indices.end(); j++ )
+                    info.position_index.iterateFillCount( *j );
+
+            if ( type == ORDER_JOURNAL_FILL || cancel_reason == CANCELLING_FOR_SHORTLONG )
+                side = side == SIDE_BUY ? SIDE_SELL : SIDE_BUY;
+            else if ( cancel_reason != CANCELLING_FOR_SLIPPAGE_RESET && cancel_reason != CANCELLING_FOR_MAX_AGE )
+                continue;
         }
 
-        // save each index as setorder
-        qint32 current_index = 0;
-        for ( QVector<PositionData>::const_iterator j = list.begin(); j != list.end(); j++ )
-        {
-            const PositionData &pos_data = *j;
+        const PositionData pos_data = info.position_index.value( indices.first() );
+        if ( landmark )
+            addPositionToMarket( Market( market ), false, side, "0.00000001", "0.00000002", "0.00000000", ACTIVE, strategy_tag,
+                                 indices, true, true );
+        else
+            addPositionToMarket( Market( market ), false, side, pos_data.buy_price, pos_data.sell_price, pos_data.order_size, ACTIVE, strategy_tag,
+                                 indices, false, true );
+
+        positions_set++;
+    }
 
-            bool is_active = ( sells.contains( current_index ) || buys.contains( current_index ) ) &&
-                             current_index > lowest_sell_idx - num_orders &&
-                             current_index < lowest_sell_idx + num_orders;
+    kDebug() << "loaded snapshot" << market << "with" << list.size() << "indices and" << positions_set << "of" << position_count << "positions,"
+             << positions_replayed << "of them went on after it";
+    return true;
+}
 
-            bool is_sell = sells.contains( current_index ) || // is active sell
-                        ( current_index > highest_sell_idx && highest_sell_idx > 0 ); // is ghost sell
+void Engine::setPendingSnapshots( const QMap<QString, QByteArray> &snapshots, const QVector<OrderJournalEvent> &journal_tail )
+{
+    pending_snapshots = snapshots;
 
-            // if the order has an "alternate_size", append it to preserve the state
-            QString order_size = pos_data.order_size;
-            if ( pos_data.alternate_size.size() > 0 )
-                order_size += QString( "/%1" ).arg( pos_data.alternate_size );
+    // only the last fill or cancel of each order, sets are the flips and new orders that are set again anyway
+    pending_journal_tail.clear();
+    for ( QVector<OrderJournalEvent>::const_iterator i = journal_tail.begin(); i != journal_tail.end(); i++ )
+        if ( i->type == ORDER_JOURNAL_FILL || i->type == ORDER_JOURNAL_CANCEL )
+            pending_journal_tail.insert( i->order_id, qMakePair( i->type, i->cancel_reason ) );
 
-            out_savefile << QString( "setorder %1 %2 %3 %4 %5 %6\n" )
-                            .arg( current_market )
-                            .arg( is_sell ? SELL : BUY )
-                            .arg( pos_data.buy_price )
-                            .arg( pos_data.sell_price )
-                            .arg( order_size )
-                            .arg( is_active ? ACTIVE : GHOST );
+    applyPendingSnapshots();
+}
 
-            current_index++;
+void Engine::applyPendingSnapshots()
+{
+    QMap<QString, QByteArray>::iterator i = pending_snapshots.begin();
+    while ( i != pending_snapshots.end() )
+    {
+        if ( !market_info[ i.key() ].ticker.isValid() )
+        {
+            i++;
+            continue;
         }
 
-        // track number of saved markets
-        if ( current_index > 0 )
-            saved_market_count++;
+        readSnapshot( i.key(), i.value(), QString( "from the primary" ) );
+        i = pending_snapshots.erase( i );
+    }
+
+    if ( pending_snapshots.isEmpty() )
+        pending_journal_tail.clear();
+}
+
+void Engine::setJournalReplica( OrderJournalReplica *replica )
+{
+    journal->setReplica( replica, getEngineId() );
+}
 
-        kDebug() << "saved market" << current_market << "with" << current_index << "indices";
+void Engine::loadSettings()
+{
+    const QString path = getSettingsPath();
+    QFile loadfile( path );
+
+    if ( !loadfile.open( QIODevice::ReadOnly | QIODevice::Text ) )
+    {
+        kDebug() << "local warning: couldn't load optional engine settings file" << path;
+        return;
     }
 
-    // if we didn't save any markets, just exit
-    if ( saved_market_count == 0 )
+    if ( loadfile.bytesAvailable() == 0 )
+        return;
+
+    const QByteArray text = loadfile.readAll();
+    const QByteArray text_hash = SettingsState::getTextHash( text );
+
+    // the file didn't change since the last start, set the market settings directly and replay the rest
+    QString residual;
+    QByteArray state;
+    if ( SettingsState::read( path, SETTINGS_STATE_VERSION, text_hash, residual, state ) && readMarketSettingsState( state ) )
     {
-        kDebug() << "no markets saved";
+        kDebug() << "[Engine] restored engine settings state," << state.size() << "bytes, replaying" << residual.size() << "bytes.";
+
+        if ( !residual.isEmpty() )
+            emit gotUserCommandChunk( residual );
+
         return;
     }
 
-    // save the buffer
-    out_savefile.flush();
-    savefile.close();
+    // emit new lines
+    const QString data = QString::fromUtf8( text );
+    kDebug() << "[Engine] loaded optional engine settings," << data.size() << "bytes.";
+
+    // the runner is on our thread, so the chunk has run when this returns
+    emit gotUserCommandChunk( data );
+
+    // take the state for the next start
+    const QString state_path = SettingsState::getPath( path );
+    const QByteArray image = SettingsState::pack( SETTINGS_STATE_VERSION, text_hash,
+                                                  SettingsState::getResidual( data, SETTINGS_STATE_COMMANDS ),
+                                                  getMarketSettingsState() );
+    saver->save( state_path, [state_path, image]() { return AsyncSaver::writeFile( state_path, image ); } );
+}
+
+QByteArray Engine::getMarketSettingsState() const
+{
+    QByteArray state;
+    QDataStream out( &state, QIODevice::WriteOnly );
+    out.setVersion( QDataStream::Qt_5_0 );
+
+    out << qint32( market_info.size() );
+    for ( MarketInfoTable::const_iterator i = market_info.begin(); i != market_info.end(); i++ )
+    {
+        const MarketInfo &info = i.value();
+        out << i.key() << info.order_min << info.order_max << info.order_dc << info.order_dc_nice
+            << info.order_landmark_thresh << info.order_landmark_start << info.slippage_timeout
+            << info.market_offset << info.market_sentiment;
+    }
+
+    return state;
 }
 
-void Engine::loadSettings()
+bool Engine::readMarketSettingsState( const QByteArray &state )
 {
-    const QString path = getSettingsPath();
-    QFile loadfile( path );
-
-    if ( !loadfile.open( QIODevice::ReadOnly | QIODevice::Text ) )
+    struct MarketSettings
     {
-        kDebug() << "local warning: couldn't load optional engine settings file" << path;
-        return;
+        QString market;
+        qint32 order_min{ 0 }, order_max{ 0 }, order_dc{ 0 }, order_dc_nice{ 0 };
+        qint32 order_landmark_thresh{ 0 }, order_landmark_start{ 0 }, slippage_timeout{ 0 };
+        qreal market_offset{ 0. };
+        bool market_sentiment{ false };
+    };
+
+    QDataStream in( state );
+    in.setVersion( QDataStream::Qt_5_0 );
+
+    qint32 market_count = 0;
+    in >> market_count;
+
+    // read all of it before setting any
+    QVector<MarketSettings> list;
+    list.reserve( qMax( market_count, 0 ) );
+    for ( qint32 i = 0; i < market_count && in.status() == QDataStream::Ok; i++ )
+    {
+        MarketSettings s;
+        in >> s.market >> s.order_min >> s.order_max >> s.order_dc >> s.order_dc_nice
+           >> s.order_landmark_thresh >> s.order_landmark_start >> s.slippage_timeout
+           >> s.market_offset >> s.market_sentiment;
+        list.append( s );
     }
 
-    if ( loadfile.bytesAvailable() == 0 )
-        return;
+    if ( in.status() != QDataStream::Ok || market_count < 0 )
+    {
+        kDebug() << "local warning: engine settings state is truncated, replaying the settings file";
+        return false;
+    }
 
-    // emit new lines
-    QString data = loadfile.readAll();
-    kDebug() << "[Engine] loaded optional engine settings," << data.size() << "bytes.";
+    for ( QVector<MarketSettings>::const_iterator i = list.begin(); i != list.end(); i++ )
+    {
+        MarketInfo &info = market_info[ i->market ];
+        info.order_min = i->order_min;
+        info.order_max = i->order_max;
+        info.order_dc = i->order_dc;
+        info.order_dc_nice = i->order_dc_nice;
+        info.order_landmark_thresh = i->order_landmark_thresh;
+        info.order_landmark_start = i->order_landmark_start;
+        info.slippage_timeout = i->slippage_timeout;
+        info.market_offset = i->market_offset;
+        info.market_sentiment = i->market_sentiment;
+
+        positions->setDCDirty( i->market );
+    }
 
-    emit gotUserCommandChunk( data );
+    return true;
 }
 
 void Engine::flipPosition( Position *const &pos )
@@ -1205,9 +2522,49 @@ void Engine::flipPosition( Position *const &pos )
         // we could use the same prices, but instead we reset the data incase there was slippage
         const PositionData &new_data = market_info[ pos->market ].position_index.value( pos->market_indices.value( 0 ) );
 
-        addPosition( pos->market, pos->side, new_data.buy_price, new_data.sell_price, new_data.order_size, ACTIVE, "",
-                     pos->market_indices, false, true );
+        addGridPosition( pos->market, pos->side, new_data, pos->market_indices );
+    }
+}
+
+bool Engine::flipPositionInPlace( Position *const pos )
+{
+    // pos must be valid!
+
+    // if it's not a ping-pong order, don't pong
+    if ( pos->is_onetime )
+        return false;
+
+    MarketInfo &info = market_info[ pos->market ];
+
+    // landmarks are rebuilt from their indices, and the rest take the long way if something's missing
+    if ( pos->is_landmark ||
+        !pos->market.isValid() ||
+        !info.is_tradeable ||
+        !info.ticker.isValid() ||
+         rest_arr.value( engine_type )->isKeyOrSecretUnset() )
+    {
+        flipPosition( pos );
+        return false;
     }
+
+    // keep what we need, the position is reset below
+    const Market market = pos->market;
+    const quint8 side = pos->side == SIDE_BUY ? SIDE_SELL : SIDE_BUY;
+    const QVector<qint32> indices = pos->market_indices;
+
+    // we could use the same prices, but instead we reset the data incase there was slippage
+    const PositionData data = info.position_index.value( indices.value( 0 ) );
+
+    // take the filled order out, it's already been logged if that fails
+    if ( !positions->detach( pos ) )
+        return true;
+
+    // and set the same object up as the next order, the values were validated when the index was set
+    positions->getPool().reacquire( pos, market, side, data.buy_price, data.sell_price, data.order_size, QLatin1String(),
+                                    indices, false, this );
+    setParsedPosition( info, pos, ACTIVE, false, false, true );
+
+    return true;
 }
 
 void Engine::cleanGraceTimes()
@@ -1216,33 +2573,46 @@ void Engine::cleanGraceTimes()
     if ( order_grace_times.isEmpty() )
         return;
 
-    const qint64 &current_time = QDateTime::currentMSecsSinceEpoch();
-    QStringList removed;
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
 
-    for ( QHash<QString, qint64>::const_iterator i = order_grace_times.begin(); i != order_grace_times.end(); i++ )
+    // walk the queue from the oldest entry, stop at the first one that hasn't expired
+    while ( !order_grace_queue.isEmpty() )
     {
-        const QString &order = i.key();
-        const qint64 &seen_time = i.value();
+        const QPair<qint64, OrderId> &entry = order_grace_queue.head();
+        QHash<OrderId, qint64>::iterator i = order_grace_times.find( entry.second );
+
+        // the grace time was reset after this entry was queued, a newer entry covers it
+        if ( i == order_grace_times.end() || i.value() != entry.first )
+        {
+            order_grace_queue.dequeue();
+            continue;
+        }
 
         // clear order ids older than timeout
-        if ( seen_time < current_time - ( settings->stray_grace_time_limit *2 ) )
-            removed.append( order );
+        if ( entry.first >= current_time - ( settings->stray_grace_time_limit *2 ) )
+            break;
+
+        order_grace_times.erase( i );
+        order_grace_queue.dequeue();
     }
+}
 
-    // clear removed after iterator finishes
-    while ( removed.size() > 0 )
-        order_grace_times.remove( removed.takeFirst() );
+void Engine::setGraceTime( const OrderId &order_id, const qint64 seen_time )
+{
+    order_grace_times.insert( order_id, seen_time );
+    order_grace_queue.enqueue( qMakePair( seen_time, order_id ) );
 }
 
 
 void Engine::checkMaintenance()
 {
-    if ( maintenance_triggered || maintenance_time <= 0 || maintenance_time > QDateTime::currentMSecsSinceEpoch() )
+    if ( maintenance_triggered || maintenance_time <= 0 || maintenance_time > VirtualClock::currentMSecsSinceEpoch() )
         return;
 
     kDebug() << "doing maintenance routine for epoch" << maintenance_time;
 
     saveMarket( ALL );
+    saveSnapshot( ALL );
     positions->cancelLocal( ALL );
     maintenance_triggered = true;
 
@@ -1253,9 +2623,78 @@ void Engine::printInternal()
 {
     kDebug() << "maintenance_time:" << maintenance_time;
     kDebug() << "maintenance_triggered:" << maintenance_triggered;
+    kDebug() << "order_timeout:" << order_timeout << "cancel_timeout:" << cancel_timeout;
 
     kDebug() << "diverge_converge: " << positions->getDCPending();
     kDebug() << "diverging_converging: " << positions->getDCMap();
+
+    scheduler->printTasks();
+}
+
+void Engine::printLatency() const
+{
+    latency.print( QString( "latency %1" ).arg( engine_type == ENGINE_BITTREX  ? "trex" :
+                                                engine_type == ENGINE_BINANCE  ? "bnc" :
+                                                engine_type == ENGINE_POLONIEX ? "polo" :
+                                                engine_type == ENGINE_WAVES    ? "waves" : "?" ) );
+}
+
+qint64 Engine::printMemory() const
+{
+    using MemoryStats::getBytes;
+    using MemoryStats::formatBytes;
+
+    // positions, with the strings and indices they own
+    qint64 position_bytes = 0;
+    for ( QVector<Position*>::const_iterator i = positions->all().constBegin(); i != positions->all().constEnd(); i++ )
+    {
+        const Position *const &pos = *i;
+        position_bytes += qint64( sizeof( Position ) ) + getBytes( pos->order_number ) + getBytes( pos->indices_str ) +
+                          getBytes( pos->strategy_tag ) + getBytes( pos->market_indices );
+    }
+
+    const qint64 pool_bytes = qint64( positions->getPool().getFreeCount() ) * qint64( sizeof( Position ) );
+    const qint64 index_bytes = positions->getIndexBytes();
+
+    // markets, their grids, order prices, ticker history and order book levels
+    qint64 market_bytes = market_info.getBytes(), grid_bytes = 0, book_bytes = 0;
+    qint32 grid_count = 0, level_count = 0;
+    for ( MarketInfoTable::const_iterator i = market_info.begin(); i != market_info.end(); i++ )
+    {
+        const MarketInfo &info = i.value();
+        market_bytes += getBytes( i.key() ) + getBytes( info.order_prices ) +
+                        getBytes( info.own_bid_ticks ) + getBytes( info.own_ask_ticks ) +
+                        qint64( info.ticker_history.getCapacity() ) * qint64( sizeof( TickerSample ) );
+
+        grid_count += info.position_index.size();
+        grid_bytes += info.position_index.getBytes(); // packed, with the fill counts and alternates of the slots that have them
+
+        const qint32 levels = info.order_book.getLevelCount( SIDE_BUY ) + info.order_book.getLevelCount( SIDE_SELL );
+        level_count += levels;
+        book_bytes += levels * ( MemoryStats::MAP_NODE_OVERHEAD + qint64( sizeof( qint64 ) + sizeof( OrderBookLevel ) ) );
+    }
+
+    qint64 grace_bytes = getBytes( order_grace_times );
+    for ( QHash<OrderId, qint64>::const_iterator i = order_grace_times.begin(); i != order_grace_times.end(); i++ )
+        grace_bytes += getBytes( i.key() );
+
+    const BaseREST *rest = rest_arr.value( engine_type );
+    const qint64 request_bytes = rest ? rest->getRequestBytes() : 0;
+    const qint32 request_count = rest ? rest->nam_queue.size() + rest->nam_queue_sent.size() : 0;
+
+    const qint64 total = position_bytes + pool_bytes + index_bytes + market_bytes + grid_bytes + book_bytes + grace_bytes + request_bytes;
+
+    kDebug() << QString( "positions:         %1 in %2" ).arg( positions->all().size(), -8 ).arg( formatBytes( position_bytes ) );
+    kDebug() << QString( "position pool:     %1 in %2" ).arg( positions->getPool().getFreeCount(), -8 ).arg( formatBytes( pool_bytes ) );
+    kDebug() << QString( "position indices:  %1" ).arg( formatBytes( index_bytes ) );
+    kDebug() << QString( "markets:           %1 in %2" ).arg( market_info.size(), -8 ).arg( formatBytes( market_bytes ) );
+    kDebug() << QString( "position_index:    %1 in %2" ).arg( grid_count, -8 ).arg( formatBytes( grid_bytes ) );
+    kDebug() << QString( "order book levels: %1 in %2" ).arg( level_count, -8 ).arg( formatBytes( book_bytes ) );
+    kDebug() << QString( "order_grace_times: %1 in %2" ).arg( order_grace_times.size(), -8 ).arg( formatBytes( grace_bytes ) );
+    kDebug() << QString( "requests:          %1 in %2" ).arg( request_count, -8 ).arg( formatBytes( request_bytes ) );
+    kDebug() << QString( "engine total:      %1" ).arg( formatBytes( total ) );
+
+    return total;
 }
 
 void Engine::findBetterPrice( Position *const &pos )
@@ -1295,7 +2734,7 @@ void Engine::findBetterPrice( Position *const &pos )
         else          ticksize = pos->sell_price.ratio( slippage_mul ) + CoinAmount::SATOSHI;
     }
 
-    //kDebug() << "slippage offset" << ticksize << pos->buy_price << pos->sell_price;
+    kLog( LOG_LEVEL_TRACE ) << "slippage offset" << ticksize << pos->buy_price << pos->sell_price;
 
     // adjust lo_sell
     if ( settings->should_adjust_hibuy_losell &&
@@ -1303,9 +2742,8 @@ void Engine::findBetterPrice( Position *const &pos )
          lo_sell.isGreaterThanZero() &&
          lo_sell > pos->buy_price )
     {
-        if ( settings->is_chatty )
-            kDebug() << "(lo-sell-adjust) tried to buy" << market << pos->buy_price
-                     << "with lo_sell at" << lo_sell;
+        kLogIf( LOG_LEVEL_DEBUG, settings->is_chatty ) << "(lo-sell-adjust) tried to buy" << market << pos->buy_price
+                                                       << "with lo_sell at" << lo_sell;
 
         // set new boundary
         info.ticker.ask = pos->buy_price;
@@ -1321,9 +2759,8 @@ void Engine::findBetterPrice( Position *const &pos )
               hi_buy.isGreaterThanZero() &&
               hi_buy < pos->sell_price )
     {
-        if ( settings->is_chatty )
-            kDebug() << "(hi-buy--adjust) tried to sell" << market << pos->sell_price
-                     << "with hi_buy at" << hi_buy;
+        kLogIf( LOG_LEVEL_DEBUG, settings->is_chatty ) << "(hi-buy--adjust) tried to sell" << market << pos->sell_price
+                                                       << "with hi_buy at" << hi_buy;
 
         // set new boundary
         info.ticker.bid = pos->sell_price;
@@ -1345,7 +2782,9 @@ void Engine::findBetterPrice( Position *const &pos )
              lo_sell.isGreaterThanZero() &&
              settings->should_slippage_be_calculated )
         {
-            new_buy_price = lo_sell - ticksize;
+            // the book can be newer than the ticker, stay behind whichever is lower
+            const Coin book_ask = info.order_book.getBestAsk();
+            new_buy_price = ( book_ask.isGreaterThanZero() && book_ask < lo_sell ? book_ask : lo_sell ) - ticksize;
             haggle_type = SLIPPAGE_CALCULATED;
         }
         // just add to the sell price
@@ -1355,7 +2794,12 @@ void Engine::findBetterPrice( Position *const &pos )
             haggle_type = SLIPPAGE_ADDITIVE;
         }
 
-        kDebug() << QString( "(post-only) trying %1  buy price %2 tick size %3 for %4" )
+        // a buy at or over one of our own sells would be rejected again, go straight to the tick under the lowest
+        const Coin own_ask = info.getLowestOwnAsk();
+        if ( own_ask.isGreaterThanZero() && new_buy_price >= own_ask )
+            new_buy_price = own_ask - info.price_ticksize;
+
+        kLog( LOG_LEVEL_DEBUG ) << QString( "(post-only) trying %1  buy price %2 tick size %3 for %4" )
                             .arg( haggle_type == SLIPPAGE_CALCULATED ? "calculated" :
                                   haggle_type == SLIPPAGE_ADDITIVE ? "additive  " : "unknown   " )
                             .arg( new_buy_price )
@@ -1375,7 +2819,8 @@ void Engine::findBetterPrice( Position *const &pos )
              hi_buy.isGreaterThanZero() &&
              settings->should_slippage_be_calculated )
         {
-            new_sell_price = hi_buy + ticksize;
+            const Coin book_bid = info.order_book.getBestBid();
+            new_sell_price = ( book_bid > hi_buy ? book_bid : hi_buy ) + ticksize;
             haggle_type = SLIPPAGE_CALCULATED;
         }
         // just add to the sell price
@@ -1385,7 +2830,12 @@ void Engine::findBetterPrice( Position *const &pos )
             haggle_type = SLIPPAGE_ADDITIVE;
         }
 
-        kDebug() << QString( "(post-only) trying %1 sell price %2 tick size %3 for %4" )
+        // same for a sell at or under one of our own buys
+        const Coin own_bid = info.getHighestOwnBid();
+        if ( own_bid.isGreaterThanZero() && new_sell_price <= own_bid )
+            new_sell_price = own_bid + info.price_ticksize;
+
+        kLog( LOG_LEVEL_DEBUG ) << QString( "(post-only) trying %1 sell price %2 tick size %3 for %4" )
                             .arg( haggle_type == SLIPPAGE_CALCULATED ? "calculated" :
                                   haggle_type == SLIPPAGE_ADDITIVE ? "additive  " : "unknown   " )
                             .arg( new_sell_price )
@@ -1401,17 +2851,33 @@ void Engine::findBetterPrice( Position *const &pos )
     pos->price_reset_count++;
 
     // remove old price from prices index for detecting stray orders
-    info.order_prices.removeOne( pos->price );
+    info.removeOrderPrice( pos->price, pos->side );
 
     // reapply offset, sentiment, price
     pos->applyOffset();
+    positions->onPriceChanged( pos );
 
     // add new price from prices index for detecting stray orders
-    info.order_prices.append( pos->price );
+    info.addOrderPrice( pos->price, pos->side );
 }
 
 void Engine::sendBuySell( Position * const &pos , bool quiet )
 {
+    // this is the replacement for an order in replaceOrder()
+    if ( replacing_pos != nullptr )
+    {
+        Position *const replaced_pos = replacing_pos;
+        replacing_pos = nullptr;
+        sendReplace( replaced_pos, pos, quiet );
+        return;
+    }
+
+    if ( isPaperTrading() )
+    {
+        paper->sendBuySell( pos );
+        return;
+    }
+
     if ( engine_type == ENGINE_BITTREX )
         reinterpret_cast<TrexREST*>( rest_arr.value( ENGINE_BITTREX ) )->sendBuySell( pos, quiet );
     else if ( engine_type == ENGINE_BINANCE )
@@ -1422,16 +2888,309 @@ void Engine::sendBuySell( Position * const &pos , bool quiet )
         reinterpret_cast<WavesREST*>( rest_arr.value( ENGINE_WAVES ) )->sendBuySell( pos, quiet );
 }
 
-void Engine::sendCancel( const QString &order_number, Position * const &pos, const Market &market )
+void Engine::sendCancel( const OrderId &order_number, Position * const &pos, const Market &market )
+{
+    // orders that aren't ours are left alone
+    if ( isPaperTrading() )
+    {
+        if ( pos )
+            paper->sendCancel( pos );
+
+        return;
+    }
+
+    const QString group = isPairCancelSupported() ? getCancelGroup( order_number, pos, market ) : QString();
+
+    // the exchange has no pair cancel, or we don't know the market
+    if ( group.isEmpty() )
+    {
+        sendCancelNow( order_number, pos, market );
+        return;
+    }
+
+    // group whatever the engine cancels in this pass
+    if ( pending_cancels.isEmpty() )
+        QTimer::singleShot( 0, this, &Engine::sendCancels );
+
+    PendingCancel cancel;
+    cancel.order_number = order_number;
+    cancel.pos = pos;
+    cancel.pos_generation = pos ? pos->getGeneration() : 0;
+    cancel.market = market;
+    cancel.group = group;
+
+    pending_cancels.append( cancel );
+}
+
+void Engine::setShard( const MarketShards &_shards, const qint32 index, const qint32 account, const Coin &_account_share )
+{
+    shards = _shards;
+    shard_index = qBound( 0, index, shards.getCount() -1 );
+    account_index = qMax( 0, account );
+    account_share = _account_share.isGreaterThanZero() && _account_share < CoinAmount::COIN ? _account_share : CoinAmount::COIN;
+
+    // our own journal, and timer jitter that doesn't line up with the other engines
+    journal->setPath( Global::getOrderJournalPath( engine_type, getEngineIndex() ) );
+    scheduler->setSeed( quint32( getEngineId() ) +1 );
+
+    kDebug() << "[Engine" << engine_type << "] shard" << shard_index << "of" << shards.getCount()
+             << "account" << account_index << "share" << account_share;
+}
+
+void Engine::flatten( QString market )
+{
+    // the arg will always be supplied; set the default arg here instead of the function def
+    if ( market.isEmpty() )
+        market = ALL;
+
+    // flattening a market again keeps its first start time, the time to flat is from the first command
+    if ( !flattening_markets.contains( market ) )
+        flattening_markets.insert( market, VirtualClock::currentMSecsSinceEpoch() );
+
+    // new orders that haven't gone out yet are dropped with their positions, instead of being cancelled after they set
+    QVector<Position*> dropped_positions;
+    qint32 ct_dropped = 0;
+    BaseREST *rest = isPaperTrading() ? nullptr : rest_arr.value( engine_type );
+    if ( rest )
+        ct_dropped = rest->dropQueuedRequests( REQUEST_NEW_ORDER, market, dropped_positions );
+
+    for ( QVector<Position*>::const_iterator i = dropped_positions.constBegin(); i != dropped_positions.constEnd(); i++ )
+        if ( positions->isValid( *i ) )
+            positions->remove( *i );
+
+    // everything we have in these goes at once, sendCancels() sends one pair cancel for each
+    QVector<Position*> cancel_positions;
+    for ( QVector<Position*>::const_iterator i = positions->all().constBegin(); i != positions->all().constEnd(); i++ )
+    {
+        Position *const &pos = *i;
+
+        if ( market != ALL && pos->market != market )
+            continue;
+
+        cancel_positions += pos;
+
+        if ( isPairCancelSupported() && positions->isActive( pos ) )
+            cancel_pair_groups.insert( getCancelGroup( pos->order_number, pos, pos->market ) );
+    }
+
+    // queued positions that were sent are cancelled when they set, see PositionMan::cancel()
+    for ( QVector<Position*>::const_iterator i = cancel_positions.constBegin(); i != cancel_positions.constEnd(); i++ )
+        if ( positions->isValid( *i ) )
+            positions->cancel( *i, true, CANCELLING_FOR_USER );
+
+    // nothing refills the grid once it's flat
+    for ( MarketInfoTable::iterator i = market_info.begin(); i != market_info.end(); i++ )
+    {
+        if ( market != ALL && i.key() != market )
+            continue;
+
+        (*i).clearOrderPrices();
+        (*i).position_index.clear();
+    }
+
+    kDebug() << "flattening" << market << ": dropped" << ct_dropped << "queued orders, cancelling" << cancel_positions.size() << "positions";
+
+    // cancels are the first class sent, don't wait for the idle tick to send them
+    if ( rest )
+        rest->wakeSendQueue( 0 );
+
+    checkFlattened();
+}
+
+void Engine::stopFlattening( QString market )
+{
+    if ( market.isEmpty() )
+        market = ALL;
+
+    // all stops every market, a single market only stops its own
+    QMap<QString, qint64>::iterator i = flattening_markets.begin();
+    while ( i != flattening_markets.end() )
+    {
+        if ( market != ALL && i.key() != market )
+        {
+            i++;
+            continue;
+        }
+
+        kDebug() << "local warning: stopped flattening" << i.key() << "after" << VirtualClock::currentMSecsSinceEpoch() - i.value() << "ms,"
+                 << ( i.key() == ALL ? positions->all().size() : positions->getMarketOrderTotal( i.key() ) ) << "positions left";
+        i = flattening_markets.erase( i );
+    }
+}
+
+bool Engine::isFlattening( const QString &market ) const
+{
+    return !flattening_markets.isEmpty() && ( flattening_markets.contains( ALL ) || flattening_markets.contains( market ) );
+}
+
+void Engine::checkFlattened()
+{
+    if ( flattening_markets.isEmpty() )
+        return;
+
+    // each market is done on its own, the others keep blocking their new orders
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
+    QMap<QString, qint64>::iterator i = flattening_markets.begin();
+    while ( i != flattening_markets.end() )
+    {
+        const bool is_flat = i.key() == ALL ? positions->all().isEmpty() : positions->getMarketOrderTotal( i.key() ) == 0;
+        if ( !is_flat )
+        {
+            i++;
+            continue;
+        }
+
+        latency.addSince( "flatten", i.value(), current_time );
+        kDebug() << "flattened" << i.key() << "in" << current_time - i.value() << "ms";
+        i = flattening_markets.erase( i );
+    }
+}
+
+void Engine::sendCancels()
+{
+    QMutexLocker locker( &engine_lock );
+
+    const QVector<PendingCancel> cancels = pending_cancels;
+    pending_cancels.clear();
+
+    QMap<QString, QVector<PendingCancel>> by_group;
+    bool has_pair_candidate = false;
+
+    for ( QVector<PendingCancel>::const_iterator i = cancels.begin(); i != cancels.end(); i++ )
+    {
+        QVector<PendingCancel> &group_cancels = by_group[ i->group ];
+        group_cancels.append( *i );
+        has_pair_candidate |= group_cancels.size() >= CANCEL_PAIR_MIN;
+    }
+
+    // count our positions in each group, a pair cancel would take out the ones we aren't cancelling
+    QHash<QString, qint32> group_position_counts;
+    for ( QVector<Position*>::const_iterator i = positions->all().constBegin(); has_pair_candidate && i != positions->all().constEnd(); i++ )
+    {
+        const QString group = getCancelGroup( (*i)->order_number, *i, (*i)->market );
+        if ( by_group.contains( group ) )
+            group_position_counts[ group ]++;
+    }
+
+    for ( QMap<QString, QVector<PendingCancel>>::const_iterator g = by_group.begin(); g != by_group.end(); g++ )
+    {
+        const QString &group = g.key();
+        const QVector<PendingCancel> &group_cancels = g.value();
+
+        // skip positions that went away since they were cancelled
+        QVector<Position*> cancel_positions;
+        qint32 ct_non_local = 0;
+        for ( QVector<PendingCancel>::const_iterator i = group_cancels.begin(); i != group_cancels.end(); i++ )
+        {
+            if ( i->pos == nullptr )
+                ct_non_local++;
+            else if ( positions->isValid( i->pos, i->pos_generation ) && !cancel_positions.contains( i->pos ) )
+                cancel_positions += i->pos;
+        }
+
+        // cancelall takes everything anyway, otherwise it has to be every order in the market and all of them ours
+        const bool is_pair_cancel = group_cancels.size() >= CANCEL_PAIR_MIN &&
+                                    ( cancel_pair_groups.contains( group ) ||
+                                      ( ct_non_local == 0 &&
+                                        !foreign_order_groups.contains( group ) &&
+                                        group_position_counts.value( group ) == cancel_positions.size() ) );
+
+        if ( is_pair_cancel )
+        {
+            sendCancelPair( group, cancel_positions );
+            continue;
+        }
+
+        for ( QVector<PendingCancel>::const_iterator i = group_cancels.begin(); i != group_cancels.end(); i++ )
+            if ( i->pos == nullptr || positions->isValid( i->pos, i->pos_generation ) )
+                sendCancelNow( i->order_number, i->pos, i->market );
+    }
+
+    cancel_pair_groups.clear();
+}
+
+void Engine::sendCancelPair( const QString &group, const QVector<Position*> &cancel_positions )
+{
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
+
+    // the individual cancel timeouts pick up anything the pair cancel misses
+    for ( QVector<Position*>::const_iterator i = cancel_positions.begin(); i != cancel_positions.end(); i++ )
+    {
+        Position *const &pos = *i;
+
+        if ( !positions->isActive( pos ) )
+            continue;
+
+        positions->setCancelling( pos );
+        pos->order_cancel_time = current_time;
+    }
+
+    kLogIf( LOG_LEVEL_DEBUG, verbosity > 0 ) << "cancelling all orders in" << group << "," << cancel_positions.size() << "local";
+
+    if ( engine_type == ENGINE_BINANCE )
+        reinterpret_cast<BncREST*>( rest_arr.value( ENGINE_BINANCE ) )->sendCancelPair( group );
+    else if ( engine_type == ENGINE_WAVES )
+        reinterpret_cast<WavesREST*>( rest_arr.value( ENGINE_WAVES ) )->sendCancelPair( Market( group ) );
+}
+
+QString Engine::getCancelGroup( const OrderId &order_number, Position * const &pos, const Market &market ) const
+{
+    // binance pair cancels go by symbol, which our order ids start with
+    if ( engine_type == ENGINE_BINANCE )
+    {
+        // queued positions don't have an order id yet
+        if ( order_number.isEmpty() )
+            return pos ? pos->market.toExchangeString( ENGINE_BINANCE ) : QString();
+
+        const char *id = order_number.constData();
+        int symbol_size = 0;
+        while ( symbol_size < order_number.size() && !isdigit( uchar( id[ symbol_size ] ) ) )
+            symbol_size++;
+
+        return QString::fromLatin1( id, symbol_size );
+    }
+
+    if ( engine_type == ENGINE_WAVES )
+        return pos ? QString( pos->market ) : QString( market );
+
+    return QString();
+}
+
+void Engine::sendCancelNow( const OrderId &order_number, Position * const &pos, const Market &market )
 {
+    // the exchanges are sent the id as a string
+    const QString order_id = order_number.toString();
+
     if ( engine_type == ENGINE_BITTREX )
-        reinterpret_cast<TrexREST*>( rest_arr.value( ENGINE_BITTREX ) )->sendCancel( order_number, pos );
+        reinterpret_cast<TrexREST*>( rest_arr.value( ENGINE_BITTREX ) )->sendCancel( order_id, pos );
     else if ( engine_type == ENGINE_BINANCE )
-        reinterpret_cast<BncREST*>( rest_arr.value( ENGINE_BINANCE ) )->sendCancel( order_number, pos );
+        reinterpret_cast<BncREST*>( rest_arr.value( ENGINE_BINANCE ) )->sendCancel( order_id, pos );
     else if ( engine_type == ENGINE_POLONIEX )
-        reinterpret_cast<PoloREST*>( rest_arr.value( ENGINE_POLONIEX ) )->sendCancel( order_number, pos );
+        reinterpret_cast<PoloREST*>( rest_arr.value( ENGINE_POLONIEX ) )->sendCancel( order_id, pos );
     else if ( engine_type == ENGINE_WAVES )
-        reinterpret_cast<WavesREST*>( rest_arr.value( ENGINE_WAVES ) )->sendCancel( order_number, pos, market );
+        reinterpret_cast<WavesREST*>( rest_arr.value( ENGINE_WAVES ) )->sendCancel( order_id, pos, market );
+}
+
+void Engine::scheduleRefill()
+{
+    if ( is_refill_scheduled || !positions->isRefillPending() )
+        return;
+
+    // after the reply that freed the slot is done
+    is_refill_scheduled = true;
+    QTimer::singleShot( 0, this, &Engine::onRefill );
+}
+
+void Engine::onRefill()
+{
+    QMutexLocker locker( &engine_lock );
+
+    is_refill_scheduled = false;
+
+    if ( !positions->isRefillPending() || yieldToFlowControl() )
+        return;
+
+    positions->checkBuySellCount();
 }
 
 bool Engine::yieldToFlowControl()
@@ -1442,8 +3201,22 @@ bool Engine::yieldToFlowControl()
 
 void Engine::onEngineMaintenance()
 {
+    QMutexLocker locker( &engine_lock );
+
     checkMaintenance(); // do maintenance routine
     cleanGraceTimes(); // cleanup stray order ids
+
+    // log latency percentiles periodically
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
+    if ( latency_log_time == 0 )
+    {
+        latency_log_time = current_time;
+    }
+    else if ( latency_log_time < current_time - LATENCY_LOG_INTERVAL )
+    {
+        latency_log_time = current_time;
+        printLatency();
+    }
 }
 
 bool Engine::tryMoveOrder( Position* const &pos )
@@ -1497,10 +3270,9 @@ bool Engine::tryMoveOrder( Position* const &pos )
             return true;
         }
 
-        if ( settings->is_chatty )
-            kDebug() << "couldn't find better buy price for" << pos->stringifyOrder() << "new_buy_price"
-                     << new_buy_price << "original_buy_price" << pos->buy_price_original
-                     << "hi_buy" << hi_buy << "lo_sell" << lo_sell;
+        kLogIf( LOG_LEVEL_DEBUG, settings->is_chatty ) << "couldn't find better buy price for" << pos->stringifyOrder() << "new_buy_price"
+                                                       << new_buy_price << "original_buy_price" << pos->buy_price_original
+                                                       << "hi_buy" << hi_buy << "lo_sell" << lo_sell;
     }
     // replace sell price
     else if ( pos->side == SIDE_SELL &&
@@ -1535,90 +3307,153 @@ bool Engine::tryMoveOrder( Position* const &pos )
             return true;
         }
 
-        if ( settings->is_chatty )
-            kDebug() << "couldn't find better sell price for" << pos->stringifyOrder() << "new_sell_price"
-                     << new_sell_price << "original_sell_price" << pos->sell_price_original
-                     << "hi_buy" << hi_buy << "lo_sell" << lo_sell;
+        kLogIf( LOG_LEVEL_DEBUG, settings->is_chatty ) << "couldn't find better sell price for" << pos->stringifyOrder() << "new_sell_price"
+                                                       << new_sell_price << "original_sell_price" << pos->sell_price_original
+                                                       << "hi_buy" << hi_buy << "lo_sell" << lo_sell;
     }
 
     return false;
 }
 
+qint64 Engine::getNextTimeoutCheck( Position *const &pos, const qint64 current_time )
+{
+    // recheck at least this often in case a deadline appears without a schedule call
+    qint64 next = current_time + cancel_timeout;
+
+    if ( pos->order_set_time == 0 )
+    {
+        // request timeout
+        next = qMin( next, pos->order_request_time > 0 ? pos->order_request_time + order_timeout +1 :
+                                                         current_time + order_timeout );
+    }
+    else
+    {
+        // cancel timeout
+        if ( pos->is_cancelling && pos->order_cancel_time > 0 )
+            next = qMin( next, pos->order_cancel_time + cancel_timeout +1 );
+
+        // slippage timeout
+        if ( pos->is_slippage && !pos->is_cancelling )
+            next = qMin( next, pos->order_set_time + market_info[ pos->market ].slippage_timeout +1 );
+
+        // max age
+        if ( !pos->is_cancelling && pos->max_age_epoch > 0 )
+            next = qMin( next, pos->max_age_epoch );
+    }
+
+    return qMax( next, current_time +1 );
+}
+
+void Engine::updateTimeouts()
+{
+    const qint64 p99 = settings->adaptive_timeout_multiplier > 0 && rest_arr.value( engine_type ) ?
+                       rest_arr.value( engine_type )->getResponseTimePercentile( 0.99 ) : -1;
+
+    // not enough recent replies (or disabled), use the static timeouts
+    if ( p99 < 0 )
+    {
+        order_timeout = settings->order_timeout;
+        cancel_timeout = settings->cancel_timeout;
+        return;
+    }
+
+    // resend after a few times the tail reply time, but never later than the static timeouts
+    const qint64 timeout = p99 * settings->adaptive_timeout_multiplier;
+    order_timeout = qMin( settings->order_timeout, qMax( settings->order_timeout_min, timeout ) );
+    cancel_timeout = qMin( settings->cancel_timeout, qMax( settings->cancel_timeout_min, timeout ) );
+}
+
 void Engine::onCheckTimeouts()
 {
+    QMutexLocker locker( &engine_lock );
+    TRACE_SPAN( "onCheckTimeouts" );
+
+    // a quiet journal still reaches the disk within a timeout pass
+    journal->flush();
+
     positions->checkBuySellCount();
+    updateTimeouts();
+
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
 
-    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+    // while the server keeps failing orders or cancels, resending them only adds to its load. they're checked again
+    // at the next deadline
+    const BaseREST *rest = rest_arr.value( engine_type );
+    const bool is_new_order_paused = rest && rest->isClassPaused( REQUEST_NEW_ORDER );
+    const bool is_cancel_paused = rest && rest->isClassPaused( REQUEST_CANCEL );
 
-    // look for timed out requests
-    for ( QSet<Position*>::const_iterator i = positions->queued().begin(); i != positions->queued().end(); i++ )
+    // only look at positions whose next deadline has passed
+    Position *pos;
+    while ( ( pos = positions->getDueTimeoutCheck( current_time ) ) )
     {
-        // flow control
+        // flow control (the rest stay due and are checked first next time)
         if ( yieldToFlowControl() )
             return;
 
-        Position *const &pos = *i;
-
-        // make sure the order hasn't been set and the request is stale
-        if ( pos->order_set_time == 0 &&
-             pos->order_request_time > 0 &&
-             pos->order_request_time + settings->order_timeout < current_time )
+        if ( pos->order_set_time == 0 )
         {
-            kDebug() << "order timeout detected, resending" << pos->stringifyOrder();
+            // make sure the order hasn't been set and the request is stale
+            if ( pos->order_request_time > 0 &&
+                 pos->order_request_time + order_timeout < current_time &&
+                 !is_new_order_paused )
+            {
+                kDebug() << "order timeout detected, resending" << pos->stringifyOrder();
 
-            sendBuySell( pos );
-        }
-    }
+                sendBuySell( pos );
+            }
 
-    // look for timed out things
-    const QSet<Position*>::const_iterator begin = positions->active().begin(),
-                                          end = positions->active().end();
-    for ( QSet<Position*>::const_iterator j = begin; j != end; j++ )
-    {
-        // flow control
-        if ( yieldToFlowControl() )
-            return;
+            if ( positions->isValid( pos ) )
+                positions->scheduleTimeoutCheck( pos, getNextTimeoutCheck( pos, current_time ) );
 
-        Position *const &pos = *j;
+            continue;
+        }
 
         // search for cancel order we should recancel
         if ( pos->is_cancelling &&
-             pos->order_set_time > 0 &&
              pos->order_cancel_time > 0 &&
-             pos->order_cancel_time < current_time - settings->cancel_timeout )
+             pos->order_cancel_time < current_time - cancel_timeout &&
+             !is_cancel_paused )
         {
             positions->cancel( pos );
+
+            if ( positions->isValid( pos ) )
+                positions->scheduleTimeoutCheck( pos, getNextTimeoutCheck( pos, current_time ) );
+
             return;
         }
 
         // search for slippage order we should replace
         if (  pos->is_slippage &&
              !pos->is_cancelling &&
-              pos->order_set_time > 0 &&
               pos->order_set_time < current_time - market_info[ pos->market ].slippage_timeout )
         {
             // reconcile slippage price according to spread hi/lo
             if ( tryMoveOrder( pos ) )
             {
-                // we found a better price, mark resetting and cancel
-                positions->cancel( pos, false, CANCELLING_FOR_SLIPPAGE_RESET );
+                // we found a better price, replace it or mark resetting and cancel
+                if ( !replaceOrder( pos, CANCELLING_FOR_SLIPPAGE_RESET ) )
+                    positions->cancel( pos, false, CANCELLING_FOR_SLIPPAGE_RESET );
             }
             else
             {
                 // don't check it until new timeout occurs
-                pos->order_set_time = current_time - settings->safety_delay_time;
+                positions->setOrderSetTime( pos, current_time - settings->safety_delay_time );
             }
         }
 
         // search for one-time order with age > max_age_minutes
-        if ( !pos->is_cancelling &&
-              pos->order_set_time > 0 &&
+        if ( positions->isValid( pos ) &&
+             !pos->is_cancelling &&
               pos->max_age_epoch > 0 &&
               current_time >= pos->max_age_epoch )
         {
             // the order has reached max age
-            positions->cancel( pos, false, CANCELLING_FOR_MAX_AGE );
+            if ( !replaceOrder( pos, CANCELLING_FOR_MAX_AGE ) )
+                positions->cancel( pos, false, CANCELLING_FOR_MAX_AGE );
         }
+
+        if ( positions->isValid( pos ) )
+            positions->scheduleTimeoutCheck( pos, getNextTimeoutCheck( pos, current_time ) );
     }
 }
 
@@ -1635,4 +3470,6 @@ void Engine::setMarketSettings( QString market, qint32 order_min, qint32 order_m
     info.order_landmark_thresh = landmark_thresh;
     info.market_sentiment = market_sentiment;
     info.market_offset = market_offset;
+
+    positions->setDCDirty( market );
 }
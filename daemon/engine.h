@@ -5,22 +5,63 @@
 #include "position.h"
 #include "baserest.h"
 #include "coinamount.h"
+#include "latencyhistogram.h"
+#include "marketshards.h"
+#include "balanceledger.h"
 
 #include <QObject>
 #include <QNetworkReply>
+#include <QMutex>
+#include <QByteArray>
+#include <QQueue>
+#include <QPair>
+#include <QSet>
 
 class Spruce;
 class CommandRunner;
 class CommandListener;
 class AlphaTracker;
+class BboCache;
+class MarketEventQueue;
+class MarketRecorder;
+class PaperExchange;
+class AsyncSaver;
+class OrderJournal;
+struct OrderJournalReplica;
+struct OrderJournalEvent;
 class PositionMan;
 class EngineSettings;
+class TaskScheduler;
+class ScheduledTask;
 
 class TrexREST;
 class BncREST;
 class PoloREST;
 class WavesREST;
 
+// a fill whose stats and log line wait until every fill in the batch was processed, see Engine::processFilledOrders()
+struct DeferredFill
+{
+    QString fill_type;
+    Market market;
+    OrderId order_id;
+    quint8 side{ 0 };
+    QString strategy_tag;
+    Coin amount;
+    Coin price;
+    Coin btc_commission;
+};
+
+// a cancel waiting for the end of the event loop pass, see Engine::sendCancels()
+struct PendingCancel
+{
+    OrderId order_number;
+    Position *pos{ nullptr };
+    quint32 pos_generation{ 0 };
+    Market market;
+    QString group; // see Engine::getCancelGroup()
+};
+
 class Engine : public QObject
 {
     Q_OBJECT
@@ -36,95 +77,250 @@ public:
     Position *addPosition( QString market_input, quint8 side, QString buy_price , QString sell_price,
                            QString order_size, QString type = ACTIVE, QString strategy_tag = QLatin1String(),
                            QVector<qint32> indices = QVector<qint32>(), bool landmark = false, bool quiet = false );
+    void addPositions( const QVector<PositionSpec> &specs ); // bulk load, validates each market once
+    // a geometric ping-pong grid, levels buy prices from lo to hi that each sell at ratio times their buy, rounded to
+    // the market's price and lot ticksizes. returns the count of indices set
+    qint32 addGrid( const QString &market_input, const Coin &lo, const Coin &hi, const qint32 levels, const qreal ratio,
+                    const Coin &size, const QString &type = ACTIVE, const QString &strategy_tag = QLatin1String() );
+    // sets a grid index again from its PositionData, without the parsing and checks that were done when it was set
+    Position *addGridPosition( const Market &market, quint8 side, const PositionData &data, const QVector<qint32> &indices,
+                               bool landmark = false, bool quiet = true );
 
     void processFilledOrders( QVector<Position*> &to_be_filled, qint8 fill_type );
 
     // post-parse processing stuff
-    void processOpenOrders( QVector<QString> &order_numbers, QMultiHash<QString, OrderInfo> &orders, qint64 request_time_sent_ms );
+    void processOpenOrders( const QVector<OrderRecord> &all_orders, qint64 request_time_sent_ms );
+    void processTicker( BaseREST *base_rest_module, const QVector<MarketTicker> &tickers, qint64 request_time_sent_ms = 0 );
     void processTicker( BaseREST *base_rest_module, const QMap<QString, TickerInfo> &ticker_data, qint64 request_time_sent_ms = 0 );
+    void processTicker( BaseREST *base_rest_module, const QString &market, const TickerInfo &ticker ); // one market from a feed, no fill checks
     void processCancelledOrder( Position *const &pos );
 
-    void saveMarket( QString market, qint32 num_orders = 15 );
-    void loadSettings();
+    void saveMarket( QString market, qint32 num_orders = 15 ); // text export, replayed through setorder
+    void saveSnapshot( QString market ); // binary snapshot of indices and positions
+    void loadSnapshot( const QString &market );
+    QMap<QString/*market*/, QByteArray> getSnapshotData( const QString &market ); // what saveSnapshot() writes, by market
+    bool readSnapshot( const QString &market, const QByteArray &data, const QString &source ); // into a market without indices
+    // read once each market has a ticker, see StandbyLink. the fills and cancels of journal_tail are applied to the
+    // positions of the snapshots that have their order ids
+    void setPendingSnapshots( const QMap<QString, QByteArray> &snapshots, const QVector<OrderJournalEvent> &journal_tail );
+    void setJournalReplica( OrderJournalReplica *replica ); // our order journal also goes to the standbys
+    void loadSettings(); // applies the settings state if it was taken from the same file, see SettingsState
 
     PositionMan *getPositionMan() const { return positions; }
-    EngineSettings *getSettings() const { return settings; }
+    BalanceLedger &getLedger() { return ledger; } // kept from our fills and holds, reconciled by the balance polls
 
-    QString getSettingsPath() const { return engine_type == ENGINE_BITTREX  ? Global::getBittrexSettingsPath() :
-                                             engine_type == ENGINE_BINANCE  ? Global::getBinanceSettingsPath() :
-                                             engine_type == ENGINE_POLONIEX ? Global::getPoloniexSettingsPath() :
-                                             engine_type == ENGINE_WAVES    ? Global::getWavesSettingsPath() :
-                                                                               QString(); }
+    // the markets a whole exchange ticker is worth parsing for, the ones with orders, spruce markets, the ones positions
+    // were asked for, and their inverses. all of them while there are none
+    bool isTrackedMarket( const qint32 market_id );
+    AsyncSaver *getSaver() const { return saver; }
+    QMutex *getLock() { return &engine_lock; } // held by everything that runs on this engine's thread
+    EngineSettings *getSettings() const { return settings; }
+    TaskScheduler *getScheduler() const { return scheduler; } // the timers of the engine and its rest interface
+    qint64 getOrderTimeout() const { return order_timeout; } // adaptive, refreshed by onCheckTimeouts()
+    qint64 getCancelTimeout() const { return cancel_timeout; } // ^
+
+    QString getSettingsPath() const { return ( engine_type == ENGINE_BITTREX  ? Global::getBittrexSettingsPath() :
+                                               engine_type == ENGINE_BINANCE  ? Global::getBinanceSettingsPath() :
+                                               engine_type == ENGINE_POLONIEX ? Global::getPoloniexSettingsPath() :
+                                               engine_type == ENGINE_WAVES    ? Global::getWavesSettingsPath() :
+                                                                                 QString() ) + getShardSuffix(); }
+
+    // one of several engines for the exchange, each with its own markets and account. an account with share of the
+    // exchange's accounts gets that part of the spruce allocations. set before the rest interface starts
+    void setShard( const MarketShards &_shards, const qint32 index, const qint32 account = 0, const Coin &_account_share = CoinAmount::COIN );
+    qint32 getShardIndex() const { return shard_index; }
+    qint32 getAccountIndex() const { return account_index; }
+    const Coin &getAccountShare() const { return account_share; }
+    qint32 getEngineIndex() const { return account_index * shards.getCount() + shard_index; } // 0 for the first engine
+    qint32 getEngineId() const { return engine_type + getEngineIndex() * ENGINE_SHARD_STRIDE; } // the type for the first engine
+    QString getShardSuffix() const { return getEngineIndex() > 0 ? QString( ".%1" ).arg( getEngineIndex() ) : QString(); } // for our files
+    bool isInShard( const QString &market ) const { return !shards.isSharded() || shards.getShard( market ) == shard_index; }
+    quint64 getFillCount() const { return fill_count; } // since startup, read under the lock
 
     void printInternal();
 
     void setMaintenanceTime( qint64 time ) { maintenance_time = time; }
     qint64 getMaintenanceTime() const { return maintenance_time; }
 
+    LatencyTracker &getLatency() { return latency; } // order lifecycle latencies (ms)
+    void printLatency() const;
+    qint64 printMemory() const; // estimated bytes held by positions, markets and requests, returns the total
+
     QDateTime getStartTime() const { return start_time; }
 
-    QHash<QString, MarketInfo> &getMarketInfoStructure() { return market_info; }
+    MarketInfoTable &getMarketInfoStructure() { return market_info; }
     MarketInfo &getMarketInfo( const QString &market ) { return market_info[ market ]; }
+    MarketInfo &getMarketInfo( const Market &market ) { return market_info[ market ]; }
+    // how much more often the market should be polled than an idle one, from its fills, orders and ticker
+    qreal getMarketPollWeight( const Market &market );
 
     void setTesting( bool testing ) { is_testing = testing; }
     bool isTesting() const { return is_testing; }
     void setVerbosity( int v ) { verbosity = v; }
     int getVerbosity() const { return verbosity; }
 
+    void setRecording( bool enabled ); // tickers, open orders and fills to getRecordingsPath()
+    bool isRecording() const { return recorder != nullptr; }
+
+    void journalOrder( const quint8 type, Position *const &pos ); // ORDER_JOURNAL_SET or ORDER_JOURNAL_CANCEL, off while testing
+
+    bool isPaperTrading() const { return paper != nullptr && !is_testing; } // PAPER_TRADE builds, see PaperExchange
+    PaperExchange *getPaperExchange() const { return paper; }
+
     void setMarketSettings( QString market, qint32 order_min, qint32 order_max, qint32 order_dc, qint32 order_dc_nice,
                             qint32 landmark_start, qint32 landmark_thresh, bool market_sentiment, qreal market_offset );
 
     void findBetterPrice( Position *const &pos );
 
     void sendBuySell( Position *const &pos, bool quiet = false );
-    void sendCancel( const QString &order_number, Position *const &pos, const Market &market = Market() );
+    void sendCancel( const OrderId &order_number, Position *const &pos, const Market &market = Market() );
+    void flatten( QString market ); // kill switch, drop the new orders still queued and cancel everything in market
+    void stopFlattening( QString market ); // set orders in market again, if a cancel never resolves
+    bool isFlattening() const { return !flattening_markets.isEmpty(); }
+    bool isFlattening( const QString &market ) const;
+    void checkFlattened(); // report the time to flat of each flattening market that has no positions left
+    void scheduleRefill(); // run checkBuySellCount() on the next pass, if it yielded to flow control
     bool yieldToFlowControl();
 
     void updateStatsAndPrintFill( const QString &fill_type, Market market, const QString &order_id, quint8 side,
                                   const QString &strategy_tag, Coin amount, Coin quantity, Coin price,
-                                  const Coin &btc_commission );
+                                  const Coin &btc_commission, bool print = true );
+    Spruce *getSpruceForTag( const QString &strategy_tag ) const; // the portfolio a fill counts for, with spruce_lock held
 
-    QVector<QString/*order_id*/> orders_for_polling;
+    QVector<OrderId> orders_for_polling;
 
     quint8 engine_type{ 0 };
     Spruce *spruce{ nullptr };
     QVector<BaseREST*> rest_arr;
     AlphaTracker *alpha{ nullptr };
+    QMutex *spruce_lock{ nullptr }; // guards spruce and alpha, which are shared with the other engines
+    const QMap<QString, Spruce*> *spruce_portfolios{ nullptr }; // the overseer's other portfolios, see getSpruceForTag()
+    BboCache *bbo{ nullptr }; // prices across the engines, we push ours when they change
+    MarketEventQueue *market_events{ nullptr }; // if set, our prices reach bbo through it, on the overseer's thread
 
 signals:
     void newEngineMessage( QString &str ); // new wss message
-    void gotUserCommandChunk( QString &s ); // loaded settings file
+    void gotUserCommandChunk( const QString &s ); // loaded settings file
+    void gotTickerUpdate(); // new ticker prices were stored in market_info, or market_events has some for the overseer
 
 public Q_SLOTS:
     void onEngineMaintenance();
     void onCheckTimeouts();
 
 private:
+    void onRefill();
+    void onFlushTickers(); // the feed tickers held by processTicker() since the last event loop turn
+    void applyPendingSnapshots(); // the ones whose market has a ticker now
+    void onTickerStale();
+    void setTickerFresh();
+
+    // cancels
+    void sendCancels(); // the cancels queued by sendCancel() in this pass, as pair cancels where that's safe
+    void sendCancelNow( const OrderId &order_number, Position *const &pos, const Market &market );
+    void sendCancelPair( const QString &group, const QVector<Position*> &cancel_positions );
+    QString getCancelGroup( const OrderId &order_number, Position *const &pos, const Market &market ) const; // empty if it can't be pair cancelled
+    bool isPairCancelSupported() const { return engine_type == ENGINE_BINANCE || engine_type == ENGINE_WAVES; }
+
+    // replacing orders that are put back after they cancel
+    bool replaceOrder( Position *const &pos, quint8 cancel_reason ); // false if it should be cancelled the normal way
+    void sendReplace( Position *const &replaced_pos, Position *const &pos, bool quiet );
+    void addReplacementFor( Position *const &pos );
+    bool isReplacedOnCancel( Position *const &pos, quint8 cancel_reason ) const;
+
     // timer routines
     void cleanGraceTimes();
+    void setGraceTime( const OrderId &order_id, const qint64 seen_time );
     void checkMaintenance();
-
+    qint64 getNextTimeoutCheck( Position *const &pos, const qint64 current_time );
+    void updateTimeouts();
+
+    bool updateTicker( const MarketTicker &ticker ); // false if bid/ask is missing
+    void updateTrackedMarkets(); // see isTrackedMarket()
+    void trackMarket( const Market &market ); // tickers are read for it from the next one on
+    void shareTicker( const Market &market, const TickerInfo &ticker, const qint64 time ); // with bbo
+    void shareStale( const bool stale );
+
+    // the per-market settings left by a settings file, see loadSettings()
+    QByteArray getMarketSettingsState() const;
+    bool readMarketSettingsState( const QByteArray &state ); // false if it's truncated, nothing is set then
+
+    Position *addPositionToMarket( Market market, bool invert, quint8 side, QString buy_price, QString sell_price,
+                                   QString order_size, QString type, QString strategy_tag, QVector<qint32> indices,
+                                   bool landmark, bool quiet );
+    Position *addParsedPosition( MarketInfo &info, const Market &market, quint8 side, const Coin &buy_price,
+                                 const Coin &sell_price, const Coin &order_size, const QString &type,
+                                 const QString &strategy_tag, const QVector<qint32> &indices, bool landmark,
+                                 bool is_onetime, bool is_taker, bool quiet );
+    Position *setParsedPosition( MarketInfo &info, Position *const &pos, const QString &type, bool is_onetime,
+                                 bool is_taker, bool quiet );
     void addLandmarkPositionFor( Position *const &pos );
     void flipPosition( Position *const &pos );
+    bool flipPositionInPlace( Position *const pos ); // returns false if pos is still to be removed
     void cancelOrderMeatDCOrder( Position *const &pos );
     bool tryMoveOrder( Position *const &pos );
-    void fillNQ( const QString &order_id, qint8 fill_type, quint8 extra_data = 0 );
-
-    QHash<QString, MarketInfo> market_info;
-    QHash<QString/*order_id*/, qint64/*seen_time*/> order_grace_times; // record "seen" time to allow for stray grace period
+    void matchOpenOrders( const QVector<OrderRecord> &orders, QVector<Position*> &seen_positions,
+                          QVector<Position*> &missing_positions ) const; // see processOpenOrders()
+    void fillNQ( const OrderId &order_id, qint8 fill_type, quint8 extra_data = 0, QVector<DeferredFill> *deferred = nullptr );
+    void applyDeferredFills( const QVector<DeferredFill> &fills );
+
+    MarketInfoTable market_info;
+    QHash<OrderId, qint64/*seen_time*/> order_grace_times; // record "seen" time to allow for stray grace period
+    QQueue<QPair<qint64/*seen_time*/, OrderId>> order_grace_queue; // grace times in insertion order, for cleanup
+    QVector<PendingCancel> pending_cancels; // waiting for sendCancels()
+    QSet<QString/*cancel group*/> cancel_pair_groups; // cancelall, everything in these goes anyway
+    QSet<QString/*cancel group*/> foreign_order_groups; // groups with orders that aren't ours in the last open orders
+    QMap<QString/*market*/, TickerInfo> pending_tickers; // the latest feed ticker of each market, see onFlushTickers()
+    BaseREST *pending_tickers_rest{ nullptr };
+    QMap<QString/*market*/, QByteArray> pending_snapshots; // see setPendingSnapshots()
+    QHash<QString/*order id*/, QPair<quint8/*journal type*/, quint8/*cancel reason*/>> pending_journal_tail; // ^
+    QSet<qint32/*market id*/> tracked_market_ids; // see isTrackedMarket()
+    QSet<qint32/*market id*/> wanted_market_ids; // asked for by addPosition(), kept after their orders are gone
+    qint64 tracked_markets_time{ 0 }; // of the last updateTrackedMarkets(), 0 to update on the next ticker
+
+    // the last open order list that was reconciled, an unchanged one only checks these again. see processOpenOrders()
+    quint64 open_orders_fingerprint{ 0 }, open_orders_position_changes{ 0 };
+    qint32 open_orders_count{ -1 };
+    QVector<OrderRecord> open_orders_strays; // listed orders that weren't ours
+    QVector<Position*> open_orders_missing; // our set orders that weren't listed
+    Position *replacing_pos{ nullptr }; // the next sendBuySell() goes out as its replacement
+    QMap<QString/*market or all*/, qint64/*start time*/> flattening_markets; // no new orders are set in these until they're flat, see flatten()
+    MarketShards shards; // see setShard()
+    qint32 shard_index{ 0 };
+    qint32 account_index{ 0 };
+    Coin account_share{ CoinAmount::COIN };
 
     QDateTime start_time;
+    LatencyTracker latency;
 
     // primitives
     qint64 maintenance_time{ 0 };
+    qint64 latency_log_time{ 0 };
+    qint64 order_timeout{ 3 * 60000 }; // settings->order_timeout, or less on a responsive link
+    qint64 cancel_timeout{ 5 * 60000 }; // settings->cancel_timeout, ^
     bool maintenance_triggered{ false };
+    bool is_refill_scheduled{ false };
+    bool is_ticker_flush_scheduled{ false };
+    bool is_ticker_stale{ false };
     bool is_testing{ false };
     int verbosity{ 1 }; // 0 = none, 1 = normal, 2 = extra
 
     PositionMan *positions{ nullptr };
     EngineSettings *settings{ nullptr };
 
-    QTimer *maintenance_timer{ nullptr };
+    MarketRecorder *recorder{ nullptr };
+    PaperExchange *paper{ nullptr };
+    AsyncSaver *saver{ nullptr }; // market and snapshot files
+    OrderJournal *journal{ nullptr }; // sets, fills and cancels, written by saver
+    BalanceLedger ledger;
+    quint64 fill_count{ 0 };
+    TaskScheduler *scheduler{ nullptr };
+    ScheduledTask *maintenance_timer{ nullptr };
+    ScheduledTask *ticker_stale_timer{ nullptr }; // runs when the last ticker would be TICKER_STALE_TIME old
+    ScheduledTask *position_snapshot_timer{ nullptr }; // publishes the positions for the readers on other threads
+
+    // SpruceOverseer locks every engine in engine id order before spruce_lock, and nothing takes an engine lock
+    // while holding spruce_lock, so the engine threads can't deadlock with it
+    QMutex engine_lock{ QMutex::Recursive };
 };
 
 #endif // ENGINE_H
@@ -0,0 +1,311 @@
+#include "global.h"
+#include "benchreport.h"
+#include "coinamount.h"
+#include "misctypes.h"
+#include "engine.h"
+#include "position.h"
+#include "positionman.h"
+#include "baserest.h"
+#include "alphatracker.h"
+#include "spruce.h"
+#include "spruceoverseer.h"
+#include "virtualclock.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QMap>
+
+#include <algorithm>
+
+// engine_bench: loads a grid of ping-pong positions across many markets into a testing engine, then drives synthetic
+// tickers, open order lists, fills, timeout checks and diverge/converge passes through it and prints the throughput.
+// usage: ./engine_bench [<positions> [<positions>...]] [--json <path>] (default 1000 10000 100000)
+//
+// the engine runs in testing mode like trader-replay: orders are set as soon as they're added and nothing is sent.
+// allocations are the ones made through operator new, Qt's containers and strings allocate with malloc and aren't
+// counted. diverge/converge runs with the default market settings, so it measures the planning scan only.
+
+namespace
+{
+
+static const qint32 BENCH_MARKETS = 200;
+static const qreal BENCH_GRID_STEP = 0.001; // distance between grid prices, as a ratio of the mid price
+static const qreal BENCH_PROFIT = 1.01; // sell price / buy price for each ping-pong
+static const qint32 BENCH_TICKER_PASSES = 200;
+static const qint32 BENCH_OPEN_ORDER_PASSES = 50;
+static const qint32 BENCH_FILL_PASSES = 100;
+static const qint32 BENCH_FILL_BATCH = 20; // positions filled in each processFilledOrders() call
+static const qint32 BENCH_TIMEOUT_PASSES = 100;
+static const qint32 BENCH_DC_PASSES = 50;
+static const qint64 BENCH_START_TIME = 1600000000000; // the virtual clock, so order ages don't depend on the machine
+
+struct Stage
+{
+    void start()
+    {
+        samples.clear();
+        allocations_start = BenchReport::getAllocations();
+        timer.start();
+        lap_ns = 0;
+    }
+
+    // after each call, for the percentiles
+    void lap()
+    {
+        const qint64 ns = timer.nsecsElapsed();
+        samples += qreal( ns - lap_ns );
+        lap_ns = ns;
+    }
+
+    void stop( const QString &name, const qint64 calls, const qint64 positions, const qint32 position_count )
+    {
+        const qint64 ns = std::max<qint64>( timer.nsecsElapsed(), 1 );
+        const quint64 allocations = BenchReport::getAllocations() - allocations_start;
+
+        if ( samples.isEmpty() )
+            samples += qreal( ns );
+
+        BenchReport::add( BenchReport::getResult( QString( "%1 %2" ).arg( name ).arg( position_count ), calls, ns, allocations, samples ) );
+
+        kDebug() << QString( "%1 %2 calls | %3 calls/s | %4 positions/s | %5 us/call | %6 allocs/call" )
+                    .arg( name, -18 )
+                    .arg( calls, 6 )
+                    .arg( qreal( calls ) * 1000000000 / ns, 12, 'f', 1 )
+                    .arg( qreal( positions ) * 1000000000 / ns, 14, 'f', 0 )
+                    .arg( qreal( ns ) / calls / 1000, 10, 'f', 1 )
+                    .arg( qreal( allocations ) / calls, 0, 'f', 0 );
+    }
+
+    QElapsedTimer timer;
+    qint64 lap_ns{ 0 };
+    QVector<qreal> samples;
+    quint64 allocations_start{ 0 };
+};
+
+QString getMarket( const qint32 i )
+{
+    return QString( "BTC_B%1" ).arg( i, 4, 10, QChar( '0' ) );
+}
+
+void runBench( const qint32 position_count )
+{
+    kDebug() << "engine_bench:" << position_count << "positions across" << BENCH_MARKETS << "markets";
+
+    VirtualClock::setTime( BENCH_START_TIME );
+
+    AlphaTracker *alpha = new AlphaTracker();
+    Spruce *spruce = new Spruce();
+    spruce->setBaseCurrency( "BTC" );
+    SpruceOverseer *spruce_overseer = new SpruceOverseer( spruce );
+    spruce_overseer->alpha = alpha;
+
+    // binance fills from tickers and open order lists, and testing mode never reaches for its rest module
+    Engine *engine = new Engine( ENGINE_BINANCE );
+    BaseREST *rest = new BaseREST( engine );
+    rest->keystore.setKeys( "bench", "bench" );
+
+    engine->setTesting( true );
+    engine->setVerbosity( 0 );
+    engine->alpha = alpha;
+    engine->spruce = spruce;
+    engine->spruce_lock = &spruce_overseer->spruce_lock;
+    engine->spruce_portfolios = &spruce_overseer->portfolios;
+    engine->bbo = &spruce_overseer->bbo;
+
+    QVector<BaseREST*> rest_arr( 4, nullptr );
+    rest_arr[ ENGINE_BINANCE ] = rest;
+    engine->rest_arr = rest_arr;
+
+    PositionMan *positions = engine->getPositionMan();
+
+    // tickers that alternate inside the innermost grid prices, so each pass changes every market without filling
+    const Coin mid_price( "0.01000000" );
+    QMap<QString, TickerInfo> tickers[ 2 ];
+    for ( qint32 i = 0; i < BENCH_MARKETS; i++ )
+    {
+        const QString market = getMarket( i );
+        engine->getMarketInfo( market ).is_tradeable = true;
+        tickers[ 0 ].insert( market, TickerInfo( mid_price.ratio( 0.9996 ), mid_price.ratio( 1.0004 ) ) );
+        tickers[ 1 ].insert( market, TickerInfo( mid_price.ratio( 0.9997 ), mid_price.ratio( 1.0003 ) ) );
+    }
+
+    engine->processTicker( rest, tickers[ 0 ] );
+
+    // a grid for each market, half buys below the mid price and half sells above it
+    QVector<PositionSpec> specs;
+    specs.reserve( position_count );
+    for ( qint32 i = 0; i < position_count; i++ )
+    {
+        const qint32 step = ( i / BENCH_MARKETS ) / 2 + 1;
+
+        PositionSpec spec;
+        spec.market = getMarket( i % BENCH_MARKETS );
+        spec.side = ( i / BENCH_MARKETS ) % 2 == 0 ? SIDE_BUY : SIDE_SELL;
+        spec.type = ACTIVE;
+        spec.order_size = "0.01000000";
+
+        if ( spec.side == SIDE_BUY )
+        {
+            const Coin buy_price = mid_price.ratio( 1. - BENCH_GRID_STEP * step );
+            spec.buy_price = buy_price.toString( 8 );
+            spec.sell_price = buy_price.ratio( BENCH_PROFIT ).toString( 8 );
+        }
+        else
+        {
+            const Coin sell_price = mid_price.ratio( 1. + BENCH_GRID_STEP * step );
+            spec.buy_price = sell_price.ratio( 1. / BENCH_PROFIT ).toString( 8 );
+            spec.sell_price = sell_price.toString( 8 );
+        }
+
+        specs += spec;
+    }
+
+    Stage stage;
+
+    // load
+    stage.start();
+    engine->addPositions( specs );
+    QCoreApplication::sendPostedEvents();
+    stage.stop( "addPositions", 1, positions->active().size(), position_count );
+
+    // let the orders age past the ticker safety delay, so the ticker fill check looks at all of them
+    qint64 current_time = BENCH_START_TIME + 60000;
+    VirtualClock::setTime( current_time );
+
+    // tickers
+    stage.start();
+    for ( qint32 i = 0; i < BENCH_TICKER_PASSES; i++ )
+    {
+        current_time += 1000;
+        VirtualClock::setTime( current_time );
+        engine->processTicker( rest, tickers[ i % 2 ], current_time );
+        stage.lap();
+    }
+    stage.stop( "processTicker", BENCH_TICKER_PASSES, qint64( BENCH_TICKER_PASSES ) * positions->active().size(), position_count );
+
+    // open orders, every one of ours is on the list
+    QVector<OrderRecord> orders;
+    orders.reserve( positions->active().size() );
+    for ( QVector<Position*>::const_iterator i = positions->active().begin(); i != positions->active().end(); i++ )
+    {
+        const Position *const &pos = *i;
+        if ( !pos )
+            continue;
+
+        OrderRecord order;
+        order.order_number = pos->order_number;
+        order.market = pos->market;
+        order.price = pos->price;
+        order.amount = pos->amount;
+        order.side = pos->side;
+        orders += order;
+    }
+
+    stage.start();
+    for ( qint32 i = 0; i < BENCH_OPEN_ORDER_PASSES; i++ )
+    {
+        current_time += 1000;
+        VirtualClock::setTime( current_time );
+        engine->processOpenOrders( orders, current_time );
+        stage.lap();
+    }
+    stage.stop( "processOpenOrders", BENCH_OPEN_ORDER_PASSES, qint64( BENCH_OPEN_ORDER_PASSES ) * orders.size(), position_count );
+
+    // fills, each position flips and its other side is set in its place
+    qint64 filled = 0;
+    quint32 seed = 1;
+    QVector<Position*> to_be_filled;
+
+    stage.start();
+    for ( qint32 i = 0; i < BENCH_FILL_PASSES; i++ )
+    {
+        current_time += 1000;
+        VirtualClock::setTime( current_time );
+
+        const QVector<Position*> &active = positions->active();
+        to_be_filled.clear();
+        for ( qint32 j = 0; j < BENCH_FILL_BATCH && active.size() > 0; j++ )
+        {
+            seed = seed * 1103515245 + 12345; // the same picks every run
+            Position *const &pos = active.at( int( ( seed >> 8 ) % quint32( active.size() ) ) );
+            if ( pos && !to_be_filled.contains( pos ) )
+                to_be_filled += pos;
+        }
+
+        filled += to_be_filled.size();
+        engine->processFilledOrders( to_be_filled, FILL_HISTORY );
+        QCoreApplication::sendPostedEvents();
+        stage.lap();
+    }
+    stage.stop( "processFilledOrders", BENCH_FILL_PASSES, filled, position_count );
+
+    // timeout checks on the live interval
+    stage.start();
+    for ( qint32 i = 0; i < BENCH_TIMEOUT_PASSES; i++ )
+    {
+        current_time += 30000;
+        VirtualClock::setTime( current_time );
+        engine->onCheckTimeouts();
+        QCoreApplication::sendPostedEvents();
+        stage.lap();
+    }
+    stage.stop( "onCheckTimeouts", BENCH_TIMEOUT_PASSES, qint64( BENCH_TIMEOUT_PASSES ) * positions->active().size(), position_count );
+
+    // diverge/converge, replanning every market each pass
+    stage.start();
+    for ( qint32 i = 0; i < BENCH_DC_PASSES; i++ )
+    {
+        positions->setDCDirtyAll();
+        positions->divergeConverge();
+        QCoreApplication::sendPostedEvents();
+        stage.lap();
+    }
+    stage.stop( "divergeConverge", BENCH_DC_PASSES, qint64( BENCH_DC_PASSES ) * positions->all().size(), position_count );
+
+    kDebug() << "positions left:" << positions->all().size() << "active:" << positions->active().size();
+
+    delete engine;
+    delete rest;
+    delete spruce_overseer;
+    delete spruce;
+    delete alpha;
+}
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication a( argc, argv );
+
+    QStringList args = QCoreApplication::arguments();
+    args.removeFirst();
+    if ( !BenchReport::init( args ) )
+        return 1;
+
+    QVector<qint32> sizes;
+    for ( QStringList::const_iterator i = args.begin(); i != args.end(); i++ )
+    {
+        bool ok = false;
+        const qint32 size = i->toInt( &ok );
+        if ( !ok || size <= 0 )
+        {
+            kDebug() << "usage: engine_bench [<positions> [<positions>...]] [--json <path>]";
+            return 1;
+        }
+
+        sizes += size;
+    }
+
+    if ( sizes.isEmpty() )
+        sizes << 1000 << 10000 << 100000;
+
+    for ( QVector<qint32>::const_iterator i = sizes.begin(); i != sizes.end(); i++ )
+        runBench( *i );
+
+    kDebug() << "engine_bench done.";
+
+    return BenchReport::finish( "engine_bench" ) ? 0 : 1;
+}
@@ -0,0 +1,202 @@
+QT       = core network websockets
+
+TARGET = engine_bench
+DESTDIR = ../
+
+MOC_DIR = ../build-tmp/engine_bench
+OBJECTS_DIR = ../build-tmp/engine_bench
+
+CONFIG += c++14 c++17
+CONFIG += RELEASE console
+#CONFIG += DEBUG
+
+# enables stack symbols on release build for QMessageLogContext function and line output
+#DEFINES -= QT_MESSAGELOGCONTEXT
+
+LIBS += -lgmp
+
+QMAKE_CXXFLAGS_RELEASE = -Wall -ansi -pedantic -fstack-protector-strong -fstack-reuse=none -D_FORTIFY_SOURCE=2 -pie -fPIE -O3
+QMAKE_CFLAGS_RELEASE = -Wall -ansi -pedantic -fstack-protector-strong -fstack-reuse=none -D_FORTIFY_SOURCE=2 -pie -fPIE -O3
+QMAKE_LFLAGS += "-z noexecstack -z relro -z now"
+
+SOURCES += engine_bench.cpp \
+    benchreport.cpp \
+    alphatracker.cpp \
+    asyncsaver.cpp \
+    bbocache.cpp \
+    marketevents.cpp \
+    commandrunner.cpp \
+    costfunctioncache.cpp \
+    market.cpp \
+    marketrecorder.cpp \
+    orderbook.cpp \
+    paperexchange.cpp \
+    tickerhistory.cpp \
+    position.cpp \
+    strategytag.cpp \
+    engine.cpp \
+    positionman.cpp \
+    positionpool.cpp \
+    positionsnapshot.cpp \
+    balanceledger.cpp \
+    eventfeed.cpp \
+    positiongrid.cpp \
+    threadplacement.cpp \
+    latencyhistogram.cpp \
+    metrics.cpp \
+    looplag.cpp \
+    marketshards.cpp \
+    linkauth.cpp \
+    sprucelink.cpp \
+    standbylink.cpp \
+    orderjournal.cpp \
+    settingsstate.cpp \
+    requestqueue.cpp \
+    tokenbucket.cpp \
+    taskscheduler.cpp \
+    tracespan.cpp \
+    memorystats.cpp \
+    asynclog.cpp \
+    virtualclock.cpp \
+    jsonstreamreader.cpp \
+    replyparser.cpp \
+    hmacsigner.cpp \
+    spruce.cpp \
+    spruceoverseer.cpp \
+    trexrest.cpp \
+    bncrest.cpp \
+    polorest.cpp \
+    wavesrest.cpp \
+    baserest.cpp \
+    coinamount.cpp \
+    wavesutil.cpp \
+    blake2bdispatch.cpp \
+    wavesaccount.cpp \
+    wavessigner.cpp \
+    ../libbase58/base58.c \
+    ../qbase58/qbase58.cpp \
+    ../libcurve25519-donna/nacl_sha512/hash.c \
+    ../libcurve25519-donna/nacl_sha512/blocks.c \
+    ../libcurve25519-donna/additions/keygen.c \
+    ../libcurve25519-donna/additions/curve_sigs.c \
+    ../libcurve25519-donna/additions/compare.c \
+    ../libcurve25519-donna/additions/fe_montx_to_edy.c \
+    ../libcurve25519-donna/additions/open_modified.c \
+    ../libcurve25519-donna/additions/sign_modified.c \
+    ../libcurve25519-donna/additions/ge_p3_to_montx.c \
+    ../libcurve25519-donna/additions/zeroize.c \
+    ../libcurve25519-donna/ge_scalarmult_base.c \
+    ../libcurve25519-donna/fe_0.c \
+    ../libcurve25519-donna/fe_1.c \
+    ../libcurve25519-donna/fe_add.c \
+    ../libcurve25519-donna/fe_invert.c \
+    ../libcurve25519-donna/fe_isnegative.c \
+    ../libcurve25519-donna/fe_isnonzero.c \
+    ../libcurve25519-donna/fe_sub.c \
+    ../libcurve25519-donna/fe_sq.c \
+    ../libcurve25519-donna/fe_sq2.c \
+    ../libcurve25519-donna/fe_frombytes.c \
+    ../libcurve25519-donna/fe_pow22523.c \
+    ../libcurve25519-donna/fe_mul.c \
+    ../libcurve25519-donna/fe_tobytes.c \
+    ../libcurve25519-donna/fe_cmov.c \
+    ../libcurve25519-donna/fe_copy.c \
+    ../libcurve25519-donna/fe_neg.c \
+    ../libcurve25519-donna/ge_add.c \
+    ../libcurve25519-donna/ge_p3_0.c \
+    ../libcurve25519-donna/ge_frombytes.c \
+    ../libcurve25519-donna/ge_tobytes.c \
+    ../libcurve25519-donna/ge_p3_tobytes.c \
+    ../libcurve25519-donna/ge_precomp_0.c \
+    ../libcurve25519-donna/ge_p2_dbl.c \
+    ../libcurve25519-donna/ge_p3_dbl.c \
+    ../libcurve25519-donna/ge_p2_0.c \
+    ../libcurve25519-donna/ge_p1p1_to_p2.c \
+    ../libcurve25519-donna/ge_p1p1_to_p3.c \
+    ../libcurve25519-donna/ge_p3_to_p2.c \
+    ../libcurve25519-donna/ge_p3_to_cached.c \
+    ../libcurve25519-donna/ge_double_scalarmult.c \
+    ../libcurve25519-donna/ge_madd.c \
+    ../libcurve25519-donna/ge_msub.c \
+    ../libcurve25519-donna/ge_sub.c \
+    ../libcurve25519-donna/sc_reduce.c \
+    ../libcurve25519-donna/sc_muladd.c
+
+HEADERS += build-config.h \
+    benchreport.h \
+    alphatracker.h \
+    asyncsaver.h \
+    bbocache.h \
+    marketevents.h \
+    commandrunner.h \
+    costfunctioncache.h \
+    enginesettings.h \
+    global.h \
+    ipcprotocol.h \
+    coinamount.h \
+    keydefs.h \
+    market.h \
+    marketrecorder.h \
+    orderbook.h \
+    paperexchange.h \
+    tickerhistory.h \
+    position.h \
+    strategytag.h \
+    engine.h \
+    positiondata.h \
+    positiongrid.h \
+    positionman.h \
+    positionpool.h \
+    positionsnapshot.h \
+    balanceledger.h \
+    eventfeed.h \
+    threadplacement.h \
+    latencyhistogram.h \
+    metrics.h \
+    looplag.h \
+    orderjournal.h \
+    settingsstate.h \
+    requestqueue.h \
+    tokenbucket.h \
+    ratewindow.h \
+    circuitbreaker.h \
+    streamresync.h \
+    flowtuner.h \
+    serverclock.h \
+    marketshards.h \
+    linkauth.h \
+    sprucelink.h \
+    standbylink.h \
+    taskscheduler.h \
+    tracespan.h \
+    memorystats.h \
+    asynclog.h \
+    virtualclock.h \
+    jsonstreamreader.h \
+    replyparser.h \
+    spscqueue.h \
+    hmacsigner.h \
+    spruce.h \
+    spruceoverseer.h \
+    trexrest.h \
+    bncrest.h \
+    wavesrest.h \
+    polorest.h \
+    keystore.h \
+    baserest.h \
+    misctypes.h \
+    orderid.h \
+    ssl_policy.h \
+    wavesutil.h \
+    blake2bdispatch.h \
+    wavesaccount.h \
+    wavessigner.h \
+    ../libbase58/libbase58.h \
+    ../qbase58/qbase58.h \
+    ../libcurve25519-donna/nacl_includes/crypto_uint32.h \
+    ../libcurve25519-donna/nacl_includes/crypto_int32.h \
+    ../libcurve25519-donna/fe.h \
+    ../libcurve25519-donna/ge.h \
+    ../libcurve25519-donna/additions/crypto_additions.h \
+    ../libcurve25519-donna/additions/keygen.h \
+    ../libcurve25519-donna/additions/curve_sigs.h
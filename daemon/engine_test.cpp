@@ -5,8 +5,10 @@
 #include "positionman.h"
 #include "coinamount.h"
 #include "alphatracker.h"
+#include "orderjournal.h"
 
 #include <algorithm>
+#include <limits>
 #include <assert.h>
 #include <QDebug>
 #include <QVector>
@@ -24,6 +26,24 @@ void EngineTest::test( Engine *e )
     assert( Market( "test_" ).operator QString().isEmpty() ); // test empty quote currency
     assert( Market( "_test" ).operator QString().isEmpty() ); // test empty base currency
 
+    // MarketInfoTable, both formats and the Market find the same entry, invalid markets aren't added
+    MarketInfoTable table;
+    table[ TEST_MARKET ].order_min = 7;
+    assert( &table[ "TEST-1" ] == &table[ Market( TEST_MARKET ) ] && table.size() == 1 );
+    assert( table.contains( Market( "TEST-1" ) ) && table.value( TEST_MARKET ).order_min == 7 );
+    assert( table.begin().key() == TEST_MARKET && !table.contains( "test_" ) );
+    table[ "test_" ].order_min = 8;
+    assert( table.size() == 1 && table.find( "test_" ) == nullptr );
+
+    // OrderId
+    assert( OrderId().isEmpty() && OrderId( QString() ) == OrderId() && qHash( OrderId( "" ) ) == qHash( OrderId() ) );
+    assert( OrderId( QString( "LTCBTC123" ) ) == OrderId( QByteArray( "LTCBTC123" ) ) );
+    assert( OrderId( "LTCBTC123" ) != OrderId( "LTCBTC124" ) );
+    assert( OrderId( "H93RaJ6D9YxEWNJiiMsej23NVHLrxu6kMyFb7CgX2DZW" ).toString() == "H93RaJ6D9YxEWNJiiMsej23NVHLrxu6kMyFb7CgX2DZW" );
+    const QString long_id = QString( "x" ).repeated( OrderId::INLINE_SIZE + 10 ); // kept on the heap
+    assert( OrderId( long_id ).toString() == long_id && OrderId( long_id ) == OrderId( long_id.toLatin1() ) );
+    assert( sizeof( OrderId ) == 64 );
+
     // set ticker to tradeable
     e->getMarketInfoStructure()[ TEST_MARKET ].is_tradeable = true;
 
@@ -91,7 +111,7 @@ void EngineTest::test( Engine *e )
     //assert( p2.profit_margin == "2.31344963" );
 
     // test landmark position using the engine
-    QVector<PositionData> &test_index = e->getMarketInfo( TEST_MARKET ).position_index;
+    PositionGrid &test_index = e->getMarketInfo( TEST_MARKET ).position_index;
     test_index += PositionData( "0.00000005", "0.00000050", "0.01", QLatin1String() ); // idx 0
     test_index += PositionData( "0.00000005", "0.00000060", "0.02", QLatin1String() ); // idx 1
     test_index += PositionData( "0.00000005", "0.00000070", "0.03", QLatin1String() ); // idx 2
@@ -108,6 +128,7 @@ void EngineTest::test( Engine *e )
     assert( p3.sideStr() == SELL );
     assert( p3.is_landmark == true );
     assert( p3.market_indices == landmark_indices );
+    assert( p3.getLowestMarketIndex() == 0 && p3.getHighestMarketIndex() == 2 );
     assert( p3.amount == "0.05999999" );
     assert( p3.original_size == "0.06000000" );
     assert( p3.quantity == "95238.09523809" );
@@ -125,12 +146,17 @@ void EngineTest::test( Engine *e )
     assert( p4->amount == "0.02000000" );
     assert( p4->quantity == "200000.00000000" );
 
+    // whole tickers parse the market and its inverse now, and nothing else
+    assert( e->isTrackedMarket( Market( TEST_MARKET ).getId() ) );
+    assert( e->isTrackedMarket( Market( TEST_MARKET ).getInverse().getId() ) );
+    assert( !e->isTrackedMarket( Market( "TEST_2" ).getId() ) );
+
     // Engine::deletePosition
     e->positions->cancelLocal();
     assert( e->positions->all().size() == 0 );
 
     // test non-zero landmark buy price because of shim
-    QVector<PositionData> &test_index_1 = e->getMarketInfo( TEST_MARKET ).position_index;
+    PositionGrid &test_index_1 = e->getMarketInfo( TEST_MARKET ).position_index;
     test_index_1 += PositionData( "0.00000001", "0.00000050", "0.01", QLatin1String() ); // idx 0
     test_index_1 += PositionData( "0.00000001", "0.00000060", "0.02", QLatin1String() ); // idx 1
     test_index_1 += PositionData( "0.00000001", "0.00000070", "0.03", QLatin1String() ); // idx 2
@@ -142,14 +168,23 @@ void EngineTest::test( Engine *e )
     assert( p5->buy_price == "0.00000001" );
     assert( p5->sell_price == "0.00000063" );
     assert( p5->strategy_tag == "test-strat" );
+    assert( p5->strategy_tag_id >= 0 && p5->strategy_tag_id == StrategyTag::findId( "test-strat" ) );
 
     // test getBuyTotal/getSellTotal
     assert( e->positions->getTotalOrdersForSide( TEST_MARKET, SIDE_BUY  ) == 1 );
     assert( e->positions->getTotalOrdersForSide( TEST_MARKET, SIDE_SELL ) == 0 );
 
+    // the landmark takes slots 0-2 of the grid
+    assert( e->positions->getLowestPingPongIndex( TEST_MARKET ) == 0 );
+    assert( e->positions->getHighestPingPongIndex( TEST_MARKET ) == 2 );
+    assert( e->positions->getByIndex( TEST_MARKET, 1 ) == p5 );
+    assert( e->positions->getByIndex( TEST_MARKET, 3 ) == nullptr );
+
     // cancel positions and clear mappings
     e->positions->cancelLocal();
     assert( e->positions->all().size() == 0 );
+    assert( e->positions->getHighestPingPongIndex( TEST_MARKET ) == -1 );
+    assert( e->positions->getLowestPingPongIndex( TEST_MARKET ) == std::numeric_limits<qint32>::max() );
 
     /// run basic ping-pong test for sell price equal to ticker ask price
     ///
@@ -159,15 +194,29 @@ void EngineTest::test( Engine *e )
     e->market_info[ TEST_MARKET ].ticker.ask = "0.00000084";
 
     pp += e->addPosition( TEST_MARKET, SIDE_BUY,  "0.00000083", "0.00000084", "0.1", ACTIVE ); // 0
+    Position *const filled_pos = pp.value( 0 );
+    const quint32 filled_generation = filled_pos->getGeneration();
 
     // simulate fills
     e->processFilledOrders( pp, FILL_WSS );
 
     // orders are filled, revamp list
-    pp = e->positions->all().values().toVector();
+    pp = e->positions->all();
 
     assert( pp.value( 0 )->price == "0.00000084" );
 
+    // the fill was flipped in place, as a new order
+    assert( pp.size() == 1 && pp.value( 0 ) == filled_pos );
+    assert( filled_pos->side == SIDE_SELL && filled_pos->getGeneration() == filled_generation +1 );
+    assert( !filled_pos->order_number.isEmpty() );
+    assert( e->positions->getByIndex( TEST_MARKET, filled_pos->getLowestMarketIndex() ) == filled_pos );
+    assert( e->positions->isValid( filled_pos ) && !e->positions->isValid( filled_pos, filled_generation ) );
+    assert( e->positions->all().size() == 1 && e->positions->active().value( 0 ) == filled_pos );
+
+    // the fill makes the market busy for the pollers, one without orders or ticker changes is idle
+    assert( e->getMarketPollWeight( TEST_MARKET ) >= 4. );
+    assert( e->getMarketPollWeight( Market( "BTC_IDLE" ) ) == 0.25 );
+
     e->positions->cancelLocal();
     assert( e->positions->all().size() == 0 );
     ///
@@ -202,6 +251,91 @@ void EngineTest::test( Engine *e )
     assert( e->positions->all().size() == 0 );
     ///
 
+    /// run flatten test, everything in the market is cancelled and nothing is set until it's flat
+    pp.clear();
+    pp += e->addPosition( TEST_MARKET, SIDE_BUY,  "0.00000040", "0.00000060", "0.1", ACTIVE ); // 0
+    pp += e->addPosition( TEST_MARKET, SIDE_SELL, "0.00000040", "0.00000060", "0.1", ACTIVE ); // 1
+    assert( e->positions->all().size() == 2 );
+
+    e->flattening_markets.insert( TEST_MARKET, 0 );
+    assert( e->addPosition( TEST_MARKET, SIDE_BUY, "0.00000041", "0.00000061", "0.1", ACTIVE ) == nullptr );
+    assert( e->positions->all().size() == 2 );
+
+    // another market's flatten doesn't block this one, and a stop leaves the other one alone
+    e->flattening_markets.insert( "BTC_OTHER", 0 );
+    e->stopFlattening( TEST_MARKET );
+    assert( e->isFlattening() && !e->isFlattening( TEST_MARKET ) && e->isFlattening( "BTC_OTHER" ) );
+    e->stopFlattening( ALL );
+    assert( !e->isFlattening() );
+
+    e->flatten( TEST_MARKET );
+    assert( e->positions->all().size() == 0 );
+    assert( !e->isFlattening() );
+    assert( e->market_info[ TEST_MARKET ].position_index.isEmpty() );
+
+    pp += e->addPosition( TEST_MARKET, SIDE_BUY,  "0.00000040", "0.00000060", "0.1", ACTIVE );
+    assert( e->positions->all().size() == 1 );
+
+    e->positions->cancelLocal();
+    assert( e->positions->all().size() == 0 );
+    ///
+
+    /// run grid test, 10 20 40 that sell at twice that. the ones under the bid buy, and bad grids set nothing
+    e->market_info[ TEST_MARKET ].ticker.bid = "0.00000030";
+    e->market_info[ TEST_MARKET ].ticker.ask = "0.00000031";
+    const qint32 grid_start = e->market_info[ TEST_MARKET ].position_index.size();
+
+    assert( e->addGrid( TEST_MARKET, Coin( "0.00000010" ), Coin( "0.00000040" ), 3, 2., Coin( "0.1" ) ) == 3 );
+    assert( e->positions->all().size() == 3 );
+    assert( e->market_info[ TEST_MARKET ].position_index.value( grid_start +1 ).buy_price == "0.00000020" );
+    assert( e->market_info[ TEST_MARKET ].position_index.value( grid_start +2 ).sell_price == "0.00000080" );
+    assert( e->positions->getByIndex( TEST_MARKET, grid_start )->side == SIDE_BUY );
+    assert( e->positions->getByIndex( TEST_MARKET, grid_start +2 )->side == SIDE_SELL );
+
+    assert( e->addGrid( TEST_MARKET, Coin( "0.00000040" ), Coin( "0.00000010" ), 3, 2., Coin( "0.1" ) ) == 0 );
+    assert( e->addGrid( TEST_MARKET, Coin( "0.00000010" ), Coin( "0.00000040" ), 3, 1., Coin( "0.1" ) ) == 0 );
+
+    /// run position snapshot test, a published snapshot doesn't change under its readers
+    const PositionSnapshotPtr grid_snapshot = e->positions->publishSnapshot( true );
+    assert( grid_snapshot->queued_count + grid_snapshot->active_count == 3 );
+    assert( grid_snapshot->positions.size() == 3 );
+    assert( e->positions->getSnapshot() == grid_snapshot );
+    assert( e->positions->publishSnapshot() == grid_snapshot ); // nothing changed
+
+    const QMap<QString, QByteArray> grid_data = e->getSnapshotData( TEST_MARKET );
+    e->positions->cancelLocal();
+    assert( e->positions->all().size() == 0 );
+    assert( grid_snapshot->positions.size() == 3 );
+
+    const PositionSnapshotPtr empty_snapshot = e->positions->publishSnapshot( true );
+    assert( empty_snapshot->positions.isEmpty() );
+    assert( empty_snapshot->epoch > grid_snapshot->epoch );
+    assert( e->positions->getSnapshot() == empty_snapshot );
+    ///
+
+    /// run journal tail test, a standby's snapshot comes back with the fills and cancels after it applied
+    QVector<OrderJournalEvent> tail;
+    OrderJournalEvent tail_event;
+    tail_event.type = ORDER_JOURNAL_FILL;
+    tail_event.order_id = TEST_MARKET + QString::number( grid_start ); // the buy at grid_start filled
+    tail += tail_event;
+    tail_event.type = ORDER_JOURNAL_CANCEL;
+    tail_event.cancel_reason = CANCELLING_FOR_USER;
+    tail_event.order_id = TEST_MARKET + QString::number( grid_start +2 ); // and the sell was cancelled
+    tail += tail_event;
+
+    e->market_info[ TEST_MARKET ].position_index.clear();
+    e->setPendingSnapshots( grid_data, tail );
+    assert( e->positions->all().size() == 2 );
+    assert( e->positions->getByIndex( TEST_MARKET, grid_start )->side == SIDE_SELL );
+    assert( e->positions->getByIndex( TEST_MARKET, grid_start +1 )->side == SIDE_BUY );
+    assert( e->positions->getByIndex( TEST_MARKET, grid_start +2 ) == nullptr );
+    assert( e->market_info[ TEST_MARKET ].position_index.value( grid_start ).fill_count == 1 );
+
+    e->positions->cancelLocal();
+    assert( e->positions->all().size() == 0 );
+    ///
+
     /// run ping-pong bulk fill test
     ///
     ///   BUYS  |  SELLS
@@ -225,7 +359,7 @@ void EngineTest::test( Engine *e )
     e->processFilledOrders( pp, FILL_WSS );
 
     QMap<QString,qint32> price_count;
-    for ( QSet<Position*>::const_iterator i = e->positions->all().begin(); i != e->positions->all().end(); i++ )
+    for ( QVector<Position*>::const_iterator i = e->positions->all().constBegin(); i != e->positions->all().constEnd(); i++ )
         price_count[ (*i)->price ]++;
 
     //assert( price_count[ QLatin1String( "0.00000004" ) ] == 4 ); // 4 buys at 4
@@ -250,7 +384,7 @@ void EngineTest::test( Engine *e )
     e->processFilledOrders( pp, FILL_WSS );
 
     price_count.clear();
-    for ( QSet<Position*>::const_iterator i = e->positions->all().begin(); i != e->positions->all().end(); i++ )
+    for ( QVector<Position*>::const_iterator i = e->positions->all().constBegin(); i != e->positions->all().constEnd(); i++ )
         price_count[ (*i)->price ]++;
 
     //assert( price_count[ QLatin1String( "0.00000056" ) ] == 1 ); // buy at 56
@@ -288,7 +422,7 @@ void EngineTest::test( Engine *e )
 
     // spread at 8|9
     price_count.clear();
-    for ( QSet<Position*>::const_iterator i = e->positions->all().begin(); i != e->positions->all().end(); i++ )
+    for ( QVector<Position*>::const_iterator i = e->positions->all().constBegin(); i != e->positions->all().constEnd(); i++ )
         price_count[ (*i)->price ]++;
 
     //assert( price_count[ QLatin1String( "0.00000007" ) ] == 1 ); // 1 buy at 7
@@ -354,7 +488,7 @@ void EngineTest::test( Engine *e )
 //    e->positions->divergeConverge();
 
 //    quint16 buy_count = 0, sell_count = 0;
-//    for ( QSet<Position*>::const_iterator i = e->positions->all().begin(); i != e->positions->all().end(); i++ )
+//    for ( QVector<Position*>::const_iterator i = e->positions->all().constBegin(); i != e->positions->all().constEnd(); i++ )
 //        ( (*i)->side == SIDE_BUY ) ? buy_count++ : sell_count++;
 
 //    // there's 3 landmark orders of 5 orders each, on both sides, plus 3 buys and 4 sells
@@ -370,7 +504,7 @@ void EngineTest::test( Engine *e )
 //    e->processFilledOrders( filled, FILL_WSS ); // fill 4 sells
 
 //    buy_count = 0, sell_count = 0;
-//    for ( QSet<Position*>::const_iterator i = e->positions->all().begin(); i != e->positions->all().end(); i++ )
+//    for ( QVector<Position*>::const_iterator i = e->positions->all().constBegin(); i != e->positions->all().constEnd(); i++ )
 //        ( (*i)->side == SIDE_BUY ) ? buy_count++ : sell_count++;
 
 //    // there's 3 landmark orders of 5 orders each, on both sides, plus 7 buys and 0 sells
@@ -380,7 +514,7 @@ void EngineTest::test( Engine *e )
 //    e->positions->divergeConverge(); // diverge landmark sell
 
 //    buy_count = 0, sell_count = 0;
-//    for ( QSet<Position*>::const_iterator i = e->positions->all().begin(); i != e->positions->all().end(); i++ )
+//    for ( QVector<Position*>::const_iterator i = e->positions->all().constBegin(); i != e->positions->all().constEnd(); i++ )
 //        ( (*i)->side == SIDE_BUY ) ? buy_count++ : sell_count++;
 
 //    // there's 3 landmark buys and 2 landmark sells, plus 7 buys and 5 sells
@@ -395,6 +529,10 @@ void EngineTest::test( Engine *e )
     e->getMarketInfoStructure().clear(); // clear TEST_MARKET market from market settings
     e->positions->diverge_converge.clear(); // clear TEST_MARKET from dc market index
     e->positions->diverging_converging.clear(); // clear TEST_MARKET from dc market index
+    e->positions->slots_dc.clear(); // and its reserved slots
+    e->wanted_market_ids.clear(); // and the tickers it filtered
+    e->tracked_market_ids.clear();
+    e->tracked_markets_time = 0;
 
     // clear TEST_MARKET market stats
     e->alpha->reset();
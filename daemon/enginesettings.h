@@ -47,9 +47,16 @@ struct EngineSettings
     bool should_dc_slippage_orders{ false };
     qint64 order_timeout{ 3 * 60000 }; // how long before we resend most requests
     qint64 cancel_timeout{ 5 * 60000 }; // how long before we resend a cancel request
+    qint64 adaptive_timeout_multiplier{ 4 }; // shorten the timeouts above to recent p99 reply time * this (0 = off)
+    qint64 order_timeout_min{ 20000 }; // lower bound for the adaptive order timeout
+    qint64 cancel_timeout_min{ 30000 }; // lower bound for the adaptive cancel timeout
     qint64 stray_grace_time_limit{ 10000 }; // how long before we cancel stray orders, if enabled
     qint64 safety_delay_time; // safety delay, should be more than your ping by a second or two
     qint64 ticker_safety_delay_time; // ^
+
+    // PAPER_TRADE builds
+    qint64 paper_latency{ 250 }; // how long simulated orders and cancels take to reach the exchange
+    quint8 paper_fill_model{ PAPER_FILL_CROSS };
 };
 
 #endif // ENGINESETTINGS_H
@@ -0,0 +1,93 @@
+#include "eventfeed.h"
+
+#include <QObject>
+#include <QMetaObject>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <atomic>
+
+namespace
+{
+
+static const char *const TYPE_NAMES[] = { "fill", "order", "ticker", "spruce" };
+
+static std::atomic<quint32> subscribed_mask( 0 );
+
+// the publishers hold this only to append, the listener to swap the queue out
+static QMutex pending_lock;
+static QVector<EventFeed::Event> pending;
+static quint64 pending_dropped = 0;
+static bool is_wake_posted = false;
+static QObject *listener = nullptr; // cleared by the listener before it goes
+
+} // namespace
+
+qint32 EventFeed::getType( const QString &name )
+{
+    for ( qint32 i = 0; i < TYPE_COUNT; i++ )
+        if ( name.compare( QLatin1String( TYPE_NAMES[ i ] ), Qt::CaseInsensitive ) == 0 )
+            return i;
+
+    return -1;
+}
+
+const char *EventFeed::getTypeName( const Type type )
+{
+    return type < TYPE_COUNT ? TYPE_NAMES[ type ] : "unknown";
+}
+
+void EventFeed::setListener( QObject *_listener )
+{
+    QMutexLocker locker( &pending_lock );
+    listener = _listener;
+}
+
+void EventFeed::setSubscribedMask( const quint32 mask )
+{
+    subscribed_mask.store( mask, std::memory_order_relaxed );
+}
+
+bool EventFeed::isSubscribed( const Type type )
+{
+    return ( subscribed_mask.load( std::memory_order_relaxed ) & ( 1u << type ) ) != 0;
+}
+
+void EventFeed::publish( const Type type, const QByteArray &line )
+{
+    if ( !isSubscribed( type ) )
+        return;
+
+    QMutexLocker locker( &pending_lock );
+
+    // the listener is behind, don't grow without bound
+    if ( pending.size() >= PENDING_MAX )
+    {
+        pending_dropped++;
+        return;
+    }
+
+    Event event;
+    event.type = type;
+    event.line = line;
+    pending += event;
+
+    if ( is_wake_posted || !listener )
+        return;
+
+    is_wake_posted = true;
+    QMetaObject::invokeMethod( listener, "flushEvents", Qt::QueuedConnection );
+}
+
+quint64 EventFeed::takePending( QVector<Event> &events )
+{
+    QMutexLocker locker( &pending_lock );
+
+    events.swap( pending );
+    pending.clear();
+    is_wake_posted = false;
+
+    const quint64 dropped = pending_dropped;
+    pending_dropped = 0;
+    return dropped;
+}
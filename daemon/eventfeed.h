@@ -0,0 +1,50 @@
+#ifndef EVENTFEED_H
+#define EVENTFEED_H
+
+#include "global.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+class QObject;
+
+//
+// EventFeed, the events pushed to the ipc clients that subscribed to them, instead of them polling getstatus and
+// getorders. the engine threads and spruce publish one text line per event, the listener takes them on the main
+// thread and writes them to each subscriber. nothing is formatted or queued while a type has no subscribers, and
+// the queue between the threads is bounded, the events over it are counted as dropped for the subscribers
+//
+namespace EventFeed
+{
+    enum Type : quint8
+    {
+        TYPE_FILL = 0, // fill <engine id> <market> <side> <order id> <price> <quantity> <amount> <fee> <fill type> <tag> <time>
+        TYPE_ORDER, // order <set|cancel> <engine id> <market> <side> <order id> <price> <quantity> <amount> <tag> <time>
+        TYPE_TICKER, // ticker <engine id> <market> <bid> <ask> <time>
+        TYPE_SPRUCE, // spruce <engine id> <market> <quantity to short/long> <amount to short/long> <time>
+        TYPE_COUNT
+    };
+
+    static const qint32 PENDING_MAX = 65536; // events waiting for the listener, over this they're dropped
+
+    struct Event
+    {
+        Type type{ TYPE_COUNT };
+        QByteArray line; // with the newline
+    };
+
+    qint32 getType( const QString &name ); // -1 if it isn't one, "all" isn't either
+    const char *getTypeName( const Type type );
+
+    // the listener, it's woken with a queued flushEvents() when the first event is pending. the mask has a bit for
+    // each type with a subscriber
+    void setListener( QObject *listener );
+    void setSubscribedMask( const quint32 mask );
+    bool isSubscribed( const Type type ); // check before building the line
+
+    void publish( const Type type, const QByteArray &line ); // from any thread
+    quint64 takePending( QVector<Event> &events ); // returns the events dropped since the last take
+}
+
+#endif // EVENTFEED_H
@@ -0,0 +1,43 @@
+#include "eventfeed_test.h"
+#include "eventfeed.h"
+
+#include <QVector>
+
+#include <assert.h>
+
+void EventFeedTest::test()
+{
+    /// test the names
+    assert( EventFeed::getType( "fill" ) == EventFeed::TYPE_FILL );
+    assert( EventFeed::getType( "Spruce" ) == EventFeed::TYPE_SPRUCE );
+    assert( EventFeed::getType( "all" ) == -1 );
+    assert( QByteArray( EventFeed::getTypeName( EventFeed::TYPE_TICKER ) ) == "ticker" );
+
+    /// test that nothing is queued without a subscriber
+    QVector<EventFeed::Event> events;
+    EventFeed::setSubscribedMask( 0 );
+    EventFeed::publish( EventFeed::TYPE_FILL, "fill\n" );
+    assert( EventFeed::takePending( events ) == 0 );
+    assert( events.isEmpty() );
+
+    /// test the subscribed types go through in order, and the rest don't
+    EventFeed::setSubscribedMask( 1u << EventFeed::TYPE_ORDER | 1u << EventFeed::TYPE_TICKER );
+    assert( EventFeed::isSubscribed( EventFeed::TYPE_ORDER ) && !EventFeed::isSubscribed( EventFeed::TYPE_FILL ) );
+    EventFeed::publish( EventFeed::TYPE_ORDER, "order 1\n" );
+    EventFeed::publish( EventFeed::TYPE_FILL, "fill\n" );
+    EventFeed::publish( EventFeed::TYPE_TICKER, "ticker\n" );
+    EventFeed::publish( EventFeed::TYPE_ORDER, "order 2\n" );
+    assert( EventFeed::takePending( events ) == 0 );
+    assert( events.size() == 3 );
+    assert( events.at( 0 ).line == "order 1\n" && events.at( 2 ).line == "order 2\n" );
+    assert( events.at( 1 ).type == EventFeed::TYPE_TICKER );
+
+    /// test the queue is bounded, the rest are counted
+    for ( qint32 i = 0; i < EventFeed::PENDING_MAX + 10; i++ )
+        EventFeed::publish( EventFeed::TYPE_TICKER, "ticker\n" );
+    assert( EventFeed::takePending( events ) == 10 );
+    assert( events.size() == EventFeed::PENDING_MAX );
+    assert( EventFeed::takePending( events ) == 0 && events.isEmpty() );
+
+    EventFeed::setSubscribedMask( 0 );
+}
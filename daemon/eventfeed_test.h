@@ -0,0 +1,9 @@
+#ifndef EVENTFEED_TEST_H
+#define EVENTFEED_TEST_H
+
+struct EventFeedTest
+{
+    void test();
+};
+
+#endif // EVENTFEED_TEST_H
@@ -1,83 +1,119 @@
 #include "fallbacklistener.h"
 #include "global.h"
 
-#include <QTimer>
 #include <QFile>
+#include <QFileSystemWatcher>
 
-FallbackListener::FallbackListener(QObject *parent)
-    : QObject( parent ),
-      input_file( nullptr ),
-      input_timer( nullptr )
+#include <algorithm>
+
+FallbackListener::FallbackListener( QObject *parent )
+    : QObject( parent )
 {
-    openInputFile();
+    input_file_path = Global::getTraderPath() + QDir::separator() + "in.txt";
+    offset_file_path = input_file_path + ".offset";
+
+    loadOffset();
+
+    // the directory too, editors that save by renaming a new file over the old one drop it from the watch
+    watcher = new QFileSystemWatcher( this );
+    connect( watcher, &QFileSystemWatcher::fileChanged, this, &FallbackListener::parseInputFile );
+    connect( watcher, &QFileSystemWatcher::directoryChanged, this, &FallbackListener::onDirectoryChanged );
+    watcher->addPath( Global::getTraderPath() );
+
+    watchInputFile();
 
-    // init input timer to read commands from in.txt
-    input_timer = new QTimer( this );
-    connect( input_timer, &QTimer::timeout, this, &FallbackListener::parseInputFile );
-    input_timer->setTimerType( Qt::VeryCoarseTimer );
-    input_timer->start( 1000 );
+    // commands left from while we were down
+    parseInputFile();
 }
 
 FallbackListener::~FallbackListener()
 {
-    input_file->close();
-    input_timer->stop();
+    delete watcher;
+    watcher = nullptr;
+}
+
+void FallbackListener::watchInputFile()
+{
+    // create the file, so there's something to watch
+    if ( !QFile::exists( input_file_path ) )
+    {
+        QFile input_file( input_file_path );
+        if ( !input_file.open( QIODevice::WriteOnly | QIODevice::Append ) )
+        {
+            kDebug() << "[FallbackListener] local error: failed to create input file:" << input_file_path;
+            return;
+        }
+    }
 
-    delete input_file;
-    delete input_timer;
+    if ( !watcher->files().contains( input_file_path ) && watcher->addPath( input_file_path ) )
+        kDebug() << "[FallbackListener] watching fallback input file" << input_file_path;
 }
 
-bool FallbackListener::openInputFile()
+void FallbackListener::onDirectoryChanged()
 {
-    // the file is open and ready, exit
-    if ( input_file && input_file->isReadable() && input_file->isWritable() )
-        return true;
+    // still watched, it's some other file in the directory
+    if ( watcher->files().contains( input_file_path ) )
+        return;
 
-    QString input_file_path = Global::getTraderPath() + QDir::separator() + "in.txt";
+    parseInputFile();
+}
 
-    // if the file is open but stale, dispose of it
-    if ( input_file && ( !input_file->isReadable() || !input_file->exists() ) )
+void FallbackListener::parseInputFile()
+{
+    // dropped from the watch, it was removed or a new file took its place, so start over on a new one
+    if ( !watcher->files().contains( input_file_path ) )
     {
-        input_file->deleteLater();
-        input_file = nullptr;
+        read_offset = 0;
+        saveOffset();
+
+        watchInputFile();
+        if ( !watcher->files().contains( input_file_path ) )
+            return;
     }
 
-    // initialize input file if needed
-    if ( !input_file )
-    {
-        input_file = new QFile( input_file_path );
-        if ( !input_file->open( QIODevice::ReadWrite | QIODevice::Text ) )
-        {
-            // delete the file handle
-            input_file->deleteLater();
-            input_file = nullptr;
+    QFile input_file( input_file_path );
+    if ( !input_file.open( QIODevice::ReadOnly ) )
+        return;
 
-            kDebug() << "[FallbackListener] local error: failed to open input file for read/write:" << input_file->fileName();
-            return false;
-        }
+    // a shorter file was cut down or replaced, start over
+    if ( input_file.size() < read_offset )
+        read_offset = 0;
 
-        kDebug() << "[FallbackListener] opened fallback input file" << input_file->fileName();
-    }
+    if ( input_file.size() == read_offset || !input_file.seek( read_offset ) )
+        return;
+
+    QByteArray data = input_file.readAll();
+
+    // a line still being written waits for its newline
+    const int end = data.lastIndexOf( '\n' );
+    if ( end < 0 )
+        return;
+
+    data.truncate( end +1 );
+    read_offset += data.size();
 
-    return true;
+    // save the offset before we parse the commands, incase we run 'exit', otherwise they'll run next time
+    saveOffset();
+
+    QString chunk = QString::fromUtf8( data );
+    emit gotDataChunk( chunk );
 }
 
-void FallbackListener::parseInputFile()
+void FallbackListener::loadOffset()
 {
-    // check/try to open file, and check for bytes available
-    if ( !openInputFile() || input_file->bytesAvailable() == 0 )
+    QFile offset_file( offset_file_path );
+    if ( !offset_file.open( QIODevice::ReadOnly | QIODevice::Text ) )
         return;
 
-    // check for new lines
-    QString data = input_file->readAll();
+    read_offset = std::max<qint64>( offset_file.readAll().trimmed().toLongLong(), 0 );
+}
 
-    // truncate the file before we parse the commands, incase we run 'exit', otherwise they'll run next time
-    // NOTE: this causes problems, as we can't bombard the text file with frequent edits. use IPC sockets instead, except for bulk calls.
-    if ( data.size() > 0 )
+void FallbackListener::saveOffset()
+{
+    QFile offset_file( offset_file_path );
+    if ( !offset_file.open( QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text ) ||
+         offset_file.write( QByteArray::number( read_offset ) ) < 0 )
     {
-        input_file->resize( 0 );
+        kDebug() << "[FallbackListener] local error: failed to save input offset to" << offset_file_path;
     }
-
-    emit gotDataChunk( data );
 }
-
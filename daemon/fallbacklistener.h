@@ -6,10 +6,15 @@
 class FallbackListener;
 
 #include <QObject>
+#include <QString>
 
-class QFile;
-class QTimer;
+class QFileSystemWatcher;
 
+//
+// FallbackListener, runs the commands appended to <config-dir>/in.txt. the file is never truncated under the writer,
+// whole lines past the offset we read up to are taken when the file changes, and the offset is kept in in.txt.offset
+// so they don't run again after a restart. a replaced or shortened file is read from the start
+//
 class FallbackListener : public QObject
 {
     Q_OBJECT
@@ -23,11 +28,17 @@ signals:
 public slots:
     void parseInputFile();
 
+private slots:
+    void onDirectoryChanged();
+
 private:
-    bool openInputFile();
+    void watchInputFile();
+    void loadOffset();
+    void saveOffset();
 
-    QFile *input_file;
-    QTimer *input_timer;
+    QString input_file_path, offset_file_path;
+    QFileSystemWatcher *watcher{ nullptr };
+    qint64 read_offset{ 0 };
 };
 
 #endif // FALLBACKLISTENER_H
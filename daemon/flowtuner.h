@@ -0,0 +1,146 @@
+#ifndef FLOWTUNER_H
+#define FLOWTUNER_H
+
+#include "global.h"
+
+#include <QtGlobal>
+
+//
+// FlowTuner, looks for the in-flight and queued limits that get the most successful replies per second while the
+// p90 reply time stays under the slo. every interval it backs the sent limit off by a quarter if replies were slow
+// or failing, and otherwise climbs while we were held back by it, stepping back once a climb lost throughput. the
+// queued limit follows the drain rate, so a full queue drains within the slo. a pinned limit is left alone
+//
+class FlowTuner
+{
+public:
+    static constexpr qint64 INTERVAL = 10000; // ms between tune() calls
+    static constexpr qint64 HOLD_TIME = 60000; // ms, how long we stay put after a climb lost throughput
+    static constexpr qint32 SENT_MIN = 4;
+    static constexpr qint32 SENT_MAX = 200;
+    static constexpr qint32 QUEUED_MIN = 8;
+    static constexpr qint32 QUEUED_MAX = 400;
+    static constexpr quint32 MIN_REPLIES = 20; // don't judge the failure rate on a couple of replies
+    static constexpr qreal FAILURE_RATIO_MAX = 0.02;
+    static constexpr qreal CLIMB_LOSS_RATIO = 0.95; // goodput under this much of the last interval's undoes a climb
+
+    bool isEnabled() const { return is_enabled; }
+    void setEnabled( const bool enabled, const qint64 current_time )
+    {
+        is_enabled = enabled;
+        reset( current_time );
+        last_step = STEP_NONE;
+    }
+
+    bool is_sent_pinned{ false };
+    bool is_queued_pinned{ false };
+
+    void addSent( const qint32 in_flight )
+    {
+        sent++;
+        peak_in_flight = qMax( peak_in_flight, in_flight );
+    }
+
+    void addReply( const bool is_failure )
+    {
+        if ( is_failure )
+            failures++;
+        else
+            successes++;
+    }
+
+    // p90 is -1 without enough replies. returns true if it changed a limit
+    bool tune( const qint64 current_time, const qint64 p90, const qint64 slo, qint32 &sent_limit, qint32 &queued_limit )
+    {
+        const qint64 elapsed = current_time - interval_start;
+        if ( !is_enabled || elapsed <= 0 )
+            return false;
+
+        const quint32 replies = successes + failures;
+        goodput = qreal( successes ) * 1000. / elapsed;
+        failure_ratio = replies > 0 ? qreal( failures ) / replies : 0.;
+
+        const bool is_congested = ( p90 >= 0 && p90 > slo ) ||
+                                  ( replies >= MIN_REPLIES && failure_ratio > FAILURE_RATIO_MAX );
+        const bool is_limited = peak_in_flight >= sent_limit;
+
+        const qint32 old_sent = sent_limit;
+        const qint32 old_queued = queued_limit;
+
+        if ( !is_sent_pinned )
+        {
+            if ( is_congested )
+            {
+                sent_limit = qMax( SENT_MIN, sent_limit * 3 / 4 );
+                last_step = STEP_DECREASE;
+            }
+            else if ( is_limited && last_step == STEP_INCREASE && goodput < last_goodput * CLIMB_LOSS_RATIO )
+            {
+                // more in flight only made the server slower, go back and stay there for a while
+                sent_limit = sent_before_step;
+                hold_until = current_time + HOLD_TIME;
+                last_step = STEP_NONE;
+            }
+            else if ( is_limited && current_time >= hold_until )
+            {
+                sent_before_step = sent_limit;
+                sent_limit = qMin( SENT_MAX, sent_limit + qMax( 1, sent_limit / 8 ) );
+                last_step = STEP_INCREASE;
+            }
+            else
+            {
+                last_step = STEP_NONE;
+            }
+        }
+
+        // what we sent this interval drains a full queue within the slo, move half way there. an idle interval says
+        // nothing about the rate
+        if ( !is_queued_pinned && sent >= MIN_REPLIES )
+        {
+            const qreal drain_rate = qreal( sent ) * 1000. / elapsed;
+            const qint32 target = qBound( QUEUED_MIN, qint32( drain_rate * slo / 1000 ), QUEUED_MAX );
+            queued_limit = qBound( QUEUED_MIN, ( queued_limit + target ) / 2, QUEUED_MAX );
+        }
+
+        last_goodput = goodput;
+        reset( current_time );
+
+        return sent_limit != old_sent || queued_limit != old_queued;
+    }
+
+    qreal getGoodput() const { return goodput; } // successful replies per second over the last interval
+    qreal getFailureRatio() const { return failure_ratio; }
+
+private:
+    enum Step : quint8
+    {
+        STEP_NONE = 0,
+        STEP_INCREASE,
+        STEP_DECREASE
+    };
+
+    void reset( const qint64 current_time )
+    {
+        interval_start = current_time;
+        sent = 0;
+        successes = 0;
+        failures = 0;
+        peak_in_flight = 0;
+    }
+
+    bool is_enabled{ false };
+    qint64 interval_start{ 0 };
+    quint32 sent{ 0 };
+    quint32 successes{ 0 };
+    quint32 failures{ 0 };
+    qint32 peak_in_flight{ 0 };
+
+    Step last_step{ STEP_NONE };
+    qint32 sent_before_step{ 0 };
+    qint64 hold_until{ 0 };
+    qreal goodput{ 0. };
+    qreal last_goodput{ 0. };
+    qreal failure_ratio{ 0. };
+};
+
+#endif // FLOWTUNER_H
@@ -13,11 +13,24 @@
 #include <QDir>
 #include <QCryptographicHash>
 #include <QRandomGenerator>
-#include <QMessageAuthenticationCode>
 #include <QSslSocket>
+#include <QMutex>
 
 #define kDebug QMessageLogger( __FILE__, __LINE__, Q_FUNC_INFO ).debug().noquote
 
+// leveled lines on top of kDebug, for the chatty ones on hot paths. levels under LOG_LEVEL (see build-config.h) are
+// compiled out, and a false condition skips the line before any of its arguments are built
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+#define LOG_ENABLED( level ) ( ( level ) >= LOG_LEVEL )
+#define kLogIf( level, condition ) if ( !LOG_ENABLED( level ) || !( condition ) ) {} else kDebug()
+#define kLog( level ) kLogIf( level, true )
+
 /// global symbols
 static const quint8 ENGINE_BITTREX                          ( 0 );
 static const quint8 ENGINE_BINANCE                          ( 1 );
@@ -44,6 +57,11 @@ static const quint8 FILL_TICKER                             ( 3 );
 static const quint8 FILL_CANCEL                             ( 4 );
 static const quint8 FILL_WSS                                ( 5 );
 static const quint8 FILL_ORDERLIST                          ( 6 );
+static const quint8 FILL_PAPER                              ( 7 );
+
+static const quint8 PAPER_FILL_TICKER                       ( 1 ); // the ticker moved past the price, like the live ticker fill check
+static const quint8 PAPER_FILL_CROSS                        ( 2 ); // the other side of the ticker reached the price
+static const quint8 PAPER_FILL_BOOK                         ( 3 ); // ^ and the book has the quantity at the price or better
 
 static const QLatin1String BUY                              ( "buy" );
 static const QLatin1String SELL                             ( "sell" );
@@ -103,14 +121,18 @@ static const int BINANCE_SAFETY_DELAY                       ( 2000 );
 static const int BINANCE_RATELIMIT_WINDOW                   ( 60000 );
 
 static const QLatin1String BNC_URL                          ( "https://api.binance.com/api/v3/" );
-static const QLatin1String BNC_URL_WSS                      ( "wss://api.binance.com" );
+static const QLatin1String BNC_URL_WSS                      ( "wss://stream.binance.com:9443/stream" );
 static const QLatin1String BNC_COMMAND_GETORDERS            ( "sign-get-openOrders" );
 static const QLatin1String BNC_COMMAND_BUYSELL              ( "sign-post-order" );
 static const QLatin1String BNC_COMMAND_CANCEL               ( "sign-delete-order" );
+static const QLatin1String BNC_COMMAND_CANCEL_PAIR          ( "sign-delete-openOrders" );
+static const QLatin1String BNC_COMMAND_CANCEL_REPLACE       ( "sign-post-order/cancelReplace" );
 static const QLatin1String BNC_COMMAND_GETORDER             ( "sign-get-order" );
 static const QLatin1String BNC_COMMAND_GETTICKER            ( "get-ticker/bookTicker" );
 static const QLatin1String BNC_COMMAND_GETEXCHANGEINFO      ( "get-v1-exchangeInfo" );
 static const QLatin1String BNC_COMMAND_GETBALANCES          ( "sign-get-account" );
+static const QLatin1String BNC_COMMAND_NEWLISTENKEY         ( "key-post-userDataStream" );
+static const QLatin1String BNC_COMMAND_KEEPLISTENKEY        ( "key-put-userDataStream" );
 static const QLatin1String BNC_RECVWINDOW                   ( "recvWindow" );
 static const QLatin1String BNC_TIMESTAMP                    ( "timestamp" );
 static const QLatin1String BNC_SIGNATURE                    ( "signature" );
@@ -138,13 +160,14 @@ static const QLatin1String POLO_COMMAND_GETORDERS_ARGS      ( "currencyPair=all"
 static const QLatin1String POLO_COMMAND_CANCEL              ( "cancelOrder" );
 static const QLatin1String POLO_COMMAND_CANCEL_ARGS         ( "orderNumber=" );
 static const QLatin1String POLO_COMMAND_GETBOOKS            ( "returnOrderBook" );
-static const QLatin1String POLO_COMMAND_GETBOOKS_ARGS       ( "currencyPair=all&depth=1" );
+static const QLatin1String POLO_COMMAND_GETBOOKS_ARGS       ( "currencyPair=all&depth=10" );
 static const QLatin1String POLO_COMMAND_GETFEE              ( "returnFeeInfo" );
 
 // waves symbols
 static const QLatin1String WAVES_MINIMUM_ORDER_SIZE         ( "0.00150000" );
 static const QLatin1String WAVES_EXCHANGE_STR               ( "Waves" );
 static const QLatin1String WAVES_MATCHER_URL                ( "https://matcher.waves.exchange/" );
+static const QLatin1String WAVES_MATCHER_URL_WSS            ( "wss://matcher.waves.exchange/ws/v0" );
 static const int WAVES_TIMER_INTERVAL_NAM_SEND              ( 100 );
 static const int WAVES_TIMER_INTERVAL_MARKET_DATA           ( 60000 * 60 );
 static const int WAVES_TIMER_INTERVAL_TICKER                ( 900 );
@@ -155,7 +178,9 @@ static const QLatin1String WAVES_COMMAND_GET_MARKET_DATA    ( "md-get-matcher/or
 static const QLatin1String WAVES_COMMAND_GET_MARKET_STATUS  ( "ms-get-matcher/orderbook/%1/%2/status" );
 static const QLatin1String WAVES_COMMAND_GET_ORDER_STATUS   ( "os-get-matcher/orderbook/%1/%2/%3" );
 static const QLatin1String WAVES_COMMAND_GET_MY_ORDERS      ( "om-get-matcher/orderbook/%1" );
+static const QLatin1String WAVES_COMMAND_GET_MY_HISTORY     ( "oh-get-matcher/orderbook/%1" );
 static const QLatin1String WAVES_COMMAND_POST_ORDER_CANCEL  ( "oc-post-matcher/orderbook/%1/%2/cancel" );
+static const QLatin1String WAVES_COMMAND_POST_PAIR_CANCEL   ( "oa-post-matcher/orderbook/%1/%2/cancel" );
 static const QLatin1String WAVES_COMMAND_POST_ORDER_NEW     ( "on-post-matcher/orderbook" );
 
 namespace Global {
@@ -218,18 +243,6 @@ static inline QString getDateStringFull()
     return QDateTime::currentDateTime().toString( "MM-dd-yy HH:mm:ss" );
 }
 
-static inline QByteArray getBittrexPoloSignature( const QByteArray &body, const QByteArray &secret )
-{
-    // sign hmac-sha512
-    return QMessageAuthenticationCode::hash( body, secret, QCryptographicHash::Sha512 ).toHex();
-}
-
-static inline QByteArray getBncSignature( const QByteArray &body, const QByteArray &secret )
-{
-    // sign hmac-sha256
-    return QMessageAuthenticationCode::hash( body, secret, QCryptographicHash::Sha256 ).toHex();
-}
-
 static inline const QString getConfigPath()
 {
     return QStandardPaths::writableLocation( QStandardPaths::ConfigLocation );
@@ -257,6 +270,40 @@ static inline const QString getWavesSettingsPath()
     return getTraderPath() + QDir::separator() + "waves.settings";
 }
 
+static inline const QString getExchangesPath()
+{
+    return getTraderPath() + QDir::separator() + "exchanges";
+}
+static inline const QString getThreadsPath()
+{
+    return getTraderPath() + QDir::separator() + "threads";
+}
+
+static inline const QString getSpruceLinkPath()
+{
+    return getTraderPath() + QDir::separator() + "spruce.link";
+}
+
+static inline const QString getStandbyPath()
+{
+    return getTraderPath() + QDir::separator() + "standby";
+}
+
+static inline const QString getWavesAccountsPath()
+{
+    return getTraderPath() + QDir::separator() + "waves.accounts";
+}
+
+static inline const QString getMockScriptPath( const QString &exchange )
+{
+    return getTraderPath() + QDir::separator() + QString( "mock.%1" ).arg( exchange );
+}
+
+static inline const QString getTracePath( const qint64 time )
+{
+    return getTraderPath() + QDir::separator() + QString( "trace.%1.json" ).arg( time );
+}
+
 static inline const QString getIPCPath()
 {
     return getTraderPath() + QDir::separator() + "trader.ipc";
@@ -267,6 +314,22 @@ static inline const QString getMarketStatsPath()
     return getTraderPath() + QDir::separator() + "stats";
 }
 
+static inline const QString getMarketStatsJournalPath()
+{
+    return getTraderPath() + QDir::separator() + "stats.journal";
+}
+
+static inline const QString getOrderJournalPath( const quint8 engine_type, const qint32 shard = 0 )
+{
+    return getTraderPath() + QDir::separator() + ( shard > 0 ? QString( "orders.%1.%2.journal" ).arg( engine_type ).arg( shard ) :
+                                                               QString( "orders.%1.journal" ).arg( engine_type ) );
+}
+
+static inline const QString getMetadataCachePath( const quint8 engine_type, const QString &name )
+{
+    return getTraderPath() + QDir::separator() + QString( "cache.%1.%2.json" ).arg( engine_type ).arg( name );
+}
+
 static inline const QString getCostFunctionCachePath()
 {
     return getTraderPath() + QDir::separator() + "cache";
@@ -277,6 +340,11 @@ static inline const QString getOldLogsPath()
     return getTraderPath() + QDir::separator() + "logs_old";
 }
 
+static inline const QString getRecordingsPath()
+{
+    return getTraderPath() + QDir::separator() + "recordings";
+}
+
 static inline void ensurePath()
 {
     // get dir ~/.config/<trader_dir>
@@ -335,105 +403,6 @@ static inline void fillInColors( QString &s )
     s.replace( ">>>none<<<", "\x1b[0m" );
 }
 
-static void messageOutput( QtMsgType type, const QMessageLogContext &context, const QString &msg )
-{
-    // avoid warnings
-    Q_UNUSED( messageOutput )
-    Q_UNUSED( context )
-
-    // add a logfile tag for test build
-    static QString log_file_path = QString( getTraderPath() + QDir::separator() + "log.%1.txt" )
-                                    .arg( QDateTime::currentSecsSinceEpoch() );
-
-    static QString log_color_file_path = QString( getTraderPath() + QDir::separator() + "log.%1_color.txt" )
-                                    .arg( QDateTime::currentSecsSinceEpoch() );
-
-    static QFile *log_file_handle = new QFile( log_file_path );
-    static QFile *log_color_file_handle = new QFile( log_color_file_path );
-
-    // open log file
-    if ( !log_file_handle->isOpen() )
-    {
-        // make sure path exists
-        ensurePath();
-
-        // move old logs to <trader_dir>/old_logs/
-        if ( !moveOldLogsOut() )
-            qCritical() << "local error: failed to move old logs out, check file permissions";
-
-        if ( !log_file_handle->open( QFile::Append | QFile::Text ) )
-            qCritical() << "local error: failed to open log file!:" << log_file_path;
-        else
-            kDebug() << "opened log" << log_file_path;
-    }
-
-    // open log_color file
-    if ( !log_color_file_handle->isOpen() )
-    {
-        // make sure path exists
-        QDir dir;
-        dir.mkdir( getTraderPath() );
-
-        if ( !log_color_file_handle->open( QFile::Append | QFile::Text ) )
-            qCritical() << "local error: failed to open log_color file!:" << log_color_file_path;
-        else
-            kDebug() << "opened log_color" << log_color_file_path;
-    }
-
-#if defined(PRINT_LOGS_WITH_FUNCTION_NAMES)
-#include <QMessageLogContext>
-
-    QString endMessage = QString( "%1 %2 %3  %4\n" )
-                            .arg( getDateStringFull() )
-                            .arg( context.function )
-                            .arg( "" )
-                            .arg( msg );
-#else
-    static QString endMessage;
-    endMessage = QString( "%1  %2\n" )
-                    .arg( getDateStringFull() )
-                    .arg( msg );
-#endif
-
-    // form color string
-    static QString endMessage_unixcolors;
-    endMessage_unixcolors= endMessage;
-    fillInColors( endMessage_unixcolors ); // replace color tags with unix color codes
-
-    static QByteArray endMessageBytes;
-    endMessageBytes = endMessage_unixcolors.toUtf8();
-
-    // print to console
-#if defined(PRINT_LOGS_TO_CONSOLE)
-    fprintf( stderr, "%s", endMessageBytes.constData() );
-#endif
-
-#if defined(PRINT_LOGS_TO_FILE_COLOR)
-    // print to file_color
-    if ( log_color_file_handle->isWritable() )
-    {
-        log_color_file_handle->write( endMessageBytes, endMessageBytes.size() );
-        log_color_file_handle->flush();
-    }
-#endif
-
-#if defined(PRINT_LOGS_TO_FILE)
-    cleanseColorTags( endMessage ); // replace color tags with nothing
-
-    endMessageBytes = endMessage.toUtf8();
-
-    // print to file
-    if ( log_file_handle->isWritable() )
-    {
-        log_file_handle->write( endMessageBytes, endMessageBytes.size() );
-        log_file_handle->flush();
-    }
-#endif
-
-    if ( type == QtFatalMsg )
-        abort();
-}
-
 } // namespace Global
 
 #endif // GLOBAL_H
@@ -0,0 +1,241 @@
+#include "hmacsigner.h"
+
+#include <QRandomGenerator>
+
+#include <cstring>
+
+// nacl sha512 compression, from ../libcurve25519-donna/nacl_sha512/blocks.c
+extern "C" int crypto_hashblocks_sha512( unsigned char *statebytes, const unsigned char *in, uint64_t inlen );
+
+static const quint8 SHA256_IV[ 32 ] =
+{
+    0x6a, 0x09, 0xe6, 0x67, 0xbb, 0x67, 0xae, 0x85, 0x3c, 0x6e, 0xf3, 0x72, 0xa5, 0x4f, 0xf5, 0x3a,
+    0x51, 0x0e, 0x52, 0x7f, 0x9b, 0x05, 0x68, 0x8c, 0x1f, 0x83, 0xd9, 0xab, 0x5b, 0xe0, 0xcd, 0x19
+};
+
+static const quint8 SHA512_IV[ 64 ] =
+{
+    0x6a, 0x09, 0xe6, 0x67, 0xf3, 0xbc, 0xc9, 0x08, 0xbb, 0x67, 0xae, 0x85, 0x84, 0xca, 0xa7, 0x3b,
+    0x3c, 0x6e, 0xf3, 0x72, 0xfe, 0x94, 0xf8, 0x2b, 0xa5, 0x4f, 0xf5, 0x3a, 0x5f, 0x1d, 0x36, 0xf1,
+    0x51, 0x0e, 0x52, 0x7f, 0xad, 0xe6, 0x82, 0xd1, 0x9b, 0x05, 0x68, 0x8c, 0x2b, 0x3e, 0x6c, 0x1f,
+    0x1f, 0x83, 0xd9, 0xab, 0xfb, 0x41, 0xbd, 0x6b, 0x5b, 0xe0, 0xcd, 0x19, 0x13, 0x7e, 0x21, 0x79
+};
+
+static const quint32 SHA256_K[ 64 ] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline quint32 load32( const quint8 *p )
+{
+    return ( quint32( p[ 0 ] ) << 24 ) | ( quint32( p[ 1 ] ) << 16 ) | ( quint32( p[ 2 ] ) << 8 ) | quint32( p[ 3 ] );
+}
+
+static inline void store32( quint8 *p, const quint32 v )
+{
+    p[ 0 ] = quint8( v >> 24 );
+    p[ 1 ] = quint8( v >> 16 );
+    p[ 2 ] = quint8( v >> 8 );
+    p[ 3 ] = quint8( v );
+}
+
+static inline quint32 rotr32( const quint32 v, const int c )
+{
+    return ( v >> c ) | ( v << ( 32 - c ) );
+}
+
+// sha256 compression over whole 64 byte blocks, the state is 8 big endian words like the nacl sha512 one
+static void hashBlocksSha256( quint8 *statebytes, const quint8 *in, quint64 size )
+{
+    quint32 state[ 8 ], w[ 64 ];
+
+    for ( int i = 0; i < 8; i++ )
+        state[ i ] = load32( statebytes + i * 4 );
+
+    for ( ; size >= 64; size -= 64, in += 64 )
+    {
+        for ( int i = 0; i < 16; i++ )
+            w[ i ] = load32( in + i * 4 );
+
+        for ( int i = 16; i < 64; i++ )
+        {
+            const quint32 s0 = rotr32( w[ i -15 ], 7 ) ^ rotr32( w[ i -15 ], 18 ) ^ ( w[ i -15 ] >> 3 );
+            const quint32 s1 = rotr32( w[ i -2 ], 17 ) ^ rotr32( w[ i -2 ], 19 ) ^ ( w[ i -2 ] >> 10 );
+            w[ i ] = w[ i -16 ] + s0 + w[ i -7 ] + s1;
+        }
+
+        quint32 a = state[ 0 ], b = state[ 1 ], c = state[ 2 ], d = state[ 3 ],
+                e = state[ 4 ], f = state[ 5 ], g = state[ 6 ], h = state[ 7 ];
+
+        for ( int i = 0; i < 64; i++ )
+        {
+            const quint32 t1 = h + ( rotr32( e, 6 ) ^ rotr32( e, 11 ) ^ rotr32( e, 25 ) ) + ( ( e & f ) ^ ( ~e & g ) ) + SHA256_K[ i ] + w[ i ];
+            const quint32 t2 = ( rotr32( a, 2 ) ^ rotr32( a, 13 ) ^ rotr32( a, 22 ) ) + ( ( a & b ) ^ ( a & c ) ^ ( b & c ) );
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[ 0 ] += a;
+        state[ 1 ] += b;
+        state[ 2 ] += c;
+        state[ 3 ] += d;
+        state[ 4 ] += e;
+        state[ 5 ] += f;
+        state[ 6 ] += g;
+        state[ 7 ] += h;
+    }
+
+    for ( int i = 0; i < 8; i++ )
+        store32( statebytes + i * 4, state[ i ] );
+}
+
+HmacSigner::HmacSigner()
+{
+    clear();
+}
+
+void HmacSigner::clear()
+{
+    // volatile so the wipe isn't optimized out
+    volatile quint8 *inner = inner_state, *outer = outer_state, *m = mask;
+    for ( int i = 0; i < MAX_STATE_SIZE; i++ )
+        inner[ i ] = outer[ i ] = m[ i ] = 0;
+
+    is_key_set = false;
+}
+
+void HmacSigner::hashBlocks( quint8 *state, const quint8 *in, const quint64 size ) const
+{
+    if ( algorithm == Sha256 )
+        hashBlocksSha256( state, in, size );
+    else
+        crypto_hashblocks_sha512( state, in, size );
+}
+
+void HmacSigner::hashFinal( quint8 *state, const quint8 *in, const qint32 size, const quint64 total_size ) const
+{
+    // the tail, 0x80, zeros, then the length in bits (sha512 has 16 bytes for it, the top 8 are always zero here)
+    quint8 padded[ MAX_BLOCK_SIZE *2 ];
+    const qint32 length_size = algorithm == Sha256 ? 8 : 16;
+    const qint32 padded_size = size < block_size - length_size ? block_size : block_size *2;
+
+    std::memcpy( padded, in, size_t( size ) );
+    padded[ size ] = 0x80;
+    std::memset( padded + size +1, 0, size_t( padded_size - size -1 ) );
+
+    const quint64 bits = total_size << 3;
+    for ( int i = 0; i < 8; i++ )
+        padded[ padded_size -1 - i ] = quint8( bits >> ( i * 8 ) );
+
+    hashBlocks( state, padded, quint64( padded_size ) );
+}
+
+void HmacSigner::unmask( const quint8 *masked, quint8 *state ) const
+{
+    for ( int i = 0; i < state_size; i++ )
+        state[ i ] = masked[ i ] ^ mask[ i ];
+}
+
+void HmacSigner::setKey( const QByteArray &secret, const Algorithm _algorithm )
+{
+    clear();
+
+    algorithm = _algorithm;
+    block_size = algorithm == Sha256 ? 64 : 128;
+    state_size = algorithm == Sha256 ? 32 : 64;
+
+    const quint8 *iv = algorithm == Sha256 ? SHA256_IV : SHA512_IV;
+    quint8 key[ MAX_BLOCK_SIZE ] = {};
+    quint8 pad[ MAX_BLOCK_SIZE ];
+
+    // keys longer than a block are hashed first
+    if ( secret.size() > block_size )
+    {
+        const quint8 *in = reinterpret_cast<const quint8*>( secret.constData() );
+        const qint32 whole = secret.size() - secret.size() % block_size;
+
+        std::memcpy( key, iv, size_t( state_size ) );
+        hashBlocks( key, in, quint64( whole ) );
+        hashFinal( key, in + whole, secret.size() - whole, quint64( secret.size() ) );
+    }
+    else
+    {
+        std::memcpy( key, secret.constData(), size_t( secret.size() ) );
+    }
+
+    // generate mask
+    for ( int i = 0; i < MAX_STATE_SIZE; i += 4 )
+        store32( mask + i, QRandomGenerator::system()->generate() );
+
+    // hash ikey and okey once
+    for ( int i = 0; i < block_size; i++ )
+        pad[ i ] = key[ i ] ^ 0x36;
+    std::memcpy( inner_state, iv, size_t( state_size ) );
+    hashBlocks( inner_state, pad, quint64( block_size ) );
+
+    for ( int i = 0; i < block_size; i++ )
+        pad[ i ] = key[ i ] ^ 0x5c;
+    std::memcpy( outer_state, iv, size_t( state_size ) );
+    hashBlocks( outer_state, pad, quint64( block_size ) );
+
+    for ( int i = 0; i < state_size; i++ )
+    {
+        inner_state[ i ] ^= mask[ i ];
+        outer_state[ i ] ^= mask[ i ];
+    }
+
+    // wipe the key copies
+    volatile quint8 *k = key, *p = pad;
+    for ( int i = 0; i < MAX_BLOCK_SIZE; i++ )
+        k[ i ] = p[ i ] = 0;
+
+    is_key_set = !secret.isEmpty();
+}
+
+void HmacSigner::sign( const char *message, const qint32 message_size, quint8 *out ) const
+{
+    const quint8 *in = reinterpret_cast<const quint8*>( message );
+    const qint32 whole = message_size - message_size % block_size;
+    quint8 state[ MAX_STATE_SIZE ];
+
+    // H( ikey || message ), starting after ikey
+    unmask( inner_state, state );
+    hashBlocks( state, in, quint64( whole ) );
+    hashFinal( state, in + whole, message_size - whole, quint64( block_size ) + quint64( message_size ) );
+
+    // H( okey || inner )
+    unmask( outer_state, out );
+    hashFinal( out, state, state_size, quint64( block_size + state_size ) );
+}
+
+QByteArray HmacSigner::signHex( const QByteArray &message ) const
+{
+    static const char hex_digits[] = "0123456789abcdef";
+
+    quint8 mac[ MAX_STATE_SIZE ];
+    sign( message.constData(), message.size(), mac );
+
+    QByteArray ret( state_size *2, Qt::Uninitialized );
+    char *out = ret.data();
+
+    for ( int i = 0; i < state_size; i++ )
+    {
+        *out++ = hex_digits[ mac[ i ] >> 4 ];
+        *out++ = hex_digits[ mac[ i ] & 0x0f ];
+    }
+
+    return ret;
+}
@@ -0,0 +1,53 @@
+#ifndef HMACSIGNER_H
+#define HMACSIGNER_H
+
+#include "global.h"
+
+#include <QByteArray>
+
+//
+// HmacSigner, hmac-sha256/sha512 with the hash states after the inner and outer key pads computed once in setKey(),
+// so signing a request only hashes the message and the inner digest. the states are masked in memory like KeyStore
+//
+class HmacSigner
+{
+public:
+    enum Algorithm
+    {
+        Sha256,
+        Sha512
+    };
+
+    static const qint32 MAX_BLOCK_SIZE = 128;
+    static const qint32 MAX_STATE_SIZE = 64; // also the biggest digest
+
+    explicit HmacSigner();
+    ~HmacSigner() { clear(); }
+
+    void setKey( const QByteArray &secret, const Algorithm _algorithm );
+    void clear();
+    bool isKeySet() const { return is_key_set; }
+
+    qint32 getDigestSize() const { return state_size; }
+
+    // hex of the mac, lowercase like QByteArray::toHex(), written straight into the returned value
+    QByteArray signHex( const QByteArray &message ) const;
+    // raw mac into out, getDigestSize() bytes
+    void sign( const char *message, const qint32 message_size, quint8 *out ) const;
+
+private:
+    void hashBlocks( quint8 *state, const quint8 *in, const quint64 size ) const; // whole blocks only
+    void hashFinal( quint8 *state, const quint8 *in, const qint32 size, const quint64 total_size ) const; // pads and hashes the tail
+    void unmask( const quint8 *masked, quint8 *state ) const;
+
+    Algorithm algorithm{ Sha512 };
+    qint32 block_size{ 128 }, state_size{ 64 };
+    bool is_key_set{ false };
+
+    // hash states after ikey/okey, xor masked
+    quint8 inner_state[ MAX_STATE_SIZE ];
+    quint8 outer_state[ MAX_STATE_SIZE ];
+    quint8 mask[ MAX_STATE_SIZE ];
+};
+
+#endif // HMACSIGNER_H
@@ -0,0 +1,47 @@
+#include "hmacsigner_test.h"
+#include "hmacsigner.h"
+
+#include <QByteArray>
+#include <QMessageAuthenticationCode>
+
+static QByteArray signHex( HmacSigner::Algorithm algorithm, const QByteArray &key, const QByteArray &message )
+{
+    HmacSigner signer;
+    signer.setKey( key, algorithm );
+    return signer.signHex( message );
+}
+
+void HmacSignerTest::test()
+{
+    /// test rfc 4231 vectors
+    const QByteArray key_1 = QByteArray( 20, char( 0x0b ) );
+    assert( signHex( HmacSigner::Sha256, key_1, "Hi There" ) == "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7" );
+    assert( signHex( HmacSigner::Sha512, key_1, "Hi There" ) == "87aa7cdea5ef619d4ff0b4241a1d6cb02379f4e2ce4ec2787ad0b30545e17cde"
+                                                               "daa833b7d6b8a702038b274eaea3f4e4be9d914eeb61f1702e696c203a126854" );
+
+    assert( signHex( HmacSigner::Sha256, "Jefe", "what do ya want for nothing?" ) == "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843" );
+
+    // key longer than the block
+    const QByteArray key_6 = QByteArray( 131, char( 0xaa ) );
+    assert( signHex( HmacSigner::Sha256, key_6, "Test Using Larger Than Block-Size Key - Hash Key First" ) == "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54" );
+    assert( signHex( HmacSigner::Sha512, key_6, "Test Using Larger Than Block-Size Key - Hash Key First" ) == "80b24263c7c1a3ebb71493c1dd7be8b49b46d1f41b4aeec1121b013783f8f352"
+                                                                                                             "6b56d037e05f2598bd0fd2215d6a1e5295e64f73f63f0aec8b915a985d786598" );
+
+    /// test against qt for each padding length, the signer is reused like in BaseREST
+    HmacSigner signer_256, signer_512;
+    const QByteArray secret = "a0b1c2d3e4f5a6b7c8d9e0f1a2b3c4d5e6f7a8b9c0d1e2f3a4b5c6d7e8f9a0b1";
+    signer_256.setKey( secret, HmacSigner::Sha256 );
+    signer_512.setKey( secret, HmacSigner::Sha512 );
+    assert( signer_256.isKeySet() && signer_256.getDigestSize() == 32 );
+
+    QByteArray message;
+    for ( int i = 0; i < 300; i++ )
+    {
+        assert( signer_256.signHex( message ) == QMessageAuthenticationCode::hash( message, secret, QCryptographicHash::Sha256 ).toHex() );
+        assert( signer_512.signHex( message ) == QMessageAuthenticationCode::hash( message, secret, QCryptographicHash::Sha512 ).toHex() );
+        message += char( 'a' + i % 26 );
+    }
+
+    signer_256.clear();
+    assert( !signer_256.isKeySet() );
+}
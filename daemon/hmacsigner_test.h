@@ -0,0 +1,9 @@
+#ifndef HMACSIGNER_TEST_H
+#define HMACSIGNER_TEST_H
+
+struct HmacSignerTest
+{
+    void test();
+};
+
+#endif // HMACSIGNER_TEST_H
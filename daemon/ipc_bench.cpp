@@ -0,0 +1,493 @@
+#include "global.h"
+#include "benchreport.h"
+#include "coinamount.h"
+#include "misctypes.h"
+#include "engine.h"
+#include "positionman.h"
+#include "bncrest.h"
+#include "alphatracker.h"
+#include "spruce.h"
+#include "spruceoverseer.h"
+#include "commandrunner.h"
+#include "commandlistener.h"
+#include "ipcprotocol.h"
+#include "mocknetwork.h"
+#include "latencyhistogram.h"
+#include "looplag.h"
+#include "tracespan.h"
+#include "taskscheduler.h"
+
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QThread>
+#include <QLocalSocket>
+#include <QDir>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QMap>
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+// ipc_bench: sends command streams to a binance engine over the local socket, the way a script talks to the daemon,
+// and prints how many commands per second the listener and the runner take, how long a batch takes from the write to
+// the end of its last command, and how late the engine thread's loop ran its timers while it was busy with them.
+// usage: ./ipc_bench [<batches> [<batch size>]] [--json <path>] (default 500 20)
+//
+// the engine runs in testing mode with the mock network answering every request, the send and ticker timers run like
+// they do in the daemon. each stream runs over the text and the binary protocol. the listener is on the main thread and
+// the runner on the engine thread like in Trader, but the text isn't prefixed with the exchange. a batch ends with a
+// setordermin on a marker market, the client keeps BENCH_WINDOW batches out and the runner's thread marks each one
+// done when it sees the marker. the log is dropped while a stream runs, printing it would be most of the time
+
+namespace
+{
+
+static const qint32 BENCH_MARKETS = 50;
+static const qint32 BENCH_WINDOW = 8; // batches written and not done yet
+static const qint32 BENCH_GRID_LEVELS = 40; // setorder prices cycle through these
+static const qint64 BENCH_IDLE_TIME = 2000; // ms of the engine loop without commands, for the baseline lag
+static const qint64 BENCH_RUN_TIMEOUT = 120000; // ms, a stream that doesn't finish by then is reported as is
+static const char *const BENCH_MARK_MARKET = "BTC_MARK";
+
+static std::atomic<bool> is_quiet( false );
+static QtMessageHandler default_handler = nullptr;
+
+void onMessage( QtMsgType type, const QMessageLogContext &context, const QString &msg )
+{
+    if ( is_quiet.load( std::memory_order_relaxed ) )
+        return;
+
+    default_handler( type, context, msg );
+}
+
+enum Stream
+{
+    STREAM_QUERY = 0,
+    STREAM_MUTATE,
+    STREAM_MIXED,
+    STREAM_COUNT
+};
+
+static const char *const STREAM_NAMES[ STREAM_COUNT ] = { "query", "mutate", "mixed" };
+
+QString getMarket( const qint32 i )
+{
+    return QString( "BTC_I%1" ).arg( i, 4, 10, QChar( '0' ) );
+}
+
+// the i'th command of a stream, the name then the args
+QStringList getCommand( const Stream stream, const qint32 i )
+{
+    const QString market = getMarket( i % BENCH_MARKETS );
+    const bool is_query = stream == STREAM_QUERY || ( stream == STREAM_MIXED && i % 2 == 0 );
+
+    if ( is_query )
+    {
+        switch ( ( i / 2 ) % 4 )
+        {
+        case 0: return QStringList() << "getstatus";
+        case 1: return QStringList() << "getbuyselltotal";
+        case 2: return QStringList() << "gethibuylosell";
+        default: return QStringList() << "getlatency";
+        }
+    }
+
+    switch ( ( i / 2 ) % 4 )
+    {
+    case 0:
+    case 1:
+    {
+        // ping-pongs below the bid, each level is 0.2% under the last
+        const Coin buy_price = Coin( "0.01000000" ).ratio( 1. - 0.002 * ( 1 + ( i / BENCH_MARKETS ) % BENCH_GRID_LEVELS ) );
+        return QStringList() << "setorder" << market << BUY << buy_price.toString( 8 ) << buy_price.ratio( 1.01 ).toString( 8 )
+                             << "0.01000000" << ACTIVE;
+    }
+    case 2: return QStringList() << "setordermin" << market << QString::number( 1 + i % 10 );
+    default: return QStringList() << "setorderdc" << market << QString::number( 1 + i % 3 );
+    }
+}
+
+QByteArray getBatch( const Stream stream, const bool is_binary, const qint32 seq, const qint32 batch_size )
+{
+    QVector<QStringList> commands;
+    for ( qint32 i = 0; i < batch_size; i++ )
+        commands += getCommand( stream, seq * batch_size + i );
+
+    commands += QStringList() << "setordermin" << BENCH_MARK_MARKET << QString::number( seq );
+
+    if ( !is_binary )
+    {
+        QString text;
+        for ( QVector<QStringList>::const_iterator i = commands.begin(); i != commands.end(); i++ )
+            text += i->join( QChar( ' ' ) ) + QChar( '\n' );
+
+        return text.toUtf8();
+    }
+
+    // numbers go in as ints, like a script that knows the types would send them
+    IpcFrameWriter writer( ENGINE_BINANCE );
+    for ( QVector<QStringList>::const_iterator i = commands.begin(); i != commands.end(); i++ )
+    {
+        writer.addCommand( getIpcCommandId( i->first() ), quint8( i->size() -1 ) );
+
+        for ( QStringList::const_iterator j = i->begin() +1; j != i->end(); j++ )
+        {
+            bool ok = false;
+            const qint64 n = j->toLongLong( &ok );
+            if ( ok )
+                writer.addInt( n );
+            else
+                writer.addString( *j );
+        }
+    }
+
+    return writer.finish();
+}
+
+// filled in by the client and the runner's thread, read once both are done
+struct Progress
+{
+    explicit Progress( const qint32 batches )
+        : sent_ns( batches +1, 0 ),
+          done_ns( batches +1, 0 )
+    {
+    }
+
+    QVector<qint64> sent_ns; // by batch seq, which starts at 1
+    QVector<qint64> done_ns;
+    std::atomic<qint32> completed{ 0 };
+    std::atomic<bool> is_stopped{ false };
+    std::atomic<bool> is_failed{ false };
+};
+
+void runClient( const QString &path, const bool is_binary, const QVector<QByteArray> &batches, Progress *progress )
+{
+    QLocalSocket sck;
+    sck.connectToServer( path );
+    if ( !sck.waitForConnected( 5000 ) )
+    {
+        progress->is_failed = true;
+        return;
+    }
+
+    if ( is_binary )
+        sck.write( IPC_BINARY_MAGIC, IPC_BINARY_MAGIC_SIZE );
+
+    for ( qint32 i = 0; i < batches.size() && !progress->is_stopped; i++ )
+    {
+        const qint32 seq = i +1;
+
+        while ( seq - progress->completed.load() > BENCH_WINDOW && !progress->is_stopped )
+            std::this_thread::sleep_for( std::chrono::microseconds( 50 ) );
+
+        progress->sent_ns[ seq ] = TraceRing::now();
+        sck.write( batches.at( i ) );
+        sck.waitForBytesWritten( 5000 );
+    }
+
+    while ( progress->completed.load() < batches.size() && !progress->is_stopped )
+        std::this_thread::sleep_for( std::chrono::microseconds( 200 ) );
+
+    sck.disconnectFromServer();
+}
+
+//
+// BenchRouter, hands what the listener reads to the runner on its thread like Trader does, and after each chunk
+// looks at the marker to see which batches are done
+//
+class BenchRouter : public QObject
+{
+public:
+    explicit BenchRouter( Engine *_engine, CommandRunner *_runner ) : engine( _engine ), runner( _runner ) {}
+
+    void setProgress( Progress *_progress ) { progress = _progress; }
+
+    void onDataChunk( QString &s )
+    {
+        QMetaObject::invokeMethod( runner, "runCommandChunk", Qt::QueuedConnection, Q_ARG( QString, s ) );
+        QMetaObject::invokeMethod( runner, [this]() { onChunkDone(); }, Qt::QueuedConnection );
+    }
+
+    void onBinaryFrame( const QByteArray &frame )
+    {
+        QMetaObject::invokeMethod( runner, "runCommandFrame", Qt::QueuedConnection, Q_ARG( QByteArray, frame ) );
+        QMetaObject::invokeMethod( runner, [this]() { onChunkDone(); }, Qt::QueuedConnection );
+    }
+
+private:
+    // on the runner's thread
+    void onChunkDone()
+    {
+        if ( !progress )
+            return;
+
+        const qint32 mark = qMin( engine->getMarketInfo( Market( BENCH_MARK_MARKET ) ).order_min, progress->done_ns.size() -1 );
+        const qint32 completed = progress->completed.load();
+        if ( mark <= completed )
+            return;
+
+        const qint64 current_ns = TraceRing::now();
+        for ( qint32 seq = completed +1; seq <= mark; seq++ )
+            progress->done_ns[ seq ] = current_ns;
+
+        progress->completed.store( mark );
+    }
+
+    Engine *engine{ nullptr };
+    CommandRunner *runner{ nullptr };
+    Progress *progress{ nullptr };
+};
+
+// a probe of the engine thread's loop for one run
+LoopProbe *startProbe( QThread *thread )
+{
+    LoopProbe *probe = new LoopProbe( "engine" );
+    probe->moveToThread( thread );
+    QMetaObject::invokeMethod( probe, [probe]() { probe->start(); }, Qt::BlockingQueuedConnection );
+    return probe;
+}
+
+LatencyHistogram stopProbe( LoopProbe *probe )
+{
+    QMetaObject::invokeMethod( probe, [probe]() { probe->stop(); }, Qt::BlockingQueuedConnection );
+    const LatencyHistogram lag = probe->getLagHistogram();
+    probe->deleteLater();
+    return lag;
+}
+
+void waitFor( const qint64 ms, Progress *progress = nullptr, const qint32 batches = 0 )
+{
+    QEventLoop loop;
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    QTimer check;
+    QObject::connect( &check, &QTimer::timeout, &loop, [&]()
+    {
+        if ( elapsed.elapsed() >= ms || ( progress && ( progress->completed.load() >= batches || progress->is_failed ) ) )
+            loop.quit();
+    } );
+    check.start( 1 );
+    loop.exec();
+}
+
+void printLag( const QString &name, const LatencyHistogram &lag )
+{
+    kDebug() << QString( "%1 loop lag p50 %2 us | p99 %3 us | max %4 us | %5 ticks" )
+                .arg( name, -14 )
+                .arg( lag.getPercentile( 0.50 ), 7 )
+                .arg( lag.getPercentile( 0.99 ), 7 )
+                .arg( lag.getMaximum(), 7 )
+                .arg( lag.getCount() );
+}
+
+void runStream( const QString &path, QThread *engine_thread, BenchRouter *router, const Stream stream, const bool is_binary,
+                const qint32 batches, const qint32 batch_size )
+{
+    const QString name = QString( "%1 %2" ).arg( is_binary ? "binary" : "text" ).arg( STREAM_NAMES[ stream ] );
+
+    QVector<QByteArray> data;
+    data.reserve( batches );
+    qint64 bytes = 0;
+    for ( qint32 seq = 1; seq <= batches; seq++ )
+    {
+        data += getBatch( stream, is_binary, seq, batch_size );
+        bytes += data.last().size();
+    }
+
+    Progress progress( batches );
+    router->setProgress( &progress );
+
+    is_quiet = true;
+    LoopProbe *probe = startProbe( engine_thread );
+
+    const quint64 allocations_start = BenchReport::getAllocations();
+
+    // a qthread, so the socket's blocking calls have an event dispatcher
+    QThread *client = QThread::create( runClient, path, is_binary, data, &progress );
+    client->start();
+    waitFor( BENCH_RUN_TIMEOUT, &progress, batches );
+    progress.is_stopped = true;
+    client->wait();
+    delete client;
+
+    const quint64 allocations = BenchReport::getAllocations() - allocations_start;
+    const LatencyHistogram lag = stopProbe( probe );
+    router->setProgress( nullptr );
+    is_quiet = false;
+
+    if ( progress.is_failed )
+    {
+        kDebug() << "local error:" << name << "couldn't connect to" << path;
+        return;
+    }
+
+    // batch latency in us, from the write to the marker. the report's percentiles are of it per command
+    const qint32 completed = progress.completed.load();
+    LatencyHistogram latency;
+    QVector<qreal> samples;
+    samples.reserve( completed );
+    for ( qint32 seq = 1; seq <= completed; seq++ )
+    {
+        const qint64 batch_ns = progress.done_ns.at( seq ) - progress.sent_ns.at( seq );
+        latency.add( batch_ns / 1000 );
+        samples += qreal( batch_ns ) / ( batch_size +1 );
+    }
+
+    const qint64 ns = completed > 0 ? qMax<qint64>( progress.done_ns.at( completed ) - progress.sent_ns.at( 1 ), 1 ) : 1;
+    const qint64 commands = qint64( completed ) * ( batch_size +1 );
+
+    // a stream that timed out is left out, so perf_suite sees it as missing
+    if ( completed == batches )
+        BenchReport::add( BenchReport::getResult( name, commands, ns, allocations, samples ) );
+
+    kDebug() << QString( "%1 %2 commands | %3 commands/s | %4 MB/s | batch p50 %5 us | p99 %6 us | max %7 us%8" )
+                .arg( name, -14 )
+                .arg( commands, 7 )
+                .arg( qreal( commands ) * 1000000000 / ns, 10, 'f', 0 )
+                .arg( qreal( bytes ) * completed / batches * 1000 / ns, 7, 'f', 2 )
+                .arg( latency.getPercentile( 0.50 ), 7 )
+                .arg( latency.getPercentile( 0.99 ), 7 )
+                .arg( latency.getMaximum(), 7 )
+                .arg( completed < batches ? QString( " | timed out after %1 of %2 batches" ).arg( completed ).arg( batches ) : QString() );
+    printLag( name, lag );
+}
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication a( argc, argv );
+    default_handler = qInstallMessageHandler( onMessage );
+
+    QStringList args = a.arguments();
+    args.removeFirst();
+    if ( !BenchReport::init( args ) )
+        return 1;
+
+    bool ok_batches = true, ok_size = true;
+    const qint32 batches = args.size() > 0 ? args.at( 0 ).toInt( &ok_batches ) : 500;
+    const qint32 batch_size = args.size() > 1 ? args.at( 1 ).toInt( &ok_size ) : 20;
+    if ( !ok_batches || !ok_size || batches <= 0 || batch_size <= 0 || args.size() > 2 )
+    {
+        kDebug() << "usage: ipc_bench [<batches> [<batch size>]] [--json <path>]";
+        return 1;
+    }
+
+    kDebug() << "ipc_bench:" << batches << "batches of" << batch_size << "commands and a marker, across" << BENCH_MARKETS << "markets";
+
+    AlphaTracker *alpha = new AlphaTracker();
+    Spruce *spruce = new Spruce();
+    spruce->setBaseCurrency( "BTC" );
+    SpruceOverseer *spruce_overseer = new SpruceOverseer( spruce );
+    spruce_overseer->alpha = alpha;
+
+    // every request is answered with an empty list after a few ms, nothing leaves the machine
+    MockNetworkAccessManager *nam = new MockNetworkAccessManager();
+    MockResponse response;
+    response.body = "[]";
+    response.latency_ms = 5;
+    nam->addResponse( response );
+
+    Engine *engine = new Engine( ENGINE_BINANCE );
+    BncREST *rest = new BncREST( engine, nam );
+    rest->keystore.setKeys( "bench", "bench" );
+    rest->signer.setKey( rest->keystore.getSecret(), HmacSigner::Sha256 );
+
+    engine->setTesting( true );
+    engine->setVerbosity( 0 );
+    engine->alpha = alpha;
+    engine->spruce = spruce;
+    engine->spruce_lock = &spruce_overseer->spruce_lock;
+    engine->spruce_portfolios = &spruce_overseer->portfolios;
+    engine->bbo = &spruce_overseer->bbo;
+
+    QVector<BaseREST*> rest_arr( 4, nullptr );
+    rest_arr[ ENGINE_BINANCE ] = rest;
+    engine->rest_arr = rest_arr;
+
+    QMap<QString, TickerInfo> tickers;
+    for ( qint32 i = 0; i < BENCH_MARKETS; i++ )
+    {
+        engine->getMarketInfo( getMarket( i ) ).is_tradeable = true;
+        tickers.insert( getMarket( i ), TickerInfo( Coin( "0.00999000" ), Coin( "0.01001000" ) ) );
+    }
+    engine->processTicker( rest, tickers );
+
+    // the timers a trading engine runs without its websocket and keys from init()
+    rest->send_timer->setCallback( [rest]() { rest->sendNamQueue(); } );
+    rest->send_wake_timer->setCallback( [rest]() { rest->sendNamQueue(); } );
+    rest->send_timer->start( BINANCE_TIMER_INTERVAL_NAM_SEND );
+    rest->ticker_timer->setCallback( [rest]() { rest->onCheckTicker(); } );
+    rest->ticker_timer->start( BINANCE_TIMER_INTERVAL_TICKER );
+
+    CommandRunner *runner = new CommandRunner( ENGINE_BINANCE, engine, rest_arr );
+    runner->setSpruceOverseer( spruce_overseer );
+
+    // the engine thread, like Trader::startEngineThread()
+    QThread *engine_thread = new QThread();
+    engine->moveToThread( engine_thread );
+    engine->getPositionMan()->moveToThread( engine_thread );
+    rest->moveToThread( engine_thread );
+    nam->moveToThread( engine_thread );
+    runner->moveToThread( engine_thread );
+    engine_thread->start();
+
+    const QString path = QDir::temp().filePath( QString( "ipc_bench.%1" ).arg( QCoreApplication::applicationPid() ) );
+    CommandListener *listener = new CommandListener( path );
+    BenchRouter *router = new BenchRouter( engine, runner );
+    QObject::connect( listener, &CommandListener::gotDataChunk, router, &BenchRouter::onDataChunk );
+    QObject::connect( listener, &CommandListener::gotBinaryFrame, router, &BenchRouter::onBinaryFrame );
+
+    // what the loop looks like without us
+    LoopProbe *idle_probe = startProbe( engine_thread );
+    waitFor( BENCH_IDLE_TIME );
+    printLag( "idle", stopProbe( idle_probe ) );
+
+    for ( qint32 s = 0; s < STREAM_COUNT; s++ )
+    {
+        for ( qint32 binary = 0; binary < 2; binary++ )
+        {
+            runStream( path, engine_thread, router, Stream( s ), binary == 1, batches, batch_size );
+
+            // the next stream starts without the orders or the marker of this one
+            QMetaObject::invokeMethod( engine, [engine]() {
+                engine->getPositionMan()->cancelLocal();
+                engine->getMarketInfo( Market( BENCH_MARK_MARKET ) ).order_min = 0;
+            }, Qt::BlockingQueuedConnection );
+        }
+    }
+
+    delete listener;
+    delete router;
+
+    // bring the engine back to this thread before deleting it
+    QThread *main_thread = QThread::currentThread();
+    QMetaObject::invokeMethod( engine, [=]() {
+        engine->moveToThread( main_thread );
+        engine->getPositionMan()->moveToThread( main_thread );
+        rest->moveToThread( main_thread );
+        nam->moveToThread( main_thread );
+        runner->moveToThread( main_thread );
+    }, Qt::BlockingQueuedConnection );
+    engine_thread->quit();
+    engine_thread->wait();
+    delete engine_thread;
+
+    delete runner;
+    delete rest;
+    delete engine;
+    delete nam;
+    delete spruce_overseer;
+    delete spruce;
+    delete alpha;
+
+    kDebug() << "ipc_bench done.";
+
+    return BenchReport::finish( "ipc_bench" ) ? 0 : 1;
+}
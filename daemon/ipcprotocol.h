@@ -0,0 +1,132 @@
+#ifndef IPCPROTOCOL_H
+#define IPCPROTOCOL_H
+
+#include <QByteArray>
+#include <QString>
+#include <QtEndian>
+
+//
+// the binary control protocol on the ipc socket, for scripts that send commands in bulk. a connection that starts
+// with IPC_BINARY_MAGIC sends frames for the rest of its life, anything else is the text protocol.
+//
+// a frame is a little endian quint32 size of what follows, quint8 engine type, quint16 command count, then for each
+// command a quint16 id (its index in IPC_COMMAND_NAMES), quint8 arg count, and each arg as a quint8 type then:
+//   IPC_ARG_STRING: quint16 size, utf8
+//   IPC_ARG_INT:    qint64
+//   IPC_ARG_COIN:   qint64 raw subsatoshis
+//
+static const char IPC_BINARY_MAGIC[] = "\0TRDIPC"; // with the terminating zero
+static const qint32 IPC_BINARY_MAGIC_SIZE = 8;
+static const qint32 IPC_FRAME_HEADER_SIZE = 4;
+static const qint32 IPC_FRAME_MAX = 16 * 1024 * 1024;
+
+static const quint8 IPC_ARG_STRING = 1;
+static const quint8 IPC_ARG_INT = 2;
+static const quint8 IPC_ARG_COIN = 3;
+
+// command ids, append only so old clients keep working
+static const char *const IPC_COMMAND_NAMES[] =
+{
+    "getbalances", "getlastprices", "getbuyselltotal", "cancelall", "cancellocal", "cancelhighest", "cancellowest",
+    "getorders", "getpositions", "getordersbyindex", "setorder", "setordermin", "setordermax", "setorderdc",
+    "setorderdcnice", "setorderlandmarkthresh", "setorderlandmarkstart", "long", "longindex", "short", "shortindex",
+    "setcancelthresh", "setkeyandsecret", "getdailyvolume", "getdailyfills", "getalpha", "setalphamanual",
+    "getdailymarketvolume", "getshortlong", "gethibuylosell", "setmarketsettings", "setmarketoffset",
+    "setmarketsentiment", "setnaminterval", "setbookinterval", "settickerinterval", "setwavestickerbatch",
+    "setwavesjwt", "setgracetimelimit", "setcheckinterval", "setdcinterval", "setclearstrayorders",
+    "setclearstrayordersall", "setslippagecalculated", "setadjustbuysell", "setdcslippage",
+    "setorderbookstaletolerance", "setsafetydelaytime", "settickersafetydelaytime", "setslippagestaletime",
+    "setqueuedcommandsmax", "setqueuedcommandsmaxdc", "setsentcommandsmax", "sethttp2", "setrecording",
+    "setpaperlatency", "setpaperfillmodel", "settimeoutyield", "setrequesttimeout", "setcanceltimeout",
+    "setadaptivetimeout", "setslippagetimeout", "setspruceinterval", "setsprucebasecurrency", "setspruceweight",
+    "setsprucestartnode", "setspruceshortlongtotal", "setsprucebetamarket", "setspruceamplification",
+    "setsprucesolver", "setsprucetrigger", "setsprucewarmstart", "setspruceprofile", "setsprucereserve",
+    "setspruceordergreed", "setspruceordersize", "setspruceordernice", "setspruceordernicecustom",
+    "setspruceordernicemarketoffset", "setspruceallocation", "setsprucesnapback", "getstatus", "getconfig",
+    "getinternal", "getlatency", "setmaintenancetime", "clearallstats", "savemarket", "savesnapshot", "loadsnapshot",
+    "savesettings", "savestats", "sendcommand", "setchatty", "spruceup", "exit", "stop", "quit",
+    "savetrace", "settracing", "getmemory", "flatten", "setspruceportfolio",
+    "setwaveshistoryfills", "setgrid", "setspruceshadow", "getspruceshadows",
+    "setflowtuning", "getledger", "setspruceroute", "setsprucesolvedeadline",
+    "setsprucecostimage"
+};
+static const qint32 IPC_COMMAND_COUNT = sizeof( IPC_COMMAND_NAMES ) / sizeof( IPC_COMMAND_NAMES[ 0 ] );
+
+static inline qint32 getIpcCommandId( const QString &name )
+{
+    for ( qint32 i = 0; i < IPC_COMMAND_COUNT; i++ )
+        if ( name == QLatin1String( IPC_COMMAND_NAMES[ i ] ) )
+            return i;
+
+    return -1;
+}
+
+//
+// IpcFrameWriter, builds one frame of commands for an engine
+//
+class IpcFrameWriter
+{
+public:
+    explicit IpcFrameWriter( const quint8 engine_type )
+        : frame( IPC_FRAME_HEADER_SIZE + 3, 0 )
+    {
+        frame[ IPC_FRAME_HEADER_SIZE ] = char( engine_type );
+    }
+
+    quint16 getCommandCount() const { return command_count; }
+    qint32 getSize() const { return frame.size(); }
+
+    // false if the id is out of range or the frame is full of commands
+    bool addCommand( const qint32 id, const quint8 arg_count )
+    {
+        if ( id < 0 || id >= IPC_COMMAND_COUNT || command_count == 0xFFFF )
+            return false;
+
+        appendInt<quint16>( quint16( id ) );
+        frame += char( arg_count );
+        command_count++;
+        return true;
+    }
+
+    void addString( const QString &arg )
+    {
+        const QByteArray utf8 = arg.toUtf8().left( 0xFFFF );
+        frame += char( IPC_ARG_STRING );
+        appendInt<quint16>( quint16( utf8.size() ) );
+        frame += utf8;
+    }
+
+    void addInt( const qint64 arg )
+    {
+        frame += char( IPC_ARG_INT );
+        appendInt<qint64>( arg );
+    }
+
+    void addCoinRaw( const qint64 raw )
+    {
+        frame += char( IPC_ARG_COIN );
+        appendInt<qint64>( raw );
+    }
+
+    // sets the sizes, the frame can't be added to after this
+    QByteArray finish()
+    {
+        qToLittleEndian<quint32>( quint32( frame.size() - IPC_FRAME_HEADER_SIZE ), frame.data() );
+        qToLittleEndian<quint16>( command_count, frame.data() + IPC_FRAME_HEADER_SIZE +1 );
+        return frame;
+    }
+
+private:
+    template <typename T>
+    void appendInt( const T value )
+    {
+        const int offset = frame.size();
+        frame.resize( offset + int( sizeof( T ) ) );
+        qToLittleEndian<T>( value, frame.data() + offset );
+    }
+
+    QByteArray frame;
+    quint16 command_count{ 0 };
+};
+
+#endif // IPCPROTOCOL_H
@@ -0,0 +1,88 @@
+#include "global.h"
+#include "orderjournal.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QTextStream>
+#include <QString>
+#include <QStringList>
+
+#include <cstdio>
+
+// trader-journal: prints order journals as csv, one line for each set, fill and cancel in the order they were written.
+// usage: ./trader-journal <journal file> [<journal file>...]
+//
+// the journals are the orders.<exchange>.journal files in the trader directory. prices, quantities, amounts and fees
+// are exact, times are ms since the epoch. cancel_reason is the CANCELLING_* number.
+
+namespace
+{
+
+QString getTypeName( const quint8 type )
+{
+    return type == ORDER_JOURNAL_SET  ? QString( "set" ) :
+           type == ORDER_JOURNAL_FILL ? QString( "fill" ) :
+                                        QString( "cancel" );
+}
+
+// quote fields that would break the line
+QString csvField( const QString &value )
+{
+    if ( !value.contains( ',' ) && !value.contains( '"' ) && !value.contains( '\n' ) )
+        return value;
+
+    return '"' + QString( value ).replace( '"', "\"\"" ) + '"';
+}
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication a( argc, argv );
+
+    QStringList args = QCoreApplication::arguments();
+    args.removeFirst();
+
+    if ( args.isEmpty() )
+    {
+        kDebug() << "usage: trader-journal <journal file> [<journal file>...]";
+        return 1;
+    }
+
+    QTextStream out( stdout );
+    out << "type,exchange,market,side,time,date,request_time,order_id,strategy_tag,fill_type,cancel_reason,price,quantity,amount,fee\n";
+
+    int ret = 0;
+    for ( QStringList::const_iterator i = args.begin(); i != args.end(); i++ )
+    {
+        OrderJournalReader reader;
+        if ( !reader.open( *i ) )
+        {
+            ret = 1;
+            continue;
+        }
+
+        OrderJournalEvent event;
+        while ( reader.next( event ) )
+        {
+            out << getTypeName( event.type ) << ','
+                << int( event.exchange ) << ','
+                << csvField( event.market ) << ','
+                << ( event.side == SIDE_BUY ? "buy" : "sell" ) << ','
+                << event.time << ','
+                << QDateTime::fromMSecsSinceEpoch( event.time ).toString( Qt::ISODateWithMs ) << ','
+                << event.request_time << ','
+                << csvField( event.order_id ) << ','
+                << csvField( event.strategy_tag ) << ','
+                << csvField( event.fill_type ) << ','
+                << int( event.cancel_reason ) << ','
+                << event.price.toSubSatoshiString() << ','
+                << event.quantity.toSubSatoshiString() << ','
+                << event.amount.toSubSatoshiString() << ','
+                << event.fee.toSubSatoshiString() << '\n';
+        }
+    }
+
+    out.flush();
+    return ret;
+}
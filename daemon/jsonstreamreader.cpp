@@ -0,0 +1,336 @@
+#include "jsonstreamreader.h"
+
+#include <cstring>
+
+JsonStreamReader::JsonStreamReader( const QByteArray &_data )
+    : p( _data.constData() ),
+      end( _data.constData() + _data.size() )
+{
+}
+
+JsonStreamReader::TokenType JsonStreamReader::setError()
+{
+    text_begin = nullptr;
+    text_size = 0;
+    p = end;
+
+    return token = Invalid;
+}
+
+JsonStreamReader::TokenType JsonStreamReader::readNext()
+{
+    // errors and the end are sticky
+    if ( token == Invalid || token == EndDocument )
+        return token;
+
+    // tokens without text don't keep the last one
+    text_begin = p;
+    text_size = 0;
+    text_escaped = false;
+
+    while ( true )
+    {
+        // skip whitespace
+        while ( p < end && ( *p == ' ' || *p == '\n' || *p == '\r' || *p == '\t' ) )
+            p++;
+
+        // the root value is done, only whitespace can follow
+        if ( root_done )
+        {
+            if ( p != end )
+                return setError();
+
+            return token = EndDocument;
+        }
+
+        if ( p == end )
+            return setError();
+
+        const char c = *p;
+        const char container = stack.isEmpty() ? 0 : stack.last();
+
+        // a value ended, expect a separator or the end of the container
+        if ( after_value )
+        {
+            if ( c == ',' )
+            {
+                p++;
+                after_value = false;
+                expect_name = container == '{';
+                continue;
+            }
+            else if ( ( c == '}' && container == '{' ) || ( c == ']' && container == '[' ) )
+            {
+                p++;
+                stack.removeLast();
+                root_done = stack.isEmpty();
+                return token = c == '}' ? EndObject : EndArray;
+            }
+
+            return setError();
+        }
+
+        // expect a name inside an object
+        if ( expect_name )
+        {
+            if ( c == '}' && just_opened )
+            {
+                p++;
+                stack.removeLast();
+                just_opened = expect_name = false;
+                after_value = true;
+                root_done = stack.isEmpty();
+                return token = EndObject;
+            }
+
+            if ( c != '"' || !parseString() )
+                return setError();
+
+            // the name is followed by ':'
+            while ( p < end && ( *p == ' ' || *p == '\n' || *p == '\r' || *p == '\t' ) )
+                p++;
+
+            if ( p == end || *p != ':' )
+                return setError();
+
+            p++;
+            just_opened = expect_name = false;
+            return token = Name;
+        }
+
+        // expect a value
+        if ( c == ']' && container == '[' && just_opened )
+        {
+            p++;
+            stack.removeLast();
+            just_opened = false;
+            after_value = true;
+            root_done = stack.isEmpty();
+            return token = EndArray;
+        }
+
+        just_opened = false;
+
+        if ( c == '{' || c == '[' )
+        {
+            p++;
+            stack.append( c );
+            just_opened = true;
+            expect_name = c == '{';
+            return token = c == '{' ? StartObject : StartArray;
+        }
+
+        // scalars
+        if ( c == '"' )
+        {
+            if ( !parseString() )
+                return setError();
+
+            token = String;
+        }
+        else if ( c == '-' || ( c >= '0' && c <= '9' ) )
+        {
+            if ( !parseNumber() )
+                return setError();
+
+            token = Number;
+        }
+        else if ( c == 't' || c == 'f' )
+        {
+            if ( !parseLiteral( c == 't' ? "true" : "false", c == 't' ? 4 : 5 ) )
+                return setError();
+
+            token = Bool;
+        }
+        else if ( c == 'n' )
+        {
+            if ( !parseLiteral( "null", 4 ) )
+                return setError();
+
+            token = Null;
+        }
+        else
+        {
+            return setError();
+        }
+
+        after_value = true;
+        root_done = stack.isEmpty();
+        return token;
+    }
+}
+
+bool JsonStreamReader::parseString()
+{
+    // p is at the opening quote
+    p++;
+    text_begin = p;
+    text_escaped = false;
+
+    while ( p < end && *p != '"' )
+    {
+        if ( *p == '\\' )
+        {
+            text_escaped = true;
+            p++; // skip the escaped char, \u digits are plain chars
+        }
+
+        p++;
+    }
+
+    if ( p >= end )
+        return false;
+
+    text_size = static_cast<qint32>( p - text_begin );
+    p++; // closing quote
+    return true;
+}
+
+bool JsonStreamReader::parseNumber()
+{
+    text_begin = p;
+    text_escaped = false;
+
+    while ( p < end && ( ( *p >= '0' && *p <= '9' ) || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E' ) )
+        p++;
+
+    text_size = static_cast<qint32>( p - text_begin );
+    return text_size > ( *text_begin == '-' ? 1 : 0 );
+}
+
+bool JsonStreamReader::parseLiteral( const char *literal, const qint32 size )
+{
+    if ( end - p < size || std::memcmp( p, literal, static_cast<size_t>( size ) ) != 0 )
+        return false;
+
+    text_begin = p;
+    text_size = size;
+    text_escaped = false;
+    p += size;
+    return true;
+}
+
+bool JsonStreamReader::readScalar()
+{
+    readNext();
+    return skipCurrentValue();
+}
+
+bool JsonStreamReader::skipValue()
+{
+    const TokenType t = readNext();
+
+    // a name, an end or an error where a value should be
+    if ( t != StartObject && t != StartArray && t != String && t != Number && t != Bool && t != Null )
+        return false;
+
+    return skipCurrentValue();
+}
+
+bool JsonStreamReader::skipCurrentValue()
+{
+    if ( token == StartObject || token == StartArray )
+        return skipToEndOf( depth() );
+
+    return token != Invalid;
+}
+
+bool JsonStreamReader::skipToEndOf( qint32 container_depth )
+{
+    while ( depth() >= container_depth )
+        if ( readNext() == Invalid )
+            return false;
+
+    return true;
+}
+
+bool JsonStreamReader::isText( const char *str ) const
+{
+    if ( token != Name && token != String && token != Number )
+        return false;
+
+    if ( text_escaped )
+        return text() == str;
+
+    const size_t len = std::strlen( str );
+    return len == static_cast<size_t>( text_size ) && std::memcmp( text_begin, str, len ) == 0;
+}
+
+QByteArray JsonStreamReader::text() const
+{
+    if ( token != Name && token != String && token != Number )
+        return QByteArray();
+
+    if ( !text_escaped )
+        return QByteArray( text_begin, text_size );
+
+    QByteArray ret;
+    ret.reserve( text_size );
+
+    const char *s = text_begin, *s_end = text_begin + text_size;
+    while ( s < s_end )
+    {
+        if ( *s != '\\' || s +1 >= s_end )
+        {
+            ret += *s++;
+            continue;
+        }
+
+        s++;
+        const char e = *s++;
+
+        if ( e == 'b' ) ret += '\b';
+        else if ( e == 'f' ) ret += '\f';
+        else if ( e == 'n' ) ret += '\n';
+        else if ( e == 'r' ) ret += '\r';
+        else if ( e == 't' ) ret += '\t';
+        else if ( e == 'u' && s_end - s >= 4 )
+        {
+            // encode the code unit as utf-8, surrogate pairs are combined
+            uint code = QByteArray( s, 4 ).toUInt( nullptr, 16 );
+            s += 4;
+
+            if ( code >= 0xD800 && code < 0xDC00 && s_end - s >= 6 && s[ 0 ] == '\\' && s[ 1 ] == 'u' )
+            {
+                const uint low = QByteArray( s +2, 4 ).toUInt( nullptr, 16 );
+                if ( low >= 0xDC00 && low < 0xE000 )
+                {
+                    code = 0x10000 + ( ( code - 0xD800 ) << 10 ) + ( low - 0xDC00 );
+                    s += 6;
+                }
+            }
+
+            ret += QString::fromUcs4( &code, 1 ).toUtf8();
+        }
+        else ret += e; // '"', '\\', '/'
+    }
+
+    return ret;
+}
+
+Coin JsonStreamReader::toCoin() const
+{
+    if ( token != String && token != Number )
+        return Coin();
+
+    if ( text_escaped )
+        return Coin::fromAscii( text() );
+
+    return Coin::fromAscii( text_begin, static_cast<size_t>( text_size ) );
+}
+
+double JsonStreamReader::toDouble() const
+{
+    if ( token != String && token != Number )
+        return 0.;
+
+    return text_escaped ? text().toDouble() : QByteArray::fromRawData( text_begin, text_size ).toDouble();
+}
+
+quint64 JsonStreamReader::toULongLong() const
+{
+    if ( token != String && token != Number )
+        return 0;
+
+    return text_escaped ? text().toULongLong() : QByteArray::fromRawData( text_begin, text_size ).toULongLong();
+}
@@ -0,0 +1,85 @@
+#ifndef JSONSTREAMREADER_H
+#define JSONSTREAMREADER_H
+
+#include "global.h"
+#include "coinamount.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QVarLengthArray>
+
+//
+// JsonStreamReader, a pull parser over the raw reply bytes (like QXmlStreamReader) so the big replies can be read in
+// one pass without building a QJsonDocument. names and strings without escapes point into the data, the data must
+// outlive the reader
+//
+class JsonStreamReader
+{
+public:
+    enum TokenType
+    {
+        NoToken,
+        Invalid,
+        StartObject,
+        EndObject,
+        StartArray,
+        EndArray,
+        Name,
+        String,
+        Number,
+        Bool,
+        Null,
+        EndDocument
+    };
+
+    explicit JsonStreamReader( const QByteArray &_data );
+
+    TokenType readNext();
+    TokenType tokenType() const { return token; }
+    bool hasError() const { return token == Invalid; }
+    bool atEnd() const { return token == Invalid || token == EndDocument; }
+    qint32 depth() const { return stack.size(); } // open objects and arrays, after the current token
+
+    // reads the value after a name. nested objects/arrays are skipped and leave tokenType() at their end
+    bool readScalar();
+    // reads the whole value that starts with the next token, including nested objects/arrays
+    bool skipValue();
+    // if the current token starts an object/array, reads until its end
+    bool skipCurrentValue();
+    // reads until the end of the object or array at container_depth, returns false on error
+    bool skipToEndOf( qint32 container_depth );
+
+    // the current name, string or number token, empty for other tokens
+    bool isText( const char *str ) const; // compare without allocating
+    QByteArray text() const; // unescaped
+    QString textString() const { return QString::fromUtf8( text() ); }
+
+    // the current number or string token as a value
+    Coin toCoin() const; // exact for decimal strings
+    double toDouble() const;
+    quint64 toULongLong() const;
+    bool toBool() const { return token == Bool && text_size == 4; }
+
+private:
+    bool parseString();
+    bool parseNumber();
+    bool parseLiteral( const char *literal, const qint32 size );
+    TokenType setError();
+
+    const char *p, *end;
+    QVarLengthArray<char, 16> stack; // '{' or '[' for each open container
+    TokenType token{ NoToken };
+
+    // current token text, for strings it's between the quotes
+    const char *text_begin{ nullptr };
+    qint32 text_size{ 0 };
+    bool text_escaped{ false };
+
+    // grammar state
+    bool after_value{ false }; // a value ended, expect ',' or the container end
+    bool expect_name{ false }; // in an object, expect a name or '}' if just_opened
+    bool just_opened{ false }; // after '{' or '[', the container can end
+    bool root_done{ false };
+};
+
+#endif // JSONSTREAMREADER_H
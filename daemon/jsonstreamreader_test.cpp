@@ -0,0 +1,67 @@
+#include "jsonstreamreader_test.h"
+#include "jsonstreamreader.h"
+
+#include <QByteArray>
+
+static bool isValidJson( const QByteArray &data )
+{
+    JsonStreamReader reader( data );
+
+    while ( !reader.atEnd() )
+        reader.readNext();
+
+    return !reader.hasError();
+}
+
+void JsonStreamReaderTest::test()
+{
+    /// test grammar
+    assert( isValidJson( "[]" ) );
+    assert( isValidJson( " { } " ) );
+    assert( isValidJson( "{\"a\":[1,{\"b\":null}],\"c\":true}" ) );
+    assert( !isValidJson( "" ) );
+    assert( !isValidJson( "[1,]" ) );
+    assert( !isValidJson( "[1 2]" ) );
+    assert( !isValidJson( "{\"a\"}" ) );
+    assert( !isValidJson( "[{}" ) ); // truncated reply
+    assert( !isValidJson( "[] x" ) );
+    assert( !isValidJson( "<html>" ) );
+
+    /// test reading an order
+    const QByteArray data( "[{\"symbol\":\"ETHBTC\",\"orderId\":123,\"x\":{\"y\":[1,2]},\"price\":\"0.02100000\",\"s\":\"a\\\"b\\u00e9\"}]" );
+    JsonStreamReader reader( data );
+
+    assert( reader.readNext() == JsonStreamReader::StartArray );
+    assert( reader.readNext() == JsonStreamReader::StartObject );
+    assert( reader.readNext() == JsonStreamReader::Name && reader.isText( "symbol" ) );
+    assert( reader.readScalar() && reader.isText( "ETHBTC" ) );
+    assert( reader.readNext() == JsonStreamReader::Name && reader.isText( "orderId" ) );
+    assert( reader.readScalar() && reader.tokenType() == JsonStreamReader::Number && reader.toULongLong() == 123 );
+
+    // nested values are skipped
+    assert( reader.readNext() == JsonStreamReader::Name && reader.isText( "x" ) );
+    assert( reader.skipValue() && reader.depth() == 2 );
+
+    assert( reader.readNext() == JsonStreamReader::Name && reader.isText( "price" ) );
+    assert( reader.readScalar() && reader.toCoin() == Coin( "0.021" ) );
+
+    // escapes
+    assert( reader.readNext() == JsonStreamReader::Name );
+    assert( reader.readScalar() && reader.text() == QByteArray( "a\"b\xc3\xa9" ) );
+
+    assert( reader.readNext() == JsonStreamReader::EndObject );
+    assert( reader.readNext() == JsonStreamReader::EndArray );
+    assert( reader.readNext() == JsonStreamReader::EndDocument );
+
+    /// test literals
+    const QByteArray literals( "{\"a\":null,\"b\":false,\"c\":true}" );
+    JsonStreamReader literal_reader( literals );
+    literal_reader.readNext();
+
+    literal_reader.readNext();
+    assert( literal_reader.readScalar() && literal_reader.tokenType() == JsonStreamReader::Null && literal_reader.text().isEmpty() );
+    literal_reader.readNext();
+    assert( literal_reader.readScalar() && !literal_reader.toBool() );
+    literal_reader.readNext();
+    assert( literal_reader.readScalar() && literal_reader.toBool() );
+}
@@ -0,0 +1,9 @@
+#ifndef JSONSTREAMREADER_TEST_H
+#define JSONSTREAMREADER_TEST_H
+
+struct JsonStreamReaderTest
+{
+    void test();
+};
+
+#endif // JSONSTREAMREADER_TEST_H
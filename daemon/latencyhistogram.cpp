@@ -0,0 +1,208 @@
+#include "latencyhistogram.h"
+
+#include <QtMath>
+#include <QDateTime>
+
+LatencyHistogram::LatencyHistogram()
+    : counts( BUCKET_COUNT, 0 )
+{
+}
+
+qint32 LatencyHistogram::getBucket( qint64 ms )
+{
+    if ( ms < SUB_BUCKETS )
+        return ms < 0 ? 0 : qint32( ms );
+
+    if ( ms >= ( qint64( 1 ) << MAX_EXPONENT ) )
+        return BUCKET_COUNT -1;
+
+    // find the power of two, then the linear sub-bucket inside it
+    qint32 exponent = 4;
+    while ( ( ms >> ( exponent +1 ) ) > 0 )
+        exponent++;
+
+    const qint32 sub = qint32( ms >> ( exponent -4 ) ) - SUB_BUCKETS;
+    return SUB_BUCKETS * ( exponent -3 ) + sub;
+}
+
+qint64 LatencyHistogram::getBucketValue( qint32 bucket )
+{
+    if ( bucket < SUB_BUCKETS )
+        return bucket;
+
+    const qint32 exponent = bucket / SUB_BUCKETS +3;
+    const qint32 sub = bucket % SUB_BUCKETS;
+    return qint64( SUB_BUCKETS + sub ) << ( exponent -4 );
+}
+
+void LatencyHistogram::add( qint64 ms )
+{
+    counts[ getBucket( ms ) ]++;
+    total++;
+
+    if ( ms > maximum )
+        maximum = ms;
+}
+
+void LatencyHistogram::add( const LatencyHistogram &other )
+{
+    for ( int i = 0; i < BUCKET_COUNT; i++ )
+        counts[ i ] += other.counts.at( i );
+
+    total += other.total;
+    maximum = qMax( maximum, other.maximum );
+}
+
+void LatencyHistogram::clear()
+{
+    counts.fill( 0 );
+    total = 0;
+    maximum = 0;
+}
+
+qint64 LatencyHistogram::getPercentile( qreal p ) const
+{
+    if ( total == 0 )
+        return 0;
+
+    const quint64 target = qMax( quint64( 1 ), quint64( qCeil( p * total ) ) );
+
+    quint64 seen = 0;
+    for ( int i = 0; i < BUCKET_COUNT; i++ )
+    {
+        seen += counts.at( i );
+        if ( seen >= target )
+            return qMin( getBucketValue( i ), maximum );
+    }
+
+    return maximum;
+}
+
+LatencyTracker::LatencyTracker()
+{
+}
+
+void LatencyTracker::add( const QString &name, qint64 ms )
+{
+    histograms[ name ].add( ms );
+}
+
+void LatencyTracker::addSince( const QString &name, qint64 start_time, qint64 end_time )
+{
+    if ( start_time <= 0 || end_time <= 0 || end_time < start_time )
+        return;
+
+    histograms[ name ].add( end_time - start_time );
+}
+
+void LatencyTracker::print( const QString &prefix ) const
+{
+    if ( histograms.isEmpty() )
+    {
+        kDebug() << prefix << "no latency samples yet";
+        return;
+    }
+
+    for ( QMap<QString, LatencyHistogram>::const_iterator i = histograms.begin(); i != histograms.end(); i++ )
+    {
+        const LatencyHistogram &histogram = i.value();
+
+        kDebug() << QString( "%1 %2 n %3 p50 %4 p90 %5 p99 %6 max %7" )
+                    .arg( prefix )
+                    .arg( i.key(), -34 )
+                    .arg( histogram.getCount(), -8 )
+                    .arg( histogram.getPercentile( 0.50 ), -6 )
+                    .arg( histogram.getPercentile( 0.90 ), -6 )
+                    .arg( histogram.getPercentile( 0.99 ), -6 )
+                    .arg( histogram.getMaximum() );
+    }
+}
+
+static const qreal RESPONSE_TIME_EWMA_ALPHA = 0.1; // ~20 replies to forget a spike by 90%
+
+ResponseTimeWindow::ResponseTimeWindow()
+    : slices( SLICES )
+{
+}
+
+void ResponseTimeWindow::expire( qint64 current_time ) const
+{
+    if ( slice_start_time == 0 )
+    {
+        slice_start_time = current_time;
+        return;
+    }
+
+    if ( current_time < slice_start_time + SLICE_TIME )
+        return;
+
+    // advance to the slice for current_time, clearing each one we pass
+    const qint64 steps = ( current_time - slice_start_time ) / SLICE_TIME;
+    for ( qint64 i = 0; i < qMin( steps, qint64( SLICES ) ); i++ )
+    {
+        slice_index = ( slice_index +1 ) % SLICES;
+        slices[ slice_index ].clear();
+    }
+    slice_start_time += steps * SLICE_TIME;
+
+    // rebuild the window from what's left
+    window.clear();
+    for ( QVector<LatencyHistogram>::const_iterator i = slices.begin(); i != slices.end(); i++ )
+        window.add( *i );
+}
+
+void ResponseTimeWindow::add( qint64 ms, qint64 current_time )
+{
+    expire( current_time );
+
+    slices[ slice_index ].add( ms );
+    window.add( ms );
+
+    ewma = ewma == 0. ? qreal( ms ) : ewma + RESPONSE_TIME_EWMA_ALPHA * ( ms - ewma );
+}
+
+quint64 ResponseTimeWindow::getCount( qint64 current_time ) const
+{
+    expire( current_time );
+    return window.getCount();
+}
+
+qint64 ResponseTimeWindow::getPercentile( qreal p, qint64 current_time ) const
+{
+    expire( current_time );
+    return window.getPercentile( p );
+}
+
+ResponseTimes::ResponseTimes()
+{
+}
+
+void ResponseTimes::add( const QString &command_class, qint64 ms )
+{
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+
+    classes[ command_class ].add( ms, current_time );
+    all.add( ms, current_time );
+}
+
+void ResponseTimes::print( const QString &prefix ) const
+{
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+
+    QMap<QString, ResponseTimeWindow> printed = classes;
+    printed.insert( "all", all );
+
+    for ( QMap<QString, ResponseTimeWindow>::const_iterator i = printed.begin(); i != printed.end(); i++ )
+    {
+        const ResponseTimeWindow &times = i.value();
+
+        kDebug() << QString( "%1 %2 ewma %3 | last 60s n %4 p50 %5 p90 %6 p99 %7" )
+                    .arg( prefix )
+                    .arg( i.key(), -34 )
+                    .arg( times.getEwma(), -8, 'f', 0 )
+                    .arg( times.getCount( current_time ), -6 )
+                    .arg( times.getPercentile( 0.50, current_time ), -6 )
+                    .arg( times.getPercentile( 0.90, current_time ), -6 )
+                    .arg( times.getPercentile( 0.99, current_time ) );
+    }
+}
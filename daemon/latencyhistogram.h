@@ -0,0 +1,107 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include "global.h"
+
+#include <QVector>
+#include <QString>
+#include <QMap>
+
+//
+// LatencyHistogram, log-linear buckets of millisecond values (16 per power of two, ~6% resolution) so percentiles
+// stay cheap no matter how many samples we add
+//
+class LatencyHistogram
+{
+public:
+    static const qint32 SUB_BUCKETS = 16;
+    static const qint32 MAX_EXPONENT = 24; // values >= 2^24 ms (~4.6 hours) fall into the last bucket
+    static const qint32 BUCKET_COUNT = SUB_BUCKETS * ( MAX_EXPONENT - 3 );
+
+    explicit LatencyHistogram();
+
+    void add( qint64 ms );
+    void add( const LatencyHistogram &other );
+    void clear();
+
+    quint64 getCount() const { return total; }
+    qint64 getMaximum() const { return maximum; }
+    qint64 getPercentile( qreal p ) const; // p from 0 to 1, returns the lower bound of the bucket
+
+    static qint32 getBucket( qint64 ms );
+    static qint64 getBucketValue( qint32 bucket );
+
+private:
+    QVector<quint32> counts;
+    quint64 total{ 0 };
+    qint64 maximum{ 0 };
+};
+
+//
+// LatencyTracker, a named histogram for each order lifecycle stage
+//
+class LatencyTracker
+{
+public:
+    explicit LatencyTracker();
+
+    void add( const QString &name, qint64 ms );
+    void addSince( const QString &name, qint64 start_time, qint64 end_time ); // skips unset (zero) times
+    void clear() { histograms.clear(); }
+
+    const QMap<QString, LatencyHistogram> &getHistograms() const { return histograms; }
+    void print( const QString &prefix ) const;
+
+private:
+    QMap<QString, LatencyHistogram> histograms;
+};
+
+//
+// ResponseTimeWindow, an ewma plus a histogram over the last minute, kept as six 10s slices that age out, so the
+// percentiles follow the current server lag instead of the whole session
+//
+class ResponseTimeWindow
+{
+public:
+    static const qint32 SLICES = 6;
+    static const qint64 SLICE_TIME = 10000;
+
+    explicit ResponseTimeWindow();
+
+    void add( qint64 ms, qint64 current_time );
+
+    qreal getEwma() const { return ewma; }
+    quint64 getCount( qint64 current_time ) const;
+    qint64 getPercentile( qreal p, qint64 current_time ) const;
+
+private:
+    void expire( qint64 current_time ) const;
+
+    // the slices are aged out lazily from the const getters too
+    mutable QVector<LatencyHistogram> slices;
+    mutable LatencyHistogram window; // sum of the live slices
+    mutable qint64 slice_start_time{ 0 }; // start of the newest slice
+    mutable qint32 slice_index{ 0 }; // newest slice
+    qreal ewma{ 0. };
+};
+
+//
+// ResponseTimes, reply times for each api command class and for all of them together
+//
+class ResponseTimes
+{
+public:
+    explicit ResponseTimes();
+
+    void add( const QString &command_class, qint64 ms );
+
+    const ResponseTimeWindow &getAll() const { return all; }
+    const QMap<QString, ResponseTimeWindow> &getClasses() const { return classes; }
+    void print( const QString &prefix ) const;
+
+private:
+    QMap<QString, ResponseTimeWindow> classes;
+    ResponseTimeWindow all;
+};
+
+#endif // LATENCYHISTOGRAM_H
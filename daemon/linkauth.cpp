@@ -0,0 +1,51 @@
+#include "linkauth.h"
+
+#include <QRandomGenerator>
+
+static const qint32 CHALLENGE_WORDS = 8;
+
+LinkAuth::LinkAuth()
+{
+}
+
+bool LinkAuth::setSecret( const QByteArray &secret )
+{
+    if ( secret.size() < MIN_SECRET_SIZE )
+    {
+        signer.clear();
+        return false;
+    }
+
+    signer.setKey( secret, HmacSigner::Sha256 );
+    return true;
+}
+
+QByteArray LinkAuth::makeChallenge()
+{
+    quint32 words[ CHALLENGE_WORDS ];
+    QRandomGenerator::system()->fillRange( words );
+
+    return QByteArray( reinterpret_cast<const char*>( words ), int( sizeof( words ) ) ).toHex();
+}
+
+QByteArray LinkAuth::answer( const QByteArray &role, const QByteArray &challenge ) const
+{
+    return signer.signHex( role + ' ' + challenge );
+}
+
+bool LinkAuth::check( const QByteArray &role, const QByteArray &challenge, const QByteArray &given ) const
+{
+    if ( !signer.isKeySet() || challenge.isEmpty() )
+        return false;
+
+    const QByteArray expected = answer( role, challenge );
+    if ( given.size() != expected.size() )
+        return false;
+
+    // don't stop at the first difference
+    quint8 diff = 0;
+    for ( int i = 0; i < expected.size(); i++ )
+        diff |= quint8( expected.at( i ) ^ given.at( i ) );
+
+    return diff == 0;
+}
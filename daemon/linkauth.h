@@ -0,0 +1,33 @@
+#ifndef LINKAUTH_H
+#define LINKAUTH_H
+
+#include "global.h"
+#include "hmacsigner.h"
+
+#include <QByteArray>
+
+//
+// LinkAuth, the shared secret handshake of the links between our daemons. each side sends the other a random
+// challenge when they connect, and answers the one it got with the hmac-sha256 of its role and that challenge, so the
+// secret doesn't go over the wire and an old answer doesn't work again. the role keeps one side's answer from passing
+// as the other's
+//
+class LinkAuth
+{
+public:
+    static const qint32 MIN_SECRET_SIZE = 16;
+
+    explicit LinkAuth();
+
+    bool setSecret( const QByteArray &secret ); // false if it's shorter than MIN_SECRET_SIZE
+    bool isSecretSet() const { return signer.isKeySet(); }
+
+    static QByteArray makeChallenge(); // hex of 32 random bytes
+    QByteArray answer( const QByteArray &role, const QByteArray &challenge ) const;
+    bool check( const QByteArray &role, const QByteArray &challenge, const QByteArray &given ) const; // in constant time
+
+private:
+    HmacSigner signer;
+};
+
+#endif // LINKAUTH_H
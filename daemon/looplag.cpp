@@ -0,0 +1,174 @@
+#include "looplag.h"
+
+#include <QTimer>
+#include <QMutexLocker>
+
+#include <thread>
+#include <chrono>
+
+namespace
+{
+
+struct Watchdog
+{
+    QMutex lock; // the probe list
+    QVector<LoopProbe*> probes;
+    std::thread thread;
+    std::atomic<bool> is_running{ false };
+    qint64 threshold_ms{ 0 };
+};
+
+Watchdog &getWatchdog()
+{
+    // never deleted, probes can outlive main()
+    static Watchdog *watchdog = new Watchdog();
+    return *watchdog;
+}
+
+} // namespace
+
+LoopProbe::LoopProbe( const QString &_name, QObject *parent )
+    : QObject( parent ),
+      name( _name )
+{
+    timer = new QTimer( this );
+    timer->setTimerType( Qt::PreciseTimer );
+    timer->setInterval( PROBE_INTERVAL );
+    connect( timer, &QTimer::timeout, this, &LoopProbe::onTick );
+
+    LoopWatchdog::addProbe( this );
+}
+
+LoopProbe::~LoopProbe()
+{
+    LoopWatchdog::removeProbe( this );
+
+    if ( TraceRing::getThreadStages() == &stages )
+        TraceRing::setThreadStages( nullptr );
+}
+
+void LoopProbe::start()
+{
+    stages.depth.store( 0, std::memory_order_relaxed );
+    TraceRing::setThreadStages( &stages );
+    last_tick_ns.store( TraceRing::now(), std::memory_order_relaxed );
+    timer->start();
+}
+
+void LoopProbe::stop()
+{
+    timer->stop();
+    last_tick_ns.store( -1, std::memory_order_relaxed );
+
+    if ( TraceRing::getThreadStages() == &stages )
+        TraceRing::setThreadStages( nullptr );
+}
+
+LatencyHistogram LoopProbe::getLagHistogram() const
+{
+    QMutexLocker locker( &lag_lock );
+    return lag_histogram;
+}
+
+qint64 LoopProbe::getStallTime( const qint64 current_ns ) const
+{
+    const qint64 last_ns = last_tick_ns.load( std::memory_order_relaxed );
+    if ( last_ns < 0 )
+        return 0;
+
+    // the tick is due an interval after the last one, it's stalled for whatever is past that
+    return qMax( qint64( 0 ), ( current_ns - last_ns ) / 1000000 - PROBE_INTERVAL );
+}
+
+void LoopProbe::checkStall( const qint64 current_ns, const qint64 threshold_ms )
+{
+    const qint64 stall_time = getStallTime( current_ns );
+    if ( stall_time < threshold_ms || is_stalled.exchange( true, std::memory_order_relaxed ) )
+        return;
+
+    stall_count.fetch_add( 1, std::memory_order_relaxed );
+    kDebug() << "local warning: loop" << name << "stalled for" << stall_time << "ms in" << getStages();
+}
+
+void LoopProbe::addLag( const qint64 lag_us )
+{
+    QMutexLocker locker( &lag_lock );
+    lag_histogram.add( lag_us );
+}
+
+void LoopProbe::onTick()
+{
+    const qint64 current_ns = TraceRing::now();
+    const qint64 last_ns = last_tick_ns.exchange( current_ns, std::memory_order_relaxed );
+    if ( last_ns < 0 )
+        return;
+
+    const qint64 lag_us = qMax( qint64( 0 ), ( current_ns - last_ns ) / 1000 - PROBE_INTERVAL * 1000 );
+    addLag( lag_us );
+
+    if ( is_stalled.exchange( false, std::memory_order_relaxed ) )
+        kDebug() << "local warning: loop" << name << "ran again after" << lag_us / 1000 << "ms";
+}
+
+void LoopWatchdog::start( const qint64 threshold_ms )
+{
+    Watchdog &watchdog = getWatchdog();
+    if ( watchdog.is_running.exchange( true, std::memory_order_acq_rel ) )
+        return;
+
+    watchdog.threshold_ms = threshold_ms;
+    watchdog.thread = std::thread( []()
+    {
+        Watchdog &watchdog = getWatchdog();
+        while ( watchdog.is_running.load( std::memory_order_acquire ) )
+        {
+            std::this_thread::sleep_for( std::chrono::milliseconds( WATCHDOG_INTERVAL ) );
+            check( TraceRing::now() );
+        }
+    } );
+}
+
+void LoopWatchdog::stop()
+{
+    Watchdog &watchdog = getWatchdog();
+    if ( !watchdog.is_running.exchange( false, std::memory_order_acq_rel ) )
+        return;
+
+    if ( watchdog.thread.joinable() )
+        watchdog.thread.join();
+}
+
+bool LoopWatchdog::isRunning()
+{
+    return getWatchdog().is_running.load( std::memory_order_acquire );
+}
+
+void LoopWatchdog::check( const qint64 current_ns )
+{
+    Watchdog &watchdog = getWatchdog();
+    QMutexLocker locker( &watchdog.lock );
+
+    for ( QVector<LoopProbe*>::const_iterator i = watchdog.probes.constBegin(); i != watchdog.probes.constEnd(); i++ )
+        (*i)->checkStall( current_ns, watchdog.threshold_ms );
+}
+
+QVector<LoopProbe*> LoopWatchdog::getProbes()
+{
+    Watchdog &watchdog = getWatchdog();
+    QMutexLocker locker( &watchdog.lock );
+    return watchdog.probes;
+}
+
+void LoopWatchdog::addProbe( LoopProbe *probe )
+{
+    Watchdog &watchdog = getWatchdog();
+    QMutexLocker locker( &watchdog.lock );
+    watchdog.probes += probe;
+}
+
+void LoopWatchdog::removeProbe( LoopProbe *probe )
+{
+    Watchdog &watchdog = getWatchdog();
+    QMutexLocker locker( &watchdog.lock );
+    watchdog.probes.removeAll( probe );
+}
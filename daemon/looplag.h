@@ -0,0 +1,82 @@
+#ifndef LOOPLAG_H
+#define LOOPLAG_H
+
+#include "global.h"
+#include "latencyhistogram.h"
+#include "tracespan.h"
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QMutex>
+
+#include <atomic>
+
+class QTimer;
+
+//
+// LoopProbe, how late the event loop of the thread it lives on runs things. a precise timer ticks every PROBE_INTERVAL
+// and the lag is how much later than that the tick ran, in microseconds. the thread also keeps the stack of stages it's
+// in (the TRACE_SPAN names), so the watchdog can say what a stalled loop is busy with
+//
+class LoopProbe : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const qint32 PROBE_INTERVAL = 100; // ms
+
+    explicit LoopProbe( const QString &_name, QObject *parent = nullptr );
+    ~LoopProbe();
+
+    void start(); // on the thread to measure, it becomes that thread's probe
+    void stop();
+
+    // these are read from any thread
+    const QString &getName() const { return name; }
+    LatencyHistogram getLagHistogram() const; // us
+    quint64 getStallCount() const { return stall_count.load( std::memory_order_relaxed ); }
+    qint64 getStallTime( const qint64 current_ns ) const; // ms since the loop last ran the probe, 0 if it isn't running
+    QString getStages() const { return stages.toString(); }
+    void checkStall( const qint64 current_ns, const qint64 threshold_ms ); // the watchdog's look, logs a new stall
+
+    // for tests, what a tick that ran lag_us late adds
+    void addLag( const qint64 lag_us );
+
+private:
+    void onTick();
+
+    QString name;
+    QTimer *timer{ nullptr };
+
+    mutable QMutex lag_lock;
+    LatencyHistogram lag_histogram;
+
+    std::atomic<qint64> last_tick_ns{ -1 }; // -1 while stopped
+    std::atomic<bool> is_stalled{ false }; // the watchdog logged it, the next tick logs the recovery
+    std::atomic<quint64> stall_count{ 0 };
+
+    StageStack stages; // the thread's, once it's started
+};
+
+//
+// LoopWatchdog, a thread of its own that looks at every probe each WATCHDOG_INTERVAL and logs the loops that haven't
+// ticked for longer than the threshold, with the stage they're stuck in. the probes register themselves
+//
+namespace LoopWatchdog
+{
+    static const qint32 WATCHDOG_INTERVAL = 50; // ms
+
+    void start( const qint64 threshold_ms );
+    void stop();
+    bool isRunning();
+
+    void check( const qint64 current_ns ); // one look at the probes, the thread calls it
+    QVector<LoopProbe*> getProbes();
+
+    // only for LoopProbe
+    void addProbe( LoopProbe *probe );
+    void removeProbe( LoopProbe *probe );
+}
+
+#endif // LOOPLAG_H
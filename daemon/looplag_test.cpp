@@ -0,0 +1,63 @@
+#include "looplag_test.h"
+#include "looplag.h"
+#include "tracespan.h"
+
+#include <assert.h>
+
+void LoopLagTest::test()
+{
+    LoopProbe *probe = new LoopProbe( "test" );
+    assert( LoopWatchdog::getProbes().contains( probe ) );
+
+    /// test the stages, spans only name them on a thread with a started probe
+    {
+        TRACE_SPAN( "before" );
+        assert( probe->getStages() == "idle" );
+    }
+
+    probe->start();
+    assert( TraceRing::getThreadStages() != nullptr );
+    {
+        TRACE_SPAN( "outer" );
+        {
+            TRACE_SPAN( "inner" );
+            assert( probe->getStages() == "outer > inner" );
+        }
+        assert( probe->getStages() == "outer" );
+    }
+    assert( probe->getStages() == "idle" );
+
+    // deeper than it names
+    StageStack stack;
+    for ( qint32 i = 0; i < StageStack::MAX_DEPTH +2; i++ )
+        stack.push( "x" );
+    assert( stack.toString().endsWith( "x > (2 more)" ) );
+    for ( qint32 i = 0; i < StageStack::MAX_DEPTH +3; i++ )
+        stack.pop();
+    assert( stack.toString() == "idle" && stack.depth == 0 );
+
+    /// test the lag histogram
+    probe->addLag( 0 );
+    probe->addLag( 250 );
+    probe->addLag( 40000 );
+    const LatencyHistogram lag = probe->getLagHistogram();
+    assert( lag.getCount() == 3 && lag.getMaximum() == 40000 );
+    assert( lag.getPercentile( 0.5 ) <= 250 && lag.getPercentile( 0.5 ) > 200 );
+
+    /// test stalls, one is counted once however long it lasts
+    const qint64 now_ns = TraceRing::now();
+    assert( probe->getStallTime( now_ns ) == 0 );
+    probe->checkStall( now_ns + 1000 * 1000000LL, 500 );
+    assert( probe->getStallCount() == 1 );
+    probe->checkStall( now_ns + 2000 * 1000000LL, 500 );
+    assert( probe->getStallCount() == 1 );
+    assert( probe->getStallTime( now_ns + 1000 * 1000000LL ) >= 1000 - LoopProbe::PROBE_INTERVAL - 1 );
+
+    // stopped probes don't stall, and the thread's spans stop naming stages
+    probe->stop();
+    assert( probe->getStallTime( now_ns + 1000 * 1000000LL ) == 0 );
+    assert( TraceRing::getThreadStages() == nullptr );
+
+    delete probe;
+    assert( !LoopWatchdog::getProbes().contains( probe ) );
+}
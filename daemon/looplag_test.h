@@ -0,0 +1,9 @@
+#ifndef LOOPLAG_TEST_H
+#define LOOPLAG_TEST_H
+
+struct LoopLagTest
+{
+    void test();
+};
+
+#endif // LOOPLAG_TEST_H
@@ -1,13 +1,18 @@
 #include "global.h"
 #include "trader.h"
+#include "asynclog.h"
+#include "memorystats.h"
 
 #include <QCoreApplication>
 #include <QString>
 
 int main( qint32 argc, char *argv[] )
 {
+    // count bignum allocations for getmemory, before any coin is promoted
+    MemoryStats::installGmpHooks();
+
     // set message handler
-    qInstallMessageHandler( Global::messageOutput );
+    qInstallMessageHandler( AsyncLog::messageOutput );
 
     // start qapp
     QCoreApplication a( argc, argv );
@@ -19,5 +24,8 @@ int main( qint32 argc, char *argv[] )
 
     kDebug() << QString( "main() done, code %1.").arg( ret );
 
+    // write out the rest of the log
+    AsyncLog::stop();
+
     return ret;
 }
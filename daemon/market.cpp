@@ -1,4 +1,13 @@
 #include "market.h"
+#include "memorystats.h"
+
+#include <QHash>
+#include <QReadWriteLock>
+
+// global market registry, markets are constructed from the spruce worker threads too
+static QReadWriteLock market_registry_lock;
+static QHash<QString,qint32> market_registry_ids;
+static QVector<QString> market_registry_strings;
 
 Market::Market()
 {
@@ -17,12 +26,62 @@ Market::Market( const QString &market )
 
     base = market.left( sep_idx );
     quote = market.mid( sep_idx +1, market.size() - sep_idx -1 );
+
+    intern();
 }
 
 Market::Market( const QString &_base, const QString &_quote )
   : base( _base ),
     quote( _quote )
 {
+    intern();
+}
+
+void Market::intern()
+{
+    if ( !isValid() )
+        return;
+
+    universal = QString( DEFAULT_MARKET_STRING_TEMPLATE )
+                .arg( base )
+                .arg( quote );
+
+    // look for an existing id first
+    {
+        QReadLocker locker( &market_registry_lock );
+        const QHash<QString,qint32>::const_iterator i = market_registry_ids.find( universal );
+        if ( i != market_registry_ids.end() )
+        {
+            id = i.value();
+            return;
+        }
+    }
+
+    QWriteLocker locker( &market_registry_lock );
+
+    // check again, another thread might have registered it while we were unlocked
+    const QHash<QString,qint32>::const_iterator i = market_registry_ids.find( universal );
+    if ( i != market_registry_ids.end() )
+    {
+        id = i.value();
+        return;
+    }
+
+    id = market_registry_strings.size();
+    market_registry_ids.insert( universal, id );
+    market_registry_strings += universal;
+}
+
+qint32 Market::getMarketId( const QString &market )
+{
+    QReadLocker locker( &market_registry_lock );
+    return market_registry_ids.value( market, -1 );
+}
+
+QString Market::getMarketString( const qint32 id )
+{
+    QReadLocker locker( &market_registry_lock );
+    return ( id < 0 || id >= market_registry_strings.size() ) ? QString() : market_registry_strings.at( id );
 }
 
 bool Market::isValid() const
@@ -32,7 +91,7 @@ bool Market::isValid() const
 
 bool Market::operator ==( const QString &other ) const
 {
-    return operator QString() == other;
+    return universal == other;
 }
 
 bool Market::operator !=( const QString &other ) const
@@ -40,14 +99,6 @@ bool Market::operator !=( const QString &other ) const
     return !operator ==( other );
 }
 
-Market::operator QString() const
-{
-    return !isValid() ? QString() :
-            QString( DEFAULT_MARKET_STRING_TEMPLATE )
-            .arg( base )
-            .arg( quote );
-}
-
 QString Market::toExchangeString( const quint8 engine_type ) const
 {
     return QString( engine_type == ENGINE_BITTREX  ? BITTREX_MARKET_STRING_TEMPLATE :
@@ -57,3 +108,68 @@ QString Market::toExchangeString( const quint8 engine_type ) const
             .arg( base )
             .arg( quote );
 }
+
+MarketInfoTable::~MarketInfoTable()
+{
+    clear();
+}
+
+void MarketInfoTable::clear()
+{
+    // every entry goes at once, so no inverse pointer is left behind
+    for ( QVector<qint32>::const_iterator i = order.begin(); i != order.end(); i++ )
+        delete by_id.at( *i );
+
+    by_id.clear();
+    order.clear();
+    names.clear();
+    invalid = MarketInfo();
+}
+
+MarketInfo &MarketInfoTable::operator []( const QString &market )
+{
+    // registered strings skip the parse, others like "BTC-DOGE" are normalized and registered
+    const qint32 market_id = Market::getMarketId( market );
+    if ( market_id >= 0 )
+        return get( market_id );
+
+    return get( Market( market ).getId() );
+}
+
+const MarketInfo *MarketInfoTable::find( const QString &market ) const
+{
+    const qint32 market_id = Market::getMarketId( market );
+    return findId( market_id >= 0 ? market_id : Market( market ).getId() );
+}
+
+MarketInfo MarketInfoTable::value( const QString &market ) const
+{
+    const MarketInfo *info = find( market );
+    return info ? *info : MarketInfo();
+}
+
+qint64 MarketInfoTable::getBytes() const
+{
+    // the slot vectors and the entries, not the name strings or what the entries hold
+    return MemoryStats::getBytes( by_id ) + MemoryStats::getBytes( order ) + MemoryStats::getBytes( names ) +
+           order.size() * qint64( sizeof( MarketInfo ) );
+}
+
+MarketInfo &MarketInfoTable::get( const qint32 market_id )
+{
+    if ( market_id < 0 )
+        return invalid;
+
+    if ( market_id >= by_id.size() )
+        by_id.resize( market_id +1 );
+
+    MarketInfo *&info = by_id[ market_id ];
+    if ( info == nullptr )
+    {
+        info = new MarketInfo();
+        order += market_id;
+        names += Market::getMarketString( market_id );
+    }
+
+    return *info;
+}
@@ -2,12 +2,17 @@
 #define MARKET_H
 
 #include "global.h"
-#include "positiondata.h"
+#include "positiongrid.h"
 #include "coinamount.h"
 #include "misctypes.h"
+#include "orderbook.h"
+#include "tickerhistory.h"
 
 #include <QVector>
+#include <QList>
 #include <QString>
+#include <QHash>
+#include <QMap>
 #include <QJsonArray>
 
 class Market
@@ -18,18 +23,29 @@ public:
     Market( const QString &_base, const QString &_quote );
     bool isValid() const;
 
+    bool operator ==( const Market &other ) const { return id == other.id; }
+    bool operator !=( const Market &other ) const { return id != other.id; }
     bool operator ==( const QString &other ) const;
     bool operator !=( const QString &other ) const;
-    operator QString() const; // obtain universal string
+    operator QString() const { return universal; } // obtain universal string
     QString toExchangeString( const quint8 engine_type ) const; // obtain exchange-specific string
 
     const QString &getBase() const { return base; }
     const QString &getQuote() const { return quote; }
+    qint32 getId() const { return id; }
 
     Market getInverse() const { return Market( getQuote(), getBase() ); }
 
+    // global market registry, every valid market gets a compact id
+    static qint32 getMarketId( const QString &market ); // returns -1 if the market was never registered
+    static QString getMarketString( const qint32 id );
+
 private:
+    void intern();
+
     QString base, quote;
+    QString universal; // cached universal string
+    qint32 id{ -1 }; // registry id, -1 if invalid
 };
 
 struct MarketInfo
@@ -75,37 +91,175 @@ struct MarketInfo
         arr += ticker.ask.toAmountString();
     }
 
-    // prices for this market
-    QVector<QString> order_prices;
+    // hot data, read for every ticker, fill and timeout check. keep it together at the front
 
     // internal ticker
     TickerInfo ticker;
 
-    // ping-pong settings
-    QVector<PositionData> /*position_index*/ position_index;
-    qint32 /*order count limit*/ order_min{ 5 };
-    qint32 /*order count limit*/ order_max{ 10 };
-    qint32 /*order count combine*/ order_dc{ 1 };
-    qint32 /*nice value*/ order_dc_nice{ 0 };
-    qint32 /*n*/ order_landmark_thresh{ 0 };
-    qint32 /*n*/ order_landmark_start{ 0 };
-    qint32 /*timeout secs*/ slippage_timeout{ 2 * 60000 };
-    qreal /*offset scalar*/ market_offset{ 0. };
+    // the inverse market's info, set the first time we get a ticker for either side. MarketInfoTable entries are
+    // never removed or moved, so the pointer stays valid. its is_tradeable says if it has a native ticker
+    MarketInfo *inverse{ nullptr };
+
+    // inverse market tags
+    bool is_tradeable{ false };
     bool /*bullish*/ market_sentiment{ false };
+    qint32 /*timeout secs*/ slippage_timeout{ 2 * 60000 };
+    qint32 /*order count combine*/ order_dc{ 1 };
 
     // per-market settings
     Coin price_ticksize{ CoinAmount::SATOSHI }; // used to find new prices and pass binance filter PRICE_FILTER "tickSize"
+    Coin quantity_ticksize{ CoinAmount::SATOSHI }; // used to pass filter LOT_SIZE "stepSize"
 
     // Binance only - used to pass filter PERCENT_PRICE
     Coin price_min_mul{ 0.2 };
     Coin price_max_mul{ 5.0 };
-    Coin quantity_ticksize{ CoinAmount::SATOSHI }; // used to pass filter LOT_SIZE "stepSize"
+    Coin min_notional; // filter NOTIONAL "minNotional", 0 if we don't know it
 
     // waves exchange
     Coin matcher_ticksize{ CoinAmount::SATOSHI };
 
-    // inverse market tags
-    bool is_tradeable{ false };
+    // cold data, grid settings and history
+
+    // ping-pong settings
+    PositionGrid /*position_index*/ position_index;
+    qint32 /*order count limit*/ order_min{ 5 };
+    qint32 /*order count limit*/ order_max{ 10 };
+    qint32 /*nice value*/ order_dc_nice{ 0 };
+    qint32 /*n*/ order_landmark_thresh{ 0 };
+    qint32 /*n*/ order_landmark_start{ 0 };
+    qreal /*offset scalar*/ market_offset{ 0. };
+
+    // recent activity, see Engine::getMarketPollWeight()
+    qint64 last_fill_time{ 0 };
+    qint64 last_ticker_change_time{ 0 };
+
+    // prices of our positions in this market as satoshi ticks, with the number of positions at each. they're also
+    // sorted by side, so a post-only reprice finds our nearest order on the other side without a reject from the exchange
+    QHash<qint64, qint32> order_prices;
+    QMap<qint64, qint32> own_bid_ticks;
+    QMap<qint64, qint32> own_ask_ticks;
+
+    static qint64 getPriceTick( const Coin &price ) { return OrderBook::getTick( price ); }
+    void addOrderPrice( const Coin &price, const quint8 side )
+    {
+        const qint64 tick = getPriceTick( price );
+        order_prices[ tick ]++;
+        ( side == SIDE_BUY ? own_bid_ticks : own_ask_ticks )[ tick ]++;
+    }
+    void removeOrderPrice( const Coin &price, const quint8 side )
+    {
+        const qint64 tick = getPriceTick( price );
+
+        QHash<qint64, qint32>::iterator i = order_prices.find( tick );
+        if ( i != order_prices.end() && --i.value() <= 0 )
+            order_prices.erase( i );
+
+        QMap<qint64, qint32> &own_ticks = side == SIDE_BUY ? own_bid_ticks : own_ask_ticks;
+        QMap<qint64, qint32>::iterator j = own_ticks.find( tick );
+        if ( j != own_ticks.end() && --j.value() <= 0 )
+            own_ticks.erase( j );
+    }
+    void clearOrderPrices()
+    {
+        order_prices.clear();
+        own_bid_ticks.clear();
+        own_ask_ticks.clear();
+    }
+    bool hasOrderPrice( const Coin &price ) const { return order_prices.contains( getPriceTick( price ) ); }
+    Coin getHighestOwnBid() const { return own_bid_ticks.isEmpty() ? Coin() : OrderBook::getPrice( own_bid_ticks.lastKey() ); } // zero without one
+    Coin getLowestOwnAsk() const { return own_ask_ticks.isEmpty() ? Coin() : OrderBook::getPrice( own_ask_ticks.firstKey() ); }
+
+    // recent tickers, sampled every TICKER_HISTORY_INTERVAL
+    TickerHistory ticker_history;
+
+    // price levels, where the exchange gives us more than the ticker
+    OrderBook order_book;
+};
+
+//
+// MarketInfoTable, an engine's MarketInfo for each market, indexed by the market's registry id so a lookup from a
+// position is a bounds check and a load instead of a string hash. each entry is allocated once and never moves, like
+// the QHash it replaces, and iterates in the order the markets were added. looking up a market that isn't there adds
+// it, except for invalid markets which all share one scratch entry that isn't iterated
+//
+class MarketInfoTable
+{
+public:
+    MarketInfoTable() {}
+    ~MarketInfoTable();
+
+    MarketInfo &operator []( const Market &market ) { return get( market.getId() ); }
+    MarketInfo &operator []( const QString &market );
+    MarketInfo &getById( const qint32 market_id ) { return get( market_id ); } // for the ids a parser already has
+    const MarketInfo *find( const Market &market ) const { return findId( market.getId() ); }
+    const MarketInfo *find( const QString &market ) const;
+    bool contains( const Market &market ) const { return find( market ) != nullptr; }
+    bool contains( const QString &market ) const { return find( market ) != nullptr; }
+    MarketInfo value( const QString &market ) const; // a copy, or a default MarketInfo
+
+    int size() const { return order.size(); }
+    void clear();
+    QList<QString> keys() const { return names.toList(); }
+    qint64 getBytes() const; // the table itself, for getmemory
+
+    class iterator
+    {
+    public:
+        iterator( MarketInfoTable *_table, int _pos ) : table( _table ), pos( _pos ) {}
+        const QString &key() const { return table->names.at( pos ); }
+        MarketInfo &value() const { return *table->by_id.at( table->order.at( pos ) ); }
+        MarketInfo &operator *() const { return value(); }
+        MarketInfo *operator ->() const { return &value(); }
+        iterator &operator ++() { pos++; return *this; }
+        iterator operator ++( int ) { iterator ret = *this; pos++; return ret; }
+        bool operator ==( const iterator &other ) const { return pos == other.pos && table == other.table; }
+        bool operator !=( const iterator &other ) const { return !operator ==( other ); }
+
+    private:
+        friend class const_iterator;
+        MarketInfoTable *table;
+        int pos;
+    };
+
+    class const_iterator
+    {
+    public:
+        const_iterator( const MarketInfoTable *_table, int _pos ) : table( _table ), pos( _pos ) {}
+        const_iterator( const iterator &i ) : table( i.table ), pos( i.pos ) {}
+        const QString &key() const { return table->names.at( pos ); }
+        const MarketInfo &value() const { return *table->by_id.at( table->order.at( pos ) ); }
+        const MarketInfo &operator *() const { return value(); }
+        const MarketInfo *operator ->() const { return &value(); }
+        const_iterator &operator ++() { pos++; return *this; }
+        const_iterator operator ++( int ) { const_iterator ret = *this; pos++; return ret; }
+        bool operator ==( const const_iterator &other ) const { return pos == other.pos && table == other.table; }
+        bool operator !=( const const_iterator &other ) const { return !operator ==( other ); }
+
+    private:
+        const MarketInfoTable *table;
+        int pos;
+    };
+
+    iterator begin() { return iterator( this, 0 ); }
+    iterator end() { return iterator( this, order.size() ); }
+    const_iterator begin() const { return const_iterator( this, 0 ); }
+    const_iterator end() const { return const_iterator( this, order.size() ); }
+    const_iterator constBegin() const { return begin(); }
+    const_iterator constEnd() const { return end(); }
+
+private:
+    Q_DISABLE_COPY( MarketInfoTable )
+
+    MarketInfo &get( const qint32 market_id );
+    const MarketInfo *findId( const qint32 market_id ) const
+    {
+        return ( market_id < 0 || market_id >= by_id.size() ) ? nullptr : by_id.at( market_id );
+    }
+
+    QVector<MarketInfo*> by_id; // nullptr for markets this engine doesn't have
+    QVector<qint32> order; // market ids in the order they were added
+    QVector<QString> names; // universal market strings, same order
+    MarketInfo invalid; // shared by lookups of invalid markets
 };
 
 #endif // MARKET_H
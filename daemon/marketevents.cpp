@@ -0,0 +1,86 @@
+#include "marketevents.h"
+#include "market.h"
+#include "bbocache.h"
+
+#include <QMutexLocker>
+
+MarketEventQueue::MarketEventQueue( const quint8 _engine_type )
+    : engine_type( _engine_type )
+{
+}
+
+bool MarketEventQueue::push( MarketEvent &event )
+{
+    pushed_count.fetch_add( 1, std::memory_order_relaxed );
+
+    if ( is_overflowing.load( std::memory_order_acquire ) || !queue.push( event ) )
+    {
+        QMutexLocker locker( &overflow_lock );
+
+        // the overseer took the overflow while we waited for the lock, the ring is usable again
+        if ( is_overflowing.load( std::memory_order_relaxed ) || !queue.push( event ) )
+        {
+            overflow.insert( event.market_id, event );
+            is_overflowing.store( true, std::memory_order_release );
+            overflow_count.fetch_add( 1, std::memory_order_relaxed );
+        }
+    }
+
+    return !is_wake_pending.exchange( true, std::memory_order_acq_rel );
+}
+
+qint32 MarketEventQueue::drain( BboCache &bbo )
+{
+    // clear it first, an event pushed after this point wakes us again
+    is_wake_pending.store( false, std::memory_order_release );
+
+    qint32 count = 0;
+    MarketEvent event;
+
+    while ( queue.pop( event ) )
+    {
+        apply( bbo, event );
+        count++;
+    }
+
+    if ( is_overflowing.load( std::memory_order_acquire ) )
+    {
+        QHash<qint32, MarketEvent> taken;
+        {
+            QMutexLocker locker( &overflow_lock );
+
+            // what's left in the ring was pushed before the overflow, apply it before the newer events
+            while ( queue.pop( event ) )
+            {
+                apply( bbo, event );
+                count++;
+            }
+
+            taken.swap( overflow );
+            is_overflowing.store( false, std::memory_order_release );
+        }
+
+        for ( QHash<qint32, MarketEvent>::const_iterator i = taken.begin(); i != taken.end(); i++ )
+            apply( bbo, i.value() );
+
+        count += taken.size();
+    }
+
+    if ( count > 0 )
+    {
+        batch_count.fetch_add( 1, std::memory_order_relaxed );
+
+        if ( quint64( count ) > max_batch.load( std::memory_order_relaxed ) )
+            max_batch.store( quint64( count ), std::memory_order_relaxed );
+    }
+
+    return count;
+}
+
+void MarketEventQueue::apply( BboCache &bbo, const MarketEvent &event ) const
+{
+    if ( event.type == MarketEvent::TICKER )
+        bbo.update( engine_type, Market::getMarketString( event.market_id ), event.ticker, event.time );
+    else
+        bbo.setStale( engine_type, event.type == MarketEvent::STALE );
+}
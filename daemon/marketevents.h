@@ -0,0 +1,71 @@
+#ifndef MARKETEVENTS_H
+#define MARKETEVENTS_H
+
+#include "global.h"
+#include "misctypes.h"
+#include "spscqueue.h"
+
+#include <QHash>
+#include <QMutex>
+
+#include <atomic>
+
+class BboCache;
+
+// one change to an exchange's prices, the ticker leaves the coins unpromoted so it's copied without allocating
+struct MarketEvent
+{
+    enum Type : quint8
+    {
+        TICKER = 0,
+        STALE, // the exchange's tickers stopped
+        FRESH // and came back
+    };
+
+    TickerInfo ticker;
+    qint64 time{ 0 };
+    qint32 market_id{ -1 }; // Market registry id, -1 for the exchange wide ones
+    quint8 type{ TICKER };
+};
+
+//
+// MarketEventQueue, carries an engine's price changes to the SpruceOverseer thread without a queued signal for each
+// one. the engine pushes into a lock-free ring and wakes the overseer once, the overseer drains all of it into the
+// BboCache in one pass. if the ring fills up, the latest event of each market waits in an overflow map instead and
+// the ring is skipped until the overseer takes the map, so the cache always sees the changes in order
+//
+class MarketEventQueue
+{
+public:
+    static const qint32 SIZE = 4096;
+
+    explicit MarketEventQueue( const quint8 _engine_type );
+
+    bool push( MarketEvent &event ); // the engine's, true if the overseer has to be woken for it
+    qint32 drain( BboCache &bbo ); // the overseer's, applies what's waiting and returns how many
+
+    // backpressure, for the metrics scrape
+    qint32 getDepth() const { return queue.size(); }
+    quint64 getPushedCount() const { return pushed_count.load( std::memory_order_relaxed ); }
+    quint64 getOverflowCount() const { return overflow_count.load( std::memory_order_relaxed ); } // went to the overflow map
+    quint64 getBatchCount() const { return batch_count.load( std::memory_order_relaxed ); }
+    quint64 getMaxBatch() const { return max_batch.load( std::memory_order_relaxed ); }
+
+private:
+    void apply( BboCache &bbo, const MarketEvent &event ) const;
+
+    quint8 engine_type;
+    SpscQueue<MarketEvent, SIZE> queue;
+    std::atomic<bool> is_wake_pending{ false };
+
+    QMutex overflow_lock; // guards overflow, and the ring while it's taken
+    QHash<qint32/*market id*/, MarketEvent> overflow;
+    std::atomic<bool> is_overflowing{ false };
+
+    std::atomic<quint64> pushed_count{ 0 };
+    std::atomic<quint64> overflow_count{ 0 };
+    std::atomic<quint64> batch_count{ 0 };
+    std::atomic<quint64> max_batch{ 0 };
+};
+
+#endif // MARKETEVENTS_H
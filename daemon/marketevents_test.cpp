@@ -0,0 +1,60 @@
+#include "marketevents_test.h"
+#include "marketevents.h"
+#include "bbocache.h"
+#include "market.h"
+
+#include <QDateTime>
+
+#include <assert.h>
+
+void MarketEventsTest::test()
+{
+    const Market market( "BTC", "EVT" );
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+
+    MarketEventQueue *events = new MarketEventQueue( ENGINE_BINANCE );
+    BboCache bbo;
+
+    // only the first push wakes the overseer
+    MarketEvent event;
+    event.market_id = market.getId();
+    event.time = current_time;
+    event.ticker = TickerInfo( Coin( "0.00010000" ), Coin( "0.00010100" ) );
+    assert( events->push( event ) );
+
+    event.ticker = TickerInfo( Coin( "0.00010001" ), Coin( "0.00010101" ) );
+    assert( !events->push( event ) );
+    assert( events->getDepth() == 2 );
+
+    assert( events->drain( bbo ) == 2 );
+    assert( bbo.getQuote( market ).best.bid == Coin( "0.00010001" ) );
+    assert( events->getBatchCount() == 1 && events->getMaxBatch() == 2 );
+
+    // the wake is armed again after a drain
+    event.type = MarketEvent::STALE;
+    event.market_id = -1;
+    assert( events->push( event ) );
+    events->drain( bbo );
+    assert( bbo.isStale( ENGINE_BINANCE ) && !bbo.getQuote( market ).isValid() );
+
+    event.type = MarketEvent::FRESH;
+    events->push( event );
+    events->drain( bbo );
+    assert( !bbo.isStale( ENGINE_BINANCE ) );
+
+    // past the ring, the latest price of the market still lands last
+    event.type = MarketEvent::TICKER;
+    event.market_id = market.getId();
+    for ( qint32 i = 0; i < MarketEventQueue::SIZE + 10; i++ )
+    {
+        event.ticker = TickerInfo( Coin( "0.00010000" ) + CoinAmount::SATOSHI * uint64_t( i ), Coin( "0.00020000" ) );
+        events->push( event );
+    }
+
+    assert( events->getOverflowCount() == 10 );
+    assert( events->drain( bbo ) == MarketEventQueue::SIZE + 1 ); // the overflow kept the latest one
+    assert( bbo.getQuote( market ).best.bid == Coin( "0.00010000" ) + CoinAmount::SATOSHI * uint64_t( MarketEventQueue::SIZE + 9 ) );
+    assert( events->getDepth() == 0 );
+
+    delete events;
+}
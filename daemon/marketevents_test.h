@@ -0,0 +1,9 @@
+#ifndef MARKETEVENTS_TEST_H
+#define MARKETEVENTS_TEST_H
+
+struct MarketEventsTest
+{
+    void test();
+};
+
+#endif // MARKETEVENTS_TEST_H
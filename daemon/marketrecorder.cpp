@@ -0,0 +1,608 @@
+#include "marketrecorder.h"
+#include "market.h"
+#include "orderbook.h"
+#include "asyncsaver.h"
+
+#include <QFile>
+#include <QDir>
+#include <QDateTime>
+#include <QDataStream>
+#include <QtEndian>
+
+#include <cstring>
+
+MarketRecorder::MarketRecorder( const quint8 _engine_type, AsyncSaver *_saver )
+    : saver( _saver ),
+      engine_type( _engine_type )
+{
+    block.reserve( MARKET_RECORDER_BLOCK_SIZE );
+    openSegment();
+}
+
+MarketRecorder::~MarketRecorder()
+{
+    closeSegment();
+}
+
+void MarketRecorder::recordTicker( const QString &market, const Coin &bid, const Coin &ask, const qint64 time )
+{
+    uchar *p = beginRecord( MARKET_RECORD_TICKER, getMarketId( market, time ), 16, time );
+    if ( !p )
+        return;
+
+    qToLittleEndian<qint64>( OrderBook::getTick( bid ), p );
+    qToLittleEndian<qint64>( OrderBook::getTick( ask ), p + 8 );
+}
+
+void MarketRecorder::recordOpenOrders( const QVector<OrderRecord> &orders, const qint64 time )
+{
+    uchar *p = beginRecord( MARKET_RECORD_OPEN_ORDERS, -1, 4, time );
+    if ( !p )
+        return;
+
+    qToLittleEndian<qint32>( orders.size(), p );
+
+    for ( QVector<OrderRecord>::const_iterator i = orders.begin(); i != orders.end(); i++ )
+    {
+        const qint32 market_id = getMarketId( i->market, time );
+
+        p = beginRecord( MARKET_RECORD_OPEN_ORDER, market_id, 17, time );
+        if ( !p )
+            return;
+
+        p[ 0 ] = i->side;
+        qToLittleEndian<qint64>( OrderBook::getTick( i->price ), p + 1 );
+        qToLittleEndian<qint64>( OrderBook::getTick( i->amount ), p + 9 );
+    }
+}
+
+void MarketRecorder::recordFill( const QString &market, const quint8 side, const qint8 fill_type, const Coin &price, const Coin &amount, const qint64 time )
+{
+    uchar *p = beginRecord( MARKET_RECORD_FILL, getMarketId( market, time ), 18, time );
+    if ( !p )
+        return;
+
+    p[ 0 ] = side;
+    p[ 1 ] = uchar( fill_type );
+    qToLittleEndian<qint64>( OrderBook::getTick( price ), p + 2 );
+    qToLittleEndian<qint64>( OrderBook::getTick( amount ), p + 10 );
+}
+
+bool MarketRecorder::openSegment()
+{
+    const QString path = Global::getRecordingsPath();
+
+    QDir dir;
+    if ( !dir.exists( path ) && !dir.mkdir( path ) )
+    {
+        kDebug() << "local error: could not create recordings path" << path;
+        return false;
+    }
+
+    const QString new_filename = QString( "%1%2%3-%4-%5.rec" )
+                                  .arg( path )
+                                  .arg( QDir::separator() )
+                                  .arg( engine_type )
+                                  .arg( QDateTime::currentDateTime().toString( "yyyyMMdd-hhmmss" ) )
+                                  .arg( segment_count++ );
+
+    // the blocks are appended on the save thread, find out here if we can write it at all
+    QFile savefile( new_filename );
+    if ( !savefile.open( QFile::WriteOnly | QFile::Truncate ) ||
+         savefile.write( MARKET_RECORDER_MAGIC, MARKET_RECORDER_MAGIC_SIZE ) != MARKET_RECORDER_MAGIC_SIZE )
+    {
+        kDebug() << "local error: could not open recording segment" << new_filename << savefile.errorString();
+        savefile.remove();
+        return false;
+    }
+
+    filename = new_filename;
+    segment_size = 0;
+    segment_blocks = QSharedPointer<QVector<MarketRecordBlock>>( new QVector<MarketRecordBlock>() );
+
+    kDebug() << "recording to" << filename;
+    return true;
+}
+
+void MarketRecorder::closeSegment()
+{
+    if ( !isOpen() )
+        return;
+
+    flushBlock();
+
+    // the index goes after the blocks, once they're all written
+    const QString path = filename;
+    const QSharedPointer<QVector<MarketRecordBlock>> blocks = segment_blocks;
+    saver->save( path, [path, blocks]()
+    {
+        QFile savefile( path );
+        if ( !savefile.open( QFile::WriteOnly | QFile::Append ) )
+            return false;
+
+        const QByteArray index = packIndex( *blocks );
+        QByteArray trailer( MARKET_RECORDER_TRAILER_SIZE, Qt::Uninitialized );
+        qToLittleEndian<qint64>( savefile.size(), reinterpret_cast<uchar*>( trailer.data() ) );
+        std::memcpy( trailer.data() + 8, MARKET_RECORDER_INDEX_MAGIC, MARKET_RECORDER_MAGIC_SIZE );
+
+        return savefile.write( index ) == index.size() && savefile.write( trailer ) == trailer.size();
+    } );
+
+    filename.clear();
+    segment_blocks.clear();
+}
+
+void MarketRecorder::flushBlock()
+{
+    if ( block.isEmpty() || !isOpen() )
+        return;
+
+    MarketRecordBlock entry;
+    entry.first_time = block_first_time;
+    entry.last_time = block_last_time;
+    for ( QSet<qint32>::const_iterator i = block_markets.begin(); i != block_markets.end(); i++ )
+        entry.markets += Market::getMarketString( *i );
+
+    // compressed on the save thread, the engine only copied the records
+    const QString path = filename;
+    const QByteArray records = block;
+    const QSharedPointer<QVector<MarketRecordBlock>> blocks = segment_blocks;
+    saver->save( path, [path, records, entry, blocks]() mutable
+    {
+        const QByteArray compressed = qCompress( records, MARKET_RECORDER_COMPRESSION );
+
+        QByteArray header( MARKET_RECORDER_BLOCK_HEADER_SIZE, Qt::Uninitialized );
+        uchar *p = reinterpret_cast<uchar*>( header.data() );
+        qToLittleEndian<quint32>( quint32( compressed.size() ), p );
+        qToLittleEndian<quint32>( quint32( records.size() ), p + 4 );
+        qToLittleEndian<qint64>( entry.first_time, p + 8 );
+        qToLittleEndian<qint64>( entry.last_time, p + 16 );
+
+        QFile savefile( path );
+        if ( !savefile.open( QFile::WriteOnly | QFile::Append ) )
+            return false;
+
+        entry.offset = savefile.size();
+        blocks->append( entry );
+
+        return savefile.write( header ) == header.size() && savefile.write( compressed ) == compressed.size();
+    } );
+
+    block.resize( 0 );
+    block_markets.clear();
+}
+
+QByteArray MarketRecorder::packIndex( const QVector<MarketRecordBlock> &blocks )
+{
+    // the names once, the blocks point at them
+    QStringList names;
+    QHash<QString, quint16> name_indexes;
+    for ( QVector<MarketRecordBlock>::const_iterator i = blocks.begin(); i != blocks.end(); i++ )
+    {
+        for ( QStringList::const_iterator j = i->markets.begin(); j != i->markets.end(); j++ )
+        {
+            if ( name_indexes.contains( *j ) )
+                continue;
+
+            name_indexes.insert( *j, quint16( names.size() ) );
+            names += *j;
+        }
+    }
+
+    QByteArray index;
+    QDataStream out( &index, QIODevice::WriteOnly );
+    out.setVersion( QDataStream::Qt_5_0 );
+
+    out << qint32( MARKET_RECORDER_INDEX_VERSION ) << names << qint32( blocks.size() );
+    for ( QVector<MarketRecordBlock>::const_iterator i = blocks.begin(); i != blocks.end(); i++ )
+    {
+        QVector<quint16> block_names;
+        for ( QStringList::const_iterator j = i->markets.begin(); j != i->markets.end(); j++ )
+            block_names += name_indexes.value( *j );
+
+        out << i->offset << i->first_time << i->last_time << block_names;
+    }
+
+    return index;
+}
+
+bool MarketRecorder::unpackIndex( const QByteArray &index, QVector<MarketRecordBlock> &blocks )
+{
+    QDataStream in( index );
+    in.setVersion( QDataStream::Qt_5_0 );
+
+    qint32 version = 0, block_count = 0;
+    QStringList names;
+    in >> version >> names >> block_count;
+
+    if ( in.status() != QDataStream::Ok || version != MARKET_RECORDER_INDEX_VERSION || block_count < 0 )
+        return false;
+
+    blocks.clear();
+    for ( qint32 i = 0; i < block_count; i++ )
+    {
+        MarketRecordBlock block;
+        QVector<quint16> block_names;
+        in >> block.offset >> block.first_time >> block.last_time >> block_names;
+
+        for ( QVector<quint16>::const_iterator j = block_names.begin(); j != block_names.end(); j++ )
+        {
+            if ( *j >= names.size() )
+                return false;
+
+            block.markets += names.at( *j );
+        }
+
+        if ( in.status() != QDataStream::Ok )
+            return false;
+
+        blocks += block;
+    }
+
+    return true;
+}
+
+qint32 MarketRecorder::getMarketId( const QString &market, const qint64 time )
+{
+    QHash<QString, qint32>::const_iterator i = market_ids.find( market );
+    const qint32 id = i != market_ids.end() ? i.value() : Market( market ).getId();
+
+    if ( i == market_ids.end() )
+        market_ids.insert( market, id );
+
+    // name the id once in each block, so every block can be read by itself
+    if ( id >= 0 && !block_markets.contains( id ) )
+    {
+        const QByteArray name = market.toUtf8().left( 255 );
+
+        uchar *p = beginRecord( MARKET_RECORD_MARKET, id, name.size(), time );
+        if ( p )
+        {
+            std::memcpy( p, name.constData(), size_t( name.size() ) );
+            block_markets.insert( id );
+        }
+    }
+
+    return id;
+}
+
+uchar *MarketRecorder::beginRecord( const quint8 type, const qint32 market_id, const qint32 payload_size, const qint64 time )
+{
+    if ( !isOpen() )
+        return nullptr;
+
+    const qint32 size = MARKET_RECORD_HEADER_SIZE + payload_size;
+
+    // hand over the full block, the next one names its markets again
+    if ( block.size() + size > MARKET_RECORDER_BLOCK_SIZE )
+    {
+        segment_size += block.size();
+        flushBlock();
+
+        // and start the next segment
+        if ( segment_size >= MARKET_RECORDER_SEGMENT_SIZE )
+        {
+            closeSegment();
+
+            if ( !openSegment() )
+                return nullptr;
+        }
+
+        if ( market_id >= 0 && type != MARKET_RECORD_MARKET )
+            getMarketId( Market::getMarketString( market_id ), time );
+    }
+
+    if ( block.isEmpty() )
+        block_first_time = time;
+    block_last_time = time;
+
+    const qint32 start = block.size();
+    block.resize( start + size );
+
+    uchar *p = reinterpret_cast<uchar*>( block.data() ) + start;
+    qToLittleEndian<quint16>( quint16( size ), p );
+    p[ 2 ] = type;
+    p[ 3 ] = engine_type;
+    qToLittleEndian<qint64>( time, p + 4 );
+    qToLittleEndian<qint32>( market_id, p + 12 );
+
+    record_count++;
+
+    return p + MARKET_RECORD_HEADER_SIZE;
+}
+
+MarketRecordReader::MarketRecordReader()
+{
+}
+
+MarketRecordReader::~MarketRecordReader()
+{
+    close();
+}
+
+bool MarketRecordReader::open( const QString &filename )
+{
+    close();
+
+    file = new QFile( filename );
+
+    char magic[ MARKET_RECORDER_MAGIC_SIZE ];
+    if ( !file->open( QFile::ReadOnly ) ||
+         ( file_size = file->size() ) < MARKET_RECORDER_MAGIC_SIZE ||
+         file->read( magic, MARKET_RECORDER_MAGIC_SIZE ) != MARKET_RECORDER_MAGIC_SIZE )
+    {
+        kDebug() << "local error: could not read recording segment" << filename << file->errorString();
+        close();
+        return false;
+    }
+
+    // the first format is one run of records, read it through a mapping like before
+    if ( std::memcmp( magic, MARKET_RECORDER_MAGIC_V1, MARKET_RECORDER_MAGIC_SIZE ) == 0 )
+    {
+        if ( !( mapping = file->map( 0, file_size ) ) )
+        {
+            kDebug() << "local error: could not map recording segment" << filename << file->errorString();
+            close();
+            return false;
+        }
+
+        data = mapping;
+        size = file_size;
+        position = MARKET_RECORDER_MAGIC_SIZE;
+        return true;
+    }
+
+    if ( std::memcmp( magic, MARKET_RECORDER_MAGIC, MARKET_RECORDER_MAGIC_SIZE ) != 0 )
+    {
+        kDebug() << "local error:" << filename << "is not a recording segment";
+        close();
+        return false;
+    }
+
+    // a segment that's still being written, or wasn't closed, has no index yet
+    if ( !readIndex() && !scanBlocks() )
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void MarketRecordReader::close()
+{
+    if ( !file )
+        return;
+
+    if ( mapping )
+        file->unmap( mapping );
+
+    file->close();
+
+    delete file;
+    file = nullptr;
+    mapping = nullptr;
+    file_size = 0;
+
+    blocks.clear();
+    next_block = 0;
+    blocks_read = 0;
+    block_data.clear();
+
+    data = nullptr;
+    size = 0;
+    position = 0;
+    markets.clear();
+}
+
+void MarketRecordReader::setTimeRange( const qint64 _start_time, const qint64 _end_time )
+{
+    start_time = _start_time;
+    end_time = _end_time;
+}
+
+void MarketRecordReader::setMarkets( const QSet<QString> &_wanted_markets )
+{
+    wanted_markets = _wanted_markets;
+}
+
+bool MarketRecordReader::readIndex()
+{
+    if ( file_size < MARKET_RECORDER_MAGIC_SIZE + MARKET_RECORDER_TRAILER_SIZE || !file->seek( file_size - MARKET_RECORDER_TRAILER_SIZE ) )
+        return false;
+
+    const QByteArray trailer = file->read( MARKET_RECORDER_TRAILER_SIZE );
+    if ( trailer.size() != MARKET_RECORDER_TRAILER_SIZE ||
+         std::memcmp( trailer.constData() + 8, MARKET_RECORDER_INDEX_MAGIC, MARKET_RECORDER_MAGIC_SIZE ) != 0 )
+        return false;
+
+    const qint64 index_offset = qFromLittleEndian<qint64>( reinterpret_cast<const uchar*>( trailer.constData() ) );
+    if ( index_offset < MARKET_RECORDER_MAGIC_SIZE || index_offset > file_size - MARKET_RECORDER_TRAILER_SIZE || !file->seek( index_offset ) )
+        return false;
+
+    const QByteArray index = file->read( file_size - MARKET_RECORDER_TRAILER_SIZE - index_offset );
+    if ( !MarketRecorder::unpackIndex( index, blocks ) )
+    {
+        kDebug() << "local warning: bad index in" << file->fileName() << ", reading its blocks";
+        return false;
+    }
+
+    return true;
+}
+
+bool MarketRecordReader::scanBlocks()
+{
+    blocks.clear();
+
+    // the headers have the times, the markets stay unknown
+    qint64 offset = MARKET_RECORDER_MAGIC_SIZE;
+    while ( offset + MARKET_RECORDER_BLOCK_HEADER_SIZE <= file_size && file->seek( offset ) )
+    {
+        const QByteArray header = file->read( MARKET_RECORDER_BLOCK_HEADER_SIZE );
+        if ( header.size() != MARKET_RECORDER_BLOCK_HEADER_SIZE )
+            break;
+
+        const uchar *p = reinterpret_cast<const uchar*>( header.constData() );
+        const qint64 compressed_size = qFromLittleEndian<quint32>( p );
+
+        // the last block can be cut off
+        if ( compressed_size == 0 || offset + MARKET_RECORDER_BLOCK_HEADER_SIZE + compressed_size > file_size )
+            break;
+
+        MarketRecordBlock block;
+        block.offset = offset;
+        block.first_time = qFromLittleEndian<qint64>( p + 8 );
+        block.last_time = qFromLittleEndian<qint64>( p + 16 );
+        blocks += block;
+
+        offset += MARKET_RECORDER_BLOCK_HEADER_SIZE + compressed_size;
+    }
+
+    return true;
+}
+
+bool MarketRecordReader::isWantedBlock( const MarketRecordBlock &block ) const
+{
+    if ( ( start_time > 0 && block.last_time < start_time ) || ( end_time > 0 && block.first_time > end_time ) )
+        return false;
+
+    // markets we don't know, have a look
+    if ( wanted_markets.isEmpty() || block.markets.isEmpty() )
+        return true;
+
+    for ( QStringList::const_iterator i = block.markets.begin(); i != block.markets.end(); i++ )
+        if ( wanted_markets.contains( *i ) )
+            return true;
+
+    return false;
+}
+
+bool MarketRecordReader::readBlock()
+{
+    while ( next_block < blocks.size() )
+    {
+        const MarketRecordBlock &block = blocks.at( next_block++ );
+        if ( !isWantedBlock( block ) )
+            continue;
+
+        if ( !file->seek( block.offset ) )
+            return false;
+
+        const QByteArray header = file->read( MARKET_RECORDER_BLOCK_HEADER_SIZE );
+        if ( header.size() != MARKET_RECORDER_BLOCK_HEADER_SIZE )
+            return false;
+
+        const uchar *p = reinterpret_cast<const uchar*>( header.constData() );
+        const qint64 compressed_size = qFromLittleEndian<quint32>( p );
+        const qint64 records_size = qFromLittleEndian<quint32>( p + 4 );
+
+        block_data = qUncompress( file->read( compressed_size ) );
+        if ( block_data.size() != records_size )
+        {
+            kDebug() << "local error: bad block at" << block.offset << "in" << file->fileName();
+            return false;
+        }
+
+        // each block names its markets again
+        markets.clear();
+        data = reinterpret_cast<const uchar*>( block_data.constData() );
+        size = block_data.size();
+        position = 0;
+        blocks_read++;
+        return true;
+    }
+
+    return false;
+}
+
+bool MarketRecordReader::isWanted( const MarketRecord &record ) const
+{
+    if ( ( start_time > 0 && record.time < start_time ) || ( end_time > 0 && record.time > end_time ) )
+        return false;
+
+    // the open orders count has no market
+    return wanted_markets.isEmpty() || record.market.isEmpty() || wanted_markets.contains( record.market );
+}
+
+bool MarketRecordReader::next( MarketRecord &record )
+{
+    while ( data || readBlock() )
+    {
+        // on to the next block
+        if ( position + MARKET_RECORD_HEADER_SIZE > size )
+        {
+            data = nullptr;
+            if ( mapping || !readBlock() )
+                return false;
+
+            continue;
+        }
+
+        const uchar *p = data + position;
+        const qint32 record_size = qFromLittleEndian<quint16>( p );
+
+        // a first format segment that wasn't closed ends in zeroes
+        if ( record_size == 0 )
+            return false;
+
+        if ( record_size < MARKET_RECORD_HEADER_SIZE || position + record_size > size )
+        {
+            kDebug() << "local error: bad record size" << record_size << "at" << position << "in" << file->fileName();
+            return false;
+        }
+
+        position += record_size;
+
+        const uchar *payload = p + MARKET_RECORD_HEADER_SIZE;
+        const qint32 payload_size = record_size - MARKET_RECORD_HEADER_SIZE;
+        const qint32 market_id = qFromLittleEndian<qint32>( p + 12 );
+
+        record = MarketRecord();
+        record.type = p[ 2 ];
+        record.exchange = p[ 3 ];
+        record.time = qFromLittleEndian<qint64>( p + 4 );
+
+        if ( record.type == MARKET_RECORD_MARKET )
+        {
+            markets.insert( market_id, QString::fromUtf8( reinterpret_cast<const char*>( payload ), payload_size ) );
+            continue;
+        }
+
+        record.market = markets.value( market_id );
+
+        if ( record.type == MARKET_RECORD_TICKER && payload_size >= 16 )
+        {
+            record.bid = OrderBook::getPrice( qFromLittleEndian<qint64>( payload ) );
+            record.ask = OrderBook::getPrice( qFromLittleEndian<qint64>( payload + 8 ) );
+        }
+        else if ( record.type == MARKET_RECORD_OPEN_ORDERS && payload_size >= 4 )
+        {
+            record.count = qFromLittleEndian<qint32>( payload );
+        }
+        else if ( record.type == MARKET_RECORD_OPEN_ORDER && payload_size >= 17 )
+        {
+            record.side = payload[ 0 ];
+            record.price = OrderBook::getPrice( qFromLittleEndian<qint64>( payload + 1 ) );
+            record.amount = OrderBook::getPrice( qFromLittleEndian<qint64>( payload + 9 ) );
+        }
+        else if ( record.type == MARKET_RECORD_FILL && payload_size >= 18 )
+        {
+            record.side = payload[ 0 ];
+            record.fill_type = qint8( payload[ 1 ] );
+            record.price = OrderBook::getPrice( qFromLittleEndian<qint64>( payload + 2 ) );
+            record.amount = OrderBook::getPrice( qFromLittleEndian<qint64>( payload + 10 ) );
+        }
+        else
+        {
+            // a type we don't know or a short payload, skip it
+            continue;
+        }
+
+        if ( !isWanted( record ) )
+            continue;
+
+        return true;
+    }
+
+    return false;
+}
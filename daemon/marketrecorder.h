@@ -0,0 +1,156 @@
+#ifndef MARKETRECORDER_H
+#define MARKETRECORDER_H
+
+#include "global.h"
+#include "coinamount.h"
+#include "misctypes.h"
+
+#include <QHash>
+#include <QSet>
+#include <QVector>
+#include <QStringList>
+#include <QByteArray>
+#include <QSharedPointer>
+
+class QFile;
+class AsyncSaver;
+
+// segment files start with this, then blocks of records compressed one at a time, then the index of the blocks once
+// the segment is closed: a QDataStream of the market names and each block's offset, time range and markets, followed
+// by qint64 index offset and MARKET_RECORDER_INDEX_MAGIC
+static const char MARKET_RECORDER_MAGIC[] = "TRDREC02";
+static const char MARKET_RECORDER_MAGIC_V1[] = "TRDREC01"; // one uncompressed run of records, still read
+static const char MARKET_RECORDER_INDEX_MAGIC[] = "TRDIDX01";
+static const qint32 MARKET_RECORDER_MAGIC_SIZE = 8;
+static const qint64 MARKET_RECORDER_SEGMENT_SIZE = 64 * 1024 * 1024; // records in a segment, before they're compressed
+static const qint32 MARKET_RECORDER_BLOCK_SIZE = 256 * 1024; // ^ in a block, the unit that's compressed and read back
+static const qint32 MARKET_RECORDER_COMPRESSION = 1; // zlib level, the fastest
+static const qint32 MARKET_RECORDER_INDEX_VERSION = 1;
+static const qint32 MARKET_RECORDER_TRAILER_SIZE = 16;
+
+// every block is little endian: quint32 compressed size, quint32 record bytes, qint64 first and last record time, then
+// the qCompress()ed records. a block names its markets itself, so it can be read without the blocks before it
+static const qint32 MARKET_RECORDER_BLOCK_HEADER_SIZE = 24;
+
+// every record is little endian: quint16 size (with this header), quint8 type, quint8 exchange, qint64 time ms,
+// qint32 market id, then the payload. prices and amounts are qint64 satoshi ticks
+static const qint32 MARKET_RECORD_HEADER_SIZE = 16;
+static const quint8 MARKET_RECORD_MARKET = 1; // market name, for the ids in this block
+static const quint8 MARKET_RECORD_TICKER = 2; // bid, ask
+static const quint8 MARKET_RECORD_OPEN_ORDERS = 3; // qint32 order count, the orders follow
+static const quint8 MARKET_RECORD_OPEN_ORDER = 4; // quint8 side, price, amount
+static const quint8 MARKET_RECORD_FILL = 5; // quint8 side, qint8 fill type, price, amount
+
+// a block of a segment, from its index
+struct MarketRecordBlock
+{
+    qint64 offset{ 0 }; // of its header in the segment
+    qint64 first_time{ 0 };
+    qint64 last_time{ 0 };
+    QStringList markets; // empty if the segment wasn't closed, it isn't known then
+};
+
+//
+// MarketRecorder, appends what an engine saw to segment files in getRecordingsPath(). records are copied into a
+// block in memory, so writing one doesn't make a system call. a full block is compressed and appended on the save
+// thread, and a full segment gets its index and the next one is started
+//
+class MarketRecorder
+{
+public:
+    explicit MarketRecorder( const quint8 _engine_type, AsyncSaver *_saver );
+    ~MarketRecorder(); // hands the last block and the index to the saver, it must still be there
+
+    bool isOpen() const { return !filename.isEmpty(); }
+    qint64 getRecordCount() const { return record_count; }
+
+    void recordTicker( const QString &market, const Coin &bid, const Coin &ask, const qint64 time );
+    void recordOpenOrders( const QVector<OrderRecord> &orders, const qint64 time );
+    void recordFill( const QString &market, const quint8 side, const qint8 fill_type, const Coin &price, const Coin &amount, const qint64 time );
+
+    static QByteArray packIndex( const QVector<MarketRecordBlock> &blocks ); // with the trailer, the offset is filled in
+    static bool unpackIndex( const QByteArray &index, QVector<MarketRecordBlock> &blocks );
+
+private:
+    bool openSegment();
+    void closeSegment();
+    void flushBlock();
+    qint32 getMarketId( const QString &market, const qint64 time ); // writes the market record the first time in a block
+    uchar *beginRecord( const quint8 type, const qint32 market_id, const qint32 payload_size, const qint64 time ); // nullptr if closed
+
+    AsyncSaver *saver{ nullptr };
+    QString filename; // of the open segment
+    QByteArray block;
+    qint64 block_first_time{ 0 };
+    qint64 block_last_time{ 0 };
+    qint64 segment_size{ 0 }; // of the records in the segment
+    qint64 record_count{ 0 };
+    qint32 segment_count{ 0 };
+    quint8 engine_type{ 0 };
+
+    QHash<QString/*market*/, qint32/*id*/> market_ids;
+    QSet<qint32/*id*/> block_markets;
+    QSharedPointer<QVector<MarketRecordBlock>> segment_blocks; // filled in on the save thread as they're written
+};
+
+// one record read back by MarketRecordReader, with the ticks turned back into prices and amounts
+struct MarketRecord
+{
+    quint8 type{ 0 };
+    quint8 exchange{ 0 };
+    qint64 time{ 0 };
+    QString market; // empty for MARKET_RECORD_OPEN_ORDERS
+    quint8 side{ 0 };
+    qint8 fill_type{ 0 };
+    qint32 count{ 0 }; // MARKET_RECORD_OPEN_ORDERS
+    Coin bid, ask; // MARKET_RECORD_TICKER
+    Coin price, amount; // MARKET_RECORD_OPEN_ORDER, MARKET_RECORD_FILL
+};
+
+//
+// MarketRecordReader, reads one segment written by MarketRecorder. with a time range or markets set, it only
+// decompresses the blocks that have some of them, and skips the records outside them. market records name the ids
+// for the rest of the block and aren't returned by next(). segments of the first format are read through a mapping
+//
+class MarketRecordReader
+{
+public:
+    explicit MarketRecordReader();
+    ~MarketRecordReader();
+
+    bool open( const QString &filename ); // reads the index, or the block headers of a segment that wasn't closed
+    void close();
+    void setTimeRange( const qint64 start_time, const qint64 end_time ); // ms, 0 for no limit
+    void setMarkets( const QSet<QString> &_wanted_markets ); // empty for all of them
+    bool next( MarketRecord &record ); // false at the end of the segment or on a bad record
+
+    const QVector<MarketRecordBlock> &getBlocks() const { return blocks; }
+    qint32 getBlocksRead() const { return blocks_read; }
+
+private:
+    bool readIndex();
+    bool scanBlocks();
+    bool isWantedBlock( const MarketRecordBlock &block ) const;
+    bool readBlock(); // the next wanted one, false at the end
+    bool isWanted( const MarketRecord &record ) const;
+
+    QFile *file{ nullptr };
+    uchar *mapping{ nullptr }; // of a first format segment
+    qint64 file_size{ 0 };
+
+    QVector<MarketRecordBlock> blocks;
+    qint32 next_block{ 0 };
+    qint32 blocks_read{ 0 };
+    QByteArray block_data; // of the block being read
+
+    const uchar *data{ nullptr }; // the records being read
+    qint64 size{ 0 };
+    qint64 position{ 0 };
+
+    qint64 start_time{ 0 };
+    qint64 end_time{ 0 };
+    QSet<QString> wanted_markets;
+    QHash<qint32/*id*/, QString/*market*/> markets;
+};
+
+#endif // MARKETRECORDER_H
@@ -0,0 +1,76 @@
+#include "marketshards.h"
+#include "market.h"
+
+#include <QStringList>
+#include <QByteArray>
+
+bool MarketShards::parse( const QString &spec )
+{
+    const QStringList parts = spec.simplified().split( QChar( ' ' ), QString::SkipEmptyParts );
+    if ( parts.isEmpty() )
+        return false;
+
+    bool ok = false;
+    const qint32 new_count = parts.at( 0 ).toInt( &ok );
+    if ( !ok || new_count < 1 || new_count * ENGINE_SHARD_STRIDE > 255 )
+        return false;
+
+    count = new_count;
+    pinned.clear();
+
+    for ( QStringList::const_iterator i = parts.begin() +1; i != parts.end(); i++ )
+    {
+        const QString market = i->section( QChar( ':' ), 0, 0 );
+        const qint32 shard = i->section( QChar( ':' ), 1 ).toInt( &ok );
+
+        if ( !ok || shard < 0 || shard >= count || !Market( market ).isValid() )
+        {
+            kDebug() << "local warning: bad shard pin" << *i << "for" << count << "shards";
+            return false;
+        }
+
+        pin( market, shard );
+    }
+
+    return true;
+}
+
+void MarketShards::pin( const QString &market, const qint32 shard )
+{
+    pinned.insert( getPairKey( market ), qBound( 0, shard, count -1 ) );
+}
+
+qint32 MarketShards::getShard( const QString &market ) const
+{
+    if ( count <= 1 )
+        return 0;
+
+    const QString key = getPairKey( market );
+
+    const QHash<QString, qint32>::const_iterator pin = pinned.constFind( key );
+    if ( pin != pinned.constEnd() )
+        return pin.value();
+
+    // fnv-1a of the utf-8 key, qHash can change with the cpu and qt version and markets have to stay in their shard
+    // across restarts and on every host
+    quint32 hash = 2166136261u;
+    const QByteArray bytes = key.toUtf8();
+    for ( QByteArray::const_iterator i = bytes.begin(); i != bytes.end(); i++ )
+    {
+        hash ^= quint8( *i );
+        hash *= 16777619u;
+    }
+
+    return qint32( hash % quint32( count ) );
+}
+
+QString MarketShards::getPairKey( const QString &market )
+{
+    const Market m( market );
+    if ( !m.isValid() )
+        return market;
+
+    const QString forward = m;
+    const QString inverse = m.getInverse();
+    return forward < inverse ? forward : inverse;
+}
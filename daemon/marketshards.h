@@ -0,0 +1,36 @@
+#ifndef MARKETSHARDS_H
+#define MARKETSHARDS_H
+
+#include "global.h"
+
+#include <QString>
+#include <QHash>
+
+// engine ids, the engine type plus the shard times this, so the shards sort after the first engine of every exchange
+static const qint32 ENGINE_SHARD_STRIDE = 16;
+
+//
+// MarketShards, which of an exchange's engines owns a market. markets are spread by a stable hash of the pair unless
+// they're pinned to a shard, and a market and its inverse are always in the same shard. set from the exchanges file,
+// "waves 3 BTC_WAVES:0 ETH_WAVES:2" runs three waves engines
+//
+class MarketShards
+{
+public:
+    explicit MarketShards( const qint32 _count = 1 ) : count( qMax( 1, _count ) ) {}
+
+    bool parse( const QString &spec ); // "<count> [market:shard ...]", false if any of it is bad
+    void pin( const QString &market, const qint32 shard );
+
+    qint32 getCount() const { return count; }
+    bool isSharded() const { return count > 1; }
+    qint32 getShard( const QString &market ) const;
+
+    static QString getPairKey( const QString &market ); // the same for a market and its inverse
+
+private:
+    qint32 count;
+    QHash<QString/*pair key*/, qint32> pinned;
+};
+
+#endif // MARKETSHARDS_H
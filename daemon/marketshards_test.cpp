@@ -0,0 +1,45 @@
+#include "marketshards_test.h"
+#include "marketshards.h"
+#include "market.h"
+
+#include <assert.h>
+
+void MarketShardsTest::test()
+{
+    /// test one shard, every market is its
+    MarketShards one;
+    assert( !one.isSharded() );
+    assert( one.getShard( "BTC_WAVES" ) == 0 );
+
+    /// test parsing
+    MarketShards shards;
+    assert( !shards.parse( "" ) );
+    assert( !shards.parse( "zero" ) );
+    assert( !shards.parse( "0" ) );
+    assert( !shards.parse( "3 BTC_WAVES:3" ) ); // out of range
+    assert( !shards.parse( "3 BTC_WAVES" ) );
+    assert( shards.parse( "3 BTC_WAVES:2 WAVES_ETH:1" ) );
+    assert( shards.isSharded() && shards.getCount() == 3 );
+
+    /// test pins, the inverse follows
+    assert( shards.getShard( "BTC_WAVES" ) == 2 );
+    assert( shards.getShard( "WAVES_BTC" ) == 2 );
+    assert( shards.getShard( "ETH_WAVES" ) == 1 );
+
+    /// test the hashed markets, in range and the same for a market and its inverse
+    const char *const markets[] = { "BTC_ETH", "USDT_BTC", "BTC_LTC", "USDN_WAVES", "BTC_DOGE" };
+    for ( size_t i = 0; i < sizeof( markets ) / sizeof( markets[ 0 ] ); i++ )
+    {
+        const QString market = markets[ i ];
+        const qint32 shard = shards.getShard( market );
+        assert( shard >= 0 && shard < 3 );
+        assert( shard == shards.getShard( Market( market ).getInverse() ) );
+        assert( MarketShards::getPairKey( market ) == MarketShards::getPairKey( Market( market ).getInverse() ) );
+    }
+
+    /// test the hash is fixed, these are the fnv-1a of the pair keys on every host
+    assert( shards.getShard( "BTC_ETH" ) == 0 ); // 0x0f7e8904
+    assert( shards.getShard( "USDT_BTC" ) == 0 ); // BTC_USDT, 0x29820e91
+    assert( shards.getShard( "USDN_WAVES" ) == 1 ); // 0x921b1cb2
+    assert( shards.getShard( "DOGE_BTC" ) == 1 ); // BTC_DOGE, 0xde8c581c
+}
@@ -0,0 +1,9 @@
+#ifndef MARKETSHARDS_TEST_H
+#define MARKETSHARDS_TEST_H
+
+struct MarketShardsTest
+{
+    void test();
+};
+
+#endif // MARKETSHARDS_TEST_H
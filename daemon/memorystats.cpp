@@ -0,0 +1,249 @@
+#include "memorystats.h"
+
+#include <QFile>
+
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <gmp.h>
+
+#if defined( Q_OS_LINUX )
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+static std::atomic<qint64> gmp_bytes( 0 );
+static std::atomic<qint64> gmp_peak_bytes( 0 );
+static std::atomic<quint64> gmp_allocations( 0 );
+static std::atomic<quint64> gmp_pool_hits( 0 );
+static std::atomic<qint64> gmp_pool_bytes( 0 ); // free blocks held by the pools
+
+// each thread keeps free lists of small limb blocks, in power of 2 size classes from GMP_POOL_MIN_SIZE. a coin's
+// bignum is a few limbs, so nearly every allocation is one of these, and a thread reuses them without the malloc lock
+static const qint32 GMP_POOL_CLASSES = 5; // 16, 32, 64, 128 and 256 bytes
+static const size_t GMP_POOL_MIN_SIZE = 16;
+static const size_t GMP_POOL_MAX_SIZE = GMP_POOL_MIN_SIZE << ( GMP_POOL_CLASSES -1 );
+static const qint32 GMP_POOL_MAX_BLOCKS = 1024; // free blocks kept in each class, the rest go back to malloc
+
+struct GmpFreeBlock
+{
+    GmpFreeBlock *next;
+};
+
+// trivially destructible so it's still there for the frees after the thread's destructors ran, see GmpPoolCloser
+struct GmpPool
+{
+    GmpFreeBlock *heads[ GMP_POOL_CLASSES ];
+    qint32 counts[ GMP_POOL_CLASSES ];
+    bool is_open;
+    bool is_closed;
+};
+
+thread_local GmpPool gmp_pool = {};
+
+// returns the thread's blocks when it exits, later frees go straight to free()
+struct GmpPoolCloser
+{
+    ~GmpPoolCloser()
+    {
+        for ( qint32 i = 0; i < GMP_POOL_CLASSES; i++ )
+        {
+            while ( gmp_pool.heads[ i ] )
+            {
+                GmpFreeBlock *block = gmp_pool.heads[ i ];
+                gmp_pool.heads[ i ] = block->next;
+                std::free( block );
+            }
+
+            gmp_pool_bytes -= qint64( gmp_pool.counts[ i ] ) * qint64( GMP_POOL_MIN_SIZE << i );
+            gmp_pool.counts[ i ] = 0;
+        }
+
+        gmp_pool.is_closed = true;
+    }
+};
+
+thread_local GmpPoolCloser gmp_pool_closer;
+
+inline qint32 getGmpPoolClass( const size_t size )
+{
+    if ( size > GMP_POOL_MAX_SIZE )
+        return -1;
+    if ( size <= GMP_POOL_MIN_SIZE )
+        return 0;
+
+    // the bit length of size -1, less the one of the smallest class
+    return qint32( sizeof( unsigned long long ) * 8 ) - __builtin_clzll( size -1 ) - 4;
+}
+
+GmpPool *getGmpPool()
+{
+    if ( Q_UNLIKELY( !gmp_pool.is_open ) )
+    {
+        if ( gmp_pool.is_closed )
+            return nullptr;
+
+        // touch the closer so it's made, and destroyed with the thread
+        (void) &gmp_pool_closer;
+        gmp_pool.is_open = true;
+    }
+
+    return gmp_pool.is_closed ? nullptr : &gmp_pool;
+}
+
+void *poolAlloc( const size_t size )
+{
+    const qint32 size_class = getGmpPoolClass( size );
+    GmpPool *pool = size_class < 0 ? nullptr : getGmpPool();
+    if ( !pool )
+        return std::malloc( size );
+
+    GmpFreeBlock *block = pool->heads[ size_class ];
+    if ( !block )
+        return std::malloc( GMP_POOL_MIN_SIZE << size_class );
+
+    pool->heads[ size_class ] = block->next;
+    pool->counts[ size_class ]--;
+    gmp_pool_hits.fetch_add( 1, std::memory_order_relaxed );
+    gmp_pool_bytes.fetch_sub( qint64( GMP_POOL_MIN_SIZE << size_class ), std::memory_order_relaxed );
+
+    return block;
+}
+
+void poolFree( void *p, const size_t size )
+{
+    // the block is the size of its class, whichever thread it came from
+    const qint32 size_class = getGmpPoolClass( size );
+    GmpPool *pool = size_class < 0 ? nullptr : getGmpPool();
+    if ( !pool || pool->counts[ size_class ] >= GMP_POOL_MAX_BLOCKS )
+    {
+        std::free( p );
+        return;
+    }
+
+    GmpFreeBlock *block = static_cast<GmpFreeBlock*>( p );
+    block->next = pool->heads[ size_class ];
+    pool->heads[ size_class ] = block;
+    pool->counts[ size_class ]++;
+    gmp_pool_bytes.fetch_add( qint64( GMP_POOL_MIN_SIZE << size_class ), std::memory_order_relaxed );
+}
+
+void addGmpBytes( const qint64 bytes )
+{
+    const qint64 current = gmp_bytes += bytes;
+
+    qint64 peak = gmp_peak_bytes;
+    while ( current > peak && !gmp_peak_bytes.compare_exchange_weak( peak, current ) ) {}
+}
+
+// gmp passes the old size back to us, so we don't have to keep a header on each block
+void *gmpAlloc( size_t size )
+{
+    void *p = poolAlloc( size );
+    if ( !p )
+        std::abort(); // gmp can't handle a failed allocation either
+
+    gmp_allocations++;
+    addGmpBytes( qint64( size ) );
+
+    return p;
+}
+
+void *gmpRealloc( void *p, size_t old_size, size_t new_size )
+{
+    const qint32 old_class = getGmpPoolClass( old_size );
+    const qint32 new_class = getGmpPoolClass( new_size );
+    void *np;
+
+    // the block already fits, or neither size is pooled
+    if ( old_class >= 0 && old_class == new_class )
+        np = p;
+    else if ( old_class < 0 && new_class < 0 )
+        np = std::realloc( p, new_size );
+    else
+    {
+        np = poolAlloc( new_size );
+        if ( np )
+        {
+            std::memcpy( np, p, std::min( old_size, new_size ) );
+            poolFree( p, old_size );
+        }
+    }
+
+    if ( !np )
+        std::abort();
+
+    addGmpBytes( qint64( new_size ) - qint64( old_size ) );
+
+    return np;
+}
+
+void gmpFree( void *p, size_t size )
+{
+    poolFree( p, size );
+
+    gmp_bytes -= qint64( size );
+}
+
+} // namespace
+
+void MemoryStats::installGmpHooks()
+{
+    mp_set_memory_functions( &gmpAlloc, &gmpRealloc, &gmpFree );
+}
+
+qint64 MemoryStats::getGmpBytes()
+{
+    return gmp_bytes;
+}
+
+qint64 MemoryStats::getGmpPeakBytes()
+{
+    return gmp_peak_bytes;
+}
+
+quint64 MemoryStats::getGmpAllocations()
+{
+    return gmp_allocations;
+}
+
+quint64 MemoryStats::getGmpPoolHits()
+{
+    return gmp_pool_hits.load( std::memory_order_relaxed );
+}
+
+qint64 MemoryStats::getGmpPoolBytes()
+{
+    return gmp_pool_bytes.load( std::memory_order_relaxed );
+}
+
+qint64 MemoryStats::getResidentBytes()
+{
+#if defined( Q_OS_LINUX )
+    // statm is in pages: size resident shared ...
+    QFile statm( "/proc/self/statm" );
+    if ( !statm.open( QIODevice::ReadOnly ) )
+        return 0;
+
+    const QList<QByteArray> fields = statm.readAll().split( ' ' );
+    if ( fields.size() < 2 )
+        return 0;
+
+    return fields.at( 1 ).toLongLong() * qint64( sysconf( _SC_PAGESIZE ) );
+#else
+    return 0;
+#endif
+}
+
+QString MemoryStats::formatBytes( const qint64 bytes )
+{
+    if ( bytes >= 1024 * 1024 )
+        return QString( "%1 MB" ).arg( qreal( bytes ) / ( 1024 * 1024 ), 0, 'f', 2 );
+    if ( bytes >= 1024 )
+        return QString( "%1 KB" ).arg( qreal( bytes ) / 1024, 0, 'f', 1 );
+
+    return QString( "%1 B" ).arg( bytes );
+}
@@ -0,0 +1,83 @@
+#ifndef MEMORYSTATS_H
+#define MEMORYSTATS_H
+
+#include "global.h"
+#include "orderid.h"
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QMap>
+
+//
+// MemoryStats, estimates of what our structures hold for the getmemory report. the container estimates count the
+// nodes or elements and their headers, not the allocator's rounding, and shared strings are counted for each holder.
+// gmp's allocations go through hooks that count them exactly, once installGmpHooks() runs before the first bignum. the
+// hooks keep small blocks on a free list for each thread
+//
+namespace MemoryStats
+{
+    void installGmpHooks();
+    qint64 getGmpBytes(); // bignum limbs allocated right now
+    qint64 getGmpPeakBytes();
+    quint64 getGmpAllocations(); // since the hooks were installed
+    quint64 getGmpPoolHits(); // of those, the ones a thread's free list had a block for
+    qint64 getGmpPoolBytes(); // free blocks the threads hold for reuse
+
+    qint64 getResidentBytes(); // the process rss, 0 where we can't read it
+
+    QString formatBytes( const qint64 bytes );
+
+    static const qint64 CONTAINER_HEADER_SIZE = 24; // QArrayData
+    static const qint64 HASH_NODE_OVERHEAD = sizeof( void* ) + sizeof( uint ); // next pointer and hash
+    static const qint64 MAP_NODE_OVERHEAD = 3 * sizeof( void* ); // parent/color, left and right
+
+    static inline qint64 getBytes( const QString &s )
+    {
+        return s.capacity() > 0 ? CONTAINER_HEADER_SIZE + ( s.capacity() + 1 ) * qint64( sizeof( QChar ) ) : 0;
+    }
+
+    static inline qint64 getBytes( const QByteArray &s )
+    {
+        return s.capacity() > 0 ? CONTAINER_HEADER_SIZE + s.capacity() + 1 : 0;
+    }
+
+    static inline qint64 getBytes( const OrderId &id )
+    {
+        return id.size() > OrderId::INLINE_SIZE ? CONTAINER_HEADER_SIZE + id.size() + 1 : 0;
+    }
+
+    template <typename T>
+    static inline qint64 getBytes( const QVector<T> &v )
+    {
+        return v.capacity() > 0 ? CONTAINER_HEADER_SIZE + v.capacity() * qint64( sizeof( T ) ) : 0;
+    }
+
+    template <typename K, typename V>
+    static inline qint64 getBytes( const QHash<K,V> &h )
+    {
+        return h.capacity() * qint64( sizeof( void* ) ) + h.size() * ( HASH_NODE_OVERHEAD + qint64( sizeof( K ) + sizeof( V ) ) );
+    }
+
+    template <typename K, typename V>
+    static inline qint64 getBytes( const QMultiHash<K,V> &h )
+    {
+        return getBytes( static_cast<const QHash<K,V>&>( h ) );
+    }
+
+    template <typename T>
+    static inline qint64 getBytes( const QSet<T> &s )
+    {
+        return s.capacity() * qint64( sizeof( void* ) ) + s.size() * ( HASH_NODE_OVERHEAD + qint64( sizeof( T ) ) );
+    }
+
+    template <typename K, typename V>
+    static inline qint64 getBytes( const QMap<K,V> &m )
+    {
+        return m.size() * ( MAP_NODE_OVERHEAD + qint64( sizeof( K ) + sizeof( V ) ) );
+    }
+}
+
+#endif // MEMORYSTATS_H
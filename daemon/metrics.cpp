@@ -0,0 +1,279 @@
+#include "metrics.h"
+#include "engine.h"
+#include "baserest.h"
+#include "positionman.h"
+#include "latencyhistogram.h"
+#include "spruce.h"
+#include "spruceoverseer.h"
+#include "costfunctioncache.h"
+#include "memorystats.h"
+#include "looplag.h"
+
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QStringList>
+#include <QHash>
+#include <QMutexLocker>
+#include <QDateTime>
+
+static const qint32 MAX_REQUEST_SIZE = 8192; // drop clients that send more than this without ending the headers
+static const qreal QUANTILES[] = { 0.5, 0.9, 0.99 };
+
+static EngineCounters engine_counters[ ENGINE_WAVES +1 ];
+static SpruceCounters spruce_counters;
+
+EngineCounters &Metrics::getEngineCounters( const quint8 engine_type )
+{
+    return engine_counters[ engine_type <= ENGINE_WAVES ? engine_type : 0 ];
+}
+
+SpruceCounters &Metrics::getSpruceCounters()
+{
+    return spruce_counters;
+}
+
+namespace
+{
+
+// the text format wants each metric's samples together after its TYPE line, so samples are grouped as they're added
+class MetricsWriter
+{
+public:
+    void add( const QString &name, const QString &type, const QString &labels, const QString &value )
+    {
+        if ( !samples.contains( name ) )
+        {
+            names += name;
+            types.insert( name, type );
+        }
+
+        samples[ name ] += labels.isEmpty() ? QString( "%1 %2" ).arg( name ).arg( value ) :
+                                              QString( "%1{%2} %3" ).arg( name ).arg( labels ).arg( value );
+    }
+
+    void add( const QString &name, const QString &type, const QString &labels, const quint64 value )
+    {
+        add( name, type, labels, QString::number( value ) );
+    }
+
+    QByteArray toText() const
+    {
+        QString out;
+        for ( QStringList::const_iterator i = names.begin(); i != names.end(); i++ )
+        {
+            out += QString( "# TYPE %1 %2\n" ).arg( *i ).arg( types.value( *i ) );
+            out += samples.value( *i ).join( '\n' ) + '\n';
+        }
+
+        return out.toUtf8();
+    }
+
+private:
+    QStringList names; // in the order they were first added
+    QHash<QString, QString> types;
+    QHash<QString, QStringList> samples;
+};
+
+QString getExchangeLabel( const quint8 engine_type )
+{
+    return engine_type == ENGINE_BITTREX  ? QString( "exchange=\"bittrex\"" ) :
+           engine_type == ENGINE_BINANCE  ? QString( "exchange=\"binance\"" ) :
+           engine_type == ENGINE_POLONIEX ? QString( "exchange=\"poloniex\"" ) :
+                                            QString( "exchange=\"waves\"" );
+}
+
+// label values can't hold quotes, backslashes or newlines unescaped
+QString escapeLabel( QString value )
+{
+    return value.replace( '\\', "\\\\" ).replace( '"', "\\\"" ).replace( '\n', "\\n" );
+}
+
+} // namespace
+
+MetricsServer::MetricsServer( SpruceOverseer *_spruce_overseer, const quint16 port, QObject *parent )
+    : QTcpServer( parent ),
+      spruce_overseer( _spruce_overseer )
+{
+    // ensure we can listen, localhost only
+    if ( !QTcpServer::listen( QHostAddress::LocalHost, port ) )
+    {
+        kDebug() << "[MetricsServer] failed to listen on port" << port << QTcpServer::errorString();
+        return;
+    }
+
+    connect( this, &QTcpServer::newConnection, this, &MetricsServer::handleNewConnection );
+    kDebug() << "[MetricsServer] listening on port" << port;
+}
+
+void MetricsServer::handleNewConnection()
+{
+    while ( QTcpServer::hasPendingConnections() )
+    {
+        QTcpSocket *sck = QTcpServer::nextPendingConnection();
+        connect( sck, &QTcpSocket::readyRead, this, &MetricsServer::handleReadyRead );
+        connect( sck, &QTcpSocket::disconnected, sck, &QTcpSocket::deleteLater );
+    }
+}
+
+void MetricsServer::handleReadyRead()
+{
+    QTcpSocket *sck = qobject_cast<QTcpSocket*>( sender() );
+    if ( !sck )
+        return;
+
+    // wait for the end of the headers, we only look at the request line
+    const QByteArray request = sck->peek( MAX_REQUEST_SIZE );
+    if ( !request.contains( "\r\n\r\n" ) )
+    {
+        if ( request.size() >= MAX_REQUEST_SIZE )
+            sck->abort();
+
+        return;
+    }
+
+    sck->readAll();
+    disconnect( sck, &QTcpSocket::readyRead, this, &MetricsServer::handleReadyRead );
+
+    const QList<QByteArray> request_line = request.left( request.indexOf( "\r\n" ) ).split( ' ' );
+    const bool is_metrics = request_line.size() >= 2 && request_line.at( 0 ) == "GET" &&
+                            ( request_line.at( 1 ) == "/metrics" || request_line.at( 1 ) == "/" );
+
+    const QByteArray body = is_metrics ? getMetrics() : QByteArray( "not found\n" );
+
+    sck->write( QByteArray( is_metrics ? "HTTP/1.0 200 OK\r\n" : "HTTP/1.0 404 Not Found\r\n" ) +
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: " + QByteArray::number( body.size() ) + "\r\n"
+                "Connection: close\r\n\r\n" + body );
+    sck->disconnectFromHost();
+}
+
+QByteArray MetricsServer::getMetrics()
+{
+    MetricsWriter out;
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+
+    for ( QMap<qint32, Engine*>::const_iterator i = spruce_overseer->engine_map.begin(); i != spruce_overseer->engine_map.end(); i++ )
+    {
+        Engine *engine = i.value();
+        QString exchange = getExchangeLabel( engine->engine_type );
+        if ( engine->getEngineIndex() > 0 )
+            exchange += QString( ",shard=\"%1\",account=\"%2\"" ).arg( engine->getShardIndex() ).arg( engine->getAccountIndex() );
+
+        // the order counters are kept for the whole exchange, the first engine has them
+        if ( engine->getEngineIndex() == 0 )
+        {
+            const EngineCounters &counters = Metrics::getEngineCounters( engine->engine_type );
+            out.add( "trader_orders_set_total", "counter", exchange, Metrics::get( counters.orders_set ) );
+            out.add( "trader_orders_cancelled_total", "counter", exchange, Metrics::get( counters.orders_cancelled ) );
+            out.add( "trader_fills_total", "counter", exchange, Metrics::get( counters.fills ) );
+        }
+
+        // price changes on their way to the overseer, read without any lock
+        const MarketEventQueue *events = spruce_overseer->market_events.value( engine->getEngineId(), nullptr );
+        if ( events )
+        {
+            out.add( "trader_market_events_total", "counter", exchange, events->getPushedCount() );
+            out.add( "trader_market_events_overflow_total", "counter", exchange, events->getOverflowCount() );
+            out.add( "trader_market_event_batches_total", "counter", exchange, events->getBatchCount() );
+            out.add( "trader_market_event_batch_max", "gauge", exchange, events->getMaxBatch() );
+            out.add( "trader_market_event_queue", "gauge", exchange, quint64( events->getDepth() ) );
+        }
+
+        // positions from the last published snapshot, without waiting on the engine
+        const PositionSnapshotPtr snapshot = engine->getPositionMan()->getSnapshot();
+        if ( snapshot )
+        {
+            out.add( "trader_positions", "gauge", exchange + ",state=\"active\"", quint64( snapshot->active_count ) );
+            out.add( "trader_positions", "gauge", exchange + ",state=\"queued\"", quint64( snapshot->queued_count ) );
+            out.add( "trader_position_snapshot_age_ms", "gauge", exchange, quint64( qMax( qint64( 0 ), QDateTime::currentMSecsSinceEpoch() - snapshot->time ) ) );
+        }
+
+        // the rest is engine state, sample it under the engine's lock like the commands do
+        QMutexLocker locker( engine->getLock() );
+
+        const QMap<QString, LatencyHistogram> &histograms = engine->getLatency().getHistograms();
+        for ( QMap<QString, LatencyHistogram>::const_iterator j = histograms.begin(); j != histograms.end(); j++ )
+        {
+            const QString labels = exchange + QString( ",stage=\"%1\"" ).arg( escapeLabel( j.key() ) );
+
+            for ( size_t q = 0; q < sizeof( QUANTILES ) / sizeof( QUANTILES[ 0 ] ); q++ )
+                out.add( "trader_latency_ms", "gauge", labels + QString( ",quantile=\"%1\"" ).arg( QUANTILES[ q ] ),
+                         quint64( j.value().getPercentile( QUANTILES[ q ] ) ) );
+
+            out.add( "trader_latency_samples_total", "counter", labels, j.value().getCount() );
+        }
+
+        BaseREST *rest = engine->rest_arr.value( engine->engine_type );
+        if ( !rest )
+            continue;
+
+        out.add( "trader_nam_queue", "gauge", exchange, quint64( rest->nam_queue.size() ) );
+        out.add( "trader_nam_queue_sent", "gauge", exchange, quint64( rest->nam_queue_sent.size() ) );
+        out.add( "trader_orders_stale_trips_total", "counter", exchange, quint64( rest->orders_stale_trip_count ) );
+        out.add( "trader_books_stale_trips_total", "counter", exchange, quint64( rest->books_stale_trip_count ) );
+        out.add( "trader_coalesced_requests_total", "counter", exchange, quint64( rest->coalesced_request_count ) );
+        out.add( "trader_clock_offset_ms", "gauge", exchange, QString::number( rest->server_clock.getOffset() ) ); // server - ours
+        out.add( "trader_clock_rejects_avoided_total", "counter", exchange, quint64( rest->clock_rejects_avoided ) );
+
+        // 0 closed, 1 open, 2 half-open
+        for ( quint8 c = 0; c < REQUEST_CLASS_COUNT; c++ )
+        {
+            const QString labels = exchange + QString( ",class=\"%1\"" ).arg( REQUEST_CLASS_NAMES[ c ] );
+            const CircuitBreaker &breaker = rest->breakers.at( c );
+
+            out.add( "trader_breaker_state", "gauge", labels, quint64( breaker.getState( current_time ) ) );
+            out.add( "trader_breaker_trips_total", "counter", labels, quint64( breaker.getTripCount() ) );
+        }
+
+        // reply times over the last minute, for each command class and all of them
+        QMap<QString, ResponseTimeWindow> windows = rest->response_times.getClasses();
+        windows.insert( "all", rest->response_times.getAll() );
+
+        for ( QMap<QString, ResponseTimeWindow>::const_iterator j = windows.begin(); j != windows.end(); j++ )
+        {
+            const QString labels = exchange + QString( ",class=\"%1\"" ).arg( escapeLabel( j.key() ) );
+
+            for ( size_t q = 0; q < sizeof( QUANTILES ) / sizeof( QUANTILES[ 0 ] ); q++ )
+                out.add( "trader_response_time_ms", "gauge", labels + QString( ",quantile=\"%1\"" ).arg( QUANTILES[ q ] ),
+                         quint64( j.value().getPercentile( QUANTILES[ q ], current_time ) ) );
+
+            out.add( "trader_response_time_samples", "gauge", labels, j.value().getCount( current_time ) );
+        }
+    }
+
+    const SpruceCounters &spruce_counts = Metrics::getSpruceCounters();
+    out.add( "trader_spruce_solves_total", "counter", QString(), Metrics::get( spruce_counts.solves ) );
+    out.add( "trader_spruce_solves_incomplete_total", "counter", QString(), Metrics::get( spruce_counts.solves_incomplete ) );
+    out.add( "trader_spruce_solve_seconds_total", "counter", QString(),
+             QString::number( Metrics::get( spruce_counts.solve_us_total ) / 1000000., 'f', 6 ) );
+    out.add( "trader_spruce_solve_seconds_last", "gauge", QString(),
+             QString::number( Metrics::get( spruce_counts.solve_us_last ) / 1000000., 'f', 6 ) );
+
+    {
+        QMutexLocker locker( &spruce_overseer->spruce_lock );
+        const CostFunctionCache &cache = spruce_overseer->spruce->getCostFunctionCache();
+        out.add( "trader_cost_cache_hits_total", "counter", QString(), cache.getCacheHits() );
+        out.add( "trader_cost_cache_misses_total", "counter", QString(), cache.getCacheMisses() );
+    }
+
+    // how late each event loop runs its timers and replies, this one included
+    const QVector<LoopProbe*> probes = LoopWatchdog::getProbes();
+    for ( QVector<LoopProbe*>::const_iterator i = probes.constBegin(); i != probes.constEnd(); i++ )
+    {
+        const LoopProbe *probe = *i;
+        const QString labels = QString( "loop=\"%1\"" ).arg( escapeLabel( probe->getName() ) );
+        const LatencyHistogram lag = probe->getLagHistogram();
+
+        for ( size_t q = 0; q < sizeof( QUANTILES ) / sizeof( QUANTILES[ 0 ] ); q++ )
+            out.add( "trader_loop_lag_us", "gauge", labels + QString( ",quantile=\"%1\"" ).arg( QUANTILES[ q ] ),
+                     quint64( lag.getPercentile( QUANTILES[ q ] ) ) );
+
+        out.add( "trader_loop_lag_max_us", "gauge", labels, quint64( lag.getMaximum() ) );
+        out.add( "trader_loop_lag_samples_total", "counter", labels, lag.getCount() );
+        out.add( "trader_loop_stalls_total", "counter", labels, probe->getStallCount() );
+    }
+
+    out.add( "trader_resident_memory_bytes", "gauge", QString(), quint64( MemoryStats::getResidentBytes() ) );
+
+    return out.toText();
+}
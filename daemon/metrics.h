@@ -0,0 +1,63 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "global.h"
+
+#include <QTcpServer>
+#include <QByteArray>
+#include <QString>
+
+#include <atomic>
+
+class Engine;
+class SpruceOverseer;
+
+// counters bumped on the hot paths. they're relaxed atomics, so an engine never waits on a scrape and a scrape reads
+// them without taking any engine's lock
+struct EngineCounters
+{
+    std::atomic<quint64> orders_set{ 0 }; // activated on the exchange
+    std::atomic<quint64> orders_cancelled{ 0 };
+    std::atomic<quint64> fills{ 0 };
+};
+
+struct SpruceCounters
+{
+    std::atomic<quint64> solves{ 0 };
+    std::atomic<quint64> solve_us_total{ 0 };
+    std::atomic<quint64> solve_us_last{ 0 };
+    std::atomic<quint64> solves_incomplete{ 0 }; // phases stopped at the solve deadline
+};
+
+namespace Metrics
+{
+    EngineCounters &getEngineCounters( const quint8 engine_type );
+    SpruceCounters &getSpruceCounters();
+
+    inline void add( std::atomic<quint64> &counter, const quint64 n = 1 ) { counter.fetch_add( n, std::memory_order_relaxed ); }
+    inline void set( std::atomic<quint64> &counter, const quint64 n ) { counter.store( n, std::memory_order_relaxed ); }
+    inline quint64 get( const std::atomic<quint64> &counter ) { return counter.load( std::memory_order_relaxed ); }
+}
+
+//
+// MetricsServer, serves the counters above and a sample of each engine's queues, positions and latencies in the
+// prometheus text format at http://127.0.0.1:<port>/metrics
+//
+class MetricsServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    explicit MetricsServer( SpruceOverseer *_spruce_overseer, const quint16 port, QObject *parent = nullptr );
+
+public slots:
+    void handleNewConnection();
+    void handleReadyRead();
+
+private:
+    QByteArray getMetrics();
+
+    SpruceOverseer *spruce_overseer{ nullptr };
+};
+
+#endif // METRICS_H
@@ -2,6 +2,7 @@
 #define MISCTYPES_H
 
 #include "coinamount.h"
+#include "orderid.h"
 
 #include <QString>
 #include <QByteArray>
@@ -18,26 +19,34 @@ struct Request
     QString body;
     qint64 time_sent_ms{ 0 }; // track timeouts
     quint16 weight{ 0 }; // for binance, command weight
+    quint8 request_class{ 0 }; // REQUEST_CANCEL, etc, see requestqueue.h
+    Coin priority; // higher is sent first within the class
+    qint64 queue_sequence{ 0 }; // set by RequestQueue::append()
+    QString command_kind; // api_command, or its prefix for commands with arguments in them
     Position *pos{ nullptr };
+    quint32 pos_generation{ 0 }; // generation of pos when queued, positions are recycled
 };
 
-struct OrderInfo
+// one order from an open orders reply, filled straight from the reply bytes by the exchange parseOpenOrders()
+struct OrderRecord
 {
-    explicit OrderInfo( const QString &_order_number,
-                        const quint8 &_side,
-                        const QString &_price,
-                        const QString &_amount )
-    {
-        order_number = _order_number;
-        side = _side;
-        price = _price;
-        amount = _amount;
-    }
+    OrderId order_number;
+    QString market;
+    Coin price;
+    Coin amount;
+    quint8 side{ 0 };
+};
 
-    QString order_number;
-    quint8 side;
-    QString price;
-    QString amount;
+// one parsed 'setorder' line, for Engine::addPositions()
+struct PositionSpec
+{
+    QString market;
+    quint8 side{ 0 };
+    QString buy_price;
+    QString sell_price;
+    QString order_size;
+    QString type;
+    QString strategy_tag;
 };
 
 struct TickerInfo
@@ -59,27 +68,35 @@ struct TickerInfo
     bool isValid() const { return bid.isGreaterThanZero() && ask.isGreaterThanZero(); }
     Coin getMidPrice() const { return ( ask + bid ) / 2; }
 
+    // 1/bid and 1/ask for the inverse market, recalculated only when bid or ask changes
+    const Coin &getBidInverse() const { return bid_inverse.of( bid ); }
+    const Coin &getAskInverse() const { return ask_inverse.of( ask ); }
+
     Coin bid;
     Coin ask;
+
+private:
+    CoinInverse bid_inverse, ask_inverse;
 };
 
-class AvgResponseTime
+// one market of a whole exchange ticker, parsers pass these flat to Engine::processTicker()
+struct MarketTicker
 {
-public:
-    explicit AvgResponseTime()
+    explicit MarketTicker()
     {
     }
-
-    void addResponseTime( quint64 time )
+    explicit MarketTicker( const qint32 _market_id,
+                           const Coin &_bid_price,
+                           const Coin &_ask_price )
     {
-        total += time;
-        iterations++;
+        market_id = _market_id;
+        bid = _bid_price;
+        ask = _ask_price;
     }
-    quint64 avgResponseTime() const { return iterations == 0 ? 0 : total / iterations; }
 
-private:
-    quint64 total{ 0 },
-            iterations{ 0 };
+    qint32 market_id{ -1 }; // see Market::getId()
+    Coin bid;
+    Coin ask;
 };
 
 #endif // MISCTYPES_H
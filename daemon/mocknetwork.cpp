@@ -0,0 +1,228 @@
+#include "mocknetwork.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTimer>
+#include <QStringList>
+#include <QVariant>
+
+#include <algorithm>
+#include <cstring>
+
+MockNetworkReply::MockNetworkReply( QNetworkAccessManager::Operation op, const QNetworkRequest &request, const MockResponse &_response,
+                                    const qint64 latency_ms, QObject *parent )
+    : QNetworkReply( parent ),
+      response( _response )
+{
+    setOperation( op );
+    setRequest( request );
+    setUrl( request.url() );
+    open( QIODevice::ReadOnly | QIODevice::Unbuffered );
+
+    // a hung request waits for abort()
+    if ( response.status == 0 && response.error == QNetworkReply::NoError )
+        return;
+
+    QTimer::singleShot( int( latency_ms ), this, &MockNetworkReply::onFinish );
+}
+
+void MockNetworkReply::abort()
+{
+    if ( isFinished() )
+        return;
+
+    response.body.clear();
+    setError( QNetworkReply::OperationCanceledError, "Operation canceled" );
+    setFinished( true );
+    emit finished();
+}
+
+qint64 MockNetworkReply::bytesAvailable() const
+{
+    if ( !isFinished() )
+        return 0;
+
+    return response.body.size() - read_pos + QIODevice::bytesAvailable();
+}
+
+qint64 MockNetworkReply::readData( char *data, qint64 max_size )
+{
+    const qint64 size = std::min( max_size, response.body.size() - read_pos );
+    if ( size <= 0 )
+        return isFinished() ? -1 : 0;
+
+    memcpy( data, response.body.constData() + read_pos, size_t( size ) );
+    read_pos += size;
+
+    return size;
+}
+
+void MockNetworkReply::onFinish()
+{
+    // aborted while it was on its way
+    if ( isFinished() )
+        return;
+
+    if ( response.error != QNetworkReply::NoError )
+    {
+        response.body.clear();
+        setError( response.error, QString( "mock error %1" ).arg( int( response.error ) ) );
+    }
+    else
+    {
+        setAttribute( QNetworkRequest::HttpStatusCodeAttribute, response.status );
+        setHeader( QNetworkRequest::ContentLengthHeader, response.body.size() );
+
+        // the body comes with the status, like QNetworkReply::ContentNotFoundError for a 404
+        if ( response.status >= 400 )
+            setError( response.status == 404 ? QNetworkReply::ContentNotFoundError : QNetworkReply::UnknownContentError,
+                      QString( "mock status %1" ).arg( response.status ) );
+    }
+
+    setFinished( true );
+
+    if ( !response.body.isEmpty() )
+        emit readyRead();
+
+    emit finished();
+}
+
+MockNetworkAccessManager::MockNetworkAccessManager( QObject *parent )
+    : QNetworkAccessManager( parent )
+{
+}
+
+// script lines: <verb or *> <part of the url or *> <status> <latency ms> [<body>|@<file>]
+// the body is the rest of the line, or the contents of a file next to the script, like a recorded reply. status 0 never
+// answers, and 'error <number>' in place of the status fails with that QNetworkReply::NetworkError. '#' starts a comment
+bool MockNetworkAccessManager::loadScript( const QString &path )
+{
+    QFile loadfile( path );
+    if ( !loadfile.open( QIODevice::ReadOnly | QIODevice::Text ) )
+    {
+        kDebug() << "local error: couldn't open mock script" << path;
+        return false;
+    }
+
+    const QDir script_dir = QFileInfo( path ).absoluteDir();
+    const QStringList lines = QString::fromUtf8( loadfile.readAll() ).split( '\n' );
+
+    for ( QStringList::const_iterator i = lines.begin(); i != lines.end(); i++ )
+    {
+        const QString line = i->trimmed();
+        if ( line.isEmpty() || line.startsWith( '#' ) )
+            continue;
+
+        QStringList args = line.split( QChar( ' ' ), QString::SkipEmptyParts );
+
+        MockResponse response;
+        bool ok = args.size() >= 4;
+
+        if ( ok && args.at( 2 ) == "error" )
+        {
+            response.error = QNetworkReply::NetworkError( args.at( 3 ).toInt( &ok ) );
+            args.removeAt( 2 );
+        }
+        else if ( ok )
+        {
+            response.status = args.at( 2 ).toInt( &ok );
+        }
+
+        if ( ok && args.size() >= 4 )
+            response.latency_ms = args.at( 3 ).toLongLong( &ok );
+
+        if ( !ok )
+        {
+            kDebug() << "local error: bad mock script line" << line;
+            return false;
+        }
+
+        response.verb = args.at( 0 ) == "*" ? QByteArray() : args.at( 0 ).toUpper().toLatin1();
+        response.url_match = args.at( 1 ) == "*" ? QString() : args.at( 1 );
+
+        const QString body = args.mid( 4 ).join( QChar( ' ' ) );
+        if ( body.startsWith( '@' ) )
+        {
+            QFile body_file( script_dir.filePath( body.mid( 1 ) ) );
+            if ( !body_file.open( QIODevice::ReadOnly ) )
+            {
+                kDebug() << "local error: couldn't open mock body" << body_file.fileName();
+                return false;
+            }
+
+            response.body = body_file.readAll();
+        }
+        else
+        {
+            response.body = body.toUtf8();
+        }
+
+        responses += response;
+    }
+
+    return true;
+}
+
+QNetworkReply *MockNetworkAccessManager::createRequest( Operation op, const QNetworkRequest &request, QIODevice *outgoing_data )
+{
+    const QByteArray verb = op == GetOperation    ? QByteArray( "GET" ) :
+                            op == PostOperation   ? QByteArray( "POST" ) :
+                            op == PutOperation    ? QByteArray( "PUT" ) :
+                            op == DeleteOperation ? QByteArray( "DELETE" ) :
+                            op == HeadOperation   ? QByteArray( "HEAD" ) :
+                                                    request.attribute( QNetworkRequest::CustomVerbAttribute ).toByteArray();
+    const QString url = request.url().toString();
+
+    MockRequest sent;
+    sent.verb = verb;
+    sent.url = url;
+    if ( outgoing_data )
+        sent.body = outgoing_data->readAll();
+    requests += sent;
+
+    // the first response that matches and has answers left
+    MockResponse response;
+    bool found = false;
+    for ( QVector<MockResponse>::iterator i = responses.begin(); i != responses.end() && !found; i++ )
+    {
+        if ( i->remaining == 0 ||
+             ( !i->verb.isEmpty() && i->verb != verb ) ||
+             ( !i->url_match.isEmpty() && !url.contains( i->url_match ) ) )
+            continue;
+
+        if ( i->remaining > 0 )
+            i->remaining--;
+
+        response = *i;
+        found = true;
+    }
+
+    if ( !found )
+    {
+        unmatched_count++;
+        response.status = 404;
+    }
+
+    qint64 latency_ms = response.latency_ms;
+    if ( latency_jitter_ms > 0 )
+        latency_ms += getRandom() % quint32( latency_jitter_ms + 1 );
+
+    if ( failure_rate > 0. && getRandom() % 1000000 < quint32( failure_rate * 1000000 ) )
+    {
+        failed_count++;
+        response.error = failure_error;
+    }
+
+    return new MockNetworkReply( op, request, response, latency_ms, this );
+}
+
+quint32 MockNetworkAccessManager::getRandom()
+{
+    // xorshift, so the same seed gives the same run
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+
+    return random_state;
+}
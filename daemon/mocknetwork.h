@@ -0,0 +1,100 @@
+#ifndef MOCKNETWORK_H
+#define MOCKNETWORK_H
+
+#include "global.h"
+
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+// one scripted answer, the first one whose verb and url match a request answers it
+struct MockResponse
+{
+    QByteArray verb; // empty for any
+    QString url_match; // a part of the url, empty for any
+    qint32 status{ 200 }; // http status, 0 never answers until the request is aborted
+    QByteArray body;
+    qint64 latency_ms{ 0 };
+    QNetworkReply::NetworkError error{ QNetworkReply::NoError };
+    qint32 remaining{ -1 }; // how many requests it answers, -1 for all of them
+};
+
+// a request the manager saw, in the order they were sent
+struct MockRequest
+{
+    QByteArray verb;
+    QString url;
+    QByteArray body;
+};
+
+class MockNetworkReply : public QNetworkReply
+{
+    Q_OBJECT
+
+public:
+    explicit MockNetworkReply( QNetworkAccessManager::Operation op, const QNetworkRequest &request, const MockResponse &_response,
+                               const qint64 latency_ms, QObject *parent = nullptr );
+
+    void abort();
+    qint64 bytesAvailable() const;
+    bool isSequential() const { return true; }
+
+protected:
+    qint64 readData( char *data, qint64 max_size );
+
+private slots:
+    void onFinish();
+
+private:
+    MockResponse response;
+    qint64 read_pos{ 0 };
+};
+
+//
+// MockNetworkAccessManager, answers requests from scripted responses instead of the network. it goes in place of the
+// manager a BaseREST subclass is constructed with, so flow control, resends and timeouts can be run against latency,
+// errors and replies that come back out of order. the extra latency comes from a seeded generator, so a run with the
+// same script and seed sends the replies in the same order
+//
+class MockNetworkAccessManager : public QNetworkAccessManager
+{
+    Q_OBJECT
+
+public:
+    explicit MockNetworkAccessManager( QObject *parent = nullptr );
+
+    void addResponse( const MockResponse &response ) { responses += response; }
+    bool loadScript( const QString &path ); // see mocknetwork.cpp for the format
+    void clearResponses() { responses.clear(); }
+
+    // replies take up to this much longer than their latency, so they can pass each other
+    void setLatencyJitter( const qint64 ms ) { latency_jitter_ms = ms; }
+    // this share of the requests fail with the error instead of their response
+    void setFailureRate( const qreal rate, const QNetworkReply::NetworkError error = QNetworkReply::RemoteHostClosedError ) { failure_rate = rate; failure_error = error; }
+    void setSeed( const quint32 seed ) { random_state = seed != 0 ? seed : 1; }
+
+    const QVector<MockRequest> &getRequests() const { return requests; }
+    qint64 getUnmatchedCount() const { return unmatched_count; } // answered with 404
+    qint64 getFailedCount() const { return failed_count; }
+
+protected:
+    QNetworkReply *createRequest( Operation op, const QNetworkRequest &request, QIODevice *outgoing_data = nullptr );
+
+private:
+    quint32 getRandom();
+
+    QVector<MockResponse> responses;
+    QVector<MockRequest> requests;
+
+    qint64 latency_jitter_ms{ 0 };
+    qreal failure_rate{ 0. };
+    QNetworkReply::NetworkError failure_error{ QNetworkReply::RemoteHostClosedError };
+    quint32 random_state{ 1 };
+
+    qint64 unmatched_count{ 0 };
+    qint64 failed_count{ 0 };
+};
+
+#endif // MOCKNETWORK_H
@@ -0,0 +1,89 @@
+#include "mocknetwork_test.h"
+#include "mocknetwork.h"
+
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QNetworkRequest>
+#include <QTimer>
+#include <QUrl>
+
+#include <assert.h>
+
+void MockNetworkTest::test()
+{
+    MockNetworkAccessManager *nam = new MockNetworkAccessManager();
+
+    MockResponse slow;
+    slow.url_match = "/slow";
+    slow.body = "slow";
+    slow.latency_ms = 20;
+    nam->addResponse( slow );
+
+    MockResponse once;
+    once.url_match = "/once";
+    once.body = "once";
+    once.remaining = 1;
+    nam->addResponse( once );
+
+    MockResponse rejected;
+    rejected.verb = "POST";
+    rejected.url_match = "/order";
+    rejected.status = 400;
+    rejected.body = "{\"code\":-1}";
+    nam->addResponse( rejected );
+
+    MockResponse hung;
+    hung.url_match = "/hang";
+    hung.status = 0;
+    nam->addResponse( hung );
+
+    QVector<QByteArray> bodies;
+    QVector<QNetworkReply::NetworkError> errors;
+    QEventLoop loop;
+    QObject::connect( nam, &QNetworkAccessManager::finished, &loop, [&]( QNetworkReply *reply )
+    {
+        bodies += reply->read( reply->bytesAvailable() );
+        errors += reply->error();
+
+        if ( bodies.size() == 4 )
+            loop.quit();
+    } );
+
+    // the slow one goes first and comes back last, the second 'once' isn't scripted
+    nam->get( QNetworkRequest( QUrl( "https://mock/slow" ) ) );
+    nam->get( QNetworkRequest( QUrl( "https://mock/once" ) ) );
+    nam->get( QNetworkRequest( QUrl( "https://mock/once" ) ) );
+    nam->post( QNetworkRequest( QUrl( "https://mock/order" ) ), QByteArray( "a=1" ) );
+    QNetworkReply *hung_reply = nam->get( QNetworkRequest( QUrl( "https://mock/hang" ) ) );
+
+    QTimer::singleShot( 2000, &loop, &QEventLoop::quit );
+    loop.exec();
+
+    assert( bodies.size() == 4 );
+    assert( bodies.contains( "once" ) );
+    assert( bodies.contains( "{\"code\":-1}" ) );
+    assert( errors.contains( QNetworkReply::ContentNotFoundError ) );
+    assert( bodies.last() == "slow" && errors.last() == QNetworkReply::NoError );
+    assert( nam->getUnmatchedCount() == 1 );
+
+    // the requests were seen in order, with their bodies
+    assert( nam->getRequests().size() == 5 );
+    assert( nam->getRequests().at( 3 ).verb == "POST" );
+    assert( nam->getRequests().at( 3 ).body == "a=1" );
+
+    // a hung request finishes when it's aborted
+    assert( !hung_reply->isFinished() );
+    hung_reply->abort();
+    assert( bodies.size() == 5 && errors.last() == QNetworkReply::OperationCanceledError );
+
+    // every request fails
+    nam->setFailureRate( 1. );
+    QNetworkReply *failed_reply = nam->get( QNetworkRequest( QUrl( "https://mock/slow" ) ) );
+    while ( !failed_reply->isFinished() )
+        QCoreApplication::processEvents( QEventLoop::WaitForMoreEvents );
+
+    assert( failed_reply->error() == QNetworkReply::RemoteHostClosedError );
+    assert( nam->getFailedCount() == 1 );
+
+    delete nam;
+}
@@ -0,0 +1,9 @@
+#ifndef MOCKNETWORK_TEST_H
+#define MOCKNETWORK_TEST_H
+
+struct MockNetworkTest
+{
+    void test();
+};
+
+#endif // MOCKNETWORK_TEST_H
@@ -0,0 +1,162 @@
+#include "orderbook.h"
+
+#include <limits>
+
+qint64 OrderBook::getTick( const Coin &price )
+{
+    // raw subsatoshis overflow above ~922, use the string conversion there
+    qint64 raw = 0;
+    if ( price.toRawInt64( raw ) )
+        return raw / 100000000; // subsatoshis per satoshi
+
+    return Coin( price ).toIntSatoshis();
+}
+
+Coin OrderBook::getPrice( const qint64 tick )
+{
+    // same cutoff, ticks that fit in raw subsatoshis skip the string
+    static const qint64 MAX_RAW_TICK = std::numeric_limits<qint64>::max() / 100000000;
+    if ( tick <= MAX_RAW_TICK && tick >= -MAX_RAW_TICK )
+        return Coin( CoinRaw{ tick * 100000000 } );
+
+    Coin ret = Coin( QString::number( tick ) );
+    ret /= uint64_t( 100000000 );
+    return ret;
+}
+
+void OrderBook::clear()
+{
+    bids.clear();
+    asks.clear();
+    update_time = 0;
+}
+
+void OrderBook::applySnapshot( const QVector<OrderBookLevel> &_bids, const QVector<OrderBookLevel> &_asks, const qint64 time )
+{
+    bids.clear();
+    asks.clear();
+
+    for ( QVector<OrderBookLevel>::const_iterator i = _bids.begin(); i != _bids.end(); i++ )
+        setLevel( bids, i->price, i->quantity );
+
+    for ( QVector<OrderBookLevel>::const_iterator i = _asks.begin(); i != _asks.end(); i++ )
+        setLevel( asks, i->price, i->quantity );
+
+    update_time = time;
+}
+
+void OrderBook::applyUpdate( const quint8 side, const Coin &price, const Coin &quantity, const qint64 time )
+{
+    const qint64 tick = getTick( price );
+
+    // a level on one side takes out what it crossed on the other
+    if ( side == SIDE_BUY )
+    {
+        setLevel( bids, price, quantity );
+
+        if ( quantity.isGreaterThanZero() )
+            while ( !asks.isEmpty() && asks.firstKey() <= tick )
+                asks.erase( asks.begin() );
+    }
+    else
+    {
+        setLevel( asks, price, quantity );
+
+        if ( quantity.isGreaterThanZero() )
+            while ( !bids.isEmpty() && bids.lastKey() >= tick )
+                bids.erase( bids.end() -1 );
+    }
+
+    update_time = time;
+}
+
+void OrderBook::applyTop( const OrderBookLevel &bid, const OrderBookLevel &ask, const qint64 time )
+{
+    const qint64 bid_tick = getTick( bid.price );
+    const qint64 ask_tick = getTick( ask.price );
+
+    // anything better than the best prices is gone
+    while ( !bids.isEmpty() && bids.lastKey() > bid_tick )
+        bids.erase( bids.end() -1 );
+    while ( !asks.isEmpty() && asks.firstKey() < ask_tick )
+        asks.erase( asks.begin() );
+
+    applyUpdate( SIDE_BUY, bid.price, bid.quantity, time );
+    applyUpdate( SIDE_SELL, ask.price, ask.quantity, time );
+}
+
+Coin OrderBook::getBestBid() const
+{
+    return bids.isEmpty() ? Coin() : bids.last().price;
+}
+
+Coin OrderBook::getBestAsk() const
+{
+    return asks.isEmpty() ? Coin() : asks.first().price;
+}
+
+Coin OrderBook::getDepth( const quint8 side, const Coin &price ) const
+{
+    const qint64 tick = getTick( price );
+    Coin depth;
+
+    if ( side == SIDE_BUY )
+    {
+        for ( QMap<qint64, OrderBookLevel>::const_iterator i = bids.lowerBound( tick ); i != bids.end(); i++ )
+            depth += i->quantity;
+    }
+    else
+    {
+        for ( QMap<qint64, OrderBookLevel>::const_iterator i = asks.begin(); i != asks.end() && i.key() <= tick; i++ )
+            depth += i->quantity;
+    }
+
+    return depth;
+}
+
+Coin OrderBook::getPriceForQuantity( const quint8 side, const Coin &quantity ) const
+{
+    const QMap<qint64, OrderBookLevel> &levels = side == SIDE_BUY ? bids : asks;
+    Coin total;
+
+    if ( levels.isEmpty() )
+        return Coin();
+
+    // walk from the best price
+    if ( side == SIDE_BUY )
+    {
+        QMap<qint64, OrderBookLevel>::const_iterator i = levels.end();
+        do
+        {
+            i--;
+            total += i->quantity;
+
+            if ( total >= quantity )
+                return i->price;
+        }
+        while ( i != levels.begin() );
+    }
+    else
+    {
+        for ( QMap<qint64, OrderBookLevel>::const_iterator i = levels.begin(); i != levels.end(); i++ )
+        {
+            total += i->quantity;
+
+            if ( total >= quantity )
+                return i->price;
+        }
+    }
+
+    return Coin();
+}
+
+void OrderBook::setLevel( QMap<qint64, OrderBookLevel> &levels, const Coin &price, const Coin &quantity )
+{
+    if ( price.isZeroOrLess() )
+        return;
+
+    if ( quantity.isZeroOrLess() )
+        levels.remove( getTick( price ) );
+    else
+        levels.insert( getTick( price ), OrderBookLevel( price, quantity ) );
+}
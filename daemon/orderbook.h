@@ -0,0 +1,53 @@
+#ifndef ORDERBOOK_H
+#define ORDERBOOK_H
+
+#include "global.h"
+#include "coinamount.h"
+
+#include <QMap>
+#include <QVector>
+
+struct OrderBookLevel
+{
+    explicit OrderBookLevel() {}
+    explicit OrderBookLevel( const Coin &_price, const Coin &_quantity )
+        : price( _price ),
+          quantity( _quantity ) {}
+
+    Coin price;
+    Coin quantity;
+};
+
+//
+// OrderBook, the price levels of one market keyed by satoshi ticks, so lookups don't compare or reparse prices.
+// replaced by rest snapshots and kept up to date between them by wss updates
+//
+class OrderBook
+{
+public:
+    static qint64 getTick( const Coin &price ); // the price as satoshi ticks
+    static Coin getPrice( const qint64 tick ); // back from ticks
+
+    void clear();
+    void applySnapshot( const QVector<OrderBookLevel> &_bids, const QVector<OrderBookLevel> &_asks, const qint64 time );
+    void applyUpdate( const quint8 side, const Coin &price, const Coin &quantity, const qint64 time ); // zero quantity removes the level
+    void applyTop( const OrderBookLevel &bid, const OrderBookLevel &ask, const qint64 time ); // drops the levels in front of them
+
+    bool isEmpty() const { return bids.isEmpty() && asks.isEmpty(); }
+    qint32 getLevelCount( const quint8 side ) const { return side == SIDE_BUY ? bids.size() : asks.size(); }
+    qint64 getUpdateTime() const { return update_time; }
+
+    Coin getBestBid() const; // zero if that side is empty
+    Coin getBestAsk() const;
+    Coin getDepth( const quint8 side, const Coin &price ) const; // quantity on the side at the price or better
+    Coin getPriceForQuantity( const quint8 side, const Coin &quantity ) const; // the last price to take quantity from the side, zero if it's short
+
+private:
+    void setLevel( QMap<qint64, OrderBookLevel> &levels, const Coin &price, const Coin &quantity );
+
+    QMap<qint64/*tick*/, OrderBookLevel> bids; // best is last
+    QMap<qint64/*tick*/, OrderBookLevel> asks; // best is first
+    qint64 update_time{ 0 };
+};
+
+#endif // ORDERBOOK_H
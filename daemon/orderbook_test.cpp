@@ -0,0 +1,46 @@
+#include "orderbook_test.h"
+#include "orderbook.h"
+
+#include <assert.h>
+
+void OrderBookTest::test()
+{
+    OrderBook book;
+    assert( book.isEmpty() );
+    assert( book.getBestBid().isZeroOrLess() && book.getBestAsk().isZeroOrLess() );
+
+    /// test snapshot
+    book.applySnapshot( QVector<OrderBookLevel>() << OrderBookLevel( Coin( "0.00000100" ), Coin( "5" ) )
+                                                  << OrderBookLevel( Coin( "0.00000098" ), Coin( "10" ) )
+                                                  << OrderBookLevel( Coin( "0.00000099" ), Coin( "1" ) ),
+                        QVector<OrderBookLevel>() << OrderBookLevel( Coin( "0.00000103" ), Coin( "4" ) )
+                                                  << OrderBookLevel( Coin( "0.00000102" ), Coin( "2" ) ), 1 );
+
+    assert( book.getBestBid() == Coin( "0.00000100" ) );
+    assert( book.getBestAsk() == Coin( "0.00000102" ) );
+    assert( book.getLevelCount( SIDE_BUY ) == 3 && book.getLevelCount( SIDE_SELL ) == 2 );
+    assert( book.getDepth( SIDE_BUY, Coin( "0.00000099" ) ) == Coin( "6" ) );
+    assert( book.getDepth( SIDE_SELL, Coin( "0.00000103" ) ) == Coin( "6" ) );
+    assert( book.getPriceForQuantity( SIDE_BUY, Coin( "7" ) ) == Coin( "0.00000098" ) );
+    assert( book.getPriceForQuantity( SIDE_SELL, Coin( "2" ) ) == Coin( "0.00000102" ) );
+    assert( book.getPriceForQuantity( SIDE_SELL, Coin( "7" ) ).isZeroOrLess() ); // not enough depth
+
+    /// test updates
+    book.applyUpdate( SIDE_BUY, Coin( "0.00000100" ), Coin(), 2 ); // removed
+    assert( book.getBestBid() == Coin( "0.00000099" ) );
+
+    book.applyUpdate( SIDE_BUY, Coin( "0.00000102" ), Coin( "3" ), 3 ); // crosses the best ask
+    assert( book.getBestBid() == Coin( "0.00000102" ) );
+    assert( book.getBestAsk() == Coin( "0.00000103" ) );
+    assert( book.getUpdateTime() == 3 );
+
+    /// test top of book
+    book.applyTop( OrderBookLevel( Coin( "0.00000098" ), Coin( "8" ) ), OrderBookLevel( Coin( "0.00000101" ), Coin( "1" ) ), 4 );
+    assert( book.getBestBid() == Coin( "0.00000098" ) );
+    assert( book.getDepth( SIDE_BUY, Coin( "0.00000098" ) ) == Coin( "8" ) );
+    assert( book.getBestAsk() == Coin( "0.00000101" ) );
+    assert( book.getLevelCount( SIDE_SELL ) == 2 );
+
+    book.clear();
+    assert( book.isEmpty() && book.getUpdateTime() == 0 );
+}
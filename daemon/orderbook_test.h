@@ -0,0 +1,9 @@
+#ifndef ORDERBOOK_TEST_H
+#define ORDERBOOK_TEST_H
+
+struct OrderBookTest
+{
+    void test();
+};
+
+#endif // ORDERBOOK_TEST_H
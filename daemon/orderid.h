@@ -0,0 +1,90 @@
+#ifndef ORDERID_H
+#define ORDERID_H
+
+#include "global.h"
+
+#include <QString>
+#include <QByteArray>
+#include <QDebug>
+
+#include <cstring>
+
+//
+// OrderId, an exchange order id held in place. ids are ascii, waves ids are 44 characters of base58, binance ours are
+// the symbol and a number, bittrex a uuid and polo a number, so they all fit in the inline buffer and copying, comparing
+// and hashing one doesn't allocate or touch utf-16. the hash is taken once when it's set. an id that doesn't fit is kept
+// in long_id instead, so nothing is cut off
+//
+class OrderId
+{
+public:
+    static const int INLINE_SIZE = 48; // with the size, hash and long_id, 64 bytes
+
+    OrderId() {}
+    OrderId( const char *id ) { set( id, int( strlen( id ) ) ); }
+    OrderId( const QByteArray &id ) { set( id.constData(), id.size() ); }
+    OrderId( const QString &id ) { const QByteArray latin1 = id.toLatin1(); set( latin1.constData(), latin1.size() ); }
+
+    bool isEmpty() const { return length == 0; }
+    int size() const { return length; }
+    void clear() { *this = OrderId(); }
+
+    const char *constData() const { return length > INLINE_SIZE ? long_id.constData() : data; }
+    QByteArray toByteArray() const { return QByteArray( constData(), length ); }
+    QString toString() const { return QString::fromLatin1( constData(), length ); }
+    uint getHash() const { return hash; }
+
+    bool operator ==( const OrderId &other ) const
+    {
+        return hash == other.hash && length == other.length && memcmp( constData(), other.constData(), size_t( length ) ) == 0;
+    }
+    bool operator !=( const OrderId &other ) const { return !( *this == other ); }
+
+    // a total order for sorting and merging id lists, by hash first so it's usually one compare. it isn't alphabetical
+    bool operator <( const OrderId &other ) const
+    {
+        if ( hash != other.hash )
+            return hash < other.hash;
+        if ( length != other.length )
+            return length < other.length;
+
+        return memcmp( constData(), other.constData(), size_t( length ) ) < 0;
+    }
+
+private:
+    void set( const char *id, const int size )
+    {
+        length = size;
+
+        // an empty id hashes like the default one
+        if ( size == 0 )
+            return;
+
+        if ( size > INLINE_SIZE )
+            long_id = QByteArray( id, size );
+        else
+            memcpy( data, id, size_t( size ) );
+
+        // fnv-1a
+        hash = 2166136261u;
+        for ( int i = 0; i < size; i++ )
+            hash = ( hash ^ uchar( id[ i ] ) ) * 16777619u;
+    }
+
+    char data[ INLINE_SIZE ];
+    qint32 length{ 0 };
+    uint hash{ 0 };
+    QByteArray long_id; // only for ids longer than INLINE_SIZE
+};
+
+inline uint qHash( const OrderId &id, uint seed = 0 )
+{
+    return id.getHash() ^ seed;
+}
+
+inline QDebug operator <<( QDebug debug, const OrderId &id )
+{
+    return debug << id.toString();
+}
+
+#endif // ORDERID_H
@@ -0,0 +1,345 @@
+#include "orderjournal.h"
+#include "asyncsaver.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QtEndian>
+
+#include <cstring>
+
+static const qint32 FLUSH_SIZE = 64 * 1024; // hand the buffer over once it's this big
+static const qint64 FLUSH_INTERVAL_MS = 1000; // or when a record comes this long after the last flush
+static const qint32 MAX_STRING_SIZE = 255;
+
+namespace
+{
+
+QByteArray getUtf8( const QString &text )
+{
+    return text.toUtf8().left( MAX_STRING_SIZE );
+}
+
+// raw subsatoshis, or the marker with the string appended to big_values
+qint64 getRaw( const Coin &value, QByteArray &big_values )
+{
+    qint64 raw = 0;
+    if ( value.toRawInt64( raw ) && raw != ORDER_JOURNAL_BIG_VALUE )
+        return raw;
+
+    const QByteArray text = value.toSubSatoshiString().toLatin1().left( MAX_STRING_SIZE );
+    big_values += char( text.size() );
+    big_values += text;
+    return ORDER_JOURNAL_BIG_VALUE;
+}
+
+// reads a value written by getRaw(), false if its string is past the end of the payload
+bool readRaw( const uchar *p, const uchar *&big_value, const uchar *end, Coin &value )
+{
+    const qint64 raw = qFromLittleEndian<qint64>( p );
+    if ( raw != ORDER_JOURNAL_BIG_VALUE )
+    {
+        value = Coin( CoinRaw{ raw } );
+        return true;
+    }
+
+    if ( big_value >= end || big_value + 1 + big_value[ 0 ] > end )
+        return false;
+
+    value = Coin( QString::fromLatin1( reinterpret_cast<const char*>( big_value + 1 ), big_value[ 0 ] ) );
+    big_value += 1 + big_value[ 0 ];
+    return true;
+}
+
+} // namespace
+
+OrderJournal::OrderJournal( const quint8 _engine_type, AsyncSaver *_saver )
+    : saver( _saver ),
+      path( Global::getOrderJournalPath( _engine_type ) ),
+      engine_type( _engine_type )
+{
+    buffer.reserve( FLUSH_SIZE + 4096 );
+}
+
+OrderJournal::~OrderJournal()
+{
+    flush();
+}
+
+void OrderJournal::record( const OrderJournalEvent &event )
+{
+    // a new standby wasn't told our ids, what's buffered only goes to the file and the ids are named again
+    if ( replica && replica->generation.load( std::memory_order_acquire ) != replica_generation )
+    {
+        replica_generation = 0;
+        flush();
+        market_ids.clear();
+        name_ids.clear();
+        replica_generation = replica->generation.load( std::memory_order_acquire );
+    }
+
+    const qint32 market_id = getId( market_ids, ORDER_JOURNAL_MARKET, event.market, event.time );
+    const qint32 tag_id = event.strategy_tag.isEmpty() ? -1 : getId( name_ids, ORDER_JOURNAL_NAME, event.strategy_tag, event.time );
+    const qint32 fill_type_id = event.fill_type.isEmpty() ? -1 : getId( name_ids, ORDER_JOURNAL_NAME, event.fill_type, event.time );
+    const QByteArray order_id = getUtf8( event.order_id );
+
+    QByteArray big_values;
+    const qint64 price = getRaw( event.price, big_values );
+    const qint64 quantity = getRaw( event.quantity, big_values );
+    const qint64 amount = getRaw( event.amount, big_values );
+    const qint64 fee = getRaw( event.fee, big_values );
+
+    uchar *p = beginRecord( event.type, market_id, ORDER_JOURNAL_ORDER_SIZE + order_id.size() + big_values.size(), event.time );
+    p[ 0 ] = event.side;
+    p[ 1 ] = event.cancel_reason;
+    qToLittleEndian<qint32>( tag_id, p + 2 );
+    qToLittleEndian<qint32>( fill_type_id, p + 6 );
+    qToLittleEndian<qint64>( event.request_time, p + 10 );
+    qToLittleEndian<qint64>( price, p + 18 );
+    qToLittleEndian<qint64>( quantity, p + 26 );
+    qToLittleEndian<qint64>( amount, p + 34 );
+    qToLittleEndian<qint64>( fee, p + 42 );
+    p[ 50 ] = quint8( order_id.size() );
+    memcpy( p + ORDER_JOURNAL_ORDER_SIZE, order_id.constData(), size_t( order_id.size() ) );
+    memcpy( p + ORDER_JOURNAL_ORDER_SIZE + order_id.size(), big_values.constData(), size_t( big_values.size() ) );
+
+    if ( buffer.size() >= FLUSH_SIZE || event.time - last_flush_time >= FLUSH_INTERVAL_MS )
+    {
+        last_flush_time = event.time;
+        flush();
+    }
+}
+
+void OrderJournal::flush()
+{
+    if ( buffer.isEmpty() )
+        return;
+
+    // the saver appends in order on its thread, a new file gets the magic first
+    const QString journal_path = path;
+    const QByteArray data = buffer;
+    buffer.resize( 0 );
+
+    saver->save( journal_path, [journal_path, data]() { return appendRecords( journal_path, data ); } );
+
+    // the standby drops a chunk from before it connected, its ids are the last standby's
+    if ( replica && replica_generation > 0 )
+    {
+        OrderJournalReplica::Chunk chunk;
+        chunk.engine_id = replica_engine_id;
+        chunk.generation = replica_generation;
+        chunk.data = data;
+
+        QMutexLocker locker( &replica->mutex );
+        replica->pending += chunk;
+    }
+}
+
+bool OrderJournal::appendRecords( const QString &journal_path, const QByteArray &data )
+{
+    if ( QFileInfo( journal_path ).size() > 0 )
+        return AsyncSaver::appendFile( journal_path, data );
+
+    return AsyncSaver::appendFile( journal_path, QByteArray( ORDER_JOURNAL_MAGIC, ORDER_JOURNAL_MAGIC_SIZE ) + data );
+}
+
+void OrderJournal::setReplica( OrderJournalReplica *_replica, const qint32 _engine_id )
+{
+    replica = _replica;
+    replica_engine_id = _engine_id;
+    replica_generation = 0;
+}
+
+void OrderJournal::setPath( const QString &_path )
+{
+    if ( _path == path )
+        return;
+
+    // what's buffered goes to the old file, and the new one has to be told the markets and names again
+    flush();
+    path = _path;
+    market_ids.clear();
+    name_ids.clear();
+}
+
+qint32 OrderJournal::getId( QHash<QString, qint32> &ids, const quint8 type, const QString &name, const qint64 time )
+{
+    QHash<QString, qint32>::const_iterator i = ids.constFind( name );
+    if ( i != ids.constEnd() )
+        return i.value();
+
+    const qint32 id = ids.size();
+    ids.insert( name, id );
+
+    const QByteArray text = getUtf8( name );
+    uchar *p = beginRecord( type, id, text.size(), time );
+    memcpy( p, text.constData(), size_t( text.size() ) );
+
+    return id;
+}
+
+uchar *OrderJournal::beginRecord( const quint8 type, const qint32 id, const qint32 payload_size, const qint64 time )
+{
+    const qint32 start = buffer.size();
+    const qint32 record_size = ORDER_JOURNAL_HEADER_SIZE + payload_size;
+    buffer.resize( start + record_size );
+
+    uchar *p = reinterpret_cast<uchar*>( buffer.data() ) + start;
+    qToLittleEndian<quint16>( quint16( record_size ), p );
+    p[ 2 ] = type;
+    p[ 3 ] = engine_type;
+    qToLittleEndian<qint64>( time, p + 4 );
+    qToLittleEndian<qint32>( id, p + 12 );
+
+    return p + ORDER_JOURNAL_HEADER_SIZE;
+}
+
+OrderJournalReader::OrderJournalReader()
+{
+}
+
+OrderJournalReader::~OrderJournalReader()
+{
+    close();
+}
+
+bool OrderJournalReader::open( const QString &filename )
+{
+    close();
+
+    file = new QFile( filename );
+
+    if ( !file->open( QFile::ReadOnly ) ||
+         ( size = file->size() ) < ORDER_JOURNAL_MAGIC_SIZE ||
+         !( data = file->map( 0, size ) ) )
+    {
+        kDebug() << "local error: could not map order journal" << filename << file->errorString();
+        close();
+        return false;
+    }
+
+    if ( std::memcmp( data, ORDER_JOURNAL_MAGIC, ORDER_JOURNAL_MAGIC_SIZE ) != 0 )
+    {
+        kDebug() << "local error:" << filename << "is not an order journal";
+        close();
+        return false;
+    }
+
+    position = ORDER_JOURNAL_MAGIC_SIZE;
+    markets.clear();
+    names.clear();
+
+    return true;
+}
+
+void OrderJournalReader::close()
+{
+    records.clear();
+
+    if ( file )
+    {
+        if ( data )
+            file->unmap( const_cast<uchar*>( data ) );
+
+        file->close();
+
+        delete file;
+        file = nullptr;
+    }
+
+    data = nullptr;
+    size = 0;
+    position = 0;
+}
+
+void OrderJournalReader::feed( const QByteArray &_records )
+{
+    // the chunks come one after another, the names stay like a restart's would
+    if ( file )
+    {
+        close();
+        markets.clear();
+        names.clear();
+    }
+
+    records = _records;
+    data = reinterpret_cast<const uchar*>( records.constData() );
+    size = records.size();
+    position = 0;
+}
+
+QString OrderJournalReader::getSourceName() const
+{
+    return file ? file->fileName() : QString( "a replica chunk" );
+}
+
+bool OrderJournalReader::next( OrderJournalEvent &event )
+{
+    while ( data && position + ORDER_JOURNAL_HEADER_SIZE <= size )
+    {
+        const uchar *p = data + position;
+        const qint32 record_size = qFromLittleEndian<quint16>( p );
+
+        if ( record_size < ORDER_JOURNAL_HEADER_SIZE || position + record_size > size )
+        {
+            kDebug() << "local error: bad record size" << record_size << "at" << position << "in" << getSourceName();
+            return false;
+        }
+
+        position += record_size;
+
+        const uchar *payload = p + ORDER_JOURNAL_HEADER_SIZE;
+        const qint32 payload_size = record_size - ORDER_JOURNAL_HEADER_SIZE;
+        const quint8 type = p[ 2 ];
+        const qint32 id = qFromLittleEndian<qint32>( p + 12 );
+
+        if ( type == ORDER_JOURNAL_MARKET || type == ORDER_JOURNAL_NAME )
+        {
+            // a restart names its ids again, so later names replace earlier ones
+            const QString name = QString::fromUtf8( reinterpret_cast<const char*>( payload ), payload_size );
+            if ( type == ORDER_JOURNAL_MARKET )
+                markets.insert( id, name );
+            else
+                names.insert( id, name );
+
+            continue;
+        }
+
+        // a type we don't know or a short payload, skip it
+        if ( type < ORDER_JOURNAL_SET || type > ORDER_JOURNAL_CANCEL ||
+             payload_size < ORDER_JOURNAL_ORDER_SIZE ||
+             payload_size < ORDER_JOURNAL_ORDER_SIZE + payload[ 50 ] )
+            continue;
+
+        const qint32 tag_id = qFromLittleEndian<qint32>( payload + 2 );
+        const qint32 fill_type_id = qFromLittleEndian<qint32>( payload + 6 );
+
+        event = OrderJournalEvent();
+        event.type = type;
+        event.exchange = p[ 3 ];
+        event.time = qFromLittleEndian<qint64>( p + 4 );
+        event.market = markets.value( id );
+        event.side = payload[ 0 ];
+        event.cancel_reason = payload[ 1 ];
+        event.strategy_tag = tag_id < 0 ? QString() : names.value( tag_id );
+        event.fill_type = fill_type_id < 0 ? QString() : names.value( fill_type_id );
+        event.request_time = qFromLittleEndian<qint64>( payload + 10 );
+        event.order_id = QString::fromUtf8( reinterpret_cast<const char*>( payload + ORDER_JOURNAL_ORDER_SIZE ), payload[ 50 ] );
+
+        // the big values follow the order id
+        const uchar *big_value = payload + ORDER_JOURNAL_ORDER_SIZE + payload[ 50 ];
+        const uchar *end = payload + payload_size;
+        if ( !readRaw( payload + 18, big_value, end, event.price ) ||
+             !readRaw( payload + 26, big_value, end, event.quantity ) ||
+             !readRaw( payload + 34, big_value, end, event.amount ) ||
+             !readRaw( payload + 42, big_value, end, event.fee ) )
+        {
+            kDebug() << "local error: truncated value at" << position - record_size << "in" << getSourceName();
+            continue;
+        }
+
+        return true;
+    }
+
+    return false;
+}
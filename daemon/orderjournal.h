@@ -0,0 +1,133 @@
+#ifndef ORDERJOURNAL_H
+#define ORDERJOURNAL_H
+
+#include "global.h"
+#include "coinamount.h"
+
+#include <QHash>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QMutex>
+
+#include <atomic>
+#include <limits>
+
+class QFile;
+class AsyncSaver;
+
+// the journal starts with this, then records to the end of the file. it's only ever appended to, so every run names
+// its markets and strings again before it uses their ids
+static const char ORDER_JOURNAL_MAGIC[] = "TRDORD01";
+static const qint32 ORDER_JOURNAL_MAGIC_SIZE = 8;
+
+// every record is little endian: quint16 size (with this header), quint8 type, quint8 exchange, qint64 time ms,
+// qint32 id, then the payload
+static const qint32 ORDER_JOURNAL_HEADER_SIZE = 16;
+static const quint8 ORDER_JOURNAL_MARKET = 1; // id is a market id, the payload its name
+static const quint8 ORDER_JOURNAL_NAME = 2; // id is a name id for the strategy tags and fill types, the payload the name
+static const quint8 ORDER_JOURNAL_SET = 3; // id is the market id, then the order payload
+static const quint8 ORDER_JOURNAL_FILL = 4; // ^
+static const quint8 ORDER_JOURNAL_CANCEL = 5; // ^
+
+// order payload: quint8 side, quint8 cancel reason, qint32 strategy tag id, qint32 fill type id (-1 for none), qint64
+// request time ms, raw subsatoshi price, quantity, amount and fee, then quint8 order id size and the order id. raw
+// subsatoshis overflow above ~922, a value that doesn't fit is ORDER_JOURNAL_BIG_VALUE and follows the order id as a
+// quint8 size and its subsatoshi string, in field order
+static const qint32 ORDER_JOURNAL_ORDER_SIZE = 51;
+static const qint64 ORDER_JOURNAL_BIG_VALUE = std::numeric_limits<qint64>::min();
+
+// one order event, written by OrderJournal and read back by OrderJournalReader
+struct OrderJournalEvent
+{
+    quint8 type{ 0 };
+    quint8 exchange{ 0 };
+    quint8 side{ 0 };
+    quint8 cancel_reason{ 0 }; // ORDER_JOURNAL_CANCEL
+    qint64 time{ 0 };
+    qint64 request_time{ 0 }; // when the order or cancel was sent, 0 for fills
+    QString market, strategy_tag, order_id;
+    QString fill_type; // ORDER_JOURNAL_FILL
+    Coin price, quantity, amount, fee;
+};
+
+// the records also go to the standbys on the way to the file, see StandbyLink. the journals hand them over from their
+// engine threads and the link takes them on its own
+struct OrderJournalReplica
+{
+    struct Chunk
+    {
+        qint32 engine_id{ 0 };
+        qint32 generation{ 0 };
+        QByteArray data;
+    };
+
+    QMutex mutex;
+    QVector<Chunk> pending; // guarded by mutex
+    std::atomic<qint32> generation{ 0 }; // 0 without a standby, a new one bumps it so the journals name their ids again
+};
+
+//
+// OrderJournal, collects an engine's order events as records and appends them to getOrderJournalPath() on the save
+// thread about once a second, so the engine only pays for packing them
+//
+class OrderJournal
+{
+public:
+    explicit OrderJournal( const quint8 _engine_type, AsyncSaver *_saver );
+    ~OrderJournal(); // hands over what's left, the saver must still be there
+
+    void record( const OrderJournalEvent &event );
+    void flush();
+    void setPath( const QString &_path ); // for the engines after the first of a sharded exchange
+    void setReplica( OrderJournalReplica *_replica, const qint32 _engine_id ); // with the engine lock held
+
+    static bool appendRecords( const QString &journal_path, const QByteArray &data ); // on the save thread, a new file gets the magic
+
+private:
+    qint32 getId( QHash<QString, qint32> &ids, const quint8 type, const QString &name, const qint64 time ); // names new ones
+    uchar *beginRecord( const quint8 type, const qint32 id, const qint32 payload_size, const qint64 time );
+
+    AsyncSaver *saver{ nullptr };
+    QString path;
+    QByteArray buffer;
+    qint64 last_flush_time{ 0 };
+    quint8 engine_type{ 0 };
+
+    OrderJournalReplica *replica{ nullptr };
+    qint32 replica_engine_id{ 0 };
+    qint32 replica_generation{ 0 }; // of the standby that was told our ids
+
+    QHash<QString/*market*/, qint32/*id*/> market_ids;
+    QHash<QString/*tag or fill type*/, qint32/*id*/> name_ids;
+};
+
+//
+// OrderJournalReader, reads a journal through a read only mapping, or the records of a replica chunk. the market and
+// name records aren't returned by next(), they name the ids of the records after them
+//
+class OrderJournalReader
+{
+public:
+    explicit OrderJournalReader();
+    ~OrderJournalReader();
+
+    bool open( const QString &filename );
+    void close();
+    void feed( const QByteArray &records ); // a chunk's records without the magic, the ids named by the last ones are kept
+    bool next( OrderJournalEvent &event ); // false at the end or on a bad record
+
+private:
+    QString getSourceName() const;
+
+    QFile *file{ nullptr };
+    QByteArray records; // fed, instead of the file
+    const uchar *data{ nullptr };
+    qint64 size{ 0 };
+    qint64 position{ 0 };
+
+    QHash<qint32/*id*/, QString/*market*/> markets;
+    QHash<qint32/*id*/, QString/*name*/> names;
+};
+
+#endif // ORDERJOURNAL_H
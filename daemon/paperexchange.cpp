@@ -0,0 +1,153 @@
+#include "paperexchange.h"
+#include "engine.h"
+#include "enginesettings.h"
+#include "positionman.h"
+#include "position.h"
+#include "orderbook.h"
+#include "virtualclock.h"
+
+#include <QTimer>
+
+#include <algorithm>
+
+PaperExchange::PaperExchange( Engine *_engine )
+    : QObject( _engine ),
+      engine( _engine )
+{
+    kDebug() << "[PaperExchange] orders are simulated, nothing is sent to the exchange";
+
+    arrival_timer = new QTimer( this );
+    connect( arrival_timer, &QTimer::timeout, this, &PaperExchange::onArrival );
+    arrival_timer->setSingleShot( true );
+    arrival_timer->setTimerType( Qt::PreciseTimer );
+}
+
+PaperExchange::~PaperExchange()
+{
+    arrival_timer->stop();
+}
+
+void PaperExchange::sendBuySell( Position *const &pos )
+{
+    pos->order_request_time = VirtualClock::currentMSecsSinceEpoch();
+    addRequest( pos, false );
+}
+
+void PaperExchange::sendCancel( Position *const &pos )
+{
+    addRequest( pos, true );
+}
+
+void PaperExchange::processTicker( const QString &market, const TickerInfo &ticker )
+{
+    PositionMan *positions = engine->getPositionMan();
+
+    if ( ticker.bid.isZeroOrLess() || ticker.ask.isZeroOrLess() || !positions->hasActiveInMarket( market ) )
+        return;
+
+    matched.clear();
+
+    if ( engine->getSettings()->paper_fill_model == PAPER_FILL_TICKER )
+        positions->getCrossedByTicker( market, ticker.bid, ticker.ask, matched );
+    else
+        positions->getTouchedByTicker( market, ticker.bid, ticker.ask, matched );
+
+    // the book decides if there was enough there to fill us
+    if ( engine->getSettings()->paper_fill_model == PAPER_FILL_BOOK )
+    {
+        QVector<Position*>::iterator end = std::remove_if( matched.begin(), matched.end(),
+            [this]( Position *const &pos ) { return !isFilledBy( pos, engine->getMarketInfo( pos->market ).ticker ); } );
+        matched.erase( end, matched.end() );
+    }
+
+    if ( matched.isEmpty() )
+        return;
+
+    // a cancel on its way doesn't save the order, it's still on the book until the cancel gets there
+    fill_count += matched.size();
+    engine->processFilledOrders( matched, FILL_PAPER );
+}
+
+void PaperExchange::onArrival()
+{
+    QMutexLocker locker( engine->getLock() );
+
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
+    PositionMan *positions = engine->getPositionMan();
+    QVector<Position*> filled;
+
+    while ( !requests.isEmpty() && requests.head().arrival_time <= current_time )
+    {
+        const PaperRequest request = requests.dequeue();
+        Position *const &pos = request.pos;
+
+        // filled or removed while the request was on the way
+        if ( !positions->isValid( pos, request.pos_generation ) )
+            continue;
+
+        if ( request.is_cancel )
+        {
+            if ( positions->isActive( pos ) )
+                engine->processCancelledOrder( pos );
+
+            continue;
+        }
+
+        // resent after a timeout, the first one set it already
+        if ( !positions->isQueued( pos ) )
+            continue;
+
+        positions->activate( pos, QString( "paper%1" ).arg( ++order_count ) );
+
+        // priced through the spread, it takes instead of resting
+        if ( isFilledBy( pos, engine->getMarketInfo( pos->market ).ticker ) )
+            filled += pos;
+    }
+
+    if ( !filled.isEmpty() )
+    {
+        fill_count += filled.size();
+        engine->processFilledOrders( filled, FILL_PAPER );
+    }
+
+    if ( !requests.isEmpty() )
+        arrival_timer->start( int( std::max<qint64>( requests.head().arrival_time - current_time, 0 ) ) );
+}
+
+void PaperExchange::addRequest( Position *const &pos, const bool is_cancel )
+{
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
+
+    PaperRequest request;
+    request.pos = pos;
+    request.pos_generation = pos->getGeneration();
+    request.is_cancel = is_cancel;
+
+    // keep them in order if the latency was lowered
+    request.arrival_time = current_time + std::max<qint64>( engine->getSettings()->paper_latency, 0 );
+    if ( !requests.isEmpty() )
+        request.arrival_time = std::max( request.arrival_time, requests.last().arrival_time );
+
+    requests.enqueue( request );
+
+    if ( !arrival_timer->isActive() )
+        arrival_timer->start( int( request.arrival_time - current_time ) );
+}
+
+bool PaperExchange::isFilledBy( Position *const &pos, const TickerInfo &ticker ) const
+{
+    // the other side has to reach our price
+    if ( pos->side == SIDE_BUY ? ( ticker.ask.isZeroOrLess() || ticker.ask > pos->price ) :
+                                 ( ticker.bid.isZeroOrLess() || ticker.bid < pos->price ) )
+        return false;
+
+    if ( engine->getSettings()->paper_fill_model != PAPER_FILL_BOOK )
+        return true;
+
+    // without a book it's the cross model
+    const OrderBook &book = engine->getMarketInfo( pos->market ).order_book;
+    if ( book.isEmpty() )
+        return true;
+
+    return book.getDepth( pos->side == SIDE_BUY ? SIDE_SELL : SIDE_BUY, pos->price ) >= pos->quantity;
+}
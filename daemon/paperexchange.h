@@ -0,0 +1,58 @@
+#ifndef PAPEREXCHANGE_H
+#define PAPEREXCHANGE_H
+
+#include "global.h"
+#include "misctypes.h"
+
+#include <QObject>
+#include <QQueue>
+#include <QVector>
+
+class Engine;
+class Position;
+class QTimer;
+
+// an order or cancel on its way to the simulated exchange
+struct PaperRequest
+{
+    Position *pos{ nullptr };
+    quint32 pos_generation{ 0 };
+    qint64 arrival_time{ 0 };
+    bool is_cancel{ false };
+};
+
+//
+// PaperExchange, takes the place of the exchange in PAPER_TRADE builds. orders and cancels arrive after
+// paper_latency, then the resting orders are matched against the live tickers with paper_fill_model and filled
+// through Engine::processFilledOrders(). nothing is sent, the rest module only reads market data
+//
+class PaperExchange : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PaperExchange( Engine *_engine );
+    ~PaperExchange();
+
+    void sendBuySell( Position *const &pos );
+    void sendCancel( Position *const &pos );
+    void processTicker( const QString &market, const TickerInfo &ticker ); // fill what the ticker reached
+
+    qint64 getOrderCount() const { return order_count; }
+    qint64 getFillCount() const { return fill_count; }
+
+private:
+    void onArrival();
+    void addRequest( Position *const &pos, const bool is_cancel );
+    bool isFilledBy( Position *const &pos, const TickerInfo &ticker ) const;
+
+    Engine *engine{ nullptr };
+    QTimer *arrival_timer{ nullptr };
+
+    QQueue<PaperRequest> requests; // by arrival time
+    QVector<Position*> matched; // reused by processTicker()
+    qint64 order_count{ 0 };
+    qint64 fill_count{ 0 };
+};
+
+#endif // PAPEREXCHANGE_H
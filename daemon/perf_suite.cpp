@@ -0,0 +1,515 @@
+#include "global.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QProcess>
+#include <QSysInfo>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QMap>
+#include <QSet>
+
+#include <algorithm>
+
+// perf_suite: runs coinamount_bench, qbase58_bench, spruce_bench, engine_bench and ipc_bench with fixed arguments,
+// writes their results as one json document and compares it to a baseline from an earlier run on the same machine.
+// usage: ./perf_suite [--baseline <path>] [--update-baseline] [--tolerance <percent>] [--p99-tolerance <percent>]
+//                     [--runs <n>] [--output <path>] [--bin-dir <path>] [--bench <name>...]
+//
+// each bench runs --runs times (default 3) and each of its results is the median of the runs, so one noisy run
+// doesn't decide the gate. a result regresses when its ns/op or allocs/op is over the baseline's by more than the
+// tolerance (default 10%), or its p99 by more than the p99 tolerance (default 25%), a result the baseline has and the
+// run doesn't regresses too. --update-baseline writes the run over the baseline instead of comparing. the benches are
+// looked for next to perf_suite and all of them have to be built, spruce_bench replays a portfolio generated here with
+// a fixed seed. a baseline belongs to the machine it was taken on, so none is kept in the tree: run the suite once
+// without --baseline to see every bench pass, then record one with --baseline <path> --update-baseline.
+// exits 0 when nothing regressed, 1 when something did, 2 when a bench or a file couldn't be used.
+
+namespace
+{
+
+static const qint32 SUITE_VERSION = 1;
+static const qint32 BENCH_TIMEOUT = 600000; // ms for one run of one bench
+static const qint32 REPLAY_SOLVES = 200;
+static const quint32 REPLAY_SEED = 12345;
+static const qreal NS_SLACK = 0.5; // ns/op under this over the tolerance isn't a regression, for the ~1 ns ops
+static const qreal ALLOCS_SLACK = 0.05;
+
+struct Bench
+{
+    QString name;
+    QStringList args;
+};
+
+struct Options
+{
+    QString baseline_path;
+    QString output_path{ "perf_suite.json" };
+    QString bin_dir;
+    QStringList only;
+    qreal tolerance{ 10. };
+    qreal p99_tolerance{ 25. };
+    qint32 runs{ 3 };
+    bool is_update_baseline{ false };
+};
+
+static const char *const RESULT_FIELDS[] = { "ops", "ns_per_op", "p50_ns", "p99_ns", "allocs_per_op" };
+static const qint32 RESULT_FIELD_COUNT = 5;
+
+bool writeFile( const QString &path, const QByteArray &data )
+{
+    QFile file( path );
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) || file.write( data ) != data.size() )
+    {
+        kDebug() << "local error: couldn't write" << path;
+        return false;
+    }
+
+    return true;
+}
+
+bool readJson( const QString &path, QJsonObject &doc )
+{
+    QFile file( path );
+    if ( !file.open( QIODevice::ReadOnly ) )
+    {
+        kDebug() << "local error: couldn't open" << path;
+        return false;
+    }
+
+    QJsonParseError error;
+    const QJsonDocument json = QJsonDocument::fromJson( file.readAll(), &error );
+    if ( error.error != QJsonParseError::NoError || !json.isObject() )
+    {
+        kDebug() << "local error: couldn't parse" << path << error.errorString();
+        return false;
+    }
+
+    doc = json.object();
+    return true;
+}
+
+// a few currencies against btc that wander a little each solve, the same walk every run
+QByteArray getReplay()
+{
+    struct Currency { const char *name; qreal quantity, price, weight, profile_u; };
+    const Currency currencies[] = { { "LTC", 40., 0.005, 1.0, 5. },
+                                    { "ETH", 6., 0.03, 1.2, 5. },
+                                    { "XMR", 12., 0.004, 0.8, 10. },
+                                    { "DASH", 20., 0.003, 0.6, 10. },
+                                    { "DOGE", 300000., 0.0000025, 0.4, 20. },
+                                    { "ZEC", 15., 0.002, 0.5, 10. } };
+    const qint32 count = sizeof( currencies ) / sizeof( currencies[ 0 ] );
+
+    QString text;
+    QTextStream out( &text );
+    out << "setsprucebasecurrency BTC\n";
+
+    QVector<qreal> prices;
+    for ( qint32 i = 0; i < count; i++ )
+    {
+        const Currency &c = currencies[ i ];
+        out << "setspruceweight " << c.name << ' ' << QString::number( c.weight, 'f', 8 ) << '\n';
+        out << "setsprucestartnode " << c.name << ' ' << QString::number( c.quantity, 'f', 8 ) << ' '
+            << QString::number( c.price, 'f', 8 ) << '\n';
+        out << "setspruceprofile " << c.name << ' ' << QString::number( c.profile_u, 'f', 8 ) << '\n';
+        prices += c.price;
+    }
+
+    quint32 seed = REPLAY_SEED;
+    for ( qint32 t = 0; t < REPLAY_SOLVES; t++ )
+    {
+        out << "liveprices";
+        for ( qint32 i = 0; i < count; i++ )
+        {
+            seed = seed * 1103515245 + 12345;
+            const qreal step = ( qreal( ( seed >> 8 ) % 2001 ) - 1000. ) / 100000.; // within 1%
+            prices[ i ] *= 1. + step;
+            out << ' ' << currencies[ i ].name << ' ' << QString::number( prices.at( i ), 'f', 8 );
+        }
+        out << '\n';
+    }
+
+    out.flush();
+    return text.toLatin1();
+}
+
+qreal getMedian( QVector<qreal> values )
+{
+    if ( values.isEmpty() )
+        return 0.;
+
+    std::sort( values.begin(), values.end() );
+    const qint32 mid = values.size() / 2;
+    return values.size() % 2 == 1 ? values.at( mid ) : ( values.at( mid -1 ) + values.at( mid ) ) / 2;
+}
+
+// runs a bench options.runs times, returns false if any run failed
+bool runBench( const Bench &bench, const Options &options, const QTemporaryDir &tmp, QJsonArray &results )
+{
+    const QString program = QDir( options.bin_dir ).filePath( bench.name );
+    const QString json_path = tmp.filePath( bench.name + ".json" );
+
+    // the runs of each result by name, in the order the bench added them
+    QStringList names;
+    QMap<QString, QVector<QJsonObject>> runs;
+
+    for ( qint32 r = 0; r < options.runs; r++ )
+    {
+        kDebug() << QString( "perf_suite: %1 run %2/%3" ).arg( bench.name ).arg( r +1 ).arg( options.runs );
+
+        QFile::remove( json_path );
+
+        QProcess process;
+        process.setProcessChannelMode( QProcess::ForwardedChannels );
+        process.start( program, QStringList( bench.args ) << "--json" << json_path );
+
+        if ( !process.waitForStarted() )
+        {
+            kDebug() << "local error: couldn't start" << program;
+            return false;
+        }
+
+        if ( !process.waitForFinished( BENCH_TIMEOUT ) )
+        {
+            kDebug() << "local error:" << bench.name << "didn't finish in" << BENCH_TIMEOUT << "ms";
+            process.kill();
+            process.waitForFinished();
+            return false;
+        }
+
+        if ( process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0 )
+        {
+            kDebug() << "local error:" << bench.name << "exited with" << process.exitCode();
+            return false;
+        }
+
+        QJsonObject doc;
+        if ( !readJson( json_path, doc ) )
+            return false;
+
+        const QJsonArray list = doc.value( "results" ).toArray();
+        for ( QJsonArray::const_iterator i = list.begin(); i != list.end(); i++ )
+        {
+            const QJsonObject result = i->toObject();
+            const QString name = result.value( "name" ).toString();
+
+            if ( !runs.contains( name ) )
+                names += name;
+
+            runs[ name ] += result;
+        }
+    }
+
+    for ( QStringList::const_iterator i = names.begin(); i != names.end(); i++ )
+    {
+        const QVector<QJsonObject> &list = runs[ *i ];
+
+        QJsonObject result;
+        result[ "bench" ] = bench.name;
+        result[ "name" ] = *i;
+        result[ "runs" ] = list.size();
+
+        for ( qint32 f = 0; f < RESULT_FIELD_COUNT; f++ )
+        {
+            QVector<qreal> values;
+            for ( QVector<QJsonObject>::const_iterator j = list.begin(); j != list.end(); j++ )
+                values += j->value( RESULT_FIELDS[ f ] ).toDouble();
+
+            result[ RESULT_FIELDS[ f ] ] = getMedian( values );
+        }
+
+        results += result;
+    }
+
+    return true;
+}
+
+QString getKey( const QJsonObject &result )
+{
+    return result.value( "bench" ).toString() + QChar( '/' ) + result.value( "name" ).toString();
+}
+
+bool isOver( const qreal current, const qreal base, const qreal tolerance, const qreal slack )
+{
+    return current > base * ( 1. + tolerance / 100. ) + slack;
+}
+
+QString getChange( const qreal current, const qreal base )
+{
+    if ( base <= 0. )
+        return current > 0. ? QString( "new" ) : QString( "+0.0%" );
+
+    const qreal change = ( current / base - 1. ) * 100.;
+    return QString( "%1%2%" ).arg( change >= 0. ? "+" : "" ).arg( change, 0, 'f', 1 );
+}
+
+// sets each result's status against the baseline, returns the number that regressed
+qint32 compare( QJsonArray &results, const QJsonObject &baseline, const Options &options )
+{
+    QMap<QString, QJsonObject> base_results;
+    const QJsonArray base_list = baseline.value( "results" ).toArray();
+    for ( QJsonArray::const_iterator i = base_list.begin(); i != base_list.end(); i++ )
+        base_results.insert( getKey( i->toObject() ), i->toObject() );
+
+    qint32 regressions = 0;
+    QSet<QString> seen;
+
+    for ( qint32 i = 0; i < results.size(); i++ )
+    {
+        QJsonObject result = results.at( i ).toObject();
+        const QString key = getKey( result );
+        seen.insert( key );
+
+        if ( !base_results.contains( key ) )
+        {
+            result[ "status" ] = QString( "new" );
+            results[ i ] = result;
+            kDebug() << QString( "%1 new" ).arg( key, -50 );
+            continue;
+        }
+
+        const QJsonObject &base = base_results[ key ];
+        const qreal ns = result.value( "ns_per_op" ).toDouble(), base_ns = base.value( "ns_per_op" ).toDouble();
+        const qreal p99 = result.value( "p99_ns" ).toDouble(), base_p99 = base.value( "p99_ns" ).toDouble();
+        const qreal allocs = result.value( "allocs_per_op" ).toDouble(), base_allocs = base.value( "allocs_per_op" ).toDouble();
+
+        QStringList over;
+        if ( isOver( ns, base_ns, options.tolerance, NS_SLACK ) )
+            over += "ns/op";
+        if ( isOver( p99, base_p99, options.p99_tolerance, NS_SLACK ) )
+            over += "p99";
+        if ( isOver( allocs, base_allocs, options.tolerance, ALLOCS_SLACK ) )
+            over += "allocs/op";
+
+        const bool is_improved = over.isEmpty() && ns < base_ns * ( 1. - options.tolerance / 100. );
+        const QString status = !over.isEmpty() ? "regressed" : is_improved ? "improved" : "ok";
+
+        result[ "status" ] = status;
+        result[ "baseline_ns_per_op" ] = base_ns;
+        result[ "baseline_p99_ns" ] = base_p99;
+        result[ "baseline_allocs_per_op" ] = base_allocs;
+        results[ i ] = result;
+
+        if ( !over.isEmpty() )
+            regressions++;
+
+        kDebug() << QString( "%1 %2 ns/op (%3) | p99 %4 ns (%5) | %6 allocs/op (%7) | %8" )
+                    .arg( key, -50 )
+                    .arg( ns, 12, 'f', 1 )
+                    .arg( getChange( ns, base_ns ), 7 )
+                    .arg( p99, 12, 'f', 1 )
+                    .arg( getChange( p99, base_p99 ), 7 )
+                    .arg( allocs, 0, 'f', 2 )
+                    .arg( getChange( allocs, base_allocs ) )
+                    .arg( over.isEmpty() ? status : status + ": " + over.join( ", " ) );
+    }
+
+    // only the benches that ran, so --bench doesn't fail on the rest
+    QStringList ran;
+    for ( QJsonArray::const_iterator i = results.begin(); i != results.end(); i++ )
+        ran += i->toObject().value( "bench" ).toString();
+
+    for ( QMap<QString, QJsonObject>::const_iterator i = base_results.begin(); i != base_results.end(); i++ )
+    {
+        if ( seen.contains( i.key() ) || !ran.contains( i.value().value( "bench" ).toString() ) )
+            continue;
+
+        QJsonObject missing = i.value();
+        missing[ "status" ] = QString( "missing" );
+        results += missing;
+        regressions++;
+
+        kDebug() << QString( "%1 missing from this run" ).arg( i.key(), -50 );
+    }
+
+    return regressions;
+}
+
+bool parseOptions( QStringList args, Options &options )
+{
+    args.removeFirst();
+
+    while ( !args.isEmpty() )
+    {
+        const QString arg = args.takeFirst();
+
+        if ( arg == "--update-baseline" )
+        {
+            options.is_update_baseline = true;
+            continue;
+        }
+
+        if ( args.isEmpty() )
+            return false;
+
+        const QString value = args.takeFirst();
+        bool ok = true;
+
+        if ( arg == "--baseline" )
+            options.baseline_path = value;
+        else if ( arg == "--output" )
+            options.output_path = value;
+        else if ( arg == "--bin-dir" )
+            options.bin_dir = value;
+        else if ( arg == "--bench" )
+            options.only += value;
+        else if ( arg == "--tolerance" )
+            options.tolerance = value.toDouble( &ok );
+        else if ( arg == "--p99-tolerance" )
+            options.p99_tolerance = value.toDouble( &ok );
+        else if ( arg == "--runs" )
+            options.runs = value.toInt( &ok );
+        else
+            return false;
+
+        if ( !ok )
+            return false;
+    }
+
+    return options.runs > 0 && options.tolerance >= 0. && options.p99_tolerance >= 0. &&
+           ( !options.is_update_baseline || !options.baseline_path.isEmpty() );
+}
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication a( argc, argv );
+
+    Options options;
+    options.bin_dir = QCoreApplication::applicationDirPath();
+
+    if ( !parseOptions( QCoreApplication::arguments(), options ) )
+    {
+        kDebug() << "usage: perf_suite [--baseline <path>] [--update-baseline] [--tolerance <percent>] [--p99-tolerance <percent>] "
+                    "[--runs <n>] [--output <path>] [--bin-dir <path>] [--bench <name>...]";
+        return 2;
+    }
+
+    QTemporaryDir tmp;
+    if ( !tmp.isValid() )
+    {
+        kDebug() << "local error: couldn't make a temporary directory";
+        return 2;
+    }
+
+    const QString replay_path = tmp.filePath( "spruce_replay.txt" );
+    if ( !writeFile( replay_path, getReplay() ) )
+        return 2;
+
+    const QVector<Bench> benches = QVector<Bench>()
+        << Bench{ "coinamount_bench", QStringList() << "200000" }
+        << Bench{ "qbase58_bench", QStringList() << "100000" }
+        << Bench{ "spruce_bench", QStringList() << replay_path }
+        << Bench{ "engine_bench", QStringList() << "1000" << "10000" }
+        << Bench{ "ipc_bench", QStringList() << "200" << "20" };
+
+    for ( QStringList::const_iterator i = options.only.begin(); i != options.only.end(); i++ )
+    {
+        bool is_known = false;
+        for ( QVector<Bench>::const_iterator j = benches.begin(); j != benches.end(); j++ )
+            is_known |= j->name == *i;
+
+        if ( !is_known )
+        {
+            kDebug() << "local error: there's no bench named" << *i;
+            return 2;
+        }
+    }
+
+    // every bench has to be there before any runs, a half run suite can't be a baseline
+    QVector<Bench> selected;
+    QStringList missing;
+    for ( QVector<Bench>::const_iterator i = benches.begin(); i != benches.end(); i++ )
+    {
+        if ( !options.only.isEmpty() && !options.only.contains( i->name ) )
+            continue;
+
+        const QFileInfo program( QDir( options.bin_dir ).filePath( i->name ) );
+        if ( !program.isFile() || !program.isExecutable() )
+            missing += i->name;
+
+        selected += *i;
+    }
+
+    if ( !missing.isEmpty() )
+    {
+        kDebug() << "local error: built benches missing from" << options.bin_dir << ":" << missing.join( ", " );
+        return 2;
+    }
+
+    QJsonArray results;
+    for ( QVector<Bench>::const_iterator i = selected.begin(); i != selected.end(); i++ )
+    {
+        if ( !runBench( *i, options, tmp, results ) )
+            return 2;
+    }
+
+    QJsonObject doc;
+    doc[ "version" ] = SUITE_VERSION;
+    doc[ "time" ] = qreal( QDateTime::currentMSecsSinceEpoch() );
+    doc[ "host" ] = QSysInfo::machineHostName();
+    doc[ "cpu" ] = QSysInfo::currentCpuArchitecture();
+    doc[ "kernel" ] = QSysInfo::kernelVersion();
+    doc[ "runs" ] = options.runs;
+
+    qint32 regressions = 0;
+    if ( !options.baseline_path.isEmpty() && !options.is_update_baseline )
+    {
+        QJsonObject baseline;
+        if ( !readJson( options.baseline_path, baseline ) )
+            return 2;
+
+        if ( baseline.value( "version" ).toInt() != SUITE_VERSION )
+        {
+            kDebug() << "local error: baseline" << options.baseline_path << "is version" << baseline.value( "version" ).toInt()
+                     << "and this is" << SUITE_VERSION;
+            return 2;
+        }
+
+        if ( baseline.value( "host" ).toString() != QSysInfo::machineHostName() )
+            kDebug() << "local warning: baseline was taken on" << baseline.value( "host" ).toString();
+
+        regressions = compare( results, baseline, options );
+        doc[ "baseline" ] = options.baseline_path;
+        doc[ "tolerance" ] = options.tolerance;
+        doc[ "p99_tolerance" ] = options.p99_tolerance;
+        doc[ "regressions" ] = regressions;
+    }
+
+    doc[ "results" ] = results;
+
+    const QByteArray data = QJsonDocument( doc ).toJson( QJsonDocument::Indented );
+    if ( !writeFile( options.output_path, data ) )
+        return 2;
+
+    if ( options.is_update_baseline )
+    {
+        if ( !writeFile( options.baseline_path, data ) )
+            return 2;
+
+        kDebug() << "perf_suite:" << results.size() << "results written to the baseline" << options.baseline_path;
+        return 0;
+    }
+
+    if ( options.baseline_path.isEmpty() )
+    {
+        kDebug() << "perf_suite:" << results.size() << "results written to" << options.output_path << "without a baseline";
+        return 0;
+    }
+
+    kDebug() << "perf_suite:" << results.size() << "results," << regressions << "regressed over" << options.tolerance
+             << "% (p99" << options.p99_tolerance << "%), written to" << options.output_path;
+
+    return regressions > 0 ? 1 : 0;
+}
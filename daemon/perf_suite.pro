@@ -0,0 +1,17 @@
+QT       = core
+
+TARGET = perf_suite
+DESTDIR = ../
+
+MOC_DIR = ../build-tmp/perf_suite
+OBJECTS_DIR = ../build-tmp/perf_suite
+
+CONFIG += c++14 c++17
+CONFIG += RELEASE console
+
+QMAKE_CXXFLAGS_RELEASE = -Wall -O2
+
+SOURCES += perf_suite.cpp
+
+HEADERS += build-config.h \
+    global.h
@@ -1,7 +1,11 @@
 #include "polorest.h"
 #include "position.h"
 #include "positionman.h"
+#include "jsonstreamreader.h"
 #include "engine.h"
+#include "taskscheduler.h"
+#include "virtualclock.h"
+#include "tracespan.h"
 #include "enginesettings.h"
 #include "coinamount.h"
 
@@ -24,20 +28,14 @@ PoloREST::PoloREST( Engine *_engine , QNetworkAccessManager *_nam )
     connect( nam, &QNetworkAccessManager::finished, this, &PoloREST::onNamReply );
 
     exchange_string = POLONIEX_EXCHANGE_STR;
+    is_http2_supported = true;
 }
 
 PoloREST::~PoloREST()
 {
-#if !defined( POLONIEX_TICKER_ONLY )
-    fee_timer->stop();
-    wss_timer->stop();
-
-    delete fee_timer;
-    delete wss_timer;
-
+    // our tasks go with us, see TaskScheduler::addTask()
     fee_timer = nullptr;
     wss_timer = nullptr;
-#endif
 
     // dispose of websocket
     if ( wss )
@@ -65,15 +63,24 @@ void PoloREST::init()
     setupCurrencyMap( currency_name_by_id );
 
     // we use this to send the requests at a predictable rate
-    connect( send_timer, &QTimer::timeout, this, &PoloREST::sendNamQueue );
+    send_timer->setCallback( [this]() { sendNamQueue(); } );
+    send_wake_timer->setCallback( [this]() { sendNamQueue(); } );
     send_timer->start( POLONIEX_TIMER_INTERVAL_NAM_SEND ); // minimum threshold 200 or so
+    setSendRate( 1000. / POLONIEX_TIMER_INTERVAL_NAM_SEND ); // same average rate as the timer, in bursts
+
+    // open the connection now instead of on the first request
+    startConnectionWarming( getWarmUrl() );
+
+    prebuildRequestTemplates( QStringList() << BUY << SELL << POLO_COMMAND_CANCEL << POLO_COMMAND_GETORDERS
+                                            << POLO_COMMAND_GETBOOKS << POLO_COMMAND_GETBALANCES << POLO_COMMAND_GETFEE );
 
-    connect( ticker_timer, &QTimer::timeout, this, &PoloREST::onCheckTicker );
+    ticker_timer->setCallback( [this]() { onCheckTicker(); } );
     ticker_timer->start( POLONIEX_TIMER_INTERVAL_TICKER );
 
     // if we are running a ticker only build, don't set keys, don't get wss feed, and don't query books and fees
 #if !defined( POLONIEX_TICKER_ONLY )
     keystore.setKeys( POLONIEX_KEY, POLONIEX_SECRET );
+    signer.setKey( keystore.getSecret(), HmacSigner::Sha512 );
 
     // create websocket
     wss = new QWebSocket();
@@ -82,20 +89,20 @@ void PoloREST::init()
     connect( wss, &QWebSocket::textMessageReceived, this, &PoloREST::wssTextMessageReceived );
 
     // this timer requests the order book
-    connect( orderbook_timer, &QTimer::timeout, this, &PoloREST::onCheckBotOrders );
+    orderbook_timer->setCallback( [this]() { onCheckBotOrders(); } );
     orderbook_timer->start( POLONIEX_TIMER_INTERVAL_ORDERBOOK );
 
-    // this timer syncs the maker fee so we can estimate profit
-    fee_timer = new QTimer( this );
-    connect( fee_timer, &QTimer::timeout, this, &PoloREST::onCheckFee );
-    fee_timer->setTimerType( Qt::VeryCoarseTimer );
+    // this syncs the maker fee so we can estimate profit
+    fee_timer = engine->getScheduler()->addTask( this, "fee", [this]() { onCheckFee(); }, TASK_PRIORITY_HOUSEKEEPING, 0.05 );
     fee_timer->start( 60000 * 60 * 12 ); // 12 hours (TODO: find the specific time that poloniex updates it)
     onCheckFee();
 
+    // this seeds the balance ledger, then checks it against the exchange
+    balance_timer->start( BalanceLedger::RECONCILE_INTERVAL );
+    checkBalances();
+
     // check websocket frequently
-    wss_timer = new QTimer( this );
-    connect( wss_timer, &QTimer::timeout, this, &PoloREST::wssCheckConnection );
-    wss_timer->setTimerType( Qt::VeryCoarseTimer );
+    wss_timer = engine->getScheduler()->addTask( this, "wss check", [this]() { wssCheckConnection(); }, TASK_PRIORITY_HOUSEKEEPING, 0.05 );
 #endif
 
     onCheckTicker();
@@ -108,17 +115,47 @@ bool PoloREST::yieldToLag() const
     const qint64 time = QDateTime::currentMSecsSinceEpoch();
 
     // have we seen the orderbook update recently?
-    return ( orderbook_update_time != 0 &&
-             orderbook_update_time < time - ( POLONIEX_TIMER_INTERVAL_ORDERBOOK *5 ) );
+    return ( ( orderbook_update_time != 0 &&
+             orderbook_update_time < time - ( POLONIEX_TIMER_INTERVAL_ORDERBOOK *5 ) ) ||
+             isResponseTimeOver( 0.99, limit_response_time_lag ) ); // or the server is lagging badly right now
+}
+
+void PoloREST::buildRequestTemplate( const QString &api_command, RequestTemplate &t ) const
+{
+    // add content header
+    t.nam_request.setRawHeader( CONTENT_TYPE, CONTENT_TYPE_ARGS );
+
+    // the orderbook is public, everything else goes to the trade api
+    if ( api_command == POLO_COMMAND_GETBOOKS )
+    {
+        t.nam_request.setUrl( QUrl( POLO_URL_PUBLIC ) );
+        t.verb = "GET";
+        return;
+    }
+
+    t.nam_request.setUrl( QUrl( POLO_URL_TRADE ) );
+    t.verb = "POST";
+    t.is_signed = true;
+}
+
+quint8 PoloREST::getRequestClass( const QString &api_command ) const
+{
+    if ( api_command == POLO_COMMAND_CANCEL )
+        return REQUEST_CANCEL;
+    if ( api_command == BUY || api_command == SELL )
+        return REQUEST_NEW_ORDER;
+
+    return REQUEST_POLL;
 }
 
 void PoloREST::sendNamRequest( Request *const &request )
 {
     // check for valid pos
-    if ( request->pos != nullptr && !engine->getPositionMan()->isValid( request->pos ) )
+    if ( request->pos != nullptr && !engine->getPositionMan()->isValid( request->pos, request->pos_generation ) )
     {
         kDebug() << "local warning: caught nam request with invalid position";
         nam_queue.removeOne( request );
+        releaseRequest( request );
         return;
     }
 
@@ -151,18 +188,17 @@ void PoloREST::sendNamRequest( Request *const &request )
     if ( !keystore.isKeyOrSecretEmpty() )
         query.addQueryItem( NONCE, QString::number( ++request_nonce ) );
 
-    // form nam request and body
-    QNetworkRequest nam_request;
-    const QByteArray query_bytes = query.toString().toLocal8Bit();
+    const RequestTemplate &t = getRequestTemplate( api_command );
 
-    // add content header
-    nam_request.setRawHeader( CONTENT_TYPE, CONTENT_TYPE_ARGS );
+    // form nam request and body from the template
+    QNetworkRequest nam_request = t.nam_request;
+    const QByteArray query_bytes = query.toString().toLocal8Bit();
 
     // incase we have POLONIEX_TICKER_ONLY enabled, don't sign a ticker request blank
-    if ( request->api_command != POLO_COMMAND_GETBOOKS )
+    if ( t.is_signed )
     {
         nam_request.setRawHeader( KEY, keystore.getKey() ); // add key header
-        nam_request.setRawHeader( SIGN, Global::getBittrexPoloSignature( query_bytes, keystore.getSecret() ) ); // add signature header
+        nam_request.setRawHeader( SIGN, signer.signHex( query_bytes ) ); // add signature header
     }
 
     // add to sent queue so we can check if it timed out
@@ -170,13 +206,10 @@ void PoloREST::sendNamRequest( Request *const &request )
 
     QNetworkReply *reply;
     // GET
-    if ( api_command == POLO_COMMAND_GETBOOKS )
+    if ( t.verb == "GET" )
     {
         // for a GET, we need to mash our query onto the end of the url instead of going into the body
-        QString public_query = query.toString();
-        //kDebug() << public_query;
-
-        QUrl public_url( POLO_URL_PUBLIC );
+        QUrl public_url = nam_request.url();
         public_url.setQuery( query );
         nam_request.setUrl( public_url );
 
@@ -185,7 +218,6 @@ void PoloREST::sendNamRequest( Request *const &request )
     // POST
     else
     {
-        nam_request.setUrl( QUrl( POLO_URL_TRADE ) );
         reply = nam->post( nam_request, query_bytes );
     }
 
@@ -195,17 +227,14 @@ void PoloREST::sendNamRequest( Request *const &request )
         return;
     }
 
-    nam_queue_sent.insert( reply, request );
-    nam_queue.removeOne( request );
+    trackSent( reply, request );
 
     last_request_sent_ms = current_time;
 }
 
 void PoloREST::sendBuySell( Position *const &pos, bool quiet )
 {
-    if ( !quiet )
-        kDebug() << QString( "queued          %1" )
-                    .arg( pos->stringifyOrderWithoutOrderID() );
+    kLogIf( LOG_LEVEL_DEBUG, !quiet && engine->getVerbosity() > 0 ) << "queued         " << pos->logOrderWithoutOrderID();
 
     // serialize some request options into url format
     QUrlQuery query;
@@ -227,7 +256,7 @@ void PoloREST::sendCancel( const QString &order_id, Position *const &pos )
 
     if ( pos && engine->getPositionMan()->isActive( pos ) )
     {
-        pos->is_cancelling = true;
+        engine->getPositionMan()->setCancelling( pos );
 
         // set the cancel time once here, and once on send, to avoid double cancel timeouts
         pos->order_cancel_time = QDateTime::currentMSecsSinceEpoch();
@@ -291,69 +320,134 @@ void PoloREST::parseCancelOrder( Request *const &request, const QJsonObject &res
     engine->processCancelledOrder( pos );
 }
 
-void PoloREST::parseOpenOrders( const QJsonObject &markets, qint64 request_time_sent_ms )
+bool PoloREST::parseOpenOrders( const QByteArray &data, qint64 request_time_sent_ms )
 {
     const qint64 current_time = QDateTime::currentMSecsSinceEpoch(); // cache time
-    QVector<QString> order_numbers; // keep track of order numbers
-    QMultiHash<QString, OrderInfo> orders;
 
-    // is the orderbook is too old to be safe? check the stale tolerance
-    if ( request_time_sent_ms < current_time - orderbook_stale_tolerance )
-    {
-        orders_stale_trip_count++;
-        return;
-    }
-
-    // don't accept responses for requests sooner than the latest response request_time_sent_ms
-    if ( request_time_sent_ms < orderbook_update_request_time )
-        return;
+    // read { market: [ orders ], ... } in one pass, errors and blank replies go through the normal reply handling
+    JsonStreamReader reader( data );
+    if ( reader.readNext() != JsonStreamReader::StartObject )
+        return false;
 
-    // set the timestamp of orderbook update if we saw any orders
-    orderbook_update_time = current_time;
-    orderbook_update_request_time = request_time_sent_ms;
+    qint32 market_count = 0;
+    open_orders.resize( 0 ); // keeps the capacity
 
-    for ( QJsonObject::const_iterator i = markets.begin(); i != markets.end(); i++ )
+    while ( reader.readNext() == JsonStreamReader::Name )
     {
-        // the first level is arrays of orders
-        if ( !i.value().isArray() )
-            continue;
+        const QString market = reader.textString();
 
-        const QString &market = i.key();
-        const QJsonArray &exchange_orders = i.value().toArray();
+        // the first level is arrays of orders, anything else is an error reply
+        if ( reader.readNext() != JsonStreamReader::StartArray )
+            return false;
+
+        market_count++;
 
-        for ( int j = 0; j < exchange_orders.size(); ++j )
+        while ( reader.readNext() != JsonStreamReader::EndArray )
         {
             // the second level is arrays of objects
-            if ( !exchange_orders[j].isObject() )
+            if ( reader.tokenType() != JsonStreamReader::StartObject )
+            {
+                if ( !reader.skipCurrentValue() )
+                    return false;
+
                 continue;
+            }
 
-            const QJsonObject &order = exchange_orders[j].toObject();
-            const QString &order_number = order.value( "orderNumber" ).toString();
-            const QString &side = order.value( "type" ).toString();
-            const QString &price = Coin( order.value( "rate" ).toString() ); // reformat into padded
-            const QString &amount = Coin( order.value( "total" ).toString() ); // reformat into padded
+            QString order_number;
+            quint8 side = 0;
+            Coin price, amount;
+
+            while ( reader.readNext() == JsonStreamReader::Name )
+            {
+                if ( reader.isText( "orderNumber" ) )
+                {
+                    reader.readScalar();
+                    order_number = reader.textString();
+                }
+                else if ( reader.isText( "type" ) )
+                {
+                    reader.readScalar();
+                    side = reader.isText( "buy" ) ? SIDE_BUY :
+                           reader.isText( "sell" ) ? SIDE_SELL : 0;
+                }
+                else if ( reader.isText( "rate" ) )
+                {
+                    reader.readScalar();
+                    price = reader.toCoin();
+                }
+                else if ( reader.isText( "total" ) )
+                {
+                    reader.readScalar();
+                    amount = reader.toCoin();
+                }
+                else if ( !reader.skipValue() )
+                {
+                    return false;
+                }
+            }
+
+            if ( reader.tokenType() != JsonStreamReader::EndObject )
+                return false;
 
             // check for missing information
             if ( market.isEmpty() ||
                  order_number.isEmpty() ||
-                 side.isEmpty() ||
-                 price.isEmpty() ||
-                 amount.isEmpty() )
+                 side == 0 ||
+                 price.isZeroOrLess() ||
+                 amount.isZeroOrLess() )
                 continue;
 
-            // insert into seen orders
-            order_numbers.append( order_number );
-
-            // insert (market, order)
-            orders.insert( market, OrderInfo( order_number, side == BUY ? SIDE_BUY : side == SELL ? SIDE_SELL : 0, price, amount ) );
+            open_orders.append( OrderRecord() );
+            OrderRecord &order = open_orders.last();
+            order.order_number = order_number;
+            order.market = market;
+            order.side = side;
+            order.price = price;
+            order.amount = amount;
         }
     }
 
-    engine->processOpenOrders( order_numbers, orders, request_time_sent_ms );
+    if ( reader.tokenType() != JsonStreamReader::EndObject ||
+         reader.readNext() != JsonStreamReader::EndDocument ||
+         market_count == 0 )
+        return false;
+
+    // is the orderbook is too old to be safe? check the stale tolerance
+    if ( request_time_sent_ms < current_time - orderbook_stale_tolerance )
+    {
+        orders_stale_trip_count++;
+        return true;
+    }
+
+    // don't accept responses for requests sooner than the latest response request_time_sent_ms
+    if ( request_time_sent_ms < orderbook_update_request_time )
+        return true;
+
+    // set the timestamp of orderbook update if we saw any orders
+    orderbook_update_time = current_time;
+    orderbook_update_request_time = request_time_sent_ms;
+
+    engine->processOpenOrders( open_orders, request_time_sent_ms );
+
+    // replay the account feed on top of it, after the caller is done with the reply buffer
+    if ( wss_1000_resync.isBuffering() )
+        QTimer::singleShot( 0, this, [this, request_time_sent_ms]() { wssFinishResync( request_time_sent_ms ); } );
+
+    return true;
+}
+
+void PoloREST::checkBalances( bool print )
+{
+    is_printing_balances = is_printing_balances || print;
+    sendRequest( POLO_COMMAND_GETBALANCES );
 }
 
 void PoloREST::parseReturnBalances( const QJsonObject &balances )
-{ // prints exchange balances
+{ // reconciles the ledger, and prints exchange balances for getbalances
+    const bool print = is_printing_balances;
+    is_printing_balances = false;
+
+    QMap<QString, BalanceLedger::Balance> polled;
     Coin total_btc_value;
 
     for ( QJsonObject::const_iterator i = balances.begin(); i != balances.end(); i++ )
@@ -373,6 +467,13 @@ void PoloREST::parseReturnBalances( const QJsonObject &balances )
         if ( total.isZeroOrLess() )
             continue;
 
+        BalanceLedger::Balance &ledger_balance = polled[ currency ];
+        ledger_balance.total = total;
+        ledger_balance.held = onOrders;
+
+        if ( !print )
+            continue;
+
         QString out = QString( "%1 TOTAL: %2 AVAIL: %3 ORDER: %4 BTC_VAL: %5" )
                        .arg( currency, -8 )
                        .arg( total, -20 )
@@ -385,7 +486,10 @@ void PoloREST::parseReturnBalances( const QJsonObject &balances )
         kDebug() << out;
     }
 
-    kDebug() << "total btc value:" << total_btc_value;
+    engine->getLedger().reconcile( polled, VirtualClock::currentMSecsSinceEpoch() );
+
+    if ( print )
+        kDebug() << "total btc value:" << total_btc_value;
 }
 
 void PoloREST::parseFeeInfo( const QJsonObject &info )
@@ -460,6 +564,9 @@ void PoloREST::parseOrderBook( const QJsonObject &info, qint64 request_time_sent
         const QJsonArray &bids = market_obj[ "bids" ].toArray();
 
         Coin hi_buy, lo_sell = CoinAmount::A_LOT;
+        QVector<OrderBookLevel> ask_levels, bid_levels;
+        ask_levels.reserve( asks.size() );
+        bid_levels.reserve( bids.size() );
 
         // walk asks
         for ( QJsonArray::const_iterator j = asks.begin(); j != asks.end(); j++ )
@@ -468,10 +575,12 @@ void PoloREST::parseOrderBook( const QJsonObject &info, qint64 request_time_sent
                 continue;
 
             const QJsonArray asks_current = (*j).toArray();
-            const Coin price = asks_current.at( 0 ).toString();
+            const Coin price = Coin::fromAscii( asks_current.at( 0 ).toString() );
 
             if ( price < lo_sell )
                 lo_sell = price;
+
+            ask_levels += OrderBookLevel( price, Coin( asks_current.at( 1 ).toDouble() ) ); // quantity is second item
         }
 
         // walk bids
@@ -481,12 +590,18 @@ void PoloREST::parseOrderBook( const QJsonObject &info, qint64 request_time_sent
                 continue;
 
             const QJsonArray bids_current = (*j).toArray();
-            const Coin price = bids_current.at( 0 ).toString(); // price is first item
+            const Coin price = Coin::fromAscii( bids_current.at( 0 ).toString() ); // price is first item
 
             if ( price > hi_buy )
                 hi_buy = price;
+
+            bid_levels += OrderBookLevel( price, Coin( bids_current.at( 1 ).toDouble() ) );
         }
 
+        // keep the levels for depth lookups
+        if ( market.size() > 0 )
+            engine->getMarketInfo( market ).order_book.applySnapshot( bid_levels, ask_levels, request_time_sent_ms );
+
 //        kDebug() << market << "highest buy:" << toSatoshiFormat( hi_buy );
 //        kDebug() << market << "lowest sell:" << toSatoshiFormat( lo_sell );
 
@@ -504,85 +619,34 @@ void PoloREST::parseOrderBook( const QJsonObject &info, qint64 request_time_sent
 
 void PoloREST::sendNamQueue()
 {
+    QMutexLocker locker( engine->getLock() );
+
     // check for requests
     if ( nam_queue.isEmpty() )
         return;
 
-    // stop sending commands if server is unresponsive
-    if ( yieldToServer() )
-        return;
-
     const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
 
     // we got a throttle error so wait until the throttle time
     if ( current_time < poloniex_throttle_time )
-        return;
-
-    QMultiMap<Coin/*weight*/,Request*> sorted_nam_queue;
-
-    // insert into auto sorted map sorted by weight
-    for ( QQueue<Request*>::const_iterator i = nam_queue.begin(); i != nam_queue.end(); i++ )
     {
-        Request *const &request = *i;
-        Position *const &pos = request->pos;
-
-        // check for valid pos
-        if ( !pos || !engine->getPositionMan()->isValid( pos ) )
-        {
-            sorted_nam_queue.insert( Coin(), request );
-            continue;
-        }
-
-        // check for cancel
-        if ( request->api_command == POLO_COMMAND_CANCEL &&
-             engine->getPositionMan()->getMarketOrderTotal( pos->market ) >= market_cancel_thresh )
-        {
-            // expedite the cancel
-            sorted_nam_queue.insert( CoinAmount::COIN, request );
-            continue;
-        }
-
-        if ( request->api_command == POLO_COMMAND_GETBOOKS ||
-             request->api_command == POLO_COMMAND_GETORDERS )
-        {
-            sorted_nam_queue.insert( Coin(), request );
-            continue;
-        }
-
-        // new hi/lo buy or sell, we should value this at 0 because it's not a reactive order
-        if ( pos->is_new_hilo_order )
-        {
-            sorted_nam_queue.insert( Coin(), request );
-            continue;
-        }
-
-        // check for not buy/sell command
-        if ( request->api_command != BUY &&
-             request->api_command != SELL )
-        {
-            sorted_nam_queue.insert( Coin(), request );
-            continue;
-        }
-
-        sorted_nam_queue.insert( pos->per_trade_profit, request );
+        wakeSendQueue( poloniex_throttle_time - current_time );
+        return;
     }
 
-    // go through orders, ranked from highest weight to lowest
-    for ( QMultiMap<Coin,Request*>::const_iterator i = sorted_nam_queue.end() -1; i != sorted_nam_queue.begin() -1; i-- )
+    // send as many requests as the rate limit allows
+    while ( !nam_queue.isEmpty() && !yieldToServer() )
     {
-        Request *const &request = i.value();
-
         // check if we received the orderbook in the timeframe of an order timeout grace period
-        // if it's stale, we can assume the server is down and we let the orders timeout
-        if ( yieldToLag() && request->api_command != POLO_COMMAND_GETORDERS )
-        {
-            // let this request hang around until the orderbook is responded to
-            continue;
-        }
+        // if it's stale, we can assume the server is down and we let the orders timeout, except for the open orders
+        Request *request = getNextRequest( yieldToLag() ? QString( POLO_COMMAND_GETORDERS ) : QString() );
+
+        // let the rest hang around until the orderbook is responded to, or until we have tokens
+        if ( !request || !takeSendTokens() )
+            return;
 
         sendNamRequest( request );
         // the request is added to sent_nam_queue and thus not deleted until the response is met
-        return;
     }
 }
 
@@ -597,11 +661,15 @@ void PoloREST::checkBotOrders( bool ignore_flow_control )
 
 void PoloREST::onCheckBotOrders()
 {
+    QMutexLocker locker( engine->getLock() );
+
     checkBotOrders();
 }
 
 void PoloREST::onCheckTicker()
 {
+    QMutexLocker locker( engine->getLock() );
+
     if ( isCommandQueued( POLO_COMMAND_GETBOOKS ) || isCommandSent( POLO_COMMAND_GETBOOKS, 10 ) )
         return;
 
@@ -610,24 +678,42 @@ void PoloREST::onCheckTicker()
 
 void PoloREST::onCheckFee()
 {
+    QMutexLocker locker( engine->getLock() );
+
     sendRequest( POLO_COMMAND_GETFEE );
 }
 
 void PoloREST::onNamReply( QNetworkReply *const &reply )
 {
+    TRACE_SPAN( "onNamReply" );
+    QMutexLocker locker( engine->getLock() );
+
     // don't process a reply we aren't tracking
     if ( !nam_queue_sent.contains( reply ) )
         return;
 
-    QByteArray data = reply->readAll();
+    QByteArray data = readReply( reply ); // shares reply_buffer, only error paths write to it
     //kDebug() << data;
 
     // reference the object we made during the request
-    Request *const &request = nam_queue_sent.take( reply );
+    Request *const &request = takeSent( reply );
     const QString &api_command = request->api_command;
-    const qint64 response_time = QDateTime::currentMSecsSinceEpoch() - request->time_sent_ms;
 
-    avg_response_time.addResponseTime( response_time );
+    // positions are recycled, forget ours if it was released and reused while the request was out
+    if ( request->pos != nullptr && request->pos->getGeneration() != request->pos_generation )
+        request->pos = nullptr;
+    const qint64 received_time = QDateTime::currentMSecsSinceEpoch();
+    const qint64 response_time = received_time - request->time_sent_ms;
+
+    response_times.add( api_command, response_time );
+    recordReply( reply, request, received_time );
+
+    // open orders are read straight from the bytes, without building a document
+    if ( api_command == POLO_COMMAND_GETORDERS && parseOpenOrders( data, request->time_sent_ms ) )
+    {
+        deleteReply( reply, request );
+        return;
+    }
 
     //kDebug() << "got reply for" << api_command;
 
@@ -858,7 +944,8 @@ void PoloREST::onNamReply( QNetworkReply *const &reply )
 
     if ( api_command == POLO_COMMAND_GETORDERS )
     {
-        parseOpenOrders( body_obj, request->time_sent_ms );
+        // parseOpenOrders() couldn't read it, don't take it for a blank orderbook
+        kDebug() << "local warning: unexpected open orders reply:" << data;
     }
     else if ( api_command == POLO_COMMAND_GETBOOKS )
     {
@@ -892,11 +979,15 @@ void PoloREST::onNamReply( QNetworkReply *const &reply )
 
 void PoloREST::wssConnected()
 {
+    QMutexLocker locker( engine->getLock() );
+
     wssSendSubscriptions();
 }
 
 void PoloREST::wssSendSubscriptions()
 {
+    QMutexLocker locker( engine->getLock() );
+
     const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
 
     // subscribe to account feed
@@ -904,7 +995,7 @@ void PoloREST::wssSendSubscriptions()
          wss_1000_subscribe_try_time < current_time - 30000 )
     {
         const QString nonce_payload = QString( "nonce=%1" ).arg( ++request_nonce );
-        const QString sign = Global::getBittrexPoloSignature( nonce_payload.toUtf8(), keystore.getSecret() );
+        const QString sign = signer.signHex( nonce_payload.toUtf8() );
 
         const QJsonObject subscribe_account_notifications
         {
@@ -948,6 +1039,31 @@ void PoloREST::wssSendJsonObj( const QJsonObject &obj )
     wss->sendTextMessage( data_str );
 }
 
+void PoloREST::wssBeginResync()
+{
+    if ( !wss_1000_resync.begin( QDateTime::currentMSecsSinceEpoch() ) )
+        return;
+
+    kDebug() << "(wss) resyncing account feed";
+
+    // the snapshot, whatever the flow control says
+    checkBotOrders( true );
+}
+
+void PoloREST::wssFinishResync( const qint64 snapshot_time )
+{
+    QMutexLocker locker( engine->getLock() );
+
+    QVector<QString> replay;
+    if ( !wss_1000_resync.finish( snapshot_time, replay ) )
+        return;
+
+    kDebug() << "(wss) account feed resynced, replaying" << replay.size() << "updates";
+
+    for ( QVector<QString>::const_iterator i = replay.begin(); i != replay.end(); i++ )
+        wssTextMessageReceived( *i );
+}
+
 void PoloREST::setupCurrencyMap( QMap<qint32, QString> &m )
 {
     // dumped from https://poloniex.com/support/api/
@@ -1058,6 +1174,8 @@ void PoloREST::setupCurrencyMap( QMap<qint32, QString> &m )
 
 void PoloREST::wssCheckConnection()
 {
+    QMutexLocker locker( engine->getLock() );
+
     if ( !wss )
         return;
 
@@ -1078,6 +1196,7 @@ void PoloREST::wssCheckConnection()
         wss_1002_state = false;
         wss_1000_subscribe_try_time = 0;
         wss_1002_subscribe_try_time = 0;
+        wss_1000_resync.cancel();
 
         wss->abort();
         wss->open( QUrl( POLO_URL_WSS ) );
@@ -1086,6 +1205,13 @@ void PoloREST::wssCheckConnection()
     {
         // if we are connected, make sure feeds are active
         wssSendSubscriptions();
+
+        // the resync snapshot didn't make it, ask again
+        if ( wss_1000_resync.isSnapshotLate( current_time ) )
+        {
+            wss_1000_resync.setSnapshotRequested( current_time );
+            checkBotOrders( true );
+        }
     }
 
     const bool wss_account_feed_is_up_to_date = wss_account_feed_update_time > current_time - wss_timeout;
@@ -1112,24 +1238,21 @@ void PoloREST::wssCheckConnection()
 
 void PoloREST::wssTextMessageReceived( const QString &msg )
 {
-    static QJsonDocument doc;
-    doc = QJsonDocument::fromJson( msg.toLocal8Bit() );
+    QMutexLocker locker( engine->getLock() );
 
     //kDebug() << "wss in:" << msg;
 
+    // the messages are fixed arrays, read them straight from the bytes without a document
+    // [1002,null,[179,"0.44761404","0.44971726","0.44761404","-0.01142671","363.24909103","820.07867271",0,"0.45800334","0.42984444"]]
+    const QByteArray data = readMessage( msg ); // shares reply_buffer
+    JsonStreamReader reader( data );
+
     // check for array
-    if ( !doc.isArray() )
+    if ( reader.readNext() != JsonStreamReader::StartArray )
         return;
 
-    // parse the outer array
-    // [1002,null,[179,0.44761404,0.44971726,0.44761404,-0.01142671,363.24909103,820.07867271,0,0.45800334,0.42984444]])
-    static QJsonArray arr;
-    arr = doc.array();
-
-    const qint32 message_type = arr.at( 0 ).toVariant().toInt(); // occasionally, this is a string
-    //message_type = message_type > 0 ? message_type : arr.at( 0 ).toString().toInt();
-
-    const qint32 status = arr.at( 1 ).toInt();
+    reader.readNext();
+    const qint32 message_type = qint32( reader.toULongLong() ); // occasionally, this is a string
 
     // update heartbeat time for any message
     const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
@@ -1143,12 +1266,17 @@ void PoloREST::wssTextMessageReceived( const QString &msg )
     if ( message_type == 1010 )
         return;
 
-    //kDebug() << message_type <<  arr.at( 1 ).toInt() ;
+    // status is null or "" for data messages
+    reader.readNext();
+    const qint32 status = reader.tokenType() == JsonStreamReader::Number ? qint32( reader.toULongLong() ) : 0;
 
     if ( message_type == 1000 && status > 0 )
     {
         kDebug() << "(wss) 1000 account feed active";
         wss_1000_state = true;
+
+        // the fills we missed while it was down come from the snapshot
+        wssBeginResync();
         return;
     }
 
@@ -1159,82 +1287,117 @@ void PoloREST::wssTextMessageReceived( const QString &msg )
         return;
     }
 
+    const bool has_data = status == 0 && reader.readNext() == JsonStreamReader::StartArray;
+
     // check for account info data
-    if ( message_type == 1000 && arr.at( 2 ).isArray() )
+    if ( message_type == 1000 && has_data )
     {
         //kDebug() << "wss-1000 in:" << msg;
 
+        // hold it until the snapshot is applied
+        if ( wss_1000_resync.add( current_time, msg ) )
+            return;
+
         QVector<Position*> filled_orders;
-        const QJsonArray &updates = arr.at( 2 ).toArray();
+        const qint32 updates_depth = reader.depth();
 
-        for ( QJsonArray::const_iterator i = updates.begin(); i != updates.end(); i++ )
+        // [["o",<order id>,"<amount>"],["b",...]]
+        while ( reader.readNext() != JsonStreamReader::EndArray && !reader.atEnd() )
         {
-            //kDebug() << (*i);
-            if ( !(*i).isArray() )
+            if ( reader.tokenType() != JsonStreamReader::StartArray )
+            {
+                reader.skipCurrentValue();
                 continue;
+            }
 
-            const QJsonArray &info = (*i).toArray();
+            const qint32 info_depth = reader.depth();
 
-            // look for order fill
-            if ( info.at( 0 ).toString() == "o" &&
-                 info.at( 2 ).toString() == "0.00000000" )
+            // look for order fill, read the first three fields of the update
+            bool is_order_update = false, is_order_gone = false;
+            QString order_id;
+
+            for ( qint32 field = 0; field < 3; field++ )
             {
-                const QString &order_id = info.at( 1 ).toVariant().toString();
+                reader.readNext();
+
+                // the update ended early or the field isn't a scalar
+                if ( reader.depth() != info_depth )
+                    break;
+
+                if ( field == 0 )
+                    is_order_update = reader.isText( "o" );
+                else if ( field == 1 )
+                    order_id = reader.textString();
+                else
+                    is_order_gone = reader.tokenType() == JsonStreamReader::String && reader.isText( "0.00000000" );
+            }
 
-                //kDebug() << "order filled or cancelled:" << order_id;
+            // skip the rest of the update
+            if ( reader.depth() >= info_depth && !reader.skipToEndOf( info_depth ) )
+                break;
 
-                // make sure order number is valid
-                if ( order_id.isEmpty() )
-                    continue;
+            if ( !is_order_update || !is_order_gone )
+                continue;
 
-                Position *const &pos = engine->getPositionMan()->getByOrderID( order_id );
+            //kDebug() << "order filled or cancelled:" << order_id;
 
-                // make sure pos is valid
-                if ( !pos )
-                    continue;
+            // make sure order number is valid
+            if ( order_id.isEmpty() )
+                continue;
 
-                if ( pos->is_cancelling )
-                    continue;
+            Position *const &pos = engine->getPositionMan()->getByOrderID( order_id );
 
-                // add order ids to process
-                filled_orders += pos;
-            }
+            // make sure pos is valid
+            if ( !pos )
+                continue;
+
+            if ( pos->is_cancelling )
+                continue;
+
+            // add order ids to process
+            filled_orders += pos;
         }
 
-        // process the orders
+        // process the orders, even the ones we read before a bad update
         engine->processFilledOrders( filled_orders, FILL_WSS );
 
+        if ( reader.depth() >= updates_depth )
+            kDebug() << "local warning: couldn't read wss account update:" << msg;
+
         return;
     }
 
     // check for non-ticker message
-    if ( message_type == 1002 && arr.at( 2 ).isArray() )
+    if ( message_type == 1002 && has_data )
     {
-        // parse the inner array
-        const QJsonArray &data = arr.at( 2 ).toArray();
-
         // data format from polo documentation:
         // [ <currency pair id>, "<last trade price>", "<lowest ask>", "<highest bid>",
         // "<percent change in last 24 hours>", "<base currency volume in last 24 hours>",
         // "<quote currency volume in last 24 hours>", <is frozen>, "<highest trade price in last 24 hours>",
         // "<lowest trade price in last 24 hours>" ]
+        reader.readNext();
+        const qint32 currency_pair = qint32( reader.toULongLong() );
+        reader.readNext(); // last trade price
+        reader.readNext();
+        const Coin ask = reader.toCoin();
+        reader.readNext();
+        const Coin bid = reader.toCoin();
 
-        //kDebug() << "bid_str:" << data.at( 3 ).toString() << "ask_str:" << data.at( 2 ).toString();
+        //kDebug() << bid << ask;
 
-        const qint32 currency_pair = data.at( 0 ).toInt();
-        const QString &market = currency_name_by_id.value( currency_pair );
-        const Coin ask = data.at( 2 ).toString();
-        const Coin bid = data.at( 3 ).toString();
+        if ( reader.hasError() )
+        {
+            kDebug() << "local warning: couldn't read wss ticker:" << msg;
+            return;
+        }
 
-        //kDebug() << bid << ask;
+        const QString &market = currency_name_by_id.value( currency_pair );
 
         if ( market.size() > 0 &&
              bid.isGreaterThanZero() &&
              ask.isGreaterThanZero() )
         {
-            QMap<QString, TickerInfo> ticker_info;
-            ticker_info.insert( market, TickerInfo( bid, ask ) );
-            engine->processTicker( this, ticker_info );
+            engine->processTicker( this, market, TickerInfo( bid, ask ) );
         }
         return;
     }
@@ -10,6 +10,7 @@
 #include "position.h"
 #include "keystore.h"
 #include "baserest.h"
+#include "streamresync.h"
 
 
 class QNetworkReply;
@@ -27,21 +28,27 @@ public:
     ~PoloREST();
 
     void init();
+    QString getWarmUrl() const { return POLO_URL_TRADE; }
+    void checkBalances( bool print = false );
 
     bool yieldToLag() const;
 
     void sendNamRequest( Request *const &request );
+    void buildRequestTemplate( const QString &api_command, RequestTemplate &t ) const;
+    quint8 getRequestClass( const QString &api_command ) const;
     void sendBuySell( Position *const &pos, bool quiet = true );
     void sendCancel( const QString &order_id, Position *const &pos = nullptr );
 
     void parseBuySell( Request *const &request, const QJsonObject &response );
     void parseCancelOrder( Request *const &request, const QJsonObject &response );
-    void parseOpenOrders( const QJsonObject &markets, qint64 request_time_sent_ms );
+    bool parseOpenOrders( const QByteArray &data, qint64 request_time_sent_ms ); // false if it isn't an orders reply
     void parseReturnBalances( const QJsonObject &balances );
     void parseFeeInfo( const QJsonObject &info );
     void parseOrderBook( const QJsonObject &info, qint64 request_time_sent_ms );
 
     void wssSendJsonObj( const QJsonObject &obj );
+    void wssBeginResync(); // the account feed is back, buffer it until an open orders snapshot is applied
+    void wssFinishResync( const qint64 snapshot_time );
     void setupCurrencyMap( QMap<qint32, QString> &m );
 
     bool getWSS1000State() const { return wss_1000_state; }
@@ -78,10 +85,12 @@ private:
            wss_1002_subscribe_try_time{ 0 },
            wss_account_feed_update_time{ 0 };
 
+    StreamResync wss_1000_resync;
+
     qint64 poloniex_throttle_time{ 0 }; // when we should wait until to sent the next request
 
-    QTimer *fee_timer{ nullptr };
-    QTimer *wss_timer{ nullptr };
+    ScheduledTask *fee_timer{ nullptr };
+    ScheduledTask *wss_timer{ nullptr };
     QWebSocket *wss{ nullptr };
 };
 
@@ -12,25 +12,61 @@ Position::Position( QString _market, quint8 _side, QString _buy_price, QString _
                     QString _order_size, QString _strategy_tag, QVector<qint32> _market_indices,
                     bool _landmark, Engine *_engine )
 {
+    init( _market, _side, _buy_price, _sell_price, _order_size, _strategy_tag, _market_indices, _landmark, _engine );
+}
+
+Position::Position( const Market &_market, quint8 _side, const Coin &_buy_price, const Coin &_sell_price,
+                    const Coin &_order_size, const QString &_strategy_tag, const QVector<qint32> &_market_indices,
+                    bool _landmark, Engine *_engine )
+{
+    init( _market, _side, _buy_price, _sell_price, _order_size, _strategy_tag, _market_indices, _landmark, _engine );
+}
+
+void Position::init( const QString &_market, quint8 _side, const QString &_buy_price, const QString &_sell_price,
+                     const QString &_order_size, const QString &_strategy_tag, const QVector<qint32> &_market_indices,
+                     bool _landmark, Engine *_engine )
+{
+    init( Market( _market ), _side, Coin( _buy_price ), Coin( _sell_price ), Coin( _order_size ), _strategy_tag, _market_indices,
+          _landmark, _engine );
+}
+
+void Position::init( const Market &_market, quint8 _side, const Coin &_buy_price, const Coin &_sell_price,
+                     const Coin &_order_size, const QString &_strategy_tag, const QVector<qint32> &_market_indices,
+                     bool _landmark, Engine *_engine )
+{
+    // reset values that a recycled position might still carry. coins are assigned to keep their storage
+    order_number.clear();
+    indices_str.clear();
+    quantity = Coin();
+    price = Coin();
+    amount = Coin();
+    per_trade_profit = Coin();
+    profit_margin = Coin();
+    btc_commission = Coin();
+    price_inverse = CoinInverse();
+
     // local info
     engine = _engine;
-    market = Market( _market );
+    market = _market;
     side = _side;
     cancel_reason = 0;
     order_set_time = 0;
     order_request_time = 0;
     order_cancel_time = 0;
     order_getorder_time = 0;
-    market_indices = _market_indices;
+    order_queued_time = 0;
+    order_seen_time = 0;
+    setMarketIndices( _market_indices );
     is_cancelling = false;
     is_landmark = _landmark;
     is_slippage = false;
     is_new_hilo_order = false;
+    is_replaced = false;
     is_onetime = false;
     is_taker = false;
     price_reset_count = 0;
     max_age_epoch = 0;
-    strategy_tag = _strategy_tag;
+    setStrategyTag( _strategy_tag );
 
     if ( engine != nullptr && is_landmark && market_indices.size() > 1 )
     {
@@ -46,8 +82,8 @@ Position::Position( QString _market, quint8 _side, QString _buy_price, QString _
         int i;
         for ( i = 0; i < market_indices.size(); i++ )
         {
-            const PositionData &data = engine->getMarketInfo( market ).position_index[ market_indices.value( i ) ];
-            Coin ordersize = data.order_size;
+            const PositionData data = engine->getMarketInfo( market ).position_index.value( market_indices.value( i ) );
+            const Coin &ordersize = data.order_size;
 
             // measure lowest order size
             if ( ordersize < lo_ordersize )
@@ -60,11 +96,11 @@ Position::Position( QString _market, quint8 _side, QString _buy_price, QString _
         // use the lowest amount as weight 1 and size others correspondingly
         for ( i = 0; i < market_indices.size(); i++ )
         {
-            const PositionData &data = engine->getMarketInfo( market ).position_index[ market_indices.value( i ) ];
+            const PositionData data = engine->getMarketInfo( market ).position_index.value( market_indices.value( i ) );
 
             Coin current_weight;
             if ( lo_ordersize < CoinAmount::A_LOT )
-                current_weight = Coin( data.order_size ) / lo_ordersize;
+                current_weight = data.order_size / lo_ordersize;
 
             //kDebug() << "idx:" << i << "price:" << data.order_size;
 
@@ -73,8 +109,8 @@ Position::Position( QString _market, quint8 _side, QString _buy_price, QString _
             ordersize_weights.insert( i, current_weight );
 
             // add to price weight totals
-            hi_price_weight_total += Coin( data.sell_price ) * current_weight;
-            lo_price_weight_total += Coin( data.buy_price ) * current_weight;
+            hi_price_weight_total += data.sell_price * current_weight;
+            lo_price_weight_total += data.buy_price * current_weight;
         }
 
         //kDebug() << "hi_price_weight_total:" << hi_price_weight_total;
@@ -111,10 +147,9 @@ Position::Position( QString _market, quint8 _side, QString _buy_price, QString _
     }
     else
     {
-        // convert to coin for satoshi formatting
-        buy_price = Coin( _buy_price );
-        sell_price = Coin( _sell_price );
-        original_size = Coin( _order_size );
+        buy_price = _buy_price;
+        sell_price = _sell_price;
+        original_size = _order_size;
     }
 
     // truncate order by exchange tick size
@@ -134,11 +169,12 @@ Position::Position( QString _market, quint8 _side, QString _buy_price, QString _
     buy_price_original = buy_price;
     sell_price_original = sell_price;
 
-    // sort the indices so we can print a nicer looking string
-    std::sort( market_indices.begin(), market_indices.end() );
+    // sort the indices so we can print a nicer looking string, they're usually sorted already and sorting would detach
+    if ( !std::is_sorted( market_indices.constBegin(), market_indices.constEnd() ) )
+        std::sort( market_indices.begin(), market_indices.end() );
 
     // setup indices_str
-    for ( QVector<qint32>::const_iterator i = market_indices.begin(); i != market_indices.end(); i++ )
+    for ( QVector<qint32>::const_iterator i = market_indices.constBegin(); i != market_indices.constEnd(); i++ )
         indices_str += QString::number( *i ) + ' ';
 
     // get rid of trailing space
@@ -319,13 +355,13 @@ void Position::applyOffset( qreal _offset, bool sentiment )
 void Position::jsonifyPositionFill( QJsonArray &arr )
 {
     arr += "f";
-    arr += order_number;
+    arr += order_number.toString();
 }
 
 void Position::jsonifyPositionSet( QJsonArray &arr )
 {
     arr += "s";
-    arr += order_number;
+    arr += order_number.toString();
     arr += market.operator QString();
     arr += is_onetime;
     arr += is_landmark;
@@ -338,7 +374,7 @@ void Position::jsonifyPositionSet( QJsonArray &arr )
 void Position::jsonifyPositionCancel( QJsonArray &arr )
 {
     arr += "c";
-    arr += order_number;
+    arr += order_number.toString();
     //arr += cancel_reason;
 }
 
@@ -360,31 +396,40 @@ void Position::jsonifyPositionCancel( QJsonArray &arr )
 
 QString Position::stringifyOrder()
 {
-    QString ret = QString( "%1%2  %3 %4 %5 @ %6               o %7 %8")
-                .arg( is_landmark ? "L" : is_onetime ? "O" : " " )
-                .arg( is_slippage ? "S" : max_age_epoch > 0 ? "T" : " " )
-                .arg( sideStr(), -4 )
-                .arg( market, -MARKET_STRING_WIDTH )
-                .arg( amount, 11 )
-                .arg( price, 10 )
-                .arg( order_number, ORDER_STRING_SIZE )
-                .arg( indices_str );
+    const QString order_number_str = order_number.toString();
 
-    return ret;
+    return stringifyOrder( getTypeFlag(), getPriceFlag(), side, market, amount, price, &order_number_str, indices_str );
 }
 
 QString Position::stringifyOrderWithoutOrderID()
 {
-    QString ret = QString( "%1%2  %3 %4 %5 @ %6 %7")
-                .arg( is_landmark ? "L" : is_onetime ? "O" : " " )
-                .arg( is_slippage ? "S" : max_age_epoch > 0 ? "T" : " " )
-                .arg( sideStr(), -4 )
+    return stringifyOrder( getTypeFlag(), getPriceFlag(), side, market, amount, price, nullptr, indices_str );
+}
+
+QString Position::stringifyOrder( const QChar type_flag, const QChar price_flag, const quint8 side, const Market &market,
+                                  const Coin &amount, const Coin &price, const QString *const order_number, const QString &indices_str )
+{
+    const QString side_str = side == SIDE_BUY ? QString( BUY ) : QString( SELL );
+
+    if ( !order_number )
+        return QString( "%1%2  %3 %4 %5 @ %6 %7")
+                .arg( type_flag )
+                .arg( price_flag )
+                .arg( side_str, -4 )
                 .arg( market, -MARKET_STRING_WIDTH )
                 .arg( amount, 11 )
                 .arg( price, 10 )
                 .arg( indices_str );
 
-    return ret;
+    return QString( "%1%2  %3 %4 %5 @ %6               o %7 %8")
+            .arg( type_flag )
+            .arg( price_flag )
+            .arg( side_str, -4 )
+            .arg( market, -MARKET_STRING_WIDTH )
+            .arg( amount, 11 )
+            .arg( price, 10 )
+            .arg( *order_number, ORDER_STRING_SIZE )
+            .arg( indices_str );
 }
 
 QString Position::stringifyNewPosition()
@@ -426,33 +471,30 @@ QString Position::stringifyPositionChange()
             .arg( market, MARKET_STRING_WIDTH )
             .arg( amount, 11 )
             .arg( price_str, -24 )
-            .arg( order_number, ORDER_STRING_SIZE )
+            .arg( order_number.toString(), ORDER_STRING_SIZE )
             .arg( indices_str )
             .arg( !is_onetime && per_trade_profit.isGreaterThanZero() ? " p " + per_trade_profit : "" );
 }
 
-qint32 Position::getLowestMarketIndex() const
+QDebug operator <<( QDebug debug, const PositionLog &log )
 {
-    // optimization for non-landmark orders
-    if ( market_indices.size() == 1 ) return market_indices.value( 0 );
-
-    qint32 idx_lo = std::numeric_limits<qint32>::max();
+    Position *const &pos = log.pos;
 
-    for ( QVector<qint32>::const_iterator i = market_indices.begin(); i != market_indices.end(); i++ )
-        if ( *i < idx_lo ) idx_lo = *i;
-
-    return idx_lo;
+    return debug << ( log.format == PositionLog::ORDER_WITHOUT_ID ? pos->stringifyOrderWithoutOrderID() :
+                      log.format == PositionLog::NEW_POSITION     ? pos->stringifyNewPosition() :
+                      log.format == PositionLog::POSITION_CHANGE  ? pos->stringifyPositionChange() :
+                                                                    pos->stringifyOrder() );
 }
 
-qint32 Position::getHighestMarketIndex() const
+void Position::setMarketIndices( const QVector<qint32> &indices )
 {
-    // optimization for non-landmark orders
-    if ( market_indices.size() == 1 ) return market_indices.value( 0 );
-
-    qint32 idx_hi = -1;
+    market_indices = indices;
+    market_index_lo = std::numeric_limits<qint32>::max();
+    market_index_hi = -1;
 
-    for ( QVector<qint32>::const_iterator i = market_indices.begin(); i != market_indices.end(); i++ )
-        if ( *i > idx_hi ) idx_hi = *i;
-
-    return idx_hi;
+    for ( QVector<qint32>::const_iterator i = market_indices.constBegin(); i != market_indices.constEnd(); i++ )
+    {
+        if ( *i < market_index_lo ) market_index_lo = *i;
+        if ( *i > market_index_hi ) market_index_hi = *i;
+    }
 }
@@ -4,10 +4,16 @@
 #include "global.h"
 #include "coinamount.h"
 #include "market.h"
+#include "orderid.h"
+#include "strategytag.h"
 
 #include <QVector>
+#include <QDebug>
+
+#include <limits>
 
 class Engine;
+struct PositionLog;
 
 class Position
 {
@@ -16,8 +22,29 @@ public:
                        QString _order_size, QString _strategy_tag = QLatin1String(),
                        QVector<qint32> _market_indices = QVector<qint32>(),
                        bool _landmark = false, Engine *_engine = nullptr );
+    explicit Position( const Market &_market, quint8 _side, const Coin &_buy_price, const Coin &_sell_price,
+                       const Coin &_order_size, const QString &_strategy_tag = QLatin1String(),
+                       const QVector<qint32> &_market_indices = QVector<qint32>(),
+                       bool _landmark = false, Engine *_engine = nullptr );
     ~Position();
 
+    // (re)initialize, used by the constructor and by PositionPool when recycling
+    void init( const QString &_market, quint8 _side, const QString &_buy_price, const QString &_sell_price,
+               const QString &_order_size, const QString &_strategy_tag = QLatin1String(),
+               const QVector<qint32> &_market_indices = QVector<qint32>(),
+               bool _landmark = false, Engine *_engine = nullptr );
+    // the same with the values already parsed, like a grid index's PositionData
+    void init( const Market &_market, quint8 _side, const Coin &_buy_price, const Coin &_sell_price,
+               const Coin &_order_size, const QString &_strategy_tag = QLatin1String(),
+               const QVector<qint32> &_market_indices = QVector<qint32>(),
+               bool _landmark = false, Engine *_engine = nullptr );
+
+    // bumped every time the object is recycled, so stale pointers can be detected
+    quint32 getGeneration() const { return generation; }
+
+    // keeps strategy_tag_id in step, set the tag through here
+    void setStrategyTag( const QString &tag ) { strategy_tag = tag; strategy_tag_id = StrategyTag::getId( tag ); }
+
     void calculateQuantity();
     void flip();
     QString getFlippedPrice() { return side == SIDE_BUY ? sell_price_original : buy_price_original; }
@@ -29,49 +56,99 @@ public:
     void jsonifyPositionCancel( QJsonArray &arr );
     QString stringifyOrder();
     QString stringifyOrderWithoutOrderID();
+    // the getorders line of either, without the order id when it's null. PositionSnapshotEntry prints it too
+    static QString stringifyOrder( const QChar type_flag, const QChar price_flag, const quint8 side, const Market &market,
+                                   const Coin &amount, const Coin &price, const QString *const order_number, const QString &indices_str );
+    QChar getTypeFlag() const { return is_landmark ? 'L' : is_onetime ? 'O' : ' '; }
+    QChar getPriceFlag() const { return is_slippage ? 'S' : max_age_epoch > 0 ? 'T' : ' '; }
     QString stringifyNewPosition();
     QString stringifyPositionChange();
+
+    // the same, formatted when the log line is written. with kLogIf() nothing is built for a line that's skipped
+    inline PositionLog logOrder();
+    inline PositionLog logOrderWithoutOrderID();
+    inline PositionLog logNewPosition();
+    inline PositionLog logPositionChange();
     QString sideStr() const { return side == SIDE_BUY  ? QString( BUY ) :
                                                          QString( SELL ); }
-    qint32 getLowestMarketIndex() const;
-    qint32 getHighestMarketIndex() const;
+    qint32 getLowestMarketIndex() const { return market_index_lo; }
+    qint32 getHighestMarketIndex() const { return market_index_hi; }
+    void setMarketIndices( const QVector<qint32> &indices ); // keeps the lo/hi above in sync
 
-    // exchange data
+    // hot data, read by the PositionMan and Engine timeout/fill scans. keep it together at the front
     Market market; // BTC_CLAM...
-    QString order_number;
-
-    Coin quantity;
-
     quint8 side; // buy = 1, sell = 2
     quint8 cancel_reason;
+    qint32 strategy_tag_id{ -1 }; // of strategy_tag, see StrategyTag
+
+    bool is_cancelling,
+    is_landmark,
+    is_slippage, // order has slippage
+    is_new_hilo_order,
+    is_replaced, // cancelled with its replacement already placed, don't re-add it
+    is_onetime, // is a one-time order, ping-pong disabled
+    is_taker; // is taker, post-only disabled
 
     qint64 order_set_time; // 0 when not set
     qint64 order_request_time; // 0 when not requested
     qint64 order_cancel_time; // 0 when not cancelling
     qint64 order_getorder_time; // 0 or last getorder time
+    qint64 order_queued_time; // 0 or when the order was queued to be set
+    qint64 order_seen_time; // 0 until the order shows up in getorders
+    qint64 max_age_epoch; // epoch time of when we should cancel the order
+
+    Coin price, buy_price, sell_price;
+    const Coin &getPriceInverse() const { return price_inverse.of( price ); } // COIN / price, cached
+
+    // cold data, exchange data
+    OrderId order_number;
+    Coin quantity;
 
     // our position data
     QString indices_str;
-    Coin price, buy_price, sell_price;
     Coin buy_price_original, sell_price_original;
     Coin original_size, amount, per_trade_profit, profit_margin, btc_commission;
     quint32 price_reset_count;
-    qint64 max_age_epoch; // epoch time of when we should cancel the order
     QString strategy_tag; // tag for short/long
 
-    // track indices for market map
+    // track indices for market map, set them with setMarketIndices(). it's shared with the vector it was set from
     QVector<qint32> market_indices;
-
-    bool is_cancelling,
-    is_landmark,
-    is_slippage, // order has slippage
-    is_new_hilo_order,
-    is_onetime, // is a one-time order, ping-pong disabled
-    is_taker; // is taker, post-only disabled
+    qint32 market_index_lo{ std::numeric_limits<qint32>::max() }, market_index_hi{ -1 };
 
 private:
+    friend class PositionPool;
+    friend class PositionMan;
+
+    CoinInverse price_inverse;
     Engine *engine;
+    quint32 generation{ 0 };
+    qint32 list_slot{ -1 }; // slot in the PositionMan queued or active list
+    qint32 all_slot{ -1 }; // slot in the PositionMan list of all positions, -1 when it isn't held there
+    bool in_active_list{ false }; // which of the two list_slot is in
+    qint32 spruce_slot{ -1 }; // slot in the PositionMan random spruce pick list
 };
 
+// a position in a log line, see Position::logOrder()
+struct PositionLog
+{
+    enum Format : quint8
+    {
+        ORDER,
+        ORDER_WITHOUT_ID,
+        NEW_POSITION,
+        POSITION_CHANGE
+    };
+
+    Position *pos{ nullptr };
+    quint8 format{ ORDER };
+};
+
+QDebug operator <<( QDebug debug, const PositionLog &log );
+
+inline PositionLog Position::logOrder() { return PositionLog{ this, PositionLog::ORDER }; }
+inline PositionLog Position::logOrderWithoutOrderID() { return PositionLog{ this, PositionLog::ORDER_WITHOUT_ID }; }
+inline PositionLog Position::logNewPosition() { return PositionLog{ this, PositionLog::NEW_POSITION }; }
+inline PositionLog Position::logPositionChange() { return PositionLog{ this, PositionLog::POSITION_CHANGE }; }
+
 
 #endif // POSITION_H
@@ -1,32 +1,45 @@
 #ifndef POSITIONDATA_H
 #define POSITIONDATA_H
 
+#include "coinamount.h"
+
 #include <QString>
 
+// one ping-pong grid index, its values are parsed and validated once by addPosition() and reused every time the
+// index is set again. strings are only made for the save files
 struct PositionData
 {
     explicit PositionData() {}
-    explicit PositionData( QString _buy_price, QString _sell_price, QString _order_size, QString _alternate_size )
+    explicit PositionData( const Coin &_buy_price, const Coin &_sell_price, const Coin &_order_size, const Coin &_alternate_size )
+        : buy_price( _buy_price ),
+          sell_price( _sell_price ),
+          order_size( _order_size ),
+          alternate_size( _alternate_size )
+    {
+    }
+    explicit PositionData( const QString &_buy_price, const QString &_sell_price, const QString &_order_size, const QString &_alternate_size )
+        : buy_price( _buy_price ),
+          sell_price( _sell_price ),
+          order_size( _order_size ),
+          alternate_size( _alternate_size.isEmpty() ? Coin() : Coin( _alternate_size ) )
     {
-        buy_price = _buy_price;
-        sell_price = _sell_price;
-        order_size = _order_size;
-        alternate_size = _alternate_size;
-        fill_count = 0;
     }
 
+    bool hasAlternateSize() const { return !alternate_size.isZero(); }
+    QString getAlternateSizeString() const { return hasAlternateSize() ? QString( alternate_size ) : QString(); }
+
     void iterateFillCount()
     {
         fill_count++;
-        if ( alternate_size.size() > 0 )
+        if ( hasAlternateSize() )
         {
             order_size = alternate_size;
-            alternate_size.clear();
+            alternate_size = Coin();
         }
     }
 
-    QString buy_price, sell_price, order_size, alternate_size;
-    quint32 fill_count;
+    Coin buy_price, sell_price, order_size, alternate_size; // alternate_size is zero if there isn't one
+    quint32 fill_count{ 0 };
 };
 
 #endif // POSITIONDATA_H
@@ -0,0 +1,113 @@
+#include "positiongrid.h"
+
+void PositionGrid::clear()
+{
+    slots.clear();
+    alternate_sizes.clear();
+    fill_counts.clear();
+    overrides.clear();
+}
+
+bool PositionGrid::toSatoshis( const Coin &c, qint64 &satoshis )
+{
+    qint64 raw = 0;
+    if ( !c.toRawInt64( raw ) || raw % 100000000 != 0 )
+        return false;
+
+    satoshis = raw / 100000000; // subsatoshis per satoshi
+    return true;
+}
+
+void PositionGrid::append( const PositionData &data )
+{
+    const qint32 index = slots.size();
+    Slot slot;
+    qint64 alternate_size = 0;
+
+    if ( !toSatoshis( data.buy_price, slot.buy_price ) ||
+         !toSatoshis( data.sell_price, slot.sell_price ) ||
+         !toSatoshis( data.order_size, slot.order_size ) ||
+         !toSatoshis( data.alternate_size, alternate_size ) )
+    {
+        slots += Slot{ 0, 0, 0 };
+        overrides.insert( index, data );
+        return;
+    }
+
+    slots += slot;
+
+    if ( alternate_size != 0 )
+        alternate_sizes.insert( index, alternate_size );
+    if ( data.fill_count > 0 )
+        fill_counts.insert( index, data.fill_count );
+}
+
+PositionData PositionGrid::value( const qint32 index ) const
+{
+    if ( index < 0 || index >= slots.size() )
+        return PositionData();
+
+    const QHash<qint32, PositionData>::const_iterator o = overrides.constFind( index );
+    if ( o != overrides.constEnd() )
+        return o.value();
+
+    const Slot &slot = slots.at( index );
+    PositionData data( fromSatoshis( slot.buy_price ), fromSatoshis( slot.sell_price ), fromSatoshis( slot.order_size ),
+                       fromSatoshis( alternate_sizes.value( index, 0 ) ) );
+    data.fill_count = fill_counts.value( index, 0 );
+
+    return data;
+}
+
+void PositionGrid::iterateFillCount( const qint32 index )
+{
+    if ( index < 0 || index >= slots.size() )
+        return;
+
+    const QHash<qint32, PositionData>::iterator o = overrides.find( index );
+    if ( o != overrides.end() )
+    {
+        o.value().iterateFillCount();
+        return;
+    }
+
+    fill_counts[ index ]++;
+
+    // the alternate size takes the place of the order size after the first fill, like PositionData's
+    const QHash<qint32, qint64>::iterator a = alternate_sizes.find( index );
+    if ( a != alternate_sizes.end() )
+    {
+        slots[ index ].order_size = a.value();
+        alternate_sizes.erase( a );
+    }
+}
+
+void PositionGrid::setVector( const QVector<PositionData> &list )
+{
+    clear();
+    slots.reserve( list.size() );
+
+    for ( QVector<PositionData>::const_iterator i = list.begin(); i != list.end(); i++ )
+        append( *i );
+}
+
+QVector<PositionData> PositionGrid::toVector() const
+{
+    QVector<PositionData> ret;
+    ret.reserve( slots.size() );
+
+    for ( qint32 i = 0; i < slots.size(); i++ )
+        ret += value( i );
+
+    return ret;
+}
+
+qint64 PositionGrid::getBytes() const
+{
+    // about what a QHash node takes, with the key, value and next pointer
+    static const qint64 HASH_NODE_BYTES = 32;
+
+    return qint64( slots.capacity() ) * qint64( sizeof( Slot ) ) +
+           qint64( alternate_sizes.size() + fill_counts.size() ) * HASH_NODE_BYTES +
+           qint64( overrides.size() ) * ( HASH_NODE_BYTES + qint64( sizeof( PositionData ) ) );
+}
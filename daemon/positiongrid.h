@@ -0,0 +1,49 @@
+#ifndef POSITIONGRID_H
+#define POSITIONGRID_H
+
+#include "positiondata.h"
+#include "coinamount.h"
+
+#include <QVector>
+#include <QHash>
+
+//
+// PositionGrid, the ping-pong indices of a market. a dense grid is thousands of slots, so each one is three satoshi
+// counts in one packed array instead of four Coins, and the fill counts and alternate sizes are only kept for the
+// slots that have them. a PositionData is made from the slot when it's asked for. the few values that aren't whole
+// satoshis, or are too large for the raw range, are kept whole as overrides
+//
+class PositionGrid
+{
+public:
+    qint32 size() const { return slots.size(); }
+    bool isEmpty() const { return slots.isEmpty(); }
+    void reserve( const qint32 n ) { slots.reserve( n ); }
+    void clear();
+
+    void append( const PositionData &data );
+    PositionGrid &operator +=( const PositionData &data ) { append( data ); return *this; }
+    PositionData value( const qint32 index ) const; // a default PositionData out of range, like QVector::value()
+    void iterateFillCount( const qint32 index ); // see PositionData::iterateFillCount()
+
+    void setVector( const QVector<PositionData> &list );
+    QVector<PositionData> toVector() const; // for the savers, which run off the engine thread
+    qint64 getBytes() const; // for getmemory
+    qint32 getOverrideCount() const { return overrides.size(); }
+
+    static bool toSatoshis( const Coin &c, qint64 &satoshis ); // false if it isn't a whole number of them in the raw range
+    static Coin fromSatoshis( const qint64 satoshis ) { return Coin( CoinRaw{ __int128( satoshis ) * 100000000 } ); }
+
+private:
+    struct Slot
+    {
+        qint64 buy_price, sell_price, order_size; // satoshis
+    };
+
+    QVector<Slot> slots; // every slot, zeros where there's an override
+    QHash<qint32/*slot*/, qint64/*satoshis*/> alternate_sizes;
+    QHash<qint32/*slot*/, quint32> fill_counts;
+    QHash<qint32/*slot*/, PositionData> overrides;
+};
+
+#endif // POSITIONGRID_H
@@ -0,0 +1,56 @@
+#include "positiongrid_test.h"
+#include "positiongrid.h"
+
+#include <QVector>
+
+#include <assert.h>
+
+void PositionGridTest::test()
+{
+    /// test that whole satoshis are packed and come back the same
+    PositionGrid grid;
+    assert( grid.isEmpty() && grid.value( 0 ).buy_price.isZero() );
+
+    grid.append( PositionData( "0.00000005", "0.00000050", "0.01", QString() ) );
+    grid.append( PositionData( "0.00010000", "0.00012000", "0.02", "0.03" ) );
+    assert( grid.size() == 2 && grid.getOverrideCount() == 0 );
+    assert( grid.value( 0 ).buy_price == "0.00000005" && grid.value( 0 ).sell_price == "0.00000050" );
+    assert( grid.value( 0 ).order_size == "0.01" && !grid.value( 0 ).hasAlternateSize() );
+    assert( grid.value( 1 ).alternate_size == "0.03" );
+    assert( grid.value( -1 ).order_size.isZero() && grid.value( 2 ).order_size.isZero() );
+
+    /// test that the alternate size takes over after the first fill
+    grid.iterateFillCount( 1 );
+    assert( grid.value( 1 ).fill_count == 1 && grid.value( 1 ).order_size == "0.03" && !grid.value( 1 ).hasAlternateSize() );
+    grid.iterateFillCount( 1 );
+    assert( grid.value( 1 ).fill_count == 2 && grid.value( 1 ).order_size == "0.03" );
+    assert( grid.value( 0 ).fill_count == 0 );
+
+    /// test that sub-satoshi values are kept whole
+    grid.append( PositionData( Coin( "0.000000051" ), Coin( "0.0000005" ), Coin( "0.01" ), Coin() ) );
+    assert( grid.getOverrideCount() == 1 );
+    assert( grid.value( 2 ).buy_price == "0.000000051" );
+    grid.iterateFillCount( 2 );
+    assert( grid.value( 2 ).fill_count == 1 );
+
+    /// test the savers' copy round trip
+    const QVector<PositionData> list = grid.toVector();
+    assert( list.size() == 3 && list.at( 1 ).fill_count == 2 );
+
+    PositionGrid restored;
+    restored.setVector( list );
+    assert( restored.size() == 3 && restored.getOverrideCount() == 1 );
+    assert( restored.value( 1 ).order_size == "0.03" && restored.value( 1 ).fill_count == 2 );
+    assert( restored.value( 2 ).buy_price == "0.000000051" );
+
+    // a dense grid stays small
+    PositionGrid dense;
+    for ( qint32 i = 0; i < 10000; i++ )
+        dense += PositionData( PositionGrid::fromSatoshis( 1000 + i ), PositionGrid::fromSatoshis( 1100 + i ), Coin( "0.001" ), Coin() );
+    assert( dense.size() == 10000 && dense.getOverrideCount() == 0 );
+    assert( dense.getBytes() < 10000 * 32 );
+    assert( dense.value( 9999 ).buy_price == PositionGrid::fromSatoshis( 10999 ) );
+
+    restored.clear();
+    assert( restored.isEmpty() && restored.getOverrideCount() == 0 );
+}
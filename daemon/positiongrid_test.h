@@ -0,0 +1,9 @@
+#ifndef POSITIONGRID_TEST_H
+#define POSITIONGRID_TEST_H
+
+struct PositionGridTest
+{
+    void test();
+};
+
+#endif // POSITIONGRID_TEST_H
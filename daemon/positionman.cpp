@@ -6,12 +6,26 @@
 #include "wavesrest.h"
 #include "engine.h"
 #include "enginesettings.h"
+#include "virtualclock.h"
+#include "metrics.h"
+#include "orderjournal.h"
+#include "memorystats.h"
 
 #include <QVector>
 #include <QSet>
 #include <QMap>
 #include <QQueue>
 #include <QPair>
+#include <QDateTime>
+#include <QMutexLocker>
+
+static const PositionSlotMap EMPTY_SLOT_MAP;
+
+static const PositionSlotMap &findSlotMap( const QHash<qint32,PositionSlotMap> &maps, const qint32 market_id )
+{
+    const QHash<qint32,PositionSlotMap>::const_iterator i = maps.find( market_id );
+    return ( i == maps.end() ) ? EMPTY_SLOT_MAP : i.value();
+}
 
 PositionMan::PositionMan( Engine *_engine, QObject *parent )
     : QObject( parent ),
@@ -23,69 +37,86 @@ PositionMan::PositionMan( Engine *_engine, QObject *parent )
 PositionMan::~PositionMan()
 {
     // delete local positions
-    while( positions_all.size() > 0 )
-        remove( *positions_all.begin() );
+    while( positions_all_list.size() > 0 )
+        remove( positions_all_list.at( positions_all_list.size() -1 ) );
 }
 
-QVector<Position*> PositionMan::activeBySetTime() const
+void PositionMan::setOrderSetTime( Position *const &pos, const qint64 set_time )
 {
-    QMultiMap<qint64, Position*> positions_by_time;
-
-    const QSet<Position*>::const_iterator begin_active = positions_active.begin(),
-                                          end_active = positions_active.end();
-    for ( QSet<Position*>::const_iterator i = begin_active; i != end_active; i++ )
+    // keep positions_by_set_time keyed by the current set time
+    if ( isActive( pos ) )
     {
-        Position *const &pos = *i;
-
-        positions_by_time.insert( pos->order_set_time, pos );
+        positions_by_set_time.remove( pos->order_set_time, pos );
+        positions_by_set_time.insert( set_time, pos );
     }
 
-    // return positions_by_time values from latest to soonest
-    QVector<Position*> ret;
-    const QMultiMap<qint64, Position*>::const_iterator begin = positions_by_time.begin(),
-                                                       end = positions_by_time.end();
+    pos->order_set_time = set_time;
 
-    for ( QMultiMap<qint64, Position*>::const_iterator i = end -1; i != begin -1; i-- )
-    {
-        Position *const &pos = *i;
+    // the slippage deadline moved
+    scheduleTimeoutCheck( pos, VirtualClock::currentMSecsSinceEpoch() );
+}
 
-        ret += pos;
-    }
+void PositionMan::scheduleTimeoutCheck( Position *const &pos, const qint64 check_time )
+{
+    unscheduleTimeoutCheck( pos );
 
-    return ret;
+    timeout_checks.insert( check_time, pos );
+    timeout_check_times.insert( pos, check_time );
+}
+
+void PositionMan::unscheduleTimeoutCheck( Position *const &pos )
+{
+    if ( !timeout_check_times.contains( pos ) )
+        return;
+
+    timeout_checks.remove( timeout_check_times.take( pos ), pos );
+}
+
+Position *PositionMan::getDueTimeoutCheck( const qint64 current_time ) const
+{
+    if ( timeout_checks.isEmpty() || timeout_checks.begin().key() > current_time )
+        return nullptr;
+
+    return timeout_checks.begin().value();
 }
 
 bool PositionMan::hasActivePositions() const
 {
-    return positions_active.size();
+    return positions_active_list.size();
 }
 
 bool PositionMan::hasQueuedPositions() const
 {
-    return positions_queued.size();
+    return positions_queued_list.size();
 }
 
 bool PositionMan::isActive( Position * const &pos ) const
 {
-    return positions_active.contains( pos );
+    return pos && pos->list_slot >= 0 && pos->in_active_list;
 }
 
 bool PositionMan::isQueued( Position * const &pos ) const
 {
-    return positions_queued.contains( pos );
+    return pos && pos->list_slot >= 0 && !pos->in_active_list;
 }
 
 bool PositionMan::isValid( Position * const &pos ) const
 {
-    return positions_all.contains( pos );
+    return pos && pos->all_slot >= 0;
 }
 
-bool PositionMan::isValidOrderID( const QString &order_id ) const
+bool PositionMan::isValid( Position * const &pos, const quint32 generation ) const
+{
+    // the pointer might have been recycled into a new position since it was stored
+    return pos && pos->all_slot >= 0 && pos->getGeneration() == generation;
+}
+
+bool PositionMan::isValidOrderID( const OrderId &order_id ) const
 {
     return positions_by_number.contains( order_id );
 }
 
-Position *PositionMan::getByOrderID( const QString &order_id ) const
+Position *PositionMan::getByOrderID( const OrderId &order_id ) const
 {
     return positions_by_number.value( order_id, nullptr );
 }
@@ -98,7 +129,7 @@ Coin PositionMan::getHiBuyFlipPrice( const QString &market ) const
     if ( !pos || !isActive( pos ) )
         return 0.;
 
-    kDebug() << "hi_buy_flip" << pos->stringifyOrder();
+    kLog( LOG_LEVEL_DEBUG ) << "hi_buy_flip" << pos->logOrder();
 
     return pos->sell_price;
 }
@@ -111,268 +142,452 @@ Coin PositionMan::getLoSellFlipPrice( const QString &market ) const
     if ( !pos || !isActive( pos ) )
         return 0.;
 
-    kDebug() << "lo_sell_flip" << pos->stringifyOrder();
+    kLog( LOG_LEVEL_DEBUG ) << "lo_sell_flip" << pos->logOrder();
 
     return pos->buy_price;
 }
 
-Coin PositionMan::getActiveSpruceEquityTotal( const Market &market, const QString &strategy, quint8 side, const Coin &price_threshold )
+Coin PositionMan::getActiveSpruceEquityTotal( const Market &market, const qint32 strategy_tag_id, quint8 side, const Coin &price_threshold )
 {
+    const PositionTagBucket *bucket = getTagBucket( strategy_tag_id, market, side );
+    const PositionTagBucket *bucket_inverse = getTagBucket( strategy_tag_id, market.getInverse(), ( side == SIDE_BUY ) ? SIDE_SELL : SIDE_BUY );
+
+    // without a threshold, the running totals are the answer
+    if ( price_threshold.isZeroOrLess() )
+    {
+        Coin ret;
+        if ( bucket )
+            ret += bucket->amount_total;
+        if ( bucket_inverse )
+            ret += bucket_inverse->amount_inverse_total;
+
+        return ret;
+    }
+
     Coin ret;
-    for( QSet<Position*>::const_iterator i = positions_all.begin(); i != positions_all.end(); i++ )
+    if ( bucket_inverse )
     {
-        Position *const &pos = *i;
+        // for inverted markets, price = 1/price
+        const Coin price_threshold_actual = CoinAmount::COIN / price_threshold;
 
-        if ( !pos->is_cancelling &&
-              pos->side != side && // if it's not tradeable, flip sides
-              pos->strategy_tag == strategy &&
-              market.getInverse() == pos->market )
+        for ( QSet<Position*>::const_iterator i = bucket_inverse->positions.begin(); i != bucket_inverse->positions.end(); i++ )
         {
-            // for inverted markets, price = 1/price
+            Position *const &pos = *i;
+            if ( pos->is_cancelling )
+                continue;
+
             const Coin price_actual = ( CoinAmount::COIN / pos->price );
-            const Coin price_threshold_actual = price_threshold.isZeroOrLess() ? Coin() : ( CoinAmount::COIN / price_threshold );
 
             if ( ( side != SIDE_BUY  && price_threshold_actual.isGreaterThanZero() && price_actual < price_threshold_actual ) ||
                  ( side != SIDE_SELL && price_threshold_actual.isGreaterThanZero() && price_actual > price_threshold_actual ) )
                 continue;
 
             ret += pos->amount * price_actual;
-            continue;
         }
+    }
 
-        if (  pos->is_cancelling ||
-              pos->side != side ||
-              pos->market != market ||
-              pos->strategy_tag != strategy ||
-              // if the threshold is zero, include any price into the total, otherwise return amount inside of the threshold only
-             ( pos->side == side && side == SIDE_BUY  && price_threshold.isGreaterThanZero() && pos->price < price_threshold ) ||
-             ( pos->side == side && side == SIDE_SELL && price_threshold.isGreaterThanZero() && pos->price > price_threshold ) )
-            continue;
+    if ( bucket )
+    {
+        for ( QSet<Position*>::const_iterator i = bucket->positions.begin(); i != bucket->positions.end(); i++ )
+        {
+            Position *const &pos = *i;
 
-        ret += pos->amount;
+            // return amount inside of the threshold only
+            if (  pos->is_cancelling ||
+                 ( side == SIDE_BUY  && pos->price < price_threshold ) ||
+                 ( side == SIDE_SELL && pos->price > price_threshold ) )
+                continue;
+
+            ret += pos->amount;
+        }
     }
 
     return ret;
 }
 
-Position *PositionMan::getByIndex( const QString &market, const qint32 idx ) const
+const PositionTagBucket *PositionMan::getTagBucket( const qint32 strategy_tag_id, const Market &market, const quint8 side ) const
 {
-    Position *ret = nullptr;
+    PositionTagKey key;
+    key.tag_id = strategy_tag_id;
+    key.market_id = market.getId();
+    key.side = side;
+
+    if ( key.tag_id < 0 )
+        return nullptr;
+
+    const QHash<PositionTagKey,PositionTagBucket>::const_iterator i = tag_buckets.find( key );
+    return ( i == tag_buckets.end() ) ? nullptr : &i.value();
+}
+
+void PositionMan::updateTagTotals( Position *const &pos )
+{
+    if ( positions_tagged.contains( pos ) )
+        addToTagBucket( pos );
+}
+
+void PositionMan::onPriceChanged( Position *const &pos )
+{
+    updateTagTotals( pos );
+
+    if ( positions_priced.contains( pos ) )
+        addToQueuedPrices( pos );
+
+    setDCDirty( pos->market ); // slippage might have changed
+    is_snapshot_dirty = true;
+}
+
+PositionSnapshotPtr PositionMan::publishSnapshot( const bool is_current )
+{
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
 
-    for ( QSet<Position*>::const_iterator i = positions_all.begin(); i != positions_all.end(); i++ )
+    // we're the only writer, the pointer is read here without the mutex
+    if ( snapshot )
     {
-        Position *const &pos = *i;
+        const qint64 age = current_time - snapshot->time;
 
-        // check for idx
-        if ( pos->market == market && pos->market_indices.contains( idx ) )
-            return pos;
+        if ( age < POSITION_SNAPSHOT_MAX_AGE &&
+             ( !is_snapshot_dirty || ( !is_current && age < POSITION_SNAPSHOT_INTERVAL ) ) )
+            return snapshot;
     }
 
-    return ret;
+    // built outside the mutex, readers keep getting the last one meanwhile
+    QSharedPointer<PositionSnapshot> next( new PositionSnapshot() );
+    next->epoch = ++snapshot_epoch;
+    next->time = current_time;
+    next->active_count = positions_active_list.size();
+    next->queued_count = positions_queued_list.size();
+    next->positions.reserve( positions_active_list.size() + positions_queued_list.size() );
+
+    for ( QVector<Position*>::const_iterator i = positions_active_list.constBegin(); i != positions_active_list.constEnd(); i++ )
+        next->positions += PositionSnapshotEntry( *i, true );
+    for ( QVector<Position*>::const_iterator i = positions_queued_list.constBegin(); i != positions_queued_list.constEnd(); i++ )
+        next->positions += PositionSnapshotEntry( *i, false );
+
+    is_snapshot_dirty = false;
+
+    QMutexLocker locker( &snapshot_mutex );
+    snapshot = next;
+    return snapshot;
 }
 
-Position *PositionMan::getHighestBuyAll( const QString &market ) const
+PositionSnapshotPtr PositionMan::getSnapshot() const
 {
-    Position *ret = nullptr;
-    Coin hi_buy = -1;
+    QMutexLocker locker( &snapshot_mutex );
+    return snapshot;
+}
 
-    for ( QSet<Position*>::const_iterator i = positions_active.begin(); i != positions_active.end(); i++ )
+bool PositionMan::hasActiveInMarket( const QString &market ) const
+{
+    return getIndex( market, SIDE_BUY ) || getIndex( market, SIDE_SELL );
+}
+
+void PositionMan::getCrossedByTicker( const QString &market, const Coin &bid, const Coin &ask, QVector<Position*> &crossed ) const
+{
+    // sells priced under the lo sell, this includes sell price <= hi buy
+    const PositionIndex *sells = getIndex( market, SIDE_SELL );
+    if ( sells )
     {
-        Position *const &pos = *i;
-        if (  pos->side != SIDE_BUY ||          // sells only
-              pos->market != market             // check market filter
-              )
-            continue;
+        const QMultiMap<Coin,Position*>::const_iterator end = sells->by_price.lowerBound( ask );
+        for ( QMultiMap<Coin,Position*>::const_iterator i = sells->by_price.begin(); i != end; i++ )
+            crossed += i.value();
+    }
 
-        if ( pos->buy_price > hi_buy ) // position index is greater than our incrementor
-        {
-            hi_buy = pos->buy_price;
-            ret = pos;
-        }
+    // buys priced over the hi buy, this includes buy price >= lo sell
+    const PositionIndex *buys = getIndex( market, SIDE_BUY );
+    if ( buys )
+    {
+        for ( QMultiMap<Coin,Position*>::const_iterator i = buys->by_price.upperBound( bid ); i != buys->by_price.end(); i++ )
+            crossed += i.value();
     }
+}
 
-    return ret;
+void PositionMan::getTouchedByTicker( const QString &market, const Coin &bid, const Coin &ask, QVector<Position*> &touched ) const
+{
+    // sells priced at or under the hi buy
+    const PositionIndex *sells = getIndex( market, SIDE_SELL );
+    if ( sells )
+    {
+        const QMultiMap<Coin,Position*>::const_iterator end = sells->by_price.upperBound( bid );
+        for ( QMultiMap<Coin,Position*>::const_iterator i = sells->by_price.begin(); i != end; i++ )
+            touched += i.value();
+    }
+
+    // buys priced at or over the lo sell
+    const PositionIndex *buys = getIndex( market, SIDE_BUY );
+    if ( buys )
+    {
+        for ( QMultiMap<Coin,Position*>::const_iterator i = buys->by_price.lowerBound( ask ); i != buys->by_price.end(); i++ )
+            touched += i.value();
+    }
 }
 
-Position *PositionMan::getLowestSellAll( const QString &market ) const
+Position *PositionMan::getQueuedByPrice( const QString &market, const quint8 side, const QString &price, const QString &amount ) const
+{
+    const Coin amount_d = amount;
+
+    PositionPriceKey key;
+    key.market_id = Market::getMarketId( market );
+    key.side = side;
+    key.price = price;
+
+    // probe, then check the amount
+    QMultiHash<PositionPriceKey,Position*>::const_iterator i = queued_by_price.find( key );
+    for ( ; i != queued_by_price.end() && i.key() == key; i++ )
+    {
+        Position *const &pos = i.value();
+
+        if ( pos->amount == amount &&
+             amount_d >= pos->amount.ratio( 0.999 ) &&
+             amount_d <= pos->amount.ratio( 1.001 ) )
+            return pos;
+    }
+
+    return nullptr;
+}
+
+void PositionMan::addToQueuedPrices( Position *const &pos )
+{
+    // drop any stale key first
+    removeFromQueuedPrices( pos );
+
+    PositionPriceKey key;
+    key.market_id = pos->market.getId();
+    key.side = pos->side;
+    key.price = pos->price.toAmountString();
+
+    queued_by_price.insert( key, pos );
+    positions_priced.insert( pos, key );
+}
+
+void PositionMan::removeFromQueuedPrices( Position *const &pos )
+{
+    if ( !positions_priced.contains( pos ) )
+        return;
+
+    queued_by_price.remove( positions_priced.take( pos ), pos );
+}
+
+void PositionMan::addToTagBucket( Position *const &pos )
+{
+    // drop any stale entry first
+    removeFromTagBucket( pos );
+
+    PositionTagEntry entry;
+    entry.key.tag_id = pos->strategy_tag_id;
+    entry.key.market_id = pos->market.getId();
+    entry.key.side = pos->side;
+
+    // cancelling positions are bucketed but not counted
+    if ( !pos->is_cancelling )
+    {
+        entry.amount = pos->amount;
+        entry.amount_inverse = pos->price.isGreaterThanZero() ? pos->amount * ( CoinAmount::COIN / pos->price ) : Coin();
+    }
+
+    PositionTagBucket &bucket = tag_buckets[ entry.key ];
+    bucket.positions.insert( pos );
+    bucket.amount_total += entry.amount;
+    bucket.amount_inverse_total += entry.amount_inverse;
+
+    positions_tagged.insert( pos, entry );
+}
+
+void PositionMan::removeFromTagBucket( Position *const &pos )
+{
+    if ( !positions_tagged.contains( pos ) )
+        return;
+
+    // take back what we added
+    const PositionTagEntry entry = positions_tagged.take( pos );
+    PositionTagBucket &bucket = tag_buckets[ entry.key ];
+    bucket.positions.remove( pos );
+    bucket.amount_total -= entry.amount;
+    bucket.amount_inverse_total -= entry.amount_inverse;
+
+    if ( bucket.positions.isEmpty() )
+        tag_buckets.remove( entry.key );
+}
+
+Position *PositionMan::getByIndex( const QString &market, const qint32 idx ) const
 {
     Position *ret = nullptr;
-    Coin lo_sell = CoinAmount::A_LOT;
 
-    for ( QSet<Position*>::const_iterator i = positions_active.begin(); i != positions_active.end(); i++ )
+    // nothing uses the slot
+    if ( !findSlotMap( slots_used, Market::getMarketId( market ) ).contains( idx ) )
+        return ret;
+
+    for ( QVector<Position*>::const_iterator i = positions_all_list.constBegin(); i != positions_all_list.constEnd(); i++ )
     {
         Position *const &pos = *i;
-        if (  pos->side != SIDE_SELL ||         // sells only
-              pos->market != market             // check market filter
-              )
-            continue;
 
-        if ( pos->sell_price < lo_sell ) // position index is less than our incrementor
-        {
-            lo_sell = pos->sell_price;
-            ret = pos;
-        }
+        // check for idx
+        if ( pos->market == market && pos->market_indices.contains( idx ) )
+            return pos;
     }
 
     return ret;
 }
 
+Position *PositionMan::getHighestBuyAll( const QString &market ) const
+{
+    const PositionIndex *index = getIndex( market, SIDE_BUY );
+    if ( !index || index->by_price.isEmpty() )
+        return nullptr;
+
+    return ( index->by_price.end() -1 ).value();
+}
+
+Position *PositionMan::getLowestSellAll( const QString &market ) const
+{
+    const PositionIndex *index = getIndex( market, SIDE_SELL );
+    if ( !index || index->by_price.isEmpty() )
+        return nullptr;
+
+    return index->by_price.begin().value();
+}
+
 bool PositionMan::isDivergingConverging( const QString &market, const qint32 index ) const
 {
-    return diverging_converging[ market ].contains( index );
+    return findSlotMap( slots_dc, Market::getMarketId( market ) ).contains( index );
 }
 
 Position *PositionMan::getHighestBuyByIndex( const QString &market ) const
 {
-    Position *ret = nullptr;
-    qint32 idx_hi_buy = -1;
+    const PositionIndex *index = getIndex( market, SIDE_BUY );
+    if ( !index )
+        return nullptr;
 
-    for ( QSet<Position*>::const_iterator i = positions_active.begin(); i != positions_active.end(); i++ )
+    // walk from the highest index down to the first one we can use
+    const QMultiMap<qint32,Position*> &map = index->by_highest_index;
+    for ( QMultiMap<qint32,Position*>::const_iterator i = map.end(); i != map.begin(); )
     {
-        Position *const &pos = *i;
-        if (  pos->side != SIDE_BUY ||         // sells only
-              pos->is_cancelling ||             // must not be cancelling
-              pos->order_number.size() == 0 ||  // must be set
-              pos->market != market             // check market filter
-              )
+        i--;
+        Position *const &pos = i.value();
+        if ( i.key() < 0 )                      // no indices
+            break;
+
+        if (  pos->is_cancelling ||             // must not be cancelling
+              pos->order_number.size() == 0 )   // must be set
             continue;
 
-        const qint32 pos_idx = pos->getHighestMarketIndex();
-        if ( pos_idx > idx_hi_buy ) // position index is greater than our incrementor
-        {
-            idx_hi_buy = pos_idx;
-            ret = pos;
-        }
+        return pos;
     }
 
-    return ret;
+    return nullptr;
 }
 
 Position *PositionMan::getHighestSellByIndex( const QString &market ) const
 {
-    Position *ret = nullptr;
-    qint32 idx_hi_buy = -1;
+    const PositionIndex *index = getIndex( market, SIDE_SELL );
+    if ( !index )
+        return nullptr;
 
-    for ( QSet<Position*>::const_iterator i = positions_active.begin(); i != positions_active.end(); i++ )
+    // walk from the highest index down to the first one we can use
+    const QMultiMap<qint32,Position*> &map = index->by_highest_index;
+    for ( QMultiMap<qint32,Position*>::const_iterator i = map.end(); i != map.begin(); )
     {
-        Position *const &pos = *i;
-        if (  pos->side != SIDE_SELL ||         // sells only
-              pos->is_cancelling ||             // must not be cancelling
-              pos->order_number.size() == 0 ||  // must be set
-              pos->market != market             // check market filter
-              )
+        i--;
+        Position *const &pos = i.value();
+        if ( i.key() < 0 )                      // no indices
+            break;
+
+        if (  pos->is_cancelling ||             // must not be cancelling
+              pos->order_number.size() == 0 )   // must be set
             continue;
 
-        const qint32 pos_idx = pos->getHighestMarketIndex();
-        if ( pos_idx > idx_hi_buy ) // position index is greater than our incrementor
-        {
-            idx_hi_buy = pos_idx;
-            ret = pos;
-        }
+        return pos;
     }
 
-    return ret;
+    return nullptr;
 }
 
 Position *PositionMan::getLowestSellByIndex( const QString &market ) const
 {
-    Position *ret = nullptr;
-    qint32 idx_lo_sell = std::numeric_limits<qint32>::max();
+    const PositionIndex *index = getIndex( market, SIDE_SELL );
+    if ( !index )
+        return nullptr;
 
-    for ( QSet<Position*>::const_iterator i = positions_active.begin(); i != positions_active.end(); i++ )
+    // walk from the lowest index up to the first one we can use
+    const QMultiMap<qint32,Position*> &map = index->by_lowest_index;
+    for ( QMultiMap<qint32,Position*>::const_iterator i = map.begin(); i != map.end(); i++ )
     {
-        Position *const &pos = *i;
-        if (  pos->side != SIDE_SELL ||         // sells only
-              pos->is_cancelling ||             // must not be cancelling
-              pos->order_number.size() == 0 ||  // must be set
-              pos->market != market             // check market filter
-              )
+        Position *const &pos = i.value();
+        if ( i.key() == std::numeric_limits<qint32>::max() ) // no indices
+            break;
+
+        if (  pos->is_cancelling ||             // must not be cancelling
+              pos->order_number.size() == 0 )   // must be set
             continue;
-        const qint32 pos_idx = pos->getLowestMarketIndex();
-        if ( pos_idx < idx_lo_sell ) // position index is greater than our incrementor
-        {
-            idx_lo_sell = pos_idx;
-            ret = pos;
-        }
+
+        return pos;
     }
 
-    return ret;
+    return nullptr;
 }
 
 Position *PositionMan::getLowestBuyByIndex( const QString &market ) const
 {
-    Position *ret = nullptr;
-    qint32 idx_lo_sell = std::numeric_limits<qint32>::max();
+    const PositionIndex *index = getIndex( market, SIDE_BUY );
+    if ( !index )
+        return nullptr;
 
-    for ( QSet<Position*>::const_iterator i = positions_active.begin(); i != positions_active.end(); i++ )
+    // walk from the lowest index up to the first one we can use
+    const QMultiMap<qint32,Position*> &map = index->by_lowest_index;
+    for ( QMultiMap<qint32,Position*>::const_iterator i = map.begin(); i != map.end(); i++ )
     {
-        Position *const &pos = *i;
-        if (  pos->side != SIDE_BUY ||          // sells only
-              pos->is_cancelling ||             // must not be cancelling
-              pos->order_number.size() == 0 ||  // must be set
-              pos->market != market             // check market filter
-              )
+        Position *const &pos = i.value();
+        if ( i.key() == std::numeric_limits<qint32>::max() ) // no indices
+            break;
+
+        if (  pos->is_cancelling ||             // must not be cancelling
+              pos->order_number.size() == 0 )   // must be set
             continue;
 
-        const qint32 pos_idx = pos->getLowestMarketIndex();
-        if ( pos_idx < idx_lo_sell ) // position index is greater than our incrementor
-        {
-            idx_lo_sell = pos_idx;
-            ret = pos;
-        }
+        return pos;
     }
 
-    return ret;
+    return nullptr;
 }
 
 Position *PositionMan::getHighestBuyByPrice( const QString &market ) const
 {
-    Position *ret = nullptr;
-    Coin hi_buy = -1;
+    const PositionIndex *index = getIndex( market, SIDE_BUY );
+    if ( !index )
+        return nullptr;
 
-    for ( QSet<Position*>::const_iterator i = positions_active.begin(); i != positions_active.end(); i++ )
+    // walk from the highest price down to the first one we can use
+    for ( QMultiMap<Coin,Position*>::const_iterator i = index->by_price.end(); i != index->by_price.begin(); )
     {
-        Position *const &pos = *i;
-        if (  pos->side != SIDE_BUY ||          // sells only
-              pos->is_cancelling ||             // must not be cancelling
-              pos->order_number.size() == 0 ||  // must be set
-              pos->market != market             // check market filter
-              )
+        i--;
+        Position *const &pos = i.value();
+        if (  pos->is_cancelling ||             // must not be cancelling
+              pos->order_number.size() == 0 )   // must be set
             continue;
 
-        if ( pos->buy_price > hi_buy ) // position index is greater than our incrementor
-        {
-            hi_buy = pos->buy_price;
-            ret = pos;
-        }
+        return pos;
     }
 
-    return ret;
+    return nullptr;
 }
 
 Position *PositionMan::getLowestSellByPrice( const QString &market ) const
 {
-    Position *ret = nullptr;
-    Coin lo_sell = CoinAmount::A_LOT;
+    const PositionIndex *index = getIndex( market, SIDE_SELL );
+    if ( !index )
+        return nullptr;
 
-    for ( QSet<Position*>::const_iterator i = positions_active.begin(); i != positions_active.end(); i++ )
+    // walk from the lowest price up to the first one we can use
+    for ( QMultiMap<Coin,Position*>::const_iterator i = index->by_price.begin(); i != index->by_price.end(); i++ )
     {
-        Position *const &pos = *i;
-        if (  pos->side != SIDE_SELL ||         // sells only
-              pos->is_cancelling ||             // must not be cancelling
-              pos->order_number.size() == 0 ||  // must be set
-              pos->market != market             // check market filter
-              )
+        Position *const &pos = i.value();
+        if (  pos->is_cancelling ||             // must not be cancelling
+              pos->order_number.size() == 0 )   // must be set
             continue;
 
-        if ( pos->sell_price < lo_sell ) // position index is less than our incrementor
-        {
-            lo_sell = pos->sell_price;
-            ret = pos;
-        }
+        return pos;
     }
 
-    return ret;
+    return nullptr;
 }
 
 Position *PositionMan::getLowestPingPong( const QString &market ) const
@@ -383,7 +598,7 @@ Position *PositionMan::getLowestPingPong( const QString &market ) const
 
     // look for highest position for a market
     qint32 pos_lo_idx;
-    for ( QSet<Position*>::const_iterator i = positions_all.begin(); i != positions_all.end(); i++ )
+    for ( QVector<Position*>::const_iterator i = positions_all_list.constBegin(); i != positions_all_list.constEnd(); i++ )
     {
         Position *const &pos = *i;
 
@@ -414,7 +629,7 @@ Position *PositionMan::getHighestPingPong( const QString &market ) const
 
     // look for highest sell index for a market
     qint32 pos_hi_idx;
-    for ( QSet<Position*>::const_iterator i = positions_all.begin(); i != positions_all.end(); i++ )
+    for ( QVector<Position*>::const_iterator i = positions_all_list.constBegin(); i != positions_all_list.constEnd(); i++ )
     {
         Position *const &pos = *i;
 
@@ -439,147 +654,80 @@ Position *PositionMan::getHighestPingPong( const QString &market ) const
 
 Position *PositionMan::getHighestSpruceBuy( const QString &market ) const
 {
-    Position *ret = nullptr;
-    Coin hi_buy;
+    const PositionIndex *index = getIndex( market, SIDE_BUY );
+    if ( !index )
+        return nullptr;
 
-    for ( QSet<Position*>::const_iterator i = positions_active.begin(); i != positions_active.end(); i++ )
+    // walk from the highest price down to the first spruce buy
+    for ( QMultiMap<Coin,Position*>::const_iterator i = index->by_price.end(); i != index->by_price.begin(); )
     {
-        Position *const &pos = *i;
-        if (  pos->side != SIDE_BUY ||          // buys only
-              pos->is_cancelling ||             // must not be cancelling
-              pos->market != market ||          // check market filter
+        i--;
+        Position *const &pos = i.value();
+        if ( !i.key().isGreaterThanZero() )
+            break;
+
+        if (  pos->is_cancelling ||             // must not be cancelling
              !pos->strategy_tag.startsWith( "spruce" ) )
             continue;
 
-        if ( pos->buy_price > hi_buy )
-        {
-            hi_buy = pos->buy_price;
-            ret = pos;
-        }
+        return pos;
     }
 
-    return ret;
+    return nullptr;
 }
 
 Position *PositionMan::getLowestSpruceSell( const QString &market ) const
 {
-    Position *ret = nullptr;
-    Coin lo_sell = CoinAmount::A_LOT;
+    const PositionIndex *index = getIndex( market, SIDE_SELL );
+    if ( !index )
+        return nullptr;
 
-    for ( QSet<Position*>::const_iterator i = positions_active.begin(); i != positions_active.end(); i++ )
+    // walk from the lowest price up to the first spruce sell
+    for ( QMultiMap<Coin,Position*>::const_iterator i = index->by_price.begin(); i != index->by_price.end(); i++ )
     {
-        Position *const &pos = *i;
-        if (  pos->side != SIDE_SELL ||         // sells only
-              pos->is_cancelling ||             // must not be cancelling
-              pos->market != market ||          // check market filter
+        Position *const &pos = i.value();
+        if ( i.key() >= CoinAmount::A_LOT )
+            break;
+
+        if (  pos->is_cancelling ||             // must not be cancelling
              !pos->strategy_tag.startsWith( "spruce" ) )
             continue;
 
-        if ( pos->sell_price < lo_sell )
-        {
-            lo_sell = pos->sell_price;
-            ret = pos;
-        }
+        return pos;
     }
 
-    return ret;
+    return nullptr;
 }
 
 Position *PositionMan::getRandomSprucePosition( const QString &market, const quint8 side )
 {
-    quint32 qualifying_pos_count = 0;
-
-    QSet<Position*>::const_iterator i;
-    for ( i = positions_active.begin(); i != positions_active.end(); i++ )
-    {
-        Position *const &pos = *i;
-        if (  pos->side != side ||         // orders matching our side only
-              pos->is_cancelling ||        // must not be cancelling
-              pos->market != market ||     // check market filter
-             !pos->strategy_tag.startsWith( "spruce" ) )
-            continue;
-
-        qualifying_pos_count++;
-    }
+    const QHash<qint32,QVector<Position*>> &lists = ( side == SIDE_BUY ) ? spruce_buys : spruce_sells;
+    const QHash<qint32,QVector<Position*>>::const_iterator i = lists.find( Market::getMarketId( market ) );
 
     // if there are no qualifying positions, exit here
-    if ( qualifying_pos_count == 0 )
+    if ( i == lists.end() || i.value().isEmpty() )
         return nullptr;
 
-    // choose an index from range 0 to qualifying_pos_count -1 (2 qualyfying positions would random from 0 to 1)
-    const quint32 index_chosen = Global::getSecureRandomRange32( 0, qualifying_pos_count -1 );
-
-    // seek to index_chosen using incrementor i_idx
-    quint32 i_idx = 0;
-    for ( i = positions_active.begin(); i != positions_active.end(); i++ )
-    {
-        Position *const &pos = *i;
-        if (  pos->side != side ||         // orders matching our side only
-              pos->is_cancelling ||        // must not be cancelling
-              pos->market != market ||     // check market filter
-             !pos->strategy_tag.startsWith( "spruce" ) )
-            continue;
-
-        // if we're on the one that we chose, return it
-        if ( i_idx == index_chosen )
-            return pos;
-
-        // increment if not
-        i_idx++;
-    }
-
-    // we should never get here
-    return nullptr;
+    // choose an index from range 0 to size -1 (2 qualyfying positions would random from 0 to 1)
+    const QVector<Position*> &qualifying = i.value();
+    return qualifying.at( Global::getSecureRandomRange32( 0, qualifying.size() -1 ) );
 }
 
 qint32 PositionMan::getLowestPingPongIndex( const QString &market ) const
 {
-    qint32 new_index = std::numeric_limits<qint32>::max();
-
-    // get lowest sell from all positions
-    for ( QSet<Position*>::const_iterator i = positions_all.begin(); i != positions_all.end(); i++ )
-    {
-        Position *const &pos = *i;
-
-        // skip if one-time order
-        if ( pos->is_onetime )
-            continue;
-
-        const qint32 pos_lowest_idx = pos->getLowestMarketIndex();
-
-        if ( pos_lowest_idx < new_index &&
-            !pos->is_cancelling &&
-             pos->market == market )
-        {
-            new_index = pos_lowest_idx;
-        }
-    }
+    // the lowest slot of any non-cancelling ping-pong position
+    const QHash<qint32,PositionSlotMap>::const_iterator i = slots_pingpong.find( Market::getMarketId( market ) );
+    const qint32 new_index = ( i == slots_pingpong.end() ) ? -1 : i.value().getLowest();
 
-    return new_index;
+    return ( new_index < 0 ) ? std::numeric_limits<qint32>::max() : new_index;
 }
 
 qint32 PositionMan::getHighestPingPongIndex( const QString &market ) const
 {
-    qint32 new_index = -1;
+    // the highest slot of any non-cancelling ping-pong position
+    const QHash<qint32,PositionSlotMap>::const_iterator i = slots_pingpong.find( Market::getMarketId( market ) );
 
-    // look for the highest buy index
-    for ( QSet<Position*>::const_iterator i = positions_all.begin(); i != positions_all.end(); i++ )
-    {
-        Position *const &pos = *i;
-
-        // skip if one-time order
-        if ( pos->is_onetime )
-            continue;
-
-        const qint32 pos_highest_idx = pos->getHighestMarketIndex();
-
-        if ( pos_highest_idx > new_index &&
-            !pos->is_cancelling &&
-             pos->market == market )
-            new_index = pos_highest_idx;
-    }
-
-    return new_index;
+    return ( i == slots_pingpong.end() ) ? -1 : i.value().getHighest();
 }
 
 qint32 PositionMan::getMarketOrderTotal( const QString &market, bool onetime_only ) const
@@ -590,7 +738,7 @@ qint32 PositionMan::getMarketOrderTotal( const QString &market, bool onetime_onl
     qint32 total = 0;
 
     // get total order count for a market
-    for ( QSet<Position*>::const_iterator i = positions_all.begin(); i != positions_all.end(); i++ )
+    for ( QVector<Position*>::const_iterator i = positions_all_list.constBegin(); i != positions_all_list.constEnd(); i++ )
     {
         const Position *const &pos = *i;
 
@@ -613,7 +761,7 @@ qint32 PositionMan::getTotalOrdersForSide( const Market &market, const quint8 si
     qint32 total = 0;
 
     // get total order count for a market
-    for ( QSet<Position*>::const_iterator i = positions_all.begin(); i != positions_all.end(); i++ )
+    for ( QVector<Position*>::const_iterator i = positions_all_list.constBegin(); i != positions_all_list.constEnd(); i++ )
     {
         Position *const &pos = *i;
 
@@ -635,10 +783,9 @@ void PositionMan::flipLoSellIndex( const QString &market, QString tag )
     if ( !isActive( pos ) )
         return;
 
-    pos->strategy_tag = tag;
+    pos->setStrategyTag( tag );
     pos->per_trade_profit = Coin(); // clear trade profit from message
-    kDebug() << QString( "queued long     %1" )
-                  .arg( pos->stringifyPositionChange() );
+    kLog( LOG_LEVEL_DEBUG ) << "queued long    " << pos->logPositionChange();
 
     cancel( pos, false, CANCELLING_FOR_SHORTLONG );
 }
@@ -661,10 +808,9 @@ void PositionMan::flipHiBuyPrice( const QString &market, QString tag )
     if ( !isActive( pos ) )
         return;
 
-    pos->strategy_tag = tag;
+    pos->setStrategyTag( tag );
     pos->per_trade_profit = Coin(); // clear trade profit from message
-    kDebug() << QString( "queued short    %1" )
-                  .arg( pos->stringifyPositionChange() );
+    kLog( LOG_LEVEL_DEBUG ) << "queued short   " << pos->logPositionChange();
 
     cancel( pos, false, CANCELLING_FOR_SHORTLONG );
 }
@@ -677,10 +823,9 @@ void PositionMan::flipHiBuyIndex( const QString &market, QString tag )
     if ( !isActive( pos ) )
         return;
 
-    pos->strategy_tag = tag;
+    pos->setStrategyTag( tag );
     pos->per_trade_profit = Coin(); // clear trade profit from message
-    kDebug() << QString( "queued short    %1" )
-                  .arg( pos->stringifyPositionChange() );
+    kLog( LOG_LEVEL_DEBUG ) << "queued short   " << pos->logPositionChange();
 
     cancel( pos, false, CANCELLING_FOR_SHORTLONG );
 }
@@ -693,18 +838,29 @@ void PositionMan::flipLoSellPrice( const QString &market, QString tag )
     if ( !isActive( pos ) )
         return;
 
-    pos->strategy_tag = tag;
+    pos->setStrategyTag( tag );
     pos->per_trade_profit = Coin(); // clear trade profit from message
-    kDebug() << QString( "queued long     %1" )
-                  .arg( pos->stringifyPositionChange() );
+    kLog( LOG_LEVEL_DEBUG ) << "queued long    " << pos->logPositionChange();
 
     cancel( pos, false, CANCELLING_FOR_SHORTLONG );
 }
 
 void PositionMan::add( Position * const &pos )
 {
-    positions_queued.insert( pos );
-    positions_all.insert( pos );
+    addToList( positions_queued_list, pos, &Position::list_slot );
+    pos->in_active_list = false;
+    change_count++;
+    is_snapshot_dirty = true;
+    addToQueuedPrices( pos );
+    pos->order_queued_time = VirtualClock::currentMSecsSinceEpoch();
+    scheduleTimeoutCheck( pos, pos->order_queued_time );
+    addToList( positions_all_list, pos, &Position::all_slot );
+    addToSlots( pos );
+    addToTagBucket( pos );
+    setDCDirty( pos->market );
+
+    if ( !pos->is_cancelling )
+        addToBuySellCount( pos );
 }
 
 void PositionMan::activate( Position * const &pos, const QString &order_number )
@@ -715,16 +871,33 @@ void PositionMan::activate( Position * const &pos, const QString &order_number )
         return;
     }
 
+    activated_count++;
+    change_count++;
+    is_snapshot_dirty = true;
+    Metrics::add( Metrics::getEngineCounters( engine->engine_type ).orders_set );
+
     // set the order_set_time so we can keep track of a missing order
-    pos->order_set_time = QDateTime::currentMSecsSinceEpoch();
+    pos->order_set_time = VirtualClock::currentMSecsSinceEpoch();
+
+    // record how long the order waited in the queue and on the wire
+    engine->getLatency().addSince( "order queued->sent", pos->order_queued_time, pos->order_request_time );
+    engine->getLatency().addSince( "order sent->set", pos->order_request_time, pos->order_set_time );
 
     // the order is set, unflag as new order if set
     pos->is_new_hilo_order = false;
 
     // insert our order number into positions
-    positions_queued.remove( pos );
-    positions_active.insert( pos );
-    positions_by_number.insert( order_number, pos );
+    removeFromList( positions_queued_list, pos, &Position::list_slot );
+    addToList( positions_active_list, pos, &Position::list_slot );
+    pos->in_active_list = true;
+    removeFromQueuedPrices( pos );
+    positions_by_set_time.insert( pos->order_set_time, pos );
+    scheduleTimeoutCheck( pos, pos->order_set_time ); // now active, the deadlines changed
+    setDCDirty( pos->market );
+
+    // track spruce positions for random picks
+    if ( !pos->is_cancelling && pos->strategy_tag.startsWith( "spruce" ) )
+        addToList( ( pos->side == SIDE_BUY ? spruce_buys : spruce_sells )[ pos->market.getId() ], pos, &Position::spruce_slot );
 
     if ( engine->isTesting() )
     {
@@ -739,27 +912,41 @@ void PositionMan::activate( Position * const &pos, const QString &order_number )
             pos->order_number = order_number;
     }
 
+    // index by the number we look it up and remove it with
+    positions_by_number.insert( pos->order_number, pos );
+    engine->journalOrder( ORDER_JOURNAL_SET, pos );
+    engine->getLedger().addHold( pos->order_number.toString(), pos->market, pos->side, pos->quantity, pos->amount );
+
+    // now that the order number is set, it can be found by the hi/lo lookups
+    addToIndex( pos );
+
     // print set order
-    if ( engine->getVerbosity() > 0 )
-        kDebug() << QString( "%1 %2" )
-                    .arg( "set", -15 )
-                    .arg( pos->stringifyOrder() );
+    kLogIf( LOG_LEVEL_DEBUG, engine->getVerbosity() > 0 ) << "set            " << pos->logOrder();
 
     // check if the order was queued for a cancel (manual or automatic) while it was queued
     if ( pos->is_cancelling &&
-         pos->order_cancel_time < QDateTime::currentMSecsSinceEpoch() - engine->getSettings()->cancel_timeout )
+         pos->order_cancel_time < VirtualClock::currentMSecsSinceEpoch() - engine->getCancelTimeout() )
     {
         cancel( pos, true, pos->cancel_reason );
     }
 }
 
 void PositionMan::remove( Position * const &pos )
+{
+    if ( !detach( pos ) )
+        return;
+
+    pool.release( pos ); // we're done with this, recycle it
+    engine->checkFlattened();
+}
+
+bool PositionMan::detach( Position * const &pos )
 {
     // prevent invalid access if pos is bad
-    if ( !positions_active.contains( pos ) && !positions_queued.contains( pos ) )
+    if ( !isValid( pos ) )
     {
         kDebug() << "local error: called deletePosition with invalid position at" << &*pos;
-        return;
+        return false;
     }
 
     /// step 1: clear position from diverge/converge, if we were diverging/converging
@@ -795,13 +982,234 @@ void PositionMan::remove( Position * const &pos )
     }
 
     /// step 3: remove from maps/containers
-    positions_active.remove( pos ); // remove from active ptr list
-    positions_queued.remove( pos ); // remove from tracking queue
-    positions_all.remove( pos ); // remove from all
+    removeFromIndex( pos ); // remove from sorted active positions
+    removeFromSlots( pos ); // free its position_index slots
+    removeFromTagBucket( pos ); // remove from strategy tag totals
+    removeFromBuySellCount( pos ); // remove from buy/sell counts
+    removeFromSpruceList( pos ); // remove from random spruce picks
+    removeFromQueuedPrices( pos ); // remove from queued price matching
+    unscheduleTimeoutCheck( pos ); // remove from timeout checks
+    setDCDirty( pos->market ); // replan dc for this market
+    if ( pos->in_active_list )
+        positions_by_set_time.remove( pos->order_set_time, pos ); // remove from set time ordering
+    removeFromList( pos->in_active_list ? positions_active_list : positions_queued_list, pos, &Position::list_slot ); // remove from active or queued
+    removeFromList( positions_all_list, pos, &Position::all_slot ); // remove from all
+    pos->in_active_list = false;
+    change_count++;
+    is_snapshot_dirty = true;
     positions_by_number.remove( pos->order_number ); // remove order from positions
-    engine->getMarketInfoStructure()[ pos->market ].order_prices.removeOne( pos->price ); // remove from prices
+    engine->getLedger().releaseHold( pos->order_number.toString() ); // filled or cancelled, what's left of its hold is free
+    engine->getMarketInfoStructure()[ pos->market ].removeOrderPrice( pos->price, pos->side ); // remove from prices
+
+    return true;
+}
+
+void PositionMan::addToIndex( Position *const &pos )
+{
+    // drop any stale keys first
+    removeFromIndex( pos );
+
+    PositionIndexKeys keys;
+    keys.market_id = pos->market.getId();
+    keys.side = pos->side;
+    keys.price = ( pos->side == SIDE_BUY ) ? pos->buy_price : pos->sell_price;
+    keys.lowest_index = pos->getLowestMarketIndex();
+    keys.highest_index = pos->getHighestMarketIndex();
+
+    PositionIndex &index = ( keys.side == SIDE_BUY ) ? index_buys[ keys.market_id ] : index_sells[ keys.market_id ];
+    index.by_price.insert( keys.price, pos );
+    index.by_lowest_index.insert( keys.lowest_index, pos );
+    index.by_highest_index.insert( keys.highest_index, pos );
+
+    positions_indexed.insert( pos, keys );
+}
+
+void PositionMan::removeFromIndex( Position *const &pos )
+{
+    if ( !positions_indexed.contains( pos ) )
+        return;
+
+    // remove by the keys we indexed with
+    const PositionIndexKeys keys = positions_indexed.take( pos );
+    QHash<qint32,PositionIndex> &indices = ( keys.side == SIDE_BUY ) ? index_buys : index_sells;
+    PositionIndex &index = indices[ keys.market_id ];
+
+    index.by_price.remove( keys.price, pos );
+    index.by_lowest_index.remove( keys.lowest_index, pos );
+    index.by_highest_index.remove( keys.highest_index, pos );
+
+    if ( index.by_price.isEmpty() )
+        indices.remove( keys.market_id );
+}
+
+const PositionIndex *PositionMan::getIndex( const QString &market, const quint8 side ) const
+{
+    const QHash<qint32,PositionIndex> &indices = ( side == SIDE_BUY ) ? index_buys : index_sells;
+    const QHash<qint32,PositionIndex>::const_iterator i = indices.find( Market::getMarketId( market ) );
+
+    return ( i == indices.end() ) ? nullptr : &i.value();
+}
+
+void PositionSlotMap::add( const qint32 slot )
+{
+    if ( slot < 0 )
+        return;
+
+    if ( slot >= counts.size() )
+    {
+        counts.resize( slot +1 );
+        words.resize( ( slot >> 6 ) +1 );
+    }
+
+    if ( counts[ slot ]++ == 0 )
+        words[ slot >> 6 ] |= quint64( 1 ) << ( slot & 63 );
+}
+
+void PositionSlotMap::remove( const qint32 slot )
+{
+    if ( slot < 0 || slot >= counts.size() || counts.at( slot ) == 0 )
+        return;
+
+    if ( --counts[ slot ] == 0 )
+        words[ slot >> 6 ] &= ~( quint64( 1 ) << ( slot & 63 ) );
+}
+
+bool PositionSlotMap::contains( const qint32 slot ) const
+{
+    return slot >= 0 && ( getWord( slot >> 6 ) & ( quint64( 1 ) << ( slot & 63 ) ) ) != 0;
+}
+
+qint32 PositionSlotMap::getLowest() const
+{
+    for ( qint32 i = 0; i < words.size(); i++ )
+        if ( words.at( i ) != 0 )
+            return ( i << 6 ) + __builtin_ctzll( words.at( i ) );
+
+    return -1;
+}
+
+qint32 PositionSlotMap::getHighest() const
+{
+    for ( qint32 i = words.size() -1; i >= 0; i-- )
+        if ( words.at( i ) != 0 )
+            return ( i << 6 ) + 63 - __builtin_clzll( words.at( i ) );
+
+    return -1;
+}
+
+qint32 PositionMan::getFreeSlotAtOrBelow( const qint32 market_id, const qint32 slot ) const
+{
+    if ( slot < 0 )
+        return -1;
+
+    const PositionSlotMap &used = findSlotMap( slots_used, market_id );
+    const PositionSlotMap &dc = findSlotMap( slots_dc, market_id );
+
+    // mask off the slots above the one we start at, then walk down a word at a time
+    quint64 mask = ( slot & 63 ) == 63 ? ~quint64( 0 ) : ( quint64( 1 ) << ( ( slot & 63 ) +1 ) ) -1;
+    for ( qint32 word = slot >> 6; word >= 0; word-- )
+    {
+        const quint64 free = ~( used.getWord( word ) | dc.getWord( word ) ) & mask;
+        if ( free != 0 )
+            return ( word << 6 ) + 63 - __builtin_clzll( free );
+
+        mask = ~quint64( 0 );
+    }
+
+    return -1;
+}
+
+qint32 PositionMan::getFreeSlotAtOrAbove( const qint32 market_id, const qint32 slot ) const
+{
+    if ( slot < 0 )
+        return getFreeSlotAtOrAbove( market_id, 0 );
+
+    const PositionSlotMap &used = findSlotMap( slots_used, market_id );
+    const PositionSlotMap &dc = findSlotMap( slots_dc, market_id );
+
+    // past the end of both maps every slot is free, so this always finds one
+    quint64 mask = ~quint64( 0 ) << ( slot & 63 );
+    for ( qint32 word = slot >> 6;; word++ )
+    {
+        const quint64 free = ~( used.getWord( word ) | dc.getWord( word ) ) & mask;
+        if ( free != 0 )
+            return ( word << 6 ) + __builtin_ctzll( free );
+
+        mask = ~quint64( 0 );
+    }
+}
+
+bool PositionMan::isFreeSlot( const qint32 market_id, const qint32 slot ) const
+{
+    return !findSlotMap( slots_used, market_id ).contains( slot ) &&
+           !findSlotMap( slots_dc, market_id ).contains( slot );
+}
+
+void PositionMan::addToSlots( Position *const &pos )
+{
+    // one-time orders don't take a slot
+    if ( pos->market_indices.isEmpty() )
+        return;
+
+    removeFromSlots( pos );
+
+    PositionSlotKeys keys;
+    keys.market_id = pos->market.getId();
+    keys.indices = pos->market_indices;
+    keys.is_pingpong = !pos->is_onetime && !pos->is_cancelling;
+
+    PositionSlotMap &used = slots_used[ keys.market_id ];
+    for ( QVector<qint32>::const_iterator i = keys.indices.constBegin(); i != keys.indices.constEnd(); i++ )
+        used.add( *i );
+
+    if ( keys.is_pingpong )
+    {
+        PositionSlotMap &pingpong = slots_pingpong[ keys.market_id ];
+        for ( QVector<qint32>::const_iterator i = keys.indices.constBegin(); i != keys.indices.constEnd(); i++ )
+            pingpong.add( *i );
+    }
+
+    positions_slotted.insert( pos, keys );
+}
+
+void PositionMan::removeFromSlots( Position *const &pos )
+{
+    if ( !positions_slotted.contains( pos ) )
+        return;
+
+    removeFromPingPongSlots( pos );
 
-    delete pos; // we're done with this on the heap
+    // clear the slots we marked, its indices might have changed since
+    const PositionSlotKeys keys = positions_slotted.take( pos );
+    PositionSlotMap &used = slots_used[ keys.market_id ];
+    for ( QVector<qint32>::const_iterator i = keys.indices.constBegin(); i != keys.indices.constEnd(); i++ )
+        used.remove( *i );
+}
+
+void PositionMan::removeFromPingPongSlots( Position *const &pos )
+{
+    QHash<Position*,PositionSlotKeys>::iterator i = positions_slotted.find( pos );
+    if ( i == positions_slotted.end() || !i.value().is_pingpong )
+        return;
+
+    PositionSlotKeys &keys = i.value();
+    PositionSlotMap &pingpong = slots_pingpong[ keys.market_id ];
+    for ( QVector<qint32>::const_iterator k = keys.indices.constBegin(); k != keys.indices.constEnd(); k++ )
+        pingpong.remove( *k );
+
+    keys.is_pingpong = false;
+}
+
+void PositionMan::addDCIndex( const QString &market, const qint32 index )
+{
+    diverging_converging[ market ].append( index );
+    slots_dc[ Market::getMarketId( market ) ].add( index );
+}
+
+void PositionMan::removeDCIndex( const QString &market, const qint32 index )
+{
+    if ( diverging_converging[ market ].removeOne( index ) )
+        slots_dc[ Market::getMarketId( market ) ].remove( index );
 }
 
 void PositionMan::removeFromDC( Position * const &pos )
@@ -823,10 +1231,10 @@ void PositionMan::removeFromDC( Position * const &pos )
 
     // remove order indices from dc list that contains indices that are converging/diverging
     for ( int i = 0; i < pos->market_indices.size(); i++ )
-        diverging_converging[ pos->market ].removeOne( pos->market_indices.value( i ) );
+        removeDCIndex( pos->market, pos->market_indices.value( i ) );
 }
 
-void PositionMan::converge( QMap<QString, QVector<qint32> > &market_map, quint8 side )
+bool PositionMan::converge( QMap<QString, QVector<qint32> > &market_map, quint8 side )
 {
     int index_offset = side == SIDE_BUY ? 1 : -1;
 
@@ -879,10 +1287,9 @@ void PositionMan::converge( QMap<QString, QVector<qint32> > &market_map, quint8
             // check if we have enough orders to make a landmark
             if ( new_order.size() == dc_value )
             {
-                if ( engine->getVerbosity() > 0 )
-                    kDebug() << QString( "converging %1 %2" )
-                                 .arg( market, -MARKET_STRING_WIDTH )
-                                 .arg( Global::printVectorqint32( new_order ) );
+                kLogIf( LOG_LEVEL_DEBUG, engine->getVerbosity() > 0 ) << QString( "converging %1 %2" )
+                                                                         .arg( market, -MARKET_STRING_WIDTH )
+                                                                         .arg( Global::printVectorqint32( new_order ) );
 
                 // store positions we are cancelling
                 QVector<Position*> position_list;
@@ -896,7 +1303,7 @@ void PositionMan::converge( QMap<QString, QVector<qint32> > &market_map, quint8
                     position_list.append( pos );
 
                     // keep track of indices we should avoid autosetting
-                    diverging_converging[ market ].append( idx );
+                    addDCIndex( market, idx );
 
                     // insert into a map for tracking for when we meet dc size (note: inside the loop for tests)
                     if ( position_list.size() == dc_value )
@@ -912,11 +1319,13 @@ void PositionMan::converge( QMap<QString, QVector<qint32> > &market_map, quint8
 
         // flow control
         if ( engine->yieldToFlowControl() )
-            return;
+            return false;
     }
+
+    return true;
 }
 
-void PositionMan::diverge( QMap<QString, QVector<qint32> > &market_map )
+bool PositionMan::diverge( QMap<QString, QVector<qint32> > &market_map )
 {
     for ( QMap<QString/*market*/,QVector<qint32>>::const_iterator i = market_map.begin(); i != market_map.end(); i++ )
     {
@@ -933,14 +1342,13 @@ void PositionMan::diverge( QMap<QString, QVector<qint32> > &market_map )
         const qint32 index = indices.value( 0 );
         Position *const &pos = getByIndex( market, index ); // get position for index
 
-        if ( engine->getVerbosity() > 0 )
-            kDebug() << QString( "diverging  %1 %2" )
-                         .arg( market, -MARKET_STRING_WIDTH )
-                         .arg( Global::printVectorqint32( pos->market_indices ) );
+        kLogIf( LOG_LEVEL_DEBUG, engine->getVerbosity() > 0 ) << QString( "diverging  %1 %2" )
+                                                                 .arg( market, -MARKET_STRING_WIDTH )
+                                                                 .arg( Global::printVectorqint32( pos->market_indices ) );
 
         // store a list of indices we must set after the cancel is complete
         for ( int k = 0; k < pos->market_indices.size(); k++ )
-            diverging_converging[ market ].append( pos->market_indices.value( k ) );
+            addDCIndex( market, pos->market_indices.value( k ) );
 
         // insert into a map for tracking for when cancels are complete
         diverge_converge.insert( QVector<Position*>() << pos, qMakePair( false, pos->market_indices ) );
@@ -950,8 +1358,30 @@ void PositionMan::diverge( QMap<QString, QVector<qint32> > &market_map )
 
         // flow control
         if ( engine->yieldToFlowControl() )
-            return;
+            return false;
     }
+
+    return true;
+}
+
+void PositionMan::setCancelling( Position *const &pos )
+{
+    if ( pos->is_cancelling )
+        return;
+
+    pos->is_cancelling = true;
+    is_snapshot_dirty = true;
+    removeFromPingPongSlots( pos );
+
+    // stop counting it in the tag totals and buy/sell counts
+    updateTagTotals( pos );
+    removeFromBuySellCount( pos );
+    removeFromSpruceList( pos );
+    setDCDirty( pos->market );
+
+    // the cancel timeout starts
+    if ( timeout_check_times.contains( pos ) )
+        scheduleTimeoutCheck( pos, VirtualClock::currentMSecsSinceEpoch() );
 }
 
 void PositionMan::cancelAll( QString market )
@@ -971,16 +1401,16 @@ void PositionMan::cancelAll( QString market )
     // clear market index
     if ( market == ALL )
     {
-        for ( QHash<QString, MarketInfo>::iterator i = engine->getMarketInfoStructure().begin(); i != engine->getMarketInfoStructure().end(); i++ )
+        for ( MarketInfoTable::iterator i = engine->getMarketInfoStructure().begin(); i != engine->getMarketInfoStructure().end(); i++ )
         {
-            (*i).order_prices.clear();
+            (*i).clearOrderPrices();
             (*i).position_index.clear();
         }
         kDebug() << "cleared all market indexes";
     }
     else
     {
-        engine->getMarketInfoStructure()[ market ].order_prices.clear();
+        engine->getMarketInfoStructure()[ market ].clearOrderPrices();
         engine->getMarketInfoStructure()[ market ].position_index.clear();
         kDebug() << "cleared" << market << "market index";
     }
@@ -1011,7 +1441,7 @@ void PositionMan::cancelLocal( QString market )
     QQueue<Position*> deleted_positions;
 
     // cancel orders if we matched the market
-    for ( QSet<Position*>::const_iterator i = all().begin(); i != all().end(); i++ )
+    for ( QVector<Position*>::const_iterator i = positions_all_list.constBegin(); i != positions_all_list.constEnd(); i++ )
     {
         Position *const &pos = *i;
 
@@ -1043,15 +1473,15 @@ void PositionMan::cancelLocal( QString market )
     // clear market index
     if ( market == ALL )
     {
-        for ( QHash<QString, MarketInfo>::iterator i = engine->getMarketInfoStructure().begin(); i != engine->getMarketInfoStructure().end(); i++ )
+        for ( MarketInfoTable::iterator i = engine->getMarketInfoStructure().begin(); i != engine->getMarketInfoStructure().end(); i++ )
         {
-            (*i).order_prices.clear();
+            (*i).clearOrderPrices();
             (*i).position_index.clear();
         }
     }
     else
     {
-        engine->getMarketInfoStructure()[ market ].order_prices.clear();
+        engine->getMarketInfoStructure()[ market ].clearOrderPrices();
         engine->getMarketInfoStructure()[ market ].position_index.clear();
     }
 
@@ -1059,7 +1489,7 @@ void PositionMan::cancelLocal( QString market )
         kDebug() << "cleared" << market << "market indices";
 }
 
-void PositionMan::cancel( Position *const &pos, bool quiet, quint8 cancel_reason )
+void PositionMan::cancel( Position *const &pos, bool quiet, quint8 cancel_reason, bool send )
 {
     // check for position in ptr list
     if ( !pos || !isValid( pos ) )
@@ -1068,7 +1498,11 @@ void PositionMan::cancel( Position *const &pos, bool quiet, quint8 cancel_reason
         return;
     }
 
-    pos->is_cancelling = true;
+    setCancelling( pos );
+
+    // the price might have been moved before cancelling (slippage reset), keep the index in order
+    if ( positions_indexed.contains( pos ) )
+        addToIndex( pos );
 
     // set cancel reason (override if neccesary to change reason)
     pos->cancel_reason = cancel_reason;
@@ -1094,7 +1528,7 @@ void PositionMan::cancel( Position *const &pos, bool quiet, quint8 cancel_reason
         return;
     }
 
-    if ( !quiet )
+    if ( !quiet && engine->getVerbosity() > 0 && LOG_ENABLED( LOG_LEVEL_DEBUG ) )
     {
         // flag if the order was cancelling already
         const bool recancelling = pos->order_cancel_time > 0 || pos->is_cancelling;
@@ -1112,13 +1546,12 @@ void PositionMan::cancel( Position *const &pos, bool quiet, quint8 cancel_reason
                           cancel_reason == CANCELLING_FOR_SPRUCE_CONFLICT ? " cnf " :
                                                                            "" ); // CANCELLING_FOR_SLIPPAGE_RESET
 
-        kDebug() << QString( "%1 %2" )
-                    .arg( prefix_str, -15 )
-                    .arg( pos->stringifyOrder() );
+        kDebug() << prefix_str.leftJustified( 15 ) << pos->logOrder();
     }
 
-    // send request
-    engine->sendCancel( pos->order_number, pos, engine->engine_type == ENGINE_WAVES ? pos->market : Market() );
+    // send request (unless it goes out with the replacement order)
+    if ( send )
+        engine->sendCancel( pos->order_number, pos, engine->engine_type == ENGINE_WAVES ? pos->market : Market() );
 }
 
 void PositionMan::cancelHighest( const QString &market )
@@ -1143,21 +1576,37 @@ void PositionMan::cancelLowest( const QString &market )
 
 void PositionMan::divergeConverge()
 {
+    QMutexLocker locker( engine->getLock() );
+
     // flow control
     if ( engine->yieldToFlowControl() )
         return;
 
-    QMap<QString/*market*/,qint32> market_hi_buy_idx; // calculate hi_buy position for each market
-    QMap<QString/*market*/,bool> market_has_slippage; // track if market has a slippage order
-    for ( QSet<Position*>::const_iterator i = all().begin(); i != all().end(); i++ )
+    // nothing changed since the last plan
+    if ( !dc_all_dirty && dc_dirty_markets.isEmpty() )
+        return;
+
+    // take the dirty markets, anything that changes from here on gets planned next time
+    const bool all_dirty = dc_all_dirty;
+    const QSet<QString> dirty_markets = dc_dirty_markets;
+    dc_all_dirty = false;
+    dc_dirty_markets.clear();
+
+    QHash<QString/*market*/,qint32> market_hi_buy_idx; // calculate hi_buy position for each market
+    QSet<QString/*market*/> market_has_slippage; // track if market has a slippage order
+    for ( QVector<Position*>::const_iterator i = positions_all_list.constBegin(); i != positions_all_list.constEnd(); i++ )
     {
         Position *const &pos = *i;
         const QString &market = pos->market;
 
+        // only plan markets that changed
+        if ( !all_dirty && !dirty_markets.contains( market ) )
+            continue;
+
         // track market_has_slippage
         if ( pos->is_slippage )
         {
-            market_has_slippage[ market ] = true;
+            market_has_slippage.insert( market );
             continue;
         }
 
@@ -1176,22 +1625,38 @@ void PositionMan::divergeConverge()
     }
 
     QMap<QString/*market*/,QVector<qint32>> converge_buys, converge_sells, diverge_buys, diverge_sells;
+    QHash<QString/*market*/,QSet<qint32>> planned_buys, planned_sells; // indices already picked for converge or diverge
+    QHash<QString/*market*/,QSet<qint32>> pending; // indices that are already diverging/converging
 
     // look for orders we should converge/diverge in order from lo->hi
-    for ( QSet<Position*>::const_iterator i = all().begin(); i != all().end(); i++ )
+    for ( QVector<Position*>::const_iterator i = positions_all_list.constBegin(); i != positions_all_list.constEnd(); i++ )
     {
         Position *const &pos = *i;
         const QString &market = pos->market;
-        const MarketInfo &info = engine->getMarketInfoStructure()[ market ];
+
+        // only plan markets that changed
+        if ( !all_dirty && !dirty_markets.contains( market ) )
+            continue;
 
         // skip if one-time order or market has slippage
-        if ( pos->is_onetime || market_has_slippage.value( market ) )
+        if ( pos->is_onetime || market_has_slippage.contains( market ) )
             continue;
 
+        const MarketInfo &info = engine->getMarketInfoStructure()[ market ];
+
         // check for market dc size
         if ( info.order_dc < 2 )
             continue;
 
+        // build the pending set for this market once
+        if ( !pending.contains( market ) )
+        {
+            const QVector<qint32> &dc_indices = diverging_converging.value( market );
+            QSet<qint32> &market_pending = pending[ market ];
+            for ( QVector<qint32>::const_iterator j = dc_indices.begin(); j != dc_indices.end(); j++ )
+                market_pending.insert( *j );
+        }
+
         const qint32 first_idx = pos->getLowestMarketIndex();
 
         // check buy orders
@@ -1199,9 +1664,8 @@ void PositionMan::divergeConverge()
              !pos->is_cancelling &&                                 // must not be cancelling
              !( !engine->getSettings()->should_dc_slippage_orders && pos->is_slippage ) && // must not be slippage
               pos->order_number.size() &&                           // must be set
-             !isDivergingConverging( market, first_idx ) &&
-             !converge_buys[ market ].contains( first_idx ) &&
-             !diverge_buys[ market ].contains( first_idx ) )
+             !pending[ market ].contains( first_idx ) &&
+             !planned_buys[ market ].contains( first_idx ) )
         {
             const qint32 buy_landmark_boundary = market_hi_buy_idx[ market ] - info.order_landmark_start;
             const qint32 hi_idx = pos->getHighestMarketIndex();
@@ -1211,12 +1675,14 @@ void PositionMan::divergeConverge()
                      hi_idx < buy_landmark_boundary - info.order_dc_nice )
             {
                 converge_buys[ market ].append( first_idx );
+                planned_buys[ market ].insert( first_idx );
             }
             // landmark buy that we should diverge
             else if ( pos->is_landmark &&
                       hi_idx > buy_landmark_boundary )
             {
                 diverge_buys[ market ].append( first_idx );
+                planned_buys[ market ].insert( first_idx );
             }
         }
 
@@ -1225,9 +1691,8 @@ void PositionMan::divergeConverge()
              !pos->is_cancelling &&                                 // must not be cancelling
              !( !engine->getSettings()->should_dc_slippage_orders && pos->is_slippage ) && // must not be slippage
               pos->order_number.size() &&                           // must be set
-             !isDivergingConverging( market, first_idx ) &&
-             !converge_sells[ market ].contains( first_idx ) &&
-             !diverge_sells[ market ].contains( first_idx ) )
+             !pending[ market ].contains( first_idx ) &&
+             !planned_sells[ market ].contains( first_idx ) )
         {
             const qint32 sell_landmark_boundary = market_hi_buy_idx[ market ] + 1 + info.order_landmark_start;
             const qint32 lo_idx = pos->getLowestMarketIndex();
@@ -1237,43 +1702,199 @@ void PositionMan::divergeConverge()
                      lo_idx > sell_landmark_boundary + info.order_dc_nice )
             {
                 converge_sells[ market ].append( first_idx );
+                planned_sells[ market ].insert( first_idx );
             }
             // landmark sell that we should diverge
             else if ( pos->is_landmark &&
                       lo_idx < sell_landmark_boundary ) // check idx
             {
                 diverge_sells[ market ].append( first_idx );
+                planned_sells[ market ].insert( first_idx );
             }
         }
     }
 
-    converge( converge_buys, SIDE_BUY ); // converge buys (many)->(one)
-    converge( converge_sells, SIDE_SELL ); // converge sells (many)->(one)
+    bool finished = true;
+    finished &= converge( converge_buys, SIDE_BUY ); // converge buys (many)->(one)
+    finished &= converge( converge_sells, SIDE_SELL ); // converge sells (many)->(one)
 
-    diverge( diverge_buys ); // diverge buy (one)->(many)
-    diverge( diverge_sells ); // diverge sell (one)->(many)
+    finished &= diverge( diverge_buys ); // diverge buy (one)->(many)
+    finished &= diverge( diverge_sells ); // diverge sell (one)->(many)
+
+    // flow control cut us short, plan the markets we had candidates for again next time
+    if ( !finished )
+    {
+        const QHash<QString,QSet<qint32>> *planned[ 2 ] = { &planned_buys, &planned_sells };
+        for ( int k = 0; k < 2; k++ )
+            for ( QHash<QString,QSet<qint32>>::const_iterator j = planned[ k ]->begin(); j != planned[ k ]->end(); j++ )
+                if ( !j.value().isEmpty() )
+                    dc_dirty_markets.insert( j.key() );
+    }
 }
 
-void PositionMan::checkBuySellCount()
+void PositionMan::setDCDirty( const QString &market )
+{
+    dc_dirty_markets.insert( market );
+}
+
+void PositionMan::setDCDirtyAll()
+{
+    dc_all_dirty = true;
+}
+
+void PositionMan::addToBuySellCount( Position *const &pos )
+{
+    const QString market = pos->market;
+    if ( market.isEmpty() ||
+        ( pos->side != SIDE_BUY && pos->side != SIDE_SELL ) ||
+         positions_counted.contains( pos ) )
+        return;
+
+    QHash<QString,qint32> &counts = ( pos->side == SIDE_BUY ) ? buy_counts : sell_counts;
+    counts[ market ]++;
+
+    positions_counted.insert( pos, pos->side );
+}
+
+void PositionMan::addToList( QVector<Position*> &list, Position *const &pos, qint32 Position::*slot )
+{
+    pos->*slot = list.size();
+    list += pos;
+}
+
+void PositionMan::removeFromList( QVector<Position*> &list, Position *const &pos, qint32 Position::*slot )
+{
+    const qint32 idx = pos->*slot;
+    if ( idx < 0 || idx >= list.size() || list.at( idx ) != pos )
+        return;
+
+    // swap the last position into our slot
+    Position *const last = list.takeLast();
+    if ( last != pos )
+    {
+        list[ idx ] = last;
+        last->*slot = idx;
+    }
+
+    pos->*slot = -1;
+}
+
+void PositionMan::removeFromSpruceList( Position *const &pos )
+{
+    if ( pos->spruce_slot < 0 )
+        return;
+
+    // the side might have been flipped since, removeFromList checks the slot actually holds pos
+    const qint32 market_id = pos->market.getId();
+    QHash<qint32,QVector<Position*>> *lists[ 2 ] = { &spruce_buys, &spruce_sells };
+    for ( int k = 0; k < 2 && pos->spruce_slot > -1; k++ )
+    {
+        QHash<qint32,QVector<Position*>>::iterator i = lists[ k ]->find( market_id );
+        if ( i == lists[ k ]->end() )
+            continue;
+
+        removeFromList( i.value(), pos, &Position::spruce_slot );
+        if ( i.value().isEmpty() )
+            lists[ k ]->erase( i );
+    }
+}
+
+void PositionMan::removeFromBuySellCount( Position *const &pos )
+{
+    if ( !positions_counted.contains( pos ) )
+        return;
+
+    // uncount from the side we counted it on
+    const quint8 side = positions_counted.take( pos );
+    const QString market = pos->market;
+    QHash<QString,qint32> &counts = ( side == SIDE_BUY ) ? buy_counts : sell_counts;
+
+    if ( --counts[ market ] <= 0 )
+        counts.remove( market );
+}
+
+qint64 PositionMan::getIndexBytes() const
 {
-    QMap<QString /*market*/, qint32> buys, sells;
+    using MemoryStats::getBytes;
+
+    qint64 bytes = getBytes( positions_by_number ) + getBytes( positions_active_list ) + getBytes( positions_queued_list ) +
+                   getBytes( positions_all_list ) + getBytes( spruce_buys ) + getBytes( spruce_sells ) + getBytes( queued_by_price ) +
+                   getBytes( positions_priced ) + getBytes( positions_by_set_time ) + getBytes( timeout_checks ) +
+                   getBytes( timeout_check_times ) + getBytes( index_buys ) + getBytes( index_sells ) +
+                   getBytes( positions_indexed ) + getBytes( tag_buckets ) +
+                   getBytes( positions_tagged ) + getBytes( buy_counts ) + getBytes( sell_counts ) +
+                   getBytes( positions_counted ) + getBytes( diverge_converge ) + getBytes( diverging_converging ) +
+                   getBytes( dc_dirty_markets ) + getBytes( slots_used ) + getBytes( slots_pingpong ) + getBytes( slots_dc ) +
+                   getBytes( positions_slotted );
+
+    // the keys the hashes hold by value, long order numbers and prices allocate on their own
+    for ( QHash<OrderId, Position*>::const_iterator i = positions_by_number.begin(); i != positions_by_number.end(); i++ )
+        bytes += getBytes( i.key() );
+    for ( QHash<Position*,PositionPriceKey>::const_iterator i = positions_priced.begin(); i != positions_priced.end(); i++ )
+        bytes += getBytes( i.value().price ) * 2; // it's in queued_by_price too
+
+    // the lists and sorted indices inside each market
+    for ( QHash<qint32,QVector<Position*>>::const_iterator i = spruce_buys.begin(); i != spruce_buys.end(); i++ )
+        bytes += getBytes( i.value() );
+    for ( QHash<qint32,QVector<Position*>>::const_iterator i = spruce_sells.begin(); i != spruce_sells.end(); i++ )
+        bytes += getBytes( i.value() );
+    for ( QHash<qint32,PositionIndex>::const_iterator i = index_buys.begin(); i != index_buys.end(); i++ )
+        bytes += getBytes( i.value().by_price ) + getBytes( i.value().by_lowest_index ) + getBytes( i.value().by_highest_index );
+    for ( QHash<qint32,PositionIndex>::const_iterator i = index_sells.begin(); i != index_sells.end(); i++ )
+        bytes += getBytes( i.value().by_price ) + getBytes( i.value().by_lowest_index ) + getBytes( i.value().by_highest_index );
+    for ( QHash<PositionTagKey,PositionTagBucket>::const_iterator i = tag_buckets.begin(); i != tag_buckets.end(); i++ )
+        bytes += getBytes( i.value().positions );
+    for ( QHash<qint32,PositionSlotMap>::const_iterator i = slots_used.begin(); i != slots_used.end(); i++ )
+        bytes += getBytes( i.value().words ) + getBytes( i.value().counts );
+    for ( QHash<qint32,PositionSlotMap>::const_iterator i = slots_pingpong.begin(); i != slots_pingpong.end(); i++ )
+        bytes += getBytes( i.value().words ) + getBytes( i.value().counts );
+    for ( QHash<qint32,PositionSlotMap>::const_iterator i = slots_dc.begin(); i != slots_dc.end(); i++ )
+        bytes += getBytes( i.value().words ) + getBytes( i.value().counts );
+    for ( QHash<Position*,PositionSlotKeys>::const_iterator i = positions_slotted.begin(); i != positions_slotted.end(); i++ )
+        bytes += getBytes( i.value().indices );
+
+    return bytes;
+}
 
-    // look for highest index in active and queued positions
-    for ( QSet<Position*>::const_iterator i = all().begin(); i != all().end(); i++ )
+bool PositionMan::auditBuySellCount() const
+{
+    QHash<QString /*market*/, qint32> buys, sells;
+
+    // tally non-cancelling positions the slow way
+    for ( QVector<Position*>::const_iterator i = positions_all_list.constBegin(); i != positions_all_list.constEnd(); i++ )
     {
         const Position *const &pos = *i;
-        const QString &market = pos->market;
+        const QString market = pos->market;
 
-        if ( market.isEmpty() )
+        if ( market.isEmpty() || pos->is_cancelling )
             continue;
-        // tally buys
-        else if ( pos->side == SIDE_BUY && !pos->is_cancelling )
+        else if ( pos->side == SIDE_BUY )
             buys[ market ]++;
-        // tally sells
-        else if ( pos->side == SIDE_SELL && !pos->is_cancelling )
+        else if ( pos->side == SIDE_SELL )
             sells[ market ]++;
     }
 
+    if ( buys != buy_counts || sells != sell_counts )
+    {
+        kDebug() << "local error: buy/sell counts are out of sync, counted" << buys << sells << "tracked" << buy_counts << sell_counts;
+        return false;
+    }
+
+    return true;
+}
+
+void PositionMan::checkBuySellCount()
+{
+#ifdef QT_DEBUG
+    auditBuySellCount();
+#endif
+
+    // work on a copy, the loop below keeps its own tally as it sets and cancels orders
+    QHash<QString /*market*/, qint32> buys = buy_counts, sells = sell_counts;
+
+    // cleared if we get through every market, otherwise the engine runs us again when a request slot frees up
+    is_refill_pending = true;
+
     // run until we stop setting new orders or flow control returns
     const QList<QString> &markets = engine->getMarketInfoStructure().keys();
     quint16 new_orders_ct;
@@ -1372,6 +1993,8 @@ void PositionMan::checkBuySellCount()
     }
     while( new_orders_ct > 0 );
 
+    is_refill_pending = false;
+
     buys.clear();
     sells.clear();
 }
@@ -1396,11 +2019,10 @@ void PositionMan::setNextLowest( const QString &market, quint8 side, bool landma
 
     const MarketInfo &info = engine->getMarketInfoStructure()[ market ];
     const qint32 dc_val = info.order_dc;
+    const qint32 market_id = Market::getMarketId( market );
 
     // count down until we find an index without a position
-    while ( getByIndex( market, new_index ) ||
-            isDivergingConverging( market, new_index ) )
-        new_index--;
+    new_index = getFreeSlotAtOrBelow( market_id, new_index );
 
     // check if we ran out of indexed positions so we don't make a bogus order
     if ( new_index < 0 )
@@ -1420,12 +2042,13 @@ void PositionMan::setNextLowest( const QString &market, quint8 side, bool landma
         }
 
         // if we can't use the new index, go to the -next lowest- index and restart the loop
-        if ( getByIndex( market, new_index ) ||
-             isDivergingConverging( market, new_index ) )
+        if ( !isFreeSlot( market_id, new_index ) )
         {
-            while ( indices.size() > 1 )
-                indices.removeLast();
+            new_index = getFreeSlotAtOrBelow( market_id, new_index -1 );
+            if ( new_index < 0 )
+                break;
 
+            indices = QVector<qint32>() << new_index;
             continue;
         }
 
@@ -1452,8 +2075,7 @@ void PositionMan::setNextLowest( const QString &market, quint8 side, bool landma
 //    kDebug() << "adding idx" << indices.value( 0 ) << "from indices" << indices;
 //    kDebug() << "adding next lo pos" << market << side << data.buy_price << data.sell_price << data.order_size;
 
-    Position *pos = engine->addPosition( market, side, data.buy_price, data.sell_price, data.order_size, "active", "",
-                                 indices, landmark, true );
+    Position *pos = engine->addGridPosition( Market( market ), side, data, indices, landmark, true );
 
     // check for valid ptr
     if ( !pos )
@@ -1462,8 +2084,7 @@ void PositionMan::setNextLowest( const QString &market, quint8 side, bool landma
     // flag as non-profitable api call (it's far from the spread)
     pos->is_new_hilo_order = true;
 
-    kDebug() << QString( "setting next lo %1" )
-                 .arg( pos->stringifyNewPosition() );
+    kLog( LOG_LEVEL_DEBUG ) << "setting next lo" << pos->logNewPosition();
 }
 
 void PositionMan::setNextHighest( const QString &market, quint8 side, bool landmark )
@@ -1486,11 +2107,10 @@ void PositionMan::setNextHighest( const QString &market, quint8 side, bool landm
 
     const MarketInfo &info = engine->getMarketInfoStructure()[ market ];
     const qint32 dc_val = info.order_dc;
+    const qint32 market_id = Market::getMarketId( market );
 
     // count up until we find an index without a position
-    while ( getByIndex( market, new_index ) ||
-            isDivergingConverging( market, new_index ) )
-        new_index++;
+    new_index = getFreeSlotAtOrAbove( market_id, new_index );
 
     // check if we ran out of indexed positions
     if ( new_index >= info.position_index.size() )
@@ -1510,12 +2130,13 @@ void PositionMan::setNextHighest( const QString &market, quint8 side, bool landm
         }
 
         // if we can't use the new index, find the next valid index and restart the loop
-        if ( getByIndex( market, new_index ) ||
-             isDivergingConverging( market, new_index ) )
+        if ( !isFreeSlot( market_id, new_index ) )
         {
-            while ( indices.size() > 1 )
-                indices.removeLast();
+            new_index = getFreeSlotAtOrAbove( market_id, new_index +1 );
+            if ( new_index >= info.position_index.size() )
+                break;
 
+            indices = QVector<qint32>() << new_index;
             continue;
         }
 
@@ -1541,8 +2162,7 @@ void PositionMan::setNextHighest( const QString &market, quint8 side, bool landm
 
 //    kDebug() << "adding next hi pos" << market << side << data.buy_price << data.sell_price << data.order_size;
 
-    Position *pos = engine->addPosition( market, side, data.buy_price, data.sell_price, data.order_size, "active", "",
-                                     indices, landmark, true );
+    Position *pos = engine->addGridPosition( Market( market ), side, data, indices, landmark, true );
 
     // check for valid ptr
     if ( !pos )
@@ -1551,6 +2171,5 @@ void PositionMan::setNextHighest( const QString &market, quint8 side, bool landm
     // flag as non-profitable api call (it's far from the spread)
     pos->is_new_hilo_order = true;
 
-    kDebug() << QString( "setting next hi %1" )
-                .arg( pos->stringifyNewPosition() );
+    kLog( LOG_LEVEL_DEBUG ) << "setting next hi" << pos->logNewPosition();
 }
@@ -4,17 +4,105 @@
 #include "global.h"
 #include "coinamount.h"
 #include "market.h"
+#include "positionpool.h"
+#include "positionsnapshot.h"
 
 #include <QObject>
 #include <QMap>
 #include <QSet>
+#include <QHash>
 #include <QVector>
 #include <QPair>
 #include <QString>
+#include <QMutex>
 
 class Position;
 class Engine;
 
+// active positions of one market and side, sorted for the hi/lo lookups
+struct PositionIndex
+{
+    QMultiMap<Coin,Position*> by_price; // buy price for buys, sell price for sells
+    QMultiMap<qint32,Position*> by_lowest_index, by_highest_index;
+};
+
+// the keys a position was indexed with, its prices and indices can change before it's removed
+struct PositionIndexKeys
+{
+    qint32 market_id{ -1 };
+    quint8 side{ 0 };
+    Coin price;
+    qint32 lowest_index{ 0 }, highest_index{ 0 };
+};
+
+// which position_index slots of a market are in use, bit n of words is set while slot n has at least one user
+struct PositionSlotMap
+{
+    QVector<quint64> words;
+    QVector<qint32> counts; // users of each slot, positions can overlap while they're being replaced
+
+    void add( const qint32 slot );
+    void remove( const qint32 slot );
+    bool contains( const qint32 slot ) const;
+    quint64 getWord( const qint32 word ) const { return word < words.size() ? words.at( word ) : 0; }
+    qint32 getLowest() const; // -1 if empty
+    qint32 getHighest() const; // -1 if empty
+};
+
+// the slots a position was marked with, so they can be cleared after its indices change
+struct PositionSlotKeys
+{
+    qint32 market_id{ -1 };
+    QVector<qint32> indices;
+    bool is_pingpong{ false }; // also marked in slots_pingpong
+};
+
+// (strategy tag, market, side) key for the tag buckets
+struct PositionTagKey
+{
+    qint32 tag_id{ -1 };
+    qint32 market_id{ -1 };
+    quint8 side{ 0 };
+
+    bool operator ==( const PositionTagKey &other ) const { return tag_id == other.tag_id && market_id == other.market_id && side == other.side; }
+};
+
+inline uint qHash( const PositionTagKey &key, uint seed = 0 )
+{
+    return qHash( qMakePair( key.tag_id, key.market_id ), seed ) ^ key.side;
+}
+
+// (market, side, price) key for matching open orders to queued positions, price is the 8 decimal amount string that
+// Coin == QString compares against
+struct PositionPriceKey
+{
+    qint32 market_id{ -1 };
+    quint8 side{ 0 };
+    QString price;
+
+    bool operator ==( const PositionPriceKey &other ) const { return market_id == other.market_id && side == other.side && price == other.price; }
+};
+
+inline uint qHash( const PositionPriceKey &key, uint seed = 0 )
+{
+    return qHash( key.price, seed ) ^ qHash( key.market_id ) ^ key.side;
+}
+
+// all positions sharing a tag key, with running totals of the ones that aren't cancelling
+struct PositionTagBucket
+{
+    QSet<Position*> positions;
+    Coin amount_total; // sum of amount
+    Coin amount_inverse_total; // sum of amount * 1/price, for inverse market totals
+};
+
+// what a position was bucketed with and what it added to the totals (zero once cancelling)
+struct PositionTagEntry
+{
+    PositionTagKey key;
+    Coin amount, amount_inverse;
+};
+
 //
 // PositionMan, helps Engine manage the positions
 //
@@ -28,19 +116,27 @@ public:
     explicit PositionMan( Engine *_engine, QObject *parent = nullptr );
     ~PositionMan();
 
-    QSet<Position*> &active() { return positions_active; }
-    QSet<Position*> &queued() { return positions_queued; }
-    QSet<Position*> &all() { return positions_all; }
-    QVector<Position*> activeBySetTime() const;
+    // contiguous, in no particular order. the order changes when a position is removed
+    const QVector<Position*> &active() const { return positions_active_list; }
+    const QVector<Position*> &queued() const { return positions_queued_list; }
+    const QVector<Position*> &all() const { return positions_all_list; }
+    const QMultiMap<qint64,Position*> &activeBySetTime() const { return positions_by_set_time; } // oldest first
+    void setOrderSetTime( Position *const &pos, const qint64 set_time );
+
+    // timeout checks, Engine::onCheckTimeouts() only looks at positions whose check time has passed
+    void scheduleTimeoutCheck( Position *const &pos, const qint64 check_time );
+    Position *getDueTimeoutCheck( const qint64 current_time ) const; // earliest due position or nullptr
 
     bool hasActivePositions() const;
     bool hasQueuedPositions() const;
+    // these read the slots kept on the position. pos may be stale, the pool never frees a position it handed out
     bool isActive( Position *const &pos ) const;
     bool isQueued( Position *const &pos ) const;
     bool isValid( Position *const &pos ) const;
-    bool isValidOrderID( const QString &order_id ) const;
+    bool isValid( Position *const &pos, const quint32 generation ) const; // and it hasn't been recycled since
+    bool isValidOrderID( const OrderId &order_id ) const;
 
-    Position *getByOrderID( const QString &order_id ) const;
+    Position *getByOrderID( const OrderId &order_id ) const;
     Position *getByIndex( const QString &market, const qint32 idx ) const;
     Position *getHighestBuyAll( const QString &market ) const;
     Position *getLowestSellAll( const QString &market ) const;
@@ -58,6 +154,11 @@ public:
 
     qint32 getLowestPingPongIndex( const QString &market ) const;
     qint32 getHighestPingPongIndex( const QString &market ) const;
+    bool hasActiveInMarket( const QString &market ) const;
+    void getCrossedByTicker( const QString &market, const Coin &bid, const Coin &ask, QVector<Position*> &crossed ) const;
+    void getTouchedByTicker( const QString &market, const Coin &bid, const Coin &ask, QVector<Position*> &touched ) const; // the other side reached the price
+    Position *getQueuedByPrice( const QString &market, const quint8 side, const QString &price, const QString &amount ) const;
+
     qint32 getMarketOrderTotal( const QString &market, bool onetime_only = false ) const;
     qint32 getTotalOrdersForSide( const Market &market, const quint8 side, const QString &strategy_filter = QLatin1String() ) const;
 
@@ -71,27 +172,46 @@ public:
     Coin getHiBuyFlipPrice( const QString &market ) const;
     Coin getLoSellFlipPrice( const QString &market ) const;
 
-    Coin getActiveSpruceEquityTotal( const Market &market, const QString &strategy, quint8 side, const Coin &price_threshold );
+    Coin getActiveSpruceEquityTotal( const Market &market, const qint32 strategy_tag_id, quint8 side, const Coin &price_threshold );
+    const PositionTagBucket *getTagBucket( const qint32 strategy_tag_id, const Market &market, const quint8 side ) const; // see StrategyTag
+    void onPriceChanged( Position *const &pos ); // call after changing the amount or price of a position
 
     void add( Position *const &pos );
     void activate( Position *const &pos, const QString &order_number );
+    quint64 getActivatedCount() const { return activated_count; } // orders set since startup
+    quint64 getChangeCount() const { return change_count; } // bumped when a position is added, set or taken out
     void remove( Position *const &pos );
+    bool detach( Position *const &pos ); // like remove(), but leaves the object to the caller instead of the pool
+    PositionPool &getPool() { return pool; }
+    qint64 getIndexBytes() const; // estimated, what the lookup structures hold on top of the positions, for getmemory
+
+    // consistent views of the positions for readers that shouldn't share time with order handling, see PositionSnapshot
+    PositionSnapshotPtr publishSnapshot( const bool is_current = false ); // engine thread, a new one if they changed or it's old. is_current doesn't wait out the interval
+    PositionSnapshotPtr getSnapshot() const; // any thread, the last one published
 
     // ping-pong routines
     void checkBuySellCount();
+    bool isRefillPending() const { return is_refill_pending; } // checkBuySellCount() yielded to flow control
+    qint32 getBuyCount( const QString &market ) const { return buy_counts.value( market ); } // non-cancelling, active and queued
+    qint32 getSellCount( const QString &market ) const { return sell_counts.value( market ); }
+    bool auditBuySellCount() const;
 
     // cancel commands
-    void cancel( Position *const &pos, bool quiet = false, quint8 cancel_reason = 0 );
+    void cancel( Position *const &pos, bool quiet = false, quint8 cancel_reason = 0, bool send = true );
+    void setCancelling( Position *const &pos );
     void cancelAll( QString market );
     void cancelLocal( QString market = "" );
     void cancelHighest( const QString &market );
     void cancelLowest( const QString &market );
 
     void divergeConverge();
+    void setDCDirty( const QString &market ); // replan this market on the next divergeConverge()
+    void setDCDirtyAll();
     bool isDivergingConverging( const QString &market, const qint32 index ) const;
     int getDCCount() { return diverge_converge.size(); }
     QMap<QVector<Position*>,QPair<bool,QVector<qint32>>> &getDCMap() { return diverge_converge; }
-    QMap<QString, QVector<qint32>> &getDCPending() { return diverging_converging; }
+    const QMap<QString, QVector<qint32>> &getDCPending() const { return diverging_converging; }
+    void removeDCIndex( const QString &market, const qint32 index ); // the index is no longer reserved by a dc
 
     void setRunningCancelAll( bool b ) { is_running_cancelall = b; }
     bool isRunningCancelAll() const { return is_running_cancelall; }
@@ -101,19 +221,80 @@ private:
     void setNextLowest( const QString &market, quint8 side = SIDE_BUY, bool landmark = false );
     void setNextHighest( const QString &market, quint8 side = SIDE_SELL, bool landmark = false );
     void removeFromDC( Position *const &pos );
+    void addDCIndex( const QString &market, const qint32 index );
+
+    // free slots are neither used by a position nor reserved by a dc
+    qint32 getFreeSlotAtOrBelow( const qint32 market_id, const qint32 slot ) const; // -1 if none
+    qint32 getFreeSlotAtOrAbove( const qint32 market_id, const qint32 slot ) const;
+    bool isFreeSlot( const qint32 market_id, const qint32 slot ) const;
+    void addToSlots( Position *const &pos );
+    void removeFromSlots( Position *const &pos );
+    void removeFromPingPongSlots( Position *const &pos );
+
+    void addToIndex( Position *const &pos );
+    void removeFromIndex( Position *const &pos );
+    const PositionIndex *getIndex( const QString &market, const quint8 side ) const;
 
-    void converge( QMap<QString/*market*/,QVector<qint32>> &market_map, quint8 side );
-    void diverge( QMap<QString/*market*/,QVector<qint32>> &market_map );
+    void addToTagBucket( Position *const &pos );
+    void updateTagTotals( Position *const &pos );
+    void addToBuySellCount( Position *const &pos );
+    void addToList( QVector<Position*> &list, Position *const &pos, qint32 Position::*slot );
+    void removeFromList( QVector<Position*> &list, Position *const &pos, qint32 Position::*slot );
+    void removeFromBuySellCount( Position *const &pos );
+    void removeFromSpruceList( Position *const &pos );
+    void unscheduleTimeoutCheck( Position *const &pos );
+    void addToQueuedPrices( Position *const &pos );
+    void removeFromQueuedPrices( Position *const &pos );
+    void removeFromTagBucket( Position *const &pos );
+
+    bool converge( QMap<QString/*market*/,QVector<qint32>> &market_map, quint8 side ); // false if we yielded to flow control
+    bool diverge( QMap<QString/*market*/,QVector<qint32>> &market_map );
 
     // maintain a map of queued positions and set positions
-    QHash<QString /* orderNumber */, Position*> positions_by_number;
-    QSet<Position*> positions_active; // ptr list of active positions
-    QSet<Position*> positions_queued; // ptr list of queued positions
-    QSet<Position*> positions_all; // active and queued
+    QHash<OrderId, Position*> positions_by_number;
+    QVector<Position*> positions_active_list; // active positions, at their list_slot
+    QVector<Position*> positions_queued_list; // queued positions, at their list_slot
+    QVector<Position*> positions_all_list; // active and queued, at their all_slot
+    QHash<qint32/*market id*/,QVector<Position*>> spruce_buys, spruce_sells; // active non-cancelling spruce positions, for random picks
+    QMultiHash<PositionPriceKey,Position*> queued_by_price; // queued positions, for matching open orders
+    QHash<Position*,PositionPriceKey> positions_priced;
+    QMultiMap<qint64/*order_set_time*/,Position*> positions_by_set_time; // active positions
+    QMultiMap<qint64/*check time*/,Position*> timeout_checks; // next time each position should be checked for timeouts
+    QHash<Position*,qint64> timeout_check_times;
+
+    // recycled position objects
+    PositionPool pool;
+
+    // sorted active positions for each market and side
+    QHash<qint32/*market id*/,PositionIndex> index_buys, index_sells;
+    QHash<Position*,PositionIndexKeys> positions_indexed;
+
+    // position_index slots in use for each market, by all positions, by non-cancelling ping-pong positions and by dcs
+    QHash<qint32/*market id*/,PositionSlotMap> slots_used, slots_pingpong, slots_dc;
+    QHash<Position*,PositionSlotKeys> positions_slotted;
+
+    // all positions bucketed by strategy tag id, market and side
+    QHash<PositionTagKey,PositionTagBucket> tag_buckets;
+    QHash<Position*,PositionTagEntry> positions_tagged;
+
+    // non-cancelling positions for each market and side, for checkBuySellCount()
+    QHash<QString/*market*/,qint32> buy_counts, sell_counts;
+    QHash<Position*,quint8/*side*/> positions_counted; // filled positions are flipped before they're removed
 
     // internal dc stuff
     QMap<QVector<Position*>/*waiting for cancel*/, QPair<bool/*is_landmark*/,QVector<qint32>/*indices*/>> diverge_converge;
     QMap<QString/*market*/, QVector<qint32>/*reserved idxs*/> diverging_converging; // store a vector of converging/diverging indices
+    QSet<QString/*market*/> dc_dirty_markets; // markets whose positions changed since the last divergeConverge()
+    quint64 activated_count{ 0 };
+    quint64 change_count{ 0 };
+    bool dc_all_dirty{ true };
+    bool is_snapshot_dirty{ true };
+    bool is_refill_pending{ false };
+
+    // the last published snapshot, the mutex is only held to copy or swap the pointer
+    PositionSnapshotPtr snapshot;
+    mutable QMutex snapshot_mutex;
+    quint64 snapshot_epoch{ 0 };
 
     // cancelall command state
     QString cancel_market_filter;
@@ -0,0 +1,53 @@
+#include "positionpool.h"
+#include "position.h"
+
+PositionPool::PositionPool()
+{
+}
+
+PositionPool::~PositionPool()
+{
+    while ( free_positions.size() > 0 )
+        delete free_positions.takeLast();
+}
+
+Position *PositionPool::acquire( const Market &market, quint8 side, const Coin &buy_price, const Coin &sell_price,
+                                 const Coin &order_size, const QString &strategy_tag,
+                                 const QVector<qint32> &market_indices, bool landmark, Engine *engine )
+{
+    acquire_count++;
+
+    // nothing to recycle, make a new one
+    if ( free_positions.isEmpty() )
+        return new Position( market, side, buy_price, sell_price, order_size, strategy_tag, market_indices, landmark, engine );
+
+    // reuse the members (and their coin storage) of a released position
+    recycle_count++;
+    Position *const pos = free_positions.takeLast();
+    pos->init( market, side, buy_price, sell_price, order_size, strategy_tag, market_indices, landmark, engine );
+
+    return pos;
+}
+
+void PositionPool::reacquire( Position *const &pos, const Market &market, quint8 side, const Coin &buy_price,
+                              const Coin &sell_price, const Coin &order_size, const QString &strategy_tag,
+                              const QVector<qint32> &market_indices, bool landmark, Engine *engine )
+{
+    acquire_count++;
+    recycle_count++;
+
+    // it's a new order, so anything still holding the old generation sees it as gone
+    pos->generation++;
+    pos->init( market, side, buy_price, sell_price, order_size, strategy_tag, market_indices, landmark, engine );
+}
+
+void PositionPool::release( Position *const &pos )
+{
+    if ( !pos )
+        return;
+
+    // invalidate anything still holding this pointer and its old generation. we never free released positions
+    // before the pool goes away, so reading the generation through a stale pointer stays safe
+    pos->generation++;
+    free_positions += pos;
+}
@@ -0,0 +1,43 @@
+#ifndef POSITIONPOOL_H
+#define POSITIONPOOL_H
+
+#include "global.h"
+
+#include <QVector>
+#include <QString>
+
+class Position;
+class Market;
+class Coin;
+class Engine;
+
+//
+// PositionPool, recycles released positions so busy markets don't allocate a new one for every order
+//
+class PositionPool
+{
+public:
+    explicit PositionPool();
+    ~PositionPool();
+
+    Position *acquire( const Market &market, quint8 side, const Coin &buy_price, const Coin &sell_price,
+                       const Coin &order_size, const QString &strategy_tag = QLatin1String(),
+                       const QVector<qint32> &market_indices = QVector<qint32>(),
+                       bool landmark = false, Engine *engine = nullptr );
+    void release( Position *const &pos );
+    // a release() and acquire() that hands back the same object, for a position that's set again right away
+    void reacquire( Position *const &pos, const Market &market, quint8 side, const Coin &buy_price, const Coin &sell_price,
+                    const Coin &order_size, const QString &strategy_tag = QLatin1String(),
+                    const QVector<qint32> &market_indices = QVector<qint32>(),
+                    bool landmark = false, Engine *engine = nullptr );
+
+    qint32 getFreeCount() const { return free_positions.size(); }
+    quint64 getAcquireCount() const { return acquire_count; }
+    quint64 getRecycleCount() const { return recycle_count; }
+
+private:
+    QVector<Position*> free_positions;
+    quint64 acquire_count{ 0 }, recycle_count{ 0 };
+};
+
+#endif // POSITIONPOOL_H
@@ -0,0 +1,32 @@
+#include "positionsnapshot.h"
+#include "position.h"
+
+PositionSnapshotEntry::PositionSnapshotEntry( const Position *const &pos, const bool _is_active )
+    : market( pos->market ),
+      side( pos->side ),
+      type_flag( pos->getTypeFlag() ),
+      price_flag( pos->getPriceFlag() ),
+      is_active( _is_active ),
+      is_cancelling( pos->is_cancelling ),
+      is_landmark( pos->is_landmark ),
+      is_onetime( pos->is_onetime ),
+      price( pos->price ),
+      amount( pos->amount ),
+      quantity( pos->quantity ),
+      order_number( pos->order_number ),
+      strategy_tag( pos->strategy_tag ),
+      indices_str( pos->indices_str ),
+      market_indices( pos->market_indices ),
+      market_index_lo( pos->getLowestMarketIndex() )
+{
+}
+
+QString PositionSnapshotEntry::stringifyOrder() const
+{
+    if ( !is_active )
+        return Position::stringifyOrder( type_flag, price_flag, side, market, amount, price, nullptr, indices_str );
+
+    const QString order_number_str = order_number.toString();
+
+    return Position::stringifyOrder( type_flag, price_flag, side, market, amount, price, &order_number_str, indices_str );
+}
@@ -0,0 +1,56 @@
+#ifndef POSITIONSNAPSHOT_H
+#define POSITIONSNAPSHOT_H
+
+#include "global.h"
+#include "coinamount.h"
+#include "market.h"
+#include "orderid.h"
+
+#include <QSharedPointer>
+#include <QVector>
+#include <QString>
+
+class Position;
+
+static const qint64 POSITION_SNAPSHOT_INTERVAL = 1000; // ms, how often a changed set of positions is published
+static const qint64 POSITION_SNAPSHOT_MAX_AGE = 10000; // ms, republished anyway, some fields change without telling PositionMan
+
+// one position as it was when the snapshot was taken, plain values so it's safe to read on any thread
+struct PositionSnapshotEntry
+{
+    explicit PositionSnapshotEntry() {}
+    explicit PositionSnapshotEntry( const Position *const &pos, const bool _is_active );
+
+    QString stringifyOrder() const; // like Position::stringifyOrder(), without the order id while it's queued
+
+    Market market;
+    quint8 side{ 0 };
+    QChar type_flag, price_flag;
+    bool is_active{ false },
+         is_cancelling{ false },
+         is_landmark{ false },
+         is_onetime{ false };
+    Coin price, amount, quantity;
+    OrderId order_number;
+    QString strategy_tag;
+    QString indices_str;
+    QVector<qint32> market_indices; // shared with the position until it changes
+    qint32 market_index_lo{ 0 };
+};
+
+//
+// PositionSnapshot, every position of an engine at one point, built on the engine thread and never changed after
+// it's published. readers on other threads hold the pointer for as long as they need and walk it without a lock,
+// PositionMan swaps in the next one and the old one goes away with its last reader
+//
+struct PositionSnapshot
+{
+    quint64 epoch{ 0 }; // counts up by one per published snapshot
+    qint64 time{ 0 }; // when it was taken
+    qint32 active_count{ 0 }, queued_count{ 0 };
+    QVector<PositionSnapshotEntry> positions; // active ones first
+};
+
+typedef QSharedPointer<const PositionSnapshot> PositionSnapshotPtr;
+
+#endif // POSITIONSNAPSHOT_H
@@ -0,0 +1,82 @@
+#include "global.h"
+#include "benchreport.h"
+#include "../qbase58/qbase58.h"
+#include "../libbase58/libbase58.h"
+
+#include <QCoreApplication>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+
+#include <algorithm>
+
+// qbase58_bench: prints ns/op for base58 of the 32 byte keys/ids and 64 byte signatures we send with waves requests,
+// libbase58 against the fixed size codecs.
+// usage: ./qbase58_bench [iterations] [--json <path>]
+
+namespace
+{
+
+// keep results alive so the compiler can't drop the loops
+static qint64 int_sink = 0;
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication a( argc, argv );
+
+    QStringList args = QCoreApplication::arguments();
+    if ( !BenchReport::init( args ) )
+        return 1;
+
+    const qint32 iterations = args.size() > 1 ? std::max( args.at( 1 ).toInt(), 1 ) : 200000;
+
+    kDebug() << "qbase58_bench:" << iterations << "iterations per test";
+
+    const int sizes[] = { 32, 64 };
+
+    for ( int s = 0; s < 2; s++ )
+    {
+        const int size = sizes[ s ];
+
+        QByteArray bytes( size, Qt::Uninitialized );
+        for ( int i = 0; i < size; i++ )
+            bytes[ i ] = char( i * 37 + 11 );
+
+        const QByteArray text = QBase58::encode( bytes );
+        const uint8_t *in = reinterpret_cast<const uint8_t*>( bytes.constData() );
+
+        kDebug() << QString( "--- %1 bytes (%2 chars)" ).arg( size ).arg( text.size() );
+
+        BenchReport::measure( QString( "%1 b58enc()" ).arg( size ), iterations, [&]( qint32 )
+        {
+            char out[ 100 ];
+            size_t out_size = sizeof( out );
+            int_sink += b58enc( out, &out_size, in, size_t( size ) ) ? qint64( out_size ) : 0;
+        } );
+        BenchReport::measure( QString( "%1 b58tobin()" ).arg( size ), iterations, [&]( qint32 )
+        {
+            char out[ 100 ];
+            size_t out_size = sizeof( out );
+            int_sink += b58tobin( out, &out_size, text.constData(), size_t( text.size() ) ) ? qint64( out_size ) : 0;
+        } );
+        BenchReport::measure( QString( "%1 encode%1()" ).arg( size ), iterations, [&]( qint32 )
+        {
+            char out[ QBase58::MAX_ENCODED_64 ];
+            int_sink += size == 32 ? QBase58::encode32( in, out ) : QBase58::encode64( in, out );
+        } );
+        BenchReport::measure( QString( "%1 decode%1()" ).arg( size ), iterations, [&]( qint32 )
+        {
+            uint8_t out[ 64 ];
+            int_sink += size == 32 ? QBase58::decode32( text.constData(), text.size(), out )
+                                   : QBase58::decode64( text.constData(), text.size(), out );
+        } );
+        BenchReport::measure( QString( "%1 QBase58::encode()" ).arg( size ), iterations, [&]( qint32 ) { int_sink += QBase58::encode( bytes ).size(); } );
+        BenchReport::measure( QString( "%1 QBase58::decode()" ).arg( size ), iterations, [&]( qint32 ) { int_sink += QBase58::decode( text ).size(); } );
+    }
+
+    kDebug() << "qbase58_bench done." << int_sink;
+
+    return BenchReport::finish( "qbase58_bench" ) ? 0 : 1;
+}
@@ -0,0 +1,24 @@
+QT       = core
+
+TARGET = qbase58_bench
+DESTDIR = ../
+
+MOC_DIR = ../build-tmp/qbase58_bench
+OBJECTS_DIR = ../build-tmp/qbase58_bench
+
+CONFIG += c++14 c++17
+CONFIG += RELEASE console
+
+QMAKE_CXXFLAGS_RELEASE = -Wall -O3
+QMAKE_CFLAGS_RELEASE = -Wall -O3
+
+SOURCES += qbase58_bench.cpp \
+    benchreport.cpp \
+    ../qbase58/qbase58.cpp \
+    ../libbase58/base58.c
+
+HEADERS += build-config.h \
+    benchreport.h \
+    global.h \
+    ../qbase58/qbase58.h \
+    ../libbase58/libbase58.h
@@ -0,0 +1,75 @@
+#ifndef RATEWINDOW_H
+#define RATEWINDOW_H
+
+#include "global.h"
+
+//
+// RateWindow, a fixed window limit as the server counts it. the server tells us its count in the reply headers, we
+// add what we sent since, so the budget is the server's instead of a guess. windows are aligned to the clock like the
+// server's, and ours roll over skew_ms late so a clock that's a little ahead doesn't spend the next window early
+//
+class RateWindow
+{
+public:
+    explicit RateWindow( const qint64 _window_ms = 60000, const qint32 _limit = 0, const qint64 _skew_ms = 500 )
+        : window_ms( _window_ms ), limit( _limit ), skew_ms( _skew_ms ) {}
+
+    void setLimit( const qint64 _window_ms, const qint32 _limit ) { window_ms = qMax( qint64( 1 ), _window_ms ); limit = _limit; }
+    qint64 getWindowMs() const { return window_ms; }
+    qint32 getLimit() const { return limit; }
+    bool isKnown() const { return is_known; } // we've had a count from the server
+
+    qint64 getWindowStart( const qint64 current_time ) const { const qint64 t = current_time - skew_ms; return t - t % window_ms; }
+    qint32 getUsed( const qint64 current_time ) const { return getWindowStart( current_time ) == window_start ? used : 0; }
+
+    // n more go out now
+    void add( const qint32 n, const qint64 current_time )
+    {
+        roll( current_time );
+        used += n;
+    }
+
+    // the server counted server_used, and in_flight more were sent after the request it counted
+    void setServerUsed( const qint32 server_used, const qint32 in_flight, const qint64 current_time )
+    {
+        roll( current_time );
+        used = server_used + in_flight;
+        is_known = true;
+    }
+
+    // the server says we're over, nothing more goes out in this window
+    void setFull( const qint64 current_time )
+    {
+        roll( current_time );
+        used = qMax( used, limit );
+    }
+
+    // ms until n more fit under the limit less reserve, 0 if they fit now
+    qint64 getWaitTime( const qint32 n, const qint32 reserve, const qint64 current_time ) const
+    {
+        if ( limit <= 0 || getUsed( current_time ) + n <= limit - reserve )
+            return 0;
+
+        return getWindowStart( current_time ) + window_ms + skew_ms - current_time;
+    }
+
+private:
+    void roll( const qint64 current_time )
+    {
+        const qint64 start = getWindowStart( current_time );
+        if ( start == window_start )
+            return;
+
+        window_start = start;
+        used = 0;
+    }
+
+    qint64 window_ms;
+    qint32 limit;
+    qint64 skew_ms;
+    qint64 window_start{ -1 };
+    qint32 used{ 0 };
+    bool is_known{ false };
+};
+
+#endif // RATEWINDOW_H
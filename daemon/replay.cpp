@@ -0,0 +1,362 @@
+#include "global.h"
+#include "coinamount.h"
+#include "misctypes.h"
+#include "engine.h"
+#include "enginesettings.h"
+#include "positionman.h"
+#include "baserest.h"
+#include "commandrunner.h"
+#include "alphatracker.h"
+#include "spruce.h"
+#include "spruceoverseer.h"
+#include "marketrecorder.h"
+#include "virtualclock.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QMap>
+#include <QSet>
+#include <QDateTime>
+
+#include <algorithm>
+
+// trader-replay: feeds recorded segments (see MarketRecorder) through an engine, its positions and spruce as fast as
+// they can be processed, on the recorded clock, then prints the fills, alpha and solver timings.
+// usage: ./trader-replay [--from <time>] [--to <time>] [--markets <market,...>] <bittrex|binance|poloniex|waves>
+//                        <commands file> <segment file> [<segment file>...]
+//
+// the commands file holds the same daemon commands the cli sends (a saved spruce.settings can be pasted in) and runs
+// before the first record. the engine runs in testing mode, so it's the simulated exchange: orders rest as soon as
+// they're set, cancels are acked on the spot, and the recorded tickers fill the orders they cross once they're older
+// than ticker_safety_delay_time, the same as the live ticker fill check. segments are read in the order given.
+//
+// --from and --to take ms since the epoch or an iso date in utc, and with them or --markets only the blocks of the
+// segments that have some of those records are decompressed.
+
+namespace
+{
+
+// the live timers, run on the virtual clock instead
+static const qint64 TIMEOUT_CHECK_INTERVAL = 30000; // BaseREST::timeout_timer
+static const qint64 DIVERGE_CONVERGE_INTERVAL = 100000; // BaseREST::diverge_converge_timer
+
+struct SolveTimes
+{
+    void add( const qint64 ns )
+    {
+        count++;
+        total_ns += ns;
+        max_ns = std::max( max_ns, ns );
+    }
+
+    QString toString() const
+    {
+        return QString( "%1 runs, avg %2 ms, max %3 ms" )
+                .arg( count )
+                .arg( count > 0 ? ( total_ns / count ) / 1000000. : 0., 0, 'f', 3 )
+                .arg( max_ns / 1000000., 0, 'f', 3 );
+    }
+
+    qint64 count{ 0 };
+    qint64 total_ns{ 0 };
+    qint64 max_ns{ 0 };
+};
+
+// ms since the epoch, or an iso date in utc. 0 if it's neither
+qint64 getTime( const QString &text )
+{
+    bool ok = false;
+    const qint64 time = text.toLongLong( &ok );
+    if ( ok )
+        return time;
+
+    QDateTime date = QDateTime::fromString( text, Qt::ISODate );
+    date.setTimeSpec( Qt::UTC );
+    return date.isValid() ? date.toMSecsSinceEpoch() : 0;
+}
+
+qint8 getExchange( const QString &name )
+{
+    return name == "bittrex"  ? ENGINE_BITTREX :
+           name == "binance"  ? ENGINE_BINANCE :
+           name == "poloniex" ? ENGINE_POLONIEX :
+           name == "waves"    ? ENGINE_WAVES :
+                                -1;
+}
+
+void printResults( Engine *engine, AlphaTracker *alpha )
+{
+    Coin total_pnl, total_volume;
+    quint64 total_trades = 0;
+
+    const QList<QString> markets = alpha->getMarkets();
+    for ( QList<QString>::const_iterator i = markets.begin(); i != markets.end(); i++ )
+    {
+        const QString &market = *i;
+        const Coin buy_volume = alpha->getVolume( SIDE_BUY, market );
+        const Coin sell_volume = alpha->getVolume( SIDE_SELL, market );
+        const Coin buy_price = alpha->getAvgPrice( market, SIDE_BUY );
+        const Coin sell_price = alpha->getAvgPrice( market, SIDE_SELL );
+
+        // mark what's left over at the last mid price
+        const TickerInfo &ticker = engine->getMarketInfo( market ).ticker;
+        const Coin mid_price = ( ticker.bid + ticker.ask ) / 2;
+
+        Coin inventory;
+        if ( buy_price.isGreaterThanZero() )
+            inventory += buy_volume / buy_price;
+        if ( sell_price.isGreaterThanZero() )
+            inventory -= sell_volume / sell_price;
+
+        const Coin pnl = sell_volume - buy_volume + inventory * mid_price;
+        total_pnl += pnl;
+        total_volume += buy_volume + sell_volume;
+        total_trades += alpha->getTrades( market );
+
+        kDebug() << QString( "%1 trades %2 buy %3 @ %4 sell %5 @ %6 inventory %7 pnl %8" )
+                    .arg( market, -12 )
+                    .arg( alpha->getTrades( market ), -6 )
+                    .arg( QString( buy_volume ) )
+                    .arg( QString( buy_price ) )
+                    .arg( QString( sell_volume ) )
+                    .arg( QString( sell_price ) )
+                    .arg( QString( inventory ) )
+                    .arg( QString( pnl ) );
+    }
+
+    kDebug() << "total pnl" << QString( total_pnl );
+
+    // one line for trader-sweep to read
+    kDebug() << QString( "summary pnl %1 volume %2 orders %3 fills %4" )
+                .arg( QString( total_pnl ) )
+                .arg( QString( total_volume ) )
+                .arg( engine->getPositionMan()->getActivatedCount() )
+                .arg( total_trades );
+}
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication a( argc, argv );
+
+    QStringList args = QCoreApplication::arguments();
+
+    // the window to replay, before the other args
+    qint64 from_time = 0, to_time = 0;
+    QSet<QString> markets;
+    while ( args.size() >= 3 && args.at( 1 ).startsWith( "--" ) )
+    {
+        const QString option = args.at( 1 );
+        const QString value = args.at( 2 );
+        args.erase( args.begin() +1, args.begin() +3 );
+
+        if ( option == "--from" && ( from_time = getTime( value ) ) > 0 )
+            continue;
+        if ( option == "--to" && ( to_time = getTime( value ) ) > 0 )
+            continue;
+
+        if ( option == "--markets" )
+        {
+            const QStringList list = value.split( QChar( ',' ), QString::SkipEmptyParts );
+            for ( QStringList::const_iterator i = list.begin(); i != list.end(); i++ )
+                markets.insert( *i );
+            continue;
+        }
+
+        kDebug() << "trader-replay error: bad option" << option << value;
+        return 1;
+    }
+
+    if ( args.size() < 4 )
+    {
+        kDebug() << "usage: trader-replay [--from <time>] [--to <time>] [--markets <market,...>] <bittrex|binance|poloniex|waves> <commands file> <segment file> [<segment file>...]";
+        return 1;
+    }
+
+    const qint8 exchange = getExchange( args.at( 1 ).toLower() );
+    if ( exchange < 0 )
+    {
+        kDebug() << "trader-replay error: unknown exchange" << args.at( 1 );
+        return 1;
+    }
+
+    QFile commands_file( args.at( 2 ) );
+    if ( !commands_file.open( QIODevice::ReadOnly | QIODevice::Text ) )
+    {
+        kDebug() << "trader-replay error: couldn't open" << args.at( 2 );
+        return 1;
+    }
+
+    const QString commands = commands_file.readAll();
+
+    // the simulated engine runs as binance whatever was recorded: it fills from tickers, and in testing mode it never
+    // reaches for an exchange specific rest module, so the plain BaseREST below stands in for one
+    AlphaTracker *alpha = new AlphaTracker();
+    Spruce *spruce = new Spruce();
+    SpruceOverseer *spruce_overseer = new SpruceOverseer( spruce );
+    spruce_overseer->alpha = alpha;
+
+    Engine *engine = new Engine( ENGINE_BINANCE );
+    BaseREST *rest = new BaseREST( engine );
+    rest->keystore.setKeys( "replay", "replay" );
+
+    engine->setTesting( true );
+    engine->alpha = alpha;
+    engine->spruce = spruce;
+    engine->spruce_lock = &spruce_overseer->spruce_lock;
+    engine->spruce_portfolios = &spruce_overseer->portfolios;
+    engine->bbo = &spruce_overseer->bbo;
+
+    QVector<BaseREST*> rest_arr( 4, nullptr );
+    rest_arr[ ENGINE_BINANCE ] = rest;
+    engine->rest_arr = rest_arr;
+
+    spruce_overseer->engine_map.insert( ENGINE_BINANCE, engine );
+
+    // time the early solves apart from the scheduled ones
+    SolveTimes spruce_times, ticker_times;
+    QElapsedTimer solve_timer;
+    QObject::connect( engine, &Engine::gotTickerUpdate, spruce_overseer, [&]()
+    {
+        solve_timer.start();
+        spruce_overseer->onTickerUpdate();
+        ticker_times.add( solve_timer.nsecsElapsed() );
+    } );
+
+    CommandRunner *runner = new CommandRunner( ENGINE_BINANCE, engine, rest_arr );
+    runner->setSpruceOverseer( spruce_overseer );
+    runner->runCommandChunk( commands );
+
+    // like SpruceOverseer::loadSettings(), so the first solve doesn't build them
+    {
+        QMutexLocker locker( &spruce_overseer->spruce_lock );
+        spruce->warmUpCostFunctions();
+    }
+
+    engine->setVerbosity( 0 );
+
+    qint64 records = 0, tickers = 0, recorded_fills = 0;
+    qint64 first_time = 0, last_time = 0;
+    qint64 next_timeout_check = 0, next_diverge_converge = 0, next_spruce = 0;
+    const qint64 spruce_interval = std::max<qint64>( spruce->getIntervalSecs() * 1000, 1000 );
+
+    QElapsedTimer wall_timer;
+    wall_timer.start();
+
+    MarketRecordReader reader;
+    MarketRecord record;
+    QMap<QString, TickerInfo> ticker_data;
+    qint32 blocks_read = 0, blocks_total = 0;
+
+    for ( int i = 3; i < args.size(); i++ )
+    {
+        if ( !reader.open( args.at( i ) ) )
+            continue;
+
+        reader.setTimeRange( from_time, to_time );
+        reader.setMarkets( markets );
+        blocks_total += reader.getBlocks().size();
+
+        while ( reader.next( record ) )
+        {
+            records++;
+
+            if ( record.exchange != quint8( exchange ) )
+                continue;
+
+            if ( record.type == MARKET_RECORD_FILL )
+                recorded_fills++;
+
+            if ( record.type != MARKET_RECORD_TICKER || record.market.isEmpty() )
+                continue;
+
+            // skip records from before a segment we already passed
+            if ( record.time < last_time )
+                continue;
+
+            if ( first_time == 0 )
+            {
+                first_time = record.time;
+                next_timeout_check = first_time + TIMEOUT_CHECK_INTERVAL;
+                next_diverge_converge = first_time + DIVERGE_CONVERGE_INTERVAL;
+                next_spruce = first_time + spruce_interval;
+            }
+
+            last_time = record.time;
+            VirtualClock::setTime( record.time );
+
+            // fire the timers that came due before this record
+            while ( next_timeout_check <= record.time || next_diverge_converge <= record.time || next_spruce <= record.time )
+            {
+                if ( next_timeout_check <= next_diverge_converge && next_timeout_check <= next_spruce )
+                {
+                    VirtualClock::setTime( next_timeout_check );
+                    engine->onCheckTimeouts();
+                    next_timeout_check += TIMEOUT_CHECK_INTERVAL;
+                }
+                else if ( next_diverge_converge <= next_spruce )
+                {
+                    VirtualClock::setTime( next_diverge_converge );
+                    engine->getPositionMan()->divergeConverge();
+                    next_diverge_converge += DIVERGE_CONVERGE_INTERVAL;
+                }
+                else
+                {
+                    VirtualClock::setTime( next_spruce );
+                    solve_timer.start();
+                    spruce_overseer->onSpruceUp();
+                    spruce_times.add( solve_timer.nsecsElapsed() );
+                    next_spruce += spruce_interval;
+                }
+
+                // refills and grouped cancels are queued to the end of the pass
+                QCoreApplication::sendPostedEvents();
+            }
+
+            VirtualClock::setTime( record.time );
+
+            ticker_data.clear();
+            ticker_data.insert( record.market, TickerInfo( record.bid, record.ask ) );
+
+            // the record time stands in for the request time, so new orders get the same safety delay as live
+            engine->processTicker( rest, ticker_data, record.time );
+            tickers++;
+
+            QCoreApplication::sendPostedEvents();
+        }
+
+        blocks_read += reader.getBlocksRead();
+    }
+
+    const qint64 wall_ms = std::max<qint64>( wall_timer.elapsed(), 1 );
+    const qint64 replayed_ms = last_time - first_time;
+
+    kDebug() << QString( "replayed %1 records, %2 tickers, %3 recorded fills, %4 s of market time in %5 s (%6x)" )
+                .arg( records )
+                .arg( tickers )
+                .arg( recorded_fills )
+                .arg( replayed_ms / 1000., 0, 'f', 1 )
+                .arg( wall_ms / 1000., 0, 'f', 1 )
+                .arg( double( replayed_ms ) / wall_ms, 0, 'f', 1 );
+
+    kDebug() << "decompressed" << blocks_read << "of" << blocks_total << "blocks";
+    kDebug() << "spruce solves:" << spruce_times.toString();
+    kDebug() << "ticker triggered checks:" << ticker_times.toString();
+    kDebug() << "open positions:" << engine->getPositionMan()->active().size();
+
+    printResults( engine, alpha );
+
+    delete runner;
+    delete engine;
+    delete rest;
+    delete spruce_overseer;
+    delete spruce;
+    delete alpha;
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include "replyparser.h"
+#include "threadplacement.h"
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QJsonParseError>
+
+class ReplyParseJob : public QRunnable
+{
+public:
+    ReplyParseJob( ReplyParser *_parser, const ParsedReply &_parsed, ReplyParser::OrderListReader _reader )
+        : parser( _parser ),
+          parsed( _parsed ),
+          reader( _reader )
+    {
+    }
+
+    void run()
+    {
+        ThreadPlacement::apply( ThreadPlacement::ROLE_PARSER );
+        ReplyParser::parseData( parsed, reader );
+        parser->push( parsed );
+    }
+
+private:
+    ReplyParser *parser; // waits for the pool before it goes away
+    ParsedReply parsed;
+    ReplyParser::OrderListReader reader;
+};
+
+ReplyParser::ReplyParser( QObject *parent )
+    : QObject( parent )
+{
+    // one thread, so there's one producer and the replies come back in the order they were handed over
+    pool = new QThreadPool( this );
+    pool->setMaxThreadCount( 1 );
+    pool->setExpiryTimeout( -1 );
+}
+
+ReplyParser::~ReplyParser()
+{
+    waitForDone();
+}
+
+void ReplyParser::parse( QNetworkReply *const &reply, Request *const &request, const QByteArray &data, OrderListReader reader )
+{
+    ParsedReply parsed;
+    parsed.reply = reply;
+    parsed.request = request;
+    parsed.data = data;
+
+    in_flight++;
+    pool->start( new ReplyParseJob( this, parsed, reader ) );
+}
+
+bool ReplyParser::take( ParsedReply &parsed )
+{
+    // clear it first, a reply pushed after this point wakes us again
+    is_wake_pending.store( false, std::memory_order_release );
+
+    if ( !queue.pop( parsed ) )
+        return false;
+
+    in_flight--;
+    return true;
+}
+
+void ReplyParser::waitForDone()
+{
+    pool->waitForDone();
+}
+
+void ReplyParser::parseData( ParsedReply &parsed, OrderListReader reader )
+{
+    if ( reader && reader( parsed.data, parsed.orders ) )
+    {
+        parsed.type = ParsedReply::ORDER_LIST;
+        return;
+    }
+
+    parsed.orders.clear();
+
+    QJsonParseError error;
+    parsed.json = QJsonDocument::fromJson( parsed.data, &error );
+    parsed.type = error.error == QJsonParseError::NoError && !parsed.data.isEmpty() ? ParsedReply::JSON : ParsedReply::INVALID;
+}
+
+void ReplyParser::push( ParsedReply &result )
+{
+    // canParse() keeps in_flight under the queue size, so there's always a slot
+    if ( !queue.push( result ) )
+    {
+        kDebug() << "local error: reply parser queue is full";
+        return;
+    }
+
+    if ( !is_wake_pending.exchange( true, std::memory_order_acq_rel ) )
+        emit parsed();
+}
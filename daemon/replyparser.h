@@ -0,0 +1,77 @@
+#ifndef REPLYPARSER_H
+#define REPLYPARSER_H
+
+#include "global.h"
+#include "misctypes.h"
+#include "spscqueue.h"
+
+#include <QObject>
+#include <QByteArray>
+#include <QJsonDocument>
+#include <QVector>
+
+#include <atomic>
+
+class QNetworkReply;
+class QThreadPool;
+
+// a reply read into something the engine thread can apply without parsing
+struct ParsedReply
+{
+    enum Type : quint8
+    {
+        INVALID = 0, // neither json nor an order list, data holds the body for the error message
+        JSON,
+        ORDER_LIST
+    };
+
+    quint8 type{ INVALID };
+    QNetworkReply *reply{ nullptr }; // still ours, the parse thread doesn't touch these two
+    Request *request{ nullptr };
+    QByteArray data;
+    QJsonDocument json;
+    QVector<OrderRecord> orders;
+};
+
+//
+// ReplyParser, parses large replies on a thread of its own and hands them back through a lock-free queue, so the engine
+// thread only applies the result. it stays a single producer because the pool has one thread, and the engine thread is
+// the only consumer. parsed() is emitted once for any number of replies waiting, take() them until it returns false
+//
+class ReplyParser : public QObject
+{
+    Q_OBJECT
+
+public:
+    // reads an order list straight from the bytes, false if it isn't one. must not touch anything but its arguments
+    typedef bool (*OrderListReader)( const QByteArray &data, QVector<OrderRecord> &orders );
+
+    static const qint32 QUEUE_SIZE = 64;
+    static const qint32 ASYNC_MIN_SIZE = 32768; // smaller replies parse quicker than the trip to the parse thread
+
+    explicit ReplyParser( QObject *parent = nullptr );
+    ~ReplyParser(); // waits for the parses in flight
+
+    // the queue can't fill up, we stop handing out parses before that
+    bool canParse( const qint32 size ) const { return size >= ASYNC_MIN_SIZE && in_flight < QUEUE_SIZE; }
+    void parse( QNetworkReply *const &reply, Request *const &request, const QByteArray &data, OrderListReader reader = nullptr );
+    bool take( ParsedReply &parsed );
+    void waitForDone();
+
+    qint32 getInFlight() const { return in_flight; }
+    static void parseData( ParsedReply &parsed, OrderListReader reader ); // the parse itself, on any thread
+
+signals:
+    void parsed(); // from the parse thread, connect it queued
+
+private:
+    friend class ReplyParseJob;
+    void push( ParsedReply &result ); // on the parse thread
+
+    QThreadPool *pool{ nullptr };
+    SpscQueue<ParsedReply, QUEUE_SIZE> queue;
+    std::atomic<bool> is_wake_pending{ false };
+    qint32 in_flight{ 0 }; // handed to parse() and not taken yet, only touched on our thread
+};
+
+#endif // REPLYPARSER_H
@@ -0,0 +1,84 @@
+#include "replyparser_test.h"
+#include "replyparser.h"
+#include "spscqueue.h"
+#include "bncrest.h"
+
+#include <QJsonArray>
+
+#include <assert.h>
+
+void ReplyParserTest::test()
+{
+    // the queue holds its capacity, then wraps around in order
+    SpscQueue<qint32, 4> queue;
+    for ( qint32 i = 0; i < 4; i++ )
+        assert( queue.push( i ) );
+
+    qint32 value = 4;
+    assert( !queue.push( value ) && queue.size() == 4 );
+
+    for ( qint32 i = 0; i < 6; i++ )
+    {
+        assert( queue.pop( value ) && value == i );
+
+        value = i + 4;
+        assert( queue.push( value ) );
+    }
+
+    while ( queue.pop( value ) ) {}
+    assert( queue.isEmpty() && value == 9 );
+
+    // small replies aren't worth the trip
+    ReplyParser *parser = new ReplyParser();
+    assert( !parser->canParse( 100 ) );
+    assert( parser->canParse( ReplyParser::ASYNC_MIN_SIZE ) );
+
+    qint32 wake_count = 0;
+    QObject::connect( parser, &ReplyParser::parsed, [&]() { wake_count++; } ); // direct, on the parse thread
+
+    // the replies come back parsed, in the order they were handed over
+    parser->parse( nullptr, nullptr, "[{\"symbol\":\"LTCBTC\",\"orderId\":7,\"side\":\"BUY\",\"price\":\"0.01\",\"origQty\":\"2\"}]", &BncREST::readOpenOrders );
+    parser->parse( nullptr, nullptr, "[{\"symbol\":\"LTCBTC\",\"bidPrice\":\"0.01\"}]" );
+    parser->parse( nullptr, nullptr, "<html>", &BncREST::readOpenOrders );
+    assert( parser->getInFlight() == 3 );
+
+    parser->waitForDone();
+    assert( wake_count == 1 ); // once for all of them
+
+    QVector<ParsedReply> replies;
+    ParsedReply parsed;
+    while ( parser->take( parsed ) )
+        replies += parsed;
+
+    assert( replies.size() == 3 );
+    assert( parser->getInFlight() == 0 );
+    assert( replies.at( 0 ).type == ParsedReply::ORDER_LIST );
+    assert( replies.at( 0 ).orders.size() == 1 && replies.at( 0 ).orders.at( 0 ).order_number == "LTCBTC7" );
+    assert( replies.at( 1 ).type == ParsedReply::JSON && replies.at( 1 ).json.array().size() == 1 );
+    assert( replies.at( 2 ).type == ParsedReply::INVALID && replies.at( 2 ).data == "<html>" );
+
+    delete parser;
+
+    // exchange info is read in one pass, every alias is kept and the filters only of the markets we want
+    const QByteArray exchange_info =
+        "{\"timezone\":\"UTC\",\"rateLimits\":[{\"rateLimitType\":\"REQUEST_WEIGHT\",\"interval\":\"MINUTE\",\"intervalNum\":1,\"limit\":6000}],"
+        "\"exchangeFilters\":[],\"symbols\":["
+        "{\"symbol\":\"LTCBTC\",\"baseAsset\":\"LTC\",\"quoteAsset\":\"BTC\",\"filters\":["
+            "{\"filterType\":\"PRICE_FILTER\",\"minPrice\":\"0.00000100\",\"tickSize\":\"0.00000100\"},"
+            "{\"stepSize\":\"0.00100000\",\"filterType\":\"LOT_SIZE\"},"
+            "{\"filterType\":\"NOTIONAL\",\"minNotional\":\"0.00010000\",\"applyMinToMarket\":true}],\"permissions\":[\"SPOT\"]},"
+        "{\"symbol\":\"DOGEBTC\",\"baseAsset\":\"DOGE\",\"quoteAsset\":\"BTC\",\"filters\":[{\"filterType\":\"PRICE_FILTER\",\"tickSize\":\"0.00000001\"}]}]}";
+
+    BncExchangeInfo info;
+    assert( BncREST::readExchangeInfo( exchange_info, info, []( const QString &market ) { return market == "BTC_LTC"; } ) );
+    assert( info.rate_limits.size() == 1 && info.rate_limits.at( 0 ).limit == 6000 && info.rate_limits.at( 0 ).interval == "MINUTE" );
+    assert( info.symbols.size() == 2 );
+    assert( info.symbols.at( 0 ).market == "BTC_LTC" && info.symbols.at( 0 ).has_filters );
+    assert( info.symbols.at( 0 ).price_ticksize == Coin( "0.000001" ) && info.symbols.at( 0 ).quantity_ticksize == Coin( "0.001" ) );
+    assert( info.symbols.at( 0 ).min_notional == Coin( "0.0001" ) );
+    assert( info.symbols.at( 1 ).alias == "DOGEBTC" && info.symbols.at( 1 ).market == "BTC_DOGE" && !info.symbols.at( 1 ).has_filters );
+
+    // an error reply isn't one
+    BncExchangeInfo error_info;
+    assert( !BncREST::readExchangeInfo( "{\"code\":-1121,\"msg\":\"Invalid symbol.\"}", error_info ) );
+}
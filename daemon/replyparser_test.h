@@ -0,0 +1,9 @@
+#ifndef REPLYPARSER_TEST_H
+#define REPLYPARSER_TEST_H
+
+struct ReplyParserTest
+{
+    void test();
+};
+
+#endif // REPLYPARSER_TEST_H
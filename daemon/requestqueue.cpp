@@ -0,0 +1,59 @@
+#include "requestqueue.h"
+#include "misctypes.h"
+
+RequestQueue::RequestQueue()
+    : classes( REQUEST_CLASS_COUNT )
+{
+}
+
+void RequestQueue::append( Request *const &request )
+{
+    if ( request->request_class >= REQUEST_CLASS_COUNT )
+    {
+        kDebug() << "local error: bad request class" << request->request_class << "for" << request->api_command;
+        request->request_class = REQUEST_POLL;
+    }
+
+    request->queue_sequence = ++sequence;
+    classes[ request->request_class ].insert( RequestKey( request->priority, -request->queue_sequence ), request );
+    kind_count[ request->command_kind ]++;
+    by_command.insert( request->api_command + request->body, request );
+    count++;
+}
+
+bool RequestQueue::removeOne( Request *const &request )
+{
+    if ( request->request_class >= REQUEST_CLASS_COUNT ||
+         classes[ request->request_class ].remove( RequestKey( request->priority, -request->queue_sequence ) ) == 0 )
+        return false;
+
+    removeFromIndices( request );
+    return true;
+}
+
+Request *RequestQueue::takeFirst()
+{
+    for ( QVector<QMap<RequestKey, Request*>>::iterator c = classes.begin(); c != classes.end(); c++ )
+    {
+        if ( c->isEmpty() )
+            continue;
+
+        QMap<RequestKey, Request*>::iterator i = c->end() -1;
+        Request *request = i.value();
+        c->erase( i );
+        removeFromIndices( request );
+        return request;
+    }
+
+    return nullptr;
+}
+
+void RequestQueue::removeFromIndices( Request *const &request )
+{
+    QHash<QString, qint32>::iterator k = kind_count.find( request->command_kind );
+    if ( k != kind_count.end() && --k.value() <= 0 )
+        kind_count.erase( k );
+
+    by_command.remove( request->api_command + request->body, request );
+    count--;
+}
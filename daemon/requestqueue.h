@@ -0,0 +1,59 @@
+#ifndef REQUESTQUEUE_H
+#define REQUESTQUEUE_H
+
+#include "global.h"
+#include "coinamount.h"
+
+#include <QVector>
+#include <QMap>
+#include <QHash>
+#include <QMultiHash>
+#include <QPair>
+
+struct Request;
+
+// request classes, in the order they are sent
+static const quint8 REQUEST_CANCEL = 0;
+static const quint8 REQUEST_NEW_ORDER = 1;
+static const quint8 REQUEST_ORDER_STATUS = 2;
+static const quint8 REQUEST_POLL = 3; // ticker, books, open orders, history, etc
+static const quint8 REQUEST_CLASS_COUNT = 4;
+static const char *const REQUEST_CLASS_NAMES[ REQUEST_CLASS_COUNT ] = { "cancel", "new_order", "order_status", "poll" }; // for logs and metrics
+
+// priority, then the negated queue sequence so older requests sort after newer ones of the same priority
+typedef QPair<Coin, qint64> RequestKey;
+
+//
+// RequestQueue, queued requests bucketed by class and sorted by priority, so the next request to send is found
+// without scanning requests of a lower class. it also counts requests by command kind and indexes them by command
+// and body, so the flow control checks and removals don't scan the queue.
+//
+class RequestQueue
+{
+public:
+    explicit RequestQueue();
+
+    void append( Request *const &request ); // uses request->request_class, priority and command_kind
+    bool removeOne( Request *const &request );
+    Request *takeFirst(); // highest class and priority
+
+    bool isEmpty() const { return count == 0; }
+    qint32 size() const { return count; }
+    qint32 size( quint8 request_class ) const { return classes.at( request_class ).size(); }
+    qint32 getKindCount( const QString &command_kind ) const { return kind_count.value( command_kind ); }
+    QList<Request*> getByCommand( const QString &api_command, const QString &body ) const { return by_command.values( api_command + body ); }
+
+    // highest priority is last, requests with the same priority are in insertion order from the end
+    const QMap<RequestKey, Request*> &getClass( quint8 request_class ) const { return classes.at( request_class ); }
+
+private:
+    void removeFromIndices( Request *const &request );
+
+    QVector<QMap<RequestKey, Request*>> classes;
+    QHash<QString/*command kind*/, qint32> kind_count;
+    QMultiHash<QString/*api_command + body*/, Request*> by_command;
+    qint64 sequence{ 0 };
+    qint32 count{ 0 };
+};
+
+#endif // REQUESTQUEUE_H
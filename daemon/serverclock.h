@@ -0,0 +1,65 @@
+#ifndef SERVERCLOCK_H
+#define SERVERCLOCK_H
+
+#include "global.h"
+
+//
+// ServerClock, how far the exchange's clock is from ours, estimated like ntp from the server time of replies. a request
+// sent at t0 with a reply read at t1 saying the server was at ts puts the server at ts when we were at (t0+t1)/2, give
+// or take half the round trip and the resolution of ts. of the last SAMPLE_COUNT replies we keep the one with the
+// smallest error, and only use its offset if it's larger than that error, so a clock that's right is left alone
+//
+class ServerClock
+{
+public:
+    static const qint32 SAMPLE_COUNT = 16;
+    static const qint64 MAX_ROUND_TRIP = 5000; // ms, slower replies are too loose to say anything
+
+    explicit ServerClock( const qint64 _resolution_ms = 1000 ) : resolution_ms( _resolution_ms ) {}
+
+    // server_ms is the time the server put in the reply, truncated to the resolution
+    void addSample( const qint64 sent_ms, const qint64 server_ms, const qint64 received_ms )
+    {
+        const qint64 round_trip = received_ms - sent_ms;
+        if ( round_trip < 0 || round_trip > MAX_ROUND_TRIP || server_ms <= 0 )
+            return;
+
+        Sample &sample = samples[ next_sample ];
+        sample.offset = server_ms + resolution_ms / 2 - ( sent_ms + received_ms ) / 2;
+        sample.error = round_trip / 2 + resolution_ms / 2;
+        sample.is_set = true;
+        next_sample = ( next_sample + 1 ) % SAMPLE_COUNT;
+        sample_count++;
+
+        // the tightest of the recent ones
+        const Sample *best = nullptr;
+        for ( qint32 i = 0; i < SAMPLE_COUNT; i++ )
+            if ( samples[ i ].is_set && ( !best || samples[ i ].error < best->error ) )
+                best = &samples[ i ];
+
+        offset = qAbs( best->offset ) > best->error ? best->offset : 0;
+    }
+
+    qint64 getOffset() const { return offset; } // server - ours, ms. 0 until we know better
+    qint64 getSampleCount() const { return sample_count; }
+    qint64 toServerTime( const qint64 local_ms ) const { return local_ms + offset; }
+
+    // the server takes timestamps up to ahead_limit ms ahead of it and behind_limit ms behind, would ours be rejected?
+    bool isLocalRejected( const qint64 ahead_limit, const qint64 behind_limit ) const { return -offset > ahead_limit || offset > behind_limit; }
+
+private:
+    struct Sample
+    {
+        qint64 offset{ 0 };
+        qint64 error{ 0 };
+        bool is_set{ false };
+    };
+
+    qint64 resolution_ms;
+    Sample samples[ SAMPLE_COUNT ];
+    qint32 next_sample{ 0 };
+    qint64 sample_count{ 0 };
+    qint64 offset{ 0 };
+};
+
+#endif // SERVERCLOCK_H
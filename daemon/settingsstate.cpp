@@ -0,0 +1,75 @@
+#include "settingsstate.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QStringList>
+#include <QFile>
+
+static const quint32 SETTINGS_STATE_MAGIC = 0x54534754; // "TGST"
+
+QByteArray SettingsState::getTextHash( const QByteArray &text )
+{
+    return QCryptographicHash::hash( text, QCryptographicHash::Sha1 );
+}
+
+QString SettingsState::getResidual( const QString &text, const char *const captured[] )
+{
+    QString residual;
+
+    const QStringList lines = text.split( '\n' );
+    for ( QStringList::const_iterator i = lines.begin(); i != lines.end(); i++ )
+    {
+        // the command is the first word, like runCommandChunk() reads it
+        const QString command = i->section( QChar( ' ' ), 0, 0 ).toLower();
+        if ( command.isEmpty() )
+            continue;
+
+        bool is_captured = false;
+        for ( int j = 0; captured[ j ] != nullptr && !is_captured; j++ )
+            is_captured = command == QLatin1String( captured[ j ] );
+
+        if ( !is_captured )
+            residual += *i + '\n';
+    }
+
+    return residual;
+}
+
+QByteArray SettingsState::pack( const quint32 version, const QByteArray &text_hash, const QString &residual, const QByteArray &state )
+{
+    QByteArray data;
+    QDataStream out( &data, QIODevice::WriteOnly );
+    out.setVersion( QDataStream::Qt_5_0 );
+
+    out << SETTINGS_STATE_MAGIC << version << text_hash << residual << state;
+
+    return data;
+}
+
+bool SettingsState::unpack( const QByteArray &data, const quint32 version, const QByteArray &text_hash, QString &residual, QByteArray &state )
+{
+    QDataStream in( data );
+    in.setVersion( QDataStream::Qt_5_0 );
+
+    quint32 magic = 0, state_version = 0;
+    QByteArray state_hash;
+    in >> magic >> state_version >> state_hash;
+
+    // an old layout or a different file, replay the text
+    if ( in.status() != QDataStream::Ok || magic != SETTINGS_STATE_MAGIC || state_version != version || state_hash != text_hash )
+        return false;
+
+    in >> residual >> state;
+
+    return in.status() == QDataStream::Ok;
+}
+
+bool SettingsState::read( const QString &settings_path, const quint32 version, const QByteArray &text_hash, QString &residual, QByteArray &state )
+{
+    QFile loadfile( getPath( settings_path ) );
+
+    if ( !loadfile.open( QIODevice::ReadOnly ) )
+        return false;
+
+    return unpack( loadfile.readAll(), version, text_hash, residual, state );
+}
@@ -0,0 +1,31 @@
+#ifndef SETTINGSSTATE_H
+#define SETTINGSSTATE_H
+
+#include "global.h"
+
+#include <QString>
+#include <QByteArray>
+
+//
+// SettingsState, a binary image of the state a settings file left behind, taken right after the file was replayed.
+// the next start with the same file applies the image directly instead of running every line through CommandRunner.
+// the image is tied to the file's hash, so an edited file is replayed as text and a new image is taken after it.
+// lines whose commands the owner doesn't capture are kept in the image as text and replayed after it's applied
+//
+class SettingsState
+{
+public:
+    static QString getPath( const QString &settings_path ) { return settings_path + ".state"; }
+    static QByteArray getTextHash( const QByteArray &text );
+
+    // the lines of text whose command isn't in captured, a null terminated list of lowercase commands
+    static QString getResidual( const QString &text, const char *const captured[] );
+
+    // the owner's version is checked with its state, bump it when the state layout changes
+    static QByteArray pack( const quint32 version, const QByteArray &text_hash, const QString &residual, const QByteArray &state );
+    static bool unpack( const QByteArray &data, const quint32 version, const QByteArray &text_hash, QString &residual, QByteArray &state );
+
+    static bool read( const QString &settings_path, const quint32 version, const QByteArray &text_hash, QString &residual, QByteArray &state );
+};
+
+#endif // SETTINGSSTATE_H
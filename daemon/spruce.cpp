@@ -3,7 +3,42 @@
 #include "global.h"
 #include "market.h"
 
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QStringList>
+
+#include <algorithm>
+
+static const quint32 BINARY_STATE_VERSION = 4;
+
+namespace
+{
+
+// coins are kept as their exact string, like the start node prices in getSaveState()
+void writeCoinMap( QDataStream &out, const QMap<QString,Coin> &map )
+{
+    out << qint32( map.size() );
+    for ( QMap<QString,Coin>::const_iterator i = map.begin(); i != map.end(); i++ )
+        out << i.key() << i.value().toSubSatoshiString();
+}
+
+void readCoinMap( QDataStream &in, QMap<QString,QString> &map )
+{
+    qint32 count = 0;
+    in >> count;
+
+    for ( qint32 i = 0; i < count && in.status() == QDataStream::Ok; i++ )
+    {
+        QString key, value;
+        in >> key >> value;
+        map.insert( key, value );
+    }
+}
+
+} // namespace
+
 Spruce::Spruce()
+    : m_cost_cache( new CostFunctionCache() )
 {
     /// user settings
     m_order_size = "0.00500000";
@@ -42,8 +77,9 @@ void Spruce::clear()
     clearLiveNodes();
     clearStartNodes();
 
-    m_currency_profile_u.clear();
-    m_currency_reserve.clear();
+    m_currency_ids.clear();
+    m_currency_names.clear();
+    m_currencies.clear();
     m_start_coeffs = m_relative_coeffs = RelativeCoeffs();
     m_quantity_to_shortlong_map.clear();
     original_quantity.clear();
@@ -52,11 +88,36 @@ void Spruce::clear()
     base_currency = QString();
     currency_weight.clear();
     currency_weight_by_coin.clear();
-    m_last_coeffs.clear();
+    m_coeffs_sorted.clear();
+    m_qtys_fingerprint = 0;
+    m_qtys_changes.clear();
     m_qtys.clear();
     m_markets_beta.clear();
 }
 
+Spruce *Spruce::clone() const
+{
+    Spruce *ret = new Spruce( *this );
+
+    // deep copy the nodes, and point the currency states at the copies
+    ret->nodes_start.clear();
+    for ( QList<Node*>::const_iterator i = nodes_start.begin(); i != nodes_start.end(); i++ )
+        ret->nodes_start += new Node( **i );
+
+    ret->nodes_now.clear();
+    for ( QVector<CurrencyState>::iterator i = ret->m_currencies.begin(); i != ret->m_currencies.end(); i++ )
+        i->node_now = nullptr;
+
+    for ( QList<Node*>::const_iterator i = nodes_now.begin(); i != nodes_now.end(); i++ )
+    {
+        Node *n = new Node( **i );
+        ret->nodes_now += n;
+        ret->m_currencies[ n->id ].node_now = n;
+    }
+
+    return ret;
+}
+
 void Spruce::setCurrencyWeight( QString currency, Coin weight )
 {
     // clear by coin
@@ -87,15 +148,31 @@ Coin Spruce::getMarketWeight( QString market ) const
     return Coin();
 }
 
-Coin Spruce::getExchangeAllocation( const QString &exchange_market_key )
+Coin Spruce::getExchangeAllocation( const quint8 engine_type, const qint32 market_id ) const
 {
-    return per_exchange_market_allocations.value( exchange_market_key );
+    ExchangeMarketKey key;
+    key.engine_type = engine_type;
+    key.market_id = market_id;
+
+    return exchange_market_allocations.value( key );
 }
 
 void Spruce::setExchangeAllocation( const QString &exchange_market_key, const Coin allocation )
 {
     per_exchange_market_allocations.insert( exchange_market_key, allocation );
 
+    // split "<engine>-<market>" once here, the market can use either separator
+    const int sep_idx = exchange_market_key.indexOf( QChar( '-' ) );
+    bool is_engine_ok = false;
+    ExchangeMarketKey key;
+    key.engine_type = quint8( exchange_market_key.left( sep_idx ).toUInt( &is_engine_ok ) );
+    key.market_id = Market( exchange_market_key.mid( sep_idx +1 ) ).getId();
+
+    if ( sep_idx < 0 || !is_engine_ok || key.market_id < 0 )
+        kDebug() << "local warning: exchange allocation key" << exchange_market_key << "isn't <engine>-<market>, it won't be used";
+    else
+        exchange_market_allocations.insert( key, allocation );
+
     kDebug() << "[Spruce] exchange allocation for" << exchange_market_key << ":" << allocation;
 }
 
@@ -125,6 +202,7 @@ void Spruce::addStartNode( QString _currency, QString _quantity, QString _price
 {
     Node *n = new Node();
     n->currency = _currency;
+    n->id = getCurrencyId( _currency );
     n->quantity = _quantity;
     n->price = _price;
     n->recalculateAmountByQuantity();
@@ -138,10 +216,11 @@ void Spruce::addLiveNode( QString _currency, QString _price )
 {
     Node *n = new Node();
     n->currency = _currency;
+    n->id = getCurrencyId( _currency );
     n->price = _price;
 
     nodes_now += n;
-    nodes_now_by_currency.insert( _currency, n );
+    m_currencies[ n->id ].node_now = n;
 }
 
 void Spruce::addMarketBeta( Market m )
@@ -162,7 +241,8 @@ void Spruce::clearLiveNodes()
     while ( nodes_now.size() > 0 )
         delete nodes_now.takeFirst();
 
-    nodes_now_by_currency.clear();
+    for ( QVector<CurrencyState>::iterator i = m_currencies.begin(); i != m_currencies.end(); i++ )
+        i->node_now = nullptr;
 }
 
 void Spruce::clearStartNodes()
@@ -173,6 +253,17 @@ void Spruce::clearStartNodes()
 
 bool Spruce::calculateAmountToShortLong()
 {
+    m_is_solved = false;
+    m_is_solve_complete = true;
+
+    // the coordinator solved it
+    if ( m_is_remote )
+    {
+        m_quantity_to_shortlong_map = m_remote_targets;
+        m_is_solved = !m_remote_targets.isEmpty();
+        return m_is_solved;
+    }
+
     if ( !normalizeEquity() )
         return false;
 
@@ -191,11 +282,15 @@ bool Spruce::calculateAmountToShortLong()
         m_quantity_to_shortlong_map[ market ] = shortlong_market;
     }
 
+    m_is_solved = true;
     return true;
 }
 
-Coin Spruce::getQuantityToShortLongNow( const QString &market )
+Coin Spruce::getQuantityToShortLongNow( const QString &market ) const
 {
+    if ( m_is_remote )
+        return m_remote_targets.value( market );
+
     if ( !quantity_to_shortlong.contains( market ) )
         return Coin();
 
@@ -207,6 +302,16 @@ Coin Spruce::getQuantityToShortLongNow( const QString &market )
 void Spruce::addToShortLonged( const QString &market, const Coin &qty )
 {
     quantity_already_shortlong[ market ] += qty;
+
+    if ( m_is_reporting_fills )
+        m_reported_fills[ market ] += qty;
+}
+
+QMap<QString,Coin> Spruce::takeReportedFills()
+{
+    QMap<QString,Coin> ret;
+    ret.swap( m_reported_fills );
+    return ret;
 }
 
 QList<QString> Spruce::getCurrencies() const
@@ -236,12 +341,21 @@ QString Spruce::getSaveState()
     // save interval
     ret += QString( "setspruceinterval %1\n" ).arg( m_interval_secs );
 
+    // save price move trigger
+    ret += QString( "setsprucetrigger %1\n" ).arg( m_trigger_ratio );
+
     // save base
     ret += QString( "setsprucebasecurrency %1\n" ).arg( base_currency.isEmpty() ? "disabled" : base_currency );
 
     // save amplification
     ret += QString( "setspruceamplification %1\n" ).arg( m_amplification );
 
+    // save solver mode
+    ret += QString( "setsprucesolver %1\n" ).arg( m_solver_adaptive ? "adaptive" : "reference" );
+    ret += QString( "setsprucewarmstart %1\n" ).arg( m_solver_warm_start ? "true" : "false" );
+    ret += QString( "setsprucesolvedeadline %1\n" ).arg( m_solve_deadline_ms );
+    ret += QString( "setsprucecostimage %1\n" ).arg( getCostFunctionImage() ? "true" : "false" );
+
     // save spread tolerances
     ret += QString( "setspruceordergreed %1 %2 %3 %4\n" )
             .arg( m_order_greed )
@@ -270,6 +384,9 @@ QString Spruce::getSaveState()
     ret += QString( "setsprucesnapback %1 %2\n" ).arg( m_snapback_ratio )
                                                  .arg( m_snapback_expiry_secs );
 
+    // save routing
+    ret += QString( "setspruceroute %1\n" ).arg( m_route_bound );
+
     // save order nice market offsets
     for ( QMap<QString,Coin>::const_iterator i = m_order_nice_market_offset_buys.begin(); i != m_order_nice_market_offset_buys.end(); i++ )
     {
@@ -293,11 +410,15 @@ QString Spruce::getSaveState()
                                                                            .arg( offset_zerobound_sells );
     }
 
+    // save in currency order
+    QList<QString> currencies_sorted = m_currency_names.toList();
+    std::sort( currencies_sorted.begin(), currencies_sorted.end() );
+
     // save profile u
-    for ( QMap<QString,Coin>::const_iterator i = m_currency_profile_u.begin(); i != m_currency_profile_u.end(); i++ )
+    for ( QList<QString>::const_iterator i = currencies_sorted.begin(); i != currencies_sorted.end(); i++ )
     {
-        const QString &currency = i.key();
-        const Coin &profile_u = i.value();
+        const QString &currency = *i;
+        const Coin &profile_u = findCurrency( currency )->profile_u;
 
         // don't save default value
         if ( profile_u == DEFAULT_PROFILE_U )
@@ -309,10 +430,10 @@ QString Spruce::getSaveState()
     }
 
     // save reserve ratio
-    for ( QMap<QString,Coin>::const_iterator i = m_currency_reserve.begin(); i != m_currency_reserve.end(); i++ )
+    for ( QList<QString>::const_iterator i = currencies_sorted.begin(); i != currencies_sorted.end(); i++ )
     {
-        const QString &currency = i.key();
-        const Coin &reserve = i.value();
+        const QString &currency = *i;
+        const Coin &reserve = findCurrency( currency )->reserve;
 
         // don't save default value
         if ( reserve == DEFAULT_RESERVE )
@@ -368,12 +489,194 @@ QString Spruce::getSaveState()
     return ret;
 }
 
+QByteArray Spruce::getBinaryState() const
+{
+    QByteArray state;
+    QDataStream out( &state, QIODevice::WriteOnly );
+    out.setVersion( QDataStream::Qt_5_0 );
+
+    out << BINARY_STATE_VERSION << m_interval_secs << m_trigger_ratio.toSubSatoshiString() << base_currency
+        << m_amplification.toSubSatoshiString() << m_solver_adaptive << m_solver_warm_start;
+
+    const Coin coins[] = { m_order_greed, m_order_greed_minimum, m_order_greed_buy_randomness, m_order_greed_sell_randomness,
+                           m_order_size, m_order_nice_buys, m_order_nice_zerobound_buys, m_order_nice_spreadput_buys,
+                           m_order_nice_sells, m_order_nice_zerobound_sells, m_order_nice_spreadput_sells,
+                           m_order_nice_custom_buys, m_order_nice_custom_zerobound_buys, m_order_nice_custom_sells,
+                           m_order_nice_custom_zerobound_sells, m_snapback_ratio, m_route_bound };
+
+    for ( size_t i = 0; i < sizeof( coins ) / sizeof( coins[ 0 ] ); i++ )
+        out << coins[ i ].toSubSatoshiString();
+
+    out << m_snapback_expiry_secs << m_solve_deadline_ms << getCostFunctionImage();
+
+    writeCoinMap( out, m_order_nice_market_offset_buys );
+    writeCoinMap( out, m_order_nice_market_offset_zerobound_buys );
+    writeCoinMap( out, m_order_nice_market_offset_sells );
+    writeCoinMap( out, m_order_nice_market_offset_zerobound_sells );
+
+    // profile u and reserve of every currency
+    out << qint32( m_currency_names.size() );
+    for ( int i = 0; i < m_currency_names.size(); i++ )
+        out << m_currency_names.at( i ) << m_currencies.at( i ).profile_u.toSubSatoshiString()
+            << m_currencies.at( i ).reserve.toSubSatoshiString();
+
+    writeCoinMap( out, per_exchange_market_allocations );
+    writeCoinMap( out, currency_weight );
+
+    out << qint32( nodes_start.size() );
+    for ( QList<Node*>::const_iterator i = nodes_start.begin(); i != nodes_start.end(); i++ )
+        out << (*i)->currency << original_quantity.value( (*i)->currency ).toSubSatoshiString() << (*i)->price.toSubSatoshiString();
+
+    writeCoinMap( out, quantity_already_shortlong );
+
+    out << qint32( m_markets_beta.size() );
+    for ( QList<Market>::const_iterator i = m_markets_beta.begin(); i != m_markets_beta.end(); i++ )
+        out << QString( *i );
+
+    return state;
+}
+
+bool Spruce::readBinaryState( const QByteArray &state )
+{
+    QDataStream in( state );
+    in.setVersion( QDataStream::Qt_5_0 );
+
+    quint32 version = 0;
+    qint64 interval_secs = 0, snapback_expiry_secs = 0, solve_deadline_ms = 0;
+    QString trigger_ratio, base, amplification;
+    bool solver_adaptive = false, solver_warm_start = false, cost_function_image = false;
+    in >> version >> interval_secs >> trigger_ratio >> base >> amplification >> solver_adaptive >> solver_warm_start;
+
+    if ( version != BINARY_STATE_VERSION )
+        return false;
+
+    QString coins[ 17 ];
+    for ( int i = 0; i < 17; i++ )
+        in >> coins[ i ];
+
+    in >> snapback_expiry_secs >> solve_deadline_ms >> cost_function_image;
+
+    QMap<QString,QString> offset_buys, offset_zerobound_buys, offset_sells, offset_zerobound_sells;
+    readCoinMap( in, offset_buys );
+    readCoinMap( in, offset_zerobound_buys );
+    readCoinMap( in, offset_sells );
+    readCoinMap( in, offset_zerobound_sells );
+
+    qint32 currency_count = 0;
+    in >> currency_count;
+
+    QVector<QStringList> currencies;
+    for ( qint32 i = 0; i < currency_count && in.status() == QDataStream::Ok; i++ )
+    {
+        QString currency, profile_u, reserve;
+        in >> currency >> profile_u >> reserve;
+        currencies += QStringList() << currency << profile_u << reserve;
+    }
+
+    QMap<QString,QString> allocations, weights;
+    readCoinMap( in, allocations );
+    readCoinMap( in, weights );
+
+    qint32 node_count = 0;
+    in >> node_count;
+
+    QVector<QStringList> start_nodes;
+    for ( qint32 i = 0; i < node_count && in.status() == QDataStream::Ok; i++ )
+    {
+        QString currency, quantity, price;
+        in >> currency >> quantity >> price;
+        start_nodes += QStringList() << currency << quantity << price;
+    }
+
+    QMap<QString,QString> shortlonged;
+    readCoinMap( in, shortlonged );
+
+    qint32 beta_count = 0;
+    in >> beta_count;
+
+    QStringList betas;
+    for ( qint32 i = 0; i < beta_count && in.status() == QDataStream::Ok; i++ )
+    {
+        QString market;
+        in >> market;
+        betas += market;
+    }
+
+    if ( in.status() != QDataStream::Ok )
+    {
+        kDebug() << "local warning: spruce settings state is truncated, replaying the settings file";
+        return false;
+    }
+
+    // set it through the setters the commands use, in the order getSaveState() writes them
+    setIntervalSecs( interval_secs );
+    setTriggerRatio( trigger_ratio );
+    setBaseCurrency( base );
+    setAmplification( amplification );
+    setSolverAdaptive( solver_adaptive );
+    setSolverWarmStart( solver_warm_start );
+    setSolveDeadline( solve_deadline_ms );
+    setCostFunctionImage( cost_function_image );
+
+    setOrderGreed( coins[ 0 ] );
+    setOrderGreedMinimum( coins[ 1 ] );
+    setOrderRandomBuy( coins[ 2 ] );
+    setOrderRandomSell( coins[ 3 ] );
+    setOrderSize( coins[ 4 ] );
+    setOrderNice( SIDE_BUY, coins[ 5 ], false );
+    setOrderNiceZeroBound( SIDE_BUY, coins[ 6 ], false );
+    setOrderNiceSpreadPut( SIDE_BUY, coins[ 7 ] );
+    setOrderNice( SIDE_SELL, coins[ 8 ], false );
+    setOrderNiceZeroBound( SIDE_SELL, coins[ 9 ], false );
+    setOrderNiceSpreadPut( SIDE_SELL, coins[ 10 ] );
+    setOrderNice( SIDE_BUY, coins[ 11 ], true );
+    setOrderNiceZeroBound( SIDE_BUY, coins[ 12 ], true );
+    setOrderNice( SIDE_SELL, coins[ 13 ], true );
+    setOrderNiceZeroBound( SIDE_SELL, coins[ 14 ], true );
+    setSnapbackRatio( coins[ 15 ] );
+    setSnapbackExpiry( snapback_expiry_secs );
+    setRouteBound( coins[ 16 ] );
+
+    for ( QMap<QString,QString>::const_iterator i = offset_buys.begin(); i != offset_buys.end(); i++ )
+        setOrderNiceMarketOffset( i.key(), SIDE_BUY, i.value() );
+    for ( QMap<QString,QString>::const_iterator i = offset_zerobound_buys.begin(); i != offset_zerobound_buys.end(); i++ )
+        setOrderNiceZeroBoundMarketOffset( i.key(), SIDE_BUY, i.value() );
+    for ( QMap<QString,QString>::const_iterator i = offset_sells.begin(); i != offset_sells.end(); i++ )
+        setOrderNiceMarketOffset( i.key(), SIDE_SELL, i.value() );
+    for ( QMap<QString,QString>::const_iterator i = offset_zerobound_sells.begin(); i != offset_zerobound_sells.end(); i++ )
+        setOrderNiceZeroBoundMarketOffset( i.key(), SIDE_SELL, i.value() );
+
+    for ( QVector<QStringList>::const_iterator i = currencies.begin(); i != currencies.end(); i++ )
+    {
+        setProfileU( i->at( 0 ), i->at( 1 ) );
+        setReserve( i->at( 0 ), i->at( 2 ) );
+    }
+
+    for ( QMap<QString,QString>::const_iterator i = allocations.begin(); i != allocations.end(); i++ )
+        setExchangeAllocation( i.key(), Coin( i.value() ) );
+
+    for ( QMap<QString,QString>::const_iterator i = weights.begin(); i != weights.end(); i++ )
+        setCurrencyWeight( i.key(), i.value() );
+
+    for ( QVector<QStringList>::const_iterator i = start_nodes.begin(); i != start_nodes.end(); i++ )
+        addStartNode( i->at( 0 ), i->at( 1 ), i->at( 2 ) );
+
+    for ( QMap<QString,QString>::const_iterator i = shortlonged.begin(); i != shortlonged.end(); i++ )
+        addToShortLonged( i.key(), i.value() );
+
+    // after the start nodes, it checks their currencies
+    for ( QStringList::const_iterator i = betas.begin(); i != betas.end(); i++ )
+        addMarketBeta( Market( *i ) );
+
+    return true;
+}
+
 Coin Spruce::getOrderSize( QString market ) const
 {
     return market.isEmpty() ? m_order_size : std::max( m_order_size * getMarketWeight( market ), getUniversalMinOrderSize() );
 }
 
-Coin Spruce::getCurrencyPriceByMarket( Market market )
+Coin Spruce::getCurrencyPriceByMarket( Market market ) const
 {
     for ( QList<Node*>::const_iterator i = nodes_now.begin(); i != nodes_now.end(); i++ )
     {
@@ -388,12 +691,44 @@ Coin Spruce::getCurrencyPriceByMarket( Market market )
 
 void Spruce::setProfileU( QString currency, Coin u )
 {
-    m_currency_profile_u.insert( currency, u );
+    m_currencies[ getCurrencyId( currency ) ].profile_u = u;
+}
+
+Coin Spruce::getProfileU( QString currency ) const
+{
+    const CurrencyState *state = findCurrency( currency );
+    return state ? state->profile_u : DEFAULT_PROFILE_U;
 }
 
 void Spruce::setReserve( QString currency, Coin r )
 {
-    m_currency_reserve.insert( currency, r );
+    m_currencies[ getCurrencyId( currency ) ].reserve = r;
+}
+
+Coin Spruce::getReserve( QString currency ) const
+{
+    const CurrencyState *state = findCurrency( currency );
+    return state ? state->reserve : DEFAULT_RESERVE;
+}
+
+void Spruce::setCostFunctionImage( const bool use_image )
+{
+    if ( use_image == getCostFunctionImage() )
+        return;
+
+    // clones share the cache, so a shadow or a solving phase keeps the mode it was copied with
+    m_cost_cache.reset( new CostFunctionCache() );
+    m_cost_cache->setUseImage( use_image );
+}
+
+void Spruce::warmUpCostFunctions()
+{
+    QList<QPair<Coin,Coin>> profiles;
+    const QList<QString> currencies = getCurrencies();
+    for ( QList<QString>::const_iterator i = currencies.begin(); i != currencies.end(); i++ )
+        profiles += qMakePair( getProfileU( *i ), getReserve( *i ) );
+
+    m_cost_cache->warmUp( profiles );
 }
 
 Coin Spruce::getEquityAll()
@@ -414,10 +749,15 @@ Coin Spruce::getLastCoeffForMarket( const QString &market ) const
 {
     QString currency = Market( market ).getQuote();
 
-    if ( !m_last_coeffs.contains( currency ) )
+    const CurrencyState *state = findCurrency( currency );
+
+    if ( !state || !state->has_coeff )
+    {
         qDebug() << "[Spruce] local warning: can't find coeff for currency" << currency;
+        return Coin();
+    }
 
-    return m_last_coeffs.value( currency );
+    return state->coeff;
 }
 
 bool Spruce::normalizeEquity()
@@ -431,18 +771,23 @@ bool Spruce::normalizeEquity()
     Coin total, original_total, total_scaled;
 
     // step 1: calculate total equity
+    CoinVector quantities, prices;
+    quantities.reserve( nodes_start.size() );
+    prices.reserve( nodes_start.size() );
     for ( QList<Node*>::const_iterator i = nodes_start.begin(); i != nodes_start.end(); i++ )
     {
         Node *n = *i;
-        total += n->quantity * n->price;
+        quantities.append( n->quantity );
+        prices.append( n->price );
     }
+    total = quantities.dot( prices );
     original_total = total;
 
     // step 2: calculate mean equity if we were to weight each market the same
     QMap<QString,Coin> mean_equity_for_market;
 
     Coin mean_equity = total / nodes_start.size();
-    mean_equity.truncateByTicksize( "0.00000001" ); // toss subsatoshi digits
+    mean_equity.truncateByDecimals( CoinAmount::satoshi_decimals ); // toss subsatoshi digits
 
     // step 3: calculate weighted equity from lowest to highest weight (map is sorted by weight)
     //         for each market and recalculate mean/total equity
@@ -503,8 +848,16 @@ bool Spruce::equalizeDates()
         return false;
     }
 
-    // track shorts/longs
-    QMap<QString,Coin> shortlongs;
+    // track shorts/longs, and the amounts moved for the next warm start
+    QMap<QString,Coin> shortlongs, amounts_moved;
+    m_solution.clear();
+
+    QElapsedTimer deadline_timer;
+    if ( m_solve_deadline_ms > 0 )
+        deadline_timer.start();
+
+    // seed the nodes with the last solution
+    const bool is_warm_start = m_solver_warm_start && applyWarmStart( shortlongs, amounts_moved );
 
     // find hi/lo coeffs
     m_start_coeffs = m_relative_coeffs = getRelativeCoeffs();
@@ -513,7 +866,6 @@ bool Spruce::equalizeDates()
     static const Coin MIN_TICKSIZE = CoinAmount::SATOSHI * 50000;
     const Coin equity = getEquityAll();
     const Coin ticksize = std::max( MIN_TICKSIZE, equity / MAX_PROBLEM_PARTS );
-    const Coin ticksize_amplified = ticksize * m_amplification;
 
     // if we don't have enough to make the adjustment, abort
     if ( equity < getUniversalMinOrderSize() )
@@ -534,139 +886,352 @@ bool Spruce::equalizeDates()
     //     long lowest coeff market
     //     get new market coeffs, set new hi/lo
     ///
+    // the adaptive solver starts with large steps and halves them each time the hi/lo pair flips (we stepped
+    // over the point where their coeffs are equal), until it's down to ticksize and continues like the
+    // reference solver. the halved steps round down, so it ends near the reference solver's result, not on it.
+
+    static const int ADAPTIVE_START_STEPS = 1024; // ticksizes per step to start the adaptive solver with
+    static const int ADAPTIVE_WARM_START_STEPS = 32; // same, when we're already close from a warm start
+    static const int DEADLINE_CHECK_STEPS = 64;
 
     quint16 i = 0;
+    Coin qty_short, qty_long; // reused each iteration
+    Coin step = !m_solver_adaptive ? ticksize :
+                 is_warm_start ? ticksize * ADAPTIVE_WARM_START_STEPS : ticksize * ADAPTIVE_START_STEPS;
     while ( true )
     {
-        Node *node_long  = nodes_now_by_currency.value( m_relative_coeffs.lo_currency ),
-             *node_short = nodes_now_by_currency.value( m_relative_coeffs.hi_currency );
+        // out of time, keep what we moved so far. the clock is read every DEADLINE_CHECK_STEPS steps
+        if ( m_solve_deadline_ms > 0 && ( i % DEADLINE_CHECK_STEPS ) == 0 && i > 0 &&
+             deadline_timer.hasExpired( m_solve_deadline_ms ) )
+        {
+            m_is_solve_complete = false;
+            break;
+        }
+
+        Node *node_long  = m_relative_coeffs.lo_id > -1 ? m_currencies.at( m_relative_coeffs.lo_id ).node_now : nullptr,
+             *node_short = m_relative_coeffs.hi_id > -1 ? m_currencies.at( m_relative_coeffs.hi_id ).node_now : nullptr;
+        bool moved = false;
 
         // short highest coeff, long lowest coeff
         if ( node_long && node_short )
         {
-            Coin qty_short = ( ticksize_amplified / node_short->price ),
-                 qty_long  = ( ticksize_amplified / node_long->price );
+            // qty = step * amplification / price
+            qty_short = step.mulDiv( m_amplification, node_short->price );
+            qty_long  = step.mulDiv( m_amplification, node_long->price );
 
             if ( node_short->quantity > qty_short )
             {
                 shortlongs[ node_short->currency ] -= qty_short;
                 shortlongs[ node_long->currency  ] += qty_long;
+                amounts_moved[ node_short->currency ] -= step;
+                amounts_moved[ node_long->currency  ] += step;
 
-                node_short->amount -= ticksize;
-                node_long->amount += ticksize;
+                node_short->amount -= step;
+                node_long->amount += step;
 
                 node_short->recalculateQuantityByPrice();
                 node_long->recalculateQuantityByPrice();
+                moved = true;
             }
         }
 
-        // get new coeffs so we can analyze m_qtys
-        m_relative_coeffs = getRelativeCoeffs();
+        // get new coeffs for the two nodes we changed so we can analyze m_qtys
+        const RelativeCoeffs last_coeffs = m_relative_coeffs;
+        m_relative_coeffs = updateRelativeCoeffs( node_short, node_long );
+
+        // adaptive solver: halve the step if we overshot, or if there wasn't enough left to short
+        const bool is_coarse = step > ticksize;
+        bool is_halved = false;
+        if ( is_coarse &&
+             ( !moved ||
+               m_relative_coeffs.hi_id == last_coeffs.lo_id ||
+               m_relative_coeffs.lo_id == last_coeffs.hi_id ) )
+        {
+            step = std::max( ticksize, step / 2 );
+            is_halved = true;
+        }
 
-        // break on consistent sawtooth pattern, which means we're done!
-        if ( m_qtys.size() >= nodes_now_by_currency.size() &&
-             ( m_qtys.value( 0 ) == m_qtys.value( m_qtys.value( 0 ).size() -1 ) ||
-               m_qtys.value( 0 ) == m_qtys.value( m_qtys.value( 0 ).size() -2 ) ) )
-            break;
+        // break on consistent sawtooth pattern, which means we're done! with steps larger than ticksize it's a
+        // cycle through more than the hi/lo pair around the fixed point, halve them instead
+        const int qtys_size = m_coeffs_sorted.size();
+        if ( m_qtys.size() >= nodes_now.size() &&
+             ( isQuantitiesUnchangedSince( qtys_size -1 ) ||
+               isQuantitiesUnchangedSince( qtys_size -2 ) ) )
+        {
+            if ( !is_coarse )
+                break;
+
+            if ( !is_halved )
+                step = std::max( ticksize, step / 2 );
+        }
 
         // break at equity limit to avoid infinite loop or bad things
         if ( i++ == MAX_PROBLEM_PARTS )
             break;
     }
 
+    m_solve_iterations = i;
+
     // put shortlongs into qty_to_shortlong with market name as key
     for ( QMap<QString,Coin>::const_iterator i = shortlongs.begin(); i != shortlongs.end(); i++ )
         quantity_to_shortlong[ Market( base_currency, i.key() ) ] = i.value();
 
+    m_solution = amounts_moved;
+    return true;
+}
+
+bool Spruce::applyWarmStart( QMap<QString,Coin> &shortlongs, QMap<QString,Coin> &amounts_moved )
+{
+    if ( m_warm_start_solution.isEmpty() )
+        return false;
+
+    // the solution moves amounts between nodes, so it stays zero-sum at any price. make sure it fits
+    // the normalized nodes before touching them.
+    for ( QList<Node*>::const_iterator i = nodes_now.begin(); i != nodes_now.end(); i++ )
+    {
+        const Node *n = *i;
+
+        if ( !( n->amount + m_warm_start_solution.value( n->currency ) ).isGreaterThanZero() )
+        {
+            kDebug() << "[Spruce] local warning: warm start solution doesn't fit" << n->currency << ", solving from the start nodes";
+            return false;
+        }
+    }
+
+    for ( QList<Node*>::const_iterator i = nodes_now.begin(); i != nodes_now.end(); i++ )
+    {
+        Node *n = *i;
+        const Coin &amount = m_warm_start_solution.value( n->currency );
+
+        if ( amount.isZero() )
+            continue;
+
+        n->amount += amount;
+        n->recalculateQuantityByPrice();
+
+        // qty = amount * amplification / price, like each solver step
+        shortlongs[ n->currency ] += amount.mulDiv( m_amplification, n->price );
+        amounts_moved[ n->currency ] += amount;
+    }
+
     return true;
 }
 
 RelativeCoeffs Spruce::getRelativeCoeffs()
 {
     // get coeffs for time distances of balances
-    m_last_coeffs = getMarketCoeffs();
+    getMarketCoeffs();
+
+    // rebuild the sorted coeffs and the qty fingerprint
+    QuantityChanges changes;
+    changes.is_rebuild = true;
+    for ( qint32 id = 0; id < m_currencies.size(); id++ )
+        changes.quantities += qMakePair( id, m_currencies.at( id ).qty_current );
+
+    m_coeffs_sorted.clear();
+    m_qtys_fingerprint = 0;
+    for ( qint32 id = 0; id < m_currencies.size(); id++ )
+    {
+        CurrencyState &state = m_currencies[ id ];
+        state.qty_current = Coin();
+        state.qty_term = 0;
+
+        if ( !state.has_coeff || !state.node_now )
+            continue;
+
+        m_coeffs_sorted.insert( qMakePair( state.coeff, m_currency_names.at( id ) ), id );
+        m_qtys_fingerprint += getQuantityFingerprint( id, state.node_now->quantity );
+    }
+
+    recordQuantityFingerprint( changes );
+
+    return getSortedRelativeCoeffs();
+}
+
+RelativeCoeffs Spruce::updateRelativeCoeffs( const Node *a, const Node *b )
+{
+    // only the nodes that changed get a new coeff, the rest are still valid
+    QuantityChanges changes;
+    const Node *changed[ 2 ] = { a, b == a ? nullptr : b };
+    for ( int k = 0; k < 2; k++ )
+    {
+        const Node *n = changed[ k ];
+        if ( !n )
+            continue;
 
+        CurrencyState &state = m_currencies[ n->id ];
+        m_coeffs_sorted.remove( qMakePair( state.coeff, n->currency ) );
+        state.coeff = getMarketCoeff( n, state );
+        m_coeffs_sorted.insert( qMakePair( state.coeff, n->currency ), n->id );
+
+        changes.quantities += qMakePair( n->id, state.qty_current );
+        m_qtys_fingerprint -= state.qty_term;
+        m_qtys_fingerprint += getQuantityFingerprint( n->id, n->quantity );
+    }
+
+    recordQuantityFingerprint( changes );
+
+    return getSortedRelativeCoeffs();
+}
+
+RelativeCoeffs Spruce::getSortedRelativeCoeffs() const
+{
     // find the highest and lowest coefficents
     RelativeCoeffs ret;
-    QMap<QString/*currency*/,Coin> qtys;
-    QMap<QString,Coin>::const_iterator begin = m_last_coeffs.begin(),
-                                       end = m_last_coeffs.end();
-    for ( QMap<QString,Coin>::const_iterator i = begin; i != end; i++ )
-    {
-        const QString &currency = i.key();
-        const Coin &coeff = i.value();
+    if ( m_coeffs_sorted.isEmpty() )
+        return ret;
 
-        if ( coeff > ret.hi_coeff )
-        {
-            ret.hi_coeff  = coeff;
-            ret.hi_currency = currency;
-        }
+    // sorted by ( coeff, currency ), so ties go to the first currency like a linear search would
+    const QMap<QPair<Coin,QString>,qint32>::const_iterator lo = m_coeffs_sorted.begin(),
+                                                           hi = m_coeffs_sorted.lowerBound( qMakePair( m_coeffs_sorted.lastKey().first, QString() ) );
 
-        if ( coeff < ret.lo_coeff )
-        {
-            ret.lo_coeff  = coeff;
-            ret.lo_currency = currency;
-        }
+    if ( hi.key().first > ret.hi_coeff )
+    {
+        ret.hi_coeff = hi.key().first;
+        ret.hi_currency = hi.key().second;
+        ret.hi_id = hi.value();
+    }
 
-        // build qtys
-        qtys.insert( currency, nodes_now_by_currency.value( currency )->quantity );
+    if ( lo.key().first < ret.lo_coeff )
+    {
+        ret.lo_coeff = lo.key().first;
+        ret.lo_currency = lo.key().second;
+        ret.lo_id = lo.value();
     }
 
-    m_qtys.prepend( qtys );
+    return ret;
+}
+
+quint64 Spruce::getQuantityFingerprint( const qint32 id, const Coin &qty )
+{
+    qint64 raw;
+    quint64 h = qty.toRawInt64( raw ) ? static_cast<quint64>( raw ) : qHash( qty.toSubSatoshiString() );
+
+    // mix in the currency and scramble (splitmix64 finalizer), so the sum over currencies works as a set hash
+    h ^= static_cast<quint64>( id +1 ) * 0x9e3779b97f4a7c15ULL;
+    h = ( h ^ ( h >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+    h = ( h ^ ( h >> 27 ) ) * 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+
+    CurrencyState &state = m_currencies[ id ];
+    state.qty_term = h;
+    state.qty_current = qty;
+    return h;
+}
+
+void Spruce::recordQuantityFingerprint( const QuantityChanges &changes )
+{
+    m_qtys.prepend( m_qtys_fingerprint );
+    m_qtys_changes.prepend( changes );
 
     // remove cache beyond number of currencies
-    if ( m_qtys.size() > m_last_coeffs.size() )
+    if ( m_qtys.size() > m_coeffs_sorted.size() )
+    {
         m_qtys.removeLast();
+        m_qtys_changes.removeLast();
+    }
+}
 
-    return ret;
+bool Spruce::isQuantitiesUnchangedSince( const int steps_back ) const
+{
+    if ( steps_back < 0 || steps_back >= m_qtys.size() )
+        return false;
+
+    // fast path: different fingerprints are always different qtys
+    if ( m_qtys.at( 0 ) != m_qtys.at( steps_back ) )
+        return false;
+
+    // the fingerprints match, confirm it by undoing the changes made since then
+    QVector<Coin> now, past;
+    now.reserve( m_currencies.size() );
+    for ( QVector<CurrencyState>::const_iterator i = m_currencies.begin(); i != m_currencies.end(); i++ )
+        now += i->qty_current;
+    past = now;
+
+    for ( int j = 0; j < steps_back; j++ )
+    {
+        const QVector<QPair<qint32,Coin>> &quantities = m_qtys_changes.at( j ).quantities;
+
+        for ( QVector<QPair<qint32,Coin>>::const_iterator i = quantities.begin(); i != quantities.end(); i++ )
+            if ( i->first < past.size() )
+                past[ i->first ] = i->second;
+    }
+
+    return past == now;
+}
+
+Coin Spruce::getMarketCoeff( const Node *n, const CurrencyState &state )
+{
+    const Coin &start_score = state.start_score;
+    const Coin score = n->quantity * n->price;
+
+    // obtain a ratio between 0 and m_log_map_end
+    bool is_negative = score < start_score;
+    Coin normalized_score = is_negative ? start_score / score
+                                        : n->quantity.mulDiv( n->price, start_score );
+
+    // find a granular point so we can map our ratio to a point in the image
+    normalized_score.truncateByTicksize( m_cost_cache->getTicksize() );
+    normalized_score -= CoinAmount::COIN; // subtract 1, the origin
+
+    // clamp score above maximum
+    const Coin &max_x = m_cost_cache->getMaxX();
+    if ( normalized_score > max_x )
+        normalized_score = max_x;
+
+    // translate the normalized score with the cost function
+    normalized_score = m_cost_cache->getY( state.profile_u, state.reserve, normalized_score );
+
+    // if we are negative, since f(x) == f(-x), we don't store negative values.
+    // apply reflection -f(x) instead of running f(-x)
+    if ( is_negative )
+        normalized_score = -normalized_score;
+
+    return normalized_score;
 }
 
-QMap<QString, Coin> Spruce::getMarketCoeffs()
+void Spruce::getMarketCoeffs()
 {
-    QMap<QString/*currency*/,Coin> start_scores, relative_coeff;
+    // reset coeffs and start scores
+    for ( QVector<CurrencyState>::iterator i = m_currencies.begin(); i != m_currencies.end(); i++ )
+    {
+        i->start_score = Coin();
+        i->coeff = Coin();
+        i->has_coeff = false;
+    }
 
-    // calculate start scores
+    // calculate start scores, these don't change while solving so they're kept for updateRelativeCoeffs()
     for ( QList<Node*>::const_iterator i = nodes_start.begin(); i != nodes_start.end(); i++ )
     {
         Node *n = *i;
-        start_scores.insert( n->currency, n->quantity * n->price );
+        m_currencies[ n->id ].start_score = n->quantity * n->price;
     }
 
     // calculate new score based on starting score using a loss function
     for ( QList<Node*>::const_iterator i = nodes_now.begin(); i != nodes_now.end(); i++ )
     {
         Node *n = *i;
-        const Coin score = n->quantity * n->price;
-        const Coin &start_score = start_scores.value( n->currency );
-        Coin &new_coeff = relative_coeff[ n->currency ];
-
-        // obtain a ratio between 0 and m_log_map_end
-        bool is_negative = score < start_score;
-        Coin normalized_score = is_negative ? start_score / score
-                                            : score / start_score;
-
-        // find a granular point so we can map our ratio to a point in the image
-        normalized_score.truncateByTicksize( m_cost_cache.getTicksize() );
-        normalized_score -= CoinAmount::COIN; // subtract 1, the origin
-
-        // clamp score above maximum
-        const Coin &max_x = m_cost_cache.getMaxX();
-        if ( normalized_score > max_x )
-            normalized_score = max_x;
+        CurrencyState &state = m_currencies[ n->id ];
+        state.coeff = getMarketCoeff( n, state );
+        state.has_coeff = true;
+    }
+}
 
-        // translate the normalized score with the cost function
-        normalized_score = m_cost_cache.getY( m_currency_profile_u.value( n->currency, DEFAULT_PROFILE_U ),
-                                              m_currency_reserve.value( n->currency, DEFAULT_RESERVE ),
-                                              normalized_score );
+qint32 Spruce::getCurrencyId( const QString &currency )
+{
+    const qint32 id = m_currency_ids.value( currency, -1 );
+    if ( id > -1 )
+        return id;
 
-        // if we are negative, since f(x) == f(-x), we don't store negative values.
-        // apply reflection -f(x) instead of running f(-x)
-        if ( is_negative )
-            normalized_score = -normalized_score;
+    m_currency_ids.insert( currency, m_currencies.size() );
+    m_currency_names += currency;
+    m_currencies += CurrencyState();
 
-        // set new coeff
-        new_coeff = normalized_score;
-    }
+    return m_currencies.size() -1;
+}
 
-    return relative_coeff;
+const CurrencyState *Spruce::findCurrency( const QString &currency ) const
+{
+    const qint32 id = m_currency_ids.value( currency, -1 );
+    return id > -1 ? &m_currencies.at( id ) : nullptr;
 }
@@ -4,26 +4,65 @@
 #include "coinamount.h"
 #include "costfunctioncache.h"
 #include "market.h"
+#include "virtualclock.h"
 
 #include <QString>
 #include <QMap>
+#include <QHash>
 #include <QMultiMap>
 #include <QVector>
 #include <QList>
+#include <QPair>
+#include <QSharedPointer>
+#include <QByteArray>
 #include <QDebug>
 
-static const Coin DEFAULT_PROFILE_U = Coin("10");
-static const Coin DEFAULT_RESERVE = Coin("0.01");
+static const Coin DEFAULT_PROFILE_U = 10_coin;
+static const Coin DEFAULT_RESERVE = 0.01_coin;
+static const QString SPRUCE_PORTFOLIO_TAG_PREFIX = "spruce."; // "spruce.<portfolio>-<B|S>-<market>", see SpruceOverseer::portfolios
 
 struct Node
 {
     QString currency;
+    qint32 id{ -1 }; // index into Spruce::m_currencies
     Coin price;
     Coin quantity;
     Coin amount;
 
-    void recalculateAmountByQuantity() { amount = quantity * price; }
-    void recalculateQuantityByPrice() { quantity = amount / price; }
+    void recalculateAmountByQuantity() { amount.setMul( quantity, price ); }
+    void recalculateQuantityByPrice() { quantity.setDiv( amount, price ); }
+};
+
+// ( engine, market id ) key for the exchange allocations, the settings write them as "<engine>-<market>"
+struct ExchangeMarketKey
+{
+    quint8 engine_type{ 0 };
+    qint32 market_id{ -1 };
+
+    bool operator ==( const ExchangeMarketKey &other ) const { return engine_type == other.engine_type && market_id == other.market_id; }
+};
+
+inline uint qHash( const ExchangeMarketKey &key, uint seed = 0 )
+{
+    return qHash( key.market_id, seed ) ^ ( uint( key.engine_type ) << 24 );
+}
+
+struct QuantityChanges // qtys from before a solver step, so older qtys can be rebuilt from the current ones
+{
+    bool is_rebuild{ false }; // if true, 'quantities' holds every qty instead of only the changed ones
+    QVector<QPair<qint32/*currency id*/,Coin>> quantities;
+};
+
+struct CurrencyState // per-currency settings and solver state, indexed by currency id
+{
+    Coin profile_u{ DEFAULT_PROFILE_U };
+    Coin reserve{ DEFAULT_RESERVE };
+    Node *node_now{ nullptr };
+    Coin start_score; // starting qty * price
+    Coin coeff; // last coeff from getMarketCoeffs()
+    bool has_coeff{ false };
+    Coin qty_current; // qty that m_qtys_fingerprint was built from
+    quint64 qty_term{ 0 }; // fingerprint term of qty_current
 };
 
 struct RelativeCoeffs // tracks hi/lo coeffs with their corresponding markets
@@ -36,6 +75,8 @@ struct RelativeCoeffs // tracks hi/lo coeffs with their corresponding markets
 
     QString hi_currency;
     QString lo_currency;
+    qint32 hi_id{ -1 };
+    qint32 lo_id{ -1 };
     Coin hi_coeff;
     Coin lo_coeff;
 };
@@ -48,17 +89,28 @@ public:
 
     void clear();
 
+    // copy of the settings and nodes that can be solved on another thread, the cost function cache is shared
+    Spruce *clone() const;
+
     void setIntervalSecs( const qint64 secs ) { m_interval_secs = secs; }
     qint64 getIntervalSecs() const { return m_interval_secs; }
 
+    // solve early when a mid price moves by more than this ratio since the last solve, 0 = only use the interval
+    void setTriggerRatio( const Coin &r ) { m_trigger_ratio = r; }
+    const Coin &getTriggerRatio() const { return m_trigger_ratio; }
+
     void setBaseCurrency( QString currency ) { base_currency = currency; }
     QString getBaseCurrency() const { return base_currency; }
     void setCurrencyWeight( QString currency, Coin weight );
     Coin getMarketWeight( QString market ) const;
 
-    Coin getExchangeAllocation( const QString &exchange_market );
+    Coin getExchangeAllocation( const quint8 engine_type, const qint32 market_id ) const;
     void setExchangeAllocation( const QString &exchange_market_key, const Coin allocation );
 
+    // how far SpruceOverseer may move an engine's allocation from the measured fills, latency and queue, 0 is off
+    void setRouteBound( const Coin &bound ) { m_route_bound = bound; }
+    const Coin &getRouteBound() const { return m_route_bound; }
+
     void setOrderGreed( Coin ratio ) { m_order_greed = ratio; }
     void setOrderRandomBuy( Coin r ) { m_order_greed_buy_randomness = r; }
     Coin getOrderRandomBuy() const { return m_order_greed_buy_randomness; }
@@ -84,7 +136,7 @@ public:
             const qint64 expiry_epoch = ( side == SIDE_BUY ) ? m_snapback_state_buys_expiry_secs.value( market ) :
                                                                m_snapback_state_sells_expiry_secs.value( market );
 
-            if ( QDateTime::currentSecsSinceEpoch() >= expiry_epoch )
+            if ( VirtualClock::currentMSecsSinceEpoch() / 1000 >= expiry_epoch )
                 setSnapbackState( market, side, false );
         }
 
@@ -146,7 +198,7 @@ public:
         // if enabled, set the expiry time
         if ( state )
         {
-            const qint64 expiry_secs = QDateTime::currentSecsSinceEpoch() + m_snapback_expiry_secs;
+            const qint64 expiry_secs = VirtualClock::currentMSecsSinceEpoch() / 1000 + m_snapback_expiry_secs;
 
             ( side == SIDE_BUY ) ? m_snapback_state_buys_expiry_secs[ market ] = expiry_secs :
                                    m_snapback_state_sells_expiry_secs[ market ] = expiry_secs;
@@ -171,14 +223,25 @@ public:
     void clearStartNodes();
 
     bool calculateAmountToShortLong();
-    Coin getQuantityToShortLongNow( const QString &market );
+    bool isSolved() const { return m_is_solved; } // result of the last calculateAmountToShortLong()
+    Coin getQuantityToShortLongNow( const QString &market ) const;
     void addToShortLonged( const QString &market, const Coin &qty );
 
+    // worker mode, see SpruceLink. the coordinator's targets stand in for the solve, and the shortlong changes are
+    // kept for it until they're taken
+    void setRemoteTargets( const QMap<QString,Coin> &targets ) { m_remote_targets = targets; m_is_remote = true; }
+    bool isRemote() const { return m_is_remote; }
+    void setReportingFills( const bool reporting ) { m_is_reporting_fills = reporting; }
+    QMap<QString,Coin> takeReportedFills(); // the changes since the last call
+    const QMap<QString,Coin> &getReportedFills() const { return m_reported_fills; }
+
     QList<QString> getCurrencies() const;
     QList<QString> getMarketsAlpha() const;
     QList<Market> &getMarketsBeta() { return m_markets_beta; }
     bool isActive();
     QString getSaveState();
+    QByteArray getBinaryState() const; // what getSaveState() writes, for SettingsState
+    bool readBinaryState( const QByteArray &state ); // false if it's truncated, nothing is set then
 
     void setMarketBuyMax( Coin marketmax ) { m_market_buy_max = marketmax; }
     Coin getMarketBuyMax( QString market = "" ) const;
@@ -189,18 +252,44 @@ public:
 
     const RelativeCoeffs &startCoeffs() { return m_start_coeffs; }
     const RelativeCoeffs &relativeCoeffs() { return m_relative_coeffs; }
-    const QMap<QString,Coin> &getQuantityToShortLongMap() { return m_quantity_to_shortlong_map; }
+    const QMap<QString,Coin> &getQuantityToShortLongMap() const { return m_quantity_to_shortlong_map; }
 
-    Coin getCurrencyPriceByMarket( Market market );
+    Coin getCurrencyPriceByMarket( Market market ) const;
 
     void setAmplification( Coin l ) { m_amplification = l; }
     Coin getAmplification() const { return m_amplification; }
 
+    // adaptive = bisect with large steps first, reference = always step by ticksize, the default
+    void setSolverAdaptive( const bool adaptive ) { m_solver_adaptive = adaptive; }
+    bool getSolverAdaptive() const { return m_solver_adaptive; }
+
+    // warm start = seed the solver with the amounts moved by a previous solve, so only the price delta is solved
+    void setSolverWarmStart( const bool warm_start ) { m_solver_warm_start = warm_start; }
+    bool getSolverWarmStart() const { return m_solver_warm_start; }
+    void setWarmStartSolution( const QMap<QString,Coin> &solution ) { m_warm_start_solution = solution; }
+    const QMap<QString/*currency*/,Coin> &getSolution() const { return m_solution; } // amounts moved by the last solve
+    quint32 getSolveIterations() const { return m_solve_iterations; } // solver steps taken by the last solve
+
+    // deadline = stop a solve after this many ms with what it moved so far, 0 runs it to the end. a solve that stopped
+    // isn't complete, its solution is where the next one resumes from
+    void setSolveDeadline( const qint64 ms ) { m_solve_deadline_ms = ms; }
+    qint64 getSolveDeadline() const { return m_solve_deadline_ms; }
+    bool isSolveComplete() const { return m_is_solve_complete; } // false if the last solve ran into the deadline
+    const CostFunctionCache &getCostFunctionCache() const { return *m_cost_cache; }
+
+    // image = read the cost functions from the images in the cost function cache dir instead of evaluating them. the
+    // images are generated at start, or by the first solve that needs one after switching
+    void setCostFunctionImage( const bool use_image );
+    bool getCostFunctionImage() const { return m_cost_cache->getUseImage(); }
+
     void setProfileU( QString currency, Coin u );
-    Coin getProfileU( QString currency ) const { return m_currency_profile_u.value( currency, DEFAULT_PROFILE_U ); }
+    Coin getProfileU( QString currency ) const;
 
     void setReserve( QString currency, Coin r );
-    Coin getReserve( QString currency ) const { return m_currency_reserve.value( currency, DEFAULT_RESERVE ); }
+    Coin getReserve( QString currency ) const;
+
+    // prepare the cost function for every currency's profile_u/reserve ahead of the first spruce tick
+    void warmUpCostFunctions();
 
     Coin getEquityAll();
     Coin getLastCoeffForMarket( const QString &market ) const;
@@ -212,14 +301,29 @@ public:
     }
 
 private:
+    Spruce( const Spruce &other ) = default; // shallow, use clone()
+
     bool normalizeEquity();
     bool equalizeDates();
+    bool applyWarmStart( QMap<QString,Coin> &shortlongs, QMap<QString,Coin> &amounts_moved );
+
+    QSharedPointer<CostFunctionCache> m_cost_cache;
 
-    CostFunctionCache m_cost_cache;
-    QMap<QString,Coin> m_currency_profile_u, m_currency_reserve;
+    // currencies are interned into ids so the solver can index m_currencies instead of looking up strings
+    qint32 getCurrencyId( const QString &currency );
+    const CurrencyState *findCurrency( const QString &currency ) const;
+    QHash<QString,qint32> m_currency_ids;
+    QVector<QString> m_currency_names;
+    QVector<CurrencyState> m_currencies;
 
-    QMap<QString/*currency*/,Coin> getMarketCoeffs();
+    void getMarketCoeffs();
+    Coin getMarketCoeff( const Node *n, const CurrencyState &state );
     RelativeCoeffs getRelativeCoeffs();
+    RelativeCoeffs updateRelativeCoeffs( const Node *a, const Node *b );
+    RelativeCoeffs getSortedRelativeCoeffs() const;
+    quint64 getQuantityFingerprint( const qint32 id, const Coin &qty );
+    void recordQuantityFingerprint( const QuantityChanges &changes );
+    bool isQuantitiesUnchangedSince( const int steps_back ) const;
 
     RelativeCoeffs m_relative_coeffs, m_start_coeffs;
     QMap<QString,Coin> m_quantity_to_shortlong_map;
@@ -232,6 +336,7 @@ private:
     QMap<QString,Coin> currency_weight; // note: weights are >0 and <=1
     QMultiMap<Coin,QString> currency_weight_by_coin; // note: weights are >0 and <=1
     QMap<QString, Coin> per_exchange_market_allocations; // note: market allocations are 0:1
+    QHash<ExchangeMarketKey, Coin> exchange_market_allocations; // the same, by id for the spruce loops
     Coin m_order_greed, m_order_greed_minimum, m_order_greed_buy_randomness, m_order_greed_sell_randomness, m_market_buy_max,
     m_market_sell_max, m_order_size, m_order_nice_buys, m_order_nice_sells, m_order_nice_zerobound_buys, m_order_nice_zerobound_sells,
     m_order_nice_spreadput_buys, m_order_nice_spreadput_sells, m_order_nice_custom_buys, m_order_nice_custom_sells,
@@ -240,18 +345,32 @@ private:
     m_order_nice_market_offset_zerobound_sells;
 
     QList<Node*> nodes_start, nodes_now;
-    QMap<QString,Node*> nodes_now_by_currency;
-    QMap<QString/*currency*/,Coin> m_last_coeffs;
-    QVector<QMap<QString/*currency*/,Coin>> m_qtys;
+    QMap<QPair<Coin,QString>/*coeff,currency*/,qint32/*currency id*/> m_coeffs_sorted; // ordered by coeff for hi/lo lookups
+    quint64 m_qtys_fingerprint{ 0 }; // sum of qty_term over m_currencies, identifies the current qtys
+    QVector<quint64> m_qtys; // recent qty fingerprints, newest first
+    QVector<QuantityChanges> m_qtys_changes; // the changes that led to each of m_qtys
     QList<Market> m_markets_beta;
 
     QMap<QString, bool> m_snapback_state_buys, m_snapback_state_sells;
     QMap<QString, qint64> m_snapback_state_buys_expiry_secs, m_snapback_state_sells_expiry_secs;
     Coin m_snapback_ratio{ "0.1" }; // 0.1 default
     qint64 m_snapback_expiry_secs{ 60 * 60 * 24 }; // 1 day default
+    Coin m_route_bound; // 0 default, the static allocations
 
     Coin m_amplification;
+    bool m_solver_adaptive{ false };
+    bool m_solver_warm_start{ false };
+    quint32 m_solve_iterations{ 0 };
+    qint64 m_solve_deadline_ms{ 0 };
+    bool m_is_solve_complete{ true };
+    QMap<QString/*currency*/,Coin> m_warm_start_solution, m_solution;
+    bool m_is_solved{ false };
+    QMap<QString/*market*/,Coin> m_remote_targets; // qty to shortlong now, from the coordinator
+    QMap<QString/*market*/,Coin> m_reported_fills;
+    bool m_is_remote{ false };
+    bool m_is_reporting_fills{ false };
     qint64 m_interval_secs{ 60 * 2 }; // 2min default
+    Coin m_trigger_ratio; // 0 default, timer only
     bool m_order_cancel_mode{ false }; // false = cancel edges, true = cancel random
 };
 
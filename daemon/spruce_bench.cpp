@@ -0,0 +1,190 @@
+#include "global.h"
+#include "benchreport.h"
+#include "coinamount.h"
+#include "costfunctioncache.h"
+#include "spruce.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QPair>
+
+#include <algorithm>
+
+// spruce_bench: replays recorded live prices through Spruce::calculateAmountToShortLong() and prints solver stats.
+// usage: ./spruce_bench <replay file> [reference|adaptive|adaptive-warm] [--json <path>]
+//
+// the replay file uses the spruce.settings commands (setsprucebasecurrency, setspruceweight, setsprucestartnode,
+// setspruceprofile, setsprucereserve, setspruceamplification), so a saved spruce.settings can be pasted in. other
+// commands are ignored. each 'liveprices <currency> <price> [<currency> <price>...]' line is one solve.
+
+namespace
+{
+
+struct Replay
+{
+    QVector<QStringList> setup; // spruce commands
+    QVector<QVector<QPair<QString,Coin>>> ticks; // live prices for each solve
+};
+
+bool loadReplay( const QString &path, Replay &replay )
+{
+    QFile file( path );
+    if ( !file.open( QIODevice::ReadOnly | QIODevice::Text ) )
+    {
+        kDebug() << "spruce_bench error: couldn't open replay file" << path;
+        return false;
+    }
+
+    QTextStream stream( &file );
+    while ( !stream.atEnd() )
+    {
+        const QStringList args = stream.readLine().split( QChar( ' ' ), QString::SkipEmptyParts );
+        if ( args.isEmpty() || args.first().startsWith( QChar( '#' ) ) )
+            continue;
+
+        if ( args.first() != "liveprices" )
+        {
+            replay.setup += args;
+            continue;
+        }
+
+        if ( args.size() < 3 || args.size() % 2 != 1 )
+        {
+            kDebug() << "spruce_bench error: bad liveprices line" << args.join( QChar( ' ' ) );
+            return false;
+        }
+
+        QVector<QPair<QString,Coin>> prices;
+        for ( int i = 1; i < args.size(); i += 2 )
+            prices += qMakePair( args.at( i ), Coin( args.at( i +1 ) ) );
+
+        replay.ticks += prices;
+    }
+
+    return true;
+}
+
+void applySetup( Spruce &spruce, const Replay &replay )
+{
+    for ( QVector<QStringList>::const_iterator i = replay.setup.begin(); i != replay.setup.end(); i++ )
+    {
+        const QStringList &args = *i;
+        const QString &command = args.first();
+
+        if ( command == "setsprucebasecurrency" && args.size() > 1 )
+            spruce.setBaseCurrency( args.at( 1 ) );
+        else if ( command == "setspruceweight" && args.size() > 2 )
+            spruce.setCurrencyWeight( args.at( 1 ), args.at( 2 ) );
+        else if ( command == "setsprucestartnode" && args.size() > 3 )
+            spruce.addStartNode( args.at( 1 ), args.at( 2 ), args.at( 3 ) );
+        else if ( command == "setspruceprofile" && args.size() > 2 )
+            spruce.setProfileU( args.at( 1 ), args.at( 2 ) );
+        else if ( command == "setsprucereserve" && args.size() > 2 )
+            spruce.setReserve( args.at( 1 ), args.at( 2 ) );
+        else if ( command == "setspruceamplification" && args.size() > 1 )
+            spruce.setAmplification( args.at( 1 ) );
+    }
+}
+
+void runMode( const QString &mode, const Replay &replay )
+{
+    Spruce spruce;
+    applySetup( spruce, replay );
+    spruce.setSolverAdaptive( mode != "reference" );
+    spruce.setSolverWarmStart( mode == "adaptive-warm" );
+
+    const CostFunctionCache &cache = spruce.getCostFunctionCache();
+    const quint64 hits_start = cache.getCacheHits(), misses_start = cache.getCacheMisses();
+
+    quint64 iterations = 0, allocations = 0, total_ns = 0, max_ns = 0;
+    int solved = 0;
+    QMap<QString,Coin> solution;
+    QVector<qreal> samples;
+    samples.reserve( replay.ticks.size() );
+
+    for ( QVector<QVector<QPair<QString,Coin>>>::const_iterator t = replay.ticks.begin(); t != replay.ticks.end(); t++ )
+    {
+        spruce.clearLiveNodes();
+        for ( QVector<QPair<QString,Coin>>::const_iterator i = t->begin(); i != t->end(); i++ )
+            spruce.addLiveNode( i->first, i->second );
+
+        if ( spruce.getSolverWarmStart() )
+            spruce.setWarmStartSolution( solution );
+
+        const quint64 allocations_start = BenchReport::getAllocations();
+        QElapsedTimer timer;
+        timer.start();
+
+        const bool ok = spruce.calculateAmountToShortLong();
+
+        const quint64 ns = timer.nsecsElapsed();
+        allocations += BenchReport::getAllocations() - allocations_start;
+        total_ns += ns;
+        samples += qreal( ns );
+        max_ns = std::max( max_ns, ns );
+
+        if ( !ok )
+            continue;
+
+        solved++;
+        iterations += spruce.getSolveIterations();
+        solution = spruce.getSolution();
+    }
+
+    const int solves = replay.ticks.size();
+    const quint64 hits = cache.getCacheHits() - hits_start,
+                  lookups = hits + cache.getCacheMisses() - misses_start;
+
+    BenchReport::add( BenchReport::getResult( mode, solves, qint64( total_ns ), allocations, samples ) );
+
+    kDebug() << QString( "%1 %2/%3 solved | %4 it/solve | %5 us/solve (max %6) | cache hits %7% | %8 allocs/solve" )
+                .arg( mode, -14 )
+                .arg( solved )
+                .arg( solves )
+                .arg( solved ? qreal( iterations ) / solved : 0., 8, 'f', 1 )
+                .arg( qreal( total_ns ) / solves / 1000, 10, 'f', 1 )
+                .arg( qreal( max_ns ) / 1000, 0, 'f', 1 )
+                .arg( lookups ? qreal( hits ) * 100 / lookups : 0., 5, 'f', 1 )
+                .arg( qreal( allocations ) / solves, 0, 'f', 0 );
+}
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication a( argc, argv );
+
+    QStringList args = QCoreApplication::arguments();
+    if ( !BenchReport::init( args ) || args.size() < 2 )
+    {
+        kDebug() << "usage: spruce_bench <replay file> [reference|adaptive|adaptive-warm] [--json <path>]";
+        return 1;
+    }
+
+    Replay replay;
+    if ( !loadReplay( args.at( 1 ), replay ) )
+        return 1;
+
+    if ( replay.ticks.isEmpty() )
+    {
+        kDebug() << "spruce_bench error: replay file has no liveprices lines";
+        return 1;
+    }
+
+    kDebug() << "spruce_bench:" << replay.ticks.size() << "solves per mode";
+
+    const QStringList modes = args.size() > 2 ? QStringList( args.at( 2 ) ) :
+                                                QStringList() << "reference" << "adaptive" << "adaptive-warm";
+
+    for ( QStringList::const_iterator i = modes.begin(); i != modes.end(); i++ )
+        runMode( *i, replay );
+
+    kDebug() << "spruce_bench done.";
+
+    return BenchReport::finish( "spruce_bench" ) ? 0 : 1;
+}
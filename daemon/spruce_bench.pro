@@ -0,0 +1,44 @@
+QT       = core network
+
+TARGET = spruce_bench
+DESTDIR = ../
+
+MOC_DIR = ../build-tmp/spruce_bench
+OBJECTS_DIR = ../build-tmp/spruce_bench
+
+CONFIG += c++14 c++17
+CONFIG += RELEASE console
+
+LIBS += -lgmp
+
+QMAKE_CXXFLAGS_RELEASE = -Wall -O3
+
+SOURCES += spruce_bench.cpp \
+    benchreport.cpp \
+    spruce.cpp \
+    costfunctioncache.cpp \
+    threadplacement.cpp \
+    tracespan.cpp \
+    market.cpp \
+    positiongrid.cpp \
+    orderbook.cpp \
+    tickerhistory.cpp \
+    virtualclock.cpp \
+    coinamount.cpp
+
+HEADERS += build-config.h \
+    benchreport.h \
+    global.h \
+    coinamount.h \
+    costfunctioncache.h \
+    threadplacement.h \
+    tracespan.h \
+    market.h \
+    misctypes.h \
+    orderid.h \
+    orderbook.h \
+    tickerhistory.h \
+    positiondata.h \
+    positiongrid.h \
+    spruce.h \
+    virtualclock.h
@@ -0,0 +1,428 @@
+#include "sprucelink.h"
+#include "spruce.h"
+#include "spruceoverseer.h"
+#include "taskscheduler.h"
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QHostInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QFile>
+#include <QDateTime>
+
+SpruceLink::SpruceLink( Spruce *_spruce, QMutex *_spruce_lock, TaskScheduler *scheduler, QObject *parent )
+    : QObject( parent ),
+      spruce( _spruce ),
+      spruce_lock( _spruce_lock )
+{
+    flush_timer = scheduler->addTask( this, "spruce link", [this]() { onFlush(); }, TASK_PRIORITY_HOUSEKEEPING, 0.05 );
+    next_fill_seq = QDateTime::currentMSecsSinceEpoch();
+}
+
+SpruceLink::~SpruceLink()
+{
+    if ( spruce )
+        spruce->setReportingFills( false );
+
+    delete sck;
+    sck = nullptr;
+}
+
+bool SpruceLink::readConfig( const QString &path )
+{
+    QFile loadfile( path );
+    if ( !loadfile.open( QIODevice::ReadOnly | QIODevice::Text ) )
+        return false;
+
+    const QStringList lines = QString::fromUtf8( loadfile.readAll() ).split( '\n' );
+    for ( QStringList::const_iterator i = lines.begin(); i != lines.end(); i++ )
+    {
+        const QStringList parts = i->section( QChar( '#' ), 0, 0 ).simplified().split( QChar( ' ' ), QString::SkipEmptyParts );
+        if ( parts.isEmpty() )
+            continue;
+
+        bool ok = false;
+        if ( parts.at( 0 ) == "coordinator" && parts.size() == 4 )
+        {
+            is_coordinator = true;
+            ok = bind_address.setAddress( parts.at( 1 ) );
+            port = ok ? quint16( parts.at( 2 ).toUInt( &ok ) ) : 0;
+            ok = ok && auth.setSecret( parts.at( 3 ).toUtf8() );
+        }
+        else if ( parts.at( 0 ) == "worker" && ( parts.size() == 4 || parts.size() == 5 ) )
+        {
+            is_coordinator = false;
+            host = parts.at( 1 );
+            port = quint16( parts.at( 2 ).toUInt( &ok ) );
+            ok = ok && auth.setSecret( parts.at( 3 ).toUtf8() );
+            name = parts.value( 4, QHostInfo::localHostName() );
+        }
+
+        if ( !ok || port == 0 )
+        {
+            kDebug() << "local error: bad spruce link line in" << loadfile.fileName()
+                     << ", use 'coordinator <address> <port> <secret>' or 'worker <host> <port> <secret> [name]'"
+                     << ", the secret is at least" << LinkAuth::MIN_SECRET_SIZE << "characters";
+            return false;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+void SpruceLink::start()
+{
+    if ( is_started )
+        return;
+
+    is_started = true;
+
+    if ( is_coordinator )
+    {
+        // the workers are on other hosts, only the interface they reach us on
+        server = new QTcpServer( this );
+        if ( !server->listen( bind_address, port ) )
+        {
+            kDebug() << "local error: spruce link failed to listen on" << bind_address.toString() << "port" << port << server->errorString();
+            return;
+        }
+
+        connect( server, &QTcpServer::newConnection, this, &SpruceLink::onNewConnection );
+        kDebug() << "[SpruceLink] coordinating on" << bind_address.toString() << "port" << port;
+        return;
+    }
+
+    // our fills go to the coordinator from now on, the solves are its
+    spruce->setReportingFills( true );
+
+    sck = new QTcpSocket();
+    connect( sck, &QTcpSocket::connected, this, &SpruceLink::onConnected );
+    connect( sck, &QTcpSocket::readyRead, this, &SpruceLink::onReadyRead );
+
+    sck->connectToHost( host, port );
+    flush_timer->start( SPRUCE_LINK_FLUSH_INTERVAL );
+    kDebug() << "[SpruceLink] working for" << host << port << "as" << name;
+}
+
+void SpruceLink::markSolveStart()
+{
+    for ( QVector<Worker>::iterator i = workers.begin(); i != workers.end(); i++ )
+        i->solve_fill_seq = i->fill_seq;
+}
+
+void SpruceLink::publishTargets( const QVector<SprucePhase> &phases )
+{
+    for ( QVector<Worker>::const_iterator w = workers.begin(); w != workers.end(); w++ )
+    {
+        if ( !w->is_ready )
+            continue;
+
+        QByteArray out;
+        for ( QVector<SprucePhase>::const_iterator p = phases.begin(); p != phases.end(); p++ )
+        {
+            if ( !p->solver->isSolved() )
+                continue;
+
+            out += QString( "targets %1 %2\n" ).arg( p->name, formatAmounts( p->solver->getQuantityToShortLongMap(), w->markets ) ).toUtf8();
+        }
+
+        out += QString( "end %1\n" ).arg( w->solve_fill_seq ).toUtf8();
+        w->sck->write( out );
+    }
+}
+
+bool SpruceLink::hasTargets( const qint64 max_age_ms ) const
+{
+    return !targets.isEmpty() && QDateTime::currentMSecsSinceEpoch() - targets_time <= max_age_ms;
+}
+
+QMap<QString,Coin> SpruceLink::getTargets( const QString &phase ) const
+{
+    QMap<QString,Coin> ret = targets.value( phase );
+
+    // a fill moves the target like it does on the coordinator, getQuantityToShortLongNow() adds what's shortlonged
+    for ( QMap<qint64,QMap<QString,Coin>>::const_iterator i = uncounted_fills.begin(); i != uncounted_fills.end(); i++ )
+        for ( QMap<QString,Coin>::const_iterator j = i.value().begin(); j != i.value().end(); j++ )
+            if ( ret.contains( j.key() ) )
+                ret[ j.key() ] += j.value();
+
+    // and the ones that aren't reported yet
+    const QMap<QString,Coin> &unreported = spruce->getReportedFills();
+    for ( QMap<QString,Coin>::const_iterator j = unreported.begin(); j != unreported.end(); j++ )
+        if ( ret.contains( j.key() ) )
+            ret[ j.key() ] += j.value();
+
+    return ret;
+}
+
+QString SpruceLink::formatAmounts( const QMap<QString,Coin> &amounts, const QSet<QString> &markets )
+{
+    QStringList parts;
+    for ( QMap<QString,Coin>::const_iterator i = amounts.begin(); i != amounts.end(); i++ )
+        if ( markets.isEmpty() || markets.contains( i.key() ) )
+            parts += QString( "%1=%2" ).arg( i.key(), i.value().toSubSatoshiString() );
+
+    return parts.join( QChar( ' ' ) );
+}
+
+bool SpruceLink::parseAmounts( const QStringList &parts, const qint32 first, QMap<QString,Coin> &amounts )
+{
+    for ( qint32 i = first; i < parts.size(); i++ )
+    {
+        const QString &part = parts.at( i );
+        const int sep_idx = part.indexOf( QChar( '=' ) );
+        if ( sep_idx <= 0 || sep_idx == part.size() -1 )
+            return false;
+
+        amounts.insert( part.left( sep_idx ), Coin( part.mid( sep_idx +1 ) ) );
+    }
+
+    return true;
+}
+
+void SpruceLink::readLine( QTcpSocket *from, const QByteArray &line )
+{
+    const QStringList parts = QString::fromUtf8( line ).simplified().split( QChar( ' ' ), QString::SkipEmptyParts );
+    if ( parts.isEmpty() )
+        return;
+
+    const QString &command = parts.at( 0 );
+
+    // the other side checks us too
+    if ( command == "challenge" && parts.size() == 2 )
+    {
+        from->write( "auth " + auth.answer( is_coordinator ? "coordinator" : "worker", parts.at( 1 ).toLatin1() ) + '\n' );
+        return;
+    }
+
+    if ( is_coordinator )
+    {
+        Worker *worker = findWorker( from );
+        if ( !worker )
+            return;
+
+        // nothing counts until its answer checks out
+        if ( !worker->is_authed )
+        {
+            if ( command == "auth" && parts.size() == 2 && auth.check( "worker", worker->challenge, parts.at( 1 ).toLatin1() ) )
+            {
+                worker->is_authed = true;
+                return;
+            }
+
+            kDebug() << "local warning: spruce link worker" << from->peerAddress().toString() << "failed the challenge, dropping it";
+            from->abort();
+            return;
+        }
+
+        if ( command == "hello" && parts.size() >= 2 )
+        {
+            worker->name = parts.at( 1 );
+            worker->markets.clear();
+            const QStringList markets = parts.value( 2 ).split( QChar( ',' ), QString::SkipEmptyParts );
+            for ( QStringList::const_iterator i = markets.begin(); i != markets.end(); i++ )
+                worker->markets.insert( *i );
+
+            worker->fill_seq = counted_fill_seqs.value( worker->name );
+            worker->is_ready = true;
+            kDebug() << "[SpruceLink] worker" << worker->name << "wants targets for" << markets.size() << "markets";
+            return;
+        }
+
+        QMap<QString,Coin> fills;
+        bool ok = false;
+        const qint64 seq = parts.value( 1 ).toLongLong( &ok );
+        if ( command == "fills" && ok && worker->is_ready && parseAmounts( parts, 2, fills ) )
+        {
+            // resent after a reconnect, we have them
+            if ( seq <= worker->fill_seq )
+                return;
+
+            // the next solve counts them, a worker only shortlongs the markets it wants targets for
+            QMutexLocker locker( spruce_lock );
+            for ( QMap<QString,Coin>::const_iterator i = fills.begin(); i != fills.end(); i++ )
+            {
+                if ( !worker->markets.contains( i.key() ) )
+                {
+                    kDebug() << "local warning: spruce link dropped a fill of" << i.key() << "from worker" << worker->name
+                             << ", it's not in its hello";
+                    continue;
+                }
+
+                spruce->addToShortLonged( i.key(), i.value() );
+            }
+
+            worker->fill_seq = seq;
+            counted_fill_seqs.insert( worker->name, seq );
+            return;
+        }
+
+        kDebug() << "local warning: spruce link got a bad line from worker" << worker->name << ":" << line.left( 128 );
+        return;
+    }
+
+    // the targets are only the coordinator's
+    if ( !is_coordinator_authed )
+    {
+        if ( command == "auth" && parts.size() == 2 && auth.check( "coordinator", challenge, parts.at( 1 ).toLatin1() ) )
+        {
+            is_coordinator_authed = true;
+            sendHello();
+            return;
+        }
+
+        kDebug() << "local warning: spruce link coordinator failed the challenge, dropping the connection";
+        from->abort();
+        return;
+    }
+
+    if ( command == "targets" && parts.size() >= 2 )
+    {
+        QMap<QString,Coin> phase_targets;
+        if ( parseAmounts( parts, 2, phase_targets ) )
+        {
+            pending_targets.insert( parts.at( 1 ), phase_targets );
+            return;
+        }
+    }
+    else if ( command == "end" && parts.size() == 2 )
+    {
+        bool ok = false;
+        const qint64 counted_seq = parts.at( 1 ).toLongLong( &ok );
+        if ( ok )
+        {
+            QMutexLocker locker( spruce_lock );
+
+            // a whole solve at once, and the fills it counted don't move it anymore
+            targets.swap( pending_targets );
+            pending_targets.clear();
+            targets_time = QDateTime::currentMSecsSinceEpoch();
+
+            while ( !uncounted_fills.isEmpty() && uncounted_fills.firstKey() <= counted_seq )
+                uncounted_fills.erase( uncounted_fills.begin() );
+            return;
+        }
+    }
+
+    kDebug() << "local warning: spruce link got a bad line from the coordinator:" << line.left( 128 );
+}
+
+void SpruceLink::onNewConnection()
+{
+    while ( server->hasPendingConnections() )
+    {
+        Worker worker;
+        worker.sck = server->nextPendingConnection();
+        worker.challenge = LinkAuth::makeChallenge();
+        connect( worker.sck, &QTcpSocket::readyRead, this, &SpruceLink::onReadyRead );
+        connect( worker.sck, &QTcpSocket::disconnected, this, &SpruceLink::onDisconnected );
+        worker.sck->write( "challenge " + worker.challenge + '\n' );
+        workers += worker;
+
+        kDebug() << "[SpruceLink] worker connected from" << worker.sck->peerAddress().toString();
+    }
+}
+
+void SpruceLink::onReadyRead()
+{
+    QTcpSocket *from = qobject_cast<QTcpSocket*>( sender() );
+    if ( !from )
+        return;
+
+    while ( from->canReadLine() )
+    {
+        const QByteArray line = from->readLine( SPRUCE_LINK_MAX_LINE );
+        readLine( from, line );
+    }
+
+    // a line that long isn't ours
+    if ( from->bytesAvailable() >= SPRUCE_LINK_MAX_LINE )
+    {
+        kDebug() << "local warning: spruce link line is too long, dropping the connection";
+        from->abort();
+    }
+}
+
+void SpruceLink::onDisconnected()
+{
+    QTcpSocket *from = qobject_cast<QTcpSocket*>( sender() );
+
+    for ( qint32 i = workers.size() -1; i >= 0; i-- )
+    {
+        if ( workers.at( i ).sck != from )
+            continue;
+
+        kDebug() << "[SpruceLink] worker" << workers.at( i ).name << "disconnected";
+        workers.remove( i );
+    }
+
+    if ( from )
+        from->deleteLater();
+}
+
+void SpruceLink::onConnected()
+{
+    kDebug() << "[SpruceLink] connected to the coordinator";
+
+    // a solve that was cut off isn't whole, and the hello waits for the coordinator's answer
+    pending_targets.clear();
+    is_coordinator_authed = false;
+    challenge = LinkAuth::makeChallenge();
+    sck->write( "challenge " + challenge + '\n' );
+}
+
+void SpruceLink::onFlush()
+{
+    if ( !sck )
+        return;
+
+    if ( sck->state() == QAbstractSocket::UnconnectedState )
+    {
+        sck->connectToHost( host, port );
+        return;
+    }
+
+    if ( sck->state() != QAbstractSocket::ConnectedState || !is_coordinator_authed )
+        return;
+
+    QMap<QString,Coin> fills;
+    {
+        QMutexLocker locker( spruce_lock );
+        fills = spruce->takeReportedFills();
+
+        if ( fills.isEmpty() )
+            return;
+
+        uncounted_fills.insert( next_fill_seq, fills );
+    }
+
+    sck->write( QString( "fills %1 %2\n" ).arg( next_fill_seq ).arg( formatAmounts( fills ) ).toUtf8() );
+    next_fill_seq++;
+}
+
+void SpruceLink::sendHello()
+{
+    QStringList markets;
+    {
+        QMutexLocker locker( spruce_lock );
+        markets = spruce->getMarketsAlpha();
+    }
+
+    sck->write( QString( "hello %1 %2\n" ).arg( name, markets.join( QChar( ',' ) ) ).toUtf8() );
+
+    for ( QMap<qint64,QMap<QString,Coin>>::const_iterator i = uncounted_fills.begin(); i != uncounted_fills.end(); i++ )
+        sck->write( QString( "fills %1 %2\n" ).arg( i.key() ).arg( formatAmounts( i.value() ) ).toUtf8() );
+}
+
+SpruceLink::Worker *SpruceLink::findWorker( QTcpSocket *from )
+{
+    for ( QVector<Worker>::iterator i = workers.begin(); i != workers.end(); i++ )
+        if ( i->sck == from )
+            return &*i;
+
+    return nullptr;
+}
@@ -0,0 +1,118 @@
+#ifndef SPRUCELINK_H
+#define SPRUCELINK_H
+
+#include "global.h"
+#include "coinamount.h"
+#include "linkauth.h"
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QVector>
+#include <QMap>
+#include <QSet>
+#include <QHash>
+#include <QHostAddress>
+
+class QTcpServer;
+class QTcpSocket;
+class QMutex;
+class Spruce;
+class ScheduledTask;
+class TaskScheduler;
+struct SprucePhase;
+
+// the lines on the link, all of them end with '\n'
+//   both ways:             "challenge <hex>" when they connect, "auth <hex>" the answer, see LinkAuth. nothing else is
+//                          read before the other side's answer checks out
+//   worker -> coordinator: "hello <name> <market,market,...>", the markets it wants targets for
+//                          "fills <seq> <market>=<qty> ...", shortlong changes since the last fills, of the hello's markets
+//   coordinator -> worker: "targets <phase> <market>=<qty> ...", one line for each phase of a solve
+//                          "end <fill seq>", the solve is complete and counted the fills up to fill seq
+static const qint32 SPRUCE_LINK_MAX_LINE = 1024 * 1024;
+static const qint64 SPRUCE_LINK_FLUSH_INTERVAL = 1000; // ms between fill reports, and reconnects from a worker
+static const qint64 SPRUCE_LINK_TARGETS_MAX_AGE = 3; // spruce intervals a worker keeps using the last targets
+
+//
+// SpruceLink, lets several daemons act as one portfolio. the coordinator solves as usual and sends each worker the
+// quantity to shortlong of every phase for the markets it asked for, the workers apply those instead of solving with
+// their own exchange allocations, and report their fills back so the next solve counts them. a worker adds the fills
+// the coordinator hasn't counted yet to the targets it has, so it doesn't fill the same target twice. set up from
+// getSpruceLinkPath(), "coordinator <address> <port> <secret>" or "worker <host> <port> <secret> [name]", the
+// coordinator only listens on address and both sides need the same secret
+//
+class SpruceLink : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SpruceLink( Spruce *_spruce, QMutex *_spruce_lock, TaskScheduler *scheduler, QObject *parent = nullptr );
+    ~SpruceLink();
+
+    bool readConfig( const QString &path ); // false without the file, or if it's bad
+    void start(); // after the settings are loaded, they aren't fills
+    bool isCoordinator() const { return is_coordinator; }
+    bool isWorker() const { return !is_coordinator; }
+
+    // coordinator, with the spruce lock held
+    void markSolveStart(); // the fills so far are in the solve that's starting
+    void publishTargets( const QVector<SprucePhase> &phases );
+    qint32 getWorkerCount() const { return workers.size(); }
+
+    // worker, with the spruce lock held
+    bool hasTargets( const qint64 max_age_ms ) const;
+    QMap<QString,Coin> getTargets( const QString &phase ) const; // with the fills since added
+
+    // the parsing, public for tests
+    static QString formatAmounts( const QMap<QString,Coin> &amounts, const QSet<QString> &markets = QSet<QString>() );
+    static bool parseAmounts( const QStringList &parts, const qint32 first, QMap<QString,Coin> &amounts );
+    void readLine( QTcpSocket *sck, const QByteArray &line );
+
+private:
+    struct Worker
+    {
+        QTcpSocket *sck{ nullptr };
+        QString name;
+        QSet<QString> markets; // empty until the hello
+        QByteArray challenge; // ours, it answers it before anything else
+        bool is_authed{ false };
+        qint64 fill_seq{ 0 }; // of the last fills counted
+        qint64 solve_fill_seq{ 0 }; // fill_seq when the solve being published started
+        bool is_ready{ false };
+    };
+
+    void onNewConnection();
+    void onReadyRead();
+    void onDisconnected();
+    void onConnected();
+    void onFlush();
+    void sendHello(); // and the fills that weren't counted yet
+    Worker *findWorker( QTcpSocket *sck );
+
+    Spruce *spruce{ nullptr };
+    QMutex *spruce_lock{ nullptr };
+    ScheduledTask *flush_timer{ nullptr };
+    LinkAuth auth;
+    bool is_coordinator{ true };
+    bool is_started{ false };
+
+    // coordinator
+    QTcpServer *server{ nullptr };
+    QHostAddress bind_address;
+    quint16 port{ 0 };
+    QVector<Worker> workers;
+    QHash<QString/*worker name*/,qint64> counted_fill_seqs; // kept over reconnects, so resent fills aren't counted twice
+
+    // worker
+    QTcpSocket *sck{ nullptr };
+    QString host, name;
+    QByteArray challenge; // ours, for the coordinator
+    bool is_coordinator_authed{ false };
+    QMap<QString/*phase*/,QMap<QString,Coin>> targets, pending_targets; // pending until its "end"
+    QMap<qint64/*seq*/,QMap<QString,Coin>> uncounted_fills; // sent, but not in the targets yet
+    qint64 next_fill_seq{ 1 }; // starts at the clock, so a restarted worker's fills are newer than the last run's
+    qint64 targets_time{ 0 };
+};
+
+#endif // SPRUCELINK_H
@@ -0,0 +1,70 @@
+#include "sprucelink_test.h"
+#include "sprucelink.h"
+#include "linkauth.h"
+#include "spruce.h"
+
+#include <QStringList>
+
+#include <assert.h>
+
+void SpruceLinkTest::test()
+{
+    /// test the amounts round trip, and the market filter
+    QMap<QString,Coin> amounts;
+    amounts.insert( "BTC_DOGE", Coin( "-12.5" ) );
+    amounts.insert( "BTC_ETH", Coin( "0.00000001" ) );
+
+    const QString line = SpruceLink::formatAmounts( amounts );
+    QMap<QString,Coin> parsed;
+    assert( SpruceLink::parseAmounts( line.split( QChar( ' ' ) ), 0, parsed ) );
+    assert( parsed == amounts );
+
+    QSet<QString> markets;
+    markets.insert( "BTC_ETH" );
+    assert( !SpruceLink::formatAmounts( amounts, markets ).contains( "BTC_DOGE" ) );
+
+    QMap<QString,Coin> bad;
+    assert( !SpruceLink::parseAmounts( QStringList() << "BTC_DOGE=", 0, bad ) );
+    assert( !SpruceLink::parseAmounts( QStringList() << "=1", 0, bad ) );
+
+    /// test the handshake, an answer only checks out with the same secret, role and challenge
+    LinkAuth coordinator_auth, worker_auth, other_auth;
+    assert( !coordinator_auth.setSecret( "short" ) && !coordinator_auth.isSecretSet() );
+    assert( coordinator_auth.setSecret( "a secret of some length" ) );
+    assert( worker_auth.setSecret( "a secret of some length" ) );
+    assert( other_auth.setSecret( "another secret of some length" ) );
+
+    const QByteArray challenge = LinkAuth::makeChallenge();
+    assert( challenge.size() == 64 && challenge != LinkAuth::makeChallenge() );
+
+    const QByteArray answer = worker_auth.answer( "worker", challenge );
+    assert( coordinator_auth.check( "worker", challenge, answer ) );
+    assert( !coordinator_auth.check( "coordinator", challenge, answer ) );
+    assert( !coordinator_auth.check( "worker", LinkAuth::makeChallenge(), answer ) );
+    assert( !coordinator_auth.check( "worker", challenge, other_auth.answer( "worker", challenge ) ) );
+    assert( !coordinator_auth.check( "worker", challenge, answer.left( answer.size() -1 ) ) );
+    assert( !coordinator_auth.check( "worker", QByteArray(), worker_auth.answer( "worker", QByteArray() ) ) );
+
+    /// test a worker's spruce, the targets are the solve and the fills are kept for the coordinator
+    Spruce spruce;
+    assert( !spruce.isRemote() );
+
+    spruce.addToShortLonged( "BTC_DOGE", Coin( "1" ) );
+    assert( spruce.takeReportedFills().isEmpty() ); // not reporting yet
+
+    spruce.setReportingFills( true );
+    spruce.addToShortLonged( "BTC_DOGE", Coin( "2" ) );
+    spruce.addToShortLonged( "BTC_DOGE", Coin( "-0.5" ) );
+    assert( spruce.getReportedFills().value( "BTC_DOGE" ) == Coin( "1.5" ) );
+    assert( spruce.takeReportedFills().value( "BTC_DOGE" ) == Coin( "1.5" ) );
+    assert( spruce.getReportedFills().isEmpty() );
+
+    spruce.setRemoteTargets( QMap<QString,Coin>() );
+    assert( spruce.isRemote() && !spruce.calculateAmountToShortLong() );
+
+    spruce.setRemoteTargets( amounts );
+    assert( spruce.calculateAmountToShortLong() && spruce.isSolved() );
+    assert( spruce.getQuantityToShortLongMap() == amounts );
+    assert( spruce.getQuantityToShortLongNow( "BTC_DOGE" ) == Coin( "-12.5" ) );
+    assert( spruce.getQuantityToShortLongNow( "BTC_LTC" ).isZero() );
+}
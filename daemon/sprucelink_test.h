@@ -0,0 +1,9 @@
+#ifndef SPRUCELINK_TEST_H
+#define SPRUCELINK_TEST_H
+
+struct SpruceLinkTest
+{
+    void test();
+};
+
+#endif // SPRUCELINK_TEST_H
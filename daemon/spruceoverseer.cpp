@@ -7,6 +7,17 @@
 #include "market.h"
 #include "engine.h"
 #include "positionman.h"
+#include "asyncsaver.h"
+#include "metrics.h"
+#include "settingsstate.h"
+#include "tracespan.h"
+#include "strategytag.h"
+#include "taskscheduler.h"
+#include "sprucelink.h"
+#include "standbylink.h"
+#include "threadplacement.h"
+#include "eventfeed.h"
+#include "virtualclock.h"
 
 #include <QTimer>
 #include <QVector>
@@ -14,6 +25,14 @@
 #include <QList>
 #include <QSet>
 #include <QFile>
+#include <QDir>
+#include <QStringList>
+#include <QtEndian>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QElapsedTimer>
+
+#include <cstring>
 
 const bool expand_spread_base_down = false; // true = getSpreadForSide always expands down for base greed value before applying other effects
 const bool expand_spread_buys = false; // expand buy side down more than sell side
@@ -21,50 +40,494 @@ const bool expand_spread_buys = false; // expand buy side down more than sell si
 const bool prices_uses_avg = true; // false = assemble widest combined spread between all exchanges, true = average spreads between all exchanges
 
 static const QString MIDSPREAD_PHASE = "mid_0";
+static const CoinRaw SOLVE_STALE_RATIO_DEFAULT = 0.005_coin; // a background solve is dropped if a mid price moved more than this, when there's no trigger ratio
+static const qint64 SOLVE_TRIGGER_RETRY_TIME = 5000; // ms before a price move triggers again after a solve that couldn't be prepared
+
+// a phase's order is the outstanding amount over this many orders, or over this many with the midspread phase's larger minimum
+static const int ORDER_CHUNKS_ESTIMATE_PER_SIDE = 10;
+static const int ORDER_SCALING_PHASE_0 = 3;
+
+// a phase's next order at the price of one it already has is what's left of the amount in one order instead of the next
+// chunk, up to this many order sizes, see SpruceOverseer::hasPhaseOrderNear()
+static const int ORDER_MERGE_SIZES_MAX = 5;
+
+// shadows, see SpruceOverseer::shadows. their simulated orders time out like the live ones, the others after 60-90s
+static const int SPRUCE_SHADOWS_MAX = 8;
+static const QString SPRUCE_SHADOW_PHASE_PREFIX = "shadow.";
+static const qint64 SPRUCE_SHADOW_TIMEOUT_MIDSPREAD = 5000;
+static const qint64 SPRUCE_SHADOW_TIMEOUT = 75000;
+
+// routing, see Spruce::setRouteBound(). the engines are measured every interval and their weights move part way to
+// the new score, so one slow interval doesn't swing the orders from one exchange to the other
+static const qint64 ROUTE_INTERVAL = 30000;
+static const quint64 ROUTE_MIN_ORDERS = 5; // a fill ratio of fewer orders says little
+static const qreal ROUTE_SMOOTHING = 0.3;
+static const qreal ROUTE_FILL_RATIO_FLOOR = 0.05; // an engine without fills in the interval isn't scored to nothing
+static const qreal ROUTE_WEIGHT_CHANGE_LOG = 0.05;
+
+// spread snapshot flags, the snapshot key is ( market, flags )
+static const quint8 SPREAD_SNAPSHOT_MID        = 0x01;
+static const quint8 SPREAD_SNAPSHOT_LIMIT      = 0x02;
+static const quint8 SPREAD_SNAPSHOT_BUY        = 0x04;
+static const quint8 SPREAD_SNAPSHOT_SELL       = 0x08;
+static const quint8 SPREAD_SNAPSHOT_DUPLICITY  = 0x10;
+static const quint8 SPREAD_SNAPSHOT_TAKER      = 0x20;
+static const quint8 SPREAD_SNAPSHOT_SIDE_LIMIT = 0x40;
+
+// the stats journal is folded into a new snapshot past this size, or this long after the last one
+static const qint64 STATS_JOURNAL_COMPACT_SIZE = 1024 * 1024;
+static const qint64 STATS_COMPACT_INTERVAL_SECS = 60 * 60 * 24;
+
+// the spruce settings state, see loadSettings(). the commands getSaveState() writes are captured by it
+static const quint32 SETTINGS_STATE_VERSION = 1;
+static const char *const SETTINGS_STATE_COMMANDS[] =
+{
+    "setspruceinterval", "setsprucetrigger", "setsprucebasecurrency", "setspruceamplification", "setsprucesolver",
+    "setsprucewarmstart", "setspruceordergreed", "setspruceordersize", "setspruceordernice", "setspruceordernicecustom",
+    "setsprucesnapback", "setspruceordernicemarketoffset", "setspruceprofile", "setsprucereserve", "setspruceallocation",
+    "setspruceweight", "setsprucestartnode", "setspruceshortlongtotal", "setsprucebetamarket", nullptr
+};
+
+// solves one phase of onSpruceUp() on a pool thread
+class SprucePhaseSolver : public QRunnable
+{
+public:
+    SprucePhaseSolver( Spruce *_solver )
+        : solver( _solver )
+    {
+    }
+
+    void run() override
+    {
+        ThreadPlacement::apply( ThreadPlacement::ROLE_SOLVER );
+        TRACE_SPAN( "calculateAmountToShortLong" );
+        solver->calculateAmountToShortLong();
+    }
+
+private:
+    Spruce *solver;
+};
+
+// solves the phases of onSpruceUp() off the main thread, then hands them back to onSpruceSolved()
+class SpruceSolveJob : public QRunnable
+{
+public:
+    SpruceSolveJob( SpruceOverseer *_overseer, const QVector<SprucePhase> &_phases )
+        : overseer( _overseer ),
+          phases( _phases )
+    {
+    }
+
+    void run() override
+    {
+        ThreadPlacement::apply( ThreadPlacement::ROLE_SOLVER );
+        SpruceOverseer::solvePhases( phases );
+        QMetaObject::invokeMethod( overseer, "onSpruceSolved", Qt::QueuedConnection );
+    }
+
+private:
+    SpruceOverseer *overseer; // waits for the pool before it goes away
+    QVector<SprucePhase> phases; // shares the solvers with m_solve_phases, nothing else touches them until we're done
+};
 
 SpruceOverseer::SpruceOverseer( Spruce *_spruce )
     : QObject( nullptr ),
-    spruce( _spruce )
+    spruce( _spruce ),
+    primary( _spruce )
 {
     kDebug() << "[SpruceOverseer]";
 
-    // this timer does tit-for-tat
-    spruce_timer = new QTimer( this );
-    connect( spruce_timer, &QTimer::timeout, this, &SpruceOverseer::onSpruceUp );
-    spruce_timer->setTimerType( Qt::VeryCoarseTimer );
+    // our timers share one wakeup, like the engines' do
+    scheduler = new TaskScheduler( this );
+
+    // this does tit-for-tat
+    spruce_timer = scheduler->addTask( this, "spruce", [this]() { onSpruceUp(); }, TASK_PRIORITY_ORDERS );
     spruce_timer->start( spruce->getIntervalSecs() * 1000 );
 
     // autosave spruce settings
-    autosave_timer = new QTimer( this );
-    connect( autosave_timer, &QTimer::timeout, this, &SpruceOverseer::onSaveSpruceSettings );
-    autosave_timer->setTimerType( Qt::VeryCoarseTimer );
+    autosave_timer = scheduler->addTask( this, "autosave", [this]() { onSaveSpruceSettings(); }, TASK_PRIORITY_HOUSEKEEPING, 0.05 );
     autosave_timer->start( 60000 * 60 ); // set default to 1hr
+
+    // append the stats changes to the journal
+    stats_timer = scheduler->addTask( this, "stats", [this]() { onSaveStats(); }, TASK_PRIORITY_HOUSEKEEPING, 0.05 );
+    stats_timer->start( 60000 );
+
+    saver = new AsyncSaver( this );
+
+    // one solve at a time, each one runs its phases on a pool of its own
+    m_solve_pool = new QThreadPool( this );
+    m_solve_pool->setMaxThreadCount( 1 );
 }
 
 SpruceOverseer::~SpruceOverseer()
 {
-    spruce_timer->stop();
-    autosave_timer->stop();
+    m_solve_pool->waitForDone();
 
-    delete spruce_timer;
-    delete autosave_timer;
+    delete scheduler;
+    scheduler = nullptr;
+    spruce_timer = nullptr;
+    autosave_timer = nullptr;
+    stats_timer = nullptr;
+
+    delete saver; // waits for the writes
+
+    qDeleteAll( market_events );
+    qDeleteAll( portfolios );
+
+    for ( QMap<QString, SpruceShadow>::const_iterator i = shadows.begin(); i != shadows.end(); i++ )
+        delete i.value().spruce;
+}
+
+MarketEventQueue *SpruceOverseer::getMarketEvents( const qint32 engine_id )
+{
+    // one queue for each engine, it stays single producer when an exchange has several
+    MarketEventQueue *&queue = market_events[ engine_id ];
+    if ( !queue )
+        queue = new MarketEventQueue( quint8( engine_id % ENGINE_SHARD_STRIDE ) );
+
+    return queue;
+}
+
+void SpruceOverseer::drainMarketEvents()
+{
+    for ( QMap<qint32, MarketEventQueue*>::const_iterator i = market_events.begin(); i != market_events.end(); i++ )
+        i.value()->drain( bbo );
+}
+
+void SpruceOverseer::lockEngines()
+{
+    // the engines run on their own threads, always lock them in the same order and then spruce
+    for ( QMap<qint32, Engine*>::const_iterator i = engine_map.begin(); i != engine_map.end(); i++ )
+        i.value()->getLock()->lock();
+
+    spruce_lock.lock();
+}
+
+void SpruceOverseer::unlockEngines()
+{
+    spruce_lock.unlock();
+
+    for ( QMap<qint32, Engine*>::const_iterator i = engine_map.end(); i != engine_map.begin(); )
+    {
+        i--;
+        i.value()->getLock()->unlock();
+    }
 }
 
 void SpruceOverseer::onSpruceUp()
 {
-    // store last spread distance limits
-    static QMap<QString,Coin> last_spread_reduce_buys;
-    static QMap<QString,Coin> last_spread_reduce_sells;
+    TRACE_SPAN( "onSpruceUp" );
 
-    if ( !spruce->isActive() )
+    // still solving, the next one starts after it's applied
+    if ( m_is_solving )
+        return;
+
+    drainMarketEvents();
+    lockEngines();
+
+    // the tickers don't change while we run, so each spread is only calculated once for all phases and cancellors
+    m_spread_snapshot_active = true;
+    m_solve_timer.start();
+
+    QVector<SprucePhase> phases;
+    const bool is_prepared = preparePortfolios( phases );
+
+    // the last solve prices weren't updated, don't let each ticker trigger it again meanwhile
+    m_prepare_failed_time = is_prepared ? 0 : VirtualClock::currentMSecsSinceEpoch();
+
+    if ( is_prepared )
+    {
+        if ( m_is_async_solve )
+        {
+            // solve without holding the engines, the result is applied in onSpruceSolved()
+            m_solve_phases = phases;
+            m_is_solving = true;
+            m_solve_pool->start( new SpruceSolveJob( this, phases ) );
+        }
+        else
+        {
+            solvePhases( phases );
+            applyPortfolios( phases );
+            addSolveMetrics();
+        }
+    }
+
+    m_spread_snapshot_active = false;
+    m_spread_snapshot.clear();
+
+    unlockEngines();
+}
+
+void SpruceOverseer::onSpruceSolved()
+{
+    TRACE_SPAN( "onSpruceSolved" );
+
+    m_is_solving = false;
+
+    drainMarketEvents();
+    lockEngines();
+
+    m_spread_snapshot_active = true;
+
+    // orders placed at prices that have since moved would have to be cancelled again, wait for the next solve
+    if ( isSolveStale( m_solve_phases ) )
+        kDebug() << "[Spruce] prices moved during the solve, dropping its result";
+    else
+        applyPortfolios( m_solve_phases );
+
+    addSolveMetrics();
+    m_solve_phases.clear();
+
+    m_spread_snapshot_active = false;
+    m_spread_snapshot.clear();
+
+    unlockEngines();
+}
+
+void SpruceOverseer::addSolveMetrics()
+{
+    SpruceCounters &counters = Metrics::getSpruceCounters();
+    const quint64 solve_us = quint64( m_solve_timer.nsecsElapsed() / 1000 );
+    Metrics::add( counters.solves );
+    Metrics::add( counters.solve_us_total, solve_us );
+    Metrics::set( counters.solve_us_last, solve_us );
+}
+
+void SpruceOverseer::trackSolveComplete( const SprucePhase &phase )
+{
+    // the midspread sell phase has the buy phase's solver
+    if ( phase.side == SIDE_SELL && phase.is_midspread )
+        return;
+
+    if ( !phase.solver->isSolved() || phase.solver->isSolveComplete() )
+    {
+        m_incomplete_phases.remove( phase.name );
+        return;
+    }
+
+    // placed as it is, and resumed on the next tick
+    m_incomplete_phases.insert( phase.name );
+    Metrics::add( Metrics::getSpruceCounters().solves_incomplete );
+    kDebug() << "[Spruce] solve of" << phase.name << "stopped at the" << phase.solver->getSolveDeadline() << "ms deadline after"
+             << phase.solver->getSolveIterations() << "steps, resuming it next tick";
+}
+
+bool SpruceOverseer::isSolveStale( const QVector<SprucePhase> &phases )
+{
+    if ( phases.isEmpty() )
+        return true;
+
+    // a move the trigger would have solved early for is too much, or the default if the trigger is off
+    const Coin trigger_ratio = spruce->getTriggerRatio();
+    const Coin stale_ratio = trigger_ratio.isGreaterThanZero() ? trigger_ratio : Coin( SOLVE_STALE_RATIO_DEFAULT );
+
+    for ( QVector<SprucePhase>::const_iterator p = phases.begin(); p != phases.end(); p++ )
+    {
+        // each portfolio's midspread phase has the prices it solved with
+        if ( !p->is_midspread || p->side != SIDE_BUY )
+            continue;
+
+        const QMap<QString,TickerInfo> &solve_spread = p->mid_spread;
+        for ( QMap<QString,TickerInfo>::const_iterator i = solve_spread.begin(); i != solve_spread.end(); i++ )
+        {
+            const Coin &solve_price = i.value().bid;
+            const TickerInfo mid_spread = getMidSpread( i.key() );
+
+            if ( !mid_spread.isValid() || !solve_price.isGreaterThanZero() )
+                return true;
+
+            if ( ( mid_spread.bid - solve_price ).abs() / solve_price > stale_ratio )
+                return true;
+        }
+    }
+
+    return false;
+}
+
+void SpruceOverseer::onTickerUpdate()
+{
+    // one wake for everything the engines pushed since the last one
+    drainMarketEvents();
+
+    // the shadows' orders fill on the prices as they come, not only on our ticks
+    if ( !shadows.isEmpty() )
+    {
+        QMutexLocker locker( &spruce_lock );
+        for ( QMap<QString, SpruceShadow>::iterator i = shadows.begin(); i != shadows.end(); i++ )
+            matchShadowOrders( i.value() );
+    }
+
+    // the stale check runs when the solve is back
+    if ( m_is_solving )
+        return;
+
+    // the timer retries a solve that couldn't be prepared, a price move only after a while
+    if ( m_prepare_failed_time > 0 &&
+         VirtualClock::currentMSecsSinceEpoch() - m_prepare_failed_time < SOLVE_TRIGGER_RETRY_TIME )
+        return;
+
+    lockEngines();
+
+    const Coin trigger_ratio = spruce->getTriggerRatio();
+    bool solve_early = false;
+
+    if ( trigger_ratio.isGreaterThanZero() && isActive() )
+    {
+        for ( QMap<QString,Coin>::const_iterator i = m_last_solve_prices.begin(); i != m_last_solve_prices.end(); i++ )
+        {
+            const QString &market = i.key();
+            const Coin &last_price = i.value();
+            const TickerInfo mid_spread = getMidSpread( market );
+
+            if ( !mid_spread.isValid() || !last_price.isGreaterThanZero() )
+                continue;
+
+            const Coin moved = ( mid_spread.bid - last_price ).abs() / last_price;
+            if ( moved <= trigger_ratio )
+                continue;
+
+            kDebug() << "[Spruce] price of" << market << "moved" << moved.toString( 4 ) << "since the last solve, solving early";
+            solve_early = true;
+            break;
+        }
+    }
+
+    unlockEngines();
+
+    if ( !solve_early )
+        return;
+
+    // the interval is the maximum time between solves, so restart it
+    spruce_timer->start( spruce->getIntervalSecs() * 1000 );
+    onSpruceUp();
+}
+
+bool SpruceOverseer::preparePortfolios( QVector<SprucePhase> &phases )
+{
+    // primary first, then the others by name. the phases of each one stay together for applyPortfolios()
+    QMap<QString, Spruce*> solving = portfolios;
+    solving.insert( QString(), primary );
+
+    for ( QMap<QString, Spruce*>::const_iterator i = solving.begin(); i != solving.end(); i++ )
+    {
+        setSolvingPortfolio( i.key() );
+
+        QVector<SprucePhase> portfolio_phases;
+        if ( prepareSpruce( portfolio_phases ) )
+            phases += portfolio_phases;
+    }
+
+    // the shadows after them, from the same spreads
+    for ( QMap<QString, SpruceShadow>::const_iterator i = shadows.begin(); i != shadows.end(); i++ )
+    {
+        setSolvingShadow( i.key() );
+
+        QVector<SprucePhase> shadow_phases;
+        if ( prepareSpruce( shadow_phases ) )
+            phases += shadow_phases;
+    }
+
+    setSolvingPortfolio( QString() );
+
+    if ( phases.isEmpty() )
+        return false;
+
+    // remember the prices we solved with for the price move trigger
+    m_last_solve_prices.clear();
+    for ( QVector<SprucePhase>::const_iterator p = phases.begin(); p != phases.end(); p++ )
+    {
+        if ( !p->is_midspread || p->side != SIDE_BUY || p->is_shadow )
+            continue;
+
+        for ( QMap<QString,TickerInfo>::const_iterator i = p->mid_spread.begin(); i != p->mid_spread.end(); i++ )
+            m_last_solve_prices.insert( i.key(), i.value().bid );
+    }
+
+    return true;
+}
+
+void SpruceOverseer::applyPortfolios( const QVector<SprucePhase> &phases )
+{
+    // with the engines locked, measure them for the routing
+    updateRoutes( VirtualClock::currentMSecsSinceEpoch() );
+
+    // apply each portfolio's run of phases with spruce pointing at it
+    qint32 start = 0;
+    while ( start < phases.size() )
+    {
+        const SprucePhase &first = phases.at( start );
+
+        qint32 end = start +1;
+        while ( end < phases.size() && phases.at( end ).portfolio == first.portfolio && phases.at( end ).is_shadow == first.is_shadow )
+            end++;
+
+        // a shadow removed while it was solving has nothing to apply to
+        if ( !first.is_shadow )
+        {
+            setSolvingPortfolio( first.portfolio );
+            applySpruce( phases.mid( start, end - start ) );
+        }
+        else if ( shadows.contains( first.portfolio ) )
+        {
+            setSolvingShadow( first.portfolio );
+            applyShadow( phases.mid( start, end - start ) );
+        }
+
+        start = end;
+    }
+
+    setSolvingPortfolio( QString() );
+}
+
+void SpruceOverseer::setSolvingPortfolio( const QString &name )
+{
+    Spruce *portfolio = name.isEmpty() ? primary : portfolios.value( name, primary );
+
+    // the spreads come from the portfolio's greed and nice settings, don't reuse another one's
+    if ( portfolio != spruce )
+        m_spread_snapshot.clear();
+
+    m_solving_portfolio = name;
+    m_is_solving_shadow = false;
+    spruce = portfolio;
+}
+
+void SpruceOverseer::setSolvingShadow( const QString &name )
+{
+    Spruce *shadow = shadows.value( name ).spruce;
+    if ( !shadow )
         return;
 
+    if ( shadow != spruce )
+        m_spread_snapshot.clear();
+
+    m_solving_portfolio = name;
+    m_is_solving_shadow = true;
+    spruce = shadow;
+}
+
+bool SpruceOverseer::prepareSpruce( QVector<SprucePhase> &phases )
+{
+    if ( !spruce->isActive() )
+        return false;
+
+    // a worker places orders for the coordinator's solves, never for old ones. the link only carries primary
+    const bool is_primary = m_solving_portfolio.isEmpty();
+    const bool is_worker = is_primary && link && link->isWorker();
+    if ( is_worker && !link->hasTargets( spruce->getIntervalSecs() * 1000 * SPRUCE_LINK_TARGETS_MAX_AGE ) )
+    {
+        kDebug() << "[Spruce] no recent targets from the coordinator, skipping";
+        return false;
+    }
+
     QMap<QString/*market*/,Coin> spread_price;
     const QList<QString> currencies = spruce->getCurrencies();
     QList<QString> markets;
     markets += MIDSPREAD_PHASE; // 1 phase for middle spread
     markets += spruce->getMarketsAlpha(); // 1 phase for each market
 
+    // collect the live nodes for each phase here, since the spreads come from the engines. each phase
+    // is then solved on its own copy of spruce, and the orders are placed by applySpruce() in phase order.
     for ( QList<QString>::const_iterator m = markets.begin(); m != markets.end(); m++ )
     {
         // track mid spread for each market (spread for every market is needed for custom phase)
@@ -75,24 +538,43 @@ void SpruceOverseer::onSpruceUp()
         // one pass in each phase for buys and sells
         for ( quint8 side = SIDE_BUY; side < SIDE_SELL +1; side++ )
         {
-            const QString phase_name = QString( "spruce-%1-%2" )
-                                      .arg( side == SIDE_BUY ? "B" : "S" )
-                                      .arg( market_phase );
+            SprucePhase phase;
+            phase.portfolio = m_solving_portfolio;
+            phase.market = market_phase;
+            phase.side = side;
+            phase.is_midspread = market_phase == MIDSPREAD_PHASE;
+            phase.is_shadow = m_is_solving_shadow;
+
+            // a shadow's phases never have orders, so they don't get a strategy tag
+            if ( phase.is_shadow )
+                phase.name = QString( "%1%2-%3-%4" )
+                             .arg( SPRUCE_SHADOW_PHASE_PREFIX )
+                             .arg( m_solving_portfolio )
+                             .arg( side == SIDE_BUY ? "B" : "S" )
+                             .arg( market_phase );
+            else
+            {
+                phase.tag_id = getPhaseTagId( market_phase, side );
+                phase.name = StrategyTag::getString( phase.tag_id );
+            }
+
+            const QString &phase_name = phase.name;
 
             // initialize duplicity spread (used only after custom phase)
-            TickerInfo spread_duplicity;
-            if ( market_phase != MIDSPREAD_PHASE )
+            TickerInfo &spread_duplicity = phase.spread_duplicity;
+            if ( !phase.is_midspread )
             {
                 spread_duplicity = getSpreadForSide( market_phase, side, true, false, true, true );
 
                 if ( !spread_duplicity.isValid() )
                 {
                     kDebug() << "spruceoverseer error: duplicity spread was not valid for phase" << phase_name;
-                    return;
+                    return false;
                 }
             }
 
-            spruce->clearLiveNodes();
+            phase.solver = QSharedPointer<Spruce>( spruce->clone() );
+            phase.solver->clearLiveNodes();
             for ( QList<QString>::const_iterator i = currencies.begin(); i != currencies.end(); i++ )
             {
                 const QString &currency = *i;
@@ -106,7 +588,7 @@ void SpruceOverseer::onSpruceUp()
                     if ( !mid_spread.value( market ).isValid() )
                     {
                         kDebug() << "spruceoverseer error: midspread was not valid for phase" << phase_name;
-                        return;
+                        return false;
                     }
                 }
 
@@ -117,19 +599,19 @@ void SpruceOverseer::onSpruceUp()
                 if ( mid_spread.value( market ).bid != mid_spread.value( market ).ask )
                 {
                     kDebug() << "local error: midspread bid" << mid_spread.value( market ).bid << "!= ask" << mid_spread.value( market ).ask;
-                    return;
+                    return false;
                 }
 
                 // if the ticker isn't updated, just skip this whole function
                 if ( flux_price.isZeroOrLess() )
                 {
                     kDebug() << "[Spruce] local error: no ticker for currency" << market;
-                    return;
+                    return false;
                 }
 
                 // if market matches selected market, select best price from duplicity price or mid price
                 if ( market == market_phase &&
-                     market_phase != MIDSPREAD_PHASE ) // on custom iteration, skip this step
+                     !phase.is_midspread ) // on custom iteration, skip this step
                 {
                     // set the most optimistic price to use, either the midprice or duplicity price
                     flux_price = ( side == SIDE_BUY ) ? std::min( flux_price, spread_duplicity.bid ) :
@@ -137,266 +619,493 @@ void SpruceOverseer::onSpruceUp()
                 }
 
                 spread_price.insert( currency, flux_price );
-                spruce->addLiveNode( currency, flux_price );
+                phase.solver->addLiveNode( currency, flux_price );
             }
 
-            // on the sell side of custom iteration 0, the result is the same as the buy side, so skip it
-            if ( !( side == SIDE_SELL && market_phase == MIDSPREAD_PHASE ) )
-            {
-                // calculate amount to short/long, and fail if necessary
-                if ( !spruce->calculateAmountToShortLong() )
-                    return;
-            }
+            phase.mid_spread = mid_spread;
 
-            const QMap<QString,Coin> &qty_to_shortlong_map = spruce->getQuantityToShortLongMap();
+            // on the sell side of custom iteration 0, the result is the same as the buy side, so reuse it
+            if ( side == SIDE_SELL && phase.is_midspread )
+                phase.solver = phases.last().solver;
 
-            for ( QMap<quint8, Engine*>::const_iterator e = engine_map.begin(); e != engine_map.end(); e++ )
-            {
-                Engine *engine = e.value();
+            phases += phase;
+        }
+    }
 
-                for ( QMap<QString,Coin>::const_iterator i = qty_to_shortlong_map.begin(); i != qty_to_shortlong_map.end(); i++ )
-                {
-                    const QString &market = i.key();
+    // take the coordinator's targets instead of solving, or note which fills this solve counts for the workers
+    if ( is_worker )
+    {
+        for ( QVector<SprucePhase>::const_iterator p = phases.begin(); p != phases.end(); p++ )
+            if ( !( p->side == SIDE_SELL && p->is_midspread ) )
+                p->solver->setRemoteTargets( link->getTargets( p->name ) );
 
-                    // skip market unless it's selected
-                    if ( market != market_phase &&
-                         market_phase != MIDSPREAD_PHASE ) // on custom iteration, set an order for every market
-                        continue;
+        return true;
+    }
 
-                    const QString exchange_market_key = QString( "%1-%2" )
-                                                        .arg( e.key() )
-                                                        .arg( market );
+    if ( is_primary && link )
+        link->markSolveStart();
 
-                    // get market allocation for this exchange and apply to qty_to_shortlong
-                    const Coin market_allocation = spruce->getExchangeAllocation( exchange_market_key );
+    // start each phase from its last solution, the midspread sell phase shares the buy phase's solver. one the deadline
+    // stopped resumes from where it was even without the warm start
+    for ( QVector<SprucePhase>::const_iterator p = phases.begin(); p != phases.end(); p++ )
+    {
+        if ( ( p->side == SIDE_SELL && p->is_midspread ) ||
+             ( !spruce->getSolverWarmStart() && !m_incomplete_phases.contains( p->name ) ) )
+            continue;
 
-                    // continue on zero market allocation for this engine
-                    if ( market_allocation.isZeroOrLess() )
-                        continue;
+        p->solver->setSolverWarmStart( true );
+        p->solver->setWarmStartSolution( m_warm_start_solutions.value( p->name ) );
+    }
 
-                    QString order_type = "onetime";
-                    Coin buy_price, sell_price;
+    return true;
+}
 
-                    // set price for order
-                    if ( market_phase == MIDSPREAD_PHASE )
-                    {
-                        buy_price = mid_spread.value( market ).bid;
-                        sell_price = mid_spread.value( market ).ask;
+void SpruceOverseer::solvePhases( const QVector<SprucePhase> &phases )
+{
+    // calculate amount to short/long for each phase concurrently
+    QThreadPool pool;
+    for ( QVector<SprucePhase>::const_iterator p = phases.begin(); p != phases.end(); p++ )
+    {
+        if ( p->side == SIDE_SELL && p->is_midspread )
+            continue;
 
-                        // set local taker mode to disable local spread collision detection which would modify the price
-                        order_type += "-taker";
+        pool.start( new SprucePhaseSolver( p->solver.data() ) );
+    }
 
-                        // set fast timeout
-                        order_type += "-timeout5";
-                    }
-                    else
-                    {
-                        buy_price = spread_duplicity.bid;
-                        sell_price = spread_duplicity.ask;
-                    }
+    pool.waitForDone();
+}
+
+void SpruceOverseer::applySpruce( const QVector<SprucePhase> &phases )
+{
+    // last spread distance limits of the portfolio being applied
+    QMap<QString,Coin> &last_spread_reduce_buys = m_spread_reduce_buys[ m_solving_portfolio ];
+    QMap<QString,Coin> &last_spread_reduce_sells = m_spread_reduce_sells[ m_solving_portfolio ];
 
-                    // run cancellors for this phase every iteration
-                    const Coin cancel_thresh_price = ( market_phase == MIDSPREAD_PHASE ) ? Coin() :
-                                                     ( side == SIDE_BUY ) ? buy_price : sell_price;
-                    runCancellors( engine, market, side, phase_name, cancel_thresh_price );
+    // keep each phase's solution for the next tick, the names are the portfolio's own
+    for ( QVector<SprucePhase>::const_iterator p = phases.begin(); p != phases.end(); p++ )
+    {
+        if ( p->solver->isSolved() )
+            m_warm_start_solutions.insert( p->name, p->solver->getSolution() );
+        else
+            m_warm_start_solutions.remove( p->name );
 
-                    const Coin qty_to_shortlong = i.value() * market_allocation;
-                    const bool is_buy = qty_to_shortlong.isZeroOrLess();
+        trackSolveComplete( *p );
+    }
 
-                    // don't place buys during the ask price loop, or sells during the bid price loop
-                    if ( (  is_buy && side == SIDE_SELL ) ||
-                         ( !is_buy && side == SIDE_BUY ) )
-                        continue;
+    // the workers place their orders for it too
+    if ( link && link->isCoordinator() && m_solving_portfolio.isEmpty() )
+        link->publishTargets( phases );
 
-                    // cache some order settings
-                    const Coin order_size_default = spruce->getOrderSize( market );
-                    const Coin order_nice = spruce->getOrderNice( market, side, market_phase == MIDSPREAD_PHASE );
-                    const Coin order_size_limit = order_size_default * order_nice;
+    for ( QVector<SprucePhase>::const_iterator p = phases.begin(); p != phases.end(); p++ )
+    {
+        const SprucePhase &phase = *p;
+        const Spruce *solved = phase.solver.data();
+        const Market &market_phase = phase.market;
+        const quint8 side = phase.side;
+        const QString &phase_name = phase.name;
+        const bool is_midspread = phase.is_midspread;
+        const TickerInfo &spread_duplicity = phase.spread_duplicity;
+        const QMap<QString,TickerInfo> &mid_spread = phase.mid_spread;
 
-                    // cache amount to short/long
-                    const Coin amount_to_shortlong = spruce->getCurrencyPriceByMarket( market ) * qty_to_shortlong;
-                    const Coin amount_to_shortlong_abs = amount_to_shortlong.abs();
+        // fail if necessary
+        if ( !solved->isSolved() )
+            return;
 
-                    // if we're under the nice size limit, skip conflict checks and order setting
-                    if ( amount_to_shortlong_abs < order_size_limit )
-                        continue;
+        // our positions in this phase's market, for the conflict checks
+        const qint32 market_tag_ids[ 2 ] = { getPhaseTagId( market_phase, SIDE_BUY ), getPhaseTagId( market_phase, SIDE_SELL ) };
 
-                    // we're over the nice value for the midspread phase.
-                    // this will modify nice values for all phases on this side on the next round of onSpruceUp() call to getOrderNice()
-                    if (  market_phase == MIDSPREAD_PHASE &&
-                         !spruce->getSnapbackState( market, side ) )
-                    {
-                        spruce->setSnapbackState( market, side, true );
-                    }
+        const QMap<QString,Coin> &qty_to_shortlong_map = solved->getQuantityToShortLongMap();
 
-                    Coin spread_distance_limit;
+        // what the solve wants of each market on each engine, for the placement below and the cancellors
+        SpruceTargetTable targets;
+        buildTargets( phase, targets );
 
-                    /// for duplicity phases, detect conflicting positions for this market within the spread distance limit
-                    if ( market_phase != MIDSPREAD_PHASE )
-                    {
-                        const Coin spread_put_threshold = order_size_default * spruce->getOrderNiceSpreadPut( side );
+        for ( QMap<qint32, Engine*>::const_iterator e = engine_map.begin(); e != engine_map.end(); e++ )
+        {
+            Engine *engine = e.value();
+
+            for ( QMap<QString,Coin>::const_iterator i = qty_to_shortlong_map.begin(); i != qty_to_shortlong_map.end(); i++ )
+            {
+                const QString &market = i.key();
+
+                // the markets of other shards, other phases, or without an allocation here aren't in it
+                const SpruceTargetTable::const_iterator t = targets.constFind( qMakePair( e.key(), Market::getMarketId( market ) ) );
+                if ( t == targets.constEnd() )
+                    continue;
+
+                const SpruceTarget &target = t.value();
+
+                QString order_type = "onetime";
+                Coin buy_price, sell_price;
 
-                        // declare spread reduce here so we can print/evalulate it after
-                        Coin spread_reduce;
+                // set price for order
+                if ( is_midspread )
+                {
+                    buy_price = mid_spread.value( market ).bid;
+                    sell_price = mid_spread.value( market ).ask;
+
+                    // set local taker mode to disable local spread collision detection which would modify the price
+                    order_type += "-taker";
+
+                    // set fast timeout
+                    order_type += "-timeout5";
+                }
+                else
+                {
+                    buy_price = spread_duplicity.bid;
+                    sell_price = spread_duplicity.ask;
+                }
+
+                // run cancellors for this phase every iteration
+                const Coin cancel_thresh_price = is_midspread ? Coin() :
+                                                 ( side == SIDE_BUY ) ? buy_price : sell_price;
+                runCancellors( engine, target, market, side, phase.tag_id, is_midspread, cancel_thresh_price );
+
+                const Coin &qty_to_shortlong = target.qty_to_shortlong;
+                const bool is_buy = qty_to_shortlong.isZeroOrLess();
+
+                // don't place buys during the ask price loop, or sells during the bid price loop
+                if ( (  is_buy && side == SIDE_SELL ) ||
+                     ( !is_buy && side == SIDE_BUY ) )
+                    continue;
+
+                // cache some order settings
+                const Coin &order_size_default = target.order_size;
+                const Coin order_nice = spruce->getOrderNice( market, side, is_midspread ); // snapback can change it in this tick
+                const Coin order_size_limit = order_size_default * order_nice;
+
+                // cache amount to short/long
+                const Coin &amount_to_shortlong = target.amount_to_shortlong;
+                const Coin amount_to_shortlong_abs = amount_to_shortlong.abs();
+
+                // if we're under the nice size limit, skip conflict checks and order setting
+                if ( amount_to_shortlong_abs < order_size_limit )
+                    continue;
+
+                // we're over the nice value for the midspread phase.
+                // this will modify nice values for all phases on this side on the next round of onSpruceUp() call to getOrderNice()
+                if (  is_midspread &&
+                     !spruce->getSnapbackState( market, side ) )
+                {
+                    spruce->setSnapbackState( market, side, true );
+                }
 
-                        // reduce spread if pending amount to shortlong is greater than size * order_nice_spreadput
-                        if ( spread_put_threshold.isGreaterThanZero() &&
-                             amount_to_shortlong_abs > spread_put_threshold )
+                Coin spread_distance_limit;
+
+                /// for duplicity phases, detect conflicting positions for this market within the spread distance limit
+                if ( !is_midspread )
+                {
+                    const Coin spread_put_threshold = order_size_default * spruce->getOrderNiceSpreadPut( side );
+
+                    // declare spread reduce here so we can print/evalulate it after
+                    Coin spread_reduce;
+
+                    // reduce spread if pending amount to shortlong is greater than size * order_nice_spreadput
+                    if ( spread_put_threshold.isGreaterThanZero() &&
+                         amount_to_shortlong_abs > spread_put_threshold )
+                    {
+                        spread_reduce = amount_to_shortlong_abs.mulDiv( CoinAmount::SATOSHI * 100000, spread_put_threshold );
+
+                        const TickerInfo collapsed_spread = getSpreadForSide( market, side, true, false, true, true, spread_reduce );
+                        if ( collapsed_spread.isValid() )
                         {
-                            spread_reduce = ( amount_to_shortlong_abs / spread_put_threshold ) * ( CoinAmount::SATOSHI * 100000 );
-
-                            const TickerInfo collapsed_spread = getSpreadForSide( market, side, true, false, true, true, spread_reduce );
-                            if ( collapsed_spread.isValid() )
-                            {
-                                buy_price = collapsed_spread.bid;
-                                sell_price = collapsed_spread.ask;
-                            }
-                            else
-                            {
-                                kDebug() << "spruceoverseer error: collapsed spread was not valid for phase" << phase_name;
-                                return;
-                            }
+                            buy_price = collapsed_spread.bid;
+                            sell_price = collapsed_spread.ask;
                         }
-
-                        // cache spread distance limit for this side
-                        if ( is_buy )
-                            last_spread_reduce_buys.insert( market, spread_reduce );
                         else
-                            last_spread_reduce_sells.insert( market, spread_reduce );
+                        {
+                            kDebug() << "spruceoverseer error: collapsed spread was not valid for phase" << phase_name;
+                            return;
+                        }
+                    }
 
-                        // cache spread distance limit for this side, but selected larger spread_reduce value from both sides
-                        const Coin spread_reduce_selected = std::max( last_spread_reduce_buys.value( market ), last_spread_reduce_sells.value( market ) );
-                        spread_distance_limit = std::min( spruce->getOrderGreed() + spread_reduce_selected, spruce->getOrderGreedMinimum() );
+                    // cache spread distance limit for this side
+                    if ( is_buy )
+                        last_spread_reduce_buys.insert( market, spread_reduce );
+                    else
+                        last_spread_reduce_sells.insert( market, spread_reduce );
+
+                    // cache spread distance limit for this side, but selected larger spread_reduce value from both sides
+                    const Coin spread_reduce_selected = std::max( last_spread_reduce_buys.value( market ), last_spread_reduce_sells.value( market ) );
+                    spread_distance_limit = std::min( spruce->getOrderGreed() + spread_reduce_selected, spruce->getOrderGreedMinimum() );
 
-                        // search positions for conflicts
-                        for ( QSet<Position*>::const_iterator j = engine->positions->all().begin(); j != engine->positions->all().end(); j++ )
+                    // search positions for conflicts
+                    for ( QVector<Position*>::const_iterator j = engine->positions->all().constBegin(); j != engine->positions->all().constEnd(); j++ )
+                    {
+                        Position *const &pos = *j;
+
+                        // look for positions on the other side of this market
+                        if ( pos->side == side ||
+                             pos->is_cancelling ||
+                             pos->order_set_time == 0 ||
+                             pos->market != market ||
+                           ( pos->strategy_tag_id != market_tag_ids[ 0 ] && pos->strategy_tag_id != market_tag_ids[ 1 ] ) )
+                            continue;
+
+                        if ( (  is_buy && buy_price >= pos->sell_price * spread_distance_limit ) ||
+                             ( !is_buy && sell_price * spread_distance_limit <= pos->buy_price ) )
                         {
-                            Position *const &pos = *j;
-
-                            // look for positions on the other side of this market
-                            if ( pos->side == side ||
-                                 pos->is_cancelling ||
-                                 pos->order_set_time == 0 ||
-                                 pos->market != market ||
-                                !pos->strategy_tag.endsWith( market ) )
-                                continue;
-
-                            if ( (  is_buy && buy_price >= pos->sell_price * spread_distance_limit ) ||
-                                 ( !is_buy && sell_price * spread_distance_limit <= pos->buy_price ) )
-                            {
-                                engine->positions->cancel( pos, false, CANCELLING_FOR_SPRUCE_CONFLICT );
-                            }
+                            engine->positions->cancel( pos, false, CANCELLING_FOR_SPRUCE_CONFLICT );
                         }
                     }
-
-                    // set slow timeout
-                    if ( !order_type.contains( "timeout" ) )
-                        order_type += QString( "-timeout%1" )
-                                      .arg( Global::getSecureRandomRange32( 60, 90 ) );
-
-                    // check amount active
-                    const Coin spruce_active_for_side = engine->positions->getActiveSpruceEquityTotal( market, phase_name, side, Coin() );
-
-                    // calculate order size, prevent going over amount_to_shortlong_abs but also prevent going under order_size_default
-                    const int ORDER_CHUNKS_ESTIMATE_PER_SIDE = 10;
-                    const int ORDER_SCALING_PHASE_0 = 3;
-                    const Coin order_size = ( market_phase == MIDSPREAD_PHASE ) ?
-                                std::max( order_size_default * ORDER_SCALING_PHASE_0, ( amount_to_shortlong_abs - spruce_active_for_side ) / ORDER_SCALING_PHASE_0 ) :
-                                std::max( order_size_default, ( amount_to_shortlong_abs - spruce_active_for_side ) / ORDER_CHUNKS_ESTIMATE_PER_SIDE );
-
-                    // don't go under the default order size
-                    if ( order_size < order_size_default )
-                        continue;
-
-                    // don't go over the abs value of our new projected position, and also regard nice value
-                    if ( spruce_active_for_side + order_size > amount_to_shortlong_abs ||
-                         spruce_active_for_side + order_size_limit > amount_to_shortlong_abs )
-                        continue;
-
-                    kDebug() << QString( "[%1 %2] %3 | co %4 | q %5 | a %6[%7] | act %8 | dst %9" )
-                                   .arg( phase_name, -MARKET_STRING_WIDTH - 9 )
-                                   .arg( market, MARKET_STRING_WIDTH )
-                                   .arg( side == SIDE_BUY ? buy_price : sell_price )
-                                   .arg( spruce->getLastCoeffForMarket( market ).toString( 4 ), 7 )
-                                   .arg( qty_to_shortlong, 16 )
-                                   .arg( amount_to_shortlong, 13 ) // print amount to s/l
-                                   .arg( amount_to_shortlong + ( is_buy ? order_size_limit : -order_size_limit ), 13 ) // print amount to s/l less the nice buffer (the actionable amount)
-                                   .arg( spruce_active_for_side, 12 )
-                                   .arg( spread_distance_limit.toString( 4 ) );
-
-                    // queue the order if we aren't paper trading
-#if !defined(PAPER_TRADE)
-                    engine->addPosition( market, is_buy ? SIDE_BUY : SIDE_SELL, buy_price, sell_price, order_size,
-                                         order_type, phase_name, QVector<qint32>(), false, true );
-#endif
                 }
+
+                // set slow timeout
+                if ( !order_type.contains( "timeout" ) )
+                    order_type += QString( "-timeout%1" )
+                                  .arg( Global::getSecureRandomRange32( 60, 90 ) );
+
+                // check amount active
+                const Coin spruce_active_for_side = engine->positions->getActiveSpruceEquityTotal( market, phase.tag_id, side, Coin() );
+
+                // calculate order size, prevent going over amount_to_shortlong_abs but also prevent going under order_size_default
+                Coin order_size = is_midspread ?
+                            std::max( order_size_default * ORDER_SCALING_PHASE_0, ( amount_to_shortlong_abs - spruce_active_for_side ) / ORDER_SCALING_PHASE_0 ) :
+                            std::max( order_size_default, ( amount_to_shortlong_abs - spruce_active_for_side ) / ORDER_CHUNKS_ESTIMATE_PER_SIDE );
+
+                // another chunk at the price the phase already rests at only adds a request, merge the rest into this one
+                const bool is_merged = hasPhaseOrderNear( engine, phase.tag_id, market, side, is_buy ? buy_price : sell_price );
+                if ( is_merged )
+                    order_size = std::max( order_size, std::min( amount_to_shortlong_abs - spruce_active_for_side, order_size_default * ORDER_MERGE_SIZES_MAX ) );
+
+                // don't go under the default order size
+                if ( order_size < order_size_default )
+                    continue;
+
+                // don't go over the abs value of our new projected position, and also regard nice value
+                if ( spruce_active_for_side + order_size > amount_to_shortlong_abs ||
+                     spruce_active_for_side + order_size_limit > amount_to_shortlong_abs )
+                    continue;
+
+                kDebug() << QString( "[%1 %2] %3 | co %4 | q %5 | a %6[%7] | act %8 | dst %9%10" )
+                               .arg( phase_name, -MARKET_STRING_WIDTH - 9 )
+                               .arg( market, MARKET_STRING_WIDTH )
+                               .arg( side == SIDE_BUY ? buy_price : sell_price )
+                               .arg( solved->getLastCoeffForMarket( market ).toString( 4 ), 7 )
+                               .arg( qty_to_shortlong, 16 )
+                               .arg( amount_to_shortlong, 13 ) // print amount to s/l
+                               .arg( amount_to_shortlong + ( is_buy ? order_size_limit : -order_size_limit ), 13 ) // print amount to s/l less the nice buffer (the actionable amount)
+                               .arg( spruce_active_for_side, 12 )
+                               .arg( spread_distance_limit.toString( 4 ) )
+                               .arg( is_merged ? " | merged" : "" );
+
+                // queue the order (paper trading builds fill it on the simulated exchange)
+                engine->addPosition( market, is_buy ? SIDE_BUY : SIDE_SELL, buy_price, sell_price, order_size,
+                                     order_type, phase_name, QVector<qint32>(), false, true );
             }
         }
     }
 }
 
-void SpruceOverseer::adjustSpread( TickerInfo &spread, Coin limit, quint8 side, Coin &minimum_ticksize, bool expand )
+void SpruceOverseer::applyShadow( const QVector<SprucePhase> &phases )
 {
-    // get price ticksize
-    Coin ticksize = minimum_ticksize;
+    SpruceShadow &shadow = shadows[ m_solving_portfolio ];
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
 
-    adjustTicksizeToSpread( ticksize, spread, minimum_ticksize );
+    // fill what the prices reached before this solve, then drop what timed out like the live orders would be
+    matchShadowOrders( shadow );
 
-    static const Coin CONTRACT_RATIO = Coin( SPREAD_CONTRACT_RATIO );
-    static Coin diff_threshold;
-    static Coin moved;
+    for ( QVector<SpruceShadowOrder>::iterator i = shadow.orders.begin(); i != shadow.orders.end(); )
+    {
+        if ( i->expiry_time <= current_time )
+            i = shadow.orders.erase( i );
+        else
+            i++;
+    }
 
-    // if contracting, calculate the contraction limit
-    if ( !expand )
+    for ( QVector<SprucePhase>::const_iterator p = phases.begin(); p != phases.end(); p++ )
     {
-        moved = Coin();
-        ticksize = -ticksize;
+        if ( p->solver->isSolved() )
+            m_warm_start_solutions.insert( p->name, p->solver->getSolution() );
+        else
+            m_warm_start_solutions.remove( p->name );
 
-        const Coin diff = std::max( spread.bid, spread.ask ) - std::min( spread.bid, spread.ask );
-        diff_threshold = diff * CONTRACT_RATIO;
+        trackSolveComplete( *p );
     }
 
-    quint32 j = ( side == SIDE_BUY ) ? 0 : 1;
+    shadow.solves++;
 
-    while ( expand ? spread.bid > spread.ask * limit :
-                     spread.bid < spread.ask * limit )
+    // the same sizing as applySpruce(), without the engine allocations, the cancellors or the conflict checks
+    for ( QVector<SprucePhase>::const_iterator p = phases.begin(); p != phases.end(); p++ )
     {
-        // if the side is buy, expand down, otherwise expand outwards
-        j++;
-        if ( ( side == SIDE_BUY && expand_spread_buys && j % 4 < 3 ) || // if expanding down, only expand down 60% of the time
-             ( j % 2 == 1 ) ) // if not expanding down, expand 50/50
-            spread.bid -= ticksize;
-        else
-            spread.ask += ticksize;
+        const SprucePhase &phase = *p;
+        const Spruce *solved = phase.solver.data();
+        const quint8 side = phase.side;
+        const bool is_midspread = phase.is_midspread;
 
-        // only collapse the spread by up to half the distance
-        if ( !expand )
+        if ( !solved->isSolved() )
+            return;
+
+        const QMap<QString,Coin> &qty_to_shortlong_map = solved->getQuantityToShortLongMap();
+        for ( QMap<QString,Coin>::const_iterator i = qty_to_shortlong_map.begin(); i != qty_to_shortlong_map.end(); i++ )
         {
-            moved += ticksize;
-            if ( moved >= diff_threshold )
-                break;
+            const QString &market = i.key();
+
+            if ( Market::getMarketId( market ) != phase.market.getId() && !is_midspread )
+                continue;
+
+            const Coin &qty_to_shortlong = i.value();
+            const Coin amount_to_shortlong = solved->getCurrencyPriceByMarket( market ) * qty_to_shortlong;
+            const Coin amount_to_shortlong_abs = amount_to_shortlong.abs();
+            const bool is_buy = qty_to_shortlong.isZeroOrLess();
+
+            if ( is_midspread && side == SIDE_BUY )
+                shadow.targets.insert( market, amount_to_shortlong );
+
+            if ( (  is_buy && side == SIDE_SELL ) ||
+                 ( !is_buy && side == SIDE_BUY ) )
+                continue;
+
+            const Coin order_size_default = spruce->getOrderSize( market );
+            const Coin order_size_limit = order_size_default * spruce->getOrderNice( market, side, is_midspread );
+            if ( amount_to_shortlong_abs < order_size_limit )
+                continue;
+
+            const TickerInfo &spread = is_midspread ? phase.mid_spread.value( market ) : phase.spread_duplicity;
+            const Coin &price = ( side == SIDE_BUY ) ? spread.bid : spread.ask;
+            if ( price.isZeroOrLess() )
+                continue;
+
+            Coin active_for_side;
+            for ( QVector<SpruceShadowOrder>::const_iterator j = shadow.orders.begin(); j != shadow.orders.end(); j++ )
+                if ( j->phase == phase.name && j->market == market )
+                    active_for_side += j->price * j->quantity;
+
+            const Coin order_size = is_midspread ?
+                        std::max( order_size_default * ORDER_SCALING_PHASE_0, ( amount_to_shortlong_abs - active_for_side ) / ORDER_SCALING_PHASE_0 ) :
+                        std::max( order_size_default, ( amount_to_shortlong_abs - active_for_side ) / ORDER_CHUNKS_ESTIMATE_PER_SIDE );
+
+            if ( order_size < order_size_default ||
+                 active_for_side + order_size > amount_to_shortlong_abs ||
+                 active_for_side + order_size_limit > amount_to_shortlong_abs )
+                continue;
+
+            SpruceShadowOrder order;
+            order.market = market;
+            order.phase = phase.name;
+            order.side = is_buy ? SIDE_BUY : SIDE_SELL;
+            order.price = price;
+            order.quantity = order_size / price;
+            order.expiry_time = current_time + ( is_midspread ? SPRUCE_SHADOW_TIMEOUT_MIDSPREAD : SPRUCE_SHADOW_TIMEOUT );
+
+            shadow.orders += order;
+            shadow.orders_placed++;
         }
     }
 }
 
-void SpruceOverseer::adjustTicksizeToSpread( Coin &ticksize, TickerInfo &spread, const Coin &ticksize_minimum )
+void SpruceOverseer::matchShadowOrders( SpruceShadow &shadow )
+{
+    for ( QVector<SpruceShadowOrder>::iterator i = shadow.orders.begin(); i != shadow.orders.end(); )
+    {
+        // the other side has to reach our price on some exchange, the paper exchange's cross fill
+        const BboQuote quote = bbo.getQuote( i->market );
+        const bool is_filled = quote.isValid() &&
+                             ( i->side == SIDE_BUY ? quote.best.ask.isGreaterThanZero() && quote.best.ask <= i->price :
+                                                     quote.best.bid.isGreaterThanZero() && quote.best.bid >= i->price );
+        if ( !is_filled )
+        {
+            i++;
+            continue;
+        }
+
+        const Coin amount = i->price * i->quantity;
+        const Coin quantity_offset = ( i->side == SIDE_BUY ) ? i->quantity : -i->quantity;
+
+        shadow.quantity[ i->market ] += quantity_offset;
+        shadow.base_flow += ( i->side == SIDE_BUY ) ? -amount : amount;
+        shadow.volume += amount;
+        shadow.fills++;
+        shadow.spruce->addToShortLonged( i->market, quantity_offset );
+
+        i = shadow.orders.erase( i );
+    }
+}
+
+qint32 SpruceOverseer::getPhaseTagId( const Market &market_phase, const quint8 side )
+{
+    const QPair<QString,QPair<qint32,quint8>> key( m_solving_portfolio, QPair<qint32,quint8>( market_phase.getId(), side ) );
+
+    QHash<QPair<QString,QPair<qint32,quint8>>,qint32>::const_iterator i = m_phase_tag_ids.find( key );
+    if ( i == m_phase_tag_ids.end() )
+    {
+        // the fills of the other portfolios find theirs by the name, see Engine::getSpruceForTag()
+        const QString prefix = m_solving_portfolio.isEmpty() ? QString( "spruce" ) : SPRUCE_PORTFOLIO_TAG_PREFIX + m_solving_portfolio;
+        i = m_phase_tag_ids.insert( key, StrategyTag::getId( QString( "%1-%2-%3" )
+                                                             .arg( prefix )
+                                                             .arg( side == SIDE_BUY ? "B" : "S" )
+                                                             .arg( market_phase ) ) );
+    }
+
+    return i.value();
+}
+
+// the step pattern of adjustSpread(), true if step j moves the bid
+static inline bool isSpreadBidStep( const bool is_down, const quint32 j )
+{
+    return ( is_down && j % 4 < 3 ) || // if expanding down, only expand down 60% of the time
+           ( j % 2 == 1 ); // if not expanding down, expand 50/50
+}
+
+static inline bool isOutsideSpreadLimit( const TickerInfo &spread, const Coin &limit, const bool expand )
 {
-    const Coin diff = std::max( spread.bid, spread.ask ) - std::min( spread.bid, spread.ask );
+    return expand ? spread.bid > spread.ask * limit :
+                    spread.bid < spread.ask * limit;
+}
+
+void SpruceOverseer::adjustSpread( TickerInfo &spread, Coin limit, quint8 side, const Coin &ticksize, bool expand )
+{
+    // expanding moves the bid down and the ask up, contracting the other way
+    const Coin step = expand ? ticksize : -ticksize;
 
-    // clamp adjustSpread() to 1000 iterations
-    if ( diff > ticksize * 1000 )
-        ticksize = std::max( diff / 1000, ticksize_minimum );
+    // if the side is buy, expand down, otherwise expand outwards. the pattern repeats every 4 steps
+    quint32 j = ( side == SIDE_BUY ) ? 0 : 1;
+    const bool is_down = side == SIDE_BUY && expand_spread_buys;
+
+    if ( !isOutsideSpreadLimit( spread, limit, expand ) || !ticksize.isGreaterThanZero() || !limit.isGreaterThanZero() )
+        return;
+
+    // after n steps with b of them on the bid and a on the ask, bid - b*step <= ( ask + a*step ) * limit once
+    // b + a*limit >= ( bid - ask*limit ) / step. one pattern of 4 steps covers bid_steps + ask_steps*limit of that,
+    // so skip all but the last pattern in one go, rounding down, then walk the few steps left exactly
+    uint64_t bid_steps = 0;
+    for ( quint32 k = j + 1; k <= j + 4; k++ )
+        if ( isSpreadBidStep( is_down, k ) )
+            bid_steps++;
+    const uint64_t ask_steps = 4 - bid_steps;
+
+    const Coin distance = expand ? spread.bid - spread.ask * limit : spread.ask * limit - spread.bid;
+    const Coin per_pattern = ticksize * bid_steps + ticksize * limit * ask_steps;
+    Coin patterns = ( distance / per_pattern ).truncatedByTicksize( "1" ) - CoinAmount::COIN;
+
+    if ( patterns.isGreaterThanZero() )
+    {
+        spread.bid -= step * patterns * bid_steps;
+        spread.ask += step * patterns * ask_steps;
+    }
+
+    while ( isOutsideSpreadLimit( spread, limit, expand ) )
+    {
+        j++;
+        if ( isSpreadBidStep( is_down, j ) )
+            spread.bid -= step;
+        else
+            spread.ask += step;
+    }
 }
 
 TickerInfo SpruceOverseer::getSpreadLimit( const QString &market, bool order_duplicity )
 {
+    const QPair<QString,quint8> snapshot_key( market, SPREAD_SNAPSHOT_LIMIT | ( order_duplicity ? SPREAD_SNAPSHOT_DUPLICITY : 0 ) );
+    if ( m_spread_snapshot_active && m_spread_snapshot.contains( snapshot_key ) )
+        return m_spread_snapshot.value( snapshot_key );
+
     // get trailing limit for this side
     const Coin trailing_limit_buy = spruce->getOrderTrailingLimit( SIDE_BUY );
     const Coin trailing_limit_sell = spruce->getOrderTrailingLimit( SIDE_SELL );
 
     // get price ticksize
-    const Coin ticksize_minimum = getPriceTicksizeForMarket( market );
-    Coin ticksize = ticksize_minimum;
+    const Coin ticksize = getPriceTicksizeForMarket( market );
 
     // read combined spread from all exchanges. include limts for side, but don't randomize
     TickerInfo ticker_buy = getSpreadForSide( market, SIDE_BUY, order_duplicity, false, true );
@@ -405,18 +1114,12 @@ TickerInfo SpruceOverseer::getSpreadLimit( const QString &market, bool order_dup
     // first, vibrate one way
     TickerInfo spread1 = TickerInfo( ticker_buy.bid, ticker_buy.ask );
 
-    // adjust ticksize
-    adjustTicksizeToSpread( ticksize, ticker_buy, ticksize_minimum );
-
     // expand spread
     adjustSpread( spread1, trailing_limit_buy, SIDE_BUY, ticksize );
 
     // vibrate the other way
     TickerInfo spread2 = TickerInfo( ticker_sell.bid, ticker_sell.ask );
 
-    // adjust ticksize
-    adjustTicksizeToSpread( ticksize, ticker_buy, ticksize_minimum );
-
     // expand spread
     adjustSpread( spread2, trailing_limit_sell, SIDE_SELL, ticksize );
 
@@ -426,91 +1129,54 @@ TickerInfo SpruceOverseer::getSpreadLimit( const QString &market, bool order_dup
     if ( !order_duplicity )
     {
         const Coin midprice = combined_spread.getMidPrice();
-        combined_spread.bid = midprice;
-        combined_spread.ask = midprice;
-    }
-
-    //kDebug() << "spread for" << market << ":" << combined_spread;
-
-    return combined_spread;
-}
-
-TickerInfo SpruceOverseer::getMidSpread( const QString &market )
-{
-    TickerInfo ret;
-    quint16 samples = 0;
-
-    for ( QMap<quint8, Engine*>::const_iterator i = engine_map.begin(); i != engine_map.end(); i++ )
-    {
-        Engine *engine = i.value();
-
-        // ensure ticker exists
-        if ( !engine->market_info.contains( market ) )
-            continue;
-
-        // ensure ticker isn't stale
-        if ( engine->rest_arr.at( engine->engine_type )->ticker_update_time
-             < QDateTime::currentMSecsSinceEpoch() - 60000 )
-        {
-            //kDebug() << "local warning: engine ticker" << engine->engine_type << "is stale, skipping";
-            continue;
-        }
+        combined_spread.bid = midprice;
+        combined_spread.ask = midprice;
+    }
 
-        const MarketInfo &info = engine->market_info[ market ];
+    //kDebug() << "spread for" << market << ":" << combined_spread;
 
-        // ensure prices are valid
-        if ( !info.ticker.isValid() )
-            continue;
+    if ( m_spread_snapshot_active )
+        m_spread_snapshot.insert( snapshot_key, combined_spread );
 
-        // use avg spread
-        if ( prices_uses_avg )
-        {
-            samples++;
+    return combined_spread;
+}
 
-            // incorporate prices of this exchange
-            ret.bid += info.ticker.bid;
-            ret.ask += info.ticker.ask;
-        }
-        // or, use combined spread edges
-        else
-        {
-            // incorporate bid price of this exchange
-            if ( ret.bid.isZeroOrLess() || // bid doesn't exist yet
-                 ret.bid > info.ticker.bid ) // bid is higher than the exchange bid
-                ret.bid = info.ticker.bid;
-
-            // incorporate ask price of this exchange
-            if ( ret.ask.isZeroOrLess() || // ask doesn't exist yet
-                 ret.ask < info.ticker.ask ) // ask is lower than the exchange ask
-                ret.ask = info.ticker.ask;
-        }
-    }
+TickerInfo SpruceOverseer::getMidSpread( const QString &market )
+{
+    TRACE_SPAN( "getMidSpread" );
 
-    if ( prices_uses_avg )
-    {
-        // on 0 samples, return here
-        if ( samples < 1 )
-            return TickerInfo();
+    const QPair<QString,quint8> snapshot_key( market, SPREAD_SNAPSHOT_MID );
+    if ( m_spread_snapshot_active && m_spread_snapshot.contains( snapshot_key ) )
+        return m_spread_snapshot.value( snapshot_key );
 
-        // divide by num of samples if necessary
-        if ( samples > 1 )
-        {
-            ret.bid /= samples;
-            ret.ask /= samples;
-        }
-    }
-    else if ( !ret.isValid() )
+    // the exchanges with fresh tickers, combined when they changed
+    const BboQuote quote = bbo.getQuote( market );
+    if ( !quote.isValid() )
         return TickerInfo();
 
-    const Coin midprice = ret.getMidPrice();
-    ret.bid = midprice;
-    ret.ask = midprice;
+    // use avg spread, or combined spread edges (lowest bid and highest ask)
+    const Coin &midprice = prices_uses_avg ? quote.average_mid_price : quote.widest_mid_price;
+    const TickerInfo ret( midprice, midprice );
+
+    if ( m_spread_snapshot_active )
+        m_spread_snapshot.insert( snapshot_key, ret );
 
     return ret;
 }
 
 TickerInfo SpruceOverseer::getSpreadForSide( const QString &market, quint8 side, bool order_duplicity, bool taker_mode, bool include_limit_for_side, bool is_randomized, Coin greed_reduce )
 {
+    TRACE_SPAN( "getSpreadForSide" );
+
+    // randomized and reduced spreads are different each call, don't snapshot them
+    const bool use_snapshot = m_spread_snapshot_active && !is_randomized && greed_reduce.isZero();
+    const QPair<QString,quint8> snapshot_key( market, ( side == SIDE_BUY ? SPREAD_SNAPSHOT_BUY : SPREAD_SNAPSHOT_SELL ) |
+                                                      ( order_duplicity ? SPREAD_SNAPSHOT_DUPLICITY : 0 ) |
+                                                      ( taker_mode ? SPREAD_SNAPSHOT_TAKER : 0 ) |
+                                                      ( include_limit_for_side ? SPREAD_SNAPSHOT_SIDE_LIMIT : 0 ) );
+    if ( use_snapshot && m_spread_snapshot.contains( snapshot_key ) )
+        return m_spread_snapshot.value( snapshot_key );
+
     if ( side == SIDE_SELL )
         greed_reduce = -greed_reduce;
 
@@ -519,10 +1185,7 @@ TickerInfo SpruceOverseer::getSpreadForSide( const QString &market, quint8 side,
 
     /// step 2: apply base greed value to spread
     // get price ticksize
-    const Coin ticksize_minimum = getPriceTicksizeForMarket( market );
-    Coin ticksize = ticksize_minimum;
-
-    adjustTicksizeToSpread( ticksize, ret, ticksize_minimum );
+    const Coin ticksize = getPriceTicksizeForMarket( market );
 
     /// step 3: adjust spread by distance chosen
     // ensure the spread is more profitable than base greed value
@@ -571,12 +1234,284 @@ TickerInfo SpruceOverseer::getSpreadForSide( const QString &market, quint8 side,
         ret.ask = midprice;
     }
 
+    if ( use_snapshot )
+        m_spread_snapshot.insert( snapshot_key, ret );
+
     return ret;
 }
 
+bool SpruceOverseer::startLink( const QString &path )
+{
+    SpruceLink *new_link = new SpruceLink( spruce, &spruce_lock, scheduler, this );
+    if ( !new_link->readConfig( path ) )
+    {
+        delete new_link;
+        return false;
+    }
+
+    link = new_link;
+    link->start();
+    return true;
+}
+
+bool SpruceOverseer::readStandby( const QString &path )
+{
+    StandbyLink *new_standby = new StandbyLink( this, scheduler, this );
+    if ( !new_standby->readConfig( path ) )
+    {
+        delete new_standby;
+        return false;
+    }
+
+    standby = new_standby;
+    return true;
+}
+
+bool SpruceOverseer::selectPortfolio( const QString &name )
+{
+    if ( name == "primary" )
+    {
+        selected_portfolio = nullptr;
+        return true;
+    }
+
+    if ( !isPortfolioName( name ) )
+    {
+        kDebug() << "local warning: bad spruce portfolio name" << name;
+        return false;
+    }
+
+    Spruce *&portfolio = portfolios[ name ];
+    if ( !portfolio )
+    {
+        portfolio = new Spruce();
+        kDebug() << "[Spruce] added portfolio" << name;
+    }
+
+    selected_portfolio = portfolio;
+    return true;
+}
+
+bool SpruceOverseer::addShadow( const QString &name )
+{
+    if ( !isPortfolioName( name ) )
+    {
+        kDebug() << "local warning: bad spruce shadow name" << name;
+        return false;
+    }
+
+    if ( !shadows.contains( name ) && shadows.size() >= SPRUCE_SHADOWS_MAX )
+    {
+        kDebug() << "local warning: already" << SPRUCE_SHADOWS_MAX << "spruce shadows, clear one first";
+        return false;
+    }
+
+    // copy before removing the old one, it may be the one selected
+    Spruce *copy = getSelectedPortfolio()->clone();
+    copy->setReportingFills( false );
+
+    removeShadow( name );
+
+    SpruceShadow &shadow = shadows[ name ];
+    shadow.spruce = copy;
+    shadow.start_time = VirtualClock::currentMSecsSinceEpoch();
+
+    selected_portfolio = copy;
+    kDebug() << "[Spruce] added shadow" << name;
+    return true;
+}
+
+bool SpruceOverseer::removeShadow( const QString &name )
+{
+    QMap<QString, SpruceShadow>::iterator i = shadows.find( name );
+    if ( i == shadows.end() )
+        return false;
+
+    // the phases being solved have their own copies
+    if ( selected_portfolio == i.value().spruce )
+        selected_portfolio = nullptr;
+
+    delete i.value().spruce;
+    shadows.erase( i );
+
+    const QString phase_prefix = SPRUCE_SHADOW_PHASE_PREFIX + name + "-";
+    for ( QMap<QString,QMap<QString,Coin>>::iterator j = m_warm_start_solutions.begin(); j != m_warm_start_solutions.end(); )
+    {
+        if ( j.key().startsWith( phase_prefix ) )
+            j = m_warm_start_solutions.erase( j );
+        else
+            j++;
+    }
+    for ( QSet<QString>::iterator j = m_incomplete_phases.begin(); j != m_incomplete_phases.end(); )
+    {
+        if ( j->startsWith( phase_prefix ) )
+            j = m_incomplete_phases.erase( j );
+        else
+            j++;
+    }
+
+    return true;
+}
+
+Coin SpruceOverseer::getShadowPnl( const SpruceShadow &shadow ) const
+{
+    Coin pnl = shadow.base_flow;
+
+    for ( QMap<QString,Coin>::const_iterator i = shadow.quantity.begin(); i != shadow.quantity.end(); i++ )
+    {
+        const BboQuote quote = bbo.getQuote( i.key() );
+        if ( quote.isValid() )
+            pnl += i.value() * quote.average_mid_price;
+    }
+
+    return pnl;
+}
+
+bool SpruceOverseer::isActive() const
+{
+    if ( primary->isActive() )
+        return true;
+
+    for ( QMap<QString, Spruce*>::const_iterator i = portfolios.begin(); i != portfolios.end(); i++ )
+        if ( i.value()->isActive() )
+            return true;
+
+    return false;
+}
+
+bool SpruceOverseer::isPortfolioName( const QString &name )
+{
+    if ( name.isEmpty() || name == "primary" )
+        return false;
+
+    for ( QString::const_iterator i = name.begin(); i != name.end(); i++ )
+        if ( !( *i >= 'a' && *i <= 'z' ) && !( *i >= 'A' && *i <= 'Z' ) && !( *i >= '0' && *i <= '9' ) )
+            return false;
+
+    return true;
+}
+
+Coin SpruceOverseer::getEngineAllocation( const Engine *engine, const qint32 market_id ) const
+{
+    const Coin allocation = getAccountAllocation( engine, market_id );
+    if ( spruce->getRouteBound().isZeroOrLess() || allocation.isZeroOrLess() )
+        return allocation;
+
+    // routing moves the market's allocation between the engines that trade it, their total stays the same
+    const QString market = Market::getMarketString( market_id );
+    Coin total, routed_total;
+    for ( QMap<qint32, Engine*>::const_iterator e = engine_map.begin(); e != engine_map.end(); e++ )
+    {
+        if ( !e.value()->isInShard( market ) )
+            continue;
+
+        const Coin other_allocation = getAccountAllocation( e.value(), market_id );
+        if ( other_allocation.isZeroOrLess() )
+            continue;
+
+        total += other_allocation;
+        routed_total += other_allocation * getRouteWeight( e.key() );
+    }
+
+    if ( routed_total.isZeroOrLess() )
+        return allocation;
+
+    return ( allocation * getRouteWeight( engine->getEngineId() ) ).mulDiv( total, routed_total );
+}
+
+Coin SpruceOverseer::getAccountAllocation( const Engine *engine, const qint32 market_id ) const
+{
+    const Coin allocation = spruce->getExchangeAllocation( engine->engine_type, market_id );
+
+    // the accounts of an exchange split its allocation, the engines of one account each have their own markets
+    if ( engine->getAccountShare() < CoinAmount::COIN )
+        return allocation * engine->getAccountShare();
+
+    return allocation;
+}
+
+void SpruceOverseer::updateRoutes( const qint64 current_time )
+{
+    if ( current_time - m_routes_time < ROUTE_INTERVAL )
+        return;
+
+    // the first update only takes the counts to measure from
+    const bool is_first = m_routes_time == 0;
+    m_routes_time = current_time;
+
+    qreal p90_total = 0., fill_ratio_total = 0.;
+    qint32 p90_count = 0, fill_ratio_count = 0;
+    for ( QMap<qint32, Engine*>::const_iterator e = engine_map.begin(); e != engine_map.end(); e++ )
+    {
+        const Engine *engine = e.value();
+        const BaseREST *rest = engine->rest_arr.value( engine->engine_type );
+        SpruceRoute &route = m_routes[ e.key() ];
+
+        const quint64 activated = engine->getPositionMan()->getActivatedCount();
+        const quint64 fills = engine->getFillCount();
+        const quint64 orders = activated - route.last_activated;
+
+        if ( !is_first && orders >= ROUTE_MIN_ORDERS )
+            route.fill_ratio = qMin( 1., qreal( fills - route.last_fills ) / orders );
+
+        route.last_activated = activated;
+        route.last_fills = fills;
+        route.p90 = rest ? rest->getResponseTimePercentile( 0.90 ) : -1;
+        route.queue_ratio = rest && rest->limit_commands_queued > 0 ? qMin( 1., qreal( rest->nam_queue.size() ) / rest->limit_commands_queued ) : 0.;
+
+        if ( route.p90 > 0 )
+        {
+            p90_total += route.p90;
+            p90_count++;
+        }
+
+        if ( route.fill_ratio >= 0. )
+        {
+            fill_ratio_total += route.fill_ratio;
+            fill_ratio_count++;
+        }
+    }
+
+    if ( is_first )
+        return;
+
+    const qreal p90_mean = p90_count > 0 ? p90_total / p90_count : 0.;
+    const qreal fill_ratio_mean = fill_ratio_count > 0 ? fill_ratio_total / fill_ratio_count : 0.;
+
+    // quicker replies, more fills per order and a shorter queue than the average engine get more of the target
+    for ( QMap<qint32, SpruceRoute>::iterator i = m_routes.begin(); i != m_routes.end(); i++ )
+    {
+        SpruceRoute &route = i.value();
+
+        qreal score = 1.;
+        if ( route.p90 > 0 && p90_mean > 0. )
+            score *= p90_mean / route.p90;
+        if ( route.fill_ratio >= 0. && fill_ratio_count > 0 )
+            score *= ( route.fill_ratio + ROUTE_FILL_RATIO_FLOOR ) / ( fill_ratio_mean + ROUTE_FILL_RATIO_FLOOR );
+        score *= 1. - route.queue_ratio / 2.;
+
+        const qreal old_weight = route.weight;
+        route.weight += ( qBound( 0., score, 2. ) - route.weight ) * ROUTE_SMOOTHING;
+
+        if ( primary->getRouteBound().isGreaterThanZero() && qAbs( route.weight - old_weight ) >= ROUTE_WEIGHT_CHANGE_LOG )
+            kDebug() << "[Spruce] engine" << i.key() << "route weight" << route.weight << "p90" << route.p90 << "ms fill ratio"
+                     << route.fill_ratio << "queue" << route.queue_ratio;
+    }
+}
+
+Coin SpruceOverseer::getRouteWeight( const qint32 engine_id ) const
+{
+    const Coin &bound = spruce->getRouteBound();
+    if ( bound.isZeroOrLess() )
+        return CoinAmount::COIN;
+
+    const Coin weight = m_routes.value( engine_id ).weight;
+    return qBound( CoinAmount::COIN - bound, weight, CoinAmount::COIN + bound );
+}
+
 Coin SpruceOverseer::getPriceTicksizeForMarket( const Market &market ) const
 {
-    for ( QMap<quint8, Engine*>::const_iterator i = engine_map.begin(); i != engine_map.end(); i++ )
+    for ( QMap<qint32, Engine*>::const_iterator i = engine_map.begin(); i != engine_map.end(); i++ )
     {
         Engine *engine = i.value();
 
@@ -607,34 +1542,127 @@ void SpruceOverseer::loadSettings()
     if ( loadfile.bytesAvailable() == 0 )
         return;
 
-    // emit new lines
-    QString data = loadfile.readAll();
-    kDebug() << "[SpruceOverseer] loaded spruce settings," << data.size() << "bytes.";
+    const QByteArray text = loadfile.readAll();
+    const QByteArray text_hash = SettingsState::getTextHash( text );
+
+    // the file didn't change since the last start, set spruce directly and replay the rest
+    QString residual;
+    QByteArray state;
+    bool is_restored = false;
+    if ( SettingsState::read( path, SETTINGS_STATE_VERSION, text_hash, residual, state ) )
+    {
+        QMutexLocker locker( &spruce_lock );
+        is_restored = spruce->readBinaryState( state );
+
+        if ( is_restored )
+            spruce_timer->setInterval( spruce->getIntervalSecs() *1000 );
+    }
+
+    if ( is_restored )
+    {
+        kDebug() << "[SpruceOverseer] restored spruce settings state," << state.size() << "bytes, replaying" << residual.size() << "bytes.";
+
+        // the runner takes an engine lock, so don't hold spruce_lock here
+        if ( !residual.isEmpty() )
+            emit gotUserCommandChunk( residual );
+    }
+    else
+    {
+        // emit new lines
+        const QString data = QString::fromUtf8( text );
+        kDebug() << "[SpruceOverseer] loaded spruce settings," << data.size() << "bytes.";
+
+        // the command runner is on an engine thread, this blocks until it ran the chunk
+        emit gotUserCommandChunk( data );
+
+        // take the state for the next start
+        QMutexLocker locker( &spruce_lock );
+        const QSharedPointer<Spruce> copy( spruce->clone() );
+        locker.unlock();
+
+        const QString state_path = SettingsState::getPath( path );
+        const QString data_residual = SettingsState::getResidual( data, SETTINGS_STATE_COMMANDS );
+        saver->save( state_path, [copy, state_path, text_hash, data_residual]()
+        {
+            return AsyncSaver::writeFile( state_path, SettingsState::pack( SETTINGS_STATE_VERSION, text_hash, data_residual,
+                                                                           copy->getBinaryState() ) );
+        } );
+    }
+
+    loadPortfolioSettings();
 
-    emit gotUserCommandChunk( data );
+    // generate the cost function images now instead of during the first spruce tick
+    QMutexLocker locker( &spruce_lock );
+    spruce->warmUpCostFunctions();
+
+    for ( QMap<QString, Spruce*>::const_iterator i = portfolios.begin(); i != portfolios.end(); i++ )
+        i.value()->warmUpCostFunctions();
 }
 
-void SpruceOverseer::saveSettings()
+void SpruceOverseer::loadPortfolioSettings()
 {
-    // open settings file
-    const QString path = getSettingsPath();
+    // the other portfolios are replayed from their own files, "spruce.<name>.settings"
+    const QStringList files = QDir( Global::getTraderPath() ).entryList( QStringList() << "spruce.*.settings", QDir::Files, QDir::Name );
+    for ( QStringList::const_iterator i = files.begin(); i != files.end(); i++ )
+    {
+        const QString name = i->mid( 7, i->size() - 7 - 9 );
+        if ( !isPortfolioName( name ) )
+            continue;
 
-    QFile savefile( path );
+        QFile loadfile( getPortfolioSettingsPath( name ) );
+        if ( !loadfile.open( QIODevice::ReadOnly | QIODevice::Text ) )
+        {
+            kDebug() << "local error: couldn't load spruce portfolio settings file" << loadfile.fileName();
+            continue;
+        }
 
-    if ( !savefile.open( QIODevice::WriteOnly | QIODevice::Text ) )
-    {
-        kDebug() << "local error: couldn't open spruce settings file" << path;
-        return;
+        const QString data = QString::fromUtf8( loadfile.readAll() );
+        kDebug() << "[SpruceOverseer] loaded spruce portfolio" << name << "settings," << data.size() << "bytes.";
+
+        // select it for its commands, then primary again for whatever comes after
+        emit gotUserCommandChunk( QString( "setspruceportfolio %1\n%2\nsetspruceportfolio primary\n" ).arg( name, data ) );
     }
+}
+
+void SpruceOverseer::saveSettings( const QString &backup_path )
+{
+    // serialize a copy on the save thread
+    QMutexLocker locker( &spruce_lock );
+    const QSharedPointer<Spruce> copy( spruce->clone() );
+    locker.unlock();
 
-    QTextStream out_savefile( &savefile );
+    const QString path = getSettingsPath();
+    saver->save( path, [copy, path, backup_path]()
+    {
+        if ( !backup_path.isEmpty() )
+            AsyncSaver::backupFile( path, backup_path );
+
+        // the state for the next start goes with the text it was taken from
+        const QByteArray text = copy->getSaveState().toUtf8();
+        if ( !AsyncSaver::writeFile( path, text, true ) )
+            return false;
+
+        return AsyncSaver::writeFile( SettingsState::getPath( path ),
+                                      SettingsState::pack( SETTINGS_STATE_VERSION, SettingsState::getTextHash( text ), QString(),
+                                                           copy->getBinaryState() ) );
+    } );
+
+    // the other portfolios only as the text, they're few and small next to primary
+    locker.relock();
+    for ( QMap<QString, Spruce*>::const_iterator i = portfolios.begin(); i != portfolios.end(); i++ )
+    {
+        const QSharedPointer<Spruce> portfolio_copy( i.value()->clone() );
+        const QString portfolio_path = getPortfolioSettingsPath( i.key() );
+        const QString portfolio_backup_path = backup_path.isEmpty() ? QString() : backup_path + "." + i.key();
 
-    // save spruce state
-    out_savefile << spruce->getSaveState();
+        saver->save( portfolio_path, [portfolio_copy, portfolio_path, portfolio_backup_path]()
+        {
+            if ( !portfolio_backup_path.isEmpty() )
+                AsyncSaver::backupFile( portfolio_path, portfolio_backup_path );
 
-    // save the buffer
-    out_savefile.flush();
-    savefile.close();
+            return AsyncSaver::writeFile( portfolio_path, portfolio_copy->getSaveState().toUtf8(), true );
+        } );
+    }
 }
 
 void SpruceOverseer::loadStats()
@@ -654,92 +1682,261 @@ void SpruceOverseer::loadStats()
     QString data = loadfile.readAll();
     kDebug() << "[SpruceOverseer] loaded stats," << data.size() << "bytes.";
 
+    QMutexLocker locker( &spruce_lock );
     alpha->reset();
     alpha->readSaveState( data );
+
+    // the journal only follows this snapshot if it was started with its generation
+    qint64 generation = 0;
+    if ( data.startsWith( "j " ) )
+        generation = data.mid( 2, data.indexOf( QChar( '\n' ) ) -2 ).toLongLong();
+
+    QFile journal_file( Global::getMarketStatsJournalPath() );
+    if ( generation > 0 && journal_file.open( QIODevice::ReadOnly ) )
+    {
+        const QByteArray journal = journal_file.readAll();
+
+        if ( journal.size() >= ALPHA_JOURNAL_HEADER_SIZE &&
+             memcmp( journal.constData(), ALPHA_JOURNAL_MAGIC, ALPHA_JOURNAL_MAGIC_SIZE ) == 0 &&
+             qFromLittleEndian<qint64>( journal.constData() + ALPHA_JOURNAL_MAGIC_SIZE ) == generation )
+        {
+            const qint64 read = alpha->readJournal( journal.mid( ALPHA_JOURNAL_HEADER_SIZE ) );
+            kDebug() << "[SpruceOverseer] replayed stats journal," << read << "bytes.";
+        }
+    }
+
+    // fold what was replayed into a new snapshot
+    stats_generation = generation;
+    compactStats();
 }
 
 void SpruceOverseer::saveStats()
 {
-    // open stats file
-    QString path = Global::getMarketStatsPath();
-    QFile savefile( path );
+    QMutexLocker locker( &spruce_lock );
 
-    if ( !savefile.open( QIODevice::WriteOnly | QIODevice::Text ) )
+    // start over from a snapshot if the journal isn't ours to append to or missed a change, and once it's big or old
+    QFile journal_file( Global::getMarketStatsJournalPath() );
+    if ( !is_stats_journal_ok || alpha->needsSnapshot() ||
+         journal_file.size() > STATS_JOURNAL_COMPACT_SIZE ||
+         QDateTime::currentSecsSinceEpoch() - stats_compact_secs > STATS_COMPACT_INTERVAL_SECS )
     {
-        kDebug() << "local error: couldn't open savemarket file" << path;
+        compactStats();
         return;
     }
 
-    QTextStream out_savefile( &savefile );
-    out_savefile << alpha->getSaveState();
+    const QByteArray records = alpha->takeJournal();
+    if ( records.isEmpty() )
+        return;
 
-    // save the buffer
-    out_savefile.flush();
-    savefile.close();
+    // the changes are in memory, so a failed append is made up for by the next snapshot
+    const QString journal_path = journal_file.fileName();
+    saver->save( journal_path, [records, journal_path]() { return AsyncSaver::appendFile( journal_path, records ); },
+                 [this]( bool ok ) { if ( !ok ) onStatsJournalFailed(); } );
 }
 
-void SpruceOverseer::onSaveSpruceSettings()
+void SpruceOverseer::compactStats()
+{
+    const QString path = Global::getMarketStatsPath();
+    const QString journal_path = Global::getMarketStatsJournalPath();
+
+    // a new generation, so a journal left from before this snapshot isn't replayed over it
+    const qint64 generation = std::max( stats_generation +1, QDateTime::currentMSecsSinceEpoch() );
+
+    // the maps are shared until alpha changes, so the copy is cheap and serializes on the save thread
+    const AlphaTracker copy = *alpha;
+
+    // everything so far is in the snapshot, start the journal after it
+    alpha->startJournal();
+    stats_generation = generation;
+    stats_compact_secs = QDateTime::currentSecsSinceEpoch();
+    is_stats_journal_ok = true;
+
+    const QString suffix = "." + QString::number( stats_compact_secs );
+    const QString backup_path = Global::getOldLogsPath() + QDir::separator() + "stats" + suffix;
+    const QString backup_journal_path = Global::getOldLogsPath() + QDir::separator() + "stats.journal" + suffix;
+
+    saver->save( path, [=]()
+    {
+        // backup the snapshot and journal we're replacing
+        AsyncSaver::backupFile( path, backup_path );
+        AsyncSaver::backupFile( journal_path, backup_journal_path );
+
+        const QByteArray snapshot = ( QString( "j %1\n" ).arg( generation ) + copy.getSaveState() ).toUtf8();
+        if ( !AsyncSaver::writeFile( path, snapshot, true ) )
+            return false;
+
+        QByteArray header( ALPHA_JOURNAL_HEADER_SIZE, 0 );
+        memcpy( header.data(), ALPHA_JOURNAL_MAGIC, ALPHA_JOURNAL_MAGIC_SIZE );
+        qToLittleEndian<qint64>( generation, header.data() + ALPHA_JOURNAL_MAGIC_SIZE );
+
+        return AsyncSaver::writeFile( journal_path, header );
+    },
+    [this]( bool ok ) { if ( !ok ) onStatsJournalFailed(); } );
+}
+
+void SpruceOverseer::onStatsJournalFailed()
+{
+    // the next save takes a new snapshot
+    QMutexLocker locker( &spruce_lock );
+    is_stats_journal_ok = false;
+}
+
+void SpruceOverseer::onSaveStats()
 {
+    QMutexLocker locker( &spruce_lock );
+
     if ( !spruce->isActive() )
         return;
 
-    const QString trader_path = Global::getTraderPath();
-    const QString settings_path = trader_path + QDir::separator() + "spruce.settings";
-    const QString stats_path = trader_path + QDir::separator() + "stats";
+    saveStats();
+}
+
+void SpruceOverseer::onSaveSpruceSettings()
+{
+    QMutexLocker locker( &spruce_lock );
+
+    if ( !isActive() )
+        return;
+
+    // backup settings file, then save
+    kDebug() << "backing up spruce settings...";
+    saveSettings( Global::getOldLogsPath() + QDir::separator() + "spruce.settings." + QString::number( QDateTime::currentSecsSinceEpoch() ) );
+}
+
+void SpruceOverseer::buildTargets( const SprucePhase &phase, SpruceTargetTable &targets )
+{
+    const Spruce *solved = phase.solver.data();
+    const QMap<QString,Coin> &qty_to_shortlong_map = solved->getQuantityToShortLongMap();
 
-    // backup settings file
-    if ( QFile::exists( settings_path ) )
+    for ( QMap<qint32, Engine*>::const_iterator e = engine_map.begin(); e != engine_map.end(); e++ )
     {
-        QString new_settings_path = Global::getOldLogsPath() + QDir::separator() + "spruce.settings." + QString::number( QDateTime::currentSecsSinceEpoch() );
-        kDebug() << "backing up spruce settings...";
+        const Engine *engine = e.value();
 
-        if ( QFile::copy( settings_path, new_settings_path ) )
-        {
-            QFile::remove( settings_path ); // remove old file on success
-            saveSettings();
-        }
-        else
+        for ( QMap<QString,Coin>::const_iterator i = qty_to_shortlong_map.begin(); i != qty_to_shortlong_map.end(); i++ )
         {
-            kDebug() << "local error: couldn't backup settings file to" << new_settings_path;
+            const QString &market = i.key();
+            const qint32 market_id = Market::getMarketId( market );
+
+            // another engine of this exchange trades it
+            if ( !engine->isInShard( market ) )
+                continue;
+
+            // skip market unless it's selected
+            if ( market_id != phase.market.getId() &&
+                 !phase.is_midspread ) // on custom iteration, set an order for every market
+                continue;
+
+            // get market allocation for this exchange, skip a zero allocation for this engine
+            const Coin allocation = getEngineAllocation( engine, market_id );
+            if ( allocation.isZeroOrLess() )
+                continue;
+
+            SpruceTarget &target = targets[ qMakePair( e.key(), market_id ) ];
+            target.qty_to_shortlong = i.value() * allocation;
+            target.amount_to_shortlong = solved->getCurrencyPriceByMarket( market ) * target.qty_to_shortlong;
+            target.order_size = spruce->getOrderSize( market );
+            target.zero_bound_tolerance[ 0 ] = target.order_size * spruce->getOrderNiceZeroBound( market, SIDE_BUY, phase.is_midspread );
+            target.zero_bound_tolerance[ 1 ] = target.order_size * spruce->getOrderNiceZeroBound( market, SIDE_SELL, phase.is_midspread );
         }
     }
 
-    // backup stats file
-    if ( QFile::exists( stats_path ) )
+    // push them to the ipc subscribers
+    if ( !EventFeed::isSubscribed( EventFeed::TYPE_SPRUCE ) )
+        return;
+
+    const qint64 current_time = VirtualClock::currentMSecsSinceEpoch();
+    for ( SpruceTargetTable::const_iterator t = targets.begin(); t != targets.end(); t++ )
+        EventFeed::publish( EventFeed::TYPE_SPRUCE, QString( "spruce %1 %2 %3 %4 %5\n" )
+                                                     .arg( t.key().first )
+                                                     .arg( Market::getMarketString( t.key().second ) )
+                                                     .arg( t->qty_to_shortlong )
+                                                     .arg( t->amount_to_shortlong )
+                                                     .arg( current_time ).toUtf8() );
+}
+
+bool SpruceOverseer::hasPhaseOrderNear( Engine *engine, const qint32 phase_tag_id, const QString &market, const quint8 side, const Coin &price ) const
+{
+    const PositionTagBucket *bucket = engine->positions->getTagBucket( phase_tag_id, Market( market ), side );
+    if ( !bucket )
+        return false;
+
+    // the same price bucket, the exchange would list them as one level anyway
+    const Coin ticksize = getPriceTicksizeForMarket( Market( market ) );
+    for ( QSet<Position*>::const_iterator i = bucket->positions.begin(); i != bucket->positions.end(); i++ )
     {
-        QString new_stats_path = Global::getOldLogsPath() + QDir::separator() + "stats." + QString::number( QDateTime::currentSecsSinceEpoch() );
-        kDebug() << "backing up spruce stats...";
+        const Position *const &pos = *i;
 
-        if ( QFile::copy( stats_path, new_stats_path ) )
-        {
-            QFile::remove( stats_path ); // remove old file on success
-            saveStats();
-        }
-        else
-        {
-            kDebug() << "local error: couldn't backup spruce stats file to" << new_stats_path;
-        }
+        if ( !pos->is_cancelling && ( pos->price - price ).abs() < ticksize )
+            return true;
     }
+
+    return false;
 }
 
-void SpruceOverseer::runCancellors( Engine *engine, const QString &market, const quint8 side, const QString &phase_name, const Coin &flux_price )
+void SpruceOverseer::runCancellors( Engine *engine, const SpruceTarget &target, const QString &market, const quint8 side, const qint32 phase_tag_id, const bool is_midspread_phase, const Coin &flux_price )
 {
-    // sort active positions by longest active first, shortest active last
-    const QVector<Position*> active_by_set_time = engine->positions->activeBySetTime();
+    TRACE_SPAN( "runCancellors" );
+
+    // compare markets by id inside the loop
+    const Market market_key( market ), market_inverse = market_key.getInverse();
+
+    // collect this phase's positions on this side, and on the inverse side of the inverse market, sorted by set time
+    QMultiMap<qint64,Position*> active_by_set_time;
+    const PositionTagBucket *buckets[ 2 ] = { engine->positions->getTagBucket( phase_tag_id, market_key, side ),
+                                              engine->positions->getTagBucket( phase_tag_id, market_inverse, ( side == SIDE_BUY ) ? SIDE_SELL : SIDE_BUY ) };
+    for ( int b = 0; b < 2; b++ )
+    {
+        const PositionTagBucket *bucket = buckets[ b ];
+        if ( !bucket )
+            continue;
+
+        for ( QSet<Position*>::const_iterator i = bucket->positions.begin(); i != bucket->positions.end(); i++ )
+            if ( engine->positions->isActive( *i ) )
+                active_by_set_time.insert( ( *i )->order_set_time, *i );
+    }
+
+    if ( active_by_set_time.isEmpty() )
+        return;
+
+    // inverse flux price doesn't change between positions
+    const Coin flux_price_inverse = flux_price.isGreaterThanZero() ? CoinAmount::COIN / flux_price : Coin();
+
+    // get possible spread price vibration limits for new spruce order on this side, set sp1 price
+    static const Coin MIDSPREAD_BUY_RATIO = 0.99_coin, MIDSPREAD_SELL_RATIO = 1.01_coin;
+    static const Coin SPREAD_BUY_RATIO = 0.999_coin, SPREAD_SELL_RATIO = 1.001_coin;
+    Coin buy_price_limit, sell_price_limit;
+    if ( is_midspread_phase )
+    {
+        const TickerInfo mid_spread = getMidSpread( market );
+        buy_price_limit.setMul( mid_spread.bid, MIDSPREAD_BUY_RATIO );
+        sell_price_limit.setMul( mid_spread.ask, MIDSPREAD_SELL_RATIO );
+    }
+    else
+    {
+        const TickerInfo spread_limit = getSpreadLimit( market, true );
+        buy_price_limit.setMul( spread_limit.bid, SPREAD_BUY_RATIO );
+        sell_price_limit.setMul( spread_limit.ask, SPREAD_SELL_RATIO );
+    }
+    const bool is_limit_valid = buy_price_limit.isGreaterThanZero() && sell_price_limit.isGreaterThanZero();
 
-    // look for spruce positions we should cancel on this side
-    const QVector<Position*>::const_iterator begin = active_by_set_time.begin(),
-                                             end = active_by_set_time.end();
-    for ( QVector<Position*>::const_iterator j = begin; j != end; j++ )
+    // look for spruce positions we should cancel on this side, latest set first
+    const QMultiMap<qint64,Position*>::const_iterator begin = active_by_set_time.begin(),
+                                                      end = active_by_set_time.end();
+    for ( QMultiMap<qint64,Position*>::const_iterator j = end; j != begin; )
     {
-        Position *const &pos = *j;
+        j--;
+        Position *const &pos = j.value();
         bool is_inverse = false;
 
+        // skip positions removed since we collected them
+        if ( !engine->positions->isActive( pos ) )
+            continue;
+
         // don't skip inverse markets matching this side (the inverse side)
         if (  pos->side != side &&
              !pos->is_cancelling &&
-              pos->strategy_tag == phase_name &&
-              pos->market.getInverse() == market )
+              pos->strategy_tag_id == phase_tag_id &&
+              pos->market == market_inverse )
         {
             //kDebug() << "found inverse market for cancellor for pos" << pos->stringifyOrder();
             is_inverse = true;
@@ -747,35 +1944,18 @@ void SpruceOverseer::runCancellors( Engine *engine, const QString &market, const
         // skip non-qualifying position
         else if ( pos->side != side ||
                   pos->is_cancelling ||
-                  pos->market != market ||
-                  pos->strategy_tag != phase_name )
+                  pos->market != market_key ||
+                  pos->strategy_tag_id != phase_tag_id )
         {
             continue;
         }
 
-        // get possible spread price vibration limits for new spruce order on this side
-        const TickerInfo spread_limit = getSpreadLimit( market, true );
-
-        // set sp1 price
-        Coin buy_price_limit, sell_price_limit;
-        if ( phase_name.contains( MIDSPREAD_PHASE ) )
-        {
-            const TickerInfo mid_spread = getMidSpread( market );
-            buy_price_limit = mid_spread.bid * Coin("0.99");
-            sell_price_limit = mid_spread.ask * Coin("1.01");
-        }
-        else
-        {
-            buy_price_limit = spread_limit.bid * Coin("0.999");
-            sell_price_limit = spread_limit.ask * Coin("1.001");
-        }
-
         // cache actual side/price
         const quint8 side_actual = is_inverse ? ( ( side == SIDE_BUY ) ? SIDE_SELL : SIDE_BUY ) : side;
-        const Coin price_actual = is_inverse ? ( CoinAmount::COIN / pos->price ) : pos->price;
+        const Coin &price_actual = is_inverse ? pos->getPriceInverse() : pos->price;
 
         /// cancellor 1: look for prices that are trailing the spread too far
-        if ( buy_price_limit.isGreaterThanZero() && sell_price_limit.isGreaterThanZero() && // ticker is valid
+        if ( is_limit_valid && // ticker is valid
              ( ( side_actual == SIDE_BUY  && price_actual < buy_price_limit ) ||
                ( side_actual == SIDE_SELL && price_actual > sell_price_limit ) ) )
         {
@@ -786,7 +1966,7 @@ void SpruceOverseer::runCancellors( Engine *engine, const QString &market, const
         // skip orders outside flux price
         if ( flux_price.isGreaterThanZero() )
         {
-            const Coin flux_price_actual = is_inverse ? ( CoinAmount::COIN / flux_price ) : flux_price;
+            const Coin &flux_price_actual = is_inverse ? flux_price_inverse : flux_price;
 
             // for cancellor 2, only try to cancel positions within the flux bounds
             if ( ( side_actual == SIDE_BUY  && price_actual < flux_price_actual ) ||
@@ -794,18 +1974,12 @@ void SpruceOverseer::runCancellors( Engine *engine, const QString &market, const
                 continue;
         }
 
-        const QString exchange_market_key = QString( "%1-%2" )
-                                            .arg( engine->engine_type )
-                                            .arg( market );
-
         // get market allocation
-        const Coin active_amount = engine->positions->getActiveSpruceEquityTotal( market, phase_name, side_actual, flux_price );
-        const Coin amount_to_shortlong = spruce->getExchangeAllocation( exchange_market_key ) * spruce->getCurrencyPriceByMarket( market ) * spruce->getQuantityToShortLongNow( market );
+        const Coin active_amount = engine->positions->getActiveSpruceEquityTotal( market_key, phase_tag_id, side_actual, flux_price );
+        const Coin &amount_to_shortlong = target.amount_to_shortlong;
 
         // get active tolerance
-        const bool is_midspread_phase = phase_name.contains( MIDSPREAD_PHASE );
-        const Coin nice_zero_bound = spruce->getOrderNiceZeroBound( market, side_actual, is_midspread_phase );
-        const Coin zero_bound_tolerance = spruce->getOrderSize( market ) * nice_zero_bound;
+        const Coin &zero_bound_tolerance = target.zero_bound_tolerance[ ( side_actual == SIDE_BUY ) ? 0 : 1 ];
 
         /// cancellor 2: look for active amount > amount_to_shortlong + order_size_limit
         if ( ( side_actual == SIDE_BUY  && amount_to_shortlong.isZeroOrLess() &&
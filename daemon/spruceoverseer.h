@@ -5,13 +5,84 @@
 #include "market.h"
 #include "coinamount.h"
 #include "misctypes.h"
+#include "bbocache.h"
+#include "marketevents.h"
 
 #include <QObject>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QVector>
+#include <QElapsedTimer>
 
 class AlphaTracker;
 class Spruce;
 class Engine;
-class QTimer;
+class TaskScheduler;
+class ScheduledTask;
+class QThreadPool;
+class AsyncSaver;
+class SpruceLink;
+class StandbyLink;
+
+struct SprucePhase // one side of one phase of onSpruceUp(), solved on its own copy of spruce
+{
+    QString portfolio; // the one it's for, empty for spruce
+    QString name; // the strategy tag of its orders
+    qint32 tag_id{ -1 }; // of name, see StrategyTag
+    bool is_midspread{ false };
+    Market market;
+    quint8 side{ 0 };
+    TickerInfo spread_duplicity;
+    QMap<QString/*market*/,TickerInfo> mid_spread;
+    QSharedPointer<Spruce> solver; // the midspread sell phase shares the buy phase's solver
+    bool is_shadow{ false }; // solved for one of SpruceOverseer::shadows, nothing is placed
+};
+
+struct SpruceTarget // what a phase's solve wants of one market on one engine, the same until the next solve
+{
+    Coin qty_to_shortlong; // the solved quantity times the engine's share of the exchange's allocation
+    Coin amount_to_shortlong; // qty_to_shortlong in the base currency
+    Coin order_size; // the default for the market
+    Coin zero_bound_tolerance[ 2 ]; // order_size times the nice zero bound, for buys and sells
+};
+typedef QHash<QPair<qint32/*engine id*/,qint32/*market id*/>,SpruceTarget> SpruceTargetTable;
+
+struct SpruceRoute // an engine's measures, they move its share of the allocations when routing is on
+{
+    quint64 last_activated{ 0 }; // the counts at the last update
+    quint64 last_fills{ 0 };
+    qreal fill_ratio{ -1. }; // fills per order set over the last interval, -1 until enough orders were set
+    qint64 p90{ -1 }; // reply time, -1 without enough replies
+    qreal queue_ratio{ 0. }; // queued requests over the queue limit
+    qreal weight{ 1. }; // smoothed, before the bound
+};
+
+struct SpruceShadowOrder // what a shadow would have placed, it rests until bbo crosses it or it times out
+{
+    QString market;
+    QString phase;
+    quint8 side{ 0 };
+    Coin price;
+    Coin quantity;
+    qint64 expiry_time{ 0 };
+};
+
+struct SpruceShadow // another configuration solved on spruce's ticks, its orders are only simulated
+{
+    Spruce *spruce{ nullptr }; // its own copy, the simulated fills move its short/long quantities
+    QVector<SpruceShadowOrder> orders; // resting
+    QMap<QString/*market*/,Coin> targets; // amount to short/long of the last solve, in the base currency
+    QMap<QString/*market*/,Coin> quantity; // bought less sold, marked to the mid price for the pnl
+    Coin base_flow; // base currency received less spent
+    Coin volume;
+    quint64 solves{ 0 };
+    quint64 orders_placed{ 0 };
+    quint64 fills{ 0 };
+    qint64 start_time{ 0 };
+};
 
 class SpruceOverseer : public QObject
 {
@@ -25,35 +96,126 @@ public:
     ~SpruceOverseer();
 
     static QString getSettingsPath() { return Global::getTraderPath() + QDir::separator() + "spruce.settings"; }
-    void loadSettings();
-    void saveSettings();
+    void loadSettings(); // and the portfolios'
+    void saveSettings( const QString &backup_path = QString() ); // written on the save thread, after copying the old file to backup_path
     void loadStats();
-    void saveStats();
+    void saveStats(); // appends the changes to the stats journal, or takes a new snapshot
 
-    QMap<quint8, Engine*> engine_map;
+    QMap<qint32/*engine id*/, Engine*> engine_map; // see Engine::getEngineId()
     AlphaTracker *alpha{ nullptr };
     Spruce *spruce{ nullptr };
+    BboCache bbo; // prices across the engines, pushed by their tickers
+    QMap<qint32/*engine id*/, MarketEventQueue*> market_events; // into bbo, from each engine's thread
+    MarketEventQueue *getMarketEvents( const qint32 engine_id ); // made on first use, call it before the engines start
+    void drainMarketEvents(); // brings bbo up to date
+    QMutex spruce_lock{ QMutex::Recursive }; // guards spruce and alpha, engines take it after their own lock
+
+    // more portfolios besides spruce, each with its own base, nodes, weights and cost cache. they're solved on spruce's
+    // tick along with it, on the same pool and from the same bbo. the setspruce commands change the selected one
+    QMap<QString/*name*/, Spruce*> portfolios;
+    Spruce *getSelectedPortfolio() const { return selected_portfolio ? selected_portfolio : primary; }
+    bool selectPortfolio( const QString &name ); // made on first use, "primary" selects spruce
+    bool isActive() const; // any of the portfolios
+    static bool isPortfolioName( const QString &name ); // letters and digits, it's part of the strategy tags
+    static QString getPortfolioSettingsPath( const QString &name ) { return Global::getTraderPath() + QDir::separator() + "spruce." + name + ".settings"; }
+
+    // candidate configurations solved on each tick from the same prices and on the same pool as the portfolios. their
+    // orders are matched against bbo like the paper exchange's, nothing is placed. they aren't saved
+    QMap<QString/*name*/, SpruceShadow> shadows;
+    bool addShadow( const QString &name ); // a copy of the selected portfolio, selected so the setspruce commands change it
+    bool removeShadow( const QString &name );
+    Coin getShadowPnl( const SpruceShadow &shadow ) const; // in the base currency, with what it holds at the mid prices
+
+    // several daemons as one portfolio, from getSpruceLinkPath(). call it after loadSettings()
+    bool startLink( const QString &path );
+    SpruceLink *link{ nullptr };
+
+    // a standby of this daemon, or this one standing by, from getStandbyPath(). read it before the rest modules start,
+    // a standby doesn't start them until it takes over
+    bool readStandby( const QString &path );
+    StandbyLink *standby{ nullptr };
+
+    // solve on the pool without the engine locks and apply the result when it's back, replay and the benches solve inline
+    void setAsyncSolve( const bool async ) { m_is_async_solve = async; }
+    bool isSolving() const { return m_is_solving; }
+    static void solvePhases( const QVector<SprucePhase> &phases ); // blocks until every phase is solved
 
 signals:
-    void gotUserCommandChunk( QString &s ); // loaded settings file
+    void gotUserCommandChunk( const QString &s ); // loaded settings file
 
 public Q_SLOTS:
     void onSpruceUp();
+    void onSpruceSolved();
+    void onTickerUpdate();
     void onSaveSpruceSettings();
+    void onSaveStats();
 
 private:
-    void runCancellors( Engine *engine, const QString &market, const quint8 side, const QString &strategy, const Coin &flux_price );
+    void lockEngines();
+    void unlockEngines();
+    void loadPortfolioSettings(); // replays each "spruce.<name>.settings"
+    void compactStats();
+    void onStatsJournalFailed();
+    bool preparePortfolios( QVector<SprucePhase> &phases ); // the phases of every portfolio that's ready
+    void applyPortfolios( const QVector<SprucePhase> &phases );
+    void setSolvingPortfolio( const QString &name ); // what spruce is while the phases are prepared and applied
+    void setSolvingShadow( const QString &name );
+    void applyShadow( const QVector<SprucePhase> &phases ); // places the simulated orders of the shadow spruce points at
+    void matchShadowOrders( SpruceShadow &shadow ); // fills what bbo crossed
+    bool prepareSpruce( QVector<SprucePhase> &phases ); // false if a spread isn't ready
+    void applySpruce( const QVector<SprucePhase> &phases );
+    bool isSolveStale( const QVector<SprucePhase> &phases ); // a mid price moved too far since prepareSpruce()
+    void addSolveMetrics();
+    void trackSolveComplete( const SprucePhase &phase ); // a phase the deadline stopped resumes on the next tick
+    void buildTargets( const SprucePhase &phase, SpruceTargetTable &targets ); // the markets the phase places orders for
+    void runCancellors( Engine *engine, const SpruceTarget &target, const QString &market, const quint8 side, const qint32 phase_tag_id, const bool is_midspread_phase, const Coin &flux_price );
+    bool hasPhaseOrderNear( Engine *engine, const qint32 phase_tag_id, const QString &market, const quint8 side, const Coin &price ) const; // within a price ticksize, not cancelling
+    qint32 getPhaseTagId( const Market &market_phase, const quint8 side ); // "spruce-<B|S>-<market>", or with the portfolio, built once
     void cancelForReason( Engine *const &engine, const Market &market, const quint8 side, const quint8 reason );
 
-    void adjustSpread( TickerInfo &spread, Coin limit, quint8 side, Coin &default_ticksize, bool expand = true );
-    void adjustTicksizeToSpread( Coin &ticksize, TickerInfo &spread, const Coin &ticksize_minimum );
+    void adjustSpread( TickerInfo &spread, Coin limit, quint8 side, const Coin &ticksize, bool expand = true ); // steps of ticksize until bid/ask is within limit
     TickerInfo getSpreadLimit( const QString &market, bool order_duplicity = false );
     TickerInfo getMidSpread( const QString &market );
     TickerInfo getSpreadForSide( const QString &market, quint8 side, bool order_duplicity = false, bool taker_mode = false, bool include_limit_for_side = false, bool is_randomized = false, Coin greed_reduce = Coin() );
     Coin getPriceTicksizeForMarket( const Market &market ) const;
+    Coin getEngineAllocation( const Engine *engine, const qint32 market_id ) const; // its account's share of the exchange's, routed
+    Coin getAccountAllocation( const Engine *engine, const qint32 market_id ) const; // before the routing
+    void updateRoutes( const qint64 current_time ); // measures the engines every ROUTE_INTERVAL, under their locks
+    Coin getRouteWeight( const qint32 engine_id ) const; // within spruce's route bound, 1 with routing off
+
+    // spreads calculated during the current onSpruceUp(), shared by order placement and the cancellors
+    QHash<QPair<QString/*market*/,quint8/*flags*/>,TickerInfo> m_spread_snapshot;
+    bool m_spread_snapshot_active{ false };
+
+    QMap<QString/*phase*/,QMap<QString,Coin>> m_warm_start_solutions; // last solution of each phase, for the warm start
+    QSet<QString/*phase*/> m_incomplete_phases; // their last solve ran into the deadline
+    QMap<QString/*portfolio*/,QMap<QString/*market*/,Coin>> m_spread_reduce_buys, m_spread_reduce_sells; // by applySpruce()
+    QMap<QString/*market*/,Coin> m_last_solve_prices; // mid prices used by the last solve, for the price move trigger
+    QHash<QPair<QString/*portfolio*/,QPair<qint32/*market id*/,quint8/*side*/>>,qint32/*tag id*/> m_phase_tag_ids;
+    QMap<qint32/*engine id*/,SpruceRoute> m_routes;
+    qint64 m_routes_time{ 0 };
+
+    Spruce *primary{ nullptr }; // spruce, when it isn't pointing at the portfolio being prepared or applied
+    Spruce *selected_portfolio{ nullptr }; // for the commands, nullptr is spruce
+    QString m_solving_portfolio; // the name of the one spruce points at, empty for primary
+    bool m_is_solving_shadow{ false }; // m_solving_portfolio is one of shadows
+
+    QThreadPool *m_solve_pool{ nullptr };
+    QVector<SprucePhase> m_solve_phases; // being solved on m_solve_pool
+    QElapsedTimer m_solve_timer;
+    bool m_is_async_solve{ false };
+    bool m_is_solving{ false };
+    qint64 m_prepare_failed_time{ 0 }; // the last onSpruceUp() that couldn't prepare the phases, 0 if it could
+
+    TaskScheduler *scheduler{ nullptr };
+    ScheduledTask *spruce_timer{ nullptr };
+    ScheduledTask *autosave_timer{ nullptr };
+    ScheduledTask *stats_timer{ nullptr };
+    AsyncSaver *saver{ nullptr }; // settings and stats writes
 
-    QTimer *spruce_timer{ nullptr };
-    QTimer *autosave_timer{ nullptr };
+    qint64 stats_generation{ 0 }; // of the snapshot the journal follows
+    qint64 stats_compact_secs{ 0 };
+    bool is_stats_journal_ok{ false }; // the journal file was started for stats_generation
 };
 
 #endif // SPRUCEOVERSEER_H
@@ -2,9 +2,12 @@
 #include "engine.h"
 #include "spruce.h"
 #include "spruceoverseer.h"
+#include "strategytag.h"
 
 #include <QDebug>
 
+#include <algorithm>
+
 void SpruceOverseerTest::test( SpruceOverseer *o, Engine *engine )
 {
     const QString TEST_MARKET = "TEST_1";
@@ -18,6 +21,11 @@ void SpruceOverseerTest::test( SpruceOverseer *o, Engine *engine )
         if ( engine->rest_arr.value( type ) != nullptr )
             engine->rest_arr.value( type )->ticker_update_time = QDateTime::currentMSecsSinceEpoch();
 
+    // push it to the cross exchange prices like updateTicker() would
+    o->bbo.update( engine->engine_type, TEST_MARKET, engine->market_info[ TEST_MARKET ].ticker, QDateTime::currentMSecsSinceEpoch() );
+    assert( o->bbo.getQuote( TEST_MARKET ).isValid() );
+    assert( o->bbo.getQuote( TEST_MARKET ).best_bid_source == engine->engine_type );
+
     /// ensure that getSpreadLimit() ratio == regular spread ratio
     // override some settings
     const Coin order_random_buy = o->spruce->getOrderRandomBuy();
@@ -115,4 +123,133 @@ void SpruceOverseerTest::test( SpruceOverseer *o, Engine *engine )
     for ( quint8 type = 0; type < 4; type++ )
         if ( engine->rest_arr.value( type ) != nullptr )
             engine->rest_arr.value( type )->ticker_update_time = 0;
+
+    o->bbo.remove( TEST_MARKET );
+    assert( !o->bbo.getQuote( TEST_MARKET ).isValid() );
+
+    /// ensure the binary settings state restores what the settings text would
+    Spruce saved;
+    saved.setBaseCurrency( "BTC" );
+    saved.setIntervalSecs( 90 );
+    saved.setOrderGreed( Coin( "0.97" ) );
+    saved.setOrderNiceMarketOffset( "BTC_DOGE", SIDE_SELL, Coin( "0.5" ) );
+    saved.addStartNode( "DOGE", "1000.12345678", "0.0000002512345678" );
+    saved.addStartNode( "LTC", "2", "0.005" );
+    saved.setCurrencyWeight( "DOGE", Coin( "0.4" ) );
+    saved.setProfileU( "LTC", Coin( "5" ) );
+    saved.setExchangeAllocation( "0-BTC_DOGE", Coin( "0.5" ) );
+    saved.setRouteBound( Coin( "0.25" ) );
+    saved.setSolveDeadline( 20 );
+    saved.setCostFunctionImage( false );
+    saved.addToShortLonged( "BTC_LTC", Coin( "-0.25" ) );
+    saved.addMarketBeta( Market( "DOGE_LTC" ) );
+
+    const QByteArray state = saved.getBinaryState();
+
+    Spruce restored;
+    assert( restored.readBinaryState( state ) );
+    assert( restored.getSaveState() == saved.getSaveState() );
+    assert( restored.getExchangeAllocation( 0, Market( "BTC_DOGE" ).getId() ) == Coin( "0.5" ) );
+    assert( restored.getRouteBound() == Coin( "0.25" ) );
+    assert( restored.getSolveDeadline() == 20 );
+    assert( !restored.getCostFunctionImage() );
+
+    // a truncated state sets nothing
+    Spruce truncated;
+    assert( !truncated.readBinaryState( state.left( state.size() /2 ) ) );
+    assert( truncated.getSaveState() == Spruce().getSaveState() );
+
+    /// ensure the adaptive solver ends near the reference solver's solution
+    Spruce reference, adaptive;
+    Spruce *solvers[] = { &reference, &adaptive };
+    for ( int k = 0; k < 2; k++ )
+    {
+        Spruce *solver = solvers[ k ];
+        solver->setBaseCurrency( "BTC" );
+        solver->setCostFunctionImage( false );
+        solver->setSolverAdaptive( solver == &adaptive );
+        solver->setCurrencyWeight( "LTC", Coin( "1" ) );
+        solver->setCurrencyWeight( "ETH", Coin( "1.2" ) );
+        solver->setCurrencyWeight( "DOGE", Coin( "0.4" ) );
+        solver->addStartNode( "LTC", "40", "0.005" );
+        solver->addStartNode( "ETH", "6", "0.03" );
+        solver->addStartNode( "DOGE", "300000", "0.0000025" );
+        solver->setProfileU( "DOGE", Coin( "20" ) );
+        solver->addLiveNode( "LTC", "0.00525" );
+        solver->addLiveNode( "ETH", "0.0291" );
+        solver->addLiveNode( "DOGE", "0.0000025" );
+        assert( solver->calculateAmountToShortLong() );
+    }
+
+    // both step by ticksize at the end, the adaptive one from where its rounded down halvings left it
+    const Coin solve_ticksize = std::max( CoinAmount::SATOSHI * 50000, reference.getEquityAll() / 10000 );
+    const QMap<QString,Coin> &reference_solution = reference.getSolution();
+    assert( !reference_solution.isEmpty() );
+    for ( QMap<QString,Coin>::const_iterator i = reference_solution.begin(); i != reference_solution.end(); i++ )
+    {
+        assert( ( i.value() - adaptive.getSolution().value( i.key() ) ).abs() <= solve_ticksize * 3 );
+    }
+
+    /// ensure another portfolio gets its own spruce, phase tags and fills
+    assert( !SpruceOverseer::isPortfolioName( "primary" ) && !SpruceOverseer::isPortfolioName( "a-b" ) );
+    assert( o->selectPortfolio( "test" ) );
+
+    Spruce *portfolio = o->getSelectedPortfolio();
+    assert( portfolio != o->spruce && o->portfolios.value( "test" ) == portfolio );
+    assert( o->selectPortfolio( "test" ) && o->getSelectedPortfolio() == portfolio );
+
+    o->setSolvingPortfolio( "test" );
+    assert( o->spruce == portfolio );
+    const QString portfolio_tag = StrategyTag::getString( o->getPhaseTagId( Market( "WAVES_BTC" ), SIDE_BUY ) );
+    o->setSolvingPortfolio( QString() );
+    assert( portfolio_tag == "spruce.test-B-WAVES_BTC" );
+    assert( StrategyTag::getString( o->getPhaseTagId( Market( "WAVES_BTC" ), SIDE_BUY ) ) == "spruce-B-WAVES_BTC" );
+
+    const QMap<QString, Spruce*> *engine_portfolios = engine->spruce_portfolios;
+    engine->spruce_portfolios = &o->portfolios;
+    assert( engine->getSpruceForTag( portfolio_tag ) == portfolio );
+    assert( engine->getSpruceForTag( "spruce-B-WAVES_BTC" ) == engine->spruce );
+    assert( engine->getSpruceForTag( "spruce.other-B-WAVES_BTC" ) == engine->spruce );
+    engine->spruce_portfolios = engine_portfolios;
+
+    // don't solve or save it
+    assert( o->selectPortfolio( "primary" ) && o->getSelectedPortfolio() == o->spruce );
+    o->portfolios.remove( "test" );
+    delete portfolio;
+
+    /// ensure a shadow is a selected copy, and its simulated orders fill only once bbo crosses them
+    assert( !o->addShadow( "a-b" ) );
+    assert( o->addShadow( "test" ) );
+
+    SpruceShadow &shadow = o->shadows[ "test" ];
+    assert( shadow.spruce != o->spruce && o->getSelectedPortfolio() == shadow.spruce );
+
+    o->setSolvingShadow( "test" );
+    assert( o->spruce == shadow.spruce && o->m_is_solving_shadow );
+    o->setSolvingPortfolio( QString() );
+    assert( o->spruce != shadow.spruce && !o->m_is_solving_shadow );
+
+    SpruceShadowOrder order;
+    order.market = TEST_MARKET;
+    order.side = SIDE_BUY;
+    order.price = "0.00010050";
+    order.quantity = "100";
+    shadow.orders += order;
+
+    o->bbo.update( engine->engine_type, TEST_MARKET, TickerInfo( Coin( "0.00010000" ), Coin( "0.00010100" ) ), QDateTime::currentMSecsSinceEpoch() );
+    o->matchShadowOrders( shadow );
+    assert( shadow.orders.size() == 1 && shadow.fills == 0 );
+
+    o->bbo.update( engine->engine_type, TEST_MARKET, TickerInfo( Coin( "0.00010000" ), Coin( "0.00010050" ) ), QDateTime::currentMSecsSinceEpoch() );
+    o->matchShadowOrders( shadow );
+    assert( shadow.orders.isEmpty() && shadow.fills == 1 );
+    assert( shadow.quantity.value( TEST_MARKET ) == Coin( "100" ) );
+    assert( shadow.base_flow == Coin( "-0.01005" ) && shadow.volume == Coin( "0.01005" ) );
+
+    // held at the mid price
+    assert( o->getShadowPnl( shadow ) == shadow.base_flow + Coin( "100" ) * o->bbo.getQuote( TEST_MARKET ).average_mid_price );
+
+    assert( o->removeShadow( "test" ) && !o->removeShadow( "test" ) );
+    assert( o->shadows.isEmpty() && o->getSelectedPortfolio() == o->spruce );
+    o->bbo.remove( TEST_MARKET );
 }
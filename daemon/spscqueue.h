@@ -0,0 +1,54 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include "global.h"
+
+#include <atomic>
+#include <utility>
+
+//
+// SpscQueue, a bounded lock-free queue for one producer thread and one consumer thread. the producer only writes head
+// and the consumer only writes tail, so neither waits on the other. when it's full push() returns false and the caller
+// decides what to do with the value
+//
+template <typename T, qint32 CAPACITY>
+class SpscQueue
+{
+    static_assert( CAPACITY > 0 && ( CAPACITY & ( CAPACITY -1 ) ) == 0, "capacity must be a power of two" );
+
+public:
+    bool push( T &value ) // the producer's, value is moved from on success
+    {
+        const quint64 head_seq = head.load( std::memory_order_relaxed );
+        if ( head_seq - tail.load( std::memory_order_acquire ) >= quint64( CAPACITY ) )
+            return false;
+
+        slots[ head_seq & ( CAPACITY -1 ) ] = std::move( value );
+        head.store( head_seq +1, std::memory_order_release );
+        return true;
+    }
+
+    bool pop( T &value ) // the consumer's, false if empty
+    {
+        const quint64 tail_seq = tail.load( std::memory_order_relaxed );
+        if ( tail_seq == head.load( std::memory_order_acquire ) )
+            return false;
+
+        T &slot = slots[ tail_seq & ( CAPACITY -1 ) ];
+        value = std::move( slot );
+        slot = T(); // don't hold on to what it pointed to
+        tail.store( tail_seq +1, std::memory_order_release );
+        return true;
+    }
+
+    qint32 size() const { return qint32( head.load( std::memory_order_acquire ) - tail.load( std::memory_order_acquire ) ); }
+    bool isEmpty() const { return size() == 0; }
+    static qint32 getCapacity() { return CAPACITY; }
+
+private:
+    T slots[ CAPACITY ];
+    alignas( 64 ) std::atomic<quint64> head{ 0 }; // next slot the producer writes
+    alignas( 64 ) std::atomic<quint64> tail{ 0 }; // next slot the consumer reads
+};
+
+#endif // SPSCQUEUE_H
@@ -6,6 +6,9 @@
 
 #include <QSslConfiguration>
 #include <QSslCipher>
+#include <QMutex>
+#include <QHash>
+#include <QByteArray>
 #include <QDebug>
 #include <QLoggingCategory>
 
@@ -32,6 +35,9 @@ static inline void enableSecureSsl()
     // disable compression
     ssl_config.setSslOption( QSsl::SslOptionDisableCompression, true );
 
+    // keep session tickets, so a dropped connection can resume (see setSessionTicket())
+    ssl_config.setSslOption( QSsl::SslOptionDisableSessionPersistence, false );
+
     QList<QSslCipher> cipher_list = ssl_config.supportedCiphers();
     QList<QSslCipher> chosen_ciphers;
 
@@ -98,6 +104,31 @@ static inline void enableSecureSsl()
     assert( QSslConfiguration::defaultConfiguration().ciphers() == chosen_ciphers );
 }
 
+// tls session tickets by host, shared by the engine threads. not static, so every file sees the same cache
+inline QMutex &getSessionTicketLock()
+{
+    static QMutex lock;
+    return lock;
+}
+
+inline QHash<QString, QByteArray> &getSessionTickets()
+{
+    static QHash<QString, QByteArray> tickets;
+    return tickets;
+}
+
+inline void setSessionTicket( const QString &host, const QByteArray &ticket )
+{
+    QMutexLocker locker( &getSessionTicketLock() );
+    getSessionTickets().insert( host, ticket );
+}
+
+inline QByteArray getSessionTicket( const QString &host )
+{
+    QMutexLocker locker( &getSessionTicketLock() );
+    return getSessionTickets().value( host );
+}
+
 }
 
 #endif // GLOBALSSL_H
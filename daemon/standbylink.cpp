@@ -0,0 +1,570 @@
+#include "standbylink.h"
+#include "spruce.h"
+#include "spruceoverseer.h"
+#include "engine.h"
+#include "baserest.h"
+#include "asyncsaver.h"
+#include "taskscheduler.h"
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QDataStream>
+#include <QFile>
+#include <QTimer>
+#include <QDateTime>
+#include <QStringList>
+#include <QtEndian>
+
+#include <cstring>
+
+StandbyLink::StandbyLink( SpruceOverseer *_overseer, TaskScheduler *scheduler, QObject *parent )
+    : QObject( parent ),
+      overseer( _overseer )
+{
+    tick_timer = scheduler->addTask( this, "standby link", [this]() { onTick(); }, TASK_PRIORITY_HOUSEKEEPING, 0. );
+}
+
+StandbyLink::~StandbyLink()
+{
+    // the engines are deleted before the overseer, and their journals hand their last records to replica
+    delete sck;
+    sck = nullptr;
+
+    qDeleteAll( journal_readers );
+    journal_readers.clear();
+}
+
+bool StandbyLink::readConfig( const QString &path )
+{
+    QFile loadfile( path );
+    if ( !loadfile.open( QIODevice::ReadOnly | QIODevice::Text ) )
+        return false;
+
+    const QStringList lines = QString::fromUtf8( loadfile.readAll() ).split( '\n' );
+    for ( QStringList::const_iterator i = lines.begin(); i != lines.end(); i++ )
+    {
+        const QStringList parts = i->section( QChar( '#' ), 0, 0 ).simplified().split( QChar( ' ' ), QString::SkipEmptyParts );
+        if ( parts.isEmpty() )
+            continue;
+
+        bool ok = false;
+        if ( parts.at( 0 ) == "primary" && parts.size() == 4 )
+        {
+            is_primary = true;
+            ok = bind_address.setAddress( parts.at( 1 ) );
+            port = ok ? quint16( parts.at( 2 ).toUInt( &ok ) ) : 0;
+            ok = ok && auth.setSecret( parts.at( 3 ).toUtf8() );
+        }
+        else if ( parts.at( 0 ) == "standby" && parts.size() == 4 )
+        {
+            is_primary = false;
+            host = parts.at( 1 );
+            port = quint16( parts.at( 2 ).toUInt( &ok ) );
+            ok = ok && auth.setSecret( parts.at( 3 ).toUtf8() );
+        }
+
+        if ( !ok || port == 0 )
+        {
+            kDebug() << "local error: bad standby line in" << loadfile.fileName()
+                     << ", use 'primary <address> <port> <secret>' or 'standby <host> <port> <secret>'"
+                     << ", the secret is at least" << LinkAuth::MIN_SECRET_SIZE << "characters";
+            return false;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+void StandbyLink::start( const QVector<BaseREST*> &_rests )
+{
+    if ( is_started )
+        return;
+
+    is_started = true;
+
+    if ( is_primary )
+    {
+        server = new QTcpServer( this );
+        if ( !server->listen( bind_address, port ) )
+        {
+            kDebug() << "local error: standby link failed to listen on" << bind_address.toString() << "port" << port << server->errorString();
+            return;
+        }
+
+        connect( server, &QTcpServer::newConnection, this, &StandbyLink::onNewConnection );
+
+        // the journals hand over their records from here on
+        for ( QMap<qint32, Engine*>::const_iterator i = overseer->engine_map.begin(); i != overseer->engine_map.end(); i++ )
+        {
+            QMutexLocker locker( i.value()->getLock() );
+            i.value()->setJournalReplica( &replica );
+        }
+
+        tick_timer->start( STANDBY_HEARTBEAT_INTERVAL );
+        kDebug() << "[StandbyLink] primary, standbys connect on" << bind_address.toString() << "port" << port;
+        return;
+    }
+
+    rests = _rests;
+    saver = new AsyncSaver( this );
+
+    // the handshakes are done before we take over, init() warms them again
+    for ( QVector<BaseREST*>::const_iterator i = rests.begin(); i != rests.end(); i++ )
+    {
+        BaseREST *rest = *i;
+        if ( rest->getWarmUrl().isEmpty() )
+            continue;
+
+        QTimer::singleShot( 0, rest, [rest]() { rest->startConnectionWarming( rest->getWarmUrl() ); } );
+    }
+
+    sck = new QTcpSocket();
+    connect( sck, &QTcpSocket::connected, this, &StandbyLink::onConnected );
+    connect( sck, &QTcpSocket::readyRead, this, &StandbyLink::onReadyRead );
+
+    last_connect_time = QDateTime::currentMSecsSinceEpoch();
+    sck->connectToHost( host, port );
+    tick_timer->start( STANDBY_CHECK_INTERVAL );
+    kDebug() << "[StandbyLink] standing by for" << host << port << ", the rest modules wait until it stops";
+}
+
+QByteArray StandbyLink::makeFrame( const quint8 type, const quint8 engine_id, const QByteArray &payload )
+{
+    QByteArray frame( STANDBY_FRAME_HEADER_SIZE + payload.size(), Qt::Uninitialized );
+    uchar *p = reinterpret_cast<uchar*>( frame.data() );
+    qToLittleEndian<quint32>( quint32( payload.size() ), p );
+    p[ 4 ] = type;
+    p[ 5 ] = engine_id;
+    memcpy( p + STANDBY_FRAME_HEADER_SIZE, payload.constData(), size_t( payload.size() ) );
+
+    return frame;
+}
+
+qint32 StandbyLink::parseFrames( const QByteArray &data, QVector<Frame> &frames )
+{
+    const uchar *p = reinterpret_cast<const uchar*>( data.constData() );
+    qint32 position = 0;
+
+    while ( data.size() - position >= STANDBY_FRAME_HEADER_SIZE )
+    {
+        const quint32 size = qFromLittleEndian<quint32>( p + position );
+        if ( size > quint32( STANDBY_FRAME_MAX ) )
+            return -1;
+
+        // wait for the rest
+        if ( data.size() - position - STANDBY_FRAME_HEADER_SIZE < qint32( size ) )
+            break;
+
+        Frame frame;
+        frame.type = p[ position + 4 ];
+        frame.engine_id = p[ position + 5 ];
+        frame.payload = data.mid( position + STANDBY_FRAME_HEADER_SIZE, qint32( size ) );
+        frames += frame;
+
+        position += STANDBY_FRAME_HEADER_SIZE + qint32( size );
+    }
+
+    return position;
+}
+
+void StandbyLink::onNewConnection()
+{
+    while ( server->hasPendingConnections() )
+    {
+        QTcpSocket *standby = server->nextPendingConnection();
+        connect( standby, &QTcpSocket::disconnected, this, &StandbyLink::onDisconnected );
+        connect( standby, &QTcpSocket::readyRead, this, &StandbyLink::onReadyRead );
+
+        // it gets nothing until it answers this, see readStandbyFrame()
+        const QByteArray standby_challenge = LinkAuth::makeChallenge();
+        standby_challenges.insert( standby, standby_challenge );
+        standby->write( makeFrame( STANDBY_FRAME_CHALLENGE, 0, standby_challenge ) );
+
+        kDebug() << "[StandbyLink] standby connected from" << standby->peerAddress().toString();
+    }
+}
+
+void StandbyLink::onDisconnected()
+{
+    QTcpSocket *from = qobject_cast<QTcpSocket*>( sender() );
+
+    if ( !from )
+        return;
+
+    if ( standbys.removeAll( from ) > 0 )
+        kDebug() << "[StandbyLink] standby" << from->peerAddress().toString() << "disconnected";
+
+    standby_challenges.remove( from );
+    standby_buffers.remove( from );
+    from->deleteLater();
+}
+
+void StandbyLink::onConnected()
+{
+    kDebug() << "[StandbyLink] connected to the primary";
+
+    // a frame that was cut off isn't whole, and nothing counts until the primary answers our challenge
+    read_buffer.clear();
+    is_primary_authed = false;
+    is_challenge_answered = false;
+    challenge = LinkAuth::makeChallenge();
+    sck->write( makeFrame( STANDBY_FRAME_CHALLENGE, 0, challenge ) );
+}
+
+void StandbyLink::onReadyRead()
+{
+    QTcpSocket *from = qobject_cast<QTcpSocket*>( sender() );
+    if ( !from || is_promoted || is_fenced )
+        return;
+
+    QByteArray &buffer = is_primary ? standby_buffers[ from ] : read_buffer;
+    buffer += from->readAll();
+
+    QVector<Frame> frames;
+    const qint32 consumed = parseFrames( buffer, frames );
+    if ( consumed < 0 )
+    {
+        kDebug() << "local warning: standby link got a bad frame, dropping the connection";
+        buffer.clear();
+        from->abort();
+        return;
+    }
+
+    buffer.remove( 0, consumed );
+
+    for ( QVector<Frame>::const_iterator i = frames.begin(); i != frames.end() && !is_promoted && !is_fenced; i++ )
+    {
+        // the frames after one that dropped the connection aren't read
+        const bool is_kept = is_primary ? readStandbyFrame( from, *i ) : readFrame( *i );
+        if ( !is_kept )
+            return;
+    }
+}
+
+void StandbyLink::onTick()
+{
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+
+    if ( is_primary )
+    {
+        if ( standbys.isEmpty() )
+        {
+            // nobody to send them to
+            QMutexLocker locker( &replica.mutex );
+            replica.pending.clear();
+            return;
+        }
+
+        // the records first, the state after them is at least as new
+        sendJournals();
+
+        if ( current_time - last_state_time >= STANDBY_STATE_INTERVAL )
+        {
+            last_state_time = current_time;
+            sendState();
+        }
+
+        broadcast( makeFrame( STANDBY_FRAME_HEARTBEAT, 0 ) );
+        return;
+    }
+
+    if ( is_promoted )
+        return;
+
+    // we claimed and the release didn't come, the primary stood down on its own by now, or it's gone
+    if ( claim_time > 0 && current_time - claim_time > STANDBY_CLAIM_TIME )
+    {
+        promote( QString( "no release from the primary %1 ms after the claim" ).arg( current_time - claim_time ) );
+        return;
+    }
+
+    // the primary went quiet, or it's gone
+    const qint64 silent_ms = current_time - last_frame_time;
+    if ( claim_time == 0 && last_frame_time > 0 && silent_ms > STANDBY_TAKEOVER_TIME )
+    {
+        claim( silent_ms );
+        return;
+    }
+
+    if ( sck->state() == QAbstractSocket::UnconnectedState && current_time - last_connect_time >= STANDBY_RECONNECT_INTERVAL )
+    {
+        last_connect_time = current_time;
+        sck->connectToHost( host, port );
+    }
+}
+
+void StandbyLink::sendJournals()
+{
+    QVector<OrderJournalReplica::Chunk> chunks;
+    {
+        QMutexLocker locker( &replica.mutex );
+        chunks.swap( replica.pending );
+    }
+
+    // a chunk of the last generation has ids the standbys weren't told
+    const qint32 generation = replica.generation.load( std::memory_order_acquire );
+    for ( QVector<OrderJournalReplica::Chunk>::const_iterator i = chunks.begin(); i != chunks.end(); i++ )
+        if ( i->generation == generation )
+            broadcast( makeFrame( STANDBY_FRAME_JOURNAL, quint8( i->engine_id ), i->data ) );
+}
+
+void StandbyLink::sendState()
+{
+    // one engine lock at a time, and spruce_lock after them
+    for ( QMap<qint32, Engine*>::const_iterator i = overseer->engine_map.begin(); i != overseer->engine_map.end(); i++ )
+    {
+        QMap<QString, QByteArray> engine_snapshots;
+        {
+            QMutexLocker locker( i.value()->getLock() );
+            engine_snapshots = i.value()->getSnapshotData( ALL );
+        }
+
+        QByteArray payload;
+        QDataStream out( &payload, QIODevice::WriteOnly );
+        out.setVersion( QDataStream::Qt_5_0 );
+        out << engine_snapshots;
+
+        broadcast( makeFrame( STANDBY_FRAME_SNAPSHOTS, quint8( i.key() ), payload ) );
+    }
+
+    QByteArray spruce_state;
+    {
+        QMutexLocker locker( &overseer->spruce_lock );
+        spruce_state = overseer->spruce->getBinaryState();
+    }
+
+    broadcast( makeFrame( STANDBY_FRAME_SPRUCE, 0, spruce_state ) );
+}
+
+void StandbyLink::broadcast( const QByteArray &frame )
+{
+    // abort() takes it off standbys right away
+    const QVector<QTcpSocket*> targets = standbys;
+    for ( QVector<QTcpSocket*>::const_iterator i = targets.begin(); i != targets.end(); i++ )
+    {
+        QTcpSocket *standby = *i;
+
+        // it stopped reading, it couldn't take over from where we are
+        if ( standby->bytesToWrite() > STANDBY_FRAME_MAX )
+        {
+            kDebug() << "local warning: standby" << standby->peerAddress().toString() << "is too far behind, dropping it";
+            standby->abort();
+            continue;
+        }
+
+        standby->write( frame );
+    }
+}
+
+bool StandbyLink::readFrame( const Frame &frame )
+{
+    // the primary checks us too, and a claim from before the reconnect goes after our answer
+    if ( frame.type == STANDBY_FRAME_CHALLENGE )
+    {
+        sck->write( makeFrame( STANDBY_FRAME_AUTH, 0, auth.answer( "standby", frame.payload ) ) );
+        is_challenge_answered = true;
+
+        if ( claim_time > 0 )
+            sck->write( makeFrame( STANDBY_FRAME_CLAIM, 0 ) );
+        return true;
+    }
+
+    // only the primary's frames keep us standing by
+    if ( !is_primary_authed )
+    {
+        if ( frame.type == STANDBY_FRAME_AUTH && auth.check( "primary", challenge, frame.payload ) )
+        {
+            is_primary_authed = true;
+            last_frame_time = QDateTime::currentMSecsSinceEpoch();
+            kDebug() << "[StandbyLink] the primary answered our challenge";
+            return true;
+        }
+
+        kDebug() << "local warning: standby link primary" << host << "failed the challenge, dropping the connection";
+        sck->abort();
+        return false;
+    }
+
+    last_frame_time = QDateTime::currentMSecsSinceEpoch();
+
+    if ( frame.type == STANDBY_FRAME_HEARTBEAT )
+        return true;
+
+    if ( frame.type == STANDBY_FRAME_RELEASE )
+    {
+        promote( "the primary stood down" );
+        return false;
+    }
+
+    if ( frame.type == STANDBY_FRAME_SPRUCE )
+    {
+        // nothing is solved before the engines have prices, so spruce can take it as it comes
+        QMutexLocker locker( &overseer->spruce_lock );
+        if ( !overseer->spruce->readBinaryState( frame.payload ) )
+            kDebug() << "local warning: standby link got a truncated spruce state," << frame.payload.size() << "bytes";
+        return true;
+    }
+
+    Engine *engine = overseer->engine_map.value( frame.engine_id );
+    if ( !engine )
+    {
+        kDebug() << "local warning: standby link got a frame for engine" << frame.engine_id << "which we don't run";
+        return true;
+    }
+
+    if ( frame.type == STANDBY_FRAME_SNAPSHOTS )
+    {
+        QMap<QString, QByteArray> engine_snapshots;
+        QDataStream in( frame.payload );
+        in.setVersion( QDataStream::Qt_5_0 );
+        in >> engine_snapshots;
+
+        if ( in.status() != QDataStream::Ok )
+        {
+            kDebug() << "local warning: standby link got truncated snapshots for engine" << frame.engine_id;
+            return true;
+        }
+
+        // the records we had are in these, the primary sends its journals before its state
+        snapshots.insert( frame.engine_id, engine_snapshots );
+        journal_tails.remove( frame.engine_id );
+        return true;
+    }
+
+    if ( frame.type == STANDBY_FRAME_JOURNAL )
+    {
+        // our engines haven't written theirs yet, the records go where the primary's would
+        const QString path = Global::getOrderJournalPath( engine->engine_type, engine->getEngineIndex() );
+        const QByteArray data = frame.payload;
+        saver->save( path, [path, data]() { return OrderJournal::appendRecords( path, data ); } );
+
+        // and the ones after the snapshots are applied when we take over
+        OrderJournalReader *&reader = journal_readers[ frame.engine_id ];
+        if ( !reader )
+            reader = new OrderJournalReader();
+
+        reader->feed( data );
+
+        QVector<OrderJournalEvent> &tail = journal_tails[ frame.engine_id ];
+        OrderJournalEvent event;
+        while ( reader->next( event ) )
+            tail += event;
+        return true;
+    }
+
+    kDebug() << "local warning: standby link got a frame of unknown type" << frame.type;
+    return true;
+}
+
+bool StandbyLink::readStandbyFrame( QTcpSocket *from, const Frame &frame )
+{
+    // the standby checks us too
+    if ( frame.type == STANDBY_FRAME_CHALLENGE )
+    {
+        from->write( makeFrame( STANDBY_FRAME_AUTH, 0, auth.answer( "primary", frame.payload ) ) );
+        return true;
+    }
+
+    // nothing from a standby counts until its answer checks out, least of all a claim
+    const QMap<QTcpSocket*, QByteArray>::iterator pending = standby_challenges.find( from );
+    if ( pending != standby_challenges.end() )
+    {
+        if ( frame.type != STANDBY_FRAME_AUTH || !auth.check( "standby", pending.value(), frame.payload ) )
+        {
+            kDebug() << "local warning: standby" << from->peerAddress().toString() << "failed the challenge, dropping it";
+            standby_challenges.erase( pending );
+            from->abort();
+            return false;
+        }
+
+        standby_challenges.erase( pending );
+        standbys += from;
+        kDebug() << "[StandbyLink] standby" << from->peerAddress().toString() << "answered our challenge";
+
+        // the journals name their ids again for it, and it gets the whole state on this tick
+        replica.generation.fetch_add( 1, std::memory_order_acq_rel );
+        last_state_time = 0;
+        return true;
+    }
+
+    if ( frame.type == STANDBY_FRAME_HEARTBEAT )
+        return true;
+
+    if ( frame.type == STANDBY_FRAME_CLAIM )
+    {
+        standDown( QString( "standby %1 claimed the primary role" ).arg( from->peerAddress().toString() ) );
+        return false;
+    }
+
+    kDebug() << "local warning: standby link got a frame of unknown type" << frame.type << "from a standby";
+    return true;
+}
+
+void StandbyLink::standDown( const QString &reason )
+{
+    is_fenced = true;
+    tick_timer->stop();
+
+    kDebug() << "[StandbyLink]" << reason << ", standing down";
+
+    // the records they don't have yet, then the release. disconnectFromHost() writes what's queued first
+    sendJournals();
+    broadcast( makeFrame( STANDBY_FRAME_RELEASE, 0 ) );
+    server->close();
+
+    const QVector<QTcpSocket*> targets = standbys;
+    for ( QVector<QTcpSocket*>::const_iterator i = targets.begin(); i != targets.end(); i++ )
+        (*i)->disconnectFromHost();
+
+    emit fenced();
+}
+
+void StandbyLink::claim( const qint64 silent_ms )
+{
+    claim_time = QDateTime::currentMSecsSinceEpoch();
+
+    kDebug() << "[StandbyLink] no word from the primary for" << silent_ms << "ms, claiming the primary role";
+
+    // readFrame() sends it once we answered the primary's challenge
+    if ( sck->state() == QAbstractSocket::ConnectedState && is_challenge_answered )
+        sck->write( makeFrame( STANDBY_FRAME_CLAIM, 0 ) );
+    else if ( sck->state() == QAbstractSocket::UnconnectedState )
+    {
+        last_connect_time = claim_time;
+        sck->connectToHost( host, port );
+    }
+}
+
+void StandbyLink::promote( const QString &reason )
+{
+    is_promoted = true;
+    tick_timer->stop();
+    sck->abort();
+
+    kDebug() << "[StandbyLink]" << reason << ", taking over";
+
+    // one engine lock at a time, the rest modules aren't running yet
+    qint32 market_count = 0, record_count = 0;
+    for ( QMap<qint32, Engine*>::const_iterator i = overseer->engine_map.begin(); i != overseer->engine_map.end(); i++ )
+    {
+        const QMap<QString, QByteArray> engine_snapshots = snapshots.value( i.key() );
+        const QVector<OrderJournalEvent> tail = journal_tails.value( i.key() );
+        market_count += engine_snapshots.size();
+        record_count += tail.size();
+
+        QMutexLocker locker( i.value()->getLock() );
+        i.value()->setPendingSnapshots( engine_snapshots, tail );
+    }
+
+    kDebug() << "[StandbyLink] set the primary's snapshots of" << market_count << "markets and" << record_count
+             << "journal records after them, starting the rest modules";
+    snapshots.clear();
+    journal_tails.clear();
+
+    emit promoted();
+}
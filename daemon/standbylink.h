@@ -0,0 +1,135 @@
+#ifndef STANDBYLINK_H
+#define STANDBYLINK_H
+
+#include "global.h"
+#include "orderjournal.h"
+#include "linkauth.h"
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QMap>
+#include <QHostAddress>
+
+class QTcpServer;
+class QTcpSocket;
+class AsyncSaver;
+class ScheduledTask;
+class TaskScheduler;
+class SpruceOverseer;
+struct BaseREST;
+
+// the frames on the link: quint32 payload size, quint8 type, quint8 engine id, little endian, then the payload. both
+// sides start with a challenge and answer the other's, see LinkAuth, and nothing else is read before the other side's
+// answer checks out. then the primary sends all but the claim, and a standby only the claim
+static const quint8 STANDBY_FRAME_HEARTBEAT = 1; // no payload
+static const quint8 STANDBY_FRAME_SNAPSHOTS = 2; // the engine's Engine::getSnapshotData() through a QDataStream
+static const quint8 STANDBY_FRAME_SPRUCE = 3; // Spruce::getBinaryState()
+static const quint8 STANDBY_FRAME_JOURNAL = 4; // order journal records of the engine
+static const quint8 STANDBY_FRAME_CLAIM = 5; // a standby is taking over, no payload
+static const quint8 STANDBY_FRAME_RELEASE = 6; // the primary stood down, after its last journal records. no payload
+static const quint8 STANDBY_FRAME_CHALLENGE = 7; // the hex challenge for the other side
+static const quint8 STANDBY_FRAME_AUTH = 8; // the hex answer to the other side's challenge
+static const qint32 STANDBY_FRAME_HEADER_SIZE = 6;
+static const qint32 STANDBY_FRAME_MAX = 64 * 1024 * 1024; // larger isn't ours, and a standby this far behind is dropped
+static const qint64 STANDBY_HEARTBEAT_INTERVAL = 200; // ms between heartbeats and journal chunks from the primary
+static const qint64 STANDBY_STATE_INTERVAL = 1000; // ms between the snapshots and spruce states
+static const qint64 STANDBY_CHECK_INTERVAL = 100; // ms between a standby's heartbeat checks
+static const qint64 STANDBY_TAKEOVER_TIME = 1000; // ms without a frame before a standby claims
+static const qint64 STANDBY_CLAIM_TIME = 1000; // ms a standby waits for the release before it takes over anyway
+static const qint64 STANDBY_RECONNECT_INTERVAL = 1000; // ms between a standby's connects
+
+//
+// StandbyLink, keeps a second daemon ready to take over this one. the primary sends its standbys the journal records
+// of every engine as they're flushed, the engines' position snapshots and spruce's state every second, and a heartbeat.
+// a standby keeps spruce's state, the latest snapshots and the journal records after them in memory and its exchange
+// connections warm, without starting its rest modules. once it hasn't heard from the primary for
+// STANDBY_TAKEOVER_TIME, it sends a claim and waits for the release, or for STANDBY_CLAIM_TIME if none comes. then it
+// hands each engine its snapshots and the journal records after them, and emits promoted() to start them. the
+// positions are set again as their markets get prices, with the fills and cancels of the records applied. the primary
+// only stands down with fenced() on the claim of a standby that answered its challenge, so a link that only went
+// quiet leaves it trading. set up from getStandbyPath(), "primary <address> <port> <secret>" or
+// "standby <host> <port> <secret>", the primary only listens on address
+//
+class StandbyLink : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Frame
+    {
+        quint8 type{ 0 };
+        quint8 engine_id{ 0 };
+        QByteArray payload;
+    };
+
+    explicit StandbyLink( SpruceOverseer *_overseer, TaskScheduler *scheduler, QObject *parent = nullptr );
+    ~StandbyLink();
+
+    bool readConfig( const QString &path ); // false without the file, or if it's bad
+    void start( const QVector<BaseREST*> &_rests ); // after the settings are loaded, a standby warms the rests' connections
+    bool isPrimary() const { return is_primary; }
+    bool isStandby() const { return !is_primary; }
+    bool isPromoted() const { return is_promoted; }
+    bool isFenced() const { return is_fenced; }
+
+    // the framing, public for tests. parseFrames() returns the bytes it read, or -1 on a bad frame
+    static QByteArray makeFrame( const quint8 type, const quint8 engine_id, const QByteArray &payload = QByteArray() );
+    static qint32 parseFrames( const QByteArray &data, QVector<Frame> &frames );
+
+signals:
+    void promoted(); // the primary stopped, start the rest modules
+    void fenced(); // a standby is taking over, stop trading
+
+private:
+    void onNewConnection();
+    void onDisconnected();
+    void onConnected();
+    void onReadyRead();
+    void onTick();
+    void sendJournals();
+    void sendState();
+    void broadcast( const QByteArray &frame );
+    bool readFrame( const Frame &frame ); // false once the connection is dropped
+    bool readStandbyFrame( QTcpSocket *from, const Frame &frame ); // ^
+    void standDown( const QString &reason );
+    void claim( const qint64 silent_ms );
+    void promote( const QString &reason );
+
+    SpruceOverseer *overseer{ nullptr };
+    ScheduledTask *tick_timer{ nullptr };
+    LinkAuth auth;
+    bool is_primary{ true };
+    bool is_started{ false };
+    quint16 port{ 0 };
+
+    // primary
+    QTcpServer *server{ nullptr };
+    QHostAddress bind_address;
+    QVector<QTcpSocket*> standbys; // the ones that answered our challenge
+    QMap<QTcpSocket*, QByteArray> standby_challenges; // of the ones that didn't yet
+    QMap<QTcpSocket*, QByteArray> standby_buffers;
+    OrderJournalReplica replica; // filled by the engines' journals
+    qint64 last_state_time{ 0 };
+    bool is_fenced{ false };
+
+    // standby
+    QTcpSocket *sck{ nullptr };
+    QString host;
+    QByteArray read_buffer;
+    QByteArray challenge; // ours, for the primary
+    bool is_primary_authed{ false };
+    bool is_challenge_answered{ false }; // the primary drops a claim that comes before our answer
+    QVector<BaseREST*> rests;
+    QMap<qint32/*engine id*/, QMap<QString/*market*/, QByteArray>> snapshots; // the latest of each engine
+    QMap<qint32/*engine id*/, OrderJournalReader*> journal_readers; // keep the ids the primary's journals named
+    QMap<qint32/*engine id*/, QVector<OrderJournalEvent>> journal_tails; // the records after the latest snapshots
+    AsyncSaver *saver{ nullptr }; // the primary's journal records, into our engines' journals
+    qint64 last_frame_time{ 0 }; // 0 until we heard from the primary
+    qint64 last_connect_time{ 0 };
+    qint64 claim_time{ 0 }; // 0 until we claimed
+    bool is_promoted{ false };
+};
+
+#endif // STANDBYLINK_H
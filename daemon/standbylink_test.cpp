@@ -0,0 +1,108 @@
+#include "standbylink_test.h"
+#include "standbylink.h"
+#include "orderjournal.h"
+#include "asyncsaver.h"
+
+#include <QDir>
+#include <QFile>
+#include <QVector>
+
+#include <assert.h>
+
+void StandbyLinkTest::test()
+{
+    /// test the frames round trip, and a frame that isn't all there yet
+    const QByteArray payload( "snapshot bytes" );
+    const QByteArray data = StandbyLink::makeFrame( STANDBY_FRAME_HEARTBEAT, 0 ) +
+                            StandbyLink::makeFrame( STANDBY_FRAME_SNAPSHOTS, 17, payload );
+
+    QVector<StandbyLink::Frame> frames;
+    assert( StandbyLink::parseFrames( data, frames ) == data.size() );
+    assert( frames.size() == 2 );
+    assert( frames.at( 0 ).type == STANDBY_FRAME_HEARTBEAT && frames.at( 0 ).payload.isEmpty() );
+    assert( frames.at( 1 ).type == STANDBY_FRAME_SNAPSHOTS && frames.at( 1 ).engine_id == 17 );
+    assert( frames.at( 1 ).payload == payload );
+
+    frames.clear();
+    assert( StandbyLink::parseFrames( data.left( data.size() -1 ), frames ) == STANDBY_FRAME_HEADER_SIZE );
+    assert( frames.size() == 1 );
+
+    QByteArray bad = StandbyLink::makeFrame( STANDBY_FRAME_JOURNAL, 1 );
+    bad[ 3 ] = char( 0x7f ); // past STANDBY_FRAME_MAX
+    assert( StandbyLink::parseFrames( bad, frames ) == -1 );
+
+    /// test the journal's chunks, a standby only gets them once the ids were named for it
+    const QString path = QDir::tempPath() + QDir::separator() + "standbylink_test.journal";
+    QFile::remove( path );
+
+    AsyncSaver saver;
+    OrderJournalReplica replica;
+    {
+        OrderJournal journal( 1, &saver );
+        journal.setPath( path );
+        journal.setReplica( &replica, 1 );
+
+        OrderJournalEvent event;
+        event.type = ORDER_JOURNAL_SET;
+        event.market = "BTC_DOGE";
+        event.time = 1000;
+        journal.record( event );
+        journal.flush();
+        assert( replica.pending.isEmpty() ); // no standby
+
+        replica.generation.store( 1 );
+        event.time = 2000;
+        journal.record( event );
+        journal.flush();
+        assert( replica.pending.size() == 1 );
+
+        const OrderJournalReplica::Chunk &chunk = replica.pending.at( 0 );
+        assert( chunk.engine_id == 1 && chunk.generation == 1 );
+        assert( quint8( chunk.data.at( 2 ) ) == ORDER_JOURNAL_MARKET ); // named again
+
+        // a standby reads the chunk's records with the ids named in it
+        OrderJournalReader chunk_reader;
+        OrderJournalEvent chunk_event;
+        chunk_reader.feed( chunk.data );
+        assert( chunk_reader.next( chunk_event ) );
+        assert( chunk_event.type == ORDER_JOURNAL_SET && chunk_event.market == "BTC_DOGE" && chunk_event.time == 2000 );
+        assert( !chunk_reader.next( chunk_event ) );
+    }
+
+    saver.waitForDone();
+    QFile::remove( path );
+
+    /// test values past the raw subsatoshi range round trip through the journal
+    {
+        OrderJournal journal( 1, &saver );
+        journal.setPath( path );
+
+        OrderJournalEvent event;
+        event.type = ORDER_JOURNAL_FILL;
+        event.market = "BTC_DOGE";
+        event.order_id = "order1";
+        event.time = 3000;
+        event.price = Coin( "0.0000000123456789" );
+        event.quantity = Coin( "123456.78901234" );
+        event.amount = Coin( "-1000" );
+        event.fee = Coin( "0.00000152" );
+        journal.record( event );
+        journal.flush();
+    }
+
+    saver.waitForDone();
+
+    OrderJournalReader reader;
+    OrderJournalEvent read;
+    assert( reader.open( path ) );
+    assert( reader.next( read ) );
+    assert( read.type == ORDER_JOURNAL_FILL && read.market == "BTC_DOGE" && read.order_id == "order1" );
+    assert( read.price == Coin( "0.0000000123456789" ) );
+    assert( read.quantity == Coin( "123456.78901234" ) );
+    assert( read.amount == Coin( "-1000" ) );
+    assert( read.fee == Coin( "0.00000152" ) );
+    assert( !reader.next( read ) );
+    reader.close();
+
+    QFile::remove( path );
+}
@@ -0,0 +1,9 @@
+#ifndef STANDBYLINK_TEST_H
+#define STANDBYLINK_TEST_H
+
+struct StandbyLinkTest
+{
+    void test();
+};
+
+#endif // STANDBYLINK_TEST_H
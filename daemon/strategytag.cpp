@@ -0,0 +1,49 @@
+#include "strategytag.h"
+
+#include <QHash>
+#include <QVector>
+#include <QReadWriteLock>
+
+// tags are registered from the engine threads and read by the overseer
+static QReadWriteLock strategy_tag_lock;
+static QHash<QString,qint32> strategy_tag_ids;
+static QVector<QString> strategy_tag_strings;
+
+qint32 StrategyTag::getId( const QString &tag )
+{
+    if ( tag.isEmpty() )
+        return -1;
+
+    // look for an existing id first
+    {
+        QReadLocker locker( &strategy_tag_lock );
+        const QHash<QString,qint32>::const_iterator i = strategy_tag_ids.find( tag );
+        if ( i != strategy_tag_ids.end() )
+            return i.value();
+    }
+
+    QWriteLocker locker( &strategy_tag_lock );
+
+    // check again, another thread might have registered it while we were unlocked
+    const QHash<QString,qint32>::const_iterator i = strategy_tag_ids.find( tag );
+    if ( i != strategy_tag_ids.end() )
+        return i.value();
+
+    const qint32 id = strategy_tag_strings.size();
+    strategy_tag_ids.insert( tag, id );
+    strategy_tag_strings += tag;
+
+    return id;
+}
+
+qint32 StrategyTag::findId( const QString &tag )
+{
+    QReadLocker locker( &strategy_tag_lock );
+    return strategy_tag_ids.value( tag, -1 );
+}
+
+QString StrategyTag::getString( const qint32 id )
+{
+    QReadLocker locker( &strategy_tag_lock );
+    return ( id < 0 || id >= strategy_tag_strings.size() ) ? QString() : strategy_tag_strings.at( id );
+}
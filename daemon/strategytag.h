@@ -0,0 +1,20 @@
+#ifndef STRATEGYTAG_H
+#define STRATEGYTAG_H
+
+#include "global.h"
+
+#include <QString>
+
+//
+// StrategyTag, the global strategy tag registry. like markets, each tag gets a compact id the first time it's seen, so
+// positions and spruce compare and bucket them by id instead of hashing tag strings. ids are never reused
+//
+class StrategyTag
+{
+public:
+    static qint32 getId( const QString &tag ); // registers the tag, -1 for an empty one
+    static qint32 findId( const QString &tag ); // -1 if the tag was never registered
+    static QString getString( const qint32 id );
+};
+
+#endif // STRATEGYTAG_H
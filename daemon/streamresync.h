@@ -0,0 +1,102 @@
+#ifndef STREAMRESYNC_H
+#define STREAMRESYNC_H
+
+#include "global.h"
+
+#include <QString>
+#include <QVector>
+
+//
+// StreamResync, brings a stream's state back after a reconnect without waiting for the next slow poll. when the feed
+// comes back up we start buffering its updates and request one rest snapshot. the snapshot holds everything up to
+// when it was sent, so once it's applied the buffered updates received after that are replayed in the order they
+// came in, and the feed is live again. updates received before the snapshot was sent are dropped, it has them
+//
+class StreamResync
+{
+public:
+    static const qint32 BUFFER_MAX = 4096;
+    static const qint64 SNAPSHOT_TIMEOUT = 30000; // ms, ask again if the snapshot hasn't been applied by then
+
+    // the feed is back up, buffer from now on. returns false if we're already waiting for a snapshot
+    bool begin( const qint64 current_time )
+    {
+        if ( is_buffering )
+            return false;
+
+        is_buffering = true;
+        buffer.clear();
+        min_snapshot_time = current_time;
+        snapshot_request_time = current_time;
+        return true;
+    }
+
+    // the feed went down, whatever we had is useless
+    void cancel()
+    {
+        is_buffering = false;
+        buffer.clear();
+    }
+
+    bool isBuffering() const { return is_buffering; }
+
+    // the snapshot went missing or was too stale to apply, the caller should request another
+    bool isSnapshotLate( const qint64 current_time ) const { return is_buffering && current_time - snapshot_request_time >= SNAPSHOT_TIMEOUT; }
+    void setSnapshotRequested( const qint64 current_time ) { snapshot_request_time = current_time; }
+
+    // true if the message was buffered and shouldn't be applied yet
+    bool add( const qint64 received_time, const QString &message )
+    {
+        if ( !is_buffering )
+            return false;
+
+        // drop the oldest, only a snapshot sent after it was received has it now
+        if ( buffer.size() >= BUFFER_MAX )
+        {
+            min_snapshot_time = qMax( min_snapshot_time, buffer.first().received_time );
+            buffer.removeFirst();
+            dropped_count++;
+        }
+
+        buffer += Message{ received_time, message };
+        return true;
+    }
+
+    // a snapshot sent at snapshot_time was applied, fills replay with the updates to apply on top of it. returns
+    // false if it was sent before the feed came back, or before an update we dropped, and we keep buffering
+    bool finish( const qint64 snapshot_time, QVector<QString> &replay )
+    {
+        if ( !is_buffering || snapshot_time < min_snapshot_time )
+            return false;
+
+        replay.clear();
+        for ( QVector<Message>::const_iterator i = buffer.begin(); i != buffer.end(); i++ )
+            if ( i->received_time >= snapshot_time )
+                replay += i->message;
+
+        is_buffering = false;
+        buffer.clear();
+        resync_count++;
+        return true;
+    }
+
+    qint32 getBufferedCount() const { return buffer.size(); }
+    qint64 getResyncCount() const { return resync_count; }
+    qint64 getDroppedCount() const { return dropped_count; }
+
+private:
+    struct Message
+    {
+        qint64 received_time{ 0 };
+        QString message;
+    };
+
+    bool is_buffering{ false };
+    QVector<Message> buffer;
+    qint64 min_snapshot_time{ 0 }; // the snapshot has to be sent at or after this to cover the gap
+    qint64 snapshot_request_time{ 0 };
+    qint64 resync_count{ 0 };
+    qint64 dropped_count{ 0 };
+};
+
+#endif // STREAMRESYNC_H
@@ -0,0 +1,312 @@
+#include "global.h"
+#include "coinamount.h"
+
+#include <QCoreApplication>
+#include <QProcess>
+#include <QTemporaryFile>
+#include <QThread>
+#include <QFile>
+#include <QTextStream>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QRegularExpression>
+
+#include <algorithm>
+#include <functional>
+
+// trader-sweep: runs trader-replay over a grid of settings, several at a time, and prints them ranked by pnl.
+// usage: ./trader-sweep [-j <jobs>] [--from <time>] [--to <time>] [--markets <market,...>] <bittrex|binance|poloniex|waves>
+//                       <sweep file> <segment file> [<segment file>...]
+//
+// the sweep file is a trader-replay commands file where any argument can be a list of values in braces, like
+// 'setspruceordergreed {0.90,0.95,0.99}'. every combination of the lists is one run. each run is its own
+// trader-replay process, so the engines, spruce and the replay clock of one run never see another's. jobs defaults
+// to one for each core.
+
+namespace
+{
+
+struct SweepDimension
+{
+    qint32 line{ 0 }; // in the sweep file
+    qint32 arg{ 0 }; // in that line
+    QStringList values;
+};
+
+struct SweepRun
+{
+    QStringList values; // for each dimension
+    QString commands;
+    QTemporaryFile *file{ nullptr };
+    QProcess *process{ nullptr };
+
+    bool is_done{ false };
+    bool is_ok{ false };
+    Coin pnl, volume;
+    quint64 orders{ 0 }, fills{ 0 };
+};
+
+bool loadSweep( const QString &path, QVector<QStringList> &lines, QVector<SweepDimension> &dimensions )
+{
+    QFile file( path );
+    if ( !file.open( QIODevice::ReadOnly | QIODevice::Text ) )
+    {
+        kDebug() << "trader-sweep error: couldn't open" << path;
+        return false;
+    }
+
+    static const QRegularExpression whitespace( "\\s+" );
+
+    QTextStream in( &file );
+    while ( !in.atEnd() )
+    {
+        const QStringList args = in.readLine().trimmed().split( whitespace, QString::SkipEmptyParts );
+        if ( args.isEmpty() )
+            continue;
+
+        for ( int i = 0; i < args.size(); i++ )
+        {
+            const QString &arg = args.at( i );
+            if ( !arg.startsWith( '{' ) || !arg.endsWith( '}' ) )
+                continue;
+
+            SweepDimension dimension;
+            dimension.line = lines.size();
+            dimension.arg = i;
+            dimension.values = arg.mid( 1, arg.size() -2 ).split( ',', QString::SkipEmptyParts );
+
+            if ( dimension.values.isEmpty() )
+            {
+                kDebug() << "trader-sweep error: empty value list in" << args.join( ' ' );
+                return false;
+            }
+
+            dimensions += dimension;
+        }
+
+        lines += args;
+    }
+
+    return true;
+}
+
+// every combination of the dimension values, the last dimension changing fastest
+QVector<SweepRun*> buildRuns( const QVector<QStringList> &lines, const QVector<SweepDimension> &dimensions )
+{
+    QVector<SweepRun*> runs;
+    QVector<int> picks( dimensions.size(), 0 );
+
+    while ( true )
+    {
+        SweepRun *run = new SweepRun();
+        QVector<QStringList> run_lines = lines;
+
+        for ( int i = 0; i < dimensions.size(); i++ )
+        {
+            const SweepDimension &dimension = dimensions.at( i );
+            const QString &value = dimension.values.at( picks.at( i ) );
+
+            run_lines[ dimension.line ][ dimension.arg ] = value;
+            run->values += value;
+        }
+
+        for ( QVector<QStringList>::const_iterator i = run_lines.begin(); i != run_lines.end(); i++ )
+            run->commands += i->join( ' ' ) + '\n';
+
+        runs += run;
+
+        // next combination
+        int k = dimensions.size() -1;
+        while ( k >= 0 && ++picks[ k ] == dimensions.at( k ).values.size() )
+            picks[ k-- ] = 0;
+
+        if ( k < 0 )
+            break;
+    }
+
+    return runs;
+}
+
+// reads the 'summary' line trader-replay prints last
+void parseRun( SweepRun *run )
+{
+    const QStringList lines = QString::fromUtf8( run->process->readAllStandardError() ).split( '\n' );
+
+    for ( QStringList::const_iterator i = lines.end(); i != lines.begin(); )
+    {
+        i--;
+
+        const int start = i->indexOf( "summary pnl " );
+        if ( start < 0 )
+            continue;
+
+        const QStringList args = i->mid( start ).split( ' ', QString::SkipEmptyParts );
+        if ( args.size() < 9 )
+            break;
+
+        run->pnl = Coin( args.at( 2 ) );
+        run->volume = Coin( args.at( 4 ) );
+        run->orders = args.at( 6 ).toULongLong();
+        run->fills = args.at( 8 ).toULongLong();
+        run->is_ok = true;
+        break;
+    }
+}
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication a( argc, argv );
+
+    QStringList args = QCoreApplication::arguments();
+    args.removeFirst();
+
+    int jobs = QThread::idealThreadCount();
+    if ( args.size() >= 2 && args.at( 0 ) == "-j" )
+    {
+        jobs = std::max( args.at( 1 ).toInt(), 1 );
+        args = args.mid( 2 );
+    }
+
+    // the replay window, see trader-replay
+    QStringList replay_options;
+    while ( args.size() >= 2 && ( args.at( 0 ) == "--from" || args.at( 0 ) == "--to" || args.at( 0 ) == "--markets" ) )
+    {
+        replay_options += args.mid( 0, 2 );
+        args = args.mid( 2 );
+    }
+
+    if ( args.size() < 3 )
+    {
+        kDebug() << "usage: trader-sweep [-j <jobs>] [--from <time>] [--to <time>] [--markets <market,...>] <bittrex|binance|poloniex|waves> <sweep file> <segment file> [<segment file>...]";
+        return 1;
+    }
+
+    const QString exchange = args.at( 0 );
+    const QStringList segments = args.mid( 2 );
+    const QString replay_path = QCoreApplication::applicationDirPath() + "/trader-replay";
+
+    QVector<QStringList> lines;
+    QVector<SweepDimension> dimensions;
+    if ( !loadSweep( args.at( 1 ), lines, dimensions ) )
+        return 1;
+
+    QVector<SweepRun*> runs = buildRuns( lines, dimensions );
+    kDebug() << "trader-sweep:" << runs.size() << "runs," << jobs << "at a time";
+
+    // only the summary line is read, so leave the replay's log lines plain
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    environment.insert( "QT_MESSAGE_PATTERN", "%{message}" );
+
+    int next_run = 0, running = 0, done = 0;
+
+    std::function<void()> startNext = [&]()
+    {
+        while ( running < jobs && next_run < runs.size() )
+        {
+            SweepRun *run = runs.at( next_run++ );
+
+            run->file = new QTemporaryFile();
+            if ( !run->file->open() )
+            {
+                kDebug() << "trader-sweep error: couldn't create a commands file";
+                run->is_done = true;
+                done++;
+                continue;
+            }
+
+            run->file->write( run->commands.toUtf8() );
+            run->file->flush();
+
+            run->process = new QProcess();
+            run->process->setProcessEnvironment( environment );
+
+            QObject::connect( run->process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>( &QProcess::finished ),
+                              [&, run]( int, QProcess::ExitStatus )
+            {
+                parseRun( run );
+                run->is_done = true;
+                running--;
+                done++;
+
+                kDebug() << QString( "[%1/%2] %3 %4" )
+                            .arg( done )
+                            .arg( runs.size() )
+                            .arg( run->values.join( ' ' ) )
+                            .arg( run->is_ok ? QString( "pnl %1" ).arg( QString( run->pnl ) ) : QString( "failed" ) );
+
+                startNext();
+            } );
+
+            // finished() never comes if it couldn't start
+            QObject::connect( run->process, &QProcess::errorOccurred, [&, run]( QProcess::ProcessError error )
+            {
+                if ( error != QProcess::FailedToStart )
+                    return;
+
+                kDebug() << "trader-sweep error: couldn't start" << replay_path;
+                run->is_done = true;
+                running--;
+                done++;
+
+                startNext();
+            } );
+
+            running++;
+            run->process->start( replay_path, QStringList() << replay_options << exchange << run->file->fileName() << segments );
+        }
+
+        if ( done == runs.size() )
+            QCoreApplication::quit();
+    };
+
+    startNext();
+
+    if ( done < runs.size() )
+        a.exec();
+
+    // best first
+    std::stable_sort( runs.begin(), runs.end(), []( SweepRun *const &x, SweepRun *const &y )
+    {
+        if ( x->is_ok != y->is_ok )
+            return x->is_ok;
+
+        return x->pnl > y->pnl;
+    } );
+
+    QStringList header;
+    for ( QVector<SweepDimension>::const_iterator i = dimensions.begin(); i != dimensions.end(); i++ )
+        header += lines.at( i->line ).at( 0 );
+
+    kDebug() << QString( "%1 %2 %3 %4 %5 %6" )
+                .arg( "rank", -5 )
+                .arg( "pnl", -20 )
+                .arg( "turnover", -20 )
+                .arg( "orders", -8 )
+                .arg( "fills", -8 )
+                .arg( header.join( ' ' ) );
+
+    for ( int i = 0; i < runs.size(); i++ )
+    {
+        const SweepRun *run = runs.at( i );
+
+        kDebug() << QString( "%1 %2 %3 %4 %5 %6" )
+                    .arg( i +1, -5 )
+                    .arg( run->is_ok ? QString( run->pnl ) : QString( "failed" ), -20 )
+                    .arg( QString( run->volume ), -20 )
+                    .arg( run->orders, -8 )
+                    .arg( run->fills, -8 )
+                    .arg( run->values.join( ' ' ) );
+    }
+
+    for ( QVector<SweepRun*>::const_iterator i = runs.begin(); i != runs.end(); i++ )
+    {
+        delete (*i)->process;
+        delete (*i)->file;
+        delete *i;
+    }
+
+    return 0;
+}
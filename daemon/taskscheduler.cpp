@@ -0,0 +1,284 @@
+#include "taskscheduler.h"
+
+#include <QTimer>
+#include <QtMath>
+
+#include <algorithm>
+#include <limits>
+
+static const qint64 COALESCE_TIME = 50; // default, see TaskScheduler::setCoalesceTime()
+static const qint64 BUSY_RETRY_TIME = 1000; // a task waiting out the busy check looks again this often, at most
+
+void ScheduledTask::start( const qint64 _interval_ms )
+{
+    interval_ms = qMax( qint64( 0 ), _interval_ms );
+    start();
+}
+
+void ScheduledTask::start()
+{
+    scheduler->schedule( this, scheduler->getTime() );
+    scheduler->arm();
+}
+
+void ScheduledTask::stop()
+{
+    if ( deadline < 0 )
+        return;
+
+    deadline = -1;
+    scheduler->arm();
+}
+
+void ScheduledTask::setInterval( const qint64 _interval_ms )
+{
+    interval_ms = qMax( qint64( 0 ), _interval_ms );
+
+    if ( isActive() )
+        start();
+}
+
+qint64 ScheduledTask::remainingTime() const
+{
+    if ( deadline < 0 )
+        return -1;
+
+    return qMax( qint64( 0 ), deadline - scheduler->getTime() );
+}
+
+TaskScheduler::TaskScheduler( QObject *parent )
+    : QObject( parent ),
+      coalesce_time( COALESCE_TIME )
+{
+    clock.start();
+
+    wake_timer = new QTimer( this );
+    wake_timer->setSingleShot( true );
+    connect( wake_timer, &QTimer::timeout, this, &TaskScheduler::onWake );
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    wake_timer->stop();
+
+    while ( tasks.size() > 0 )
+        delete tasks.takeLast();
+}
+
+ScheduledTask *TaskScheduler::addTask( QObject *context, const QString &name, const std::function<void()> &callback,
+                                       const quint8 priority, const qreal jitter, const quint8 flags )
+{
+    ScheduledTask *task = new ScheduledTask();
+    task->scheduler = this;
+    task->context = context;
+    task->callback = callback;
+    task->name = name;
+    task->priority = priority;
+    task->jitter = qBound( 0., jitter, 1. );
+    task->flags = flags;
+
+    tasks += task;
+
+    // the callback usually calls into context
+    if ( context )
+        connect( context, &QObject::destroyed, this, [this]( QObject *obj ) { removeTasks( obj ); } );
+
+    return task;
+}
+
+qint64 TaskScheduler::getTime() const
+{
+    return manual_time >= 0 ? manual_time : clock.elapsed();
+}
+
+qint32 TaskScheduler::runDue( const qint64 current_time )
+{
+    is_running = true;
+
+    // the due tasks, and the nearly due ones that can share the wakeup
+    QVector<ScheduledTask*> due;
+    for ( QVector<ScheduledTask*>::const_iterator i = tasks.constBegin(); i != tasks.constEnd(); i++ )
+    {
+        ScheduledTask *const &task = *i;
+
+        if ( task->isActive() && task->deadline <= current_time + getSlack( task ) )
+            due += task;
+    }
+
+    std::stable_sort( due.begin(), due.end(), []( const ScheduledTask *a, const ScheduledTask *b )
+    {
+        return a->priority != b->priority ? a->priority < b->priority : a->deadline < b->deadline;
+    } );
+
+    qint32 ct_ran = 0;
+    for ( QVector<ScheduledTask*>::const_iterator i = due.constBegin(); i != due.constEnd(); i++ )
+    {
+        ScheduledTask *const &task = *i;
+
+        // a task that ran before this one stopped or restarted it, or its context went away
+        if ( task->is_removed || !task->isActive() || task->deadline > current_time + getSlack( task ) )
+            continue;
+
+        // it would only yield to flow control, look again soon instead of after a whole interval
+        if ( ( task->flags & TASK_SKIP_IF_BUSY ) && busy_check && busy_check() )
+        {
+            task->deadline = current_time + qMin( qMax( task->interval_ms, qint64( 1 ) ), BUSY_RETRY_TIME );
+            task->skip_count++;
+            skip_count++;
+            continue;
+        }
+
+        // set the next run first, so the callback can restart or stop it
+        if ( task->flags & TASK_SINGLE_SHOT )
+            task->deadline = -1;
+        else
+            schedule( task, current_time );
+
+        task->run_count++;
+        run_count++;
+        ct_ran++;
+
+        if ( task->callback )
+            task->callback();
+    }
+
+    is_running = false;
+
+    // drop the tasks whose context went away in a callback
+    for ( qint32 i = tasks.size() -1; i >= 0; i-- )
+    {
+        if ( !tasks.at( i )->is_removed )
+            continue;
+
+        delete tasks.at( i );
+        tasks.remove( i );
+    }
+
+    arm();
+
+    return ct_ran;
+}
+
+qint64 TaskScheduler::getNextDeadline() const
+{
+    qint64 next = -1;
+
+    for ( QVector<ScheduledTask*>::const_iterator i = tasks.constBegin(); i != tasks.constEnd(); i++ )
+        if ( (*i)->isActive() && ( next < 0 || (*i)->deadline < next ) )
+            next = (*i)->deadline;
+
+    return next;
+}
+
+void TaskScheduler::printTasks() const
+{
+    const qint64 current_time = getTime();
+
+    kDebug() << "scheduler wakeups:" << wake_count << "runs:" << run_count << "skipped while busy:" << skip_count;
+
+    for ( QVector<ScheduledTask*>::const_iterator i = tasks.constBegin(); i != tasks.constEnd(); i++ )
+    {
+        const ScheduledTask *const &task = *i;
+
+        kDebug() << QString( "  %1 priority %2 interval %3 due %4 runs %5 skipped %6" )
+                    .arg( task->name, -20 )
+                    .arg( task->priority )
+                    .arg( task->interval_ms, -8 )
+                    .arg( task->isActive() ? QString::number( task->deadline - current_time ) : QString( "-" ), -8 )
+                    .arg( task->run_count, -8 )
+                    .arg( task->skip_count );
+    }
+}
+
+void TaskScheduler::onWake()
+{
+    wake_count++;
+    armed_deadline = -1;
+    runDue( getTime() );
+}
+
+void TaskScheduler::schedule( ScheduledTask *const &task, const qint64 current_time )
+{
+    qint64 offset = 0;
+
+    // spread the runs over +/- jitter of the interval, so tasks with the same interval don't stay on the same turn
+    if ( task->jitter > 0. && !( task->flags & TASK_PRECISE ) )
+        offset = qRound64( task->interval_ms * task->jitter * ( getRandom() / 2147483648. - 1. ) );
+
+    task->deadline = current_time + qMax( qint64( 0 ), task->interval_ms + offset );
+}
+
+void TaskScheduler::arm()
+{
+    // runDue() arms once it's done
+    if ( is_running )
+        return;
+
+    const ScheduledTask *next = nullptr;
+    for ( QVector<ScheduledTask*>::const_iterator i = tasks.constBegin(); i != tasks.constEnd(); i++ )
+    {
+        const ScheduledTask *const &task = *i;
+
+        // a precise task wins a tie, so the wakeup is precise
+        if ( task->isActive() && ( !next || task->deadline < next->deadline ||
+                                   ( task->deadline == next->deadline && ( task->flags & TASK_PRECISE ) ) ) )
+            next = task;
+    }
+
+    if ( !next )
+    {
+        wake_timer->stop();
+        armed_deadline = -1;
+        return;
+    }
+
+    // already armed for it, wakeSendQueue() and the like restart tasks often
+    if ( wake_timer->isActive() && armed_deadline == next->deadline )
+        return;
+
+    armed_deadline = next->deadline;
+    wake_timer->setTimerType( ( next->flags & TASK_PRECISE ) ? Qt::PreciseTimer : Qt::CoarseTimer );
+    wake_timer->start( int( qBound( qint64( 0 ), next->deadline - getTime(), qint64( std::numeric_limits<int>::max() ) ) ) );
+}
+
+qint64 TaskScheduler::getSlack( const ScheduledTask *const &task ) const
+{
+    if ( task->flags & TASK_PRECISE )
+        return 0;
+
+    return qMin( coalesce_time, task->interval_ms / 10 );
+}
+
+void TaskScheduler::removeTasks( QObject *context )
+{
+    for ( qint32 i = tasks.size() -1; i >= 0; i-- )
+    {
+        ScheduledTask *task = tasks.at( i );
+
+        if ( task->context != context )
+            continue;
+
+        task->deadline = -1;
+
+        // runDue() still has it, it drops it when it's done
+        if ( is_running )
+        {
+            task->is_removed = true;
+            continue;
+        }
+
+        delete task;
+        tasks.remove( i );
+    }
+
+    arm();
+}
+
+quint32 TaskScheduler::getRandom()
+{
+    // xorshift32
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
@@ -0,0 +1,126 @@
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+#include "global.h"
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QElapsedTimer>
+
+#include <functional>
+
+class QTimer;
+class TaskScheduler;
+
+// when several tasks are due on the same wakeup, the lower priority runs first
+static const quint8 TASK_PRIORITY_SEND = 0;
+static const quint8 TASK_PRIORITY_TIMEOUTS = 1;
+static const quint8 TASK_PRIORITY_ORDERS = 2;
+static const quint8 TASK_PRIORITY_TICKER = 3;
+static const quint8 TASK_PRIORITY_DC = 4;
+static const quint8 TASK_PRIORITY_HOUSEKEEPING = 5;
+
+// task flags
+static const quint8 TASK_SKIP_IF_BUSY = 0x1; // waits out the busy check instead of running, see TaskScheduler::setBusyCheck()
+static const quint8 TASK_PRECISE = 0x2; // never runs early to share a wakeup, and the wakeup for it is precise
+static const quint8 TASK_SINGLE_SHOT = 0x4;
+
+//
+// ScheduledTask, one job on a TaskScheduler. it has the calls of the QTimer it replaces, so the code that starts,
+// stops and reads the intervals of the poll timers didn't change
+//
+class ScheduledTask
+{
+public:
+    void setCallback( const std::function<void()> &_callback ) { callback = _callback; }
+
+    void start( const qint64 interval_ms ); // sets the interval, then starts
+    void start(); // the next run is an interval from now, restarts an active task like QTimer
+    void stop();
+    void setInterval( const qint64 interval_ms ); // an active task is restarted
+    qint64 interval() const { return interval_ms; }
+    bool isActive() const { return deadline >= 0; }
+    qint64 remainingTime() const; // ms until it's due, -1 if it isn't active
+
+    const QString &getName() const { return name; }
+    quint8 getPriority() const { return priority; }
+    qint64 getRunCount() const { return run_count; }
+    qint64 getSkipCount() const { return skip_count; }
+
+private:
+    friend class TaskScheduler;
+    explicit ScheduledTask() {}
+
+    TaskScheduler *scheduler{ nullptr };
+    QObject *context{ nullptr }; // the task goes away with it
+    std::function<void()> callback;
+    QString name;
+    qint64 interval_ms{ 0 };
+    qint64 deadline{ -1 }; // on the scheduler clock, -1 when stopped
+    qreal jitter{ 0. }; // of the interval, each run is up to this much early or late
+    quint8 priority{ TASK_PRIORITY_HOUSEKEEPING };
+    quint8 flags{ 0 };
+    bool is_removed{ false };
+    qint64 run_count{ 0 };
+    qint64 skip_count{ 0 };
+};
+
+//
+// TaskScheduler, the periodic jobs of an engine and its rest interface behind one timer, armed for the earliest
+// deadline. tasks that are nearly due when it wakes run on the same wakeup in priority order instead of waking it
+// again, the periodic ones are jittered so they drift apart instead of piling onto the same turn, and the polls that
+// would only yield to flow control are put off until it clears. the callbacks take their own locks like the timer
+// slots did
+//
+class TaskScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TaskScheduler( QObject *parent = nullptr );
+    ~TaskScheduler();
+
+    // the task is stopped until start(), and goes away with context
+    ScheduledTask *addTask( QObject *context, const QString &name, const std::function<void()> &callback,
+                            const quint8 priority, const qreal jitter = 0., const quint8 flags = 0 );
+
+    void setBusyCheck( const std::function<bool()> &check ) { busy_check = check; } // true while TASK_SKIP_IF_BUSY tasks wait
+    void setCoalesceTime( const qint64 ms ) { coalesce_time = ms; } // how early a task can run to share a wakeup
+    void setSeed( const quint32 seed ) { random_state = seed != 0 ? seed : 1; }
+    void setManualTime( const qint64 ms ) { manual_time = ms; } // for tests, -1 follows the clock again
+
+    qint64 getTime() const; // ms on the scheduler clock
+    qint32 runDue( const qint64 current_time ); // runs what's due, returns how many ran. the wakeups call it
+    qint64 getNextDeadline() const; // -1 if nothing is scheduled
+
+    qint64 getWakeCount() const { return wake_count; }
+    qint64 getRunCount() const { return run_count; }
+    qint64 getSkipCount() const { return skip_count; }
+    void printTasks() const;
+
+private:
+    friend class ScheduledTask;
+    void onWake();
+    void schedule( ScheduledTask *const &task, const qint64 current_time ); // next periodic deadline, with jitter
+    void arm(); // the timer for the earliest deadline
+    qint64 getSlack( const ScheduledTask *const &task ) const;
+    void removeTasks( QObject *context );
+    quint32 getRandom();
+
+    QVector<ScheduledTask*> tasks;
+    QTimer *wake_timer{ nullptr };
+    QElapsedTimer clock;
+    std::function<bool()> busy_check;
+    qint64 coalesce_time;
+    qint64 manual_time{ -1 };
+    qint64 armed_deadline{ -1 };
+    quint32 random_state{ 1 };
+    bool is_running{ false }; // in runDue(), it arms once at the end
+
+    qint64 wake_count{ 0 };
+    qint64 run_count{ 0 };
+    qint64 skip_count{ 0 };
+};
+
+#endif // TASKSCHEDULER_H
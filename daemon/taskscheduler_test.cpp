@@ -0,0 +1,78 @@
+#include "taskscheduler_test.h"
+#include "taskscheduler.h"
+
+#include <QObject>
+#include <QStringList>
+
+#include <functional>
+
+#include <assert.h>
+
+void TaskSchedulerTest::test()
+{
+    TaskScheduler scheduler;
+    scheduler.setManualTime( 0 );
+
+    // the wakeups at a given time
+    const std::function<qint32( qint64 )> run_at = [&scheduler]( const qint64 time ) { scheduler.setManualTime( time ); return scheduler.runDue( time ); };
+
+    QStringList ran;
+    bool is_busy = false;
+    scheduler.setBusyCheck( [&is_busy]() { return is_busy; } );
+
+    ScheduledTask *poll = scheduler.addTask( nullptr, "poll", [&ran]() { ran += "poll"; }, TASK_PRIORITY_TICKER, 0., TASK_SKIP_IF_BUSY );
+    ScheduledTask *send = scheduler.addTask( nullptr, "send", [&ran]() { ran += "send"; }, TASK_PRIORITY_SEND );
+    ScheduledTask *wake = scheduler.addTask( nullptr, "wake", [&ran]() { ran += "wake"; }, TASK_PRIORITY_SEND, 0., TASK_PRECISE | TASK_SINGLE_SHOT );
+    assert( !poll->isActive() && scheduler.getNextDeadline() == -1 );
+
+    /// test coalescing, the nearly due tasks share the wakeup in priority order
+    poll->start( 1000 );
+    send->start( 1020 );
+    assert( scheduler.getNextDeadline() == 1000 );
+    assert( run_at( 990 ) == 2 );
+    assert( ran == QStringList() << "send" << "poll" );
+    assert( poll->remainingTime() == 1000 && send->remainingTime() == 1020 );
+
+    /// test precise tasks, they don't run early and run once
+    ran.clear();
+    wake->start( 100 );
+    assert( run_at( 1089 ) == 0 );
+    assert( run_at( 1090 ) == 1 && ran == QStringList() << "wake" );
+    assert( !wake->isActive() && run_at( 1190 ) == 0 );
+
+    /// test skip if busy, the poll looks again soon instead of after its interval
+    ran.clear();
+    send->stop();
+    is_busy = true;
+    assert( run_at( 2000 ) == 0 && ran.isEmpty() );
+    assert( poll->getSkipCount() == 1 && poll->isActive() );
+    is_busy = false;
+    assert( run_at( 2999 ) == 1 && ran == QStringList() << "poll" );
+
+    /// test the interval change restarts it
+    scheduler.setManualTime( 5000 );
+    poll->setInterval( 3000 );
+    assert( poll->remainingTime() == 3000 );
+
+    /// test jitter, the runs stay within it and don't all land on the interval
+    ScheduledTask *jittered = scheduler.addTask( nullptr, "jittered", nullptr, TASK_PRIORITY_HOUSEKEEPING, 0.1 );
+    bool is_spread = false;
+    for ( int i = 0; i < 20; i++ )
+    {
+        jittered->start( 10000 );
+        const qint64 remaining = jittered->remainingTime();
+        assert( remaining >= 9000 && remaining <= 11000 );
+        is_spread |= remaining != 10000;
+    }
+    assert( is_spread );
+
+    /// test the tasks go away with their context
+    QObject *context = new QObject();
+    ScheduledTask *owned = scheduler.addTask( context, "owned", nullptr, TASK_PRIORITY_HOUSEKEEPING );
+    owned->start( 1 );
+    poll->stop();
+    jittered->stop();
+    assert( scheduler.getNextDeadline() == 5001 );
+    delete context;
+    assert( scheduler.getNextDeadline() == -1 );
+}
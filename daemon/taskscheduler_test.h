@@ -0,0 +1,9 @@
+#ifndef TASKSCHEDULER_TEST_H
+#define TASKSCHEDULER_TEST_H
+
+struct TaskSchedulerTest
+{
+    void test();
+};
+
+#endif // TASKSCHEDULER_TEST_H
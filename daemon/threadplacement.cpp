@@ -0,0 +1,189 @@
+#include "threadplacement.h"
+
+#include <QFile>
+#include <QHash>
+#include <QVector>
+#include <QStringList>
+#include <QThread>
+
+#include <atomic>
+
+#if defined( Q_OS_LINUX )
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace
+{
+
+static const char *const ROLE_NAMES[] = { "main", "engine", "parser", "solver", "batch" };
+static const QString ANY_ENGINE = "*";
+
+struct Placement
+{
+    QVector<qint32> cpus;
+    qint32 fifo_priority{ 0 }; // 0 keeps the default scheduler
+    qint32 nice{ 0 };
+    bool has_nice{ false };
+};
+
+// written by load() before the threads start, only read after is_loaded
+static QHash<QString/*engine name, or empty*/, Placement> placements[ ThreadPlacement::ROLE_COUNT ];
+static std::atomic<bool> is_loaded( false );
+static std::atomic<bool> is_logged[ ThreadPlacement::ROLE_COUNT ]; // the solver pool's threads come and go, say it once
+
+// the pool threads apply their role once
+static thread_local qint32 applied_role = -1;
+
+bool parseCpus( const QString &spec, QVector<qint32> &cpus )
+{
+    const QStringList ranges = spec.split( ',', QString::SkipEmptyParts );
+    for ( QStringList::const_iterator i = ranges.begin(); i != ranges.end(); i++ )
+    {
+        bool ok_lo = false, ok_hi = false;
+        const qint32 lo = i->section( '-', 0, 0 ).toInt( &ok_lo );
+        const qint32 hi = i->contains( '-' ) ? i->section( '-', 1, 1 ).toInt( &ok_hi ) : lo;
+
+        if ( !ok_lo || ( i->contains( '-' ) && !ok_hi ) || lo < 0 || hi < lo || hi >= 1024 )
+            return false;
+
+        for ( qint32 cpu = lo; cpu <= hi; cpu++ )
+            if ( !cpus.contains( cpu ) )
+                cpus += cpu;
+    }
+
+    return !cpus.isEmpty();
+}
+
+void applyPlacement( const Placement &placement, const QString &label, const bool verbose )
+{
+#if defined( Q_OS_LINUX )
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    for ( QVector<qint32>::const_iterator i = placement.cpus.begin(); i != placement.cpus.end(); i++ )
+        CPU_SET( *i, &set );
+
+    const int affinity_error = pthread_setaffinity_np( pthread_self(), sizeof( set ), &set );
+    if ( affinity_error != 0 && verbose )
+        kDebug() << "local warning: couldn't pin the" << label << "thread to cpus" << placement.cpus << ":" << strerror( affinity_error );
+
+    // realtime needs CAP_SYS_NICE or an rtprio limit, without it the thread keeps running as it was
+    if ( placement.fifo_priority > 0 )
+    {
+        sched_param param;
+        std::memset( &param, 0, sizeof( param ) );
+        param.sched_priority = placement.fifo_priority;
+
+        const int sched_error = pthread_setschedparam( pthread_self(), SCHED_FIFO, &param );
+        if ( sched_error != 0 && verbose )
+            kDebug() << "local warning: couldn't set SCHED_FIFO" << placement.fifo_priority << "for the" << label << "thread:" << strerror( sched_error );
+    }
+
+    // nice is per thread on linux, by its tid
+    if ( placement.has_nice && setpriority( PRIO_PROCESS, id_t( syscall( SYS_gettid ) ), placement.nice ) != 0 && verbose )
+        kDebug() << "local warning: couldn't set nice" << placement.nice << "for the" << label << "thread:" << strerror( errno );
+
+    if ( affinity_error == 0 && verbose )
+        kDebug() << "[ThreadPlacement]" << label << "thread on cpus" << placement.cpus
+                 << ( placement.fifo_priority > 0 ? QString( "fifo %1" ).arg( placement.fifo_priority ) : QString() );
+#else
+    Q_UNUSED( placement )
+    if ( verbose )
+        kDebug() << "local warning: thread placement is only supported on linux, the" << label << "thread runs as it was";
+#endif
+}
+
+} // namespace
+
+bool ThreadPlacement::load( const QString &path )
+{
+    QFile loadfile( path );
+    if ( !loadfile.open( QIODevice::ReadOnly | QIODevice::Text ) )
+        return false;
+
+    const qint32 cpu_count = QThread::idealThreadCount();
+    bool ok = true;
+
+    const QStringList lines = QString::fromUtf8( loadfile.readAll() ).split( '\n' );
+    for ( QStringList::const_iterator i = lines.begin(); i != lines.end(); i++ )
+    {
+        const QString line = i->section( QChar( '#' ), 0, 0 ).simplified();
+        if ( line.isEmpty() )
+            continue;
+
+        QStringList args = line.split( ' ' );
+        const QString role_name = args.takeFirst().toLower();
+
+        qint32 role = -1;
+        for ( qint32 r = 0; r < ROLE_COUNT; r++ )
+            if ( role_name == ROLE_NAMES[ r ] )
+                role = r;
+
+        // the engines are named like their loop probes, "waves" or "waves:1"
+        const QString engine_name = ( role == ROLE_ENGINE && !args.isEmpty() ) ? args.takeFirst().toLower() : QString();
+
+        Placement placement;
+        bool is_bad = role < 0 || ( role == ROLE_ENGINE && engine_name.isEmpty() ) ||
+                      args.isEmpty() || !parseCpus( args.takeFirst(), placement.cpus );
+
+        while ( !is_bad && args.size() >= 2 )
+        {
+            const QString option = args.takeFirst().toLower();
+            bool is_number = false;
+            const qint32 value = args.takeFirst().toInt( &is_number );
+
+            if ( option == "fifo" && is_number && value >= 1 && value <= 99 )
+                placement.fifo_priority = value;
+            else if ( option == "nice" && is_number && value >= -20 && value <= 19 )
+            {
+                placement.nice = value;
+                placement.has_nice = true;
+            }
+            else
+                is_bad = true;
+        }
+
+        if ( is_bad || !args.isEmpty() )
+        {
+            kDebug() << "local warning: bad thread placement" << line << "in" << loadfile.fileName();
+            ok = false;
+            continue;
+        }
+
+        for ( QVector<qint32>::const_iterator c = placement.cpus.begin(); c != placement.cpus.end(); c++ )
+            if ( *c >= cpu_count )
+                kDebug() << "local warning: cpu" << *c << "in" << line << "isn't one of our" << cpu_count;
+
+        placements[ role ].insert( engine_name, placement );
+    }
+
+    is_loaded.store( true, std::memory_order_release );
+
+    kDebug() << "[ThreadPlacement] read" << loadfile.fileName();
+    return ok;
+}
+
+void ThreadPlacement::apply( const Role role, const QString &engine_name )
+{
+    // a thread that started before load() asks again later
+    if ( role >= ROLE_COUNT || applied_role == role || !is_loaded.load( std::memory_order_acquire ) )
+        return;
+
+    applied_role = role;
+
+    const QHash<QString, Placement> &role_placements = placements[ role ];
+    QHash<QString, Placement>::const_iterator i = role_placements.constFind( engine_name.toLower() );
+    if ( i == role_placements.constEnd() && role == ROLE_ENGINE )
+        i = role_placements.constFind( ANY_ENGINE );
+    if ( i == role_placements.constEnd() )
+        return;
+
+    const QString label = engine_name.isEmpty() ? QString( ROLE_NAMES[ role ] ) : QString( "%1 %2" ).arg( ROLE_NAMES[ role ] ).arg( engine_name );
+    const bool verbose = role == ROLE_ENGINE || !is_logged[ role ].exchange( true );
+    applyPlacement( i.value(), label, verbose );
+}
@@ -0,0 +1,39 @@
+#ifndef THREADPLACEMENT_H
+#define THREADPLACEMENT_H
+
+#include "global.h"
+
+#include <QString>
+
+//
+// ThreadPlacement, pins our threads to cores and sets their scheduling from the threads file, read once before the
+// threads start. each line is a role, the engines also take an engine name or * for the rest, then a cpu list like
+// 2,4-5 and optionally fifo <1-99> for SCHED_FIFO or nice <n>:
+//
+//     main 1
+//     engine waves:1 2 fifo 10
+//     engine * 3
+//     parser 4
+//     solver 5-7
+//     batch 0 nice 10
+//
+// without the file, or on other systems than linux, nothing is changed. the pool threads apply theirs from their
+// first job, each thread once
+//
+namespace ThreadPlacement
+{
+    enum Role : quint8
+    {
+        ROLE_MAIN = 0, // spruce, the commands and the ipc socket
+        ROLE_ENGINE, // an engine, its rest module and its connections
+        ROLE_PARSER, // the reply parsers
+        ROLE_SOLVER, // the spruce phases and the cost function images
+        ROLE_BATCH, // the saves and the log writer
+        ROLE_COUNT
+    };
+
+    bool load( const QString &path ); // false if the file is missing or had a bad line
+    void apply( const Role role, const QString &engine_name = QString() ); // to the calling thread, once after load()
+}
+
+#endif // THREADPLACEMENT_H
@@ -0,0 +1,96 @@
+#include "tickerhistory.h"
+#include "orderbook.h"
+
+#include <QtMath>
+
+TickerHistory::TickerHistory( const qint32 _capacity )
+    : capacity( qMax( _capacity, 1 ) )
+{
+    samples.resize( capacity );
+}
+
+void TickerHistory::add( const Coin &bid, const Coin &ask, const qint64 time )
+{
+    TickerSample sample;
+    sample.bid = OrderBook::getTick( bid );
+    sample.ask = OrderBook::getTick( ask );
+    sample.time = time;
+
+    // drop the oldest
+    if ( count == capacity )
+    {
+        const qint64 oldest_seq = next_seq - count;
+        const qreal oldest_mid = getMid( at( oldest_seq ) );
+
+        mid_sum -= oldest_mid;
+        mid_sum_squares -= oldest_mid * oldest_mid;
+
+        if ( min_bids.first() == oldest_seq )
+            min_bids.removeFirst();
+        if ( max_asks.first() == oldest_seq )
+            max_asks.removeFirst();
+
+        count--;
+    }
+
+    if ( count == 0 )
+        mid_offset = ( sample.bid + sample.ask ) /2.;
+
+    // anything behind the new sample that it's better than can't be the min/max again
+    while ( !min_bids.isEmpty() && at( min_bids.last() ).bid >= sample.bid )
+        min_bids.removeLast();
+    while ( !max_asks.isEmpty() && at( max_asks.last() ).ask <= sample.ask )
+        max_asks.removeLast();
+
+    samples[ int( next_seq % capacity ) ] = sample;
+    min_bids.append( next_seq );
+    max_asks.append( next_seq );
+
+    const qreal mid = getMid( sample );
+    mid_sum += mid;
+    mid_sum_squares += mid * mid;
+
+    next_seq++;
+    count++;
+}
+
+void TickerHistory::clear()
+{
+    min_bids.clear();
+    max_asks.clear();
+    next_seq = 0;
+    count = 0;
+    mid_offset = 0.;
+    mid_sum = 0.;
+    mid_sum_squares = 0.;
+}
+
+Coin TickerHistory::getMinBid() const
+{
+    return min_bids.isEmpty() ? Coin() : CoinAmount::SATOSHI * uint64_t( at( min_bids.first() ).bid );
+}
+
+Coin TickerHistory::getMaxAsk() const
+{
+    return max_asks.isEmpty() ? Coin() : CoinAmount::SATOSHI * uint64_t( at( max_asks.first() ).ask );
+}
+
+Coin TickerHistory::getMeanMid() const
+{
+    if ( count == 0 )
+        return Coin();
+
+    return CoinAmount::SATOSHI * uint64_t( qRound64( mid_offset + mid_sum / count ) );
+}
+
+qreal TickerHistory::getVolatility() const
+{
+    if ( count < 2 )
+        return 0.;
+
+    const qreal mean = mid_sum / count;
+    const qreal variance = qMax( 0., mid_sum_squares / count - mean * mean );
+    const qreal mean_mid = mid_offset + mean;
+
+    return mean_mid > 0. ? qSqrt( variance ) / mean_mid : 0.;
+}
@@ -0,0 +1,59 @@
+#ifndef TICKERHISTORY_H
+#define TICKERHISTORY_H
+
+#include "global.h"
+#include "coinamount.h"
+
+#include <QVector>
+#include <QList>
+
+static const qint32 TICKER_HISTORY_CAPACITY = 300; // samples per market
+static const qint64 TICKER_HISTORY_INTERVAL = 1000; // ms between samples, so the capacity covers 5 minutes
+
+struct TickerSample
+{
+    qint64 bid{ 0 }; // satoshi ticks
+    qint64 ask{ 0 };
+    qint64 time{ 0 };
+};
+
+//
+// TickerHistory, the last samples of a market's bid/ask in a ring, with the rolling min/max kept in monotonic deques and
+// the mean/variance in running sums, so every stat is O(1) and the memory stays at the capacity
+//
+class TickerHistory
+{
+public:
+    explicit TickerHistory( const qint32 _capacity = TICKER_HISTORY_CAPACITY );
+
+    void add( const Coin &bid, const Coin &ask, const qint64 time ); // drops the oldest sample when full
+    void clear();
+
+    qint32 size() const { return count; }
+    qint32 getCapacity() const { return capacity; }
+    qint64 getFirstTime() const { return count > 0 ? at( next_seq - count ).time : 0; }
+    qint64 getLastTime() const { return count > 0 ? at( next_seq -1 ).time : 0; }
+
+    Coin getMinBid() const; // zero if empty
+    Coin getMaxAsk() const;
+    Coin getMeanMid() const;
+    qreal getVolatility() const; // standard deviation of the mid price over its mean
+
+private:
+    const TickerSample &at( const qint64 seq ) const { return samples.at( int( seq % capacity ) ); }
+    qreal getMid( const TickerSample &sample ) const { return ( sample.bid + sample.ask ) /2. - mid_offset; }
+
+    QVector<TickerSample> samples;
+    QList<qint64/*seq*/> min_bids; // increasing bids, the front is the min
+    QList<qint64/*seq*/> max_asks; // decreasing asks, the front is the max
+    qint64 next_seq{ 0 };
+    qint32 capacity{ TICKER_HISTORY_CAPACITY };
+    qint32 count{ 0 };
+
+    // sums of the mid minus the first mid, so the squares don't lose precision on large prices
+    qreal mid_offset{ 0. };
+    qreal mid_sum{ 0. };
+    qreal mid_sum_squares{ 0. };
+};
+
+#endif // TICKERHISTORY_H
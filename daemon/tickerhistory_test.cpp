@@ -0,0 +1,37 @@
+#include "tickerhistory_test.h"
+#include "tickerhistory.h"
+
+#include <assert.h>
+
+void TickerHistoryTest::test()
+{
+    TickerHistory history( 3 );
+    assert( history.size() == 0 );
+    assert( history.getMinBid().isZeroOrLess() && history.getMaxAsk().isZeroOrLess() );
+    assert( history.getVolatility() == 0. );
+
+    /// test rolling min/max
+    history.add( Coin( "0.00000100" ), Coin( "0.00000110" ), 1 );
+    history.add( Coin( "0.00000090" ), Coin( "0.00000120" ), 2 );
+    history.add( Coin( "0.00000095" ), Coin( "0.00000105" ), 3 );
+    assert( history.size() == 3 );
+    assert( history.getMinBid() == Coin( "0.00000090" ) );
+    assert( history.getMaxAsk() == Coin( "0.00000120" ) );
+    assert( history.getMeanMid() == Coin( "0.00000103" ) ); // (105 + 105 + 100) / 3, rounded
+
+    // the min/max fall out of the window
+    history.add( Coin( "0.00000098" ), Coin( "0.00000100" ), 4 );
+    assert( history.size() == 3 );
+    assert( history.getFirstTime() == 2 && history.getLastTime() == 4 );
+    history.add( Coin( "0.00000099" ), Coin( "0.00000101" ), 5 );
+    assert( history.getMinBid() == Coin( "0.00000095" ) );
+    assert( history.getMaxAsk() == Coin( "0.00000105" ) );
+
+    /// test volatility
+    history.clear();
+    history.add( Coin( "0.00000100" ), Coin( "0.00000100" ), 1 );
+    history.add( Coin( "0.00000100" ), Coin( "0.00000100" ), 2 );
+    assert( history.getVolatility() == 0. );
+    history.add( Coin( "0.00000130" ), Coin( "0.00000130" ), 3 );
+    assert( history.getVolatility() > 0.1 && history.getVolatility() < 0.2 ); // stddev 14.1 over mean 110
+}
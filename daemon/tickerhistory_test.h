@@ -0,0 +1,9 @@
+#ifndef TICKERHISTORY_TEST_H
+#define TICKERHISTORY_TEST_H
+
+struct TickerHistoryTest
+{
+    void test();
+};
+
+#endif // TICKERHISTORY_TEST_H
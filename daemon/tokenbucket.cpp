@@ -0,0 +1,50 @@
+#include "tokenbucket.h"
+
+#include <QtMath>
+
+TokenBucket::TokenBucket( qreal _rate, qreal _capacity )
+{
+    setRate( _rate, _capacity );
+}
+
+void TokenBucket::setRate( qreal tokens_per_second, qreal _capacity )
+{
+    rate = qMax( tokens_per_second, 0.001 );
+    capacity = qMax( _capacity, 1. );
+    tokens = capacity;
+    refill_time = 0;
+}
+
+qreal TokenBucket::getTokens( qint64 current_time ) const
+{
+    // the first call starts with a full bucket
+    if ( refill_time == 0 || current_time <= refill_time )
+        return tokens;
+
+    return qMin( capacity, tokens + ( current_time - refill_time ) * rate / 1000. );
+}
+
+bool TokenBucket::tryTake( qreal cost, qint64 current_time )
+{
+    // a cost over capacity would never fit, let it through on a full bucket
+    cost = qMin( cost, capacity );
+
+    const qreal available = getTokens( current_time );
+    tokens = available;
+    refill_time = qMax( refill_time, current_time );
+
+    if ( available < cost )
+        return false;
+
+    tokens -= cost;
+    return true;
+}
+
+qint64 TokenBucket::getWaitTime( qreal cost, qint64 current_time ) const
+{
+    const qreal missing = qMin( cost, capacity ) - getTokens( current_time );
+    if ( missing <= 0. )
+        return 0;
+
+    return qCeil( missing * 1000. / rate );
+}
@@ -0,0 +1,53 @@
+#ifndef TOKENBUCKET_H
+#define TOKENBUCKET_H
+
+#include "global.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+
+//
+// TokenBucket, refills at a steady rate up to a burst capacity, so requests can go out in bursts without going over
+// the exchange's average rate
+//
+class TokenBucket
+{
+public:
+    explicit TokenBucket( qreal _rate = 1., qreal _capacity = 1. );
+
+    void setRate( qreal tokens_per_second, qreal _capacity ); // refills the bucket
+    qreal getRate() const { return rate; }
+    qreal getCapacity() const { return capacity; }
+
+    bool tryTake( qreal cost, qint64 current_time ); // false if there aren't enough tokens yet
+    qint64 getWaitTime( qreal cost, qint64 current_time ) const; // ms until tryTake() would succeed
+    qreal getTokens( qint64 current_time ) const;
+
+private:
+    qreal rate{ 1. }; // tokens per second
+    qreal capacity{ 1. };
+    qreal tokens{ 1. };
+    qint64 refill_time{ 0 }; // when tokens was last updated
+};
+
+//
+// SharedTokenBucket, one TokenBucket for the engines of an exchange that run on their own threads, so the shards of an
+// exchange spend one rate limit between them
+//
+class SharedTokenBucket
+{
+public:
+    explicit SharedTokenBucket( qreal _rate = 1., qreal _capacity = 1. ) : bucket( _rate, _capacity ) {}
+
+    void setRate( qreal tokens_per_second, qreal _capacity ) { QMutexLocker locker( &lock ); bucket.setRate( tokens_per_second, _capacity ); }
+    qreal getRate() const { QMutexLocker locker( &lock ); return bucket.getRate(); }
+
+    bool tryTake( qreal cost, qint64 current_time ) { QMutexLocker locker( &lock ); return bucket.tryTake( cost, current_time ); }
+    qint64 getWaitTime( qreal cost, qint64 current_time ) const { QMutexLocker locker( &lock ); return bucket.getWaitTime( cost, current_time ); }
+
+private:
+    mutable QMutex lock;
+    TokenBucket bucket;
+};
+
+#endif // TOKENBUCKET_H
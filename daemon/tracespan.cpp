@@ -0,0 +1,154 @@
+#include "tracespan.h"
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QHash>
+#include <QStringList>
+
+#include <algorithm>
+#include <atomic>
+
+namespace
+{
+
+struct Ring
+{
+    Ring()
+        : events( TraceRing::SIZE )
+    {
+        clock.start();
+    }
+
+    QElapsedTimer clock; // monotonic where the platform has it
+    QMutex lock;
+    QVector<TraceEvent> events;
+    qint64 count{ 0 }; // spans added since the last clear
+};
+
+std::atomic<bool> is_enabled( true );
+thread_local StageStack *thread_stages = nullptr;
+
+Ring &getRing()
+{
+    static Ring ring;
+    return ring;
+}
+
+} // namespace
+
+QString StageStack::toString() const
+{
+    // the thread moves on as we read, a name can be one it just left. good enough to point at it
+    const qint32 d = depth.load( std::memory_order_acquire );
+
+    QStringList ret;
+    for ( qint32 i = 0; i < std::min( d, MAX_DEPTH ); i++ )
+    {
+        const char *name = stages[ i ].load( std::memory_order_acquire );
+        ret += name ? QString( name ) : QString( "?" );
+    }
+
+    if ( d > MAX_DEPTH )
+        ret += QString( "(%1 more)" ).arg( d - MAX_DEPTH );
+
+    return ret.isEmpty() ? QString( "idle" ) : ret.join( " > " );
+}
+
+bool TraceRing::isEnabled()
+{
+    return is_enabled.load( std::memory_order_relaxed );
+}
+
+void TraceRing::setEnabled( const bool enabled )
+{
+    is_enabled.store( enabled, std::memory_order_relaxed );
+}
+
+qint64 TraceRing::now()
+{
+    return getRing().clock.nsecsElapsed();
+}
+
+void TraceRing::setThreadStages( StageStack *stages )
+{
+    thread_stages = stages;
+}
+
+StageStack *TraceRing::getThreadStages()
+{
+    return thread_stages;
+}
+
+void TraceRing::add( const char *name, const qint64 start_ns, const qint64 end_ns )
+{
+    const quint64 thread_id = quint64( quintptr( QThread::currentThreadId() ) );
+
+    Ring &ring = getRing();
+    QMutexLocker locker( &ring.lock );
+
+    TraceEvent &event = ring.events[ int( ring.count % SIZE ) ];
+    event.name = name;
+    event.start_ns = start_ns;
+    event.duration_ns = end_ns - start_ns;
+    event.thread_id = thread_id;
+    ring.count++;
+}
+
+void TraceRing::clear()
+{
+    Ring &ring = getRing();
+    QMutexLocker locker( &ring.lock );
+    ring.count = 0;
+}
+
+QVector<TraceEvent> TraceRing::getEvents()
+{
+    Ring &ring = getRing();
+    QMutexLocker locker( &ring.lock );
+
+    const qint64 size = std::min<qint64>( ring.count, SIZE );
+    QVector<TraceEvent> ret;
+    ret.reserve( int( size ) );
+
+    for ( qint64 i = ring.count - size; i < ring.count; i++ )
+        ret += ring.events.at( int( i % SIZE ) );
+
+    return ret;
+}
+
+QByteArray TraceRing::toChromeTrace()
+{
+    const QVector<TraceEvent> events = getEvents();
+
+    // chrome wants small thread ids, number them in the order they show up
+    QHash<quint64, qint32> thread_numbers;
+
+    QByteArray json;
+    json.reserve( events.size() * 96 + 64 );
+    json += "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+    for ( QVector<TraceEvent>::const_iterator i = events.begin(); i != events.end(); i++ )
+    {
+        if ( !thread_numbers.contains( i->thread_id ) )
+            thread_numbers.insert( i->thread_id, thread_numbers.size() + 1 );
+
+        if ( i != events.begin() )
+            json += ',';
+
+        // complete events, times in microseconds
+        json += "{\"name\":\"";
+        json += i->name;
+        json += "\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+        json += QByteArray::number( thread_numbers.value( i->thread_id ) );
+        json += ",\"ts\":";
+        json += QByteArray::number( i->start_ns / 1000., 'f', 3 );
+        json += ",\"dur\":";
+        json += QByteArray::number( i->duration_ns / 1000., 'f', 3 );
+        json += '}';
+    }
+
+    json += "]}";
+    return json;
+}
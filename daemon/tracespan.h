@@ -0,0 +1,107 @@
+#ifndef TRACESPAN_H
+#define TRACESPAN_H
+
+#include "global.h"
+
+#include <QByteArray>
+#include <QVector>
+#include <QString>
+
+#include <atomic>
+
+// one finished span, the name points at a string literal
+struct TraceEvent
+{
+    const char *name{ nullptr };
+    qint64 start_ns{ 0 };
+    qint64 duration_ns{ 0 };
+    quint64 thread_id{ 0 };
+};
+
+//
+// StageStack, the span names a thread is inside of. only that thread writes it, the loop watchdog reads it to say what
+// a stalled loop is busy with (see looplag.h)
+//
+struct StageStack
+{
+    static const qint32 MAX_DEPTH = 8; // deeper spans are counted but not named
+
+    StageStack() { for ( qint32 i = 0; i < MAX_DEPTH; i++ ) stages[ i ].store( nullptr, std::memory_order_relaxed ); }
+
+    void push( const char *name )
+    {
+        const qint32 d = depth.load( std::memory_order_relaxed );
+        if ( d < MAX_DEPTH )
+            stages[ d ].store( name, std::memory_order_release );
+        depth.store( d +1, std::memory_order_release );
+    }
+    void pop()
+    {
+        const qint32 d = depth.load( std::memory_order_relaxed );
+        if ( d > 0 )
+            depth.store( d -1, std::memory_order_release );
+    }
+
+    QString toString() const; // outermost first, "onSpruceUp > runCancellors", "idle" if empty
+
+    std::atomic<const char*> stages[ MAX_DEPTH ];
+    std::atomic<qint32> depth{ 0 };
+};
+
+//
+// TraceRing, the last SIZE spans from every thread, kept in memory so a slow spruce tick or fill pass can be looked at
+// after the fact. toChromeTrace() gives the json that chrome://tracing and perfetto read, 'savetrace' writes it out
+//
+namespace TraceRing
+{
+    static const qint32 SIZE = 65536;
+
+    bool isEnabled();
+    void setEnabled( const bool enabled );
+
+    qint64 now(); // monotonic ns since startup
+    void add( const char *name, const qint64 start_ns, const qint64 end_ns );
+    void clear();
+
+    QVector<TraceEvent> getEvents(); // oldest first
+    QByteArray toChromeTrace();
+
+    // the calling thread's stages, the spans push onto them whether tracing is on or not. nullptr for none
+    void setThreadStages( StageStack *stages );
+    StageStack *getThreadStages();
+}
+
+//
+// TraceSpan, times its scope into the ring. it reads the clock twice and takes one uncontended lock, and while tracing
+// is off only names the stage for a thread that has a loop probe
+//
+class TraceSpan
+{
+public:
+    explicit TraceSpan( const char *_name )
+        : name( _name ),
+          start_ns( TraceRing::isEnabled() ? TraceRing::now() : -1 ),
+          stages( TraceRing::getThreadStages() )
+    {
+        if ( stages )
+            stages->push( name );
+    }
+    ~TraceSpan()
+    {
+        if ( stages )
+            stages->pop();
+        if ( start_ns >= 0 )
+            TraceRing::add( name, start_ns, TraceRing::now() );
+    }
+
+private:
+    const char *name;
+    qint64 start_ns;
+    StageStack *stages;
+};
+
+#define TRACE_SPAN_JOIN( a, b ) a##b
+#define TRACE_SPAN_VAR( line ) TRACE_SPAN_JOIN( trace_span_, line )
+#define TRACE_SPAN( name ) TraceSpan TRACE_SPAN_VAR( __LINE__ )( name )
+
+#endif // TRACESPAN_H
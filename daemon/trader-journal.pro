@@ -0,0 +1,27 @@
+QT       = core network
+
+TARGET = trader-journal
+DESTDIR = ../
+
+MOC_DIR = ../build-tmp/trader-journal
+OBJECTS_DIR = ../build-tmp/trader-journal
+
+CONFIG += c++14 c++17
+CONFIG += RELEASE console
+
+LIBS += -lgmp
+
+QMAKE_CXXFLAGS_RELEASE = -Wall -O3
+
+SOURCES += journal.cpp \
+    orderjournal.cpp \
+    asyncsaver.cpp \
+    threadplacement.cpp \
+    coinamount.cpp
+
+HEADERS += build-config.h \
+    global.h \
+    orderjournal.h \
+    asyncsaver.h \
+    threadplacement.h \
+    coinamount.h
@@ -0,0 +1,21 @@
+QT       = core network
+
+TARGET = trader-sweep
+DESTDIR = ../
+
+MOC_DIR = ../build-tmp/trader-sweep
+OBJECTS_DIR = ../build-tmp/trader-sweep
+
+CONFIG += c++14 c++17
+CONFIG += RELEASE console
+
+LIBS += -lgmp
+
+QMAKE_CXXFLAGS_RELEASE = -Wall -O3
+
+SOURCES += sweep.cpp \
+    coinamount.cpp
+
+HEADERS += build-config.h \
+    global.h \
+    coinamount.h
@@ -12,13 +12,37 @@
 #include "fallbacklistener.h"
 #include "commandlistener.h"
 #include "commandrunner.h"
+#include "metrics.h"
+#include "looplag.h"
+#include "marketshards.h"
+#include "tokenbucket.h"
+#include "threadplacement.h"
+#include "mocknetwork.h"
+#include "mocknetwork_test.h"
+#include "replyparser_test.h"
+#include "marketevents_test.h"
 #include "global.h"
 #include "alphatracker.h"
 #include "spruce.h"
 #include "spruceoverseer.h"
 #include "spruceoverseer_test.h"
+#include "standbylink.h"
+#include "standbylink_test.h"
+#include "balanceledger_test.h"
+#include "eventfeed_test.h"
+#include "positiongrid_test.h"
+#include "costfunctioncache_test.h"
 #include "wavesutil_test.h"
 #include "wavesaccount_test.h"
+#include "jsonstreamreader_test.h"
+#include "orderbook_test.h"
+#include "tickerhistory_test.h"
+#include "taskscheduler_test.h"
+#include "looplag_test.h"
+#include "marketshards_test.h"
+#include "sprucelink_test.h"
+#include "hmacsigner_test.h"
+#include "asynclog_test.h"
 #include "../qbase58/qbase58_test.h"
 
 #include <QByteArray>
@@ -26,6 +50,95 @@
 #include <QThread>
 #include <QCoreApplication>
 #include <QNetworkAccessManager>
+#include <QFile>
+#include <QStringList>
+#include <QHash>
+
+static const qint64 LOOP_STALL_THRESHOLD = 500; // ms without a loop probe tick before the watchdog logs the loop
+static const qint32 MAX_ENGINES_PER_EXCHANGE = 15; // accounts times shards, the engine ids stay under 256
+
+namespace
+{
+
+// exchanges that are built in, in engine type order
+const char *const BUILT_IN_EXCHANGES[] = {
+#ifdef BITTREX_ENABLED
+    "bittrex",
+#endif
+#ifdef BINANCE_ENABLED
+    "binance",
+#endif
+#ifdef POLONIEX_ENABLED
+    "poloniex",
+#endif
+#ifdef WAVES_ENABLED
+    "waves",
+#endif
+    nullptr
+};
+
+// the exchanges to start, named one per line in the exchanges file. without the file, all the built in ones. a line can
+// also split the exchange's markets over several engines, "waves 3 BTC_WAVES:0" runs three and pins BTC_WAVES to the first
+QStringList readExchanges( QHash<QString, MarketShards> &shards )
+{
+    QStringList built_in;
+    for ( int i = 0; BUILT_IN_EXCHANGES[ i ] != nullptr; i++ )
+        built_in += BUILT_IN_EXCHANGES[ i ];
+
+    QFile loadfile( Global::getExchangesPath() );
+    if ( !loadfile.open( QIODevice::ReadOnly | QIODevice::Text ) )
+        return built_in;
+
+    QStringList exchanges;
+    const QStringList lines = QString::fromUtf8( loadfile.readAll() ).split( '\n' );
+    for ( QStringList::const_iterator i = lines.begin(); i != lines.end(); i++ )
+    {
+        const QString line = i->section( QChar( '#' ), 0, 0 ).simplified();
+        const QString name = line.section( QChar( ' ' ), 0, 0 ).toLower();
+        const QString shard_spec = line.section( QChar( ' ' ), 1 );
+        if ( name.isEmpty() || exchanges.contains( name ) )
+            continue;
+
+        if ( !built_in.contains( name ) )
+        {
+            kDebug() << "local warning: exchange" << name << "in" << loadfile.fileName() << "isn't built in";
+            continue;
+        }
+
+        exchanges += name;
+
+        if ( shard_spec.isEmpty() )
+            continue;
+
+        // the other exchanges limit and sign requests for the whole key, they'd need one rest module between the shards
+        MarketShards exchange_shards;
+        if ( !exchange_shards.parse( shard_spec ) )
+            kDebug() << "local warning: bad shards" << shard_spec << "for" << name << "in" << loadfile.fileName() << ", starting one engine";
+        else if ( exchange_shards.isSharded() && name != "waves" )
+            kDebug() << "local warning: only waves can run several engines, starting one for" << name;
+        else
+            shards.insert( name, exchange_shards );
+    }
+
+    kDebug() << "[Trader] starting exchanges" << exchanges << "from" << loadfile.fileName();
+    return exchanges;
+}
+
+// the network manager for an exchange's rest module
+QNetworkAccessManager *createNetworkManager( const QString &exchange )
+{
+#ifdef MOCK_NETWORK
+    MockNetworkAccessManager *nam = new MockNetworkAccessManager();
+    nam->loadScript( Global::getMockScriptPath( exchange ) );
+    kDebug() << "[Trader] answering" << exchange << "requests from" << Global::getMockScriptPath( exchange );
+    return nam;
+#else
+    Q_UNUSED( exchange )
+    return new QNetworkAccessManager();
+#endif
+}
+
+} // namespace
 
 
 Trader::Trader( QObject *parent )
@@ -39,57 +152,100 @@ Trader::Trader( QObject *parent )
     // ssl hacks
     GlobalSsl::enableSecureSsl();
 
+    // only build what the exchanges file asks for, the others cost nothing
+    QHash<QString, MarketShards> exchange_shards;
+    const QStringList exchanges = readExchanges( exchange_shards );
+
+    // the cores and priorities of our threads, before any of the pools or engines start. spruce runs on this one
+    ThreadPlacement::load( Global::getThreadsPath() );
+    ThreadPlacement::apply( ThreadPlacement::ROLE_MAIN );
+
     // create spruce and spruceOverseer
     alpha = new AlphaTracker();
     spruce = new Spruce();
     spruce_overseer = new SpruceOverseer( spruce );
     spruce_overseer->alpha = alpha;
-
-    nam = new QNetworkAccessManager();
+    spruce_overseer->setAsyncSolve( true );
 
     // engine init
 #ifdef BITTREX_ENABLED
-    engine_trex = new Engine( ENGINE_BITTREX );
-    rest_trex = new TrexREST( engine_trex, nam );
-    engine_trex->alpha = alpha;
-    engine_trex->spruce = spruce;
-
-    spruce_overseer->engine_map.insert( ENGINE_BITTREX, engine_trex );
-
-    bittrex = true;
+    if ( exchanges.contains( "bittrex" ) )
+    {
+        engine_trex = new Engine( ENGINE_BITTREX );
+        nam_trex = createNetworkManager( "bittrex" );
+        rest_trex = new TrexREST( engine_trex, nam_trex );
+        engine_trex->alpha = alpha;
+        engine_trex->spruce = spruce;
+        engine_trex->spruce_lock = &spruce_overseer->spruce_lock;
+        engine_trex->spruce_portfolios = &spruce_overseer->portfolios;
+        engine_trex->bbo = &spruce_overseer->bbo;
+        engine_trex->market_events = spruce_overseer->getMarketEvents( ENGINE_BITTREX );
+
+        spruce_overseer->engine_map.insert( ENGINE_BITTREX, engine_trex );
+        connect( engine_trex, &Engine::gotTickerUpdate, spruce_overseer, &SpruceOverseer::onTickerUpdate );
+
+        bittrex = true;
+    }
 #endif
 
 #ifdef BINANCE_ENABLED
-    engine_bnc = new Engine( ENGINE_BINANCE );
-    rest_bnc = new BncREST( engine_bnc, nam );
-    engine_bnc->alpha = alpha;
-    engine_bnc->spruce = spruce;
-
-    spruce_overseer->engine_map.insert( ENGINE_BINANCE, engine_bnc );
-
-    binance = true;
+    if ( exchanges.contains( "binance" ) )
+    {
+        engine_bnc = new Engine( ENGINE_BINANCE );
+        nam_bnc = createNetworkManager( "binance" );
+        rest_bnc = new BncREST( engine_bnc, nam_bnc );
+        engine_bnc->alpha = alpha;
+        engine_bnc->spruce = spruce;
+        engine_bnc->spruce_lock = &spruce_overseer->spruce_lock;
+        engine_bnc->spruce_portfolios = &spruce_overseer->portfolios;
+        engine_bnc->bbo = &spruce_overseer->bbo;
+        engine_bnc->market_events = spruce_overseer->getMarketEvents( ENGINE_BINANCE );
+
+        spruce_overseer->engine_map.insert( ENGINE_BINANCE, engine_bnc );
+        connect( engine_bnc, &Engine::gotTickerUpdate, spruce_overseer, &SpruceOverseer::onTickerUpdate );
+
+        binance = true;
+    }
 #endif
 
 #ifdef POLONIEX_ENABLED
-    engine_polo = new Engine( ENGINE_POLONIEX );
-    rest_polo = new PoloREST( engine_polo, nam );
-    engine_polo->alpha = alpha;
-    engine_polo->spruce = spruce;
-
-    spruce_overseer->engine_map.insert( ENGINE_POLONIEX, engine_polo );
-
-    poloniex = true;
+    if ( exchanges.contains( "poloniex" ) )
+    {
+        engine_polo = new Engine( ENGINE_POLONIEX );
+        nam_polo = createNetworkManager( "poloniex" );
+        rest_polo = new PoloREST( engine_polo, nam_polo );
+        engine_polo->alpha = alpha;
+        engine_polo->spruce = spruce;
+        engine_polo->spruce_lock = &spruce_overseer->spruce_lock;
+        engine_polo->spruce_portfolios = &spruce_overseer->portfolios;
+        engine_polo->bbo = &spruce_overseer->bbo;
+        engine_polo->market_events = spruce_overseer->getMarketEvents( ENGINE_POLONIEX );
+
+        spruce_overseer->engine_map.insert( ENGINE_POLONIEX, engine_polo );
+        connect( engine_polo, &Engine::gotTickerUpdate, spruce_overseer, &SpruceOverseer::onTickerUpdate );
+
+        poloniex = true;
+    }
 #endif
 
 #ifdef WAVES_ENABLED
-    engine_waves = new Engine( ENGINE_WAVES );
-    rest_waves = new WavesREST( engine_waves, nam );
-    engine_waves->alpha = alpha;
-    engine_waves->spruce = spruce;
-
-    spruce_overseer->engine_map.insert( ENGINE_WAVES, engine_waves );
-
-    waves = true;
+    if ( exchanges.contains( "waves" ) )
+    {
+        engine_waves = new Engine( ENGINE_WAVES );
+        nam_waves = createNetworkManager( "waves" );
+        rest_waves = new WavesREST( engine_waves, nam_waves );
+        engine_waves->alpha = alpha;
+        engine_waves->spruce = spruce;
+        engine_waves->spruce_lock = &spruce_overseer->spruce_lock;
+        engine_waves->spruce_portfolios = &spruce_overseer->portfolios;
+        engine_waves->bbo = &spruce_overseer->bbo;
+        engine_waves->market_events = spruce_overseer->getMarketEvents( ENGINE_WAVES );
+
+        spruce_overseer->engine_map.insert( ENGINE_WAVES, engine_waves );
+        connect( engine_waves, &Engine::gotTickerUpdate, spruce_overseer, &SpruceOverseer::onTickerUpdate );
+
+        waves = true;
+    }
 #endif
 
     QVector<BaseREST*> rest_arr;
@@ -147,6 +303,55 @@ Trader::Trader( QObject *parent )
     CoinAmountTest coin_test;
     coin_test.test();
 
+    JsonStreamReaderTest jsonstreamreader_test;
+    jsonstreamreader_test.test();
+
+    OrderBookTest orderbook_test;
+    orderbook_test.test();
+
+    TickerHistoryTest tickerhistory_test;
+    tickerhistory_test.test();
+
+    TaskSchedulerTest taskscheduler_test;
+    taskscheduler_test.test();
+
+    LoopLagTest looplag_test;
+    looplag_test.test();
+
+    MarketShardsTest marketshards_test;
+    marketshards_test.test();
+
+    SpruceLinkTest sprucelink_test;
+    sprucelink_test.test();
+
+    StandbyLinkTest standbylink_test;
+    standbylink_test.test();
+
+    BalanceLedgerTest balanceledger_test;
+    balanceledger_test.test();
+
+    EventFeedTest eventfeed_test;
+    eventfeed_test.test();
+    PositionGridTest positiongrid_test;
+    positiongrid_test.test();
+    CostFunctionCacheTest costfunctioncache_test;
+    costfunctioncache_test.test();
+
+    HmacSignerTest hmacsigner_test;
+    hmacsigner_test.test();
+
+    AsyncLogTest asynclog_test;
+    asynclog_test.test();
+
+    MockNetworkTest mocknetwork_test;
+    mocknetwork_test.test();
+
+    ReplyParserTest replyparser_test;
+    replyparser_test.test();
+
+    MarketEventsTest marketevents_test;
+    marketevents_test.test();
+
     EngineTest engine_test;
     if ( bittrex  ) engine_test.test( engine_trex );
     if ( binance  ) engine_test.test( engine_bnc );
@@ -162,6 +367,11 @@ Trader::Trader( QObject *parent )
     qint64 t1 = QDateTime::currentMSecsSinceEpoch();
     kDebug() << "[Trader] Tests passed in" << t1 - t0 << "ms.";
 
+    // split the markets of the sharded exchanges and their accounts, after the tests so they can use any market
+    if ( waves )
+        addShards( "waves", exchange_shards.value( "waves" ), readAccounts( Global::getWavesAccountsPath() ),
+                   engine_waves, rest_waves, rest_arr );
+
     // print build info
     kDebug() << "[Trader] Startup success." << Global::getBuildString();
 
@@ -173,28 +383,289 @@ Trader::Trader( QObject *parent )
                                     command_runner_waves != nullptr ? command_runner_waves :
                                                                      nullptr;
 
+    // loadSettings() warms up the cost functions after the chunk, so wait for the runner's thread to finish it
     if ( command_runner )
-        connect( spruce_overseer, &SpruceOverseer::gotUserCommandChunk, command_runner, &CommandRunner::runCommandChunk );
+        connect( spruce_overseer, &SpruceOverseer::gotUserCommandChunk, command_runner, &CommandRunner::runCommandChunk, Qt::BlockingQueuedConnection );
 
     // open IPC command listener
     command_listener = new CommandListener();
     connect( command_listener, &CommandListener::gotDataChunk, this, &Trader::handleCommand );
+    connect( command_listener, &CommandListener::gotBinaryFrame, this, &Trader::handleBinaryFrame );
+
+#ifdef METRICS_PORT
+    // open the metrics endpoint, it samples the engines under their locks from this thread
+    metrics_server = new MetricsServer( spruce_overseer, METRICS_PORT );
+#endif
 
     // open fallback listener that uses a plain file, useful for copying a 'setorder' dump into a file
 //    listener_fallback = new FallbackListener();
 //    connect( listener_fallback, &FallbackListener::gotDataChunk, runner, &CommandRunner::runCommandChunk );
 
+    // run each exchange on its own thread, so a slow reply or parse on one doesn't hold up the others
+    if ( bittrex  ) thread_trex = startEngineThread( engine_trex, rest_trex, nam_trex, command_runner_trex, probe_trex );
+    if ( binance  ) thread_bnc = startEngineThread( engine_bnc, rest_bnc, nam_bnc, command_runner_bnc, probe_bnc );
+    if ( poloniex ) thread_polo = startEngineThread( engine_polo, rest_polo, nam_polo, command_runner_polo, probe_polo );
+    if ( waves    ) thread_waves = startEngineThread( engine_waves, rest_waves, nam_waves, command_runner_waves, probe_waves );
+
+    for ( QVector<EngineShard>::iterator i = extra_shards.begin(); i != extra_shards.end(); i++ )
+        i->thread = startEngineThread( i->engine, i->rest, i->nam, i->runner, i->probe );
+
+    // watch this loop too, spruce runs on it, and log any loop that stops running for LOOP_STALL_THRESHOLD
+    probe_main = new LoopProbe( "main", this );
+    probe_main->start();
+    LoopWatchdog::start( LOOP_STALL_THRESHOLD );
+
     // tests passed. start rest, load settings and stats, initialize api keys
     for ( int i = 0; i < rest_arr.size(); i++ )
         if ( rest_arr.at( i ) != nullptr )
-            rest_arr.at( i )->init();
+            rests += rest_arr.at( i );
+
+    for ( QVector<EngineShard>::const_iterator i = extra_shards.begin(); i != extra_shards.end(); i++ )
+        rests += i->rest;
+
+    // a standby starts them once the primary stops
+    const bool is_standby = spruce_overseer->readStandby( Global::getStandbyPath() ) && spruce_overseer->standby->isStandby();
+    if ( is_standby )
+        connect( spruce_overseer->standby, &StandbyLink::promoted, this, &Trader::startRests );
+    else
+        startRests();
+
+    // a primary shuts down once a standby is taking over, its orders stay for the standby's positions. queued, the
+    // link is deleted with the overseer
+    if ( spruce_overseer->standby )
+        connect( spruce_overseer->standby, &StandbyLink::fenced, this, &Trader::handleExitSignal, Qt::QueuedConnection );
 
     spruce_overseer->loadSettings();
     spruce_overseer->loadStats();
+
+    // act as one portfolio with the daemons on other hosts, if spruce.link says so
+    spruce_overseer->startLink( Global::getSpruceLinkPath() );
+
+    // after the settings, the primary's spruce state replaces them on a standby
+    if ( spruce_overseer->standby )
+        spruce_overseer->standby->start( rests );
+}
+
+void Trader::startRests()
+{
+    for ( QVector<BaseREST*>::const_iterator i = rests.begin(); i != rests.end(); i++ )
+    {
+        BaseREST *rest = *i;
+
+        // init on the engine thread
+        QTimer::singleShot( 0, rest, [rest]() { QMutexLocker locker( rest->engine->getLock() ); rest->init(); } );
+    }
+}
+
+void Trader::addShards( const QString &exchange, const MarketShards &shards, const QVector<EngineAccount> &accounts,
+                        Engine *primary, BaseREST *primary_rest, const QVector<BaseREST*> &rest_arr )
+{
+    const quint8 engine_type = primary->engine_type;
+
+    // every account runs an engine for each shard
+    const qint32 account_count = qBound( 1, accounts.size(), MAX_ENGINES_PER_EXCHANGE / shards.getCount() );
+    if ( accounts.size() > account_count )
+        kDebug() << "local warning: only" << account_count << "of" << accounts.size() << exchange << "accounts fit" << shards.getCount() << "shards each";
+
+    if ( !shards.isSharded() && account_count < 2 )
+    {
+        setAccountKey( primary_rest, accounts.value( 0 ) );
+        return;
+    }
+
+    qreal total_weight = 0.;
+    for ( qint32 account = 0; account < account_count; account++ )
+        total_weight += accounts.value( account ).weight;
+
+    for ( qint32 account = 0; account < account_count; account++ )
+    {
+        const Coin share = account_count > 1 ? Coin( accounts.value( account ).weight / total_weight ) : CoinAmount::COIN;
+
+        // the matcher limits each account by itself, so the engines of an account send under one rate
+        SharedTokenBucket *limiter = new SharedTokenBucket();
+        shard_send_limiters.insert( engine_type + account * shards.getCount() * ENGINE_SHARD_STRIDE, limiter );
+
+        for ( qint32 index = 0; index < shards.getCount(); index++ )
+        {
+            if ( account == 0 && index == 0 )
+            {
+                primary->setShard( shards, 0, 0, share );
+                setAccountKey( primary_rest, accounts.value( 0 ) );
+                primary_rest->shareSendLimiter( limiter );
+                continue;
+            }
+
+            EngineShard shard;
+            shard.engine = new Engine( engine_type );
+            shard.engine->setShard( shards, index, account, share );
+            shard.nam = createNetworkManager( exchange );
+#ifdef WAVES_ENABLED
+            if ( engine_type == ENGINE_WAVES )
+                shard.rest = new WavesREST( shard.engine, shard.nam );
+#endif
+            if ( !shard.rest )
+            {
+                kDebug() << "local error: can't shard exchange" << exchange;
+                delete shard.engine;
+                delete shard.nam;
+                return;
+            }
+
+            setAccountKey( shard.rest, accounts.value( account ) );
+            shard.rest->shareSendLimiter( limiter );
+            shard.engine->alpha = alpha;
+            shard.engine->spruce = spruce;
+            shard.engine->spruce_lock = &spruce_overseer->spruce_lock;
+            shard.engine->spruce_portfolios = &spruce_overseer->portfolios;
+            shard.engine->bbo = &spruce_overseer->bbo;
+            shard.engine->market_events = spruce_overseer->getMarketEvents( shard.engine->getEngineId() );
+
+            spruce_overseer->engine_map.insert( shard.engine->getEngineId(), shard.engine );
+            connect( shard.engine, &Engine::gotTickerUpdate, spruce_overseer, &SpruceOverseer::onTickerUpdate );
+
+            // the shard's commands reach its own rest module
+            QVector<BaseREST*> shard_rest_arr = rest_arr;
+            shard_rest_arr[ engine_type ] = shard.rest;
+
+            shard.engine->rest_arr = shard_rest_arr;
+            shard.runner = new CommandRunner( engine_type, shard.engine, shard_rest_arr );
+            shard.runner->spruce_overseer = spruce_overseer;
+            connect( shard.runner, &CommandRunner::exitSignal, this, &Trader::handleExitSignal );
+            connect( shard.engine, &Engine::gotUserCommandChunk, shard.runner, &CommandRunner::runCommandChunk );
+
+            extra_shards += shard;
+        }
+    }
+
+    kDebug() << "[Trader] started" << account_count * shards.getCount() << "engines for" << exchange << "," << account_count
+             << "accounts with" << shards.getCount() << "shards each";
+}
+
+void Trader::setAccountKey( BaseREST *rest, const EngineAccount &account )
+{
+    if ( account.key_b58.isEmpty() )
+        return;
+
+#ifdef WAVES_ENABLED
+    if ( rest->engine->engine_type == ENGINE_WAVES )
+    {
+        static_cast<WavesREST*>( rest )->setAccountKeyB58( account.key_b58 );
+        return;
+    }
+#endif
+
+    kDebug() << "local warning: exchange" << rest->exchange_string << "can't take more accounts";
+}
+
+QVector<Trader::EngineAccount> Trader::readAccounts( const QString &path )
+{
+    QVector<EngineAccount> accounts;
+
+    QFile loadfile( path );
+    if ( !loadfile.open( QIODevice::ReadOnly | QIODevice::Text ) )
+        return accounts;
+
+    // "<private key> [weight=1]", one account per line
+    const QStringList lines = QString::fromUtf8( loadfile.readAll() ).split( '\n' );
+    for ( QStringList::const_iterator i = lines.begin(); i != lines.end(); i++ )
+    {
+        const QString line = i->section( QChar( '#' ), 0, 0 ).simplified();
+        if ( line.isEmpty() )
+            continue;
+
+        EngineAccount account;
+        account.key_b58 = line.section( QChar( ' ' ), 0, 0 ).toLatin1();
+
+        const QString weight = line.section( QChar( ' ' ), 1, 1 );
+        bool ok = true;
+        if ( !weight.isEmpty() )
+            account.weight = weight.toDouble( &ok );
+
+        if ( !ok || account.weight <= 0. )
+        {
+            kDebug() << "local warning: bad account weight" << weight << "in" << loadfile.fileName();
+            continue;
+        }
+
+        accounts += account;
+    }
+
+    kDebug() << "[Trader] read" << accounts.size() << "accounts from" << loadfile.fileName();
+    return accounts;
+}
+
+QThread *Trader::startEngineThread( Engine *engine, BaseREST *rest, QNetworkAccessManager *nam, CommandRunner *runner, LoopProbe *&probe )
+{
+    QThread *thread = new QThread();
+    thread->setObjectName( QString( "engine %1" ).arg( engine->getEngineId() ) );
+
+    const QString name = engine->getEngineIndex() > 0 ? QString( "%1:%2" ).arg( rest->exchange_string ).arg( engine->getEngineIndex() ) :
+                                                        QString( rest->exchange_string );
+
+    // without a context object this runs on the new thread, before its loop starts
+    connect( thread, &QThread::started, [name]() { ThreadPlacement::apply( ThreadPlacement::ROLE_ENGINE, name ); } );
+
+    // the probe starts on the new thread, so it's that thread's
+    probe = new LoopProbe( name );
+    probe->moveToThread( thread );
+    connect( thread, &QThread::started, probe, &LoopProbe::start );
+
+    // timers are children of the objects and move along with them
+    engine->moveToThread( thread );
+    engine->getPositionMan()->moveToThread( thread );
+    rest->moveToThread( thread );
+    nam->moveToThread( thread );
+    runner->moveToThread( thread );
+
+    thread->start();
+    return thread;
+}
+
+void Trader::stopEngineThread( QThread *&thread, Engine *engine, BaseREST *rest, QNetworkAccessManager *nam, CommandRunner *runner, LoopProbe *&probe )
+{
+    if ( !thread )
+        return;
+
+    // objects can only be pushed away from their own thread, so move them back to this thread from there
+    QThread *main_thread = QThread::currentThread();
+    QMetaObject::invokeMethod( engine, [=]() {
+        probe->stop();
+        probe->moveToThread( main_thread );
+        engine->moveToThread( main_thread );
+        engine->getPositionMan()->moveToThread( main_thread );
+        rest->moveToThread( main_thread );
+        nam->moveToThread( main_thread );
+        runner->moveToThread( main_thread );
+    }, Qt::BlockingQueuedConnection );
+
+    thread->quit();
+    thread->wait();
+
+    delete thread;
+    thread = nullptr;
+    delete probe;
+    probe = nullptr;
 }
 
 Trader::~Trader()
 {
+    // a loop that's shutting down isn't stalled
+    LoopWatchdog::stop();
+
+    // bring the engines back to this thread before deleting them
+    stopEngineThread( thread_trex, engine_trex, rest_trex, nam_trex, command_runner_trex, probe_trex );
+    stopEngineThread( thread_bnc, engine_bnc, rest_bnc, nam_bnc, command_runner_bnc, probe_bnc );
+    stopEngineThread( thread_polo, engine_polo, rest_polo, nam_polo, command_runner_polo, probe_polo );
+    stopEngineThread( thread_waves, engine_waves, rest_waves, nam_waves, command_runner_waves, probe_waves );
+
+    for ( QVector<EngineShard>::iterator i = extra_shards.begin(); i != extra_shards.end(); i++ )
+    {
+        stopEngineThread( i->thread, i->engine, i->rest, i->nam, i->runner, i->probe );
+        delete i->engine;
+        delete i->rest;
+        delete i->runner;
+    }
+
     delete engine_trex;
     delete engine_bnc;
     delete engine_polo;
@@ -208,16 +679,25 @@ Trader::~Trader()
     delete command_runner_polo;
     delete command_runner_waves;
     delete command_listener;
+    delete metrics_server;
     delete alpha;
     delete spruce;
     delete spruce_overseer;
 
     QCoreApplication::processEvents( QEventLoop::AllEvents, 10000 );
 
-    // force nam to close
-    nam->thread()->exit();
-    delete nam;
-    nam = nullptr;
+    delete nam_trex;
+    delete nam_bnc;
+    delete nam_polo;
+    delete nam_waves;
+    nam_trex = nam_bnc = nam_polo = nam_waves = nullptr;
+
+    for ( QVector<EngineShard>::const_iterator i = extra_shards.begin(); i != extra_shards.end(); i++ )
+        delete i->nam;
+    extra_shards.clear();
+
+    qDeleteAll( shard_send_limiters );
+    shard_send_limiters.clear();
 
     kDebug() << "[Trader] done.";
 }
@@ -226,31 +706,89 @@ void Trader::handleCommand( QString &s )
 {
     //kDebug() << "[Trader] got command:" << s;
 
+    CommandRunner *runner = nullptr;
+    int prefix_size = 0;
+
+    // "waves:1 <command>" goes to that engine of the exchange, ":0" is the first one like no index at all
+    const QString prefix = s.section( QChar( ' ' ), 0, 0 );
+    if ( prefix.contains( QChar( ':' ) ) )
+    {
+        const QString exchange = prefix.section( QChar( ':' ), 0, 0 );
+        const qint32 index = prefix.section( QChar( ':' ), 1 ).toInt();
+
+        if ( index == 0 )
+        {
+            s = exchange + s.mid( prefix.size() );
+            handleCommand( s );
+            return;
+        }
+
+        for ( QVector<EngineShard>::const_iterator i = extra_shards.begin(); i != extra_shards.end(); i++ )
+            if ( i->engine->getEngineIndex() == index && exchange.compare( i->rest->exchange_string, Qt::CaseInsensitive ) == 0 )
+                runner = i->runner;
+
+        if ( runner == nullptr )
+        {
+            kDebug() << "[Trader] exchange engine isn't running:" << prefix;
+            return;
+        }
+
+        QMetaObject::invokeMethod( runner, "runCommandChunk", Qt::QueuedConnection, Q_ARG( QString, s.mid( prefix.size() +1 ) ) );
+        return;
+    }
+
     if ( s.startsWith( QString( "bittrex " ), Qt::CaseInsensitive ) )
     {
-        s = s.mid( 8 );
-        command_runner_trex->runCommandChunk( s );
+        runner = command_runner_trex;
+        prefix_size = 8;
     }
     else if ( s.startsWith( QString( "binance " ), Qt::CaseInsensitive ) )
     {
-        s = s.mid( 8 );
-        command_runner_bnc->runCommandChunk( s );
+        runner = command_runner_bnc;
+        prefix_size = 8;
     }
     else if ( s.startsWith( QString( "poloniex " ), Qt::CaseInsensitive ) )
     {
-        s = s.mid( 9 );
-        command_runner_polo->runCommandChunk( s );
+        runner = command_runner_polo;
+        prefix_size = 9;
     }
     else if ( s.startsWith( QString( "waves " ), Qt::CaseInsensitive ) )
     {
-        s = s.mid( 6 );
-        command_runner_waves->runCommandChunk( s );
+        runner = command_runner_waves;
+        prefix_size = 6;
     }
     else
     {
         kDebug() << "[Trader] bad exchange prefix:" << s;
         return;
     }
+
+    // the exchange isn't started
+    if ( runner == nullptr )
+    {
+        kDebug() << "[Trader] exchange isn't running:" << s.left( prefix_size - 1 );
+        return;
+    }
+
+    QMetaObject::invokeMethod( runner, "runCommandChunk", Qt::QueuedConnection, Q_ARG( QString, s.mid( prefix_size ) ) );
+}
+
+void Trader::handleBinaryFrame( const QByteArray &frame )
+{
+    // the frame starts with the engine type
+    const qint8 engine_type = frame.isEmpty() ? -1 : qint8( frame.at( 0 ) );
+    CommandRunner *runner = engine_type == ENGINE_BITTREX  ? command_runner_trex :
+                            engine_type == ENGINE_BINANCE  ? command_runner_bnc :
+                            engine_type == ENGINE_POLONIEX ? command_runner_polo :
+                            engine_type == ENGINE_WAVES    ? command_runner_waves :
+                                                             nullptr;
+    if ( runner == nullptr )
+    {
+        kDebug() << "[Trader] bad engine type in command frame:" << engine_type;
+        return;
+    }
+
+    QMetaObject::invokeMethod( runner, "runCommandFrame", Qt::QueuedConnection, Q_ARG( QByteArray, frame ) );
 }
 
 void Trader::handleExitSignal()
@@ -2,14 +2,22 @@
 #define TREXTRADER_H
 
 #include <QObject>
+#include <QVector>
+#include <QMap>
+#include <QByteArray>
 
 #include "global.h"
 
 class QNetworkAccessManager;
+class QThread;
 
 class CommandRunner;
 class CommandListener;
 class FallbackListener;
+class MetricsServer;
+class LoopProbe;
+class MarketShards;
+class SharedTokenBucket;
 
 class AlphaTracker;
 class Spruce;
@@ -19,6 +27,7 @@ class TrexREST;
 class BncREST;
 class PoloREST;
 class WavesREST;
+class BaseREST;
 
 class Trader : public QObject
 {
@@ -30,12 +39,45 @@ public:
 
 public slots:
     void handleCommand( QString &s );
+    void handleBinaryFrame( const QByteArray &frame );
     void handleExitSignal();
+    void startRests(); // init on their engine threads, a standby's once it takes over
 
 private:
-    QNetworkAccessManager *nam;
+    // an account of an exchange, its engines get weight over the weights of all of them of its allocations
+    struct EngineAccount
+    {
+        QByteArray key_b58; // empty for the built in key
+        qreal weight{ 1. };
+    };
+    static QVector<EngineAccount> readAccounts( const QString &path ); // empty without the file
+    void setAccountKey( BaseREST *rest, const EngineAccount &account );
+
+    void addShards( const QString &exchange, const MarketShards &shards, const QVector<EngineAccount> &accounts,
+                    Engine *primary, BaseREST *primary_rest, const QVector<BaseREST*> &rest_arr );
+    QThread *startEngineThread( Engine *engine, BaseREST *rest, QNetworkAccessManager *nam, CommandRunner *runner, LoopProbe *&probe );
+    void stopEngineThread( QThread *&thread, Engine *engine, BaseREST *rest, QNetworkAccessManager *nam, CommandRunner *runner, LoopProbe *&probe );
+
+    // one thread and network manager for each exchange
+    QThread *thread_trex{ nullptr };
+    QThread *thread_bnc{ nullptr };
+    QThread *thread_polo{ nullptr };
+    QThread *thread_waves{ nullptr };
+
+    QNetworkAccessManager *nam_trex{ nullptr };
+    QNetworkAccessManager *nam_bnc{ nullptr };
+    QNetworkAccessManager *nam_polo{ nullptr };
+    QNetworkAccessManager *nam_waves{ nullptr };
+
+    // event loop lag of this thread and each exchange's
+    LoopProbe *probe_main{ nullptr };
+    LoopProbe *probe_trex{ nullptr };
+    LoopProbe *probe_bnc{ nullptr };
+    LoopProbe *probe_polo{ nullptr };
+    LoopProbe *probe_waves{ nullptr };
 
     CommandListener *command_listener{ nullptr };
+    MetricsServer *metrics_server{ nullptr };
     CommandRunner *command_runner_trex{ nullptr };
     CommandRunner *command_runner_bnc{ nullptr };
     CommandRunner *command_runner_polo{ nullptr };
@@ -54,6 +96,20 @@ private:
     BncREST *rest_bnc{ nullptr };
     PoloREST *rest_polo{ nullptr };
     WavesREST *rest_waves{ nullptr };
+
+    // the engines after the first of a sharded exchange, see MarketShards
+    struct EngineShard
+    {
+        Engine *engine{ nullptr };
+        BaseREST *rest{ nullptr };
+        QNetworkAccessManager *nam{ nullptr };
+        CommandRunner *runner{ nullptr };
+        QThread *thread{ nullptr };
+        LoopProbe *probe{ nullptr };
+    };
+    QVector<EngineShard> extra_shards;
+    QVector<BaseREST*> rests; // of every engine
+    QMap<qint32/*engine id of the account's first*/, SharedTokenBucket*> shard_send_limiters; // an account's engines send under one rate
 };
 
 #endif // TREXTRADER_H
@@ -21,14 +21,65 @@ QMAKE_LFLAGS += "-z noexecstack -z relro -z now"
 
 SOURCES += main.cpp \
     alphatracker.cpp \
+    asyncsaver.cpp \
+    asynclog.cpp \
+    asynclog_test.cpp \
+    bbocache.cpp \
+    marketevents.cpp \
     commandlistener.cpp \
     commandrunner.cpp \
     costfunctioncache.cpp \
     fallbacklistener.cpp \
     market.cpp \
+    marketrecorder.cpp \
+    mocknetwork.cpp \
+    mocknetwork_test.cpp \
+    replyparser_test.cpp \
+    marketevents_test.cpp \
+    orderbook.cpp \
+    orderbook_test.cpp \
+    paperexchange.cpp \
+    tickerhistory.cpp \
+    tickerhistory_test.cpp \
     position.cpp \
+    strategytag.cpp \
     engine.cpp \
     positionman.cpp \
+    positionpool.cpp \
+    positionsnapshot.cpp \
+    balanceledger.cpp \
+    eventfeed.cpp \
+    positiongrid.cpp \
+    threadplacement.cpp \
+    latencyhistogram.cpp \
+    metrics.cpp \
+    looplag.cpp \
+    marketshards.cpp \
+    linkauth.cpp \
+    sprucelink.cpp \
+    standbylink.cpp \
+    orderjournal.cpp \
+    settingsstate.cpp \
+    requestqueue.cpp \
+    tokenbucket.cpp \
+    taskscheduler.cpp \
+    taskscheduler_test.cpp \
+    looplag_test.cpp \
+    marketshards_test.cpp \
+    sprucelink_test.cpp \
+    standbylink_test.cpp \
+    balanceledger_test.cpp \
+    eventfeed_test.cpp \
+    positiongrid_test.cpp \
+    costfunctioncache_test.cpp \
+    tracespan.cpp \
+    memorystats.cpp \
+    virtualclock.cpp \
+    jsonstreamreader.cpp \
+    replyparser.cpp \
+    jsonstreamreader_test.cpp \
+    hmacsigner.cpp \
+    hmacsigner_test.cpp \
     spruce.cpp \
     spruceoverseer.cpp \
     spruceoverseer_test.cpp \
@@ -42,13 +93,14 @@ SOURCES += main.cpp \
     coinamount.cpp \
     coinamount_test.cpp \
     wavesutil.cpp \
+    blake2bdispatch.cpp \
     wavesutil_test.cpp \
     wavesaccount.cpp \
+    wavessigner.cpp \
     wavesaccount_test.cpp \
     ../libbase58/base58.c \
     ../qbase58/qbase58.cpp \
     ../qbase58/qbase58_test.cpp \
-    ../blake2b/sse/blake2b.c \
     ../libcurve25519-donna/nacl_sha512/hash.c \
     ../libcurve25519-donna/nacl_sha512/blocks.c \
     ../libcurve25519-donna/additions/keygen.c \
@@ -98,19 +150,77 @@ SOURCES += main.cpp \
 
 HEADERS += build-config.h \
     alphatracker.h \
+    asyncsaver.h \
+    asynclog.h \
+    asynclog_test.h \
+    bbocache.h \
+    marketevents.h \
     commandlistener.h \
     commandrunner.h \
     costfunctioncache.h \
     enginesettings.h \
     fallbacklistener.h \
     global.h \
+    ipcprotocol.h \
     coinamount.h \
     keydefs.h \
     market.h \
+    marketrecorder.h \
+    mocknetwork.h \
+    mocknetwork_test.h \
+    replyparser_test.h \
+    marketevents_test.h \
+    orderbook.h \
+    orderbook_test.h \
+    paperexchange.h \
+    tickerhistory.h \
+    tickerhistory_test.h \
     position.h \
+    strategytag.h \
     engine.h \
     positiondata.h \
+    positiongrid.h \
     positionman.h \
+    positionpool.h \
+    positionsnapshot.h \
+    balanceledger.h \
+    eventfeed.h \
+    threadplacement.h \
+    latencyhistogram.h \
+    metrics.h \
+    looplag.h \
+    orderjournal.h \
+    settingsstate.h \
+    requestqueue.h \
+    tokenbucket.h \
+    ratewindow.h \
+    circuitbreaker.h \
+    streamresync.h \
+    flowtuner.h \
+    serverclock.h \
+    marketshards.h \
+    linkauth.h \
+    sprucelink.h \
+    standbylink.h \
+    taskscheduler.h \
+    taskscheduler_test.h \
+    looplag_test.h \
+    marketshards_test.h \
+    sprucelink_test.h \
+    standbylink_test.h \
+    balanceledger_test.h \
+    eventfeed_test.h \
+    positiongrid_test.h \
+    costfunctioncache_test.h \
+    tracespan.h \
+    memorystats.h \
+    virtualclock.h \
+    jsonstreamreader.h \
+    replyparser.h \
+    spscqueue.h \
+    jsonstreamreader_test.h \
+    hmacsigner.h \
+    hmacsigner_test.h \
     spruce.h \
     spruceoverseer.h \
     spruceoverseer_test.h \
@@ -123,16 +233,18 @@ HEADERS += build-config.h \
     engine_test.h \
     baserest.h \
     misctypes.h \
+    orderid.h \
     ssl_policy.h \
     coinamount_test.h \
     wavesutil.h \
+    blake2bdispatch.h \
     wavesutil_test.h \
     wavesaccount.h \
+    wavessigner.h \
     wavesaccount_test.h \
     ../libbase58/libbase58.h \
     ../qbase58/qbase58.h \
     ../qbase58/qbase58_test.h \
-    ../blake2b/sse/blake2.h \
     ../libcurve25519-donna/nacl_includes/crypto_uint32.h \
     ../libcurve25519-donna/nacl_includes/crypto_int32.h \
     ../libcurve25519-donna/fe.h \
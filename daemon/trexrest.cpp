@@ -1,8 +1,12 @@
 #include "trexrest.h"
 #include "position.h"
 #include "positionman.h"
+#include "jsonstreamreader.h"
 #include "alphatracker.h"
 #include "engine.h"
+#include "taskscheduler.h"
+#include "virtualclock.h"
+#include "tracespan.h"
 
 #include <QTimer>
 #include <QNetworkAccessManager>
@@ -25,16 +29,13 @@ TrexREST::TrexREST( Engine *_engine, QNetworkAccessManager *_nam )
     connect( nam, &QNetworkAccessManager::finished, this, &TrexREST::onNamReply );
 
     exchange_string = BITTREX_EXCHANGE_STR;
+    is_http2_supported = true;
 }
 
 TrexREST::~TrexREST()
 {
-#if !defined( BITTREX_TICKER_ONLY )
-    order_history_timer->stop();
-
-    delete order_history_timer;
+    // our tasks go with us, see TaskScheduler::addTask()
     order_history_timer = nullptr;
-#endif
 
     kDebug() << "[TrexREST] done.";
 }
@@ -48,27 +49,41 @@ void TrexREST::init()
     BaseREST::market_cancel_thresh = 300; // limit for market order total for weighting cancels to be sent first
 
     // we use this to send the requests at a predictable rate
-    connect( send_timer, &QTimer::timeout, this, &TrexREST::sendNamQueue );
+    send_timer->setCallback( [this]() { sendNamQueue(); } );
+    send_wake_timer->setCallback( [this]() { sendNamQueue(); } );
     send_timer->start( BITTREX_TIMER_INTERVAL_NAM_SEND ); // minimum threshold 200 or so
+    setSendRate( 1000. / BITTREX_TIMER_INTERVAL_NAM_SEND ); // same average rate as the timer, in bursts
+
+    // open the connection now instead of on the first request
+    startConnectionWarming( getWarmUrl() );
+
+    prebuildRequestTemplates( QStringList() << TREX_COMMAND_CANCEL << TREX_COMMAND_BUY << TREX_COMMAND_SELL
+                                            << TREX_COMMAND_GET_ORDERS << TREX_COMMAND_GET_ORDER
+                                            << TREX_COMMAND_GET_ORDER_HIST << TREX_COMMAND_GET_BALANCES
+                                            << TREX_COMMAND_GET_MARKET_SUMS );
 
-    connect( ticker_timer, &QTimer::timeout, this, &TrexREST::onCheckTicker );
+    ticker_timer->setCallback( [this]() { onCheckTicker(); } );
     ticker_timer->start( BITTREX_TIMER_INTERVAL_TICKER );
 
 #if !defined( BITTREX_TICKER_ONLY )
     keystore.setKeys( BITTREX_KEY, BITTREX_SECRET );
+    signer.setKey( keystore.getSecret(), HmacSigner::Sha512 );
 
     // this timer requests the order book
-    connect( orderbook_timer, &QTimer::timeout, this, &TrexREST::onCheckBotOrders );
+    orderbook_timer->setCallback( [this]() { onCheckBotOrders(); } );
     orderbook_timer->start( BITTREX_TIMER_INTERVAL_ORDERBOOK );
 
-    // this timer requests the order book
-    order_history_timer = new QTimer( this );
-    connect( order_history_timer, &QTimer::timeout, this, &TrexREST::onCheckOrderHistory );
-    order_history_timer->setTimerType( Qt::VeryCoarseTimer );
+    // this requests the order history
+    order_history_timer = engine->getScheduler()->addTask( this, "order history", [this]() { onCheckOrderHistory(); },
+                                                           TASK_PRIORITY_ORDERS, 0.05 );
     order_history_timer->start( BITTREX_TIMER_INTERVAL_ORDER_HISTORY );
 
+    // this seeds the balance ledger, then checks it against the exchange
+    balance_timer->start( BalanceLedger::RECONCILE_INTERVAL );
+
     onCheckOrderHistory();
     onCheckBotOrders();
+    checkBalances();
 #endif
 
     onCheckTicker();
@@ -78,9 +93,7 @@ void TrexREST::init()
 
 void TrexREST::sendNamQueue()
 {
-    // stop sending commands if server is unresponsive
-    if ( yieldToServer() )
-        return;
+    QMutexLocker locker( engine->getLock() );
 
     // check for cancelled orders that we should poll for partial fills
 //    if ( nam_queue.isEmpty() &&
@@ -92,84 +105,49 @@ void TrexREST::sendNamQueue()
 //        sendRequest( TREX_COMMAND_GET_ORDER, "uuid=" + order_number, nullptr );
 //    }
 
-    // check for requests
-    if ( nam_queue.isEmpty() )
-        return;
-
-    QMultiMap<Coin/*weight*/,Request*> sorted_nam_queue;
-
-    // insert into auto sorted map sorted by weight
-    for ( QQueue<Request*>::const_iterator i = nam_queue.begin(); i != nam_queue.end(); i++ )
+    // send as many requests as the rate limit allows
+    while ( !nam_queue.isEmpty() && !yieldToServer() )
     {
-        Request *const &request = *i;
-        Position *const &pos = request->pos;
-
-        // check for valid pos
-        if ( !pos || !engine->getPositionMan()->isValid( pos ) )
-        {
-            sorted_nam_queue.insert( Coin(), request );
-            continue;
-        }
-
-        // check if we should prioritize cancel
-        if ( request->api_command == TREX_COMMAND_CANCEL &&
-             engine->getPositionMan()->getMarketOrderTotal( pos->market ) >= market_cancel_thresh )
-        {
-            // expedite the cancel
-            sorted_nam_queue.insert( CoinAmount::COIN, request );
-            continue;
-        }
-
-        if ( request->api_command == TREX_COMMAND_GET_ORDER_HIST )
-        {
-            sorted_nam_queue.insert( CoinAmount::SATOSHI, request );
-            continue;
-        }
-
-        // new hi/lo buy or sell, we should value this at 0 because it's not a reactive order
-        if ( pos->is_new_hilo_order )
-        {
-            sorted_nam_queue.insert( Coin(), request );
-            continue;
-        }
-
-        // check for not buy/sell command
-        if ( request->api_command != TREX_COMMAND_BUY &&
-             request->api_command != TREX_COMMAND_SELL )
-        {
-            sorted_nam_queue.insert( Coin(), request );
-            continue;
-        }
-
-        sorted_nam_queue.insert( pos->per_trade_profit, request );
-    }
-
-    // go through orders, ranked from highest weight to lowest
-    for ( QMultiMap<Coin,Request*>::const_iterator i = sorted_nam_queue.end() -1; i != sorted_nam_queue.begin() -1; i-- )
-    {
-        Request *const &request = i.value();
-
         // check if we received the orderbook in the timeframe of an order timeout grace period
-        // if it's stale, we can assume the server is down and we let the orders timeout
-        if ( yieldToLag() && request->api_command != TREX_COMMAND_GET_ORDER_HIST )
-        {
-            // let this request hang around until the orderbook is responded to
-            continue;
-        }
+        // if it's stale, we can assume the server is down and we let the orders timeout, except for the order history
+        Request *request = getNextRequest( yieldToLag() ? QString( TREX_COMMAND_GET_ORDER_HIST ) : QString() );
+
+        // let the rest hang around until the orderbook is responded to, or until we have tokens
+        if ( !request || !takeSendTokens() )
+            return;
 
         sendNamRequest( request );
         // the request is added to sent_nam_queue and thus not deleted until the response is met
-        return;
     }
 }
 
+void TrexREST::buildRequestTemplate( const QString &api_command, RequestTemplate &t ) const
+{
+    t.nam_request.setUrl( QUrl( TREX_REST_URL + api_command ) );
+    t.verb = "GET";
+    t.is_signed = true; // if we have keys
+}
+
+quint8 TrexREST::getRequestClass( const QString &api_command ) const
+{
+    if ( api_command == TREX_COMMAND_CANCEL )
+        return REQUEST_CANCEL;
+    if ( api_command == TREX_COMMAND_BUY || api_command == TREX_COMMAND_SELL )
+        return REQUEST_NEW_ORDER;
+    if ( api_command == TREX_COMMAND_GET_ORDER )
+        return REQUEST_ORDER_STATUS;
+
+    return REQUEST_POLL;
+}
+
 void TrexREST::sendNamRequest( Request *const &request )
 {
     // check for valid pos
-    if ( request->pos != nullptr && !engine->getPositionMan()->isValid( request->pos ) )
+    if ( request->pos != nullptr && !engine->getPositionMan()->isValid( request->pos, request->pos_generation ) )
     {
         kDebug() << "local warning: caught nam request with invalid position";
         nam_queue.removeOne( request );
+        releaseRequest( request );
         return;
     }
 
@@ -192,8 +170,11 @@ void TrexREST::sendNamRequest( Request *const &request )
     // add to sent queue so we can check if it timed out
     request->time_sent_ms = current_time;
 
-    // create url which will hold 'url'+'query_args'
-    QUrl url = QUrl( TREX_REST_URL + api_command );
+    const RequestTemplate &t = getRequestTemplate( api_command );
+
+    // copy the template url which will hold 'url'+'query_args'
+    QNetworkRequest nam_request = t.nam_request;
+    QUrl url = nam_request.url();
 
     // inherit the body from the input structure
     QUrlQuery query = QUrlQuery( request->body );
@@ -207,13 +188,11 @@ void TrexREST::sendNamRequest( Request *const &request )
     }
 
     url.setQuery( query );
-
-    QNetworkRequest nam_request;
     nam_request.setUrl( url );
 
     // add auth header
     if ( !keystore.isKeyOrSecretEmpty() )
-        nam_request.setRawHeader( TREX_APISIGN, Global::getBittrexPoloSignature( nam_request.url().toString().toLocal8Bit(), keystore.getSecret() ) );
+        nam_request.setRawHeader( TREX_APISIGN, signer.signHex( nam_request.url().toString().toLocal8Bit() ) );
 
     // send REST message
     QNetworkReply *const &reply = nam->get( nam_request );
@@ -224,16 +203,13 @@ void TrexREST::sendNamRequest( Request *const &request )
         return;
     }
 
-    nam_queue_sent.insert( reply, request );
-    nam_queue.removeOne( request );
+    trackSent( reply, request );
     last_request_sent_ms = current_time;
 }
 
 void TrexREST::sendBuySell( Position *const &pos, bool quiet )
 {
-    if ( !quiet )
-        kDebug() << QString( "queued          %1" )
-                    .arg( pos->stringifyOrderWithoutOrderID() );
+    kLogIf( LOG_LEVEL_DEBUG, !quiet && engine->getVerbosity() > 0 ) << "queued         " << pos->logOrderWithoutOrderID();
 
     // serialize some request options into url format
     QUrlQuery query;
@@ -251,7 +227,7 @@ void TrexREST::sendCancel( const QString &order_id, Position * const &pos )
 
     if ( pos && engine->getPositionMan()->isActive( pos ) )
     {
-        pos->is_cancelling = true;
+        engine->getPositionMan()->setCancelling( pos );
 
         // set the cancel time once here, and once on send, to avoid double cancel timeouts
         pos->order_cancel_time = QDateTime::currentMSecsSinceEpoch();
@@ -261,18 +237,40 @@ void TrexREST::sendCancel( const QString &order_id, Position * const &pos )
 bool TrexREST::yieldToLag() const
 {
     // have we seen the orderbook update recently?
-    return ( order_history_update_time != 0 &&
-             order_history_update_time < QDateTime::currentMSecsSinceEpoch() - ( BITTREX_TIMER_INTERVAL_ORDERBOOK *10 ) );
+    return ( ( order_history_update_time != 0 &&
+             order_history_update_time < QDateTime::currentMSecsSinceEpoch() - ( BITTREX_TIMER_INTERVAL_ORDERBOOK *10 ) ) ||
+             isResponseTimeOver( 0.99, limit_response_time_lag ) ); // or the server is lagging badly right now
 }
 
 void TrexREST::onNamReply( QNetworkReply *const &reply )
 {
+    TRACE_SPAN( "onNamReply" );
+    QMutexLocker locker( engine->getLock() );
+
     // don't process a reply we aren't tracking
     if ( !nam_queue_sent.contains( reply ) )
         return;
 
-    QString path = reply->url().path();
-    QByteArray data = reply->readAll();
+    QByteArray data = readReply( reply ); // shares reply_buffer, only error paths write to it
+
+    Request *const &request = takeSent( reply );
+    const QString &api_command = request->api_command;
+
+    // positions are recycled, forget ours if it was released and reused while the request was out
+    if ( request->pos != nullptr && request->pos->getGeneration() != request->pos_generation )
+        request->pos = nullptr;
+    const qint64 received_time = QDateTime::currentMSecsSinceEpoch();
+    const qint64 response_time = received_time - request->time_sent_ms;
+
+    response_times.add( api_command, response_time );
+    recordReply( reply, request, received_time );
+
+    // open orders are read straight from the bytes, without building a document
+    if ( api_command == TREX_COMMAND_GET_ORDERS && parseOpenOrders( data, request->time_sent_ms ) )
+    {
+        deleteReply( reply, request );
+        return;
+    }
 
     // parse any possible json in the body
     QJsonDocument body_json = QJsonDocument::fromJson( data );
@@ -292,12 +290,6 @@ void TrexREST::onNamReply( QNetworkReply *const &reply )
     else if ( is_object )
         result_obj = result_value.toObject();
 
-    Request *const &request = nam_queue_sent.take( reply );
-    const QString &api_command = request->api_command;
-    const qint64 response_time = QDateTime::currentMSecsSinceEpoch() - request->time_sent_ms;
-
-    avg_response_time.addResponseTime( response_time );
-
     // handle success=false
     if ( !success )
     {
@@ -415,7 +407,8 @@ void TrexREST::onNamReply( QNetworkReply *const &reply )
     }
     else if ( api_command == TREX_COMMAND_GET_ORDERS ) // getorder-fill
     {
-        parseOpenOrders( result_arr, request->time_sent_ms );
+        // parseOpenOrders() couldn't read it, don't take it for a blank orderbook
+        kDebug() << "local warning: unexpected open orders reply:" << data;
     }
     else if ( api_command == TREX_COMMAND_GET_MARKET_SUMS ) // ticker-fill
     {
@@ -458,11 +451,15 @@ void TrexREST::checkBotOrders( bool ignore_flow_control )
 
 void TrexREST::onCheckBotOrders()
 {
+    QMutexLocker locker( engine->getLock() );
+
     checkBotOrders();
 }
 
 void TrexREST::onCheckOrderHistory()
 {
+    QMutexLocker locker( engine->getLock() );
+
     // ensure key/secret is set and command is not queued
     if ( isKeyOrSecretUnset() || isCommandQueued( TREX_COMMAND_GET_ORDER_HIST ) || isCommandSent( TREX_COMMAND_GET_ORDER_HIST, 10 ) )
         return;
@@ -472,6 +469,8 @@ void TrexREST::onCheckOrderHistory()
 
 void TrexREST::onCheckTicker()
 {
+    QMutexLocker locker( engine->getLock() );
+
     if ( isCommandQueued( TREX_COMMAND_GET_MARKET_SUMS ) || isCommandSent( TREX_COMMAND_GET_MARKET_SUMS, 10 ) )
         return;
 
@@ -480,6 +479,8 @@ void TrexREST::onCheckTicker()
 
 void TrexREST::wssConnected()
 {
+    QMutexLocker locker( engine->getLock() );
+
 }
 
 void TrexREST::wssSendJsonObj( const QJsonObject &obj )
@@ -489,10 +490,14 @@ void TrexREST::wssSendJsonObj( const QJsonObject &obj )
 
 void TrexREST::wssCheckConnection()
 {
+    QMutexLocker locker( engine->getLock() );
+
 }
 
 void TrexREST::wssTextMessageReceived( const QString &msg )
 {
+    QMutexLocker locker( engine->getLock() );
+
     Q_UNUSED( msg )
 }
 
@@ -556,69 +561,147 @@ void TrexREST::parseCancelOrder( Request *const &request, const QJsonObject &res
     engine->processCancelledOrder( pos );
 }
 
-void TrexREST::parseOpenOrders( const QJsonArray &orders, qint64 request_time_sent_ms )
+bool TrexREST::parseOpenOrders( const QByteArray &data, qint64 request_time_sent_ms )
 {
     const qint64 current_time = QDateTime::currentMSecsSinceEpoch(); // cache time
 
+    // read { "success": true, "result": [ orders ] } in one pass, anything else goes through the normal reply handling
+    JsonStreamReader reader( data );
+    if ( reader.readNext() != JsonStreamReader::StartObject )
+        return false;
+
+    bool success = false, has_result = false;
+    open_orders.resize( 0 ); // keeps the capacity
+
+    while ( reader.readNext() == JsonStreamReader::Name )
+    {
+        if ( reader.isText( "success" ) )
+        {
+            reader.readScalar();
+            success = reader.toBool();
+            continue;
+        }
+        else if ( !reader.isText( "result" ) )
+        {
+            if ( !reader.skipValue() )
+                return false;
+
+            continue;
+        }
+
+        if ( reader.readNext() != JsonStreamReader::StartArray )
+            return false;
+
+        has_result = true;
+
+        while ( reader.readNext() != JsonStreamReader::EndArray )
+        {
+            if ( reader.tokenType() != JsonStreamReader::StartObject )
+            {
+                if ( !reader.skipCurrentValue() )
+                    return false;
+
+                continue;
+            }
+
+            QString market, order_number;
+            quint8 side = 0;
+            double price_d = 0., quantity_d = 0.;
+
+            while ( reader.readNext() == JsonStreamReader::Name )
+            {
+                if ( reader.isText( "Exchange" ) )
+                {
+                    reader.readScalar();
+                    market = reader.textString();
+                }
+                else if ( reader.isText( "OrderUuid" ) )
+                {
+                    reader.readScalar();
+                    order_number = reader.textString();
+                }
+                else if ( reader.isText( "OrderType" ) )
+                {
+                    reader.readScalar();
+                    side = reader.isText( "LIMIT_BUY" ) ? SIDE_BUY :
+                           reader.isText( "LIMIT_SELL" ) ? SIDE_SELL : 0;
+                }
+                // the exchange uses a double (wtf), we'll read a double
+                else if ( reader.isText( "Limit" ) )
+                {
+                    reader.readScalar();
+                    price_d = reader.toDouble();
+                }
+                else if ( reader.isText( "Quantity" ) )
+                {
+                    reader.readScalar();
+                    quantity_d = reader.toDouble();
+                }
+                else if ( !reader.skipValue() )
+                {
+                    return false;
+                }
+            }
+
+            if ( reader.tokenType() != JsonStreamReader::EndObject )
+                return false;
+
+            const Coin price = price_d;
+            const Coin amount = Coin( quantity_d ) * price;
+
+            // check for missing information
+            if ( market.isEmpty() ||
+                 order_number.isEmpty() ||
+                 side == 0 ||
+                 amount.isZeroOrLess() ) // only check amount: if price or quantity is 0, amount is also 0
+                continue;
+
+            open_orders.append( OrderRecord() );
+            OrderRecord &order = open_orders.last();
+            order.order_number = order_number;
+            order.market = market;
+            order.side = side;
+            order.price = price;
+            order.amount = amount;
+        }
+    }
+
+    if ( reader.tokenType() != JsonStreamReader::EndObject ||
+         reader.readNext() != JsonStreamReader::EndDocument ||
+         !success || !has_result )
+        return false;
+
     // is the orderbook is too old to be safe? check the stale tolerance
     if ( request_time_sent_ms < current_time - orderbook_stale_tolerance )
     {
         orders_stale_trip_count++;
-        return;
+        return true;
     }
 
     // don't accept responses for requests sooner than the latest response request_time_sent_ms
     if ( request_time_sent_ms < orderbook_update_request_time )
-        return;
+        return true;
 
     // set the timestamp of orderbook update if we saw any orders
     orderbook_update_time = current_time;
     orderbook_update_request_time = request_time_sent_ms;
 
-    // parse array of objects
-    QVector<QString> order_numbers; // keep track of order numbers
-    QMultiHash<QString, OrderInfo> order_map; // store map of order numbers/orderinfo
-
-    for ( QJsonArray::const_iterator i = orders.begin(); i != orders.end(); ++i )
-    {
-        if ( !(*i).isObject() )
-            continue;
-
-        const QJsonObject &order = (*i).toObject();
-
-        const QString &market = order.value( "Exchange" ).toString();
-        const QString &order_number = order.value( "OrderUuid" ).toString();
-        const QString &order_type = order.value( "OrderType" ).toString();
-        const  quint8 &side = order_type == "LIMIT_BUY" ? SIDE_BUY :
-                              order_type == "LIMIT_SELL" ? SIDE_SELL : 0;
-
-        // the exchange uses a double (wtf), we'll read a double
-        const Coin price = order.value( "Limit" ).toDouble();
-        const Coin quantity = order.value( "Quantity" ).toDouble();
-        const Coin amount = quantity * price;
-
-        //kDebug() << order;
-        //kDebug() << market << side << amount << "@" << price << order_number;
-
-        // check for missing information
-        if ( market.isEmpty() ||
-             order_number.isEmpty() ||
-             side == 0 ||
-             amount.isZeroOrLess() ) // only check amount: if price or quantity is 0, amount is also 0
-            continue;
-
-        // insert into seen orders
-        order_numbers.append( order_number );
-
-        // insert (market, order)
-        order_map.insert( market, OrderInfo( order_number, side, price, amount ) );
-    }
+    engine->processOpenOrders( open_orders, request_time_sent_ms );
+    return true;
+}
 
-    engine->processOpenOrders( order_numbers, order_map, request_time_sent_ms );
+void TrexREST::checkBalances( bool print )
+{
+    is_printing_balances = is_printing_balances || print;
+    sendRequest( TREX_COMMAND_GET_BALANCES );
 }
 
 void TrexREST::parseReturnBalances( const QJsonArray &balances )
-{ // prints exchange balances
+{ // reconciles the ledger, and prints exchange balances for getbalances
+    const bool print = is_printing_balances;
+    is_printing_balances = false;
+
+    QMap<QString, BalanceLedger::Balance> polled;
     Coin total_d;
 
     for ( QJsonArray::const_iterator i = balances.begin(); i != balances.end(); ++i )
@@ -641,6 +724,14 @@ void TrexREST::parseReturnBalances( const QJsonArray &balances )
         if ( balance.isZeroOrLess() && pending.isZeroOrLess() )
             continue;
 
+        // pending deposits aren't ours to trade yet
+        BalanceLedger::Balance &ledger_balance = polled[ currency ];
+        ledger_balance.total = balance;
+        ledger_balance.held = balance - available;
+
+        if ( !print )
+            continue;
+
         // store value of current currency
         Coin value_d = balance + pending;
 
@@ -668,7 +759,10 @@ void TrexREST::parseReturnBalances( const QJsonArray &balances )
         kDebug() << out;
     }
 
-    kDebug() << "total:" << total_d;
+    engine->getLedger().reconcile( polled, VirtualClock::currentMSecsSinceEpoch() );
+
+    if ( print )
+        kDebug() << "total:" << total_d;
 }
 
 void TrexREST::parseGetOrder( const QJsonObject &order )
@@ -751,7 +845,8 @@ void TrexREST::parseOrderBook( const QJsonArray &info, qint64 request_time_sent_
 
     ticker_update_request_time = request_time_sent_ms;
 
-    QMap<QString, TickerInfo> ticker_info;
+    QVector<MarketTicker> ticker_info;
+    ticker_info.reserve( info.size() );
 
     // iterate through each market object
     for ( QJsonArray::const_iterator i = info.begin(); i != info.end(); i++ )
@@ -767,18 +862,21 @@ void TrexREST::parseOrderBook( const QJsonArray &info, qint64 request_time_sent_
              !info.contains( "Bid" ) )
             continue;
 
-        const QString &market = info[ "MarketName" ].toString();
+        // skip the markets we don't trade before parsing their prices
+        const Market market( info[ "MarketName" ].toString() );
+        if ( !market.isValid() || !engine->isTrackedMarket( market.getId() ) )
+            continue;
+
         const Coin ask = info[ "Ask" ].toDouble();
         const Coin bid = info[ "Bid" ].toDouble();
 
         //kDebug() << market << "bid:" << bid << "ask:" << ask;
 
         // update our maps
-        if ( market.size() > 0 &&
-             bid.isGreaterThanZero() &&
+        if ( bid.isGreaterThanZero() &&
              ask.isGreaterThanZero() )
         {
-            ticker_info.insert( market, TickerInfo( bid, ask ) );
+            ticker_info += MarketTicker( market.getId(), bid, ask );
         }
     }
 
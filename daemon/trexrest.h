@@ -26,15 +26,19 @@ public:
     ~TrexREST();
 
     void init();
+    QString getWarmUrl() const { return TREX_REST_URL; }
+    void checkBalances( bool print = false );
 
     bool yieldToLag() const;
 
     void sendNamRequest( Request *const &request );
+    void buildRequestTemplate( const QString &api_command, RequestTemplate &t ) const;
+    quint8 getRequestClass( const QString &api_command ) const;
     void sendBuySell( Position *const &pos, bool quiet = true );
     void sendCancel( const QString &order_id, Position *const &pos = nullptr );
     void parseBuySell( Request *const &request, const QJsonObject &response );
     void parseCancelOrder( Request *const &request, const QJsonObject &response );
-    void parseOpenOrders(const QJsonArray &orders, qint64 request_time_sent_ms );
+    bool parseOpenOrders( const QByteArray &data, qint64 request_time_sent_ms ); // false if it isn't a successful orders reply
     void parseReturnBalances( const QJsonArray &balances );
     void parseGetOrder( const QJsonObject &order );
     void parseOrderBook( const QJsonArray &info, qint64 request_time_sent_ms );
@@ -59,7 +63,7 @@ public Q_SLOTS:
 private:
     qint64 order_history_update_time{ 0 };
 
-    QTimer *order_history_timer{ nullptr };
+    ScheduledTask *order_history_timer{ nullptr };
 };
 
 #endif // TREXREST_H
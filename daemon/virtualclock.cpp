@@ -0,0 +1,3 @@
+#include "virtualclock.h"
+
+std::atomic<qint64> VirtualClock::virtual_time( 0 );
@@ -0,0 +1,26 @@
+#ifndef VIRTUALCLOCK_H
+#define VIRTUALCLOCK_H
+
+#include <QDateTime>
+
+#include <atomic>
+
+//
+// VirtualClock, the time the engine logic runs on. it follows the wall clock unless trader-replay sets it to the
+// time of the record being replayed, so order ages, timeouts and stale checks play out like they did when recorded
+//
+namespace VirtualClock
+{
+    extern std::atomic<qint64> virtual_time; // zero follows the wall clock
+
+    static inline qint64 currentMSecsSinceEpoch()
+    {
+        const qint64 time = virtual_time.load( std::memory_order_relaxed );
+        return time > 0 ? time : QDateTime::currentMSecsSinceEpoch();
+    }
+
+    static inline void setTime( const qint64 time ) { virtual_time.store( time, std::memory_order_relaxed ); }
+    static inline bool isVirtual() { return virtual_time.load( std::memory_order_relaxed ) > 0; }
+}
+
+#endif // VIRTUALCLOCK_H
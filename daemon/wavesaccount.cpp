@@ -7,12 +7,50 @@
 #include "../libcurve25519-donna/additions/curve_sigs.h"
 
 #include <QDebug>
-#include <QRandomGenerator>
 #include <QJsonObject>
-#include <QJsonArray>
-#include <QJsonDocument>
 #include <QDataStream>
 
+#include <cstring>
+
+static const qint32 ORDER_JSON_RESERVE = 512; // an order body is ~450 bytes with the id and proof, and 33 byte assets
+
+static inline char *putInt64( char *p, const qint64 value )
+{
+    // big endian, like QDataStream
+    for ( int i = 7; i >= 0; i-- )
+        *p++ = char( quint64( value ) >> ( i * 8 ) );
+
+    return p;
+}
+
+// decimal, without QByteArray::number() allocating
+static inline void appendInt64( QByteArray &out, const qint64 value )
+{
+    char buf[ 24 ];
+    char *end = buf + sizeof( buf );
+    char *p = end;
+
+    quint64 n = value < 0 ? quint64( 0 ) - quint64( value ) : quint64( value );
+    do
+    {
+        *--p = char( '0' + n % 10 );
+        n /= 10;
+    }
+    while ( n > 0 );
+
+    if ( value < 0 )
+        *--p = '-';
+
+    out.append( p, int( end - p ) );
+}
+
+// the order body's asset pair, up to the expiration. the ids are base58 or "WAVES", nothing to escape
+static QByteArray getAssetPairJson( const QString &amount_asset, const QString &price_asset )
+{
+    return ",\"assetPair\":{\"amountAsset\":\"" + amount_asset.toLatin1() +
+           "\",\"priceAsset\":\"" + price_asset.toLatin1() + "\"},\"expiration\":";
+}
+
 WavesAccount::WavesAccount()
 {
 }
@@ -36,6 +74,9 @@ void WavesAccount::setPrivateKey( const QByteArray &new_private_key )
 
     curve25519_keygen( reinterpret_cast<uint8_t*>( public_key.data() ),
                        reinterpret_cast<uint8_t*>( private_key.data() ) );
+
+    signer.setPrivateKey( private_key );
+    updateOrderHeader();
 }
 
 void WavesAccount::setPrivateKeyB58( const QByteArray &new_private_key_b58 )
@@ -43,6 +84,28 @@ void WavesAccount::setPrivateKeyB58( const QByteArray &new_private_key_b58 )
     setPrivateKey( QBase58::decode( new_private_key_b58 ) );
 }
 
+void WavesAccount::setMatcherPublicKeyB58( const QByteArray &new_matcher_public_key_b58 )
+{
+    matcher_public_key = QBase58::decode( new_matcher_public_key_b58 );
+    updateOrderHeader();
+}
+
+void WavesAccount::updateOrderHeader()
+{
+    order_header.clear();
+
+    // the order body around the keys, in the key order QJsonDocument wrote them in
+    order_json_matcher = "\",\"matcherFee\":300000,\"matcherPublicKey\":\"" + QBase58::encode( matcher_public_key ) + "\",\"orderType\":\"";
+    order_json_sender = "\"],\"senderPublicKey\":\"" + QBase58::encode( public_key ) + "\",\"timestamp\":";
+
+    if ( public_key.size() < 32 || matcher_public_key.size() < 32 )
+        return;
+
+    order_header += 0x02; // version byte
+    order_header += public_key;
+    order_header += matcher_public_key;
+}
+
 QByteArray WavesAccount::address( const uint8_t network ) const
 {
     if ( public_key.size() < 32 )
@@ -70,31 +133,7 @@ QByteArray WavesAccount::address( const uint8_t network ) const
 
 bool WavesAccount::sign( const QByteArray &message, QByteArray &signature, bool add_random_bytes ) const
 {
-    if ( private_key.size() < 32 )
-    {
-        kDebug() << "local error: WavesAccount::sign: private key size <32";
-        return false;
-    }
-
-    // generate random bytes if add_random_bytes is set
-    QByteArray random_bytes;
-    random_bytes.resize( 64 );
-
-    if ( add_random_bytes )
-        QRandomGenerator::global()->generate( random_bytes.begin(), random_bytes.end() );
-    else
-        random_bytes.fill( 0x00 );
-
-    // assure correct signature buffer size
-    signature.resize( 64 );
-
-    const int ret = curve25519_sign( reinterpret_cast<uint8_t*>( signature.data() ),
-                                     reinterpret_cast<const uint8_t*>( private_key.constData() ),
-                                     reinterpret_cast<const uint8_t*>( message.constData() ),
-                                     message.size(),
-                                     reinterpret_cast<const uint8_t*>( random_bytes.constData() ) );
-
-    return ret == 0;
+    return signer.sign( message, signature, add_random_bytes );
 }
 
 bool WavesAccount::verify( const QByteArray &message, const QByteArray &signature ) const
@@ -150,6 +189,22 @@ void WavesAccount::initAssetMaps()
     // duplicate the above map into reverse access map alias_by_asset
     for ( QMap<QString,QString>::const_iterator i = asset_by_alias.begin(); i != asset_by_alias.end(); i++ )
         alias_by_asset.insert( i.value(), i.key() );
+
+    // the asset bytes for every pair, so new orders don't look up and decode the asset ids
+    order_asset_bytes.clear();
+    order_asset_json.clear();
+    for ( QMap<QString,QString>::const_iterator quote = alias_by_asset.begin(); quote != alias_by_asset.end(); quote++ )
+    {
+        for ( QMap<QString,QString>::const_iterator base = alias_by_asset.begin(); base != alias_by_asset.end(); base++ )
+        {
+            if ( base == quote )
+                continue;
+
+            const qint32 market_id = Market( base.key(), quote.key() ).getId();
+            order_asset_bytes.insert( market_id, WavesUtil::getAssetBytes( quote.value() ) + WavesUtil::getAssetBytes( base.value() ) );
+            order_asset_json.insert( market_id, getAssetPairJson( quote.value(), base.value() ) );
+        }
+    }
 }
 
 QByteArray WavesAccount::createCancelBytes( const QByteArray &order_id_b58 ) const
@@ -165,33 +220,61 @@ QByteArray WavesAccount::createCancelBytes( const QByteArray &order_id_b58 ) con
 
 QByteArray WavesAccount::createCancelBody( const QByteArray &order_id_b58, bool random_sign_bytes ) const
 {
-    if ( public_key.size() < 32 )
-    {
-        kDebug() << "local error: WavesAccount::createCancelBody: account public key is empty";
+    WavesSignJob job;
+    job.add_random_bytes = random_sign_bytes;
+
+    if ( !createCancelJob( order_id_b58, job ) )
         return QByteArray();
-    }
 
-    const QByteArray cancel_order_bytes = createCancelBytes( order_id_b58 );
-    QByteArray signature;
-    const bool sign_result = sign( cancel_order_bytes, signature, random_sign_bytes );
+    const bool sign_result = signer.signJob( job );
 
     assert( sign_result );
 
+    return job.signed_body;
+}
+
+bool WavesAccount::createCancelJob( const QByteArray &order_id_b58, WavesSignJob &job ) const
+{
+    if ( public_key.size() < 32 )
+    {
+        kDebug() << "local error: WavesAccount::createCancelJob: account public key is empty";
+        return false;
+    }
+
+    job.bytes = createCancelBytes( order_id_b58 );
+    job.is_order = false;
+
     //qDebug() << acc.publicKeyB58();
     //qDebug() << cancel_order_bytes.size() << cancel_order_bytes.toHex();
 
-    QJsonObject obj;
-    obj[ "orderId" ] = QString( order_id_b58 );
-    obj[ "sender" ] = QString( publicKeyB58() );
-    obj[ "senderPublicKey" ] = QString( publicKeyB58() );
-    obj[ "signature" ] = QString( QBase58::encode( signature ) );
-    obj[ "proofs" ] = QJsonArray{ QString( QBase58::encode( signature ) ) };
+    job.body = QJsonObject();
+    job.body[ "orderId" ] = QString( order_id_b58 );
+    job.body[ "sender" ] = QString( publicKeyB58() );
+    job.body[ "senderPublicKey" ] = QString( publicKeyB58() );
 
-    // jsonify object
-    QJsonDocument doc;
-    doc.setObject( obj );
+    return true;
+}
+
+bool WavesAccount::createCancelPairJob( const qint64 epoch_now, WavesSignJob &job ) const
+{
+    if ( public_key.size() < 32 )
+    {
+        kDebug() << "local error: WavesAccount::createCancelPairJob: account public key is empty";
+        return false;
+    }
+
+    // the timestamp takes the place of the order id
+    job.bytes = QByteArray( 40, Qt::Uninitialized );
+    std::memcpy( job.bytes.data(), public_key.constData(), 32 );
+    putInt64( job.bytes.data() + 32, epoch_now );
+    job.is_order = false;
 
-    return doc.toJson( QJsonDocument::Compact );
+    job.body = QJsonObject();
+    job.body[ "sender" ] = QString( publicKeyB58() );
+    job.body[ "senderPublicKey" ] = QString( publicKeyB58() );
+    job.body[ "timestamp" ] = epoch_now;
+
+    return true;
 }
 
 QByteArray WavesAccount::createOrderBytes( Position * const &pos, const Coin &price_ticksize, const Coin &qty_ticksize, const qint64 epoch_now, const qint64 epoch_expiration ) const
@@ -204,27 +287,31 @@ QByteArray WavesAccount::createOrderBytes( Position * const &pos, const Coin &pr
         return QByteArray();
     }
 
-    QByteArray order_v2;
-    order_v2 += 0x02; // version byte
-    order_v2 += publicKey();
-    order_v2 += matcher_public_key;
-    order_v2 += WavesUtil::getAssetBytes( alias_by_asset.value( pos->market.getQuote() ) );
-    order_v2 += WavesUtil::getAssetBytes( alias_by_asset.value( pos->market.getBase() ) );
-    order_v2 += pos->side == SIDE_SELL ? WavesUtil::SELL : WavesUtil::BUY;
-
-    // the size is 1 + 32 + 32 + [ 1/33 ] + [ 1/33 ] + 1
-    // both assets cannot be size 1 but can be size 33, so the size is now either 100 or 132
-
-    QDataStream order_v2_stream( &order_v2, QIODevice::WriteOnly );
-    order_v2_stream.device()->seek( order_v2.size() );
-
-    order_v2_stream << Coin( CoinAmount::SATOSHI * ( pos->price / price_ticksize ) ).toIntSatoshis(); // price = 1000000
-    order_v2_stream << Coin( CoinAmount::SATOSHI * ( pos->quantity / qty_ticksize ) ).toIntSatoshis(); // amount = 9700000
-    order_v2_stream << epoch_now; // order set time +1 minute
-    order_v2_stream << epoch_expiration; // expiration time
-    order_v2_stream << qint64( 300000 ); // matcher fee = 300000
-
-    // make sure the stream only appended 40 more bytes ( size = 100 + 40 or 132 + 40 )
+    // amount and price asset bytes, each 1 or 33 bytes
+    const QHash<qint32, QByteArray>::const_iterator cached_asset_bytes = order_asset_bytes.constFind( pos->market.getId() );
+    const QByteArray asset_bytes = cached_asset_bytes != order_asset_bytes.constEnd() ?
+                                   cached_asset_bytes.value() :
+                                   WavesUtil::getAssetBytes( alias_by_asset.value( pos->market.getQuote() ) ) +
+                                   WavesUtil::getAssetBytes( alias_by_asset.value( pos->market.getBase() ) );
+
+    // the size is 1 + 32 + 32 + [ 1/33 ] + [ 1/33 ] + 1 + 5 * 8
+    // both assets cannot be size 1 but can be size 33, so the size is either 140 or 172
+    QByteArray order_v2( order_header.size() + asset_bytes.size() + 1 + 40, Qt::Uninitialized );
+    char *p = order_v2.data();
+
+    std::memcpy( p, order_header.constData(), size_t( order_header.size() ) );
+    p += order_header.size();
+    std::memcpy( p, asset_bytes.constData(), size_t( asset_bytes.size() ) );
+    p += asset_bytes.size();
+    *p++ = char( pos->side == SIDE_SELL ? WavesUtil::SELL : WavesUtil::BUY );
+
+    p = putInt64( p, Coin( CoinAmount::SATOSHI * ( pos->price / price_ticksize ) ).toIntSatoshis() ); // price = 1000000
+    p = putInt64( p, Coin( CoinAmount::SATOSHI * ( pos->quantity / qty_ticksize ) ).toIntSatoshis() ); // amount = 9700000
+    p = putInt64( p, epoch_now ); // order set time +1 minute
+    p = putInt64( p, epoch_expiration ); // expiration time
+    p = putInt64( p, qint64( 300000 ) ); // matcher fee = 300000
+
+    assert( p == order_v2.constData() + order_v2.size() );
     assert( order_v2.size() == 140 || order_v2.size() == 172 );
 
     return order_v2;
@@ -235,52 +322,72 @@ QByteArray WavesAccount::createOrderId( const QByteArray &order_bytes ) const
     return QBase58::encode( WavesUtil::hashBlake2b( order_bytes ) );
 }
 
+QByteArray WavesAccount::getOrderKey( const QByteArray &order_bytes )
+{
+    // the timestamp, expiration and fee are the last 3 int64s
+    return order_bytes.left( order_bytes.size() - 3 * 8 );
+}
+
 QByteArray WavesAccount::createOrderBody( Position * const &pos, const Coin &price_ticksize, const Coin &qty_ticksize, const qint64 epoch_now, const qint64 epoch_expiration, bool random_sign_bytes ) const
+{
+    WavesSignJob job;
+    job.add_random_bytes = random_sign_bytes;
+
+    if ( !createOrderJob( pos, price_ticksize, qty_ticksize, epoch_now, epoch_expiration, job ) )
+        return QByteArray();
+
+    const bool sign_result = signer.signJob( job );
+
+    assert( sign_result );
+
+    return job.signed_body;
+}
+
+bool WavesAccount::createOrderJob( Position * const &pos, const Coin &price_ticksize, const Coin &qty_ticksize, const qint64 epoch_now, const qint64 epoch_expiration, WavesSignJob &job ) const
 {
     if ( matcher_public_key.size() < 32 ||
          public_key.size() < 32 ||
          alias_by_asset.size() == 0 )
     {
-        kDebug() << "local error: WavesAccount::createOrderBody: account pubkey or matcher pubkey is empty, or asset aliases are empty";
-        return QByteArray();
+        kDebug() << "local error: WavesAccount::createOrderJob: account pubkey or matcher pubkey is empty, or asset aliases are empty";
+        return false;
     }
 
-    const QByteArray order_bytes_v2 = createOrderBytes( pos, price_ticksize, qty_ticksize, epoch_now, epoch_expiration );
-    const QByteArray order_id_v2_b58 = createOrderId( order_bytes_v2 );
-    QByteArray signature;
-
-    const bool sign_result = sign( order_bytes_v2, signature, random_sign_bytes );
-
-    assert( sign_result );
+    job.bytes = createOrderBytes( pos, price_ticksize, qty_ticksize, epoch_now, epoch_expiration );
+    job.is_order = true;
 
 //    kDebug() << "price ticksize" << price_ticksize;
 //    kDebug() << "  qty ticksize" << qty_ticksize;
 //    kDebug() << "price parts" << Coin( CoinAmount::SATOSHI * ( pos->price / price_ticksize ) ).toIntSatoshis();
 //    kDebug() << "  qty parts" << Coin( CoinAmount::SATOSHI * ( pos->quantity / qty_ticksize ) ).toIntSatoshis();
 
-    QJsonObject order_body_v2;
-    // put transaction bytes
-    order_body_v2[ "orderType" ] = pos->side == SIDE_BUY ? "buy" : "sell";
-    order_body_v2[ "version" ] = 2;
-    order_body_v2[ "assetPair" ] = QJsonObject{ { "amountAsset", alias_by_asset.value( pos->market.getQuote() ) },
-                                                { "priceAsset", alias_by_asset.value( pos->market.getBase() ) } };
-    order_body_v2[ "price" ] = Coin( CoinAmount::SATOSHI * ( pos->price / price_ticksize ) ).toIntSatoshis();
-    order_body_v2[ "amount" ] = Coin( CoinAmount::SATOSHI * ( pos->quantity / qty_ticksize ) ).toIntSatoshis();
-    order_body_v2[ "timestamp" ] = epoch_now;
-    order_body_v2[ "expiration" ] = epoch_expiration;
-    order_body_v2[ "matcherFee" ] = 300000;
-    order_body_v2[ "matcherPublicKey" ] = QString( QBase58::encode( matcher_public_key ) );
-    order_body_v2[ "senderPublicKey" ] = QString( QBase58::encode( public_key ) );
-
-    // put order id and signature
-    order_body_v2[ "id" ] = QString( order_id_v2_b58 );
-    order_body_v2[ "proofs" ] = QJsonArray{ QString( QBase58::encode( signature ) ) };
-
-    // jsonify object
-    QJsonDocument doc;
-    doc.setObject( order_body_v2 );
-
-    return doc.toJson( QJsonDocument::Compact );
+    // the body as QJsonDocument would write it, keys sorted and compact, from the pieces that don't change. the signer
+    // puts the order id and the signature in the gaps
+    const QHash<qint32, QByteArray>::const_iterator cached_asset_json = order_asset_json.constFind( pos->market.getId() );
+
+    QByteArray &json = job.order_json;
+    json.clear();
+    json.reserve( ORDER_JSON_RESERVE );
+
+    json += "{\"amount\":";
+    appendInt64( json, Coin( CoinAmount::SATOSHI * ( pos->quantity / qty_ticksize ) ).toIntSatoshis() );
+    json += cached_asset_json != order_asset_json.constEnd() ?
+            cached_asset_json.value() :
+            getAssetPairJson( alias_by_asset.value( pos->market.getQuote() ), alias_by_asset.value( pos->market.getBase() ) );
+    appendInt64( json, epoch_expiration );
+    json += ",\"id\":\"";
+    job.id_offset = json.size();
+    json += order_json_matcher;
+    json += pos->side == SIDE_BUY ? "buy" : "sell";
+    json += "\",\"price\":";
+    appendInt64( json, Coin( CoinAmount::SATOSHI * ( pos->price / price_ticksize ) ).toIntSatoshis() );
+    json += ",\"proofs\":[\"";
+    job.proof_offset = json.size();
+    json += order_json_sender;
+    appendInt64( json, epoch_now );
+    json += ",\"version\":2}";
+
+    return true;
 }
 
 QByteArray WavesAccount::createGetOrdersBytes( const qint64 epoch_now )
@@ -3,9 +3,11 @@
 
 #include "../qbase58/qbase58.h"
 #include "coinamount.h"
+#include "wavessigner.h"
 
 #include <QByteArray>
 #include <QMap>
+#include <QHash>
 #include <QStringList>
 
 class Position;
@@ -22,7 +24,7 @@ public:
     /// crypto stuff
     void setPrivateKey( const QByteArray &new_private_key );
     void setPrivateKeyB58( const QByteArray &new_private_key_b58 );
-    void setMatcherPublicKeyB58( const QByteArray &new_matcher_public_key_b58 ) { matcher_public_key = QBase58::decode( new_matcher_public_key_b58 ); }
+    void setMatcherPublicKeyB58( const QByteArray &new_matcher_public_key_b58 );
 
     QByteArray privateKey() const { return private_key; }
     QByteArray privateKeyB58() const { return QBase58::encode( private_key ); }
@@ -32,6 +34,7 @@ public:
 
     bool sign( const QByteArray &message, QByteArray &signature, bool add_random_bytes = true ) const;
     bool verify( const QByteArray &message, const QByteArray &signature ) const;
+    const WavesSigner &getSigner() const { return signer; }
 
     /// order stuff
     void initAssetMaps();
@@ -42,15 +45,26 @@ public:
 
     QByteArray createCancelBytes( const QByteArray &order_id_b58 ) const;
     QByteArray createCancelBody( const QByteArray &order_id_b58, bool random_sign_bytes = true ) const;
+    bool createCancelJob( const QByteArray &order_id_b58, WavesSignJob &job ) const; // unsigned, see WavesSigner::signJob()
+    bool createCancelPairJob( const qint64 epoch_now, WavesSignJob &job ) const; // every order in the pair, ^
 
     QByteArray createOrderBytes( Position *const &pos, const Coin &price_ticksize, const Coin &qty_ticksize, const qint64 epoch_now, const qint64 epoch_expiration ) const;
     QByteArray createOrderId( const QByteArray &order_bytes ) const;
+    static QByteArray getOrderKey( const QByteArray &order_bytes ); // the bytes before the timestamps, the order whenever it's placed
     QByteArray createOrderBody( Position *const &pos, const Coin &price_ticksize, const Coin &qty_ticksize, const qint64 epoch_now, const qint64 epoch_expiration, bool random_sign_bytes = true ) const;
+    bool createOrderJob( Position *const &pos, const Coin &price_ticksize, const Coin &qty_ticksize, const qint64 epoch_now, const qint64 epoch_expiration, WavesSignJob &job ) const;
 
     QByteArray createGetOrdersBytes( const qint64 epoch_now );
 
 private:
+    void updateOrderHeader();
+
     QByteArray private_key, public_key, matcher_public_key;
+    QByteArray order_header; // version byte, sender and matcher public keys
+    QHash<qint32, QByteArray> order_asset_bytes; // amount then price asset bytes by market id, see initAssetMaps()
+    QHash<qint32, QByteArray> order_asset_json; // the "assetPair" of the order body by market id, ^
+    QByteArray order_json_matcher, order_json_sender; // the order body around the public keys, see updateOrderHeader()
+    WavesSigner signer;
 
     // asset mappings
     QMap<QString,QString> asset_by_alias, alias_by_asset;
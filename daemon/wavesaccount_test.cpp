@@ -3,6 +3,8 @@
 #include "position.h"
 
 #include <QByteArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 
 void WavesAccountTest::test()
 {
@@ -83,6 +85,19 @@ void WavesAccountTest::test()
     /// test creating order body from the order byes above
     assert( acc.createOrderBody( &pos, CoinAmount::SATOSHI, CoinAmount::SATOSHI, quint64( 1580472938469 ), quint64( 1582978538468 ) , false ) == "{\"amount\":9700000,\"assetPair\":{\"amountAsset\":\"WAVES\",\"priceAsset\":\"8LQW8f7P5d5PZM7GtZEBgaqRPGSzS3DfPuiXrURJ4AJS\"},\"expiration\":1582978538468,\"id\":\"DH2Uyfdoj2pj1t1EEbLPYJMVRcWYqw6kBgQkVZjNiE2o\",\"matcherFee\":300000,\"matcherPublicKey\":\"9cpfKN9suPNvfeUNphzxXMjcnn974eme8ZhWUjaktzU5\",\"orderType\":\"sell\",\"price\":1000000,\"proofs\":[\"DCKsiyJu1avWRDe3Zr5Wxt2T1A352T1TosxwUiaQEaTDqYoNC7D9N3fa6fDjGLL3QRbxKnovKchrMCJb6fv1d5y\"],\"senderPublicKey\":\"27YM9icwd6TwfZD3KEJpYsj7rLwPAShJdYXrCt8QRo6L\",\"timestamp\":1580472938469,\"version\":2}" );
 
+    // a buy, the same body as QJsonDocument writes
+    Position buy_pos = Position( "BTC_WAVES", SIDE_BUY, "", "0.01000000", "0.00097" );
+    const QByteArray buy_body = acc.createOrderBody( &buy_pos, CoinAmount::SATOSHI, CoinAmount::SATOSHI, quint64( 1580472938469 ), quint64( 1582978538468 ) , false );
+    const QJsonObject buy_obj = QJsonDocument::fromJson( buy_body ).object();
+    assert( buy_obj[ "orderType" ].toString() == "buy" && buy_obj[ "price" ].toVariant().toLongLong() == 1000000 );
+    assert( buy_obj[ "id" ].toString() == QString( acc.createOrderId( acc.createOrderBytes( &buy_pos, CoinAmount::SATOSHI, CoinAmount::SATOSHI, quint64( 1580472938469 ), quint64( 1582978538468 ) ) ) ) );
+    assert( QJsonDocument( buy_obj ).toJson( QJsonDocument::Compact ) == buy_body );
+
+    // an order signed ahead is found by the same key later, when the times have moved
+    const QByteArray buy_key = WavesAccount::getOrderKey( acc.createOrderBytes( &buy_pos, CoinAmount::SATOSHI, CoinAmount::SATOSHI, quint64( 1580472938469 ), quint64( 1582978538468 ) ) );
+    assert( buy_key == WavesAccount::getOrderKey( acc.createOrderBytes( &buy_pos, CoinAmount::SATOSHI, CoinAmount::SATOSHI, quint64( 1580472999999 ), quint64( 1582978599999 ) ) ) );
+    assert( buy_key != WavesAccount::getOrderKey( order_bytes_v2 ) );
+
     /// test creating get orders bytes
     QByteArray get_orders_bytes = acc.createGetOrdersBytes( qint64( 0 ) );
 
@@ -1,10 +1,14 @@
 #include "wavesrest.h"
 #include "position.h"
 #include "positionman.h"
+#include "jsonstreamreader.h"
 #include "alphatracker.h"
 #include "engine.h"
+#include "taskscheduler.h"
+#include "tracespan.h"
 #include "wavesaccount.h"
 #include "wavesutil.h"
+#include "blake2bdispatch.h"
 #include "enginesettings.h"
 
 #include <QTimer>
@@ -15,11 +19,41 @@
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QThread>
+#include <QThreadPool>
 #include <QWebSocket>
 #include <QDebug>
 #include <QDateTime>
+#include <QtMath>
+#include <QSet>
 
-static const int MAX_NEW_ORDERS_IN_FLIGHT = 2;
+#include <algorithm>
+
+static const QString MARKET_DATA_CACHE_NAME = "marketdata";
+static const qint64 MARKET_DATA_CACHE_MAX_AGE_SECS = 60 * 60 * 24; // the matcher key and ticksizes, asked for again anyway
+// new orders in flight, grows by one per round trip while the matcher is healthy and halves on errors/timeouts
+static const qreal NEW_ORDER_WINDOW_START = 2.;
+static const qreal NEW_ORDER_WINDOW_MIN = 1.;
+static const qreal NEW_ORDER_WINDOW_MAX = 16.;
+static const qint64 NEW_ORDER_TIMEOUT = 10000; // a new order reply slower than this counts as a timeout
+
+static const qint64 WSS_TIMEOUT = 30000; // reconnect and fall back to rest polling when a feed is quiet this long
+static const qint32 WSS_BOOK_DEPTH = 1; // we only use the spread
+
+static const qint64 CANCELLING_CHECK_SPACING = 1000; // after the first status query of a cancelled order, doubling
+static const qint64 CANCELLING_CHECK_SPACING_MAX = 30000;
+
+static const qint64 HISTORY_INTERVAL = 2000; // between order history requests, the polled orders wait for the next one
+static const qint64 CLOCK_TOLERANCE = 60000; // about how far from the matcher's clock a signed timestamp can be
+static const qint64 HISTORY_TIME_MARGIN = 60000; // the matcher's order timestamps are ours, give our clock some slack
+
+static const qint32 SIGN_THREADS_MAX = 4;
+static const qint32 SIGN_BATCH_MIN = 4; // fewer jobs are signed inline, the pool hop costs more than it saves
+
+// the flips of the grid orders are signed this often in the background. each one is used for PRESIGN_MAX_AGE, and
+// signed again once it's PRESIGN_REFRESH_AGE old so there's a fresh one before that runs out
+static const qint64 PRESIGN_INTERVAL = 10000;
+static const qint64 PRESIGN_MAX_AGE = 60000 * 5;
+static const qint64 PRESIGN_REFRESH_AGE = PRESIGN_MAX_AGE - 3 * PRESIGN_INTERVAL;
 
 WavesREST::WavesREST( Engine *_engine, QNetworkAccessManager *_nam )
     : BaseREST( _engine )
@@ -34,10 +68,28 @@ WavesREST::WavesREST( Engine *_engine, QNetworkAccessManager *_nam )
 
 WavesREST::~WavesREST()
 {
-    market_data_timer->stop();
-
-    delete market_data_timer;
+    // our tasks go with us, see TaskScheduler::addTask()
     market_data_timer = nullptr;
+    wss_timer = nullptr;
+    presign_timer = nullptr;
+
+    // let the signing batches finish, their replies to us are dropped with us
+    if ( sign_pool )
+        sign_pool->waitForDone();
+
+    while ( signing_requests.size() > 0 )
+        delete signing_requests.takeFirst();
+
+    // dispose of websocket
+    if ( wss )
+    {
+        // disconnect wss so we don't call wssCheckConnection()
+        disconnect( wss, &QWebSocket::disconnected, this, &WavesREST::wssCheckConnection );
+
+        wss->abort();
+        delete wss;
+        wss = nullptr;
+    }
 
     kDebug() << "[WavesREST] done.";
 }
@@ -46,34 +98,70 @@ void WavesREST::init()
 {
     BaseREST::limit_commands_queued = 30; // stop checks if we are over this many commands queued
     BaseREST::limit_commands_sent = 10; // stop checks if we are over this many commands sent
+    setNewOrderWindow( NEW_ORDER_WINDOW_START ); // new orders in flight, adjusted by updateNewOrderWindow()
     engine->getSettings()->order_timeout = 60000 * 15; // extend order timeout (we don't want stray orders during ddos)
 
     // init asset maps
     account.initAssetMaps();
 
+    kDebug() << "[WavesREST] blake2b backend:" << Blake2bDispatch::getBackendName( Blake2bDispatch::getBackend() );
+
+    // signing pool for new order and cancel bursts, leave the cores to the engines
+    sign_pool = new QThreadPool( this );
+    sign_pool->setMaxThreadCount( qBound( 1, QThread::idealThreadCount() / 2, SIGN_THREADS_MAX ) );
+
     // we use this to send the requests at a predictable rate
-    connect( send_timer, &QTimer::timeout, this, &WavesREST::sendNamQueue );
+    send_timer->setCallback( [this]() { sendNamQueue(); } );
+    send_wake_timer->setCallback( [this]() { sendNamQueue(); } );
     send_timer->start( WAVES_TIMER_INTERVAL_NAM_SEND ); // minimum threshold 200 or so
+    setSendRate( 1000. / WAVES_TIMER_INTERVAL_NAM_SEND ); // same average rate as the timer, in bursts
+
+    // open the connection now instead of on the first request
+    startConnectionWarming( getWarmUrl() );
 
-    // this timer requests market data
-    market_data_timer = new QTimer( this );
-    market_data_timer->setTimerType( Qt::VeryCoarseTimer );
-    connect( market_data_timer, &QTimer::timeout, this, &WavesREST::onCheckMarketData );
+    prebuildRequestTemplates( QStringList() << WAVES_COMMAND_GET_MATCHER_PUBKEY << WAVES_COMMAND_GET_MARKET_DATA
+                                            << WAVES_COMMAND_GET_MARKET_STATUS << WAVES_COMMAND_GET_ORDER_STATUS
+                                            << WAVES_COMMAND_GET_MY_ORDERS << WAVES_COMMAND_GET_MY_HISTORY << WAVES_COMMAND_POST_ORDER_CANCEL << WAVES_COMMAND_POST_PAIR_CANCEL
+                                            << WAVES_COMMAND_POST_ORDER_NEW );
+
+    // this requests market data
+    market_data_timer = engine->getScheduler()->addTask( this, "market data", [this]() { onCheckMarketData(); },
+                                                         TASK_PRIORITY_HOUSEKEEPING, 0.05, TASK_SKIP_IF_BUSY );
     market_data_timer->start( WAVES_TIMER_INTERVAL_MARKET_DATA );
 
-    connect( ticker_timer, &QTimer::timeout, this, &WavesREST::onCheckTicker );
+    ticker_timer->setCallback( [this]() { onCheckTicker(); } );
     ticker_timer->start( WAVES_TIMER_INTERVAL_TICKER );
 
+    // create websocket, the book feed works without keys
+    wss = new QWebSocket();
+    connect( wss, &QWebSocket::connected, this, &WavesREST::wssConnected );
+    connect( wss, &QWebSocket::disconnected, this, &WavesREST::wssCheckConnection );
+    connect( wss, &QWebSocket::textMessageReceived, this, &WavesREST::wssTextMessageReceived );
+
+    // check websocket frequently, started after the first market data
+    wss_timer = engine->getScheduler()->addTask( this, "wss check", [this]() { wssCheckConnection(); }, TASK_PRIORITY_HOUSEKEEPING, 0.05 );
+
 #if !defined( WAVES_TICKER_ONLY )
-    account.setPrivateKeyB58( WAVES_SECRET );
+    account.setPrivateKeyB58( account_key_b58.isEmpty() ? QByteArray( WAVES_SECRET ) : account_key_b58 );
 
     // when ticker mode is disabled, set dummy keys so BaseREST::isKeyOrSecretUnset() returns a sane value
     keystore.setKeys( "dummy", "dummy" );
 
-    connect( orderbook_timer, &QTimer::timeout, this, &WavesREST::onCheckBotOrders );
+    orderbook_timer->setCallback( [this]() { onCheckBotOrders(); } );
     orderbook_timer->start( WAVES_TIMER_INTERVAL_CHECK_MY_ORDERS );
+
+    // sign the next order of each grid position ahead, see onPresignOrders()
+    presign_timer = engine->getScheduler()->addTask( this, "presign", [this]() { onPresignOrders(); },
+                                                     TASK_PRIORITY_HOUSEKEEPING, 0.05, TASK_SKIP_IF_BUSY );
+    presign_timer->start( PRESIGN_INTERVAL );
 #endif
 
+    // set up the markets from the last reply while the first one is on its way
+    QJsonObject cached_data;
+    if ( readMetadataCache( MARKET_DATA_CACHE_NAME, MARKET_DATA_CACHE_MAX_AGE_SECS, cached_data ) &&
+         parseMarketData( cached_data ) )
+        kDebug() << "[WavesREST] read cached market data";
+
     onCheckMarketData();
 
     engine->loadSettings();
@@ -81,16 +169,22 @@ void WavesREST::init()
 
 void WavesREST::sendNamQueue()
 {
+    QMutexLocker locker( engine->getLock() );
+
     // stop sending commands if server is unresponsive
     if ( yieldToServer() )
         return;
 
     // check for orders that we should poll
-    if ( nam_queue.isEmpty() )
+    if ( nam_queue.isEmpty() && history_fills )
+    {
+        checkOrderHistory();
+    }
+    else if ( nam_queue.isEmpty() )
     {
         while ( engine->orders_for_polling.size() > 0 )
         {
-            const QString order_number = engine->orders_for_polling.takeFirst();
+            const OrderId order_number = engine->orders_for_polling.takeFirst();
 
             // if it's invalid, just toss it and goto the next id
             if ( !engine->getPositionMan()->isValidOrderID( order_number ) )
@@ -105,48 +199,128 @@ void WavesREST::sendNamQueue()
     if ( nam_queue.isEmpty() )
         onCheckCancellingOrders();
 
-    // check for no requests
-    if ( nam_queue.isEmpty() )
+    // new orders stuck in flight shrink the window
+    if ( sent_by_class.at( REQUEST_NEW_ORDER ) > 0 )
+        checkNewOrderTimeouts();
+
+    // send as many requests as the rate limit allows
+    while ( !nam_queue.isEmpty() && !yieldToServer() )
+    {
+        // the next request, new orders wait while the new order window is full
+        Request *request = getNextRequest();
+        if ( !request || !takeSendTokens() )
+            return;
+
+        sendNamRequest( request );
+        // the request is added to sent_nam_queue and thus not deleted until the response is met
+    }
+}
+
+quint8 WavesREST::getRequestClass( const QString &api_command ) const
+{
+    // waves commands are prefixed with their type
+    if ( api_command.startsWith( "oc-" ) || api_command.startsWith( "oa-" ) )
+        return REQUEST_CANCEL;
+    if ( api_command.startsWith( "on-" ) )
+        return REQUEST_NEW_ORDER;
+    if ( api_command.startsWith( "os-" ) || api_command.startsWith( "oh-" ) )
+        return REQUEST_ORDER_STATUS;
+
+    return REQUEST_POLL;
+}
+
+void WavesREST::setNewOrderWindow( qreal window )
+{
+    new_order_window = qBound( NEW_ORDER_WINDOW_MIN, window, NEW_ORDER_WINDOW_MAX );
+    limit_commands_sent_by_class[ REQUEST_NEW_ORDER ] = qFloor( new_order_window );
+}
+
+void WavesREST::updateNewOrderWindow( Request *const &request, bool ok )
+{
+    // additive increase, about one more order in flight per window of replies
+    if ( ok )
+    {
+        setNewOrderWindow( new_order_window + 1. / new_order_window );
+        return;
+    }
+
+    // multiplicative decrease, once for the requests that were in flight when we last backed off
+    if ( request->time_sent_ms < new_order_window_decrease_time )
         return;
 
-    // go through requests
-    for ( QQueue<Request*>::const_iterator i = nam_queue.begin(); i != nam_queue.end(); i++ )
+    new_order_window_decrease_time = QDateTime::currentMSecsSinceEpoch();
+    setNewOrderWindow( new_order_window /2 );
+
+    if ( engine->getVerbosity() > 1 )
+        kDebug() << "local waves info: new order window shrunk to" << limit_commands_sent_by_class.at( REQUEST_NEW_ORDER );
+}
+
+void WavesREST::checkNewOrderTimeouts()
+{
+    const qint64 timeout_time = QDateTime::currentMSecsSinceEpoch() - NEW_ORDER_TIMEOUT;
+
+    for ( QHash<QNetworkReply*,Request*>::const_iterator i = nam_queue_sent.begin(); i != nam_queue_sent.end(); i++ )
     {
-        Request *const &request = *i;
+        Request *const &request = i.value();
 
-        // if 2 or more new order commands are in flight, wait for them
-        if ( request->api_command.startsWith( "on-" ) && isCommandSent( "on-", MAX_NEW_ORDERS_IN_FLIGHT ) )
+        if ( request->request_class == REQUEST_NEW_ORDER &&
+             request->time_sent_ms < timeout_time &&
+             request->time_sent_ms >= new_order_window_decrease_time )
         {
-            // print something every 2 mins
-            static qint64 last_print_time = 0;
-            const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
-            if ( last_print_time < current_time - 120000 )
-            {
-                //kDebug() << "local" << engine->engine_type << "info: too many new orders in flight, waiting.";
-                last_print_time = current_time;
-            }
-
-            continue;
+            updateNewOrderWindow( request, false );
+            return;
         }
+    }
+}
 
-        sendNamRequest( request );
-        // the request is added to sent_nam_queue and thus not deleted until the response is met
+void WavesREST::buildRequestTemplate( const QString &api_command, RequestTemplate &t ) const
+{
+    // after the request tag comes the verb
+    if ( api_command.mid( 3 ).startsWith( "get-" ) )
+    {
+        t.verb = "GET";
+        t.command_offset = 3 + 4;
+    }
+    else if ( api_command.mid( 3 ).startsWith( "post-" ) )
+    {
+        t.verb = "POST";
+        t.command_offset = 3 + 5;
+    }
+    else
+    {
         return;
     }
+
+    t.base_url = WAVES_MATCHER_URL;
+    t.is_fixed_url = false;
+
+    // add http content json header, except for get my orders and history which are signed in the headers
+    if ( !api_command.startsWith( "om" ) && !api_command.startsWith( "oh" ) )
+        t.nam_request.setRawHeader( "Content-Type", "application/json;charset=UTF-8" );
+
+    // add http json accept header
+    t.nam_request.setRawHeader( "Accept", "application/json" );
+}
+
+QString WavesREST::getCommandKind( const QString &api_command ) const
+{
+    // the prefix, the rest of the command has the market/order in it
+    return api_command.left( 3 );
 }
 
 void WavesREST::sendNamRequest( Request * const &request )
 {
     // check for valid pos
-    if ( request->pos != nullptr && !engine->getPositionMan()->isValid( request->pos ) )
+    if ( request->pos != nullptr && !engine->getPositionMan()->isValid( request->pos, request->pos_generation ) )
     {
         kDebug() << "local warning: caught nam request with invalid position";
         nam_queue.removeOne( request );
+        releaseRequest( request );
         return;
     }
 
     const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
-    QString api_command = request->api_command;
+    const QString &api_command = request->api_command;
 
     request_nonce++; // bump nonce for baserest stats
 
@@ -158,39 +332,34 @@ void WavesREST::sendNamRequest( Request * const &request )
     // set cancel time properly
     else if ( api_command.startsWith( "oc" ) && request->pos != nullptr )
         request->pos->order_cancel_time = current_time;
-    // if calling get my orders, set flag
-    else if ( api_command.startsWith( "om" ) )
+    // if calling get my orders or history, set flag
+    else if ( api_command.startsWith( "om" ) || api_command.startsWith( "oh" ) )
         is_my_orders_request = true;
 
     // add to sent queue so we can check if it timed out
     request->time_sent_ms = current_time;
 
-    // remove request tag
-    api_command.remove( 0, 3 );
-
-    const bool is_get = api_command.startsWith( "get-" );
-    const bool is_post = api_command.startsWith( "post-" );
+    const RequestTemplate &t = getRequestTemplate( api_command );
 
-    if ( is_get )
-        api_command.remove( 0, 4 );
-    else if ( is_post )
-        api_command.remove( 0, 5 );
+    // create url which will hold 'url'+'query_args', the path after the tag and verb can hold asset and order ids
+    QUrl url = t.is_fixed_url ? t.nam_request.url() : QUrl( t.base_url + api_command.mid( t.command_offset ) );
 
-    const QLatin1String &base_url_str = WAVES_MATCHER_URL;
-
-    // create url which will hold 'url'+'query_args'
-    QUrl url = QUrl( base_url_str + api_command );
-
-    // create the request
-    QNetworkRequest nam_request;
+    // copy the constant headers from the template
+    QNetworkRequest nam_request = t.nam_request;
 
     // add orders request http headers
     if ( is_my_orders_request )
     {
-        const QUrlQuery query = QUrlQuery( "activeOnly=true" );
+        // the history query is in the body, see checkOrderHistory()
+        const QUrlQuery query = QUrlQuery( api_command.startsWith( "oh" ) ? request->body : QString( "activeOnly=true" ) );
         url.setQuery( query );
 
-        const QByteArray sign_bytes = account.createGetOrdersBytes( current_time );
+        // signed on the matcher's clock
+        const qint64 server_time = current_time + server_clock.getOffset();
+        if ( server_clock.isLocalRejected( CLOCK_TOLERANCE, CLOCK_TOLERANCE ) )
+            clock_rejects_avoided++;
+
+        const QByteArray sign_bytes = account.createGetOrdersBytes( server_time );
         QByteArray signature;
 
         const bool success = account.sign( sign_bytes, signature );
@@ -200,24 +369,16 @@ void WavesREST::sendNamRequest( Request * const &request )
 
         // add signature and timestamp header
         nam_request.setRawHeader( "Signature", QBase58::encode( signature ) );
-        nam_request.setRawHeader( "Timestamp", QString::number( current_time ).toLocal8Bit() );
-    }
-    else
-    {
-        // add http content json header
-        nam_request.setRawHeader( "Content-Type", "application/json;charset=UTF-8" );
+        nam_request.setRawHeader( "Timestamp", QString::number( server_time ).toLocal8Bit() );
     }
 
-    // add http json accept header
-    nam_request.setRawHeader( "Accept", "application/json" );
-
     // set the url
     nam_request.setUrl( url );
 
     // send REST message
-    QNetworkReply *const &reply = is_get  ? nam->get( nam_request ) :
-                                  is_post ? nam->post( nam_request, request->body.toLocal8Bit() ) :
-                                          nullptr;
+    QNetworkReply *const &reply = t.verb == "GET"  ? nam->get( nam_request ) :
+                                  t.verb == "POST" ? nam->post( nam_request, request->body.toLocal8Bit() ) :
+                                                     nullptr;
 
     if ( !reply )
     {
@@ -225,8 +386,7 @@ void WavesREST::sendNamRequest( Request * const &request )
         return;
     }
 
-    nam_queue_sent.insert( reply, request );
-    nam_queue.removeOne( request );
+    trackSent( reply, request );
     last_request_sent_ms = current_time;
 }
 
@@ -235,12 +395,13 @@ void WavesREST::getOrderStatus( Position * const &pos )
     sendRequest( QString( WAVES_COMMAND_GET_ORDER_STATUS )
                   .arg( account.getAliasByAsset( pos->market.getQuote() ) )
                   .arg( account.getAliasByAsset( pos->market.getBase() ) )
-                  .arg( pos->order_number ), "", pos );
+                  .arg( pos->order_number.toString() ), "", pos );
 }
 
 void WavesREST::sendCancel( const QString &order_id, Position * const &pos, const Market &market )
 {
-    const QByteArray body = account.createCancelBody( order_id.toLocal8Bit() );
+    WavesSignJob job;
+    account.createCancelJob( order_id.toLocal8Bit(), job );
 
     const QString command = QString( WAVES_COMMAND_POST_ORDER_CANCEL )
                              .arg( account.getAliasByAsset( market.getQuote() ) )
@@ -249,209 +410,971 @@ void WavesREST::sendCancel( const QString &order_id, Position * const &pos, cons
     // set is_cancelling
     if ( pos && engine->getPositionMan()->isActive( pos ) )
     {
-        pos->is_cancelling = true;
+        engine->getPositionMan()->setCancelling( pos );
 
         // set the cancel time once here, and once on send, to avoid double cancel timeouts
         pos->order_cancel_time = QDateTime::currentMSecsSinceEpoch();
     }
 
-    sendRequest( command, body, pos );
+    queueSignJob( command, job, pos );
 }
 
 void WavesREST::sendCancelNonLocal( const QString &order_id, const QString &amount_asset_alias, const QString &price_asset_alias )
 {
-    const QByteArray body = account.createCancelBody( order_id.toLocal8Bit() );
+    WavesSignJob job;
+    account.createCancelJob( order_id.toLocal8Bit(), job );
 
     const QString command = QString( WAVES_COMMAND_POST_ORDER_CANCEL )
                              .arg( amount_asset_alias )
                              .arg( price_asset_alias );
 
     kDebug() << "local" << engine->engine_type << "info: sending manual cancel request for order_id" << order_id;
-    sendRequest( command, body );
+    queueSignJob( command, job );
+}
+
+void WavesREST::sendCancelPair( const Market &market )
+{
+    WavesSignJob job;
+    if ( !account.createCancelPairJob( getServerTime(), job ) )
+        return;
+
+    const QString command = QString( WAVES_COMMAND_POST_PAIR_CANCEL )
+                             .arg( account.getAliasByAsset( market.getQuote() ) )
+                             .arg( account.getAliasByAsset( market.getBase() ) );
+
+    queueSignJob( command, job );
+}
+
+void WavesREST::sendBuySell( Position * const &pos, bool quiet )
+{
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+    const qint64 server_time = getServerTime(); // what the order is signed with
+    const qint64 now = server_time + 60000;
+    const qint64 future_29d = server_time + qint64( 60000 ) * 60 * 24 * 29;
+    const qint64 future_28d = current_time + qint64( 60000 ) * 60 * 24 * 28;
+
+    if ( server_clock.isLocalRejected( CLOCK_TOLERANCE, CLOCK_TOLERANCE ) )
+        clock_rejects_avoided++;
+
+    MarketInfo &info = engine->getMarketInfo( pos->market );
+
+    // create order body for expiration in 29 days, signed with the rest of the burst
+    WavesSignJob job;
+    account.createOrderJob( pos, info.price_ticksize, info.quantity_ticksize, now, future_29d, job );
+
+    // if the order is already set to expire, keep that time, otherwise set to cancel in 28 days
+    if ( pos->max_age_epoch == 0 )
+        pos->max_age_epoch = future_28d;
+
+    kLogIf( LOG_LEVEL_DEBUG, !quiet && engine->getVerbosity() > 0 ) << "queued         " << pos->logOrderWithoutOrderID();
+
+    // a flip we signed ahead only has to be sent. its times are from when it was signed, at most PRESIGN_MAX_AGE ago
+    if ( takePresignedOrder( job ) )
+    {
+        Request *const request = prepareRequest( WAVES_COMMAND_POST_ORDER_NEW, QString(), pos );
+        request->body = QString( job.signed_body );
+        nam_queue.append( request );
+        wakeSendQueue();
+        return;
+    }
+
+    queueSignJob( WAVES_COMMAND_POST_ORDER_NEW, job, pos );
+}
+
+bool WavesREST::takePresignedOrder( WavesSignJob &job )
+{
+    QHash<QByteArray, PresignedOrder>::iterator i = presigned_orders.find( WavesAccount::getOrderKey( job.bytes ) );
+    if ( i == presigned_orders.end() )
+        return false;
+
+    // it's used once, the same order id can't go out twice
+    const bool is_fresh = QDateTime::currentMSecsSinceEpoch() - i.value().presign_time < PRESIGN_MAX_AGE;
+    if ( is_fresh )
+        job.signed_body = i.value().signed_body;
+
+    presigned_orders.erase( i );
+    return is_fresh;
+}
+
+void WavesREST::onPresignOrders()
+{
+    QMutexLocker locker( engine->getLock() );
+
+    if ( sign_pool == nullptr || isKeyOrSecretUnset() )
+        return;
+
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+    const qint64 server_time = getServerTime();
+    const qint64 now = server_time + 60000;
+    const qint64 future_29d = server_time + qint64( 60000 ) * 60 * 24 * 29;
+
+    // the next order of each set grid position, built the way Engine::flipPositionInPlace() sets it up
+    QSet<QByteArray> wanted;
+    QVector<WavesSignJob> jobs;
+    const QVector<Position*> &positions = engine->getPositionMan()->active();
+    for ( QVector<Position*>::const_iterator i = positions.begin(); i != positions.end(); i++ )
+    {
+        const Position *pos = *i;
+
+        if ( pos->is_onetime || pos->is_landmark || pos->is_cancelling || pos->order_set_time == 0 || pos->market_indices.isEmpty() )
+            continue;
+
+        MarketInfo &info = engine->getMarketInfo( pos->market );
+        const qint32 index = pos->market_indices.value( 0 );
+        if ( !info.is_tradeable || index < 0 || index >= info.position_index.size() )
+            continue;
+
+        const PositionData data = info.position_index.value( index );
+        Position flipped( pos->market, pos->side == SIDE_BUY ? SIDE_SELL : SIDE_BUY, data.buy_price, data.sell_price, data.order_size,
+                          QLatin1String(), pos->market_indices, false, engine );
+
+        WavesSignJob job;
+        if ( !account.createOrderJob( &flipped, info.price_ticksize, info.quantity_ticksize, now, future_29d, job ) )
+            continue;
+
+        const QByteArray key = WavesAccount::getOrderKey( job.bytes );
+        wanted.insert( key );
+
+        // the one we have is good for a while yet
+        const QHash<QByteArray, PresignedOrder>::const_iterator existing = presigned_orders.constFind( key );
+        if ( presigning_orders.contains( key ) ||
+           ( existing != presigned_orders.constEnd() && current_time - existing.value().presign_time < PRESIGN_REFRESH_AGE ) )
+            continue;
+
+        job.presign_time = current_time;
+        presigning_orders.insert( key );
+        jobs += job;
+    }
+
+    // the positions that went away won't flip
+    for ( QHash<QByteArray, PresignedOrder>::iterator i = presigned_orders.begin(); i != presigned_orders.end(); )
+    {
+        if ( wanted.contains( i.key() ) )
+            i++;
+        else
+            i = presigned_orders.erase( i );
+    }
+
+    if ( !jobs.isEmpty() )
+        signOnPool( jobs );
+}
+
+void WavesREST::queueSignJob( const QString &api_command, WavesSignJob &job, Position * const &pos )
+{
+    // the priority and position generation are taken now, the body when it's signed
+    job.request = prepareRequest( api_command, QString(), pos );
+    signing_requests.append( job.request );
+
+    // sign whatever the engine queues in this pass together
+    if ( sign_jobs.isEmpty() )
+        QTimer::singleShot( 0, this, &WavesREST::sendSignJobs );
+
+    sign_jobs.append( job );
+}
+
+void WavesREST::sendSignJobs()
+{
+    QMutexLocker locker( engine->getLock() );
+
+    if ( sign_jobs.isEmpty() )
+        return;
+
+    const QVector<WavesSignJob> jobs = sign_jobs;
+    sign_jobs.clear();
+
+    // sign small bursts here
+    if ( jobs.size() < SIGN_BATCH_MIN || sign_pool == nullptr )
+    {
+        QVector<WavesSignJob> signed_jobs = jobs;
+        for ( QVector<WavesSignJob>::iterator i = signed_jobs.begin(); i != signed_jobs.end(); i++ )
+            account.getSigner().signJob( *i );
+
+        onSignBatchDone( signed_jobs );
+        return;
+    }
+
+    signOnPool( jobs );
+}
+
+void WavesREST::signOnPool( const QVector<WavesSignJob> &jobs )
+{
+    // split the burst evenly over the pool
+    const qint32 threads = qMax( 1, sign_pool->maxThreadCount() );
+    const qint32 batch_size = ( jobs.size() + threads -1 ) / threads;
+
+    for ( qint32 i = 0; i < jobs.size(); i += batch_size )
+        sign_pool->start( new WavesSignBatch( this, account.getSigner(), jobs.mid( i, batch_size ) ) );
+}
+
+void WavesREST::onSignBatchDone( const QVector<WavesSignJob> &jobs )
+{
+    QMutexLocker locker( engine->getLock() );
+
+    for ( QVector<WavesSignJob>::const_iterator i = jobs.begin(); i != jobs.end(); i++ )
+    {
+        const WavesSignJob &job = *i;
+
+        // signed ahead, kept until the position it's the flip of fills
+        if ( job.presign_time > 0 )
+        {
+            const QByteArray key = WavesAccount::getOrderKey( job.bytes );
+            if ( presigning_orders.remove( key ) && !job.signed_body.isEmpty() )
+            {
+                PresignedOrder &presigned = presigned_orders[ key ];
+                presigned.signed_body = job.signed_body;
+                presigned.presign_time = job.presign_time;
+            }
+            continue;
+        }
+
+        if ( !signing_requests.removeOne( job.request ) )
+            continue;
+
+        // send it anyway, the matcher error goes through the usual reply handling
+        if ( job.signed_body.isEmpty() )
+            kDebug() << "local" << engine->engine_type << "error: failed to sign" << job.request->api_command;
+
+        //kDebug() << "sending signed request:" << job.signed_body;
+        job.request->body = QString( job.signed_body );
+        nam_queue.append( job.request );
+    }
+
+    wakeSendQueue();
+}
+
+void WavesREST::onNamReply( QNetworkReply * const &reply )
+{
+    TRACE_SPAN( "onNamReply" );
+    QMutexLocker locker( engine->getLock() );
+
+    // don't process a reply we aren't tracking
+    if ( !nam_queue_sent.contains( reply ) )
+        return;
+
+    QByteArray data = readReply( reply ); // shares reply_buffer, only error paths write to it
+
+    Request *const &request = takeSent( reply );
+    const QString &api_command = request->api_command;
+
+    // positions are recycled, forget ours if it was released and reused while the request was out
+    if ( request->pos != nullptr && request->pos->getGeneration() != request->pos_generation )
+        request->pos = nullptr;
+    const qint64 received_time = QDateTime::currentMSecsSinceEpoch();
+    const qint64 response_time = received_time - request->time_sent_ms;
+
+    response_times.add( api_command.left( 2 ), response_time ); // the command prefix, the rest is the order/asset
+    readServerDate( reply, request->time_sent_ms, received_time );
+    recordReply( reply, request, received_time );
+
+    // my orders are read straight from the bytes, without building a document
+    if ( api_command.startsWith( "om" ) && parseMyOrders( data, request->time_sent_ms ) )
+    {
+        deleteReply( reply, request );
+        return;
+    }
+
+    // parse any possible json in the body
+    QJsonDocument body_json = QJsonDocument::fromJson( data );
+    QJsonObject result_obj;
+    QJsonArray result_arr;
+
+    const bool is_array = body_json.isArray();
+    const bool is_object = body_json.isObject();
+
+    // cache result array/object
+    if ( is_array )
+        result_arr = body_json.array();
+    else if ( is_object )
+        result_obj = body_json.object();
+
+
+    // matcher errors and slow replies shrink the new order window, our own balance errors leave it alone
+    if ( api_command.startsWith( "on" ) &&
+         !( is_object && result_obj.value( "message" ).toString().startsWith( "Not enough tradable balance." ) ) )
+    {
+        const bool ok = is_object && result_obj.value( "success" ).toBool();
+        updateNewOrderWindow( request, ok && response_time < NEW_ORDER_TIMEOUT );
+    }
+
+    // print unknown reply
+    if ( !is_array && !is_object )
+    {
+        const bool contains_html = data.contains( QByteArray( "<html" ) ) || data.contains( QByteArray( "<HTML" ) );
+
+        // reduce size of cloudflare errors
+        if ( contains_html )
+            data = QByteArray( "<html error>" );
+
+        kDebug() << "local warning: nam reply got html reponse for" << reply->url().path() << ":" << data;
+    }
+    // handle matcher info response
+    else if ( api_command.startsWith( "md" ) )
+    {
+        if ( parseMarketData( result_obj ) )
+            writeMetadataCache( MARKET_DATA_CACHE_NAME, data );
+    }
+    // handle order depth response
+    else if ( api_command.startsWith( "ms" ) )
+    {
+        parseMarketStatus( result_obj, request );
+    }
+    // handle order status response
+    else if ( api_command.startsWith( "os" ) )
+    {
+        parseOrderStatus( result_obj, request );
+    }
+    // handle order history response
+    else if ( api_command.startsWith( "oh" ) )
+    {
+        parseOrderHistory( result_arr );
+    }
+    // handle order cancel response
+    else if ( api_command.startsWith( "oc" ) )
+    {
+        parseCancelOrder( result_obj, request );
+    }
+    // handle pair cancel response
+    else if ( api_command.startsWith( "oa" ) )
+    {
+        parseCancelPair( result_obj );
+    }
+    // handle order new response
+    else if ( api_command.startsWith( "on" ) )
+    {
+        parseNewOrder( result_obj, request );
+    }
+    // handle my orders response
+    else if ( api_command.startsWith( "om" ) )
+    {
+        // parseMyOrders() couldn't read it, don't take it for a blank orderbook
+        kDebug() << "local warning: unexpected my orders reply:" << data;
+    }
+    else
+    {
+        kDebug() << "local warning: nam reply of unknown command for command:" << api_command << "path:" << reply->url().path() << ":" << data;
+    }
+
+    deleteReply( reply, request );
 }
 
-void WavesREST::sendBuySell( Position * const &pos, bool quiet )
-{
-    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
-    const qint64 now = current_time + 60000;
-    const qint64 future_29d = current_time + qint64( 60000 ) * 60 * 24 * 29;
-    const qint64 future_28d = current_time + qint64( 60000 ) * 60 * 24 * 28;
+void WavesREST::onCheckMarketData()
+{
+    QMutexLocker locker( engine->getLock() );
+
+    sendRequest( WAVES_COMMAND_GET_MARKET_DATA );
+}
+
+void WavesREST::onCheckTicker()
+{
+    QMutexLocker locker( engine->getLock() );
+
+    checkTicker();
+}
+
+void WavesREST::checkTicker( bool ignore_flow_control )
+{
+    if ( !ignore_flow_control && yieldToFlowControl() )
+        return;
+
+    // if tracked markets are empty, skip ticker
+    if ( tracked_markets.isEmpty() )
+    {
+        kDebug() << "local warning: skipping querying ticker because tracked_markets is empty";
+        return;
+    }
+
+    // query every tracked market this tick, so the tickers don't get older as we add markets
+    if ( ticker_batch )
+    {
+        checkTickerBatch();
+        return;
+    }
+
+    // one market per tick, busy markets get more of the turns. every market gains its weight in credit, the one with
+    // the most goes and pays back the total, so each is queried in proportion to its weight and none is left out
+    QString next_market;
+    qreal next_credit = 0., weight_total = 0.;
+    for ( QStringList::const_iterator i = tracked_markets.begin(); i != tracked_markets.end(); i++ )
+    {
+        const qreal weight = engine->getMarketPollWeight( Market( *i ) );
+        qreal &credit = ticker_poll_credit[ *i ];
+
+        credit += weight;
+        weight_total += weight;
+
+        if ( next_market.isEmpty() || credit > next_credit )
+        {
+            next_market = *i;
+            next_credit = credit;
+        }
+    }
+
+//    kDebug() << "checking next ticker" << next_market;
+
+    ticker_poll_credit[ next_market ] -= weight_total;
+    sendRequest( getMarketStatusCommand( next_market ) );
+}
+
+void WavesREST::checkTickerBatch()
+{
+    // markets with a status request out already, one pass over the sent requests
+    QSet<QString> pending;
+    for ( QHash<QNetworkReply*,Request*>::const_iterator i = nam_queue_sent.begin(); i != nam_queue_sent.end(); i++ )
+        if ( i.value()->api_command.startsWith( "ms" ) )
+            pending.insert( i.value()->api_command );
+
+    for ( QStringList::const_iterator i = tracked_markets.begin(); i != tracked_markets.end(); i++ )
+    {
+        // active markets go every tick, idle ones once they've saved up a turn
+        qreal &credit = ticker_poll_credit[ *i ];
+        credit = std::min( credit + engine->getMarketPollWeight( Market( *i ) ), 1. );
+        if ( credit < 1. )
+            continue;
+
+        const QString ticker_url = getMarketStatusCommand( *i );
+
+        // skip markets we are still waiting on
+        if ( pending.contains( ticker_url ) || !nam_queue.getByCommand( ticker_url, QString() ).isEmpty() )
+            continue;
+
+        credit -= 1.;
+        sendRequest( ticker_url );
+    }
+}
+
+QString WavesREST::getMarketStatusCommand( const Market &market ) const
+{
+    const QString price_alias = account.getAliasByAsset( market.getBase() );
+    const QString amount_alias = account.getAliasByAsset( market.getQuote() );
+
+    return QString( WAVES_COMMAND_GET_MARKET_STATUS )
+            .arg( amount_alias )
+            .arg( price_alias );
+}
+
+void WavesREST::setTickerBatch( bool enabled, qint32 interval )
+{
+    ticker_batch = enabled;
+
+    if ( interval > 0 )
+        ticker_timer->setInterval( interval );
+
+    kDebug() << "waves ticker batch mode is" << ( ticker_batch ? "enabled" : "disabled" ) << "ticker interval" << ticker_timer->interval();
+}
+
+void WavesREST::checkBotOrders( bool ignore_flow_control )
+{
+    if ( !ignore_flow_control && yieldToFlowControl() )
+        return;
+
+    sendRequest( QString( WAVES_COMMAND_GET_MY_ORDERS )
+                  .arg( QString( account.publicKeyB58() ) ) );
+}
+
+void WavesREST::setHistoryFills( bool enabled )
+{
+    history_fills = enabled;
+
+    kDebug() << "waves history fills are" << ( history_fills ? "enabled" : "disabled" );
+}
+
+void WavesREST::checkOrderHistory()
+{
+    const QString command = QString( WAVES_COMMAND_GET_MY_HISTORY ).arg( QString( account.publicKeyB58() ) );
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+
+    // one request settles every order polled since the last one
+    if ( engine->orders_for_polling.isEmpty() ||
+         current_time < history_request_time + HISTORY_INTERVAL ||
+         isCommandQueued( getCommandKind( command ) ) ||
+         isCommandSent( getCommandKind( command ) ) )
+        return;
+
+    // the history since the oldest of them, the ones that aren't closed yet are polled again when they come up
+    qint64 time_start = 0;
+    qint32 count = 0;
+    while ( !engine->orders_for_polling.isEmpty() )
+    {
+        const OrderId order_number = engine->orders_for_polling.takeFirst();
+
+        // if it's invalid, just toss it and goto the next id
+        if ( !engine->getPositionMan()->isValidOrderID( order_number ) )
+            continue;
+
+        const qint64 set_time = engine->getPositionMan()->getByOrderID( order_number )->order_set_time;
+        if ( set_time > 0 && ( time_start == 0 || set_time < time_start ) )
+            time_start = set_time;
+
+        count++;
+    }
+
+    if ( count == 0 )
+        return;
+
+    history_request_time = current_time;
+
+    QString query = "activeOnly=false&closedOnly=true";
+    if ( time_start > 0 )
+        query += QString( "&timeStart=%1" ).arg( time_start - HISTORY_TIME_MARGIN );
+
+    sendRequest( command, query );
+}
+
+void WavesREST::onCheckBotOrders()
+{
+    QMutexLocker locker( engine->getLock() );
+
+    checkBotOrders();
+}
+
+void WavesREST::onCheckCancellingOrders()
+{
+    QMutexLocker locker( engine->getLock() );
+
+    if ( yieldToFlowControl() )
+        return;
+
+    // the earliest check, if it's due
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+    QMultiMap<qint64, CancellingCheck>::iterator next = cancelling_checks.begin();
+    if ( next == cancelling_checks.end() || next.key() > current_time )
+        return;
+
+    CancellingCheck check = next.value();
+    cancelling_checks.erase( next );
+
+    // it went away without a status, or it's another position now
+    if ( !engine->getPositionMan()->isValid( check.pos, check.generation ) )
+    {
+        cancelling_check_times.remove( check.pos );
+        return;
+    }
+
+    // query it, and again later if the reply doesn't settle it
+    const qint64 spacing = qMin( CANCELLING_CHECK_SPACING << qMin( check.checks, 15 ), CANCELLING_CHECK_SPACING_MAX );
+    check.checks++;
+    cancelling_checks.insert( current_time + spacing, check );
+    cancelling_check_times.insert( check.pos, current_time + spacing );
+
+    // the next history request covers it
+    if ( history_fills )
+    {
+        if ( !engine->orders_for_polling.contains( check.pos->order_number ) )
+            engine->orders_for_polling += check.pos->order_number;
+
+        return;
+    }
+
+    getOrderStatus( check.pos );
+}
+
+void WavesREST::addCancellingCheck( Position *const &pos )
+{
+    // already waiting, the earlier check stands
+    if ( cancelling_check_times.contains( pos ) )
+    {
+        const qint64 due_time = cancelling_check_times.value( pos );
+        for ( QMultiMap<qint64, CancellingCheck>::const_iterator i = cancelling_checks.constFind( due_time );
+              i != cancelling_checks.constEnd() && i.key() == due_time; i++ )
+            if ( i.value().pos == pos && i.value().generation == pos->getGeneration() )
+                return;
+
+        removeCancellingCheck( pos );
+    }
+
+    // the first query goes out on the next turn of the send queue
+    CancellingCheck check;
+    check.pos = pos;
+    check.generation = pos->getGeneration();
+
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+    cancelling_checks.insert( current_time, check );
+    cancelling_check_times.insert( pos, current_time );
+}
+
+void WavesREST::removeCancellingCheck( Position *const &pos )
+{
+    const QHash<Position*, qint64>::iterator time = cancelling_check_times.find( pos );
+    if ( time == cancelling_check_times.end() )
+        return;
+
+    const qint64 due_time = time.value();
+    cancelling_check_times.erase( time );
+
+    for ( QMultiMap<qint64, CancellingCheck>::iterator i = cancelling_checks.find( due_time );
+          i != cancelling_checks.end() && i.key() == due_time; i++ )
+    {
+        if ( i.value().pos != pos )
+            continue;
+
+        cancelling_checks.erase( i );
+        return;
+    }
+}
+
+void WavesREST::setJwt( const QByteArray &jwt )
+{
+    wss_jwt = jwt;
+
+    // resubscribe with the new token
+    wss_address_state = false;
+    wss_address_subscribe_try_time = 0;
+    wssSendSubscriptions();
+
+    kDebug() << "waves address stream token" << ( wss_jwt.isEmpty() ? "cleared" : "set" );
+}
+
+void WavesREST::wssConnected()
+{
+    QMutexLocker locker( engine->getLock() );
+
+    wss_heartbeat_time = QDateTime::currentMSecsSinceEpoch();
+
+    wssSendSubscriptions();
+}
+
+void WavesREST::wssSendSubscriptions()
+{
+    QMutexLocker locker( engine->getLock() );
+
+    if ( !wss || !wss->isValid() )
+        return;
+
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+
+    // subscribe to the book of each tracked market we don't have yet
+    for ( QStringList::const_iterator i = tracked_markets.begin(); i != tracked_markets.end(); i++ )
+    {
+        const Market market = *i;
+        const QString pair = QString( "%1-%2" )
+                              .arg( account.getAliasByAsset( market.getQuote() ) )
+                              .arg( account.getAliasByAsset( market.getBase() ) );
+
+        if ( wss_books.contains( pair ) )
+            continue;
+
+        WavesBook &book = wss_books[ pair ];
+        book.market = market;
+
+        const QJsonObject subscribe_book
+        {
+            { "T", "obs" },
+            { "S", pair },
+            { "d", WSS_BOOK_DEPTH }
+        };
+
+        wssSendJsonObj( subscribe_book );
+    }
+
+#if !defined( WAVES_TICKER_ONLY )
+    // subscribe to the address feed, the matcher wants a jwt from the waves.exchange oauth flow which we don't do,
+    // so it has to be set with setwavesjwt
+    if ( !wss_address_state &&
+         !wss_jwt.isEmpty() &&
+         wss_address_subscribe_try_time < current_time - WSS_TIMEOUT )
+    {
+        const QJsonObject subscribe_address
+        {
+            { "T", "aus" },
+            { "S", QString( account.address() ) },
+            { "t", "jwt" },
+            { "j", QString( wss_jwt ) }
+        };
 
-    MarketInfo &info = engine->getMarketInfo( pos->market );
+        kDebug() << "(wss) sending address subscribe";
+        wssSendJsonObj( subscribe_address );
 
-    // create order body for expiration in 29 days
-    const QByteArray body = account.createOrderBody( pos, info.price_ticksize, info.quantity_ticksize, now, future_29d );
+        wss_address_subscribe_try_time = current_time;
+    }
+#else
+    Q_UNUSED( current_time )
+#endif
+}
 
-    // if the order is already set to expire, keep that time, otherwise set to cancel in 28 days
-    if ( pos->max_age_epoch == 0 )
-        pos->max_age_epoch = future_28d;
+void WavesREST::wssSendJsonObj( const QJsonObject &obj )
+{
+    const QJsonDocument doc = QJsonDocument( obj );
+    const QString data_str = doc.toJson( QJsonDocument::Compact );
 
-    if ( !quiet )
-        kDebug() << QString( "queued          %1" )
-                    .arg( pos->stringifyOrderWithoutOrderID() );
+    //kDebug() << "(wss) sending" << data_str;
 
-    //kDebug() << "sending new order request:" << body;
-    sendRequest( WAVES_COMMAND_POST_ORDER_NEW, body, pos );
+    wss->sendTextMessage( data_str );
 }
 
-void WavesREST::onNamReply( QNetworkReply * const &reply )
+void WavesREST::wssCheckConnection()
 {
-    // don't process a reply we aren't tracking
-    if ( !nam_queue_sent.contains( reply ) )
+    QMutexLocker locker( engine->getLock() );
+
+    if ( !wss )
         return;
 
-    const QString path = reply->url().path();
-    QByteArray data = reply->readAll();
+    const qint64 current_time = QDateTime::currentMSecsSinceEpoch();
 
-    // parse any possible json in the body
-    QJsonDocument body_json = QJsonDocument::fromJson( data );
-    QJsonObject result_obj;
-    QJsonArray result_arr;
+    // check for connected
+    if ( ( !wss->isValid() ||  // socket is invalid OR
+           wss_heartbeat_time < current_time - WSS_TIMEOUT ) && // we stopped receiving data
+         wss_connect_try_time < current_time - WSS_TIMEOUT ) // last time we tried to connect is stale
+    {
+        kDebug() << "(wss-reconnect)";
 
-    const bool is_array = body_json.isArray();
-    const bool is_object = body_json.isObject();
+        // update the time now incase open() is blocking when another disconnected() event fires
+        wss_connect_try_time = current_time;
+        wss_address_state = false;
+        wss_address_subscribe_try_time = 0;
+        wss_books.clear();
+        wss_address_resync.cancel();
 
-    // cache result array/object
-    if ( is_array )
-        result_arr = body_json.array();
-    else if ( is_object )
-        result_obj = body_json.object();
+        wss->abort();
+        wss->open( QUrl( WAVES_MATCHER_URL_WSS ) );
+    }
+    else
+    {
+        // if we are connected, make sure feeds are active
+        wssSendSubscriptions();
 
-    Request *const &request = nam_queue_sent.take( reply );
-    const QString &api_command = request->api_command;
-    const qint64 response_time = QDateTime::currentMSecsSinceEpoch() - request->time_sent_ms;
+        // the resync snapshot didn't make it, ask again
+        if ( wss_address_resync.isSnapshotLate( current_time ) )
+        {
+            wss_address_resync.setSnapshotRequested( current_time );
+            checkBotOrders( true );
+        }
+    }
 
-    avg_response_time.addResponseTime( response_time );
+    const bool wss_is_up_to_date = wss->isValid() && wss_heartbeat_time > current_time - WSS_TIMEOUT;
 
-    // print unknown reply
-    if ( !is_array && !is_object )
+    // the book feed is up when every tracked market has a snapshot
+    bool wss_book_feed_is_up_to_date = wss_is_up_to_date && !wss_books.isEmpty();
+    for ( QMap<QString, WavesBook>::const_iterator i = wss_books.begin(); i != wss_books.end() && wss_book_feed_is_up_to_date; i++ )
+        wss_book_feed_is_up_to_date = i.value().has_snapshot;
+
+    // book feed is up to date, keep polling the ticker slowly to reconcile
+    if ( wss_book_feed_is_up_to_date &&
+         wss_rest_ticker_interval == 0 )
     {
-        const bool contains_html = data.contains( QByteArray( "<html" ) ) || data.contains( QByteArray( "<HTML" ) );
+        wss_rest_ticker_interval = ticker_timer->interval();
+        ticker_timer->setInterval( 20000 );
 
-        // reduce size of cloudflare errors
-        if ( contains_html )
-            data = QByteArray( "<html error>" );
+        kDebug() << "(wss) slowed down price timer";
+    }
+    // feed is old, restore interval
+    else if ( !wss_book_feed_is_up_to_date &&
+              wss_rest_ticker_interval > 0 )
+    {
+        ticker_timer->setInterval( wss_rest_ticker_interval );
+        wss_rest_ticker_interval = 0;
 
-        kDebug() << "local warning: nam reply got html reponse for" << path << ":" << data;
+        kDebug() << "(wss) sped up price timer";
     }
-    // handle matcher info response
-    else if ( api_command.startsWith( "md" ) )
+
+#if !defined( WAVES_TICKER_ONLY )
+    const bool wss_address_feed_is_up_to_date = wss_is_up_to_date && wss_address_state;
+
+    // address feed is up to date, adjust timer interval to be slower
+    if ( wss_address_feed_is_up_to_date &&
+         orderbook_timer->interval() < 120000 )
     {
-        parseMarketData( result_obj );
+        orderbook_timer->setInterval( 120000 );
+
+        kDebug() << "(wss) slowed down orderbook timer";
     }
-    // handle order depth response
-    else if ( api_command.startsWith( "ms" ) )
+    // feed is old, restore interval
+    else if ( !wss_address_feed_is_up_to_date &&
+              orderbook_timer->interval() > WAVES_TIMER_INTERVAL_CHECK_MY_ORDERS )
     {
-        parseMarketStatus( result_obj, request );
+        orderbook_timer->setInterval( WAVES_TIMER_INTERVAL_CHECK_MY_ORDERS );
+
+        kDebug() << "(wss) sped up orderbook timer";
     }
-    // handle order status response
-    else if ( api_command.startsWith( "os" ) )
+#endif
+}
+
+void WavesREST::wssTextMessageReceived( const QString &msg )
+{
+    QMutexLocker locker( engine->getLock() );
+
+    const QJsonDocument doc = QJsonDocument::fromJson( readMessage( msg ) );
+
+    //kDebug() << "wss in:" << msg;
+
+    if ( !doc.isObject() )
+        return;
+
+    wss_heartbeat_time = QDateTime::currentMSecsSinceEpoch();
+
+    const QJsonObject info = doc.object();
+    const QString type = info.value( "T" ).toString();
+
+    // ping, echo it back or the matcher drops us
+    if ( type == "pp" )
+        wssSendJsonObj( info );
+    else if ( type == "ob" )
+        wssParseOrderBook( info );
+    else if ( type == "au" )
     {
-        parseOrderStatus( result_obj, request );
+        // after the first one, hold them until the snapshot is applied
+        if ( wss_address_state && wss_address_resync.add( wss_heartbeat_time, msg ) )
+            return;
+
+        wssParseAddress( info );
     }
-    // handle order cancel response
-    else if ( api_command.startsWith( "oc" ) )
+    else if ( type == "e" )
     {
-        parseCancelOrder( result_obj, request );
+        kDebug() << "(wss) error:" << info.value( "m" ).toString();
+
+        // maybe the token expired, retry the address feed later
+        wss_address_state = false;
+        wss_address_resync.cancel();
     }
-    // handle order new response
-    else if ( api_command.startsWith( "on" ) )
+    // "i" is the connection init
+}
+
+void WavesREST::wssParseOrderBook( const QJsonObject &info )
+{
+    const QString pair = info.value( "S" ).toString();
+
+    if ( !wss_books.contains( pair ) )
     {
-        parseNewOrder( result_obj, request );
+        kDebug() << "local waves warning: wss book update for unsubscribed pair" << pair;
+        return;
     }
-    // handle my orders response
-    else if ( api_command.startsWith( "om" ) )
+
+    WavesBook &book = wss_books[ pair ];
+    const qint64 update_id = info.value( "U" ).toVariant().toLongLong();
+
+    // the first message is the snapshot, then changed levels
+    if ( !book.has_snapshot )
     {
-        parseMyOrders( result_arr, request->time_sent_ms );
+        book.bids.clear();
+        book.asks.clear();
+        book.has_snapshot = true;
     }
-    else
+    else if ( update_id > 0 && book.update_id > 0 )
     {
-        kDebug() << "local warning: nam reply of unknown command for command:" << api_command << "path:" << path << ":" << data;
+        // we already have it
+        if ( update_id <= book.update_id )
+            return;
+
+        // we missed some, the levels are wrong now. drop the book and take a new snapshot on the next check
+        if ( update_id > book.update_id + 1 )
+        {
+            kDebug() << "local waves warning: resubscribing wss book" << pair << "after it skipped from update" << book.update_id << "to" << update_id;
+
+            const QJsonObject unsubscribe_book
+            {
+                { "T", "obu" },
+                { "S", pair }
+            };
+
+            wssSendJsonObj( unsubscribe_book );
+            wss_books.remove( pair );
+            return;
+        }
     }
 
-    deleteReply( reply, request );
-}
+    book.update_id = update_id;
 
-void WavesREST::onCheckMarketData()
-{
-    sendRequest( WAVES_COMMAND_GET_MARKET_DATA );
-}
+    wssApplyBookLevels( book.bids, info.value( "b" ).toArray() );
+    wssApplyBookLevels( book.asks, info.value( "a" ).toArray() );
 
-void WavesREST::onCheckTicker()
-{
-    checkTicker();
-}
+    // check for one sided/crossed book
+    if ( book.bids.isEmpty() ||
+         book.asks.isEmpty() ||
+         book.bids.lastKey() >= book.asks.firstKey() )
+        return;
 
-void WavesREST::checkTicker( bool ignore_flow_control )
-{
-    if ( !ignore_flow_control && yieldToFlowControl() )
+    // check that market exists
+    if ( !engine->getMarketInfoStructure().contains( book.market ) )
         return;
 
-    // if the next index to query is bad, reset it
-    if ( next_ticker_index_to_query >= tracked_markets.size() )
-        next_ticker_index_to_query = 0;
+    engine->processTicker( this, book.market, TickerInfo( book.bids.lastKey(), book.asks.firstKey() ) );
+}
 
-    // if tracked markets are empty, skip ticker
-    if ( tracked_markets.isEmpty() )
+void WavesREST::wssApplyBookLevels( QMap<Coin,Coin> &levels, const QJsonArray &updates )
+{
+    // levels are [ "price", "amount" ], zero amount removes the level
+    for ( QJsonArray::const_iterator i = updates.begin(); i != updates.end(); i++ )
     {
-        kDebug() << "local warning: skipping querying ticker because tracked_markets is empty";
-        return;
+        const QJsonArray level = (*i).toArray();
+        const Coin price = Coin::fromAscii( level.at( 0 ).toString() );
+        const Coin amount = Coin::fromAscii( level.at( 1 ).toString() );
+
+        if ( !price.isGreaterThanZero() )
+            continue;
+
+        if ( amount.isGreaterThanZero() )
+            levels.insert( price, amount );
+        else
+            levels.remove( price );
     }
+}
 
-//    kDebug() << "checking next ticker" << tracked_markets.value( next_ticker_index_to_query );
+void WavesREST::wssParseAddress( const QJsonObject &info )
+{
+    // the first message is the snapshot of our orders, after that only changes. it doesn't have the orders that
+    // closed while we were gone, those come from the rest snapshot
+    const bool is_snapshot = !wss_address_state;
+    if ( is_snapshot )
+    {
+        kDebug() << "(wss) address feed is up";
+        wss_address_state = true;
+    }
 
-    Market market = tracked_markets.value( next_ticker_index_to_query );
+    const QJsonArray orders = info.value( "o" ).toArray();
+    for ( QJsonArray::const_iterator i = orders.begin(); i != orders.end(); i++ )
+    {
+        const QJsonObject order = (*i).toObject();
+        const QString order_id = order.value( "i" ).toString();
+        const QString order_status = order.value( "s" ).toString();
 
-    const QString price_alias = account.getAliasByAsset( market.getBase() );
-    const QString amount_alias = account.getAliasByAsset( market.getQuote() );
+        // skip non-local orders
+        if ( !engine->getPositionMan()->isValidOrderID( order_id ) )
+            continue;
 
-    const QString ticker_url = QString( WAVES_COMMAND_GET_MARKET_STATUS )
-                                .arg( amount_alias )
-                                .arg( price_alias );
+        Position *pos = engine->getPositionMan()->getByOrderID( order_id );
 
-    sendRequest( ticker_url );
+        if ( order_status == "Filled" )
+        {
+            removeCancellingCheck( pos );
+            engine->processFilledOrders( QVector<Position*>() << pos, FILL_WSS );
+        }
+        // let getorder process the partial fill and the cancel
+        else if ( order_status == "Cancelled" &&
+                  !engine->orders_for_polling.contains( order_id ) )
+        {
+            engine->orders_for_polling += order_id;
+        }
+    }
 
-    // iterate index
-    next_ticker_index_to_query++;
+    if ( is_snapshot )
+        wssBeginResync();
 }
 
-void WavesREST::checkBotOrders( bool ignore_flow_control )
+void WavesREST::wssBeginResync()
 {
-    if ( !ignore_flow_control && yieldToFlowControl() )
+    if ( !wss_address_resync.begin( QDateTime::currentMSecsSinceEpoch() ) )
         return;
 
-    sendRequest( QString( WAVES_COMMAND_GET_MY_ORDERS )
-                  .arg( QString( account.publicKeyB58() ) ) );
-}
+    kDebug() << "(wss) resyncing address feed";
 
-void WavesREST::onCheckBotOrders()
-{
-    checkBotOrders();
+    // the snapshot, whatever the flow control says
+    checkBotOrders( true );
 }
 
-void WavesREST::onCheckCancellingOrders()
+void WavesREST::wssFinishResync( const qint64 snapshot_time )
 {
-    if ( yieldToFlowControl() )
-        return;
+    QMutexLocker locker( engine->getLock() );
 
-    // check for empty cancelling query orders
-    if ( cancelling_orders_to_query.size() == 0 )
+    QVector<QString> replay;
+    if ( !wss_address_resync.finish( snapshot_time, replay ) )
         return;
 
-    if ( ++last_cancelling_index_checked >= cancelling_orders_to_query.size() )
-        last_cancelling_index_checked = 0;
+    kDebug() << "(wss) address feed resynced, replaying" << replay.size() << "updates";
 
-    Position *order_to_check = cancelling_orders_to_query.value( last_cancelling_index_checked );
-
-    // prevent bad access, check if address is still alive
-    if ( engine->getPositionMan()->isValid( order_to_check ) )
-        getOrderStatus( order_to_check );
-    // if it's not valid, remove it from the query list
-    else
-        cancelling_orders_to_query.removeAt( last_cancelling_index_checked );
+    for ( QVector<QString>::const_iterator i = replay.begin(); i != replay.end(); i++ )
+        wssTextMessageReceived( *i );
 }
 
-void WavesREST::parseMarketData( const QJsonObject &info )
+bool WavesREST::parseMarketData( const QJsonObject &info )
 {
     //kDebug() << "market data" << info;
 
@@ -460,7 +1383,7 @@ void WavesREST::parseMarketData( const QJsonObject &info )
          !info.value( "markets").isArray() )
     {
         kDebug() << "nam reply error: couldn't find the correct fields in market data";
-        return;
+        return false;
     }
 
     const QString matcher_pubkey = info.value( "matcherPublicKey" ).toString();
@@ -480,7 +1403,7 @@ void WavesREST::parseMarketData( const QJsonObject &info )
         const QString price_asset_alias = market_data.value( "priceAsset" ).toString();
         const Coin price_ticksize = Coin::ticksizeFromDecimals( market_data.value( "priceAssetInfo" ).toObject().value( "decimals" ).toVariant().toULongLong() );
         const Coin amount_ticksize = Coin::ticksizeFromDecimals( market_data.value( "amountAssetInfo" ).toObject().value( "decimals" ).toVariant().toULongLong() );
-        const Coin matcher_ticksize = market_data.value( "matchingRules" ).toObject().value( "tickSize" ).toString();
+        const Coin matcher_ticksize = Coin::fromAscii( market_data.value( "matchingRules" ).toObject().value( "tickSize" ).toString() );
 
         if ( amount_asset_alias.isEmpty() ||
              price_asset_alias.isEmpty() ||
@@ -505,8 +1428,6 @@ void WavesREST::parseMarketData( const QJsonObject &info )
 //                 << "price asset:" << price_asset << "price ticksize:" << price_ticksize
 //                 << "amount asset:" << amount_asset << "amount ticksize:" << amount_ticksize;
 
-        tracked_markets += market;
-
         // update market ticksize
         MarketInfo &market_info = engine->getMarketInfo( market );
         market_info.price_ticksize = price_ticksize;
@@ -519,6 +1440,10 @@ void WavesREST::parseMarketData( const QJsonObject &info )
             market_info.price_ticksize = CoinAmount::SATOSHI *100;
         else if ( market == "USDN_USDT" )
             market_info.price_ticksize = CoinAmount::SATOSHI;
+
+        // the other shards poll their own markets
+        if ( engine->isInShard( market ) )
+            tracked_markets += market;
     }
 
     // update tickers
@@ -528,7 +1453,17 @@ void WavesREST::parseMarketData( const QJsonObject &info )
             checkTicker( true ); // check ticker, ignore flow control = true
 
         initial_ticker_update_done = true;
+
+        wss_timer->start( WSS_TIMEOUT );
+        wssCheckConnection(); // connect now that we know the markets
     }
+    // subscribe to any new markets
+    else
+    {
+        wssSendSubscriptions();
+    }
+
+    return true;
 }
 
 void WavesREST::parseMarketStatus( const QJsonObject &info, Request *const &request )
@@ -638,41 +1573,63 @@ void WavesREST::parseOrderStatus( const QJsonObject &info, Request *const &reque
     if ( !engine->getPositionMan()->isActive( request->pos ) )
     {
         //kDebug() << "local waves warning: found response for order status, but position is not active for order_id" << order_id << info;
-        cancelling_orders_to_query.removeOne( request->pos );
+        removeCancellingCheck( request->pos );
         return;
     }
 
-    Position *const &pos = request->pos;
-    MarketInfo &market_info = engine->getMarketInfo( pos->market );
-
-    const QString &order_status = info.value( "status" ).toString();
-    Coin filled_quantity = market_info.quantity_ticksize * info.value( "filledAmount" ).toVariant().toULongLong();
     //const Coin filled_fee = CoinAmount::SATOSHI * info.value( "filledFee" ).toVariant().toULongLong();
 
-    //kDebug() << "order status" << order_id << ":" << order_status;
+    applyOrderStatus( request->pos, info.value( "status" ).toString(), info.value( "filledAmount" ).toVariant().toULongLong(), FILL_GETORDER );
+}
+
+void WavesREST::parseOrderHistory( const QJsonArray &info )
+{
+    for ( QJsonArray::const_iterator i = info.begin(); i != info.end(); i++ )
+    {
+        const QJsonObject order = (*i).toObject();
+        const QString order_id = order.value( "id" ).toString();
+
+        // skip non-local orders
+        if ( !engine->getPositionMan()->isValidOrderID( order_id ) )
+            continue;
+
+        Position *const pos = engine->getPositionMan()->getByOrderID( order_id );
+        if ( !engine->getPositionMan()->isActive( pos ) )
+            continue;
+
+        applyOrderStatus( pos, order.value( "status" ).toString(), order.value( "filledAmount" ).toVariant().toULongLong(), FILL_HISTORY );
+    }
+}
+
+void WavesREST::applyOrderStatus( Position *const &pos, const QString &order_status, const quint64 filled_amount, const quint8 fill_type )
+{
+    MarketInfo &market_info = engine->getMarketInfo( pos->market );
+    Coin filled_quantity = market_info.quantity_ticksize * filled_amount;
+
+    //kDebug() << "order status" << pos->order_number << ":" << order_status;
 
     // clamp qty to original amount
     if ( filled_quantity > pos->quantity )
     {
-        kDebug() << "local warning: processed filled quantity" << filled_quantity << "greater than position quantity" << pos->quantity << ", clamping to position quantity. ticksize" << market_info.quantity_ticksize << "filled_amount" << info.value( "filledAmount" ).toVariant().toULongLong();
+        kDebug() << "local warning: processed filled quantity" << filled_quantity << "greater than position quantity" << pos->quantity << ", clamping to position quantity. ticksize" << market_info.quantity_ticksize << "filled_amount" << filled_amount;
         filled_quantity = pos->quantity;
     }
 
     // remove it from pending status orders
     if ( pos->is_cancelling )
-        cancelling_orders_to_query.removeOne( pos );
+        removeCancellingCheck( pos );
 
     if ( order_status == "Filled" )
     {
         // do single order fill
-        engine->processFilledOrders( QVector<Position*>() << pos, FILL_GETORDER );
+        engine->processFilledOrders( QVector<Position*>() << pos, fill_type );
     }
     // we cancelled the order out but it got filled or cancelled
     else if ( order_status == "Cancelled" )
     {
         // process partially filled amount
         if ( filled_quantity.isGreaterThanZero() )
-            engine->updateStatsAndPrintFill( "getorder", pos->market, pos->order_number, pos->side, pos->strategy_tag, Coin(), filled_quantity, pos->price, Coin() );
+            engine->updateStatsAndPrintFill( fill_type == FILL_HISTORY ? "history" : "getorder", pos->market, pos->order_number.toString(), pos->side, pos->strategy_tag, Coin(), filled_quantity, pos->price, Coin() );
 
         engine->processCancelledOrder( pos );
     }
@@ -701,8 +1658,59 @@ void WavesREST::parseCancelOrder( const QJsonObject &info, Request *const &reque
     }
 
     // queue getstatus command
-    if ( !cancelling_orders_to_query.contains( pos ) )
-        cancelling_orders_to_query += pos;
+    addCancellingCheck( pos );
+}
+
+void WavesREST::parseCancelPair( const QJsonObject &info )
+{
+    // the orders that fail go through the cancel timeouts one at a time
+    if ( info.value( "status" ).toString() != "BatchCancelCompleted" )
+    {
+        kDebug() << "local waves warning: bad pair cancel reply:" << info;
+        return;
+    }
+
+    // message is an array of arrays of per order results
+    QJsonArray results;
+    const QJsonArray message = info.value( "message" ).toArray();
+    for ( QJsonArray::const_iterator i = message.begin(); i != message.end(); i++ )
+    {
+        if ( (*i).isArray() )
+        {
+            const QJsonArray inner = (*i).toArray();
+            for ( QJsonArray::const_iterator j = inner.begin(); j != inner.end(); j++ )
+                results += *j;
+        }
+        else
+        {
+            results += *i;
+        }
+    }
+
+    qint32 ct_local = 0, ct_failed = 0;
+
+    for ( QJsonArray::const_iterator i = results.begin(); i != results.end(); i++ )
+    {
+        const QJsonObject result = (*i).toObject();
+
+        if ( result.value( "status" ).toString() != "OrderCanceled" )
+        {
+            ct_failed++;
+            continue;
+        }
+
+        Position *const pos = engine->getPositionMan()->getByOrderID( result.value( "orderId" ).toString() );
+
+        if ( !pos || !engine->getPositionMan()->isActive( pos ) )
+            continue;
+
+        // same as a single cancel, the status query processes it
+        addCancellingCheck( pos );
+
+        ct_local++;
+    }
+
+    kDebug() << "successfully cancelled" << results.size() - ct_failed << "orders in pair," << ct_local << "local," << ct_failed << "failed";
 }
 
 void WavesREST::parseNewOrder( const QJsonObject &info, Request *const &request )
@@ -764,72 +1772,153 @@ void WavesREST::parseNewOrder( const QJsonObject &info, Request *const &request
     engine->getPositionMan()->activate( pos, order_id );
 }
 
-void WavesREST::parseMyOrders( const QJsonArray &orders, qint64 request_time_sent_ms )
+bool WavesREST::parseMyOrders( const QByteArray &data, qint64 request_time_sent_ms )
 {
     const qint64 current_time = QDateTime::currentMSecsSinceEpoch(); // cache time
 
-    // is the orderbook is too old to be safe? check the stale tolerance
-    if ( request_time_sent_ms < current_time - orderbook_stale_tolerance )
-    {
-        orders_stale_trip_count++;
-        return;
-    }
-
-    // don't accept responses for requests sooner than the latest response request_time_sent_ms
-    if ( request_time_sent_ms < orderbook_update_request_time )
-        return;
-
-    // set the timestamp of orderbook update if we saw any orders
-    orderbook_update_time = current_time;
-    orderbook_update_request_time = request_time_sent_ms;
+    // read the array of orders in one pass
+    JsonStreamReader reader( data );
+    if ( reader.readNext() != JsonStreamReader::StartArray )
+        return false;
 
-    // parse array of objects
-    QVector<QString> order_numbers; // keep track of order numbers
-    QMultiHash<QString, OrderInfo> order_map; // store map of order numbers/orderinfo
+    open_orders.resize( 0 ); // keeps the capacity
 
-    for ( QJsonArray::const_iterator i = orders.begin(); i != orders.end(); i++ )
+    while ( reader.readNext() != JsonStreamReader::EndArray )
     {
-        if ( !(*i).isObject() )
+        if ( reader.tokenType() != JsonStreamReader::StartObject )
+        {
+            if ( !reader.skipCurrentValue() )
+                return false;
+
             continue;
+        }
 
-        const QJsonObject &order = (*i).toObject();
-        const QString &id = order.value( "id" ).toString();
-        const QString &side_str = order.value( "type" ).toString().toLower();
-        const uint64_t price_raw = order.value( "price" ).toVariant().toULongLong();
-        const uint64_t amount_raw = order.value( "amount" ).toVariant().toULongLong();
+        QString id, amount_asset, price_asset;
+        quint8 side = 0;
+        uint64_t price_raw = 0, amount_raw = 0;
+        bool has_asset_pair = false;
+
+        while ( reader.readNext() == JsonStreamReader::Name )
+        {
+            if ( reader.isText( "id" ) )
+            {
+                reader.readScalar();
+                id = reader.textString();
+            }
+            else if ( reader.isText( "type" ) )
+            {
+                reader.readScalar();
+                side = reader.isText( "buy" ) || reader.isText( "BUY" ) ? SIDE_BUY :
+                       reader.isText( "sell" ) || reader.isText( "SELL" ) ? SIDE_SELL : 0;
+            }
+            else if ( reader.isText( "price" ) )
+            {
+                reader.readScalar();
+                price_raw = reader.toULongLong();
+            }
+            else if ( reader.isText( "amount" ) )
+            {
+                reader.readScalar();
+                amount_raw = reader.toULongLong();
+            }
+            else if ( reader.isText( "assetPair" ) )
+            {
+                if ( reader.readNext() != JsonStreamReader::StartObject )
+                {
+                    if ( !reader.skipCurrentValue() )
+                        return false;
+
+                    continue;
+                }
+
+                // parse price/amount asset, waves is null
+                while ( reader.readNext() == JsonStreamReader::Name )
+                {
+                    has_asset_pair = true;
+
+                    if ( reader.isText( "amountAsset" ) )
+                    {
+                        reader.readScalar();
+                        amount_asset = reader.textString();
+                    }
+                    else if ( reader.isText( "priceAsset" ) )
+                    {
+                        reader.readScalar();
+                        price_asset = reader.textString();
+                    }
+                    else if ( !reader.skipValue() )
+                    {
+                        return false;
+                    }
+                }
+
+                if ( reader.tokenType() != JsonStreamReader::EndObject )
+                    return false;
+            }
+            else if ( !reader.skipValue() )
+            {
+                return false;
+            }
+        }
 
-        const QJsonObject &asset_pair = order.value( "assetPair" ).toObject();
+        if ( reader.tokenType() != JsonStreamReader::EndObject )
+            return false;
 
-        // parse price/amount asset
-        const QString &amount_asset = asset_pair.value( "amountAsset" ).toString();
-        const QString &price_asset = asset_pair.value( "priceAsset" ).toString();
+        if ( id.isEmpty() || // check for bad id
+             !has_asset_pair || // check empty asset pair
+             side == 0 || // check for bad side
+             price_raw < 1 || // check for bad raw price
+             amount_raw < 1 ) // check for bad raw amount
+            continue;
 
         Market market = Market( account.getAssetByAlias( price_asset ),
                                 account.getAssetByAlias( amount_asset ) );
 
+        if ( !market.isValid() ) // check for empty assets
+            continue;
+
         // process price/base amounts
         MarketInfo &local_market_info = engine->getMarketInfo( market );
         const Coin price = local_market_info.price_ticksize * price_raw;
         const Coin base_amount = ( local_market_info.quantity_ticksize * amount_raw ) * price;
 
-        if ( id.isEmpty() || // check for bad id
-             asset_pair.isEmpty() || // check empty asset pair
-             !market.isValid() || // check for empty assets
-             ( side_str != "buy" && side_str != "sell" ) || // check for bad side
-             price_raw < 1 || // check for bad raw price
-             amount_raw < 1 || // check for bad raw amount
-             price.isZeroOrLess() || // check for bad price
+        if ( price.isZeroOrLess() || // check for bad price
              base_amount.isZeroOrLess() ) // check for bad amount
             continue;
 
-        const quint8 side = side_str == "buy" ? SIDE_BUY : SIDE_SELL;
+        open_orders.append( OrderRecord() );
+        OrderRecord &order = open_orders.last();
+        order.order_number = id;
+        order.market = market;
+        order.side = side;
+        order.price = price;
+        order.amount = base_amount;
+    }
 
-        // insert into seen orders
-        order_numbers += id;
+    // the whole reply should be the array
+    if ( reader.readNext() != JsonStreamReader::EndDocument )
+        return false;
 
-        // insert (market, order)
-        order_map.insert( market, OrderInfo( id, side, price, base_amount ) );
+    // is the orderbook is too old to be safe? check the stale tolerance
+    if ( request_time_sent_ms < current_time - orderbook_stale_tolerance )
+    {
+        orders_stale_trip_count++;
+        return true;
     }
 
-    engine->processOpenOrders( order_numbers, order_map, request_time_sent_ms );
+    // don't accept responses for requests sooner than the latest response request_time_sent_ms
+    if ( request_time_sent_ms < orderbook_update_request_time )
+        return true;
+
+    // set the timestamp of orderbook update if we saw any orders
+    orderbook_update_time = current_time;
+    orderbook_update_request_time = request_time_sent_ms;
+
+    engine->processOpenOrders( open_orders, request_time_sent_ms );
+
+    // replay the address feed on top of it, after the caller is done with the reply buffer
+    if ( wss_address_resync.isBuffering() )
+        QTimer::singleShot( 0, this, [this, request_time_sent_ms]() { wssFinishResync( request_time_sent_ms ); } );
+
+    return true;
 }
@@ -2,15 +2,32 @@
 #define WAVESREST_H
 
 #include <QObject>
+#include <QMap>
+#include <QHash>
+#include <QSet>
 
 #include "global.h"
 #include "position.h"
 #include "keystore.h"
 #include "baserest.h"
 #include "wavesaccount.h"
+#include "streamresync.h"
 
 class QNetworkReply;
 class QTimer;
+class QWebSocket;
+class QJsonObject;
+class QJsonArray;
+class QThreadPool;
+
+// local copy of a matcher order book from the websocket feed
+struct WavesBook
+{
+    QString market;
+    QMap<Coin,Coin> bids, asks; // price -> amount
+    bool has_snapshot{ false };
+    qint64 update_id{ 0 }; // "U" of the last update, they count up by one per pair
+};
 
 class WavesREST : public BaseREST
 {
@@ -23,17 +40,32 @@ public:
     ~WavesREST();
 
     void init();
+    QString getWarmUrl() const { return WAVES_MATCHER_URL; }
+    void setAccountKeyB58( const QByteArray &key_b58 ) { account_key_b58 = key_b58; } // before init(), instead of WAVES_SECRET
 
     void sendNamRequest( Request *const &request );
+    quint8 getRequestClass( const QString &api_command ) const;
+    QString getCommandKind( const QString &api_command ) const;
+    void buildRequestTemplate( const QString &api_command, RequestTemplate &t ) const;
 
     void getOrderStatus( Position *const &pos );
 
     void sendCancel( const QString &order_id, Position *const &pos , const Market &market );
     void sendCancelNonLocal( const QString &order_id , const QString &amount_asset_alias, const QString &price_asset_alias );
+    void sendCancelPair( const Market &market ); // every order we have in the market, ours or not
     void sendBuySell( Position *const &pos, bool quiet = true );
 
     void checkTicker( bool ignore_flow_control = false );
+    void checkTickerBatch();
+    QString getMarketStatusCommand( const Market &market ) const;
+    void setTickerBatch( bool enabled, qint32 interval = 0 ); // interval 0 keeps the ticker interval
     void checkBotOrders( bool ignore_flow_control = false );
+    void setHistoryFills( bool enabled ); // settle the polled orders from one order history request, see checkOrderHistory()
+
+    void setJwt( const QByteArray &jwt ); // address stream token, see wssSendSubscriptions()
+
+    void onSignBatchDone( const QVector<WavesSignJob> &jobs ); // from WavesSignBatch, on our thread
+    void wssSendJsonObj( const QJsonObject &obj );
 
 public Q_SLOTS:
     void sendNamQueue();
@@ -43,25 +75,95 @@ public Q_SLOTS:
     void onCheckTicker();
     void onCheckBotOrders();
     void onCheckCancellingOrders();
+    void onPresignOrders();
+
+    void wssConnected();
+    void wssCheckConnection();
+    void wssTextMessageReceived( const QString &msg );
+    void wssSendSubscriptions();
 
 private:
-    void parseMarketData( const QJsonObject &info );
+    void queueSignJob( const QString &api_command, WavesSignJob &job, Position *const &pos = nullptr );
+    void sendSignJobs();
+    void signOnPool( const QVector<WavesSignJob> &jobs ); // split evenly over sign_pool
+    bool takePresignedOrder( WavesSignJob &job ); // sets signed_body if job's order was signed ahead and is still fresh
+
+    void wssParseOrderBook( const QJsonObject &info );
+    void wssApplyBookLevels( QMap<Coin,Coin> &levels, const QJsonArray &updates );
+    void wssParseAddress( const QJsonObject &info );
+    void wssBeginResync(); // the address feed is back, buffer it until a my orders snapshot is applied
+    void wssFinishResync( const qint64 snapshot_time );
+
+    bool parseMarketData( const QJsonObject &info ); // false if it's missing fields
     void parseMarketStatus( const QJsonObject &info, Request *const &request );
     void parseOrderStatus( const QJsonObject &info, Request *const &request );
     void parseCancelOrder( const QJsonObject &info, Request *const &request );
+    void parseCancelPair( const QJsonObject &info );
     void parseNewOrder( const QJsonObject &info, Request *const &request );
-    void parseMyOrders( const QJsonArray &orders, qint64 request_time_sent_ms );
+    bool parseMyOrders( const QByteArray &data, qint64 request_time_sent_ms ); // false if it isn't an orders array
+    void parseOrderHistory( const QJsonArray &info );
+    void applyOrderStatus( Position *const &pos, const QString &order_status, const quint64 filled_amount, const quint8 fill_type );
+    void checkOrderHistory(); // the closed orders since the oldest polled one, instead of a status query for each
+
+    void addCancellingCheck( Position *const &pos ); // (re)starts its status checks
+    void removeCancellingCheck( Position *const &pos );
+
+    void setNewOrderWindow( qreal window );
+    void updateNewOrderWindow( Request *const &request, bool ok );
+    void checkNewOrderTimeouts();
 
     WavesAccount account;
+    QByteArray account_key_b58; // empty for WAVES_SECRET
 
     QStringList tracked_markets;
 
-    QVector<Position*> cancelling_orders_to_query;
+    // cancelled orders waiting for a status query, by when the next one is due. each query spaces the next out further
+    struct CancellingCheck
+    {
+        Position *pos{ nullptr };
+        quint32 generation{ 0 }; // it can be recycled while it waits
+        qint32 checks{ 0 };
+    };
+    QMultiMap<qint64/*due time*/, CancellingCheck> cancelling_checks;
+    QHash<Position*, qint64/*due time*/> cancelling_check_times; // to find and drop one
 
     bool initial_ticker_update_done{ false };
-    qint32 next_ticker_index_to_query{ 0 };
-    qint32 last_cancelling_index_checked{ 0 };
-    QTimer *market_data_timer{ nullptr };
+    QHash<QString/*market*/, qreal> ticker_poll_credit; // weighted turns for the ticker queries, see checkTicker()
+    bool ticker_batch{ false }; // query all tracked markets each ticker tick instead of one
+    bool history_fills{ false }; // see checkOrderHistory()
+    qint64 history_request_time{ 0 };
+    ScheduledTask *market_data_timer{ nullptr };
+
+    // websocket feed, rest polling stays on as the fallback and to reconcile
+    QWebSocket *wss{ nullptr };
+    ScheduledTask *wss_timer{ nullptr };
+    QByteArray wss_jwt;
+    QMap<QString, WavesBook> wss_books; // by "amountAlias-priceAlias"
+    bool wss_address_state{ false }; // got the address snapshot
+    StreamResync wss_address_resync;
+    qint64 wss_connect_try_time{ 0 },
+           wss_heartbeat_time{ 0 },
+           wss_address_subscribe_try_time{ 0 };
+    qint32 wss_rest_ticker_interval{ 0 }; // ticker interval to restore when the book feed goes stale
+
+    // new orders and cancels are signed on the pool in bursts, then queued
+    QThreadPool *sign_pool{ nullptr };
+    QVector<WavesSignJob> sign_jobs; // waiting for sendSignJobs()
+    QVector<Request*> signing_requests; // on the pool, not in nam_queue yet
+
+    // the flips of our grid orders, signed ahead so a fill only has to send the next order. by WavesAccount::getOrderKey()
+    struct PresignedOrder
+    {
+        QByteArray signed_body;
+        qint64 presign_time{ 0 };
+    };
+    QHash<QByteArray, PresignedOrder> presigned_orders;
+    QSet<QByteArray> presigning_orders; // on the pool
+    ScheduledTask *presign_timer{ nullptr };
+
+    // aimd window for new orders in flight
+    qreal new_order_window{ 2. };
+    qint64 new_order_window_decrease_time{ 0 }; // requests sent before this already counted for the last decrease
 };
 
 #endif // WAVESREST_H
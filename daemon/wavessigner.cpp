@@ -0,0 +1,137 @@
+#include "wavessigner.h"
+#include "wavesutil.h"
+#include "wavesrest.h"
+
+#include "../qbase58/qbase58.h"
+
+#include <QRandomGenerator>
+#include <QVarLengthArray>
+#include <QJsonArray>
+#include <QJsonDocument>
+
+#include <cstring>
+
+extern "C" {
+#include "../libcurve25519-donna/ge.h"
+#include "../libcurve25519-donna/additions/crypto_additions.h"
+}
+
+// seeded once for each thread from the system source, the 64 bytes only go into the nonce hash next to the key
+static QRandomGenerator64 &getNonceGenerator()
+{
+    static thread_local QRandomGenerator64 generator = []()
+    {
+        quint32 seed[ 16 ];
+        QRandomGenerator::system()->fillRange( seed );
+        return QRandomGenerator64( seed, 16 );
+    }();
+
+    return generator;
+}
+
+WavesSigner::WavesSigner()
+{
+    std::memset( ed_public_key, 0, sizeof( ed_public_key ) );
+}
+
+void WavesSigner::setPrivateKey( const QByteArray &_private_key )
+{
+    if ( _private_key.size() < 32 )
+    {
+        kDebug() << "local error: WavesSigner::setPrivateKey: tried to set new private key with size <32";
+        return;
+    }
+
+    private_key = _private_key;
+
+    // the ed25519 public key for the curve25519 private key, curve25519_sign() does this on every call
+    ge_p3 ed_public_key_point;
+    ge_scalarmult_base( &ed_public_key_point, reinterpret_cast<const unsigned char*>( private_key.constData() ) );
+    ge_p3_tobytes( ed_public_key, &ed_public_key_point );
+}
+
+bool WavesSigner::sign( const QByteArray &message, QByteArray &signature, bool add_random_bytes ) const
+{
+    if ( private_key.size() < 32 )
+    {
+        kDebug() << "local error: WavesSigner::sign: private key size <32";
+        return false;
+    }
+
+    quint64 random[ 8 ] = {};
+
+    if ( add_random_bytes )
+        getNonceGenerator().fillRange( random );
+
+    // prefix + key + message + random, then the signature + message (same as curve25519_sign(), on the stack)
+    QVarLengthArray<unsigned char, 512> sign_buffer( message.size() + 128 );
+
+    crypto_sign_modified( sign_buffer.data(),
+                          reinterpret_cast<const unsigned char*>( message.constData() ),
+                          quint64( message.size() ),
+                          reinterpret_cast<const unsigned char*>( private_key.constData() ),
+                          ed_public_key,
+                          reinterpret_cast<const unsigned char*>( random ) );
+
+    signature.resize( 64 );
+    std::memcpy( signature.data(), sign_buffer.constData(), 64 );
+
+    // encode the sign bit into the unused high bit of s
+    signature[ 63 ] = char( ( quint8( signature[ 63 ] ) & 0x7F ) | ( ed_public_key[ 31 ] & 0x80 ) );
+
+    return true;
+}
+
+bool WavesSigner::signJob( WavesSignJob &job ) const
+{
+    job.signed_body.clear();
+
+    QByteArray signature;
+    if ( job.bytes.isEmpty() || !sign( job.bytes, signature, job.add_random_bytes ) )
+        return false;
+
+    const QByteArray signature_b58 = QBase58::encode( signature );
+
+    // orders are preformatted, the id and the proof go right into the gaps
+    if ( job.is_order )
+    {
+        const QByteArray id_b58 = QBase58::encode( WavesUtil::hashBlake2b( job.bytes ) );
+        const char *json = job.order_json.constData();
+
+        job.signed_body.reserve( job.order_json.size() + id_b58.size() + signature_b58.size() );
+        job.signed_body.append( json, job.id_offset );
+        job.signed_body += id_b58;
+        job.signed_body.append( json + job.id_offset, job.proof_offset - job.id_offset );
+        job.signed_body += signature_b58;
+        job.signed_body.append( json + job.proof_offset, job.order_json.size() - job.proof_offset );
+        return true;
+    }
+
+    job.body[ "signature" ] = QString( signature_b58 );
+    job.body[ "proofs" ] = QJsonArray{ QString( signature_b58 ) };
+
+    // jsonify object
+    QJsonDocument doc;
+    doc.setObject( job.body );
+
+    job.signed_body = doc.toJson( QJsonDocument::Compact );
+    return true;
+}
+
+WavesSignBatch::WavesSignBatch( WavesREST *_rest, const WavesSigner &_signer, const QVector<WavesSignJob> &_jobs )
+    : rest( _rest ),
+      signer( _signer ),
+      jobs( _jobs )
+{
+}
+
+void WavesSignBatch::run()
+{
+    for ( QVector<WavesSignJob>::iterator i = jobs.begin(); i != jobs.end(); i++ )
+        signer.signJob( *i );
+
+    // back to the engine thread
+    WavesREST *const target = rest;
+    const QVector<WavesSignJob> signed_jobs = jobs;
+    QMetaObject::invokeMethod( target, [target, signed_jobs]() { target->onSignBatchDone( signed_jobs ); }, Qt::QueuedConnection );
+}
@@ -0,0 +1,68 @@
+#ifndef WAVESSIGNER_H
+#define WAVESSIGNER_H
+
+#include "global.h"
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QRunnable>
+#include <QVector>
+
+struct Request;
+class WavesREST;
+
+// an order or cancel waiting for its signature. the bytes and the unsigned body are made on the engine thread,
+// the signer adds the id (orders), the proofs and writes signed_body
+struct WavesSignJob
+{
+    QByteArray bytes;
+    QJsonObject body; // cancels
+    QByteArray order_json; // orders, the finished body less the id and the proof, see WavesAccount::createOrderJob()
+    qint32 id_offset{ 0 }; // where they go in order_json
+    qint32 proof_offset{ 0 };
+    bool is_order{ false };
+    bool add_random_bytes{ true };
+    qint64 presign_time{ 0 }; // when an order signed ahead was made, see WavesREST::onPresignOrders()
+    Request *request{ nullptr }; // owned by WavesREST until the job comes back, nullptr for an order signed ahead
+    QByteArray signed_body; // empty if signing failed
+};
+
+//
+// WavesSigner, curve25519 signatures with the ed25519 public key worked out once in setPrivateKey() instead of on
+// every sign, and the nonce randomness from a generator for each thread instead of the locked global one. sign() and
+// signJob() are const and safe to call from the signing pool
+//
+class WavesSigner
+{
+public:
+    explicit WavesSigner();
+
+    void setPrivateKey( const QByteArray &_private_key ); // clamped curve25519 key
+    bool isKeySet() const { return private_key.size() >= 32; }
+
+    bool sign( const QByteArray &message, QByteArray &signature, bool add_random_bytes = true ) const;
+    bool signJob( WavesSignJob &job ) const;
+
+private:
+    QByteArray private_key;
+    quint8 ed_public_key[ 32 ]; // the high bit of the last byte goes into the signature
+};
+
+//
+// WavesSignBatch, signs a copy of some jobs on the pool and hands them back to WavesREST::onSignBatchDone() on the
+// engine thread
+//
+class WavesSignBatch : public QRunnable
+{
+public:
+    explicit WavesSignBatch( WavesREST *_rest, const WavesSigner &_signer, const QVector<WavesSignJob> &_jobs );
+
+    void run();
+
+private:
+    WavesREST *rest; // waits for the pool before it goes away
+    WavesSigner signer;
+    QVector<WavesSignJob> jobs;
+};
+
+#endif // WAVESSIGNER_H
@@ -1,5 +1,5 @@
 #include "wavesutil.h"
-#include "../blake2b/sse/blake2.h"
+#include "blake2bdispatch.h"
 #include "../qbase58/qbase58.h"
 
 #include <QByteArray>
@@ -8,18 +8,17 @@
 
 QByteArray WavesUtil::hashBlake2b( const QByteArray &in )
 {
-    QByteArray blake_out;
-    blake_out.resize( 32 );
-
-    blake2b_state S[1];
-
-    blake2b_init( S, 32 );
-    blake2b_update( S, in.data(), in.length() );
-    blake2b_final( S, blake_out.data(), 32 );
+    QByteArray blake_out( 32, Qt::Uninitialized );
+    hashBlake2b( in.constData(), size_t( in.size() ), reinterpret_cast<uint8_t*>( blake_out.data() ) );
 
     return blake_out;
 }
 
+void WavesUtil::hashBlake2b( const char *in, const size_t size, uint8_t out[ 32 ] )
+{
+    Blake2bDispatch::hash256( in, size, out );
+}
+
 QByteArray WavesUtil::hashWaves( const QByteArray &in )
 {
     const QByteArray sha3_out = QCryptographicHash::hash( hashBlake2b( in ), QCryptographicHash::Keccak_256 );
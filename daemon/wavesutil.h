@@ -9,6 +9,7 @@ namespace WavesUtil
     const uint8_t SELL = 1;
 
     QByteArray hashBlake2b( const QByteArray &in );
+    void hashBlake2b( const char *in, const size_t size, uint8_t out[ 32 ] ); // no allocation
     QByteArray hashWaves( const QByteArray &in );
 
     void clampPrivateKey( QByteArray &key );
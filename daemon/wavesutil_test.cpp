@@ -1,5 +1,6 @@
 #include "wavesutil_test.h"
 #include "wavesutil.h"
+#include "blake2bdispatch.h"
 #include "../qbase58/qbase58.h"
 
 #include <QByteArray>
@@ -19,6 +20,25 @@ void WavesUtilTest::test()
     assert( WavesUtil::hashBlake2b( QByteArray() ).toHex() == "0e5751c026e543b2e8ab2eb06099daa1d1e5df47778f7787faab45cdf12fe3a8" );
     assert( WavesUtil::hashBlake2b( QByteArray( "Hello World!\n") ).toHex() == "f497a36252fe0182836a19a75de5d75996a0f0a4e19f81fe749aa9e809a1150c" );
 
+    /// test that each blake2b backend the cpu has agrees with the one we use, over block boundaries
+    QByteArray data;
+    for ( int i = 0; i < 600; i++ )
+        data += char( i * 7 + 3 );
+
+    for ( int b = Blake2bDispatch::Scalar; b <= Blake2bDispatch::Avx2; b++ )
+    {
+        const Blake2bDispatch::Backend backend = Blake2bDispatch::Backend( b );
+        if ( !Blake2bDispatch::isSupported( backend ) )
+            continue;
+
+        for ( int size = 0; size <= data.size(); size++ )
+        {
+            uint8_t out[ 32 ];
+            Blake2bDispatch::hash256( backend, data.constData(), size_t( size ), out );
+            assert( QByteArray( reinterpret_cast<const char*>( out ), 32 ) == WavesUtil::hashBlake2b( data.left( size ) ) );
+        }
+    }
+
     /// test waves hash
     assert( WavesUtil::hashWaves( QByteArray( "A nice, long test to make the day great! :-)" ) ).toHex() == "5df3cf20205d75e09ae46d13a8d99a16174d71c84ffcc00387fec3d81e39dcbe" );
 
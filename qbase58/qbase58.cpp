@@ -5,10 +5,166 @@
 #include <QByteArray>
 #include <QDebug>
 
+static const char ALPHABET[] = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+static const uint32_t POW58_5 = 58 * 58 * 58 * 58 * 58; // 656356768, five digits per 32 bit limb step
+
+// digit values by ascii, -1 for chars outside the alphabet
+static const int8_t DIGITS[ 128 ] =
+{
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1, -1, 0, 1, 2, 3, 4, 5, 6,  7, 8,-1,-1,-1,-1,-1,-1,
+    -1, 9,10,11,12,13,14,15, 16,-1,17,18,19,20,21,-1, 22,23,24,25,26,27,28,29, 30,31,32,-1,-1,-1,-1,-1,
+    -1,33,34,35,36,37,38,39, 40,41,42,43,-1,44,45,46, 47,48,49,50,51,52,53,54, 55,56,57,-1,-1,-1,-1,-1
+};
+
+// the input as big endian 32 bit limbs, divided by 58^5 until it's zero
+template <int N, int MAX_ENCODED>
+static int encodeFixed( const uint8_t *in, char *out )
+{
+    const int LIMBS = N / 4;
+
+    uint32_t limbs[ LIMBS ];
+    for ( int i = 0; i < LIMBS; i++ )
+        limbs[ i ] = ( uint32_t( in[ i * 4 ] ) << 24 ) | ( uint32_t( in[ i * 4 +1 ] ) << 16 ) |
+                     ( uint32_t( in[ i * 4 +2 ] ) << 8 ) | uint32_t( in[ i * 4 +3 ] );
+
+    // leading zero bytes are '1's
+    int zeros = 0;
+    while ( zeros < N && in[ zeros ] == 0 )
+        zeros++;
+
+    // digits, least significant first, rounded up to whole 5 digit steps
+    char digits[ MAX_ENCODED +5 ];
+    int digit_count = 0;
+    int first = 0;
+
+    while ( first < LIMBS && limbs[ first ] == 0 )
+        first++;
+
+    while ( first < LIMBS )
+    {
+        uint64_t remainder = 0;
+        for ( int i = first; i < LIMBS; i++ )
+        {
+            const uint64_t current = ( remainder << 32 ) | limbs[ i ];
+            limbs[ i ] = uint32_t( current / POW58_5 );
+            remainder = current % POW58_5;
+        }
+
+        while ( first < LIMBS && limbs[ first ] == 0 )
+            first++;
+
+        for ( int j = 0; j < 5; j++, remainder /= 58 )
+            digits[ digit_count++ ] = ALPHABET[ remainder % 58 ];
+    }
+
+    // drop the zero digits the last step padded on
+    while ( digit_count > 0 && digits[ digit_count -1 ] == '1' )
+        digit_count--;
+
+    char *p = out;
+    for ( int i = 0; i < zeros; i++ )
+        *p++ = '1';
+    while ( digit_count > 0 )
+        *p++ = digits[ --digit_count ];
+
+    return int( p - out );
+}
+
+// accumulates 5 digits at a time into big endian 32 bit limbs
+template <int N, int MAX_ENCODED>
+static bool decodeFixed( const char *in, const int size, uint8_t *out )
+{
+    const int LIMBS = N / 4;
+
+    if ( size < 1 || size > MAX_ENCODED )
+        return false;
+
+    // leading '1's are zero bytes
+    int ones = 0;
+    while ( ones < size && in[ ones ] == '1' )
+        ones++;
+
+    uint32_t limbs[ LIMBS ] = {};
+
+    for ( int i = ones; i < size; )
+    {
+        uint32_t chunk = 0, multiplier = 1;
+        for ( int j = 0; j < 5 && i < size; j++, i++ )
+        {
+            const uint8_t c = uint8_t( in[ i ] );
+            const int8_t digit = c < 128 ? DIGITS[ c ] : -1;
+            if ( digit < 0 )
+                return false;
+
+            chunk = chunk * 58 + uint32_t( digit );
+            multiplier *= 58;
+        }
+
+        // limbs = limbs * multiplier + chunk
+        uint64_t carry = chunk;
+        for ( int k = LIMBS -1; k >= 0; k-- )
+        {
+            const uint64_t current = uint64_t( limbs[ k ] ) * multiplier + carry;
+            limbs[ k ] = uint32_t( current );
+            carry = current >> 32;
+        }
+
+        // over N bytes
+        if ( carry != 0 )
+            return false;
+    }
+
+    for ( int i = 0; i < LIMBS; i++ )
+    {
+        out[ i * 4 ] = uint8_t( limbs[ i ] >> 24 );
+        out[ i * 4 +1 ] = uint8_t( limbs[ i ] >> 16 );
+        out[ i * 4 +2 ] = uint8_t( limbs[ i ] >> 8 );
+        out[ i * 4 +3 ] = uint8_t( limbs[ i ] );
+    }
+
+    // the value has to fill the bytes after the zeros exactly, like decode() would give us N bytes
+    int zeros = 0;
+    while ( zeros < N && out[ zeros ] == 0 )
+        zeros++;
+
+    return zeros == ones;
+}
+
+int QBase58::encode32( const uint8_t in[ 32 ], char out[ MAX_ENCODED_32 ] )
+{
+    return encodeFixed<32, MAX_ENCODED_32>( in, out );
+}
+
+int QBase58::encode64( const uint8_t in[ 64 ], char out[ MAX_ENCODED_64 ] )
+{
+    return encodeFixed<64, MAX_ENCODED_64>( in, out );
+}
+
+bool QBase58::decode32( const char *in, const int size, uint8_t out[ 32 ] )
+{
+    return decodeFixed<32, MAX_ENCODED_32>( in, size, out );
+}
+
+bool QBase58::decode64( const char *in, const int size, uint8_t out[ 64 ] )
+{
+    return decodeFixed<64, MAX_ENCODED_64>( in, size, out );
+}
+
 QByteArray QBase58::encode( const QByteArray &in )
 {
-    QByteArray out;
-    out.resize( in.size() *2 ); // note: surely there is something better than size*2, but it's better than static
+    const uint8_t *in_bytes = reinterpret_cast<const uint8_t*>( in.constData() );
+
+    // keys, ids and signatures
+    if ( in.size() == 32 || in.size() == 64 )
+    {
+        QByteArray out( in.size() == 32 ? MAX_ENCODED_32 : MAX_ENCODED_64, Qt::Uninitialized );
+        out.resize( in.size() == 32 ? encode32( in_bytes, out.data() ) : encode64( in_bytes, out.data() ) );
+        return out;
+    }
+
+    // log(256)/log(58) is under 1.38, +1 for the zero byte
+    QByteArray out( in.size() * 138 / 100 +2, Qt::Uninitialized );
     size_t out_size = out.size();
 
     const bool result = b58enc( out.data(), &out_size, in.data(), in.size() );
@@ -20,16 +176,29 @@ QByteArray QBase58::encode( const QByteArray &in )
     }
 
     // shrink the buffer to get rid of the trailing bytes and zero byte
-    if ( (size_t) out.size() > out_size )
-        out.resize( out_size -1 ); // -1 for zero byte
+    out.resize( out_size -1 ); // -1 for zero byte
 
     return out;
 }
 
 QByteArray QBase58::decode( const QByteArray &in )
 {
-    QByteArray out;
-    out.resize( in.size() *2 );
+    // text that could be 32 or 64 bytes, anything else falls through to the generic decoder
+    if ( in.size() >= 32 && in.size() <= MAX_ENCODED_32 )
+    {
+        QByteArray out( 32, Qt::Uninitialized );
+        if ( decode32( in.constData(), in.size(), reinterpret_cast<uint8_t*>( out.data() ) ) )
+            return out;
+    }
+    else if ( in.size() >= 64 && in.size() <= MAX_ENCODED_64 )
+    {
+        QByteArray out( 64, Qt::Uninitialized );
+        if ( decode64( in.constData(), in.size(), reinterpret_cast<uint8_t*>( out.data() ) ) )
+            return out;
+    }
+
+    // each char is under 6 bits, so the output is never longer than the input
+    QByteArray out( in.size() +1, Qt::Uninitialized );
     size_t out_size = out.size();
 
     const bool result = b58tobin( out.data(), &out_size, in.data(), in.size() );
@@ -40,9 +209,6 @@ QByteArray QBase58::decode( const QByteArray &in )
         return QByteArray();
     }
 
-    // shrink the buffer to get rid of the preceeding bytes
-    if ( out_size < (size_t) out.size() )
-        out.remove( 0, ( in.size() *2 ) - out_size );
-
-    return out;
+    // the result is at the end of the buffer
+    return out.right( int( out_size ) );
 }
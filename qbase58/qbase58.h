@@ -3,10 +3,23 @@
 
 #include <QByteArray>
 
+#include <stdint.h>
+
 namespace QBase58
 {
+    // the longest base58 text of 32 and 64 bytes (keys and ids, signatures)
+    const int MAX_ENCODED_32 = 44;
+    const int MAX_ENCODED_64 = 88;
+
     QByteArray encode( const QByteArray &in );
     QByteArray decode( const QByteArray &in );
+
+    // fixed size codecs into the caller's buffer. encode returns the length written, decode returns false if the
+    // text has a bad char or isn't exactly that many bytes
+    int encode32( const uint8_t in[ 32 ], char out[ MAX_ENCODED_32 ] );
+    int encode64( const uint8_t in[ 64 ], char out[ MAX_ENCODED_64 ] );
+    bool decode32( const char *in, const int size, uint8_t out[ 32 ] );
+    bool decode64( const char *in, const int size, uint8_t out[ 64 ] );
 }
 
 #endif // QBASE58_H
@@ -1,6 +1,8 @@
 #include "qbase58_test.h"
 #include "qbase58.h"
 
+#include "../libbase58/libbase58.h"
+
 #include <QByteArray>
 
 void QBase58Test::test()
@@ -16,4 +18,41 @@ void QBase58Test::test()
     assert( QBase58::encode( QByteArray::fromHex( "0x0000287fb4cd" ) ) == "111233QC4" );
     assert( QBase58::encode( "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa" )
             == "3KkDZnpqFNhbEP9UY6aEka7Y7GeXv5ewVw2aoE3Y3mTG3Rgyu97ZzZwmFyGDc1F4AjwzpVPHqN4pceKnyRTRarHg7K3rP4ny2FvoMcmmR17B1H9Jmr2GQ4AFZAswHjEZDitDq2U2S2jcERKzU3UmbVtfA7Ct3XAExCBoHnNXMPt6t7HsABanmpf6tkfTGzNELUVQ5hPDswWYp5zYnAb45koPVQs2gnrmn925Sgox6Dkb2h6dbK2iBKfeKQsV9umbTLmW8Ddbpfcm657hHB8kCiYCDKFnYFynE38UrWS6qemoqVZhqD1XJyZiWZrp1YquobcAUwh8eZZaCna9Uqz8hktsZD3jnZXEkcLhvqTVQzKTDUsLMtcVTaticcYWR9iYz8wBaAdecXtdjsgREmKfb9mVddt9Uk4VgTwci3xBDV7Qf8TrxAyGouAXadzufsxU6B6U8tSigDoLyhfuNKPe6hRVXNGsRB1JwQrwTZ73GVv7UV74nC71Z4kV7Kv52AgCGjacVPHyaxSa227PH2XxrPFGp27Aq2yH8Y1yddUNUpAFbVkyHhG3wGp74pkayFmRMTZL5UJSFQBCprC99hx3uQs99wa5x67pzv2mbR3rxdMdxSBajwZ5189tpNj4BPHia3j2huwahSobYARcjCu6rg2Q8pLLWYMADHxzvM3dvEPJL49sSZh7HMtKJRphzdsWhf6SSgKrsAEYczmh78adk2ua3z8fhmDu2DFsewc3wUgrNAp8ts8DwQ8N2GTKbkDPJz2GcRupxgwX6Ckb3Q1wCjJiY5ZbQNfLmN3YkudCx3whQFJZzZKBuUHiwwHfmX6pfSmBZyrF8dmvh7XiuXAKxh61bT4u8ctL7eE4eFVsxxHj9ivbGQN5CuyJFNsQJNnDSYeLz62AD38QcE7NaxrXkpuQYhdT63M2BcL8BVbtpPQhenquNTSJNmy3bUhky2qLH9oU5py7rpfwWpggg" );
+
+    /// test the fixed size codecs against libbase58, with some leading zeros and 0xff runs
+    quint32 seed = 12345;
+    for ( int i = 0; i < 200; i++ )
+    {
+        const int size = i % 2 == 0 ? 32 : 64;
+        const int zeros = i % 7 == 0 ? i % size : 0;
+
+        uint8_t bytes[ 64 ];
+        for ( int j = 0; j < size; j++ )
+        {
+            seed = seed * 1103515245 + 12345;
+            bytes[ j ] = j < zeros ? 0 : i % 5 == 0 ? 0xff : uint8_t( seed >> 16 );
+        }
+
+        char expected[ 100 ];
+        size_t expected_size = sizeof( expected );
+        assert( b58enc( expected, &expected_size, bytes, size_t( size ) ) );
+        expected_size--; // zero byte
+
+        char encoded_fixed[ QBase58::MAX_ENCODED_64 ];
+        const int encoded_size = size == 32 ? QBase58::encode32( bytes, encoded_fixed ) : QBase58::encode64( bytes, encoded_fixed );
+        assert( QByteArray( encoded_fixed, encoded_size ) == QByteArray( expected, int( expected_size ) ) );
+
+        uint8_t decoded_fixed[ 64 ];
+        assert( size == 32 ? QBase58::decode32( expected, int( expected_size ), decoded_fixed )
+                           : QBase58::decode64( expected, int( expected_size ), decoded_fixed ) );
+        assert( QByteArray( reinterpret_cast<const char*>( decoded_fixed ), size ) == QByteArray( reinterpret_cast<const char*>( bytes ), size ) );
+    }
+
+    /// the fixed decoders only take exactly that many bytes
+    uint8_t out[ 32 ];
+    assert( QBase58::decode32( encoded.constData(), encoded.size(), out ) );
+    assert( !QBase58::decode32( encoded.mid( 3 ).constData(), encoded.size() -3, out ) ); // 31 bytes
+    assert( !QBase58::decode32( QByteArray( "1" + encoded ).constData(), encoded.size() +1, out ) ); // 33 bytes
+    assert( !QBase58::decode32( QByteArray( "0" + encoded.mid( 1 ) ).constData(), encoded.size(), out ) ); // bad char
+    assert( QBase58::decode( encoded.mid( 3 ) ).size() == 31 );
 }
@@ -1,6 +1,6 @@
 exists( daemon/keydefs.h ) {
     TEMPLATE = subdirs
-    SUBDIRS = cli/trader-cli.pro daemon/traderd.pro
+    SUBDIRS = cli/trader-cli.pro daemon/traderd.pro daemon/coinamount_bench.pro daemon/spruce_bench.pro daemon/qbase58_bench.pro daemon/trader-replay.pro daemon/trader-sweep.pro daemon/trader-journal.pro daemon/engine_bench.pro daemon/ipc_bench.pro daemon/perf_suite.pro
 } else {
     error( "keydefs.h doesn't exist. You must either: 1) Generate the file with 'python generate_keys.py', or 2) Copy the example file with 'cp daemon/keydefs.h.example daemon/keydefs.h' and manually fill in your keys, or if you don't want hardcoded keys: 3) Copy the example file, leave your keys blank, and use the cli command 'setkeyandsecret' at runtime." )
 }